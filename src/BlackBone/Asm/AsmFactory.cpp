@@ -0,0 +1,82 @@
+#include "AsmFactory.h"
+
+namespace blackbone
+{
+
+namespace
+{
+    /// <summary>
+    /// Released generators of current thread
+    /// </summary>
+    struct AsmCache
+    {
+        static constexpr size_t MaxCached = 4;      // Per architecture, enough for nested generation
+
+        ~AsmCache();
+
+        std::vector<std::unique_ptr<IAsmHelper>> helpers[2];
+    };
+
+    thread_local bool t_cacheDestroyed = false;
+    thread_local AsmCache t_cache;
+
+    AsmCache::~AsmCache()
+    {
+        t_cacheDestroyed = true;
+    }
+
+    /// <summary>
+    /// Get cache of current thread
+    /// </summary>
+    /// <returns>Cache, nullptr if thread is exiting and cache is already destroyed</returns>
+    AsmCache* ThreadCache()
+    {
+        return t_cacheDestroyed ? nullptr : &t_cache;
+    }
+}
+
+/// <summary>
+/// Get suitable asm generator
+/// </summary>
+/// <param name="arch">Desired CPU architecture</param>
+/// <returns>AsmHelperBase interface</returns>
+AsmHelperPtr AsmFactory::GetAssembler( eAsmArch arch )
+{
+    if (arch != asm32 && arch != asm64)
+        return nullptr;
+
+    auto cache = ThreadCache();
+    if (cache && !cache->helpers[arch].empty())
+    {
+        auto helper = std::move( cache->helpers[arch].back() );
+        cache->helpers[arch].pop_back();
+        return AsmHelperPtr( helper.release() );
+    }
+
+    if (arch == asm32)
+        return AsmHelperPtr( new AsmHelper32() );
+
+    return AsmHelperPtr( new AsmHelper64() );
+}
+
+/// <summary>
+/// Reset generator and put it into cache of current thread
+/// </summary>
+/// <param name="ptr">Generator</param>
+void AsmHelperDeleter::operator()( IAsmHelper* ptr ) const
+{
+    std::unique_ptr<IAsmHelper> helper( ptr );
+    auto cache = ThreadCache();
+    if (!helper || !cache)
+        return;
+
+    auto arch = helper->assembler()->getArch() == asmjit::kArchX86 ? AsmFactory::asm32 : AsmFactory::asm64;
+    auto& cached = cache->helpers[arch];
+    if (cached.size() >= AsmCache::MaxCached)
+        return;
+
+    helper->Reset();
+    cached.emplace_back( std::move( helper ) );
+}
+
+}
@@ -8,10 +8,20 @@
 namespace blackbone
 {
 
-using AsmHelperPtr = std::unique_ptr<IAsmHelper>;
+/// <summary>
+/// Returns released generator into per-thread cache instead of destroying it
+/// </summary>
+struct AsmHelperDeleter
+{
+    BLACKBONE_API void operator()( IAsmHelper* ptr ) const;
+};
+
+using AsmHelperPtr = std::unique_ptr<IAsmHelper, AsmHelperDeleter>;
 
 /// <summary>
-/// Get suitable asm generator
+/// Get suitable asm generator.
+/// Generators are reused: released ones are reset, keeping code buffer and zone memory,
+/// and cached per thread, so repeated code generation doesn't construct new assemblers
 /// </summary>
 class AsmFactory
 {
@@ -27,18 +37,7 @@ public:
     /// </summary>
     /// <param name="arch">Desired CPU architecture</param>
     /// <returns>AsmHelperBase interface</returns>
-    static AsmHelperPtr GetAssembler( eAsmArch arch )
-    {
-        switch (arch)
-        {
-        case asm32:
-            return std::make_unique<AsmHelper32>();
-        case asm64:
-            return std::make_unique<AsmHelper64>();
-        default:
-            return nullptr;
-        }
-    }
+    BLACKBONE_API static AsmHelperPtr GetAssembler( eAsmArch arch );
 
     /// <summary>
     /// Get suitable asm generator
@@ -79,9 +78,9 @@ public:
     static AsmHelperPtr GetAssembler()
     {
 #ifdef USE64
-        return std::make_unique<AsmHelper64>();
+        return GetAssembler( asm64 );
 #else
-        return std::make_unique<AsmHelper32>();
+        return GetAssembler( asm32 );
 #endif
     }
 };
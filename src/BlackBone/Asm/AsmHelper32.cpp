@@ -1,6 +1,5 @@
 #include "AsmHelper32.h"
 
-#include <set>
 #include <assert.h>
 
 namespace blackbone
@@ -61,9 +60,10 @@ void AsmHelper32::GenEpilogue( bool switchMode /*= false*/ , int retSize /*= -1
 /// <param name="pFN">Function pointer</param>
 /// <param name="args">Function arguments</param>
 /// <param name="cc">Calling convention</param>
-void AsmHelper32::GenCall( const AsmFunctionPtr& pFN, const std::vector<AsmVariant>& args, eCalligConvention cc /*= CC_stdcall*/ )
+void AsmHelper32::GenCall( const AsmFunctionPtr& pFN, AsmArgs args, eCalligConvention cc /*= CC_stdcall*/ )
 {
-    std::set<int> passedIdx;
+    // At most 2 arguments go into registers
+    int passedIdx[2] = { -1, -1 };
 
     // Pass arguments in registers
     // 64bit arguments are never passed in registers
@@ -72,7 +72,7 @@ void AsmHelper32::GenCall( const AsmFunctionPtr& pFN, const std::vector<AsmVaria
             if (args[i].reg86Compatible())
             {
                 PushArg( args[i], (eArgType)j );
-                passedIdx.emplace( i );
+                passedIdx[j] = i;
                 j++;
             }      
 
@@ -80,7 +80,7 @@ void AsmHelper32::GenCall( const AsmFunctionPtr& pFN, const std::vector<AsmVaria
     for (int i = (int)args.size() - 1; i >= 0; i--)
     {
         // Skip arguments passed in registers
-        if (passedIdx.count( i ) == 0)
+        if (passedIdx[0] != i && passedIdx[1] != i)
             PushArg( args[i] );
     }
  
@@ -88,8 +88,7 @@ void AsmHelper32::GenCall( const AsmFunctionPtr& pFN, const std::vector<AsmVaria
     if(pFN.type == AsmVariant::imm)
     {
         assert( pFN.imm_val64 <= std::numeric_limits<uint32_t>::max() );
-        _assembler.mov( asmjit::host::eax, pFN.imm_val );
-        _assembler.call( asmjit::host::eax );
+        CallImm( pFN.imm_val );
     }
     // Already in register
     else if (pFN.type == AsmVariant::reg)
@@ -135,8 +134,7 @@ void AsmHelper32::ExitThreadWithStatus( uint64_t pExitThread, uint64_t resultPtr
     // NtTerminateThread( NULL, eax );
     _assembler.push( asmjit::host::eax );
     _assembler.push( 0 );
-    _assembler.mov( asmjit::host::eax, pExitThread );
-    _assembler.call( asmjit::host::eax );
+    CallImm( pExitThread );
     
     _assembler.ret();
 }
@@ -181,8 +179,44 @@ void AsmHelper32::SaveRetValAndSignalEvent(
     _assembler.mov( asmjit::host::eax, EventPtr );
     _assembler.mov( asmjit::host::eax, asmjit::host::dword_ptr( asmjit::host::eax ) );
     _assembler.push( asmjit::host::eax );
-    _assembler.mov( asmjit::host::eax, pSetEvent );
-    _assembler.call( asmjit::host::eax );
+    CallImm( pSetEvent );
+}
+
+/// <summary>
+/// Emit direct calls, code must be relocated to codeBase
+/// </summary>
+/// <param name="codeBase">Final code address</param>
+void AsmHelper32::EnableCompactCode( uint64_t codeBase )
+{
+    _assembler.setBaseAddress( static_cast<asmjit::Ptr>(codeBase) );
+    _compact = true;
+}
+
+/// <summary>
+/// Drop generated code and disable compact code
+/// </summary>
+void AsmHelper32::Reset()
+{
+    IAsmHelper::Reset();
+    _compact = false;
+}
+
+/// <summary>
+/// Call function by address
+/// </summary>
+/// <param name="target">Function address</param>
+void AsmHelper32::CallImm( uint64_t target )
+{
+    // rel32 reaches whole 32 bit address space
+    if (_compact)
+    {
+        _assembler.call( static_cast<asmjit::Ptr>(target) );
+    }
+    else
+    {
+        _assembler.mov( asmjit::host::eax, target );
+        _assembler.call( asmjit::host::eax );
+    }
 }
 
 /// <summary>
@@ -33,7 +33,7 @@ public:
     /// <param name="pFN">Function pointer</param>
     /// <param name="args">Function arguments</param>
     /// <param name="cc">Calling convention</param>
-    virtual void GenCall( const AsmFunctionPtr& pFN, const std::vector<AsmVariant>& args, eCalligConvention cc = cc_stdcall );
+    virtual void GenCall( const AsmFunctionPtr& pFN, AsmArgs args, eCalligConvention cc = cc_stdcall );
 
     /// <summary>
     /// Save eax value and terminate current thread
@@ -64,6 +64,17 @@ public:
     /// <param name="">Unused</param>
     virtual void EnableX64CallStack( bool ) { }
 
+    /// <summary>
+    /// Emit direct calls, code must be relocated to codeBase
+    /// </summary>
+    /// <param name="codeBase">Final code address</param>
+    virtual void EnableCompactCode( uint64_t codeBase );
+
+    /// <summary>
+    /// Drop generated code and disable compact code
+    /// </summary>
+    virtual void Reset();
+
 private:
     AsmHelper32( const AsmHelper32& ) = delete;
     AsmHelper32& operator = (const AsmHelper32&) = delete;
@@ -82,6 +93,15 @@ private:
     /// <param name="index">Argument location</param>
     template<typename _Type>
     void PushArgp( _Type arg, eArgType index );
+
+    /// <summary>
+    /// Call function by address
+    /// </summary>
+    /// <param name="target">Function address</param>
+    void CallImm( uint64_t target );
+
+private:
+    bool _compact = false;  // Code address is known, calls are relative
 };
 
 }
@@ -67,7 +67,7 @@ void AsmHelper64::GenEpilogue( bool switchMode /*= false*/, int /*retSize = 0*/
 /// <param name="pFN">Function pointer</param>
 /// <param name="args">Function arguments</param>
 /// <param name="cc">Ignored</param>
-void AsmHelper64::GenCall( const AsmFunctionPtr& pFN, const std::vector<AsmVariant>& args, eCalligConvention /*cc = CC_stdcall*/ )
+void AsmHelper64::GenCall( const AsmFunctionPtr& pFN, AsmArgs args, eCalligConvention /*cc = CC_stdcall*/ )
 {
     //
     // reserve stack size (0x28 - minimal size for 4 registers and return address)
@@ -87,8 +87,7 @@ void AsmHelper64::GenCall( const AsmFunctionPtr& pFN, const std::vector<AsmVaria
 
     if (pFN.type == AsmVariant::imm)
     {
-        _assembler.mov( asmjit::host::rax, pFN.imm_val64 );
-        _assembler.call( asmjit::host::rax );
+        CallImm( pFN.imm_val64 );
     }
     else if (pFN.type == AsmVariant::reg)
     {
@@ -109,15 +108,11 @@ void AsmHelper64::GenCall( const AsmFunctionPtr& pFN, const std::vector<AsmVaria
 void AsmHelper64::ExitThreadWithStatus( uint64_t pExitThread, uint64_t resultPtr )
 {
     if (resultPtr != 0)
-    {
-        _assembler.mov( asmjit::host::rdx, resultPtr );
-        _assembler.mov( asmjit::host::dword_ptr( asmjit::host::rdx ), asmjit::host::rax );
-    }
+        _assembler.mov( AbsPtr( resultPtr, asmjit::host::rdx ), asmjit::host::rax );
 
     _assembler.mov( asmjit::host::rdx, asmjit::host::rax );
-    _assembler.mov( asmjit::host::rcx, 0 );
-    _assembler.mov( asmjit::host::rax, pExitThread );
-    _assembler.call( asmjit::host::rax );
+    LoadImm( asmjit::host::rcx, 0 );
+    CallImm( pExitThread );
 }
 
 /// <summary>
@@ -136,25 +131,20 @@ void AsmHelper64::SaveRetValAndSignalEvent(
     eReturnType rtype /*= rt_int32*/ 
     )
 {
-    _assembler.mov( asmjit::host::rcx, ResultPtr );
-
     // FPU value has been already saved
     if (rtype == rt_int64 || rtype == rt_int32)
-        _assembler.mov( asmjit::host::dword_ptr( asmjit::host::rcx ), asmjit::host::rax );
+        _assembler.mov( AbsPtr( ResultPtr, asmjit::host::rcx ), asmjit::host::rax );
 
     // Save last NT status
     _assembler.mov( asmjit::host::rdx, asmjit::host::dword_ptr_abs( 0x30 ).setSegment( asmjit::host::gs ) );    // TEB ptr
     _assembler.add( asmjit::host::rdx, 0x598 + 0x197 * sizeof( uint64_t ) );
     _assembler.mov( asmjit::host::rdx, asmjit::host::dword_ptr( asmjit::host::rdx ) );
-    _assembler.mov( asmjit::host::rax, lastStatusPtr );
-    _assembler.mov( asmjit::host::dword_ptr( asmjit::host::rax ), asmjit::host::rdx );
+    _assembler.mov( AbsPtr( lastStatusPtr, asmjit::host::rax ), asmjit::host::rdx );
 
     // NtSetEvent(hEvent, NULL)
-    _assembler.mov( asmjit::host::rax, EventPtr );
-    _assembler.mov( asmjit::host::rcx, asmjit::host::dword_ptr( asmjit::host::rax ) );
-    _assembler.mov( asmjit::host::rdx, 0 );
-    _assembler.mov( asmjit::host::rax, pSetEvent );
-    _assembler.call( asmjit::host::rax );
+    _assembler.mov( asmjit::host::rcx, AbsPtr( EventPtr, asmjit::host::rax ) );
+    LoadImm( asmjit::host::rdx, 0 );
+    CallImm( pSetEvent );
 }
 
 
@@ -170,6 +160,104 @@ void AsmHelper64::EnableX64CallStack( bool state )
     _stackEnabled = state;
 }
 
+/// <summary>
+/// Use short encodings: 32 bit immediates, direct calls and rip-relative addressing.
+/// Code must be relocated to codeBase
+/// </summary>
+/// <param name="codeBase">Final code address</param>
+void AsmHelper64::EnableCompactCode( uint64_t codeBase )
+{
+    _assembler.setBaseAddress( static_cast<asmjit::Ptr>(codeBase) );
+
+    // Label memory operands are encoded as [rip + disp32]
+    _base = _assembler.newLabel();
+    _assembler.bind( _base );
+    _baseAddress = codeBase + _assembler.getOffset();
+    _compact = true;
+}
+
+/// <summary>
+/// Drop generated code, restore default stack reservation policy and disable compact code
+/// </summary>
+void AsmHelper64::Reset()
+{
+    IAsmHelper::Reset();
+    _stackEnabled = true;
+    _compact = false;
+}
+
+/// <summary>
+/// Load immediate into register
+/// </summary>
+/// <param name="reg">Target register</param>
+/// <param name="value">Value</param>
+void AsmHelper64::LoadImm( const asmjit::GpReg& reg, uint64_t value )
+{
+    int32_t disp = 0;
+
+    // 32 bit mov zero-extends into full register
+    if (_compact && value <= 0xFFFFFFFF)
+        _assembler.mov( asmjit::host::gpd( reg.getRegIndex() ), static_cast<uint32_t>(value) );
+    else if (RipDisp( value, disp ))
+        _assembler.lea( reg, asmjit::host::ptr( _base, disp ) );
+    else
+        _assembler.mov( reg, value );
+}
+
+/// <summary>
+/// Call function by address
+/// </summary>
+/// <param name="target">Function address</param>
+void AsmHelper64::CallImm( uint64_t target )
+{
+    int32_t disp = 0;
+    if (RipDisp( target, disp ))
+    {
+        _assembler.call( static_cast<asmjit::Ptr>(target) );
+    }
+    else
+    {
+        _assembler.mov( asmjit::host::rax, target );
+        _assembler.call( asmjit::host::rax );
+    }
+}
+
+/// <summary>
+/// Get memory operand for absolute address
+/// </summary>
+/// <param name="address">Memory address</param>
+/// <param name="tmp">Register to hold address if it can't be reached rip-relative</param>
+/// <returns>Memory operand</returns>
+asmjit::Mem AsmHelper64::AbsPtr( uint64_t address, const asmjit::GpReg& tmp )
+{
+    int32_t disp = 0;
+    if (RipDisp( address, disp ))
+        return asmjit::host::dword_ptr( _base, disp );
+
+    _assembler.mov( tmp, address );
+    return asmjit::host::dword_ptr( tmp );
+}
+
+/// <summary>
+/// Get rip-relative displacement of address
+/// </summary>
+/// <param name="address">Target address</param>
+/// <param name="disp">Displacement from base label</param>
+/// <returns>true if address is reachable</returns>
+bool AsmHelper64::RipDisp( uint64_t address, int32_t& disp ) const
+{
+    if (!_compact)
+        return false;
+
+    // Leave room for code emitted after base label
+    int64_t distance = static_cast<int64_t>(address - _baseAddress);
+    if (distance <= INT32_MIN + 0x10000 || distance >= INT32_MAX - 0x10000)
+        return false;
+
+    disp = static_cast<int32_t>(distance);
+    return true;
+}
+
 /// <summary>
 /// Push function argument
 /// </summary>
@@ -236,16 +324,16 @@ void AsmHelper64::PushArgp( const _Type& arg, int32_t index, bool fpu /*= false*
         // Use XMM register
         if (fpu)
         {
-            _assembler.mov( asmjit::host::rax, arg );
+            LoadArg( asmjit::host::rax, arg );
             _assembler.movq( xregs[index], asmjit::host::rax );
         }
         else
-            _assembler.mov( regs[index], arg );
+            LoadArg( regs[index], arg );
     }
     // Pass on stack
     else
     {
-        _assembler.mov( asmjit::host::rax, arg );
+        LoadArg( asmjit::host::rax, arg );
         _assembler.mov( asmjit::host::qword_ptr( asmjit::host::rsp, index * sizeof( uint64_t ) ), asmjit::host::rax );
     }
 }
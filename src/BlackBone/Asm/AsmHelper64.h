@@ -31,7 +31,7 @@ public:
     /// <param name="pFN">Function pointer</param>
     /// <param name="args">Function arguments</param>
     /// <param name="cc">Ignored</param>
-    virtual void GenCall( const AsmFunctionPtr& pFN, const std::vector<AsmVariant>& args, eCalligConvention cc = cc_stdcall );
+    virtual void GenCall( const AsmFunctionPtr& pFN, AsmArgs args, eCalligConvention cc = cc_stdcall );
 
     /// <summary>
     /// Save rax value and terminate current thread
@@ -65,6 +65,18 @@ public:
     /// </param>
     virtual void EnableX64CallStack( bool state );
 
+    /// <summary>
+    /// Use short encodings: 32 bit immediates, direct calls and rip-relative addressing.
+    /// Code must be relocated to codeBase
+    /// </summary>
+    /// <param name="codeBase">Final code address</param>
+    virtual void EnableCompactCode( uint64_t codeBase );
+
+    /// <summary>
+    /// Drop generated code, restore default stack reservation policy and disable compact code
+    /// </summary>
+    virtual void Reset();
+
 private:
     AsmHelper64( const AsmHelper64& ) = delete;
     AsmHelper64& operator = (const AsmHelper64&) = delete;
@@ -85,8 +97,49 @@ private:
     template<typename _Type>
     void PushArgp( const _Type& arg, int32_t index, bool fpu = false );
 
+    /// <summary>
+    /// Load argument into register
+    /// </summary>
+    /// <param name="reg">Target register</param>
+    /// <param name="arg">Argument</param>
+    template<typename _Type>
+    void LoadArg( const asmjit::GpReg& reg, const _Type& arg ) { _assembler.mov( reg, arg ); }
+    void LoadArg( const asmjit::GpReg& reg, uint64_t arg ) { LoadImm( reg, arg ); }
+
+    /// <summary>
+    /// Load immediate into register
+    /// </summary>
+    /// <param name="reg">Target register</param>
+    /// <param name="value">Value</param>
+    void LoadImm( const asmjit::GpReg& reg, uint64_t value );
+
+    /// <summary>
+    /// Call function by address
+    /// </summary>
+    /// <param name="target">Function address</param>
+    void CallImm( uint64_t target );
+
+    /// <summary>
+    /// Get memory operand for absolute address
+    /// </summary>
+    /// <param name="address">Memory address</param>
+    /// <param name="tmp">Register to hold address if it can't be reached rip-relative</param>
+    /// <returns>Memory operand</returns>
+    asmjit::Mem AbsPtr( uint64_t address, const asmjit::GpReg& tmp );
+
+    /// <summary>
+    /// Get rip-relative displacement of address
+    /// </summary>
+    /// <param name="address">Target address</param>
+    /// <param name="disp">Displacement from base label</param>
+    /// <returns>true if address is reachable</returns>
+    bool RipDisp( uint64_t address, int32_t& disp ) const;
+
 private:
     bool _stackEnabled;     // if true - GenCall will allocate shadow stack space
+    bool _compact = false;  // Code address is known, short encodings are used
+    asmjit::Label _base;    // Label bound when compact code was enabled
+    uint64_t _baseAddress = 0;  // Address of base label
 };
 
 }
@@ -76,6 +76,100 @@ private:
     int32_t disp_ofst;              // Next variable stack offset
 };
 
+/// <summary>
+/// Stack frame with slot sizes declared up front.
+/// Layout matches AsmStackAllocator, but frame size is known before any code is emitted
+/// </summary>
+template<size_t... Sizes>
+class AsmStackFrame
+{
+    static_assert(sizeof...(Sizes) > 0, "Stack frame must have at least one slot");
+
+public:
+    static constexpr size_t Count = sizeof...(Sizes);      // Slot count
+
+    BLACKBONE_API AsmStackFrame( asmjit::X86Assembler* pAsm, int32_t baseval = 0x28 )
+        : _pAsm( pAsm )
+        , _x64( pAsm->getArch() == asmjit::kArch::kArchX64 )
+        , _base( _x64 ? baseval : static_cast<int32_t>(sizeof( uint64_t )) )
+    {
+    }
+
+    /// <summary>
+    /// Slot size aligned on word length
+    /// </summary>
+    /// <param name="index">Slot index</param>
+    /// <param name="x64">64 bit frame</param>
+    /// <returns>Size in bytes</returns>
+    static constexpr int32_t SlotSize( size_t index, bool x64 )
+    {
+        constexpr size_t sizes[] = { Sizes... };
+        const size_t word = x64 ? sizeof( uint64_t ) : sizeof( uint32_t );
+        return static_cast<int32_t>((sizes[index] + word - 1) & ~(word - 1));
+    }
+
+    /// <summary>
+    /// Slot offset relative to first slot
+    /// </summary>
+    /// <param name="index">Slot index, Count for end of last slot</param>
+    /// <param name="x64">64 bit frame</param>
+    /// <returns>Offset in bytes</returns>
+    static constexpr int32_t Offset( size_t index, bool x64 )
+    {
+        int32_t offset = 0;
+        for (size_t i = 0; i < index; i++)
+            offset += SlotSize( i, x64 );
+
+        return offset;
+    }
+
+    /// <summary>
+    /// Size of all slots including base offset
+    /// </summary>
+    /// <param name="x64">64 bit frame</param>
+    /// <param name="baseval">Base offset of 64 bit frame</param>
+    /// <returns>Size in bytes</returns>
+    static constexpr int32_t TotalSize( bool x64, int32_t baseval = 0x28 )
+    {
+        return (x64 ? baseval : static_cast<int32_t>(sizeof( uint64_t ))) + Offset( Count, x64 );
+    }
+
+    /// <summary>
+    /// Stack variable
+    /// </summary>
+    /// <returns>Variable memory object</returns>
+    template<size_t Index>
+    asmjit::Mem Get() const
+    {
+        static_assert(Index < Count, "Stack slot index out of range");
+
+        constexpr int32_t offset32 = Offset( Index, false ), offset64 = Offset( Index, true );
+        constexpr int32_t size32 = SlotSize( Index, false ), size64 = SlotSize( Index, true );
+
+        if (_x64)
+            return asmjit::Mem( _pAsm->zsp, _base + offset64, size64 );
+
+        return asmjit::Mem( _pAsm->zbp, -(_base + offset32) - size32, size32 );
+    }
+
+    /// <summary>
+    /// Get total size of all stack variables
+    /// </summary>
+    /// <returns>Size in bytes</returns>
+    BLACKBONE_API intptr_t getTotalSize() const { return _base + Offset( Count, _x64 ); }
+
+    /// <summary>
+    /// Get frame size aligned on 16 bytes
+    /// </summary>
+    /// <returns>Size in bytes</returns>
+    BLACKBONE_API int32_t getFrameSize() const { return (static_cast<int32_t>(getTotalSize()) + 0xF) & ~0xF; }
+
+private:
+    asmjit::X86Assembler* _pAsm;    // Underlying assembler
+    bool _x64;                      // 64 bit frame
+    int32_t _base;                  // First slot offset
+};
+
 //
 //  Helpers
 //
@@ -2,15 +2,19 @@
 
 
 #include "../Config.h"
+#include "../Misc/MemoryResource.h"
 #pragma warning(disable : 4100)
 #include "../../3rd_party/AsmJit/AsmJit.h"
 #pragma warning(default : 4100)
 
 #include <vector>
+#include <initializer_list>
 
 
 namespace blackbone
 {
+class MemBlock;
+
 /// <summary>
 /// General purpose assembly variable
 /// </summary>
@@ -28,6 +32,10 @@ struct AsmVariant
     template<typename T>
     static constexpr bool is_void_ptr = (std::is_pointer_v<T> && std::is_void_v<cleanup_t<T>>);
 
+    // Pointer or array to const data is never read back after call
+    template<typename T>
+    static constexpr bool is_const_data = std::is_const_v<std::remove_pointer_t<std::remove_extent_t<std::remove_reference_t<T>>>>;
+
     enum eType
     {
         noarg,          // void
@@ -42,7 +50,15 @@ struct AsmVariant
         mem_ptr         // pointer to stack variable
     };
 
+    // Size of by-value payloads stored inside variable itself
+    static constexpr size_t InlineSize = 32;
+
     template<typename T>
+    using not_variant_t = std::enable_if_t<!std::is_base_of_v<AsmVariant, std::decay_t<T>>>;
+
+    BLACKBONE_API AsmVariant() = default;
+
+    template<typename T, typename = not_variant_t<T>>
     AsmVariant( T&& arg )
     {
         using RAW_T = std::decay_t<T>;
@@ -53,20 +69,28 @@ struct AsmVariant
         {
             set( imm, argSize, static_cast<uint64_t>(arg) );
         }
+        // Remote memory block, passed as is
+        else if constexpr(std::is_same_v<RAW_T, MemBlock>)
+        {
+            *this = remote( arg.ptr() );
+        }
         // Array of elements
         else if constexpr(std::is_array_v<std::remove_reference_t<T>>)
         {
             set( dataPtr, sizeof( arg ), reinterpret_cast<uint64_t>(arg) );
+            output = !is_const_data<T>;
         }
         // char*, const char*, etc.
         else if constexpr(is_string_ptr<RAW_T, char>)
         {
             set( dataPtr, strlen( arg ) + 1, reinterpret_cast<uint64_t>(arg) );
+            output = !is_const_data<RAW_T>;
         }
         // wchar_t*, const wchar_t*, etc.
         else if constexpr(is_string_ptr<RAW_T, wchar_t>)
         {
             set( dataPtr, (wcslen( arg ) + 1) * sizeof( wchar_t ), reinterpret_cast<uint64_t>(arg) );
+            output = !is_const_data<RAW_T>;
         }
         // void*, const void*, etc.
         else if constexpr(is_void_ptr<RAW_T>)
@@ -87,6 +111,7 @@ struct AsmVariant
         else if constexpr(std::is_pointer_v<RAW_T>)
         {
             set( dataPtr, sizeof( cleanup_t<RAW_T> ), reinterpret_cast<uint64_t>(arg) );
+            output = !is_const_data<RAW_T>;
         }
         // Arbitrary variable passed by value
         // Can fit into register
@@ -98,9 +123,7 @@ struct AsmVariant
         }
         else
         {
-            buf.resize( argSize );
-            set( dataStruct, argSize, reinterpret_cast<uint64_t>(buf.data()) );
-            memcpy( buf.data(), &arg, argSize );
+            setData( &arg, argSize );
         }
     }
 
@@ -109,7 +132,45 @@ struct AsmVariant
     explicit AsmVariant( T* ptr, size_t size_ )
         : type( dataPtr )
         , size( size_ )
-        , imm_val64( reinterpret_cast<uint64_t>(ptr) ) { }
+        , imm_val64( reinterpret_cast<uint64_t>(ptr) )
+        , output( !std::is_const_v<T> ) { }
+
+    /// <summary>
+    /// Local buffer copied into target process, never read back
+    /// </summary>
+    /// <param name="ptr">Buffer</param>
+    /// <param name="size_">Buffer size</param>
+    /// <returns>Argument</returns>
+    static AsmVariant in( const void* ptr, size_t size_ )
+    {
+        AsmVariant var( ptr, size_ );
+        var.output = false;
+        return var;
+    }
+
+    /// <summary>
+    /// Local buffer copied into target process and read back after call
+    /// </summary>
+    /// <param name="ptr">Buffer</param>
+    /// <param name="size_">Buffer size</param>
+    /// <returns>Argument</returns>
+    static AsmVariant out( void* ptr, size_t size_ )
+    {
+        return AsmVariant( ptr, size_ );
+    }
+
+    /// <summary>
+    /// Memory already present in target process, e.g. allocated block or mapped shared buffer.
+    /// Address is passed as is, nothing is copied
+    /// </summary>
+    /// <param name="address">Target address</param>
+    /// <returns>Argument</returns>
+    static AsmVariant remote( uint64_t address )
+    {
+        AsmVariant var( 0 );
+        var.set( imm, address > 0xFFFFFFFF ? sizeof( uint64_t ) : sizeof( uint32_t ), address );
+        return var;
+    }
 
     BLACKBONE_API AsmVariant( float _imm_fpu )
         : type( imm_float )
@@ -141,9 +202,45 @@ struct AsmVariant
     BLACKBONE_API AsmVariant( const asmjit::Mem* _mem )
         : AsmVariant( const_cast<asmjit::Mem*>(_mem) ) { }
 
-    BLACKBONE_API AsmVariant( const AsmVariant& ) = default;
-    BLACKBONE_API AsmVariant( AsmVariant&& ) = default;
-    BLACKBONE_API AsmVariant& operator =( const AsmVariant& ) = default;
+    BLACKBONE_API AsmVariant( const AsmVariant& other )
+    {
+        *this = other;
+    }
+
+    BLACKBONE_API AsmVariant( AsmVariant&& other )
+    {
+        *this = std::move( other );
+    }
+
+    BLACKBONE_API AsmVariant& operator =( const AsmVariant& other )
+    {
+        if (this != &other)
+        {
+            bool owned = other.ownsData();
+            copyFields( other );
+            buf = other.buf;
+
+            if (owned)
+                imm_val64 = reinterpret_cast<uint64_t>(buf.empty() ? inline_buf : buf.data());
+        }
+
+        return *this;
+    }
+
+    BLACKBONE_API AsmVariant& operator =( AsmVariant&& other )
+    {
+        if (this != &other)
+        {
+            bool owned = other.ownsData();
+            copyFields( other );
+            buf = std::move( other.buf );
+
+            if (owned)
+                imm_val64 = reinterpret_cast<uint64_t>(buf.empty() ? inline_buf : buf.data());
+        }
+
+        return *this;
+    }
 
     //
     // Get floating point value as raw data
@@ -172,6 +269,39 @@ struct AsmVariant
         imm_val64 = val;
     }
 
+    /// <summary>
+    /// Store copy of value passed by value.
+    /// Small values are kept in inline buffer, heap is used only for large ones
+    /// </summary>
+    /// <param name="data">Value</param>
+    /// <param name="size_">Value size</param>
+    inline void setData( const void* data, size_t size_ )
+    {
+        uint8_t* ptr = inline_buf;
+        if (size_ > InlineSize)
+        {
+            buf.assign( reinterpret_cast<const uint8_t*>(data), reinterpret_cast<const uint8_t*>(data) + size_ );
+            ptr = buf.data();
+        }
+        else
+        {
+            buf.clear();
+            memcpy( inline_buf, data, size_ );
+        }
+
+        set( dataStruct, size_, reinterpret_cast<uint64_t>(ptr) );
+    }
+
+    /// <summary>
+    /// Check if value points into own storage
+    /// </summary>
+    /// <returns>true if value is stored inside variable</returns>
+    inline bool ownsData() const
+    {
+        return type == dataStruct && (imm_val64 == reinterpret_cast<uint64_t>(inline_buf)
+            || (!buf.empty() && imm_val64 == reinterpret_cast<uint64_t>(buf.data())));
+    }
+
     eType  type = noarg;    // Variable type
     size_t size = 0;        // Variable size
     asmjit::GpReg reg_val;  // General purpose register
@@ -188,9 +318,79 @@ struct AsmVariant
     };
 
     uint64_t new_imm_val = 0;       // Replaced immediate value for dataPtr type
-    std::vector<uint8_t> buf;       // Value buffer
+    bool output = true;             // dataPtr is read back after call
+    std::pmr::vector<uint8_t> buf{ TransientResource() };  // Value buffer for values larger than InlineSize
+    alignas(8) uint8_t inline_buf[InlineSize] = { 0 };     // Value buffer for small values
+
+private:
+    inline void copyFields( const AsmVariant& other )
+    {
+        type = other.type;
+        size = other.size;
+        reg_val = other.reg_val;
+        mem_val = other.mem_val;
+        imm_val64 = other.imm_val64;
+        new_imm_val = other.new_imm_val;
+        output = other.output;
+        memcpy( inline_buf, other.inline_buf, sizeof( inline_buf ) );
+    }
 };
 
+/// <summary>
+/// Non-owning list of call arguments.
+/// Binds to initializer list, vector or array, so argument lists are passed without copying
+/// </summary>
+template<typename T>
+class AsmArgSpan
+{
+public:
+    using value_type = std::remove_const_t<T>;
+
+    AsmArgSpan() = default;
+
+    AsmArgSpan( T* data, size_t count )
+        : _data( data )
+        , _count( count ) { }
+
+    AsmArgSpan( std::vector<value_type>& args )
+        : _data( args.data() )
+        , _count( args.size() ) { }
+
+    // Read-only span only
+    AsmArgSpan( const std::vector<value_type>& args )
+        : _data( args.data() )
+        , _count( args.size() ) { }
+
+    // Read-only span only. List storage lives until the end of full expression, enough for a single call
+    AsmArgSpan( std::initializer_list<value_type> args )
+        : _data( args.begin() )
+        , _count( args.size() ) { }
+
+    AsmArgSpan( const AsmArgSpan<value_type>& args )
+        : _data( args.begin() )
+        , _count( args.size() ) { }
+
+    template<size_t N>
+    AsmArgSpan( T( &args )[N] )
+        : _data( args )
+        , _count( N ) { }
+
+    T* begin() const { return _data; }
+    T* end() const   { return _data + _count; }
+
+    T& operator []( size_t idx ) const { return _data[idx]; }
+
+    size_t size() const { return _count; }
+    bool empty() const  { return _count == 0; }
+
+private:
+    T* _data = nullptr;
+    size_t _count = 0;
+};
+
+using AsmArgs       = AsmArgSpan<const AsmVariant>;    // Read-only arguments
+using AsmArgsInOut  = AsmArgSpan<AsmVariant>;          // Arguments updated during marshaling
+
 /// <summary>
 /// Remote function pointer
 /// </summary>
@@ -0,0 +1,286 @@
+#include "CodeRelocator.h"
+#include "LDasmCache.h"
+
+#include <algorithm>
+
+namespace blackbone
+{
+
+namespace
+{
+    /// <summary>
+    /// Branch kind
+    /// </summary>
+    enum eBranch
+    {
+        Branch_None = 0,    // Not a branch
+        Branch_Jmp,         // EB rel8, E9 rel32
+        Branch_Call,        // E8 rel32
+        Branch_Jcc,         // 7x rel8, 0F 8x rel32
+        Branch_Loop,        // E0-E3 rel8, no rel32 form
+    };
+
+    /// <summary>
+    /// Emit rel32 to target
+    /// </summary>
+    void PutRel32( std::vector<uint8_t>& out, ptr_t to, ptr_t target )
+    {
+        auto rel = static_cast<int32_t>(target - (to + out.size() + sizeof( int32_t )));
+        auto p = reinterpret_cast<const uint8_t*>(&rel);
+        out.insert( out.end(), p, p + sizeof( rel ) );
+    }
+
+    /// <summary>
+    /// Emit 'jmp [rip+0]' followed by absolute target
+    /// </summary>
+    void PutAbsJmp( std::vector<uint8_t>& out, ptr_t target )
+    {
+        const uint8_t jmp[] = { 0xFF, 0x25, 0x00, 0x00, 0x00, 0x00 };
+        out.insert( out.end(), jmp, jmp + sizeof( jmp ) );
+
+        auto p = reinterpret_cast<const uint8_t*>(&target);
+        out.insert( out.end(), p, p + sizeof( target ) );
+    }
+}
+
+/// <summary>
+/// Get relocated instruction offset
+/// </summary>
+/// <param name="offset">Original instruction offset</param>
+/// <returns>Relocated offset, -1 if offset is not an instruction start</returns>
+int32_t RelocatedCode::Translate( uint32_t offset ) const
+{
+    auto iter = std::lower_bound( offsets.begin(), offsets.end(), std::make_pair( offset, 0u ) );
+    if (iter == offsets.end() || iter->first != offset)
+        return -1;
+
+    return static_cast<int32_t>(iter->second);
+}
+
+/// <summary>
+/// Relocate whole instructions covering at least len bytes
+/// </summary>
+/// <param name="code">Code bytes</param>
+/// <param name="size">Number of available code bytes</param>
+/// <param name="from">Original code address</param>
+/// <param name="to">Relocated code address</param>
+/// <param name="len">Number of bytes to cover</param>
+/// <param name="is64">64 bit code</param>
+/// <param name="result">Relocated code</param>
+/// <returns>Status code</returns>
+NTSTATUS CodeRelocator::Relocate(
+    const uint8_t* code,
+    size_t size,
+    ptr_t from,
+    ptr_t to,
+    uint32_t len,
+    bool is64,
+    RelocatedCode& result
+    )
+{
+    result = RelocatedCode();
+
+    LdasmBlock block;
+    LdasmCache::Instance().Decode( from, code, size, len, is64, block );
+
+    // Pass 1: instruction bounds
+    uint32_t consumed = 0;
+    uint32_t count = 0;
+    for (; count < block.count && consumed < len; count++)
+    {
+        auto& ld = block.data[count];
+        if (block.lengths[count] == 0 || (ld.flags & F_INVALID) || consumed + block.lengths[count] > size)
+            return STATUS_ILLEGAL_INSTRUCTION;
+
+        // Function ends before requested length is covered
+        uint8_t opcode = code[consumed + ld.opcd_offset];
+        if (consumed + block.lengths[count] < len && (opcode == 0xC3 || opcode == 0xC2 || opcode == 0xCC))
+            return STATUS_BUFFER_TOO_SMALL;
+
+        consumed += block.lengths[count];
+    }
+
+    if (consumed < len)
+        return STATUS_ILLEGAL_INSTRUCTION;
+
+    auto inside = [&]( ptr_t target ) { return target >= from && target < from + consumed; };
+
+    // Relocated code is short, so distance to its start decides rel32 reach
+    auto reachable = [&]( ptr_t target )
+    {
+        if (!is64 || inside( target ))
+            return true;
+
+        int64_t distance = static_cast<int64_t>(target - to);
+        return distance > INT32_MIN + 0x1000 && distance < INT32_MAX - 0x1000;
+    };
+
+    // Pass 2: emit, internal branch targets are fixed up after all offsets are known
+    struct Fixup
+    {
+        size_t position;        // rel32 position in relocated code
+        uint32_t target;        // Original target offset
+    };
+
+    std::vector<Fixup> fixups;
+    auto& out = result.code;
+
+    for (uint32_t i = 0, offset = 0; i < count; offset += block.lengths[i], i++)
+    {
+        auto& ld = block.data[i];
+        auto ilen = block.lengths[i];
+        auto src = code + offset;
+        auto ip = from + offset + ilen;
+
+        result.offsets.emplace_back( offset, static_cast<uint32_t>(out.size()) );
+
+        if (!(ld.flags & F_RELATIVE))
+        {
+            out.insert( out.end(), src, src + ilen );
+            continue;
+        }
+
+        // [rip+disp32]
+        if ((ld.flags & F_MODRM) && (ld.modrm & 0xC7) == 0x05 && is64)
+        {
+            int32_t disp = 0;
+            memcpy( &disp, src + ld.disp_offset, sizeof( disp ) );
+
+            ptr_t target = ip + disp;
+            if (inside( target ))
+                return STATUS_NOT_SUPPORTED;
+
+            int64_t newDisp = static_cast<int64_t>(target - (to + out.size() + ilen));
+            if (newDisp != static_cast<int32_t>(newDisp))
+                return STATUS_NOT_SUPPORTED;
+
+            disp = static_cast<int32_t>(newDisp);
+            size_t pos = out.size();
+            out.insert( out.end(), src, src + ilen );
+            memcpy( out.data() + pos + ld.disp_offset, &disp, sizeof( disp ) );
+            continue;
+        }
+
+        // Branch operand
+        uint8_t op = src[ld.opcd_offset];
+        uint8_t cc = ld.opcd_size == 2 ? src[ld.opcd_offset + 1] & 0x0F : op & 0x0F;
+        eBranch kind = Branch_None;
+
+        if (ld.opcd_size == 1 && (op == 0xEB || op == 0xE9))
+            kind = Branch_Jmp;
+        else if (ld.opcd_size == 1 && op == 0xE8)
+            kind = Branch_Call;
+        else if (ld.opcd_size == 1 && op >= 0x70 && op <= 0x7F)
+            kind = Branch_Jcc;
+        else if (ld.opcd_size == 2 && src[ld.opcd_offset + 1] >= 0x80 && src[ld.opcd_offset + 1] <= 0x8F)
+            kind = Branch_Jcc;
+        else if (ld.opcd_size == 1 && op >= 0xE0 && op <= 0xE3)
+            kind = Branch_Loop;
+
+        // rel16 in 32 bit code truncates EIP
+        if (kind == Branch_None || (ld.imm_size != sizeof( int8_t ) && ld.imm_size != sizeof( int32_t )))
+            return STATUS_NOT_SUPPORTED;
+
+        int32_t rel = 0;
+        if (ld.imm_size == sizeof( int8_t ))
+            rel = static_cast<int8_t>(src[ld.imm_offset]);
+        else
+            memcpy( &rel, src + ld.imm_offset, sizeof( rel ) );
+
+        ptr_t target = is64 ? ip + rel : static_cast<uint32_t>(ip + rel);
+        bool inRange = reachable( target );
+
+        auto putTarget = [&]()
+        {
+            if (inside( target ))
+            {
+                fixups.push_back( { out.size(), static_cast<uint32_t>(target - from) } );
+                PutRel32( out, to, to );
+            }
+            else
+                PutRel32( out, to, target );
+        };
+
+        switch (kind)
+        {
+            case Branch_Jmp:
+                if (inRange)
+                {
+                    out.push_back( 0xE9 );
+                    putTarget();
+                }
+                else
+                    PutAbsJmp( out, target );
+                break;
+
+            case Branch_Call:
+                if (inRange)
+                {
+                    out.push_back( 0xE8 );
+                    putTarget();
+                }
+                else
+                {
+                    // call [rip+2]; jmp $+10; dq target
+                    const uint8_t call[] = { 0xFF, 0x15, 0x02, 0x00, 0x00, 0x00, 0xEB, 0x08 };
+                    out.insert( out.end(), call, call + sizeof( call ) );
+
+                    auto p = reinterpret_cast<const uint8_t*>(&target);
+                    out.insert( out.end(), p, p + sizeof( target ) );
+                }
+                break;
+
+            case Branch_Jcc:
+                if (inRange)
+                {
+                    out.push_back( 0x0F );
+                    out.push_back( 0x80 | cc );
+                    putTarget();
+                }
+                else
+                {
+                    // Inverted condition skips absolute jump
+                    out.push_back( 0x70 | (cc ^ 1) );
+                    out.push_back( 0x0E );
+                    PutAbsJmp( out, target );
+                }
+                break;
+
+            case Branch_Loop:
+                // loop $+4; jmp short over; jmp target
+                out.insert( out.end(), src, src + ld.opcd_offset );
+                out.push_back( op );
+                out.push_back( 0x02 );
+                out.push_back( 0xEB );
+                out.push_back( inRange ? 0x05 : 0x0E );
+
+                if (inRange)
+                {
+                    out.push_back( 0xE9 );
+                    putTarget();
+                }
+                else
+                    PutAbsJmp( out, target );
+                break;
+
+            default:
+                return STATUS_NOT_SUPPORTED;
+        }
+    }
+
+    // Branches into relocated instructions
+    for (auto& fixup : fixups)
+    {
+        int32_t newOffset = result.Translate( fixup.target );
+        if (newOffset < 0)
+            return STATUS_NOT_SUPPORTED;
+
+        auto rel = static_cast<int32_t>(newOffset - (fixup.position + sizeof( int32_t )));
+        memcpy( out.data() + fixup.position, &rel, sizeof( rel ) );
+    }
+
+    result.consumed = consumed;
+    return STATUS_SUCCESS;
+}
+
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "../Config.h"
+#include "../Include/Types.h"
+
+#include <vector>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Instructions moved to another address
+/// </summary>
+struct RelocatedCode
+{
+    std::vector<uint8_t> code;                                  // Relocated instructions
+    std::vector<std::pair<uint32_t, uint32_t>> offsets;         // Original instruction offset, relocated instruction offset
+    uint32_t consumed = 0;                                      // Original bytes covered
+
+    /// <summary>
+    /// Get relocated instruction offset
+    /// </summary>
+    /// <param name="offset">Original instruction offset</param>
+    /// <returns>Relocated offset, -1 if offset is not an instruction start</returns>
+    BLACKBONE_API int32_t Translate( uint32_t offset ) const;
+};
+
+/// <summary>
+/// Relocates whole instructions.
+/// Short branches are rewritten into rel32 forms, branches that can't be reached with rel32
+/// are rewritten into absolute jumps, [rip+disp32] operands are adjusted
+/// </summary>
+class CodeRelocator
+{
+public:
+    static constexpr uint32_t MaxGrowth = 9;        // Longest rewrite is 18 bytes for 2 byte instruction
+
+    /// <summary>
+    /// Maximum relocated size
+    /// </summary>
+    /// <param name="len">Number of bytes to cover</param>
+    /// <returns>Size in bytes</returns>
+    static constexpr uint32_t MaxSize( uint32_t len ) { return (len + 14) * MaxGrowth; }
+
+    /// <summary>
+    /// Relocate whole instructions covering at least len bytes
+    /// </summary>
+    /// <param name="code">Code bytes</param>
+    /// <param name="size">Number of available code bytes</param>
+    /// <param name="from">Original code address</param>
+    /// <param name="to">Relocated code address</param>
+    /// <param name="len">Number of bytes to cover</param>
+    /// <param name="is64">64 bit code</param>
+    /// <param name="result">Relocated code</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API static NTSTATUS Relocate(
+        const uint8_t* code,
+        size_t size,
+        ptr_t from,
+        ptr_t to,
+        uint32_t len,
+        bool is64,
+        RelocatedCode& result
+        );
+};
+
+}
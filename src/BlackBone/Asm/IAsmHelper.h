@@ -55,10 +55,23 @@ namespace blackbone
 
         virtual void GenPrologue( bool switchMode = false ) = 0;
         virtual void GenEpilogue( bool switchMode = false, int retSize = -1) = 0;
-        virtual void GenCall( const AsmFunctionPtr&, const std::vector<AsmVariant>& args, eCalligConvention cc = cc_stdcall ) = 0;
+        virtual void GenCall( const AsmFunctionPtr&, AsmArgs args, eCalligConvention cc = cc_stdcall ) = 0;
         virtual void ExitThreadWithStatus( uint64_t pExitThread, uint64_t resultPtr ) = 0;
         virtual void SaveRetValAndSignalEvent( uint64_t pSetEvent, uint64_t ResultPtr, uint64_t EventPtr, uint64_t errPtr, eReturnType rtype = rt_int32 ) = 0;
         virtual void EnableX64CallStack( bool state ) = 0;
+        virtual void EnableCompactCode( uint64_t codeBase ) = 0;
+
+        /// <summary>
+        /// Drop generated code and labels. Code buffer and zone memory are kept for reuse
+        /// </summary>
+        BLACKBONE_API virtual void Reset()
+        {
+            _assembler.reset( false );
+
+            // Code copied by make() is owned by runtime
+            if (_runtime.getMemMgr()->getUsedBytes() != 0)
+                _runtime.getMemMgr()->reset();
+        }
 
         /// <summary>
         /// Switch processor into WOW64 emulation mode
@@ -87,6 +100,40 @@ namespace blackbone
             _assembler.db( 0xCB );    // retf
         }
 
+        /// <summary>
+        /// Run long mode region from WOW64 code. Far call switches mode on entry and region returns with retf,
+        /// so any number of x64 calls inside region costs a single mode switch pair
+        /// </summary>
+        /// <param name="region">Region address, see GenX64RegionPrologue</param>
+        BLACKBONE_API void GenX64RegionCall( uint32_t region )
+        {
+            // call far 0x33:region
+            _assembler.db( 0x9A );
+            _assembler.dd( region );
+            _assembler.dw( 0x33 );
+        }
+
+        /// <summary>
+        /// Start long mode region. Stack is aligned like on x64 function entry
+        /// </summary>
+        BLACKBONE_API void GenX64RegionPrologue()
+        {
+            _assembler.push( asmjit::host::rbp );
+            _assembler.mov( asmjit::host::rbp, asmjit::host::rsp );
+            _assembler.and_( asmjit::host::rsp, -16 );
+            _assembler.sub( asmjit::host::rsp, 8 );
+        }
+
+        /// <summary>
+        /// End long mode region and return into WOW64 code
+        /// </summary>
+        BLACKBONE_API void GenX64RegionEpilogue()
+        {
+            _assembler.mov( asmjit::host::rsp, asmjit::host::rbp );
+            _assembler.pop( asmjit::host::rbp );
+            _assembler.db( 0xCB );    // retf
+        }
+
         BLACKBONE_API inline asmjit::X86Assembler* assembler() { return &_assembler; }
         BLACKBONE_API inline asmjit::X86Assembler* operator ->() { return &_assembler; }
 
@@ -771,6 +771,48 @@ unsigned int __fastcall ldasm( void *code, ldasm_data *ld, uint32_t is64 )
     return s;
 }
 
+unsigned int __fastcall ldasm_block( void *code, uint32_t len, uint8_t *lengths, ldasm_data *ld, uint32_t max_count, uint32_t is64 )
+/*
+ Description:
+ Disassemble instructions covering at least len bytes
+ 
+ Arguments: 
+ code      - pointer to the code for disassemble
+ len       - number of bytes to cover
+ lengths   - receives length of each instruction, can be NULL
+ ld        - receives data of each instruction, can be NULL
+ max_count - number of elements in lengths and ld
+ is64      - set this flag for 64-bit code, and clear for 32-bit
+ 
+ Return:
+ number of instructions, last one has F_INVALID flag set if decoding failed
+ */
+{
+    uint8_t *p = (uint8_t*)code;
+    uint32_t count = 0, total = 0;
+    ldasm_data tmp;
+    
+    /* dummy check */
+    if (!code)
+        return 0;
+    
+    while (total < len && count < max_count) {
+        ldasm_data *cur = ld ? &ld[count] : &tmp;
+        unsigned int s = ldasm( p + total, cur, is64 );
+        
+        if (lengths)
+            lengths[count] = (uint8_t)s;
+        count++;
+        
+        if (s == 0 || cur->flags & F_INVALID)
+            break;
+        
+        total += s;
+    }
+    
+    return count;
+}
+
 // Get function size
 unsigned long __fastcall SizeOfProc( void *Proc )
 {
@@ -40,6 +40,7 @@ typedef struct _ldasm_data
 } ldasm_data;
 
 BLACKBONE_API unsigned int  __fastcall ldasm( void *code, ldasm_data *ld, uint32_t is64 );
+BLACKBONE_API unsigned int  __fastcall ldasm_block( void *code, uint32_t len, uint8_t *lengths, ldasm_data *ld, uint32_t max_count, uint32_t is64 );
 BLACKBONE_API unsigned long __fastcall SizeOfProc( void *Proc );
 BLACKBONE_API void*         __fastcall ResolveJmp( void *Proc );
 
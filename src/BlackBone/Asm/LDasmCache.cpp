@@ -0,0 +1,66 @@
+#include "LDasmCache.h"
+
+#include <algorithm>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Process-wide cache
+/// </summary>
+LdasmCache& LdasmCache::Instance()
+{
+    static LdasmCache* cache = new LdasmCache();
+    return *cache;
+}
+
+/// <summary>
+/// Decode instructions covering at least len bytes
+/// </summary>
+/// <param name="address">Code address, local or remote</param>
+/// <param name="code">Code bytes</param>
+/// <param name="size">Number of available code bytes</param>
+/// <param name="len">Number of bytes to cover</param>
+/// <param name="is64">Decode 64 bit code</param>
+/// <param name="block">Decoded instructions</param>
+/// <returns>Instruction count</returns>
+uint32_t LdasmCache::Decode( ptr_t address, const uint8_t* code, size_t size, uint32_t len, bool is64, LdasmBlock& block )
+{
+    len = std::min( len, MaxBytes );
+
+    auto& entry = _entries[static_cast<size_t>((address * 0x9E3779B97F4A7C15ull) >> 32) & (Slots - 1)];
+
+    {
+        CSLock lck( _lock );
+
+        // Same code at the same place decodes the same way
+        if (entry.covered != 0 && entry.covered <= size && entry.address == address && entry.len == len && entry.is64 == is64
+            && memcmp( entry.code, code, entry.covered ) == 0)
+        {
+            block = entry.block;
+            return block.count;
+        }
+    }
+
+    block.count = ldasm_block( const_cast<uint8_t*>(code), len, block.lengths, block.data, LdasmBlock::MaxInstructions, is64 );
+
+    uint32_t covered = 0;
+    for (uint32_t i = 0; i < block.count; i++)
+        covered += block.lengths[i];
+
+    if (covered == 0 || covered > sizeof( entry.code ))
+        return block.count;
+
+    CSLock lck( _lock );
+
+    entry.address = address;
+    entry.len = len;
+    entry.covered = covered;
+    entry.is64 = is64;
+    entry.block = block;
+    memcpy( entry.code, code, covered );
+
+    return block.count;
+}
+
+}
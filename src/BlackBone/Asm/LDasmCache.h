@@ -0,0 +1,73 @@
+#pragma once
+
+#include "LDasm.h"
+#include "../Include/Types.h"
+#include "../Misc/Utils.h"
+
+namespace blackbone
+{
+
+/// <summary>
+/// Decoded instruction sequence
+/// </summary>
+struct LdasmBlock
+{
+    static constexpr uint32_t MaxInstructions = 16;
+
+    uint32_t count = 0;                             // Decoded instructions
+    uint8_t lengths[MaxInstructions] = { 0 };       // Instruction lengths
+    ldasm_data data[MaxInstructions] = { };         // Instruction data
+};
+
+/// <summary>
+/// Cache of decoded function prologues.
+/// Entry is keyed by code address and stores decoded bytes, so patched or reused code is decoded again
+/// </summary>
+class LdasmCache
+{
+public:
+    static constexpr uint32_t MaxBytes = 0x40;      // Longest cached sequence
+
+    /// <summary>
+    /// Process-wide cache
+    /// </summary>
+    BLACKBONE_API static LdasmCache& Instance();
+
+    /// <summary>
+    /// Decode instructions covering at least len bytes
+    /// </summary>
+    /// <param name="address">Code address, local or remote</param>
+    /// <param name="code">Code bytes</param>
+    /// <param name="size">Number of available code bytes</param>
+    /// <param name="len">Number of bytes to cover</param>
+    /// <param name="is64">Decode 64 bit code</param>
+    /// <param name="block">Decoded instructions</param>
+    /// <returns>Instruction count</returns>
+    BLACKBONE_API uint32_t Decode( ptr_t address, const uint8_t* code, size_t size, uint32_t len, bool is64, LdasmBlock& block );
+
+private:
+    LdasmCache() = default;
+    LdasmCache( const LdasmCache& ) = delete;
+    LdasmCache& operator =( const LdasmCache& ) = delete;
+
+    static constexpr size_t Slots = 256;
+
+    /// <summary>
+    /// Cached decode result
+    /// </summary>
+    struct Entry
+    {
+        ptr_t address = 0;              // Code address
+        uint32_t len = 0;               // Requested length
+        uint32_t covered = 0;           // Decoded bytes
+        bool is64 = false;              // 64 bit code
+        uint8_t code[MaxBytes + 16];    // Decoded bytes, last instruction can exceed MaxBytes
+        LdasmBlock block;               // Result
+    };
+
+private:
+    Entry _entries[Slots];              // Direct-mapped by address
+    CriticalSection _lock;
+};
+
+}
@@ -0,0 +1,173 @@
+#include "StubTemplate.h"
+#include "AsmFactory.h"
+#include "../Misc/Utils.h"
+
+#include <algorithm>
+#include <map>
+
+namespace blackbone
+{
+
+namespace
+{
+    /// <summary>
+    /// Process-wide template cache. Templates are never released
+    /// </summary>
+    struct StubTemplates
+    {
+        CriticalSection lock;
+        std::map<std::pair<bool, StubTemplate::Key>, std::unique_ptr<StubTemplate>> templates;  // Failed keys map to nullptr
+    };
+
+    StubTemplates& Templates()
+    {
+        static StubTemplates* templates = new StubTemplates();
+        return *templates;
+    }
+
+    /// <summary>
+    /// Make placeholder immediate
+    /// </summary>
+    /// <param name="x86">4 byte placeholder</param>
+    /// <param name="marker">Placeholder tag</param>
+    /// <param name="index">Value index</param>
+    /// <param name="addend">Constant added to value</param>
+    /// <returns>Placeholder</returns>
+    uint64_t Placeholder( bool x86, uint16_t marker, size_t index, uint32_t addend )
+    {
+        if (x86)
+            return (static_cast<uint64_t>(marker) << 16) | (static_cast<uint64_t>(index) << 12) | addend;
+
+        return (static_cast<uint64_t>(marker) << 48) | (static_cast<uint64_t>(index) << 32) | 0x5A5A0000 | addend;
+    }
+}
+
+/// <summary>
+/// Get immediate
+/// </summary>
+/// <param name="index">Value index</param>
+/// <param name="addend">Constant added to value, e.g. slot offset</param>
+/// <returns>Value or placeholder</returns>
+uint64_t StubValues::operator()( size_t index, uint32_t addend /*= 0*/ ) const
+{
+    if (_marker == 0)
+        return index < _count ? _values[index] + addend : 0;
+
+    // Index and addend must fit into placeholder
+    if (_x86 ? (index >= 0x10 || addend >= 0x1000) : (index >= 0x10000 || addend >= 0x10000))
+        _valid = false;
+
+    _used.emplace_back( index, addend );
+    return Placeholder( _x86, _marker, index, addend );
+}
+
+/// <summary>
+/// Get cached template, template is generated on first use
+/// </summary>
+/// <param name="key">Template key</param>
+/// <param name="x86">Generate x86 code</param>
+/// <param name="generate">Code generator, must use values for every variable immediate</param>
+/// <returns>Template, nullptr if code can't be patched</returns>
+const StubTemplate* StubTemplate::Get( const Key& key, bool x86, const fnGenerate& generate )
+{
+    auto& cache = Templates();
+    CSLock lck( cache.lock );
+
+    auto iter = cache.templates.find( std::make_pair( x86, key ) );
+    if (iter == cache.templates.end())
+        iter = cache.templates.emplace( std::make_pair( x86, key ), Build( x86, generate ) ).first;
+
+    return iter->second.get();
+}
+
+/// <summary>
+/// Copy code and patch immediates
+/// </summary>
+/// <param name="dst">Destination buffer, at least size() bytes</param>
+/// <param name="values">Immediate values</param>
+/// <param name="count">Value count</param>
+void StubTemplate::Emit( void* dst, const uint64_t* values, size_t count ) const
+{
+    auto code = reinterpret_cast<uint8_t*>(dst);
+    memcpy( code, _code.data(), _code.size() );
+
+    for (auto& patch : _patches)
+    {
+        uint64_t value = patch.index < count ? values[patch.index] + patch.addend : 0;
+        memcpy( code + patch.offset, &value, _width );
+    }
+}
+
+/// <summary>
+/// Generate code and locate placeholders.
+/// Code is generated twice with different placeholders, so every immediate is confirmed
+/// and any other code depending on immediate values is detected
+/// </summary>
+/// <param name="x86">Generate x86 code</param>
+/// <param name="generate">Code generator</param>
+/// <returns>Template, nullptr if some immediate can't be located</returns>
+std::unique_ptr<StubTemplate> StubTemplate::Build( bool x86, const fnGenerate& generate )
+{
+    const uint16_t markers[] = { 0xC0DE, 0xBEEF };
+    StubValues values[] = { StubValues( x86, markers[0] ), StubValues( x86, markers[1] ) };
+    std::vector<uint8_t> code[2];
+
+    for (size_t i = 0; i < _countof( values ); i++)
+    {
+        auto a = AsmFactory::GetAssembler( x86 ? AsmFactory::asm32 : AsmFactory::asm64 );
+        generate( *a, values[i] );
+        if (!values[i]._valid)
+            return nullptr;
+
+        code[i].resize( (*a)->getCodeSize() );
+        (*a)->relocCode( code[i].data() );
+    }
+
+    if (code[0].empty() || code[0].size() != code[1].size() || values[0]._used != values[1]._used)
+        return nullptr;
+
+    auto used = values[0]._used;
+    std::sort( used.begin(), used.end() );
+    used.erase( std::unique( used.begin(), used.end() ), used.end() );
+
+    auto tmpl = std::make_unique<StubTemplate>();
+    tmpl->_width = x86 ? sizeof( uint32_t ) : sizeof( uint64_t );
+
+    std::vector<bool> patched( code[0].size() );
+    for (auto& [index, addend] : used)
+    {
+        uint64_t first = Placeholder( x86, markers[0], index, addend );
+        uint64_t second = Placeholder( x86, markers[1], index, addend );
+        size_t found = 0;
+
+        for (size_t offset = 0; offset + tmpl->_width <= code[0].size(); offset++)
+        {
+            if (memcmp( code[0].data() + offset, &first, tmpl->_width ) != 0)
+                continue;
+
+            if (memcmp( code[1].data() + offset, &second, tmpl->_width ) != 0)
+                return nullptr;
+
+            tmpl->_patches.push_back( { offset, index, addend } );
+            std::fill_n( patched.begin() + offset, tmpl->_width, true );
+
+            found++;
+            offset += tmpl->_width - 1;
+        }
+
+        if (found == 0)
+            return nullptr;
+    }
+
+    // Immediate affected something besides itself, e.g. instruction encoding
+    for (size_t i = 0; i < code[0].size(); i++)
+    {
+        if (code[0][i] != code[1][i] && !patched[i])
+            return nullptr;
+    }
+
+    tmpl->_code = std::move( code[0] );
+    return tmpl;
+}
+
+}
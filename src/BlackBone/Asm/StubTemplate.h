@@ -0,0 +1,111 @@
+#pragma once
+
+#include "IAsmHelper.h"
+
+#include <functional>
+#include <memory>
+#include <tuple>
+#include <vector>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Immediate values for stub generation.
+/// While template is built, placeholders are returned instead of real values
+/// </summary>
+class StubValues
+{
+public:
+    /// <summary>
+    /// Real values
+    /// </summary>
+    /// <param name="values">Values</param>
+    /// <param name="count">Value count</param>
+    BLACKBONE_API StubValues( const uint64_t* values, size_t count )
+        : _values( values )
+        , _count( count ) { }
+
+    /// <summary>
+    /// Get immediate
+    /// </summary>
+    /// <param name="index">Value index</param>
+    /// <param name="addend">Constant added to value, e.g. slot offset</param>
+    /// <returns>Value or placeholder</returns>
+    BLACKBONE_API uint64_t operator()( size_t index, uint32_t addend = 0 ) const;
+
+private:
+    friend class StubTemplate;
+
+    StubValues( bool x86, uint16_t marker )
+        : _x86( x86 )
+        , _marker( marker ) { }
+
+    const uint64_t* _values = nullptr;  // Real values
+    size_t _count = 0;                  // Real value count
+    bool _x86 = false;                  // Placeholder width is 4 bytes
+    uint16_t _marker = 0;               // Placeholder tag, 0 if real values are used
+    mutable std::vector<std::pair<size_t, uint32_t>> _used;     // Requested placeholders
+    mutable bool _valid = true;         // All placeholders can be encoded
+};
+
+/// <summary>
+/// Stub machine code generated once with placeholder immediates.
+/// Emitting stub is a copy with immediates patched in, no assembler pass is needed.
+/// Generated code must not depend on its address, e.g. only register calls and labels can be used
+/// </summary>
+class StubTemplate
+{
+public:
+    using Key = std::tuple<int, eCalligConvention, eReturnType, size_t>;   // Stub kind, calling convention, return type, argument count
+    using fnGenerate = std::function<void( IAsmHelper& a, const StubValues& values )>;
+
+    /// <summary>
+    /// Get cached template, template is generated on first use
+    /// </summary>
+    /// <param name="key">Template key</param>
+    /// <param name="x86">Generate x86 code</param>
+    /// <param name="generate">Code generator, must use values for every variable immediate</param>
+    /// <returns>Template, nullptr if code can't be patched</returns>
+    BLACKBONE_API static const StubTemplate* Get( const Key& key, bool x86, const fnGenerate& generate );
+
+    /// <summary>
+    /// Copy code and patch immediates
+    /// </summary>
+    /// <param name="dst">Destination buffer, at least size() bytes</param>
+    /// <param name="values">Immediate values</param>
+    /// <param name="count">Value count</param>
+    BLACKBONE_API void Emit( void* dst, const uint64_t* values, size_t count ) const;
+
+    /// <summary>
+    /// Code size
+    /// </summary>
+    /// <returns>Size in bytes</returns>
+    BLACKBONE_API size_t size() const { return _code.size(); }
+
+private:
+    /// <summary>
+    /// Immediate location
+    /// </summary>
+    struct Patch
+    {
+        size_t offset;      // Offset in code
+        size_t index;       // Value index
+        uint32_t addend;    // Constant added to value
+    };
+
+    /// <summary>
+    /// Generate code and locate placeholders
+    /// </summary>
+    /// <param name="x86">Generate x86 code</param>
+    /// <param name="generate">Code generator</param>
+    /// <returns>Template, nullptr if some immediate can't be located</returns>
+    static std::unique_ptr<StubTemplate> Build( bool x86, const fnGenerate& generate );
+
+private:
+    std::vector<uint8_t> _code;         // Code with placeholders
+    std::vector<Patch> _patches;        // Immediate locations
+    size_t _width = 0;                  // Immediate size
+};
+
+}
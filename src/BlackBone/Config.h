@@ -26,6 +26,16 @@
     #error "Unknown or unsupported compiler"
 #endif
 
+// Coroutine task layer requires C++20
+#if defined(__cpp_impl_coroutine)
+    #define BLACKBONE_COROUTINES
+#endif
+
+// Compile-time signature literals require consteval and class type template arguments
+#if defined(__cpp_consteval) && defined(__cpp_nontype_template_args) && __cpp_nontype_template_args >= 201911L
+    #define BLACKBONE_SIGNATURE_LITERALS
+#endif
+
 // No IA64 support
 #if defined (_M_AMD64) || defined (__x86_64__)
     #define USE64
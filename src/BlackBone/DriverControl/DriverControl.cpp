@@ -5,11 +5,26 @@
 
 #include <3rd_party/VersionApi.h>
 
+#include <algorithm>
+
 namespace blackbone
 {
 
 #define DRIVER_SVC_NAME L"BlackBone"
 
+/// <summary>
+/// Pending asynchronous request. Input and output buffers live until completion
+/// </summary>
+struct DriverControl::AsyncRequest : OVERLAPPED
+{
+    DWORD code = 0;                                                     // IOCTL code
+    std::vector<uint8_t> input;                                         // Input buffer
+    std::vector<uint8_t> output;                                        // Output buffer
+    std::function<void( NTSTATUS status, AsyncRequest& self )> complete;  // Completion handler
+
+    AsyncRequest() : OVERLAPPED{ } { }
+};
+
 DriverControl::DriverControl()
 {
 }
@@ -25,6 +40,92 @@ DriverControl& DriverControl::Instance()
     return instance;
 }
 
+CommandRing::~CommandRing()
+{
+    DriverControl::Instance().DestroyRing( *this );
+}
+
+/// <summary>
+/// Queue memory copy. Ring is flushed first if it is full
+/// </summary>
+/// <param name="pid">Target PID or target handle</param>
+/// <param name="target">Target address</param>
+/// <param name="local">Local buffer, must stay valid until Flush</param>
+/// <param name="size">Range size</param>
+/// <param name="write">true to write into target, false to read</param>
+/// <param name="pStatus">Optional copy status, filled by Flush</param>
+/// <returns>Status code</returns>
+NTSTATUS CommandRing::Push( DWORD pid, ptr_t target, void* local, ptr_t size, bool write, NTSTATUS* pStatus /*= nullptr*/ )
+{
+    if (!valid())
+        return STATUS_INVALID_HANDLE;
+
+    // No free slots
+    if (_head - _completed == BLACKBONE_RING_ENTRIES)
+    {
+        NTSTATUS status = Flush();
+        if (status == STATUS_TIMEOUT)
+            return status;
+    }
+
+    auto slot = _head & (BLACKBONE_RING_ENTRIES - 1);
+    auto& entry = _ring->entries[slot];
+
+    entry.localbuf = reinterpret_cast<ULONGLONG>(local);
+    entry.targetPtr = target;
+    entry.size = size;
+    entry.pid = pid;
+    entry.write = write;
+    entry.status = STATUS_PENDING;
+
+    _results[slot] = pStatus;
+    _head++;
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Publish queued commands and wait until driver executes all of them
+/// </summary>
+/// <param name="timeout">Wait timeout in milliseconds</param>
+/// <returns>STATUS_SUCCESS if all commands succeeded, otherwise status of first failed command</returns>
+NTSTATUS CommandRing::Flush( DWORD timeout /*= INFINITE*/ )
+{
+    NTSTATUS result = STATUS_SUCCESS;
+
+    if (!valid())
+        return STATUS_INVALID_HANDLE;
+
+    if (_head == _completed)
+        return STATUS_SUCCESS;
+
+    // Entries must be visible before head
+    InterlockedExchange( &_ring->head, _head );
+    SetEvent( _hRequest );
+
+    while (InterlockedCompareExchange( &_ring->tail, 0, 0 ) - _head < 0)
+    {
+        if (WaitForSingleObject( _hComplete, timeout ) != WAIT_OBJECT_0)
+            return STATUS_TIMEOUT;
+    }
+
+    for (; _completed != _head; _completed++)
+    {
+        auto slot = _completed & (BLACKBONE_RING_ENTRIES - 1);
+        NTSTATUS status = _ring->entries[slot].status;
+
+        if (_results[slot])
+            *_results[slot] = status;
+
+        if (NT_SUCCESS( result ) && !NT_SUCCESS( status ))
+            result = status;
+
+        _results[slot] = nullptr;
+    }
+
+    return result;
+}
+
 /// <summary>
 /// Try to load driver if it isn't loaded
 /// </summary>
@@ -109,6 +210,12 @@ NTSTATUS DriverControl::Reload( std::wstring path /*= L"" */ )
 /// <returns>Status code</returns>
 NTSTATUS DriverControl::Unload()
 {
+    {
+        std::lock_guard<std::mutex> lg( _asyncLock );
+        _hPort.reset();
+        _hAsyncDriver.reset();
+    }
+
     _hDriver.reset();
     return UnloadDriver( DRIVER_SVC_NAME );
 }
@@ -121,14 +228,16 @@ NTSTATUS DriverControl::Unload()
 /// <param name="pipeName">Pipe name to use for hook data transfer</param>
 /// <param name="mapSections">The map sections.</param>
 /// <param name="result">Results</param>
+/// <param name="lazy">Only record regions, they are mapped with MapMemoryRegion on demand and reported with zero address until then</param>
 /// <returns>Status code </returns>
-NTSTATUS DriverControl::MapMemory( DWORD pid, const std::wstring& pipeName, bool mapSections, MapMemoryResult& result )
+NTSTATUS DriverControl::MapMemory( DWORD pid, const std::wstring& pipeName, bool mapSections, MapMemoryResult& result, bool lazy /*= false*/ )
 {
     MAP_MEMORY data = { 0 };
     DWORD bytes = 0;
     ULONG sizeRequired = 0;
     data.pid = pid;
     data.mapSections = mapSections;
+    data.lazy = lazy;
 
     // Not loaded
     if (_hDriver == INVALID_HANDLE_VALUE)
@@ -136,12 +245,12 @@ NTSTATUS DriverControl::MapMemory( DWORD pid, const std::wstring& pipeName, bool
 
     wcscpy_s( data.pipeName, pipeName.c_str() );
 
-    BOOL res = DeviceIoControl( _hDriver, IOCTL_BLACKBONE_MAP_MEMORY, &data, sizeof( data ), &sizeRequired, sizeof( sizeRequired ), &bytes, NULL );
+    BOOL res = Ioctl( IOCTL_BLACKBONE_MAP_MEMORY, &data, sizeof( data ), &sizeRequired, sizeof( sizeRequired ), &bytes );
     if (res != FALSE && bytes == 4)
     {
         MAP_MEMORY_RESULT* pResult = (MAP_MEMORY_RESULT*)malloc( sizeRequired );
 
-        if (DeviceIoControl( _hDriver, IOCTL_BLACKBONE_MAP_MEMORY, &data, sizeof( data ), pResult, sizeRequired, &bytes, NULL ))
+        if (Ioctl( IOCTL_BLACKBONE_MAP_MEMORY, &data, sizeof( data ), pResult, sizeRequired, &bytes ))
         {
             for (ULONG i = 0; i < pResult->count; i++)
                 result.regions.emplace( std::make_pair( std::make_pair( pResult->entries[i].originalPtr, pResult->entries[i].size ),
@@ -181,7 +290,7 @@ NTSTATUS DriverControl::MapMemoryRegion( DWORD pid, ptr_t base, uint32_t size, M
     data.base = base;
     data.size = size;
 
-    if (DeviceIoControl( _hDriver, IOCTL_BLACKBONE_MAP_REGION, &data, sizeof( data ), &mapResult, sizeof( mapResult ), &bytes, NULL ))
+    if (Ioctl( IOCTL_BLACKBONE_MAP_REGION, &data, sizeof( data ), &mapResult, sizeof( mapResult ), &bytes ))
     {
         result.newPtr = mapResult.newPtr;
         result.originalPtr = mapResult.originalPtr;
@@ -195,6 +304,49 @@ NTSTATUS DriverControl::MapMemoryRegion( DWORD pid, ptr_t base, uint32_t size, M
     return LastNtStatus();
 }
 
+/// <summary>
+/// Sync memory mapped with MapMemory with current target address space.
+/// Only regions that were released or allocated since last sync are unmapped or mapped
+/// </summary>
+/// <param name="pid">Target PID</param>
+/// <param name="mapSections">Map new section objects</param>
+/// <param name="result">Removed and added regions</param>
+/// <returns>Status code</returns>
+NTSTATUS DriverControl::RefreshMemoryMap( DWORD pid, bool mapSections, RemapRefreshResult& result )
+{
+    // Delta is applied by driver before output is written, so request can't be repeated with bigger buffer
+    constexpr ULONG maxEntries = 1024;
+
+    REMAP_REFRESH data = { 0 };
+    DWORD bytes = 0;
+
+    // Not loaded
+    if (_hDriver == INVALID_HANDLE_VALUE)
+        return STATUS_DEVICE_DOES_NOT_EXIST;
+
+    data.pid = pid;
+    data.mapSections = mapSections;
+
+    std::vector<uint8_t> buf( FIELD_OFFSET( REMAP_REFRESH_RESULT, entries ) + maxEntries * sizeof( MAP_MEMORY_RESULT_ENTRY ) );
+    auto pResult = reinterpret_cast<REMAP_REFRESH_RESULT*>( buf.data() );
+
+    if (!Ioctl( IOCTL_BLACKBONE_REMAP_REFRESH, &data, sizeof( data ), buf.data(), static_cast<DWORD>(buf.size()), &bytes ))
+        return LastNtStatus();
+
+    result.removed.clear();
+    result.added.clear();
+
+    for (ULONG i = 0; i < pResult->count; i++)
+    {
+        auto& entry = pResult->entries[i];
+        auto& target = i < pResult->removed ? result.removed : result.added;
+        target.emplace( std::make_pair( std::make_pair( entry.originalPtr, entry.size ), entry.newPtr ) );
+    }
+
+    result.complete = pResult->count == pResult->removed + pResult->added;
+    return STATUS_SUCCESS;
+}
+
 /// <summary>
 /// Unmap memory of the target process from current
 /// </summary>
@@ -209,7 +361,7 @@ NTSTATUS DriverControl::UnmapMemory( DWORD pid )
     if (_hDriver == INVALID_HANDLE_VALUE)
         return STATUS_DEVICE_DOES_NOT_EXIST;
 
-    if (DeviceIoControl( _hDriver, IOCTL_BLACKBONE_UNMAP_MEMORY, &data, sizeof( data ), NULL, 0, &bytes, NULL ))
+    if (Ioctl( IOCTL_BLACKBONE_UNMAP_MEMORY, &data, sizeof( data ), NULL, 0, &bytes ))
         return STATUS_SUCCESS;
 
     return LastNtStatus();
@@ -238,7 +390,7 @@ NTSTATUS DriverControl::UnmapMemoryRegion( DWORD pid, ptr_t base, uint32_t size
     if (_hDriver == INVALID_HANDLE_VALUE)
         return STATUS_DEVICE_DOES_NOT_EXIST;
 
-    if (!DeviceIoControl( _hDriver, IOCTL_BLACKBONE_UNMAP_REGION, &data, sizeof( data ), NULL, 0, &bytes, NULL ))
+    if (!Ioctl( IOCTL_BLACKBONE_UNMAP_REGION, &data, sizeof( data ), NULL, 0, &bytes ))
         return LastNtStatus();
 
     return STATUS_SUCCESS;
@@ -260,7 +412,7 @@ NTSTATUS DriverControl::DisableDEP( DWORD pid )
     if (_hDriver == INVALID_HANDLE_VALUE)
         return STATUS_DEVICE_DOES_NOT_EXIST;
 
-    if (!DeviceIoControl( _hDriver, IOCTL_BLACKBONE_DISABLE_DEP, &disableDep, sizeof( disableDep ), nullptr, 0, &bytes, NULL ))
+    if (!Ioctl( IOCTL_BLACKBONE_DISABLE_DEP, &disableDep, sizeof( disableDep ), nullptr, 0, &bytes ))
         return LastNtStatus();
 
     return STATUS_SUCCESS;
@@ -288,7 +440,7 @@ NTSTATUS DriverControl::ProtectProcess(
     if (_hDriver == INVALID_HANDLE_VALUE)
         return STATUS_DEVICE_DOES_NOT_EXIST;
 
-    if (!DeviceIoControl( _hDriver, IOCTL_BLACKBONE_SET_PROTECTION, &setProt, sizeof( setProt ), nullptr, 0, &bytes, NULL ))
+    if (!Ioctl( IOCTL_BLACKBONE_SET_PROTECTION, &setProt, sizeof( setProt ), nullptr, 0, &bytes ))
         return LastNtStatus();
 
     return STATUS_SUCCESS;
@@ -314,7 +466,7 @@ NTSTATUS DriverControl::PromoteHandle( DWORD pid, HANDLE handle, DWORD access )
     if (_hDriver == INVALID_HANDLE_VALUE)
         return STATUS_DEVICE_DOES_NOT_EXIST;
 
-    if (!DeviceIoControl( _hDriver, IOCTL_BLACKBONE_GRANT_ACCESS, &grantAccess, sizeof( grantAccess ), nullptr, 0, &bytes, NULL ))
+    if (!Ioctl( IOCTL_BLACKBONE_GRANT_ACCESS, &grantAccess, sizeof( grantAccess ), nullptr, 0, &bytes ))
         return LastNtStatus();
 
     return STATUS_SUCCESS;
@@ -347,10 +499,10 @@ NTSTATUS DriverControl::AllocateMem( DWORD pid, ptr_t& base, ptr_t& size, DWORD
     if (_hDriver == INVALID_HANDLE_VALUE)
         return STATUS_DEVICE_DOES_NOT_EXIST;
 
-    if (!DeviceIoControl( 
-        _hDriver, IOCTL_BLACKBONE_ALLOCATE_FREE_MEMORY, 
+    if (!Ioctl( 
+        IOCTL_BLACKBONE_ALLOCATE_FREE_MEMORY, 
         &allocMem, sizeof( allocMem ), 
-        &result, sizeof( result ), &bytes, NULL 
+        &result, sizeof( result ), &bytes 
         ))
     {
         size = base = 0;
@@ -363,6 +515,65 @@ NTSTATUS DriverControl::AllocateMem( DWORD pid, ptr_t& base, ptr_t& size, DWORD
     return STATUS_SUCCESS;
 }
 
+/// <summary>
+/// Allocate several regions in one request.
+/// Regions with MEM_LARGE_PAGES type are rounded up to large page size and committed at once,
+/// regular pages are used if large pages aren't available
+/// </summary>
+/// <param name="pid">Target PID</param>
+/// <param name="ranges">Regions to allocate, base, size and status of every region are updated</param>
+/// <returns>Request status</returns>
+NTSTATUS DriverControl::AllocateMemBatch( DWORD pid, std::vector<AllocRange>& ranges )
+{
+    // Not loaded
+    if (_hDriver == INVALID_HANDLE_VALUE)
+        return STATUS_DEVICE_DOES_NOT_EXIST;
+
+    if (ranges.empty())
+        return STATUS_SUCCESS;
+
+    DWORD bytes = 0;
+    DWORD size = static_cast<DWORD>(FIELD_OFFSET( ALLOCATE_MEMORY_BATCH, entries ) + ranges.size() * sizeof( ALLOCATE_MEMORY_ENTRY ));
+
+    std::vector<uint8_t> buffer( size );
+    auto pData = reinterpret_cast<PALLOCATE_MEMORY_BATCH>(buffer.data());
+
+    pData->pid = pid;
+    pData->count = static_cast<ULONG>(ranges.size());
+
+    for (size_t i = 0; i < ranges.size(); i++)
+    {
+        pData->entries[i].base = ranges[i].base;
+        pData->entries[i].size = ranges[i].size;
+        pData->entries[i].type = ranges[i].type;
+        pData->entries[i].protection = ranges[i].protection;
+        pData->entries[i].physical = ranges[i].physical;
+        pData->entries[i].status = STATUS_PENDING;
+    }
+
+    if (!Ioctl( IOCTL_BLACKBONE_ALLOCATE_MEMORY_BATCH, pData, size, pData, size, &bytes ))
+    {
+        // Driver build without batch support, allocate one by one
+        NTSTATUS status = LastNtStatus();
+        if (status != STATUS_INVALID_PARAMETER && status != STATUS_INVALID_DEVICE_REQUEST)
+            return status;
+
+        for (auto& range : ranges)
+            range.status = AllocateMem( pid, range.base, range.size, range.type & ~MEM_LARGE_PAGES, range.protection, range.physical );
+
+        return STATUS_SUCCESS;
+    }
+
+    for (size_t i = 0; i < ranges.size(); i++)
+    {
+        ranges[i].base = pData->entries[i].base;
+        ranges[i].size = pData->entries[i].size;
+        ranges[i].status = pData->entries[i].status;
+    }
+
+    return STATUS_SUCCESS;
+}
+
 /// <summary>
 /// Free virtual memory
 /// </summary>
@@ -388,10 +599,10 @@ NTSTATUS DriverControl::FreeMem( DWORD pid, ptr_t base, ptr_t size, DWORD type )
     if (_hDriver == INVALID_HANDLE_VALUE)
         return STATUS_DEVICE_DOES_NOT_EXIST;
 
-    if (!DeviceIoControl(
-        _hDriver, IOCTL_BLACKBONE_ALLOCATE_FREE_MEMORY,
+    if (!Ioctl(
+        IOCTL_BLACKBONE_ALLOCATE_FREE_MEMORY,
         &freeMem, sizeof( freeMem ),
-        &result, sizeof( result ), &bytes, NULL
+        &result, sizeof( result ), &bytes
         ))
     {
         return LastNtStatus();
@@ -400,6 +611,54 @@ NTSTATUS DriverControl::FreeMem( DWORD pid, ptr_t base, ptr_t size, DWORD type )
     return STATUS_SUCCESS;
 }
 
+/// <summary>
+/// Reference target process in driver once.
+/// Returned handle can be passed instead of PID to ReadMem, WriteMem, CopyMemBatch, AllocateMem, FreeMem,
+/// ProtectMem, ProtectMemBatch, EnumMemoryRegions and ScanMemory, which saves process lookup on every call.
+/// Handle is closed by driver when target or current process exits
+/// </summary>
+/// <param name="pid">Target PID</param>
+/// <returns>Target handle</returns>
+call_result_t<DWORD> DriverControl::OpenTarget( DWORD pid )
+{
+    DWORD bytes = 0;
+    OPEN_TARGET data = { 0 };
+    OPEN_TARGET_RESULT result = { 0 };
+
+    data.pid = pid;
+
+    // Not loaded
+    if (_hDriver == INVALID_HANDLE_VALUE)
+        return STATUS_DEVICE_DOES_NOT_EXIST;
+
+    if (!Ioctl( IOCTL_BLACKBONE_OPEN_TARGET, &data, sizeof( data ), &result, sizeof( result ), &bytes ))
+        return LastNtStatus();
+
+    return result.handle;
+}
+
+/// <summary>
+/// Close target handle
+/// </summary>
+/// <param name="handle">Handle returned by OpenTarget</param>
+/// <returns>Status code</returns>
+NTSTATUS DriverControl::CloseTarget( DWORD handle )
+{
+    DWORD bytes = 0;
+    CLOSE_TARGET data = { 0 };
+
+    data.handle = handle;
+
+    // Not loaded
+    if (_hDriver == INVALID_HANDLE_VALUE)
+        return STATUS_DEVICE_DOES_NOT_EXIST;
+
+    if (!Ioctl( IOCTL_BLACKBONE_CLOSE_TARGET, &data, sizeof( data ), nullptr, 0, &bytes ))
+        return LastNtStatus();
+
+    return STATUS_SUCCESS;
+}
+
 /// <summary>
 /// Read process memory
 /// </summary>
@@ -423,7 +682,7 @@ NTSTATUS DriverControl::ReadMem( DWORD pid, ptr_t base, ptr_t size, PVOID buffer
     if (_hDriver == INVALID_HANDLE_VALUE)
         return STATUS_DEVICE_DOES_NOT_EXIST;
 
-    if (!DeviceIoControl( _hDriver, IOCTL_BLACKBONE_COPY_MEMORY, &copyMem, sizeof( copyMem ), nullptr, 0, &bytes, NULL ))
+    if (!Ioctl( IOCTL_BLACKBONE_COPY_MEMORY, &copyMem, sizeof( copyMem ), nullptr, 0, &bytes ))
         return LastNtStatus();
 
     return STATUS_SUCCESS;
@@ -452,9 +711,114 @@ NTSTATUS DriverControl::WriteMem( DWORD pid, ptr_t base, ptr_t size, PVOID buffe
     if (_hDriver == INVALID_HANDLE_VALUE)
         return STATUS_DEVICE_DOES_NOT_EXIST;
 
-    if (!DeviceIoControl( _hDriver, IOCTL_BLACKBONE_COPY_MEMORY, &copyMem, sizeof( copyMem ), nullptr, 0, &bytes, NULL ))
+    if (!Ioctl( IOCTL_BLACKBONE_COPY_MEMORY, &copyMem, sizeof( copyMem ), nullptr, 0, &bytes ))
+        return LastNtStatus();
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Read or write several ranges in one request.
+/// Falls back to single range requests if loaded driver doesn't support vectored copy
+/// </summary>
+/// <param name="pid">Target PID</param>
+/// <param name="ranges">Ranges to copy, status of every range is updated</param>
+/// <returns>STATUS_SUCCESS if all ranges succeeded, otherwise status of first failed range</returns>
+NTSTATUS DriverControl::CopyMemBatch( DWORD pid, std::vector<CopyRange>& ranges )
+{
+    // Not loaded
+    if (_hDriver == INVALID_HANDLE_VALUE)
+        return STATUS_DEVICE_DOES_NOT_EXIST;
+
+    if (ranges.empty())
+        return STATUS_SUCCESS;
+
+    // Driver build without vectored copy rejects unknown control code
+    NTSTATUS status = SendCopyVector( IOCTL_BLACKBONE_COPY_MEMORY_VECTOR, pid, ranges );
+    if (status == STATUS_INVALID_PARAMETER || status == STATUS_INVALID_DEVICE_REQUEST)
+    {
+        for (auto& range : ranges)
+        {
+            range.status = range.write ? WriteMem( pid, range.target, range.size, range.local )
+                                       : ReadMem( pid, range.target, range.size, range.local );
+        }
+    }
+    else if (!NT_SUCCESS( status ))
+        return status;
+
+    for (const auto& range : ranges)
+    {
+        if (!NT_SUCCESS( range.status ))
+            return range.status;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Read several ranges by walking target page tables and copying physical memory.
+/// Target isn't attached and its address space isn't locked, so it's suitable for read-only monitoring.
+/// Pages that aren't resident fail with STATUS_INVALID_ADDRESS, write ranges fail with STATUS_NOT_SUPPORTED.
+/// Requires Windows 8.1 or newer
+/// </summary>
+/// <param name="pid">Target PID or target handle</param>
+/// <param name="ranges">Ranges to read, status of every range is updated</param>
+/// <returns>STATUS_SUCCESS if all ranges succeeded, otherwise status of first failed range</returns>
+NTSTATUS DriverControl::ReadMemPhysical( DWORD pid, std::vector<CopyRange>& ranges )
+{
+    // Not loaded
+    if (_hDriver == INVALID_HANDLE_VALUE)
+        return STATUS_DEVICE_DOES_NOT_EXIST;
+
+    if (ranges.empty())
+        return STATUS_SUCCESS;
+
+    NTSTATUS status = SendCopyVector( IOCTL_BLACKBONE_READ_PHYSICAL_VECTOR, pid, ranges );
+    if (!NT_SUCCESS( status ))
+        return status;
+
+    for (const auto& range : ranges)
+    {
+        if (!NT_SUCCESS( range.status ))
+            return range.status;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Send ranges as COPY_MEMORY_VECTOR request
+/// </summary>
+/// <param name="code">IOCTL code</param>
+/// <param name="pid">Target PID</param>
+/// <param name="ranges">Ranges, status of every range is updated on success</param>
+/// <returns>Request status</returns>
+NTSTATUS DriverControl::SendCopyVector( DWORD code, DWORD pid, std::vector<CopyRange>& ranges )
+{
+    DWORD bytes = 0;
+    DWORD size = static_cast<DWORD>(FIELD_OFFSET( COPY_MEMORY_VECTOR, entries ) + ranges.size() * sizeof( COPY_MEMORY_ENTRY ));
+
+    std::vector<uint8_t> buffer( size );
+    auto pData = reinterpret_cast<PCOPY_MEMORY_VECTOR>(buffer.data());
+
+    pData->pid = pid;
+    pData->count = static_cast<ULONG>(ranges.size());
+
+    for (size_t i = 0; i < ranges.size(); i++)
+    {
+        pData->entries[i].localbuf = reinterpret_cast<ULONGLONG>(ranges[i].local);
+        pData->entries[i].targetPtr = ranges[i].target;
+        pData->entries[i].size = ranges[i].size;
+        pData->entries[i].write = ranges[i].write ? TRUE : FALSE;
+        pData->entries[i].status = STATUS_PENDING;
+    }
+
+    if (!Ioctl( code, pData, size, pData, size, &bytes ))
         return LastNtStatus();
 
+    for (size_t i = 0; i < ranges.size(); i++)
+        ranges[i].status = pData->entries[i].status;
+
     return STATUS_SUCCESS;
 }
 
@@ -480,7 +844,44 @@ NTSTATUS DriverControl::ProtectMem( DWORD pid, ptr_t base, ptr_t size, DWORD pro
     if (_hDriver == INVALID_HANDLE_VALUE)
         return STATUS_DEVICE_DOES_NOT_EXIST;
 
-    if (!DeviceIoControl( _hDriver, IOCTL_BLACKBONE_PROTECT_MEMORY, &protectMem, sizeof( protectMem ), nullptr, 0, &bytes, NULL ))
+    if (!Ioctl( IOCTL_BLACKBONE_PROTECT_MEMORY, &protectMem, sizeof( protectMem ), nullptr, 0, &bytes ))
+        return LastNtStatus();
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Change memory protection of several regions in one request
+/// </summary>
+/// <param name="pid">Target PID.</param>
+/// <param name="ranges">Regions and their new protection</param>
+/// <returns>Status code</returns>
+NTSTATUS DriverControl::ProtectMemBatch( DWORD pid, const std::vector<ProtectRange>& ranges )
+{
+    // Not loaded
+    if (_hDriver == INVALID_HANDLE_VALUE)
+        return STATUS_DEVICE_DOES_NOT_EXIST;
+
+    if (ranges.empty())
+        return STATUS_SUCCESS;
+
+    DWORD bytes = 0;
+    DWORD size = static_cast<DWORD>(FIELD_OFFSET( PROTECT_MEMORY_BATCH, entries ) + ranges.size() * sizeof( PROTECT_MEMORY_ENTRY ));
+
+    std::vector<uint8_t> buffer( size );
+    auto pData = reinterpret_cast<PPROTECT_MEMORY_BATCH>(buffer.data());
+
+    pData->pid = pid;
+    pData->count = static_cast<ULONG>(ranges.size());
+
+    for (size_t i = 0; i < ranges.size(); i++)
+    {
+        pData->entries[i].base = ranges[i].base;
+        pData->entries[i].size = ranges[i].size;
+        pData->entries[i].newProtection = ranges[i].protection;
+    }
+
+    if (!Ioctl( IOCTL_BLACKBONE_PROTECT_MEMORY_BATCH, pData, size, nullptr, 0, &bytes ))
         return LastNtStatus();
 
     return STATUS_SUCCESS;
@@ -525,12 +926,86 @@ NTSTATUS DriverControl::InjectDll(
     data.unlink = unlink;
     data.erasePE = erasePE;
 
-    if (!DeviceIoControl( _hDriver, IOCTL_BLACKBONE_INJECT_DLL, &data, sizeof( data ), nullptr, 0, &bytes, NULL ))
+    if (!Ioctl( IOCTL_BLACKBONE_INJECT_DLL, &data, sizeof( data ), nullptr, 0, &bytes ))
         return LastNtStatus();
 
     return STATUS_SUCCESS;
 }
 
+/// <summary>
+/// Inject same DLL into several processes in one request
+/// </summary>
+/// <param name="pids">Target PIDs</param>
+/// <param name="path">Full qualified dll path</param>
+/// <param name="itype">Injection type, IT_Thread or IT_Apc</param>
+/// <param name="statuses">Injection status of every target, in order of pids</param>
+/// <param name="initRVA">Init routine RVA</param>
+/// <param name="initArg">Init routine argument</param>
+/// <param name="unlink">Unlink module after injection</param>
+/// <param name="erasePE">Erase PE headers after injection</param>
+/// <param name="wait">Wait for injection</param>
+/// <returns>Request status</returns>
+NTSTATUS DriverControl::InjectDllBatch(
+    const std::vector<DWORD>& pids,
+    const std::wstring& path,
+    InjectType itype,
+    std::vector<NTSTATUS>& statuses,
+    uint32_t initRVA /*= 0*/,
+    const std::wstring& initArg /*= L""*/,
+    bool unlink /*= false*/,
+    bool erasePE /*= false*/,
+    bool wait /*= true*/
+    )
+{
+    statuses.assign( pids.size(), STATUS_PENDING );
+
+    // Not loaded
+    if (_hDriver == INVALID_HANDLE_VALUE)
+        return STATUS_DEVICE_DOES_NOT_EXIST;
+
+    if (pids.empty())
+        return STATUS_SUCCESS;
+
+    DWORD bytes = 0;
+    DWORD size = static_cast<DWORD>(FIELD_OFFSET( INJECT_DLL_BATCH, entries ) + pids.size() * sizeof( INJECT_DLL_BATCH_ENTRY ));
+
+    std::vector<uint8_t> buffer( size );
+    auto pData = reinterpret_cast<PINJECT_DLL_BATCH>(buffer.data());
+
+    wcscpy_s( pData->FullDllPath, path.c_str() );
+    wcscpy_s( pData->initArg, initArg.c_str() );
+    pData->type = itype;
+    pData->initRVA = initRVA;
+    pData->wait = wait;
+    pData->unlink = unlink;
+    pData->erasePE = erasePE;
+    pData->count = static_cast<ULONG>(pids.size());
+
+    for (size_t i = 0; i < pids.size(); i++)
+    {
+        pData->entries[i].pid = pids[i];
+        pData->entries[i].status = STATUS_PENDING;
+    }
+
+    if (!Ioctl( IOCTL_BLACKBONE_INJECT_DLL_BATCH, pData, size, pData, size, &bytes ))
+    {
+        // Driver build without batch support, inject one by one
+        NTSTATUS status = LastNtStatus();
+        if (status != STATUS_INVALID_PARAMETER && status != STATUS_INVALID_DEVICE_REQUEST)
+            return status;
+
+        for (size_t i = 0; i < pids.size(); i++)
+            statuses[i] = InjectDll( pids[i], path, itype, initRVA, initArg, unlink, erasePE, wait );
+
+        return STATUS_SUCCESS;
+    }
+
+    for (size_t i = 0; i < pids.size(); i++)
+        statuses[i] = pData->entries[i].status;
+
+    return STATUS_SUCCESS;
+}
+
 /// <summary>
 /// Manually map PE image
 /// </summary>
@@ -569,7 +1044,7 @@ NTSTATUS DriverControl::MmapDll(
     data.imageSize = 0;
     data.asImage = false;
 
-    if (!DeviceIoControl( _hDriver, IOCTL_BLACKBONE_INJECT_DLL, &data, sizeof( data ), nullptr, 0, &bytes, NULL ))
+    if (!Ioctl( IOCTL_BLACKBONE_INJECT_DLL, &data, sizeof( data ), nullptr, 0, &bytes ))
         return LastNtStatus();
 
     return STATUS_SUCCESS;
@@ -612,7 +1087,7 @@ NTSTATUS DriverControl::MmapDll(
     data.imageSize = size;
     data.asImage = asImage;
 
-    if (!DeviceIoControl( _hDriver, IOCTL_BLACKBONE_INJECT_DLL, &data, sizeof( data ), nullptr, 0, &bytes, NULL ))
+    if (!Ioctl( IOCTL_BLACKBONE_INJECT_DLL, &data, sizeof( data ), nullptr, 0, &bytes ))
         return LastNtStatus();
 
     return STATUS_SUCCESS;
@@ -639,7 +1114,7 @@ NTSTATUS DriverControl::MMapDriver( const std::wstring& path )
     wcscpy_s( data.FullPath, ustr.Buffer );
     SAFE_CALL( RtlFreeUnicodeString, &ustr);
 
-    if (!DeviceIoControl( _hDriver, IOCTL_BLACKBONE_MAP_DRIVER, &data, sizeof( data ), nullptr, 0, &bytes, NULL ))
+    if (!Ioctl( IOCTL_BLACKBONE_MAP_DRIVER, &data, sizeof( data ), nullptr, 0, &bytes ))
         return LastNtStatus();
 
     return STATUS_SUCCESS;
@@ -666,7 +1141,7 @@ NTSTATUS DriverControl::ConcealVAD( DWORD pid, ptr_t base, uint32_t size )
     if (_hDriver == INVALID_HANDLE_VALUE)
         return STATUS_DEVICE_DOES_NOT_EXIST;
 
-    if (!DeviceIoControl( _hDriver, IOCTL_BLACKBONE_HIDE_VAD, &hideVAD, sizeof( hideVAD ), nullptr, 0, &bytes, NULL ))
+    if (!Ioctl( IOCTL_BLACKBONE_HIDE_VAD, &hideVAD, sizeof( hideVAD ), nullptr, 0, &bytes ))
         return LastNtStatus();
 
     return STATUS_SUCCESS;
@@ -686,7 +1161,7 @@ NTSTATUS DriverControl::UnlinkHandleTable( DWORD pid )
     if (_hDriver == INVALID_HANDLE_VALUE)
         return STATUS_DEVICE_DOES_NOT_EXIST;
 
-    if (!DeviceIoControl( _hDriver, IOCTL_BLACKBONE_UNLINK_HTABLE, &unlink, sizeof( unlink ), nullptr, 0, &bytes, NULL ))
+    if (!Ioctl( IOCTL_BLACKBONE_UNLINK_HTABLE, &unlink, sizeof( unlink ), nullptr, 0, &bytes ))
         return LastNtStatus();
 
     return STATUS_SUCCESS;
@@ -697,9 +1172,16 @@ NTSTATUS DriverControl::UnlinkHandleTable( DWORD pid )
 /// </summary>
 /// <param name="pid">Target process ID</param>
 /// <param name="regions">Found regions</param>
+/// <param name="fromVad">
+/// Read VAD tree directly: one region per allocation with its initial protection and zero State.
+/// Much cheaper for large address spaces, when per-page state isn't needed
+/// </param>
 /// <returns>Status code</returns>
-NTSTATUS DriverControl::EnumMemoryRegions( DWORD pid, std::vector<MEMORY_BASIC_INFORMATION64>& regions )
+NTSTATUS DriverControl::EnumMemoryRegions( DWORD pid, std::vector<MEMORY_BASIC_INFORMATION64>& regions, bool fromVad /*= false*/ )
 {
+    // Regions per request
+    constexpr size_t chunkSize = 256;
+
     // Not loaded
     if (_hDriver == INVALID_HANDLE_VALUE)
     {
@@ -707,20 +1189,71 @@ NTSTATUS DriverControl::EnumMemoryRegions( DWORD pid, std::vector<MEMORY_BASIC_I
     }
 
     DWORD bytes = 0;
-    ENUM_REGIONS data = { 0 };
-    DWORD size = sizeof( ENUM_REGIONS_RESULT );
-    auto result = reinterpret_cast<PENUM_REGIONS_RESULT>(malloc( size ));
+    ENUM_REGIONS_NEXT data = { 0 };
+    DWORD size = static_cast<DWORD>(FIELD_OFFSET( ENUM_REGIONS_NEXT_RESULT, regions ) + chunkSize * sizeof( MEM_REGION ));
+    std::vector<uint8_t> buffer( size );
+    auto result = reinterpret_cast<PENUM_REGIONS_NEXT_RESULT>(buffer.data());
+
+    data.pid = pid;
+    data.fromVad = fromVad;
+    regions.clear();
+
+    // Single VAD walk, streamed in chunks
+    do
+    {
+        if (!Ioctl( IOCTL_BLACKBONE_ENUM_REGIONS_NEXT, &data, sizeof( data ), result, size, &bytes ))
+        {
+            // Driver build without resumable enumeration
+            NTSTATUS status = LastNtStatus();
+            if (regions.empty() && (status == STATUS_INVALID_PARAMETER || status == STATUS_INVALID_DEVICE_REQUEST))
+                return EnumMemoryRegionsLegacy( pid, regions );
+
+            return status;
+        }
+
+        for (uint32_t i = 0; i < result->count; i++)
+        {
+            MEMORY_BASIC_INFORMATION64 mbi = { 0 };
+            mbi.AllocationBase = result->regions[i].AllocationBase;
+            mbi.AllocationProtect = result->regions[i].AllocationProtect;
+            mbi.BaseAddress = result->regions[i].BaseAddress;
+            mbi.Protect = result->regions[i].Protect;
+            mbi.RegionSize = result->regions[i].RegionSize;
+            mbi.State = result->regions[i].State;
+            mbi.Type = result->regions[i].Type;
+
+            regions.emplace_back( mbi );
+        }
+
+        data.start = result->next;
+    } while (data.start != 0);
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Enumerate memory regions with driver that lacks IOCTL_BLACKBONE_ENUM_REGIONS_NEXT
+/// </summary>
+/// <param name="pid">Target process ID</param>
+/// <param name="regions">Found regions</param>
+/// <returns>Status code</returns>
+NTSTATUS DriverControl::EnumMemoryRegionsLegacy( DWORD pid, std::vector<MEMORY_BASIC_INFORMATION64>& regions )
+{
+    DWORD bytes = 0;
+    ENUM_REGIONS data = { 0 };
+    DWORD size = sizeof( ENUM_REGIONS_RESULT );
+    auto result = reinterpret_cast<PENUM_REGIONS_RESULT>(malloc( size ));
 
     data.pid = pid;
     result->count = 0;
 
-    DeviceIoControl( _hDriver, IOCTL_BLACKBONE_ENUM_REGIONS, &data, sizeof( data ), result, size, &bytes, NULL );
+    Ioctl( IOCTL_BLACKBONE_ENUM_REGIONS, &data, sizeof( data ), result, size, &bytes );
 
     result->count += 100;
     size = static_cast<DWORD>(result->count * sizeof( result->regions[0] ) + sizeof( result->count ));
     result = reinterpret_cast<PENUM_REGIONS_RESULT>(realloc( result, size ));
 
-    if (!DeviceIoControl( _hDriver, IOCTL_BLACKBONE_ENUM_REGIONS, &data, sizeof( data ), result, size, &bytes, NULL ))
+    if (!Ioctl( IOCTL_BLACKBONE_ENUM_REGIONS, &data, sizeof( data ), result, size, &bytes ))
     {
         free( result );
         return LastNtStatus();
@@ -742,8 +1275,599 @@ NTSTATUS DriverControl::EnumMemoryRegions( DWORD pid, std::vector<MEMORY_BASIC_I
     return STATUS_SUCCESS;
 }
 
+/// <summary>
+/// Enumerate loader modules of target process in single request
+/// </summary>
+/// <param name="pid">Target process ID</param>
+/// <param name="x86">Walk 32 bit loader list of WOW64 process</param>
+/// <param name="modules">Found modules</param>
+/// <returns>Status code</returns>
+NTSTATUS DriverControl::EnumModules( DWORD pid, bool x86, std::vector<ModuleDataPtr>& modules )
+{
+    // Not loaded
+    if (_hDriver == INVALID_HANDLE_VALUE)
+    {
+        return STATUS_DEVICE_DOES_NOT_EXIST;
+    }
+
+    DWORD bytes = 0;
+    ENUM_MODULES data = { 0 };
+    std::vector<uint8_t> buffer( 0x4000 );
+
+    data.pid = pid;
+    data.x86 = x86;
+    modules.clear();
+
+    // Loader list could grow between calls
+    for (;;)
+    {
+        if (!Ioctl(
+            IOCTL_BLACKBONE_ENUM_MODULES, &data, sizeof( data ),
+            buffer.data(), static_cast<DWORD>(buffer.size()), &bytes
+            ))
+        {
+            return LastNtStatus();
+        }
+
+        auto result = reinterpret_cast<PENUM_MODULES_RESULT>(buffer.data());
+        if (result->required <= buffer.size())
+            break;
+
+        buffer.resize( result->required + 0x1000 );
+    }
+
+    auto result = reinterpret_cast<PENUM_MODULES_RESULT>(buffer.data());
+    auto record = result->records;
+
+    for (uint32_t i = 0; i < result->count; i++)
+    {
+        ModuleData mod;
+        mod.baseAddress = record->base;
+        mod.size = record->size;
+        mod.fullPath = Utils::ToLower( std::wstring( record->name, record->nameLength ) );
+        mod.name = Utils::StripPath( mod.fullPath );
+        mod.type = x86 ? mt_mod32 : mt_mod64;
+        mod.ldrPtr = record->ldrEntry;
+        mod.manual = false;
+
+        modules.emplace_back( std::make_shared<const ModuleData>( mod ) );
+        record = reinterpret_cast<PMODULE_RECORD>(reinterpret_cast<uint8_t*>(record) + record->recordSize);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Scan committed, accessible, non-guarded memory regions for pattern.
+/// Memory is scanned in target address space, only match addresses are transferred.
+/// Request is sent through overlapped handle, so scans from several threads run concurrently.
+/// </summary>
+/// <param name="pid">Target process ID</param>
+/// <param name="pattern">Pattern bytes</param>
+/// <param name="mask">Pattern mask, 0xFF - significant byte, 0x00 - wildcard. nullptr for exact match</param>
+/// <param name="size">Pattern size, up to BLACKBONE_MAX_PATTERN</param>
+/// <param name="results">Found addresses</param>
+/// <param name="minAddress">Lowest scanned address</param>
+/// <param name="maxAddress">Highest scanned address (exclusive), 0 - no limit</param>
+/// <param name="protection">Any of these protection flags must be set, 0 - any protection</param>
+/// <param name="type">Any of MEM_IMAGE | MEM_PRIVATE | MEM_MAPPED, 0 - any type</param>
+/// <returns>Status code</returns>
+NTSTATUS DriverControl::ScanMemory(
+    DWORD pid,
+    const uint8_t* pattern,
+    const uint8_t* mask,
+    size_t size,
+    std::vector<ptr_t>& results,
+    ptr_t minAddress /*= 0*/,
+    ptr_t maxAddress /*= 0*/,
+    DWORD protection /*= 0*/,
+    DWORD type /*= 0*/
+    )
+{
+    // Not loaded
+    if (_hDriver == INVALID_HANDLE_VALUE)
+        return STATUS_DEVICE_DOES_NOT_EXIST;
+
+    if (pattern == nullptr || size == 0 || size > BLACKBONE_MAX_PATTERN)
+        return STATUS_INVALID_PARAMETER;
+
+    DWORD bytes = 0;
+    SCAN_MEMORY data = { 0 };
+
+    data.pid = pid;
+    data.minAddress = minAddress;
+    data.maxAddress = maxAddress;
+    data.protection = protection;
+    data.type = type;
+    data.length = static_cast<ULONG>(size);
+    data.useMask = mask != nullptr;
+    memcpy( data.pattern, pattern, size );
+    if (mask)
+        memcpy( data.mask, mask, size );
+
+    // Retry with bigger buffer if not all matches fit
+    for (ULONGLONG capacity = 0x1000;;)
+    {
+        // Output size is passed to DeviceIoControl as DWORD
+        if (capacity > (MAXDWORD - FIELD_OFFSET( SCAN_MEMORY_RESULT, addresses )) / sizeof( ULONGLONG ))
+            return STATUS_INVALID_PARAMETER;
+
+        DWORD outSize = static_cast<DWORD>(FIELD_OFFSET( SCAN_MEMORY_RESULT, addresses ) + capacity * sizeof( ULONGLONG ));
+        auto result = reinterpret_cast<PSCAN_MEMORY_RESULT>(malloc( outSize ));
+        if (!result)
+            return STATUS_NO_MEMORY;
+
+        if (!IoctlParallel( IOCTL_BLACKBONE_SCAN_MEMORY, &data, sizeof( data ), result, outSize, &bytes ))
+        {
+            free( result );
+            return LastNtStatus();
+        }
+
+        if (result->total > result->count)
+        {
+            capacity = result->total + 0x100;
+            free( result );
+            continue;
+        }
 
+        results.assign( result->addresses, result->addresses + result->count );
+        free( result );
+        return STATUS_SUCCESS;
+    }
+}
+
+
+
+
+/// <summary>
+/// Create command ring for current process. Only one ring per process can exist
+/// </summary>
+/// <param name="ring">Ring to initialize</param>
+/// <returns>Status code</returns>
+NTSTATUS DriverControl::CreateRing( CommandRing& ring )
+{
+    DWORD bytes = 0;
+    CREATE_RING data = { 0 };
+    CREATE_RING_RESULT result = { 0 };
+
+    // Not loaded
+    if (_hDriver == INVALID_HANDLE_VALUE)
+        return STATUS_DEVICE_DOES_NOT_EXIST;
+
+    if (ring.valid())
+        return STATUS_OBJECT_NAME_COLLISION;
+
+    ring._hRequest = CreateEventW( NULL, FALSE, FALSE, NULL );
+    ring._hComplete = CreateEventW( NULL, FALSE, FALSE, NULL );
+    if (!ring._hRequest || !ring._hComplete)
+        return LastNtStatus();
+
+    data.requestEvent = reinterpret_cast<ULONGLONG>(ring._hRequest.get());
+    data.completeEvent = reinterpret_cast<ULONGLONG>(ring._hComplete.get());
+
+    if (!Ioctl( IOCTL_BLACKBONE_CREATE_RING, &data, sizeof( data ), &result, sizeof( result ), &bytes ))
+        return LastNtStatus();
+
+    ring._ring = reinterpret_cast<PCOMMAND_RING>(result.address);
+    ring._head = ring._completed = 0;
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Destroy command ring. Pending commands are discarded
+/// </summary>
+/// <param name="ring">Ring to destroy</param>
+/// <returns>Status code</returns>
+NTSTATUS DriverControl::DestroyRing( CommandRing& ring )
+{
+    DWORD bytes = 0;
+
+    if (!ring.valid())
+        return STATUS_SUCCESS;
+
+    // Shared page is gone after this point regardless of result
+    ring._ring = nullptr;
+
+    // Not loaded
+    if (_hDriver == INVALID_HANDLE_VALUE)
+        return STATUS_DEVICE_DOES_NOT_EXIST;
+
+    if (!Ioctl( IOCTL_BLACKBONE_DESTROY_RING, nullptr, 0, nullptr, 0, &bytes ))
+        return LastNtStatus();
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Subscribe current process to driver process, thread and image load events.
+/// Existing subscription filter is replaced. Events are retrieved with WaitEventsAsync
+/// </summary>
+/// <param name="pid">Watched process ID, 0 to watch all processes</param>
+/// <param name="mask">Combination of BLACKBONE_EVENT_MASK( NotifyEventType ) values</param>
+/// <returns>Status code</returns>
+NTSTATUS DriverControl::SubscribeEvents( DWORD pid, uint32_t mask )
+{
+    DWORD bytes = 0;
+    SUBSCRIBE_EVENTS data = { 0 };
+
+    // Not loaded
+    if (_hDriver == INVALID_HANDLE_VALUE)
+        return STATUS_DEVICE_DOES_NOT_EXIST;
+
+    data.pid = pid;
+    data.mask = mask;
+
+    if (!Ioctl( IOCTL_BLACKBONE_SUBSCRIBE_EVENTS, &data, sizeof( data ), nullptr, 0, &bytes ))
+        return LastNtStatus();
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Remove event subscription. Pending WaitEventsAsync request completes with STATUS_CANCELLED
+/// </summary>
+/// <returns>Status code</returns>
+NTSTATUS DriverControl::UnsubscribeEvents()
+{
+    DWORD bytes = 0;
+
+    // Not loaded
+    if (_hDriver == INVALID_HANDLE_VALUE)
+        return STATUS_DEVICE_DOES_NOT_EXIST;
+
+    if (!Ioctl( IOCTL_BLACKBONE_UNSUBSCRIBE_EVENTS, nullptr, 0, nullptr, 0, &bytes ))
+        return LastNtStatus();
+
+    return STATUS_SUCCESS;
+}
 
+/// <summary>
+/// Queue process memory read. Buffer must stay valid until callback is invoked
+/// </summary>
+/// <param name="pid">Target PID or target handle</param>
+/// <param name="base">Target base</param>
+/// <param name="size">Data size</param>
+/// <param name="buffer">Buffer address</param>
+/// <param name="callback">Completion callback</param>
+/// <returns>Status code, callback is invoked only if request was queued successfully</returns>
+NTSTATUS DriverControl::ReadMemAsync( DWORD pid, ptr_t base, ptr_t size, PVOID buffer, AsyncCallback callback )
+{
+    auto request = std::make_unique<AsyncRequest>();
+    COPY_MEMORY copyMem = { 0 };
+
+    copyMem.pid = pid;
+    copyMem.targetPtr = base;
+    copyMem.localbuf = (ULONGLONG)buffer;
+    copyMem.size = size;
+    copyMem.write = FALSE;
+
+    request->code = IOCTL_BLACKBONE_COPY_MEMORY;
+    request->input.assign( reinterpret_cast<uint8_t*>(&copyMem), reinterpret_cast<uint8_t*>(&copyMem + 1) );
+    request->complete = [callback]( NTSTATUS status, AsyncRequest& ) { callback( status ); };
+
+    return SubmitAsync( std::move( request ) );
+}
+
+/// <summary>
+/// Queue process memory write. Buffer must stay valid until callback is invoked
+/// </summary>
+/// <param name="pid">Target PID or target handle</param>
+/// <param name="base">Target base</param>
+/// <param name="size">Data size</param>
+/// <param name="buffer">Buffer address</param>
+/// <param name="callback">Completion callback</param>
+/// <returns>Status code, callback is invoked only if request was queued successfully</returns>
+NTSTATUS DriverControl::WriteMemAsync( DWORD pid, ptr_t base, ptr_t size, PVOID buffer, AsyncCallback callback )
+{
+    auto request = std::make_unique<AsyncRequest>();
+    COPY_MEMORY copyMem = { 0 };
+
+    copyMem.pid = pid;
+    copyMem.targetPtr = base;
+    copyMem.localbuf = (ULONGLONG)buffer;
+    copyMem.size = size;
+    copyMem.write = TRUE;
+
+    request->code = IOCTL_BLACKBONE_COPY_MEMORY;
+    request->input.assign( reinterpret_cast<uint8_t*>(&copyMem), reinterpret_cast<uint8_t*>(&copyMem + 1) );
+    request->complete = [callback]( NTSTATUS status, AsyncRequest& ) { callback( status ); };
+
+    return SubmitAsync( std::move( request ) );
+}
+
+/// <summary>
+/// Queue virtual memory allocation
+/// </summary>
+/// <param name="pid">Target PID or target handle</param>
+/// <param name="base">Desired base. If 0 address is chosed by the system</param>
+/// <param name="size">Region size</param>
+/// <param name="type">Allocation type - MEM_RESERVE/MEM_COMMIT</param>
+/// <param name="protection">Memory protection</param>
+/// <param name="callback">Completion callback, receives allocated base and size</param>
+/// <param name="physical">Allocate physical pages</param>
+/// <returns>Status code, callback is invoked only if request was queued successfully</returns>
+NTSTATUS DriverControl::AllocateMemAsync( 
+    DWORD pid, ptr_t base, ptr_t size, DWORD type, DWORD protection, 
+    AsyncAllocCallback callback, bool physical /*= false*/ 
+    )
+{
+    auto request = std::make_unique<AsyncRequest>();
+    ALLOCATE_FREE_MEMORY allocMem = { 0 };
+
+    allocMem.pid = pid;
+    allocMem.base = base;
+    allocMem.size = size;
+    allocMem.type = type;
+    allocMem.protection = protection;
+    allocMem.allocate = TRUE;
+    allocMem.physical = physical;
+
+    request->code = IOCTL_BLACKBONE_ALLOCATE_FREE_MEMORY;
+    request->input.assign( reinterpret_cast<uint8_t*>(&allocMem), reinterpret_cast<uint8_t*>(&allocMem + 1) );
+    request->output.resize( sizeof( ALLOCATE_FREE_MEMORY_RESULT ) );
+    request->complete = [callback]( NTSTATUS status, AsyncRequest& self )
+    {
+        auto result = reinterpret_cast<PALLOCATE_FREE_MEMORY_RESULT>(self.output.data());
+        if (NT_SUCCESS( status ))
+            callback( status, result->address, result->size );
+        else
+            callback( status, 0, 0 );
+    };
+
+    return SubmitAsync( std::move( request ) );
+}
+
+/// <summary>
+/// Queue memory region enumeration. Chunks are requested one after another,
+/// callback is invoked once with all regions after the last chunk.
+/// Requires driver with IOCTL_BLACKBONE_ENUM_REGIONS_NEXT support
+/// </summary>
+/// <param name="pid">Target PID or target handle</param>
+/// <param name="callback">Completion callback</param>
+/// <param name="fromVad">Read VAD tree directly, see EnumMemoryRegions</param>
+/// <returns>Status code, callback is invoked only if request was queued successfully</returns>
+NTSTATUS DriverControl::EnumMemoryRegionsAsync( DWORD pid, AsyncRegionsCallback callback, bool fromVad /*= false*/ )
+{
+    ENUM_REGIONS_NEXT data = { 0 };
+    data.pid = pid;
+    data.fromVad = fromVad;
+
+    return EnumRegionsChunkAsync( data, std::make_shared<std::vector<MEMORY_BASIC_INFORMATION64>>(), std::move( callback ) );
+}
+
+/// <summary>
+/// Queue next region enumeration chunk
+/// </summary>
+/// <param name="data">Enumeration state</param>
+/// <param name="regions">Regions found so far</param>
+/// <param name="callback">Final completion callback</param>
+/// <returns>Status code</returns>
+NTSTATUS DriverControl::EnumRegionsChunkAsync(
+    const ENUM_REGIONS_NEXT& data,
+    std::shared_ptr<std::vector<MEMORY_BASIC_INFORMATION64>> regions,
+    AsyncRegionsCallback callback
+    )
+{
+    // Regions per request
+    constexpr size_t chunkSize = 256;
+
+    auto request = std::make_unique<AsyncRequest>();
+
+    request->code = IOCTL_BLACKBONE_ENUM_REGIONS_NEXT;
+    request->input.assign( reinterpret_cast<const uint8_t*>(&data), reinterpret_cast<const uint8_t*>(&data + 1) );
+    request->output.resize( FIELD_OFFSET( ENUM_REGIONS_NEXT_RESULT, regions ) + chunkSize * sizeof( MEM_REGION ) );
+    request->complete = [this, data, regions, callback]( NTSTATUS status, AsyncRequest& self )
+    {
+        if (!NT_SUCCESS( status ))
+            return callback( status, *regions );
+
+        auto result = reinterpret_cast<PENUM_REGIONS_NEXT_RESULT>(self.output.data());
+        for (uint32_t i = 0; i < result->count; i++)
+        {
+            MEMORY_BASIC_INFORMATION64 mbi = { 0 };
+            mbi.AllocationBase = result->regions[i].AllocationBase;
+            mbi.AllocationProtect = result->regions[i].AllocationProtect;
+            mbi.BaseAddress = result->regions[i].BaseAddress;
+            mbi.Protect = result->regions[i].Protect;
+            mbi.RegionSize = result->regions[i].RegionSize;
+            mbi.State = result->regions[i].State;
+            mbi.Type = result->regions[i].Type;
+
+            regions->emplace_back( mbi );
+        }
+
+        if (result->next == 0)
+            return callback( STATUS_SUCCESS, *regions );
+
+        // Resume from where driver stopped
+        auto next = data;
+        next.start = result->next;
+
+        status = EnumRegionsChunkAsync( next, regions, callback );
+        if (!NT_SUCCESS( status ))
+            callback( status, *regions );
+    };
+
+    return SubmitAsync( std::move( request ) );
+}
+
+/// <summary>
+/// Queue wait for subscribed events, see SubscribeEvents.
+/// Callback is invoked once at least one event is available; queue new wait from it to keep receiving events.
+/// Only one wait can be pending at a time
+/// </summary>
+/// <param name="callback">Completion callback, receives events and number of events lost due to queue overflow</param>
+/// <param name="maxEvents">Max number of events per completion</param>
+/// <returns>Status code, callback is invoked only if request was queued successfully</returns>
+NTSTATUS DriverControl::WaitEventsAsync( AsyncEventsCallback callback, size_t maxEvents /*= 64*/ )
+{
+    auto request = std::make_unique<AsyncRequest>();
+
+    request->code = IOCTL_BLACKBONE_WAIT_EVENTS;
+    request->output.resize( FIELD_OFFSET( WAIT_EVENTS_RESULT, events ) + std::max<size_t>( maxEvents, 1 ) * sizeof( NOTIFY_EVENT ) );
+    request->complete = [callback]( NTSTATUS status, AsyncRequest& self )
+    {
+        std::vector<NOTIFY_EVENT> events;
+        auto result = reinterpret_cast<PWAIT_EVENTS_RESULT>(self.output.data());
+        if (!NT_SUCCESS( status ))
+            return callback( status, events, 0 );
+
+        events.assign( result->events, result->events + result->count );
+        callback( status, events, result->lost );
+    };
+
+    return SubmitAsync( std::move( request ) );
+}
+
+/// <summary>
+/// Dequeue completed asynchronous requests and invoke their callbacks on the calling thread.
+/// Can be called from any number of threads. All queued requests must be completed before Unload or Reload
+/// </summary>
+/// <param name="timeout">Wait timeout in milliseconds</param>
+/// <param name="maxCount">Max number of completions to process</param>
+/// <returns>Number of processed completions, 0 on timeout</returns>
+size_t DriverControl::PollCompletions( DWORD timeout /*= INFINITE*/, size_t maxCount /*= 64*/ )
+{
+    OVERLAPPED_ENTRY entries[64] = { };
+    ULONG count = 0;
+
+    if (!_hPort || maxCount == 0)
+        return 0;
+
+    ULONG limit = static_cast<ULONG>(std::min<size_t>( maxCount, _countof( entries ) ));
+    if (!GetQueuedCompletionStatusEx( _hPort, entries, limit, &count, timeout, FALSE ))
+        return 0;
+
+    for (ULONG i = 0; i < count; i++)
+    {
+        // Custom packets posted by user carry no request
+        if (entries[i].lpOverlapped == nullptr)
+            continue;
+
+        std::unique_ptr<AsyncRequest> request( static_cast<AsyncRequest*>(entries[i].lpOverlapped) );
+        request->complete( static_cast<NTSTATUS>(request->Internal), *request );
+    }
+
+    return count;
+}
+
+/// <summary>
+/// Open overlapped driver handle and completion port on first use
+/// </summary>
+/// <returns>Status code</returns>
+NTSTATUS DriverControl::EnsureAsync()
+{
+    std::lock_guard<std::mutex> lg( _asyncLock );
+
+    if (_hPort)
+        return STATUS_SUCCESS;
+
+    // Not loaded
+    if (!_hDriver)
+        return STATUS_DEVICE_DOES_NOT_EXIST;
+
+    // Synchronous calls keep using _hDriver, overlapped handle requires OVERLAPPED in every request
+    Handle hDevice = CreateFileW(
+        BLACKBONE_DEVICE_FILE,
+        GENERIC_READ | GENERIC_WRITE,
+        FILE_SHARE_READ | FILE_SHARE_WRITE,
+        NULL, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, NULL
+        );
+
+    if (!hDevice)
+        return LastNtStatus();
+
+    Handle hPort = CreateIoCompletionPort( hDevice, NULL, 0, 0 );
+    if (!hPort)
+        return LastNtStatus();
+
+    _hAsyncDriver = std::move( hDevice );
+    _hPort = std::move( hPort );
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Send synchronous request to driver
+/// </summary>
+/// <param name="code">IOCTL code</param>
+/// <param name="in">Input buffer</param>
+/// <param name="inSize">Input size</param>
+/// <param name="out">Output buffer</param>
+/// <param name="outSize">Output size</param>
+/// <param name="bytes">Number of bytes returned</param>
+/// <returns>DeviceIoControl result</returns>
+BOOL DriverControl::Ioctl( DWORD code, LPVOID in, DWORD inSize, LPVOID out, DWORD outSize, DWORD* bytes )
+{
+    _ioctls++;
+
+    LatencyTimer timer( _latency.recording( LatencyOp::DriverRequest ) );
+    return DeviceIoControl( _hDriver, code, in, inSize, out, outSize, bytes, NULL );
+}
+
+/// <summary>
+/// Send request through overlapped handle and wait for its completion.
+/// Requests on synchronous handle are serialized by I/O manager, these are not.
+/// Falls back to synchronous handle if overlapped one can't be opened
+/// </summary>
+/// <param name="code">IOCTL code</param>
+/// <param name="in">Input buffer</param>
+/// <param name="inSize">Input size</param>
+/// <param name="out">Output buffer</param>
+/// <param name="outSize">Output size</param>
+/// <param name="bytes">Number of bytes returned</param>
+/// <returns>DeviceIoControl result</returns>
+BOOL DriverControl::IoctlParallel( DWORD code, LPVOID in, DWORD inSize, LPVOID out, DWORD outSize, DWORD* bytes )
+{
+    if (!NT_SUCCESS( EnsureAsync() ))
+        return Ioctl( code, in, inSize, out, outSize, bytes );
+
+    Handle hEvent( CreateEventW( NULL, TRUE, FALSE, NULL ) );
+    if (!hEvent)
+        return FALSE;
+
+    _ioctls++;
+
+    LatencyTimer timer( _latency.recording( LatencyOp::DriverRequest ) );
+
+    // Low bit of event handle keeps completion packet out of _hPort
+    OVERLAPPED ov = { 0 };
+    ov.hEvent = reinterpret_cast<HANDLE>(reinterpret_cast<uintptr_t>(hEvent.get()) | 1);
+
+    if (!DeviceIoControl( _hAsyncDriver, code, in, inSize, out, outSize, nullptr, &ov ) && GetLastError() != ERROR_IO_PENDING)
+        return FALSE;
+
+    return GetOverlappedResult( _hAsyncDriver, &ov, bytes, TRUE );
+}
+
+/// <summary>
+/// Send request through overlapped handle. Ownership is passed to completion port on success
+/// </summary>
+/// <param name="request">Request</param>
+/// <returns>Status code</returns>
+NTSTATUS DriverControl::SubmitAsync( std::unique_ptr<AsyncRequest> request )
+{
+    NTSTATUS status = EnsureAsync();
+    if (!NT_SUCCESS( status ))
+        return status;
+
+    _ioctls++;
+
+    // Completion packet is queued for both immediate and pending completion
+    if (!DeviceIoControl(
+        _hAsyncDriver, request->code,
+        request->input.data(), static_cast<DWORD>(request->input.size()),
+        request->output.data(), static_cast<DWORD>(request->output.size()),
+        nullptr, request.get()
+        ) && GetLastError() != ERROR_IO_PENDING)
+    {
+        return LastNtStatus();
+    }
+
+    request.release();
+    return STATUS_SUCCESS;
+}
 
 /// <summary>
 /// Load arbitrary driver
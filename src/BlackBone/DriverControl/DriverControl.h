@@ -4,11 +4,17 @@
 #include "../Include/Types.h"
 #include "../Include/Macro.h"
 #include "../Include/HandleGuard.h"
+#include "../Include/CallResult.h"
+#include "../Misc/LatencyHistogram.h"
 #include "../../BlackBoneDrv/BlackBoneDef.h"
 
 #include <string>
 #include <map>
 #include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
 
 ENUM_OPS( KMmapFlags );
 
@@ -35,9 +41,100 @@ struct MapMemoryRegionResult
     uint32_t removedSize;       // Size of unmapped region
 };
 
+struct RemapRefreshResult
+{
+    mapMemoryMap removed;       // Unmapped regions, mapped address is the former one
+    mapMemoryMap added;         // Newly mapped regions
+    bool complete = true;       // false if driver output was truncated and delta is partial
+};
+
+struct CopyRange
+{
+    ptr_t target;               // Target address
+    void* local;                // Local buffer
+    ptr_t size;                 // Range size
+    bool write;                 // true to write into target, false to read
+    NTSTATUS status;            // Copy status, filled by CopyMemBatch or ReadMemPhysical
+};
+
+struct AllocRange
+{
+    ptr_t base;                 // Desired base, 0 for any. Allocated base on success
+    ptr_t size;                 // Region size. Allocated size on success
+    DWORD type;                 // MEM_RESERVE/MEM_COMMIT. MEM_LARGE_PAGES is tried first if set
+    DWORD protection;           // Memory protection
+    bool physical;              // Directly map physical pages
+    NTSTATUS status;            // Allocation status, filled by AllocateMemBatch
+};
+
+struct ProtectRange
+{
+    ptr_t base;                 // Region base address
+    ptr_t size;                 // Region size
+    DWORD protection;           // New protection
+};
+
+/// <summary>
+/// Client side of driver command ring, see DriverControl::CreateRing.
+/// Commands are executed by driver worker thread without IRP per command.
+/// Single producer: ring must not be used by several threads at once
+/// </summary>
+class CommandRing
+{
+public:
+    BLACKBONE_API CommandRing() = default;
+    BLACKBONE_API ~CommandRing();
+
+    CommandRing( const CommandRing& ) = delete;
+    CommandRing& operator =( const CommandRing& ) = delete;
+
+    /// <summary>
+    /// Queue memory copy. Ring is flushed first if it is full
+    /// </summary>
+    /// <param name="pid">Target PID or target handle</param>
+    /// <param name="target">Target address</param>
+    /// <param name="local">Local buffer, must stay valid until Flush</param>
+    /// <param name="size">Range size</param>
+    /// <param name="write">true to write into target, false to read</param>
+    /// <param name="pStatus">Optional copy status, filled by Flush</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS Push( DWORD pid, ptr_t target, void* local, ptr_t size, bool write, NTSTATUS* pStatus = nullptr );
+
+    /// <summary>
+    /// Publish queued commands and wait until driver executes all of them
+    /// </summary>
+    /// <param name="timeout">Wait timeout in milliseconds</param>
+    /// <returns>STATUS_SUCCESS if all commands succeeded, otherwise status of first failed command</returns>
+    BLACKBONE_API NTSTATUS Flush( DWORD timeout = INFINITE );
+
+    /// <summary>
+    /// Check if ring is created
+    /// </summary>
+    /// <returns>true if ring is mapped</returns>
+    BLACKBONE_API inline bool valid() const { return _ring != nullptr; }
+
+private:
+    friend class DriverControl;
+
+    PCOMMAND_RING _ring = nullptr;                          // Shared ring
+    Handle _hRequest;                                       // Signaled after commands are published
+    Handle _hComplete;                                      // Signaled by driver after ring is drained
+    LONG _head = 0;                                         // Number of queued commands
+    LONG _completed = 0;                                    // Number of collected results
+    NTSTATUS* _results[BLACKBONE_RING_ENTRIES] = { };       // Result destinations
+};
 
 class DriverControl
 {
+public:
+    /// <summary>
+    /// Asynchronous request completion callbacks, invoked from PollCompletions
+    /// </summary>
+    using AsyncCallback = std::function<void( NTSTATUS status )>;
+    using AsyncAllocCallback = std::function<void( NTSTATUS status, ptr_t base, ptr_t size )>;
+    using AsyncRegionsCallback = std::function<void( NTSTATUS status, std::vector<MEMORY_BASIC_INFORMATION64>& regions )>;
+    using AsyncEventsCallback = std::function<void( NTSTATUS status, std::vector<NOTIFY_EVENT>& events, uint32_t lost )>;
+
 public:
     BLACKBONE_API DriverControl();
     BLACKBONE_API ~DriverControl();
@@ -107,6 +204,16 @@ public:
     /// <returns>Status code</returns>
     BLACKBONE_API NTSTATUS AllocateMem( DWORD pid, ptr_t& base, ptr_t& size, DWORD type, DWORD protection, bool physical = false );
 
+    /// <summary>
+    /// Allocate several regions in one request.
+    /// Regions with MEM_LARGE_PAGES type are rounded up to large page size and committed at once,
+    /// regular pages are used if large pages aren't available
+    /// </summary>
+    /// <param name="pid">Target PID</param>
+    /// <param name="ranges">Regions to allocate, base, size and status of every region are updated</param>
+    /// <returns>Request status</returns>
+    BLACKBONE_API NTSTATUS AllocateMemBatch( DWORD pid, std::vector<AllocRange>& ranges );
+
     /// <summary>
     /// Free virtual memory
     /// </summary>
@@ -117,6 +224,23 @@ public:
     /// <returns>Status code</returns>
     BLACKBONE_API NTSTATUS FreeMem( DWORD pid, ptr_t base, ptr_t size, DWORD type );
 
+    /// <summary>
+    /// Reference target process in driver once.
+    /// Returned handle can be passed instead of PID to ReadMem, WriteMem, CopyMemBatch, AllocateMem, FreeMem,
+    /// ProtectMem, ProtectMemBatch, EnumMemoryRegions and ScanMemory, which saves process lookup on every call.
+    /// Handle is closed by driver when target or current process exits
+    /// </summary>
+    /// <param name="pid">Target PID</param>
+    /// <returns>Target handle</returns>
+    BLACKBONE_API call_result_t<DWORD> OpenTarget( DWORD pid );
+
+    /// <summary>
+    /// Close target handle
+    /// </summary>
+    /// <param name="handle">Handle returned by OpenTarget</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS CloseTarget( DWORD handle );
+
     /// <summary>
     /// Read process memory
     /// </summary>
@@ -137,6 +261,26 @@ public:
     /// <returns>Status code</returns>
     BLACKBONE_API NTSTATUS WriteMem( DWORD pid, ptr_t base, ptr_t size, PVOID buffer );
 
+    /// <summary>
+    /// Read or write several ranges in one request.
+    /// Falls back to single range requests if loaded driver doesn't support vectored copy
+    /// </summary>
+    /// <param name="pid">Target PID</param>
+    /// <param name="ranges">Ranges to copy, status of every range is updated</param>
+    /// <returns>STATUS_SUCCESS if all ranges succeeded, otherwise status of first failed range</returns>
+    BLACKBONE_API NTSTATUS CopyMemBatch( DWORD pid, std::vector<CopyRange>& ranges );
+
+    /// <summary>
+    /// Read several ranges by walking target page tables and copying physical memory.
+    /// Target isn't attached and its address space isn't locked, so it's suitable for read-only monitoring.
+    /// Pages that aren't resident fail with STATUS_INVALID_ADDRESS, write ranges fail with STATUS_NOT_SUPPORTED.
+    /// Requires Windows 8.1 or newer
+    /// </summary>
+    /// <param name="pid">Target PID or target handle</param>
+    /// <param name="ranges">Ranges to read, status of every range is updated</param>
+    /// <returns>STATUS_SUCCESS if all ranges succeeded, otherwise status of first failed range</returns>
+    BLACKBONE_API NTSTATUS ReadMemPhysical( DWORD pid, std::vector<CopyRange>& ranges );
+
     /// <summary>
     /// Change memory protection
     /// </summary>
@@ -147,6 +291,14 @@ public:
     /// <returns>Status code</returns>
     BLACKBONE_API NTSTATUS ProtectMem( DWORD pid, ptr_t base, ptr_t size, DWORD protection );
 
+    /// <summary>
+    /// Change memory protection of several regions in one request
+    /// </summary>
+    /// <param name="pid">Target PID.</param>
+    /// <param name="ranges">Regions and their new protection</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS ProtectMemBatch( DWORD pid, const std::vector<ProtectRange>& ranges );
+
     /// <summary>
     /// Maps target process memory into current process
     /// </summary>
@@ -154,8 +306,9 @@ public:
     /// <param name="pipeName">Pipe name to use for hook data transfer</param>
     /// <param name="mapSections">The map sections.</param>
     /// <param name="result">Results</param>
+    /// <param name="lazy">Only record regions, they are mapped with MapMemoryRegion on demand and reported with zero address until then</param>
     /// <returns>Status code </returns>
-    BLACKBONE_API NTSTATUS MapMemory( DWORD pid, const std::wstring& pipeName, bool mapSections, MapMemoryResult& result );
+    BLACKBONE_API NTSTATUS MapMemory( DWORD pid, const std::wstring& pipeName, bool mapSections, MapMemoryResult& result, bool lazy = false );
 
     /// <summary>
     /// Maps single memory region into current process
@@ -167,6 +320,16 @@ public:
     /// <returns>Status code</returns>
     BLACKBONE_API NTSTATUS MapMemoryRegion( DWORD pid, ptr_t base, uint32_t size, MapMemoryRegionResult& result );
 
+    /// <summary>
+    /// Sync memory mapped with MapMemory with current target address space.
+    /// Only regions that were released or allocated since last sync are unmapped or mapped
+    /// </summary>
+    /// <param name="pid">Target PID</param>
+    /// <param name="mapSections">Map new section objects</param>
+    /// <param name="result">Removed and added regions</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS RefreshMemoryMap( DWORD pid, bool mapSections, RemapRefreshResult& result );
+
     /// <summary>
     /// Unmap memory of the target process from current
     /// </summary>
@@ -209,6 +372,31 @@ public:
         bool wait = true
         );
 
+    /// <summary>
+    /// Inject same DLL into several processes in one request
+    /// </summary>
+    /// <param name="pids">Target PIDs</param>
+    /// <param name="path">Full qualified dll path</param>
+    /// <param name="itype">Injection type, IT_Thread or IT_Apc</param>
+    /// <param name="statuses">Injection status of every target, in order of pids</param>
+    /// <param name="initRVA">Init routine RVA</param>
+    /// <param name="initArg">Init routine argument</param>
+    /// <param name="unlink">Unlink module after injection</param>
+    /// <param name="erasePE">Erase PE headers after injection</param>
+    /// <param name="wait">Wait for injection</param>
+    /// <returns>Request status</returns>
+    BLACKBONE_API NTSTATUS InjectDllBatch(
+        const std::vector<DWORD>& pids,
+        const std::wstring& path,
+        InjectType itype,
+        std::vector<NTSTATUS>& statuses,
+        uint32_t initRVA = 0,
+        const std::wstring& initArg = L"",
+        bool unlink = false,
+        bool erasePE = false,
+        bool wait = true
+        );
+
     /// <summary>
     /// Manually map PE image
     /// </summary>
@@ -275,8 +463,151 @@ public:
     /// </summary>
     /// <param name="pid">Target process ID</param>
     /// <param name="regions">Found regions</param>
+    /// <param name="fromVad">
+    /// Read VAD tree directly: one region per allocation with its initial protection and zero State.
+    /// Much cheaper for large address spaces, when per-page state isn't needed
+    /// </param>
     /// <returns>Status code</returns>
-    BLACKBONE_API NTSTATUS EnumMemoryRegions( DWORD pid, std::vector<MEMORY_BASIC_INFORMATION64>& regions );
+    BLACKBONE_API NTSTATUS EnumMemoryRegions( DWORD pid, std::vector<MEMORY_BASIC_INFORMATION64>& regions, bool fromVad = false );
+
+    /// <summary>
+    /// Enumerate loader modules of target process in single request
+    /// </summary>
+    /// <param name="pid">Target process ID</param>
+    /// <param name="x86">Walk 32 bit loader list of WOW64 process</param>
+    /// <param name="modules">Found modules</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS EnumModules( DWORD pid, bool x86, std::vector<ModuleDataPtr>& modules );
+
+    /// <summary>
+    /// Scan committed, accessible, non-guarded memory regions for pattern.
+    /// Memory is scanned in target address space, only match addresses are transferred.
+    /// Request is sent through overlapped handle, so scans from several threads run concurrently.
+    /// </summary>
+    /// <param name="pid">Target process ID</param>
+    /// <param name="pattern">Pattern bytes</param>
+    /// <param name="mask">Pattern mask, 0xFF - significant byte, 0x00 - wildcard. nullptr for exact match</param>
+    /// <param name="size">Pattern size, up to BLACKBONE_MAX_PATTERN</param>
+    /// <param name="results">Found addresses</param>
+    /// <param name="minAddress">Lowest scanned address</param>
+    /// <param name="maxAddress">Highest scanned address (exclusive), 0 - no limit</param>
+    /// <param name="protection">Any of these protection flags must be set, 0 - any protection</param>
+    /// <param name="type">Any of MEM_IMAGE | MEM_PRIVATE | MEM_MAPPED, 0 - any type</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS ScanMemory(
+        DWORD pid,
+        const uint8_t* pattern,
+        const uint8_t* mask,
+        size_t size,
+        std::vector<ptr_t>& results,
+        ptr_t minAddress = 0,
+        ptr_t maxAddress = 0,
+        DWORD protection = 0,
+        DWORD type = 0
+        );
+
+    /// <summary>
+    /// Create command ring for current process. Only one ring per process can exist
+    /// </summary>
+    /// <param name="ring">Ring to initialize</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS CreateRing( CommandRing& ring );
+
+    /// <summary>
+    /// Destroy command ring. Pending commands are discarded
+    /// </summary>
+    /// <param name="ring">Ring to destroy</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS DestroyRing( CommandRing& ring );
+
+    /// <summary>
+    /// Subscribe current process to driver process, thread and image load events.
+    /// Existing subscription filter is replaced. Events are retrieved with WaitEventsAsync
+    /// </summary>
+    /// <param name="pid">Watched process ID, 0 to watch all processes</param>
+    /// <param name="mask">Combination of BLACKBONE_EVENT_MASK( NotifyEventType ) values</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS SubscribeEvents( DWORD pid, uint32_t mask );
+
+    /// <summary>
+    /// Remove event subscription. Pending WaitEventsAsync request completes with STATUS_CANCELLED
+    /// </summary>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS UnsubscribeEvents();
+
+    /// <summary>
+    /// Queue process memory read. Buffer must stay valid until callback is invoked
+    /// </summary>
+    /// <param name="pid">Target PID or target handle</param>
+    /// <param name="base">Target base</param>
+    /// <param name="size">Data size</param>
+    /// <param name="buffer">Buffer address</param>
+    /// <param name="callback">Completion callback</param>
+    /// <returns>Status code, callback is invoked only if request was queued successfully</returns>
+    BLACKBONE_API NTSTATUS ReadMemAsync( DWORD pid, ptr_t base, ptr_t size, PVOID buffer, AsyncCallback callback );
+
+    /// <summary>
+    /// Queue process memory write. Buffer must stay valid until callback is invoked
+    /// </summary>
+    /// <param name="pid">Target PID or target handle</param>
+    /// <param name="base">Target base</param>
+    /// <param name="size">Data size</param>
+    /// <param name="buffer">Buffer address</param>
+    /// <param name="callback">Completion callback</param>
+    /// <returns>Status code, callback is invoked only if request was queued successfully</returns>
+    BLACKBONE_API NTSTATUS WriteMemAsync( DWORD pid, ptr_t base, ptr_t size, PVOID buffer, AsyncCallback callback );
+
+    /// <summary>
+    /// Queue virtual memory allocation
+    /// </summary>
+    /// <param name="pid">Target PID or target handle</param>
+    /// <param name="base">Desired base. If 0 address is chosed by the system</param>
+    /// <param name="size">Region size</param>
+    /// <param name="type">Allocation type - MEM_RESERVE/MEM_COMMIT</param>
+    /// <param name="protection">Memory protection</param>
+    /// <param name="callback">Completion callback, receives allocated base and size</param>
+    /// <param name="physical">Allocate physical pages</param>
+    /// <returns>Status code, callback is invoked only if request was queued successfully</returns>
+    BLACKBONE_API NTSTATUS AllocateMemAsync( 
+        DWORD pid, ptr_t base, ptr_t size, DWORD type, DWORD protection, 
+        AsyncAllocCallback callback, bool physical = false 
+        );
+
+    /// <summary>
+    /// Queue memory region enumeration. Chunks are requested one after another,
+    /// callback is invoked once with all regions after the last chunk.
+    /// Requires driver with IOCTL_BLACKBONE_ENUM_REGIONS_NEXT support
+    /// </summary>
+    /// <param name="pid">Target PID or target handle</param>
+    /// <param name="callback">Completion callback</param>
+    /// <param name="fromVad">Read VAD tree directly, see EnumMemoryRegions</param>
+    /// <returns>Status code, callback is invoked only if request was queued successfully</returns>
+    BLACKBONE_API NTSTATUS EnumMemoryRegionsAsync( DWORD pid, AsyncRegionsCallback callback, bool fromVad = false );
+
+    /// <summary>
+    /// Queue wait for subscribed events, see SubscribeEvents.
+    /// Callback is invoked once at least one event is available; queue new wait from it to keep receiving events.
+    /// Only one wait can be pending at a time
+    /// </summary>
+    /// <param name="callback">Completion callback, receives events and number of events lost due to queue overflow</param>
+    /// <param name="maxEvents">Max number of events per completion</param>
+    /// <returns>Status code, callback is invoked only if request was queued successfully</returns>
+    BLACKBONE_API NTSTATUS WaitEventsAsync( AsyncEventsCallback callback, size_t maxEvents = 64 );
+
+    /// <summary>
+    /// Dequeue completed asynchronous requests and invoke their callbacks on the calling thread.
+    /// Can be called from any number of threads. All queued requests must be completed before Unload or Reload
+    /// </summary>
+    /// <param name="timeout">Wait timeout in milliseconds</param>
+    /// <param name="maxCount">Max number of completions to process</param>
+    /// <returns>Number of processed completions, 0 on timeout</returns>
+    BLACKBONE_API size_t PollCompletions( DWORD timeout = INFINITE, size_t maxCount = 64 );
+
+    /// <summary>
+    /// Get completion port used for asynchronous requests, e.g. to post custom wake-up packets
+    /// </summary>
+    /// <returns>Port handle, NULL if no asynchronous request was issued yet</returns>
+    BLACKBONE_API inline HANDLE completionPort() const { return _hPort; }
 
     /// <summary>
     /// Check if driver is loaded
@@ -285,6 +616,18 @@ public:
     BLACKBONE_API inline bool loaded() const { return _hDriver.valid(); }
     BLACKBONE_API inline NTSTATUS status() const { return _loadStatus; }
 
+    /// <summary>
+    /// Number of driver requests sent so far, by all processes
+    /// </summary>
+    /// <returns>Request count</returns>
+    BLACKBONE_API inline uint64_t ioctls() const { return _ioctls; }
+
+    /// <summary>
+    /// Synchronous request latencies, recorded under LatencyOp::DriverRequest once enabled
+    /// </summary>
+    /// <returns>Latency recorder</returns>
+    BLACKBONE_API inline LatencyRecorder& latency() { return _latency; }
+
 private:
     DriverControl( const DriverControl& ) = delete;
     DriverControl& operator = (const DriverControl&) = delete;
@@ -304,6 +647,79 @@ private:
     /// <returns>Status</returns>
     NTSTATUS UnloadDriver( const std::wstring& svcName );
 
+    /// <summary>
+    /// Enumerate memory regions with driver that lacks IOCTL_BLACKBONE_ENUM_REGIONS_NEXT
+    /// </summary>
+    /// <param name="pid">Target process ID</param>
+    /// <param name="regions">Found regions</param>
+    /// <returns>Status code</returns>
+    NTSTATUS EnumMemoryRegionsLegacy( DWORD pid, std::vector<MEMORY_BASIC_INFORMATION64>& regions );
+
+    /// <summary>
+    /// Send ranges as COPY_MEMORY_VECTOR request
+    /// </summary>
+    /// <param name="code">IOCTL code</param>
+    /// <param name="pid">Target PID</param>
+    /// <param name="ranges">Ranges, status of every range is updated on success</param>
+    /// <returns>Request status</returns>
+    NTSTATUS SendCopyVector( DWORD code, DWORD pid, std::vector<CopyRange>& ranges );
+
+    /// <summary>
+    /// Pending asynchronous request
+    /// </summary>
+    struct AsyncRequest;
+
+    /// <summary>
+    /// Open overlapped driver handle and completion port on first use
+    /// </summary>
+    /// <returns>Status code</returns>
+    NTSTATUS EnsureAsync();
+
+    /// <summary>
+    /// Send synchronous request to driver
+    /// </summary>
+    /// <param name="code">IOCTL code</param>
+    /// <param name="in">Input buffer</param>
+    /// <param name="inSize">Input size</param>
+    /// <param name="out">Output buffer</param>
+    /// <param name="outSize">Output size</param>
+    /// <param name="bytes">Number of bytes returned</param>
+    /// <returns>DeviceIoControl result</returns>
+    BOOL Ioctl( DWORD code, LPVOID in, DWORD inSize, LPVOID out, DWORD outSize, DWORD* bytes );
+
+    /// <summary>
+    /// Send request through overlapped handle and wait for its completion.
+    /// Requests on synchronous handle are serialized by I/O manager, these are not
+    /// </summary>
+    /// <param name="code">IOCTL code</param>
+    /// <param name="in">Input buffer</param>
+    /// <param name="inSize">Input size</param>
+    /// <param name="out">Output buffer</param>
+    /// <param name="outSize">Output size</param>
+    /// <param name="bytes">Number of bytes returned</param>
+    /// <returns>DeviceIoControl result</returns>
+    BOOL IoctlParallel( DWORD code, LPVOID in, DWORD inSize, LPVOID out, DWORD outSize, DWORD* bytes );
+
+    /// <summary>
+    /// Send request through overlapped handle. Ownership is passed to completion port on success
+    /// </summary>
+    /// <param name="request">Request</param>
+    /// <returns>Status code</returns>
+    NTSTATUS SubmitAsync( std::unique_ptr<AsyncRequest> request );
+
+    /// <summary>
+    /// Queue next region enumeration chunk
+    /// </summary>
+    /// <param name="data">Enumeration state</param>
+    /// <param name="regions">Regions found so far</param>
+    /// <param name="callback">Final completion callback</param>
+    /// <returns>Status code</returns>
+    NTSTATUS EnumRegionsChunkAsync( 
+        const ENUM_REGIONS_NEXT& data,
+        std::shared_ptr<std::vector<MEMORY_BASIC_INFORMATION64>> regions, 
+        AsyncRegionsCallback callback 
+        );
+
     /// <summary>
     /// Fill minimum driver registry entry
     /// </summary>
@@ -313,7 +729,12 @@ private:
     LSTATUS PrepareDriverRegEntry( const std::wstring& svcName, const std::wstring& path );
 private:
     Handle _hDriver;
+    Handle _hAsyncDriver;       // Overlapped driver handle
+    Handle _hPort;              // Completion port bound to _hAsyncDriver
+    std::mutex _asyncLock;      // Guards lazy async handle creation
     NTSTATUS _loadStatus = STATUS_NOT_FOUND;
+    std::atomic<uint64_t> _ioctls{ 0 };     // Driver requests sent
+    LatencyRecorder _latency;               // Request latencies
 };
 
 // Syntax sugar
@@ -32,6 +32,15 @@ typedef NTSTATUS( NTAPI* fnNtQueryVirtualMemory )(
     OUT PSIZE_T ReturnLength
     );
 
+// NtReadVirtualMemory
+typedef NTSTATUS( NTAPI* fnNtReadVirtualMemory )(
+    IN  HANDLE  ProcessHandle,
+    IN  PVOID   BaseAddress,
+    OUT PVOID   Buffer,
+    IN  SIZE_T  BufferLength,
+    OUT PSIZE_T ReturnLength OPTIONAL
+    );
+
 // NtWow64QueryInformationProcess64
 typedef NTSTATUS( NTAPI *fnNtWow64QueryInformationProcess64 )(
     IN  HANDLE ProcessHandle,
@@ -128,6 +137,24 @@ typedef NTSTATUS( NTAPI* fnNtCreateThreadEx )(
     OUT LPVOID lpBytesBuffer
     );
 
+// NtGetWriteWatch
+typedef NTSTATUS( NTAPI* fnNtGetWriteWatch )(
+    IN HANDLE ProcessHandle,
+    IN ULONG Flags,
+    IN PVOID BaseAddress,
+    IN SIZE_T RegionSize,
+    OUT PVOID* UserAddressArray,
+    IN OUT PULONG_PTR EntriesInUserAddressArray,
+    OUT PULONG Granularity
+    );
+
+// NtResetWriteWatch
+typedef NTSTATUS( NTAPI* fnNtResetWriteWatch )(
+    IN HANDLE ProcessHandle,
+    IN PVOID BaseAddress,
+    IN SIZE_T RegionSize
+    );
+
 // NtLockVirtualMemory
 typedef NTSTATUS( NTAPI* fnNtLockVirtualMemory )(
     IN HANDLE process,
@@ -198,6 +225,26 @@ typedef DWORD( NTAPI* fnNtQuerySection )(
     PULONG ReturnLength
     );
 
+// NtMapViewOfSection
+typedef NTSTATUS( NTAPI* fnNtMapViewOfSection )(
+    IN HANDLE SectionHandle,
+    IN HANDLE ProcessHandle,
+    IN OUT PVOID* BaseAddress,
+    IN ULONG_PTR ZeroBits,
+    IN SIZE_T CommitSize,
+    IN OUT PLARGE_INTEGER SectionOffset,
+    IN OUT PSIZE_T ViewSize,
+    IN DWORD InheritDisposition,
+    IN ULONG AllocationType,
+    IN ULONG Win32Protect
+    );
+
+// NtUnmapViewOfSection
+typedef NTSTATUS( NTAPI* fnNtUnmapViewOfSection )(
+    IN HANDLE ProcessHandle,
+    IN PVOID BaseAddress
+    );
+
 // NtSuspendProcess
 typedef NTSTATUS( NTAPI* fnNtSuspendProcess )(
     HANDLE ProcessHandle
@@ -294,4 +341,29 @@ typedef BOOL( __stdcall* fnQueryFullProcessImageNameW)
         PDWORD lpdwSize
     );
 
+// PssCaptureSnapshot
+typedef DWORD( __stdcall* fnPssCaptureSnapshot )
+    (
+        HANDLE            ProcessHandle,
+        PSS_CAPTURE_FLAGS CaptureFlags,
+        DWORD             ThreadContextFlags,
+        HPSS*             SnapshotHandle
+    );
+
+// PssQuerySnapshot
+typedef DWORD( __stdcall* fnPssQuerySnapshot )
+    (
+        HPSS                        SnapshotHandle,
+        PSS_QUERY_INFORMATION_CLASS InformationClass,
+        void*                       Buffer,
+        DWORD                       BufferLength
+    );
+
+// PssFreeSnapshot
+typedef DWORD( __stdcall* fnPssFreeSnapshot )
+    (
+        HANDLE ProcessHandle,
+        HPSS   SnapshotHandle
+    );
+
 }
\ No newline at end of file
@@ -9,6 +9,7 @@
 #include <winioctl.h>
 #include <TlHelp32.h>
 #include <Shlwapi.h>
+#include <ProcessSnapshot.h>
 
 #pragma warning(push)
 #pragma warning(disable : 4005)
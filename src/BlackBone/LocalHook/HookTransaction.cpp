@@ -0,0 +1,187 @@
+#include "HookTransaction.h"
+#include "../Process/Process.h"
+
+#include <algorithm>
+
+namespace blackbone
+{
+
+// Attempts to catch every thread outside of non-relocated prologues
+constexpr int MaxCommitAttempts = 16;
+
+HookTransaction::~HookTransaction()
+{
+    Abort();
+}
+
+/// <summary>
+/// Queue hook patch. Called by hook objects instead of writing patch directly
+/// </summary>
+/// <param name="hook">Hook object</param>
+/// <param name="size">Patch size</param>
+/// <returns>true on success</returns>
+bool HookTransaction::Stage( DetourBase* hook, size_t size )
+{
+    if (hook == nullptr || size == 0)
+        return false;
+
+    for (auto& patch : _patches)
+        if (patch.hook == hook || patch.address == hook->_original)
+            return false;
+
+    Patch patch;
+    patch.hook = hook;
+    patch.address = reinterpret_cast<uint8_t*>(hook->_original);
+    patch.size = size;
+
+    _patches.emplace_back( patch );
+    return true;
+}
+
+/// <summary>
+/// Write all prepared hooks
+/// </summary>
+/// <returns>true on success, false if some thread couldn't be moved out of a prologue</returns>
+bool HookTransaction::Commit()
+{
+    if (_patches.empty())
+        return true;
+
+    Process thisProc;
+    if (!NT_SUCCESS( thisProc.Attach( GetCurrentProcessId() ) ))
+        return false;
+
+    auto threads = thisProc.threads().getAll();
+    std::vector<ThreadPtr> suspended;
+
+    for (int attempt = 0; attempt < MaxCommitAttempts; attempt++)
+    {
+        bool stuck = false;
+
+        for (auto& thd : threads)
+        {
+            if (thd->id() == GetCurrentThreadId() || !thd->Suspend())
+                continue;
+
+            suspended.emplace_back( thd );
+            if (!FixupThread( thd->handle() ))
+            {
+                stuck = true;
+                break;
+            }
+        }
+
+        bool written = !stuck && WritePatches();
+
+        for (auto& thd : suspended)
+            thd->Resume();
+
+        suspended.clear();
+
+        // Patches written before a failure stay installed
+        _patches.erase( std::remove_if( _patches.begin(), _patches.end(), []( const Patch& patch ) { return patch.hook->_hooked; } ), _patches.end() );
+
+        if (written || !stuck)
+            return written;
+
+        // Let thread leave original prologue
+        SwitchToThread();
+    }
+
+    return false;
+}
+
+/// <summary>
+/// Drop all prepared hooks
+/// </summary>
+void HookTransaction::Abort()
+{
+    for (auto& patch : _patches)
+        if (patch.hook->_type == HookType::Int3)
+            DetourBase::RemoveBreakpoint( patch.address );
+
+    _patches.clear();
+}
+
+/// <summary>
+/// Move suspended thread out of overwritten prologues
+/// </summary>
+/// <param name="hThread">Thread handle</param>
+/// <returns>false if thread is inside prologue that wasn't relocated</returns>
+bool HookTransaction::FixupThread( HANDLE hThread )
+{
+    CONTEXT ctx = { 0 };
+    ctx.ContextFlags = CONTEXT_CONTROL;
+
+    if (!GetThreadContext( hThread, &ctx ))
+        return true;
+
+    auto ip = reinterpret_cast<uint8_t*>(ctx.NIP);
+    for (auto& patch : _patches)
+    {
+        // Thread at function start will enter the hook
+        if (ip <= patch.address || ip >= patch.address + patch.size)
+            continue;
+
+        // Original code was moved by whole instructions, some of them were rewritten
+        if (patch.hook->_type != HookType::Inline)
+            return false;
+
+        auto offset = patch.hook->_relocated.Translate( static_cast<uint32_t>(ip - patch.address) );
+        if (offset < 0)
+            return false;
+
+        ctx.NIP = reinterpret_cast<uintptr_t>(patch.hook->_origThunk + offset);
+        return SetThreadContext( hThread, &ctx ) != FALSE;
+    }
+
+    return true;
+}
+
+/// <summary>
+/// Write all patches
+/// </summary>
+/// <returns>true on success</returns>
+bool HookTransaction::WritePatches()
+{
+    auto page = []( const uint8_t* ptr ) { return reinterpret_cast<uintptr_t>(ptr) & ~static_cast<uintptr_t>(0xFFF); };
+
+    std::sort( _patches.begin(), _patches.end(), []( const Patch& l, const Patch& r ) { return l.address < r.address; } );
+
+    for (size_t first = 0; first < _patches.size();)
+    {
+        // Patches with same first and last pages share protection change
+        auto startPage = page( _patches[first].address );
+        auto endPage = page( _patches[first].address + _patches[first].size - 1 );
+
+        size_t last = first + 1;
+        while (last < _patches.size()
+            && page( _patches[last].address ) == startPage
+            && page( _patches[last].address + _patches[last].size - 1 ) == endPage)
+        {
+            last++;
+        }
+
+        auto base = reinterpret_cast<void*>(startPage);
+        auto size = endPage + 0x1000 - startPage;
+
+        DWORD flOld = 0;
+        if (!VirtualProtect( base, size, PAGE_EXECUTE_READWRITE, &flOld ))
+            return false;
+
+        for (size_t i = first; i < last; i++)
+        {
+            memcpy( _patches[i].address, _patches[i].hook->_newCode, _patches[i].size );
+            _patches[i].hook->_hooked = true;
+        }
+
+        VirtualProtect( base, size, flOld, &flOld );
+        FlushInstructionCache( GetCurrentProcess(), base, size );
+
+        first = last;
+    }
+
+    return true;
+}
+
+}
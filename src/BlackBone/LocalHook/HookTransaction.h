@@ -0,0 +1,95 @@
+#pragma once
+
+#include "LocalHookBase.h"
+
+#include <vector>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Installs a group of inline and int3 hooks at once.
+/// Hooks added to transaction are prepared but not written, Commit suspends other threads once,
+/// moves threads stopped inside overwritten prologues into relocated code,
+/// writes all patches with one protection change per page and resumes
+/// </summary>
+class HookTransaction
+{
+public:
+    BLACKBONE_API HookTransaction() = default;
+    BLACKBONE_API ~HookTransaction();
+
+    /// <summary>
+    /// Prepare hook without writing it
+    /// </summary>
+    /// <param name="detour">Hook object</param>
+    /// <param name="args">Hook object 'Hook' arguments</param>
+    /// <returns>true on success</returns>
+    template<typename D, typename... Args>
+    bool Add( D& detour, Args&&... args )
+    {
+        auto& base = static_cast<DetourBase&>(detour);
+
+        base._transaction = this;
+        bool result = detour.Hook( std::forward<Args>( args )... );
+        base._transaction = nullptr;
+
+        return result;
+    }
+
+    /// <summary>
+    /// Write all prepared hooks
+    /// </summary>
+    /// <returns>true on success, false if some thread couldn't be moved out of a prologue</returns>
+    BLACKBONE_API bool Commit();
+
+    /// <summary>
+    /// Drop all prepared hooks
+    /// </summary>
+    BLACKBONE_API void Abort();
+
+    /// <summary>
+    /// Queue hook patch. Called by hook objects instead of writing patch directly
+    /// </summary>
+    /// <param name="hook">Hook object</param>
+    /// <param name="size">Patch size</param>
+    /// <returns>true on success</returns>
+    BLACKBONE_API bool Stage( DetourBase* hook, size_t size );
+
+    /// <summary>
+    /// Number of prepared hooks
+    /// </summary>
+    BLACKBONE_API size_t size() const { return _patches.size(); }
+
+private:
+    HookTransaction( const HookTransaction& ) = delete;
+    HookTransaction& operator =( const HookTransaction& ) = delete;
+
+    /// <summary>
+    /// Prepared patch
+    /// </summary>
+    struct Patch
+    {
+        DetourBase* hook = nullptr;
+        uint8_t* address = nullptr;     // Patched function
+        size_t size = 0;                // Patch size
+    };
+
+    /// <summary>
+    /// Move suspended thread out of overwritten prologues
+    /// </summary>
+    /// <param name="hThread">Thread handle</param>
+    /// <returns>false if thread is inside prologue that wasn't relocated</returns>
+    bool FixupThread( HANDLE hThread );
+
+    /// <summary>
+    /// Write all patches
+    /// </summary>
+    /// <returns>true on success</returns>
+    bool WritePatches();
+
+private:
+    std::vector<Patch> _patches;
+};
+
+}
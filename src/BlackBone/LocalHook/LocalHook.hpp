@@ -1,6 +1,7 @@
 #pragma once
 
 #include "HookHandlers.h"
+#include "HookTransaction.h"
 #include "../Process/Process.h"
 
 namespace blackbone
@@ -134,6 +135,9 @@ public:
                 break;
         }
 
+        if (this->_type == HookType::Int3 || this->_type == HookType::HWBP)
+            DetourBase::RemoveBreakpoint( this->_original );
+
         this->_hooked = false;
         return true;
     }
@@ -180,6 +184,10 @@ private:
         (*jmpToThunk)->setBaseAddress( (uintptr_t)this->_original );
         auto codeSize = (*jmpToThunk)->relocCode( this->_newCode );
 
+        // Patch is written on transaction commit
+        if (this->_transaction != nullptr)
+            return this->_transaction->Stage( this, codeSize );
+
         DWORD flOld = 0;
         if (!VirtualProtect( this->_original, codeSize, PAGE_EXECUTE_READWRITE, &flOld ))
             return false;
@@ -202,17 +210,15 @@ private:
         this->_origSize = sizeof( this->_newCode[0] );
 
         // Setup handler
-        if (this->_vecHandler == nullptr)
-            this->_vecHandler = AddVectoredExceptionHandler( 1, &DetourBase::VectoredHandler );
-
-        if (!this->_vecHandler)
+        if (!DetourBase::AddBreakpoint( this->_original, this ))
             return false;
 
-        this->_breakpoints.insert( std::make_pair( this->_original, (DetourBase*)this ) );
-
         // Save original code
         memcpy( this->_origCode, this->_original, this->_origSize );
 
+        if (this->_transaction != nullptr)
+            return this->_transaction->Stage( this, this->_origSize );
+
         // Write break instruction
         DWORD flOld = 0;
         if (!VirtualProtect(this->_original, this->_origSize, PAGE_EXECUTE_READWRITE, &flOld))
@@ -233,14 +239,9 @@ private:
         thisProc.Attach( GetCurrentProcessId() );
 
         // Setup handler
-        if (this->_vecHandler == nullptr)
-            this->_vecHandler = AddVectoredExceptionHandler( 1, &DetourBase::VectoredHandler );
-
-        if (!this->_vecHandler)
+        if (!DetourBase::AddBreakpoint( this->_original, this ))
             return false;
 
-        this->_breakpoints.insert( std::make_pair( this->_original, (DetourBase*)this ) );
-
         // Add breakpoint to every thread
         for (auto& thd : thisProc.threads().getAll())
             this->_hwbpIdx[thd->id()] = thd->AddHWBP( reinterpret_cast<ptr_t>(this->_original), hwbp_execute, hwbp_1 ).result();
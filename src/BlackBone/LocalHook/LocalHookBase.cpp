@@ -2,7 +2,8 @@
 
 namespace blackbone
 {
-std::unordered_map<void*, DetourBase*> DetourBase::_breakpoints;
+DetourBase::BreakpointSlot DetourBase::_breakpoints[DetourBase::BreakpointSlots];
+CriticalSection DetourBase::_breakpointLock;
 void* DetourBase::_vecHandler = nullptr;
 
 DetourBase::DetourBase()
@@ -11,46 +12,29 @@ DetourBase::DetourBase()
 
 DetourBase::~DetourBase()
 {
-    VirtualFree( _buf, 0, MEM_RELEASE );
+    TrampolinePool::Instance().Free( _buf );
 }
 
 /// <summary>
 /// Allocate detour buffer as close to target as possible
 /// </summary>
 /// <param name="nearest">Target address</param>
+/// <param name="size">Buffer size</param>
 /// <returns>true on success</returns>
-bool DetourBase::AllocateBuffer( uint8_t* nearest )
+bool DetourBase::AllocateBuffer( uint8_t* nearest, size_t size /*= TrampolinePool::SlotSize*/ )
 {
     if (_buf != nullptr)
         return true;
 
-    MEMORY_BASIC_INFORMATION mbi = { 0 };
-    for (SIZE_T addr = (SIZE_T)nearest; addr > (SIZE_T)nearest - 0x80000000; addr = (SIZE_T)mbi.BaseAddress - 1)
-    {
-        if (!VirtualQuery( (LPCVOID)addr, &mbi, sizeof( mbi ) ))
-            break;
-
-        if (mbi.State == MEM_FREE)
-        {
-            _buf = (uint8_t*)VirtualAlloc(
-                (uint8_t*)mbi.BaseAddress + mbi.RegionSize - 0x1000, 0x1000,
-                MEM_RESERVE | MEM_COMMIT, PAGE_EXECUTE_READWRITE
-                );
-
-            if (_buf)
-                break;
-        }
-    }
-
-    // If allocating a memory page failed, allocate first suitable
+    _buf = TrampolinePool::Instance().Allocate( nearest, size );
     if (_buf == nullptr)
-        _buf = (uint8_t*)VirtualAlloc( nullptr, 0x1000, MEM_RESERVE | MEM_COMMIT, PAGE_EXECUTE_READWRITE );
+        return false;
 
     _origCode = _buf + 0x100;
     _origThunk = _buf + 0x200;
     _newCode  = _buf + 0x300;
 
-    return _buf != nullptr;
+    return true;
 }
 
 
@@ -110,74 +94,116 @@ bool DetourBase::ToggleHBP( int index, bool enable )
 /// <param name="Ptr">Origianl function address</param>
 void DetourBase::CopyOldCode( uint8_t* ptr )
 { 
-    // Store original bytes
-    uint8_t* src = ptr;
-    uint8_t* thunk = _origThunk, *original = _origCode;
-    uint32_t all_len = 0;
-    ldasm_data ld = { 0 };
+    // Whole instructions are moved into thunk, branches and rip-relative operands are rewritten.
+    // Decoding reads at most one instruction past hook size
+    NTSTATUS status = CodeRelocator::Relocate(
+        ptr, _origSize + 15,
+        reinterpret_cast<ptr_t>(ptr), reinterpret_cast<ptr_t>(_origThunk),
+        static_cast<uint32_t>(_origSize), is_x64 != 0, _relocated
+        );
+
+    // Thunk must fit relocated code and jump back
+    if (NT_SUCCESS( status ) && _relocated.code.size() + 14 <= static_cast<size_t>(_newCode - _origThunk))
+    {
+        memcpy( _origCode, ptr, _relocated.consumed );
+        memcpy( _origThunk, _relocated.code.data(), _relocated.code.size() );
 
-    do 
+        SET_JUMP( _origThunk + _relocated.code.size(), ptr + _relocated.consumed );
+        _callOriginal = _origThunk;
+    }
+    // Failed to copy old code, use backup plan
+    else
     {
-        uint32_t len = ldasm( src, &ld, is_x64 );
+        _relocated = RelocatedCode();
+        _type = HookType::InternalInline;
+        memcpy( _origCode, ptr, _origSize );
+    }
+}
 
-        // Determine code end
-        if (ld.flags & F_INVALID
-                || (len == 1 && (src[ld.opcd_offset] == 0xCC || src[ld.opcd_offset] == 0xC3))
-                || (len == 3 && src[ld.opcd_offset] == 0xC2)
-                || len + all_len > 128)
-        {
-            break;
-        }
+/// <summary>
+/// Breakpoint table start index for address
+/// </summary>
+static inline size_t BreakpointIndex( void* address, size_t slots )
+{
+    return static_cast<size_t>((reinterpret_cast<uint64_t>(address) * 0x9E3779B97F4A7C15ull) >> 32) & (slots - 1);
+}
 
-        // move instruction 
-        memcpy( original, src, len );
-        memcpy( thunk, src, len );
+/// <summary>
+/// Route breakpoint at address to hook and install exception handler
+/// </summary>
+/// <param name="address">Breakpoint address</param>
+/// <param name="hook">Hook instance</param>
+/// <returns>true on success, false if breakpoint table is full</returns>
+bool DetourBase::AddBreakpoint( void* address, DetourBase* hook )
+{
+    CSLock lck( _breakpointLock );
 
-        // if instruction has relative offset, calculate new offset 
-        if (ld.flags & F_RELATIVE)
+    if (_vecHandler == nullptr)
+        _vecHandler = AddVectoredExceptionHandler( 1, &DetourBase::VectoredHandler );
+
+    if (_vecHandler == nullptr)
+        return false;
+
+    for (size_t i = 0, idx = BreakpointIndex( address, BreakpointSlots ); i < BreakpointSlots; i++, idx = (idx + 1) & (BreakpointSlots - 1))
+    {
+        auto& slot = _breakpoints[idx];
+        auto key = slot.address.load( std::memory_order_relaxed );
+
+        // Instance pointer must be visible before address is
+        if (key == address || key == nullptr)
         {
-            int32_t diff = 0;
-            const uintptr_t ofst = (ld.disp_offset != 0 ? ld.disp_offset : ld.imm_offset);
-            const uintptr_t sz = ld.disp_size != 0 ? ld.disp_size : ld.imm_size;
-
-            memcpy( &diff, src + ofst, sz );
-
-        #ifdef USE64
-            // exit if jump is greater then 2GB
-            if (_abs64( src + len + diff - thunk ) > INT_MAX)
-            {
-                break;
-            }
-            else
-            {
-                diff += static_cast<int32_t>(src - thunk);
-                memcpy( thunk + ofst, &diff, sz );
-            }
-        #else
-            diff += src - thunk;
-            memcpy( thunk + ofst, &diff, sz );
-        #endif
+            slot.hook.store( hook, std::memory_order_release );
+            if (key == nullptr)
+                slot.address.store( address, std::memory_order_release );
+
+            return true;
         }
+    }
 
-        src += len;
-        thunk += len;
-        original += len;
-        all_len += len;
-    } while (all_len < _origSize);
+    return false;
+}
 
-    // Failed to copy old code, use backup plan
-    if (all_len < _origSize)
-    {
-        _type = HookType::InternalInline;
-        memcpy( _origCode, ptr, _origSize );
-    }         
-    else
+/// <summary>
+/// Stop routing breakpoint at address
+/// </summary>
+/// <param name="address">Breakpoint address</param>
+void DetourBase::RemoveBreakpoint( void* address )
+{
+    CSLock lck( _breakpointLock );
+
+    for (size_t i = 0, idx = BreakpointIndex( address, BreakpointSlots ); i < BreakpointSlots; i++, idx = (idx + 1) & (BreakpointSlots - 1))
     {
-        SET_JUMP( thunk, src );
-        _callOriginal = _origThunk;
-    } 
+        auto key = _breakpoints[idx].address.load( std::memory_order_relaxed );
+        if (key == nullptr)
+            return;
+
+        if (key == address)
+        {
+            _breakpoints[idx].hook.store( nullptr, std::memory_order_release );
+            return;
+        }
+    }
 }
 
+/// <summary>
+/// Find hook by breakpoint address. Safe to call from exception handler on any thread
+/// </summary>
+/// <param name="address">Breakpoint address</param>
+/// <returns>Hook instance, nullptr if not found</returns>
+DetourBase* DetourBase::FindBreakpoint( void* address )
+{
+    for (size_t i = 0, idx = BreakpointIndex( address, BreakpointSlots ); i < BreakpointSlots; i++, idx = (idx + 1) & (BreakpointSlots - 1))
+    {
+        auto key = _breakpoints[idx].address.load( std::memory_order_acquire );
+        if (key == nullptr)
+            return nullptr;
+
+        if (key == address)
+            return _breakpoints[idx].hook.load( std::memory_order_acquire );
+    }
+
+    return nullptr;
+}
 
 /// <summary>
 /// Exception handler
@@ -209,10 +235,9 @@ LONG NTAPI DetourBase::VectoredHandler( PEXCEPTION_POINTERS excpt )
 /// <returns>Exception disposition</returns>
 LONG NTAPI DetourBase::Int3Handler( PEXCEPTION_POINTERS excpt )
 {
-    if (_breakpoints.count( excpt->ExceptionRecord->ExceptionAddress ))
+    DetourBase* pInst = FindBreakpoint( excpt->ExceptionRecord->ExceptionAddress );
+    if (pInst != nullptr)
     {
-        DetourBase* pInst = _breakpoints[excpt->ExceptionRecord->ExceptionAddress];
-
         ((_NT_TIB*)NtCurrentTeb())->ArbitraryUserPointer = (void*)pInst;
         excpt->ContextRecord->NIP = (uintptr_t)pInst->_internalHandler;
 
@@ -242,10 +267,9 @@ LONG NTAPI DetourBase::StepHandler( PEXCEPTION_POINTERS excpt )
     DWORD index = 0;
     int found = _BitScanForward( &index, static_cast<DWORD>(excpt->ContextRecord->Dr6) );
 
-    if (found != 0 && index < 4 && _breakpoints.count( excpt->ExceptionRecord->ExceptionAddress ))
+    DetourBase* pInst = found != 0 && index < 4 ? FindBreakpoint( excpt->ExceptionRecord->ExceptionAddress ) : nullptr;
+    if (pInst != nullptr)
     {
-        DetourBase* pInst = _breakpoints[excpt->ExceptionRecord->ExceptionAddress];
-
         // Disable breakpoint at current index
         BitTestAndResetT( (LONG_PTR*)&excpt->ContextRecord->Dr7, 2 * index );
 
@@ -4,9 +4,13 @@
 #include "../Include/Winheaders.h"
 #include "../Asm/AsmFactory.h"
 #include "../Asm/LDasm.h"
+#include "../Asm/LDasmCache.h"
+#include "../Asm/CodeRelocator.h"
 #include "../Include/Macro.h"
+#include "TrampolinePool.h"
 
 #include <tuple>
+#include <atomic>
 #include <unordered_map>
 
 namespace blackbone
@@ -47,6 +51,8 @@ namespace ReturnMethod
 
 class DetourBase
 {
+    friend class HookTransaction;
+
     using mapIdx = std::unordered_map<DWORD, int>;
 
 public:
@@ -59,8 +65,9 @@ protected:
     /// Allocate detour buffer as close to target as possible
     /// </summary>
     /// <param name="nearest">Target address</param>
+    /// <param name="size">Buffer size</param>
     /// <returns>true on success</returns>
-    BLACKBONE_API bool AllocateBuffer( uint8_t* nearest );
+    BLACKBONE_API bool AllocateBuffer( uint8_t* nearest, size_t size = TrampolinePool::SlotSize );
 
     /// <summary>
     /// Temporarily disable hook
@@ -88,6 +95,27 @@ protected:
     /// <param name="Ptr">Origianl function address</param>
     BLACKBONE_API void CopyOldCode( uint8_t* Ptr );
 
+    /// <summary>
+    /// Route breakpoint at address to hook and install exception handler
+    /// </summary>
+    /// <param name="address">Breakpoint address</param>
+    /// <param name="hook">Hook instance</param>
+    /// <returns>true on success, false if breakpoint table is full</returns>
+    BLACKBONE_API static bool AddBreakpoint( void* address, DetourBase* hook );
+
+    /// <summary>
+    /// Stop routing breakpoint at address
+    /// </summary>
+    /// <param name="address">Breakpoint address</param>
+    BLACKBONE_API static void RemoveBreakpoint( void* address );
+
+    /// <summary>
+    /// Find hook by breakpoint address. Safe to call from exception handler on any thread
+    /// </summary>
+    /// <param name="address">Breakpoint address</param>
+    /// <returns>Hook instance, nullptr if not found</returns>
+    BLACKBONE_API static DetourBase* FindBreakpoint( void* address );
+
     /// <summary>
     /// Exception handlers
     /// </summary>
@@ -113,13 +141,30 @@ protected:
     uint8_t* _origCode = nullptr;       // Original function bytes
     uint8_t* _origThunk = nullptr;      // Original bytes adjusted for relocation
     uint8_t* _newCode = nullptr;        // Trampoline bytes
+    RelocatedCode _relocated;           // Layout of original bytes in thunk
     
     HookType::e _type = HookType::Inline;
     CallOrder::e _order = CallOrder::HookFirst;
     ReturnMethod::e _retType = ReturnMethod::UseOriginal;
 
-    // Global hook instances relationship
-    BLACKBONE_API static std::unordered_map<void*, DetourBase*> _breakpoints;
+    class HookTransaction* _transaction = nullptr;  // Transaction that writes the patch, if any
+
+    /// <summary>
+    /// Breakpoint table slot.
+    /// Address is written once and slot is never reused for another one,
+    /// so readers need no lock: a removed hook only clears instance pointer
+    /// </summary>
+    struct BreakpointSlot
+    {
+        std::atomic<void*> address;
+        std::atomic<DetourBase*> hook;
+    };
+
+    static constexpr size_t BreakpointSlots = 1024;
+
+    // Global hook instances relationship, open-addressed with linear probing
+    BLACKBONE_API static BreakpointSlot _breakpoints[BreakpointSlots];
+    BLACKBONE_API static CriticalSection _breakpointLock;
 
     // Exception handler
     BLACKBONE_API static void* _vecHandler;
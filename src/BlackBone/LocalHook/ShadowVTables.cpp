@@ -0,0 +1,152 @@
+#include "ShadowVTables.h"
+
+namespace blackbone
+{
+
+/// <summary>
+/// Process-wide registry. Shadows are never released, objects can reference them until exit
+/// </summary>
+ShadowVTables& ShadowVTables::Instance()
+{
+    static ShadowVTables* registry = new ShadowVTables();
+    return *registry;
+}
+
+/// <summary>
+/// Replace function in shadow of a vtable, shadow is created on first use
+/// </summary>
+/// <param name="vtable">Original vtable</param>
+/// <param name="index">Function index</param>
+/// <param name="function">New function</param>
+/// <param name="vtableLen">Number of functions in vtable, 0 - detect by bounds of module that owns first function</param>
+/// <returns>true on success</returns>
+bool ShadowVTables::SetEntry( void** vtable, int index, void* function, int vtableLen /*= 0*/ )
+{
+    if (vtable == nullptr || index < 0)
+        return false;
+
+    CSLock lck( _lock );
+
+    auto iter = _shadows.find( vtable );
+    if (iter == _shadows.end())
+    {
+        if (vtableLen == 0)
+            vtableLen = Length( vtable );
+
+        if (index >= vtableLen)
+            return false;
+
+        Shadow shadow;
+        shadow.length = vtableLen;
+        shadow.table.reset( new void*[vtableLen + 1] );
+        memcpy( shadow.table.get(), vtable - 1, (vtableLen + 1) * sizeof( void* ) );
+
+        _originals.emplace( shadow.functions(), vtable );
+        iter = _shadows.emplace( vtable, std::move( shadow ) ).first;
+    }
+
+    if (index >= iter->second.length)
+        return false;
+
+    iter->second.functions()[index] = function;
+    return true;
+}
+
+/// <summary>
+/// Reset function in shadow back to original one
+/// </summary>
+/// <param name="vtable">Original vtable</param>
+/// <param name="index">Function index</param>
+/// <returns>true on success, false if there is no such shadow</returns>
+bool ShadowVTables::ResetEntry( void** vtable, int index )
+{
+    CSLock lck( _lock );
+
+    auto iter = _shadows.find( vtable );
+    if (iter == _shadows.end() || index < 0 || index >= iter->second.length)
+        return false;
+
+    iter->second.functions()[index] = vtable[index];
+    return true;
+}
+
+/// <summary>
+/// Move object onto shadow of its vtable
+/// </summary>
+/// <param name="ppVtable">Pointer to object vtable pointer</param>
+/// <returns>true on success, false if object vtable has no shadow</returns>
+bool ShadowVTables::Attach( void** ppVtable )
+{
+    CSLock lck( _lock );
+
+    auto vtable = reinterpret_cast<void**>(*ppVtable);
+    if (_originals.count( vtable ))
+        return true;
+
+    auto iter = _shadows.find( vtable );
+    if (iter == _shadows.end())
+        return false;
+
+    *ppVtable = iter->second.functions();
+    return true;
+}
+
+/// <summary>
+/// Move object back onto original vtable
+/// </summary>
+/// <param name="ppVtable">Pointer to object vtable pointer</param>
+/// <returns>true on success, false if object doesn't use a shadow</returns>
+bool ShadowVTables::Detach( void** ppVtable )
+{
+    CSLock lck( _lock );
+
+    auto iter = _originals.find( reinterpret_cast<void**>(*ppVtable) );
+    if (iter == _originals.end())
+        return false;
+
+    *ppVtable = iter->second;
+    return true;
+}
+
+/// <summary>
+/// Get original vtable
+/// </summary>
+/// <param name="vtable">Original vtable or its shadow</param>
+/// <returns>Original vtable</returns>
+void** ShadowVTables::Original( void** vtable )
+{
+    CSLock lck( _lock );
+
+    auto iter = _originals.find( vtable );
+    return iter != _originals.end() ? iter->second : vtable;
+}
+
+/// <summary>
+/// Count vtable functions
+/// </summary>
+/// <param name="vtable">Vtable</param>
+/// <returns>Number of consecutive functions inside module of the first one</returns>
+int ShadowVTables::Length( void** vtable )
+{
+    HMODULE hMod = NULL;
+    if (!GetModuleHandleExW( GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                             reinterpret_cast<LPCWSTR>(vtable[0]), &hMod ))
+    {
+        return 0;
+    }
+
+    auto pDos = reinterpret_cast<PIMAGE_DOS_HEADER>(hMod);
+    auto pNt = reinterpret_cast<PIMAGE_NT_HEADERS>(reinterpret_cast<uint8_t*>(hMod) + pDos->e_lfanew);
+
+    auto imageBase = reinterpret_cast<uintptr_t>(hMod);
+    auto imageSize = static_cast<uintptr_t>(pNt->OptionalHeader.SizeOfImage);
+
+    int length = 0;
+    for (auto ptr = reinterpret_cast<uintptr_t>(vtable[length]);
+          ptr >= imageBase && ptr < imageBase + imageSize;
+          ptr = reinterpret_cast<uintptr_t>(vtable[++length]));
+
+    return length;
+}
+
+}
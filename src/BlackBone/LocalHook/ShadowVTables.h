@@ -0,0 +1,94 @@
+#pragma once
+
+#include "../Config.h"
+#include "../Include/Winheaders.h"
+#include "../Misc/Utils.h"
+
+#include <map>
+#include <memory>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Registry of patched vtable copies shared by all objects of a class.
+/// One shadow is built per original vtable and holds every hooked index,
+/// so moving an object onto hooked vtable is a single pointer write
+/// </summary>
+class ShadowVTables
+{
+public:
+    /// <summary>
+    /// Process-wide registry. Shadows are never released, objects can reference them until exit
+    /// </summary>
+    BLACKBONE_API static ShadowVTables& Instance();
+
+    /// <summary>
+    /// Replace function in shadow of a vtable, shadow is created on first use
+    /// </summary>
+    /// <param name="vtable">Original vtable</param>
+    /// <param name="index">Function index</param>
+    /// <param name="function">New function</param>
+    /// <param name="vtableLen">Number of functions in vtable, 0 - detect by bounds of module that owns first function</param>
+    /// <returns>true on success</returns>
+    BLACKBONE_API bool SetEntry( void** vtable, int index, void* function, int vtableLen = 0 );
+
+    /// <summary>
+    /// Reset function in shadow back to original one
+    /// </summary>
+    /// <param name="vtable">Original vtable</param>
+    /// <param name="index">Function index</param>
+    /// <returns>true on success, false if there is no such shadow</returns>
+    BLACKBONE_API bool ResetEntry( void** vtable, int index );
+
+    /// <summary>
+    /// Move object onto shadow of its vtable
+    /// </summary>
+    /// <param name="ppVtable">Pointer to object vtable pointer</param>
+    /// <returns>true on success, false if object vtable has no shadow</returns>
+    BLACKBONE_API bool Attach( void** ppVtable );
+
+    /// <summary>
+    /// Move object back onto original vtable
+    /// </summary>
+    /// <param name="ppVtable">Pointer to object vtable pointer</param>
+    /// <returns>true on success, false if object doesn't use a shadow</returns>
+    BLACKBONE_API bool Detach( void** ppVtable );
+
+    /// <summary>
+    /// Get original vtable
+    /// </summary>
+    /// <param name="vtable">Original vtable or its shadow</param>
+    /// <returns>Original vtable</returns>
+    BLACKBONE_API void** Original( void** vtable );
+
+private:
+    ShadowVTables() = default;
+    ShadowVTables( const ShadowVTables& ) = delete;
+    ShadowVTables& operator =( const ShadowVTables& ) = delete;
+
+    /// <summary>
+    /// Patched vtable copy
+    /// </summary>
+    struct Shadow
+    {
+        std::unique_ptr<void*[]> table;     // Copy, starting from RTTI locator preceding first function
+        int length = 0;                     // Number of functions
+
+        void** functions() const { return table.get() + 1; }
+    };
+
+    /// <summary>
+    /// Count vtable functions
+    /// </summary>
+    /// <param name="vtable">Vtable</param>
+    /// <returns>Number of consecutive functions inside module of the first one</returns>
+    static int Length( void** vtable );
+
+private:
+    std::map<void**, Shadow> _shadows;      // Shadows by original vtable
+    std::map<void**, void**> _originals;    // Original vtables by shadow
+    CriticalSection _lock;
+};
+
+}
@@ -0,0 +1,248 @@
+#pragma once
+
+#include "LocalHookBase.h"
+#include "HookTransaction.h"
+
+#include <type_traits>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Call hook and original function in order fixed at compile time
+/// </summary>
+/// <param name="original">Original function</param>
+/// <param name="hook">Hook function</param>
+/// <param name="args">Function arguments</param>
+/// <returns>Original or hook return value, depending on Ret</returns>
+template<CallOrder::e Order, ReturnMethod::e Ret, typename R, typename Fn, typename... Args>
+inline R StaticHookDispatch( Fn original, Fn hook, Args... args )
+{
+    if constexpr (Order == CallOrder::NoOriginal)
+    {
+        return hook( args... );
+    }
+    else if constexpr (std::is_void_v<R>)
+    {
+        if constexpr (Order == CallOrder::HookFirst)
+        {
+            hook( args... );
+            original( args... );
+        }
+        else
+        {
+            original( args... );
+            hook( args... );
+        }
+    }
+    else if constexpr (Order == CallOrder::HookFirst)
+    {
+        R val_new = hook( args... );
+        R val_original = original( args... );
+
+        if constexpr (Ret == ReturnMethod::UseNew)
+            return val_new;
+        else
+            return val_original;
+    }
+    else
+    {
+        R val_original = original( args... );
+        R val_new = hook( args... );
+
+        if constexpr (Ret == ReturnMethod::UseNew)
+            return val_new;
+        else
+            return val_original;
+    }
+}
+
+template<typename Fn, CallOrder::e Order, ReturnMethod::e Ret>
+struct StaticHookHandler;
+
+template<typename R, typename... Args, CallOrder::e Order, ReturnMethod::e Ret>
+struct StaticHookHandler<R( __cdecl* )(Args...), Order, Ret> : public DetourBase
+{
+    using type = R( __cdecl* )(Args...);
+
+    static __declspec(noinline) R __cdecl Handler( Args... args )
+    {
+        auto pInst = reinterpret_cast<StaticHookHandler*>(((_NT_TIB*)NtCurrentTeb())->ArbitraryUserPointer);
+        return StaticHookDispatch<Order, Ret, R>(
+            reinterpret_cast<type>(pInst->_callOriginal), reinterpret_cast<type>(pInst->_callback), args...
+            );
+    }
+};
+
+#ifndef USE64
+template<typename R, typename... Args, CallOrder::e Order, ReturnMethod::e Ret>
+struct StaticHookHandler<R( __stdcall* )(Args...), Order, Ret> : public DetourBase
+{
+    using type = R( __stdcall* )(Args...);
+
+    static __declspec(noinline) R __stdcall Handler( Args... args )
+    {
+        auto pInst = reinterpret_cast<StaticHookHandler*>(((_NT_TIB*)NtCurrentTeb())->ArbitraryUserPointer);
+        return StaticHookDispatch<Order, Ret, R>(
+            reinterpret_cast<type>(pInst->_callOriginal), reinterpret_cast<type>(pInst->_callback), args...
+            );
+    }
+};
+
+template<typename R, typename... Args, CallOrder::e Order, ReturnMethod::e Ret>
+struct StaticHookHandler<R( __fastcall* )(Args...), Order, Ret> : public DetourBase
+{
+    using type = R( __fastcall* )(Args...);
+
+    static __declspec(noinline) R __fastcall Handler( Args... args )
+    {
+        auto pInst = reinterpret_cast<StaticHookHandler*>(((_NT_TIB*)NtCurrentTeb())->ArbitraryUserPointer);
+        return StaticHookDispatch<Order, Ret, R>(
+            reinterpret_cast<type>(pInst->_callOriginal), reinterpret_cast<type>(pInst->_callback), args...
+            );
+    }
+};
+#endif
+
+/// <summary>
+/// Inline hook with call order and return method fixed at compile time.
+/// Hook has the same signature as original function and gets arguments by value.
+/// Hook is never disabled while called, original function is always called through relocated prologue.
+/// With CallOrder::NoOriginal hooked function jumps directly into hook
+/// </summary>
+template<typename Fn, CallOrder::e Order = CallOrder::HookFirst, ReturnMethod::e Ret = ReturnMethod::UseOriginal>
+class StaticDetour : public StaticHookHandler<Fn, Order, Ret>
+{
+public:
+    using type = typename StaticHookHandler<Fn, Order, Ret>::type;
+
+public:
+    StaticDetour()
+    {
+        this->_internalHandler = &StaticHookHandler<Fn, Order, Ret>::Handler;
+    }
+
+    ~StaticDetour()
+    {
+        Restore();
+    }
+
+    /// <summary>
+    /// Hook function
+    /// </summary>
+    /// <param name="ptr">Target function address</param>
+    /// <param name="hkPtr">Hook function address</param>
+    /// <returns>true on success</returns>
+    bool Hook( type ptr, type hkPtr )
+    {
+        if (this->_hooked)
+            return false;
+
+        this->_type = HookType::Inline;
+        this->_order = Order;
+        this->_retType = Ret;
+        this->_callOriginal = this->_original = ptr;
+        this->_callback = hkPtr;
+
+        if (!DetourBase::AllocateBuffer( reinterpret_cast<uint8_t*>(ptr) ))
+            return false;
+
+        return HookInline();
+    }
+
+    /// <summary>
+    /// Relocated original function, callable while hook is installed
+    /// </summary>
+    /// <returns>Original function</returns>
+    type original() const { return reinterpret_cast<type>(this->_callOriginal); }
+
+    /// <summary>
+    /// Restore hooked function
+    /// </summary>
+    /// <returns>true on success, false if not hooked</returns>
+    bool Restore()
+    {
+        if (!this->_hooked)
+            return false;
+
+        DWORD flOld = 0;
+        if (!VirtualProtect( this->_original, this->_origSize, PAGE_EXECUTE_READWRITE, &flOld ))
+            return false;
+
+        memcpy( this->_original, this->_origCode, this->_origSize );
+        VirtualProtect( this->_original, this->_origSize, flOld, &flOld );
+
+        this->_hooked = false;
+        return true;
+    }
+
+private:
+
+    /// <summary>
+    /// Perform inline hook
+    /// </summary>
+    /// <returns>true on success</returns>
+    bool HookInline()
+    {
+        auto jmpToHook  = AsmFactory::GetAssembler();
+        auto jmpToThunk = AsmFactory::GetAssembler();
+
+        //
+        // Construct jump to thunk
+        //
+#ifdef USE64
+        (*jmpToThunk)->mov( asmjit::host::rax, (uint64_t)this->_buf );
+        (*jmpToThunk)->jmp( asmjit::host::rax );
+#else
+        (*jmpToThunk)->jmp( (asmjit::Ptr)this->_buf );
+#endif
+        this->_origSize = (*jmpToThunk)->getCodeSize();
+
+        DetourBase::CopyOldCode( (uint8_t*)this->_original );
+
+        // Prologue couldn't be relocated, original can't be called without unhooking
+        if (this->_type == HookType::InternalInline && Order != CallOrder::NoOriginal)
+            return false;
+
+        if constexpr (Order == CallOrder::NoOriginal)
+        {
+            // No state to pass, tail call into hook
+            (*jmpToHook)->jmp( (asmjit::Ptr)this->_callback );
+        }
+        else
+        {
+#ifdef USE64
+            // mov gs:[0x28], this
+            (*jmpToHook)->mov( asmjit::host::rax, (uint64_t)this );
+            (*jmpToHook)->mov( asmjit::host::qword_ptr_abs( 0x28 ).setSegment( asmjit::host::gs ), asmjit::host::rax );
+#else
+            // mov fs:[0x14], this
+            (*jmpToHook)->mov( asmjit::host::dword_ptr_abs( 0x14 ).setSegment( asmjit::host::fs ), (uint32_t)this );
+#endif // USE64
+
+            (*jmpToHook)->jmp( (asmjit::Ptr)&StaticHookHandler<Fn, Order, Ret>::Handler );
+        }
+
+        (*jmpToHook)->relocCode( this->_buf );
+
+        (*jmpToThunk)->setBaseAddress( (uintptr_t)this->_original );
+        auto codeSize = (*jmpToThunk)->relocCode( this->_newCode );
+
+        // Patch is written on transaction commit
+        if (this->_transaction != nullptr)
+            return this->_transaction->Stage( this, codeSize );
+
+        DWORD flOld = 0;
+        if (!VirtualProtect( this->_original, codeSize, PAGE_EXECUTE_READWRITE, &flOld ))
+            return false;
+
+        memcpy( this->_original, this->_newCode, codeSize );
+
+        VirtualProtect( this->_original, codeSize, flOld, &flOld );
+
+        this->_hooked = (codeSize != 0);
+        return this->_hooked;
+    }
+};
+
+}
@@ -1,6 +1,7 @@
 #include "../Config.h"
 #include "TraceHook.h"
 #include "../Include/Macro.h"
+#include "../Misc/StackWalker.h"
 
 #define BEA_USE_STDCALL
 //#define BEA_ENGINE_STATIC
@@ -19,9 +20,16 @@
 #define ADDR_MASK 0xFFFFF000
 #endif
 
+// Break values are placed in the first 64KB of address space, which is never mapped
+#define BREAK_VALUE_FIRST   0x2000
+#define BREAK_VALUE_LAST    0x10000
+
 namespace blackbone
 {
 
+// Tracing state of current thread
+static thread_local TraceThreadState s_threadState;
+
 TraceHook::TraceHook()
 {
 }
@@ -62,29 +70,35 @@ bool TraceHook::ApplyHook( void* targetFunc,
         if (ctx.hooks.count( (uintptr_t)targetFunc ))
             return false;
         else
-            ctx.hooks.emplace( (uintptr_t)targetFunc, std::make_pair( (uintptr_t)hookFunc, false ) );
+            ctx.hooks.emplace( (uintptr_t)targetFunc, (uintptr_t)hookFunc );
     }
     // Create new context
     else
     {
+        // Each pointer gets own page, so exception address identifies the context
+        uintptr_t breakValue = BREAK_VALUE_FIRST;
+        for (; breakValue < BREAK_VALUE_LAST && FindContext( breakValue ) != nullptr; breakValue += 0x1000);
+
+        if (breakValue >= BREAK_VALUE_LAST)
+            return false;
+
         HookContext ctx;
 
         // Setup context
         ctx.targetPtr = (uintptr_t)ptrAddress;
         ctx.checkIP = (uintptr_t)chekcIP;
         ctx.origPtrVal = *(uintptr_t*)ptrAddress;
-        ctx.breakValue = _breakPtr;
+        ctx.breakValue = breakValue;
         ctx.tracePath = tracePath;
 
-        ctx.hooks.emplace( (uintptr_t)targetFunc, std::make_pair( (uintptr_t)hookFunc, false ) );
+        ctx.hooks.emplace( (uintptr_t)targetFunc, (uintptr_t)hookFunc );
         _contexts.emplace( (uintptr_t)ptrAddress, std::move( ctx ) );
 
         if (_pExptHandler == nullptr)
             _pExptHandler = AddVectoredExceptionHandler( 0, &TraceHook::VecHandler );
 
         // Setup exception
-        *(uintptr_t*)ptrAddress = ctx.breakValue;
-        _breakPtr += 0x10;
+        *(uintptr_t*)ptrAddress = breakValue;
     }
 
     return true;
@@ -111,6 +125,12 @@ bool TraceHook::RemoveHook( void* targetFunc )
         // Remove function from list
         ctx.hooks.erase( (uintptr_t)targetFunc );
 
+        {
+            CSLock lck( _pathLock );
+            for (auto path = ctx.paths.begin(); path != ctx.paths.end();)
+                path = path->second.target == (uintptr_t)targetFunc ? ctx.paths.erase( path ) : std::next( path );
+        }
+
         if (ctx.hooks.empty())
         {
             // Remove hook itself
@@ -156,16 +176,26 @@ LONG TraceHook::VecHandlerP( PEXCEPTION_POINTERS ExceptionInfo )
     auto exptContex = ExceptionInfo->ContextRecord;
     auto exptRecord = ExceptionInfo->ExceptionRecord;
     auto exptCode   = exptRecord->ExceptionCode;
-
-    // TODO: Somehow determine current hook context
-    HookContext* ctx = &_contexts.begin()->second;
+    auto& ts        = s_threadState;
 
     // Check if exception should be handled
     if (exptCode != EXCEPTION_SINGLE_STEP && exptCode != EXCEPTION_ACCESS_VIOLATION)
-    {
         return EXCEPTION_CONTINUE_SEARCH;
+
+    // Thread isn't traced yet, only access to broken pointer starts tracing
+    if (ts.ctx == nullptr)
+    {
+        if (exptCode != EXCEPTION_ACCESS_VIOLATION)
+            return EXCEPTION_CONTINUE_SEARCH;
+
+        ts.ctx = FindContext( exptRecord->ExceptionInformation[1] );
+        if (ts.ctx == nullptr)
+            return EXCEPTION_CONTINUE_SEARCH;
     }
-    else if (exptCode == EXCEPTION_ACCESS_VIOLATION && (ctx->state == TS_Step || ctx->state == TS_StepInto))
+
+    HookContext* ctx = ts.ctx;
+
+    if (exptCode == EXCEPTION_ACCESS_VIOLATION && (ts.state == TS_Step || ts.state == TS_StepInto))
     {
         if ((exptRecord->ExceptionInformation[1] & ADDR_MASK) != (ctx->breakValue & ADDR_MASK))
             return EXCEPTION_CONTINUE_SEARCH;
@@ -179,15 +209,34 @@ LONG TraceHook::VecHandlerP( PEXCEPTION_POINTERS ExceptionInfo )
             return EXCEPTION_CONTINUE_EXECUTION;
         }
     }
+    // Cached path didn't reach hooked function, start over
+    else if (exptCode == EXCEPTION_ACCESS_VIOLATION && ts.state == TS_WaitTarget)
+    {
+        if ((exptRecord->ExceptionInformation[1] & ADDR_MASK) != (ctx->breakValue & ADDR_MASK))
+            return EXCEPTION_CONTINUE_SEARCH;
+
+        DisarmPath( ts, exptContex );
+        ts.reset();
+        ts.ctx = ctx;
+    }
     
-    switch (ctx->state)
+    switch (ts.state)
     {
         // Start of tracing
         case TS_Start:
             {
-                ctx->state = ctx->tracePath[ctx->stateIdx].action;
+                ts.state = ctx->tracePath[ts.stateIdx].action;
 
                 RestorePtr( *ctx, ExceptionInfo );
+
+                // Instruction that accessed pointer is a trace point
+                if (ts.state == TS_Step)
+                {
+                    BeginPath( ts, exptContex );
+                    if (ts.state == TS_WaitTarget)
+                        return EXCEPTION_CONTINUE_EXECUTION;
+                }
+
                 return VecHandlerP( ExceptionInfo );
             }
             break;
@@ -196,17 +245,17 @@ LONG TraceHook::VecHandlerP( PEXCEPTION_POINTERS ExceptionInfo )
         case TS_Step:
             {
                 // Function call occurred. Queue break on return.
-                if (CheckBranching( *ctx, exptContex->NIP, exptContex->NSP ))
+                if (CheckBranching( ts, exptContex->NIP, exptContex->NSP ))
                 {
                     // Target function reached
                     if (ctx->hooks.count( exptContex->NIP ))
                     {
-                        HandleBranch( *ctx, exptContex );
+                        HandleBranch( ts, exptContex );
                         return EXCEPTION_CONTINUE_EXECUTION;
                     }
                     else
                     {
-                        ctx->state = TS_WaitReturn;
+                        ts.state = TS_WaitReturn;
                         BreakOnReturn( exptContex->NSP );
                     }
                 }
@@ -225,8 +274,8 @@ LONG TraceHook::VecHandlerP( PEXCEPTION_POINTERS ExceptionInfo )
 
                 if (frames.size() > 1)
                 {
-                    ctx->stateIdx++;
-                    ctx->state = TS_WaitReturn;
+                    ts.stateIdx++;
+                    ts.state = TS_WaitReturn;
                     BreakOnReturn( frames.back().first );
                 }
             }
@@ -236,16 +285,21 @@ LONG TraceHook::VecHandlerP( PEXCEPTION_POINTERS ExceptionInfo )
         case TS_StepInto:
             {
                 // Check if step into path function has occurred
-                if (CheckBranching( *ctx, exptContex->NIP, exptContex->NSP ))
+                if (CheckBranching( ts, exptContex->NIP, exptContex->NSP ))
                 {
-                    if (exptContex->NIP == ctx->tracePath[ctx->stateIdx].arg)
+                    if (exptContex->NIP == ctx->tracePath[ts.stateIdx].arg)
                     {
-                        ctx->stateIdx++;
-                        ctx->state = ctx->tracePath[ctx->stateIdx].action;
+                        ts.stateIdx++;
+                        ts.state = ctx->tracePath[ts.stateIdx].action;
+
+                        // Path function entry is a trace point
+                        if (ts.state == TS_Step)
+                            BeginPath( ts, exptContex );
                     }
                 }
 
-                exptContex->EFlags |= SingleStep;
+                if (ts.state != TS_WaitTarget)
+                    exptContex->EFlags |= SingleStep;
             }
             break;
 
@@ -260,8 +314,39 @@ LONG TraceHook::VecHandlerP( PEXCEPTION_POINTERS ExceptionInfo )
             #endif // USE64
 
                 // Continue stepping
-                exptContex->EFlags |= SingleStep;
-                ctx->state = ctx->tracePath[ctx->stateIdx].action;
+                ts.state = ctx->tracePath[ts.stateIdx].action;
+
+                // Return from hooked function is a new trace point, other calls are a part of current path
+                if (ts.state == TS_Step && ts.pathIP == 0)
+                    BeginPath( ts, exptContex );
+
+                if (ts.state != TS_WaitTarget)
+                    exptContex->EFlags |= SingleStep;
+            }
+            break;
+
+        // Hardware breakpoint on hooked function
+        case TS_WaitTarget:
+            {
+                if (exptCode != EXCEPTION_SINGLE_STEP || ts.breakIdx < 0 || !(exptContex->Dr6 & (uintptr_t( 1 ) << ts.breakIdx)))
+                    return EXCEPTION_CONTINUE_SEARCH;
+
+                DisarmPath( ts, exptContex );
+
+                // Same function reached through different path, drop stale entry
+                if (exptContex->NSP != ts.expectSP || !ctx->hooks.count( exptContex->NIP ))
+                {
+                    {
+                        CSLock lck( _pathLock );
+                        ctx->paths.erase( std::make_pair( ts.pathIP, ts.pathDepth ) );
+                    }
+
+                    ts.reset();
+                    return EXCEPTION_CONTINUE_EXECUTION;
+                }
+
+                HandleBranch( ts, exptContex );
+                return EXCEPTION_CONTINUE_EXECUTION;
             }
             break;
 
@@ -269,8 +354,8 @@ LONG TraceHook::VecHandlerP( PEXCEPTION_POINTERS ExceptionInfo )
             break;
     }
 
-    ctx->lastIP = exptContex->NIP;
-    ctx->lastSP = exptContex->NSP;
+    ts.lastIP = exptContex->NIP;
+    ts.lastSP = exptContex->NSP;
     
     return EXCEPTION_CONTINUE_EXECUTION;
 }
@@ -279,22 +364,22 @@ LONG TraceHook::VecHandlerP( PEXCEPTION_POINTERS ExceptionInfo )
 /// <summary>
 /// Check if last instruction caused branching
 /// </summary>
-/// <param name="ctx">Current hook info</param>
+/// <param name="ts">Thread tracing state</param>
 /// <param name="ip">Instruction pointer</param>
 /// <param name="sp">Stack pointer</param>
 /// <returns>True if branching has occurred</returns>
-bool TraceHook::CheckBranching( const HookContext& ctx, uintptr_t ip, uintptr_t sp )
+bool TraceHook::CheckBranching( const TraceThreadState& ts, uintptr_t ip, uintptr_t sp )
 {
     // Not yet initialized
-    if (ctx.lastIP == 0 || ctx.lastSP == 0)
+    if (ts.lastIP == 0 || ts.lastSP == 0)
         return false;
 
     // Difference in instruction pointer more than possible 'call' length
     // Stack pointer changed
-    if (ip - ctx.lastIP >= 8 && sp != ctx.lastSP)
+    if (ip - ts.lastIP >= 8 && sp != ts.lastSP)
     {
         DISASM info = { 0 };
-        info.EIP = ctx.lastIP;
+        info.EIP = ts.lastIP;
 
     #ifdef USE64
         info.Archi = 64;
@@ -314,29 +399,112 @@ bool TraceHook::CheckBranching( const HookContext& ctx, uintptr_t ip, uintptr_t
 /// <summary>
 /// Handle branching
 /// </summary>
-/// <param name="ctx">Current hook context</param>
+/// <param name="ts">Thread tracing state</param>
 /// <param name="exptContex">Thread context</param>
-void TraceHook::HandleBranch( HookContext& ctx, PCONTEXT exptContex )
+void TraceHook::HandleBranch( TraceThreadState& ts, PCONTEXT exptContex )
 {
-    // Mark this hook as called
-    ctx.hooks[exptContex->NIP].second = true;
+    auto ctx = ts.ctx;
+    auto target = exptContex->NIP;
 
-    // Reset tracing state if all hooks were called
-    auto iter = std::find_if( ctx.hooks.begin(), ctx.hooks.end(),
-                              []( const decltype(ctx.hooks)::value_type& val ){ return (val.second.second == false); } );
+    // Remember where stepping from last trace point ended
+    if (ts.pathIP != 0 && ts.state == TS_Step)
+    {
+        ResolvedPath path;
+        path.target = target;
+        path.spDelta = ts.pathSP - exptContex->NSP;
+
+        CSLock lck( _pathLock );
+        ctx->paths[std::make_pair( ts.pathIP, ts.pathDepth )] = path;
+    }
+
+    // Mark this hook as called
+    if (std::find( ts.called.begin(), ts.called.end(), target ) == ts.called.end())
+        ts.called.emplace_back( target );
 
     // Break after hook execution
-    if (iter != ctx.hooks.end())
+    if (ts.called.size() < ctx->hooks.size())
     {
-        ctx.state = TS_WaitReturn;
+        ts.state = TS_WaitReturn;
+        ts.pathIP = 0;
         BreakOnReturn( exptContex->NSP );
     }
-    // Reset state
+    // Reset state if all hooks were called
     else
-        ctx.reset();
+        ts.reset();
 
     // Reroute to hook function
-    exptContex->NIP = ctx.hooks[exptContex->NIP].first;
+    exptContex->NIP = ctx->hooks[target];
+}
+
+/// <summary>
+/// Start single-stepping from trace point, or skip it if path from this point is already resolved
+/// </summary>
+/// <param name="ts">Thread tracing state</param>
+/// <param name="exptContex">Thread context</param>
+void TraceHook::BeginPath( TraceThreadState& ts, PCONTEXT exptContex )
+{
+    uintptr_t stackBase = (uintptr_t)((PNT_TIB)NtCurrentTeb())->StackBase;
+
+    ts.pathIP = exptContex->NIP;
+    ts.pathSP = exptContex->NSP;
+    ts.pathDepth = stackBase - exptContex->NSP;
+
+    ResolvedPath path;
+    {
+        CSLock lck( _pathLock );
+        auto iter = ts.ctx->paths.find( std::make_pair( ts.pathIP, ts.pathDepth ) );
+        if (iter == ts.ctx->paths.end())
+            return;
+
+        path = iter->second;
+    }
+
+    // Find free debug register
+    for (int i = 0; i < 4; i++)
+    {
+        if (exptContex->Dr7 & (uintptr_t( 1 ) << (2 * i)))
+            continue;
+
+        // Execute breakpoint, length 1
+        (&exptContex->Dr0)[i] = path.target;
+        exptContex->Dr7 &= ~(uintptr_t( 0xF ) << (16 + 4 * i));
+        exptContex->Dr7 |= uintptr_t( 1 ) << (2 * i);
+
+        ts.breakIdx = i;
+        ts.expectSP = ts.pathSP - path.spDelta;
+        ts.state = TS_WaitTarget;
+        return;
+    }
+}
+
+/// <summary>
+/// Disable debug register armed for cached path
+/// </summary>
+/// <param name="ts">Thread tracing state</param>
+/// <param name="exptContex">Thread context</param>
+void TraceHook::DisarmPath( TraceThreadState& ts, PCONTEXT exptContex )
+{
+    if (ts.breakIdx < 0)
+        return;
+
+    (&exptContex->Dr0)[ts.breakIdx] = 0;
+    exptContex->Dr7 &= ~(uintptr_t( 1 ) << (2 * ts.breakIdx));
+    exptContex->Dr6 &= ~(uintptr_t( 1 ) << ts.breakIdx);
+    ts.breakIdx = -1;
+}
+
+/// <summary>
+/// Find hook context by exception address
+/// </summary>
+/// <param name="address">Accessed address</param>
+/// <returns>Hook context, nullptr if not found</returns>
+HookContext* TraceHook::FindContext( uintptr_t address )
+{
+    for (auto& ctx : _contexts)
+        if ((ctx.second.breakValue & ADDR_MASK) == (address & ADDR_MASK))
+            return &ctx.second;
+
+    return nullptr;
 }
 
 
@@ -395,62 +563,68 @@ bool TraceHook::RestorePtr( const HookContext& ctx, PEXCEPTION_POINTERS Exceptio
 /// <returns>Number of found frames</returns>
 size_t TraceHook::StackBacktrace( uintptr_t ip, uintptr_t sp, vecStackFrames& results, uintptr_t depth /*= 10 */ )
 {
+    StackWalker::vecFrames frames;
+
+#ifdef USE64
+    // Function table is exact and needs no memory queries
+    StackWalker::Unwind( ip, sp, HIGHEST_BIT_SET, frames, depth );
+#else
     SYSTEM_INFO sysinfo = {};
     uintptr_t stack_base = (uintptr_t)((PNT_TIB)NtCurrentTeb())->StackBase;
 
     GetNativeSystemInfo( &sysinfo );
 
-    // Store exception address
-    results.emplace_back( 0, ip );
+    auto read = []( ptr_t address, void* buffer, size_t size )
+    {
+        memcpy( buffer, reinterpret_cast<const void*>(address), size );
+        return true;
+    };
 
-    // Walk stack
-    for (uintptr_t stackPtr = sp; stackPtr < stack_base && results.size() <= depth; stackPtr += sizeof(void*))
+    auto query = []( ptr_t address, ptr_t& base, ptr_t& size, bool& executable )
     {
-        uintptr_t stack_val = *(uintptr_t*)stackPtr;
         MEMORY_BASIC_INFORMATION meminfo = { 0 };
+        if (VirtualQuery( reinterpret_cast<LPVOID>(address), &meminfo, sizeof( meminfo ) ) != sizeof( meminfo ))
+            return false;
 
-        // Decode value
-        uintptr_t original = stack_val & HIGHEST_BIT_UNSET;
-
-        // Invalid value
-        if ( original < (uintptr_t)sysinfo.lpMinimumApplicationAddress ||
-             original > (uintptr_t)sysinfo.lpMaximumApplicationAddress)
-        {
-            continue;
-        }
-
-        // Check if memory is executable
-        if (VirtualQuery( (LPVOID)original, &meminfo, sizeof(meminfo) ) != sizeof(meminfo))
-            continue;
+        base = reinterpret_cast<ptr_t>(meminfo.BaseAddress);
+        size = meminfo.RegionSize;
+        executable = (meminfo.Protect == PAGE_EXECUTE_READ ||
+                      meminfo.Protect == PAGE_EXECUTE_WRITECOPY ||
+                      meminfo.Protect == PAGE_EXECUTE_READWRITE);
 
-        if ( meminfo.Protect != PAGE_EXECUTE_READ &&
-             meminfo.Protect != PAGE_EXECUTE_WRITECOPY &&
-             meminfo.Protect != PAGE_EXECUTE_READWRITE)
-        {
-            continue;
-        }
+        return true;
+    };
 
+    auto isCall = []( ptr_t original )
+    {
         // Detect 'call' instruction
         for (uintptr_t j = 1; j < 8; j++)
         {
             DISASM info = { 0 };
-            info.EIP = original - j;
-
-        #ifdef USE64
-            info.Archi = 64;
-        #endif  
+            info.EIP = static_cast<UIntPtr>(original - j);
 
             // FIXME: Alternative for MinGW
 #ifdef COMPILER_MSVC
             if (Disasm( &info ) > 0 && info.Instruction.BranchType == CallType)
-            {
-                results.emplace_back( stackPtr, stack_val );
-                break;
-            }
+                return true;
 #endif // COMPILER_MSVC
         }
 
-    }
+        return false;
+    };
+
+    ExecRangeCache cache;
+    StackWalker walker(
+        cache, sizeof( uintptr_t ), HIGHEST_BIT_SET,
+        reinterpret_cast<ptr_t>(sysinfo.lpMinimumApplicationAddress), reinterpret_cast<ptr_t>(sysinfo.lpMaximumApplicationAddress),
+        read, query, isCall
+        );
+
+    walker.Scan( ip, sp, stack_base, frames, depth );
+#endif
+
+    for (auto& frame : frames)
+        results.emplace_back( static_cast<uintptr_t>(frame.first), static_cast<uintptr_t>(frame.second) );
 
     return results.size();
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "../Include/WinHeaders.h"
+#include "../Misc/Utils.h"
 
 #include <stdint.h>
 #include <vector>
@@ -17,6 +18,7 @@ enum TraceState
     TS_StepOut,     // Break on function return
     TS_StepInto,    // Step into specific function
     TS_WaitReturn,  // Wait for break-on-return
+    TS_WaitTarget,  // Wait for hooked function reached by cached path. Internal use only
 };
 
 struct PathNode
@@ -30,39 +32,65 @@ struct PathNode
 };
 
 
+/// <summary>
+/// Hooked function reached by single-stepping from a trace point
+/// </summary>
+struct ResolvedPath
+{
+    uintptr_t target = 0;       // Hooked function
+    uintptr_t spDelta = 0;      // Stack pointer difference between trace point and hooked function entry
+};
+
 /// <summary>
 /// Hook-related data
 /// </summary>
 struct HookContext
 {
-    using mapHooks = std::unordered_map<uintptr_t, std::pair<uintptr_t, bool>>;
+    using mapHooks = std::unordered_map<uintptr_t, uintptr_t>;
     using vecState = std::vector<PathNode>;
+    using mapPaths = std::map<std::pair<uintptr_t, uintptr_t>, ResolvedPath>;
 
-    uintptr_t lastIP = 0;       // Previous EIP/RIP value
-    uintptr_t lastSP = 0;       // Previous ESP/RSP value
     uintptr_t targetPtr = 0;    // Address causing exception
     uintptr_t origPtrVal = 0;   // Original pointer value
     uintptr_t checkIP = 0;      // Address of instruction that checks target pointer
     uintptr_t breakValue = 0;   // Value used to generate exception
-    uintptr_t stateIdx = 0;     // Current state index in state vector
 
-    TraceState state = TS_Start;    // Current tracing state
-    vecState tracePath;             // Function trace path
-    mapHooks hooks;                 // List of hooks associated with current pointer
+    vecState tracePath;         // Function trace path
+    mapHooks hooks;             // Hooked functions associated with current pointer and their hooks
+    mapPaths paths;             // Resolved paths keyed by trace point address and stack depth
+};
 
+/// <summary>
+/// Tracing state of a single thread
+/// </summary>
+struct TraceThreadState
+{
+    HookContext* ctx = nullptr;     // Traced context, nullptr if thread isn't traced
+    uintptr_t lastIP = 0;           // Previous EIP/RIP value
+    uintptr_t lastSP = 0;           // Previous ESP/RSP value
+    uintptr_t stateIdx = 0;         // Current state index in state vector
+
+    uintptr_t pathIP = 0;           // Address stepping started from
+    uintptr_t pathSP = 0;           // Stack pointer stepping started with
+    uintptr_t pathDepth = 0;        // Stack depth stepping started with
+    uintptr_t expectSP = 0;         // Stack pointer expected on cached path target
+    int breakIdx = -1;              // Debug register used for cached path
+
+    TraceState state = TS_Start;    // Current tracing state
+    std::vector<uintptr_t> called;  // Hooked functions called during current trace
 
     /// <summary>
     /// Reset tracing state
     /// </summary>
     void reset()
     {
+        ctx = nullptr;
         state = TS_Start;
         lastIP = lastSP = 0;
         stateIdx = 0;
-
-        // Mark hooks as non-called
-        for (auto& item : hooks)
-            item.second.second = false;
+        pathIP = pathSP = pathDepth = expectSP = 0;
+        breakIdx = -1;
+        called.clear();
     }
 };
 
@@ -131,18 +159,39 @@ private:
     /// <summary>
     /// Check if last instruction caused branching
     /// </summary>
-    /// <param name="ctx">Current hook info</param>
+    /// <param name="ts">Thread tracing state</param>
     /// <param name="ip">Instruction pointer</param>
     /// <param name="sp">Stack pointer</param>
     /// <returns>True if branching has occurred</returns>
-    bool CheckBranching( const HookContext& ctx, uintptr_t ip, uintptr_t sp );
+    bool CheckBranching( const TraceThreadState& ts, uintptr_t ip, uintptr_t sp );
 
     /// <summary>
     /// Handle branching
     /// </summary>
-    /// <param name="ctx">Current hook context</param>
+    /// <param name="ts">Thread tracing state</param>
+    /// <param name="exptContex">Thread context</param>
+    void HandleBranch( TraceThreadState& ts, PCONTEXT exptContex );
+
+    /// <summary>
+    /// Start single-stepping from trace point, or skip it if path from this point is already resolved
+    /// </summary>
+    /// <param name="ts">Thread tracing state</param>
+    /// <param name="exptContex">Thread context</param>
+    void BeginPath( TraceThreadState& ts, PCONTEXT exptContex );
+
+    /// <summary>
+    /// Disable debug register armed for cached path
+    /// </summary>
+    /// <param name="ts">Thread tracing state</param>
     /// <param name="exptContex">Thread context</param>
-    void HandleBranch( HookContext& ctx, PCONTEXT exptContex );
+    void DisarmPath( TraceThreadState& ts, PCONTEXT exptContex );
+
+    /// <summary>
+    /// Find hook context by exception address
+    /// </summary>
+    /// <param name="address">Accessed address</param>
+    /// <returns>Hook context, nullptr if not found</returns>
+    HookContext* FindContext( uintptr_t address );
 
     /// <summary>
     /// Restore original pointer value
@@ -155,7 +204,7 @@ private:
 private:
     PVOID       _pExptHandler = nullptr;        // Exception handler
     mapContext  _contexts;                      // Hook contexts
-    uintptr_t   _breakPtr = 0x2000;             // Exception pointer generator
+    CriticalSection _pathLock;                  // Resolved path cache lock
 };
 
 }
\ No newline at end of file
@@ -0,0 +1,210 @@
+#include "TrampolinePool.h"
+#include "../Include/Macro.h"
+
+#include <algorithm>
+
+namespace blackbone
+{
+
+// Max distance of slab from hooked address, with margin for slab itself
+constexpr intptr_t MaxSlabDistance = 0x7FFF0000 - static_cast<intptr_t>(TrampolinePool::SlabSize);
+
+static_assert(TrampolinePool::SlabSize / TrampolinePool::SlotSize == 64, "Slab bitmap must fit 64 bits");
+
+/// <summary>
+/// Process-wide pool. It is never destroyed, so static hook objects can release trampolines on exit
+/// </summary>
+TrampolinePool& TrampolinePool::Instance()
+{
+    static TrampolinePool* pool = new TrampolinePool();
+    return *pool;
+}
+
+/// <summary>
+/// Allocate zeroed executable trampoline
+/// </summary>
+/// <param name="nearest">Hooked address, nullptr if location doesn't matter</param>
+/// <param name="size">Trampoline size, at most SlabSize</param>
+/// <returns>Trampoline address, nullptr on failure</returns>
+uint8_t* TrampolinePool::Allocate( const void* nearest, size_t size /*= SlotSize*/ )
+{
+    if (size == 0 || size > SlabSize)
+        return nullptr;
+
+    auto count = static_cast<uint32_t>((size + SlotSize - 1) / SlotSize);
+
+    CSLock lck( _lock );
+
+    for (auto& slab : _slabs)
+    {
+        if (!Reachable( slab.base, nearest ))
+            continue;
+
+        if (auto ptr = Take( slab, count ))
+            return ptr;
+    }
+
+    auto base = AllocateSlab( nearest );
+    if (base == 0)
+        return nullptr;
+
+    Slab slab;
+    slab.base = base;
+    _slabs.emplace_back( slab );
+
+    return Take( _slabs.back(), count );
+}
+
+/// <summary>
+/// Release trampoline
+/// </summary>
+/// <param name="ptr">Trampoline address</param>
+void TrampolinePool::Free( void* ptr )
+{
+    if (ptr == nullptr)
+        return;
+
+    CSLock lck( _lock );
+
+    auto addr = reinterpret_cast<uintptr_t>(ptr);
+    for (auto& slab : _slabs)
+    {
+        if (addr < slab.base || addr >= slab.base + SlabSize)
+            continue;
+
+        auto iter = slab.sizes.find( addr );
+        if (iter == slab.sizes.end())
+            return;
+
+        // Slabs are kept for later allocations near the same module
+        auto first = static_cast<uint32_t>((addr - slab.base) / SlotSize);
+        uint64_t mask = (iter->second == 64 ? ~0ull : ((1ull << iter->second) - 1)) << first;
+        slab.used &= ~mask;
+        slab.sizes.erase( iter );
+        return;
+    }
+}
+
+/// <summary>
+/// Take free slots from existing slab
+/// </summary>
+/// <param name="slab">Slab</param>
+/// <param name="count">Slot count</param>
+/// <returns>Trampoline address, nullptr if slab has no free run</returns>
+uint8_t* TrampolinePool::Take( Slab& slab, uint32_t count )
+{
+    uint64_t mask = count == 64 ? ~0ull : ((1ull << count) - 1);
+
+    for (uint32_t first = 0; first + count <= 64; first++)
+    {
+        if ((slab.used & (mask << first)) != 0)
+            continue;
+
+        slab.used |= mask << first;
+
+        auto ptr = reinterpret_cast<uint8_t*>(slab.base + first * SlotSize);
+        slab.sizes.emplace( reinterpret_cast<uintptr_t>(ptr), count );
+        memset( ptr, 0, count * SlotSize );
+
+        return ptr;
+    }
+
+    return nullptr;
+}
+
+/// <summary>
+/// Allocate new slab within rel32 reach of address
+/// </summary>
+/// <param name="nearest">Hooked address</param>
+/// <returns>Slab base, 0 on failure</returns>
+uintptr_t TrampolinePool::AllocateSlab( const void* nearest )
+{
+#ifdef USE64
+    MEMORY_BASIC_INFORMATION mbi = { 0 };
+    if (nearest != nullptr && VirtualQuery( nearest, &mbi, sizeof( mbi ) ))
+    {
+        auto moduleBase = reinterpret_cast<uintptr_t>(mbi.AllocationBase ? mbi.AllocationBase : mbi.BaseAddress);
+        auto& ranges = FreeRanges( moduleBase );
+
+        // Candidates could've been taken since region walk
+        while (!ranges.empty())
+        {
+            auto candidate = ranges.front();
+            ranges.erase( ranges.begin() );
+
+            if (!Reachable( candidate, nearest ))
+                continue;
+
+            auto ptr = VirtualAlloc( reinterpret_cast<void*>(candidate), SlabSize, MEM_RESERVE | MEM_COMMIT, PAGE_EXECUTE_READWRITE );
+            if (ptr != nullptr)
+                return reinterpret_cast<uintptr_t>(ptr);
+        }
+    }
+#endif
+
+    // Location doesn't matter, or nothing is free in reach
+    return reinterpret_cast<uintptr_t>(VirtualAlloc( nullptr, SlabSize, MEM_RESERVE | MEM_COMMIT, PAGE_EXECUTE_READWRITE ));
+}
+
+/// <summary>
+/// Find free ranges around module
+/// </summary>
+/// <param name="moduleBase">Module allocation base</param>
+/// <returns>Free slab candidates, nearest first</returns>
+std::vector<uintptr_t>& TrampolinePool::FreeRanges( uintptr_t moduleBase )
+{
+    auto iter = _free.find( moduleBase );
+    if (iter != _free.end())
+        return iter->second;
+
+    auto& ranges = _free[moduleBase];
+
+    SYSTEM_INFO si = { 0 };
+    GetSystemInfo( &si );
+
+    auto start = std::max<uintptr_t>( moduleBase > static_cast<uintptr_t>(MaxSlabDistance) ? moduleBase - MaxSlabDistance : 0, reinterpret_cast<uintptr_t>(si.lpMinimumApplicationAddress) );
+    auto end = std::min<uintptr_t>( moduleBase + MaxSlabDistance, reinterpret_cast<uintptr_t>(si.lpMaximumApplicationAddress) );
+
+    // Every slab sized piece of every free region in reach
+    MEMORY_BASIC_INFORMATION mbi = { 0 };
+    for (uintptr_t addr = start; addr < end && VirtualQuery( reinterpret_cast<void*>(addr), &mbi, sizeof( mbi ) ); addr = reinterpret_cast<uintptr_t>(mbi.BaseAddress) + mbi.RegionSize)
+    {
+        if (mbi.State != MEM_FREE)
+            continue;
+
+        auto regionStart = reinterpret_cast<uintptr_t>(mbi.BaseAddress);
+        auto regionEnd = regionStart + mbi.RegionSize;
+
+        for (auto slab = Align( regionStart, SlabSize ); slab + SlabSize <= regionEnd && slab < end; slab += SlabSize)
+            if (slab >= start)
+                ranges.emplace_back( slab );
+    }
+
+    std::sort( ranges.begin(), ranges.end(), [moduleBase]( uintptr_t l, uintptr_t r )
+    {
+        auto distance = []( uintptr_t a, uintptr_t b ) { return a > b ? a - b : b - a; };
+        return distance( l, moduleBase ) < distance( r, moduleBase );
+    } );
+
+    return ranges;
+}
+
+/// <summary>
+/// Check if slab is within rel32 reach of address
+/// </summary>
+bool TrampolinePool::Reachable( uintptr_t slab, const void* nearest )
+{
+#ifdef USE64
+    if (nearest == nullptr)
+        return true;
+
+    auto distance = static_cast<intptr_t>(slab - reinterpret_cast<uintptr_t>(nearest));
+    return distance < MaxSlabDistance && distance > -MaxSlabDistance;
+#else
+    UNREFERENCED_PARAMETER( slab );
+    UNREFERENCED_PARAMETER( nearest );
+    return true;
+#endif
+}
+
+}
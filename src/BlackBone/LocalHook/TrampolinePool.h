@@ -0,0 +1,91 @@
+#pragma once
+
+#include "../Config.h"
+#include "../Include/Winheaders.h"
+#include "../Misc/Utils.h"
+
+#include <vector>
+#include <map>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Shared allocator of hook trampolines in current process.
+/// Trampolines are carved from 64KB slabs placed within rel32 reach of hooked module,
+/// free ranges around a module are found by a single region walk and cached
+/// </summary>
+class TrampolinePool
+{
+public:
+    static constexpr size_t SlotSize = 0x400;       // Allocation granularity
+    static constexpr size_t SlabSize = 0x10000;     // Slab size, equals system allocation granularity
+
+    /// <summary>
+    /// Process-wide pool. It is never destroyed, so static hook objects can release trampolines on exit
+    /// </summary>
+    BLACKBONE_API static TrampolinePool& Instance();
+
+    /// <summary>
+    /// Allocate zeroed executable trampoline
+    /// </summary>
+    /// <param name="nearest">Hooked address, nullptr if location doesn't matter</param>
+    /// <param name="size">Trampoline size, at most SlabSize</param>
+    /// <returns>Trampoline address, nullptr on failure</returns>
+    BLACKBONE_API uint8_t* Allocate( const void* nearest, size_t size = SlotSize );
+
+    /// <summary>
+    /// Release trampoline
+    /// </summary>
+    /// <param name="ptr">Trampoline address</param>
+    BLACKBONE_API void Free( void* ptr );
+
+private:
+    TrampolinePool() = default;
+    TrampolinePool( const TrampolinePool& ) = delete;
+    TrampolinePool& operator =( const TrampolinePool& ) = delete;
+
+    /// <summary>
+    /// Slot bitmap of a slab
+    /// </summary>
+    struct Slab
+    {
+        uintptr_t base = 0;
+        uint64_t used = 0;                          // One bit per slot
+        std::map<uintptr_t, uint32_t> sizes;        // Slot count of each allocation
+    };
+
+    /// <summary>
+    /// Take free slots from existing slab
+    /// </summary>
+    /// <param name="slab">Slab</param>
+    /// <param name="count">Slot count</param>
+    /// <returns>Trampoline address, nullptr if slab has no free run</returns>
+    uint8_t* Take( Slab& slab, uint32_t count );
+
+    /// <summary>
+    /// Allocate new slab within rel32 reach of address
+    /// </summary>
+    /// <param name="nearest">Hooked address</param>
+    /// <returns>Slab base, 0 on failure</returns>
+    uintptr_t AllocateSlab( const void* nearest );
+
+    /// <summary>
+    /// Find free ranges around module
+    /// </summary>
+    /// <param name="moduleBase">Module allocation base</param>
+    /// <returns>Free slab candidates, nearest first</returns>
+    std::vector<uintptr_t>& FreeRanges( uintptr_t moduleBase );
+
+    /// <summary>
+    /// Check if slab is within rel32 reach of address
+    /// </summary>
+    static bool Reachable( uintptr_t slab, const void* nearest );
+
+private:
+    std::vector<Slab> _slabs;                               // Allocated slabs
+    std::map<uintptr_t, std::vector<uintptr_t>> _free;      // Cached free slab candidates per module
+    CriticalSection _lock;
+};
+
+}
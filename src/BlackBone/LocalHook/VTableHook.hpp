@@ -1,6 +1,7 @@
 #pragma once
 
 #include "LocalHook.hpp"
+#include "ShadowVTables.h"
 #include "../Misc/DynImport.h"
 
 namespace blackbone
@@ -17,7 +18,8 @@ public:
 public:
     VTableDetour()
     {
-        DetourBase::AllocateBuffer( nullptr );
+        // Vtable copy is placed after trampoline code
+        DetourBase::AllocateBuffer( nullptr, 0x1000 );
     }
 
     ~VTableDetour()
@@ -47,8 +49,6 @@ public:
         int vtableLen = 0 
         )
     {
-        auto jmpToHook = AsmFactory::GetAssembler();
-
         this->_type = HookType::VTable;
         this->_order = order;
         this->_retType = retType;
@@ -60,18 +60,7 @@ public:
         this->_vtIndex = index;
         this->_vtCopied = copyVtable;
 
-        // Construct jump to hook handler
-#ifdef USE64
-        // mov gs:[0x28], this
-        (*jmpToHook)->mov( asmjit::host::rax, (uint64_t)this );
-        (*jmpToHook)->mov( asmjit::host::qword_ptr_abs( 0x28 ).setSegment( asmjit::host::gs ), asmjit::host::rax );
-#else
-        // mov fs:[0x14], this
-        (*jmpToHook)->mov( asmjit::host::dword_ptr_abs( 0x14 ).setSegment( asmjit::host::fs ), (uint32_t)this );
-#endif // USE64
-
-        (*jmpToHook)->jmp( (asmjit::Ptr)this->_internalHandler );
-        (*jmpToHook)->relocCode( this->_buf );
+        BuildThunk();
 
         // Modify VTable copy
         if (copyVtable)
@@ -146,6 +135,86 @@ public:
         return Hook( ppVtable, index, brutal_cast<hktype>(hkPtr), order, retType, copyVtable, vtableLen );
     }
 
+    /// <summary>
+    /// Hook function in vtable shared by all objects of a class.
+    /// Function is replaced in the class shadow vtable, and object is moved onto it.
+    /// Other objects are hooked by AttachShared
+    /// </summary>
+    /// <param name="ppVtable">Pointer to vtable pointer</param>
+    /// <param name="index">Function index</param>
+    /// <param name="hkPtr">Hook function address</param>
+    /// <param name="order">Call order. Hook before original or vice versa</param>
+    /// <param name="retType">Return value. Use origianl or value from hook</param>
+    /// <param name="vtableLen">Optional. Number of function in vtable, used when shadow is created</param>
+    /// <returns>true on success</returns>
+    bool HookShared(
+        void** ppVtable,
+        int index,
+        hktype hkPtr,
+        CallOrder::e order = CallOrder::HookFirst,
+        ReturnMethod::e retType = ReturnMethod::UseOriginal,
+        int vtableLen = 0
+        )
+    {
+        auto& shadows = ShadowVTables::Instance();
+
+        // Object could already use the shadow
+        auto vtable = shadows.Original( reinterpret_cast<void**>(*ppVtable) );
+
+        this->_type = HookType::VTable;
+        this->_order = order;
+        this->_retType = retType;
+        this->_callOriginal = this->_original = vtable[index];
+        this->_callback = hkPtr;
+        this->_internalHandler = &HookHandler<Fn, C>::Handler;
+        this->_ppVtable = ppVtable;
+        this->_pVtable = vtable;
+        this->_vtIndex = index;
+        this->_vtShared = true;
+
+        BuildThunk();
+
+        if (!shadows.SetEntry( vtable, index, this->_buf, vtableLen ) || !shadows.Attach( ppVtable ))
+            return false;
+
+        return (this->_hooked = true);
+    }
+
+    /// <summary>
+    /// Hook function in vtable shared by all objects of a class
+    /// </summary>
+    /// <param name="ppVtable">Pointer to vtable pointer</param>
+    /// <param name="index">Function index</param>
+    /// <param name="hkPtr">Hook class member address</param>
+    /// <param name="pClass">Hook class address</param>
+    /// <param name="order">Call order. Hook before original or vice versa</param>
+    /// <param name="retType">Return value. Use origianl or value from hook</param>
+    /// <param name="vtableLen">Optional. Number of function in vtable, used when shadow is created</param>
+    /// <returns>true on success</returns>
+    bool HookShared(
+        void** ppVtable,
+        int index,
+        hktypeC hkPtr,
+        C* pClass,
+        CallOrder::e order = CallOrder::HookFirst,
+        ReturnMethod::e retType = ReturnMethod::UseOriginal,
+        int vtableLen = 0
+        )
+    {
+        this->_callbackClass = pClass;
+        return HookShared( ppVtable, index, brutal_cast<hktype>(hkPtr), order, retType, vtableLen );
+    }
+
+    /// <summary>
+    /// Move another object of hooked class onto shared vtable
+    /// </summary>
+    /// <param name="ppVtable">Pointer to vtable pointer</param>
+    /// <returns>true on success, false if class has no shared hooks</returns>
+    static bool AttachShared( void** ppVtable )
+    {
+        return ShadowVTables::Instance().Attach( ppVtable );
+    }
+
     /// <summary>
     /// Restore hooked function
     /// </summary>
@@ -155,7 +224,12 @@ public:
         if (!this->_hooked)
             return false;
 
-        if (this->_vtCopied)
+        // Objects keep shadow vtable, it now points to original function
+        if (this->_vtShared)
+        {
+            ShadowVTables::Instance().ResetEntry( reinterpret_cast<void**>(this->_pVtable), this->_vtIndex );
+        }
+        else if (this->_vtCopied)
         {
             *this->_ppVtable = this->_pVtable;
         }
@@ -172,8 +246,30 @@ public:
         return true;
     }
 
+private:
+    /// <summary>
+    /// Construct jump to hook handler
+    /// </summary>
+    void BuildThunk()
+    {
+        auto jmpToHook = AsmFactory::GetAssembler();
+
+#ifdef USE64
+        // mov gs:[0x28], this
+        (*jmpToHook)->mov( asmjit::host::rax, (uint64_t)this );
+        (*jmpToHook)->mov( asmjit::host::qword_ptr_abs( 0x28 ).setSegment( asmjit::host::gs ), asmjit::host::rax );
+#else
+        // mov fs:[0x14], this
+        (*jmpToHook)->mov( asmjit::host::dword_ptr_abs( 0x14 ).setSegment( asmjit::host::fs ), (uint32_t)this );
+#endif // USE64
+
+        (*jmpToHook)->jmp( (asmjit::Ptr)this->_internalHandler );
+        (*jmpToHook)->relocCode( this->_buf );
+    }
+
 private:
     bool   _vtCopied = false;           // VTable was copied
+    bool   _vtShared = false;           // VTable is shared shadow
     void** _ppVtable = nullptr;         // Pointer to VTable pointer
     void*  _pVtable = nullptr;          // Pointer to VTable
     int    _vtIndex = 0;                // VTable function index
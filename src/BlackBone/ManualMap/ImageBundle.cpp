@@ -0,0 +1,184 @@
+#include "ImageBundle.h"
+#include "../Misc/BinaryStream.h"
+#include "../Misc/Utils.h"
+#include "../Include/HandleGuard.h"
+#include "../Include/Macro.h"
+
+#include <algorithm>
+
+namespace blackbone
+{
+
+// 'BBIB'
+constexpr uint32_t BundleMagic = 0x42494242;
+constexpr uint32_t BundleVersion = 1;
+
+/// <summary>
+/// Find dependency by import name
+/// </summary>
+/// <param name="name">Import name, case insensitive</param>
+/// <returns>Dependency, nullptr if not found</returns>
+const BundleDependency* BundleImage::dependency( const std::wstring& name ) const
+{
+    auto lower = Utils::ToLower( name );
+    for (auto& dep : dependencies)
+    {
+        if (dep.name == lower)
+            return &dep;
+    }
+
+    return nullptr;
+}
+
+/// <summary>
+/// Find pre-resolved import
+/// </summary>
+/// <param name="rva">Import address table entry RVA</param>
+/// <returns>Thunk, nullptr if import must be resolved at mapping time</returns>
+const BundleThunk* BundleImage::thunk( uint32_t rva ) const
+{
+    auto iter = std::lower_bound( thunks.begin(), thunks.end(), rva, []( const BundleThunk& thunk, uint32_t value )
+    {
+        return thunk.thunkRVA < value;
+    } );
+
+    if (iter == thunks.end() || iter->thunkRVA != rva)
+        return nullptr;
+
+    return &(*iter);
+}
+
+/// <summary>
+/// Write bundle to file
+/// </summary>
+/// <param name="path">File path</param>
+/// <returns>Status code</returns>
+NTSTATUS ImageBundle::Save( const std::wstring& path ) const
+{
+    BinaryWriter writer;
+    writer.put( BundleMagic );
+    writer.put( BundleVersion );
+    writer.put( static_cast<uint32_t>(_images.size()) );
+
+    for (const auto& img : _images)
+    {
+        writer.put( img.path );
+        writer.put( static_cast<uint32_t>(img.type) );
+        writer.put( img.image );
+        writer.put( img.relocs.dir64() );
+        writer.put( img.relocs.highLow() );
+        writer.put( img.relocs.pages() );
+
+        writer.put( static_cast<uint32_t>(img.dependencies.size()) );
+        for (const auto& dep : img.dependencies)
+        {
+            writer.put( dep.name );
+            writer.put( dep.path );
+            writer.put( dep.imageSize );
+            writer.put( dep.timeStamp );
+        }
+
+        writer.put( img.thunks );
+    }
+
+    auto hFile = Handle( CreateFileW( path.c_str(), FILE_GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, 0, NULL ) );
+    if (!hFile)
+        return LastNtStatus();
+
+    DWORD bytes = 0;
+    auto& data = writer.data();
+    if (!WriteFile( hFile, data.data(), static_cast<DWORD>(data.size()), &bytes, NULL ) || bytes != data.size())
+        return LastNtStatus();
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Read bundle from file
+/// </summary>
+/// <param name="path">File path</param>
+/// <returns>Status code, STATUS_INVALID_IMAGE_FORMAT if file isn't a valid bundle</returns>
+NTSTATUS ImageBundle::Load( const std::wstring& path )
+{
+    clear();
+
+    auto hFile = Handle( CreateFileW( path.c_str(), FILE_GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL ) );
+    if (!hFile)
+        return LastNtStatus();
+
+    LARGE_INTEGER size = { { 0 } };
+    if (!GetFileSizeEx( hFile, &size ) || size.HighPart != 0)
+        return STATUS_FILE_TOO_LARGE;
+
+    std::vector<uint8_t> buf( size.LowPart );
+    DWORD bytes = 0;
+    if (!ReadFile( hFile, buf.data(), size.LowPart, &bytes, NULL ) || bytes != size.LowPart)
+        return LastNtStatus();
+
+    BinaryReader reader( buf.data(), buf.size() );
+    uint32_t magic = 0, version = 0, count = 0;
+
+    if (!reader.get( magic ) || !reader.get( version ) || !reader.get( count ) || magic != BundleMagic || version != BundleVersion || count == 0)
+        return STATUS_INVALID_IMAGE_FORMAT;
+
+    auto fail = [this]()
+    {
+        clear();
+        return STATUS_INVALID_IMAGE_FORMAT;
+    };
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        BundleImage img;
+        uint32_t type = 0, depCount = 0;
+        std::vector<uint32_t> dir64, highLow, pages;
+
+        if (!reader.getString( img.path ) || !reader.get( type ) || !reader.getBytes( img.image ) ||
+            !reader.getVector( dir64 ) || !reader.getVector( highLow ) || !reader.getVector( pages ) || !reader.get( depCount ))
+        {
+            return fail();
+        }
+
+        if ((type != mt_mod32 && type != mt_mod64) || img.image.empty())
+            return fail();
+
+        img.type = static_cast<eModType>(type);
+        if (!NT_SUCCESS( img.relocs.Assign( std::move( dir64 ), std::move( highLow ), std::move( pages ) ) ))
+            return fail();
+
+        for (uint32_t j = 0; j < depCount; j++)
+        {
+            BundleDependency dep;
+            if (!reader.getString( dep.name ) || !reader.getString( dep.path ) || !reader.get( dep.imageSize ) || !reader.get( dep.timeStamp ))
+                return fail();
+
+            img.dependencies.emplace_back( std::move( dep ) );
+        }
+
+        if (!reader.getVector( img.thunks ))
+            return fail();
+
+        // Thunks are searched by RVA and must point to a known dependency
+        auto invalid = std::find_if( img.thunks.begin(), img.thunks.end(), [&img]( const BundleThunk& thunk )
+        {
+            return thunk.dependency >= img.dependencies.size();
+        } );
+
+        bool sorted = std::is_sorted( img.thunks.begin(), img.thunks.end(), []( const BundleThunk& l, const BundleThunk& r )
+        {
+            return l.thunkRVA < r.thunkRVA;
+        } );
+
+        if (invalid != img.thunks.end() || !sorted)
+            return fail();
+
+        _images.emplace_back( std::move( img ) );
+    }
+
+    if (!reader.eof())
+        return fail();
+
+    return STATUS_SUCCESS;
+}
+
+}
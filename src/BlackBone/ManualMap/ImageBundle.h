@@ -0,0 +1,111 @@
+#pragma once
+
+#include "../Include/Winheaders.h"
+#include "../Include/Types.h"
+#include "../PE/RelocTable.h"
+
+#include <string>
+#include <vector>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Dependency of bundled image, as resolved at bundle build time
+/// </summary>
+struct BundleDependency
+{
+    std::wstring name;              // Import name, lowercase
+    std::wstring path;              // Resolved image path, lowercase
+    uint32_t imageSize = 0;         // Exporter image size
+    uint32_t timeStamp = 0;         // Exporter TimeDateStamp
+};
+
+/// <summary>
+/// Pre-resolved import thunk
+/// </summary>
+struct BundleThunk
+{
+    uint32_t thunkRVA = 0;          // Import address table entry RVA
+    uint32_t dependency = 0;        // Exporter index in image dependency list
+    uint32_t exportRVA = 0;         // Function RVA in exporter
+};
+
+/// <summary>
+/// Pre-parsed image
+/// </summary>
+struct BundleImage
+{
+    std::wstring path;                          // Image path, lowercase
+    eModType type = mt_default;                 // Image architecture
+    std::vector<uint8_t> image;                 // Image layout, not relocated
+    pe::RelocTable relocs;                      // Decoded base relocations
+    std::vector<BundleDependency> dependencies; // Resolved imported modules
+    std::vector<BundleThunk> thunks;            // Pre-resolved imports, sorted by thunk RVA
+
+    /// <summary>
+    /// Find dependency by import name
+    /// </summary>
+    /// <param name="name">Import name, case insensitive</param>
+    /// <returns>Dependency, nullptr if not found</returns>
+    BLACKBONE_API const BundleDependency* dependency( const std::wstring& name ) const;
+
+    /// <summary>
+    /// Find pre-resolved import
+    /// </summary>
+    /// <param name="rva">Import address table entry RVA</param>
+    /// <returns>Thunk, nullptr if import must be resolved at mapping time</returns>
+    BLACKBONE_API const BundleThunk* thunk( uint32_t rva ) const;
+};
+
+/// <summary>
+/// Image and its manually mapped dependencies, prepared for repeated mapping.
+/// Holds image layouts, dependency paths, relocations and imports expressed as exporter RVAs,
+/// so mapping only needs module bases in the target. Built by MMap::BuildBundle.
+/// </summary>
+class ImageBundle
+{
+public:
+    BLACKBONE_API ImageBundle() = default;
+
+    /// <summary>
+    /// Write bundle to file
+    /// </summary>
+    /// <param name="path">File path</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS Save( const std::wstring& path ) const;
+
+    /// <summary>
+    /// Read bundle from file
+    /// </summary>
+    /// <param name="path">File path</param>
+    /// <returns>Status code, STATUS_INVALID_IMAGE_FORMAT if file isn't a valid bundle</returns>
+    BLACKBONE_API NTSTATUS Load( const std::wstring& path );
+
+    /// <summary>
+    /// Remove all images
+    /// </summary>
+    BLACKBONE_API inline void clear() { _images.clear(); }
+
+    /// <summary>
+    /// Bundle has no images
+    /// </summary>
+    BLACKBONE_API inline bool empty() const { return _images.empty(); }
+
+    /// <summary>
+    /// Bundled images, root image first
+    /// </summary>
+    BLACKBONE_API inline const std::vector<BundleImage>& images() const { return _images; }
+
+    /// <summary>
+    /// Root image
+    /// </summary>
+    BLACKBONE_API inline const BundleImage& root() const { return _images.front(); }
+
+private:
+    friend class MMap;
+
+    std::vector<BundleImage> _images;   // Root image and its dependencies
+};
+
+}
@@ -163,22 +163,32 @@ LONG CALLBACK VectoredHandler( PEXCEPTION_POINTERS ExceptionInfo )
     if (ExceptionInfo->ExceptionRecord->ExceptionCode == EH_EXCEPTION_NUMBER)
     {
         ModuleTable* pTable = reinterpret_cast<ModuleTable*>(0xDEADBEEFDEADBEEF);
-        for (ptr_t i = 0; i < pTable->count; i++)
+        ExceptionModule* pEntries = reinterpret_cast<ExceptionModule*>(pTable->entries);
+        ptr_t site = ExceptionInfo->ExceptionRecord->ExceptionInformation[2];
+
+        // Find last image with base not above exception site
+        ptr_t lo = 0, hi = pTable->count;
+        while (lo < hi)
+        {
+            ptr_t mid = (lo + hi) / 2;
+            if (site < pEntries[mid].base)
+                hi = mid;
+            else
+                lo = mid + 1;
+        }
+
+        // Check exception site image boundaries
+        if (lo != 0 && site <= pEntries[lo - 1].base + pEntries[lo - 1].size)
         {
-            // Check exception site image boundaries
-            if (ExceptionInfo->ExceptionRecord->ExceptionInformation[2] >= pTable->entry[i].base &&
-                ExceptionInfo->ExceptionRecord->ExceptionInformation[2] <= pTable->entry[i].base + pTable->entry[i].size)
+            // Assume that's our exception because ImageBase = 0 and not suitable magic number
+            if (ExceptionInfo->ExceptionRecord->ExceptionInformation[0] == EH_PURE_MAGIC_NUMBER1
+                && ExceptionInfo->ExceptionRecord->ExceptionInformation[3] == 0)
             {
-                // Assume that's our exception because ImageBase = 0 and not suitable magic number
-                if (ExceptionInfo->ExceptionRecord->ExceptionInformation[0] == EH_PURE_MAGIC_NUMBER1
-                    && ExceptionInfo->ExceptionRecord->ExceptionInformation[3] == 0)
-                {
-                    // CRT magic number
-                    ExceptionInfo->ExceptionRecord->ExceptionInformation[0] = (ULONG_PTR)EH_MAGIC_NUMBER1;
+                // CRT magic number
+                ExceptionInfo->ExceptionRecord->ExceptionInformation[0] = (ULONG_PTR)EH_MAGIC_NUMBER1;
 
-                    // fix exception image base
-                    ExceptionInfo->ExceptionRecord->ExceptionInformation[3] = (ULONG_PTR)pTable->entry[i].base;
-                }
+                // fix exception image base
+                ExceptionInfo->ExceptionRecord->ExceptionInformation[3] = (ULONG_PTR)pEntries[lo - 1].base;
             }
         }
     }
@@ -187,16 +197,15 @@ LONG CALLBACK VectoredHandler( PEXCEPTION_POINTERS ExceptionInfo )
 }*/
 uint8_t MExcept::_handler64[] =
 {
-    0x48, 0x83, 0xEC, 0x08, 0x48, 0x8B, 0x01, 0x4C, 0x8B, 0xD9, 0x81, 0x38, 0x63, 0x73, 0x6D, 0xE0, 
-    0x0F, 0x85, 0x7C, 0x00, 0x00, 0x00, 0x48, 0x89, 0x1C, 0x24, 0x45, 0x33, 0xC9, 0x48, 0xBB, 0xEF, 
-    0xBE, 0xAD, 0xDE, 0xEF, 0xBE, 0xAD, 0xDE, 0x4C, 0x39, 0x0B, 0x76, 0x5B, 0x48, 0xB8, 0xF7, 0xBE, 
-    0xAD, 0xDE, 0xEF, 0xBE, 0xAD, 0xDE, 0x66, 0x66, 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00,
-    0x4D, 0x8B, 0x03, 0x48, 0x8B, 0x10, 0x4D, 0x8B, 0x50, 0x30, 0x4C, 0x3B, 0xD2, 0x72, 0x2C, 0x48, 
-    0x03, 0x50, 0x08, 0x4C, 0x3B, 0xD2, 0x77, 0x23, 0x49, 0x81, 0x78, 0x20, 0x00, 0x40, 0x99, 0x01,
-    0x75, 0x19, 0x49, 0x83, 0x78, 0x38, 0x00, 0x75, 0x12, 0x49, 0xC7, 0x40, 0x20, 0x20, 0x05, 0x93, 
-    0x19, 0x49, 0x8B, 0x13, 0x48, 0x8B, 0x08, 0x48, 0x89, 0x4A, 0x38, 0x49, 0xFF, 0xC1, 0x48, 0x83, 
-    0xC0, 0x10, 0x4C, 0x3B, 0x0B, 0x72, 0xB9, 0x33, 0xC0, 0x48, 0x8B, 0x1C, 0x24, 0x48, 0x83, 0xC4, 
-    0x08, 0xC3, 0x33, 0xC0, 0x48, 0x83, 0xC4, 0x08, 0xC3
+    0x48, 0x8B, 0x01, 0x81, 0x38, 0x63, 0x73, 0x6D, 0xE0, 0x75, 0x76, 0x49, 0xB8, 0xEF, 0xBE, 0xAD,
+    0xDE, 0xEF, 0xBE, 0xAD, 0xDE, 0x4D, 0x8B, 0x08, 0x4D, 0x8B, 0x40, 0x08, 0x4C, 0x8B, 0x50, 0x30,
+    0x31, 0xC9, 0x4C, 0x39, 0xC9, 0x73, 0x1F, 0x4A, 0x8D, 0x14, 0x09, 0x48, 0xD1, 0xEA, 0x49, 0x89,
+    0xD3, 0x49, 0xC1, 0xE3, 0x04, 0x4F, 0x3B, 0x14, 0x18, 0x72, 0x06, 0x48, 0x8D, 0x4A, 0x01, 0xEB,
+    0xE1, 0x49, 0x89, 0xD1, 0xEB, 0xDC, 0x48, 0x85, 0xC9, 0x74, 0x36, 0x48, 0xFF, 0xC9, 0x48, 0xC1,
+    0xE1, 0x04, 0x49, 0x01, 0xC8, 0x49, 0x8B, 0x10, 0x49, 0x89, 0xD3, 0x4D, 0x03, 0x58, 0x08, 0x4D,
+    0x39, 0xDA, 0x77, 0x1D, 0x48, 0x81, 0x78, 0x20, 0x00, 0x40, 0x99, 0x01, 0x75, 0x13, 0x48, 0x83,
+    0x78, 0x38, 0x00, 0x75, 0x0C, 0x48, 0xC7, 0x40, 0x20, 0x20, 0x05, 0x93, 0x19, 0x48, 0x89, 0x50,
+    0x38, 0x31, 0xC0, 0xC3
 };
 
 /// <summary>
@@ -214,37 +223,22 @@ NTSTATUS MExcept::CreateVEH( Process& proc, ModuleData& mod, bool partial )
 
     if (mod.type == mt_mod64)
     {
-        // Add module to module table
-        if (!_pModTable.valid())
-        {
-            auto mem = proc.memory().Allocate( 0x1000, PAGE_READWRITE, 0, false );
-            if (!mem)
-                return mem.status;
-
-            _pModTable = std::move( mem.result() );
-        }
-
-        ModuleTable table;
-        _pModTable.Read ( 0, table );
-
-        // Add new entry to the table
-        table.entry[table.count].base = mod.baseAddress;
-        table.entry[table.count].size = mod.size;
-        table.count++;
-
-        _pModTable.Write( 0, table );
+        NTSTATUS status = AddToTable( proc, mod );
+        if (!NT_SUCCESS( status ))
+            return status;
     }
 
     // No handler required
     if (partial)
         return STATUS_SUCCESS;
 
-    // VEH codecave
-    auto mem = proc.memory().Allocate( 0x2000, PAGE_EXECUTE_READWRITE, 0, false );
+    // VEH codecave, handler outlives this object
+    auto mem = proc.memory().codeHeap().Allocate( 0x2000 );
     if (!mem)
         return mem.status;
 
     _pVEHCode = std::move( mem.result() );
+    _pVEHCode.Release();
 
     BLACKBONE_TRACE( "ManualMap: Vectored hander: 0x%p", _pVEHCode.ptr() );
 
@@ -273,7 +267,6 @@ NTSTATUS MExcept::CreateVEH( Process& proc, ModuleData& mod, bool partial )
         memcpy( newHandler, _handler64, handlerSize );
 
         replaceStub( newHandler, handlerSize, 0xDEADBEEFDEADBEEF, _pModTable.ptr() );
-        replaceStub( newHandler, handlerSize, 0xDEADBEEFDEADBEF7, _pModTable.ptr() + sizeof( ptr_t ) );    
     }
     else
     {
@@ -284,9 +277,9 @@ NTSTATUS MExcept::CreateVEH( Process& proc, ModuleData& mod, bool partial )
         if (!pDecode)
             return pDecode.status;
 
-        replaceStub( newHandler, handlerSize, 0xDEADDA7A, static_cast<uint32_t>(g_symbols.LdrpInvertedFunctionTable32) );
+        replaceStub( newHandler, handlerSize, 0xDEADDA7A, static_cast<uint32_t>(g_symbols->LdrpInvertedFunctionTable32) );
         replaceStub( newHandler, handlerSize, 0xDEADC0DE, static_cast<uint32_t>(pDecode->procAddress) );
-        replaceStub( newHandler, handlerSize, 0xDEADC0D2, static_cast<uint32_t>(g_symbols.LdrProtectMrdata) );
+        replaceStub( newHandler, handlerSize, 0xDEADC0D2, static_cast<uint32_t>(g_symbols->LdrProtectMrdata) );
     }
 
     // Write handler data into target process
@@ -350,13 +343,95 @@ NTSTATUS MExcept::RemoveVEH( Process& proc, bool partial, eModType mt )
     if (!partial)
     {
         proc.remote().ExecInWorkerThread( (*a)->make(), (*a)->getCodeSize(), result );
-        _pVEHCode.Free();
-        _hVEH = 0;
-
-        _pModTable.Free();
+        ReleaseVEH();
     }        
 
     return STATUS_SUCCESS;
 }
 
+/// <summary>
+/// Generate VEH removal for batched remote call.
+/// ReleaseVEH must be called once generated code has run
+/// </summary>
+/// <param name="proc">Target process</param>
+/// <param name="a">Target assembly helper</param>
+/// <param name="mt">Module type</param>
+/// <returns>false if no handler is installed</returns>
+bool MExcept::GenRemoveVEH( Process& proc, IAsmHelper& a, eModType mt )
+{
+    if (_hVEH == 0)
+        return false;
+
+    auto pRemoveHandler = proc.modules().GetNtdllExport( "RtlRemoveVectoredExceptionHandler", mt );
+    if (!pRemoveHandler)
+        return false;
+
+    // RemoveVectoredExceptionHandler(pHandler);
+    a.GenCall( pRemoveHandler->procAddress, { _hVEH } );
+    return true;
+}
+
+/// <summary>
+/// Free handler code and module table after handler was removed
+/// </summary>
+void MExcept::ReleaseVEH()
+{
+    _pVEHCode.Free();
+    _hVEH = 0;
+
+    _pModTable.Free();
+    _pEntries.Free();
+    _modules.clear();
+}
+
+/// <summary>
+/// Add module to x64 module table, table is moved to bigger block if full
+/// </summary>
+/// <param name="proc">Target process</param>
+/// <param name="mod">Module to add</param>
+/// <returns>Status code</returns>
+NTSTATUS MExcept::AddToTable( Process& proc, const ModuleData& mod )
+{
+    if (!_pModTable.valid())
+    {
+        auto mem = proc.memory().Allocate( 0x1000, PAGE_READWRITE, 0, false );
+        if (!mem)
+            return mem.status;
+
+        _pModTable = std::move( mem.result() );
+    }
+
+    // Keep entries sorted by base, remapped image replaces old entry
+    ExceptionModule entry = { mod.baseAddress, mod.size };
+    auto iter = std::lower_bound( _modules.begin(), _modules.end(), entry, []( const auto& l, const auto& r ) { return l.base < r.base; } );
+    if (iter != _modules.end() && iter->base == entry.base)
+        *iter = entry;
+    else
+        _modules.insert( iter, entry );
+
+    size_t tableSize = _modules.size() * sizeof( ExceptionModule );
+    ptr_t oldEntries = _pEntries.ptr();
+
+    if (tableSize > _pEntries.size())
+    {
+        auto mem = proc.memory().Allocate( Align( tableSize * 2, 0x1000 ), PAGE_READWRITE, 0, false );
+        if (!mem)
+            return mem.status;
+
+        // Handler may still be walking old table, so it is left to the target process
+        _pEntries.Release();
+        _pEntries = std::move( mem.result() );
+    }
+
+    NTSTATUS status = _pEntries.Write( 0, tableSize, _modules.data() );
+    if (!NT_SUCCESS( status ))
+        return status;
+
+    // New array is published before count, so handler never sees count beyond array
+    if (_pEntries.ptr() != oldEntries)
+        _pModTable.Write( FIELD_OFFSET( ModuleTable, entries ), _pEntries.ptr() );
+
+    return _pModTable.Write( FIELD_OFFSET( ModuleTable, count ), static_cast<ptr_t>(_modules.size()) );
+}
+
 }
@@ -3,6 +3,8 @@
 #include "../Include/Winheaders.h"
 #include "../Process/MemBlock.h"
 
+#include <vector>
+
 namespace blackbone
 {
 
@@ -17,12 +19,12 @@ struct ExceptionModule
 
 
 /// <summary>
-/// x64 module table
+/// x64 module table header. Entries are sorted by base, so handler can use binary search
 /// </summary>
 struct ModuleTable
 {
     ptr_t count;                    // Number of used entries
-    ExceptionModule entry[250];     // Module data
+    ptr_t entries;                  // Address of ExceptionModule array
 };
 
 /// <summary>
@@ -53,18 +55,43 @@ public:
     /// <returns>Status code</returns>
     BLACKBONE_API NTSTATUS RemoveVEH( class Process& proc, bool partial, eModType mt );
 
+    /// <summary>
+    /// Generate VEH removal for batched remote call.
+    /// ReleaseVEH must be called once generated code has run
+    /// </summary>
+    /// <param name="proc">Target process</param>
+    /// <param name="a">Target assembly helper</param>
+    /// <param name="mt">Module type</param>
+    /// <returns>false if no handler is installed</returns>
+    BLACKBONE_API bool GenRemoveVEH( class Process& proc, class IAsmHelper& a, eModType mt );
+
+    /// <summary>
+    /// Free handler code and module table after handler was removed
+    /// </summary>
+    BLACKBONE_API void ReleaseVEH();
+
     /// <summary>
     /// Reset data
     /// </summary>
-    BLACKBONE_API  inline void reset() { _pModTable.Free(); }
+    BLACKBONE_API  inline void reset() { _pModTable.Free(); _pEntries.Free(); _modules.clear(); }
 
 private:
     MExcept( const MExcept& ) = delete;
     MExcept& operator =(const MExcept&) = delete;
 
+    /// <summary>
+    /// Add module to x64 module table, table is moved to bigger block if full
+    /// </summary>
+    /// <param name="proc">Target process</param>
+    /// <param name="mod">Module to add</param>
+    /// <returns>Status code</returns>
+    NTSTATUS AddToTable( class Process& proc, const ModuleData& mod );
+
 private:
     MemBlock  _pVEHCode;    // VEH function codecave
-    MemBlock  _pModTable;   // x64 module address range table
+    MemBlock  _pModTable;   // x64 module table header
+    MemBlock  _pEntries;    // x64 module table entries
+    std::vector<ExceptionModule> _modules;  // Local copy of table entries
     uint64_t  _hVEH = 0;    // VEH handle
 
     static uint8_t _handler32[];
@@ -1,12 +1,16 @@
 #include "MMap.h"
+#include "ImageBundle.h"
 #include "../Process/Process.h"
 #include "../Misc/NameResolve.h"
+#include "../PE/RelocTable.h"
 #include "../Misc/Utils.h"
 #include "../Misc/DynImport.h"
 #include "../Misc/Trace.hpp"
 #include "../DriverControl/DriverControl.h"
 
 #include <random>
+#include <chrono>
+#include <string_view>
 #include <3rd_party/VersionApi.h>
 
 #ifndef STATUS_INVALID_EXCEPTION_HANDLER
@@ -16,6 +20,38 @@
 namespace blackbone
 {
 
+/// <summary>
+/// Identity of image manifest, images with the same identity get the same SxS redirection
+/// </summary>
+/// <param name="image">Image</param>
+/// <returns>Manifest identity, empty if image has no manifest</returns>
+static std::wstring ManifestKey( pe::PEImage& image )
+{
+    if (image.manifestID() == 0 || image.manifestFile().empty())
+        return std::wstring();
+
+    return Utils::ToLower( image.manifestFile() ) + L':' + std::to_wstring( image.manifestID() );
+}
+
+/// <summary>
+/// Hash every page of image layout
+/// </summary>
+/// <param name="image">Image layout</param>
+/// <returns>Page hashes</returns>
+static std::vector<size_t> PageHashes( const std::pmr::vector<uint8_t>& image )
+{
+    std::vector<size_t> hashes;
+    hashes.reserve( Align( image.size(), 0x1000 ) / 0x1000 );
+
+    for (size_t offset = 0; offset < image.size(); offset += 0x1000)
+    {
+        std::string_view page( reinterpret_cast<const char*>(image.data() + offset), std::min<size_t>( 0x1000, image.size() - offset ) );
+        hashes.emplace_back( std::hash<std::string_view>()(page) );
+    }
+
+    return hashes;
+}
+
 MMap::MMap( Process& proc )
     : _process( proc )
 {
@@ -33,16 +69,18 @@ MMap::~MMap(void)
 /// <param name="flags">Image mapping flags</param>
 /// <param name="mapCallback">Mapping callback. Triggers for each mapped module</param>
 /// <param name="context">User-supplied callback context</param>
+/// <param name="pStats">Optional per phase mapping statistics</param>
 /// <returns>Mapped image info </returns>
 call_result_t<ModuleDataPtr> MMap::MapImage(
     const std::wstring& path,
     eLoadFlags flags /*= NoFlags*/,
     MapCallback mapCallback /*= nullptr*/,
     void* context /*= nullptr*/,
-    CustomArgs_t* pCustomArgs /*= nullptr*/
+    CustomArgs_t* pCustomArgs /*= nullptr*/,
+    MapStats* pStats /*= nullptr*/
     )
 {
-    return MapImageInternal( path, nullptr, 0, false, flags, mapCallback, context, pCustomArgs );
+    return MapImageInternal( path, nullptr, 0, false, flags, mapCallback, context, pCustomArgs, nullptr, pStats );
 }
 
 /// <summary>
@@ -54,6 +92,7 @@ call_result_t<ModuleDataPtr> MMap::MapImage(
 /// <param name="flags">Image mapping flags</param>
 /// <param name="mapCallback">Mapping callback. Triggers for each mapped module</param>
 /// <param name="context">User-supplied callback context</param>
+/// <param name="pStats">Optional per phase mapping statistics</param>
 /// <returns>Mapped image info</returns>
 call_result_t<ModuleDataPtr> MMap::MapImage(
     size_t size, void* buffer,
@@ -61,14 +100,228 @@ call_result_t<ModuleDataPtr> MMap::MapImage(
     eLoadFlags flags /*= NoFlags*/,
     MapCallback mapCallback /*= nullptr*/,
     void* context /*= nullptr*/,
-    CustomArgs_t* pCustomArgs /*= nullptr*/
+    CustomArgs_t* pCustomArgs /*= nullptr*/,
+    MapStats* pStats /*= nullptr*/
     )
 {
     // Create fake path
     wchar_t path[64];
     wsprintfW( path, L"MemoryImage_0x%p", buffer );
 
-    return MapImageInternal( path, buffer, size, asImage, flags, mapCallback, context, pCustomArgs );
+    return MapImageInternal( path, buffer, size, asImage, flags, mapCallback, context, pCustomArgs, nullptr, pStats );
+}
+
+/// <summary>
+/// Manually map prepared image bundle into underlying target process.
+/// Dependencies already loaded in the target are used as is
+/// </summary>
+/// <param name="bundle">Image bundle</param>
+/// <param name="flags">Image mapping flags. ManualImports is required to map bundled dependencies</param>
+/// <param name="mapCallback">Mapping callback. Triggers for each mapped module</param>
+/// <param name="context">User-supplied callback context</param>
+/// <param name="pStats">Optional per phase mapping statistics</param>
+/// <returns>Mapped image info</returns>
+call_result_t<ModuleDataPtr> MMap::MapImage(
+    const ImageBundle& bundle,
+    eLoadFlags flags /*= ManualImports*/,
+    MapCallback mapCallback /*= nullptr*/,
+    void* context /*= nullptr*/,
+    CustomArgs_t* pCustomArgs /*= nullptr*/,
+    MapStats* pStats /*= nullptr*/
+    )
+{
+    if (bundle.empty())
+        return STATUS_INVALID_PARAMETER;
+
+    return MapImageInternal( bundle.root().path, nullptr, 0, false, flags, mapCallback, context, pCustomArgs, &bundle, pStats );
+}
+
+/// <summary>
+/// Prepare image and its dependencies for repeated mapping.
+/// Dependency paths and imports are resolved against modules of underlying process,
+/// bundle is valid for any process with the same system images
+/// </summary>
+/// <param name="path">Image path</param>
+/// <param name="bundle">Resulting bundle</param>
+/// <param name="flags">Mapping flags. With ManualImports missing dependencies are bundled as well</param>
+/// <returns>Status code</returns>
+NTSTATUS MMap::BuildBundle( const std::wstring& path, ImageBundle& bundle, eLoadFlags flags /*= ManualImports*/ )
+{
+    // Exporter data needed to express imports as RVAs
+    struct Exporter
+    {
+        std::unordered_map<std::string, uint32_t> exports;  // Named exports, except forwarded
+        uint32_t imageSize = 0;                             // Image size
+        uint32_t timeStamp = 0;                             // TimeDateStamp
+    };
+
+    std::unordered_map<std::wstring, std::unique_ptr<Exporter>> exporters;
+    auto getExporter = [&exporters]( const std::wstring& filePath ) -> const Exporter*
+    {
+        auto iter = exporters.find( filePath );
+        if (iter != exporters.end())
+            return iter->second.get();
+
+        std::unique_ptr<Exporter> pExporter;
+        pe::PEImage image;
+        if (NT_SUCCESS( image.Load( filePath, pe::HeadersOnly ) ))
+        {
+            pExporter.reset( new Exporter() );
+
+            auto expStart = image.DirectoryAddress( IMAGE_DIRECTORY_ENTRY_EXPORT, pe::RVA );
+            auto expEnd = expStart + image.DirectorySize( IMAGE_DIRECTORY_ENTRY_EXPORT );
+
+            // Forwarded exports are resolved at mapping time
+            for (const auto& item : image.ExportsView())
+                if (item.RVA < expStart || item.RVA >= expEnd)
+                    pExporter->exports.emplace( std::string( item.name ), item.RVA );
+
+            auto pDosHdr = reinterpret_cast<const IMAGE_DOS_HEADER*>(image.base());
+            auto pNtHdr = reinterpret_cast<const IMAGE_NT_HEADERS32*>(reinterpret_cast<const uint8_t*>(pDosHdr) + pDosHdr->e_lfanew);
+
+            pExporter->imageSize = image.imageSize();
+            pExporter->timeStamp = pNtHdr->FileHeader.TimeDateStamp;
+        }
+
+        return exporters.emplace( filePath, std::move( pExporter ) ).first->second.get();
+    };
+
+    bundle.clear();
+
+    auto root = std::make_shared<ImageContext>();
+    root->ldrEntry.fullPath = Utils::ToLower( path );
+    root->ldrEntry.name = Utils::StripPath( root->ldrEntry.fullPath );
+    root->flags = flags;
+
+    auto status = root->peImage.Load( path, flags & NoSxS ? true : false );
+    if (!NT_SUCCESS( status ))
+    {
+        BLACKBONE_TRACE( L"ManualMap: Failed to load image '%ls'. Status 0x%X", path.c_str(), status );
+        return status;
+    }
+
+    if (root->peImage.mType() == mt_mod32 && !_process.core().isWow64())
+        return STATUS_INVALID_IMAGE_WIN_32;
+
+    root->ldrEntry.type = root->peImage.mType();
+
+    std::set<std::wstring> visited = { root->ldrEntry.fullPath };
+    vecImageCtx queue = { root };
+
+    // Images are added in load order, root first
+    for (size_t idx = 0; idx < queue.size(); idx++)
+    {
+        auto pImage = queue[idx];
+        auto mt = pImage->ldrEntry.type;
+
+        BundleImage entry;
+        entry.path = pImage->ldrEntry.fullPath;
+        entry.type = mt;
+
+        if (!NT_SUCCESS( status = StageImage( pImage ) ) || !NT_SUCCESS( status = entry.relocs.Parse( pImage->peImage ) ))
+        {
+            BLACKBONE_TRACE( L"ManualMap: Failed to prepare image '%ls' for bundle. Status 0x%X", entry.path.c_str(), status );
+            return status;
+        }
+
+        // Handle x64 system32 dlls for wow64 process
+        FsRedirector fsr( !(pImage->flags & IsDependency) && mt == mt_mod64 && _process.barrier().sourceWow64 );
+
+        // Dependency index and its exporter data, if imports can be pre-resolved
+        std::unordered_map<std::wstring, std::pair<uint32_t, const Exporter*>> depIndex;
+        for (auto delayed : { false, true })
+        {
+            if (delayed && (pImage->flags & NoDelayLoad))
+                continue;
+
+            for (auto& importMod : pImage->peImage.GetImports( delayed ))
+            {
+                auto name = Utils::ToLower( importMod.first );
+                auto iter = depIndex.find( name );
+                if (iter == depIndex.end())
+                {
+                    std::wstring depPath = importMod.first;
+                    auto hMod = _process.modules().GetModule( depPath, LdrList, mt, pImage->ldrEntry.fullPath.c_str() );
+
+                    // Unresolved modules, e.g. ones requiring remote SxS probing, are left for mapping time
+                    bool resolved = NT_SUCCESS( ResolveDependencyPath( pImage, depPath ) );
+                    if (!resolved && !hMod)
+                        continue;
+
+                    depPath = Utils::ToLower( resolved ? depPath : hMod->fullPath );
+                    if (!hMod)
+                        hMod = _process.modules().GetModule( depPath, LdrList, mt );
+
+                    BundleDependency dep;
+                    dep.name = name;
+                    dep.path = hMod ? Utils::ToLower( hMod->fullPath ) : depPath;
+
+                    // Exporter must be the image loaded in target
+                    auto pExporter = getExporter( depPath );
+                    if (pExporter != nullptr && hMod && hMod->size != pExporter->imageSize)
+                        pExporter = nullptr;
+
+                    if (pExporter != nullptr)
+                    {
+                        dep.imageSize = pExporter->imageSize;
+                        dep.timeStamp = pExporter->timeStamp;
+                    }
+
+                    // Missing dependency is bundled as well
+                    if (!hMod && (flags & ManualImports) && visited.emplace( depPath ).second)
+                    {
+                        auto pDep = std::make_shared<ImageContext>();
+                        pDep->ldrEntry.fullPath = depPath;
+                        pDep->ldrEntry.name = Utils::StripPath( depPath );
+                        pDep->ldrEntry.type = mt;
+                        pDep->flags = flags | NoSxS | NoDelayLoad | PartialExcept | IsDependency;
+
+                        if (!NT_SUCCESS( status = pDep->peImage.Load( depPath, pe::SkipActx ) ))
+                        {
+                            BLACKBONE_TRACE( L"ManualMap: Failed to load dependency '%ls'. Status 0x%X", depPath.c_str(), status );
+                            return status;
+                        }
+
+                        if (pDep->peImage.mType() != mt)
+                            return STATUS_INVALID_IMAGE_FORMAT;
+
+                        queue.emplace_back( std::move( pDep ) );
+                    }
+
+                    iter = depIndex.emplace( name, std::make_pair( static_cast<uint32_t>(entry.dependencies.size()), pExporter ) ).first;
+                    entry.dependencies.emplace_back( std::move( dep ) );
+                }
+
+                auto [index, pExporter] = iter->second;
+                if (pExporter == nullptr)
+                    continue;
+
+                // Imports by ordinal and forwarded ones are resolved at mapping time
+                for (auto& importFn : importMod.second)
+                {
+                    if (importFn.importByOrd)
+                        continue;
+
+                    auto exp = pExporter->exports.find( importFn.importName );
+                    if (exp != pExporter->exports.end())
+                        entry.thunks.emplace_back( BundleThunk{ static_cast<uint32_t>(importFn.ptrRVA), index, exp->second } );
+                }
+            }
+        }
+
+        std::sort( entry.thunks.begin(), entry.thunks.end(), []( const BundleThunk& l, const BundleThunk& r )
+        {
+            return l.thunkRVA < r.thunkRVA;
+        } );
+
+        entry.image.assign( pImage->localImage.begin(), pImage->localImage.end() );
+        decltype(pImage->localImage)( pImage->localImage.get_allocator() ).swap( pImage->localImage );
+        pImage->peImage.Release();
+
+        bundle._images.emplace_back( std::move( entry ) );
+    }
+
+    return STATUS_SUCCESS;
 }
 
 /// <summary>
@@ -81,6 +334,8 @@ call_result_t<ModuleDataPtr> MMap::MapImage(
 /// <param name="flags">Image mapping flags</param>
 /// <param name="mapCallback">Mapping callback. Triggers for each mapped module</param>
 /// <param name="context">User-supplied callback context</param>
+/// <param name="pBundle">Prepared image bundle</param>
+/// <param name="pStats">Mapping statistics</param>
 /// <returns>Mapped image info</returns>
 call_result_t<ModuleDataPtr> MMap::MapImageInternal(
     const std::wstring& path,
@@ -89,9 +344,23 @@ call_result_t<ModuleDataPtr> MMap::MapImageInternal(
     eLoadFlags flags /*= NoFlags*/,
     MapCallback mapCallback /*= nullptr*/,
     void* context /*= nullptr*/,
-    CustomArgs_t* pCustomArgs /*= nullptr*/
+    CustomArgs_t* pCustomArgs /*= nullptr*/,
+    const ImageBundle* pBundle /*= nullptr*/,
+    MapStats* pStats /*= nullptr*/
     )
 {
+    LatencyTimer timer( _process.latency().recording( LatencyOp::MapImage ) );
+    StatsScope stats( *this, pStats );
+
+    // Staging copies and import tables of the root image and all dependencies come from one arena,
+    // released at once when call returns. Resource supplied by caller through TransientScope takes precedence.
+    // Lock is needed because ParallelDeps stages images on worker threads
+    constexpr size_t arenaBlock = 0x100000;
+    std::pmr::monotonic_buffer_resource arena( arenaBlock );
+    LockedResource lockedArena( &arena );
+    bool ownArena = TransientResource() == std::pmr::get_default_resource();
+    TransientScope scope( ownArena ? static_cast<std::pmr::memory_resource*>(&lockedArena) : TransientResource() );
+
     if (!(flags & ForceRemap))
     {
         // Already loaded
@@ -100,7 +369,7 @@ call_result_t<ModuleDataPtr> MMap::MapImageInternal(
     }
 
     // Prepare target process
-    auto mode = (flags & NoThreads) ? Worker_UseExisting : Worker_CreateNew;
+    auto mode = (flags & NoThreads) ? Worker_UseExisting : Worker_CreateNewEvent;
     auto status = _process.remote().CreateRPCEnvironment( mode, true );
     if (!NT_SUCCESS( status ))
     {
@@ -122,14 +391,52 @@ call_result_t<ModuleDataPtr> MMap::MapImageInternal(
 
     BLACKBONE_TRACE( L"ManualMap: Mapping image '%ls' with flags 0x%x", path.c_str(), flags );
 
+    // Arena is sized from prepared dependency set
+    if (flags & SharedArena)
+        flags |= ParallelDeps;
+
+    // Load and stage dependencies ahead of mapping. Bundle has everything parsed already
+    size_t arenaSize = 0;
+    if (pBundle != nullptr || ((flags & ParallelDeps) && (flags & ManualImports)))
+    {
+        PhaseScope phase( *this, MP_Load );
+        if (pBundle != nullptr)
+            arenaSize = PrepareBundle( *pBundle );
+        else
+            arenaSize = PrepareDependencies( path, buffer, size, asImage, flags );
+    }
+
+    // Reserve and commit memory for the whole set at once
+    if ((flags & SharedArena) && !(flags & (MapInHighMem | HideVAD)) && arenaSize != 0)
+    {
+        PhaseScope phase( *this, MP_Allocate );
+        auto mem = _process.memory().Allocate( arenaSize, PAGE_EXECUTE_READWRITE );
+        if (mem)
+        {
+            _arena = std::move( mem.result() );
+            _arenaUsed = 0;
+
+            BLACKBONE_TRACE( L"ManualMap: Shared arena of 0x%llx bytes allocated at 0x%016llx", static_cast<uint64_t>(arenaSize), _arena.ptr() );
+        }
+    }
+
     // Map module and all dependencies
     auto mod = FindOrMapModule( path, buffer, size, asImage, flags );
+
+    // Unused prepared images, e.g. loaded natively by callback decision
+    _prepared.clear();
+
     if (!mod)
     {
         Cleanup();
         return mod.status;
     }
 
+    // Arena now belongs to mapped images
+    _arena.Release();
+    _arena.Reset();
+    _arenaUsed = 0;
+
     // Change process base module address if needed
     if (flags & RebaseProcess && !_images.empty() && _images.rbegin()->get()->peImage.isExe())
     {
@@ -181,33 +488,54 @@ call_result_t<ModuleDataPtr> MMap::MapImageInternal(
         }
     };
 
-    // Run initializers
+    // Collect images to initialize
+    vecImageCtx pending;
     for (auto& img : _images)
     {
         // Init once
-        if (!img->initialized)
+        if (img->initialized)
+            continue;
+
+        // Hack for IL dlls
+        if (!img->peImage.isExe() && img->peImage.pureIL())
         {
-            // Hack for IL dlls
-            if (!img->peImage.isExe() && img->peImage.pureIL())
-            {
-                DWORD flOld = 0;
-                auto flg = img->imgMem.Read( img->peImage.ilFlagOffset(), 0 );
-                img->imgMem.Protect( PAGE_EXECUTE_READWRITE, img->peImage.ilFlagOffset(), sizeof( flg ), &flOld );
-                img->imgMem.Write( img->peImage.ilFlagOffset(), flg & ~COMIMAGE_FLAGS_ILONLY );
-                img->imgMem.Protect( flOld, img->peImage.ilFlagOffset(), sizeof( flg ), &flOld );
-            }
+            DWORD flOld = 0;
+            auto flg = img->imgMem.Read( img->peImage.ilFlagOffset(), 0 );
+            img->imgMem.Protect( PAGE_EXECUTE_READWRITE, img->peImage.ilFlagOffset(), sizeof( flg ), &flOld );
+            img->imgMem.Write( img->peImage.ilFlagOffset(), flg & ~COMIMAGE_FLAGS_ILONLY );
+            img->imgMem.Protect( flOld, img->peImage.ilFlagOffset(), sizeof( flg ), &flOld );
+        }
 
-            // Don't run initializer for pure IL dlls
-            if (!img->peImage.pureIL() || img->peImage.isExe())
-                status = RunModuleInitializers( img, DLL_PROCESS_ATTACH, pCustomArgs ).status;
+        // Don't run initializer for pure IL dlls
+        if (!img->peImage.pureIL() || img->peImage.isExe())
+            pending.emplace_back( img );
+    }
 
-            if (!NT_SUCCESS( status ))
-            {
-                BLACKBONE_TRACE( L"ManualMap: ModuleInitializers failed for '%ls', status: 0x%X", img->ldrEntry.name.c_str(), status );
-                Cleanup();
-                return status;
-            }
+    // Run initializers, one remote call per run of images of the same architecture
+    for (size_t start = 0; start < pending.size(); )
+    {
+        size_t end = start + 1;
+        while (end < pending.size() && pending[end]->ldrEntry.type == pending[start]->ldrEntry.type)
+            end++;
+
+        vecImageCtx batch( pending.begin() + start, pending.begin() + end );
+        std::vector<uint32_t> results;
+
+        status = RunBatchInitializers( batch, DLL_PROCESS_ATTACH, pCustomArgs, results );
+        if (!NT_SUCCESS( status ))
+        {
+            BLACKBONE_TRACE( L"ManualMap: ModuleInitializers failed for '%ls', status: 0x%X", batch.front()->ldrEntry.name.c_str(), status );
+            Cleanup();
+            return status;
+        }
+
+        start = end;
+    }
 
+    for (auto& img : _images)
+    {
+        if (!img->initialized)
+        {
             // Wipe header
             if (img->flags & WipeHeader)
                 wipeMemory( _process, img.get(), 0, img->peImage.headersSize() );
@@ -236,14 +564,14 @@ call_result_t<ModuleDataPtr> MMap::MapImageInternal(
 template<typename T>
 void MMap::FixManagedPath( ptr_t base, const std::wstring &path )
 {
-    _PEB_T<T> peb = { 0 };
     _PEB_LDR_DATA2_T<T> ldr = { 0 };
 
-    if (_process.core().peb( &peb ) != 0 && _process.memory().Read( peb.Ldr, sizeof( ldr ), &ldr ) == STATUS_SUCCESS)
+    auto peb = _process.memory().ReadFields<_PEB_T<T>, &_PEB_T<T>::Ldr>( _process.core().peb<T>() );
+    if (peb && _process.memory().Read( peb->Ldr, sizeof( ldr ), &ldr ) == STATUS_SUCCESS)
     {
         // Get PEB loader entry
         for (auto head = ldr.InLoadOrderModuleList.Flink;
-            head != fieldPtr( peb.Ldr, &_PEB_LDR_DATA2_T<T>::InLoadOrderModuleList );
+            head != fieldPtr( peb->Ldr, &_PEB_LDR_DATA2_T<T>::InLoadOrderModuleList );
             head = _process.memory().Read<T>( head ).result( 0 ))
         {
             _LDR_DATA_TABLE_ENTRY_BASE_T<T> localdata = { { 0 } };
@@ -280,7 +608,18 @@ call_result_t<ModuleDataPtr> MMap::FindOrMapModule(
     )
 {
     NTSTATUS status = STATUS_SUCCESS;
-    ImageContextPtr pImage( new ImageContext() );
+    ImageContextPtr pImage;
+
+    // Take image loaded by PrepareDependencies
+    auto prepared = buffer == nullptr ? _prepared.find( Utils::ToLower( path ) ) : _prepared.end();
+    if (prepared != _prepared.end())
+    {
+        pImage = prepared->second;
+        _prepared.erase( prepared );
+    }
+    else
+        pImage = std::make_shared<ImageContext>();
+
     auto& ldrEntry = pImage->ldrEntry;
 
     ldrEntry.fullPath = Utils::ToLower( path );
@@ -288,7 +627,17 @@ call_result_t<ModuleDataPtr> MMap::FindOrMapModule(
     pImage->flags = flags;
 
     // Load and parse image
-    status = buffer ? pImage->peImage.Load( buffer, size, !asImage ) : pImage->peImage.Load( path, flags & NoSxS ? true : false );
+    {
+        PhaseScope phase( *this, MP_Load );
+
+        if (pImage->peImage.base() != nullptr)
+            status = STATUS_SUCCESS;
+        else if (buffer)
+            status = pImage->peImage.Load( buffer, size, !asImage );
+        else
+            status = pImage->peImage.Load( path, flags & NoSxS ? true : false );
+    }
+
     if (!NT_SUCCESS( status ))
     {
         BLACKBONE_TRACE( L"ManualMap: Failed to load image '%ls'/0x%p. Status 0x%X", path.c_str(), buffer, status );
@@ -318,61 +667,11 @@ call_result_t<ModuleDataPtr> MMap::FindOrMapModule(
 
     ldrEntry.type = pImage->peImage.mType();
 
-    // Try to map image in high (>4GB) memory range
-    if (flags & MapInHighMem)
-    {
-        AllocateInHighMem( pImage->imgMem, pImage->peImage.imageSize() );
-    }
-    // Try to map image at it's original ASRL-aware base
-    else if (flags & HideVAD)
-    {      
-        ptr_t base  = pImage->peImage.imageBase();
-        ptr_t image_size = pImage->peImage.imageSize();
-
-        if (!NT_SUCCESS( Driver().EnsureLoaded() ))
-        {
-            pImage->peImage.Release();
-            return Driver().status();
-        }
-
-        // Allocate as physical at desired base
-        status = Driver().AllocateMem( _process.pid(), base, image_size, MEM_COMMIT, PAGE_EXECUTE_READWRITE, true );
-
-        // Allocate at any base
-        if (!NT_SUCCESS( status ))
-        {
-            base = 0;
-            image_size = pImage->peImage.imageSize();
-            status = Driver().AllocateMem( _process.pid(), base, image_size, MEM_COMMIT, PAGE_EXECUTE_READWRITE, true );
-        }
-
-        // Store allocated region
-        if (NT_SUCCESS( status ))
-        {
-            pImage->imgMem = MemBlock( &_process.memory(), base, static_cast<size_t>(image_size), PAGE_EXECUTE_READWRITE, true, true );
-        }
-        // Stop mapping
-        else
-        {
-            //flags &= ~HideVAD;
-            BLACKBONE_TRACE( L"ManualMap: Failed to allocate physical memory for image, status 0x%X", status );
-            pImage->peImage.Release();
-            return status;
-        }
-    }
-
-    // Allocate normally if something went wrong
-    if (!pImage->imgMem.valid())
+    // Reserve target memory
+    if (!NT_SUCCESS( status = AllocateImage( pImage, flags ) ))
     {
-        auto mem = _process.memory().Allocate( pImage->peImage.imageSize(), PAGE_EXECUTE_READWRITE, pImage->peImage.imageBase() );
-        if (!mem)
-        {
-            BLACKBONE_TRACE( L"ManualMap: Failed to allocate memory for image, status 0x%X", status );
-            pImage->peImage.Release();
-            return mem.status;
-        }
-
-        pImage->imgMem = std::move( mem.result() );
+        pImage->peImage.Release();
+        return status;
     }
 
     ldrEntry.baseAddress = pImage->imgMem.ptr();
@@ -394,8 +693,15 @@ call_result_t<ModuleDataPtr> MMap::FindOrMapModule(
         }
     }
 
-    // Core image mapping operations
-    if (!NT_SUCCESS( status = CopyImage( pImage ) ))
+    // Core image mapping operations.
+    // Image is relocated locally and written into target once. Prepared dependencies are staged already
+    if (pImage->localImage.empty())
+    {
+        PhaseScope phase( *this, MP_Load );
+        status = StageImage( pImage );
+    }
+
+    if (!NT_SUCCESS( status ))
     {
         pImage->peImage.Release();
         return status;
@@ -407,6 +713,12 @@ call_result_t<ModuleDataPtr> MMap::FindOrMapModule(
         return status;
     }
 
+    if (!NT_SUCCESS( status = CopyImage( pImage ) ))
+    {
+        pImage->peImage.Release();
+        return status;
+    }
+
     auto mt = ldrEntry.type;
 	ModuleDataPtr pMod;
 
@@ -505,6 +817,7 @@ call_result_t<ModuleDataPtr> MMap::FindOrMapModule(
 
     // Unload local copy
     pImage->peImage.Release();
+    pImage->bundle = nullptr;
 
     // Release ownership of image memory block
     pImage->imgMem.Release();
@@ -515,99 +828,543 @@ call_result_t<ModuleDataPtr> MMap::FindOrMapModule(
 }
 
 /// <summary>
-/// Unmap all manually mapped modules
-/// </summary>
-/// <returns>Status code</returns>
-NTSTATUS MMap::UnmapAllModules()
-{
-    for (auto img = _images.rbegin(); img != _images.rend(); ++img)
-    {
-        auto pImage = *img;
-        BLACKBONE_TRACE( L"ManualMap: Unmapping image '%ls'", pImage->ldrEntry.name.c_str() );
-
-        // Call main
-        RunModuleInitializers( pImage, DLL_PROCESS_DETACH );
-
-        // Remove VEH
-        if (!(pImage->flags & NoExceptions))
-            DisableExceptions( pImage );
-
-        _process.nativeLdr().UnloadTLS( pImage->ldrEntry );
-
-        // Remove from loader
-        if (pImage->ldrEntry.flags != Ldr_None)
-            _process.nativeLdr().Unlink( pImage->ldrEntry );
-
-        // Free memory
-        pImage->imgMem.Free();
-
-        // Remove reference from local modules list
-        _process.modules().RemoveManualModule( pImage->ldrEntry.name, pImage->peImage.mType() );
-    } 
-
-    Cleanup();
-    return STATUS_SUCCESS;
-}
-
-/// <summary>
-/// Copies image into target process
+/// Allocate target memory for image
 /// </summary>
 /// <param name="pImage">Image data</param>
+/// <param name="flags">Mapping flags</param>
 /// <returns>Status code</returns>
-NTSTATUS MMap::CopyImage( ImageContextPtr pImage )
+NTSTATUS MMap::AllocateImage( ImageContextPtr pImage, eLoadFlags flags )
 {
+    PhaseScope phase( *this, MP_Allocate );
     NTSTATUS status = STATUS_SUCCESS;
 
-    BLACKBONE_TRACE( L"ManualMap: Performing image copy" );
-
-    // offset to first section equals to header size
-    size_t dwHeaderSize = pImage->peImage.headersSize();
-
-    // Copy header
-    if (pImage->flags & HideVAD)
-        status = Driver().WriteMem( _process.pid(), pImage->imgMem.ptr(), dwHeaderSize, pImage->peImage.base() );
-    else
-        status = pImage->imgMem.Write( 0, dwHeaderSize, pImage->peImage.base() );
+    // Images are placed at 64 KB granularity, same as separate allocations
+    size_t arenaSlot = Align( pImage->peImage.imageSize(), 0x10000 );
 
-    if (!NT_SUCCESS( status ))
+    // Take part of shared arena, image will be relocated
+    if (_arena.valid() &&
+        (pImage->peImage.DllCharacteristics() & IMAGE_DLLCHARACTERISTICS_DYNAMIC_BASE) &&
+        _arenaUsed + arenaSlot <= _arena.size())
     {
-        BLACKBONE_TRACE( L"ManualMap: Failed to copy image headers. Status = 0x%x", status );
-        return status;
+        pImage->imgMem = MemBlock( &_process.memory(), _arena.ptr() + _arenaUsed, pImage->peImage.imageSize(), PAGE_EXECUTE_READWRITE, false );
+        pImage->arenaBase = _arena.ptr();
+        _arenaUsed += arenaSlot;
     }
-
-    // Set header protection
-    if (!(pImage->flags & HideVAD))
+    // Try to map image in high (>4GB) memory range
+    else if (flags & MapInHighMem)
     {
-        status = pImage->imgMem.Protect( PAGE_READONLY, 0, dwHeaderSize );
-        if (!NT_SUCCESS( status ))
-        {
-            BLACKBONE_TRACE( L"ManualMap: Failed to set header memory protection. Status = 0x%x", status );
-            return status;
-        }
+        AllocateInHighMem( pImage->imgMem, pImage->peImage.imageSize() );
     }
+    // Try to map image at it's original ASRL-aware base
+    else if (flags & HideVAD)
+    {      
+        ptr_t base  = pImage->peImage.imageBase();
+        ptr_t image_size = pImage->peImage.imageSize();
 
-    // Copy sections
-    for (auto& section : pImage->peImage.sections())
-    {
-        // Skip discardable sections
-        if (section.Characteristics & (IMAGE_SCN_MEM_READ | IMAGE_SCN_MEM_WRITE | IMAGE_SCN_MEM_EXECUTE))
+        if (!NT_SUCCESS( Driver().EnsureLoaded() ))
         {
-            if (section.SizeOfRawData == 0)
-                continue;
+            return Driver().status();
+        }
+
+        // Allocate as physical at desired base
+        status = Driver().AllocateMem( _process.pid(), base, image_size, MEM_COMMIT, PAGE_EXECUTE_READWRITE, true );
+
+        // Allocate at any base
+        if (!NT_SUCCESS( status ))
+        {
+            base = 0;
+            image_size = pImage->peImage.imageSize();
+            status = Driver().AllocateMem( _process.pid(), base, image_size, MEM_COMMIT, PAGE_EXECUTE_READWRITE, true );
+        }
+
+        // Store allocated region
+        if (NT_SUCCESS( status ))
+        {
+            pImage->imgMem = MemBlock( &_process.memory(), base, static_cast<size_t>(image_size), PAGE_EXECUTE_READWRITE, true, true );
+        }
+        // Stop mapping
+        else
+        {
+            //flags &= ~HideVAD;
+            BLACKBONE_TRACE( L"ManualMap: Failed to allocate physical memory for image, status 0x%X", status );
+            return status;
+        }
+    }
+
+    // Allocate normally if something went wrong
+    if (!pImage->imgMem.valid())
+    {
+        auto mem = _process.memory().Allocate( pImage->peImage.imageSize(), PAGE_EXECUTE_READWRITE, pImage->peImage.imageBase() );
+        if (!mem)
+        {
+            BLACKBONE_TRACE( L"ManualMap: Failed to allocate memory for image, status 0x%X", mem.status );
+            return mem.status;
+        }
+
+        pImage->imgMem = std::move( mem.result() );
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Unmap all manually mapped modules.
+/// Images of each architecture are torn down by single remote call
+/// </summary>
+/// <returns>Status code</returns>
+NTSTATUS MMap::UnmapAllModules()
+{
+    // Reverse mapping order, so dependencies are detached after their dependents
+    vecImageCtx images64, images32;
+    for (auto img = _images.rbegin(); img != _images.rend(); ++img)
+        ((*img)->ldrEntry.type == mt_mod64 ? images64 : images32).emplace_back( *img );
+
+    for (auto images : { &images64, &images32 })
+    {
+        if (!images->empty())
+            UnmapBatch( *images );
+    }
+
+    Cleanup();
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Unmap several images in a single remote call: detach notifications in list order,
+/// then exception table, TLS and loader unregistration, then memory release.
+/// All images must have the same architecture
+/// </summary>
+/// <param name="images">Images to unmap</param>
+/// <returns>Status code</returns>
+NTSTATUS MMap::UnmapBatch( const vecImageCtx& images )
+{
+    auto mt = images.front()->ldrEntry.type;
+    auto a = AsmFactory::GetAssembler( mt );
+    uint64_t result = 0;
+
+    // Regions released from inside the stub. Shared arena is released once all its images are gone.
+    // Driver allocated and concealed images are freed locally
+    std::vector<ptr_t> regions;
+    std::set<ptr_t> arenas;
+    for (auto& pImage : images)
+    {
+        if (pImage->arenaBase != 0)
+            arenas.emplace( pImage->arenaBase );
+        else if (!(pImage->flags & (HideVAD | MapInHighMem)))
+            regions.emplace_back( pImage->imgMem.ptr() );
+    }
+
+    regions.insert( regions.end(), arenas.begin(), arenas.end() );
+
+    // NtFreeVirtualMemory takes base and size by pointer, { base, 0 } pair per region
+    size_t ptrSize = mt == mt_mod64 ? sizeof( uint64_t ) : sizeof( uint32_t );
+    std::vector<uint8_t> table( regions.size() * 2 * ptrSize );
+    for (size_t i = 0; i < regions.size(); i++)
+        memcpy( table.data() + i * 2 * ptrSize, &regions[i], ptrSize );
+
+    MemBlock tableMem;
+    auto pFree = _process.modules().GetNtdllExport( "NtFreeVirtualMemory", mt );
+    if (pFree && !table.empty())
+    {
+        auto mem = _process.memory().Allocate( table.size(), PAGE_READWRITE );
+        if (mem && NT_SUCCESS( mem->Write( 0, table.size(), table.data() ) ))
+            tableMem = std::move( mem.result() );
+    }
+
+    a->GenPrologue();
+
+    // Detach notifications go first, while all images and exception handlers are in place
+    GenActivationContext( *a, mt, true );
+    for (auto& pImage : images)
+    {
+        BLACKBONE_TRACE( L"ManualMap: Unmapping image '%ls'", pImage->ldrEntry.name.c_str() );
+        GenInitializerCalls( *a, pImage, DLL_PROCESS_DETACH, 0, 0 );
+    }
+
+    GenActivationContext( *a, mt, false );
+
+    auto pRemoveTable = _process.modules().GetNtdllExport( "RtlDeleteFunctionTable", mt );
+    bool removeVEH = false;
+
+    for (auto& pImage : images)
+    {
+        if (!(pImage->flags & NoExceptions))
+        {
+            // RtlDeleteFunctionTable(pExpTable);
+            if (mt == mt_mod64 && pImage->pExpTableAddr != 0 && pRemoveTable)
+                a->GenCall( pRemoveTable->procAddress, { pImage->pExpTableAddr } );
+
+            removeVEH |= !(pImage->flags & PartialExcept);
+        }
+
+        _process.nativeLdr().GenUnloadTLS( *a, pImage->ldrEntry );
+
+        // Remove from loader
+        if (pImage->ldrEntry.flags != Ldr_None)
+            _process.nativeLdr().GenUnlink( *a, pImage->ldrEntry );
+    }
+
+    removeVEH = removeVEH && _expMgr.GenRemoveVEH( _process, *a, mt );
+
+    // NtFreeVirtualMemory(NtCurrentProcess(), &base, &size, MEM_RELEASE);
+    for (size_t i = 0; tableMem.valid() && i < regions.size(); i++)
+    {
+        auto entry = tableMem.ptr() + i * 2 * ptrSize;
+        a->GenCall( pFree->procAddress, { static_cast<ptr_t>(-1), entry, entry + ptrSize, MEM_RELEASE } );
+    }
+
+    _process.remote().AddReturnWithEvent( *a, mt );
+    a->GenEpilogue();
+
+    auto status = _process.remote().ExecInWorkerThread( (*a)->make(), (*a)->getCodeSize(), result );
+    if (!NT_SUCCESS( status ))
+        BLACKBONE_TRACE( L"ManualMap: Failed to unmap %d images in single call. Status 0x%X", static_cast<int>(images.size()), status );
+
+    // Memory that wasn't released by stub is freed locally
+    bool released = NT_SUCCESS( status ) && tableMem.valid();
+    for (auto& pImage : images)
+    {
+        if (pImage->arenaBase == 0)
+        {
+            if (released && !(pImage->flags & (HideVAD | MapInHighMem)))
+                pImage->imgMem.Release();
+            else
+                pImage->imgMem.Free();
+        }
+
+        // Remove reference from local modules list
+        _process.modules().RemoveManualModule( pImage->ldrEntry.name, pImage->peImage.mType() );
+    }
+
+    if (!released)
+    {
+        for (auto base : arenas)
+            _process.memory().Free( base );
+    }
+
+    if (removeVEH && NT_SUCCESS( status ))
+        _expMgr.ReleaseVEH();
+
+    return status;
+}
+
+/// <summary>
+/// Replace manually mapped image with new build of it in place.
+/// Image keeps its base, loader entries, security cookie and state of unchanged pages.
+/// Only pages that differ from previous build after relocation are written and only imports of these pages
+/// or imports that have changed are resolved again. Initializers aren't run again and static TLS isn't reinitialized.
+/// New build must fit into image memory
+/// </summary>
+/// <param name="existing">Manually mapped image</param>
+/// <param name="newPath">New image build</param>
+/// <param name="pStats">Optional per phase statistics</param>
+/// <returns>Status code</returns>
+NTSTATUS MMap::UpdateImage( const ModuleDataPtr& existing, const std::wstring& newPath, MapStats* pStats /*= nullptr*/ )
+{
+    StatsScope stats( *this, pStats );
+
+    if (!existing)
+        return STATUS_INVALID_PARAMETER;
+
+    auto iter = std::find_if( _images.begin(), _images.end(), [&existing]( const ImageContextPtr& img )
+    {
+        return img->ldrEntry.baseAddress == existing->baseAddress;
+    } );
+
+    if (iter == _images.end())
+        return STATUS_NOT_FOUND;
+
+    // Staging copy comes from call scoped arena, same as in MapImage
+    std::pmr::monotonic_buffer_resource arena( 0x100000 );
+    bool ownArena = TransientResource() == std::pmr::get_default_resource();
+    TransientScope scope( ownArena ? &arena : TransientResource() );
+
+    // New build takes over image memory and target state of previous one
+    auto pOld = *iter;
+    auto pImage = std::make_shared<ImageContext>();
+    auto flags = pOld->flags;
+    NTSTATUS status = STATUS_SUCCESS;
+
+    pImage->imgMem = pOld->imgMem;
+    pImage->ldrEntry = pOld->ldrEntry;
+    pImage->arenaBase = pOld->arenaBase;
+    pImage->pExpTableAddr = pOld->pExpTableAddr;
+    pImage->importKeys = pOld->importKeys;
+    pImage->flags = flags;
+    pImage->initialized = pOld->initialized;
+
+    BLACKBONE_TRACE( L"ManualMap: Updating image '%ls' from '%ls'", pOld->ldrEntry.name.c_str(), newPath.c_str() );
+
+    {
+        PhaseScope phase( *this, MP_Load );
+        if (NT_SUCCESS( status = pImage->peImage.Load( newPath, true ) ))
+        {
+            if (pImage->peImage.mType() != pOld->ldrEntry.type || pImage->peImage.imageSize() > Align( pOld->ldrEntry.size, 0x1000 ))
+                status = STATUS_INVALID_IMAGE_FORMAT;
+            else
+                status = StageImage( pImage );
+        }
+    }
+
+    if (NT_SUCCESS( status ))
+        status = RelocateImage( pImage );
+
+    if (!NT_SUCCESS( status ))
+    {
+        BLACKBONE_TRACE( L"ManualMap: Failed to load image update '%ls'. Status 0x%X", newPath.c_str(), status );
+        pImage->peImage.Release();
+        return status;
+    }
+
+    // Pages changed since previous build, images are compared before binding
+    auto& local = pImage->localImage;
+    pImage->pageHashes = PageHashes( local );
+
+    std::set<uint32_t> dirty;
+    for (uint32_t page = 0; page < pImage->pageHashes.size(); page++)
+        if (page >= pOld->pageHashes.size() || pOld->pageHashes[page] != pImage->pageHashes[page])
+            dirty.emplace( page );
+
+    BLACKBONE_TRACE( L"ManualMap: %d of %d image pages changed", static_cast<int>(dirty.size()), static_cast<int>(pImage->pageHashes.size()) );
+
+    // Running code relies on current security cookie value
+    auto pLoadConfig32 = reinterpret_cast<PIMAGE_LOAD_CONFIG_DIRECTORY32>(pImage->peImage.DirectoryAddress( IMAGE_DIRECTORY_ENTRY_LOAD_CONFIG ));
+    auto pLoadConfig64 = reinterpret_cast<PIMAGE_LOAD_CONFIG_DIRECTORY64>(pLoadConfig32);
+    ptr_t pCookie = 0;
+    if (pLoadConfig32 != nullptr)
+        pCookie = pImage->ldrEntry.type == mt_mod64 ? pLoadConfig64->SecurityCookie : pLoadConfig32->SecurityCookie;
+
+    if (pCookie != 0 && pOld->cookieAddr != 0)
+    {
+        auto cookieRVA = static_cast<size_t>(pCookie - pImage->peImage.imageBase());
+        auto size = pImage->ldrEntry.type == mt_mod64 ? sizeof( uint64_t ) : sizeof( uint32_t );
+
+        if (cookieRVA + size <= local.size() && dirty.count( static_cast<uint32_t>(cookieRVA >> 12) ))
+        {
+            uint64_t cookie = 0;
+            if (NT_SUCCESS( status = _process.memory().Read( pOld->cookieAddr, size, &cookie ) ))
+                memcpy( local.data() + cookieRVA, &cookie, size );
+        }
+
+        pImage->cookieAddr = pImage->imgMem.ptr() + cookieRVA;
+    }
+
+    // Write changed pages, adjacent pages at once
+    if (NT_SUCCESS( status ))
+    {
+        PhaseScope phase( *this, MP_Copy );
+        auto tx = _process.memory().BeginWrite();
+
+        for (auto page = dirty.begin(); page != dirty.end() && NT_SUCCESS( status ); )
+        {
+            auto first = *page;
+            auto last = first;
+            for (++page; page != dirty.end() && *page == last + 1; ++page)
+                last = *page;
+
+            size_t offset = static_cast<size_t>(first) << 12;
+            size_t size = std::min<size_t>( (static_cast<size_t>(last) + 1) << 12, local.size() ) - offset;
+
+            if (flags & HideVAD)
+                status = Driver().WriteMem( _process.pid(), pImage->imgMem.ptr() + offset, size, local.data() + offset );
+            else
+                status = tx.Write( pImage->imgMem.ptr() + offset, size, local.data() + offset );
+        }
+
+        // Read-only sections are made writable for the duration of write
+        if (NT_SUCCESS( status ) && !(flags & HideVAD))
+            status = tx.Commit( true );
+    }
+
+    if (!NT_SUCCESS( status ))
+    {
+        BLACKBONE_TRACE( L"ManualMap: Failed to write image update. Status 0x%X", status );
+        pImage->peImage.Release();
+        return status;
+    }
+
+    {
+        // Handle x64 system32 dlls for wow64 process
+        bool fsRedirect = !(flags & IsDependency) && pImage->ldrEntry.type == mt_mod64 && _process.barrier().sourceWow64;
+        FsRedirector fsr( fsRedirect );
+
+        status = ResolveImport( pImage, false, &dirty );
+        if (NT_SUCCESS( status ) && !(flags & NoDelayLoad))
+            status = ResolveImport( pImage, true, &dirty );
+    }
+
+    if (!NT_SUCCESS( status ))
+    {
+        pImage->peImage.Release();
+        return status;
+    }
+
+    // Section layout has changed
+    auto& oldSections = pOld->peImage.sections();
+    auto& newSections = pImage->peImage.sections();
+    bool sameLayout = oldSections.size() == newSections.size() && std::equal(
+        oldSections.begin(), oldSections.end(), newSections.begin(), []( const IMAGE_SECTION_HEADER& a, const IMAGE_SECTION_HEADER& b )
+        {
+            return a.VirtualAddress == b.VirtualAddress && a.Misc.VirtualSize == b.Misc.VirtualSize && a.Characteristics == b.Characteristics;
+        } );
+
+    if (!sameLayout && !(flags & HideVAD))
+        ProtectImageMemory( pImage );
+
+    // Function table has changed
+    auto expRVA = static_cast<uint32_t>(pImage->peImage.DirectoryAddress( IMAGE_DIRECTORY_ENTRY_EXCEPTION, pe::RVA ));
+    auto expSize = static_cast<uint32_t>(pImage->peImage.DirectorySize( IMAGE_DIRECTORY_ENTRY_EXCEPTION ));
+    bool expChanged = false;
+    for (uint32_t page = expRVA >> 12; expSize != 0 && page <= (expRVA + expSize - 1) >> 12 && !expChanged; page++)
+        expChanged = dirty.count( page ) != 0;
+
+    if (expChanged && !(flags & NoExceptions) && pImage->ldrEntry.type == mt_mod64)
+    {
+        PhaseScope phase( *this, MP_Exceptions );
+        ptr_t expTable = pImage->imgMem.ptr() + expRVA;
+
+        // Table registered through RtlAddFunctionTable
+        if (pImage->pExpTableAddr != 0)
+        {
+            auto pRemoveTable = _process.modules().GetNtdllExport( "RtlDeleteFunctionTable", pImage->ldrEntry.type );
+            auto pAddTable = _process.modules().GetNtdllExport( "RtlAddFunctionTable", pImage->ldrEntry.type );
+            if (pRemoveTable && pAddTable)
+            {
+                auto a = AsmFactory::GetAssembler( pImage->ldrEntry.type );
+                uint64_t result = 0;
+
+                a->GenPrologue();
+                a->GenCall( pRemoveTable->procAddress, { pImage->pExpTableAddr } );
+                a->GenCall( pAddTable->procAddress, { expTable, expSize / sizeof( IMAGE_RUNTIME_FUNCTION_ENTRY ), pImage->imgMem.ptr() } );
+                _process.remote().AddReturnWithEvent( *a );
+                a->GenEpilogue();
+
+                status = _process.remote().ExecInWorkerThread( (*a)->make(), (*a)->getCodeSize(), result );
+                if (NT_SUCCESS( status ))
+                    pImage->pExpTableAddr = expTable;
+            }
+            else
+                status = !pRemoveTable ? pRemoveTable.status : pAddTable.status;
+        }
+        else if (!_process.nativeLdr().UpdateInvertedFunctionTable( pImage->ldrEntry, expTable, expSize ))
+        {
+            status = STATUS_UNSUCCESSFUL;
+        }
+
+        if (!NT_SUCCESS( status ))
+            BLACKBONE_TRACE( L"ManualMap: Failed to update function table of image '%ls'. Status 0x%X", pImage->ldrEntry.name.c_str(), status );
+    }
+
+    pImage->ldrEntry.entryPoint = pImage->peImage.entryPoint( pImage->imgMem.ptr<ptr_t>() );
+    pImage->peImage.GetTLSCallbacks( pImage->imgMem.ptr<ptr_t>(), pImage->tlsCallbacks );
+    pImage->peImage.Release();
+
+    // Unchanged IAT entries still point to thunks of previous build
+    for (auto& block : pOld->lazyBind)
+        pImage->lazyBind.emplace_back( std::move( block ) );
+
+    // Staging copy is no longer needed
+    decltype(pImage->localImage)( pImage->localImage.get_allocator() ).swap( pImage->localImage );
+
+    *iter = pImage;
+    return status;
+}
+
+/// <summary>
+/// Build image layout in local staging buffer
+/// </summary>
+/// <param name="pImage">Image data</param>
+/// <returns>Status code</returns>
+NTSTATUS MMap::StageImage( ImageContextPtr pImage )
+{
+    auto& image = pImage->peImage;
+    auto& local = pImage->localImage;
+    size_t imageSize = image.imageSize();
+
+    local.assign( imageSize, 0 );
+    pImage->sectionExtents.assign( image.sections().size(), 0 );
+
+    // offset to first section equals to header size
+    size_t dwHeaderSize = std::min( image.headersSize(), imageSize );
+    memcpy( local.data(), image.base(), dwHeaderSize );
+
+    for (size_t i = 0; i < image.sections().size(); i++)
+    {
+        auto& section = image.sections()[i];
+
+        // Skip discardable sections
+        if (!(section.Characteristics & (IMAGE_SCN_MEM_READ | IMAGE_SCN_MEM_WRITE | IMAGE_SCN_MEM_EXECUTE)) || section.SizeOfRawData == 0)
+            continue;
+
+        if (section.VirtualAddress >= imageSize)
+        {
+            BLACKBONE_TRACE( L"ManualMap: Section at offset 0x%x is outside of image", section.VirtualAddress );
+            return STATUS_INVALID_IMAGE_FORMAT;
+        }
+
+        auto pSource = reinterpret_cast<const uint8_t*>(image.ResolveRVAToVA( section.VirtualAddress ));
+        auto size = static_cast<uint32_t>(std::min<size_t>( section.SizeOfRawData, imageSize - section.VirtualAddress ));
+        if (pSource == nullptr)
+            continue;
+
+        memcpy( local.data() + section.VirtualAddress, pSource, size );
+        pImage->sectionExtents[i] = size;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Copies staged image into target process
+/// </summary>
+/// <param name="pImage">Image data</param>
+/// <returns>Status code</returns>
+NTSTATUS MMap::CopyImage( ImageContextPtr pImage )
+{
+    PhaseScope phase( *this, MP_Copy );
+    NTSTATUS status = STATUS_SUCCESS;
+    auto pLocal = pImage->localImage.data();
+
+    BLACKBONE_TRACE( L"ManualMap: Performing image copy" );
+
+    // offset to first section equals to header size
+    size_t dwHeaderSize = std::min<size_t>( pImage->peImage.headersSize(), pImage->localImage.size() );
+
+    // Copy header
+    if (pImage->flags & HideVAD)
+        status = Driver().WriteMem( _process.pid(), pImage->imgMem.ptr(), dwHeaderSize, pLocal );
+    else
+        status = pImage->imgMem.Write( 0, dwHeaderSize, pLocal );
+
+    if (!NT_SUCCESS( status ))
+    {
+        BLACKBONE_TRACE( L"ManualMap: Failed to copy image headers. Status = 0x%x", status );
+        return status;
+    }
+
+    // Copy sections. Adjacent sections are flushed at once
+    auto tx = _process.memory().BeginWrite();
+    for (size_t i = 0; i < pImage->peImage.sections().size(); i++)
+    {
+        auto& section = pImage->peImage.sections()[i];
+        auto size = pImage->sectionExtents[i];
+
+        // Skip discardable and empty sections
+        if (size != 0)
+        {
+            uint8_t* pSource = pLocal + section.VirtualAddress;
 
-            uint8_t* pSource = reinterpret_cast<uint8_t*>(pImage->peImage.ResolveRVAToVA( section.VirtualAddress ));
-            
             // Copy section data
             if (pImage->flags & HideVAD)
             {
                 status = Driver().WriteMem(
                     _process.pid(), pImage->imgMem.ptr() + section.VirtualAddress,
-                    section.SizeOfRawData, pSource
+                    size, pSource
                     );
             }
             else
             {
-                status = pImage->imgMem.Write( section.VirtualAddress, section.SizeOfRawData, pSource );
+                status = tx.Write( pImage->imgMem.ptr() + section.VirtualAddress, size, pSource );
             }
 
             if (!NT_SUCCESS( status ))
@@ -622,44 +1379,89 @@ NTSTATUS MMap::CopyImage( ImageContextPtr pImage )
         } 
     }
 
+    status = tx.Commit();
+    if (!NT_SUCCESS( status ))
+    {
+        BLACKBONE_TRACE( L"ManualMap: Failed to copy image sections. Status = 0x%x", status );
+        return status;
+    }
+
+    // Compared with next build by UpdateImage
+    pImage->pageHashes = PageHashes( pImage->localImage );
+
+    // Staging copy is no longer needed
+    decltype(pImage->localImage)( pImage->localImage.get_allocator() ).swap( pImage->localImage );
     return STATUS_SUCCESS;
 }
 
 /// <summary>
-/// Adjust image memory protection
+/// Adjust image memory protection.
+/// Adjacent ranges with equal protection are merged, with driver loaded all ranges are changed in one request
 /// </summary>
 /// <param name="pImage">image data</param>
 /// <returns>Status code</returns>
 NTSTATUS MMap::ProtectImageMemory( ImageContextPtr pImage )
 {
-    // Set section memory protection
-    for (auto& section : pImage->peImage.sections())
+    PhaseScope phase( *this, MP_Protect );
+    auto& sections = pImage->peImage.sections();
+    std::vector<ProtectRange> ranges;
+
+    // Header range comes first, section ranges follow in ascending order
+    auto add = [&ranges]( DWORD prot, ptr_t start, ptr_t end )
+    {
+        if (!ranges.empty() && ranges.back().protection == prot && start <= Align( static_cast<size_t>(ranges.back().base + ranges.back().size), 0x1000 ))
+            ranges.back().size = std::max( ranges.back().size, end - ranges.back().base );
+        else
+            ranges.emplace_back( ProtectRange{ start, end - start, prot } );
+    };
+
+    add( PAGE_READONLY, 0, std::min<ptr_t>( pImage->peImage.headersSize(), pImage->peImage.imageSize() ) );
+
+    for (auto& section : sections)
     {
         auto prot = GetSectionProt( section.Characteristics );
         if (prot != PAGE_NOACCESS)
         {
-            auto status = pImage->imgMem.Protect( prot, section.VirtualAddress, section.Misc.VirtualSize );
-            if (!NT_SUCCESS( status ))
-            {
-                BLACKBONE_TRACE(
-                    L"ManualMap: Failed to set section memory protection at offset 0x%x. Status = 0x%x",
-                    section.VirtualAddress, status
-                    );
+            add( prot, section.VirtualAddress, section.VirtualAddress + section.Misc.VirtualSize );
+            continue;
+        }
+
+        // Decommit pages with NO_ACCESS protection
+        auto status = _process.memory().Free( pImage->imgMem.ptr() + section.VirtualAddress, section.Misc.VirtualSize, MEM_DECOMMIT );
+        if (!NT_SUCCESS( status ))
+        {
+            BLACKBONE_TRACE(
+                L"ManualMap: Failed to set section memory protection at offset 0x%x. Status = 0x%x",
+                section.VirtualAddress, status
+            );
+        }
+    }
 
-                return status;
-            }
+    // Single kernel transition for the whole image
+    if (Driver().loaded())
+    {
+        std::vector<ProtectRange> absolute( ranges );
+        for (auto& range : absolute)
+        {
+            range.base += pImage->imgMem.ptr();
+            range.protection = CastProtection( range.protection, _process.core().DEP() );
         }
-        // Decommit pages with NO_ACCESS protection
-        else
+
+        if (NT_SUCCESS( Driver().ProtectMemBatch( _process.pid(), absolute ) ))
+            return STATUS_SUCCESS;
+    }
+
+    for (auto& range : ranges)
+    {
+        auto status = pImage->imgMem.Protect( range.protection, static_cast<uintptr_t>(range.base), static_cast<size_t>(range.size) );
+        if (!NT_SUCCESS( status ))
         {
-            auto status = _process.memory().Free( pImage->imgMem.ptr() + section.VirtualAddress, section.Misc.VirtualSize, MEM_DECOMMIT );
-            if (!NT_SUCCESS( status ))
-            {
-                BLACKBONE_TRACE(
-                    L"ManualMap: Failed to set section memory protection at offset 0x%x. Status = 0x%x",
-                    section.VirtualAddress, status
+            BLACKBONE_TRACE(
+                L"ManualMap: Failed to set section memory protection at offset 0x%x. Status = 0x%x",
+                static_cast<uint32_t>(range.base), status
                 );
-            }
+
+            return status;
         }
     }
 
@@ -667,12 +1469,13 @@ NTSTATUS MMap::ProtectImageMemory( ImageContextPtr pImage )
 }
 
 /// <summary>
-///  Fix relocations if image wasn't loaded at base address
+///  Fix relocations in staged image if image wasn't loaded at base address
 /// </summary>
 /// <param name="pImage">image data</param>
 /// <returns>true on success</returns>
 NTSTATUS MMap::RelocateImage( ImageContextPtr pImage )
 {
+    PhaseScope phase( *this, MP_Relocate );
     NTSTATUS status = STATUS_SUCCESS;
     BLACKBONE_TRACE( L"ManualMap: Relocating image '%ls'", pImage->ldrEntry.fullPath.c_str() );
 
@@ -693,72 +1496,46 @@ NTSTATUS MMap::RelocateImage( ImageContextPtr pImage )
         return STATUS_INVALID_IMAGE_HASH;
     }
 
-    auto start = pImage->peImage.DirectoryAddress( IMAGE_DIRECTORY_ENTRY_BASERELOC );
-    auto end = start + pImage->peImage.DirectorySize( IMAGE_DIRECTORY_ENTRY_BASERELOC );
-    auto fixrec = reinterpret_cast<pe::RelocData*>(start);
+    // Bundled images carry decoded relocations
+    pe::RelocTable parsed;
+    auto& relocs = pImage->bundle != nullptr ? pImage->bundle->relocs : parsed;
+    if (pImage->bundle == nullptr && !NT_SUCCESS( status = parsed.Parse( pImage->peImage ) ))
+    {
+        BLACKBONE_TRACE( L"ManualMap: Abnormal relocation type. Aborting" );
+        return status;
+    }
 
     // No relocatable data
-    if (fixrec == nullptr)
+    if (relocs.empty())
     {
         BLACKBONE_TRACE( L"ManualMap: Image does not use relocations" );
         return STATUS_SUCCESS;
     }
 
-    // Read whole image to process it locally
-    std::unique_ptr<uint8_t[]> localImage( new uint8_t[pImage->ldrEntry.size] );
-    auto pLocal = localImage.get();
-    _process.memory().Read( pImage->imgMem.ptr(), pImage->ldrEntry.size, pLocal );
+    auto localSize = pImage->localImage.size();
+    auto& sections = pImage->peImage.sections();
 
-    while ((uintptr_t)fixrec < end && fixrec->BlockSize)
+    // Fixups may land past raw section data, extend part of the section copied into target
+    for (auto page : relocs.pages())
     {
-        DWORD count = (fixrec->BlockSize - 8) >> 1;             // records count
-
-        for (DWORD i = 0; i < count; ++i)
+        for (size_t i = 0; i < sections.size(); i++)
         {
-            WORD fixtype = (fixrec->Item[i].Type);              // fixup type
-            WORD fixoffset = (fixrec->Item[i].Offset) % 4096;   // offset in 4K block
+            auto& section = sections[i];
+            uint32_t sectionSize = std::max<uint32_t>( section.Misc.VirtualSize, section.SizeOfRawData );
 
-            // no fixup required
-            if (fixtype == IMAGE_REL_BASED_ABSOLUTE)
-                continue;
-
-            // add delta 
-            if (fixtype == IMAGE_REL_BASED_HIGHLOW || fixtype == IMAGE_REL_BASED_DIR64)
-            {
-                uintptr_t fixRVA = fixoffset + fixrec->PageRVA;
-                if (pImage->ldrEntry.type == mt_mod64)
-                {
-                    uint64_t val = *reinterpret_cast<uint64_t*>(pLocal + fixRVA) + Delta;
-                    *reinterpret_cast<uint64_t*>(pLocal + fixRVA) = val;
-                }
-                else
-                {
-                    uint32_t val = *reinterpret_cast<uint32_t*>(pLocal + fixRVA) + static_cast<uint32_t>(Delta);
-                    *reinterpret_cast<uint32_t*>(pLocal + fixRVA) = static_cast<uint32_t>(val);
-                }
-            }
-            else
+            if (page >= section.VirtualAddress && page < section.VirtualAddress + sectionSize && section.VirtualAddress < localSize)
             {
-                // TODO: support for all remaining relocations
-                BLACKBONE_TRACE( L"ManualMap: Abnormal relocation type %d. Aborting", fixtype );
-                return STATUS_INVALID_IMAGE_FORMAT;
+                uint32_t extent = std::min<uint32_t>( page - section.VirtualAddress + 0x1000, sectionSize );
+                extent = static_cast<uint32_t>(std::min<size_t>( extent, localSize - section.VirtualAddress ));
+                pImage->sectionExtents[i] = std::max( pImage->sectionExtents[i], extent );
+                break;
             }
         }
-
-        // next reloc entry
-        fixrec = reinterpret_cast<pe::RelocData*>(reinterpret_cast<uintptr_t>(fixrec) + fixrec->BlockSize);
     }
 
-    // Apply relocations, skip header
-    if (pImage->flags & HideVAD)
-        status = Driver().WriteMem( _process.pid(), pImage->ldrEntry.baseAddress + 0x1000, pImage->ldrEntry.size - 0x1000, pLocal + 0x1000 );
-    else
-        status = _process.memory().Write( pImage->ldrEntry.baseAddress + 0x1000, pImage->ldrEntry.size - 0x1000, pLocal + 0x1000 );
-
+    status = relocs.Apply( pImage->localImage.data(), localSize, Delta );
     if (!NT_SUCCESS( status ))
-    {
-        BLACKBONE_TRACE( L"ManualMap: Failed to apply relocations. Status = 0x%x", status );
-    }
+        BLACKBONE_TRACE( L"ManualMap: Relocation is outside of image. Aborting" );
 
     return status;
 }
@@ -778,21 +1555,13 @@ call_result_t<ModuleDataPtr> MMap::FindOrMapDependency( ImageContextPtr pImage,
 
     BLACKBONE_TRACE( L"ManualMap: Loading new dependency '%ls'", path.c_str() );
 
-    auto flags = NameResolve::EnsureFullPath;
-
-    // Wow64 fs redirection
-    if (pImage->ldrEntry.type == mt_mod32 && !_process.barrier().sourceWow64)
-        flags = static_cast<NameResolve::eResolveFlag>(static_cast<int32_t>(flags) | NameResolve::Wow64);
-
-    auto basedir = pImage->peImage.noPhysFile() ? Utils::GetExeDirectory() : Utils::GetParent( pImage->ldrEntry.fullPath );
-    auto status = NameResolve::Instance().ResolvePath( 
-        path,
-        pImage->ldrEntry.name, 
-        basedir, 
-        flags, 
-        _process, 
-        pImage->peImage.actx() 
-    );
+    // Path was resolved when bundle was built
+    NTSTATUS status = STATUS_SUCCESS;
+    auto pDep = pImage->bundle != nullptr ? pImage->bundle->dependency( path ) : nullptr;
+    if (pDep != nullptr)
+        path = pDep->path;
+    else
+        status = ResolveDependencyPath( pImage, path );
 
     // Do remote SxS probe
     if (status == STATUS_SXS_IDENTITIES_DIFFERENT)
@@ -838,28 +1607,281 @@ call_result_t<ModuleDataPtr> MMap::FindOrMapDependency( ImageContextPtr pImage,
     }
 };
 
+/// <summary>
+/// Resolve dependency path relative to importing image
+/// </summary>
+/// <param name="pImage">Importing image data</param>
+/// <param name="path">Dependency name, resolved path on success</param>
+/// <returns>Status code</returns>
+NTSTATUS MMap::ResolveDependencyPath( ImageContextPtr pImage, std::wstring& path )
+{
+    PhaseScope phase( *this, MP_Dependencies );
+    auto flags = NameResolve::EnsureFullPath;
+
+    // Wow64 fs redirection
+    if (pImage->ldrEntry.type == mt_mod32 && !_process.barrier().sourceWow64)
+        flags = static_cast<NameResolve::eResolveFlag>(static_cast<int32_t>(flags) | NameResolve::Wow64);
+
+    auto basedir = pImage->peImage.noPhysFile() ? Utils::GetExeDirectory() : Utils::GetParent( pImage->ldrEntry.fullPath );
+    return NameResolve::Instance().ResolvePath( 
+        path,
+        pImage->ldrEntry.name, 
+        basedir, 
+        flags, 
+        _process, 
+        pImage->peImage.actx(),
+        ManifestKey( pImage->peImage )
+    );
+}
+
+/// <summary>
+/// Walk import graph of the image level by level and load and stage missing dependencies concurrently.
+/// Prepared images are picked up by FindOrMapModule, remote allocation, imports and initialization stay serialized.
+/// </summary>
+/// <param name="path">Image path</param>
+/// <param name="buffer">Image data buffer</param>
+/// <param name="size">Buffer size.</param>
+/// <param name="asImage">If set to true - buffer has image memory layout</param>
+/// <param name="flags">Mapping flags</param>
+/// <returns>Size of shared arena needed for relocatable images of the set, 64 KB granular</returns>
+size_t MMap::PrepareDependencies( const std::wstring& path, void* buffer, size_t size, bool asImage, eLoadFlags flags )
+{
+    constexpr size_t maxThreads = 8;
+    size_t arenaSize = 0;
+
+    auto reserve = [&arenaSize]( const pe::PEImage& image )
+    {
+        if (image.DllCharacteristics() & IMAGE_DLLCHARACTERISTICS_DYNAMIC_BASE)
+            arenaSize += Align( image.imageSize(), 0x10000 );
+    };
+
+    // Root image is needed only for its import list
+    auto root = std::make_shared<ImageContext>();
+    root->ldrEntry.fullPath = Utils::ToLower( path );
+    root->ldrEntry.name = Utils::StripPath( root->ldrEntry.fullPath );
+    root->flags = flags;
+
+    auto status = buffer ? root->peImage.Load( buffer, size, !asImage ) : root->peImage.Load( path, pe::LazyParse );
+    if (!NT_SUCCESS( status ))
+        return 0;
+
+    root->ldrEntry.type = root->peImage.mType();
+    reserve( root->peImage );
+
+    SYSTEM_INFO info = { { 0 } };
+    GetNativeSystemInfo( &info );
+
+    std::set<std::wstring> visited;
+    vecImageCtx level = { root };
+
+    while (!level.empty())
+    {
+        // Resolve paths of the next level. Resolution uses shared loader state, keep it on this thread
+        vecImageCtx next;
+        for (auto& parent : level)
+        {
+            for (auto& importMod : parent->peImage.GetImports())
+            {
+                std::wstring depPath = importMod.first;
+                if (_process.modules().GetModule( depPath, LdrList, parent->peImage.mType(), parent->ldrEntry.fullPath.c_str() ))
+                    continue;
+
+                if (!NT_SUCCESS( ResolveDependencyPath( parent, depPath ) ))
+                    continue;
+
+                depPath = Utils::ToLower( depPath );
+                if (!visited.emplace( depPath ).second || _process.modules().GetModule( depPath, LdrList, parent->peImage.mType() ))
+                    continue;
+
+                auto dep = std::make_shared<ImageContext>();
+                dep->ldrEntry.fullPath = depPath;
+                dep->ldrEntry.name = Utils::StripPath( depPath );
+                dep->ldrEntry.type = parent->ldrEntry.type;
+                dep->flags = flags | NoSxS | NoDelayLoad | PartialExcept | IsDependency;
+
+                next.emplace_back( dep );
+            }
+        }
+
+        if (next.empty())
+            break;
+
+        // Independent images of one level are loaded and staged concurrently
+        PrepareContext context( *this, next );
+        size_t threads = std::min<size_t>( { next.size(), info.dwNumberOfProcessors, maxThreads } );
+
+        std::vector<HANDLE> workers;
+        for (size_t i = 1; i < threads; i++)
+        {
+            HANDLE hThread = CreateThread( NULL, 0, &MMap::PrepareWorkerWrap, &context, 0, NULL );
+            if (hThread != NULL)
+                workers.emplace_back( hThread );
+        }
+
+        // Calling thread takes part as well
+        PrepareWorker( context );
+
+        for (auto hThread : workers)
+        {
+            WaitForSingleObject( hThread, INFINITE );
+            CloseHandle( hThread );
+        }
+
+        // Failed images are left for the regular path to report
+        level.clear();
+        for (auto& dep : next)
+        {
+            if (dep->peImage.base() == nullptr)
+                continue;
+
+            _prepared.emplace( dep->ldrEntry.fullPath, dep );
+            level.emplace_back( dep );
+            reserve( dep->peImage );
+        }
+    }
+
+    return arenaSize;
+}
+
+/// <summary>
+/// Load and stage dependency images
+/// </summary>
+/// <param name="context">Shared image list</param>
+void MMap::PrepareWorker( PrepareContext& context )
+{
+    for (size_t idx = context.next++; idx < context.images.size(); idx = context.next++)
+    {
+        auto& pImage = context.images[idx];
+
+        if (!NT_SUCCESS( pImage->peImage.Load( pImage->ldrEntry.fullPath, pe::SkipActx ) ) ||
+            pImage->peImage.mType() != pImage->ldrEntry.type ||
+            !NT_SUCCESS( StageImage( pImage ) ))
+        {
+            pImage->localImage.clear();
+            pImage->peImage.Release();
+        }
+    }
+}
+
+/// <summary>
+/// Preparation thread entry point
+/// </summary>
+/// <param name="lpParam">Prepare context</param>
+/// <returns>0</returns>
+DWORD CALLBACK MMap::PrepareWorkerWrap( LPVOID lpParam )
+{
+    auto& context = *reinterpret_cast<PrepareContext*>(lpParam);
+    context.self.PrepareWorker( context );
+    return 0;
+}
+
+/// <summary>
+/// Load and stage all images of the bundle. Prepared images are picked up by FindOrMapModule
+/// </summary>
+/// <param name="bundle">Image bundle</param>
+/// <returns>Size of shared arena needed for relocatable images of the set, 64 KB granular</returns>
+size_t MMap::PrepareBundle( const ImageBundle& bundle )
+{
+    size_t arenaSize = 0;
+
+    for (auto& img : bundle.images())
+    {
+        auto pImage = std::make_shared<ImageContext>();
+        pImage->ldrEntry.fullPath = img.path;
+        pImage->ldrEntry.name = Utils::StripPath( img.path );
+        pImage->ldrEntry.type = img.type;
+        pImage->bundle = &img;
+
+        // Bundle holds image layout, staging is a plain copy. Failed images are left for the regular path
+        if (!NT_SUCCESS( pImage->peImage.Load( const_cast<uint8_t*>(img.image.data()), img.image.size(), false ) ) ||
+            pImage->peImage.mType() != img.type ||
+            pImage->peImage.imageSize() > img.image.size() ||
+            !NT_SUCCESS( StageImage( pImage ) ))
+        {
+            BLACKBONE_TRACE( L"ManualMap: Failed to prepare bundled image '%ls'", img.path.c_str() );
+            pImage->localImage.clear();
+            pImage->peImage.Release();
+            continue;
+        }
+
+        if (pImage->peImage.DllCharacteristics() & IMAGE_DLLCHARACTERISTICS_DYNAMIC_BASE)
+            arenaSize += Align( pImage->peImage.imageSize(), 0x10000 );
+
+        _prepared.emplace( img.path, pImage );
+    }
+
+    return arenaSize;
+}
+
+/// <summary>
+/// Check if loaded module is the image bundle imports were resolved against
+/// </summary>
+/// <param name="dep">Bundle dependency</param>
+/// <param name="hMod">Loaded module</param>
+/// <returns>true if pre-resolved imports can be used</returns>
+bool MMap::BundleDependencyValid( const BundleDependency& dep, const ModuleDataPtr& hMod )
+{
+    if (dep.imageSize == 0 || hMod->size != dep.imageSize || Utils::ToLower( hMod->fullPath ) != dep.path)
+        return false;
+
+    auto lfanew = _process.memory().Read<int32_t>( hMod->baseAddress + offsetof( IMAGE_DOS_HEADER, e_lfanew ) );
+    if (!lfanew)
+        return false;
+
+    auto timeStamp = _process.memory().Read<uint32_t>( hMod->baseAddress + lfanew.result() + offsetof( IMAGE_NT_HEADERS32, FileHeader.TimeDateStamp ) );
+    return timeStamp && timeStamp.result() == dep.timeStamp;
+}
+
 /// <summary>
 /// Resolves image import or delayed image import
 /// </summary>
 /// <param name="pImage">Image data</param>
 /// <param name="useDelayed">Resolve delayed import instead</param>
+/// <param name="dirtyPages">If set, only imports placed on these pages or imports that have changed are resolved</param>
 /// <returns>Status code</returns>
-NTSTATUS MMap::ResolveImport( ImageContextPtr pImage, bool useDelayed /*= false */ )
+NTSTATUS MMap::ResolveImport( ImageContextPtr pImage, bool useDelayed /*= false */, const std::set<uint32_t>* dirtyPages /*= nullptr*/ )
 {
+    PhaseScope phase( *this, useDelayed ? MP_DelayImports : MP_Imports );
     auto imports = pImage->peImage.GetImports( useDelayed );
     if (imports.empty())
         return STATUS_SUCCESS;
 
-    // Read whole image to process it locally
-    std::unique_ptr<uint8_t[]> localImage( new uint8_t[pImage->ldrEntry.size] );
-    auto pLocal = localImage.get();
-    _process.memory().Read( pImage->imgMem.ptr(), pImage->ldrEntry.size, pLocal );
+    // Probe remote SxS redirection for all dependencies in one call
+    PrefetchRemoteSxS( pImage, useDelayed );
+
+    // Resolved thunks by RVA, written into target once all are known
+    std::pmr::map<uintptr_t, ptr_t> iat( TransientResource() );
+    auto setThunk = [&iat]( uintptr_t rva, ptr_t address )
+    {
+        iat[rva] = address;
+    };
+
+    // Imports bound on first call
+    std::pmr::vector<LazyImport> lazy( TransientResource() );
 
     // Traverse entries
     for (auto& importMod : imports)
     {
         std::wstring wstrDll = importMod.first;
 
+        // Imports still bound in target are skipped, unneeded dependencies aren't loaded
+        std::pmr::vector<size_t> changed( TransientResource() );
+        size_t modKey = std::hash<std::wstring>()(Utils::ToLower( importMod.first ));
+        for (size_t i = 0; i < importMod.second.size(); i++)
+        {
+            auto& importFn = importMod.second[i];
+            size_t key = modKey * 31 + (importFn.importByOrd ? importFn.importOrdinal : std::hash<std::string>()(importFn.importName));
+            auto& oldKey = pImage->importKeys[importFn.ptrRVA];
+
+            if (dirtyPages == nullptr || dirtyPages->count( static_cast<uint32_t>(importFn.ptrRVA >> 12) ) || oldKey != key)
+                changed.emplace_back( i );
+
+            oldKey = key;
+        }
+
+        if (changed.empty())
+            continue;
+
         // Load dependency if needed
         auto hMod = FindOrMapDependency( pImage, wstrDll );
         if (!hMod)
@@ -868,14 +1890,56 @@ NTSTATUS MMap::ResolveImport( ImageContextPtr pImage, bool useDelayed /*= false
             return hMod.status;
         }
 
-        for (auto& importFn : importMod.second)
+        // Pre-resolved imports are valid only for the same exporter image
+        auto pBundle = pImage->bundle;
+        auto pDep = pBundle != nullptr ? pBundle->dependency( importMod.first ) : nullptr;
+        if (pDep != nullptr && !BundleDependencyValid( *pDep, hMod.result() ))
+            pDep = nullptr;
+
+        // Native loader can resolve exports of its own modules on first call
+        bool lazyMod = (pImage->flags & LazyBind) && !hMod.result()->manual;
+
+        // Resolve remaining functions of this module at once
+        std::pmr::vector<size_t> pending( TransientResource() );
+        std::vector<const char*> names;
+        names.reserve( changed.size() );
+        for (auto i : changed)
         {
-            call_result_t<exportData> expData;
+            auto& importFn = importMod.second[i];
+            auto pThunk = pDep != nullptr ? pBundle->thunk( static_cast<uint32_t>(importFn.ptrRVA) ) : nullptr;
+            if (pThunk != nullptr && &pBundle->dependencies[pThunk->dependency] == pDep)
+            {
+                setThunk( importFn.ptrRVA, hMod.result()->baseAddress + pThunk->exportRVA );
+                continue;
+            }
+
+            if (lazyMod)
+            {
+                lazy.emplace_back( LazyImport{
+                    importFn.ptrRVA,
+                    hMod.result()->baseAddress,
+                    importFn.importByOrd ? nullptr : importFn.importName.c_str(),
+                    importFn.importOrdinal
+                } );
+                continue;
+            }
 
+            pending.emplace_back( i );
             if (importFn.importByOrd)
-                expData = _process.modules().GetExport( hMod.result(), reinterpret_cast<const char*>(importFn.importOrdinal) );
+                names.emplace_back( reinterpret_cast<const char*>(importFn.importOrdinal) );
             else
-                expData = _process.modules().GetExport( hMod.result(), importFn.importName.c_str() );
+                names.emplace_back( importFn.importName.c_str() );
+        }
+
+        if (names.empty())
+            continue;
+
+        auto exports = _process.modules().GetExports( hMod.result(), names );
+
+        for (size_t i = 0; i < pending.size(); i++)
+        {
+            auto& importFn = importMod.second[pending[i]];
+            auto& expData = exports[i];
 
             // Still forwarded, load missing modules
             while (expData && expData->procAddress && expData->isForwarded)
@@ -902,64 +1966,312 @@ NTSTATUS MMap::ResolveImport( ImageContextPtr pImage, bool useDelayed /*= false
                     expData = _process.modules().GetExport( hFwdMod.result(), expData->forwardName.c_str(), wdllpath.c_str() );
             }
 
-            // Failed to resolve import
-            if (!expData)
-            {
-                if (importFn.importByOrd)
-                {
-                    BLACKBONE_TRACE(
-                        L"ManualMap: Failed to get import #%d from image '%ls'",
-                        importFn.importOrdinal,
-                        wstrDll.c_str()
-                    );
-                }
-                else
-                {
-                    BLACKBONE_TRACE(
-                        L"ManualMap: Failed to get import '%ls' from image '%ls'",
-                        Utils::AnsiToWstring( importFn.importName ).c_str(),
-                        wstrDll.c_str()
-                    );
-                }
+            // Failed to resolve import
+            if (!expData)
+            {
+                if (importFn.importByOrd)
+                {
+                    BLACKBONE_TRACE(
+                        L"ManualMap: Failed to get import #%d from image '%ls'",
+                        importFn.importOrdinal,
+                        wstrDll.c_str()
+                    );
+                }
+                else
+                {
+                    BLACKBONE_TRACE(
+                        L"ManualMap: Failed to get import '%ls' from image '%ls'",
+                        Utils::AnsiToWstring( importFn.importName ).c_str(),
+                        wstrDll.c_str()
+                    );
+                }
+
+                return expData.status;
+            }
+
+            setThunk( importFn.ptrRVA, expData->procAddress );
+        }
+    }
+
+    auto status = STATUS_SUCCESS;
+    if (!lazy.empty() && !NT_SUCCESS( status = BindLazy( pImage, lazy, iat ) ))
+    {
+        BLACKBONE_TRACE( L"ManualMap: Failed to create lazy import thunks. Status 0x%x", status );
+        return status;
+    }
+
+    auto width = pImage->ldrEntry.type == mt_mod64 ? sizeof( uint64_t ) : sizeof( uint32_t );
+    auto tx = _process.memory().BeginWrite();
+
+    // Thunks of one import descriptor are adjacent, every thunk array is written at once
+    for (auto iter = iat.begin(); iter != iat.end() && NT_SUCCESS( status ); )
+    {
+        auto start = iter->first;
+        std::pmr::vector<uint8_t> run( TransientResource() );
+
+        for (auto next = start; iter != iat.end() && iter->first == next; ++iter, next += width)
+        {
+            auto offset = run.size();
+            run.resize( offset + width );
+
+            if (width == sizeof( uint64_t ))
+                memcpy( run.data() + offset, &iter->second, sizeof( uint64_t ) );
+            else
+                *reinterpret_cast<uint32_t*>(run.data() + offset) = static_cast<uint32_t>(iter->second);
+        }
+
+        if (start + run.size() > pImage->ldrEntry.size)
+        {
+            BLACKBONE_TRACE( L"ManualMap: Import thunk at offset 0x%x is outside of image", static_cast<uint32_t>(start) );
+            status = STATUS_INVALID_IMAGE_FORMAT;
+        }
+        else if (pImage->flags & HideVAD)
+            status = Driver().WriteMem( _process.pid(), pImage->ldrEntry.baseAddress + start, run.size(), run.data() );
+        else
+            status = tx.Write( pImage->ldrEntry.baseAddress + start, run.size(), run.data() );
+    }
+
+    // Read-only import sections are made writable for the duration of write
+    if (NT_SUCCESS( status ) && !(pImage->flags & HideVAD))
+        status = tx.Commit( true );
+
+    // Write function address
+    if (!NT_SUCCESS( status ))
+    {
+        BLACKBONE_TRACE( L"ManualMap: Failed to write import function. Status 0x%x", status );
+    }
+
+    return status;
+}
+
+/// <summary>
+/// LazyBind binding table entry
+/// </summary>
+template<typename T>
+struct LazyEntry
+{
+    T target;                           // Bound function, thunk binding code until resolved
+    T module;                           // Exporting module
+    T name;                             // nameString address, 0 if imported by ordinal
+    uint32_t ordinal;                   // Function ordinal
+    _UNICODE_STRING_T<T> nameString;    // ANSI_STRING with function name, same layout
+};
+
+// Size of LazyBind thunk: jmp [entry], push index, jmp resolver
+constexpr size_t LazyThunkSize = 0x10;
+
+// Upper bound of LazyBind resolver code size
+constexpr size_t LazyResolverSize = 0x100;
+
+/// <summary>
+/// Place resolver thunks of lazily bound imports into target.
+/// Every import gets a thunk that jumps through its binding table entry,
+/// entry initially points to code that passes entry index to shared resolver.
+/// Resolver calls LdrGetProcedureAddress, stores result into the entry and continues into function
+/// </summary>
+/// <param name="pImage">Image data</param>
+/// <param name="imports">Lazily bound imports</param>
+/// <param name="iat">Receives thunk addresses by IAT entry RVA</param>
+/// <returns>Status code</returns>
+NTSTATUS MMap::BindLazy( ImageContextPtr pImage, const std::pmr::vector<LazyImport>& imports, std::pmr::map<uintptr_t, ptr_t>& iat )
+{
+    bool x64 = pImage->ldrEntry.type == mt_mod64;
+
+    auto getProc = _process.modules().GetNtdllExport( "LdrGetProcedureAddress", pImage->ldrEntry.type );
+    if (!getProc)
+        return getProc.status;
+
+    auto raise = _process.modules().GetNtdllExport( "RtlRaiseStatus", pImage->ldrEntry.type );
+    if (!raise)
+        return raise.status;
+
+    // Binding table, thunks, function names, resolver
+    size_t entrySize = x64 ? sizeof( LazyEntry<uint64_t> ) : sizeof( LazyEntry<uint32_t> );
+    size_t thunkOffset = Align( imports.size() * entrySize, 0x10 );
+    size_t namesOffset = thunkOffset + imports.size() * LazyThunkSize;
+    size_t namesSize = 0;
+    for (auto& item : imports)
+        namesSize += item.name != nullptr ? strlen( item.name ) + 1 : 0;
+
+    size_t resolverOffset = Align( namesOffset + namesSize, 0x10 );
+
+    auto mem = _process.memory().codeHeap().Allocate( resolverOffset + LazyResolverSize );
+    if (!mem)
+        return mem.status;
+
+    ptr_t base = mem->ptr();
+    ptr_t resolver = base + resolverOffset;
+    std::pmr::vector<uint8_t> buf( resolverOffset + LazyResolverSize, 0, TransientResource() );
 
-                return expData.status;
+    auto fillEntries = [&]( auto width )
+    {
+        using T = decltype(width);
+
+        auto pEntries = reinterpret_cast<LazyEntry<T>*>(buf.data());
+        auto pName = buf.data() + namesOffset;
+
+        for (size_t i = 0; i < imports.size(); i++)
+        {
+            auto& item = imports[i];
+            auto& entry = pEntries[i];
+            ptr_t entryPtr = base + i * sizeof( LazyEntry<T> );
+            ptr_t thunk = base + thunkOffset + i * LazyThunkSize;
+
+            entry.target = static_cast<T>(thunk + 6);
+            entry.module = static_cast<T>(item.module);
+            entry.ordinal = item.ordinal;
+
+            if (item.name != nullptr)
+            {
+                auto len = strlen( item.name );
+                memcpy( pName, item.name, len + 1 );
+
+                entry.name = static_cast<T>(entryPtr + offsetOf( &LazyEntry<T>::nameString ));
+                entry.nameString.Length = static_cast<uint16_t>(len);
+                entry.nameString.MaximumLength = static_cast<uint16_t>(len + 1);
+                entry.nameString.Buffer = static_cast<T>(base + (pName - buf.data()));
+                pName += len + 1;
             }
 
-            if (pImage->ldrEntry.type == mt_mod64)
-                *reinterpret_cast<uint64_t*>(pLocal + importFn.ptrRVA) = expData->procAddress;
-            else
-                *reinterpret_cast<uint32_t*>(pLocal + importFn.ptrRVA) = static_cast<uint32_t>(expData->procAddress);
-        }
-    }
+            // jmp [entry.target], rip relative for x64 target
+            uint8_t* pThunk = buf.data() + thunkOffset + i * LazyThunkSize;
+            pThunk[0] = 0xFF;
+            pThunk[1] = 0x25;
+            *reinterpret_cast<int32_t*>(pThunk + 2) = x64
+                ? static_cast<int32_t>(entryPtr - (thunk + 6))
+                : static_cast<int32_t>(entryPtr);
 
-    auto status = STATUS_SUCCESS;
+            // push index
+            pThunk[6] = 0x68;
+            *reinterpret_cast<uint32_t*>(pThunk + 7) = static_cast<uint32_t>(i);
 
-    // Apply imports, skip header
-    if (pImage->flags & HideVAD)
-    {
-        status = Driver().WriteMem(
-            _process.pid(),
-            pImage->ldrEntry.baseAddress + 0x1000,
-            pImage->ldrEntry.size - 0x1000,
-            pLocal + 0x1000
-        );
-    }
+            // jmp resolver
+            pThunk[11] = 0xE9;
+            *reinterpret_cast<int32_t*>(pThunk + 12) = static_cast<int32_t>(resolver - (thunk + LazyThunkSize));
+
+            iat[item.thunkRVA] = thunk;
+        }
+    };
+
+    if (x64)
+        fillEntries( uint64_t() );
     else
+        fillEntries( uint32_t() );
+
+    auto a = AsmFactory::GetAssembler( pImage->ldrEntry.type );
+    auto fail = (*a)->newLabel();
+
     {
-        status = _process.memory().Write(
-            pImage->ldrEntry.baseAddress + 0x1000,
-            pImage->ldrEntry.size - 0x1000,
-            pLocal + 0x1000
-        );
+        using namespace asmjit::host;
+
+        if (x64)
+        {
+            using Entry = LazyEntry<uint64_t>;
+
+            // [rsp] entry index, [rsp + 0x8] return address.
+            // Argument registers are saved, [rsp + 0x20] resolved address, [rsp + 0x30] xmm0-xmm3
+            (*a)->push( rcx );
+            (*a)->push( rdx );
+            (*a)->push( r8 );
+            (*a)->push( r9 );
+            (*a)->push( rbx );
+            (*a)->sub( rsp, 0x78 );
+            (*a)->movdqu( oword_ptr( rsp, 0x30 ), xmm0 );
+            (*a)->movdqu( oword_ptr( rsp, 0x40 ), xmm1 );
+            (*a)->movdqu( oword_ptr( rsp, 0x50 ), xmm2 );
+            (*a)->movdqu( oword_ptr( rsp, 0x60 ), xmm3 );
+
+            (*a)->mov( rbx, qword_ptr( rsp, 0xA0 ) );
+            (*a)->imul( rbx, rbx, static_cast<int32_t>(sizeof( Entry )) );
+            (*a)->mov( rax, base );
+            (*a)->add( rbx, rax );
+
+            (*a)->mov( rcx, qword_ptr( rbx, FIELD_OFFSET( Entry, module ) ) );
+            (*a)->mov( rdx, qword_ptr( rbx, FIELD_OFFSET( Entry, name ) ) );
+            (*a)->mov( r8d, dword_ptr( rbx, FIELD_OFFSET( Entry, ordinal ) ) );
+            (*a)->lea( r9, qword_ptr( rsp, 0x20 ) );
+            (*a)->mov( rax, getProc->procAddress );
+            (*a)->call( rax );
+            (*a)->test( eax, eax );
+            (*a)->js( fail );
+
+            // Concurrent binding of the same entry stores the same value
+            (*a)->mov( rax, qword_ptr( rsp, 0x20 ) );
+            (*a)->mov( qword_ptr( rbx, FIELD_OFFSET( Entry, target ) ), rax );
+
+            (*a)->movdqu( xmm0, oword_ptr( rsp, 0x30 ) );
+            (*a)->movdqu( xmm1, oword_ptr( rsp, 0x40 ) );
+            (*a)->movdqu( xmm2, oword_ptr( rsp, 0x50 ) );
+            (*a)->movdqu( xmm3, oword_ptr( rsp, 0x60 ) );
+            (*a)->add( rsp, 0x78 );
+            (*a)->pop( rbx );
+            (*a)->pop( r9 );
+            (*a)->pop( r8 );
+            (*a)->pop( rdx );
+            (*a)->pop( rcx );
+            (*a)->lea( rsp, qword_ptr( rsp, 8 ) );
+            (*a)->jmp( rax );
+
+            // Unresolved import is fatal, same as for delay load
+            (*a)->bind( fail );
+            (*a)->mov( ecx, eax );
+            (*a)->mov( rax, raise->procAddress );
+            (*a)->call( rax );
+        }
+        else
+        {
+            using Entry = LazyEntry<uint32_t>;
+
+            // [esp] entry index, [esp + 0x4] return address
+            (*a)->push( ebx );
+            (*a)->push( ecx );
+            (*a)->push( edx );
+
+            (*a)->mov( ebx, dword_ptr( esp, 0xC ) );
+            (*a)->imul( ebx, ebx, static_cast<int32_t>(sizeof( Entry )) );
+            (*a)->add( ebx, static_cast<uint32_t>(base) );
+
+            // Resolved address
+            (*a)->push( 0 );
+            (*a)->mov( eax, esp );
+
+            (*a)->push( eax );
+            (*a)->push( dword_ptr( ebx, FIELD_OFFSET( Entry, ordinal ) ) );
+            (*a)->push( dword_ptr( ebx, FIELD_OFFSET( Entry, name ) ) );
+            (*a)->push( dword_ptr( ebx, FIELD_OFFSET( Entry, module ) ) );
+            (*a)->mov( eax, static_cast<uint32_t>(getProc->procAddress) );
+            (*a)->call( eax );
+            (*a)->test( eax, eax );
+            (*a)->js( fail );
+
+            (*a)->pop( eax );
+            (*a)->mov( dword_ptr( ebx, FIELD_OFFSET( Entry, target ) ), eax );
+
+            (*a)->pop( edx );
+            (*a)->pop( ecx );
+            (*a)->pop( ebx );
+            (*a)->lea( esp, dword_ptr( esp, 4 ) );
+            (*a)->jmp( eax );
+
+            (*a)->bind( fail );
+            (*a)->push( eax );
+            (*a)->mov( eax, static_cast<uint32_t>(raise->procAddress) );
+            (*a)->call( eax );
+        }
     }
 
-    // Write function address
+    if ((*a)->getCodeSize() > LazyResolverSize)
+        return STATUS_BUFFER_OVERFLOW;
+
+    (*a)->setBaseAddress( static_cast<asmjit::Ptr>(resolver) );
+    (*a)->relocCode( buf.data() + resolverOffset );
+
+    NTSTATUS status = _process.memory().Write( base, buf.size(), buf.data() );
     if (!NT_SUCCESS( status ))
-    {
-        BLACKBONE_TRACE( L"ManualMap: Failed to write import function. Status 0x%x", status );
-    }
+        return status;
 
-    return status;
+    pImage->lazyBind.emplace_back( std::move( mem.result() ) );
+    return STATUS_SUCCESS;
 }
 
 /// <summary>
@@ -969,6 +2281,7 @@ NTSTATUS MMap::ResolveImport( ImageContextPtr pImage, bool useDelayed /*= false
 /// <returns>true on success</returns>
 NTSTATUS MMap::EnableExceptions( ImageContextPtr pImage )
 {
+    PhaseScope phase( *this, MP_Exceptions );
     BLACKBONE_TRACE( L"ManualMap: Enabling exception support for image '%ls'", pImage->ldrEntry.name.c_str() );
     bool partial = (pImage->flags & PartialExcept) != 0;
     bool success = _process.nativeLdr().InsertInvertedFunctionTable( pImage->ldrEntry );
@@ -1067,6 +2380,7 @@ NTSTATUS MMap::DisableExceptions( ImageContextPtr pImage )
 /// <returns>Status code</returns>
 NTSTATUS MMap::InitStaticTLS( ImageContextPtr pImage )
 {
+    PhaseScope phase( *this, MP_TLS );
     auto pTls = reinterpret_cast<PIMAGE_TLS_DIRECTORY>(pImage->peImage.DirectoryAddress( IMAGE_DIRECTORY_ENTRY_TLS ));
     auto rebasedTlsPtr = REBASE( pTls, pImage->peImage.base(), pImage->imgMem.ptr() );
 
@@ -1087,6 +2401,7 @@ NTSTATUS MMap::InitStaticTLS( ImageContextPtr pImage )
 /// <returns>Status code</returns>
 NTSTATUS MMap::InitializeCookie( ImageContextPtr pImage )
 {
+    PhaseScope phase( *this, MP_Cookie );
     auto pLoadConfig32 = reinterpret_cast<PIMAGE_LOAD_CONFIG_DIRECTORY32>(pImage->peImage.DirectoryAddress( IMAGE_DIRECTORY_ENTRY_LOAD_CONFIG ));
     auto pLoadConfig64 = reinterpret_cast<PIMAGE_LOAD_CONFIG_DIRECTORY64>(pLoadConfig32);
     if (!pLoadConfig32)
@@ -1137,7 +2452,8 @@ NTSTATUS MMap::InitializeCookie( ImageContextPtr pImage )
             cookie |= (cookie | 0x4711) << 16;
     }
 
-    return _process.memory().Write( REBASE( pCookie, pImage->peImage.imageBase(), pImage->imgMem.ptr() ), size, &cookie );
+    pImage->cookieAddr = REBASE( pCookie, pImage->peImage.imageBase(), pImage->imgMem.ptr() );
+    return _process.memory().Write( pImage->cookieAddr, size, &cookie );
 }
 
 /// <summary>
@@ -1156,33 +2472,105 @@ call_result_t<uint64_t> MMap::RunModuleInitializers( ImageContextPtr pImage, DWO
     auto a = AsmFactory::GetAssembler( pImage->ldrEntry.type );
     uint64_t result = 0;
 
-    auto hNtdll = _process.modules().GetModule( L"ntdll.dll", LdrList, pImage->peImage.mType() );
-    auto pActivateActx = _process.modules().GetExport( hNtdll, "RtlActivateActivationContext" );
-    auto pDeactivateActx = _process.modules().GetExport( hNtdll, "RtlDeactivateActivationContext" );
+    // Prepare custom arguments
+    auto customArgs = CopyCustomArgs( pCustomArgs );
+    if (!customArgs)
+        return customArgs.status;
 
     a->GenPrologue();
 
-    // ActivateActCtx
-    if (_pAContext.valid() && pActivateActx)
-    {
-        (*a)->mov( (*a)->zax, _pAContext.ptr() );
-        (*a)->mov( (*a)->zax, asmjit::host::dword_ptr( (*a)->zax ) );
-        a->GenCall( pActivateActx->procAddress, { 0, (*a)->zax, _pAContext.ptr() + sizeof( ptr_t ) } );
-    }
+    GenActivationContext( *a, pImage->peImage.mType(), true );
+    GenInitializerCalls( *a, pImage, dwReason, customArgs.result(), 0 );
+    GenActivationContext( *a, pImage->peImage.mType(), false );
 
-    // Prepare custom arguments
-    ptr_t customArgumentsAddress = 0;
-    if (pCustomArgs)
-    {
-        auto memBuf = _process.memory().Allocate( pCustomArgs->size() + sizeof( uint64_t ), PAGE_EXECUTE_READWRITE, 0, false );
-        if (!memBuf)
-            return memBuf.status;
+    // Set invalid return code offset to preserve one from DllMain
+    _process.remote().AddReturnWithEvent( *a, pImage->ldrEntry.type, rt_int32, ARGS_OFFSET );
+    a->GenEpilogue();
+
+    NTSTATUS status = _process.remote().ExecInWorkerThread( (*a)->make(), (*a)->getCodeSize(), result );
+    if (!NT_SUCCESS( status ))
+        return status;
+
+    if (pImage->ldrEntry.entryPoint == 0)
+        return call_result_t<uint64_t>( ERROR_SUCCESS, STATUS_SUCCESS );
+    
+    BLACKBONE_TRACE( L"ManualMap: DllMain of '%ls' returned %lld", pImage->ldrEntry.name.c_str(), result );
+    return result;
+}
+
+/// <summary>
+/// Run initializers of several images in a single remote call, in list order.
+/// All images must have the same architecture
+/// </summary>
+/// <param name="images">Images to initialize</param>
+/// <param name="dwReason">Call reason</param>
+/// <param name="pCustomArgs">Custom arguments passed to each initializer</param>
+/// <param name="results">DllMain result of each image, InitNotRun if image has no entry point</param>
+/// <returns>Status code</returns>
+NTSTATUS MMap::RunBatchInitializers( const vecImageCtx& images, DWORD dwReason, CustomArgs_t* pCustomArgs, std::vector<uint32_t>& results )
+{
+    PhaseScope phase( *this, MP_EntryPoint );
+    results.assign( images.size(), InitNotRun );
+    if (images.empty())
+        return STATUS_SUCCESS;
+
+    auto mt = images.front()->ldrEntry.type;
+    auto a = AsmFactory::GetAssembler( mt );
+    uint64_t result = 0;
+
+    // Each DllMain stores its result in own slot
+    size_t resultSize = results.size() * sizeof( uint32_t );
+    auto resultMem = _process.memory().Allocate( resultSize, PAGE_READWRITE );
+    if (!resultMem)
+        return resultMem.status;
+
+    auto status = resultMem->Write( 0, resultSize, results.data() );
+    if (!NT_SUCCESS( status ))
+        return status;
+
+    auto customArgs = CopyCustomArgs( pCustomArgs );
+    if (!customArgs)
+        return customArgs.status;
+
+    a->GenPrologue();
+    GenActivationContext( *a, mt, true );
+
+    for (size_t i = 0; i < images.size(); i++)
+        GenInitializerCalls( *a, images[i], dwReason, customArgs.result(), resultMem->ptr() + i * sizeof( uint32_t ) );
+
+    GenActivationContext( *a, mt, false );
+    _process.remote().AddReturnWithEvent( *a, mt );
+    a->GenEpilogue();
+
+    BLACKBONE_TRACE( L"ManualMap: Running initializers of %d images in single call", static_cast<int>(images.size()) );
+
+    status = _process.remote().ExecInWorkerThread( (*a)->make(), (*a)->getCodeSize(), result );
+    if (!NT_SUCCESS( status ))
+        return status;
+
+    status = resultMem->Read( 0, resultSize, results.data() );
+    if (!NT_SUCCESS( status ))
+        return status;
 
-        memBuf->Write( 0, pCustomArgs->size() );
-        memBuf->Write( sizeof( uint64_t ), pCustomArgs->size(), pCustomArgs->data() );
-        customArgumentsAddress = memBuf->ptr();
+    for (size_t i = 0; i < images.size(); i++)
+    {
+        if (results[i] != InitNotRun)
+            BLACKBONE_TRACE( L"ManualMap: DllMain of '%ls' returned %d", images[i]->ldrEntry.name.c_str(), results[i] );
     }
 
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Generate TLS callback and entry point calls
+/// </summary>
+/// <param name="a">Target assembly helper</param>
+/// <param name="pImage">Image data</param>
+/// <param name="dwReason">Call reason</param>
+/// <param name="customArgs">Custom arguments address</param>
+/// <param name="resultPtr">Address to store DllMain result at, 0 - RPC return value</param>
+void MMap::GenInitializerCalls( IAsmHelper& a, ImageContextPtr pImage, DWORD dwReason, ptr_t customArgs, ptr_t resultPtr )
+{
     // Function order
     // TLS first, entry point last
     if (!(pImage->flags & NoTLS))
@@ -1195,7 +2583,7 @@ call_result_t<uint64_t> MMap::RunModuleInitializers( ImageContextPtr pImage, DWO
                 pCallback, pImage->ldrEntry.name.c_str(), dwReason 
             );
 
-            a->GenCall( pCallback, { pImage->imgMem.ptr(), dwReason, customArgumentsAddress } );
+            a.GenCall( pCallback, { pImage->imgMem.ptr(), dwReason, customArgs } );
         }
     }
 
@@ -1203,31 +2591,73 @@ call_result_t<uint64_t> MMap::RunModuleInitializers( ImageContextPtr pImage, DWO
     if (pImage->ldrEntry.entryPoint != 0)
     {
         BLACKBONE_TRACE( L"ManualMap: Calling entry point for '%ls', Reason: %d", pImage->ldrEntry.name.c_str(), dwReason );
-        a->GenCall( pImage->ldrEntry.entryPoint, { pImage->imgMem.ptr(), dwReason, customArgumentsAddress } );
-        _process.remote().SaveCallResult( *a );
+        a.GenCall( pImage->ldrEntry.entryPoint, { pImage->imgMem.ptr(), dwReason, customArgs } );
+
+        if (resultPtr != 0)
+        {
+            a->mov( a->zdx, resultPtr );
+            a->mov( asmjit::host::dword_ptr( a->zdx ), a->zax );
+        }
+        else
+            _process.remote().SaveCallResult( a );
     }
+}
+
+/// <summary>
+/// Generate activation or deactivation of SxS context, if any
+/// </summary>
+/// <param name="a">Target assembly helper</param>
+/// <param name="mt">Image architecture</param>
+/// <param name="activate">true to activate, false to deactivate</param>
+void MMap::GenActivationContext( IAsmHelper& a, eModType mt, bool activate )
+{
+    if (!_pAContext.valid())
+        return;
+
+    auto hNtdll = _process.modules().GetModule( L"ntdll.dll", LdrList, mt );
 
+    // ActivateActCtx
+    if (activate)
+    {
+        auto pActivateActx = _process.modules().GetExport( hNtdll, "RtlActivateActivationContext" );
+        if (pActivateActx)
+        {
+            a->mov( a->zax, _pAContext.ptr() );
+            a->mov( a->zax, asmjit::host::dword_ptr( a->zax ) );
+            a.GenCall( pActivateActx->procAddress, { 0, a->zax, _pAContext.ptr() + sizeof( ptr_t ) } );
+        }
+    }
     // DeactivateActCtx
-    if (_pAContext.valid() && pDeactivateActx)
+    else
     {
-        (*a)->mov( (*a)->zax, _pAContext.ptr() + sizeof( ptr_t ) );
-        (*a)->mov( (*a)->zax, asmjit::host::dword_ptr( (*a)->zax ) );
-        a->GenCall( pDeactivateActx->procAddress, { 0, (*a)->zax } );
+        auto pDeactivateActx = _process.modules().GetExport( hNtdll, "RtlDeactivateActivationContext" );
+        if (pDeactivateActx)
+        {
+            a->mov( a->zax, _pAContext.ptr() + sizeof( ptr_t ) );
+            a->mov( a->zax, asmjit::host::dword_ptr( a->zax ) );
+            a.GenCall( pDeactivateActx->procAddress, { 0, a->zax } );
+        }
     }
+}
 
-    // Set invalid return code offset to preserve one from DllMain
-    _process.remote().AddReturnWithEvent( *a, pImage->ldrEntry.type, rt_int32, ARGS_OFFSET );
-    a->GenEpilogue();
+/// <summary>
+/// Copy custom initializer arguments into target process
+/// </summary>
+/// <param name="pCustomArgs">Custom arguments</param>
+/// <returns>Arguments address, 0 if no arguments</returns>
+call_result_t<ptr_t> MMap::CopyCustomArgs( CustomArgs_t* pCustomArgs )
+{
+    if (!pCustomArgs)
+        return ptr_t( 0 );
 
-    NTSTATUS status = _process.remote().ExecInWorkerThread( (*a)->make(), (*a)->getCodeSize(), result );
-    if (!NT_SUCCESS( status ))
-        return status;
+    // Block is left to the image
+    auto memBuf = _process.memory().Allocate( pCustomArgs->size() + sizeof( uint64_t ), PAGE_EXECUTE_READWRITE, 0, false );
+    if (!memBuf)
+        return memBuf.status;
 
-    if (pImage->ldrEntry.entryPoint == 0)
-        return call_result_t<uint64_t>( ERROR_SUCCESS, STATUS_SUCCESS );
-    
-    BLACKBONE_TRACE( L"ManualMap: DllMain of '%ls' returned %lld", pImage->ldrEntry.name.c_str(), result );
-    return result;
+    memBuf->Write( 0, pCustomArgs->size() );
+    memBuf->Write( sizeof( uint64_t ), pCustomArgs->size(), pCustomArgs->data() );
+    return memBuf->ptr();
 }
 
 
@@ -1240,14 +2670,16 @@ call_result_t<uint64_t> MMap::RunModuleInitializers( ImageContextPtr pImage, DWO
 /// </summary>
 /// <param name="image">Source umage</param>
 /// <returns>true on success</returns>
-NTSTATUS MMap::CreateActx( const pe::PEImage& image  )
-{   
+NTSTATUS MMap::CreateActx( pe::PEImage& image  )
+{
+    PhaseScope phase( *this, MP_SxS );
     auto a = AsmFactory::GetAssembler( image.mType() );
 
     NTSTATUS status = STATUS_SUCCESS;
     uint64_t result = 0;
 
-    auto mem = _process.memory().Allocate( 512, PAGE_READWRITE );
+    // Handle, ACTCTX and manifest path
+    auto mem = _process.memory().heap().Allocate( sizeof( ptr_t ) + sizeof( _ACTCTXW64 ) + (image.manifestFile().length() + 1) * sizeof( wchar_t ) );
     if (!mem)
         return mem.status;
 
@@ -1307,7 +2739,7 @@ NTSTATUS MMap::CreateActx( const pe::PEImage& image  )
             image.manifestFile().c_str()
         );
 
-        auto pCode = _process.memory().Allocate( 0x1000 );
+        auto pCode = _process.memory().codeHeap().Allocate( 0x1000 );
         if (!pCode)
             return pCode.status;
 
@@ -1372,6 +2804,8 @@ NTSTATUS MMap::CreateActx( const pe::PEImage& image  )
         return status;
     }
 
+    // Images sharing a manifest share SxS probe results
+    _actxManifest = ManifestKey( image );
     return STATUS_SUCCESS;
 }
 
@@ -1382,15 +2816,70 @@ NTSTATUS MMap::CreateActx( const pe::PEImage& image  )
 /// <returns>Status code</returns>
 NTSTATUS MMap::ProbeRemoteSxS( std::wstring& path )
 {
+    auto key = SxSCacheKey( path );
+    auto iter = _sxsCache.find( key );
+    if (iter == _sxsCache.end())
+    {
+        NTSTATUS status = ProbeRemoteSxS( std::vector<std::wstring>{ path } );
+        if (!NT_SUCCESS( status ))
+            return status;
+
+        iter = _sxsCache.find( key );
+        if (iter == _sxsCache.end())
+            return STATUS_NOT_FOUND;
+    }
+
+    if (NT_SUCCESS( iter->second.first ))
+        path = iter->second.second;
+
+    return iter->second.first;
+}
+
+/// <summary>
+/// Do SxS path probing of several paths in the target process with a single remote call.
+/// Results are stored in the SxS cache, already cached paths are skipped
+/// Target memory layout, per path:
+/// --------------------------------------------------------------------------
+/// | OriginalName | name | DllName1 | DllName2 | pPath | status | dll_path |
+/// --------------------------------------------------------------------------
+/// </summary>
+/// <param name="paths">Paths to probe</param>
+/// <returns>Status code</returns>
+NTSTATUS MMap::ProbeRemoteSxS( const std::vector<std::wstring>& paths )
+{
+    PhaseScope phase( *this, MP_SxS );
     NTSTATUS status = STATUS_SUCCESS;
 
-    constexpr uint32_t memSize    = 0x1000;
+    constexpr uint32_t entrySize  = 0x800;
+    constexpr uint32_t nameOffset = 0x10;
+    constexpr uint32_t nameSize   = 0x2F0;
     constexpr uint32_t dll1Offset = 0x300;
-    constexpr uint32_t dll2Offset = 0x600;
-    constexpr uint32_t pathOffset = 0x800;
-    constexpr uint32_t strOffset  = 0xA00;
+    constexpr uint32_t dll2Offset = 0x320;
+    constexpr uint32_t pathOffset = 0x340;
+    constexpr uint32_t statOffset = 0x348;
+    constexpr uint32_t strOffset  = 0x600;
     constexpr uint16_t strSize    = 0x200;
 
+    std::vector<std::pair<std::wstring, std::wstring>> pending;
+    for (auto& path : paths)
+    {
+        auto key = SxSCacheKey( path );
+        if (_sxsCache.count( key ) != 0)
+            continue;
+
+        if ((path.length() + 1) * sizeof( wchar_t ) > nameSize)
+        {
+            _sxsCache.emplace( key, std::make_pair( STATUS_NAME_TOO_LONG, std::wstring() ) );
+            continue;
+        }
+
+        if (std::find_if( pending.begin(), pending.end(), [&key]( auto& val ) { return val.first == key; } ) == pending.end())
+            pending.emplace_back( key, path );
+    }
+
+    if (pending.empty())
+        return STATUS_SUCCESS;
+
     // No underlying function
     auto ProbeFn = _process.modules().GetNtdllExport( "RtlDosApplyFileIsolationRedirection_Ustr" );
     if (!ProbeFn)
@@ -1402,31 +2891,38 @@ NTSTATUS MMap::ProbeRemoteSxS( std::wstring& path )
     auto pAsm = AsmFactory::GetAssembler( _process.barrier().targetWow64 );
     auto& a = *pAsm.get();
 
-    // REmote buffer
+    // Remote buffer
+    auto memSize = static_cast<uint32_t>(pending.size() * entrySize);
     auto memBuf = _process.memory().Allocate( memSize, PAGE_READWRITE );
     if (!memBuf)
         return memBuf.status;
 
-    // Fill Unicode strings
+    // Fill Unicode strings locally and write them at once
     auto memPtr = memBuf->ptr();
+    std::pmr::vector<uint8_t> localBuf( memSize, TransientResource() );
     auto fillStr = [&]( auto&& OriginalName )
     {
         std::remove_reference<decltype(OriginalName)>::type DllName1 = { 0 };
 
-        OriginalName.Length = static_cast<uint16_t>(path.length() * sizeof( wchar_t ));
-        OriginalName.MaximumLength = OriginalName.Length;
-        OriginalName.Buffer = static_cast<decltype(OriginalName.Buffer)>(memPtr + sizeof( OriginalName ));
+        for (size_t i = 0; i < pending.size(); i++)
+        {
+            auto& path = pending[i].second;
+            auto entry = static_cast<uint32_t>(i * entrySize);
+
+            OriginalName.Length = static_cast<uint16_t>(path.length() * sizeof( wchar_t ));
+            OriginalName.MaximumLength = OriginalName.Length;
+            OriginalName.Buffer = static_cast<decltype(OriginalName.Buffer)>(memPtr + entry + nameOffset);
 
-        auto status = _process.memory().Write( memPtr, OriginalName );
-        status = _process.memory().Write( memPtr + sizeof( OriginalName ), OriginalName.Length + 2, path.c_str() );
-        if (!NT_SUCCESS( status ))
-            return status;
+            DllName1.Length = 0;
+            DllName1.MaximumLength = strSize;
+            DllName1.Buffer = static_cast<decltype(DllName1.Buffer)>(memPtr + entry + strOffset);
 
-        DllName1.Length = 0;
-        DllName1.MaximumLength = strSize;
-        DllName1.Buffer = static_cast<decltype(DllName1.Buffer)>(memPtr + strOffset);
+            memcpy( localBuf.data() + entry, &OriginalName, sizeof( OriginalName ) );
+            memcpy( localBuf.data() + entry + nameOffset, path.c_str(), OriginalName.Length + sizeof( wchar_t ) );
+            memcpy( localBuf.data() + entry + dll1Offset, &DllName1, sizeof( DllName1 ) );
+        }
 
-        return _process.memory().Write( memPtr + dll1Offset, DllName1 );
+        return _process.memory().Write( memPtr, localBuf.size(), localBuf.data() );
     };
 
     if (_process.barrier().targetWow64)
@@ -1447,18 +2943,23 @@ NTSTATUS MMap::ProbeRemoteSxS( std::wstring& path )
         a.GenCall( pActivateActx->procAddress, { 0, a->zax, actx + sizeof( ptr_t ) } );
     }
 
-    // RtlDosApplyFileIsolationRedirection_Ustr
-    a.GenCall( ProbeFn->procAddress,
+    // RtlDosApplyFileIsolationRedirection_Ustr for every path
+    for (size_t i = 0; i < pending.size(); i++)
     {
-        TRUE,
-        memPtr + 0, 0,
-        memPtr + dll1Offset,
-        memPtr + dll2Offset,
-        memPtr + pathOffset,
-        0, 0, 0
-    } );
-
-    _process.remote().SaveCallResult( a );
+        auto entry = memPtr + i * entrySize;
+        a.GenCall( ProbeFn->procAddress,
+        {
+            TRUE,
+            entry + 0, 0,
+            entry + dll1Offset,
+            entry + dll2Offset,
+            entry + pathOffset,
+            0, 0, 0
+        } );
+
+        a->mov( a->zdx, entry + statOffset );
+        a->mov( asmjit::host::dword_ptr( a->zdx ), asmjit::host::eax );
+    }
 
     // DeactivateActCtx
     if (actx && pDeactivateActx)
@@ -1475,16 +2976,77 @@ NTSTATUS MMap::ProbeRemoteSxS( std::wstring& path )
     if (!NT_SUCCESS( status = _process.remote().ExecInWorkerThread( a->make(), a->getCodeSize(), result ) ))
         return status;
 
-    status = static_cast<NTSTATUS>(result);
-    if (NT_SUCCESS( status ))
+    // Read results back
+    if (!NT_SUCCESS( status = memBuf->Read( 0, memSize, localBuf.data() ) ))
+        return status;
+
+    for (size_t i = 0; i < pending.size(); i++)
     {
-        // Read result back
-        std::unique_ptr<uint8_t[]> localBuf( new uint8_t[memSize] );
-        if (NT_SUCCESS( status = memBuf->Read( 0, memSize, localBuf.get() ) ))
-            path = reinterpret_cast<wchar_t*>(localBuf.get() + strOffset);
+        auto entry = localBuf.data() + i * entrySize;
+        auto probeStatus = *reinterpret_cast<NTSTATUS*>(entry + statOffset);
+
+        // Result is always placed into DllName1 buffer
+        std::wstring resolved;
+        if (NT_SUCCESS( probeStatus ))
+        {
+            auto length = _process.barrier().targetWow64 ?
+                reinterpret_cast<_UNICODE_STRING_T<uint32_t>*>(entry + dll1Offset)->Length :
+                reinterpret_cast<_UNICODE_STRING_T<uint64_t>*>(entry + dll1Offset)->Length;
+
+            if (length == 0 || length > strSize)
+                probeStatus = STATUS_NAME_TOO_LONG;
+            else
+                resolved.assign( reinterpret_cast<wchar_t*>(entry + strOffset), length / sizeof( wchar_t ) );
+        }
+
+        _sxsCache.emplace( pending[i].first, std::make_pair( probeStatus, std::move( resolved ) ) );
     }
 
-    return status;
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Probe SxS redirection of image dependencies in the target process at once.
+/// Only arch mismatch makes local probing unreliable, otherwise nothing is done
+/// </summary>
+/// <param name="pImage">Image data</param>
+/// <param name="useDelayed">Probe delayed imports instead</param>
+void MMap::PrefetchRemoteSxS( ImageContextPtr pImage, bool useDelayed )
+{
+    if (!_process.barrier().mismatch)
+        return;
+
+    std::vector<std::wstring> paths;
+    for (auto& importMod : pImage->peImage.GetImports( useDelayed ))
+    {
+        std::wstring path = importMod.first;
+        if (pImage->bundle != nullptr && pImage->bundle->dependency( path ) != nullptr)
+            continue;
+
+        if (_process.modules().GetModule( path, LdrList, pImage->peImage.mType(), pImage->ldrEntry.fullPath.c_str() ))
+            continue;
+
+        if (ResolveDependencyPath( pImage, path ) == STATUS_SXS_IDENTITIES_DIFFERENT)
+            paths.emplace_back( std::move( path ) );
+    }
+
+    if (!paths.empty())
+        ProbeRemoteSxS( paths );
+}
+
+/// <summary>
+/// Remote SxS cache key of a path for current activation context
+/// </summary>
+/// <param name="path">Path to probe</param>
+/// <returns>Cache key</returns>
+std::wstring MMap::SxSCacheKey( const std::wstring& path ) const
+{
+    // Results depend on target process as well
+    auto key = std::to_wstring( _process.pid() ) + L'|';
+    if (_pAContext.valid())
+        key += _actxManifest;
+
+    return key + L'|' + Utils::ToLower( path );
 }
 
 /// <summary>
@@ -1590,4 +3152,109 @@ DWORD MMap::GetSectionProt( DWORD characteristics )
     return dwResult;
 }
 
+/// <summary>
+/// Add counters difference to phase counters
+/// </summary>
+/// <param name="stats">Phase counters</param>
+/// <param name="from">Counters at phase start</param>
+/// <param name="to">Counters at phase end</param>
+static void AddDelta( MapPhaseStats& stats, const MapPhaseStats& from, const MapPhaseStats& to )
+{
+    stats.time += to.time - from.time;
+    stats.memoryCalls += to.memoryCalls - from.memoryCalls;
+    stats.rpcCalls += to.rpcCalls - from.rpcCalls;
+    stats.bytesWritten += to.bytesWritten - from.bytesWritten;
+}
+
+/// <summary>
+/// Start collecting mapping statistics
+/// </summary>
+/// <param name="pStats">Output statistics, nullptr to disable collection</param>
+void MMap::BeginStats( MapStats* pStats )
+{
+    _pStats = pStats;
+    _phaseStack.clear();
+
+    if (_pStats == nullptr)
+        return;
+
+    *_pStats = MapStats();
+    _statsStart = _phaseMark = StatsSnapshot();
+}
+
+/// <summary>
+/// Finish collecting mapping statistics
+/// </summary>
+void MMap::EndStats()
+{
+    if (_pStats == nullptr)
+        return;
+
+    auto now = StatsSnapshot();
+    AccruePhase( now );
+
+    AddDelta( _pStats->total, _statsStart, now );
+    _pStats->total.count = 1;
+
+    _pStats = nullptr;
+    _phaseStack.clear();
+}
+
+/// <summary>
+/// Enter mapping phase. Current phase is suspended until nested one is left
+/// </summary>
+/// <param name="phase">Phase</param>
+void MMap::EnterPhase( MapPhase phase )
+{
+    if (_pStats == nullptr)
+        return;
+
+    AccruePhase( StatsSnapshot() );
+    _phaseStack.emplace_back( phase );
+    _pStats->phases[phase].count++;
+}
+
+/// <summary>
+/// Leave current mapping phase
+/// </summary>
+void MMap::LeavePhase()
+{
+    if (_pStats == nullptr || _phaseStack.empty())
+        return;
+
+    AccruePhase( StatsSnapshot() );
+    _phaseStack.pop_back();
+}
+
+/// <summary>
+/// Add counters since last phase switch to current phase
+/// </summary>
+/// <param name="now">Current counters</param>
+void MMap::AccruePhase( const MapPhaseStats& now )
+{
+    if (!_phaseStack.empty())
+        AddDelta( _pStats->phases[_phaseStack.back()], _phaseMark, now );
+
+    _phaseMark = now;
+}
+
+/// <summary>
+/// Get current time and process counters
+/// </summary>
+/// <returns>Counters snapshot</returns>
+MapPhaseStats MMap::StatsSnapshot()
+{
+    using namespace std::chrono;
+
+    MapPhaseStats snapshot;
+    auto memory = _process.memory().counters();
+
+    snapshot.time = static_cast<uint64_t>(duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count());
+    snapshot.memoryCalls = memory.calls;
+    snapshot.bytesWritten = memory.bytesWritten;
+    snapshot.rpcCalls = _process.remote().calls();
+
+    return snapshot;
+}
+
 }
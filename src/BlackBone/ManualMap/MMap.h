@@ -8,15 +8,24 @@
 #include "../Process/MemBlock.h"
 #include "../ManualMap/Native/NtLoader.h"
 #include "MExcept.h"
+#include "../Misc/MemoryResource.h"
 
 #include <array>
 #include <vector>
 #include <map>
+#include <set>
+#include <unordered_map>
 #include <tuple>
+#include <atomic>
 
 namespace blackbone
 {
 
+class IAsmHelper;
+struct BundleImage;
+struct BundleDependency;
+class ImageBundle;
+
 class CustomArgs_t
 {
 public:
@@ -86,7 +95,7 @@ private:
     }
 
 private:
-    std::vector<uint8_t> _buffer;
+    std::pmr::vector<uint8_t> _buffer{ TransientResource() };
 };
 
 // Loader flags
@@ -101,6 +110,9 @@ enum eLoadFlags
     RebaseProcess   = 0x40,     // If target image is an .exe file, process base address will be replaced with mapped module value
     NoThreads       = 0x80,     // Don't create new threads, use hijacking
     ForceRemap      = 0x100,    // Force remapping module even if it's already loaded
+    ParallelDeps    = 0x200,    // Load and stage manually mapped dependencies concurrently before mapping. Requires ManualImports
+    SharedArena     = 0x400,    // Place relocatable image and its manually mapped dependencies into single allocation. Implies ParallelDeps
+    LazyBind        = 0x800,    // Bind imports from natively loaded modules on first call through resolver thunks placed in target
 
     NoExceptions    = 0x01000,  // Do not create custom exception handler
     PartialExcept   = 0x02000,  // Only create Inverted function table, without VEH
@@ -142,6 +154,48 @@ enum CallbackType
 
 using MapCallback = LoadData( *)(CallbackType type, void* context, Process& process, const ModuleData& modInfo);
 
+// Manual mapping phases
+enum MapPhase
+{
+    MP_Load,            // Image loading, parsing and staging
+    MP_SxS,             // Activation context creation and remote SxS probing
+    MP_Dependencies,    // Dependency path resolution
+    MP_Allocate,        // Image memory allocation
+    MP_Copy,            // Image copy into target
+    MP_Relocate,        // Base relocations
+    MP_Imports,         // Import resolution
+    MP_DelayImports,    // Delayed import resolution
+    MP_Protect,         // Section protection
+    MP_TLS,             // Static TLS initialization
+    MP_Exceptions,      // Exception handling support
+    MP_Cookie,          // Security cookie
+    MP_EntryPoint,      // TLS callbacks and entry points
+
+    MP_Count
+};
+
+/// <summary>
+/// Counters of a mapping phase. Time spent in nested phases, e.g. mapping of dependency during import resolution,
+/// is accounted to the nested phase only
+/// </summary>
+struct MapPhaseStats
+{
+    uint64_t time = 0;              // Wall time, microseconds
+    uint32_t count = 0;             // Number of times phase was entered
+    uint64_t memoryCalls = 0;       // Memory syscalls
+    uint64_t rpcCalls = 0;          // Remote code executions
+    uint64_t bytesWritten = 0;      // Bytes written into target, driver writes excluded
+};
+
+/// <summary>
+/// Manual mapping statistics
+/// </summary>
+struct MapStats
+{
+    std::array<MapPhaseStats, MP_Count> phases; // Per phase counters
+    MapPhaseStats total;                        // Whole MapImage call
+};
+
 
 /// <summary>
 /// Image data
@@ -154,7 +208,15 @@ struct ImageContext
     MemBlock       imgMem;                  // Target image memory region
     NtLdrEntry     ldrEntry;                // Native loader module information
     vecPtr         tlsCallbacks;            // TLS callback routines
+    std::pmr::vector<uint8_t> localImage{ TransientResource() };  // Local staging copy of image layout, released after copy
+    std::vector<uint32_t> sectionExtents;   // Number of bytes of each section copied into target
     ptr_t          pExpTableAddr = 0;       // Exception table address (amd64 only)
+    ptr_t          arenaBase = 0;           // Base of shared allocation holding the image, 0 if image has own allocation
+    std::vector<MemBlock> lazyBind;         // LazyBind resolver, thunks and binding tables
+    std::vector<size_t> pageHashes;         // Hash of every relocated image page before binding, compared by UpdateImage
+    std::unordered_map<uintptr_t, size_t> importKeys;   // Hash of module and function name by IAT entry RVA
+    ptr_t          cookieAddr = 0;          // Security cookie address
+    const BundleImage* bundle = nullptr;    // Prepared image data, valid only while mapping
     eLoadFlags     flags = NoFlags;         // Image loader flags
     bool           initialized = false;     // Image entry point was called
 };
@@ -178,13 +240,15 @@ public:
     /// <param name="flags">Image mapping flags</param>
     /// <param name="mapCallback">Mapping callback. Triggers for each mapped module</param>
     /// <param name="context">User-supplied callback context</param>
+    /// <param name="pStats">Optional per phase mapping statistics</param>
     /// <returns>Mapped image info </returns>
     BLACKBONE_API call_result_t<ModuleDataPtr> MapImage(
         const std::wstring& path,
         eLoadFlags flags = NoFlags,
         MapCallback mapCallback = nullptr,
         void* context = nullptr,
-        CustomArgs_t* pCustomArgs_t = nullptr
+        CustomArgs_t* pCustomArgs_t = nullptr,
+        MapStats* pStats = nullptr
         );
 
     /// <summary>
@@ -196,6 +260,7 @@ public:
     /// <param name="flags">Image mapping flags</param>
     /// <param name="mapCallback">Mapping callback. Triggers for each mapped module</param>
     /// <param name="context">User-supplied callback context</param>
+    /// <param name="pStats">Optional per phase mapping statistics</param>
     /// <returns>Mapped image info</returns>
     BLACKBONE_API call_result_t<ModuleDataPtr> MapImage(
         size_t size, void* buffer,
@@ -203,11 +268,56 @@ public:
         eLoadFlags flags = NoFlags,
         MapCallback mapCallback = nullptr,
         void* context = nullptr,
-        CustomArgs_t* pCustomArgs_t = nullptr
+        CustomArgs_t* pCustomArgs_t = nullptr,
+        MapStats* pStats = nullptr
+        );
+
+    /// <summary>
+    /// Manually map prepared image bundle into underlying target process.
+    /// Dependencies already loaded in the target are used as is
+    /// </summary>
+    /// <param name="bundle">Image bundle</param>
+    /// <param name="flags">Image mapping flags. ManualImports is required to map bundled dependencies</param>
+    /// <param name="mapCallback">Mapping callback. Triggers for each mapped module</param>
+    /// <param name="context">User-supplied callback context</param>
+    /// <param name="pStats">Optional per phase mapping statistics</param>
+    /// <returns>Mapped image info</returns>
+    BLACKBONE_API call_result_t<ModuleDataPtr> MapImage(
+        const ImageBundle& bundle,
+        eLoadFlags flags = ManualImports,
+        MapCallback mapCallback = nullptr,
+        void* context = nullptr,
+        CustomArgs_t* pCustomArgs_t = nullptr,
+        MapStats* pStats = nullptr
         );
 
     /// <summary>
-    /// Unmap all manually mapped modules
+    /// Prepare image and its dependencies for repeated mapping.
+    /// Dependency paths and imports are resolved against modules of underlying process,
+    /// bundle is valid for any process with the same system images
+    /// </summary>
+    /// <param name="path">Image path</param>
+    /// <param name="bundle">Resulting bundle</param>
+    /// <param name="flags">Mapping flags. With ManualImports missing dependencies are bundled as well</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS BuildBundle( const std::wstring& path, ImageBundle& bundle, eLoadFlags flags = ManualImports );
+
+    /// <summary>
+    /// Replace manually mapped image with new build of it in place.
+    /// Image keeps its base, loader entries, security cookie and state of unchanged pages.
+    /// Only pages that differ from previous build after relocation are written and only imports of these pages
+    /// or imports that have changed are resolved again. Initializers aren't run again and static TLS isn't reinitialized.
+    /// New build must fit into image memory
+    /// </summary>
+    /// <param name="existing">Manually mapped image</param>
+    /// <param name="newPath">New image build</param>
+    /// <param name="pStats">Optional per phase statistics</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS UpdateImage( const ModuleDataPtr& existing, const std::wstring& newPath, MapStats* pStats = nullptr );
+
+    /// <summary>
+    /// Unmap all manually mapped modules.
+    /// Images of each architecture are torn down by single remote call
     /// </summary>
     /// <returns>Status code</returns>
     BLACKBONE_API NTSTATUS UnmapAllModules();
@@ -221,7 +331,7 @@ public:
     /// <summary>
     /// Reset local data
     /// </summary>
-    BLACKBONE_API inline void reset() { _images.clear(); _pAContext.Reset(); _usedBlocks.clear(); }
+    BLACKBONE_API inline void reset() { _images.clear(); _prepared.clear(); _pAContext.Reset(); _actxManifest.clear(); _arena.Reset(); _arenaUsed = 0; _usedBlocks.clear(); }
 private:
     /// <summary>
     /// Manually map PE image into underlying target process
@@ -233,6 +343,8 @@ private:
     /// <param name="flags">Image mapping flags</param>
     /// <param name="mapCallback">Mapping callback. Triggers for each mapped module</param>
     /// <param name="context">User-supplied callback context</param>
+    /// <param name="pBundle">Prepared image bundle</param>
+    /// <param name="pStats">Mapping statistics</param>
     /// <returns>Mapped image info</returns>
     call_result_t<ModuleDataPtr> MapImageInternal(
         const std::wstring& path,
@@ -241,7 +353,9 @@ private:
         eLoadFlags flags = NoFlags,
         MapCallback ldrCallback = nullptr,
         void* ldrContext = nullptr,
-        CustomArgs_t* pCustomArgs_t = nullptr
+        CustomArgs_t* pCustomArgs_t = nullptr,
+        const ImageBundle* pBundle = nullptr,
+        MapStats* pStats = nullptr
         );
  
     /// <summary>
@@ -264,6 +378,14 @@ private:
         eLoadFlags flags = NoFlags
         );
 
+    /// <summary>
+    /// Allocate target memory for image
+    /// </summary>
+    /// <param name="pImage">Image data</param>
+    /// <param name="flags">Mapping flags</param>
+    /// <returns>Status code</returns>
+    NTSTATUS AllocateImage( ImageContextPtr pImage, eLoadFlags flags );
+
     /// <summary>
     /// Run module initializers(TLS and entry point).
     /// </summary>
@@ -277,8 +399,63 @@ private:
     /// <returns>DllMain result</returns>
     call_result_t<uint64_t> RunModuleInitializers( ImageContextPtr pImage, DWORD dwReason, CustomArgs_t* pCustomArgs_t = nullptr );
 
+    // DllMain result slot of image without entry point
+    static constexpr uint32_t InitNotRun = 0xFFFFFFFF;
+
+    /// <summary>
+    /// Run initializers of several images in a single remote call, in list order.
+    /// All images must have the same architecture
+    /// </summary>
+    /// <param name="images">Images to initialize</param>
+    /// <param name="dwReason">Call reason</param>
+    /// <param name="pCustomArgs">Custom arguments passed to each initializer</param>
+    /// <param name="results">DllMain result of each image, InitNotRun if image has no entry point</param>
+    /// <returns>Status code</returns>
+    NTSTATUS RunBatchInitializers( const vecImageCtx& images, DWORD dwReason, CustomArgs_t* pCustomArgs, std::vector<uint32_t>& results );
+
+    /// <summary>
+    /// Unmap several images in a single remote call: detach notifications in list order,
+    /// then exception table, TLS and loader unregistration, then memory release.
+    /// All images must have the same architecture
+    /// </summary>
+    /// <param name="images">Images to unmap</param>
+    /// <returns>Status code</returns>
+    NTSTATUS UnmapBatch( const vecImageCtx& images );
+
+    /// <summary>
+    /// Generate TLS callback and entry point calls
+    /// </summary>
+    /// <param name="a">Target assembly helper</param>
+    /// <param name="pImage">Image data</param>
+    /// <param name="dwReason">Call reason</param>
+    /// <param name="customArgs">Custom arguments address</param>
+    /// <param name="resultPtr">Address to store DllMain result at, 0 - RPC return value</param>
+    void GenInitializerCalls( IAsmHelper& a, ImageContextPtr pImage, DWORD dwReason, ptr_t customArgs, ptr_t resultPtr );
+
+    /// <summary>
+    /// Generate activation or deactivation of SxS context, if any
+    /// </summary>
+    /// <param name="a">Target assembly helper</param>
+    /// <param name="mt">Image architecture</param>
+    /// <param name="activate">true to activate, false to deactivate</param>
+    void GenActivationContext( IAsmHelper& a, eModType mt, bool activate );
+
+    /// <summary>
+    /// Copy custom initializer arguments into target process
+    /// </summary>
+    /// <param name="pCustomArgs">Custom arguments</param>
+    /// <returns>Arguments address, 0 if no arguments</returns>
+    call_result_t<ptr_t> CopyCustomArgs( CustomArgs_t* pCustomArgs );
+
+    /// <summary>
+    /// Build image layout in local staging buffer
+    /// </summary>
+    /// <param name="pImage">Image data</param>
+    /// <returns>Status code</returns>
+    NTSTATUS StageImage( ImageContextPtr pImage );
+
     /// <summary>
-    /// Copies image into target process
+    /// Copies staged image into target process
     /// </summary>
     /// <param name="pImage">Image data</param>
     /// <returns>Status code</returns>
@@ -292,7 +469,7 @@ private:
     NTSTATUS ProtectImageMemory( ImageContextPtr pImage );
 
     /// <summary>
-    ///  Fix relocations if image wasn't loaded at base address
+    ///  Fix relocations in staged image if image wasn't loaded at base address
     /// </summary>
     /// <param name="pImage">image data</param>
     /// <returns>true on success</returns>
@@ -303,8 +480,32 @@ private:
     /// </summary>
     /// <param name="pImage">Image data</param>
     /// <param name="useDelayed">Resolve delayed import instead</param>
+    /// <param name="dirtyPages">If set, only imports placed on these pages or imports that have changed are resolved</param>
+    /// <returns>Status code</returns>
+    NTSTATUS ResolveImport( ImageContextPtr pImage, bool useDelayed = false, const std::set<uint32_t>* dirtyPages = nullptr );
+
+    /// <summary>
+    /// Import bound on first call
+    /// </summary>
+    struct LazyImport
+    {
+        uintptr_t   thunkRVA;       // Import address table entry RVA
+        module_t    module;         // Exporting module
+        const char* name;           // Function name, nullptr if imported by ordinal
+        uint16_t    ordinal;        // Function ordinal
+    };
+
+    /// <summary>
+    /// Place resolver thunks of lazily bound imports into target.
+    /// Every import gets a thunk that jumps through its binding table entry,
+    /// entry initially points to code that passes entry index to shared resolver.
+    /// Resolver calls LdrGetProcedureAddress, stores result into the entry and continues into function
+    /// </summary>
+    /// <param name="pImage">Image data</param>
+    /// <param name="imports">Lazily bound imports</param>
+    /// <param name="iat">Receives thunk addresses by IAT entry RVA</param>
     /// <returns>Status code</returns>
-    NTSTATUS ResolveImport( ImageContextPtr pImage, bool useDelayed = false );
+    NTSTATUS BindLazy( ImageContextPtr pImage, const std::pmr::vector<LazyImport>& imports, std::pmr::map<uintptr_t, ptr_t>& iat );
 
     /// <summary>
     /// Resolve static TLS storage
@@ -342,6 +543,68 @@ private:
     /// <returns></returns>
     call_result_t<ModuleDataPtr> FindOrMapDependency( ImageContextPtr pImage, std::wstring& path );
 
+    /// <summary>
+    /// Resolve dependency path relative to importing image
+    /// </summary>
+    /// <param name="pImage">Importing image data</param>
+    /// <param name="path">Dependency name, resolved path on success</param>
+    /// <returns>Status code</returns>
+    NTSTATUS ResolveDependencyPath( ImageContextPtr pImage, std::wstring& path );
+
+    /// <summary>
+    /// Walk import graph of the image level by level and load and stage missing dependencies concurrently.
+    /// Prepared images are picked up by FindOrMapModule, remote allocation, imports and initialization stay serialized.
+    /// </summary>
+    /// <param name="path">Image path</param>
+    /// <param name="buffer">Image data buffer</param>
+    /// <param name="size">Buffer size.</param>
+    /// <param name="asImage">If set to true - buffer has image memory layout</param>
+    /// <param name="flags">Mapping flags</param>
+    /// <returns>Size of shared arena needed for relocatable images of the set, 64 KB granular</returns>
+    size_t PrepareDependencies( const std::wstring& path, void* buffer, size_t size, bool asImage, eLoadFlags flags );
+
+    /// <summary>
+    /// Load and stage all images of the bundle. Prepared images are picked up by FindOrMapModule
+    /// </summary>
+    /// <param name="bundle">Image bundle</param>
+    /// <returns>Size of shared arena needed for relocatable images of the set, 64 KB granular</returns>
+    size_t PrepareBundle( const ImageBundle& bundle );
+
+    /// <summary>
+    /// Check if loaded module is the image bundle imports were resolved against
+    /// </summary>
+    /// <param name="dep">Bundle dependency</param>
+    /// <param name="hMod">Loaded module</param>
+    /// <returns>true if pre-resolved imports can be used</returns>
+    bool BundleDependencyValid( const BundleDependency& dep, const ModuleDataPtr& hMod );
+
+    /// <summary>
+    /// Shared preparation worker state
+    /// </summary>
+    struct PrepareContext
+    {
+        PrepareContext( MMap& self_, vecImageCtx& images_ )
+            : self( self_ )
+            , images( images_ ) { }
+
+        MMap& self;
+        vecImageCtx& images;
+        std::atomic<size_t> next{ 0 };
+    };
+
+    /// <summary>
+    /// Load and stage dependency images
+    /// </summary>
+    /// <param name="context">Shared image list</param>
+    void PrepareWorker( PrepareContext& context );
+
+    /// <summary>
+    /// Preparation thread entry point
+    /// </summary>
+    /// <param name="lpParam">Prepare context</param>
+    /// <returns>0</returns>
+    static DWORD CALLBACK PrepareWorkerWrap( LPVOID lpParam );
+
     /// <summary>
     /// Create activation context
     /// Target memory layout:
@@ -353,7 +616,7 @@ private:
     /// <param name="id">Manifest resource id</param>
     /// <param name="asImage">if true - 'path' points to a valid PE file, otherwise - 'path' points to separate manifest file</param>
     /// <returns>true on success</returns>
-    NTSTATUS CreateActx( const pe::PEImage& image );
+    NTSTATUS CreateActx( pe::PEImage& image );
 
     /// <summary>
     /// Do SxS path probing in the target process
@@ -362,6 +625,29 @@ private:
     /// <returns>Status code</returns>
     NTSTATUS ProbeRemoteSxS( std::wstring& path );
 
+    /// <summary>
+    /// Do SxS path probing of several paths in the target process with a single remote call.
+    /// Results are stored in the SxS cache, already cached paths are skipped
+    /// </summary>
+    /// <param name="paths">Paths to probe</param>
+    /// <returns>Status code</returns>
+    NTSTATUS ProbeRemoteSxS( const std::vector<std::wstring>& paths );
+
+    /// <summary>
+    /// Probe SxS redirection of image dependencies in the target process at once.
+    /// Only arch mismatch makes local probing unreliable, otherwise nothing is done
+    /// </summary>
+    /// <param name="pImage">Image data</param>
+    /// <param name="useDelayed">Probe delayed imports instead</param>
+    void PrefetchRemoteSxS( ImageContextPtr pImage, bool useDelayed );
+
+    /// <summary>
+    /// Remote SxS cache key of a path for current activation context
+    /// </summary>
+    /// <param name="path">Path to probe</param>
+    /// <returns>Cache key</returns>
+    std::wstring SxSCacheKey( const std::wstring& path ) const;
+
     /// <summary>
     /// Hide memory VAD node
     /// </summary>
@@ -384,13 +670,86 @@ private:
     /// <returns>Memory protection value</returns>
     DWORD GetSectionProt( DWORD characteristics );
 
+    /// <summary>
+    /// Start collecting mapping statistics
+    /// </summary>
+    /// <param name="pStats">Output statistics, nullptr to disable collection</param>
+    void BeginStats( MapStats* pStats );
+
+    /// <summary>
+    /// Finish collecting mapping statistics
+    /// </summary>
+    void EndStats();
+
+    /// <summary>
+    /// Enter mapping phase. Current phase is suspended until nested one is left
+    /// </summary>
+    /// <param name="phase">Phase</param>
+    void EnterPhase( MapPhase phase );
+
+    /// <summary>
+    /// Leave current mapping phase
+    /// </summary>
+    void LeavePhase();
+
+    /// <summary>
+    /// Add counters since last phase switch to current phase
+    /// </summary>
+    /// <param name="now">Current counters</param>
+    void AccruePhase( const MapPhaseStats& now );
+
+    /// <summary>
+    /// Get current time and process counters
+    /// </summary>
+    /// <returns>Counters snapshot</returns>
+    MapPhaseStats StatsSnapshot();
+
+    /// <summary>
+    /// Statistics collection for the duration of MapImage call
+    /// </summary>
+    class StatsScope
+    {
+    public:
+        StatsScope( MMap& mmap, MapStats* pStats )
+            : _mmap( mmap ) { _mmap.BeginStats( pStats ); }
+
+        ~StatsScope() { _mmap.EndStats(); }
+
+    private:
+        MMap& _mmap;
+    };
+
+    /// <summary>
+    /// Mapping phase for the duration of the scope
+    /// </summary>
+    class PhaseScope
+    {
+    public:
+        PhaseScope( MMap& mmap, MapPhase phase )
+            : _mmap( mmap ) { _mmap.EnterPhase( phase ); }
+
+        ~PhaseScope() { _mmap.LeavePhase(); }
+
+    private:
+        MMap& _mmap;
+    };
+
 private:
     class Process&  _process;               // Target process manager
     MExcept         _expMgr;                // Exception handler manager
     vecImageCtx     _images;                // Mapped images
+    std::unordered_map<std::wstring, ImageContextPtr> _prepared;    // Loaded and staged dependencies, not mapped yet
     MemBlock        _pAContext;             // SxS activation context memory address
+    std::wstring    _actxManifest;          // Manifest identity of _pAContext
+    std::unordered_map<std::wstring, std::pair<NTSTATUS, std::wstring>> _sxsCache;  // Remote SxS results by process, manifest and path. Kept between MapImage calls
+    MemBlock        _arena;                 // Shared allocation for image set, owned until mapping succeeds
+    size_t          _arenaUsed = 0;         // Bytes of arena given to images
     MapCallback     _mapCallback = nullptr; // Loader callback for adding image into loader lists
     void*           _userContext = nullptr; // user context for _ldrCallback       
+    MapStats*       _pStats = nullptr;      // Statistics of current MapImage call
+    std::vector<MapPhase> _phaseStack;      // Entered phases, innermost last
+    MapPhaseStats   _phaseMark;             // Counters at last phase switch
+    MapPhaseStats   _statsStart;            // Counters at MapImage start
 
     std::vector<std::pair<ptr_t, size_t>> _usedBlocks;   // Used memory blocks 
 };
@@ -8,9 +8,27 @@
 
 #include <3rd_party/VersionApi.h>
 
+#include <mutex>
+#include <tuple>
+
 namespace blackbone
 {
 
+/// <summary>
+/// Loader variables located in ntdll image.
+/// Same in every process that has same ntdll mapped at same base
+/// </summary>
+struct LdrGlobals
+{
+    ptr_t hashTable = 0;            // LdrpHashTable address
+    ptr_t moduleIndexBase = 0;      // LdrpModuleIndex address
+};
+
+using LdrGlobalsKey = std::tuple<ptr_t, uint32_t, eModType>;    // ntdll base, size and type
+
+static std::map<LdrGlobalsKey, LdrGlobals> g_ldrGlobals;
+static std::mutex g_ldrGlobalsGuard;
+
 NtLdr::NtLdr( Process& proc )
     : _process( proc )
 {
@@ -27,6 +45,8 @@ NtLdr::~NtLdr(void)
 /// <returns>true on success</returns
 bool NtLdr::Init( eModType initFor /*= mt_default*/ )
 {
+    CSLock lck( _lock );
+
     // Sanity check, already initialized
     assert( initFor != _initializedFor );
     if (initFor == _initializedFor)
@@ -37,20 +57,51 @@ bool NtLdr::Init( eModType initFor /*= mt_default*/ )
     if (_initializedFor == mt_unknown)
         _initializedFor = _process.core().isWow64() ? mt_mod32 : mt_mod64;
 
+    // Loader heap belongs to process, ntdll variables can be taken from previous lookup
+    auto ntdll = _process.modules().GetModule( L"ntdll.dll", Sections, _initializedFor );
+    LdrGlobalsKey key( ntdll ? ntdll->baseAddress : 0, ntdll ? ntdll->size : 0, _initializedFor );
+    bool cached = false;
+
+    _LdrpHashTable = _LdrpModuleIndexBase = 0;
+    if (ntdll)
+    {
+        std::lock_guard<std::mutex> lock( g_ldrGlobalsGuard );
+        auto iter = g_ldrGlobals.find( key );
+        if (iter != g_ldrGlobals.end())
+        {
+            _LdrpHashTable = iter->second.hashTable;
+            _LdrpModuleIndexBase = iter->second.moduleIndexBase;
+            cached = true;
+        }
+    }
+
     // Select loader version
     if (_initializedFor == mt_mod32)
     {
         FindLdrHeap<uint32_t>();
-        FindLdrpHashTable<uint32_t>();
-        if (IsWindows8OrGreater())
-            FindLdrpModuleIndexBase<uint32_t>();
+        if (!cached)
+        {
+            FindLdrpHashTable<uint32_t>();
+            if (IsWindows8OrGreater())
+                FindLdrpModuleIndexBase<uint32_t>();
+        }
     }
     else
     {
         FindLdrHeap<uint64_t>();
-        FindLdrpHashTable<uint64_t>();
-        if (IsWindows8OrGreater())
-            FindLdrpModuleIndexBase<uint64_t>();
+        if (!cached)
+        {
+            FindLdrpHashTable<uint64_t>();
+            if (IsWindows8OrGreater())
+                FindLdrpModuleIndexBase<uint64_t>();
+        }
+    }
+
+    // Only complete results are shared
+    if (ntdll && !cached && _LdrpHashTable != 0 && (_LdrpModuleIndexBase != 0 || !IsWindows8OrGreater()))
+    {
+        std::lock_guard<std::mutex> lock( g_ldrGlobalsGuard );
+        g_ldrGlobals[key] = { _LdrpHashTable, _LdrpModuleIndexBase };
     }
 
     _nodeMap.clear();
@@ -76,6 +127,8 @@ bool NtLdr::Init( eModType initFor /*= mt_default*/ )
 /// <returns>true on success</returns>
 bool NtLdr::CreateNTReference( NtLdrEntry& mod )
 {
+    CSLock lck( _lock );
+
     // Skip
     if (mod.flags == Ldr_None)
         return true;
@@ -87,6 +140,9 @@ bool NtLdr::CreateNTReference( NtLdrEntry& mod )
     bool x64Image = (mod.type == mt_mod64);
     bool w8 = IsWindows8OrGreater();
 
+    // List patches are applied together after entry is complete
+    auto tx = _process.memory().BeginWrite();
+
     // Win 8 and higher
     if (w8)
         mod.ldrPtr = CALL_64_86( x64Image, InitW8Node, mod );
@@ -107,23 +163,23 @@ bool NtLdr::CreateNTReference( NtLdrEntry& mod )
     if (mod.flags & Ldr_HashTable)
     {
         auto ptr = FIELD_PTR_64_86( x64Image, mod.ldrPtr, _LDR_DATA_TABLE_ENTRY_BASE_T, HashLinks );
-        CALL_64_86( x64Image, InsertHashNode, ptr, mod.hash );
+        CALL_64_86( x64Image, InsertHashNode, tx, ptr, mod.hash );
     }
 
     // Insert into ldr lists
     if (mod.flags & Ldr_ThdCall || (!w8 && mod.flags & Ldr_ModList))
     {
-        _process.memory().Write( FIELD_PTR_64_86( x64Image, mod.ldrPtr, _LDR_DATA_TABLE_ENTRY_BASE_T, Flags ), 0x80004 );
+        tx.Write( FIELD_PTR_64_86( x64Image, mod.ldrPtr, _LDR_DATA_TABLE_ENTRY_BASE_T, Flags ), 0x80004 );
         ptr_t loadPtr = 0, initptr = 0;
 
         loadPtr = FIELD_PTR_64_86( x64Image, mod.ldrPtr, _LDR_DATA_TABLE_ENTRY_BASE_T, InLoadOrderLinks );
         if(w8)
             initptr = FIELD_PTR_64_86( x64Image, mod.ldrPtr, _LDR_DATA_TABLE_ENTRY_BASE_T, InInitializationOrderLinks );
 
-        CALL_64_86( x64Image, InsertMemModuleNode, 0, loadPtr, initptr );
+        CALL_64_86( x64Image, InsertMemModuleNode, tx, 0, loadPtr, initptr );
     }
 
-    return true;
+    return NT_SUCCESS( tx.Commit() );
 }
 
 /// <summary>
@@ -156,6 +212,8 @@ ptr_t NtLdr::SetNode( ptr_t ptr, Module pModule )
 /// <returns>Status code</returns>
 NTSTATUS NtLdr::AddStaticTLSEntry( NtLdrEntry& mod, ptr_t tlsPtr )
 {
+    CSLock lck( _lock );
+
     bool wxp = IsWindowsXPOrGreater() && !IsWindowsVistaOrGreater();
     ptr_t pNode = _nodeMap.count( mod.baseAddress ) ? _nodeMap[mod.baseAddress] : 0;
 
@@ -163,12 +221,12 @@ NTSTATUS NtLdr::AddStaticTLSEntry( NtLdrEntry& mod, ptr_t tlsPtr )
     ptr_t LdrpHandleTlsData = 0;
     if (mod.type == mt_mod64)
     {
-        LdrpHandleTlsData = g_symbols.LdrpHandleTlsData64;
+        LdrpHandleTlsData = g_symbols->LdrpHandleTlsData64;
         pNode = SetNode<_LDR_DATA_TABLE_ENTRY_BASE64>( pNode, mod.baseAddress );
     }
     else
     {
-        LdrpHandleTlsData = g_symbols.LdrpHandleTlsData32;
+        LdrpHandleTlsData = g_symbols->LdrpHandleTlsData32;
         pNode = SetNode<_LDR_DATA_TABLE_ENTRY_BASE32>( pNode, mod.baseAddress );
     }
 
@@ -235,12 +293,14 @@ NTSTATUS NtLdr::AddStaticTLSEntry( NtLdrEntry& mod, ptr_t tlsPtr )
 /// <returns>true on success</returns>
 bool NtLdr::InsertInvertedFunctionTable( NtLdrEntry& mod )
 { 
-    ptr_t RtlInsertInvertedFunctionTable = g_symbols.RtlInsertInvertedFunctionTable64;
-    ptr_t LdrpInvertedFunctionTable = g_symbols.LdrpInvertedFunctionTable64;
+    CSLock lck( _lock );
+
+    ptr_t RtlInsertInvertedFunctionTable = g_symbols->RtlInsertInvertedFunctionTable64;
+    ptr_t LdrpInvertedFunctionTable = g_symbols->LdrpInvertedFunctionTable64;
     if (mod.type == mt_mod32)
     {
-        RtlInsertInvertedFunctionTable = g_symbols.RtlInsertInvertedFunctionTable32;
-        LdrpInvertedFunctionTable = g_symbols.LdrpInvertedFunctionTable32;
+        RtlInsertInvertedFunctionTable = g_symbols->RtlInsertInvertedFunctionTable32;
+        LdrpInvertedFunctionTable = g_symbols->LdrpInvertedFunctionTable32;
     }
 
     // Invalid addresses. Probably pattern scan has failed
@@ -341,6 +401,59 @@ bool NtLdr::InsertInvertedFunctionTable( NtLdrEntry& mod )
     }
 }
 
+/// <summary>
+/// Point existing LdrpInvertedFunctionTable record of x64 module to new exception directory
+/// </summary>
+/// <param name="mod">Module data</param>
+/// <param name="exceptionDir">Exception directory address</param>
+/// <param name="size">Exception directory size</param>
+/// <returns>true on success</returns>
+bool NtLdr::UpdateInvertedFunctionTable( const NtLdrEntry& mod, ptr_t exceptionDir, uint32_t size )
+{
+    CSLock lck( _lock );
+
+    // x86 records describe SafeSEH handlers, not affected by exception directory
+    ptr_t LdrpInvertedFunctionTable = g_symbols->LdrpInvertedFunctionTable64;
+    if (mod.type != mt_mod64 || LdrpInvertedFunctionTable == 0)
+        return false;
+
+    auto UpdateP = [&]( auto table )
+    {
+        auto& memory = _process.memory();
+        if (!NT_SUCCESS( memory.Read( LdrpInvertedFunctionTable, sizeof( table ), &table ) ))
+            return false;
+
+        for (ULONG i = 0; i < table.Count; i++)
+        {
+            auto& entry = table.Entries[i];
+            if (entry.ImageBase != mod.baseAddress)
+                continue;
+
+            if (entry.ExceptionDirectory == exceptionDir && entry.SizeOfTable == size)
+                return true;
+
+            entry.ExceptionDirectory = exceptionDir;
+            entry.SizeOfTable = size;
+
+            // Table is located in read-only mrdata section since Win10
+            auto offset = reinterpret_cast<uint8_t*>(&entry) - reinterpret_cast<uint8_t*>(&table);
+            DWORD flOld = 0;
+            memory.Protect( LdrpInvertedFunctionTable + offset, sizeof( entry ), PAGE_EXECUTE_READWRITE, &flOld );
+            auto status = memory.Write( LdrpInvertedFunctionTable + offset, sizeof( entry ), &entry );
+            memory.Protect( LdrpInvertedFunctionTable + offset, sizeof( entry ), flOld, &flOld );
+
+            return NT_SUCCESS( status );
+        }
+
+        return false;
+    };
+
+    if (IsWindows8OrGreater())
+        return UpdateP( _RTL_INVERTED_FUNCTION_TABLE8<DWORD64>() );
+    else
+        return UpdateP( _RTL_INVERTED_FUNCTION_TABLE7<DWORD64>() );
+}
+
 /// <summary>
 /// Free static TLS
 /// </summary>
@@ -349,13 +462,15 @@ bool NtLdr::InsertInvertedFunctionTable( NtLdrEntry& mod )
 /// <returns>Status code</returns>
 NTSTATUS NtLdr::UnloadTLS( const NtLdrEntry& mod, bool noThread /*= false*/ )
 {
+    CSLock lck( _lock );
+
     // No loader entry to free
     if (mod.ldrPtr == 0)
         return STATUS_INVALID_ADDRESS;
 
-    ptr_t LdrpReleaseTlsEntry = g_symbols.LdrpReleaseTlsEntry64;
+    ptr_t LdrpReleaseTlsEntry = g_symbols->LdrpReleaseTlsEntry64;
     if (mod.type == mt_mod32)
-        LdrpReleaseTlsEntry = g_symbols.LdrpReleaseTlsEntry32;
+        LdrpReleaseTlsEntry = g_symbols->LdrpReleaseTlsEntry32;
 
     // Not available
     if (LdrpReleaseTlsEntry == 0)
@@ -377,57 +492,50 @@ NTSTATUS NtLdr::UnloadTLS( const NtLdrEntry& mod, bool noThread /*= false*/ )
 }
 
 /// <summary>
-///  Initialize OS-specific module entry
+/// Allocate module entry and fill common fields of its local copy
 /// </summary>
 /// <param name="mod">Module data</param>
-/// <returns>Pointer to created entry</returns>
+/// <param name="entry">Local entry copy</param>
+/// <returns>Pointer to allocated entry</returns>
 template<typename T>
-ptr_t NtLdr::InitBaseNode( NtLdrEntry& mod )
+ptr_t NtLdr::InitBaseNode( NtLdrEntry& mod, _LDR_DATA_TABLE_ENTRY_BASE_T<T>& entry )
 {
-    using EntryType = _LDR_DATA_TABLE_ENTRY_BASE_T<T>;
     ptr_t entryPtr = AllocateInHeap( mod.type, sizeof( _LDR_DATA_TABLE_ENTRY_W8<T> ) ).result( 0 );
     if (entryPtr == 0)
         return 0;
 
     // Allocate space for Unicode string
-    _UNICODE_STRING_T<T> strLocal = { 0 };
     auto mem = _process.memory().Allocate( 0x1000, PAGE_READWRITE, 0, false );
     if (!mem)
         return 0;
 
     auto StringBuf = std::move( mem.result() );
 
-    // entryPtr->DllBase = ModuleBase;
-    _process.memory().Write( fieldPtr( entryPtr, &EntryType::DllBase ), static_cast<T>(mod.baseAddress) );
-
-    // entryPtr->SizeOfImage = ImageSize;
-    _process.memory().Write( fieldPtr( entryPtr, &EntryType::SizeOfImage ), mod.size );
-
-    // entryPtr->EntryPoint = entryPoint;
-    _process.memory().Write( fieldPtr( entryPtr, &EntryType::EntryPoint ), static_cast<T>(mod.entryPoint) );
+    entry.DllBase = static_cast<T>(mod.baseAddress);
+    entry.SizeOfImage = mod.size;
+    entry.EntryPoint = static_cast<T>(mod.entryPoint);
+    entry.LoadCount = 0xFFFF;
 
     // Dll name hash
     mod.hash = HashString( mod.name );
 
-    // Dll name
-    strLocal.Length = static_cast<WORD>(mod.name.length() * sizeof( wchar_t ));
-    strLocal.MaximumLength = 0x600;
-    strLocal.Buffer = StringBuf.ptr<T>();
-    StringBuf.Write( 0, strLocal.Length + 2, mod.name.c_str() );
+    // Dll name at 0, full path at 0x800
+    size_t nameSize = mod.name.length() * sizeof( wchar_t );
+    size_t pathSize = mod.fullPath.length() * sizeof( wchar_t );
+    std::vector<uint8_t> strings( 0x800 + pathSize + sizeof( wchar_t ) );
+    memcpy( strings.data(), mod.name.c_str(), nameSize );
+    memcpy( strings.data() + 0x800, mod.fullPath.c_str(), pathSize );
 
-    // entryPtr->BaseDllName = strLocal;
-    _process.memory().Write( fieldPtr( entryPtr, &EntryType::BaseDllName ), strLocal );
-
-    // Dll full path
-    strLocal.Length = static_cast<WORD>(mod.fullPath.length() * sizeof( wchar_t ));
-    strLocal.Buffer = StringBuf.ptr<T>() + 0x800;
-    StringBuf.Write( 0x800, strLocal.Length + 2, mod.fullPath.c_str() );
+    if (!NT_SUCCESS( StringBuf.Write( 0, strings.size(), strings.data() ) ))
+        return 0;
 
-    // entryPtr->FullDllName = strLocal;
-    _process.memory().Write( fieldPtr( entryPtr, &EntryType::FullDllName ), strLocal );
+    entry.BaseDllName.Length = static_cast<WORD>(nameSize);
+    entry.BaseDllName.MaximumLength = 0x600;
+    entry.BaseDllName.Buffer = StringBuf.ptr<T>();
 
-    // entryPtr->LoadCount = -1;
-    _process.memory().Write( fieldPtr( entryPtr, &EntryType::LoadCount ), strLocal );
+    entry.FullDllName.Length = static_cast<WORD>(pathSize);
+    entry.FullDllName.MaximumLength = 0x600;
+    entry.FullDllName.Buffer = StringBuf.ptr<T>() + 0x800;
 
     return entryPtr;
 }
@@ -443,29 +551,24 @@ ptr_t NtLdr::InitW8Node( NtLdrEntry& mod )
     using EntryType = _LDR_DATA_TABLE_ENTRY_W8<T>;
     using DdagType = _LDR_DDAG_NODE<T>;
 
-    ptr_t entryPtr = InitBaseNode<T>( mod );
+    EntryType entry = { };
+    DdagType ddag = { };
+
+    ptr_t entryPtr = InitBaseNode<T>( mod, entry );
     ptr_t DdagNodePtr = AllocateInHeap( mod.type, sizeof( DdagType ) ).result( 0 );
     if (!entryPtr || !DdagNodePtr)
         return 0;
- 
-    // entryPtr->BaseNameHashValue = hash;
-    _process.memory().Write( fieldPtr( entryPtr, &EntryType::BaseNameHashValue ), mod.hash );
-
-    //
-    // Ddag node
-    //
 
-    // entryPtr->DdagNode = pDdagNode;
-    _process.memory().Write( fieldPtr( entryPtr, &EntryType::DdagNode ), static_cast<T>(DdagNodePtr) );
+    entry.BaseNameHashValue = mod.hash;
+    entry.DdagNode = static_cast<T>(DdagNodePtr);
 
-    // DdagNodePtr->State = LdrModulesReadyToRun;
-    _process.memory().Write( fieldPtr( DdagNodePtr, &DdagType::State ), LdrModulesReadyToRun );
+    ddag.State = LdrModulesReadyToRun;
+    ddag.ReferenceCount = 1;
+    ddag.LoadCount = static_cast<uint32_t>(-1);
 
-    // DdagNodePtr->ReferenceCount = 1;
-    _process.memory().Write( fieldPtr( DdagNodePtr, &DdagType::ReferenceCount ), 1 );
-
-    // DdagNodePtr->LoadCount = -1;
-    _process.memory().Write( fieldPtr( DdagNodePtr, &DdagType::LoadCount ), -1 );
+    if (!NT_SUCCESS( _process.memory().Write( DdagNodePtr, ddag ) ) ||
+        !NT_SUCCESS( _process.memory().Write( entryPtr, entry ) ))
+        return 0;
 
     return entryPtr;
 }
@@ -480,17 +583,18 @@ ptr_t NtLdr::InitW7Node( NtLdrEntry& mod )
 {
     using EntryType = _LDR_DATA_TABLE_ENTRY_W7<T>;
 
-    ptr_t entryPtr = InitBaseNode<T>( mod );
+    EntryType entry = { };
+
+    ptr_t entryPtr = InitBaseNode<T>( mod, entry );
     if (!entryPtr)
         return 0;
 
-    // Forward Links
-    _process.memory().Write( fieldPtr( entryPtr, &EntryType::ForwarderLinks ), fieldPtr( entryPtr, &EntryType::ForwarderLinks ) );
-    _process.memory().Write( fieldPtr( entryPtr, &EntryType::ForwarderLinks ) + sizeof( T ), fieldPtr( entryPtr, &EntryType::ForwarderLinks ) );
+    // Forward and static links point to themselves
+    entry.ForwarderLinks.Flink = entry.ForwarderLinks.Blink = static_cast<T>(fieldPtr( entryPtr, &EntryType::ForwarderLinks ));
+    entry.StaticLinks.Flink = entry.StaticLinks.Blink = static_cast<T>(fieldPtr( entryPtr, &EntryType::StaticLinks ));
 
-    // Static links
-    _process.memory().Write( fieldPtr( entryPtr, &EntryType::StaticLinks ), fieldPtr( entryPtr, &EntryType::StaticLinks ) );
-    _process.memory().Write( fieldPtr( entryPtr, &EntryType::StaticLinks ) + sizeof( T ), fieldPtr( entryPtr, &EntryType::StaticLinks ) );
+    if (!NT_SUCCESS( _process.memory().Write( entryPtr, entry ) ))
+        return 0;
 
     return entryPtr;
 }
@@ -582,7 +686,7 @@ void NtLdr::InsertTreeNode( ptr_t nodePtr, const NtLdrEntry& mod )
 /// <param name="pNodeMemoryOrderLink">InMemoryOrderModuleList link of entry to be inserted</param>
 /// <param name="pNodeLoadOrderLink">InLoadOrderModuleList link of entry to be inserted</param>
 template<typename T>
-void NtLdr::InsertMemModuleNode( ptr_t pNodeMemoryOrderLink, ptr_t pNodeLoadOrderLink, ptr_t pNodeInitOrderLink )
+void NtLdr::InsertMemModuleNode( WriteTransaction& tx, ptr_t pNodeMemoryOrderLink, ptr_t pNodeLoadOrderLink, ptr_t pNodeInitOrderLink )
 {
     ptr_t pPeb = _process.core().peb<T>();
     ptr_t pLdr = 0;
@@ -594,15 +698,15 @@ void NtLdr::InsertMemModuleNode( ptr_t pNodeMemoryOrderLink, ptr_t pNodeLoadOrde
     {
         // pLdr->InMemoryOrderModuleList
         if (pNodeMemoryOrderLink)
-            InsertTailList<T>( fieldPtr( pLdr, &_PEB_LDR_DATA2_T<T>::InMemoryOrderModuleList ), pNodeMemoryOrderLink );
+            InsertTailList<T>( tx, fieldPtr( pLdr, &_PEB_LDR_DATA2_T<T>::InMemoryOrderModuleList ), pNodeMemoryOrderLink );
 
         // pLdr->InLoadOrderModuleList
         if (pNodeLoadOrderLink)
-            InsertTailList<T>( fieldPtr( pLdr, &_PEB_LDR_DATA2_T<T>::InLoadOrderModuleList ), pNodeLoadOrderLink );
+            InsertTailList<T>( tx, fieldPtr( pLdr, &_PEB_LDR_DATA2_T<T>::InLoadOrderModuleList ), pNodeLoadOrderLink );
 
         // pLdr->InInitializationOrderModuleList
         if (pNodeInitOrderLink)
-            InsertTailList<T>( fieldPtr( pLdr, &_PEB_LDR_DATA2_T<T>::InInitializationOrderModuleList ), pNodeInitOrderLink );
+            InsertTailList<T>( tx, fieldPtr( pLdr, &_PEB_LDR_DATA2_T<T>::InInitializationOrderModuleList ), pNodeInitOrderLink );
     }
 }
 
@@ -612,14 +716,14 @@ void NtLdr::InsertMemModuleNode( ptr_t pNodeMemoryOrderLink, ptr_t pNodeLoadOrde
 /// <param name="pNodeLink">Link of entry to be inserted</param>
 /// <param name="hash">Module hash</param>
 template<typename T>
-void NtLdr::InsertHashNode( ptr_t pNodeLink, ULONG hash )
+void NtLdr::InsertHashNode( WriteTransaction& tx, ptr_t pNodeLink, ULONG hash )
 {
     if(pNodeLink)
     {
         // LrpHashTable record
         auto pHashList = _process.memory().Read<T>( _LdrpHashTable + sizeof( _LIST_ENTRY_T<T> )*(hash & 0x1F) );
         if(pHashList)
-            InsertTailList<T>( pHashList.result(), pNodeLink );
+            InsertTailList<T>( tx, pHashList.result(), pNodeLink );
     }
 }
 
@@ -629,20 +733,20 @@ void NtLdr::InsertHashNode( ptr_t pNodeLink, ULONG hash )
 /// <param name="ListHead">List head pointer</param>
 /// <param name="Entry">Entry list link to be inserted</param>
 template<typename T>
-void NtLdr::InsertTailList( ptr_t ListHead, ptr_t Entry )
+void NtLdr::InsertTailList( WriteTransaction& tx, ptr_t ListHead, ptr_t Entry )
 {
     // PrevEntry = ListHead->Blink;
     auto PrevEntry = _process.memory().Read<T>( fieldPtr( ListHead, &_LIST_ENTRY_T<T>::Blink ) ).result( 0 );
 
     // Entry->Flink = ListHead;
     // Entry->Blink = PrevEntry;
-    _process.memory().Write( fieldPtr( Entry, &_LIST_ENTRY_T<T>::Flink ), sizeof(T), &ListHead );
-    _process.memory().Write( fieldPtr( Entry, &_LIST_ENTRY_T<T>::Blink ), sizeof( T ), &PrevEntry );
+    _LIST_ENTRY_T<T> link = { static_cast<T>(ListHead), PrevEntry };
+    tx.Write( Entry, link );
 
     // PrevEntry->Flink = Entry;
     // ListHead->Blink  = Entry;
-    _process.memory().Write( fieldPtr( PrevEntry, &_LIST_ENTRY_T<T>::Flink ), sizeof( T ), &Entry );
-    _process.memory().Write( fieldPtr( ListHead, &_LIST_ENTRY_T<T>::Blink ), sizeof( T ), &Entry );
+    tx.Write( fieldPtr( PrevEntry, &_LIST_ENTRY_T<T>::Flink ), static_cast<T>(Entry) );
+    tx.Write( fieldPtr( ListHead, &_LIST_ENTRY_T<T>::Blink ), static_cast<T>(Entry) );
 }
 
 /// <summary>
@@ -718,12 +822,11 @@ call_result_t<ptr_t> NtLdr::AllocateInHeap( eModType mt, size_t size )
 template<typename T>
 bool NtLdr::FindLdrpHashTable()
 {
-    _PEB_T<T> Peb = { 0 };
-    _process.core().peb( &Peb );
-    if (Peb.ImageBaseAddress == 0)
+    auto Peb = _process.memory().ReadFields<_PEB_T<T>, &_PEB_T<T>::ImageBaseAddress, &_PEB_T<T>::Ldr>( _process.core().peb<T>() );
+    if (!Peb || Peb->ImageBaseAddress == 0)
         return false;
 
-    auto Ldr = _process.memory().Read<_PEB_LDR_DATA2_T<T>>( Peb.Ldr );
+    auto Ldr = _process.memory().Read<_PEB_LDR_DATA2_T<T>>( Peb->Ldr );
     if (!Ldr)
         return false;
 
@@ -733,11 +836,11 @@ bool NtLdr::FindLdrpHashTable()
     if (!NT_SUCCESS( _process.memory().Read( entryPtr, entry ) ))
         return false;
 
-    wchar_t nameBuf[260] = { 0 };
-    if (!NT_SUCCESS( _process.memory().Read( entry.BaseDllName.Buffer, entry.BaseDllName.Length + 2, nameBuf ) ))
+    auto name = _process.memory().ReadUnicodeString( entry.BaseDllName );
+    if (!name)
         return false;
 
-    ULONG NtdllHashIndex = HashString( nameBuf ) & 0x1F;
+    ULONG NtdllHashIndex = HashString( name.result() ) & 0x1F;
     T NtdllBase = static_cast<T>(entry.DllBase);
     T NtdllEndAddress = NtdllBase + entry.SizeOfImage - 1;
 
@@ -773,13 +876,12 @@ bool NtLdr::FindLdrpHashTable()
 template<typename T>
 bool NtLdr::FindLdrpModuleIndexBase()
 {
-    _PEB_T<T> Peb = { 0 };
-    _process.core().peb( &Peb );
+    auto Peb = _process.memory().ReadFields<_PEB_T<T>, &_PEB_T<T>::ImageBaseAddress, &_PEB_T<T>::Ldr>( _process.core().peb<T>() );
 
-    if (Peb.ImageBaseAddress != 0)
+    if (Peb && Peb->ImageBaseAddress != 0)
     {
         T lastNode = 0;
-        auto Ldr = _process.memory().Read<_PEB_LDR_DATA2_T<T>>( Peb.Ldr );
+        auto Ldr = _process.memory().Read<_PEB_LDR_DATA2_T<T>>( Peb->Ldr );
         if (!Ldr)
             return false;
 
@@ -836,20 +938,21 @@ template<typename T>
 bool NtLdr::FindLdrHeap()
 {
     int32_t retries = 50;
-    _PEB_T<T> Peb = { 0 };
+    ptr_t pebPtr = _process.core().peb<T>();
 
-    _process.core().peb<T>( &Peb );
-    for (; Peb.Ldr == 0 && retries > 0; retries--, Sleep( 10 ))
-        _process.core().peb<T>( &Peb );
+    // Only loader pointer is polled
+    auto Peb = _process.memory().ReadFields<_PEB_T<T>, &_PEB_T<T>::Ldr>( pebPtr );
+    for (; (!Peb || Peb->Ldr == 0) && retries > 0; retries--, Sleep( 10 ))
+        Peb = _process.memory().ReadFields<_PEB_T<T>, &_PEB_T<T>::Ldr>( pebPtr );
 
-    if (Peb.Ldr)
+    if (Peb && Peb->Ldr)
     {
-        auto Ldr = _process.memory().Read<_PEB_LDR_DATA2_T<T>>( Peb.Ldr );
+        auto Ldr = _process.memory().Read<_PEB_LDR_DATA2_T<T>>( Peb->Ldr );
         if (!Ldr)
             return false;
 
         for (; Ldr->InMemoryOrderModuleList.Flink == Ldr->InMemoryOrderModuleList.Blink && retries > 0; retries--, Sleep( 10 ))
-            Ldr = _process.memory().Read<_PEB_LDR_DATA2_T<T>>( Peb.Ldr );
+            Ldr = _process.memory().Read<_PEB_LDR_DATA2_T<T>>( Peb->Ldr );
 
         MEMORY_BASIC_INFORMATION64 mbi = { 0 };
         auto NtdllEntry = Ldr->InMemoryOrderModuleList.Flink;
@@ -872,6 +975,8 @@ bool NtLdr::FindLdrHeap()
 /// <returns>true on success</returns>
 bool NtLdr::Unlink( const ModuleData& mod, bool noThread /*= false*/ )
 {
+    CSLock lck( _lock );
+
     ptr_t ldrEntry = 0;
     auto x64Image = mod.type == mt_mod64;
 
@@ -890,6 +995,40 @@ bool NtLdr::Unlink( const ModuleData& mod, bool noThread /*= false*/ )
     return ldrEntry != 0;
 }
 
+/// <summary>
+/// Generate static TLS release instead of running it in separate remote call
+/// </summary>
+/// <param name="a">Target assembly helper</param>
+/// <param name="mod">Target module</param>
+/// <returns>false if module has no loader entry or release routine is not available</returns>
+bool NtLdr::GenUnloadTLS( IAsmHelper& a, const NtLdrEntry& mod )
+{
+    ptr_t LdrpReleaseTlsEntry = mod.type == mt_mod32 ? g_symbols->LdrpReleaseTlsEntry32 : g_symbols->LdrpReleaseTlsEntry64;
+    if (mod.ldrPtr == 0 || LdrpReleaseTlsEntry == 0)
+        return false;
+
+    a.GenCall( LdrpReleaseTlsEntry, { mod.ldrPtr, 0 }, IsWindows8Point1OrGreater() ? cc_fastcall : cc_stdcall );
+    return true;
+}
+
+/// <summary>
+/// Generate module unlink from Ntdll loader instead of running it in separate remote call.
+/// List entries are read at run time, so code remains valid if lists change before it runs
+/// </summary>
+/// <param name="a">Target assembly helper</param>
+/// <param name="mod">Module data</param>
+/// <returns>false if loader entry wasn't found</returns>
+bool NtLdr::GenUnlink( IAsmHelper& a, const ModuleData& mod )
+{
+    CSLock lck( _lock );
+
+    // Reinitialize
+    if (_initializedFor != mod.type)
+        Init( mod.type );
+
+    return CALL_64_86( mod.type == mt_mod64, GenUnlinkEntry, a, mod ) != 0;
+}
+
 /// <summary>
 /// Unlink module from PEB_LDR_DATA
 /// </summary>
@@ -1006,4 +1145,70 @@ ptr_t NtLdr::UnlinkTreeNode( const ModuleData& mod, ptr_t ldrEntry, bool noThrea
     return ldrEntry;
 }
 
+/// <summary>
+/// Generate module unlink from loader lists and module graph
+/// </summary>
+/// <param name="a">Target assembly helper</param>
+/// <param name="mod">Module data</param>
+/// <returns>Address of removed record</returns>
+template<typename T>
+ptr_t NtLdr::GenUnlinkEntry( IAsmHelper& a, const ModuleData& mod )
+{
+    auto ldrEntry = mod.ldrPtr;
+    if (ldrEntry == 0)
+        ldrEntry = FindLdrEntry<T>( mod.baseAddress );
+
+    if (ldrEntry == 0)
+        return 0;
+
+    GenUnlinkListEntry<T>( a, fieldPtr( ldrEntry, &_LDR_DATA_TABLE_ENTRY_BASE_T<T>::InLoadOrderLinks ) );
+    GenUnlinkListEntry<T>( a, fieldPtr( ldrEntry, &_LDR_DATA_TABLE_ENTRY_BASE_T<T>::InMemoryOrderLinks ) );
+    GenUnlinkListEntry<T>( a, fieldPtr( ldrEntry, &_LDR_DATA_TABLE_ENTRY_BASE_T<T>::InInitializationOrderLinks ) );
+    GenUnlinkListEntry<T>( a, fieldPtr( ldrEntry, &_LDR_DATA_TABLE_ENTRY_BASE_T<T>::HashLinks ) );
+
+    if (IsWindows8OrGreater())
+    {
+        auto RtlRbRemoveNode = _process.modules().GetNtdllExport( "RtlRbRemoveNode" );
+        if (!RtlRbRemoveNode)
+            return 0;
+
+        a.GenCall( RtlRbRemoveNode->procAddress,
+        {
+            _LdrpModuleIndexBase,
+            ldrEntry + offsetOf( &_LDR_DATA_TABLE_ENTRY_W8<T>::BaseAddressIndexNode )
+        } );
+    }
+
+    return ldrEntry;
+}
+
+/// <summary>
+/// Generate removal of record from LIST_ENTRY structure
+/// </summary>
+/// <param name="a">Target assembly helper</param>
+/// <param name="pListLink">Entry link</param>
+template<typename T>
+void NtLdr::GenUnlinkListEntry( IAsmHelper& a, ptr_t pListLink )
+{
+    auto skip = a->newLabel();
+    auto blinkOfs = static_cast<int32_t>(offsetOf( &_LIST_ENTRY_T<T>::Blink ));
+
+    a->mov( a->zdx, pListLink );
+    a->mov( a->zax, a->intptr_ptr( a->zdx ) );
+    a->mov( a->zcx, a->intptr_ptr( a->zdx, blinkOfs ) );
+
+    // List is empty
+    a->test( a->zax, a->zax );
+    a->jz( skip );
+    a->test( a->zcx, a->zcx );
+    a->jz( skip );
+    a->cmp( a->zax, a->zcx );
+    a->je( skip );
+
+    // OldFlink->Blink = OldBlink; OldBlink->Flink = OldFlink;
+    a->mov( a->intptr_ptr( a->zax, blinkOfs ), a->zcx );
+    a->mov( a->intptr_ptr( a->zcx ), a->zax );
+    a->bind( skip );
+}
+
 }
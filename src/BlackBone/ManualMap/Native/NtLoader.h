@@ -6,10 +6,13 @@
 #include "../../Include/NativeStructures.h"
 #include "../../Include/Macro.h"
 #include "../../Include/CallResult.h"
+#include "../../Misc/Utils.h"
 
 namespace blackbone
 {
 
+class IAsmHelper;
+
 enum LdrRefFlags
 {
     Ldr_None      = 0x00,   // Do not create any reference
@@ -30,6 +33,9 @@ struct NtLdrEntry : ModuleData
     bool safeSEH = false;
 };
 
+/// <summary>
+/// Native loader structures manipulation. Public routines are serialized internally
+/// </summary>
 class NtLdr
 {
 public:
@@ -67,6 +73,15 @@ public:
     /// <returns>true on success</returns>
     BLACKBONE_API bool InsertInvertedFunctionTable( NtLdrEntry& mod );
 
+    /// <summary>
+    /// Point existing LdrpInvertedFunctionTable record of x64 module to new exception directory
+    /// </summary>
+    /// <param name="mod">Module data</param>
+    /// <param name="exceptionDir">Exception directory address</param>
+    /// <param name="size">Exception directory size</param>
+    /// <returns>true on success</returns>
+    BLACKBONE_API bool UpdateInvertedFunctionTable( const NtLdrEntry& mod, ptr_t exceptionDir, uint32_t size );
+
     /// <summary>
     /// Free static TLS
     /// </summary>
@@ -82,6 +97,23 @@ public:
     /// <param name="noThread">Don't create new threads during unlink</param>
     /// <returns>true on success</returns>
     BLACKBONE_API bool Unlink( const ModuleData& mod, bool noThread = false );
+
+    /// <summary>
+    /// Generate static TLS release instead of running it in separate remote call
+    /// </summary>
+    /// <param name="a">Target assembly helper</param>
+    /// <param name="mod">Target module</param>
+    /// <returns>false if module has no loader entry or release routine is not available</returns>
+    BLACKBONE_API bool GenUnloadTLS( IAsmHelper& a, const NtLdrEntry& mod );
+
+    /// <summary>
+    /// Generate module unlink from Ntdll loader instead of running it in separate remote call.
+    /// List entries are read at run time, so code remains valid if lists change before it runs
+    /// </summary>
+    /// <param name="a">Target assembly helper</param>
+    /// <param name="mod">Module data</param>
+    /// <returns>false if loader entry wasn't found</returns>
+    BLACKBONE_API bool GenUnlink( IAsmHelper& a, const ModuleData& mod );
 private:
 
     /// <summary>
@@ -106,12 +138,13 @@ private:
     bool FindLdrHeap();
 
     /// <summary>
-    ///  Initialize OS-specific module entry
+    /// Allocate module entry and fill common fields of its local copy
     /// </summary>
     /// <param name="mod">Module data</param>
-    /// <returns>Pointer to created entry</returns>
+    /// <param name="entry">Local entry copy</param>
+    /// <returns>Pointer to allocated entry</returns>
     template<typename T>
-    ptr_t InitBaseNode( NtLdrEntry& mod );
+    ptr_t InitBaseNode( NtLdrEntry& mod, _LDR_DATA_TABLE_ENTRY_BASE_T<T>& entry );
 
     /// <summary>
     ///  Initialize OS-specific module entry
@@ -140,26 +173,29 @@ private:
     /// <summary>
     /// Insert entry into LdrpHashTable[]
     /// </summary>
+    /// <param name="tx">Pending link writes</param>
     /// <param name="pNodeLink">Link of entry to be inserted</param>
     /// <param name="hash">Module hash</param>
     template<typename T>
-    void InsertHashNode( ptr_t pNodeLink, ULONG hash );
+    void InsertHashNode( class WriteTransaction& tx, ptr_t pNodeLink, ULONG hash );
 
     /// <summary>
     /// Insert entry into InLoadOrderModuleList and InMemoryOrderModuleList
     /// </summary>
+    /// <param name="tx">Pending link writes</param>
     /// <param name="pNodeMemoryOrderLink">InMemoryOrderModuleList link of entry to be inserted</param>
     /// <param name="pNodeLoadOrderLink">InLoadOrderModuleList link of entry to be inserted</param>
     template<typename T>
-    void InsertMemModuleNode( ptr_t pNodeMemoryOrderLink, ptr_t pNodeLoadOrderLink, ptr_t pNodeInitOrderLink );
+    void InsertMemModuleNode( class WriteTransaction& tx, ptr_t pNodeMemoryOrderLink, ptr_t pNodeLoadOrderLink, ptr_t pNodeInitOrderLink );
 
     /// <summary>
     /// Insert entry into standard double linked list
     /// </summary>
+    /// <param name="tx">Pending link writes</param>
     /// <param name="ListHead">List head pointer</param>
     /// <param name="Entry">Entry list link to be inserted</param>
     template<typename T>
-    void InsertTailList( ptr_t ListHead, ptr_t Entry );
+    void InsertTailList( class WriteTransaction& tx, ptr_t ListHead, ptr_t Entry );
 
     /// <summary>
     /// Hash image name
@@ -219,6 +255,23 @@ private:
     template<typename T>
     ptr_t UnlinkTreeNode( const ModuleData& mod, ptr_t ldrEntry, bool noThread = false );
 
+    /// <summary>
+    /// Generate module unlink from loader lists and module graph
+    /// </summary>
+    /// <param name="a">Target assembly helper</param>
+    /// <param name="mod">Module data</param>
+    /// <returns>Address of removed record</returns>
+    template<typename T>
+    ptr_t GenUnlinkEntry( IAsmHelper& a, const ModuleData& mod );
+
+    /// <summary>
+    /// Generate removal of record from LIST_ENTRY structure
+    /// </summary>
+    /// <param name="a">Target assembly helper</param>
+    /// <param name="pListLink">Entry link</param>
+    template<typename T>
+    void GenUnlinkListEntry( IAsmHelper& a, ptr_t pListLink );
+
     NtLdr( const NtLdr& ) = delete;
     NtLdr& operator =(const NtLdr&) = delete;
 
@@ -231,6 +284,7 @@ private:
 
     eModType _initializedFor = mt_unknown;  // Loader initialization target
     std::map<ptr_t, ptr_t> _nodeMap;        // Allocated native structures
+    CriticalSection _lock;                  // Serializes loader structure updates
 };
 
 }
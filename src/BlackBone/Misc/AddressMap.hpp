@@ -0,0 +1,167 @@
+#pragma once
+
+#include "../Include/Types.h"
+
+#include <vector>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Flat open addressing hash table keyed by address.
+/// Lookup is a single probe sequence over contiguous slots, so it doesn't depend on number of entries.
+/// Address 0 and ~0 are reserved as empty and deleted markers
+/// </summary>
+template<typename T>
+class AddressMap
+{
+    static constexpr ptr_t Empty = 0;
+    static constexpr ptr_t Deleted = ~static_cast<ptr_t>(0);
+
+    struct Slot
+    {
+        ptr_t key = Empty;
+        T value = T();
+    };
+
+public:
+    /// <summary>
+    /// Find value
+    /// </summary>
+    /// <param name="key">Address</param>
+    /// <returns>Value pointer, nullptr if not found</returns>
+    T* find( ptr_t key )
+    {
+        size_t idx = lookup( key );
+        return idx != npos ? &_slots[idx].value : nullptr;
+    }
+
+    const T* find( ptr_t key ) const
+    {
+        return const_cast<AddressMap*>(this)->find( key );
+    }
+
+    bool contains( ptr_t key ) const { return find( key ) != nullptr; }
+
+    /// <summary>
+    /// Insert or replace value
+    /// </summary>
+    /// <param name="key">Address</param>
+    /// <param name="value">Value</param>
+    /// <returns>Stored value</returns>
+    T& insert( ptr_t key, const T& value )
+    {
+        if (auto existing = find( key ))
+            return *existing = value;
+
+        // Keep load factor below 1/2, deleted slots included
+        if ((_used + 1) * 2 > _slots.size())
+            rehash( _size * 4 > 16 ? _size * 4 : 16 );
+
+        size_t idx = index( key );
+        while (_slots[idx].key != Empty && _slots[idx].key != Deleted)
+            idx = (idx + 1) & mask();
+
+        if (_slots[idx].key == Empty)
+            _used++;
+
+        _slots[idx].key = key;
+        _slots[idx].value = value;
+        _size++;
+
+        return _slots[idx].value;
+    }
+
+    /// <summary>
+    /// Remove value
+    /// </summary>
+    /// <param name="key">Address</param>
+    /// <returns>true if value was removed</returns>
+    bool erase( ptr_t key )
+    {
+        size_t idx = lookup( key );
+        if (idx == npos)
+            return false;
+
+        _slots[idx].key = Deleted;
+        _slots[idx].value = T();
+        _size--;
+
+        return true;
+    }
+
+    /// <summary>
+    /// Invoke function for every entry
+    /// </summary>
+    /// <param name="fn">Function receiving address and value</param>
+    template<typename Fn>
+    void for_each( Fn&& fn )
+    {
+        for (auto& slot : _slots)
+            if (slot.key != Empty && slot.key != Deleted)
+                fn( slot.key, slot.value );
+    }
+
+    void clear()
+    {
+        _slots.clear();
+        _size = _used = 0;
+    }
+
+    size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+
+private:
+    static constexpr size_t npos = static_cast<size_t>(-1);
+
+    size_t mask() const { return _slots.size() - 1; }
+
+    /// <summary>
+    /// Get slot index of a key
+    /// </summary>
+    /// <param name="key">Address</param>
+    /// <returns>Slot index, npos if not found</returns>
+    size_t lookup( ptr_t key ) const
+    {
+        if (_slots.empty() || key == Empty || key == Deleted)
+            return npos;
+
+        for (size_t idx = index( key ), i = 0; i < _slots.size(); idx = (idx + 1) & mask(), i++)
+        {
+            if (_slots[idx].key == key)
+                return idx;
+            if (_slots[idx].key == Empty)
+                break;
+        }
+
+        return npos;
+    }
+
+    size_t index( ptr_t key ) const
+    {
+        // Fibonacci hashing spreads aligned addresses
+        return static_cast<size_t>((key * 0x9E3779B97F4A7C15ull) >> 32) & mask();
+    }
+
+    void rehash( size_t capacity )
+    {
+        size_t size = 16;
+        while (size < capacity)
+            size <<= 1;
+
+        std::vector<Slot> old( size );
+        old.swap( _slots );
+        _size = _used = 0;
+
+        for (auto& slot : old)
+            if (slot.key != Empty && slot.key != Deleted)
+                insert( slot.key, slot.value );
+    }
+
+private:
+    std::vector<Slot> _slots;   // Power of 2 slot table
+    size_t _size = 0;           // Live entries
+    size_t _used = 0;           // Live and deleted entries
+};
+
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include "../Include/Winheaders.h"
+
+#include <string>
+#include <vector>
+#include <type_traits>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Sequential binary writer
+/// </summary>
+class BinaryWriter
+{
+public:
+    template<typename T>
+    void put( const T& value )
+    {
+        static_assert(std::is_trivially_copyable_v<T>, "Plain data required");
+        auto ptr = reinterpret_cast<const uint8_t*>(&value);
+        _data.insert( _data.end(), ptr, ptr + sizeof( T ) );
+    }
+
+    void put( const void* data, size_t size )
+    {
+        put( static_cast<uint32_t>(size) );
+        auto ptr = reinterpret_cast<const uint8_t*>(data);
+        _data.insert( _data.end(), ptr, ptr + size );
+    }
+
+    template<typename T>
+    void put( const std::vector<T>& vec )
+    {
+        static_assert(std::is_trivially_copyable_v<T>, "Plain data required");
+        put( vec.data(), vec.size() * sizeof( T ) );
+    }
+
+    void put( const std::string& str )  { put( str.data(), str.size() ); }
+    void put( const std::wstring& str ) { put( str.data(), str.size() * sizeof( wchar_t ) ); }
+
+    std::vector<uint8_t>& data() { return _data; }
+
+private:
+    std::vector<uint8_t> _data;
+};
+
+/// <summary>
+/// Sequential binary reader. Any out of bounds read invalidates the reader
+/// </summary>
+class BinaryReader
+{
+public:
+    BinaryReader( const uint8_t* data, size_t size )
+        : _ptr( data )
+        , _end( data + size ) { }
+
+    template<typename T>
+    bool get( T& value )
+    {
+        static_assert(std::is_trivially_copyable_v<T>, "Plain data required");
+        if (!check( sizeof( T ) ))
+            return false;
+
+        memcpy( &value, _ptr, sizeof( T ) );
+        _ptr += sizeof( T );
+        return true;
+    }
+
+    template<typename C>
+    bool getString( C& str )
+    {
+        uint32_t size = 0;
+        if (!get( size ) || size % sizeof( typename C::value_type ) != 0 || !check( size ))
+            return false;
+
+        str.assign( reinterpret_cast<const typename C::value_type*>(_ptr), size / sizeof( typename C::value_type ) );
+        _ptr += size;
+        return true;
+    }
+
+    template<typename T>
+    bool getVector( std::vector<T>& vec )
+    {
+        static_assert(std::is_trivially_copyable_v<T>, "Plain data required");
+
+        uint32_t size = 0;
+        if (!get( size ) || size % sizeof( T ) != 0 || !check( size ))
+            return false;
+
+        vec.resize( size / sizeof( T ) );
+        if (size != 0)
+            memcpy( vec.data(), _ptr, size );
+
+        _ptr += size;
+        return true;
+    }
+
+    bool getBytes( std::vector<uint8_t>& bytes ) { return getVector( bytes ); }
+
+    bool eof() const { return _ptr == _end; }
+
+private:
+    bool check( size_t size )
+    {
+        if (static_cast<size_t>(_end - _ptr) < size)
+        {
+            _ptr = _end;
+            return false;
+        }
+
+        return true;
+    }
+
+private:
+    const uint8_t* _ptr;
+    const uint8_t* _end;
+};
+
+}
@@ -5,6 +5,7 @@
 #include "Utils.h"
 #include "InitOnce.h"
 
+#include <atomic>
 #include <unordered_map>
 
 namespace blackbone
@@ -72,6 +73,65 @@ public:
 		return pfn ? pfn( std::forward<Args>( args )... ) : std::invoke_result_t<T, Args...>();
     }
 
+    /// <summary>
+    /// Get dll function through per-import slot.
+    /// Slot is filled on first successful lookup, later calls are single acquire load without locking or allocation.
+    /// Missing imports are looked up again on every call, so functions loaded later are picked up
+    /// </summary>
+    /// <param name="name">Function name</param>
+    /// <returns>Function pointer</returns>
+    template<typename T, uint64_t Key>
+    static T cached( const char* name )
+    {
+        auto pfn = ImportSlot<T, Key>::value.load( std::memory_order_acquire );
+        if (pfn)
+            return pfn;
+
+        pfn = Instance().get<T>( name );
+        if (pfn)
+            ImportSlot<T, Key>::value.store( pfn, std::memory_order_release );
+
+        return pfn;
+    }
+
+    /// <summary>
+    /// Call native import if resolved
+    /// </summary>
+    /// <param name="pfn">Function pointer</param>
+    /// <param name="...args">Function args</param>
+    /// <returns>Function result or STATUS_ORDINAL_NOT_FOUND if import not found</returns>
+    template<typename T, typename... Args>
+    static NTSTATUS nativeCall( T pfn, Args&&... args )
+    {
+        return pfn ? pfn( std::forward<Args>( args )... ) : STATUS_ORDINAL_NOT_FOUND;
+    }
+
+    /// <summary>
+    /// Call import if resolved
+    /// </summary>
+    /// <param name="pfn">Function pointer</param>
+    /// <param name="...args">Function args</param>
+    /// <returns>Function result or 0 if import not found</returns>
+    template<typename T, typename... Args>
+    static auto call( T pfn, Args&&... args )
+    {
+        return pfn ? pfn( std::forward<Args>( args )... ) : std::invoke_result_t<T, Args...>();
+    }
+
+    /// <summary>
+    /// FNV-1a hash of import name, used as slot key
+    /// </summary>
+    /// <param name="name">Function name</param>
+    /// <returns>Hash value</returns>
+    static constexpr uint64_t Hash( const char* name )
+    {
+        uint64_t hash = 0xCBF29CE484222325ull;
+        for (; *name; name++)
+            hash = (hash ^ static_cast<uint8_t>(*name)) * 0x100000001B3ull;
+
+        return hash;
+    }
+
     /// <summary>
     /// Load function into database
     /// </summary>
@@ -104,6 +164,16 @@ public:
         return nullptr;
     }
 
+private:
+    /// <summary>
+    /// Resolved function pointer of single import. Constant-initialized, so reading it needs no guard
+    /// </summary>
+    template<typename T, uint64_t Key>
+    struct ImportSlot
+    {
+        static inline std::atomic<T> value{ nullptr };
+    };
+
 private:
     std::unordered_map<std::string, FARPROC> _funcs;    // function database
     CriticalSection _mapGuard;                          // function database guard
@@ -111,8 +181,8 @@ private:
 
 // Syntax sugar
 #define LOAD_IMPORT(name, module) (DynImport::Instance().load( name, module ))
-#define GET_IMPORT(name) (DynImport::Instance().get<fn ## name>( #name ))
-#define SAFE_NATIVE_CALL(name, ...) (DynImport::Instance().safeNativeCall<fn ## name>( #name, __VA_ARGS__ ))
-#define SAFE_CALL(name, ...) (DynImport::Instance().safeCall<fn ## name>( #name, __VA_ARGS__ ))
+#define GET_IMPORT(name) (DynImport::cached<fn ## name, DynImport::Hash( #name )>( #name ))
+#define SAFE_NATIVE_CALL(name, ...) (DynImport::nativeCall( GET_IMPORT( name ), __VA_ARGS__ ))
+#define SAFE_CALL(name, ...) (DynImport::call( GET_IMPORT( name ), __VA_ARGS__ ))
 
 }
\ No newline at end of file
@@ -5,7 +5,6 @@
 #include <3rd_party/VersionApi.h>
 
 #include "DynImport.h"
-#include "../Symbols/SymbolLoader.h"
 #include "NameResolve.h"
 
 #include <string>
@@ -33,9 +32,6 @@ public:
             GrantPriviledge( L"SeLoadDriverPrivilege" );
             LoadFuncs();
 
-            SymbolLoader sl;
-            sl.Load( g_symbols );
-
             NameResolve::Instance().Initialize();
         }
 
@@ -92,8 +88,11 @@ public:
         LOAD_IMPORT( "NtDuplicateObject",                        hNtdll );
         LOAD_IMPORT( "NtQueryObject",                            hNtdll );
         LOAD_IMPORT( "NtQuerySection",                           hNtdll );
+        LOAD_IMPORT( "NtMapViewOfSection",                       hNtdll );
+        LOAD_IMPORT( "NtUnmapViewOfSection",                     hNtdll );
         LOAD_IMPORT( "RtlCreateActivationContext",               hNtdll );
         LOAD_IMPORT( "NtQueryVirtualMemory",                     hNtdll );
+        LOAD_IMPORT( "NtReadVirtualMemory",                      hNtdll );
         LOAD_IMPORT( "NtCreateThreadEx",                         hNtdll );
         LOAD_IMPORT( "NtLockVirtualMemory",                      hNtdll );
         LOAD_IMPORT( "NtSuspendProcess",                         hNtdll );
@@ -105,6 +104,8 @@ public:
         LOAD_IMPORT( "NtOpenEvent",                              hNtdll );
         LOAD_IMPORT( "NtCreateEvent",                            hNtdll );
         LOAD_IMPORT( "NtQueueApcThread",                         hNtdll );
+        LOAD_IMPORT( "NtGetWriteWatch",                          hNtdll );
+        LOAD_IMPORT( "NtResetWriteWatch",                        hNtdll );
         LOAD_IMPORT( "RtlEncodeSystemPointer",                   hNtdll );
         LOAD_IMPORT( "RtlQueueApcWow64Thread",                   hNtdll ); 
         LOAD_IMPORT( "NtWow64QueryInformationProcess64",         hNtdll );
@@ -115,6 +116,9 @@ public:
         LOAD_IMPORT( "Wow64SuspendThread",                       hKernel32 );
         LOAD_IMPORT( "GetProcessDEPPolicy",                      hKernel32 );
         LOAD_IMPORT( "QueryFullProcessImageNameW",               hKernel32 );
+        LOAD_IMPORT( "PssCaptureSnapshot",                       hKernel32 );
+        LOAD_IMPORT( "PssQuerySnapshot",                         hKernel32 );
+        LOAD_IMPORT( "PssFreeSnapshot",                          hKernel32 );
     }
 
 private:
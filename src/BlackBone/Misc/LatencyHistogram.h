@@ -0,0 +1,319 @@
+#pragma once
+
+#include "../Include/Winheaders.h"
+#include "../Include/Macro.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Latency distribution summary, nanoseconds
+/// </summary>
+struct LatencySnapshot
+{
+    uint64_t count = 0;     // Number of recorded operations
+    uint64_t mean = 0;      // Average latency
+    uint64_t p50 = 0;       // Median
+    uint64_t p90 = 0;       // 90th percentile
+    uint64_t p99 = 0;       // 99th percentile
+    uint64_t p999 = 0;      // 99.9th percentile
+    uint64_t max = 0;       // Slowest operation
+};
+
+/// <summary>
+/// Log-linear latency histogram.
+/// Each power of two range is split into 8 linear buckets, so percentiles are reported with at most 12.5% error.
+/// Recording is lock-free and can be done from any thread
+/// </summary>
+class LatencyHistogram
+{
+public:
+    static constexpr uint32_t SubBits = 3;
+    static constexpr uint32_t SubCount = 1 << SubBits;
+    static constexpr uint32_t Groups = 40;                 // Up to ~2^42 ns, larger values land into last bucket
+    static constexpr uint32_t BucketCount = Groups * SubCount;
+
+    /// <summary>
+    /// Record single operation
+    /// </summary>
+    /// <param name="ns">Operation latency, nanoseconds</param>
+    inline void Record( uint64_t ns )
+    {
+        _buckets[Bucket( ns )].fetch_add( 1, std::memory_order_relaxed );
+        _count.fetch_add( 1, std::memory_order_relaxed );
+        _sum.fetch_add( ns, std::memory_order_relaxed );
+
+        for (uint64_t max = _max.load( std::memory_order_relaxed ); ns > max;)
+            if (_max.compare_exchange_weak( max, ns, std::memory_order_relaxed ))
+                break;
+    }
+
+    /// <summary>
+    /// Get latency below which given fraction of operations completed
+    /// </summary>
+    /// <param name="fraction">Fraction, 0.0 - 1.0</param>
+    /// <returns>Bucket upper bound, nanoseconds</returns>
+    inline uint64_t Percentile( double fraction ) const
+    {
+        uint64_t total = 0;
+        std::array<uint64_t, BucketCount> counts;
+        for (uint32_t i = 0; i < BucketCount; i++)
+            total += counts[i] = _buckets[i].load( std::memory_order_relaxed );
+
+        if (total == 0)
+            return 0;
+
+        uint64_t rank = static_cast<uint64_t>(fraction * static_cast<double>(total) + 0.5);
+        rank = rank == 0 ? 1 : (rank > total ? total : rank);
+
+        uint64_t seen = 0;
+        for (uint32_t i = 0; i < BucketCount; i++)
+        {
+            seen += counts[i];
+            if (seen >= rank)
+                return (std::min)( UpperBound( i ), _max.load( std::memory_order_relaxed ) );
+        }
+
+        return _max.load( std::memory_order_relaxed );
+    }
+
+    /// <summary>
+    /// Summarize distribution
+    /// </summary>
+    /// <returns>Summary</returns>
+    inline LatencySnapshot snapshot() const
+    {
+        LatencySnapshot result;
+        result.count = _count.load( std::memory_order_relaxed );
+        result.mean = result.count != 0 ? _sum.load( std::memory_order_relaxed ) / result.count : 0;
+        result.p50 = Percentile( 0.5 );
+        result.p90 = Percentile( 0.9 );
+        result.p99 = Percentile( 0.99 );
+        result.p999 = Percentile( 0.999 );
+        result.max = _max.load( std::memory_order_relaxed );
+
+        return result;
+    }
+
+    /// <summary>
+    /// Drop recorded values
+    /// </summary>
+    inline void reset()
+    {
+        for (auto& bucket : _buckets)
+            bucket.store( 0, std::memory_order_relaxed );
+
+        _count = 0;
+        _sum = 0;
+        _max = 0;
+    }
+
+    /// <summary>
+    /// Get bucket index of a value
+    /// </summary>
+    /// <param name="value">Value</param>
+    /// <returns>Bucket index</returns>
+    static inline uint32_t Bucket( uint64_t value )
+    {
+        if (value < SubCount)
+            return static_cast<uint32_t>(value);
+
+        unsigned long msb = 0;
+#ifdef USE64
+        BitScanReverseT( &msb, value );
+#else
+        if (value >> 32)
+        {
+            BitScanReverseT( &msb, static_cast<unsigned long>(value >> 32) );
+            msb += 32;
+        }
+        else
+            BitScanReverseT( &msb, static_cast<unsigned long>(value) );
+#endif
+
+        uint32_t group = msb - SubBits + 1;
+        if (group >= Groups)
+            return BucketCount - 1;
+
+        uint32_t sub = static_cast<uint32_t>(value >> (msb - SubBits)) & (SubCount - 1);
+        return group * SubCount + sub;
+    }
+
+    /// <summary>
+    /// Get largest value that falls into bucket
+    /// </summary>
+    /// <param name="bucket">Bucket index</param>
+    /// <returns>Upper bound</returns>
+    static inline uint64_t UpperBound( uint32_t bucket )
+    {
+        uint32_t group = bucket / SubCount, sub = bucket % SubCount;
+        if (group == 0)
+            return sub;
+
+        return ((static_cast<uint64_t>(SubCount + sub + 1)) << (group - 1)) - 1;
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, BucketCount> _buckets = { };
+    std::atomic<uint64_t> _count{ 0 };
+    std::atomic<uint64_t> _sum{ 0 };
+    std::atomic<uint64_t> _max{ 0 };
+};
+
+/// <summary>
+/// Timed operation kinds
+/// </summary>
+enum class LatencyOp
+{
+    MemoryRead,         // ProcessMemory::Read
+    RemoteCall,         // RemoteFunction::Call
+    MapImage,           // MMap::MapImage
+    HookDispatch,       // RemoteHook callback
+    DriverRequest,      // DriverControl request
+
+    Count
+};
+
+/// <summary>
+/// Set of latency histograms, one per LatencyOp. Disabled by default.
+/// Histograms are allocated on first enable and live until recorder is destroyed
+/// </summary>
+class LatencyRecorder
+{
+public:
+    using Histograms = std::array<LatencyHistogram, static_cast<size_t>(LatencyOp::Count)>;
+
+    /// <summary>
+    /// Enable or disable recording
+    /// </summary>
+    /// <param name="enable">true to record latencies</param>
+    inline void Enable( bool enable = true )
+    {
+        if (enable)
+        {
+            std::lock_guard<std::mutex> lock( _allocGuard );
+            if (!_storage)
+            {
+                _storage = std::make_unique<Histograms>();
+                _histograms.store( _storage.get(), std::memory_order_release );
+            }
+        }
+
+        _enabled.store( enable, std::memory_order_release );
+    }
+
+    /// <summary>
+    /// Check if recording is enabled
+    /// </summary>
+    /// <returns>true if enabled</returns>
+    inline bool enabled() const { return _enabled.load( std::memory_order_acquire ); }
+
+    /// <summary>
+    /// Get histogram to record into
+    /// </summary>
+    /// <param name="op">Operation</param>
+    /// <returns>Histogram, nullptr if recording is disabled</returns>
+    inline LatencyHistogram* recording( LatencyOp op )
+    {
+        return enabled() ? &(*_histograms.load( std::memory_order_relaxed ))[static_cast<size_t>(op)] : nullptr;
+    }
+
+    /// <summary>
+    /// Summarize recorded latencies of an operation
+    /// </summary>
+    /// <param name="op">Operation</param>
+    /// <returns>Summary, empty if recording was never enabled</returns>
+    inline LatencySnapshot snapshot( LatencyOp op ) const
+    {
+        auto histogram = this->histogram( op );
+        return histogram != nullptr ? histogram->snapshot() : LatencySnapshot();
+    }
+
+    /// <summary>
+    /// Get raw histogram of an operation
+    /// </summary>
+    /// <param name="op">Operation</param>
+    /// <returns>Histogram, nullptr if recording was never enabled</returns>
+    inline const LatencyHistogram* histogram( LatencyOp op ) const
+    {
+        auto histograms = _histograms.load( std::memory_order_acquire );
+        return histograms != nullptr ? &(*histograms)[static_cast<size_t>(op)] : nullptr;
+    }
+
+    /// <summary>
+    /// Drop recorded values
+    /// </summary>
+    inline void reset()
+    {
+        if (auto histograms = _histograms.load( std::memory_order_acquire ))
+        {
+            for (auto& histogram : *histograms)
+                histogram.reset();
+        }
+    }
+
+private:
+    std::atomic<bool> _enabled{ false };
+    std::atomic<Histograms*> _histograms{ nullptr };    // Published histograms, set once
+    std::unique_ptr<Histograms> _storage;               // Histogram storage
+    std::mutex _allocGuard;                             // Guards allocation
+};
+
+/// <summary>
+/// Records scope duration into histogram
+/// </summary>
+class LatencyTimer
+{
+public:
+    /// <summary>
+    /// Start timing
+    /// </summary>
+    /// <param name="histogram">Target histogram, nullptr to skip timing</param>
+    LatencyTimer( LatencyHistogram* histogram )
+        : _histogram( histogram )
+    {
+        if (_histogram)
+            QueryPerformanceCounter( &_start );
+    }
+
+    ~LatencyTimer()
+    {
+        if (!_histogram)
+            return;
+
+        LARGE_INTEGER now;
+        QueryPerformanceCounter( &now );
+
+        uint64_t ticks = static_cast<uint64_t>(now.QuadPart - _start.QuadPart);
+        uint64_t freq = Frequency();
+        _histogram->Record( (ticks / freq) * 1000000000ull + (ticks % freq) * 1000000000ull / freq );
+    }
+
+    LatencyTimer( const LatencyTimer& ) = delete;
+    LatencyTimer& operator =( const LatencyTimer& ) = delete;
+
+private:
+    static inline uint64_t Frequency()
+    {
+        static const uint64_t freq = []()
+        {
+            LARGE_INTEGER value;
+            QueryPerformanceFrequency( &value );
+            return static_cast<uint64_t>(value.QuadPart);
+        }();
+
+        return freq;
+    }
+
+private:
+    LatencyHistogram* _histogram;
+    LARGE_INTEGER _start = { };
+};
+
+}
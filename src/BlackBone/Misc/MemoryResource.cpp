@@ -0,0 +1,31 @@
+#include "MemoryResource.h"
+
+namespace blackbone
+{
+
+namespace
+{
+    thread_local std::pmr::memory_resource* t_transient = nullptr;   // Resource of innermost TransientScope
+}
+
+/// <summary>
+/// Get resource for operation-scoped library buffers
+/// </summary>
+/// <returns>Memory resource</returns>
+std::pmr::memory_resource* TransientResource()
+{
+    return t_transient != nullptr ? t_transient : std::pmr::get_default_resource();
+}
+
+TransientScope::TransientScope( std::pmr::memory_resource* resource )
+    : _previous( t_transient )
+{
+    t_transient = resource;
+}
+
+TransientScope::~TransientScope()
+{
+    t_transient = _previous;
+}
+
+}
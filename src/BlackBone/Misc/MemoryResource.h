@@ -0,0 +1,162 @@
+#pragma once
+
+#include "../Config.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory_resource>
+#include <mutex>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Allocation statistics
+/// </summary>
+struct AllocStats
+{
+    uint64_t allocations = 0;   // Number of allocations
+    uint64_t deallocations = 0; // Number of deallocations
+    uint64_t bytes = 0;         // Total allocated bytes
+    uint64_t live = 0;          // Bytes not yet released
+    uint64_t peak = 0;          // Largest number of live bytes
+};
+
+/// <summary>
+/// Memory resource that counts allocations passed to upstream resource
+/// </summary>
+class CountingResource : public std::pmr::memory_resource
+{
+public:
+    /// <summary>
+    /// Create counter
+    /// </summary>
+    /// <param name="upstream">Resource that does actual allocations</param>
+    CountingResource( std::pmr::memory_resource* upstream = std::pmr::get_default_resource() )
+        : _upstream( upstream ) { }
+
+    /// <summary>
+    /// Get allocation statistics
+    /// </summary>
+    /// <returns>Statistics</returns>
+    inline AllocStats stats() const
+    {
+        AllocStats result;
+        result.allocations = _allocations.load( std::memory_order_relaxed );
+        result.deallocations = _deallocations.load( std::memory_order_relaxed );
+        result.bytes = _bytes.load( std::memory_order_relaxed );
+        result.live = _live.load( std::memory_order_relaxed );
+        result.peak = _peak.load( std::memory_order_relaxed );
+
+        return result;
+    }
+
+    /// <summary>
+    /// Reset counters. Live bytes are kept
+    /// </summary>
+    inline void reset()
+    {
+        _allocations = 0;
+        _deallocations = 0;
+        _bytes = 0;
+        _peak = _live.load();
+    }
+
+private:
+    void* do_allocate( size_t bytes, size_t align ) override
+    {
+        void* ptr = _upstream->allocate( bytes, align );
+
+        _allocations.fetch_add( 1, std::memory_order_relaxed );
+        _bytes.fetch_add( bytes, std::memory_order_relaxed );
+
+        uint64_t live = _live.fetch_add( bytes, std::memory_order_relaxed ) + bytes;
+        for (uint64_t peak = _peak.load( std::memory_order_relaxed ); live > peak;)
+            if (_peak.compare_exchange_weak( peak, live, std::memory_order_relaxed ))
+                break;
+
+        return ptr;
+    }
+
+    void do_deallocate( void* ptr, size_t bytes, size_t align ) override
+    {
+        _upstream->deallocate( ptr, bytes, align );
+
+        _deallocations.fetch_add( 1, std::memory_order_relaxed );
+        _live.fetch_sub( bytes, std::memory_order_relaxed );
+    }
+
+    bool do_is_equal( const std::pmr::memory_resource& other ) const noexcept override
+    {
+        return this == &other;
+    }
+
+private:
+    std::pmr::memory_resource* _upstream;
+    std::atomic<uint64_t> _allocations{ 0 };
+    std::atomic<uint64_t> _deallocations{ 0 };
+    std::atomic<uint64_t> _bytes{ 0 };
+    std::atomic<uint64_t> _live{ 0 };
+    std::atomic<uint64_t> _peak{ 0 };
+};
+
+/// <summary>
+/// Serializes access to resource that isn't thread-safe, e.g. monotonic arena shared by worker threads
+/// </summary>
+class LockedResource : public std::pmr::memory_resource
+{
+public:
+    LockedResource( std::pmr::memory_resource* upstream )
+        : _upstream( upstream ) { }
+
+private:
+    void* do_allocate( size_t bytes, size_t align ) override
+    {
+        std::lock_guard<std::mutex> lock( _guard );
+        return _upstream->allocate( bytes, align );
+    }
+
+    void do_deallocate( void* ptr, size_t bytes, size_t align ) override
+    {
+        std::lock_guard<std::mutex> lock( _guard );
+        _upstream->deallocate( ptr, bytes, align );
+    }
+
+    bool do_is_equal( const std::pmr::memory_resource& other ) const noexcept override
+    {
+        return this == &other;
+    }
+
+private:
+    std::pmr::memory_resource* _upstream;
+    std::mutex _guard;
+};
+
+/// <summary>
+/// Get resource for operation-scoped library buffers: image staging copies, call argument buffers, custom init arguments.
+/// Calling thread TransientScope resource if any, std::pmr::get_default_resource() otherwise.
+/// Long-living caches (module lists, export and import tables) always use default allocator
+/// </summary>
+/// <returns>Memory resource</returns>
+BLACKBONE_API std::pmr::memory_resource* TransientResource();
+
+/// <summary>
+/// Routes operation-scoped buffers created by calling thread into given resource for the scope lifetime,
+/// e.g. into arena released once MapImage returns. Scopes can be nested.
+/// Objects that own such buffers (AsmVariant, CustomArgs_t) must not outlive the resource.
+/// MapImage with ParallelDeps stages images on worker threads, resource must be thread-safe in this case
+/// </summary>
+class TransientScope
+{
+public:
+    BLACKBONE_API TransientScope( std::pmr::memory_resource* resource );
+    BLACKBONE_API ~TransientScope();
+
+    TransientScope( const TransientScope& ) = delete;
+    TransientScope& operator =( const TransientScope& ) = delete;
+
+private:
+    std::pmr::memory_resource* _previous;
+};
+
+}
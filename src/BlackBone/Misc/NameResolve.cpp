@@ -12,6 +12,167 @@
 namespace blackbone
 {
 
+/// <summary>
+/// Build table from api set names and their hosts
+/// </summary>
+/// <param name="sets">Api set names and hosts</param>
+/// <param name="stripPrefix">Ignore 'api-' and 'ext-' prefixes, pre Win10 schema stores names without them</param>
+void ApiSetTable::Build( const std::vector<std::pair<std::wstring, std::vector<std::wstring>>>& sets, bool stripPrefix )
+{
+    _stripPrefix = stripPrefix;
+    _pool.clear();
+    _hosts.clear();
+    _entries.clear();
+    _slots.clear();
+
+    // Views point into pool and host array, so both are allocated once
+    size_t poolSize = 0, hostCount = 0;
+    for (const auto& set : sets)
+    {
+        poolSize += set.first.size();
+        hostCount += set.second.size();
+
+        for (const auto& host : set.second)
+            poolSize += host.size();
+    }
+
+    _pool.reserve( poolSize );
+    _hosts.reserve( hostCount );
+    _entries.reserve( sets.size() );
+
+    auto intern = [this]( std::wstring_view str )
+    {
+        size_t offset = _pool.size();
+        _pool.append( str );
+        return std::wstring_view( _pool.data() + offset, str.size() );
+    };
+
+    wchar_t buf[MaxName] = { 0 };
+    for (const auto& set : sets)
+    {
+        auto name = Canonicalize( set.first, buf );
+        if (name.empty())
+            continue;
+
+        Entry entry;
+        entry.name = intern( name );
+        entry.hosts.first = _hosts.data() + _hosts.size();
+        entry.hosts.count = set.second.size();
+
+        for (const auto& host : set.second)
+            _hosts.emplace_back( intern( host ) );
+
+        _entries.emplace_back( entry );
+    }
+
+    // Load factor is kept under 0.5
+    size_t slotCount = 16;
+    while (slotCount < _entries.size() * 2)
+        slotCount *= 2;
+
+    _slots.assign( slotCount, 0 );
+    for (size_t i = 0; i < _entries.size(); i++)
+    {
+        for (size_t idx = Hash( _entries[i].name ) & (slotCount - 1);; idx = (idx + 1) & (slotCount - 1))
+        {
+            // Versions that differ only in minor number map to the first one
+            if (_slots[idx] != 0 && _entries[_slots[idx] - 1].name == _entries[i].name)
+                break;
+
+            if (_slots[idx] == 0)
+            {
+                _slots[idx] = static_cast<uint32_t>(i + 1);
+                break;
+            }
+        }
+    }
+}
+
+/// <summary>
+/// Find api set hosts
+/// </summary>
+/// <param name="name">Dll name or path, any case, with or without extension and minor version</param>
+/// <returns>Api set hosts, nullptr if name isn't an api set</returns>
+const ApiSetTable::Hosts* ApiSetTable::Find( std::wstring_view name ) const
+{
+    if (_slots.empty())
+        return nullptr;
+
+    wchar_t buf[MaxName];
+    auto key = Canonicalize( name, buf );
+    if (key.empty())
+        return nullptr;
+
+    const size_t mask = _slots.size() - 1;
+    for (size_t idx = Hash( key ) & mask; _slots[idx] != 0; idx = (idx + 1) & mask)
+    {
+        const auto& entry = _entries[_slots[idx] - 1];
+        if (entry.name == key)
+            return &entry.hosts;
+    }
+
+    return nullptr;
+}
+
+/// <summary>
+/// Canonical api set name: lowercase file name without extension and minor version
+/// </summary>
+/// <param name="name">Dll name or path</param>
+/// <param name="buf">Output buffer, MaxName characters</param>
+/// <returns>Canonical name inside output buffer, empty if name is too long</returns>
+std::wstring_view ApiSetTable::Canonicalize( std::wstring_view name, wchar_t* buf ) const
+{
+    auto pos = name.find_last_of( L"\\/" );
+    if (pos != name.npos)
+        name.remove_prefix( pos + 1 );
+
+    if (name.empty() || name.size() > MaxName)
+        return std::wstring_view();
+
+    for (size_t i = 0; i < name.size(); i++)
+        buf[i] = static_cast<wchar_t>(towlower( name[i] ));
+
+    std::wstring_view result( buf, name.size() );
+    if (result.size() > 4 && result.substr( result.size() - 4 ) == L".dll")
+        result.remove_suffix( 4 );
+
+    if (_stripPrefix && (result.substr( 0, 4 ) == L"api-" || result.substr( 0, 4 ) == L"ext-"))
+        result.remove_prefix( 4 );
+
+    // 'l1-2-0' -> 'l1-2'. Win10 schema names already come without minor version
+    auto isNumber = []( std::wstring_view str )
+    {
+        return !str.empty() && std::all_of( str.begin(), str.end(), []( wchar_t c ) { return c >= L'0' && c <= L'9'; } );
+    };
+
+    auto last = result.rfind( L'-' );
+    if (last != result.npos && last > 0)
+    {
+        auto prev = result.rfind( L'-', last - 1 );
+        if (prev != result.npos && isNumber( result.substr( last + 1 ) ) && isNumber( result.substr( prev + 1, last - prev - 1 ) ))
+            result = result.substr( 0, last );
+    }
+
+    return result;
+}
+
+/// <summary>
+/// FNV-1a hash
+/// </summary>
+/// <param name="name">Canonical name</param>
+/// <returns>Hash</returns>
+uint32_t ApiSetTable::Hash( std::wstring_view name )
+{
+    uint32_t hash = 2166136261u;
+    for (auto c : name)
+    {
+        hash ^= static_cast<uint32_t>(c);
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
 NameResolve& NameResolve::Instance()
 {
     static NameResolve instance;
@@ -56,6 +217,9 @@ bool blackbone::NameResolve::InitializeP()
     PEB_T *ppeb = reinterpret_cast<PEB_T*>(reinterpret_cast<TEB_T*>(NtCurrentTeb())->ProcessEnvironmentBlock);
     PApiSetMap pSetMap = reinterpret_cast<PApiSetMap>(ppeb->ApiSetMap);
 
+    std::vector<std::pair<std::wstring, std::vector<std::wstring>>> sets;
+    sets.reserve( pSetMap->Count );
+
     for (DWORD i = 0; i < pSetMap->Count; i++)
     {
         PApiSetEntry pDescriptor = pSetMap->entry(i);
@@ -64,7 +228,6 @@ bool blackbone::NameResolve::InitializeP()
         wchar_t dllName[MAX_PATH] = { 0 };
 
         auto nameSize = pSetMap->apiName( pDescriptor, dllName );
-        std::transform( dllName, dllName + nameSize / sizeof( wchar_t ), dllName, ::towlower );
 
         PHostArray pHostData = pSetMap->valArray( pDescriptor );
 
@@ -80,9 +243,11 @@ bool blackbone::NameResolve::InitializeP()
                 vhosts.emplace_back( std::move( hostName ) );
         }
 
-        _apiSchema.emplace( dllName, std::move( vhosts ) );
+        sets.emplace_back( std::wstring( dllName, nameSize / sizeof( wchar_t ) ), std::move( vhosts ) );
     }
 
+    // Pre Win10 schema stores names without 'api-' prefix
+    _apiSchema.Build( sets, !IsWindows10OrGreater() );
     return true;
 }
 
@@ -95,6 +260,7 @@ bool blackbone::NameResolve::InitializeP()
 /// <param name="flags">Resolve flags</param>
 /// <param name="procID">Process ID. Used to search process executable directory</param>
 /// <param name="actx">Activation context</param>
+/// <param name="manifest">Identity of activation context manifest. SxS results are cached per manifest, empty string disables caching for valid 'actx'</param>
 /// <returns>Status</returns>
 NTSTATUS NameResolve::ResolvePath( 
     std::wstring& path, 
@@ -102,37 +268,24 @@ NTSTATUS NameResolve::ResolvePath(
     const std::wstring& searchDir,
     eResolveFlag flags, 
     Process& proc,
-    HANDLE actx /*= INVALID_HANDLE_VALUE*/ 
+    HANDLE actx /*= INVALID_HANDLE_VALUE*/,
+    const std::wstring& manifest /*= std::wstring()*/
     )
 {
     NTSTATUS status = STATUS_SUCCESS;
-    wchar_t tmpPath[4096] = { 0 };
-    std::wstring completePath;
-
-    path = Utils::ToLower( std::move( path ) );
-
-    // Leave only file name
-    std::wstring filename = Utils::StripPath( path );
-
-    // 'ext-ms-' are resolved the same way 'api-ms-' are
-    if (!IsWindows10OrGreater() && filename.find( L"ext-ms-" ) == 0)
-        filename.erase( 0, 4 );
 
     //
     // ApiSchema redirection
     //
-    auto iter = std::find_if( _apiSchema.begin(), _apiSchema.end(), [&filename]( const auto& val ) { 
-        return filename.find( val.first.c_str() ) != filename.npos; } );
-
-    if (iter != _apiSchema.end())
+    if (auto hosts = _apiSchema.Find( path ))
     {
         // Select appropriate api host
-        if (!iter->second.empty())
-            path = iter->second.front() != baseName ? iter->second.front() : iter->second.back();
+        if (!hosts->empty())
+            path = hosts->front() != baseName ? hosts->front() : hosts->back();
         else
             path = baseName;
 
-        status = ProbeSxSRedirect( path, proc, actx );
+        status = ProbeSxSRedirect( path, proc, actx, manifest );
         if (NT_SUCCESS( status ) || status == STATUS_SXS_IDENTITIES_DIFFERENT)
         {
             return status;
@@ -151,8 +304,81 @@ NTSTATUS NameResolve::ResolvePath(
     if (flags & ApiSchemaOnly)
         return STATUS_NOT_FOUND;
 
+    path = Utils::ToLower( std::move( path ) );
+
+    // Results depend on SxS context, search directories and process identity.
+    // Process is identified by pid and creation time, so reused pid never matches
+    std::wstring key;
+    bool cached = true;
+    if (!manifest.empty())
+        key = L"m:" + manifest;
+    else if (actx == INVALID_HANDLE_VALUE)
+        key = L"-";
+    else if (actx == NULL)
+        key = L"0";
+    else
+        cached = false;
+
+    if (cached)
+    {
+        FILETIME created = { 0 }, unused = { 0 };
+        GetProcessTimes( proc.core().handle(), &created, &unused, &unused, &unused );
+
+        key += L'|' + std::to_wstring( proc.core().pid() ) + L':' + std::to_wstring( created.dwHighDateTime ) + L':' + std::to_wstring( created.dwLowDateTime );
+        key += L'|' + std::to_wstring( (flags & (NoSearch | Wow64)) | (proc.barrier().mismatch ? 0x100 : 0) );
+        key += L'|' + Utils::ToLower( searchDir );
+        key += L'|' + path;
+
+        CSLock lck( _pathLock );
+        auto iter = _pathCache.find( key );
+        if (iter != _pathCache.end())
+        {
+            if (NT_SUCCESS( iter->second.first ))
+                path = iter->second.second;
+
+            return iter->second.first;
+        }
+    }
+
+    status = SearchImage( path, searchDir, flags, proc, actx, manifest );
+
+    if (cached)
+    {
+        CSLock lck( _pathLock );
+        _pathCache.emplace( std::move( key ), std::make_pair( status, NT_SUCCESS( status ) ? path : std::wstring() ) );
+    }
+
+    return status;
+}
+
+/// <summary>
+/// Resolve image path through SxS and loader search order. No caching
+/// </summary>
+/// <param name="path">Lowercase image path</param>
+/// <param name="searchDir">Directory where source image is located</param>
+/// <param name="flags">Resolve flags</param>
+/// <param name="proc">Process. Used to search process executable directory</param>
+/// <param name="actx">Activation context</param>
+/// <param name="manifest">Identity of activation context manifest</param>
+/// <returns>Status</returns>
+NTSTATUS NameResolve::SearchImage(
+    std::wstring& path,
+    const std::wstring& searchDir,
+    eResolveFlag flags,
+    Process& proc,
+    HANDLE actx,
+    const std::wstring& manifest
+    )
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    wchar_t tmpPath[4096] = { 0 };
+    std::wstring completePath;
+
+    // Leave only file name
+    std::wstring filename = Utils::StripPath( path );
+
     // SxS redirection
-    status = ProbeSxSRedirect( path, proc, actx );
+    status = ProbeSxSRedirect( path, proc, actx, manifest );
     if (NT_SUCCESS( status ) || status == STATUS_SXS_IDENTITIES_DIFFERENT)
         return status;
 
@@ -297,9 +523,48 @@ NTSTATUS NameResolve::ResolvePath(
 /// <param name="path">Image path.</param>
 /// <param name="proc">Process. Used to search process executable directory</param>
 /// <param name="actx">Activation context</param>
+/// <param name="manifest">Identity of activation context manifest. SxS results are cached per manifest, empty string disables caching for valid 'actx'</param>
 /// <returns></returns>
-NTSTATUS NameResolve::ProbeSxSRedirect( std::wstring& path, Process& proc, HANDLE actx /*= INVALID_HANDLE_VALUE*/ )
+NTSTATUS NameResolve::ProbeSxSRedirect( 
+    std::wstring& path, 
+    Process& proc, 
+    HANDLE actx /*= INVALID_HANDLE_VALUE*/, 
+    const std::wstring& manifest /*= std::wstring()*/ 
+    )
 {
+    // Images without manifest share the same context, so their results are cached as well
+    std::wstring key;
+    bool cached = true;
+    if (!manifest.empty())
+        key = L"m:" + manifest;
+    else if (actx == INVALID_HANDLE_VALUE)
+        key = L"-";
+    else if (actx == NULL)
+        key = L"0";
+    else
+        cached = false;
+
+    if (cached)
+    {
+        key += L'|';
+        key += Utils::ToLower( path );
+
+        CSLock lck( _sxsLock );
+        auto iter = _sxsCache.find( key );
+        if (iter != _sxsCache.end())
+        {
+            if (iter->second.first != STATUS_SUCCESS)
+                return iter->second.first;
+
+            // Arch mismatch, local SxS redirection is incorrect
+            if (proc.barrier().mismatch)
+                return STATUS_SXS_IDENTITIES_DIFFERENT;
+
+            path = iter->second.second;
+            return STATUS_SUCCESS;
+        }
+    }
+
     UNICODE_STRING OriginalName = { 0 };
     UNICODE_STRING DllName1 = { 0 };
     UNICODE_STRING DllName2 = { 0 };
@@ -331,6 +596,12 @@ NTSTATUS NameResolve::ProbeSxSRedirect( std::wstring& path, Process& proc, HANDL
     if (cookie != 0 && actx != INVALID_HANDLE_VALUE)
         DeactivateActCtx( 0, cookie );
 
+    if (cached)
+    {
+        CSLock lck( _sxsLock );
+        _sxsCache.emplace( key, std::make_pair( status, status == STATUS_SUCCESS ? std::wstring( pPath->Buffer ) : std::wstring() ) );
+    }
+
     if (status == STATUS_SUCCESS)
     {
         // Arch mismatch, local SxS redirection is incorrect
@@ -348,6 +619,37 @@ NTSTATUS NameResolve::ProbeSxSRedirect( std::wstring& path, Process& proc, HANDL
     return status;
 }
 
+/// <summary>
+/// Drop cached SxS redirection results, e.g. after manifest files were changed
+/// </summary>
+void NameResolve::ClearSxSCache()
+{
+    CSLock lck( _sxsLock );
+    _sxsCache.clear();
+
+    // Resolved paths include SxS results
+    ClearPathCache();
+}
+
+/// <summary>
+/// Check if name refers to api set and needs to be resolved into host name. Doesn't allocate
+/// </summary>
+/// <param name="name">Dll name or path, any case</param>
+/// <returns>true if name is an api set</returns>
+bool NameResolve::IsApiSet( std::wstring_view name ) const
+{
+    return _apiSchema.Find( name ) != nullptr;
+}
+
+/// <summary>
+/// Drop cached path resolution results, e.g. after files were added to search directories
+/// </summary>
+void NameResolve::ClearPathCache()
+{
+    CSLock lck( _pathLock );
+    _pathCache.clear();
+}
+
 /// <summary>
 /// Gets the process executable directory
 /// </summary>
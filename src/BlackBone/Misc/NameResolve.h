@@ -2,18 +2,83 @@
 
 #include "../Include/Winheaders.h"
 #include "../Include/Types.h"
+#include "../Misc/Utils.h"
 
 #include <unordered_map>
 #include <vector>
 #include <string>
+#include <string_view>
 
 namespace blackbone
 {
 
+/// <summary>
+/// Immutable api set schema lookup table.
+/// Names are interned in a single lowercase pool and found through open addressing hash,
+/// so lookups don't allocate
+/// </summary>
+class ApiSetTable
+{
+public:
+    // Longest api set name, longer names can't be api sets
+    static constexpr size_t MaxName = 128;
+
+    /// <summary>
+    /// Api set hosts
+    /// </summary>
+    struct Hosts
+    {
+        const std::wstring_view* first = nullptr;
+        size_t count = 0;
+
+        bool empty() const { return count == 0; }
+        const std::wstring_view& front() const { return first[0]; }
+        const std::wstring_view& back() const { return first[count - 1]; }
+    };
+
+    /// <summary>
+    /// Build table from api set names and their hosts
+    /// </summary>
+    /// <param name="sets">Api set names and hosts</param>
+    /// <param name="stripPrefix">Ignore 'api-' and 'ext-' prefixes, pre Win10 schema stores names without them</param>
+    void Build( const std::vector<std::pair<std::wstring, std::vector<std::wstring>>>& sets, bool stripPrefix );
+
+    /// <summary>
+    /// Find api set hosts
+    /// </summary>
+    /// <param name="name">Dll name or path, any case, with or without extension and minor version</param>
+    /// <returns>Api set hosts, nullptr if name isn't an api set</returns>
+    const Hosts* Find( std::wstring_view name ) const;
+
+    bool empty() const { return _entries.empty(); }
+
+private:
+    /// <summary>
+    /// Canonical api set name: lowercase file name without extension and minor version
+    /// </summary>
+    /// <param name="name">Dll name or path</param>
+    /// <param name="buf">Output buffer, MaxName characters</param>
+    /// <returns>Canonical name inside output buffer, empty if name is too long</returns>
+    std::wstring_view Canonicalize( std::wstring_view name, wchar_t* buf ) const;
+
+    static uint32_t Hash( std::wstring_view name );
+
+private:
+    struct Entry
+    {
+        std::wstring_view name;
+        Hosts hosts;
+    };
+
+    std::wstring _pool;                     // Interned names
+    std::vector<std::wstring_view> _hosts;  // Host names, grouped by api set
+    std::vector<Entry> _entries;            // Api sets
+    std::vector<uint32_t> _slots;           // Hash slots, entry index + 1, 0 if empty
+    bool _stripPrefix = false;              // Ignore 'api-' and 'ext-' prefixes
+};
+
 class NameResolve
 {
-    using mapApiSchema = std::unordered_map<std::wstring, std::vector<std::wstring>>;
-   
 public:
     enum eResolveFlag
     {
@@ -44,6 +109,7 @@ public:
     /// <param name="flags">Resolve flags</param>
     /// <param name="proc">Process. Used to search process executable directory</param>
     /// <param name="actx">Activation context</param>
+    /// <param name="manifest">Identity of activation context manifest. SxS results are cached per manifest, empty string disables caching for valid 'actx'</param>
     /// <returns>Status</returns>
     BLACKBONE_API NTSTATUS ResolvePath( 
         std::wstring& path,
@@ -51,17 +117,41 @@ public:
         const std::wstring& searchDir,
         eResolveFlag flags,
         class Process& proc,
-        HANDLE actx = INVALID_HANDLE_VALUE
+        HANDLE actx = INVALID_HANDLE_VALUE,
+        const std::wstring& manifest = std::wstring()
         );
 
+    /// <summary>
+    /// Check if name refers to api set and needs to be resolved into host name. Doesn't allocate
+    /// </summary>
+    /// <param name="name">Dll name or path, any case</param>
+    /// <returns>true if name is an api set</returns>
+    BLACKBONE_API bool IsApiSet( std::wstring_view name ) const;
+
     /// <summary>
     /// Try SxS redirection
     /// </summary>
     /// <param name="path">Image path.</param>
     /// <param name="proc">Process. Used to search process executable directory</param>
     /// <param name="actx">Activation context</param>
+    /// <param name="manifest">Identity of activation context manifest. SxS results are cached per manifest, empty string disables caching for valid 'actx'</param>
     /// <returns></returns>
-    BLACKBONE_API NTSTATUS ProbeSxSRedirect( std::wstring& path, class Process& proc, HANDLE actx = INVALID_HANDLE_VALUE );
+    BLACKBONE_API NTSTATUS ProbeSxSRedirect( 
+        std::wstring& path, 
+        class Process& proc, 
+        HANDLE actx = INVALID_HANDLE_VALUE, 
+        const std::wstring& manifest = std::wstring() 
+        );
+
+    /// <summary>
+    /// Drop cached SxS redirection results, e.g. after manifest files were changed
+    /// </summary>
+    BLACKBONE_API void ClearSxSCache();
+
+    /// <summary>
+    /// Drop cached path resolution results, e.g. after files were added to search directories
+    /// </summary>
+    BLACKBONE_API void ClearPathCache();
 
 private:
     // Ensure singleton
@@ -76,6 +166,25 @@ private:
     /// <returns>Process executable directory</returns>
     std::wstring GetProcessDirectory( DWORD pid );
 
+    /// <summary>
+    /// Resolve image path through SxS and loader search order. No caching
+    /// </summary>
+    /// <param name="path">Lowercase image path</param>
+    /// <param name="searchDir">Directory where source image is located</param>
+    /// <param name="flags">Resolve flags</param>
+    /// <param name="proc">Process. Used to search process executable directory</param>
+    /// <param name="actx">Activation context</param>
+    /// <param name="manifest">Identity of activation context manifest</param>
+    /// <returns>Status</returns>
+    NTSTATUS SearchImage(
+        std::wstring& path,
+        const std::wstring& searchDir,
+        eResolveFlag flags,
+        class Process& proc,
+        HANDLE actx,
+        const std::wstring& manifest
+        );
+
     /// <summary>
     /// OS dependent api set initialization
     /// </summary>
@@ -84,7 +193,11 @@ private:
     bool InitializeP();
 
 private:
-    mapApiSchema _apiSchema;    // Api schema table
+    ApiSetTable _apiSchema;     // Api schema table
+    std::unordered_map<std::wstring, std::pair<NTSTATUS, std::wstring>> _sxsCache;  // SxS results by manifest and image name
+    CriticalSection _sxsLock;   // SxS cache lock
+    std::unordered_map<std::wstring, std::pair<NTSTATUS, std::wstring>> _pathCache;  // Resolved paths by context and image name
+    CriticalSection _pathLock;  // Path cache lock
 };
 
 
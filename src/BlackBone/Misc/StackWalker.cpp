@@ -0,0 +1,219 @@
+#include "StackWalker.h"
+
+#include <algorithm>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Look up address
+/// </summary>
+/// <param name="address">Address</param>
+/// <param name="executable">Set to true if address is inside executable region</param>
+/// <returns>true if address is inside cached region</returns>
+bool ExecRangeCache::Find( ptr_t address, bool& executable )
+{
+    CSLock lck( _lock );
+
+    auto iter = std::upper_bound( _ranges.begin(), _ranges.end(), address, []( ptr_t addr, const Range& range ) { return addr < range.start; } );
+    if (iter == _ranges.begin())
+        return false;
+
+    --iter;
+    if (address >= iter->end)
+        return false;
+
+    executable = iter->executable;
+    return true;
+}
+
+/// <summary>
+/// Cache region
+/// </summary>
+/// <param name="base">Region base</param>
+/// <param name="size">Region size</param>
+/// <param name="executable">Region contains code</param>
+void ExecRangeCache::Add( ptr_t base, ptr_t size, bool executable )
+{
+    if (size == 0)
+        return;
+
+    CSLock lck( _lock );
+
+    Range range = { base, base + size, executable };
+
+    // Replace overlapping regions, they are outdated
+    auto first = std::lower_bound( _ranges.begin(), _ranges.end(), range.start, []( const Range& r, ptr_t addr ) { return r.end <= addr; } );
+    auto last = first;
+    while (last != _ranges.end() && last->start < range.end)
+        ++last;
+
+    first = _ranges.erase( first, last );
+    _ranges.insert( first, range );
+}
+
+/// <summary>
+/// Drop all regions, e.g. after module load or unload
+/// </summary>
+void ExecRangeCache::clear()
+{
+    CSLock lck( _lock );
+    _ranges.clear();
+}
+
+/// <summary>
+/// Stack walker
+/// </summary>
+/// <param name="cache">Region cache, can outlive single walk</param>
+/// <param name="wordSize">Stack slot size</param>
+/// <param name="markBit">Bit cleared from slot values before they are checked</param>
+/// <param name="minAddr">Lowest code address</param>
+/// <param name="maxAddr">Highest code address</param>
+/// <param name="read">Stack memory reader</param>
+/// <param name="query">Region query, used on cache miss</param>
+/// <param name="isCall">Check if instruction preceding address is 'call'</param>
+StackWalker::StackWalker(
+    ExecRangeCache& cache,
+    uint32_t wordSize,
+    ptr_t markBit,
+    ptr_t minAddr,
+    ptr_t maxAddr,
+    fnRead read,
+    fnQuery query,
+    fnIsCall isCall
+    )
+    : _cache( cache )
+    , _wordSize( wordSize )
+    , _markBit( markBit )
+    , _minAddr( minAddr )
+    , _maxAddr( maxAddr )
+    , _read( std::move( read ) )
+    , _query( std::move( query ) )
+    , _isCall( std::move( isCall ) )
+{
+}
+
+/// <summary>
+/// Scan stack for return addresses
+/// </summary>
+/// <param name="ip">Current instruction pointer</param>
+/// <param name="sp">Current stack pointer</param>
+/// <param name="stackBase">Stack base</param>
+/// <param name="results">Found frames, first one is current instruction pointer</param>
+/// <param name="depth">Frame depth limit</param>
+/// <returns>Number of found frames</returns>
+size_t StackWalker::Scan( ptr_t ip, ptr_t sp, ptr_t stackBase, vecFrames& results, size_t depth )
+{
+    uint8_t block[0x1000] = { 0 };
+    size_t found = 0;
+
+    // Store exception address
+    results.emplace_back( 0, ip );
+
+    for (ptr_t blockPtr = sp; blockPtr < stackBase && found < depth;)
+    {
+        // Read up to the end of current page
+        auto size = static_cast<size_t>(std::min<ptr_t>( sizeof( block ) - (blockPtr & (sizeof( block ) - 1)), stackBase - blockPtr ));
+        size -= size % _wordSize;
+        if (size == 0 || !_read( blockPtr, block, size ))
+            break;
+
+        for (size_t offset = 0; offset < size && found < depth; offset += _wordSize)
+        {
+            ptr_t stackVal = 0;
+            memcpy( &stackVal, block + offset, _wordSize );
+
+            ptr_t original = stackVal & ~_markBit;
+
+            // Invalid value
+            if (original < _minAddr || original > _maxAddr)
+                continue;
+
+            if (!IsExecutable( original ) || !_isCall( original ))
+                continue;
+
+            results.emplace_back( blockPtr + offset, stackVal );
+            found++;
+        }
+
+        blockPtr += size;
+    }
+
+    return found;
+}
+
+#ifdef USE64
+/// <summary>
+/// Unwind current thread stack using function table instead of scanning.
+/// Leaf functions without unwind data are expected to have return address on top of the stack
+/// </summary>
+/// <param name="ip">Current instruction pointer</param>
+/// <param name="sp">Current stack pointer</param>
+/// <param name="markBit">Bit cleared from return addresses before they are unwound</param>
+/// <param name="results">Found frames, first one is current instruction pointer</param>
+/// <param name="depth">Frame depth limit</param>
+/// <returns>Number of found frames</returns>
+size_t StackWalker::Unwind( ptr_t ip, ptr_t sp, ptr_t markBit, vecFrames& results, size_t depth )
+{
+    CONTEXT ctx = { 0 };
+    size_t found = 0;
+    auto stackBase = reinterpret_cast<ptr_t>(reinterpret_cast<PNT_TIB>(NtCurrentTeb())->StackBase);
+
+    ctx.Rip = ip;
+    ctx.Rsp = sp;
+
+    // Store exception address
+    results.emplace_back( 0, ip );
+
+    while (found < depth && ctx.Rsp < stackBase)
+    {
+        DWORD64 imageBase = 0;
+        auto entry = RtlLookupFunctionEntry( ctx.Rip, &imageBase, nullptr );
+
+        if (entry != nullptr)
+        {
+            PVOID handlerData = nullptr;
+            DWORD64 establisher = 0;
+            RtlVirtualUnwind( UNW_FLAG_NHANDLER, imageBase, ctx.Rip, entry, &ctx, &handlerData, &establisher, nullptr );
+        }
+        else
+        {
+            // Leaf function
+            ctx.Rip = *reinterpret_cast<DWORD64*>(ctx.Rsp);
+            ctx.Rsp += sizeof( DWORD64 );
+        }
+
+        if (ctx.Rip == 0)
+            break;
+
+        // Return address slot is right below caller stack pointer
+        results.emplace_back( ctx.Rsp - sizeof( DWORD64 ), ctx.Rip );
+        found++;
+
+        ctx.Rip &= ~markBit;
+    }
+
+    return found;
+}
+#endif
+
+/// <summary>
+/// Check if address is inside code
+/// </summary>
+/// <param name="address">Address</param>
+/// <returns>true if executable</returns>
+bool StackWalker::IsExecutable( ptr_t address )
+{
+    bool executable = false;
+    if (_cache.Find( address, executable ))
+        return executable;
+
+    ptr_t base = 0, size = 0;
+    if (!_query( address, base, size, executable ))
+        return false;
+
+    _cache.Add( base, size, executable );
+    return executable;
+}
+
+}
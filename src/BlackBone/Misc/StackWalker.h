@@ -0,0 +1,137 @@
+#pragma once
+
+#include "../Include/Winheaders.h"
+#include "../Include/Types.h"
+#include "../Misc/Utils.h"
+
+#include <functional>
+#include <vector>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Sorted cache of memory regions already checked for code.
+/// Each region is queried once, later addresses inside it are resolved by binary search.
+/// </summary>
+class ExecRangeCache
+{
+public:
+    /// <summary>
+    /// Look up address
+    /// </summary>
+    /// <param name="address">Address</param>
+    /// <param name="executable">Set to true if address is inside executable region</param>
+    /// <returns>true if address is inside cached region</returns>
+    BLACKBONE_API bool Find( ptr_t address, bool& executable );
+
+    /// <summary>
+    /// Cache region
+    /// </summary>
+    /// <param name="base">Region base</param>
+    /// <param name="size">Region size</param>
+    /// <param name="executable">Region contains code</param>
+    BLACKBONE_API void Add( ptr_t base, ptr_t size, bool executable );
+
+    /// <summary>
+    /// Drop all regions, e.g. after module load or unload
+    /// </summary>
+    BLACKBONE_API void clear();
+
+private:
+    /// <summary>
+    /// Cached region
+    /// </summary>
+    struct Range
+    {
+        ptr_t start;
+        ptr_t end;
+        bool executable;
+    };
+
+    std::vector<Range> _ranges;     // Non-overlapping regions sorted by start address
+    CriticalSection _lock;
+};
+
+/// <summary>
+/// Heuristic stack walker shared by local and remote hooks.
+/// Stack is read in page-sized blocks, return address candidates are checked against region cache,
+/// only candidates inside code are passed to 'call' instruction check
+/// </summary>
+class StackWalker
+{
+public:
+    using vecFrames = std::vector<std::pair<ptr_t, ptr_t>>;     // Stack slot address, slot value
+
+    using fnRead   = std::function<bool( ptr_t address, void* buffer, size_t size )>;
+    using fnQuery  = std::function<bool( ptr_t address, ptr_t& base, ptr_t& size, bool& executable )>;
+    using fnIsCall = std::function<bool( ptr_t returnAddress )>;
+
+public:
+    /// <summary>
+    /// Stack walker
+    /// </summary>
+    /// <param name="cache">Region cache, can outlive single walk</param>
+    /// <param name="wordSize">Stack slot size</param>
+    /// <param name="markBit">Bit cleared from slot values before they are checked</param>
+    /// <param name="minAddr">Lowest code address</param>
+    /// <param name="maxAddr">Highest code address</param>
+    /// <param name="read">Stack memory reader</param>
+    /// <param name="query">Region query, used on cache miss</param>
+    /// <param name="isCall">Check if instruction preceding address is 'call'</param>
+    BLACKBONE_API StackWalker(
+        ExecRangeCache& cache,
+        uint32_t wordSize,
+        ptr_t markBit,
+        ptr_t minAddr,
+        ptr_t maxAddr,
+        fnRead read,
+        fnQuery query,
+        fnIsCall isCall
+        );
+
+    /// <summary>
+    /// Scan stack for return addresses
+    /// </summary>
+    /// <param name="ip">Current instruction pointer</param>
+    /// <param name="sp">Current stack pointer</param>
+    /// <param name="stackBase">Stack base</param>
+    /// <param name="results">Found frames, first one is current instruction pointer</param>
+    /// <param name="depth">Frame depth limit</param>
+    /// <returns>Number of found frames</returns>
+    BLACKBONE_API size_t Scan( ptr_t ip, ptr_t sp, ptr_t stackBase, vecFrames& results, size_t depth );
+
+#ifdef USE64
+    /// <summary>
+    /// Unwind current thread stack using function table instead of scanning.
+    /// Leaf functions without unwind data are expected to have return address on top of the stack
+    /// </summary>
+    /// <param name="ip">Current instruction pointer</param>
+    /// <param name="sp">Current stack pointer</param>
+    /// <param name="markBit">Bit cleared from return addresses before they are unwound</param>
+    /// <param name="results">Found frames, first one is current instruction pointer</param>
+    /// <param name="depth">Frame depth limit</param>
+    /// <returns>Number of found frames</returns>
+    BLACKBONE_API static size_t Unwind( ptr_t ip, ptr_t sp, ptr_t markBit, vecFrames& results, size_t depth );
+#endif
+
+private:
+    /// <summary>
+    /// Check if address is inside code
+    /// </summary>
+    /// <param name="address">Address</param>
+    /// <returns>true if executable</returns>
+    bool IsExecutable( ptr_t address );
+
+private:
+    ExecRangeCache& _cache;
+    uint32_t _wordSize;
+    ptr_t _markBit;
+    ptr_t _minAddr;
+    ptr_t _maxAddr;
+    fnRead _read;
+    fnQuery _query;
+    fnIsCall _isCall;
+};
+
+}
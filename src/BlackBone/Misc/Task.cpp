@@ -0,0 +1,249 @@
+#include "Task.h"
+
+#ifdef BLACKBONE_COROUTINES
+
+#include "../Process/AsyncMemory.h"
+#include "../DriverControl/DriverControl.h"
+
+#include <algorithm>
+#include <memory>
+#include <thread>
+
+namespace blackbone
+{
+
+// Completion key used to stop scheduler thread
+constexpr ULONG_PTR StopKey = 1;
+
+/// <summary>
+/// Start scheduler threads
+/// </summary>
+/// <param name="threads">Number of threads, 0 - number of CPUs</param>
+TaskScheduler::TaskScheduler( uint32_t threads /*= 0*/ )
+{
+    if (threads == 0)
+        threads = std::max( std::thread::hardware_concurrency(), 1u );
+
+    _idle = CreateEventW( NULL, TRUE, TRUE, NULL );
+    _port = CreateIoCompletionPort( INVALID_HANDLE_VALUE, NULL, 0, threads );
+    if (!_port || !_idle)
+        return;
+
+    for (uint32_t i = 0; i < threads; i++)
+    {
+        Handle hThread( CreateThread( NULL, 0, &TaskScheduler::WorkerThreadWrap, this, 0, NULL ) );
+        if (hThread)
+            _threads.emplace_back( std::move( hThread ) );
+    }
+}
+
+/// <summary>
+/// Wait for spawned tasks and stop threads
+/// </summary>
+TaskScheduler::~TaskScheduler()
+{
+    Wait();
+
+    _stop = true;
+    if (_driverThread)
+        WaitForSingleObject( _driverThread, INFINITE );
+
+    for (size_t i = 0; i < _threads.size(); i++)
+        PostQueuedCompletionStatus( _port, 0, StopKey, nullptr );
+
+    for (auto& thread : _threads)
+        WaitForSingleObject( thread, INFINITE );
+}
+
+/// <summary>
+/// Queue coroutine resumption. Coroutine is resumed inline if it can't be queued
+/// </summary>
+/// <param name="handle">Suspended coroutine</param>
+void TaskScheduler::Post( std::coroutine_handle<> handle )
+{
+    if (!valid() || !PostQueuedCompletionStatus( _port, 0, 0, reinterpret_cast<LPOVERLAPPED>(handle.address()) ))
+        handle.resume();
+}
+
+/// <summary>
+/// Wait until all spawned tasks are finished
+/// </summary>
+/// <param name="timeout">Wait timeout</param>
+/// <returns>true if no task is running</returns>
+bool TaskScheduler::Wait( uint32_t timeout /*= INFINITE*/ )
+{
+    if (!_idle)
+        return true;
+
+    return WaitForSingleObject( _idle, timeout ) == WAIT_OBJECT_0;
+}
+
+/// <summary>
+/// Dispatch DriverControl asynchronous completions from a dedicated scheduler thread.
+/// Required by driver awaitables unless application calls Driver().PollCompletions itself
+/// </summary>
+/// <returns>Status code</returns>
+NTSTATUS TaskScheduler::EnableDriverPolling()
+{
+    CSLock lck( _lock );
+
+    if (_driverThread)
+        return STATUS_SUCCESS;
+
+    _driverThread = CreateThread( NULL, 0, &TaskScheduler::DriverThreadWrap, this, 0, NULL );
+    return _driverThread ? STATUS_SUCCESS : LastNtStatus();
+}
+
+/// <summary>
+/// Number of spawned tasks not finished yet
+/// </summary>
+/// <returns>Task count</returns>
+size_t TaskScheduler::pending()
+{
+    CSLock lck( _lock );
+    return _pending;
+}
+
+void TaskScheduler::TaskStarted()
+{
+    CSLock lck( _lock );
+    if (_pending++ == 0)
+        ResetEvent( _idle );
+}
+
+void TaskScheduler::TaskFinished()
+{
+    CSLock lck( _lock );
+    if (--_pending == 0)
+        SetEvent( _idle );
+}
+
+DWORD CALLBACK TaskScheduler::WorkerThreadWrap( LPVOID lpParam )
+{
+    reinterpret_cast<TaskScheduler*>(lpParam)->WorkerThread();
+    return 0;
+}
+
+void TaskScheduler::WorkerThread()
+{
+    for (;;)
+    {
+        DWORD bytes = 0;
+        ULONG_PTR key = 0;
+        LPOVERLAPPED pOverlapped = nullptr;
+
+        if (!GetQueuedCompletionStatus( _port, &bytes, &key, &pOverlapped, INFINITE ) && pOverlapped == nullptr)
+            break;
+
+        if (key == StopKey)
+            break;
+
+        std::coroutine_handle<>::from_address( pOverlapped ).resume();
+    }
+}
+
+DWORD CALLBACK TaskScheduler::DriverThreadWrap( LPVOID lpParam )
+{
+    reinterpret_cast<TaskScheduler*>(lpParam)->DriverThread();
+    return 0;
+}
+
+void TaskScheduler::DriverThread()
+{
+    // Callbacks only post coroutines back to scheduler port
+    while (!_stop)
+        Driver().PollCompletions( 100 );
+}
+
+/// <summary>
+/// Forward AsyncMemory completion to awaiter
+/// </summary>
+static void AsyncMemoryComplete( NTSTATUS status, ptr_t /*address*/, size_t /*size*/, void* /*buffer*/, void* context )
+{
+    std::unique_ptr<AsyncResult<NTSTATUS>::Completion> complete( reinterpret_cast<AsyncResult<NTSTATUS>::Completion*>(context) );
+    (*complete)( status );
+}
+
+/// <summary>
+/// Read memory through AsyncMemory worker pool
+/// </summary>
+/// <param name="scheduler">Scheduler resuming awaiting coroutine</param>
+/// <param name="async">Worker pool</param>
+/// <param name="memory">Target process memory</param>
+/// <param name="address">Address to read from</param>
+/// <param name="size">Size of data to read</param>
+/// <param name="buffer">Output buffer, must stay valid until operation is completed</param>
+/// <returns>Awaitable status code</returns>
+AsyncResult<NTSTATUS> ReadAsync( TaskScheduler& scheduler, AsyncMemory& async, ProcessMemory& memory, ptr_t address, size_t size, void* buffer )
+{
+    return AsyncResult<NTSTATUS>( scheduler, [&async, &memory, address, size, buffer]( AsyncResult<NTSTATUS>::Completion complete )
+    {
+        auto pComplete = new AsyncResult<NTSTATUS>::Completion( std::move( complete ) );
+        NTSTATUS status = async.Read( memory, address, size, buffer, &AsyncMemoryComplete, pComplete );
+        if (!NT_SUCCESS( status ))
+            AsyncMemoryComplete( status, address, size, buffer, pComplete );
+    } );
+}
+
+/// <summary>
+/// Write memory through AsyncMemory worker pool
+/// </summary>
+/// <param name="scheduler">Scheduler resuming awaiting coroutine</param>
+/// <param name="async">Worker pool</param>
+/// <param name="memory">Target process memory</param>
+/// <param name="address">Address to write to</param>
+/// <param name="size">Size of data to write</param>
+/// <param name="buffer">Data to write, must stay valid until operation is completed</param>
+/// <returns>Awaitable status code</returns>
+AsyncResult<NTSTATUS> WriteAsync( TaskScheduler& scheduler, AsyncMemory& async, ProcessMemory& memory, ptr_t address, size_t size, const void* buffer )
+{
+    return AsyncResult<NTSTATUS>( scheduler, [&async, &memory, address, size, buffer]( AsyncResult<NTSTATUS>::Completion complete )
+    {
+        auto pComplete = new AsyncResult<NTSTATUS>::Completion( std::move( complete ) );
+        NTSTATUS status = async.Write( memory, address, size, buffer, &AsyncMemoryComplete, pComplete );
+        if (!NT_SUCCESS( status ))
+            AsyncMemoryComplete( status, address, size, const_cast<void*>(buffer), pComplete );
+    } );
+}
+
+/// <summary>
+/// Read memory through BlackBone driver overlapped request
+/// </summary>
+/// <param name="scheduler">Scheduler resuming awaiting coroutine</param>
+/// <param name="pid">Target PID</param>
+/// <param name="address">Address to read from</param>
+/// <param name="size">Size of data to read</param>
+/// <param name="buffer">Output buffer, must stay valid until operation is completed</param>
+/// <returns>Awaitable status code</returns>
+AsyncResult<NTSTATUS> DriverReadAsync( TaskScheduler& scheduler, DWORD pid, ptr_t address, size_t size, void* buffer )
+{
+    return AsyncResult<NTSTATUS>( scheduler, [pid, address, size, buffer]( AsyncResult<NTSTATUS>::Completion complete )
+    {
+        NTSTATUS status = Driver().ReadMemAsync( pid, address, size, buffer, complete );
+        if (!NT_SUCCESS( status ))
+            complete( status );
+    } );
+}
+
+/// <summary>
+/// Write memory through BlackBone driver overlapped request
+/// </summary>
+/// <param name="scheduler">Scheduler resuming awaiting coroutine</param>
+/// <param name="pid">Target PID</param>
+/// <param name="address">Address to write to</param>
+/// <param name="size">Size of data to write</param>
+/// <param name="buffer">Data to write, must stay valid until operation is completed</param>
+/// <returns>Awaitable status code</returns>
+AsyncResult<NTSTATUS> DriverWriteAsync( TaskScheduler& scheduler, DWORD pid, ptr_t address, size_t size, const void* buffer )
+{
+    return AsyncResult<NTSTATUS>( scheduler, [pid, address, size, buffer]( AsyncResult<NTSTATUS>::Completion complete )
+    {
+        NTSTATUS status = Driver().WriteMemAsync( pid, address, size, const_cast<void*>(buffer), complete );
+        if (!NT_SUCCESS( status ))
+            complete( status );
+    } );
+}
+
+}
+
+#endif // BLACKBONE_COROUTINES
@@ -0,0 +1,422 @@
+#pragma once
+
+#include "../Config.h"
+
+#ifdef BLACKBONE_COROUTINES
+
+#include "../Include/Winheaders.h"
+#include "../Include/Types.h"
+#include "../Include/HandleGuard.h"
+#include "Utils.h"
+
+#include <coroutine>
+#include <optional>
+#include <functional>
+#include <exception>
+#include <utility>
+#include <vector>
+
+namespace blackbone
+{
+
+template<typename T = void>
+class Task;
+
+namespace detail
+{
+
+/// <summary>
+/// Common part of task promise. Task starts suspended and resumes its awaiter when finished
+/// </summary>
+struct TaskPromiseBase
+{
+    struct FinalAwaiter
+    {
+        bool await_ready() const noexcept { return false; }
+
+        template<typename Promise>
+        std::coroutine_handle<> await_suspend( std::coroutine_handle<Promise> handle ) noexcept
+        {
+            auto continuation = handle.promise().continuation;
+            return continuation ? continuation : std::noop_coroutine();
+        }
+
+        void await_resume() const noexcept { }
+    };
+
+    std::suspend_always initial_suspend() noexcept { return { }; }
+    FinalAwaiter final_suspend() noexcept { return { }; }
+    void unhandled_exception() noexcept { std::terminate(); }
+
+    std::coroutine_handle<> continuation;   // Coroutine awaiting this task
+};
+
+template<typename T>
+struct TaskPromise : TaskPromiseBase
+{
+    Task<T> get_return_object() noexcept;
+
+    template<typename U>
+    void return_value( U&& value ) { result.emplace( std::forward<U>( value ) ); }
+
+    T get() { return std::move( *result ); }
+
+    std::optional<T> result;
+};
+
+template<>
+struct TaskPromise<void> : TaskPromiseBase
+{
+    Task<void> get_return_object() noexcept;
+
+    void return_void() noexcept { }
+    void get() noexcept { }
+};
+
+/// <summary>
+/// Fire-and-forget coroutine, frame is released upon completion
+/// </summary>
+struct DetachedTask
+{
+    struct promise_type
+    {
+        DetachedTask get_return_object() noexcept { return { }; }
+        std::suspend_never initial_suspend() noexcept { return { }; }
+        std::suspend_never final_suspend() noexcept { return { }; }
+        void return_void() noexcept { }
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
+
+}
+
+/// <summary>
+/// Lazily started coroutine producing single value.
+/// Body runs when task is awaited, awaiter is resumed on the thread that finished the task
+/// </summary>
+template<typename T>
+class Task
+{
+public:
+    using promise_type = detail::TaskPromise<T>;
+
+public:
+    Task() = default;
+    explicit Task( std::coroutine_handle<promise_type> handle )
+        : _handle( handle ) { }
+
+    Task( Task&& other ) noexcept
+        : _handle( std::exchange( other._handle, nullptr ) ) { }
+
+    Task& operator =( Task&& other ) noexcept
+    {
+        if (this != &other)
+        {
+            if (_handle)
+                _handle.destroy();
+
+            _handle = std::exchange( other._handle, nullptr );
+        }
+
+        return *this;
+    }
+
+    Task( const Task& ) = delete;
+    Task& operator =( const Task& ) = delete;
+
+    ~Task()
+    {
+        if (_handle)
+            _handle.destroy();
+    }
+
+    auto operator co_await() noexcept
+    {
+        struct Awaiter
+        {
+            bool await_ready() const noexcept { return !handle || handle.done(); }
+
+            std::coroutine_handle<> await_suspend( std::coroutine_handle<> awaiting ) noexcept
+            {
+                handle.promise().continuation = awaiting;
+                return handle;
+            }
+
+            T await_resume() { return handle.promise().get(); }
+
+            std::coroutine_handle<promise_type> handle;
+        };
+
+        return Awaiter{ _handle };
+    }
+
+    /// <summary>
+    /// Task holds coroutine
+    /// </summary>
+    /// <returns>true if valid</returns>
+    inline bool valid() const { return static_cast<bool>(_handle); }
+
+private:
+    std::coroutine_handle<promise_type> _handle;
+};
+
+namespace detail
+{
+
+template<typename T>
+inline Task<T> TaskPromise<T>::get_return_object() noexcept
+{
+    return Task<T>( std::coroutine_handle<TaskPromise<T>>::from_promise( *this ) );
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() noexcept
+{
+    return Task<void>( std::coroutine_handle<TaskPromise<void>>::from_promise( *this ) );
+}
+
+}
+
+/// <summary>
+/// Resumes coroutines on a pool of threads waiting on IO completion port.
+/// Coroutines suspended on asynchronous operations hold no thread,
+/// so a few scheduler threads can drive any number of concurrent tasks
+/// </summary>
+class TaskScheduler
+{
+public:
+    /// <summary>
+    /// Start scheduler threads
+    /// </summary>
+    /// <param name="threads">Number of threads, 0 - number of CPUs</param>
+    BLACKBONE_API TaskScheduler( uint32_t threads = 0 );
+
+    /// <summary>
+    /// Wait for spawned tasks and stop threads
+    /// </summary>
+    BLACKBONE_API ~TaskScheduler();
+
+    TaskScheduler( const TaskScheduler& ) = delete;
+    TaskScheduler& operator =( const TaskScheduler& ) = delete;
+
+    /// <summary>
+    /// Queue coroutine resumption. Coroutine is resumed inline if it can't be queued
+    /// </summary>
+    /// <param name="handle">Suspended coroutine</param>
+    BLACKBONE_API void Post( std::coroutine_handle<> handle );
+
+    /// <summary>
+    /// Move awaiting coroutine onto scheduler thread
+    /// </summary>
+    /// <returns>Awaitable</returns>
+    auto Schedule() noexcept
+    {
+        struct Awaiter
+        {
+            bool await_ready() const noexcept { return false; }
+            void await_suspend( std::coroutine_handle<> handle ) { scheduler.Post( handle ); }
+            void await_resume() const noexcept { }
+
+            TaskScheduler& scheduler;
+        };
+
+        return Awaiter{ *this };
+    }
+
+    /// <summary>
+    /// Start task on scheduler thread without waiting for its result
+    /// </summary>
+    /// <param name="task">Task</param>
+    template<typename T>
+    void Spawn( Task<T> task )
+    {
+        TaskStarted();
+
+        []( TaskScheduler& self, Task<T> task ) -> detail::DetachedTask
+        {
+            co_await self.Schedule();
+            co_await task;
+            self.TaskFinished();
+        }( *this, std::move( task ) );
+    }
+
+    /// <summary>
+    /// Run task on scheduler and block calling thread until it is finished.
+    /// Must not be called from scheduler thread
+    /// </summary>
+    /// <param name="task">Task</param>
+    /// <returns>Task result</returns>
+    template<typename T>
+    T Run( Task<T> task )
+    {
+        Handle hDone( CreateEventW( NULL, TRUE, FALSE, NULL ) );
+
+        if constexpr (std::is_void_v<T>)
+        {
+            []( TaskScheduler& self, Task<T> task, HANDLE hDone ) -> detail::DetachedTask
+            {
+                co_await self.Schedule();
+                co_await task;
+                SetEvent( hDone );
+            }( *this, std::move( task ), hDone );
+
+            WaitForSingleObject( hDone, INFINITE );
+        }
+        else
+        {
+            std::optional<T> result;
+
+            []( TaskScheduler& self, Task<T> task, HANDLE hDone, std::optional<T>& result ) -> detail::DetachedTask
+            {
+                co_await self.Schedule();
+                result.emplace( co_await task );
+                SetEvent( hDone );
+            }( *this, std::move( task ), hDone, result );
+
+            WaitForSingleObject( hDone, INFINITE );
+            return std::move( *result );
+        }
+    }
+
+    /// <summary>
+    /// Wait until all spawned tasks are finished
+    /// </summary>
+    /// <param name="timeout">Wait timeout</param>
+    /// <returns>true if no task is running</returns>
+    BLACKBONE_API bool Wait( uint32_t timeout = INFINITE );
+
+    /// <summary>
+    /// Dispatch DriverControl asynchronous completions from a dedicated scheduler thread.
+    /// Required by driver awaitables unless application calls Driver().PollCompletions itself
+    /// </summary>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS EnableDriverPolling();
+
+    /// <summary>
+    /// Number of spawned tasks not finished yet
+    /// </summary>
+    /// <returns>Task count</returns>
+    BLACKBONE_API size_t pending();
+
+    /// <summary>
+    /// Scheduler threads are running
+    /// </summary>
+    /// <returns>true if coroutines can be scheduled</returns>
+    BLACKBONE_API inline bool valid() const { return _port.valid() && !_threads.empty(); }
+
+private:
+    /// <summary>
+    /// Spawned task accounting
+    /// </summary>
+    BLACKBONE_API void TaskStarted();
+    BLACKBONE_API void TaskFinished();
+
+    static DWORD CALLBACK WorkerThreadWrap( LPVOID lpParam );
+    void WorkerThread();
+
+    static DWORD CALLBACK DriverThreadWrap( LPVOID lpParam );
+    void DriverThread();
+
+private:
+    Handle _port;                       // IO completion port
+    std::vector<Handle> _threads;       // Scheduler threads
+    Handle _driverThread;               // Driver completion polling thread
+    volatile bool _stop = false;        // Stop driver polling
+    Handle _idle;                       // Signaled when no spawned task is running
+    size_t _pending = 0;                // Spawned tasks not finished yet
+    CriticalSection _lock;              // Pending counter lock
+};
+
+/// <summary>
+/// Awaitable over callback based asynchronous operation.
+/// Operation is started when coroutine suspends, completion resumes it on scheduler thread
+/// </summary>
+template<typename T>
+class AsyncResult
+{
+public:
+    using Completion = std::function<void( T value )>;
+    using Starter = std::function<void( Completion complete )>;
+
+public:
+    /// <summary>
+    /// Wrap operation
+    /// </summary>
+    /// <param name="scheduler">Scheduler resuming awaiting coroutine</param>
+    /// <param name="start">Starts operation, completion must be invoked exactly once, failure included</param>
+    AsyncResult( TaskScheduler& scheduler, Starter start )
+        : _scheduler( &scheduler )
+        , _start( std::move( start ) ) { }
+
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend( std::coroutine_handle<> handle )
+    {
+        _handle = handle;
+
+        // Completion may resume coroutine and release this object before start returns
+        auto start = std::move( _start );
+        start( [this]( T value )
+        {
+            _value.emplace( std::move( value ) );
+            _scheduler->Post( _handle );
+        } );
+    }
+
+    T await_resume() { return std::move( *_value ); }
+
+private:
+    TaskScheduler* _scheduler;          // Resuming scheduler
+    Starter _start;                     // Operation
+    std::optional<T> _value;            // Operation result
+    std::coroutine_handle<> _handle;    // Awaiting coroutine
+};
+
+/// <summary>
+/// Read memory through AsyncMemory worker pool
+/// </summary>
+/// <param name="scheduler">Scheduler resuming awaiting coroutine</param>
+/// <param name="async">Worker pool</param>
+/// <param name="memory">Target process memory</param>
+/// <param name="address">Address to read from</param>
+/// <param name="size">Size of data to read</param>
+/// <param name="buffer">Output buffer, must stay valid until operation is completed</param>
+/// <returns>Awaitable status code</returns>
+BLACKBONE_API AsyncResult<NTSTATUS> ReadAsync( TaskScheduler& scheduler, class AsyncMemory& async, class ProcessMemory& memory, ptr_t address, size_t size, void* buffer );
+
+/// <summary>
+/// Write memory through AsyncMemory worker pool
+/// </summary>
+/// <param name="scheduler">Scheduler resuming awaiting coroutine</param>
+/// <param name="async">Worker pool</param>
+/// <param name="memory">Target process memory</param>
+/// <param name="address">Address to write to</param>
+/// <param name="size">Size of data to write</param>
+/// <param name="buffer">Data to write, must stay valid until operation is completed</param>
+/// <returns>Awaitable status code</returns>
+BLACKBONE_API AsyncResult<NTSTATUS> WriteAsync( TaskScheduler& scheduler, class AsyncMemory& async, class ProcessMemory& memory, ptr_t address, size_t size, const void* buffer );
+
+/// <summary>
+/// Read memory through BlackBone driver overlapped request
+/// </summary>
+/// <param name="scheduler">Scheduler resuming awaiting coroutine</param>
+/// <param name="pid">Target PID</param>
+/// <param name="address">Address to read from</param>
+/// <param name="size">Size of data to read</param>
+/// <param name="buffer">Output buffer, must stay valid until operation is completed</param>
+/// <returns>Awaitable status code</returns>
+BLACKBONE_API AsyncResult<NTSTATUS> DriverReadAsync( TaskScheduler& scheduler, DWORD pid, ptr_t address, size_t size, void* buffer );
+
+/// <summary>
+/// Write memory through BlackBone driver overlapped request
+/// </summary>
+/// <param name="scheduler">Scheduler resuming awaiting coroutine</param>
+/// <param name="pid">Target PID</param>
+/// <param name="address">Address to write to</param>
+/// <param name="size">Size of data to write</param>
+/// <param name="buffer">Data to write, must stay valid until operation is completed</param>
+/// <returns>Awaitable status code</returns>
+BLACKBONE_API AsyncResult<NTSTATUS> DriverWriteAsync( TaskScheduler& scheduler, DWORD pid, ptr_t address, size_t size, const void* buffer );
+
+}
+
+#endif // BLACKBONE_COROUTINES
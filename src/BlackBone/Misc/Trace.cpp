@@ -0,0 +1,328 @@
+#include "../Include/Winheaders.h"
+#include "Trace.hpp"
+#include "Utils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace blackbone
+{
+
+namespace tracing
+{
+
+/// <summary>
+/// Single producer, single consumer record ring of one thread
+/// </summary>
+struct Ring
+{
+    static constexpr uint32_t Capacity = 128;
+
+    TraceRecord records[Capacity];
+    std::atomic<uint32_t> head{ 0 };        // Next record to fill, owned by producer
+    std::atomic<uint32_t> tail{ 0 };        // Next record to format, owned by flusher
+    std::atomic<bool> orphaned{ false };    // Producer thread has exited
+};
+
+/// <summary>
+/// Ring registry and flush thread.
+/// Rings are shared with owner threads, so exiting threads don't depend on registry lifetime
+/// </summary>
+class TraceLog
+{
+public:
+    static TraceLog& Instance()
+    {
+        static TraceLog instance;
+        return instance;
+    }
+
+    ~TraceLog()
+    {
+        {
+            CSLock lck( _lock );
+            _stop = true;
+        }
+
+        Wake();
+        if (_worker.joinable())
+            _worker.join();
+
+        // Records emitted by later static destructors bypass rings
+        mode = TraceMode::Synchronous;
+        Flush();
+
+        CloseHandle( _wake );
+    }
+
+    /// <summary>
+    /// Get ring of calling thread, register it on first use
+    /// </summary>
+    /// <returns>Ring</returns>
+    Ring* LocalRing()
+    {
+        struct Holder
+        {
+            std::shared_ptr<Ring> ring;
+            ~Holder()
+            {
+                if (ring)
+                    ring->orphaned = true;
+            }
+        };
+
+        thread_local Holder holder;
+        if (!holder.ring)
+        {
+            holder.ring = std::make_shared<Ring>();
+
+            CSLock lck( _lock );
+            _rings.emplace_back( holder.ring );
+
+            if (!_worker.joinable() && !_stop)
+                _worker = std::thread( &TraceLog::FlushWorker, this );
+        }
+
+        return holder.ring.get();
+    }
+
+    /// <summary>
+    /// Format and emit records of all rings
+    /// </summary>
+    /// <param name="wait">Wait for concurrent flush to finish</param>
+    void Flush( bool wait = true )
+    {
+        if (wait)
+            _flushLock.lock();
+        else if (!_flushLock.try_lock())
+            return;
+
+        std::vector<std::shared_ptr<Ring>> rings;
+        {
+            CSLock lck( _lock );
+            rings = _rings;
+        }
+
+        for (auto& ring : rings)
+        {
+            // Orphaned state must be observed before last records are drained
+            bool orphaned = ring->orphaned.load();
+            uint32_t tail = ring->tail.load( std::memory_order_relaxed );
+            uint32_t head = ring->head.load( std::memory_order_acquire );
+
+            for (; tail != head; tail++)
+            {
+                auto& record = ring->records[tail % Ring::Capacity];
+                record.format( record );
+            }
+
+            ring->tail.store( tail, std::memory_order_release );
+
+            if (orphaned)
+            {
+                CSLock lck( _lock );
+                _rings.erase( std::remove( _rings.begin(), _rings.end(), ring ), _rings.end() );
+            }
+        }
+
+        if (auto dropped = _dropped.exchange( 0 ))
+            Emit( GetCurrentThreadId(), 0, (L"Trace ring overflow, " + std::to_wstring( dropped ) + L" records dropped").c_str() );
+
+        _flushLock.unlock();
+    }
+
+    /// <summary>
+    /// Emit formatted message to sink or debug output
+    /// </summary>
+    /// <param name="tid">Producer thread</param>
+    /// <param name="time">Record time</param>
+    /// <param name="message">Message</param>
+    void Emit( uint32_t tid, uint64_t time, const wchar_t* message )
+    {
+        if (auto fn = sink.load())
+        {
+            fn( TraceEvent{ tid, time, message } );
+            return;
+        }
+
+        wchar_t buf[2048];
+        swprintf_s( buf, L"BlackBone: %ls\r\n", message );
+        OutputDebugStringW( buf );
+
+#ifdef CONSOLE_TRACE
+        wprintf_s( buf );
+#endif
+    }
+
+    /// <summary>
+    /// Wake flusher when ring receives first record or fills up
+    /// </summary>
+    void Wake()
+    {
+        SetEvent( _wake );
+    }
+
+    /// <summary>
+    /// Account record that didn't fit into ring
+    /// </summary>
+    void Drop()
+    {
+        _dropped++;
+        Wake();
+    }
+
+    std::atomic<TraceMode> mode{ TraceMode::Buffered };    // Delivery mode
+    std::atomic<fnTraceSink> sink{ nullptr };               // User sink, replaces debug output
+
+private:
+    TraceLog()
+    {
+        _wake = CreateEventW( nullptr, FALSE, FALSE, nullptr );
+    }
+
+    /// <summary>
+    /// Background flush loop, runs until registry is destroyed
+    /// </summary>
+    void FlushWorker()
+    {
+        for (;;)
+        {
+            WaitForSingleObject( _wake, INFINITE );
+            Flush();
+
+            CSLock lck( _lock );
+            if (_stop)
+                break;
+        }
+    }
+
+private:
+    std::vector<std::shared_ptr<Ring>> _rings;  // Registered thread rings
+    std::thread _worker;                        // Background flush thread
+    bool _stop = false;                         // Flush thread shutdown request
+    HANDLE _wake = nullptr;                     // Flush request event
+    std::atomic<uint64_t> _dropped{ 0 };        // Records lost to ring overflow
+    CriticalSection _lock;                      // Ring registry lock
+    CriticalSection _flushLock;                 // Serializes flushes
+};
+
+/// <summary>
+/// Get free record in calling thread ring
+/// </summary>
+/// <returns>Record, nullptr if ring is full and record is dropped</returns>
+TraceRecord* AcquireRecord()
+{
+    auto& log = TraceLog::Instance();
+
+    TraceRecord* record = nullptr;
+    if (log.mode.load( std::memory_order_relaxed ) == TraceMode::Synchronous)
+    {
+        thread_local TraceRecord scratch;
+        record = &scratch;
+    }
+    else
+    {
+        auto ring = log.LocalRing();
+        uint32_t head = ring->head.load( std::memory_order_relaxed );
+        if (head - ring->tail.load( std::memory_order_acquire ) >= Ring::Capacity)
+        {
+            log.Drop();
+            return nullptr;
+        }
+
+        record = &ring->records[head % Ring::Capacity];
+    }
+
+    FILETIME time = { };
+    GetSystemTimeAsFileTime( &time );
+
+    record->time = (static_cast<uint64_t>(time.dwHighDateTime) << 32) | time.dwLowDateTime;
+    record->tid = GetCurrentThreadId();
+    return record;
+}
+
+/// <summary>
+/// Publish record obtained from AcquireRecord
+/// </summary>
+/// <param name="record">Filled record</param>
+void CommitRecord( TraceRecord* record )
+{
+    auto& log = TraceLog::Instance();
+    if (log.mode.load( std::memory_order_relaxed ) == TraceMode::Synchronous)
+    {
+        record->format( *record );
+        return;
+    }
+
+    auto ring = log.LocalRing();
+    uint32_t head = ring->head.load( std::memory_order_relaxed );
+
+    // Record could've been acquired before mode switch
+    if (record != &ring->records[head % Ring::Capacity])
+    {
+        record->format( *record );
+        return;
+    }
+
+    ring->head.store( head + 1, std::memory_order_release );
+
+    // Flusher sleeps until woken, so first record after idle period has to wake it too
+    uint32_t queued = head + 1 - ring->tail.load( std::memory_order_relaxed );
+    if (queued == 1 || queued == Ring::Capacity / 2)
+        log.Wake();
+}
+
+/// <summary>
+/// Emit formatted message
+/// </summary>
+/// <param name="record">Source record</param>
+/// <param name="message">Message</param>
+void EmitMessage( const TraceRecord& record, const char* message )
+{
+    wchar_t buf[1024] = { 0 };
+    MultiByteToWideChar( CP_ACP, 0, message, -1, buf, _countof( buf ) - 1 );
+    TraceLog::Instance().Emit( record.tid, record.time, buf );
+}
+
+void EmitMessage( const TraceRecord& record, const wchar_t* message )
+{
+    TraceLog::Instance().Emit( record.tid, record.time, message );
+}
+
+}
+
+/// <summary>
+/// Set trace delivery mode. Buffered by default
+/// </summary>
+/// <param name="mode">Trace mode</param>
+void SetTraceMode( TraceMode mode )
+{
+    auto& log = tracing::TraceLog::Instance();
+    log.mode = mode;
+
+    if (mode == TraceMode::Synchronous)
+        log.Flush();
+}
+
+/// <summary>
+/// Replace default OutputDebugString output, e.g. with ETW provider
+/// </summary>
+/// <param name="sink">Sink, nullptr to restore default output</param>
+void SetTraceSink( fnTraceSink sink )
+{
+    tracing::TraceLog::Instance().sink = sink;
+}
+
+/// <summary>
+/// Format and emit all queued records of all threads
+/// </summary>
+void FlushTrace()
+{
+    tracing::TraceLog::Instance().Flush();
+}
+
+}
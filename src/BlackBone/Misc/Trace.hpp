@@ -1,7 +1,13 @@
 #pragma once
 
+#include "../Config.h"
+
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <tuple>
+#include <type_traits>
 
 #pragma warning(push)
 #pragma warning(disable : 4091)
@@ -10,39 +16,265 @@
 
 namespace blackbone
 {
-#ifndef BLACKBONE_NO_TRACE
 
-inline void DoTraceV( const char* fmt, va_list va_args )
+/// <summary>
+/// Trace delivery mode
+/// </summary>
+enum class TraceMode
 {
-    char buf[2048], userbuf[1024];
-    vsprintf_s( userbuf, fmt, va_args );
-    sprintf_s( buf, "BlackBone: %s\r\n", userbuf );
-    OutputDebugStringA( buf );
+    Buffered,       // Records are queued in per-thread rings and formatted by background thread
+    Synchronous,    // Records are formatted and emitted by calling thread
+};
 
-#ifdef CONSOLE_TRACE
-    printf_s( buf );
-#endif
+/// <summary>
+/// Formatted trace record, passed to trace sink
+/// </summary>
+struct TraceEvent
+{
+    uint32_t tid;               // Thread that produced record
+    uint64_t time;              // System time, FILETIME units
+    const wchar_t* message;     // Formatted message, without prefix and line break
+};
+
+/// <summary>
+/// Trace sink, called on flush thread in buffered mode
+/// </summary>
+using fnTraceSink = void( *)(const TraceEvent& event);
+
+/// <summary>
+/// Set trace delivery mode. Buffered by default
+/// </summary>
+/// <param name="mode">Trace mode</param>
+BLACKBONE_API void SetTraceMode( TraceMode mode );
+
+/// <summary>
+/// Replace default OutputDebugString output, e.g. with ETW provider
+/// </summary>
+/// <param name="sink">Sink, nullptr to restore default output</param>
+BLACKBONE_API void SetTraceSink( fnTraceSink sink );
+
+/// <summary>
+/// Format and emit all queued records of all threads
+/// </summary>
+BLACKBONE_API void FlushTrace();
+
+namespace tracing
+{
+
+constexpr size_t PayloadSize = 464;     // Raw argument storage of single record
+
+struct TraceRecord;
+using fnFormat = void( *)(const TraceRecord& record);
+
+/// <summary>
+/// Queued trace record. Format string must be a literal, it is formatted after the call returns
+/// </summary>
+struct TraceRecord
+{
+    const void* fmt;            // Format string
+    fnFormat format;            // Formatter, knows argument types
+    uint64_t time;              // System time, FILETIME units
+    uint32_t tid;               // Producer thread
+    alignas(8) uint8_t payload[PayloadSize];
+};
+
+/// <summary>
+/// Get free record in calling thread ring
+/// </summary>
+/// <returns>Record, nullptr if ring is full and record is dropped</returns>
+BLACKBONE_API TraceRecord* AcquireRecord();
+
+/// <summary>
+/// Publish record obtained from AcquireRecord
+/// </summary>
+/// <param name="record">Filled record</param>
+BLACKBONE_API void CommitRecord( TraceRecord* record );
+
+/// <summary>
+/// Emit formatted message
+/// </summary>
+/// <param name="record">Source record</param>
+/// <param name="message">Message</param>
+BLACKBONE_API void EmitMessage( const TraceRecord& record, const char* message );
+BLACKBONE_API void EmitMessage( const TraceRecord& record, const wchar_t* message );
+
+template<typename T> struct IsString : std::false_type { };
+template<> struct IsString<char*> : std::true_type { };
+template<> struct IsString<const char*> : std::true_type { };
+template<> struct IsString<wchar_t*> : std::true_type { };
+template<> struct IsString<const wchar_t*> : std::true_type { };
+
+/// <summary>
+/// Payload layout. Scalars are stored as is, strings are copied and share what's left
+/// </summary>
+template<typename... Args>
+struct Layout
+{
+    static constexpr size_t strings = (size_t( 0 ) + ... + (IsString<Args>::value ? 1 : 0));
+    static constexpr size_t scalars = (size_t( 0 ) + ... + (IsString<Args>::value ? 0 : sizeof( Args ) + alignof(Args)));
+    static_assert(scalars <= PayloadSize, "Too many trace arguments");
+
+    static constexpr size_t perString = strings != 0 ? (PayloadSize - scalars) / strings : 0;
+};
+
+constexpr size_t AlignUp( size_t value, size_t align )
+{
+    return (value + align - 1) & ~(align - 1);
 }
 
-inline void DoTraceV( const wchar_t* fmt, va_list va_args )
+/// <summary>
+/// Serializes arguments into record payload
+/// </summary>
+class PayloadWriter
 {
-    wchar_t buf[2048], userbuf[1024];
-    vswprintf_s( userbuf, fmt, va_args );
-    swprintf_s( buf, L"BlackBone: %ls\r\n", userbuf );
-    OutputDebugStringW( buf );
+public:
+    PayloadWriter( uint8_t* payload )
+        : _payload( payload ) { }
 
-#ifdef CONSOLE_TRACE
-    wprintf_s( buf );
-#endif
+    template<typename T>
+    void Write( T value, size_t budget )
+    {
+        if constexpr (IsString<T>::value)
+        {
+            using Ch = std::remove_const_t<std::remove_pointer_t<T>>;
+
+            // Length prefix, characters and terminator within budget
+            _pos = AlignUp( _pos, alignof(uint16_t) );
+            size_t maxChars = budget > 2 * sizeof( uint16_t ) + sizeof( Ch ) ? (budget - 2 * sizeof( uint16_t )) / sizeof( Ch ) - 1 : 0;
+            uint16_t length = NullString;
+            if (value != nullptr)
+            {
+                size_t count = 0;
+                while (count < maxChars && value[count] != 0)
+                    count++;
+
+                length = static_cast<uint16_t>(count);
+            }
+
+            memcpy( _payload + _pos, &length, sizeof( length ) );
+            _pos += sizeof( length );
+
+            if (length != NullString)
+            {
+                _pos = AlignUp( _pos, sizeof( Ch ) );
+                memcpy( _payload + _pos, value, length * sizeof( Ch ) );
+                _pos += length * sizeof( Ch );
+                memset( _payload + _pos, 0, sizeof( Ch ) );
+                _pos += sizeof( Ch );
+            }
+        }
+        else
+        {
+            static_assert(std::is_trivially_copyable_v<T>, "Trace argument must be trivially copyable");
+
+            _pos = AlignUp( _pos, alignof(T) );
+            memcpy( _payload + _pos, &value, sizeof( T ) );
+            _pos += sizeof( T );
+        }
+    }
+
+    static constexpr uint16_t NullString = 0xFFFF;
+
+private:
+    uint8_t* _payload;
+    size_t _pos = 0;
+};
+
+/// <summary>
+/// Restores arguments from record payload, strings point into payload
+/// </summary>
+class PayloadReader
+{
+public:
+    PayloadReader( const uint8_t* payload )
+        : _payload( payload ) { }
+
+    template<typename T>
+    T Read()
+    {
+        if constexpr (IsString<T>::value)
+        {
+            using Ch = std::remove_const_t<std::remove_pointer_t<T>>;
+
+            uint16_t length = 0;
+            _pos = AlignUp( _pos, alignof(uint16_t) );
+            memcpy( &length, _payload + _pos, sizeof( length ) );
+            _pos += sizeof( length );
+
+            if (length == PayloadWriter::NullString)
+                return nullptr;
+
+            _pos = AlignUp( _pos, sizeof( Ch ) );
+            auto str = reinterpret_cast<const Ch*>(_payload + _pos);
+            _pos += (length + 1) * sizeof( Ch );
+
+            return const_cast<T>(str);
+        }
+        else
+        {
+            T value;
+            _pos = AlignUp( _pos, alignof(T) );
+            memcpy( &value, _payload + _pos, sizeof( T ) );
+            _pos += sizeof( T );
+
+            return value;
+        }
+    }
+
+private:
+    const uint8_t* _payload;
+    size_t _pos = 0;
+};
+
+/// <summary>
+/// Format queued record
+/// </summary>
+/// <param name="record">Record</param>
+template<typename Ch, typename... Args>
+void FormatRecord( const TraceRecord& record )
+{
+    PayloadReader reader( record.payload );
+
+    // Braced initialization reads arguments in order
+    std::tuple<Args...> args{ reader.Read<Args>()... };
+
+    std::apply( [&record]( auto... values )
+    {
+        Ch buf[1024];
+        if constexpr (std::is_same_v<Ch, char>)
+            _snprintf_s( buf, _TRUNCATE, static_cast<const char*>(record.fmt), values... );
+        else
+            _snwprintf_s( buf, _TRUNCATE, static_cast<const wchar_t*>(record.fmt), values... );
+
+        EmitMessage( record, buf );
+    }, args );
 }
 
-template<typename Ch>
-inline void DoTrace( const Ch* fmt, ... )
+}
+
+#ifndef BLACKBONE_NO_TRACE
+
+/// <summary>
+/// Queue trace record. Only raw arguments are copied, formatting is deferred
+/// </summary>
+/// <param name="fmt">Format string literal</param>
+/// <param name="args">Arguments</param>
+template<typename Ch, typename... Args>
+inline void DoTrace( const Ch* fmt, const Args&... args )
 {
-    va_list va_args;
-    va_start( va_args, fmt );
-    DoTraceV( fmt, va_args );
-    va_end( va_args );
+    using namespace tracing;
+
+    auto record = AcquireRecord();
+    if (record == nullptr)
+        return;
+
+    record->fmt = fmt;
+    record->format = &FormatRecord<Ch, std::decay_t<Args>...>;
+
+    PayloadWriter writer( record->payload );
+    (writer.Write<std::decay_t<Args>>( args, Layout<std::decay_t<Args>...>::perString ), ...);
+
+    CommitRecord( record );
 }
 
 #define BLACKBONE_TRACE(fmt, ...) DoTrace(fmt, ##__VA_ARGS__)
@@ -51,4 +283,4 @@ inline void DoTrace( const Ch* fmt, ... )
 #define BLACKBONE_TRACE(...)
 #endif
 
-}
\ No newline at end of file
+}
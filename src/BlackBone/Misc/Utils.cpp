@@ -4,10 +4,102 @@
 
 #include <algorithm>
 #include <random>
+#include <intrin.h>
 
 namespace blackbone
 {
 
+/// <summary>
+/// Widen leading ASCII characters
+/// </summary>
+/// <param name="src">Source string</param>
+/// <param name="length">Source length</param>
+/// <param name="dst">Output, at least 'length' characters</param>
+/// <returns>Number of converted characters, stops at first non-ASCII one</returns>
+static size_t WidenAscii( const char* src, size_t length, wchar_t* dst )
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+
+    for (; i + 16 <= length; i += 16)
+    {
+        __m128i d = _mm_loadu_si128( reinterpret_cast<const __m128i*>(src + i) );
+        if (_mm_movemask_epi8( d ) != 0)
+            break;
+
+        _mm_storeu_si128( reinterpret_cast<__m128i*>(dst + i), _mm_unpacklo_epi8( d, zero ) );
+        _mm_storeu_si128( reinterpret_cast<__m128i*>(dst + i + 8), _mm_unpackhi_epi8( d, zero ) );
+    }
+
+    for (; i < length && static_cast<uint8_t>(src[i]) < 0x80; i++)
+        dst[i] = static_cast<wchar_t>(src[i]);
+
+    return i;
+}
+
+/// <summary>
+/// Lower case conversion. Blocks of ASCII characters are converted with SSE2, others fall back to towlower
+/// </summary>
+/// <param name="src">Source string</param>
+/// <param name="length">Source length</param>
+/// <param name="dst">Output, at least 'length' characters. May be the same as source</param>
+static void ToLowerAscii( const wchar_t* src, size_t length, wchar_t* dst )
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i high = _mm_set1_epi16( static_cast<short>(0xFF80) );
+    const __m128i upperA = _mm_set1_epi16( L'A' - 1 );
+    const __m128i upperZ = _mm_set1_epi16( L'Z' + 1 );
+    const __m128i delta = _mm_set1_epi16( L'a' - L'A' );
+    size_t i = 0;
+
+    for (; i + 8 <= length; i += 8)
+    {
+        __m128i d = _mm_loadu_si128( reinterpret_cast<const __m128i*>(src + i) );
+        if (_mm_movemask_epi8( _mm_cmpeq_epi16( _mm_and_si128( d, high ), zero ) ) != 0xFFFF)
+        {
+            for (size_t j = i; j < i + 8; j++)
+                dst[j] = static_cast<wchar_t>(towlower( src[j] ));
+
+            continue;
+        }
+
+        __m128i upper = _mm_and_si128( _mm_cmpgt_epi16( d, upperA ), _mm_cmplt_epi16( d, upperZ ) );
+        _mm_storeu_si128( reinterpret_cast<__m128i*>(dst + i), _mm_add_epi16( d, _mm_and_si128( upper, delta ) ) );
+    }
+
+    for (; i < length; i++)
+        dst[i] = static_cast<wchar_t>(towlower( src[i] ));
+}
+
+/// <summary>
+/// Narrow leading ASCII characters
+/// </summary>
+/// <param name="src">Source string</param>
+/// <param name="length">Source length</param>
+/// <param name="dst">Output, at least 'length' bytes</param>
+/// <returns>Number of converted characters, stops at first non-ASCII one</returns>
+static size_t NarrowAscii( const wchar_t* src, size_t length, char* dst )
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i high = _mm_set1_epi16( static_cast<short>(0xFF80) );
+    size_t i = 0;
+
+    for (; i + 16 <= length; i += 16)
+    {
+        __m128i lo = _mm_loadu_si128( reinterpret_cast<const __m128i*>(src + i) );
+        __m128i hi = _mm_loadu_si128( reinterpret_cast<const __m128i*>(src + i + 8) );
+        if (_mm_movemask_epi8( _mm_cmpeq_epi16( _mm_and_si128( _mm_or_si128( lo, hi ), high ), zero ) ) != 0xFFFF)
+            break;
+
+        _mm_storeu_si128( reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16( lo, hi ) );
+    }
+
+    for (; i < length && src[i] < 0x80; i++)
+        dst[i] = static_cast<char>(src[i]);
+
+    return i;
+}
+
 /// <summary>
 /// Convert UTF-8 string to wide char one
 /// </summary>
@@ -36,9 +128,20 @@ std::string Utils::WstringToUTF8( const std::wstring& str )
 /// <returns>wide char string</returns>
 std::wstring Utils::AnsiToWstring( const std::string& input, DWORD locale /*= CP_ACP*/ )
 {
-    wchar_t buf[2048] = { 0 };
-    MultiByteToWideChar( locale, 0, input.c_str(), (int)input.length(), buf, ARRAYSIZE( buf ) );
-    return buf;
+    // Every character takes at least one byte
+    std::wstring result( input.size(), L'\0' );
+
+    size_t done = WidenAscii( input.data(), input.size(), result.data() );
+    if (done < input.size())
+    {
+        done += MultiByteToWideChar(
+            locale, 0, input.data() + done, static_cast<int>(input.size() - done),
+            result.data() + done, static_cast<int>(result.size() - done)
+        );
+    }
+
+    result.resize( done );
+    return result;
 }
 
 /// <summary>
@@ -49,9 +152,92 @@ std::wstring Utils::AnsiToWstring( const std::string& input, DWORD locale /*= CP
 /// <returns>ANSI string</returns>
 std::string Utils::WstringToAnsi( const std::wstring& input, DWORD locale /*= CP_ACP*/ )
 {
-    char buf[2048] = { 0 };
-    WideCharToMultiByte( locale, 0, input.c_str(), (int)input.length(), buf, ARRAYSIZE( buf ), nullptr, nullptr );
-    return buf;
+    std::string result( input.size(), '\0' );
+
+    size_t done = NarrowAscii( input.data(), input.size(), result.data() );
+    if (done < input.size())
+    {
+        auto src = input.data() + done;
+        int srcLength = static_cast<int>(input.size() - done);
+        int length = WideCharToMultiByte( locale, 0, src, srcLength, nullptr, 0, nullptr, nullptr );
+
+        result.resize( done + length );
+        done += WideCharToMultiByte( locale, 0, src, srcLength, result.data() + done, length, nullptr, nullptr );
+    }
+
+    result.resize( done );
+    return result;
+}
+
+/// <summary>
+/// Convert ANSI or UTF-8 string into caller buffer without allocations.
+/// ASCII characters are widened directly, code page conversion is used only for the rest
+/// </summary>
+/// <param name="input">ANSI string</param>
+/// <param name="buf">Output buffer, result is null-terminated</param>
+/// <param name="size">Buffer size in characters</param>
+/// <param name="locale">String locale</param>
+/// <returns>Result length, 0 if buffer is too small</returns>
+size_t Utils::AnsiToWstring( std::string_view input, wchar_t* buf, size_t size, DWORD locale /*= CP_ACP*/ )
+{
+    if (size == 0)
+        return 0;
+
+    // ASCII prefix always ends on character boundary
+    size_t done = WidenAscii( input.data(), std::min( input.size(), size - 1 ), buf );
+    if (done < input.size())
+    {
+        int length = MultiByteToWideChar(
+            locale, 0, input.data() + done, static_cast<int>(input.size() - done),
+            buf + done, static_cast<int>(size - 1 - done)
+        );
+
+        if (length <= 0)
+        {
+            buf[0] = L'\0';
+            return 0;
+        }
+
+        done += length;
+    }
+
+    buf[done] = L'\0';
+    return done;
+}
+
+/// <summary>
+/// Convert wide char string into caller buffer without allocations.
+/// ASCII characters are narrowed directly, code page conversion is used only for the rest
+/// </summary>
+/// <param name="input">Wide char string</param>
+/// <param name="buf">Output buffer, result is null-terminated</param>
+/// <param name="size">Buffer size in bytes</param>
+/// <param name="locale">String locale</param>
+/// <returns>Result length, 0 if buffer is too small</returns>
+size_t Utils::WstringToAnsi( std::wstring_view input, char* buf, size_t size, DWORD locale /*= CP_ACP*/ )
+{
+    if (size == 0)
+        return 0;
+
+    size_t done = NarrowAscii( input.data(), std::min( input.size(), size - 1 ), buf );
+    if (done < input.size())
+    {
+        int length = WideCharToMultiByte(
+            locale, 0, input.data() + done, static_cast<int>(input.size() - done),
+            buf + done, static_cast<int>(size - 1 - done), nullptr, nullptr
+        );
+
+        if (length <= 0)
+        {
+            buf[0] = '\0';
+            return 0;
+        }
+
+        done += length;
+    }
+
+    buf[done] = '\0';
+    return done;
 }
 
 /// <summary>
@@ -161,10 +347,32 @@ std::wstring Utils::RandomANString( int length /*= 0*/ )
 /// <returns>Result string</returns>
 std::wstring Utils::ToLower( std::wstring str )
 {
-    std::transform( str.begin(), str.end(), str.begin(), ::towlower );
+    ToLowerAscii( str.data(), str.size(), str.data() );
     return str;
 }
 
+/// <summary>
+/// Cast string characters to lower case into caller buffer without allocations
+/// </summary>
+/// <param name="str">Source string</param>
+/// <param name="buf">Output buffer, result is null-terminated. May be the same as source</param>
+/// <param name="size">Buffer size in characters</param>
+/// <returns>Result length, 0 if buffer is too small</returns>
+size_t Utils::ToLower( std::wstring_view str, wchar_t* buf, size_t size )
+{
+    if (size <= str.size())
+    {
+        if (size != 0)
+            buf[0] = L'\0';
+
+        return 0;
+    }
+
+    ToLowerAscii( str.data(), str.size(), buf );
+    buf[str.size()] = L'\0';
+    return str.size();
+}
+
 /// <summary>
 /// Get system error description
 /// </summary>
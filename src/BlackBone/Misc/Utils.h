@@ -2,6 +2,7 @@
 
 #include "../Include/Winheaders.h"
 #include <string>
+#include <string_view>
 #include <vector>
 #include <tuple>
 
@@ -41,6 +42,52 @@ public:
     /// <returns>ANSI string</returns>
     BLACKBONE_API static std::string WstringToAnsi( const std::wstring& input, DWORD locale = CP_ACP );
 
+    /// <summary>
+    /// Convert ANSI or UTF-8 string into caller buffer without allocations.
+    /// ASCII characters are widened directly, code page conversion is used only for the rest
+    /// </summary>
+    /// <param name="input">ANSI string</param>
+    /// <param name="buf">Output buffer, result is null-terminated</param>
+    /// <param name="size">Buffer size in characters</param>
+    /// <param name="locale">String locale</param>
+    /// <returns>Result length, 0 if buffer is too small</returns>
+    BLACKBONE_API static size_t AnsiToWstring( std::string_view input, wchar_t* buf, size_t size, DWORD locale = CP_ACP );
+
+    /// <summary>
+    /// Convert wide char string into caller buffer without allocations.
+    /// ASCII characters are narrowed directly, code page conversion is used only for the rest
+    /// </summary>
+    /// <param name="input">Wide char string</param>
+    /// <param name="buf">Output buffer, result is null-terminated</param>
+    /// <param name="size">Buffer size in bytes</param>
+    /// <param name="locale">String locale</param>
+    /// <returns>Result length, 0 if buffer is too small</returns>
+    BLACKBONE_API static size_t WstringToAnsi( std::wstring_view input, char* buf, size_t size, DWORD locale = CP_ACP );
+
+    /// <summary>
+    /// Convert UTF-8 string into caller buffer
+    /// </summary>
+    /// <param name="str">UTF-8 string</param>
+    /// <param name="buf">Output buffer, result is null-terminated</param>
+    /// <param name="size">Buffer size in characters</param>
+    /// <returns>Result length, 0 if buffer is too small</returns>
+    static size_t UTF8ToWstring( std::string_view str, wchar_t* buf, size_t size )
+    {
+        return AnsiToWstring( str, buf, size, CP_UTF8 );
+    }
+
+    /// <summary>
+    /// Convert wide string to UTF-8 into caller buffer
+    /// </summary>
+    /// <param name="str">Wide char string</param>
+    /// <param name="buf">Output buffer, result is null-terminated</param>
+    /// <param name="size">Buffer size in bytes</param>
+    /// <returns>Result length, 0 if buffer is too small</returns>
+    static size_t WstringToUTF8( std::wstring_view str, char* buf, size_t size )
+    {
+        return WstringToAnsi( str, buf, size, CP_UTF8 );
+    }
+
     /// <summary>
     /// Format string
     /// </summary>
@@ -76,6 +123,15 @@ public:
     /// <returns>Result string</returns>
     BLACKBONE_API static std::wstring ToLower( std::wstring str );
 
+    /// <summary>
+    /// Cast string characters to lower case into caller buffer without allocations
+    /// </summary>
+    /// <param name="str">Source string</param>
+    /// <param name="buf">Output buffer, result is null-terminated. May be the same as source</param>
+    /// <param name="size">Buffer size in characters</param>
+    /// <returns>Result length, 0 if buffer is too small</returns>
+    BLACKBONE_API static size_t ToLower( std::wstring_view str, wchar_t* buf, size_t size );
+
     /// <summary>
     /// Generate random alpha-numeric string
     /// </summary>
@@ -125,6 +181,11 @@ public:
         LeaveCriticalSection( &_native );
     }
 
+    BLACKBONE_API bool try_lock()
+    {
+        return TryEnterCriticalSection( &_native ) != FALSE;
+    }
+
 private:
     CRITICAL_SECTION _native;
 };
@@ -155,6 +216,117 @@ private:
     CriticalSection& _cs;
 };
 
+/// <summary>
+/// std::shared_mutex alternative. Not recursive
+/// </summary>
+class ReadWriteLock
+{
+public:
+    BLACKBONE_API ReadWriteLock()
+    {
+#ifndef XP_BUILD
+        InitializeSRWLock( &_native );
+#endif
+    }
+
+    BLACKBONE_API void lock()
+    {
+#ifndef XP_BUILD
+        AcquireSRWLockExclusive( &_native );
+#else
+        _native.lock();
+#endif
+    }
+
+    BLACKBONE_API void unlock()
+    {
+#ifndef XP_BUILD
+        ReleaseSRWLockExclusive( &_native );
+#else
+        _native.unlock();
+#endif
+    }
+
+    BLACKBONE_API void lock_shared()
+    {
+#ifndef XP_BUILD
+        AcquireSRWLockShared( &_native );
+#else
+        _native.lock();
+#endif
+    }
+
+    BLACKBONE_API void unlock_shared()
+    {
+#ifndef XP_BUILD
+        ReleaseSRWLockShared( &_native );
+#else
+        _native.unlock();
+#endif
+    }
+
+private:
+    ReadWriteLock( const ReadWriteLock& ) = delete;
+    ReadWriteLock& operator = ( const ReadWriteLock& ) = delete;
+
+private:
+#ifndef XP_BUILD
+    SRWLOCK _native;
+#else
+    CriticalSection _native;
+#endif
+};
+
+/// <summary>
+/// std::shared_lock alternative
+/// </summary>
+class SharedLock
+{
+public:
+    BLACKBONE_API SharedLock( ReadWriteLock& rw )
+        : _rw( rw )
+    {
+        rw.lock_shared();
+    }
+
+    BLACKBONE_API ~SharedLock()
+    {
+        _rw.unlock_shared();
+    }
+
+private:
+    SharedLock( const SharedLock& ) = delete;
+    SharedLock& operator = ( const SharedLock& ) = delete;
+
+private:
+    ReadWriteLock& _rw;
+};
+
+/// <summary>
+/// std::unique_lock alternative
+/// </summary>
+class ExclusiveLock
+{
+public:
+    BLACKBONE_API ExclusiveLock( ReadWriteLock& rw )
+        : _rw( rw )
+    {
+        rw.lock();
+    }
+
+    BLACKBONE_API ~ExclusiveLock()
+    {
+        _rw.unlock();
+    }
+
+private:
+    ExclusiveLock( const ExclusiveLock& ) = delete;
+    ExclusiveLock& operator = ( const ExclusiveLock& ) = delete;
+
+private:
+    ReadWriteLock& _rw;
+};
+
 
 /// <summary>
 /// System32 helper
@@ -190,8 +362,8 @@ namespace tuple_detail
     template<typename T, typename F, size_t... Is>
     void visit_each( T&& t, F f, std::index_sequence<Is...> ) { auto l = { (f( std::get<Is>( t ) ), 0)... }; }
 
-    template<typename... Ts>
-    void copyTuple( std::tuple<Ts...> const& from, std::vector<char>& to )
+    template<typename Buffer, typename... Ts>
+    void copyTuple( std::tuple<Ts...> const& from, Buffer& to )
     {
         auto func = [&to]( auto& v )
         {
@@ -0,0 +1,371 @@
+#include "ImageCache.h"
+#include "../Misc/BinaryStream.h"
+
+namespace blackbone
+{
+
+namespace pe
+{
+
+// 'BBIC'
+constexpr uint32_t CacheMagic = 0x43494242;
+constexpr uint32_t CacheVersion = 2;
+
+/// <summary>
+/// Serialize import table
+/// </summary>
+/// <param name="writer">Output</param>
+/// <param name="imports">Imports</param>
+static void WriteImports( BinaryWriter& writer, const mapImports& imports )
+{
+    writer.put( static_cast<uint32_t>(imports.size()) );
+    for (const auto& mod : imports)
+    {
+        writer.put( mod.first );
+        writer.put( static_cast<uint32_t>(mod.second.size()) );
+
+        for (const auto& imp : mod.second)
+        {
+            writer.put( imp.importName );
+            writer.put( static_cast<uint64_t>(imp.ptrRVA) );
+            writer.put( imp.importOrdinal );
+            writer.put( static_cast<uint8_t>(imp.importByOrd) );
+        }
+    }
+}
+
+/// <summary>
+/// Deserialize import table
+/// </summary>
+/// <param name="reader">Input</param>
+/// <param name="imports">Imports</param>
+/// <returns>true on success</returns>
+static bool ReadImports( BinaryReader& reader, mapImports& imports )
+{
+    uint32_t modCount = 0;
+    if (!reader.get( modCount ))
+        return false;
+
+    for (uint32_t i = 0; i < modCount; i++)
+    {
+        std::wstring name;
+        uint32_t count = 0;
+        if (!reader.getString( name ) || !reader.get( count ))
+            return false;
+
+        auto& entries = imports[name];
+        for (uint32_t j = 0; j < count; j++)
+        {
+            ImportData data;
+            uint64_t rva = 0;
+            uint8_t byOrd = 0;
+
+            if (!reader.getString( data.importName ) || !reader.get( rva ) || !reader.get( data.importOrdinal ) || !reader.get( byOrd ))
+                return false;
+
+            data.ptrRVA = static_cast<uintptr_t>(rva);
+            data.importByOrd = byOrd != 0;
+            entries.emplace_back( std::move( data ) );
+        }
+    }
+
+    return true;
+}
+
+/// <summary>
+/// Serialize image metadata
+/// </summary>
+/// <param name="writer">Output</param>
+/// <param name="data">Image metadata</param>
+static void WriteMetadata( BinaryWriter& writer, const ImageMetadata& data )
+{
+    writer.put( static_cast<uint64_t>(data.imageBase) );
+    writer.put( data.imageSize );
+    writer.put( data.epRVA );
+    writer.put( data.hdrSize );
+    writer.put( data.subsystem );
+    writer.put( data.dllCharacteristics );
+    writer.put( data.ilFlagOffset );
+    writer.put( static_cast<uint8_t>(data.is64) );
+    writer.put( static_cast<uint8_t>(data.isExe) );
+    writer.put( static_cast<uint8_t>(data.isPureIL) );
+
+    writer.put( data.headers.data(), data.headers.size() );
+    writer.put( data.sections.data(), data.sections.size() * sizeof( IMAGE_SECTION_HEADER ) );
+    WriteImports( writer, data.imports );
+    WriteImports( writer, data.delayImports );
+
+    writer.put( static_cast<uint32_t>(data.exports.size()) );
+    for (const auto& exp : data.exports)
+    {
+        writer.put( exp.name );
+        writer.put( exp.RVA );
+        writer.put( exp.ordinal );
+    }
+
+    writer.put( data.relocations.data(), data.relocations.size() );
+    writer.put( data.tlsCallbacks.data(), data.tlsCallbacks.size() * sizeof( uint32_t ) );
+}
+
+/// <summary>
+/// Deserialize image metadata
+/// </summary>
+/// <param name="reader">Input</param>
+/// <param name="data">Image metadata</param>
+/// <returns>true on success</returns>
+static bool ReadMetadata( BinaryReader& reader, ImageMetadata& data )
+{
+    uint64_t imageBase = 0;
+    uint8_t is64 = 0, isExe = 0, isPureIL = 0;
+    std::vector<uint8_t> sections, tls;
+    uint32_t exportCount = 0;
+
+    if (!reader.get( imageBase ) || !reader.get( data.imageSize ) || !reader.get( data.epRVA ) ||
+        !reader.get( data.hdrSize ) || !reader.get( data.subsystem ) || !reader.get( data.dllCharacteristics ) ||
+        !reader.get( data.ilFlagOffset ) || !reader.get( is64 ) || !reader.get( isExe ) || !reader.get( isPureIL ))
+    {
+        return false;
+    }
+
+    data.imageBase = static_cast<ptr_t>(imageBase);
+    data.is64 = is64 != 0;
+    data.isExe = isExe != 0;
+    data.isPureIL = isPureIL != 0;
+
+    if (!reader.getBytes( data.headers ) || !reader.getBytes( sections ) || sections.size() % sizeof( IMAGE_SECTION_HEADER ) != 0)
+        return false;
+
+    data.sections.resize( sections.size() / sizeof( IMAGE_SECTION_HEADER ) );
+    if (!sections.empty())
+        memcpy( data.sections.data(), sections.data(), sections.size() );
+
+    if (!ReadImports( reader, data.imports ) || !ReadImports( reader, data.delayImports ) || !reader.get( exportCount ))
+        return false;
+
+    for (uint32_t i = 0; i < exportCount; i++)
+    {
+        std::string name;
+        uint32_t rva = 0;
+        WORD ordinal = 0;
+        if (!reader.getString( name ) || !reader.get( rva ) || !reader.get( ordinal ))
+            return false;
+
+        data.exports.emplace_back( name, rva, ordinal );
+    }
+
+    if (!reader.getBytes( data.relocations ) || !reader.getBytes( tls ) || tls.size() % sizeof( uint32_t ) != 0)
+        return false;
+
+    data.tlsCallbacks.resize( tls.size() / sizeof( uint32_t ) );
+    if (!tls.empty())
+        memcpy( data.tlsCallbacks.data(), tls.data(), tls.size() );
+
+    return true;
+}
+
+ImageCache::~ImageCache()
+{
+    Flush();
+}
+
+/// <summary>
+/// Enable cache and load existing cache file, if any
+/// </summary>
+/// <param name="path">Cache file path</param>
+/// <returns>Status code</returns>
+NTSTATUS ImageCache::Open( const std::wstring& path )
+{
+    CSLock lck( _lock );
+
+    _entries.clear();
+    _path = path;
+    _dirty = false;
+
+    auto hFile = Handle( CreateFileW( path.c_str(), FILE_GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL ) );
+    if (!hFile)
+    {
+        // Cache will be created on flush
+        return GetLastError() == ERROR_FILE_NOT_FOUND ? STATUS_SUCCESS : LastNtStatus();
+    }
+
+    LARGE_INTEGER size = { { 0 } };
+    if (!GetFileSizeEx( hFile, &size ) || size.HighPart != 0)
+        return STATUS_FILE_TOO_LARGE;
+
+    std::vector<uint8_t> buf( size.LowPart );
+    DWORD bytes = 0;
+    if (!ReadFile( hFile, buf.data(), size.LowPart, &bytes, NULL ) || bytes != size.LowPart)
+        return LastNtStatus();
+
+    BinaryReader reader( buf.data(), buf.size() );
+    uint32_t magic = 0, version = 0, count = 0;
+
+    // Stale or foreign file, start from scratch
+    if (!reader.get( magic ) || !reader.get( version ) || !reader.get( count ) || magic != CacheMagic || version != CacheVersion)
+        return STATUS_SUCCESS;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        FileKey key;
+        ImageMetadata data;
+
+        if (!reader.get( key.volume ) || !reader.get( key.fileId ) || !reader.get( key.lastWrite ) || !ReadMetadata( reader, data ))
+        {
+            _entries.clear();
+            break;
+        }
+
+        _entries.emplace( key, std::move( data ) );
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Write modified cache to disk
+/// </summary>
+/// <returns>Status code</returns>
+NTSTATUS ImageCache::Flush()
+{
+    CSLock lck( _lock );
+
+    if (!_dirty || _path.empty())
+        return STATUS_SUCCESS;
+
+    BinaryWriter writer;
+    writer.put( CacheMagic );
+    writer.put( CacheVersion );
+    writer.put( static_cast<uint32_t>(_entries.size()) );
+
+    for (const auto& entry : _entries)
+    {
+        writer.put( entry.first.volume );
+        writer.put( entry.first.fileId );
+        writer.put( entry.first.lastWrite );
+        WriteMetadata( writer, entry.second );
+    }
+
+    // Write to temporary file first, so readers never see partial cache
+    auto tmpPath = _path + L".tmp";
+    auto hFile = Handle( CreateFileW( tmpPath.c_str(), FILE_GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, 0, NULL ) );
+    if (!hFile)
+        return LastNtStatus();
+
+    DWORD bytes = 0;
+    auto& data = writer.data();
+    if (!WriteFile( hFile, data.data(), static_cast<DWORD>(data.size()), &bytes, NULL ) || bytes != data.size())
+    {
+        auto status = LastNtStatus();
+        hFile.reset();
+        DeleteFileW( tmpPath.c_str() );
+        return status;
+    }
+
+    hFile.reset();
+    if (!MoveFileExW( tmpPath.c_str(), _path.c_str(), MOVEFILE_REPLACE_EXISTING ))
+        return LastNtStatus();
+
+    _dirty = false;
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Flush and disable cache
+/// </summary>
+void ImageCache::Close()
+{
+    Flush();
+
+    CSLock lck( _lock );
+    _entries.clear();
+    _path.clear();
+}
+
+/// <summary>
+/// Cache was opened
+/// </summary>
+bool ImageCache::enabled() const
+{
+    CSLock lck( _lock );
+    return !_path.empty();
+}
+
+/// <summary>
+/// Find metadata for a file
+/// </summary>
+/// <param name="imagePath">Image path</param>
+/// <param name="data">Found metadata</param>
+/// <returns>true if file is cached and wasn't modified since</returns>
+bool ImageCache::Lookup( const std::wstring& imagePath, ImageMetadata& data )
+{
+    if (!enabled())
+        return false;
+
+    FileKey key;
+    if (!GetFileKey( imagePath, key ))
+        return false;
+
+    CSLock lck( _lock );
+
+    auto iter = _entries.find( key );
+    if (iter == _entries.end())
+        return false;
+
+    data = iter->second;
+    return true;
+}
+
+/// <summary>
+/// Add or replace file metadata
+/// </summary>
+/// <param name="imagePath">Image path</param>
+/// <param name="data">Image metadata</param>
+/// <returns>true on success</returns>
+bool ImageCache::Store( const std::wstring& imagePath, const ImageMetadata& data )
+{
+    if (!enabled())
+        return false;
+
+    FileKey key;
+    if (!GetFileKey( imagePath, key ))
+        return false;
+
+    CSLock lck( _lock );
+
+    _entries[key] = data;
+    _dirty = true;
+
+    return true;
+}
+
+/// <summary>
+/// Get file identity
+/// </summary>
+/// <param name="path">File path</param>
+/// <param name="key">File key</param>
+/// <returns>true on success</returns>
+bool ImageCache::GetFileKey( const std::wstring& path, FileKey& key )
+{
+    auto hFile = Handle( CreateFileW(
+        path.c_str(), FILE_READ_ATTRIBUTES,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        NULL, OPEN_EXISTING, 0, NULL
+        ) );
+
+    if (!hFile)
+        return false;
+
+    BY_HANDLE_FILE_INFORMATION info = { 0 };
+    if (!GetFileInformationByHandle( hFile, &info ))
+        return false;
+
+    key.volume = info.dwVolumeSerialNumber;
+    key.fileId = (static_cast<uint64_t>(info.nFileIndexHigh) << 32) | info.nFileIndexLow;
+    key.lastWrite = (static_cast<uint64_t>(info.ftLastWriteTime.dwHighDateTime) << 32) | info.ftLastWriteTime.dwLowDateTime;
+
+    return true;
+}
+
+}
+
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include "PEImage.h"
+#include "../Misc/Utils.h"
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+namespace blackbone
+{
+
+namespace pe
+{
+
+/// <summary>
+/// Parsed image metadata, independent of file mapping
+/// </summary>
+struct ImageMetadata
+{
+    ptr_t imageBase = 0;                    // Image base
+    uint32_t imageSize = 0;                 // Image size
+    uint32_t epRVA = 0;                     // Entry point RVA
+    uint32_t hdrSize = 0;                   // Size of headers
+    uint32_t subsystem = 0;                 // Image subsystem
+    uint32_t dllCharacteristics = 0;        // DllCharacteristics flags
+    int32_t ilFlagOffset = 0;               // Offset of pure IL flag
+    bool is64 = false;                      // Image is 64 bit
+    bool isExe = false;                     // Image is an .exe file
+    bool isPureIL = false;                  // Pure IL image
+
+    std::vector<uint8_t> headers;           // Raw NT headers
+    vecSections sections;                   // Section headers
+    mapImports imports;                     // Import functions
+    mapImports delayImports;                // Delayed import functions
+    vecExports exports;                     // Named exports, sorted
+    std::vector<uint8_t> relocations;       // Raw base relocation directory
+    std::vector<uint32_t> tlsCallbacks;     // TLS callback RVAs
+};
+
+/// <summary>
+/// Persistent on-disk cache of parsed image metadata.
+/// Entries are keyed by volume serial, file ID and last write time, so replaced or updated files are never matched.
+/// Cache is disabled until Open is called.
+/// </summary>
+class ImageCache
+{
+public:
+    BLACKBONE_API static ImageCache& Instance()
+    {
+        static ImageCache instance;
+        return instance;
+    }
+
+    ImageCache() = default;
+    ImageCache( const ImageCache& ) = delete;
+    BLACKBONE_API ~ImageCache();
+
+    /// <summary>
+    /// Enable cache and load existing cache file, if any
+    /// </summary>
+    /// <param name="path">Cache file path</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS Open( const std::wstring& path );
+
+    /// <summary>
+    /// Write modified cache to disk
+    /// </summary>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS Flush();
+
+    /// <summary>
+    /// Flush and disable cache
+    /// </summary>
+    BLACKBONE_API void Close();
+
+    /// <summary>
+    /// Find metadata for a file
+    /// </summary>
+    /// <param name="imagePath">Image path</param>
+    /// <param name="data">Found metadata</param>
+    /// <returns>true if file is cached and wasn't modified since</returns>
+    BLACKBONE_API bool Lookup( const std::wstring& imagePath, ImageMetadata& data );
+
+    /// <summary>
+    /// Add or replace file metadata
+    /// </summary>
+    /// <param name="imagePath">Image path</param>
+    /// <param name="data">Image metadata</param>
+    /// <returns>true on success</returns>
+    BLACKBONE_API bool Store( const std::wstring& imagePath, const ImageMetadata& data );
+
+    /// <summary>
+    /// Cache was opened
+    /// </summary>
+    BLACKBONE_API bool enabled() const;
+
+private:
+    /// <summary>
+    /// File identity
+    /// </summary>
+    struct FileKey
+    {
+        uint32_t volume = 0;        // Volume serial number
+        uint64_t fileId = 0;        // File index on volume
+        uint64_t lastWrite = 0;     // Last write time
+
+        bool operator == (const FileKey& other) const
+        {
+            return volume == other.volume && fileId == other.fileId && lastWrite == other.lastWrite;
+        }
+    };
+
+    struct FileKeyHash
+    {
+        size_t operator()( const FileKey& key ) const
+        {
+            return std::hash<uint64_t>()( key.fileId ) ^ std::hash<uint64_t>()( key.lastWrite ) ^ key.volume;
+        }
+    };
+
+    /// <summary>
+    /// Get file identity
+    /// </summary>
+    /// <param name="path">File path</param>
+    /// <param name="key">File key</param>
+    /// <returns>true on success</returns>
+    static bool GetFileKey( const std::wstring& path, FileKey& key );
+
+private:
+    std::unordered_map<FileKey, ImageMetadata, FileKeyHash> _entries;   // Cached images
+    std::wstring _path;                                                 // Cache file
+    bool _dirty = false;                                                // Cache was modified since last flush
+    mutable CriticalSection _lock;                                      // Cache guard
+};
+
+}
+
+}
@@ -0,0 +1,308 @@
+#include "NetMetadata.h"
+#include "PEImage.h"
+#include "../Misc/Utils.h"
+
+#include <algorithm>
+
+namespace blackbone
+{
+
+namespace pe
+{
+
+constexpr uint32_t MetadataSignature = 0x424A5342;  // 'BSJB'
+
+// Metadata table numbers
+constexpr uint32_t TblModule      = 0x00;
+constexpr uint32_t TblTypeRef     = 0x01;
+constexpr uint32_t TblTypeDef     = 0x02;
+constexpr uint32_t TblFieldPtr    = 0x03;
+constexpr uint32_t TblField       = 0x04;
+constexpr uint32_t TblMethodPtr   = 0x05;
+constexpr uint32_t TblMethodDef   = 0x06;
+constexpr uint32_t TblParam       = 0x08;
+constexpr uint32_t TblModuleRef   = 0x1A;
+constexpr uint32_t TblTypeSpec    = 0x1B;
+constexpr uint32_t TblAssemblyRef = 0x23;
+constexpr uint32_t TblCount       = 0x40;
+
+/// <summary>
+/// Read 2 or 4 byte little-endian column and advance pointer
+/// </summary>
+/// <param name="ptr">Column address</param>
+/// <param name="width">Column width</param>
+/// <returns>Column value</returns>
+inline uint32_t ReadColumn( const uint8_t*& ptr, uint32_t width )
+{
+    uint32_t value = 0;
+    memcpy( &value, ptr, width );
+    ptr += width;
+    return value;
+}
+
+/// <summary>
+/// Get string from #Strings heap
+/// </summary>
+/// <param name="heap">Heap start</param>
+/// <param name="size">Heap size</param>
+/// <param name="offset">String offset</param>
+/// <returns>String, empty if offset is out of heap</returns>
+static std::wstring HeapString( const uint8_t* heap, size_t size, uint32_t offset )
+{
+    if (offset >= size)
+        return std::wstring();
+
+    auto start = reinterpret_cast<const char*>(heap + offset);
+    auto end = std::find( start, reinterpret_cast<const char*>(heap + size), '\0' );
+
+    return Utils::UTF8ToWstring( std::string( start, end ) );
+}
+
+/// <summary>
+/// Parse metadata of a .NET image
+/// </summary>
+/// <param name="image">Loaded image</param>
+/// <returns>Status code, STATUS_INVALID_IMAGE_FORMAT if image has no valid metadata</returns>
+NTSTATUS NetMetadata::Parse( const PEImage& image )
+{
+    auto pCorHdr = reinterpret_cast<const IMAGE_COR20_HEADER*>(image.DirectoryAddress( IMAGE_DIRECTORY_ENTRY_COM_DESCRIPTOR ));
+    if (pCorHdr == nullptr || pCorHdr->MetaData.VirtualAddress == 0)
+    {
+        clear();
+        return STATUS_INVALID_IMAGE_FORMAT;
+    }
+
+    auto pRoot = image.ResolveRVAToVA( pCorHdr->MetaData.VirtualAddress );
+    if (pRoot == 0)
+    {
+        clear();
+        return STATUS_INVALID_IMAGE_FORMAT;
+    }
+
+    return Parse( reinterpret_cast<const void*>(pRoot), pCorHdr->MetaData.Size );
+}
+
+/// <summary>
+/// Parse metadata root
+/// </summary>
+/// <param name="pRoot">Metadata root, 'BSJB' signature</param>
+/// <param name="size">Metadata size</param>
+/// <returns>Status code, STATUS_INVALID_IMAGE_FORMAT for malformed metadata</returns>
+NTSTATUS NetMetadata::Parse( const void* pRoot, size_t size )
+{
+    clear();
+
+    auto base = reinterpret_cast<const uint8_t*>(pRoot);
+    auto end = base + size;
+    auto ptr = base;
+
+    //
+    // Metadata root
+    //
+    if (size < 0x10)
+        return STATUS_INVALID_IMAGE_FORMAT;
+
+    if (ReadColumn( ptr, 4 ) != MetadataSignature)
+        return STATUS_INVALID_IMAGE_FORMAT;
+
+    ptr += 2 * sizeof( uint16_t ) + sizeof( uint32_t );     // MajorVersion, MinorVersion, Reserved
+    uint32_t verLength = ReadColumn( ptr, 4 );
+    if (verLength > static_cast<size_t>(end - ptr) || static_cast<size_t>(end - ptr) - verLength < 2 * sizeof( uint16_t ))
+        return STATUS_INVALID_IMAGE_FORMAT;
+
+    _version.assign( reinterpret_cast<const char*>(ptr), strnlen( reinterpret_cast<const char*>(ptr), verLength ) );
+    ptr += verLength;
+
+    ptr += sizeof( uint16_t );                              // Flags
+    uint32_t streams = ReadColumn( ptr, 2 );
+
+    const uint8_t *tables = nullptr, *tablesEnd = nullptr;
+    const uint8_t *strings = nullptr;
+    size_t stringsSize = 0;
+
+    //
+    // Stream headers
+    //
+    for (uint32_t i = 0; i < streams; i++)
+    {
+        if (end - ptr < 2 * static_cast<ptrdiff_t>(sizeof( uint32_t )))
+            return STATUS_INVALID_IMAGE_FORMAT;
+
+        uint32_t offset = ReadColumn( ptr, 4 );
+        uint32_t streamSize = ReadColumn( ptr, 4 );
+
+        auto name = reinterpret_cast<const char*>(ptr);
+        size_t nameLength = strnlen( name, std::min<size_t>( end - ptr, 32 ) );
+        ptr += Align( nameLength + 1, 4 );
+
+        if (ptr > end || offset > size || streamSize > size - offset)
+            return STATUS_INVALID_IMAGE_FORMAT;
+
+        std::string streamName( name, nameLength );
+        if (streamName == "#~")
+        {
+            tables = base + offset;
+            tablesEnd = tables + streamSize;
+        }
+        else if (streamName == "#Strings")
+        {
+            strings = base + offset;
+            stringsSize = streamSize;
+        }
+        // Uncompressed tables with edit-and-continue indirections, only produced by incremental builds
+        else if (streamName == "#-")
+            return STATUS_NOT_SUPPORTED;
+    }
+
+    if (tables == nullptr || strings == nullptr || tablesEnd - tables < 0x18)
+        return STATUS_INVALID_IMAGE_FORMAT;
+
+    //
+    // '#~' stream header
+    //
+    ptr = tables + 6;                                       // Reserved, MajorVersion, MinorVersion
+    uint8_t heapSizes = *ptr;
+    ptr += 2;                                               // HeapSizes, Reserved
+
+    uint64_t valid = 0;
+    memcpy( &valid, ptr, sizeof( valid ) );
+    ptr += 2 * sizeof( uint64_t );                          // Valid, Sorted
+
+    uint32_t rows[TblCount] = { 0 };
+    for (uint32_t i = 0; i < TblCount; i++)
+    {
+        if (!(valid & (1ull << i)))
+            continue;
+
+        if (tablesEnd - ptr < static_cast<ptrdiff_t>(sizeof( uint32_t )))
+            return STATUS_INVALID_IMAGE_FORMAT;
+
+        rows[i] = ReadColumn( ptr, 4 );
+    }
+
+    //
+    // Column widths
+    //
+    const uint32_t strIdx = (heapSizes & 0x01) ? 4 : 2;
+    const uint32_t guidIdx = (heapSizes & 0x02) ? 4 : 2;
+    const uint32_t blobIdx = (heapSizes & 0x04) ? 4 : 2;
+
+    auto simpleIdx = [&rows]( uint32_t table ) { return rows[table] < 0x10000 ? 2u : 4u; };
+    auto codedIdx = [&rows]( std::initializer_list<uint32_t> targets, uint32_t tagBits )
+    {
+        uint32_t maxRows = 0;
+        for (auto table : targets)
+            maxRows = std::max( maxRows, rows[table] );
+
+        return maxRows < (1u << (16 - tagBits)) ? 2u : 4u;
+    };
+
+    const uint32_t typeDefOrRef = codedIdx( { TblTypeDef, TblTypeRef, TblTypeSpec }, 2 );
+    const uint32_t resolutionScope = codedIdx( { TblModule, TblModuleRef, TblAssemblyRef, TblTypeRef }, 2 );
+
+    uint32_t rowSize[TblMethodDef + 1] = { 0 };
+    rowSize[TblModule]    = 2 + strIdx + 3 * guidIdx;
+    rowSize[TblTypeRef]   = resolutionScope + 2 * strIdx;
+    rowSize[TblTypeDef]   = 4 + 2 * strIdx + typeDefOrRef + simpleIdx( TblField ) + simpleIdx( TblMethodDef );
+    rowSize[TblFieldPtr]  = simpleIdx( TblField );
+    rowSize[TblField]     = 2 + strIdx + blobIdx;
+    rowSize[TblMethodPtr] = simpleIdx( TblMethodDef );
+    rowSize[TblMethodDef] = 4 + 2 + 2 + strIdx + blobIdx + simpleIdx( TblParam );
+
+    // Tables are stored back to back in table number order
+    const uint8_t* tableStart[TblMethodDef + 1] = { nullptr };
+    for (uint32_t i = 0; i <= TblMethodDef; i++)
+    {
+        uint64_t tableSize = static_cast<uint64_t>(rows[i]) * rowSize[i];
+        if (static_cast<uint64_t>(tablesEnd - ptr) < tableSize)
+            return STATUS_INVALID_IMAGE_FORMAT;
+
+        tableStart[i] = ptr;
+        ptr += tableSize;
+    }
+
+    //
+    // MethodDef
+    //
+    _methods.resize( rows[TblMethodDef] );
+    for (uint32_t i = 0; i < rows[TblMethodDef]; i++)
+    {
+        auto row = tableStart[TblMethodDef] + static_cast<size_t>(i) * rowSize[TblMethodDef];
+        auto& method = _methods[i];
+
+        method.rva = ReadColumn( row, 4 );
+        row += 2 * sizeof( uint16_t );                      // ImplFlags, Flags
+        method.name = HeapString( strings, stringsSize, ReadColumn( row, strIdx ) );
+        method.token = (TblMethodDef << 24) | (i + 1);
+    }
+
+    //
+    // TypeDef. Type owns methods from its MethodList up to MethodList of the next type
+    //
+    const bool indirect = rows[TblMethodPtr] != 0;
+    const uint32_t listRows = indirect ? rows[TblMethodPtr] : rows[TblMethodDef];
+    const uint32_t fieldIdx = simpleIdx( TblField );
+    const uint32_t methodIdx = simpleIdx( TblMethodDef );
+
+    auto methodList = [&]( uint32_t typeRow )
+    {
+        if (typeRow >= rows[TblTypeDef])
+            return listRows + 1;
+
+        auto row = tableStart[TblTypeDef] + static_cast<size_t>(typeRow) * rowSize[TblTypeDef];
+        row += 4 + 2 * strIdx + typeDefOrRef + fieldIdx;
+        return std::min( ReadColumn( row, methodIdx ), listRows + 1 );
+    };
+
+    for (uint32_t i = 0; i < rows[TblTypeDef]; i++)
+    {
+        auto row = tableStart[TblTypeDef] + static_cast<size_t>(i) * rowSize[TblTypeDef] + 4;
+        auto typeName = HeapString( strings, stringsSize, ReadColumn( row, strIdx ) );
+        auto typeNamespace = HeapString( strings, stringsSize, ReadColumn( row, strIdx ) );
+
+        if (!typeNamespace.empty())
+            typeName = typeNamespace + L"." + typeName;
+
+        for (uint32_t j = std::max( methodList( i ), 1u ), last = methodList( i + 1 ); j < last; j++)
+        {
+            uint32_t index = j;
+            if (indirect)
+            {
+                auto ptrRow = tableStart[TblMethodPtr] + static_cast<size_t>(j - 1) * rowSize[TblMethodPtr];
+                index = ReadColumn( ptrRow, methodIdx );
+            }
+
+            if (index != 0 && index <= _methods.size())
+                _methods[index - 1].type = typeName;
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Method RVAs keyed by declaring type and method name, same layout as ImageNET produces.
+/// First overload wins
+/// </summary>
+/// <returns>Method RVAs</returns>
+NetMetadata::mapMethodRVA NetMetadata::methodRVAs() const
+{
+    mapMethodRVA result;
+    for (auto& method : _methods)
+        result.emplace( std::make_pair( method.type, method.name ), method.rva );
+
+    return result;
+}
+
+/// <summary>
+/// Remove parsed data
+/// </summary>
+void NetMetadata::clear()
+{
+    _methods.clear();
+    _version.clear();
+}
+
+}
+
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "../Include/Winheaders.h"
+#include "../Include/Types.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace blackbone
+{
+
+namespace pe
+{
+
+/// <summary>
+/// Method from MethodDef table
+/// </summary>
+struct NetMethod
+{
+    std::wstring type;          // Declaring type, namespace qualified
+    std::wstring name;          // Method name
+    uint32_t rva = 0;           // Method body RVA, 0 for abstract and runtime methods
+    uint32_t token = 0;         // MethodDef token
+};
+
+/// <summary>
+/// ECMA-335 metadata table reader.
+/// Reads TypeDef and MethodDef tables straight from the '#~' stream of an image,
+/// no metadata dispenser or CLR is involved
+/// </summary>
+class NetMetadata
+{
+public:
+    using mapMethodRVA = std::map<std::pair<std::wstring, std::wstring>, uintptr_t>;
+
+public:
+    BLACKBONE_API NetMetadata() = default;
+
+    /// <summary>
+    /// Parse metadata of a .NET image
+    /// </summary>
+    /// <param name="image">Loaded image</param>
+    /// <returns>Status code, STATUS_INVALID_IMAGE_FORMAT if image has no valid metadata</returns>
+    BLACKBONE_API NTSTATUS Parse( const class PEImage& image );
+
+    /// <summary>
+    /// Parse metadata root
+    /// </summary>
+    /// <param name="pRoot">Metadata root, 'BSJB' signature</param>
+    /// <param name="size">Metadata size</param>
+    /// <returns>Status code, STATUS_INVALID_IMAGE_FORMAT for malformed metadata</returns>
+    BLACKBONE_API NTSTATUS Parse( const void* pRoot, size_t size );
+
+    /// <summary>
+    /// Method RVAs keyed by declaring type and method name, same layout as ImageNET produces.
+    /// First overload wins
+    /// </summary>
+    /// <returns>Method RVAs</returns>
+    BLACKBONE_API mapMethodRVA methodRVAs() const;
+
+    /// <summary>
+    /// Remove parsed data
+    /// </summary>
+    BLACKBONE_API void clear();
+
+    /// <summary>
+    /// Methods in MethodDef table order
+    /// </summary>
+    BLACKBONE_API inline const std::vector<NetMethod>& methods() const { return _methods; }
+
+    /// <summary>
+    /// Metadata runtime version string
+    /// </summary>
+    BLACKBONE_API inline const std::string& version() const { return _version; }
+
+private:
+    std::vector<NetMethod> _methods;    // MethodDef rows
+    std::string _version;               // Runtime version from metadata root
+};
+
+}
+
+}
@@ -0,0 +1,303 @@
+#include "PECollection.h"
+
+#include <algorithm>
+
+namespace blackbone
+{
+
+namespace pe
+{
+
+/// <summary>
+/// Get string ID, add string if missing
+/// </summary>
+/// <param name="str">String</param>
+/// <returns>String ID</returns>
+uint32_t StringTable::Intern( std::string_view str )
+{
+    CSLock lck( _lock );
+
+    auto iter = _index.find( str );
+    if (iter != _index.end())
+        return iter->second;
+
+    auto id = static_cast<uint32_t>(_strings.size());
+    _strings.emplace_back( str );
+    _index.emplace( _strings.back(), id );
+
+    return id;
+}
+
+/// <summary>
+/// Intern several strings under single lock acquisition
+/// </summary>
+/// <param name="strings">Strings</param>
+/// <param name="ids">Resulting IDs, in the same order</param>
+void StringTable::Intern( const std::vector<std::string_view>& strings, std::vector<uint32_t>& ids )
+{
+    CSLock lck( _lock );
+
+    ids.resize( strings.size() );
+    for (size_t i = 0; i < strings.size(); i++)
+    {
+        auto iter = _index.find( strings[i] );
+        if (iter != _index.end())
+        {
+            ids[i] = iter->second;
+            continue;
+        }
+
+        ids[i] = static_cast<uint32_t>(_strings.size());
+        _strings.emplace_back( strings[i] );
+        _index.emplace( _strings.back(), ids[i] );
+    }
+}
+
+/// <summary>
+/// Get ID of already interned string
+/// </summary>
+/// <param name="str">String</param>
+/// <returns>String ID, InvalidId if not found</returns>
+uint32_t StringTable::Find( std::string_view str ) const
+{
+    CSLock lck( _lock );
+
+    auto iter = _index.find( str );
+    return iter != _index.end() ? iter->second : InvalidId;
+}
+
+/// <summary>
+/// Get string by ID
+/// </summary>
+/// <param name="id">String ID</param>
+/// <returns>Interned string</returns>
+const std::string& StringTable::Get( uint32_t id ) const
+{
+    static const std::string empty;
+
+    CSLock lck( _lock );
+    return id < _strings.size() ? _strings[id] : empty;
+}
+
+/// <summary>
+/// Number of interned strings
+/// </summary>
+size_t StringTable::size() const
+{
+    CSLock lck( _lock );
+    return _strings.size();
+}
+
+/// <summary>
+/// Remove all strings
+/// </summary>
+void StringTable::clear()
+{
+    CSLock lck( _lock );
+
+    _index.clear();
+    _strings.clear();
+}
+
+/// <summary>
+/// Load and parse images on a worker pool, then link imports to exports.
+/// Images are mapped only while being parsed.
+/// </summary>
+/// <param name="paths">Image paths</param>
+/// <param name="threads">Number of worker threads, 0 - one per processor</param>
+/// <returns>STATUS_SUCCESS if at least one image was loaded</returns>
+NTSTATUS PECollection::LoadMany( const std::vector<std::wstring>& paths, uint32_t threads /*= 0*/ )
+{
+    clear();
+
+    _images.resize( paths.size() );
+    for (size_t i = 0; i < paths.size(); i++)
+        _images[i].path = paths[i];
+
+    if (threads == 0)
+    {
+        SYSTEM_INFO info = { { 0 } };
+        GetNativeSystemInfo( &info );
+        threads = info.dwNumberOfProcessors;
+    }
+
+    LoadContext context( *this );
+    threads = static_cast<uint32_t>(std::min<size_t>( threads, paths.size() ));
+
+    std::vector<HANDLE> workers;
+    for (uint32_t i = 1; i < threads; i++)
+    {
+        HANDLE hThread = CreateThread( NULL, 0, &PECollection::LoadWorkerWrap, &context, 0, NULL );
+        if (hThread != NULL)
+            workers.emplace_back( hThread );
+    }
+
+    // Calling thread takes part as well
+    LoadWorker( context );
+
+    for (auto hThread : workers)
+    {
+        WaitForSingleObject( hThread, INFINITE );
+        CloseHandle( hThread );
+    }
+
+    Link();
+
+    bool anyLoaded = std::any_of( _images.begin(), _images.end(), []( const auto& img ) { return NT_SUCCESS( img.status ); } );
+    return anyLoaded ? STATUS_SUCCESS : STATUS_NOT_FOUND;
+}
+
+/// <summary>
+/// Remove all images and strings
+/// </summary>
+void PECollection::clear()
+{
+    _images.clear();
+    _links.clear();
+    _strings.clear();
+}
+
+/// <summary>
+/// Load single image
+/// </summary>
+/// <param name="image">Image entry, path must be set</param>
+void PECollection::LoadImage( CollectionImage& image )
+{
+    PEImage pe;
+
+    // Only directories are needed, skip image mapping and activation context
+    image.status = pe.Load( image.path, HeadersOnly );
+    if (!NT_SUCCESS( image.status ))
+        return;
+
+    image.type = pe.mType();
+
+    // Collect all names first and intern them at once.
+    // Lower-cased module names are kept in 'lowered', deque doesn't relocate them
+    std::vector<std::string_view> names;
+    std::vector<uint32_t> ids;
+    std::deque<std::string> lowered;
+
+    auto lower = [&lowered]( std::string_view str ) -> std::string_view
+    {
+        lowered.emplace_back( str );
+        std::transform( lowered.back().begin(), lowered.back().end(), lowered.back().begin(), ::tolower );
+        return lowered.back();
+    };
+
+    auto fileName = Utils::WstringToAnsi( Utils::ToLower( Utils::StripPath( image.path ) ) );
+    names.emplace_back( fileName );
+
+    for (bool delayed : { false, true })
+    {
+        std::string_view lastDll, lastLower;
+        for (const auto& item : pe.ImportsView( delayed ))
+        {
+            // Entries of one descriptor share the same name pointer
+            if (item.dllName.data() != lastDll.data())
+            {
+                lastDll = item.dllName;
+                lastLower = lower( item.dllName );
+            }
+
+            CollectionImport imp;
+            imp.byOrdinal = item.importByOrd;
+            imp.ordinal = item.importOrdinal;
+            imp.delayed = delayed;
+
+            image.imports.emplace_back( imp );
+            names.emplace_back( lastLower );
+            names.emplace_back( item.importName );
+        }
+    }
+
+    size_t exportStart = names.size();
+    for (const auto& item : pe.ExportsView())
+    {
+        CollectionExport exp;
+        exp.RVA = item.RVA;
+
+        image.exports.emplace_back( exp );
+        names.emplace_back( item.name );
+    }
+
+    _strings.Intern( names, ids );
+
+    image.name = ids[0];
+    for (size_t i = 0; i < image.imports.size(); i++)
+    {
+        image.imports[i].dll = ids[1 + i * 2];
+        if (!image.imports[i].byOrdinal)
+            image.imports[i].name = ids[2 + i * 2];
+    }
+
+    for (size_t i = 0; i < image.exports.size(); i++)
+        image.exports[i].name = ids[exportStart + i];
+
+    std::sort( image.exports.begin(), image.exports.end(), []( const auto& l, const auto& r ) { return l.name < r.name; } );
+}
+
+/// <summary>
+/// Resolve named imports against loaded images
+/// </summary>
+void PECollection::Link()
+{
+    // Module name and type -> image index. First image wins for duplicate names
+    std::unordered_map<uint64_t, uint32_t> modules;
+    for (uint32_t i = 0; i < _images.size(); i++)
+    {
+        if (NT_SUCCESS( _images[i].status ))
+            modules.emplace( (static_cast<uint64_t>(_images[i].type) << 32) | _images[i].name, i );
+    }
+
+    for (uint32_t i = 0; i < _images.size(); i++)
+    {
+        const auto& image = _images[i];
+
+        for (uint32_t j = 0; j < image.imports.size(); j++)
+        {
+            const auto& imp = image.imports[j];
+            if (imp.byOrdinal)
+                continue;
+
+            auto iter = modules.find( (static_cast<uint64_t>(image.type) << 32) | imp.dll );
+            if (iter == modules.end())
+                continue;
+
+            const auto& exports = _images[iter->second].exports;
+            auto exp = std::lower_bound(
+                exports.begin(), exports.end(), imp.name,
+                []( const auto& e, uint32_t name ) { return e.name < name; }
+                );
+
+            if (exp != exports.end() && exp->name == imp.name)
+                _links.emplace_back( CollectionLink{ i, j, iter->second } );
+        }
+    }
+}
+
+/// <summary>
+/// Load worker
+/// </summary>
+/// <param name="context">Shared image list</param>
+void PECollection::LoadWorker( LoadContext& context )
+{
+    for (size_t idx = context.next++; idx < _images.size(); idx = context.next++)
+        LoadImage( _images[idx] );
+}
+
+/// <summary>
+/// Load worker thread entry point
+/// </summary>
+/// <param name="lpParam">Load context</param>
+/// <returns>0</returns>
+DWORD CALLBACK PECollection::LoadWorkerWrap( LPVOID lpParam )
+{
+    auto& context = *reinterpret_cast<LoadContext*>(lpParam);
+    context.self.LoadWorker( context );
+    return 0;
+}
+
+}
+
+}
@@ -0,0 +1,202 @@
+#pragma once
+
+#include "PEImage.h"
+#include "../Misc/Utils.h"
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <atomic>
+
+namespace blackbone
+{
+
+namespace pe
+{
+
+/// <summary>
+/// Thread-safe string interning table
+/// </summary>
+class StringTable
+{
+public:
+    static constexpr uint32_t InvalidId = 0xFFFFFFFF;
+
+public:
+    /// <summary>
+    /// Get string ID, add string if missing
+    /// </summary>
+    /// <param name="str">String</param>
+    /// <returns>String ID</returns>
+    BLACKBONE_API uint32_t Intern( std::string_view str );
+
+    /// <summary>
+    /// Intern several strings under single lock acquisition
+    /// </summary>
+    /// <param name="strings">Strings</param>
+    /// <param name="ids">Resulting IDs, in the same order</param>
+    BLACKBONE_API void Intern( const std::vector<std::string_view>& strings, std::vector<uint32_t>& ids );
+
+    /// <summary>
+    /// Get ID of already interned string
+    /// </summary>
+    /// <param name="str">String</param>
+    /// <returns>String ID, InvalidId if not found</returns>
+    BLACKBONE_API uint32_t Find( std::string_view str ) const;
+
+    /// <summary>
+    /// Get string by ID
+    /// </summary>
+    /// <param name="id">String ID</param>
+    /// <returns>Interned string</returns>
+    BLACKBONE_API const std::string& Get( uint32_t id ) const;
+
+    /// <summary>
+    /// Number of interned strings
+    /// </summary>
+    BLACKBONE_API size_t size() const;
+
+    /// <summary>
+    /// Remove all strings
+    /// </summary>
+    BLACKBONE_API void clear();
+
+private:
+    std::deque<std::string> _strings;                           // Interned strings, never relocated
+    std::unordered_map<std::string_view, uint32_t> _index;      // String -> ID, keys point into _strings
+    mutable CriticalSection _lock;                              // Table guard
+};
+
+/// <summary>
+/// Single import of collection image
+/// </summary>
+struct CollectionImport
+{
+    uint32_t dll = StringTable::InvalidId;      // Lower-case imported module name ID
+    uint32_t name = StringTable::InvalidId;     // Function name ID, InvalidId if imported by ordinal
+    WORD ordinal = 0;                           // Function ordinal
+    bool byOrdinal = false;                     // Function is imported by ordinal
+    bool delayed = false;                       // Delayed import
+};
+
+/// <summary>
+/// Single named export of collection image
+/// </summary>
+struct CollectionExport
+{
+    uint32_t name = StringTable::InvalidId;     // Function name ID
+    uint32_t RVA = 0;                           // Function RVA
+};
+
+/// <summary>
+/// Per-image load result
+/// </summary>
+struct CollectionImage
+{
+    std::wstring path;                          // Image path
+    uint32_t name = StringTable::InvalidId;     // Lower-case file name ID
+    NTSTATUS status = STATUS_SUCCESS;           // Load status
+    eModType type = mt_default;                 // Image type
+    std::vector<CollectionImport> imports;      // Imports, including delayed
+    std::vector<CollectionExport> exports;      // Named exports, sorted by name ID
+};
+
+/// <summary>
+/// Import resolved to export of another collection image
+/// </summary>
+struct CollectionLink
+{
+    uint32_t importer = 0;                      // Importing image index
+    uint32_t import = 0;                        // Import index in importing image
+    uint32_t exporter = 0;                      // Exporting image index
+};
+
+/// <summary>
+/// Set of images loaded and parsed concurrently
+/// </summary>
+class PECollection
+{
+public:
+    BLACKBONE_API PECollection() = default;
+    BLACKBONE_API ~PECollection() = default;
+
+    /// <summary>
+    /// Load and parse images on a worker pool, then link imports to exports.
+    /// Images are mapped only while being parsed.
+    /// </summary>
+    /// <param name="paths">Image paths</param>
+    /// <param name="threads">Number of worker threads, 0 - one per processor</param>
+    /// <returns>STATUS_SUCCESS if at least one image was loaded</returns>
+    BLACKBONE_API NTSTATUS LoadMany( const std::vector<std::wstring>& paths, uint32_t threads = 0 );
+
+    /// <summary>
+    /// Remove all images and strings
+    /// </summary>
+    BLACKBONE_API void clear();
+
+    /// <summary>
+    /// Get per-image results, in the order of LoadMany paths
+    /// </summary>
+    /// <returns>Images</returns>
+    BLACKBONE_API inline const std::vector<CollectionImage>& images() const { return _images; }
+
+    /// <summary>
+    /// Get resolved import to export links
+    /// </summary>
+    /// <returns>Links</returns>
+    BLACKBONE_API inline const std::vector<CollectionLink>& links() const { return _links; }
+
+    /// <summary>
+    /// Get shared string table
+    /// </summary>
+    /// <returns>String table</returns>
+    BLACKBONE_API inline const StringTable& strings() const { return _strings; }
+
+private:
+    /// <summary>
+    /// Shared worker state
+    /// </summary>
+    struct LoadContext
+    {
+        LoadContext( PECollection& self_ )
+            : self( self_ ) { }
+
+        PECollection& self;
+        std::atomic<size_t> next{ 0 };
+    };
+
+    /// <summary>
+    /// Load single image
+    /// </summary>
+    /// <param name="image">Image entry, path must be set</param>
+    void LoadImage( CollectionImage& image );
+
+    /// <summary>
+    /// Resolve named imports against loaded images
+    /// </summary>
+    void Link();
+
+    /// <summary>
+    /// Load worker
+    /// </summary>
+    /// <param name="context">Shared image list</param>
+    void LoadWorker( LoadContext& context );
+
+    /// <summary>
+    /// Load worker thread entry point
+    /// </summary>
+    /// <param name="lpParam">Load context</param>
+    /// <returns>0</returns>
+    static DWORD CALLBACK LoadWorkerWrap( LPVOID lpParam );
+
+private:
+    std::vector<CollectionImage> _images;       // Loaded images
+    std::vector<CollectionLink> _links;         // Import -> export links
+    StringTable _strings;                       // DLL and function names
+};
+
+}
+
+}
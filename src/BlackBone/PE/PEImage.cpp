@@ -1,4 +1,6 @@
 #include "../PE/PEImage.h"
+#include "../PE/ImageCache.h"
+#include "../PE/RelocTable.h"
 #include "../Include/Macro.h"
 #include "../Misc/Utils.h"
 #include "../Misc/DynImport.h"
@@ -32,10 +34,37 @@ PEImage::~PEImage( void )
 /// <param name="skipActx">If true - do not initialize activation context</param>
 /// <returns>Status code</returns>
 NTSTATUS PEImage::Load( const std::wstring& path, bool skipActx /*= false*/ )
+{
+    return Load( path, skipActx ? SkipActx : NoImageFlags );
+}
+
+/// <summary>
+/// Load image from file
+/// </summary>
+/// <param name="path">File path</param>
+/// <param name="flags">Load flags</param>
+/// <returns>Status code</returns>
+NTSTATUS PEImage::Load( const std::wstring& path, eImageFlags flags )
 {
     Release( true );
+
+    // Cached import data belongs to previous image
+    if (path != _imagePath || _noFile)
+        ResetImports();
+
     _imagePath = path;
     _noFile = false;
+    _flags = flags;
+
+    if (flags & UseCache)
+    {
+        ImageMetadata data;
+        if (ImageCache::Instance().Lookup( path, data ))
+        {
+            ApplyMetadata( data );
+            return STATUS_SUCCESS;
+        }
+    }
 
     _hFile = CreateFileW(
         path.c_str(), FILE_GENERIC_READ,
@@ -46,7 +75,9 @@ NTSTATUS PEImage::Load( const std::wstring& path, bool skipActx /*= false*/ )
     if (_hFile)
     {
         // Try mapping as image
-        _hMapping = CreateFileMappingW( _hFile, NULL, SEC_IMAGE | PAGE_READONLY, 0, 0, NULL );
+        if (!(flags & HeadersOnly))
+            _hMapping = CreateFileMappingW( _hFile, NULL, SEC_IMAGE | PAGE_READONLY, 0, 0, NULL );
+
         if (_hMapping)
         {
             _isPlainData = false;
@@ -73,7 +104,24 @@ NTSTATUS PEImage::Load( const std::wstring& path, bool skipActx /*= false*/ )
     if (!NT_SUCCESS( status ))
         return status;
 
-    return skipActx ? status : PrepareACTX( _imagePath.c_str() );
+    if ((flags & UseCache) && ImageCache::Instance().enabled())
+    {
+        ImageMetadata data;
+        ExtractMetadata( data );
+        ImageCache::Instance().Store( path, data );
+    }
+
+    if (flags & (SkipActx | HeadersOnly))
+        return status;
+
+    // Deferred until first actx/manifest query
+    if (flags & LazyParse)
+    {
+        _actxPending = true;
+        return status;
+    }
+
+    return PrepareACTX( _imagePath.c_str() );
 }
 
 /// <summary>
@@ -87,7 +135,10 @@ NTSTATUS PEImage::Load( void* pData, size_t size, bool plainData /*= true */ )
 {
     Release( true );
 
+    ResetImports();
+
     _noFile = true;
+    _flags = NoImageFlags;
     _pFileBase = pData;
     _isPlainData = plainData;
 
@@ -104,7 +155,7 @@ NTSTATUS PEImage::Load( void* pData, size_t size, bool plainData /*= true */ )
 /// <returns>Status code</returns>
 NTSTATUS PEImage::Reload()
 {
-    return Load( _imagePath );
+    return Load( _imagePath, _flags );
 }
 
 /// <summary>
@@ -122,14 +173,22 @@ void PEImage::Release( bool temporary /*= false*/ )
     _hMapping.reset();
     _hFile.reset();
     _hctx.reset();
+    _actxPending = false;
+    _fromCache = false;
 
     // Reset pointers to data
     _pImageHdr32 = nullptr;
     _pImageHdr64 = nullptr;
+    _cachedHeaders.clear();
 
     if(!temporary)
     {
         _imagePath.clear();
+        _netPending = false;
+        _cachedExports.clear();
+        _cachedTls.clear();
+        _cachedRelocs.clear();
+        ResetImports();
 
         // Ensure temporary file is deleted
         if (_noFile)
@@ -139,6 +198,118 @@ void PEImage::Release( bool temporary /*= false*/ )
     }
 }
 
+/// <summary>
+/// Drop cached import data
+/// </summary>
+void PEImage::ResetImports()
+{
+    _imports.clear();
+    _delayImports.clear();
+    _importsParsed = _delayImportsParsed = false;
+
+    // Cached views point into import tables
+    _cachedImportViews[0].clear();
+    _cachedImportViews[1].clear();
+    _cachedDllNames.clear();
+}
+
+/// <summary>
+/// Fill image info from cached metadata
+/// </summary>
+/// <param name="data">Cached metadata</param>
+void PEImage::ApplyMetadata( const ImageMetadata& data )
+{
+    _fromCache = true;
+    _imgBase = data.imageBase;
+    _imgSize = data.imageSize;
+    _epRVA = data.epRVA;
+    _hdrSize = data.hdrSize;
+    _subsystem = data.subsystem;
+    _DllCharacteristics = data.dllCharacteristics;
+    _ILFlagOffset = data.ilFlagOffset;
+    _is64 = data.is64;
+    _isExe = data.isExe;
+    _isPureIL = data.isPureIL;
+    _isPlainData = true;
+
+    _sections = data.sections;
+    _imports = data.imports;
+    _delayImports = data.delayImports;
+    _importsParsed = _delayImportsParsed = true;
+    _cachedExports = data.exports;
+    _cachedTls = data.tlsCallbacks;
+    _cachedRelocs = data.relocations;
+
+    // Directory queries are served from header copy
+    if (data.headers.size() >= (_is64 ? sizeof( IMAGE_NT_HEADERS64 ) : sizeof( IMAGE_NT_HEADERS32 )))
+    {
+        _cachedHeaders = data.headers;
+        _pImageHdr32 = reinterpret_cast<PCHDR32>(_cachedHeaders.data());
+        _pImageHdr64 = reinterpret_cast<PCHDR64>(_pImageHdr32);
+    }
+
+    // Import views, module names are narrowed once
+    _cachedDllNames.clear();
+    for (int i = 0; i < 2; i++)
+    {
+        _cachedImportViews[i].clear();
+        for (const auto& mod : i == 0 ? _imports : _delayImports)
+        {
+            _cachedDllNames.emplace_back( Utils::WstringToAnsi( mod.first ) );
+            for (const auto& imp : mod.second)
+            {
+                ImportView view;
+                view.dllName = _cachedDllNames.back();
+                view.importName = imp.importName;
+                view.ptrRVA = imp.ptrRVA;
+                view.importOrdinal = imp.importOrdinal;
+                view.importByOrd = imp.importByOrd;
+                _cachedImportViews[i].emplace_back( view );
+            }
+        }
+    }
+
+    // No file is mapped, .NET metadata can't be parsed
+    _netPending = false;
+}
+
+/// <summary>
+/// Collect metadata of mapped image
+/// </summary>
+/// <param name="data">Image metadata</param>
+void PEImage::ExtractMetadata( ImageMetadata& data )
+{
+    data.imageBase = _imgBase;
+    data.imageSize = _imgSize;
+    data.epRVA = _epRVA;
+    data.hdrSize = _hdrSize;
+    data.subsystem = _subsystem;
+    data.dllCharacteristics = _DllCharacteristics;
+    data.ilFlagOffset = _ILFlagOffset;
+    data.is64 = _is64;
+    data.isExe = _isExe;
+    data.isPureIL = _isPureIL;
+
+    data.sections = _sections;
+    data.headers.assign(
+        reinterpret_cast<const uint8_t*>(_pImageHdr32),
+        reinterpret_cast<const uint8_t*>(_pImageHdr32) + (_is64 ? sizeof( IMAGE_NT_HEADERS64 ) : sizeof( IMAGE_NT_HEADERS32 ))
+        );
+
+    data.imports = GetImports( false );
+    data.delayImports = GetImports( true );
+    GetExports( data.exports );
+
+    auto pReloc = reinterpret_cast<const uint8_t*>(DirectoryAddress( IMAGE_DIRECTORY_ENTRY_BASERELOC ));
+    if (pReloc)
+        data.relocations.assign( pReloc, pReloc + DirectorySize( IMAGE_DIRECTORY_ENTRY_BASERELOC ) );
+
+    std::vector<ptr_t> tls;
+    GetTLSCallbacks( _imgBase, tls );
+    for (auto callback : tls)
+        data.tlsCallbacks.emplace_back( static_cast<uint32_t>(callback - _imgBase) );
+}
+
 /// <summary>
 /// Parses PE image
 /// </summary>
@@ -210,12 +381,16 @@ NTSTATUS PEImage::Parse( void* pImageBase /*= nullptr*/ )
             + static_cast<int32_t>(offsetof( IMAGE_COR20_HEADER, Flags )));
 
 #ifdef COMPILER_MSVC
-        if (_netImage.Init( _imagePath ))
+        // Metadata is parsed on first net() call
+        if (_flags & (LazyParse | HeadersOnly))
+            _netPending = true;
+        else if (_netImage.Init( _imagePath ))
             _netImage.Parse();
 #endif
     }
 
     // Sections
+    _sections.clear();
     for (int i = 0; i < _pImageHdr32->FileHeader.NumberOfSections; ++i, ++pSection)
         _sections.emplace_back( *pSection );
 
@@ -223,142 +398,183 @@ NTSTATUS PEImage::Parse( void* pImageBase /*= nullptr*/ )
 }
 
 /// <summary>
-/// Processes image imports
+/// Processes image imports. Import directory is parsed once, on first call
 /// </summary>
 /// <param name="useDelayed">Process delayed import instead</param>
 /// <returns>Import data</returns>
 mapImports& PEImage::GetImports( bool useDelayed /*= false*/ )
 {
-    if(useDelayed)
-    {
-        auto pImportTbl = reinterpret_cast<PIMAGE_DELAYLOAD_DESCRIPTOR>(DirectoryAddress( IMAGE_DIRECTORY_ENTRY_DELAY_IMPORT ));
-        if (!pImportTbl)
-            return _delayImports;
+    auto& imports = useDelayed ? _delayImports : _imports;
+    auto& parsed = useDelayed ? _delayImportsParsed : _importsParsed;
 
-        // Delayed Imports
-        for (; pImportTbl->DllNameRVA; ++pImportTbl)
-        {
-            uint8_t* pRVA = nullptr;
-            DWORD IAT_Index = 0;
-            char *pDllName = reinterpret_cast<char*>(ResolveRVAToVA( pImportTbl->DllNameRVA ));
-            auto dllStr = Utils::AnsiToWstring( pDllName );
+    // Nothing to parse
+    if (parsed || !_pFileBase)
+        return imports;
 
-            pRVA = reinterpret_cast<uint8_t*>(ResolveRVAToVA( pImportTbl->ImportNameTableRVA ));
+    parsed = true;
 
-            while (_is64 ? THK64( pRVA )->u1.AddressOfData : THK32( pRVA )->u1.AddressOfData)
-            {
-                uint64_t AddressOfData = _is64 ? THK64( pRVA )->u1.AddressOfData : THK32( pRVA )->u1.AddressOfData;
-                auto pAddressTable = reinterpret_cast<IMAGE_IMPORT_BY_NAME*>(ResolveRVAToVA( static_cast<uintptr_t>(AddressOfData) ));
-                ImportData data;
-
-                // import by name
-                if (AddressOfData < (_is64 ? IMAGE_ORDINAL_FLAG64 : IMAGE_ORDINAL_FLAG32) && pAddressTable->Name[0])
-                {
-                    data.importByOrd = false;
-                    data.importName = reinterpret_cast<const char*>(pAddressTable->Name);
-                    data.importOrdinal = 0;
-                }
-                // import by ordinal
-                else
-                {
-                    data.importByOrd = true;
-                    data.importOrdinal = static_cast<WORD>(AddressOfData & 0xFFFF);
-                }
-
-                data.ptrRVA = pImportTbl->ImportAddressTableRVA + IAT_Index;
-
-                _delayImports[dllStr].emplace_back( data );
-
-                // Go to next entry
-                pRVA += _is64 ? sizeof(IMAGE_THUNK_DATA64) : sizeof(IMAGE_THUNK_DATA32);
-                IAT_Index += _is64 ? sizeof(uint64_t) : sizeof(uint32_t);
-            }
+    std::string_view lastDll;
+    std::vector<ImportData>* pEntries = nullptr;
+
+    for (const auto& item : ImportsView( useDelayed ))
+    {
+        // Entries of one descriptor share the same name pointer
+        if (pEntries == nullptr || item.dllName.data() != lastDll.data())
+        {
+            lastDll = item.dllName;
+            pEntries = &imports[Utils::AnsiToWstring( std::string( item.dllName ) )];
         }
 
-        return _delayImports;
+        ImportData data;
+        data.importName    = std::string( item.importName );
+        data.ptrRVA        = item.ptrRVA;
+        data.importOrdinal = item.importOrdinal;
+        data.importByOrd   = item.importByOrd;
+
+        pEntries->emplace_back( std::move( data ) );
     }
-    else
-    {
-        auto *pImportTbl = reinterpret_cast<PIMAGE_IMPORT_DESCRIPTOR>(DirectoryAddress( IMAGE_DIRECTORY_ENTRY_IMPORT ));
-        if (!pImportTbl)
-            return _imports;
 
-        // Imports
-        for (; pImportTbl->Name; ++pImportTbl)
-        {
-            uint8_t* pRVA = nullptr;
-            DWORD IAT_Index = 0;
-            char *pDllName = reinterpret_cast<char*>(ResolveRVAToVA( pImportTbl->Name ));
-            auto dllStr = Utils::AnsiToWstring( pDllName );
+    return imports;
+}
 
-            pRVA = reinterpret_cast<uint8_t*>(ResolveRVAToVA( 
-                pImportTbl->OriginalFirstThunk ? 
-                pImportTbl->OriginalFirstThunk : 
-                pImportTbl->FirstThunk ));
+/// <summary>
+/// Enumerate imports without copying. Entries point into mapped image
+/// </summary>
+/// <param name="useDelayed">Enumerate delayed import instead</param>
+/// <returns>Import range</returns>
+ImportRange PEImage::ImportsView( bool useDelayed /*= false*/ ) const
+{
+    return ImportRange{ ImportIterator( this, useDelayed ), ImportIterator() };
+}
 
-            while (_is64 ? THK64( pRVA )->u1.AddressOfData : THK32( pRVA )->u1.AddressOfData)
-            {
-                uint64_t AddressOfData = _is64 ? THK64( pRVA )->u1.AddressOfData : THK32( pRVA )->u1.AddressOfData;
-                
-                auto* pAddressTable = reinterpret_cast<IMAGE_IMPORT_BY_NAME*>(ResolveRVAToVA( static_cast<uintptr_t>(AddressOfData) ));
-                ImportData data;
-
-                // import by name
-                if (AddressOfData < (_is64 ? IMAGE_ORDINAL_FLAG64 : IMAGE_ORDINAL_FLAG32) && pAddressTable->Name[0])
-                {
-                    data.importByOrd   = false;
-                    data.importName    = reinterpret_cast<const char*>(pAddressTable->Name);
-                    data.importOrdinal = 0;
-                }
-                // import by ordinal
-                else
-                {
-                    data.importByOrd   = true;
-                    data.importOrdinal = static_cast<WORD>(AddressOfData & 0xFFFF);
-                }
-
-                // Save address to IAT
-                if (pImportTbl->FirstThunk)
-                    data.ptrRVA = pImportTbl->FirstThunk + IAT_Index;
-                // Save address to OrigianlFirstThunk
-                else
-                    data.ptrRVA = static_cast<uintptr_t>(AddressOfData) - reinterpret_cast<uintptr_t>(_pFileBase);
-
-                _imports[dllStr].emplace_back( data );
-
-                // Go to next entry
-                pRVA += _is64 ? sizeof(IMAGE_THUNK_DATA64) : sizeof(IMAGE_THUNK_DATA32);
-                IAT_Index += _is64 ? sizeof(uint64_t) : sizeof(uint32_t);
-            }
-        }
+/// <summary>
+/// Enumerate named exports without copying. Entries point into mapped image
+/// </summary>
+/// <returns>Export range, in export directory order</returns>
+ExportRange PEImage::ExportsView() const
+{
+    if (_fromCache)
+        return ExportRange{ ExportIterator( this, 0 ), ExportIterator( this, static_cast<uint32_t>(_cachedExports.size()) ) };
 
-        return _imports;
+    auto pExport = reinterpret_cast<const IMAGE_EXPORT_DIRECTORY*>(DirectoryAddress( IMAGE_DIRECTORY_ENTRY_EXPORT ));
+    uint32_t count = pExport ? pExport->NumberOfNames : 0;
 
-    }
+    return ExportRange{ ExportIterator( this, 0 ), ExportIterator( this, count ) };
 }
 
 /// <summary>
-/// Retrieve all exported functions with names
+/// Retrieve all exported functions with names.
+/// Released image is temporarily reloaded
 /// </summary>
 /// <param name="names">Found exports</param>
 void PEImage::GetExports( vecExports& exports )
 {
     exports.clear();
-    Reload();
 
-    auto pExport = reinterpret_cast<PIMAGE_EXPORT_DIRECTORY>(DirectoryAddress( IMAGE_DIRECTORY_ENTRY_EXPORT ));
-    if (pExport == 0)
+    if (_fromCache)
+    {
+        exports = _cachedExports;
         return;
+    }
 
-    DWORD *pAddressOfNames = reinterpret_cast<DWORD*>(pExport->AddressOfNames + reinterpret_cast<uintptr_t>(_pFileBase));
-    DWORD *pAddressOfFuncs = reinterpret_cast<DWORD*>(pExport->AddressOfFunctions + reinterpret_cast<uintptr_t>(_pFileBase));
-    WORD  *pAddressOfOrds  = reinterpret_cast<WORD*> (pExport->AddressOfNameOrdinals + reinterpret_cast<size_t>(_pFileBase));
+    // Map image only if it was released
+    bool reloaded = false;
+    if (!_pFileBase && !_noFile)
+    {
+        if (!NT_SUCCESS( Load( _imagePath, _flags | SkipActx ) ))
+            return;
+
+        reloaded = true;
+    }
 
-    for (DWORD i = 0; i < pExport->NumberOfNames; ++i)
-        exports.push_back( ExportData( reinterpret_cast<const char*>(_pFileBase)+pAddressOfNames[i], pAddressOfFuncs[pAddressOfOrds[i]] ) );
+    for (const auto& item : ExportsView())
+        exports.emplace_back( std::string( item.name ), item.RVA, item.ordinal );
 
     std::sort( exports.begin(), exports.end() );
-    return Release( true );
+
+    if (reloaded)
+        Release( true );
+}
+
+/// <summary>
+/// Get activation context handle
+/// </summary>
+/// <returns>Actx handle</returns>
+HANDLE PEImage::actx()
+{
+    PrepareLazyACTX();
+    return _hctx;
+}
+
+/// <summary>
+/// Get manifest resource ID
+/// </summary>
+/// <returns>Manifest resource ID</returns>
+int PEImage::manifestID()
+{
+    PrepareLazyACTX();
+    return _manifestIdx;
+}
+
+/// <summary>
+/// Get manifest resource file
+/// </summary>
+/// <returns>Manifest resource file</returns>
+const std::wstring& PEImage::manifestFile()
+{
+    PrepareLazyACTX();
+    return _manifestPath;
+}
+
+/// <summary>
+/// Get .NET image data. Metadata is parsed on first call if loaded with LazyParse or HeadersOnly
+/// </summary>
+/// <returns>.NET image data</returns>
+ImageNET& PEImage::net()
+{
+#ifdef COMPILER_MSVC
+    if (_netPending)
+    {
+        _netPending = false;
+        if (_netImage.Init( _imagePath ))
+            _netImage.Parse();
+    }
+#endif
+
+    return _netImage;
+}
+
+/// <summary>
+/// Apply base relocations and update image base.
+/// Only images loaded from writable memory with image layout can be rebased
+/// </summary>
+/// <param name="newBase">New image base</param>
+/// <returns>Status code</returns>
+NTSTATUS PEImage::Rebase( module_t newBase )
+{
+    if (!_pFileBase || !_pImageHdr32)
+        return STATUS_INVALID_ADDRESS;
+
+    // File views are read-only, plain data has no virtual layout
+    if (!_noFile || _isPlainData)
+        return STATUS_NOT_SUPPORTED;
+
+    RelocTable relocs;
+    auto status = relocs.Parse( *this );
+    if (!NT_SUCCESS( status ))
+        return status;
+
+    status = relocs.Apply( reinterpret_cast<uint8_t*>(_pFileBase), _imgSize, newBase - _imgBase );
+    if (!NT_SUCCESS( status ))
+        return status;
+
+    if (_is64)
+        const_cast<IMAGE_NT_HEADERS64*>(_pImageHdr64)->OptionalHeader.ImageBase = newBase;
+    else
+        const_cast<IMAGE_NT_HEADERS32*>(_pImageHdr32)->OptionalHeader.ImageBase = static_cast<DWORD>(newBase);
+
+    _imgBase = newBase;
+    return STATUS_SUCCESS;
 }
 
 /// <summary>
@@ -370,7 +586,11 @@ void PEImage::GetExports( vecExports& exports )
 uintptr_t PEImage::DirectoryAddress( int index, AddressType type /*= VA*/ ) const
 {
     // Sanity check
-    if (index < 0 || index >= IMAGE_NUMBEROF_DIRECTORY_ENTRIES)
+    if (index < 0 || index >= IMAGE_NUMBEROF_DIRECTORY_ENTRIES || !_pImageHdr32)
+        return 0;
+
+    // Image from ImageCache has no data to point to
+    if (type == VA && !_pFileBase)
         return 0;
 
     const auto idd = _is64 ? _pImageHdr64->OptionalHeader.DataDirectory  : _pImageHdr32->OptionalHeader.DataDirectory;
@@ -385,7 +605,7 @@ uintptr_t PEImage::DirectoryAddress( int index, AddressType type /*= VA*/ ) cons
 size_t PEImage::DirectorySize( int index ) const
 {
     // Sanity check
-    if (index < 0 || index >= IMAGE_NUMBEROF_DIRECTORY_ENTRIES)
+    if (index < 0 || index >= IMAGE_NUMBEROF_DIRECTORY_ENTRIES || !_pImageHdr32)
         return 0;
 
     const IMAGE_DATA_DIRECTORY* idd = _is64 ? _pImageHdr64->OptionalHeader.DataDirectory : _pImageHdr32->OptionalHeader.DataDirectory;
@@ -439,6 +659,14 @@ uintptr_t PEImage::ResolveRVAToVA( uintptr_t Rva, AddressType type /*= VA*/ ) co
 /// <returns>Number of TLS callbacks in image</returns>
 int PEImage::GetTLSCallbacks( module_t targetBase, std::vector<ptr_t>& result ) const
 {
+    if (_fromCache)
+    {
+        for (auto rva : _cachedTls)
+            result.push_back( targetBase + rva );
+
+        return static_cast<int>(result.size());
+    }
+
     uint8_t *pTls = reinterpret_cast<uint8_t*>(DirectoryAddress( IMAGE_DIRECTORY_ENTRY_TLS ));
     uint64_t* pCallback = 0;
     if (!pTls)
@@ -468,6 +696,19 @@ int PEImage::GetTLSCallbacks( module_t targetBase, std::vector<ptr_t>& result )
     return (int)result.size();
 }
 
+/// <summary>
+/// Prepare activation context deferred by LazyParse flag
+/// </summary>
+void PEImage::PrepareLazyACTX()
+{
+    // Manifest can be read only while image is mapped
+    if (!_actxPending || !_pFileBase)
+        return;
+
+    _actxPending = false;
+    PrepareACTX( _imagePath.c_str() );
+}
+
 /// <summary>
 /// Prepare activation context
 /// </summary>
@@ -620,6 +861,215 @@ void* PEImage::GetManifest( uint32_t& size, int32_t& manifestID )
     return nullptr;
 }
 
+/// <summary>
+/// Import directory iterator
+/// </summary>
+/// <param name="image">Parsed image</param>
+/// <param name="delayed">Iterate delayed import directory</param>
+ImportIterator::ImportIterator( const PEImage* image, bool delayed )
+    : _image( image )
+    , _delayed( delayed )
+{
+    if (image->_fromCache)
+    {
+        const auto& views = image->_cachedImportViews[delayed ? 1 : 0];
+        if (!views.empty())
+        {
+            _cached = views.data();
+            _cachedEnd = views.data() + views.size();
+            _view = *_cached;
+        }
+
+        return;
+    }
+
+    _descriptor = reinterpret_cast<const uint8_t*>(image->DirectoryAddress(
+        delayed ? IMAGE_DIRECTORY_ENTRY_DELAY_IMPORT : IMAGE_DIRECTORY_ENTRY_IMPORT
+        ));
+
+    Fetch();
+}
+
+/// <summary>
+/// Move to next import entry
+/// </summary>
+/// <returns>Iterator</returns>
+ImportIterator& ImportIterator::operator ++()
+{
+    if (_cached)
+    {
+        if (++_cached == _cachedEnd)
+        {
+            _cached = _cachedEnd = nullptr;
+            _view = ImportView();
+        }
+        else
+            _view = *_cached;
+
+        return *this;
+    }
+
+    bool is64 = _image->mType() == mt_mod64;
+
+    _thunk += is64 ? sizeof( IMAGE_THUNK_DATA64 ) : sizeof( IMAGE_THUNK_DATA32 );
+    _iatIndex += is64 ? sizeof( uint64_t ) : sizeof( uint32_t );
+
+    Fetch();
+    return *this;
+}
+
+/// <summary>
+/// Move to the first valid entry starting from current position
+/// </summary>
+void ImportIterator::Fetch()
+{
+    bool is64 = _image && _image->mType() == mt_mod64;
+
+    while (_descriptor)
+    {
+        auto pImport = reinterpret_cast<const IMAGE_IMPORT_DESCRIPTOR*>(_descriptor);
+        auto pDelayed = reinterpret_cast<const IMAGE_DELAYLOAD_DESCRIPTOR*>(_descriptor);
+
+        // Start new descriptor
+        if (_thunk == nullptr)
+        {
+            uintptr_t nameRVA = _delayed ? pDelayed->DllNameRVA : pImport->Name;
+            if (nameRVA == 0)
+                break;
+
+            uintptr_t thunkRVA = _delayed ? pDelayed->ImportNameTableRVA :
+                (pImport->OriginalFirstThunk ? pImport->OriginalFirstThunk : pImport->FirstThunk);
+
+            auto pDllName = reinterpret_cast<const char*>(_image->ResolveRVAToVA( nameRVA ));
+            _thunk = reinterpret_cast<const uint8_t*>(_image->ResolveRVAToVA( thunkRVA ));
+            _iatIndex = 0;
+
+            if (pDllName)
+                _view.dllName = pDllName;
+        }
+
+        uint64_t AddressOfData = 0;
+        if (_thunk && _view.dllName.data())
+            AddressOfData = is64 ? THK64( _thunk )->u1.AddressOfData : THK32( _thunk )->u1.AddressOfData;
+
+        // Descriptor end, go to next
+        if (AddressOfData == 0)
+        {
+            _descriptor += _delayed ? sizeof( IMAGE_DELAYLOAD_DESCRIPTOR ) : sizeof( IMAGE_IMPORT_DESCRIPTOR );
+            _thunk = nullptr;
+            _view.dllName = std::string_view();
+            continue;
+        }
+
+        auto pAddressTable = AddressOfData < (is64 ? IMAGE_ORDINAL_FLAG64 : IMAGE_ORDINAL_FLAG32) ?
+            reinterpret_cast<const IMAGE_IMPORT_BY_NAME*>(_image->ResolveRVAToVA( static_cast<uintptr_t>(AddressOfData) )) :
+            nullptr;
+
+        // import by name
+        if (pAddressTable && pAddressTable->Name[0])
+        {
+            _view.importByOrd   = false;
+            _view.importName    = reinterpret_cast<const char*>(pAddressTable->Name);
+            _view.importOrdinal = 0;
+        }
+        // import by ordinal
+        else
+        {
+            _view.importByOrd   = true;
+            _view.importName    = std::string_view();
+            _view.importOrdinal = static_cast<WORD>(AddressOfData & 0xFFFF);
+        }
+
+        if (_delayed)
+            _view.ptrRVA = pDelayed->ImportAddressTableRVA + _iatIndex;
+        // Save address to IAT
+        else if (pImport->FirstThunk)
+            _view.ptrRVA = pImport->FirstThunk + _iatIndex;
+        // Save address to OrigianlFirstThunk
+        else
+            _view.ptrRVA = static_cast<uintptr_t>(AddressOfData) - reinterpret_cast<uintptr_t>(_image->base());
+
+        return;
+    }
+
+    // End of directory
+    _descriptor = nullptr;
+    _thunk = nullptr;
+    _view = ImportView();
+}
+
+/// <summary>
+/// Named exports iterator
+/// </summary>
+/// <param name="image">Parsed image</param>
+/// <param name="index">Starting name index</param>
+ExportIterator::ExportIterator( const PEImage* image, uint32_t index )
+    : _image( image )
+    , _index( index )
+{
+    if (image->_fromCache)
+    {
+        _cached = image->_cachedExports.data();
+        _count = static_cast<uint32_t>(image->_cachedExports.size());
+        Fetch();
+        return;
+    }
+
+    auto pExport = reinterpret_cast<const IMAGE_EXPORT_DIRECTORY*>(image->DirectoryAddress( IMAGE_DIRECTORY_ENTRY_EXPORT ));
+    if (pExport)
+    {
+        _names = reinterpret_cast<const DWORD*>(image->ResolveRVAToVA( pExport->AddressOfNames ));
+        _funcs = reinterpret_cast<const DWORD*>(image->ResolveRVAToVA( pExport->AddressOfFunctions ));
+        _ords  = reinterpret_cast<const WORD*>(image->ResolveRVAToVA( pExport->AddressOfNameOrdinals ));
+
+        if (_names && _funcs && _ords)
+            _count = pExport->NumberOfNames;
+    }
+
+    // Malformed directory, nothing to iterate
+    if (_count == 0)
+        _index = 0;
+
+    Fetch();
+}
+
+/// <summary>
+/// Move to next export
+/// </summary>
+/// <returns>Iterator</returns>
+ExportIterator& ExportIterator::operator ++()
+{
+    ++_index;
+    Fetch();
+    return *this;
+}
+
+/// <summary>
+/// Fill current entry
+/// </summary>
+void ExportIterator::Fetch()
+{
+    if (_index >= _count)
+    {
+        _view = ExportView();
+        return;
+    }
+
+    if (_cached)
+    {
+        _view.name = _cached[_index].name;
+        _view.ordinal = _cached[_index].ordinal;
+        _view.RVA = _cached[_index].RVA;
+        return;
+    }
+
+    auto pName = reinterpret_cast<const char*>(_image->ResolveRVAToVA( _names[_index] ));
+
+    _view.name = pName ? std::string_view( pName ) : std::string_view();
+    _view.ordinal = _ords[_index];
+    _view.RVA = _funcs[_view.ordinal];
+}
+
 }
 
 }
@@ -4,6 +4,7 @@
 #include "../Include/Winheaders.h"
 #include "../Include/Types.h"
 #include "../Include/HandleGuard.h"
+#include "../Include/Macro.h"
 #include "../Misc/Utils.h"
 
 #ifdef COMPILER_MSVC
@@ -11,6 +12,8 @@
 #endif // COMPILER_MSVC
 
 #include <string>
+#include <string_view>
+#include <iterator>
 #include <memory>
 #include <vector>
 #include <map>
@@ -31,6 +34,18 @@ enum AddressType
     RPA,    // Relative physical
 };
 
+// Image load flags
+enum eImageFlags
+{
+    NoImageFlags = 0x00,    // Parse everything eagerly
+    SkipActx     = 0x01,    // Do not initialize activation context
+    LazyParse    = 0x02,    // Parse .NET metadata and activation context on first access
+    HeadersOnly  = 0x04,    // Map as plain data and parse only headers and sections. Directories can still be queried
+    UseCache     = 0x08,    // Take metadata from ImageCache if available. Cached image isn't mapped, views and relocations are served from cache, directory VAs are 0
+};
+
+ENUM_OPS( eImageFlags )
+
 // Relocation block information
 struct RelocData
 {
@@ -62,10 +77,12 @@ struct ExportData
 {
     std::string name;
     uint32_t RVA = 0;
+    WORD ordinal = 0;       // Ordinal, without ordinal base
 
-    ExportData( const std::string& name_, uint32_t rva_ )
+    ExportData( const std::string& name_, uint32_t rva_, WORD ordinal_ = 0 )
         : name( name_ )
-        , RVA( rva_ ) { }
+        , RVA( rva_ )
+        , ordinal( ordinal_ ) { }
 
     bool operator == (const ExportData& other)
     {
@@ -83,11 +100,151 @@ using mapImports  = std::unordered_map<std::wstring, std::vector<ImportData>>;
 using vecSections = std::vector<IMAGE_SECTION_HEADER>;
 using vecExports  = std::vector<ExportData>;
 
+/// <summary>
+/// Import entry pointing directly into mapped image
+/// </summary>
+struct ImportView
+{
+    std::string_view dllName;       // Imported module name
+    std::string_view importName;    // Function name, empty if imported by ordinal
+    uintptr_t ptrRVA = 0;           // Function pointer RVA
+    WORD importOrdinal = 0;         // Function ordinal
+    bool importByOrd = false;       // Function is imported by ordinal
+};
+
+/// <summary>
+/// Named export pointing directly into mapped image
+/// </summary>
+struct ExportView
+{
+    std::string_view name;          // Function name
+    uint32_t RVA = 0;               // Function RVA
+    WORD ordinal = 0;               // Function ordinal, without ordinal base
+};
+
+class PEImage;
+struct ImageMetadata;
+
+/// <summary>
+/// Forward iterator over import directory entries.
+/// Valid only while image stays mapped
+/// </summary>
+class ImportIterator
+{
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type        = ImportView;
+    using difference_type   = ptrdiff_t;
+    using pointer           = const ImportView*;
+    using reference         = const ImportView&;
+
+public:
+    ImportIterator() = default;
+    BLACKBONE_API ImportIterator( const PEImage* image, bool delayed );
+
+    BLACKBONE_API ImportIterator& operator ++();
+
+    inline reference operator *() const { return _view; }
+    inline pointer operator ->() const { return &_view; }
+
+    inline bool operator == (const ImportIterator& other) const
+    {
+        return _descriptor == other._descriptor && _thunk == other._thunk && _cached == other._cached;
+    }
+    inline bool operator != (const ImportIterator& other) const { return !(*this == other); }
+
+private:
+    /// <summary>
+    /// Move to the first valid entry starting from current position
+    /// </summary>
+    void Fetch();
+
+private:
+    const PEImage* _image = nullptr;        // Parsed image
+    const uint8_t* _descriptor = nullptr;   // Current import descriptor
+    const uint8_t* _thunk = nullptr;        // Current thunk
+    uint32_t _iatIndex = 0;                 // Offset of current entry in IAT
+    bool _delayed = false;                  // Delayed import directory
+    const ImportView* _cached = nullptr;    // Current entry of image loaded from ImageCache
+    const ImportView* _cachedEnd = nullptr; // End of cached entries
+    ImportView _view;                       // Current entry
+};
+
+/// <summary>
+/// Forward iterator over named exports.
+/// Valid only while image stays mapped
+/// </summary>
+class ExportIterator
+{
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type        = ExportView;
+    using difference_type   = ptrdiff_t;
+    using pointer           = const ExportView*;
+    using reference         = const ExportView&;
+
+public:
+    ExportIterator() = default;
+    BLACKBONE_API ExportIterator( const PEImage* image, uint32_t index );
+
+    BLACKBONE_API ExportIterator& operator ++();
+
+    inline reference operator *() const { return _view; }
+    inline pointer operator ->() const { return &_view; }
+
+    inline bool operator == (const ExportIterator& other) const { return _index == other._index; }
+    inline bool operator != (const ExportIterator& other) const { return !(*this == other); }
+
+private:
+    /// <summary>
+    /// Fill current entry
+    /// </summary>
+    void Fetch();
+
+private:
+    const PEImage* _image = nullptr;        // Parsed image
+    const DWORD* _names = nullptr;          // AddressOfNames
+    const DWORD* _funcs = nullptr;          // AddressOfFunctions
+    const WORD* _ords = nullptr;            // AddressOfNameOrdinals
+    const ExportData* _cached = nullptr;    // Exports of image loaded from ImageCache
+    uint32_t _index = 0;                    // Current name index
+    uint32_t _count = 0;                    // Number of names
+    ExportView _view;                       // Current entry
+};
+
+/// <summary>
+/// Import directory range
+/// </summary>
+struct ImportRange
+{
+    ImportIterator first;
+    ImportIterator last;
+
+    inline ImportIterator begin() const { return first; }
+    inline ImportIterator end() const { return last; }
+};
+
+/// <summary>
+/// Named exports range
+/// </summary>
+struct ExportRange
+{
+    ExportIterator first;
+    ExportIterator last;
+
+    inline ExportIterator begin() const { return first; }
+    inline ExportIterator end() const { return last; }
+};
+
 /// <summary>
 /// Primitive PE parsing class
 /// </summary>
 class PEImage
 {
+    friend class ImportIterator;
+    friend class ExportIterator;
+    friend class RelocTable;
+
     using PCHDR32 = const IMAGE_NT_HEADERS32*;
     using PCHDR64 = const IMAGE_NT_HEADERS64*;
     
@@ -103,6 +260,14 @@ public:
     /// <returns>Status code</returns>
     BLACKBONE_API NTSTATUS Load( const std::wstring& path, bool skipActx = false );
 
+    /// <summary>
+    /// Load image from file
+    /// </summary>
+    /// <param name="path">File path</param>
+    /// <param name="flags">Load flags</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS Load( const std::wstring& path, eImageFlags flags );
+
     /// <summary>
     /// Load image from memory location
     /// </summary>
@@ -131,14 +296,28 @@ public:
     BLACKBONE_API NTSTATUS Parse( void* pImageBase = nullptr );
 
     /// <summary>
-    /// Processes image imports
+    /// Processes image imports. Import directory is parsed once, on first call
     /// </summary>
     /// <param name="useDelayed">Process delayed import instead</param>
     /// <returns>Import data</returns>
     BLACKBONE_API mapImports& GetImports( bool useDelayed = false );
 
     /// <summary>
-    /// Retrieve all exported functions with names
+    /// Enumerate imports without copying. Entries point into mapped image
+    /// </summary>
+    /// <param name="useDelayed">Enumerate delayed import instead</param>
+    /// <returns>Import range</returns>
+    BLACKBONE_API ImportRange ImportsView( bool useDelayed = false ) const;
+
+    /// <summary>
+    /// Enumerate named exports without copying. Entries point into mapped image
+    /// </summary>
+    /// <returns>Export range, in export directory order</returns>
+    BLACKBONE_API ExportRange ExportsView() const;
+
+    /// <summary>
+    /// Retrieve all exported functions with names.
+    /// Released image is temporarily reloaded
     /// </summary>
     /// <param name="names">Found exports</param>
     BLACKBONE_API void GetExports( vecExports& exports );
@@ -152,6 +331,14 @@ public:
     /// <returns>Number of TLS callbacks in image</returns>
     BLACKBONE_API int GetTLSCallbacks( module_t targetBase, std::vector<ptr_t>& result ) const;
 
+    /// <summary>
+    /// Apply base relocations and update image base.
+    /// Only images loaded from writable memory with image layout can be rebased
+    /// </summary>
+    /// <param name="newBase">New image base</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS Rebase( module_t newBase );
+
     /// <summary>
     /// Retrieve data directory address
     /// </summary>
@@ -247,7 +434,7 @@ public:
     /// Get activation context handle
     /// </summary>
     /// <returns>Actx handle</returns>
-    BLACKBONE_API inline HANDLE actx() const { return _hctx; }
+    BLACKBONE_API HANDLE actx();
 
     /// <summary>
     /// true if image is mapped as plain data file
@@ -259,7 +446,7 @@ public:
     /// Get manifest resource ID
     /// </summary>
     /// <returns>Manifest resource ID</returns>
-    BLACKBONE_API inline int manifestID() const { return _manifestIdx; }
+    BLACKBONE_API int manifestID();
 
     /// <summary>
     /// Get image subsystem
@@ -271,7 +458,7 @@ public:
     /// Get manifest resource file
     /// </summary>
     /// <returns>Manifest resource file</returns>
-    BLACKBONE_API inline const std::wstring& manifestFile() const { return _manifestPath; }
+    BLACKBONE_API const std::wstring& manifestFile();
 
     /// <summary>
     /// If true - no actual PE file available on disk
@@ -290,10 +477,32 @@ public:
     /// .NET image parser
     /// </summary>
     /// <returns>.NET image parser</returns>
-    BLACKBONE_API ImageNET& net() { return _netImage; }
+    BLACKBONE_API ImageNET& net();
 #endif
 
 private:
+    /// <summary>
+    /// Drop cached import data
+    /// </summary>
+    void ResetImports();
+
+    /// <summary>
+    /// Fill image info from cached metadata
+    /// </summary>
+    /// <param name="data">Cached metadata</param>
+    void ApplyMetadata( const ImageMetadata& data );
+
+    /// <summary>
+    /// Collect metadata of mapped image
+    /// </summary>
+    /// <param name="data">Image metadata</param>
+    void ExtractMetadata( ImageMetadata& data );
+
+    /// <summary>
+    /// Prepare activation context deferred by LazyParse flag
+    /// </summary>
+    void PrepareLazyACTX();
+
     /// <summary>
     /// Prepare activation context
     /// </summary>
@@ -329,10 +538,22 @@ private:
     uint32_t    _subsystem = 0;                 // Image subsystem
     int32_t     _ILFlagOffset = 0;              // Offset of pure IL flag
     uint32_t    _DllCharacteristics = 0;        // DllCharacteristics flags
+    eImageFlags _flags = NoImageFlags;          // Load flags
+    bool        _actxPending = false;           // Activation context wasn't prepared yet
+    bool        _netPending = false;            // .NET metadata wasn't parsed yet
+    bool        _importsParsed = false;         // Import directory was parsed
+    bool        _delayImportsParsed = false;    // Delayed import directory was parsed
+    bool        _fromCache = false;             // Image info was taken from ImageCache, file isn't mapped
 
     vecSections _sections;                      // Section info
     mapImports  _imports;                       // Import functions
     mapImports  _delayImports;                  // Import functions
+    vecExports  _cachedExports;                 // Exports from ImageCache
+    std::vector<uint32_t> _cachedTls;           // TLS callback RVAs from ImageCache
+    std::vector<uint8_t> _cachedHeaders;        // NT headers from ImageCache, header pointers refer here
+    std::vector<uint8_t> _cachedRelocs;         // Raw base relocation directory from ImageCache
+    std::list<std::string> _cachedDllNames;     // Narrow import module names, referenced by cached import views
+    std::vector<ImportView> _cachedImportViews[2];  // Import and delayed import entries from ImageCache
 
     std::wstring _imagePath;                    // Image path
     std::wstring _manifestPath;                 // Image manifest container
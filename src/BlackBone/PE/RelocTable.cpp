@@ -0,0 +1,223 @@
+#include "RelocTable.h"
+#include "PEImage.h"
+
+#include <algorithm>
+
+namespace blackbone
+{
+
+namespace pe
+{
+
+/// <summary>
+/// Add delta to unaligned value
+/// </summary>
+/// <param name="ptr">Value address</param>
+/// <param name="delta">Delta</param>
+template<typename T>
+inline void AddDelta( uint8_t* ptr, T delta )
+{
+    T val;
+    memcpy( &val, ptr, sizeof( val ) );
+    val += delta;
+    memcpy( ptr, &val, sizeof( val ) );
+}
+
+/// <summary>
+/// Add delta to all fixups of one width. Loop is unrolled by 4
+/// </summary>
+/// <param name="pImage">Image base</param>
+/// <param name="offsets">Fixup RVAs</param>
+/// <param name="delta">Delta</param>
+template<typename T>
+void ApplyFixups( uint8_t* pImage, const std::vector<uint32_t>& offsets, T delta )
+{
+    size_t i = 0;
+    const size_t count = offsets.size();
+    const uint32_t* pOffsets = offsets.data();
+
+    for (; i + 4 <= count; i += 4)
+    {
+        AddDelta( pImage + pOffsets[i], delta );
+        AddDelta( pImage + pOffsets[i + 1], delta );
+        AddDelta( pImage + pOffsets[i + 2], delta );
+        AddDelta( pImage + pOffsets[i + 3], delta );
+    }
+
+    for (; i < count; i++)
+        AddDelta( pImage + pOffsets[i], delta );
+}
+
+/// <summary>
+/// Decode base relocation directory
+/// </summary>
+/// <param name="pDirectory">Directory data</param>
+/// <param name="size">Directory size</param>
+/// <returns>Status code, STATUS_INVALID_IMAGE_FORMAT for unsupported relocation types</returns>
+NTSTATUS RelocTable::Parse( const void* pDirectory, size_t size )
+{
+    clear();
+
+    auto ptr = reinterpret_cast<const uint8_t*>(pDirectory);
+    auto end = ptr + size;
+
+    while (ptr + offsetof( RelocData, Item ) <= end)
+    {
+        auto fixrec = reinterpret_cast<const RelocData*>(ptr);
+        if (fixrec->BlockSize < offsetof( RelocData, Item ) || fixrec->BlockSize > static_cast<size_t>(end - ptr))
+            break;
+
+        DWORD count = (fixrec->BlockSize - 8) >> 1;             // records count
+        bool used = false;
+
+        for (DWORD i = 0; i < count; ++i)
+        {
+            WORD fixtype = (fixrec->Item[i].Type);              // fixup type
+            WORD fixoffset = (fixrec->Item[i].Offset) % 4096;   // offset in 4K block
+
+            // no fixup required
+            if (fixtype == IMAGE_REL_BASED_ABSOLUTE)
+                continue;
+
+            // Fixup start and end are computed in 64 bits, end must fit 32 bit limit
+            uint64_t fixRVA = static_cast<uint64_t>(fixrec->PageRVA) + fixoffset;
+            uint64_t fixEnd = fixRVA + (fixtype == IMAGE_REL_BASED_DIR64 ? sizeof( uint64_t ) : sizeof( uint32_t ));
+            if (fixEnd > 0xFFFFFFFF)
+            {
+                clear();
+                return STATUS_INVALID_IMAGE_FORMAT;
+            }
+
+            if (fixtype == IMAGE_REL_BASED_DIR64)
+                _dir64.emplace_back( static_cast<uint32_t>(fixRVA) );
+            else if (fixtype == IMAGE_REL_BASED_HIGHLOW)
+                _highLow.emplace_back( static_cast<uint32_t>(fixRVA) );
+            else
+            {
+                // TODO: support for all remaining relocations
+                clear();
+                return STATUS_INVALID_IMAGE_FORMAT;
+            }
+
+            _limit = std::max( _limit, static_cast<uint32_t>(fixEnd) );
+            used = true;
+        }
+
+        if (used)
+            _pages.emplace_back( fixrec->PageRVA );
+
+        // next reloc entry
+        ptr += fixrec->BlockSize;
+    }
+
+    // Blocks are usually sorted already, sorting keeps writes sequential for the rest.
+    // Duplicate fixups are kept, loader applies them twice as well
+    auto sort = []( std::vector<uint32_t>& vec )
+    {
+        if (!std::is_sorted( vec.begin(), vec.end() ))
+            std::sort( vec.begin(), vec.end() );
+    };
+
+    sort( _dir64 );
+    sort( _highLow );
+    sort( _pages );
+
+    _pages.erase( std::unique( _pages.begin(), _pages.end() ), _pages.end() );
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Decode base relocation directory of an image
+/// </summary>
+/// <param name="image">Loaded image</param>
+/// <returns>Status code, STATUS_INVALID_IMAGE_FORMAT for unsupported relocation types</returns>
+NTSTATUS RelocTable::Parse( const PEImage& image )
+{
+    // Image from ImageCache keeps raw directory copy
+    if (image._fromCache)
+        return Parse( image._cachedRelocs.data(), image._cachedRelocs.size() );
+
+    auto start = image.DirectoryAddress( IMAGE_DIRECTORY_ENTRY_BASERELOC );
+    if (start == 0)
+    {
+        clear();
+        return STATUS_SUCCESS;
+    }
+
+    return Parse( reinterpret_cast<const void*>(start), image.DirectorySize( IMAGE_DIRECTORY_ENTRY_BASERELOC ) );
+}
+
+/// <summary>
+/// Set already decoded fixups, e.g. deserialized ones
+/// </summary>
+/// <param name="dir64">RVAs of 64 bit fixups, ascending</param>
+/// <param name="highLow">RVAs of 32 bit fixups, ascending</param>
+/// <param name="pages">RVAs of pages containing fixups, ascending</param>
+/// <returns>Status code, STATUS_INVALID_PARAMETER if any list isn't sorted</returns>
+NTSTATUS RelocTable::Assign( std::vector<uint32_t> dir64, std::vector<uint32_t> highLow, std::vector<uint32_t> pages )
+{
+    clear();
+
+    if (!std::is_sorted( dir64.begin(), dir64.end() ) ||
+        !std::is_sorted( highLow.begin(), highLow.end() ) ||
+        !std::is_sorted( pages.begin(), pages.end() ))
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    // Fixup end must not wrap around
+    if ((!dir64.empty() && dir64.back() > 0xFFFFFFFF - sizeof( uint64_t )) ||
+        (!highLow.empty() && highLow.back() > 0xFFFFFFFF - sizeof( uint32_t )))
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    // Highest fixups are the last ones
+    if (!dir64.empty())
+        _limit = std::max<uint32_t>( _limit, dir64.back() + sizeof( uint64_t ) );
+    if (!highLow.empty())
+        _limit = std::max<uint32_t>( _limit, highLow.back() + sizeof( uint32_t ) );
+
+    _dir64 = std::move( dir64 );
+    _highLow = std::move( highLow );
+    _pages = std::move( pages );
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Add delta to every fixup
+/// </summary>
+/// <param name="pImage">Image with virtual layout</param>
+/// <param name="size">Image size</param>
+/// <param name="delta">Relocation delta</param>
+/// <returns>Status code, STATUS_INVALID_IMAGE_FORMAT if any fixup is outside of the image</returns>
+NTSTATUS RelocTable::Apply( uint8_t* pImage, size_t size, ptr_t delta ) const
+{
+    // Single bounds check covers all fixups
+    if (_limit > size)
+        return STATUS_INVALID_IMAGE_FORMAT;
+
+    if (delta == 0)
+        return STATUS_SUCCESS;
+
+    ApplyFixups<uint64_t>( pImage, _dir64, delta );
+    ApplyFixups<uint32_t>( pImage, _highLow, static_cast<uint32_t>(delta) );
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Remove all fixups
+/// </summary>
+void RelocTable::clear()
+{
+    _dir64.clear();
+    _highLow.clear();
+    _pages.clear();
+    _limit = 0;
+}
+
+}
+
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "../Include/Winheaders.h"
+#include "../Include/Types.h"
+
+#include <vector>
+
+namespace blackbone
+{
+
+namespace pe
+{
+
+/// <summary>
+/// Pre-decoded base relocation directory.
+/// Fixups are grouped by width into sorted offset arrays, so applying delta is a tight loop without per-entry type dispatch.
+/// </summary>
+class RelocTable
+{
+public:
+    BLACKBONE_API RelocTable() = default;
+
+    /// <summary>
+    /// Decode base relocation directory
+    /// </summary>
+    /// <param name="pDirectory">Directory data</param>
+    /// <param name="size">Directory size</param>
+    /// <returns>Status code, STATUS_INVALID_IMAGE_FORMAT for unsupported relocation types</returns>
+    BLACKBONE_API NTSTATUS Parse( const void* pDirectory, size_t size );
+
+    /// <summary>
+    /// Decode base relocation directory of an image
+    /// </summary>
+    /// <param name="image">Loaded image</param>
+    /// <returns>Status code, STATUS_INVALID_IMAGE_FORMAT for unsupported relocation types</returns>
+    BLACKBONE_API NTSTATUS Parse( const class PEImage& image );
+
+    /// <summary>
+    /// Set already decoded fixups, e.g. deserialized ones
+    /// </summary>
+    /// <param name="dir64">RVAs of 64 bit fixups, ascending</param>
+    /// <param name="highLow">RVAs of 32 bit fixups, ascending</param>
+    /// <param name="pages">RVAs of pages containing fixups, ascending</param>
+    /// <returns>Status code, STATUS_INVALID_PARAMETER if any list isn't sorted</returns>
+    BLACKBONE_API NTSTATUS Assign( std::vector<uint32_t> dir64, std::vector<uint32_t> highLow, std::vector<uint32_t> pages );
+
+    /// <summary>
+    /// Add delta to every fixup
+    /// </summary>
+    /// <param name="pImage">Image with virtual layout</param>
+    /// <param name="size">Image size</param>
+    /// <param name="delta">Relocation delta</param>
+    /// <returns>Status code, STATUS_INVALID_IMAGE_FORMAT if any fixup is outside of the image</returns>
+    BLACKBONE_API NTSTATUS Apply( uint8_t* pImage, size_t size, ptr_t delta ) const;
+
+    /// <summary>
+    /// Remove all fixups
+    /// </summary>
+    BLACKBONE_API void clear();
+
+    /// <summary>
+    /// RVAs of 64 bit fixups, ascending
+    /// </summary>
+    BLACKBONE_API inline const std::vector<uint32_t>& dir64() const { return _dir64; }
+
+    /// <summary>
+    /// RVAs of 32 bit fixups, ascending
+    /// </summary>
+    BLACKBONE_API inline const std::vector<uint32_t>& highLow() const { return _highLow; }
+
+    /// <summary>
+    /// RVAs of pages containing fixups, ascending
+    /// </summary>
+    BLACKBONE_API inline const std::vector<uint32_t>& pages() const { return _pages; }
+
+    /// <summary>
+    /// Table has no fixups
+    /// </summary>
+    BLACKBONE_API inline bool empty() const { return _dir64.empty() && _highLow.empty(); }
+
+    /// <summary>
+    /// End of the highest fixup, 0 if table is empty
+    /// </summary>
+    BLACKBONE_API inline uint32_t limit() const { return _limit; }
+
+private:
+    std::vector<uint32_t> _dir64;       // IMAGE_REL_BASED_DIR64 RVAs
+    std::vector<uint32_t> _highLow;     // IMAGE_REL_BASED_HIGHLOW RVAs
+    std::vector<uint32_t> _pages;       // Pages with fixups
+    uint32_t _limit = 0;                // End of the highest fixup
+};
+
+}
+
+}
@@ -0,0 +1,191 @@
+#include "FileScanner.h"
+#include "../PE/PEImage.h"
+
+#include <algorithm>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Scan for single pattern
+/// </summary>
+/// <param name="pattern">Pattern</param>
+/// <param name="useWildcard">True if pattern contains wildcards</param>
+/// <param name="wildcard">Pattern wildcard</param>
+FileScanner::FileScanner( const PatternSearch& pattern, bool useWildcard, uint8_t wildcard )
+    : _pattern( &pattern )
+    , _useWildcard( useWildcard )
+    , _wildcard( wildcard )
+{
+}
+
+/// <summary>
+/// Scan for all patterns of a set in one pass. Set must outlive scanner
+/// </summary>
+/// <param name="patterns">Pattern set</param>
+FileScanner::FileScanner( PatternSet& patterns )
+    : _set( &patterns )
+{
+    // Automaton is read-only afterwards and can be shared by workers
+    _set->Compile();
+}
+
+/// <summary>
+/// Scan single file
+/// </summary>
+/// <param name="path">Image path</param>
+/// <param name="result">Scan result</param>
+/// <param name="options">Scan options, threads value is ignored</param>
+/// <returns>Status code</returns>
+NTSTATUS FileScanner::Scan( const std::wstring& path, FileScanResult& result, const FileScanOptions& options /*= FileScanOptions()*/ ) const
+{
+    result.path = path;
+    result.matches.clear();
+
+    // Raw section data must be bound by file size
+    WIN32_FILE_ATTRIBUTE_DATA attr = { 0 };
+    if (!GetFileAttributesExW( path.c_str(), GetFileExInfoStandard, &attr ))
+        return result.status = LastNtStatus();
+
+    uint64_t fileSize = (static_cast<uint64_t>(attr.nFileSizeHigh) << 32) | attr.nFileSizeLow;
+
+    // File is mapped as plain data, image mapping would require section alignment and relocations
+    pe::PEImage image;
+    result.status = image.Load( path, pe::HeadersOnly );
+    if (!NT_SUCCESS( result.status ))
+        return result.status;
+
+    result.type = image.mType();
+
+    auto base = reinterpret_cast<const uint8_t*>(image.base());
+    for (const auto& section : image.sections())
+    {
+        if (options.characteristics != 0 && (section.Characteristics & options.characteristics) == 0)
+            continue;
+
+        auto pName = reinterpret_cast<const char*>(section.Name);
+        if (!options.sectionName.empty() && options.sectionName != std::string( pName, strnlen( pName, IMAGE_SIZEOF_SHORT_NAME ) ))
+            continue;
+
+        // Zero-filled tail of section isn't backed by file
+        uint64_t size = section.SizeOfRawData;
+        if (section.Misc.VirtualSize != 0)
+            size = std::min<uint64_t>( size, section.Misc.VirtualSize );
+
+        if (section.PointerToRawData >= fileSize)
+            continue;
+
+        size = std::min<uint64_t>( size, fileSize - section.PointerToRawData );
+        if (size != 0)
+            ScanSection( base + section.PointerToRawData, static_cast<size_t>(size), section.VirtualAddress, result.matches );
+    }
+
+    return result.status;
+}
+
+/// <summary>
+/// Scan files on a worker pool
+/// </summary>
+/// <param name="paths">Image paths</param>
+/// <param name="results">Per-file results, in the order of paths</param>
+/// <param name="options">Scan options</param>
+/// <returns>STATUS_SUCCESS if at least one file was scanned</returns>
+NTSTATUS FileScanner::ScanMany(
+    const std::vector<std::wstring>& paths,
+    std::vector<FileScanResult>& results,
+    const FileScanOptions& options /*= FileScanOptions()*/
+    ) const
+{
+    results.clear();
+    results.resize( paths.size() );
+    for (size_t i = 0; i < paths.size(); i++)
+        results[i].path = paths[i];
+
+    uint32_t threads = options.threads;
+    if (threads == 0)
+    {
+        SYSTEM_INFO info = { { 0 } };
+        GetNativeSystemInfo( &info );
+        threads = info.dwNumberOfProcessors;
+    }
+
+    ScanContext context( *this, results, options );
+    threads = static_cast<uint32_t>(std::min<size_t>( threads, paths.size() ));
+
+    std::vector<HANDLE> workers;
+    for (uint32_t i = 1; i < threads; i++)
+    {
+        HANDLE hThread = CreateThread( NULL, 0, &FileScanner::ScanWorkerWrap, &context, 0, NULL );
+        if (hThread != NULL)
+            workers.emplace_back( hThread );
+    }
+
+    // Calling thread takes part as well
+    ScanWorker( context );
+
+    for (auto hThread : workers)
+    {
+        WaitForSingleObject( hThread, INFINITE );
+        CloseHandle( hThread );
+    }
+
+    bool anyScanned = std::any_of( results.begin(), results.end(), []( const auto& res ) { return NT_SUCCESS( res.status ); } );
+    return anyScanned ? STATUS_SUCCESS : STATUS_NOT_FOUND;
+}
+
+/// <summary>
+/// Scan section raw data
+/// </summary>
+/// <param name="data">Section data</param>
+/// <param name="size">Data size</param>
+/// <param name="rva">Section RVA</param>
+/// <param name="out">Found matches</param>
+void FileScanner::ScanSection( const uint8_t* data, size_t size, uint32_t rva, std::vector<PatternSet::Match>& out ) const
+{
+    // Matches are reported as pointers into mapping and translated afterwards
+    if (_set)
+    {
+        size_t first = out.size();
+        _set->Search( data, size, out );
+
+        for (size_t i = first; i < out.size(); i++)
+            out[i].address = out[i].address - reinterpret_cast<ptr_t>(data) + rva;
+    }
+    else if (_pattern)
+    {
+        std::vector<ptr_t> found;
+        auto pData = const_cast<uint8_t*>(data);
+
+        if (_useWildcard)
+            _pattern->Search( _wildcard, pData, size, found );
+        else
+            _pattern->Search( pData, size, found );
+
+        for (auto address : found)
+            out.emplace_back( PatternSet::Match{ 0, address - reinterpret_cast<ptr_t>(data) + rva } );
+    }
+}
+
+/// <summary>
+/// Scan worker
+/// </summary>
+/// <param name="context">Shared file list</param>
+void FileScanner::ScanWorker( ScanContext& context ) const
+{
+    for (size_t idx = context.next++; idx < context.results.size(); idx = context.next++)
+        Scan( context.results[idx].path, context.results[idx], context.options );
+}
+
+/// <summary>
+/// Scan worker thread entry point
+/// </summary>
+/// <param name="lpParam">Scan context</param>
+/// <returns>0</returns>
+DWORD CALLBACK FileScanner::ScanWorkerWrap( LPVOID lpParam )
+{
+    auto& context = *reinterpret_cast<ScanContext*>(lpParam);
+    context.self.ScanWorker( context );
+    return 0;
+}
+
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include "../Include/Winheaders.h"
+#include "../Include/Types.h"
+#include "PatternSearch.h"
+#include "PatternSet.h"
+
+#include <string>
+#include <vector>
+#include <atomic>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Offline scan options
+/// </summary>
+struct FileScanOptions
+{
+    DWORD characteristics = IMAGE_SCN_MEM_EXECUTE;  // Section must have any of these IMAGE_SCN_* flags, 0 - any section
+    std::string sectionName;                        // Scan only section with this name, empty - any name
+    uint32_t threads = 0;                           // Number of worker threads for ScanMany, 0 - one per processor
+};
+
+/// <summary>
+/// Per-file scan result
+/// </summary>
+struct FileScanResult
+{
+    std::wstring path;                          // Image path
+    NTSTATUS status = STATUS_SUCCESS;           // Load status
+    eModType type = mt_default;                 // Image type
+    std::vector<PatternSet::Match> matches;     // Matches, address is an RVA. Pattern ID is 0 for single pattern scans
+};
+
+/// <summary>
+/// Scans PE files on disk without loading them into any process.
+/// Files are mapped as plain data, only raw data of selected sections is scanned
+/// and file offsets are translated into RVAs, so results can be compared with live module scans.
+/// Matches spanning two sections are not reported.
+/// </summary>
+class FileScanner
+{
+public:
+    /// <summary>
+    /// Scan for single pattern
+    /// </summary>
+    /// <param name="pattern">Pattern</param>
+    /// <param name="useWildcard">True if pattern contains wildcards</param>
+    /// <param name="wildcard">Pattern wildcard</param>
+    BLACKBONE_API FileScanner( const PatternSearch& pattern, bool useWildcard, uint8_t wildcard );
+
+    /// <summary>
+    /// Scan for all patterns of a set in one pass. Set must outlive scanner
+    /// </summary>
+    /// <param name="patterns">Pattern set</param>
+    BLACKBONE_API FileScanner( PatternSet& patterns );
+
+    BLACKBONE_API ~FileScanner() = default;
+
+    /// <summary>
+    /// Scan single file
+    /// </summary>
+    /// <param name="path">Image path</param>
+    /// <param name="result">Scan result</param>
+    /// <param name="options">Scan options, threads value is ignored</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS Scan( const std::wstring& path, FileScanResult& result, const FileScanOptions& options = FileScanOptions() ) const;
+
+    /// <summary>
+    /// Scan files on a worker pool
+    /// </summary>
+    /// <param name="paths">Image paths</param>
+    /// <param name="results">Per-file results, in the order of paths</param>
+    /// <param name="options">Scan options</param>
+    /// <returns>STATUS_SUCCESS if at least one file was scanned</returns>
+    BLACKBONE_API NTSTATUS ScanMany(
+        const std::vector<std::wstring>& paths,
+        std::vector<FileScanResult>& results,
+        const FileScanOptions& options = FileScanOptions()
+        ) const;
+
+private:
+    /// <summary>
+    /// Shared worker state
+    /// </summary>
+    struct ScanContext
+    {
+        ScanContext( const FileScanner& self_, std::vector<FileScanResult>& results_, const FileScanOptions& options_ )
+            : self( self_ ), results( results_ ), options( options_ ) { }
+
+        const FileScanner& self;
+        std::vector<FileScanResult>& results;
+        const FileScanOptions& options;
+        std::atomic<size_t> next{ 0 };
+    };
+
+    /// <summary>
+    /// Scan section raw data
+    /// </summary>
+    /// <param name="data">Section data</param>
+    /// <param name="size">Data size</param>
+    /// <param name="rva">Section RVA</param>
+    /// <param name="out">Found matches</param>
+    void ScanSection( const uint8_t* data, size_t size, uint32_t rva, std::vector<PatternSet::Match>& out ) const;
+
+    /// <summary>
+    /// Scan worker
+    /// </summary>
+    /// <param name="context">Shared file list</param>
+    void ScanWorker( ScanContext& context ) const;
+
+    /// <summary>
+    /// Scan worker thread entry point
+    /// </summary>
+    /// <param name="lpParam">Scan context</param>
+    /// <returns>0</returns>
+    static DWORD CALLBACK ScanWorkerWrap( LPVOID lpParam );
+
+private:
+    const PatternSearch* _pattern = nullptr;    // Single pattern
+    PatternSet* _set = nullptr;                 // Pattern set
+    bool _useWildcard = false;                  // Single pattern contains wildcards
+    uint8_t _wildcard = 0;                      // Single pattern wildcard
+};
+
+}
@@ -2,41 +2,413 @@
 #include "../Include/Macro.h"
 #include "../Include/Winheaders.h"
 #include "../Process/Process.h"
+#include "../PE/PEImage.h"
+#include "../DriverControl/DriverControl.h"
+
+#include "../../3rd_party/AsmJit/AsmJit.h"
 
 #include <algorithm>
+#include <sstream>
+#include <cctype>
+#include <atomic>
+#include <future>
 #include <memory>
+#include <thread>
+#include <intrin.h>
+
+#ifdef COMPILER_GCC
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
 
 namespace blackbone
 {
 
+namespace
+{
+
+/// <summary>
+/// Check if CPU and OS support AVX2
+/// </summary>
+/// <returns>true if AVX2 path can be used</returns>
+bool HasAVX2()
+{
+    static const bool avx2 = asmjit::X86CpuInfo::getHost()->hasFeature( asmjit::kX86CpuFeatureAVX2 );
+    return avx2;
+}
+
+/// <summary>
+/// Check if CPU supports SSE2
+/// </summary>
+/// <returns>true if SSE2 path can be used</returns>
+bool HasSSE2()
+{
+#ifdef USE64
+    return true;
+#else
+    static const bool sse2 = asmjit::X86CpuInfo::getHost()->hasFeature( asmjit::kX86CpuFeatureSSE2 );
+    return sse2;
+#endif
+}
+
+inline uint32_t LowestBit( uint32_t mask )
+{
+    unsigned long index = 0;
+    _BitScanForward( &index, mask );
+    return index;
+}
+
+/// <summary>
+/// Compare data against pattern ignoring wildcard bytes
+/// </summary>
+/// <param name="data">Data to test</param>
+/// <param name="layout">Pattern layout</param>
+/// <returns>true if data matches pattern</returns>
+inline bool MatchMasked( const uint8_t* data, const PatternLayout& layout )
+{
+    const size_t len = layout.bytes.size();
+    const uint8_t* pattern = layout.bytes.data();
+    const uint8_t* mask = layout.mask.data();
+
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i d = _mm_loadu_si128( reinterpret_cast<const __m128i*>(data + i) );
+        __m128i p = _mm_loadu_si128( reinterpret_cast<const __m128i*>(pattern + i) );
+        __m128i m = _mm_loadu_si128( reinterpret_cast<const __m128i*>(mask + i) );
+
+        if (_mm_movemask_epi8( _mm_cmpeq_epi8( _mm_and_si128( d, m ), p ) ) != 0xFFFF)
+            return false;
+    }
+
+    for (; i < len; i++)
+        if ((data[i] & mask[i]) != pattern[i])
+            return false;
+
+    return true;
+}
+
+/// <summary>
+/// Scalar tail of vectorized search
+/// </summary>
+/// <param name="data">Scanned data</param>
+/// <param name="size">Data size</param>
+/// <param name="pos">Starting position</param>
+/// <param name="layout">Pattern layout</param>
+/// <param name="onMatch">Match callback, returns false to stop search</param>
+template<typename Fn>
+inline void SearchMaskedTail( const uint8_t* data, size_t size, size_t pos, const PatternLayout& layout, Fn& onMatch )
+{
+    const size_t plen = layout.bytes.size();
+    const uint8_t anchor = layout.bytes[layout.first];
+
+    while (pos + plen <= size)
+    {
+        if (data[pos + layout.first] == anchor && MatchMasked( data + pos, layout ))
+        {
+            if (!onMatch( pos ))
+                return;
+
+            pos += plen;
+        }
+        else
+            pos++;
+    }
+}
+
+/// <summary>
+/// SSE2 wildcard search. First and last significant bytes are used as anchors
+/// </summary>
+/// <param name="data">Scanned data</param>
+/// <param name="size">Data size</param>
+/// <param name="layout">Pattern layout</param>
+/// <param name="onMatch">Match callback, returns false to stop search</param>
+template<typename Fn>
+void SearchMaskedSSE2( const uint8_t* data, size_t size, const PatternLayout& layout, Fn onMatch )
+{
+    const size_t plen = layout.bytes.size();
+    const __m128i first = _mm_set1_epi8( static_cast<char>(layout.bytes[layout.first]) );
+    const __m128i last = _mm_set1_epi8( static_cast<char>(layout.bytes[layout.last]) );
+
+    size_t pos = 0;
+    while (pos + layout.last + 16 <= size && pos + plen <= size)
+    {
+        __m128i d1 = _mm_loadu_si128( reinterpret_cast<const __m128i*>(data + pos + layout.first) );
+        __m128i d2 = _mm_loadu_si128( reinterpret_cast<const __m128i*>(data + pos + layout.last) );
+        uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8( _mm_and_si128( _mm_cmpeq_epi8( d1, first ), _mm_cmpeq_epi8( d2, last ) ) ));
+
+        size_t next = pos + 16;
+        for (; mask != 0; mask &= mask - 1)
+        {
+            size_t candidate = pos + LowestBit( mask );
+            if (candidate + plen <= size && MatchMasked( data + candidate, layout ))
+            {
+                if (!onMatch( candidate ))
+                    return;
+
+                next = candidate + plen;
+                break;
+            }
+        }
+
+        pos = next;
+    }
+
+    SearchMaskedTail( data, size, pos, layout, onMatch );
+}
+
+/// <summary>
+/// AVX2 wildcard search. First and last significant bytes are used as anchors
+/// </summary>
+/// <param name="data">Scanned data</param>
+/// <param name="size">Data size</param>
+/// <param name="layout">Pattern layout</param>
+/// <param name="onMatch">Match callback, returns false to stop search</param>
+template<typename Fn>
+TARGET_AVX2 void SearchMaskedAVX2( const uint8_t* data, size_t size, const PatternLayout& layout, Fn onMatch )
+{
+    const size_t plen = layout.bytes.size();
+    const __m256i first = _mm256_set1_epi8( static_cast<char>(layout.bytes[layout.first]) );
+    const __m256i last = _mm256_set1_epi8( static_cast<char>(layout.bytes[layout.last]) );
+
+    size_t pos = 0;
+    while (pos + layout.last + 32 <= size && pos + plen <= size)
+    {
+        __m256i d1 = _mm256_loadu_si256( reinterpret_cast<const __m256i*>(data + pos + layout.first) );
+        __m256i d2 = _mm256_loadu_si256( reinterpret_cast<const __m256i*>(data + pos + layout.last) );
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8( _mm256_and_si256( _mm256_cmpeq_epi8( d1, first ), _mm256_cmpeq_epi8( d2, last ) ) ));
+
+        size_t next = pos + 32;
+        for (; mask != 0; mask &= mask - 1)
+        {
+            size_t candidate = pos + LowestBit( mask );
+            if (candidate + plen <= size && MatchMasked( data + candidate, layout ))
+            {
+                if (!onMatch( candidate ))
+                {
+                    _mm256_zeroupper();
+                    return;
+                }
+
+                next = candidate + plen;
+                break;
+            }
+        }
+
+        pos = next;
+    }
+
+    _mm256_zeroupper();
+    SearchMaskedTail( data, size, pos, layout, onMatch );
+}
+
+/// <summary>
+/// Search callback that appends address to std::vector
+/// </summary>
+bool CollectResult( ptr_t address, void* context )
+{
+    reinterpret_cast<std::vector<ptr_t>*>(context)->emplace_back( address );
+    return true;
+}
+
+/// <summary>
+/// Search callback that stores first address and stops search
+/// </summary>
+bool StoreFirst( ptr_t address, void* context )
+{
+    *reinterpret_cast<ptr_t*>(context) = address;
+    return false;
+}
+
+/// <summary>
+/// Streaming search state. Tracks whether user callback requested stop
+/// </summary>
+struct StreamContext
+{
+    SearchCallback callback;
+    void* context;
+    bool stopped;
+};
+
+bool StreamResult( ptr_t address, void* context )
+{
+    auto ctx = reinterpret_cast<StreamContext*>(context);
+    ctx->stopped = !ctx->callback( address, ctx->context );
+    return !ctx->stopped;
+}
+
+}
+
+/// <summary>
+/// Check region against filter and clip it to address range
+/// </summary>
+/// <param name="mbi">Region info</param>
+/// <param name="start">Region start, clipped on return</param>
+/// <param name="size">Region size, clipped on return</param>
+/// <returns>true if region should be scanned</returns>
+bool RegionFilter::Match( const MEMORY_BASIC_INFORMATION64& mbi, ptr_t& start, ptr_t& size ) const
+{
+    if (mbi.State != MEM_COMMIT || mbi.Protect == PAGE_NOACCESS/*|| !(mbi.Protect & PAGE_READWRITE)*/)
+        return false;
+
+    if (protection != 0 && (mbi.Protect & protection) == 0)
+        return false;
+
+    if (type != 0 && (mbi.Type & type) == 0)
+        return false;
+
+    ptr_t end = mbi.BaseAddress + mbi.RegionSize;
+    start = std::max( start, minAddress );
+    if (maxAddress != 0)
+        end = std::min( end, maxAddress );
+
+    if (start >= end)
+        return false;
+
+    size = end - start;
+
+    if (!modules.empty())
+    {
+        auto inside = [&]( const ModuleDataPtr& mod )
+        {
+            return mod && start < mod->baseAddress + mod->size && mod->baseAddress < end;
+        };
+
+        if (std::none_of( modules.begin(), modules.end(), inside ))
+            return false;
+    }
+
+    return predicate == nullptr || predicate( mbi, context );
+}
+
+/// <summary>
+/// Build layout
+/// </summary>
+/// <param name="pattern">Pattern bytes</param>
+/// <param name="wildcard">Pattern wildcard</param>
+/// <returns>false if pattern consists of wildcards only</returns>
+bool PatternLayout::Build( const std::vector<uint8_t>& pattern, uint8_t wildcard )
+{
+    auto iter = std::find_if( pattern.begin(), pattern.end(), [wildcard]( uint8_t v ) { return v != wildcard; } );
+    if (iter == pattern.end())
+        return false;
+
+    first = static_cast<size_t>(iter - pattern.begin());
+    last = static_cast<size_t>(pattern.rend() - std::find_if( pattern.rbegin(), pattern.rend(), [wildcard]( uint8_t v ) { return v != wildcard; } )) - 1;
+
+    bytes.resize( pattern.size() );
+    mask.resize( pattern.size() );
+    for (size_t i = 0; i < pattern.size(); i++)
+    {
+        mask[i] = pattern[i] != wildcard ? 0xFF : 0x00;
+        bytes[i] = pattern[i] & mask[i];
+    }
+
+    return true;
+}
+
 PatternSearch::PatternSearch( const std::vector<uint8_t>& pattern )
     : _pattern( pattern )
 {
+    Compile();
+}
+
+PatternSearch::PatternSearch( const std::vector<uint8_t>& pattern, uint8_t wildcard )
+    : _pattern( pattern )
+    , _wildcard( wildcard )
+{
+    Compile();
+    _hasLayout = _layout.Build( _pattern, wildcard );
 }
 
 PatternSearch::PatternSearch( const std::initializer_list<uint8_t>&& pattern )
     : _pattern( pattern )
 {
+    Compile();
 }
 
 PatternSearch::PatternSearch( const std::string& pattern )
     : _pattern( pattern.begin(), pattern.end() )
 {
+    Compile();
 }
 
 PatternSearch::PatternSearch( const char* pattern, size_t len /*= 0*/ )
     : _pattern( pattern, pattern + (len ? len : strlen( pattern )) )
 {
+    Compile();
 }
 
 PatternSearch::PatternSearch( const uint8_t* pattern, size_t len /*= 0*/ )
     : _pattern( pattern, pattern + (len ? len : strlen( (const char*)pattern )) )
 { 
+    Compile();
+}
+
+/// <summary>
+/// Parse IDA-style pattern string, e.g. "48 8B ?? ?? 89".
+/// Wildcard layout is precompiled, search with wildcard() value.
+/// </summary>
+/// <param name="pattern">Space separated hex bytes, '?' or '??' for wildcard</param>
+/// <param name="wildcard">Byte value used for wildcard positions</param>
+/// <returns>Compiled pattern or STATUS_INVALID_PARAMETER if string is malformed</returns>
+call_result_t<PatternSearch> PatternSearch::FromString( const std::string& pattern, uint8_t wildcard /*= 0xCC*/ )
+{
+    std::vector<uint8_t> bytes, mask;
+    std::istringstream stream( pattern );
+
+    for (std::string token; stream >> token;)
+    {
+        if (token == "?" || token == "??")
+        {
+            bytes.emplace_back( wildcard );
+            mask.emplace_back( 0x00 );
+        }
+        else if (token.size() == 2 && isxdigit( static_cast<uint8_t>(token[0]) ) && isxdigit( static_cast<uint8_t>(token[1]) ))
+        {
+            bytes.emplace_back( static_cast<uint8_t>(strtoul( token.c_str(), nullptr, 16 )) );
+            mask.emplace_back( 0xFF );
+        }
+        else
+            return STATUS_INVALID_PARAMETER;
+    }
+
+    auto first = std::find( mask.begin(), mask.end(), 0xFF );
+    if (first == mask.end())
+        return STATUS_INVALID_PARAMETER;
+
+    PatternSearch result( bytes );
+    result._wildcard = wildcard;
+    result._hasLayout = true;
+
+    // Literal bytes equal to wildcard stay significant, so layout is built from parsed mask
+    auto& layout = result._layout;
+    layout.first = static_cast<size_t>(first - mask.begin());
+    layout.last = static_cast<size_t>(mask.rend() - std::find( mask.rbegin(), mask.rend(), 0xFF )) - 1;
+    layout.mask = mask;
+    layout.bytes.resize( bytes.size() );
+    for (size_t i = 0; i < bytes.size(); i++)
+        layout.bytes[i] = bytes[i] & mask[i];
+
+    return result;
+}
+
+/// <summary>
+/// Precompute search tables
+/// </summary>
+void PatternSearch::Compile()
+{
+    const size_t nlen = _pattern.size();
+
+    _skip.fill( nlen );
+    for (size_t i = 0; i + 1 < nlen; i++)
+        _skip[_pattern[i]] = nlen - 1 - i;
 }
 
 /// <summary>
 /// Default pattern matching with wildcards.
-/// std::search is approximately 2x faster than naive approach.
+/// Uses AVX2 or SSE2 anchor scan if supported by CPU, scalar anchor scan otherwise.
 /// </summary>
 /// <param name="wildcard">Pattern wildcard</param>
 /// <param name="scanStart">Starting address</param>
@@ -51,9 +423,70 @@ size_t PatternSearch::Search(
     std::vector<ptr_t>& out, 
     ptr_t value_offset /*= 0*/ 
     ) const
+{
+    Search( wildcard, scanStart, scanSize, &CollectResult, &out, value_offset );
+    return out.size();
+}
+
+/// <summary>
+/// Default pattern matching with wildcards.
+/// Uses AVX2 or SSE2 anchor scan if supported by CPU, scalar anchor scan otherwise.
+/// </summary>
+/// <param name="wildcard">Pattern wildcard</param>
+/// <param name="scanStart">Starting address</param>
+/// <param name="scanSize">Size of region to scan</param>
+/// <param name="callback">Called for every found address, returns false to stop search</param>
+/// <param name="context">User context passed to callback</param>
+/// <param name="value_offset">Value that will be added to resulting addresses</param>
+/// <returns>Number of addresses passed to callback</returns>
+size_t PatternSearch::Search( 
+    uint8_t wildcard, 
+    void* scanStart, 
+    size_t scanSize, 
+    SearchCallback callback, 
+    void* context, 
+    ptr_t value_offset /*= 0*/ 
+    ) const
 {
     const uint8_t* cstart = (const uint8_t*)scanStart;
     const uint8_t* cend   = cstart + scanSize;
+    size_t found = 0;
+
+    auto report = [&]( const uint8_t* ptr )
+    {
+        found++;
+        if (value_offset != 0)
+            return callback( REBASE( ptr, scanStart, value_offset ), context );
+        else
+            return callback( reinterpret_cast<ptr_t>(ptr), context );
+    };
+
+    // Use precompiled layout if wildcard matches
+    PatternLayout local;
+    const PatternLayout* layout = nullptr;
+    if (_hasLayout && wildcard == _wildcard)
+        layout = &_layout;
+    else if (local.Build( _pattern, wildcard ))
+        layout = &local;
+
+    if (layout)
+    {
+        if (_pattern.size() > scanSize)
+            return found;
+
+        auto onMatch = [&]( size_t pos ) { return report( cstart + pos ); };
+
+        if (HasAVX2())
+            SearchMaskedAVX2( cstart, scanSize, *layout, onMatch );
+        else if (HasSSE2())
+            SearchMaskedSSE2( cstart, scanSize, *layout, onMatch );
+        else
+            SearchMaskedTail( cstart, scanSize, 0, *layout, onMatch );
+
+        return found;
+    }
+
+    // Pattern consists of wildcards only
 
     auto comparer = [&wildcard]( uint8_t val1, uint8_t val2 )
     {
@@ -63,18 +496,13 @@ size_t PatternSearch::Search(
     for (;;)
     {
         const uint8_t* res = std::search( cstart, cend, _pattern.begin(), _pattern.end(), comparer );
-        if (res >= cend)
+        if (res >= cend || !report( res ))
             break;
 
-        if (value_offset != 0)
-            out.emplace_back( REBASE( res, scanStart, value_offset ) );
-        else
-            out.emplace_back( reinterpret_cast<ptr_t>(res) );
-
         cstart = res + _pattern.size();
     }
 
-    return out.size();
+    return found;
 }
 
 /// <summary>
@@ -93,36 +521,55 @@ size_t PatternSearch::Search(
     ptr_t value_offset /*= 0*/ 
     ) const
 {
-    size_t bad_char_skip[UCHAR_MAX + 1];
+    Search( scanStart, scanSize, &CollectResult, &out, value_offset );
+    return out.size();
+}
+
+/// <summary>
+/// Full pattern match, no wildcards.
+/// Uses BoyerMooreHorspool algorithm.
+/// </summary>
+/// <param name="scanStart">Starting address</param>
+/// <param name="scanSize">Size of region to scan</param>
+/// <param name="callback">Called for every found address, returns false to stop search</param>
+/// <param name="context">User context passed to callback</param>
+/// <param name="value_offset">Value that will be added to resulting addresses</param>
+/// <returns>Number of addresses passed to callback</returns>
+size_t PatternSearch::Search( 
+    void* scanStart,
+    size_t scanSize, 
+    SearchCallback callback, 
+    void* context, 
+    ptr_t value_offset /*= 0*/ 
+    ) const
+{
+    if (_pattern.empty())
+        return 0;
 
     const uint8_t* haystack = reinterpret_cast<const uint8_t*>(scanStart);
     const uint8_t* needle   = &_pattern[0];
     uintptr_t       nlen     = _pattern.size();
     uintptr_t       scan     = 0;
     uintptr_t       last     = nlen - 1;
+    size_t          found    = 0;
 
-    //
-    // Preprocess
-    //
-    for (scan = 0; scan <= UCHAR_MAX; ++scan)
-        bad_char_skip[scan] = nlen;
-
-    for (scan = 0; scan < last; ++scan)
-        bad_char_skip[needle[scan]] = last - scan;
+    // Skip table is precomputed in constructor
+    const auto& bad_char_skip = _skip;
 
-    //
-    // Search
-    //
     while (scanSize >= static_cast<size_t>(nlen))
     {
         for (scan = last; haystack[scan] == needle[scan]; --scan)
         {
             if (scan == 0)
             {
-                if (value_offset != 0)
-                    out.emplace_back( REBASE( haystack, scanStart, value_offset ) );
-                else
-                    out.emplace_back( reinterpret_cast<ptr_t>(haystack) );
+                found++;
+
+                bool proceed = value_offset != 0 ?
+                    callback( REBASE( haystack, scanStart, value_offset ), context ) :
+                    callback( reinterpret_cast<ptr_t>(haystack), context );
+
+                if (!proceed)
+                    return found;
 
                 break;
             }
@@ -132,7 +579,36 @@ size_t PatternSearch::Search(
         haystack += bad_char_skip[haystack[last]];
     }
 
-    return out.size();
+    return found;
+}
+
+/// <summary>
+/// Find first pattern occurrence, wildcards allowed
+/// </summary>
+/// <param name="wildcard">Pattern wildcard</param>
+/// <param name="scanStart">Starting address</param>
+/// <param name="scanSize">Size of region to scan</param>
+/// <param name="value_offset">Value that will be added to resulting address</param>
+/// <returns>Found address, 0 if not found</returns>
+ptr_t PatternSearch::SearchFirst( uint8_t wildcard, void* scanStart, size_t scanSize, ptr_t value_offset /*= 0*/ ) const
+{
+    ptr_t result = 0;
+    Search( wildcard, scanStart, scanSize, &StoreFirst, &result, value_offset );
+    return result;
+}
+
+/// <summary>
+/// Find first pattern occurrence, no wildcards
+/// </summary>
+/// <param name="scanStart">Starting address</param>
+/// <param name="scanSize">Size of region to scan</param>
+/// <param name="value_offset">Value that will be added to resulting address</param>
+/// <returns>Found address, 0 if not found</returns>
+ptr_t PatternSearch::SearchFirst( void* scanStart, size_t scanSize, ptr_t value_offset /*= 0*/ ) const
+{
+    ptr_t result = 0;
+    Search( scanStart, scanSize, &StoreFirst, &result, value_offset );
+    return result;
 }
 
 /// <summary>
@@ -190,29 +666,92 @@ size_t PatternSearch::SearchRemote(
 }
 
 /// <summary>
-/// Search pattern in whole address space of remote process
+/// Search pattern in whole address space of remote process.
+/// If BlackBone driver is loaded and filter has no module or predicate constraints,
+/// scan is performed in kernel and only match addresses are transferred.
 /// </summary>
 /// <param name="remote">Remote process</param>
 /// <param name="useWildcard">True if pattern contains wildcards</param>
 /// <param name="wildcard">Pattern wildcard</param>
 /// <param name="out">Found results</param>
+/// <param name="threads">Number of scanning threads. 1 - scan sequentially, 0 - use all CPU cores</param>
+/// <param name="filter">Scanned regions filter</param>
 /// <returns>Number of found addresses</returns>
 size_t PatternSearch::SearchRemoteWhole( 
     Process& remote, 
     bool useWildcard, 
     uint8_t wildcard, 
-    std::vector<ptr_t>& out 
+    std::vector<ptr_t>& out,
+    uint32_t threads /*= 1*/,
+    const RegionFilter& filter /*= RegionFilter()*/
     ) const
 {
+    if (threads == 0)
+        threads = std::max( std::thread::hardware_concurrency(), 1u );
+
+    if (NT_SUCCESS( SearchDriver( remote, useWildcard, wildcard, out, threads, filter ) ))
+        return out.size();
+
+    if (threads > 1)
+        return SearchRemoteParallel( remote, useWildcard, wildcard, out, threads, filter );
+
+    out.clear();
+    SearchRemoteWhole( remote, useWildcard, wildcard, &CollectResult, &out, filter );
+
+    return out.size();
+}
+
+/// <summary>
+/// Search pattern in whole address space of remote process.
+/// Scan stops as soon as callback returns false.
+/// Kernel scan is used under the same conditions as in vector version.
+/// </summary>
+/// <param name="remote">Remote process</param>
+/// <param name="useWildcard">True if pattern contains wildcards</param>
+/// <param name="wildcard">Pattern wildcard</param>
+/// <param name="callback">Called for every found address, returns false to stop search</param>
+/// <param name="context">User context passed to callback</param>
+/// <param name="filter">Scanned regions filter</param>
+/// <returns>Number of addresses passed to callback</returns>
+size_t PatternSearch::SearchRemoteWhole( 
+    Process& remote, 
+    bool useWildcard, 
+    uint8_t wildcard, 
+    SearchCallback callback, 
+    void* context,
+    const RegionFilter& filter /*= RegionFilter()*/
+    ) const
+{
+    std::vector<ptr_t> kernelResults;
+    if (NT_SUCCESS( SearchDriver( remote, useWildcard, wildcard, kernelResults, 1, filter ) ))
+    {
+        size_t passed = 0;
+        for (auto address : kernelResults)
+        {
+            passed++;
+            if (!callback( address, context ))
+                break;
+        }
+
+        return passed;
+    }
+
+    // Regions are streamed through fixed size buffer, so memory usage doesn't depend on region size
     MEMORY_BASIC_INFORMATION64 mbi = { 0 };
-    size_t  bufsize = 1 * 1024 * 1024;  // 1 MB
+    const size_t chunkSize = 1 * 1024 * 1024;  // 1 MB
+    const size_t bufsize = chunkSize + (_pattern.empty() ? 0 : _pattern.size() - 1);
     uint8_t *buf = reinterpret_cast<uint8_t*>(VirtualAlloc( 0, bufsize, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE ));
+    size_t found = 0;
+    bool stopped = false;
 
-    out.clear();
+    if (!buf)
+        return 0;
 
     auto native = remote.core().native();
 
-    for (ptr_t memptr = native->minAddr(); memptr < native->maxAddr(); memptr = mbi.BaseAddress + mbi.RegionSize)
+    const ptr_t maxAddr = filter.maxAddress != 0 ? std::min( filter.maxAddress, native->maxAddr() ) : native->maxAddr();
+
+    for (ptr_t memptr = std::max( native->minAddr(), filter.minAddress ); memptr < maxAddr && !stopped; memptr = mbi.BaseAddress + mbi.RegionSize)
     {
         auto status = remote.core().native()->VirtualQueryExT( memptr, &mbi );
 
@@ -222,30 +761,440 @@ size_t PatternSearch::SearchRemoteWhole(
             continue;
 
         // Filter regions
-        if (mbi.State != MEM_COMMIT || mbi.Protect == PAGE_NOACCESS/*|| !(mbi.Protect & PAGE_READWRITE)*/)
+        ptr_t start = memptr, size = 0;
+        if (!filter.Match( mbi, start, size ))
             continue;
 
-        // Reallocate buffer
-        if (mbi.RegionSize > bufsize)
+        found += SearchRemoteStream( 
+            remote, useWildcard, wildcard, start, static_cast<size_t>(size), buf, chunkSize, callback, context, stopped 
+            );
+    }
+
+    VirtualFree( buf, 0, MEM_RELEASE );
+
+    return found;
+}
+
+
+
+/// <summary>
+/// Search pattern in remote process using BlackBone driver.
+/// With several threads, matching regions are split into slices of roughly equal size
+/// and every slice is scanned by separate kernel request.
+/// </summary>
+/// <param name="remote">Remote process</param>
+/// <param name="useWildcard">True if pattern contains wildcards</param>
+/// <param name="wildcard">Pattern wildcard</param>
+/// <param name="out">Found results, sorted by address</param>
+/// <param name="threads">Number of concurrent kernel scans</param>
+/// <param name="filter">Scanned regions filter</param>
+/// <returns>Status code, STATUS_NOT_SUPPORTED if scan can't be done in kernel</returns>
+NTSTATUS PatternSearch::SearchDriver( 
+    Process& remote, 
+    bool useWildcard, 
+    uint8_t wildcard, 
+    std::vector<ptr_t>& out,
+    uint32_t threads,
+    const RegionFilter& filter
+    ) const
+{
+    // Module and predicate filters can only be evaluated in user mode
+    if (!Driver().loaded() || _pattern.empty() || _pattern.size() > BLACKBONE_MAX_PATTERN)
+        return STATUS_NOT_SUPPORTED;
+
+    if (!filter.modules.empty() || filter.predicate != nullptr)
+        return STATUS_NOT_SUPPORTED;
+
+    std::vector<uint8_t> mask;
+    if (useWildcard)
+    {
+        mask.resize( _pattern.size() );
+        for (size_t i = 0; i < _pattern.size(); i++)
+            mask[i] = _pattern[i] != wildcard ? 0xFF : 0x00;
+
+        // Pattern of wildcards only
+        if (std::none_of( mask.begin(), mask.end(), []( uint8_t m ) { return m != 0; } ))
+            return STATUS_NOT_SUPPORTED;
+    }
+
+    auto native = remote.core().native();
+    const ptr_t minAddr = std::max( native->minAddr(), filter.minAddress );
+    const ptr_t maxAddr = filter.maxAddress != 0 ? std::min( filter.maxAddress, native->maxAddr() ) : native->maxAddr();
+
+    auto scan = [&]( ptr_t start, ptr_t end, std::vector<ptr_t>& found )
+    {
+        return Driver().ScanMemory( 
+            remote.core().pid(), _pattern.data(), useWildcard ? mask.data() : nullptr, _pattern.size(), found,
+            start, end, filter.protection, filter.type
+            );
+    };
+
+    std::vector<ptr_t> results;
+    if (threads <= 1)
+    {
+        NTSTATUS status = scan( minAddr, maxAddr, results );
+        if (NT_SUCCESS( status ))
+            out.swap( results );
+
+        return status;
+    }
+
+    // Collect scanned ranges to split them evenly between threads
+    MEMORY_BASIC_INFORMATION64 mbi = { 0 };
+    std::vector<std::pair<ptr_t, ptr_t>> ranges;
+    ptr_t total = 0;
+
+    for (ptr_t memptr = minAddr; memptr < maxAddr; memptr = mbi.BaseAddress + mbi.RegionSize)
+    {
+        auto status = native->VirtualQueryExT( memptr, &mbi );
+
+        if (status == STATUS_INVALID_PARAMETER || status == STATUS_ACCESS_DENIED)
+            break;
+        else if (status != STATUS_SUCCESS)
+            continue;
+
+        ptr_t start = memptr, size = 0;
+        if (!filter.Match( mbi, start, size ))
+            continue;
+
+        ranges.emplace_back( start, start + size );
+        total += size;
+    }
+
+    // Slice ends either on region end or in the middle of a region
+    const ptr_t sliceSize = std::max<ptr_t>( (total + threads - 1) / threads, 1 );
+    std::vector<std::pair<ptr_t, ptr_t>> slices;
+    ptr_t sliceStart = 0, accumulated = 0;
+
+    for (auto& range : ranges)
+    {
+        for (ptr_t ptr = range.first; ptr < range.second;)
+        {
+            if (accumulated == 0)
+                sliceStart = ptr;
+
+            ptr_t step = std::min( range.second - ptr, sliceSize - accumulated );
+            ptr += step;
+            accumulated += step;
+
+            if (accumulated == sliceSize)
+            {
+                slices.emplace_back( sliceStart, ptr );
+                accumulated = 0;
+            }
+        }
+    }
+
+    if (accumulated != 0)
+        slices.emplace_back( sliceStart, ranges.back().second );
+
+    // Slices overlap by pattern size - 1, match belongs to slice it starts in
+    const ptr_t overlap = _pattern.size() - 1;
+    std::vector<std::vector<ptr_t>> found( slices.size() );
+    std::vector<NTSTATUS> statuses( slices.size(), STATUS_SUCCESS );
+    std::vector<std::thread> pool;
+
+    for (size_t i = 0; i < slices.size(); i++)
+    {
+        pool.emplace_back( [&, i]()
+        {
+            const ptr_t end = slices[i].second;
+            statuses[i] = scan( slices[i].first, std::min( end + overlap, maxAddr ), found[i] );
+            found[i].erase( std::find_if( found[i].begin(), found[i].end(), [end]( ptr_t v ) { return v >= end; } ), found[i].end() );
+        } );
+    }
+
+    for (auto& thread : pool)
+        thread.join();
+
+    // Slices are ordered by address, so concatenation keeps results sorted
+    for (size_t i = 0; i < slices.size(); i++)
+    {
+        if (!NT_SUCCESS( statuses[i] ))
+            return statuses[i];
+
+        results.insert( results.end(), found[i].begin(), found[i].end() );
+    }
+
+    out.swap( results );
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Search pattern in sections of remote module.
+/// Section headers are parsed with pe::PEImage, every matching section is read once.
+/// </summary>
+/// <param name="remote">Remote process</param>
+/// <param name="module">Module to scan</param>
+/// <param name="useWildcard">True if pattern contains wildcards</param>
+/// <param name="wildcard">Pattern wildcard</param>
+/// <param name="out">Found results</param>
+/// <param name="characteristics">Section must have any of these IMAGE_SCN_* flags, 0 - any section</param>
+/// <param name="sectionName">Scan only section with this name, empty - any name</param>
+/// <returns>Number of found addresses</returns>
+size_t PatternSearch::SearchModule( 
+    Process& remote, 
+    const ModuleDataPtr& module, 
+    bool useWildcard, 
+    uint8_t wildcard, 
+    std::vector<ptr_t>& out,
+    DWORD characteristics /*= IMAGE_SCN_MEM_EXECUTE*/,
+    const std::string& sectionName /*= ""*/
+    ) const
+{
+    if (!module || module->size == 0)
+        return out.size();
+
+    // Image-sized zeroed buffer, pages are committed only for read data
+    uint8_t *buf = reinterpret_cast<uint8_t*>(VirtualAlloc( 0, module->size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE ));
+    if (!buf)
+        return out.size();
+
+    pe::PEImage image, fullImage;
+    pe::PEImage* pImage = &image;
+    size_t hdrSize = std::min<size_t>( module->size, remote.core().native()->pageSize() );
+
+    auto status = remote.memory().Read( module->baseAddress, hdrSize, buf );
+    if (NT_SUCCESS( status ))
+        status = image.Parse( buf );
+
+    // Section table doesn't fit into first page
+    if (NT_SUCCESS( status ) && image.headersSize() > hdrSize && image.headersSize() <= module->size)
+    {
+        pImage = &fullImage;
+        status = remote.memory().Read( module->baseAddress, image.headersSize(), buf );
+        if (NT_SUCCESS( status ))
+            status = fullImage.Parse( buf );
+    }
+
+    if (NT_SUCCESS( status ))
+    {
+        for (const auto& section : pImage->sections())
         {
-            bufsize = static_cast<size_t>(mbi.RegionSize);
-            VirtualFree( buf, 0, MEM_RELEASE );
-            buf = reinterpret_cast<uint8_t*>(VirtualAlloc( 0, bufsize, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE ));
+            if (characteristics != 0 && (section.Characteristics & characteristics) == 0)
+                continue;
+
+            auto pName = reinterpret_cast<const char*>(section.Name);
+            if (!sectionName.empty() && sectionName != std::string( pName, strnlen( pName, IMAGE_SIZEOF_SHORT_NAME ) ))
+                continue;
+
+            size_t size = section.Misc.VirtualSize != 0 ? section.Misc.VirtualSize : section.SizeOfRawData;
+            if (section.VirtualAddress >= module->size)
+                continue;
+
+            size = std::min<size_t>( size, module->size - section.VirtualAddress );
+            uint8_t* pSection = buf + section.VirtualAddress;
+            ptr_t address = module->baseAddress + section.VirtualAddress;
+
+            if (size == 0 || remote.memory().Read( address, size, pSection ) != STATUS_SUCCESS)
+                continue;
+
+            if (useWildcard)
+                Search( wildcard, pSection, size, out, address );
+            else
+                Search( pSection, size, out, address );
         }
+    }
 
-        if (remote.memory().Read( memptr, static_cast<size_t>(mbi.RegionSize), buf ) != STATUS_SUCCESS)
+    VirtualFree( buf, 0, MEM_RELEASE );
+    return out.size();
+}
+
+/// <summary>
+/// Search pattern in remote memory range reading it in fixed size chunks.
+/// Last pattern size - 1 bytes of every chunk are carried over to the next one,
+/// so matches crossing chunk boundary are not lost.
+/// </summary>
+/// <param name="remote">Remote process</param>
+/// <param name="useWildcard">True if pattern contains wildcards</param>
+/// <param name="wildcard">Pattern wildcard</param>
+/// <param name="scanStart">Starting address</param>
+/// <param name="scanSize">Size of region to scan</param>
+/// <param name="buf">Scratch buffer, must hold chunkSize + pattern size - 1 bytes</param>
+/// <param name="chunkSize">Number of bytes read at once</param>
+/// <param name="callback">Called for every found address, returns false to stop search</param>
+/// <param name="context">User context passed to callback</param>
+/// <param name="stopped">Set to true if callback requested stop</param>
+/// <returns>Number of addresses passed to callback</returns>
+size_t PatternSearch::SearchRemoteStream( 
+    Process& remote, 
+    bool useWildcard, 
+    uint8_t wildcard, 
+    ptr_t scanStart, 
+    size_t scanSize, 
+    uint8_t* buf, 
+    size_t chunkSize, 
+    SearchCallback callback, 
+    void* context, 
+    bool& stopped 
+    ) const
+{
+    const size_t overlap = _pattern.empty() ? 0 : _pattern.size() - 1;
+    StreamContext ctx = { callback, context, false };
+    size_t carry = 0;
+    size_t found = 0;
+
+    for (size_t offset = 0; offset < scanSize; offset += chunkSize)
+    {
+        size_t size = std::min( chunkSize, scanSize - offset );
+
+        // Unreadable chunk breaks continuity
+        if (remote.memory().Read( scanStart + offset, size, buf + carry ) != STATUS_SUCCESS)
+        {
+            carry = 0;
             continue;
+        }
+
+        size_t total = carry + size;
+        ptr_t base = scanStart + offset - carry;
 
         if (useWildcard)
-            Search( wildcard, buf, static_cast<size_t>(mbi.RegionSize), out, memptr );
+            found += Search( wildcard, buf, total, &StreamResult, &ctx, base );
         else
-            Search( buf, static_cast<size_t>(mbi.RegionSize), out, memptr );
+            found += Search( buf, total, &StreamResult, &ctx, base );
+
+        if (ctx.stopped)
+        {
+            stopped = true;
+            break;
+        }
+
+        // Match starting inside carried tail can't fit into current chunk, so it won't be reported twice
+        carry = std::min( overlap, total );
+        memmove( buf, buf + total - carry, carry );
     }
 
-    VirtualFree( buf, 0, MEM_RELEASE );
+    return found;
+}
+
+/// <summary>
+/// Search pattern in committed regions of remote process using multiple threads.
+/// Remote reads are prefetched into second per-thread buffer while current one is scanned.
+/// </summary>
+/// <param name="remote">Remote process</param>
+/// <param name="useWildcard">True if pattern contains wildcards</param>
+/// <param name="wildcard">Pattern wildcard</param>
+/// <param name="out">Found results, sorted by address</param>
+/// <param name="threads">Number of scanning threads</param>
+/// <param name="filter">Scanned regions filter</param>
+/// <returns>Number of found addresses</returns>
+size_t PatternSearch::SearchRemoteParallel( 
+    Process& remote, 
+    bool useWildcard, 
+    uint8_t wildcard, 
+    std::vector<ptr_t>& out,
+    uint32_t threads,
+    const RegionFilter& filter
+    ) const
+{
+    // Large regions are split into chunks so they can be scanned by several threads.
+    // Chunks overlap by pattern size - 1, match belongs to chunk it starts in.
+    constexpr size_t chunkSize = 4 * 1024 * 1024;  // 4 MB
+
+    struct WorkItem
+    {
+        ptr_t base;         // Chunk address
+        size_t size;        // Bytes to read, including overlap
+        size_t owned;       // Bytes owned by this chunk
+    };
+
+    MEMORY_BASIC_INFORMATION64 mbi = { 0 };
+    std::vector<WorkItem> items;
+
+    out.clear();
+
+    auto native = remote.core().native();
+    const size_t overlap = _pattern.empty() ? 0 : _pattern.size() - 1;
+
+    const ptr_t maxAddr = filter.maxAddress != 0 ? std::min( filter.maxAddress, native->maxAddr() ) : native->maxAddr();
+
+    for (ptr_t memptr = std::max( native->minAddr(), filter.minAddress ); memptr < maxAddr; memptr = mbi.BaseAddress + mbi.RegionSize)
+    {
+        auto status = native->VirtualQueryExT( memptr, &mbi );
+
+        if (status == STATUS_INVALID_PARAMETER || status == STATUS_ACCESS_DENIED)
+            break;
+        else if (status != STATUS_SUCCESS)
+            continue;
+
+        // Filter regions
+        ptr_t start = memptr, regionSize = 0;
+        if (!filter.Match( mbi, start, regionSize ))
+            continue;
+
+        const ptr_t end = start + regionSize;
+        for (ptr_t base = start; base < end; base += chunkSize)
+        {
+            size_t owned = static_cast<size_t>(std::min<ptr_t>( chunkSize, end - base ));
+            size_t size = static_cast<size_t>(std::min<ptr_t>( owned + overlap, end - base ));
+            items.emplace_back( WorkItem{ base, size, owned } );
+        }
+    }
+
+    if (items.empty())
+        return 0;
+
+    threads = std::min( threads, static_cast<uint32_t>(items.size()) );
+
+    std::vector<std::vector<ptr_t>> results( items.size() );
+    std::atomic<size_t> next( 0 );
+
+    auto read = [&]( size_t idx, std::vector<uint8_t>& buf )
+    {
+        buf.resize( items[idx].size );
+        return remote.memory().Read( items[idx].base, items[idx].size, buf.data() );
+    };
+
+    auto scan = [&]( size_t idx, std::vector<uint8_t>& buf )
+    {
+        auto& found = results[idx];
+        if (useWildcard)
+            Search( wildcard, buf.data(), buf.size(), found, items[idx].base );
+        else
+            Search( buf.data(), buf.size(), found, items[idx].base );
+
+        // Drop matches that belong to next chunk
+        const ptr_t limit = items[idx].base + items[idx].owned;
+        found.erase( std::find_if( found.begin(), found.end(), [limit]( ptr_t v ) { return v >= limit; } ), found.end() );
+    };
+
+    auto worker = [&]()
+    {
+        std::vector<uint8_t> buffers[2];
+        int current = 0;
+
+        size_t idx = next++;
+        NTSTATUS status = idx < items.size() ? read( idx, buffers[current] ) : STATUS_NO_MORE_ENTRIES;
+
+        while (idx < items.size())
+        {
+            // Prefetch next chunk while current one is scanned
+            size_t nextIdx = next++;
+            std::future<NTSTATUS> prefetch;
+            if (nextIdx < items.size())
+                prefetch = std::async( std::launch::async, read, nextIdx, std::ref( buffers[current ^ 1] ) );
+
+            if (status == STATUS_SUCCESS)
+                scan( idx, buffers[current] );
+
+            status = prefetch.valid() ? prefetch.get() : STATUS_NO_MORE_ENTRIES;
+            idx = nextIdx;
+            current ^= 1;
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (uint32_t i = 0; i < threads; i++)
+        pool.emplace_back( worker );
+
+    for (auto& thread : pool)
+        thread.join();
+
+    // Chunks are ordered by address, so concatenation keeps results sorted
+    for (auto& found : results)
+        out.insert( out.end(), found.begin(), found.end() );
 
     return out.size();
 }
 
-
 }
\ No newline at end of file
@@ -1,18 +1,93 @@
 #pragma once
 
+#include "../Include/Winheaders.h"
 #include "../Include/Types.h"
+#include "../Include/CallResult.h"
 
 #include <string>
 #include <vector>
+#include <array>
 #include <initializer_list>
 
 namespace blackbone
 {
 
+/// <summary>
+/// Pattern search callback
+/// </summary>
+/// <param name="address">Found address</param>
+/// <param name="context">User context</param>
+/// <returns>true to continue search, false to stop</returns>
+using SearchCallback = bool( *)(ptr_t address, void* context);
+
+/// <summary>
+/// Custom region predicate
+/// </summary>
+/// <param name="mbi">Region info</param>
+/// <param name="context">User context</param>
+/// <returns>true if region should be scanned</returns>
+using RegionPredicate = bool( *)(const MEMORY_BASIC_INFORMATION64& mbi, void* context);
+
+/// <summary>
+/// Memory region filter for whole-process scans.
+/// Committed accessible regions are always required, every non-empty criterion narrows the set further.
+/// </summary>
+struct RegionFilter
+{
+    DWORD protection = 0;               // Any of these protection flags must be set, 0 - any protection
+    DWORD type = 0;                     // Any of MEM_IMAGE | MEM_PRIVATE | MEM_MAPPED, 0 - any type
+    ptr_t minAddress = 0;               // Lowest scanned address
+    ptr_t maxAddress = 0;               // Highest scanned address (exclusive), 0 - no limit
+    std::vector<ModuleDataPtr> modules; // Scan only regions inside these modules
+    RegionPredicate predicate = nullptr;// Custom predicate
+    void* context = nullptr;            // Custom predicate context
+
+    /// <summary>
+    /// Executable image memory, typical for code signatures
+    /// </summary>
+    /// <returns>Filter</returns>
+    static RegionFilter Code()
+    {
+        RegionFilter filter;
+        filter.protection = PAGE_EXECUTE | PAGE_EXECUTE_READ | PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY;
+        filter.type = MEM_IMAGE;
+        return filter;
+    }
+
+    /// <summary>
+    /// Check region against filter and clip it to address range
+    /// </summary>
+    /// <param name="mbi">Region info</param>
+    /// <param name="start">Region start, clipped on return</param>
+    /// <param name="size">Region size, clipped on return</param>
+    /// <returns>true if region should be scanned</returns>
+    BLACKBONE_API bool Match( const MEMORY_BASIC_INFORMATION64& mbi, ptr_t& start, ptr_t& size ) const;
+};
+
+/// <summary>
+/// Wildcard pattern layout used by vectorized matchers
+/// </summary>
+struct PatternLayout
+{
+    size_t first = 0;               // Index of first non-wildcard byte
+    size_t last = 0;                // Index of last non-wildcard byte
+    std::vector<uint8_t> bytes;     // Pattern bytes with wildcards zeroed
+    std::vector<uint8_t> mask;      // 0xFF for significant byte, 0x00 for wildcard
+
+    /// <summary>
+    /// Build layout
+    /// </summary>
+    /// <param name="pattern">Pattern bytes</param>
+    /// <param name="wildcard">Pattern wildcard</param>
+    /// <returns>false if pattern consists of wildcards only</returns>
+    bool Build( const std::vector<uint8_t>& pattern, uint8_t wildcard );
+};
+
 class PatternSearch
 {
 public:
     BLACKBONE_API PatternSearch( const std::vector<uint8_t>& pattern );
+    BLACKBONE_API PatternSearch( const std::vector<uint8_t>& pattern, uint8_t wildcard );
     BLACKBONE_API PatternSearch( const std::initializer_list<uint8_t>&& pattern );
     BLACKBONE_API PatternSearch( const std::string& pattern );
     BLACKBONE_API PatternSearch( const char* pattern, size_t len = 0 );
@@ -20,9 +95,18 @@ public:
 
     BLACKBONE_API ~PatternSearch() = default;
 
+    /// <summary>
+    /// Parse IDA-style pattern string, e.g. "48 8B ?? ?? 89".
+    /// Wildcard layout is precompiled, search with wildcard() value.
+    /// </summary>
+    /// <param name="pattern">Space separated hex bytes, '?' or '??' for wildcard</param>
+    /// <param name="wildcard">Byte value used for wildcard positions</param>
+    /// <returns>Compiled pattern or STATUS_INVALID_PARAMETER if string is malformed</returns>
+    BLACKBONE_API static call_result_t<PatternSearch> FromString( const std::string& pattern, uint8_t wildcard = 0xCC );
+
     /// <summary>
     /// Default pattern matching with wildcards.
-    /// std::search is approximately 2x faster than naive approach.
+    /// Uses AVX2 or SSE2 anchor scan if supported by CPU, scalar anchor scan otherwise.
     /// </summary>
     /// <param name="wildcard">Pattern wildcard</param>
     /// <param name="scanStart">Starting address</param>
@@ -54,6 +138,63 @@ public:
         ptr_t value_offset = 0 
         ) const;
 
+    /// <summary>
+    /// Default pattern matching with wildcards.
+    /// Uses AVX2 or SSE2 anchor scan if supported by CPU, scalar anchor scan otherwise.
+    /// </summary>
+    /// <param name="wildcard">Pattern wildcard</param>
+    /// <param name="scanStart">Starting address</param>
+    /// <param name="scanSize">Size of region to scan</param>
+    /// <param name="callback">Called for every found address, returns false to stop search</param>
+    /// <param name="context">User context passed to callback</param>
+    /// <param name="value_offset">Value that will be added to resulting addresses</param>
+    /// <returns>Number of addresses passed to callback</returns>
+    BLACKBONE_API size_t Search( 
+        uint8_t wildcard, 
+        void* scanStart, 
+        size_t scanSize, 
+        SearchCallback callback, 
+        void* context, 
+        ptr_t value_offset = 0 
+        ) const;
+
+    /// <summary>
+    /// Full pattern match, no wildcards.
+    /// Uses BoyerMooreHorspool algorithm.
+    /// </summary>
+    /// <param name="scanStart">Starting address</param>
+    /// <param name="scanSize">Size of region to scan</param>
+    /// <param name="callback">Called for every found address, returns false to stop search</param>
+    /// <param name="context">User context passed to callback</param>
+    /// <param name="value_offset">Value that will be added to resulting addresses</param>
+    /// <returns>Number of addresses passed to callback</returns>
+    BLACKBONE_API size_t Search( 
+        void* scanStart, 
+        size_t scanSize, 
+        SearchCallback callback, 
+        void* context, 
+        ptr_t value_offset = 0 
+        ) const;
+
+    /// <summary>
+    /// Find first pattern occurrence, wildcards allowed
+    /// </summary>
+    /// <param name="wildcard">Pattern wildcard</param>
+    /// <param name="scanStart">Starting address</param>
+    /// <param name="scanSize">Size of region to scan</param>
+    /// <param name="value_offset">Value that will be added to resulting address</param>
+    /// <returns>Found address, 0 if not found</returns>
+    BLACKBONE_API ptr_t SearchFirst( uint8_t wildcard, void* scanStart, size_t scanSize, ptr_t value_offset = 0 ) const;
+
+    /// <summary>
+    /// Find first pattern occurrence, no wildcards
+    /// </summary>
+    /// <param name="scanStart">Starting address</param>
+    /// <param name="scanSize">Size of region to scan</param>
+    /// <param name="value_offset">Value that will be added to resulting address</param>
+    /// <returns>Found address, 0 if not found</returns>
+    BLACKBONE_API ptr_t SearchFirst( void* scanStart, size_t scanSize, ptr_t value_offset = 0 ) const;
+
     /// <summary>
     /// Search pattern in remote process
     /// </summary>
@@ -87,22 +228,161 @@ public:
         ) const;
 
     /// <summary>
-    /// Search pattern in whole address space of remote process
+    /// Search pattern in whole address space of remote process.
+    /// If BlackBone driver is loaded and filter has no module or predicate constraints,
+    /// scan is performed in kernel and only match addresses are transferred.
     /// </summary>
     /// <param name="remote">Remote process</param>
     /// <param name="useWildcard">True if pattern contains wildcards</param>
     /// <param name="wildcard">Pattern wildcard</param>
     /// <param name="out">Found results</param>
+    /// <param name="threads">Number of scanning threads. 1 - scan sequentially, 0 - use all CPU cores</param>
+    /// <param name="filter">Scanned regions filter</param>
     /// <returns>Number of found addresses</returns>
     BLACKBONE_API size_t SearchRemoteWhole( 
         class Process& remote, 
         bool useWildcard, 
         uint8_t wildcard, 
-        std::vector<ptr_t>& out 
+        std::vector<ptr_t>& out,
+        uint32_t threads = 1,
+        const RegionFilter& filter = RegionFilter()
+        ) const;
+
+    /// <summary>
+    /// Search pattern in whole address space of remote process.
+    /// Scan stops as soon as callback returns false.
+    /// Kernel scan is used under the same conditions as in vector version.
+    /// </summary>
+    /// <param name="remote">Remote process</param>
+    /// <param name="useWildcard">True if pattern contains wildcards</param>
+    /// <param name="wildcard">Pattern wildcard</param>
+    /// <param name="callback">Called for every found address, returns false to stop search</param>
+    /// <param name="context">User context passed to callback</param>
+    /// <param name="filter">Scanned regions filter</param>
+    /// <returns>Number of addresses passed to callback</returns>
+    BLACKBONE_API size_t SearchRemoteWhole( 
+        class Process& remote, 
+        bool useWildcard, 
+        uint8_t wildcard, 
+        SearchCallback callback, 
+        void* context,
+        const RegionFilter& filter = RegionFilter()
+        ) const;
+
+    /// <summary>
+    /// Search pattern in sections of remote module.
+    /// Section headers are parsed with pe::PEImage, every matching section is read once.
+    /// </summary>
+    /// <param name="remote">Remote process</param>
+    /// <param name="module">Module to scan</param>
+    /// <param name="useWildcard">True if pattern contains wildcards</param>
+    /// <param name="wildcard">Pattern wildcard</param>
+    /// <param name="out">Found results</param>
+    /// <param name="characteristics">Section must have any of these IMAGE_SCN_* flags, 0 - any section</param>
+    /// <param name="sectionName">Scan only section with this name, empty - any name</param>
+    /// <returns>Number of found addresses</returns>
+    BLACKBONE_API size_t SearchModule( 
+        class Process& remote, 
+        const ModuleDataPtr& module, 
+        bool useWildcard, 
+        uint8_t wildcard, 
+        std::vector<ptr_t>& out,
+        DWORD characteristics = IMAGE_SCN_MEM_EXECUTE,
+        const std::string& sectionName = ""
+        ) const;
+
+    /// <summary>
+    /// Get raw pattern bytes
+    /// </summary>
+    /// <returns>Pattern bytes</returns>
+    BLACKBONE_API inline const std::vector<uint8_t>& pattern() const { return _pattern; }
+
+    /// <summary>
+    /// Get wildcard value pattern layout was precompiled for
+    /// </summary>
+    /// <returns>Pattern wildcard</returns>
+    BLACKBONE_API inline uint8_t wildcard() const { return _wildcard; }
+
+private:
+    /// <summary>
+    /// Search pattern in remote memory range reading it in fixed size chunks.
+    /// Last pattern size - 1 bytes of every chunk are carried over to the next one,
+    /// so matches crossing chunk boundary are not lost.
+    /// </summary>
+    /// <param name="remote">Remote process</param>
+    /// <param name="useWildcard">True if pattern contains wildcards</param>
+    /// <param name="wildcard">Pattern wildcard</param>
+    /// <param name="scanStart">Starting address</param>
+    /// <param name="scanSize">Size of region to scan</param>
+    /// <param name="buf">Scratch buffer, must hold chunkSize + pattern size - 1 bytes</param>
+    /// <param name="chunkSize">Number of bytes read at once</param>
+    /// <param name="callback">Called for every found address, returns false to stop search</param>
+    /// <param name="context">User context passed to callback</param>
+    /// <param name="stopped">Set to true if callback requested stop</param>
+    /// <returns>Number of addresses passed to callback</returns>
+    size_t SearchRemoteStream( 
+        class Process& remote, 
+        bool useWildcard, 
+        uint8_t wildcard, 
+        ptr_t scanStart, 
+        size_t scanSize, 
+        uint8_t* buf, 
+        size_t chunkSize, 
+        SearchCallback callback, 
+        void* context, 
+        bool& stopped 
+        ) const;
+
+    /// <summary>
+    /// Search pattern in committed regions of remote process using multiple threads.
+    /// Remote reads are prefetched into second per-thread buffer while current one is scanned.
+    /// </summary>
+    /// <param name="remote">Remote process</param>
+    /// <param name="useWildcard">True if pattern contains wildcards</param>
+    /// <param name="wildcard">Pattern wildcard</param>
+    /// <param name="out">Found results, sorted by address</param>
+    /// <param name="threads">Number of scanning threads</param>
+    /// <param name="filter">Scanned regions filter</param>
+    /// <returns>Number of found addresses</returns>
+    size_t SearchRemoteParallel( 
+        class Process& remote, 
+        bool useWildcard, 
+        uint8_t wildcard, 
+        std::vector<ptr_t>& out,
+        uint32_t threads,
+        const RegionFilter& filter
+        ) const;
+
+    /// <summary>
+    /// Search pattern in remote process using BlackBone driver
+    /// </summary>
+    /// <param name="remote">Remote process</param>
+    /// <param name="useWildcard">True if pattern contains wildcards</param>
+    /// <param name="wildcard">Pattern wildcard</param>
+    /// <param name="out">Found results, sorted by address</param>
+    /// <param name="threads">Number of concurrent kernel scans</param>
+    /// <param name="filter">Scanned regions filter</param>
+    /// <returns>Status code, STATUS_NOT_SUPPORTED if scan can't be done in kernel</returns>
+    NTSTATUS SearchDriver( 
+        class Process& remote, 
+        bool useWildcard, 
+        uint8_t wildcard, 
+        std::vector<ptr_t>& out,
+        uint32_t threads,
+        const RegionFilter& filter
         ) const;
 
+    /// <summary>
+    /// Precompute search tables
+    /// </summary>
+    void Compile();
+
 private:
-    std::vector<uint8_t> _pattern;      // Pattern to search
+    std::vector<uint8_t> _pattern;              // Pattern to search
+    std::array<size_t, 256> _skip;              // Boyer-Moore-Horspool bad character table
+    PatternLayout _layout;                      // Precompiled wildcard layout
+    uint8_t _wildcard = 0;                      // Wildcard _layout was built for
+    bool _hasLayout = false;                    // _layout is valid
 };
 
 }
\ No newline at end of file
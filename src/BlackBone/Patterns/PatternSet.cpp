@@ -0,0 +1,292 @@
+#include "PatternSet.h"
+#include "../Include/Macro.h"
+#include "../Include/Winheaders.h"
+#include "../Process/Process.h"
+
+#include <algorithm>
+#include <queue>
+
+namespace blackbone
+{
+
+// Max anchor length. Limits automaton size for long patterns
+constexpr size_t MaxAnchorLength = 16;
+
+/// <summary>
+/// Add pattern without wildcards
+/// </summary>
+/// <param name="pattern">Pattern bytes</param>
+/// <param name="resultOffset">Value added to every match address of this pattern</param>
+/// <returns>Pattern ID</returns>
+size_t PatternSet::Add( const std::vector<uint8_t>& pattern, ptr_t resultOffset /*= 0*/ )
+{
+    Entry entry;
+    entry.bytes = pattern;
+    entry.mask.assign( pattern.size(), 0xFF );
+    entry.anchor = 0;
+    entry.anchorLen = std::min( pattern.size(), MaxAnchorLength );
+    entry.resultOffset = resultOffset;
+
+    _patterns.emplace_back( std::move( entry ) );
+    _compiled = false;
+
+    return _patterns.size() - 1;
+}
+
+/// <summary>
+/// Add pattern with wildcards
+/// </summary>
+/// <param name="wildcard">Pattern wildcard</param>
+/// <param name="pattern">Pattern bytes</param>
+/// <param name="resultOffset">Value added to every match address of this pattern</param>
+/// <returns>Pattern ID</returns>
+size_t PatternSet::Add( uint8_t wildcard, const std::vector<uint8_t>& pattern, ptr_t resultOffset /*= 0*/ )
+{
+    Entry entry;
+    entry.bytes.resize( pattern.size() );
+    entry.mask.resize( pattern.size() );
+    entry.resultOffset = resultOffset;
+
+    // Pick longest literal run as automaton anchor
+    for (size_t i = 0, run = 0; i < pattern.size(); i++)
+    {
+        entry.mask[i] = pattern[i] != wildcard ? 0xFF : 0x00;
+        entry.bytes[i] = pattern[i] & entry.mask[i];
+
+        run = entry.mask[i] ? run + 1 : 0;
+        if (run > entry.anchorLen)
+        {
+            entry.anchorLen = run;
+            entry.anchor = i + 1 - run;
+        }
+    }
+
+    entry.anchorLen = std::min( entry.anchorLen, MaxAnchorLength );
+
+    _patterns.emplace_back( std::move( entry ) );
+    _compiled = false;
+
+    return _patterns.size() - 1;
+}
+
+/// <summary>
+/// Add pattern without wildcards
+/// </summary>
+/// <param name="pattern">Pattern</param>
+/// <param name="resultOffset">Value added to every match address of this pattern</param>
+/// <returns>Pattern ID</returns>
+size_t PatternSet::Add( const PatternSearch& pattern, ptr_t resultOffset /*= 0*/ )
+{
+    return Add( pattern.pattern(), resultOffset );
+}
+
+/// <summary>
+/// Build automaton. Called automatically by search routines if set was modified
+/// </summary>
+void PatternSet::Compile()
+{
+    _nodes.clear();
+    _nodes.emplace_back();
+    _nodes[0].next.fill( -1 );
+
+    // Build trie over anchors
+    for (size_t id = 0; id < _patterns.size(); id++)
+    {
+        const auto& entry = _patterns[id];
+        if (entry.anchorLen == 0)
+            continue;
+
+        int32_t state = 0;
+        for (size_t i = entry.anchor; i < entry.anchor + entry.anchorLen; i++)
+        {
+            uint8_t c = entry.bytes[i];
+            if (_nodes[state].next[c] == -1)
+            {
+                _nodes[state].next[c] = static_cast<int32_t>(_nodes.size());
+                _nodes.emplace_back();
+                _nodes.back().next.fill( -1 );
+            }
+
+            state = _nodes[state].next[c];
+        }
+
+        _nodes[state].output.emplace_back( static_cast<uint32_t>(id) );
+    }
+
+    // Compute failure links and convert trie into complete DFA
+    std::vector<int32_t> fail( _nodes.size(), 0 );
+    std::queue<int32_t> queue;
+
+    for (auto& next : _nodes[0].next)
+    {
+        if (next == -1)
+        {
+            next = 0;
+        }
+        else
+        {
+            fail[next] = 0;
+            queue.push( next );
+        }
+    }
+
+    while (!queue.empty())
+    {
+        int32_t state = queue.front();
+        queue.pop();
+
+        auto& out = _nodes[state].output;
+        const auto& failOut = _nodes[fail[state]].output;
+        out.insert( out.end(), failOut.begin(), failOut.end() );
+
+        for (size_t c = 0; c < 256; c++)
+        {
+            int32_t next = _nodes[state].next[c];
+            if (next == -1)
+            {
+                _nodes[state].next[c] = _nodes[fail[state]].next[c];
+            }
+            else
+            {
+                fail[next] = _nodes[fail[state]].next[c];
+                queue.push( next );
+            }
+        }
+    }
+
+    _compiled = true;
+}
+
+/// <summary>
+/// Verify full pattern at candidate position
+/// </summary>
+/// <param name="entry">Pattern</param>
+/// <param name="data">Candidate data</param>
+/// <returns>true if pattern matches</returns>
+bool PatternSet::Verify( const Entry& entry, const uint8_t* data ) const
+{
+    for (size_t i = 0; i < entry.bytes.size(); i++)
+    {
+        if ((data[i] & entry.mask[i]) != entry.bytes[i])
+            return false;
+    }
+
+    return true;
+}
+
+/// <summary>
+/// Search all patterns in local buffer in one pass.
+/// Matches of the same pattern are reported in ascending address order.
+/// </summary>
+/// <param name="scanStart">Starting address</param>
+/// <param name="scanSize">Size of region to scan</param>
+/// <param name="out">Found results</param>
+/// <param name="value_offset">Value that will be added to resulting addresses</param>
+/// <returns>Number of found matches</returns>
+size_t PatternSet::Search( const void* scanStart, size_t scanSize, std::vector<Match>& out, ptr_t value_offset /*= 0*/ )
+{
+    if (!_compiled)
+        Compile();
+
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(scanStart);
+    int32_t state = 0;
+
+    for (size_t i = 0; i < scanSize; i++)
+    {
+        state = _nodes[state].next[data[i]];
+
+        for (auto id : _nodes[state].output)
+        {
+            const auto& entry = _patterns[id];
+
+            // Anchor ends at 'i', restore pattern start
+            size_t prefix = entry.anchor + entry.anchorLen;
+            if (i + 1 < prefix)
+                continue;
+
+            size_t start = i + 1 - prefix;
+            if (start + entry.bytes.size() > scanSize || !Verify( entry, data + start ))
+                continue;
+
+            ptr_t address = value_offset != 0 ? REBASE( data + start, scanStart, value_offset ) : reinterpret_cast<ptr_t>(data + start);
+            out.emplace_back( Match{ id, address + entry.resultOffset } );
+        }
+    }
+
+    return out.size();
+}
+
+/// <summary>
+/// Search all patterns in remote process
+/// </summary>
+/// <param name="remote">Remote process</param>
+/// <param name="scanStart">Starting address</param>
+/// <param name="scanSize">Size of region to scan</param>
+/// <param name="out">Found results</param>
+/// <returns>Number of found matches</returns>
+size_t PatternSet::SearchRemote( Process& remote, ptr_t scanStart, size_t scanSize, std::vector<Match>& out )
+{
+    uint8_t *pBuffer = reinterpret_cast<uint8_t*>(VirtualAlloc( NULL, scanSize, MEM_COMMIT, PAGE_READWRITE ));
+
+    if (pBuffer && remote.memory().Read( scanStart, scanSize, pBuffer ) == STATUS_SUCCESS)
+        Search( pBuffer, scanSize, out, scanStart );
+
+    if (pBuffer)
+        VirtualFree( pBuffer, 0, MEM_RELEASE );
+
+    return out.size();
+}
+
+/// <summary>
+/// Search all patterns in whole address space of remote process
+/// </summary>
+/// <param name="remote">Remote process</param>
+/// <param name="out">Found results</param>
+/// <param name="filter">Scanned regions filter</param>
+/// <returns>Number of found matches</returns>
+size_t PatternSet::SearchRemoteWhole( Process& remote, std::vector<Match>& out, const RegionFilter& filter /*= RegionFilter()*/ )
+{
+    MEMORY_BASIC_INFORMATION64 mbi = { 0 };
+    size_t  bufsize = 1 * 1024 * 1024;  // 1 MB
+    uint8_t *buf = reinterpret_cast<uint8_t*>(VirtualAlloc( 0, bufsize, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE ));
+
+    out.clear();
+
+    auto native = remote.core().native();
+
+    const ptr_t maxAddr = filter.maxAddress != 0 ? std::min( filter.maxAddress, native->maxAddr() ) : native->maxAddr();
+
+    for (ptr_t memptr = std::max( native->minAddr(), filter.minAddress ); memptr < maxAddr; memptr = mbi.BaseAddress + mbi.RegionSize)
+    {
+        auto status = native->VirtualQueryExT( memptr, &mbi );
+
+        if (status == STATUS_INVALID_PARAMETER || status == STATUS_ACCESS_DENIED)
+            break;
+        else if (status != STATUS_SUCCESS)
+            continue;
+
+        // Filter regions
+        ptr_t start = memptr, size = 0;
+        if (!filter.Match( mbi, start, size ))
+            continue;
+
+        // Reallocate buffer
+        if (size > bufsize)
+        {
+            bufsize = static_cast<size_t>(size);
+            VirtualFree( buf, 0, MEM_RELEASE );
+            buf = reinterpret_cast<uint8_t*>(VirtualAlloc( 0, bufsize, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE ));
+        }
+
+        if (remote.memory().Read( start, static_cast<size_t>(size), buf ) != STATUS_SUCCESS)
+            continue;
+
+        Search( buf, static_cast<size_t>(size), out, start );
+    }
+
+    VirtualFree( buf, 0, MEM_RELEASE );
+
+    return out.size();
+}
+
+}
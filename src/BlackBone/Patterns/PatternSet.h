@@ -0,0 +1,136 @@
+#pragma once
+
+#include "../Include/Types.h"
+#include "PatternSearch.h"
+
+#include <vector>
+#include <array>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Multiple patterns compiled into single Aho-Corasick automaton.
+/// Automaton is built over the longest literal run of every pattern,
+/// wildcard bytes are verified only for anchor hits.
+/// </summary>
+class PatternSet
+{
+public:
+    /// <summary>
+    /// Single pattern match
+    /// </summary>
+    struct Match
+    {
+        size_t id;          // Pattern ID returned by Add
+        ptr_t address;      // Match address + pattern result offset
+    };
+
+public:
+    BLACKBONE_API PatternSet() = default;
+    BLACKBONE_API ~PatternSet() = default;
+
+    /// <summary>
+    /// Add pattern without wildcards
+    /// </summary>
+    /// <param name="pattern">Pattern bytes</param>
+    /// <param name="resultOffset">Value added to every match address of this pattern</param>
+    /// <returns>Pattern ID</returns>
+    BLACKBONE_API size_t Add( const std::vector<uint8_t>& pattern, ptr_t resultOffset = 0 );
+
+    /// <summary>
+    /// Add pattern with wildcards
+    /// </summary>
+    /// <param name="wildcard">Pattern wildcard</param>
+    /// <param name="pattern">Pattern bytes</param>
+    /// <param name="resultOffset">Value added to every match address of this pattern</param>
+    /// <returns>Pattern ID</returns>
+    BLACKBONE_API size_t Add( uint8_t wildcard, const std::vector<uint8_t>& pattern, ptr_t resultOffset = 0 );
+
+    /// <summary>
+    /// Add pattern without wildcards
+    /// </summary>
+    /// <param name="pattern">Pattern</param>
+    /// <param name="resultOffset">Value added to every match address of this pattern</param>
+    /// <returns>Pattern ID</returns>
+    BLACKBONE_API size_t Add( const PatternSearch& pattern, ptr_t resultOffset = 0 );
+
+    /// <summary>
+    /// Build automaton. Called automatically by search routines if set was modified
+    /// </summary>
+    BLACKBONE_API void Compile();
+
+    /// <summary>
+    /// Search all patterns in local buffer in one pass.
+    /// Matches of the same pattern are reported in ascending address order.
+    /// </summary>
+    /// <param name="scanStart">Starting address</param>
+    /// <param name="scanSize">Size of region to scan</param>
+    /// <param name="out">Found results</param>
+    /// <param name="value_offset">Value that will be added to resulting addresses</param>
+    /// <returns>Number of found matches</returns>
+    BLACKBONE_API size_t Search(
+        const void* scanStart,
+        size_t scanSize,
+        std::vector<Match>& out,
+        ptr_t value_offset = 0
+        );
+
+    /// <summary>
+    /// Search all patterns in remote process
+    /// </summary>
+    /// <param name="remote">Remote process</param>
+    /// <param name="scanStart">Starting address</param>
+    /// <param name="scanSize">Size of region to scan</param>
+    /// <param name="out">Found results</param>
+    /// <returns>Number of found matches</returns>
+    BLACKBONE_API size_t SearchRemote(
+        class Process& remote,
+        ptr_t scanStart,
+        size_t scanSize,
+        std::vector<Match>& out
+        );
+
+    /// <summary>
+    /// Search all patterns in whole address space of remote process
+    /// </summary>
+    /// <param name="remote">Remote process</param>
+    /// <param name="out">Found results</param>
+    /// <param name="filter">Scanned regions filter</param>
+    /// <returns>Number of found matches</returns>
+    BLACKBONE_API size_t SearchRemoteWhole( class Process& remote, std::vector<Match>& out, const RegionFilter& filter = RegionFilter() );
+
+    /// <summary>
+    /// Pattern count
+    /// </summary>
+    /// <returns>Number of added patterns</returns>
+    BLACKBONE_API inline size_t size() const { return _patterns.size(); }
+
+private:
+    struct Entry
+    {
+        std::vector<uint8_t> bytes;     // Pattern bytes, wildcards zeroed
+        std::vector<uint8_t> mask;      // 0xFF for significant byte, 0x00 for wildcard
+        size_t anchor = 0;              // Anchor offset inside pattern
+        size_t anchorLen = 0;           // Anchor length, 0 if pattern consists of wildcards only
+        ptr_t resultOffset = 0;         // Value added to match address
+    };
+
+    struct Node
+    {
+        std::array<int32_t, 256> next;  // Complete transition table
+        std::vector<uint32_t> output;   // Patterns whose anchor ends in this state
+    };
+
+    /// <summary>
+    /// Verify full pattern at candidate position
+    /// </summary>
+    bool Verify( const Entry& entry, const uint8_t* data ) const;
+
+private:
+    std::vector<Entry> _patterns;       // Added patterns
+    std::vector<Node> _nodes;           // Automaton states
+    bool _compiled = false;             // Automaton is up to date
+};
+
+}
@@ -0,0 +1,411 @@
+#pragma once
+
+#include "../Config.h"
+#include "../Include/Winheaders.h"
+#include "../Include/Types.h"
+#include "../Include/Macro.h"
+#include "PatternSearch.h"
+
+#include <array>
+#include <vector>
+#include <cstddef>
+#include <intrin.h>
+
+#if defined(USE64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BLACKBONE_SIG_SSE2
+#endif
+
+namespace blackbone
+{
+
+namespace detail
+{
+
+#ifdef BLACKBONE_SIGNATURE_LITERALS
+
+/// <summary>
+/// String literal usable as template argument
+/// </summary>
+template<size_t N>
+struct FixedString
+{
+    constexpr FixedString( const char( &str )[N] )
+    {
+        for (size_t i = 0; i < N; i++)
+            data[i] = str[i];
+    }
+
+    char data[N] = { };
+};
+
+#endif
+
+/// <summary>
+/// Not constexpr, reaching it during constant evaluation makes literal ill-formed
+/// </summary>
+inline void InvalidSignature() { }
+
+constexpr int HexDigit( char c )
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+
+    return -1;
+}
+
+#ifdef BLACKBONE_SIGNATURE_LITERALS
+
+/// <summary>
+/// Count space separated tokens
+/// </summary>
+template<size_t N>
+constexpr size_t SignatureLength( const FixedString<N>& str )
+{
+    size_t count = 0;
+    for (size_t i = 0; i + 1 < N; i++)
+        if (str.data[i] != ' ' && (i == 0 || str.data[i - 1] == ' '))
+            count++;
+
+    return count;
+}
+
+#endif
+
+/// <summary>
+/// How often byte occurs in x86/x64 code, higher is more common.
+/// Rough ranking, only used to choose anchor bytes
+/// </summary>
+constexpr int ByteFrequency( uint8_t value )
+{
+    switch (value)
+    {
+        case 0x00: return 100;
+        case 0xFF: return 90;
+        case 0xCC: return 85;
+        case 0x48: return 80;
+        case 0x8B: return 75;
+        case 0x89: return 70;
+        case 0x24: return 65;
+        case 0x0F: return 60;
+        case 0x4C: return 55;
+        case 0x44: return 55;
+        case 0xE8: return 50;
+        case 0x83: return 50;
+        case 0x01: return 45;
+        case 0x8D: return 45;
+        case 0x85: return 40;
+        case 0x74: return 40;
+        case 0x75: return 40;
+        case 0xC3: return 35;
+        case 0x90: return 35;
+        case 0x40: return 30;
+        case 0x08: return 30;
+        case 0x10: return 30;
+        case 0x20: return 30;
+        case 0x33: return 25;
+        case 0xC0: return 25;
+        case 0x41: return 25;
+        case 0x4D: return 20;
+        case 0x49: return 20;
+        case 0x80: return 20;
+        case 0x28: return 20;
+        case 0x30: return 20;
+        case 0x38: return 20;
+        case 0x18: return 20;
+        case 0xE9: return 15;
+        case 0xEB: return 15;
+        case 0x84: return 15;
+        case 0xC7: return 15;
+        case 0x02: return 10;
+        case 0x04: return 10;
+        default:   return 0;
+    }
+}
+
+}
+
+/// <summary>
+/// Signature known at compile time.
+/// Length, bytes, mask and anchor bytes are constants, so byte compare is fully unrolled
+/// and the two rarest significant bytes are used to filter candidates.
+/// Search semantics match PatternSearch: matches don't overlap, value_offset rebases results
+/// </summary>
+template<size_t Len>
+struct Signature
+{
+    static_assert(Len > 0, "Empty signature");
+
+    std::array<uint8_t, Len> bytes = { };   // Pattern bytes with wildcards zeroed
+    std::array<uint8_t, Len> mask = { };    // 0xFF for significant byte, 0x00 for wildcard
+    size_t anchor = 0;                      // Offset of the rarest significant byte
+    size_t anchor2 = 0;                     // Offset of the second rarest significant byte, equals anchor if there is only one
+    bool valid = false;                     // Signature has at least one significant byte
+
+    /// <summary>
+    /// Signature length
+    /// </summary>
+    static constexpr size_t size() { return Len; }
+
+    /// <summary>
+    /// Choose anchor bytes. Called once by signature builders
+    /// </summary>
+    constexpr void Finalize()
+    {
+        int best = 0x7FFFFFFF, second = 0x7FFFFFFF;
+        valid = false;
+
+        for (size_t i = 0; i < Len; i++)
+        {
+            if (mask[i] == 0)
+                continue;
+
+            int freq = detail::ByteFrequency( bytes[i] );
+            if (!valid)
+            {
+                anchor = anchor2 = i;
+                best = freq;
+                valid = true;
+            }
+            else if (freq < best)
+            {
+                anchor2 = anchor;
+                second = best;
+                anchor = i;
+                best = freq;
+            }
+            else if (anchor2 == anchor || freq < second)
+            {
+                anchor2 = i;
+                second = freq;
+            }
+        }
+    }
+
+    /// <summary>
+    /// Compare data against signature
+    /// </summary>
+    /// <param name="data">Data, must hold Len bytes</param>
+    /// <returns>true if data matches</returns>
+    inline bool Match( const uint8_t* data ) const
+    {
+        size_t i = 0;
+
+#ifdef BLACKBONE_SIG_SSE2
+        for (; i + 16 <= Len; i += 16)
+        {
+            __m128i d = _mm_loadu_si128( reinterpret_cast<const __m128i*>(data + i) );
+            __m128i p = _mm_loadu_si128( reinterpret_cast<const __m128i*>(bytes.data() + i) );
+            __m128i m = _mm_loadu_si128( reinterpret_cast<const __m128i*>(mask.data() + i) );
+
+            if (_mm_movemask_epi8( _mm_cmpeq_epi8( _mm_and_si128( d, m ), p ) ) != 0xFFFF)
+                return false;
+        }
+#endif
+
+        for (; i < Len; i++)
+            if ((data[i] & mask[i]) != bytes[i])
+                return false;
+
+        return true;
+    }
+
+    /// <summary>
+    /// Search signature in local buffer
+    /// </summary>
+    /// <param name="scanStart">Starting address</param>
+    /// <param name="scanSize">Size of region to scan</param>
+    /// <param name="callback">Called for every found address, returns false to stop search</param>
+    /// <param name="context">User context passed to callback</param>
+    /// <param name="value_offset">Value that will be added to resulting addresses</param>
+    /// <returns>Number of addresses passed to callback</returns>
+    size_t Search( const void* scanStart, size_t scanSize, SearchCallback callback, void* context, ptr_t value_offset = 0 ) const
+    {
+        auto data = reinterpret_cast<const uint8_t*>(scanStart);
+        size_t found = 0;
+
+        if (!valid || scanSize < Len)
+            return found;
+
+        auto report = [&]( size_t pos )
+        {
+            found++;
+            if (value_offset != 0)
+                return callback( REBASE( data + pos, scanStart, value_offset ), context );
+            else
+                return callback( reinterpret_cast<ptr_t>(data + pos), context );
+        };
+
+        const size_t high = anchor > anchor2 ? anchor : anchor2;
+        size_t pos = 0;
+
+#ifdef BLACKBONE_SIG_SSE2
+        const __m128i a1 = _mm_set1_epi8( static_cast<char>(bytes[anchor]) );
+        const __m128i a2 = _mm_set1_epi8( static_cast<char>(bytes[anchor2]) );
+
+        while (pos + high + 16 <= scanSize && pos + Len <= scanSize)
+        {
+            __m128i d1 = _mm_loadu_si128( reinterpret_cast<const __m128i*>(data + pos + anchor) );
+            __m128i d2 = _mm_loadu_si128( reinterpret_cast<const __m128i*>(data + pos + anchor2) );
+            uint32_t hits = static_cast<uint32_t>(_mm_movemask_epi8( _mm_and_si128( _mm_cmpeq_epi8( d1, a1 ), _mm_cmpeq_epi8( d2, a2 ) ) ));
+
+            size_t next = pos + 16;
+            for (; hits != 0; hits &= hits - 1)
+            {
+                unsigned long bit = 0;
+                _BitScanForward( &bit, hits );
+
+                size_t candidate = pos + bit;
+                if (candidate + Len <= scanSize && Match( data + candidate ))
+                {
+                    if (!report( candidate ))
+                        return found;
+
+                    next = candidate + Len;
+                    break;
+                }
+            }
+
+            pos = next;
+        }
+#endif
+
+        while (pos + Len <= scanSize)
+        {
+            if (data[pos + anchor] == bytes[anchor] && data[pos + anchor2] == bytes[anchor2] && Match( data + pos ))
+            {
+                if (!report( pos ))
+                    return found;
+
+                pos += Len;
+            }
+            else
+                pos++;
+        }
+
+        return found;
+    }
+
+    /// <summary>
+    /// Search signature in local buffer
+    /// </summary>
+    /// <param name="scanStart">Starting address</param>
+    /// <param name="scanSize">Size of region to scan</param>
+    /// <param name="out">Found results</param>
+    /// <param name="value_offset">Value that will be added to resulting addresses</param>
+    /// <returns>Number of found addresses</returns>
+    size_t Search( const void* scanStart, size_t scanSize, std::vector<ptr_t>& out, ptr_t value_offset = 0 ) const
+    {
+        Search( scanStart, scanSize, []( ptr_t address, void* context )
+        {
+            reinterpret_cast<std::vector<ptr_t>*>(context)->emplace_back( address );
+            return true;
+        }, &out, value_offset );
+
+        return out.size();
+    }
+
+    /// <summary>
+    /// Find first signature occurrence
+    /// </summary>
+    /// <param name="scanStart">Starting address</param>
+    /// <param name="scanSize">Size of region to scan</param>
+    /// <param name="value_offset">Value that will be added to resulting address</param>
+    /// <returns>Found address, 0 if not found</returns>
+    ptr_t SearchFirst( const void* scanStart, size_t scanSize, ptr_t value_offset = 0 ) const
+    {
+        ptr_t result = 0;
+        Search( scanStart, scanSize, []( ptr_t address, void* context )
+        {
+            *reinterpret_cast<ptr_t*>(context) = address;
+            return false;
+        }, &result, value_offset );
+
+        return result;
+    }
+
+    /// <summary>
+    /// Convert to run-time pattern, e.g. for remote and whole-process scans
+    /// </summary>
+    /// <param name="wildcard">Byte value used for wildcard positions, must not occur at significant positions</param>
+    /// <returns>Pattern precompiled for wildcard</returns>
+    PatternSearch ToPattern( uint8_t wildcard = 0xCC ) const
+    {
+        std::vector<uint8_t> pattern( Len );
+        for (size_t i = 0; i < Len; i++)
+            pattern[i] = mask[i] != 0 ? bytes[i] : wildcard;
+
+        return PatternSearch( pattern, wildcard );
+    }
+};
+
+#ifdef BLACKBONE_SIGNATURE_LITERALS
+
+/// <summary>
+/// Build signature from IDA-style string at compile time
+/// </summary>
+template<detail::FixedString Str>
+consteval auto MakeSignature()
+{
+    constexpr size_t len = detail::SignatureLength( Str );
+    Signature<len> sig;
+
+    size_t idx = 0;
+    for (size_t i = 0; i + 1 < sizeof( Str.data ); )
+    {
+        if (Str.data[i] == ' ')
+        {
+            i++;
+            continue;
+        }
+
+        size_t tokenEnd = i;
+        while (tokenEnd + 1 < sizeof( Str.data ) && Str.data[tokenEnd] != ' ')
+            tokenEnd++;
+
+        size_t tokenLen = tokenEnd - i;
+        if (Str.data[i] == '?' && (tokenLen == 1 || (tokenLen == 2 && Str.data[i + 1] == '?')))
+        {
+            sig.bytes[idx] = 0;
+            sig.mask[idx] = 0;
+        }
+        else if (tokenLen == 2 && detail::HexDigit( Str.data[i] ) >= 0 && detail::HexDigit( Str.data[i + 1] ) >= 0)
+        {
+            sig.bytes[idx] = static_cast<uint8_t>((detail::HexDigit( Str.data[i] ) << 4) | detail::HexDigit( Str.data[i + 1] ));
+            sig.mask[idx] = 0xFF;
+        }
+        else
+            detail::InvalidSignature();
+
+        idx++;
+        i = tokenEnd;
+    }
+
+    sig.Finalize();
+    if (!sig.valid)
+        detail::InvalidSignature();
+
+    return sig;
+}
+
+inline namespace literals
+{
+
+/// <summary>
+/// Compile-time signature literal, e.g. "48 8B 05 ?? ?? ?? ?? 48 85 C0"_sig.
+/// Malformed string or signature made of wildcards only fails to compile
+/// </summary>
+template<detail::FixedString Str>
+consteval auto operator""_sig()
+{
+    return MakeSignature<Str>();
+}
+
+}
+
+#endif
+
+}
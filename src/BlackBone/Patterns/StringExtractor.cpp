@@ -0,0 +1,433 @@
+#include "StringExtractor.h"
+#include "../Process/Process.h"
+
+#include "../../3rd_party/AsmJit/AsmJit.h"
+
+#include <algorithm>
+#include <future>
+#include <intrin.h>
+
+#ifdef COMPILER_GCC
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+
+namespace blackbone
+{
+
+namespace
+{
+
+constexpr size_t ChunkSize = 1 * 1024 * 1024;     // 1 MB
+
+/// <summary>
+/// Check if CPU and OS support AVX2
+/// </summary>
+/// <returns>true if AVX2 path can be used</returns>
+bool HasAVX2()
+{
+    static const bool avx2 = asmjit::X86CpuInfo::getHost()->hasFeature( asmjit::kX86CpuFeatureAVX2 );
+    return avx2;
+}
+
+/// <summary>
+/// Check if CPU supports SSE2
+/// </summary>
+/// <returns>true if SSE2 path can be used</returns>
+bool HasSSE2()
+{
+#ifdef USE64
+    return true;
+#else
+    static const bool sse2 = asmjit::X86CpuInfo::getHost()->hasFeature( asmjit::kX86CpuFeatureSSE2 );
+    return sse2;
+#endif
+}
+
+inline uint32_t LowestBit( uint32_t mask )
+{
+    unsigned long index = 0;
+    _BitScanForward( &index, mask );
+    return index;
+}
+
+/// <summary>
+/// Build ASCII and UTF-16 bitmaps of 32 byte block.
+/// UTF-16 character occupies two bits, so runs of both encodings are found the same way
+/// </summary>
+/// <param name="printable">Printable byte mask</param>
+/// <param name="zero">Zero byte mask</param>
+/// <param name="ascii">Printable ASCII bytes</param>
+/// <param name="wide">Printable UTF-16 characters</param>
+inline void Combine( uint32_t printable, uint32_t zero, uint32_t& ascii, uint32_t& wide )
+{
+    const uint32_t chars = printable & (zero >> 1) & 0x55555555;
+
+    ascii = printable;
+    wide = chars | (chars << 1);
+}
+
+/// <summary>
+/// Printable is 0x20 - 0x7E or tab. Range check is done as single signed compare of biased value
+/// </summary>
+TARGET_AVX2 size_t ClassifyAVX2( const uint8_t* data, size_t blocks, uint32_t* ascii, uint32_t* wide )
+{
+    const __m256i low = _mm256_set1_epi8( 0x20 );
+    const __m256i bias = _mm256_set1_epi8( static_cast<char>(0x80) );
+    const __m256i limit = _mm256_set1_epi8( static_cast<char>(0x5F ^ 0x80) );
+    const __m256i tab = _mm256_set1_epi8( 0x09 );
+    const __m256i zero = _mm256_setzero_si256();
+
+    for (size_t i = 0; i < blocks; i++)
+    {
+        __m256i d = _mm256_loadu_si256( reinterpret_cast<const __m256i*>(data + i * 32) );
+        __m256i s = _mm256_xor_si256( _mm256_sub_epi8( d, low ), bias );
+        __m256i p = _mm256_or_si256( _mm256_cmpgt_epi8( limit, s ), _mm256_cmpeq_epi8( d, tab ) );
+
+        Combine(
+            static_cast<uint32_t>(_mm256_movemask_epi8( p )),
+            static_cast<uint32_t>(_mm256_movemask_epi8( _mm256_cmpeq_epi8( d, zero ) )),
+            ascii[i], wide[i]
+            );
+    }
+
+    _mm256_zeroupper();
+    return blocks;
+}
+
+size_t ClassifySSE2( const uint8_t* data, size_t blocks, uint32_t* ascii, uint32_t* wide )
+{
+    const __m128i low = _mm_set1_epi8( 0x20 );
+    const __m128i bias = _mm_set1_epi8( static_cast<char>(0x80) );
+    const __m128i limit = _mm_set1_epi8( static_cast<char>(0x5F ^ 0x80) );
+    const __m128i tab = _mm_set1_epi8( 0x09 );
+    const __m128i zero = _mm_setzero_si128();
+
+    auto classify = [&]( const uint8_t* ptr, uint32_t& printable, uint32_t& zeroes )
+    {
+        __m128i d = _mm_loadu_si128( reinterpret_cast<const __m128i*>(ptr) );
+        __m128i s = _mm_xor_si128( _mm_sub_epi8( d, low ), bias );
+        __m128i p = _mm_or_si128( _mm_cmpgt_epi8( limit, s ), _mm_cmpeq_epi8( d, tab ) );
+
+        printable = static_cast<uint32_t>(_mm_movemask_epi8( p ));
+        zeroes = static_cast<uint32_t>(_mm_movemask_epi8( _mm_cmpeq_epi8( d, zero ) ));
+    };
+
+    for (size_t i = 0; i < blocks; i++)
+    {
+        uint32_t p1 = 0, z1 = 0, p2 = 0, z2 = 0;
+        classify( data + i * 32, p1, z1 );
+        classify( data + i * 32 + 16, p2, z2 );
+
+        Combine( p1 | (p2 << 16), z1 | (z2 << 16), ascii[i], wide[i] );
+    }
+
+    return blocks;
+}
+
+/// <summary>
+/// Classify chunk bytes
+/// </summary>
+/// <param name="data">Chunk data</param>
+/// <param name="size">Chunk size</param>
+/// <param name="ascii">Printable ASCII bitmap, (size + 31) / 32 words</param>
+/// <param name="wide">Printable UTF-16 bitmap, (size + 31) / 32 words</param>
+void Classify( const uint8_t* data, size_t size, uint32_t* ascii, uint32_t* wide )
+{
+    const size_t words = (size + 31) / 32;
+    size_t w = 0;
+
+    if (HasAVX2())
+        w = ClassifyAVX2( data, size / 32, ascii, wide );
+    else if (HasSSE2())
+        w = ClassifySSE2( data, size / 32, ascii, wide );
+
+    // Tail and CPUs without SSE2
+    for (; w < words; w++)
+    {
+        uint32_t printable = 0, zero = 0;
+        for (size_t i = 0; i < 32 && w * 32 + i < size; i++)
+        {
+            const uint8_t b = data[w * 32 + i];
+            if (static_cast<uint8_t>(b - 0x20) < 0x5F || b == 0x09)
+                printable |= 1u << i;
+            if (b == 0)
+                zero |= 1u << i;
+        }
+
+        Combine( printable, zero, ascii[w], wide[w] );
+    }
+}
+
+/// <summary>
+/// Find first bit with given value, whole words are skipped at once
+/// </summary>
+/// <param name="bits">Bitmap</param>
+/// <param name="pos">Starting bit</param>
+/// <param name="limit">Bitmap size in bits</param>
+/// <param name="set">Bit value to look for</param>
+/// <returns>Bit index or limit if not found</returns>
+inline size_t NextBit( const uint32_t* bits, size_t pos, size_t limit, bool set )
+{
+    while (pos < limit)
+    {
+        const size_t w = pos / 32;
+        uint32_t word = (set ? bits[w] : ~bits[w]) & (~0u << (pos % 32));
+        if (word != 0)
+            return std::min( w * 32 + LowestBit( word ), limit );
+
+        pos = (w + 1) * 32;
+    }
+
+    return limit;
+}
+
+bool CollectString( const FoundString& str, void* context )
+{
+    reinterpret_cast<std::vector<FoundString>*>(context)->emplace_back( str );
+    return true;
+}
+
+}
+
+StringExtractor::StringExtractor( const StringScanOptions& options /*= StringScanOptions()*/ )
+    : _options( options )
+{
+}
+
+/// <summary>
+/// Extract strings from all regions of remote process matching filter
+/// </summary>
+/// <param name="remote">Remote process</param>
+/// <param name="callback">Called for every found string, returns false to stop</param>
+/// <param name="context">User context passed to callback</param>
+/// <returns>Number of strings passed to callback</returns>
+size_t StringExtractor::Extract( Process& remote, StringCallback callback, void* context )
+{
+    struct Chunk
+    {
+        ptr_t address;  // Chunk address
+        size_t size;    // Chunk size
+        size_t region;  // Region index
+    };
+
+    auto& regionMap = remote.memory().regionMap();
+    if (!NT_SUCCESS( regionMap.Refresh() ))
+        return 0;
+
+    std::vector<Chunk> chunks;
+    size_t region = 0;
+
+    for (const auto& mbi : regionMap.regions())
+    {
+        if (mbi.Protect & PAGE_GUARD)
+            continue;
+
+        ptr_t start = mbi.BaseAddress, size = 0;
+        if (!_options.filter.Match( mbi, start, size ))
+            continue;
+
+        for (ptr_t offset = 0; offset < size; offset += ChunkSize)
+            chunks.push_back( { start + offset, static_cast<size_t>(std::min<ptr_t>( ChunkSize, size - offset )), region } );
+
+        region++;
+    }
+
+    State state;
+    state.callback = callback;
+    state.context = context;
+
+    if (chunks.empty())
+        return 0;
+
+    std::vector<uint8_t> buffers[2] = { std::vector<uint8_t>( ChunkSize ), std::vector<uint8_t>( ChunkSize ) };
+    auto read = [&]( size_t idx, std::vector<uint8_t>& buf )
+    {
+        return remote.memory().Read( chunks[idx].address, chunks[idx].size, buf.data() );
+    };
+
+    int current = 0;
+    NTSTATUS status = read( 0, buffers[current] );
+
+    for (size_t idx = 0; idx < chunks.size() && !state.stopped; idx++)
+    {
+        // Next chunk is read while current one is scanned
+        std::future<NTSTATUS> prefetch;
+        if (idx + 1 < chunks.size())
+            prefetch = std::async( std::launch::async, read, idx + 1, std::ref( buffers[current ^ 1] ) );
+
+        // Unreadable chunk breaks continuity
+        if (NT_SUCCESS( status ))
+            ScanChunk( buffers[current].data(), chunks[idx].size, chunks[idx].address, state );
+        else
+            Flush( state );
+
+        // Strings don't span regions
+        if (idx + 1 == chunks.size() || chunks[idx + 1].region != chunks[idx].region)
+            Flush( state );
+
+        status = prefetch.valid() ? prefetch.get() : STATUS_NO_MORE_ENTRIES;
+        current ^= 1;
+    }
+
+    return state.found;
+}
+
+/// <summary>
+/// Extract strings from all regions of remote process matching filter
+/// </summary>
+/// <param name="remote">Remote process</param>
+/// <param name="out">Found strings, ascending by address for each encoding</param>
+/// <returns>Number of found strings</returns>
+size_t StringExtractor::Extract( Process& remote, std::vector<FoundString>& out )
+{
+    out.clear();
+    return Extract( remote, &CollectString, &out );
+}
+
+/// <summary>
+/// Extract strings from local buffer. Region filter is not applied
+/// </summary>
+/// <param name="data">Buffer</param>
+/// <param name="size">Buffer size</param>
+/// <param name="base">Address reported for first buffer byte, must be even for UTF-16 strings to be aligned</param>
+/// <param name="callback">Called for every found string, returns false to stop</param>
+/// <param name="context">User context passed to callback</param>
+/// <returns>Number of strings passed to callback</returns>
+size_t StringExtractor::Extract( const void* data, size_t size, ptr_t base, StringCallback callback, void* context )
+{
+    State state;
+    state.callback = callback;
+    state.context = context;
+
+    auto pData = reinterpret_cast<const uint8_t*>(data);
+    for (size_t offset = 0; offset < size && !state.stopped; offset += ChunkSize)
+        ScanChunk( pData + offset, std::min( ChunkSize, size - offset ), base + offset, state );
+
+    Flush( state );
+    return state.found;
+}
+
+/// <summary>
+/// Process chunk of contiguous data
+/// </summary>
+/// <param name="data">Chunk data</param>
+/// <param name="size">Chunk size</param>
+/// <param name="base">Chunk address</param>
+/// <param name="state">Stream state, runs left open are continued by next chunk</param>
+void StringExtractor::ScanChunk( const uint8_t* data, size_t size, ptr_t base, State& state ) const
+{
+    const size_t words = (size + 31) / 32;
+    for (auto& bitmap : state.bitmaps)
+    {
+        if (bitmap.size() < words)
+            bitmap.resize( words );
+    }
+
+    Classify( data, size, state.bitmaps[0].data(), state.bitmaps[1].data() );
+
+    for (size_t e = 0; e < 2 && !state.stopped; e++)
+    {
+        const StringEncoding encoding = e == 0 ? StringAscii : StringUtf16;
+        if (!(_options.encodings & encoding))
+            continue;
+
+        const size_t step = e == 0 ? 1 : 2;
+        const uint32_t* bits = state.bitmaps[e].data();
+        auto& run = state.runs[e];
+
+        auto append = [&]( size_t from, size_t to )
+        {
+            for (size_t i = from; i < to && run.text.size() < _options.maxLength; i += step)
+                run.text.push_back( static_cast<char>(data[i]) );
+
+            run.length += (to - from) / step;
+        };
+
+        auto begin = [&]( size_t start, size_t end )
+        {
+            run.address = base + start;
+            run.length = 0;
+            run.text.clear();
+            append( start, end );
+        };
+
+        size_t pos = 0;
+
+        // Continue run left open by previous chunk
+        if (run.open)
+        {
+            const size_t end = NextBit( bits, 0, size, false );
+            append( 0, end );
+            if (end == size)
+                continue;
+
+            Report( run, encoding, state );
+            pos = end;
+        }
+
+        while (pos < size && !state.stopped)
+        {
+            const size_t start = NextBit( bits, pos, size, true );
+            if (start >= size)
+                break;
+
+            const size_t end = NextBit( bits, start, size, false );
+
+            // Run may continue in next chunk
+            if (end == size)
+            {
+                begin( start, end );
+                run.open = true;
+                break;
+            }
+
+            if ((end - start) / step >= _options.minLength)
+            {
+                begin( start, end );
+                Report( run, encoding, state );
+            }
+
+            pos = end;
+        }
+    }
+}
+
+/// <summary>
+/// Report open runs and close them
+/// </summary>
+/// <param name="state">Stream state</param>
+void StringExtractor::Flush( State& state ) const
+{
+    for (size_t e = 0; e < 2; e++)
+    {
+        if (state.runs[e].open)
+            Report( state.runs[e], e == 0 ? StringAscii : StringUtf16, state );
+    }
+}
+
+/// <summary>
+/// Report run if it's long enough
+/// </summary>
+/// <param name="run">Finished run</param>
+/// <param name="encoding">Run encoding</param>
+/// <param name="state">Stream state</param>
+void StringExtractor::Report( Run& run, StringEncoding encoding, State& state ) const
+{
+    run.open = false;
+    if (run.length < _options.minLength || state.stopped)
+        return;
+
+    FoundString str;
+    str.address = run.address;
+    str.encoding = encoding;
+    str.length = run.length;
+    str.text.swap( run.text );
+
+    state.found++;
+    if (!state.callback( str, state.context ))
+        state.stopped = true;
+}
+
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include "../Include/Winheaders.h"
+#include "../Include/Types.h"
+#include "PatternSearch.h"
+
+#include <string>
+#include <vector>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Extracted string encodings
+/// </summary>
+enum StringEncoding
+{
+    StringAscii = 0x1,      // Printable ASCII bytes
+    StringUtf16 = 0x2,      // UTF-16LE characters in printable ASCII range, at even addresses
+    StringAny   = StringAscii | StringUtf16,
+};
+
+/// <summary>
+/// Found string
+/// </summary>
+struct FoundString
+{
+    ptr_t address = 0;                      // String address
+    StringEncoding encoding = StringAscii;  // String encoding
+    size_t length = 0;                      // Length in characters
+    std::string text;                       // Characters, UTF-16 ones narrowed. Truncated to StringScanOptions::maxLength
+};
+
+/// <summary>
+/// String callback
+/// </summary>
+/// <param name="str">Found string</param>
+/// <param name="context">User context</param>
+/// <returns>true to continue extraction, false to stop</returns>
+using StringCallback = bool( *)(const FoundString& str, void* context);
+
+/// <summary>
+/// Extraction options
+/// </summary>
+struct StringScanOptions
+{
+    size_t minLength = 4;                   // Shorter runs are ignored
+    size_t maxLength = 0x1000;              // Reported text is truncated to this number of characters, full length is kept
+    uint32_t encodings = StringAny;         // StringEncoding flags
+    RegionFilter filter;                    // Scanned regions, e.g. type = MEM_IMAGE or MEM_PRIVATE
+};
+
+/// <summary>
+/// Printable string extractor, same as 'strings' utility.
+/// Regions are streamed through fixed size buffer, bytes are classified by AVX2 or SSE2 if supported by CPU
+/// and runs are found on resulting bitmaps, so data without printable characters is skipped a word at a time.
+/// Strings spanning two chunks of one region are reported once.
+/// </summary>
+class StringExtractor
+{
+public:
+    BLACKBONE_API StringExtractor( const StringScanOptions& options = StringScanOptions() );
+    BLACKBONE_API ~StringExtractor() = default;
+
+    /// <summary>
+    /// Extract strings from all regions of remote process matching filter
+    /// </summary>
+    /// <param name="remote">Remote process</param>
+    /// <param name="callback">Called for every found string, returns false to stop</param>
+    /// <param name="context">User context passed to callback</param>
+    /// <returns>Number of strings passed to callback</returns>
+    BLACKBONE_API size_t Extract( class Process& remote, StringCallback callback, void* context );
+
+    /// <summary>
+    /// Extract strings from all regions of remote process matching filter
+    /// </summary>
+    /// <param name="remote">Remote process</param>
+    /// <param name="out">Found strings, ascending by address for each encoding</param>
+    /// <returns>Number of found strings</returns>
+    BLACKBONE_API size_t Extract( class Process& remote, std::vector<FoundString>& out );
+
+    /// <summary>
+    /// Extract strings from local buffer. Region filter is not applied
+    /// </summary>
+    /// <param name="data">Buffer</param>
+    /// <param name="size">Buffer size</param>
+    /// <param name="base">Address reported for first buffer byte, must be even for UTF-16 strings to be aligned</param>
+    /// <param name="callback">Called for every found string, returns false to stop</param>
+    /// <param name="context">User context passed to callback</param>
+    /// <returns>Number of strings passed to callback</returns>
+    BLACKBONE_API size_t Extract( const void* data, size_t size, ptr_t base, StringCallback callback, void* context );
+
+    BLACKBONE_API inline const StringScanOptions& options() const { return _options; }
+
+private:
+    /// <summary>
+    /// Run of printable characters that may continue in next chunk
+    /// </summary>
+    struct Run
+    {
+        bool open = false;      // Run reaches end of last chunk
+        ptr_t address = 0;      // Run start
+        size_t length = 0;      // Characters so far
+        std::string text;       // Characters so far, up to max length
+    };
+
+    /// <summary>
+    /// Stream state
+    /// </summary>
+    struct State
+    {
+        StringCallback callback = nullptr;
+        void* context = nullptr;
+        size_t found = 0;
+        bool stopped = false;
+        Run runs[2];                        // ASCII and UTF-16 runs
+        std::vector<uint32_t> bitmaps[2];   // Printable ASCII bytes and UTF-16 characters
+    };
+
+    /// <summary>
+    /// Process chunk of contiguous data
+    /// </summary>
+    /// <param name="data">Chunk data</param>
+    /// <param name="size">Chunk size</param>
+    /// <param name="base">Chunk address</param>
+    /// <param name="state">Stream state, runs left open are continued by next chunk</param>
+    void ScanChunk( const uint8_t* data, size_t size, ptr_t base, State& state ) const;
+
+    /// <summary>
+    /// Report open runs and close them
+    /// </summary>
+    /// <param name="state">Stream state</param>
+    void Flush( State& state ) const;
+
+    /// <summary>
+    /// Report run if it's long enough
+    /// </summary>
+    /// <param name="run">Finished run</param>
+    /// <param name="encoding">Run encoding</param>
+    /// <param name="state">Stream state</param>
+    void Report( Run& run, StringEncoding encoding, State& state ) const;
+
+private:
+    StringScanOptions _options;
+};
+
+}
@@ -0,0 +1,548 @@
+#include "ValueScanner.h"
+#include "../Process/Process.h"
+
+#include "../../3rd_party/AsmJit/AsmJit.h"
+
+#include <algorithm>
+#include <type_traits>
+#include <intrin.h>
+
+namespace blackbone
+{
+
+namespace
+{
+
+constexpr size_t PageSize = 0x1000;
+constexpr size_t BatchBytes = 16 * 1024 * 1024;    // Max size of pages read at once
+
+/// <summary>
+/// Check if CPU supports SSE2
+/// </summary>
+/// <returns>true if SSE2 path can be used</returns>
+bool HasSSE2()
+{
+#ifdef USE64
+    return true;
+#else
+    static const bool sse2 = asmjit::X86CpuInfo::getHost()->hasFeature( asmjit::kX86CpuFeatureSSE2 );
+    return sse2;
+#endif
+}
+
+inline uint32_t LowestBit64( uint64_t mask )
+{
+    unsigned long index = 0;
+    if (static_cast<uint32_t>(mask) != 0)
+    {
+        _BitScanForward( &index, static_cast<uint32_t>(mask) );
+        return index;
+    }
+
+    _BitScanForward( &index, static_cast<uint32_t>(mask >> 32) );
+    return index + 32;
+}
+
+inline size_t BitCount64( uint64_t v )
+{
+    v = v - ((v >> 1) & 0x5555555555555555ull);
+    v = (v & 0x3333333333333333ull) + ((v >> 2) & 0x3333333333333333ull);
+    v = (v + (v >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+    return static_cast<size_t>((v * 0x0101010101010101ull) >> 56);
+}
+
+template<typename T>
+inline T Convert( const ScanValue& value )
+{
+    if constexpr (std::is_floating_point_v<T>)
+        return static_cast<T>(value.real);
+    else
+        return static_cast<T>(value.integer);
+}
+
+/// <summary>
+/// SSE2 compares, lane masks are returned as movemask bits. No 64 bit integer compares in SSE2
+/// </summary>
+template<typename T>
+struct Sse
+{
+    static constexpr size_t lanes = 0;
+};
+
+template<>
+struct Sse<int32_t>
+{
+    using V = __m128i;
+    static constexpr size_t lanes = 4;
+    static constexpr uint32_t full = 0xF;
+
+    static V load( const int32_t* p ) { return _mm_loadu_si128( reinterpret_cast<const __m128i*>(p) ); }
+    static V set1( int32_t v ) { return _mm_set1_epi32( v ); }
+    static uint32_t eq( V l, V r ) { return _mm_movemask_ps( _mm_castsi128_ps( _mm_cmpeq_epi32( l, r ) ) ); }
+    static uint32_t gt( V l, V r ) { return _mm_movemask_ps( _mm_castsi128_ps( _mm_cmpgt_epi32( l, r ) ) ); }
+    static uint32_t lt( V l, V r ) { return _mm_movemask_ps( _mm_castsi128_ps( _mm_cmplt_epi32( l, r ) ) ); }
+    static uint32_t ge( V l, V r ) { return ~lt( l, r ) & full; }
+    static uint32_t le( V l, V r ) { return ~gt( l, r ) & full; }
+};
+
+template<>
+struct Sse<float>
+{
+    using V = __m128;
+    static constexpr size_t lanes = 4;
+    static constexpr uint32_t full = 0xF;
+
+    static V load( const float* p ) { return _mm_loadu_ps( p ); }
+    static V set1( float v ) { return _mm_set1_ps( v ); }
+    static uint32_t eq( V l, V r ) { return _mm_movemask_ps( _mm_cmpeq_ps( l, r ) ); }
+    static uint32_t gt( V l, V r ) { return _mm_movemask_ps( _mm_cmpgt_ps( l, r ) ); }
+    static uint32_t lt( V l, V r ) { return _mm_movemask_ps( _mm_cmplt_ps( l, r ) ); }
+    static uint32_t ge( V l, V r ) { return _mm_movemask_ps( _mm_cmpge_ps( l, r ) ); }
+    static uint32_t le( V l, V r ) { return _mm_movemask_ps( _mm_cmple_ps( l, r ) ); }
+};
+
+template<>
+struct Sse<double>
+{
+    using V = __m128d;
+    static constexpr size_t lanes = 2;
+    static constexpr uint32_t full = 0x3;
+
+    static V load( const double* p ) { return _mm_loadu_pd( p ); }
+    static V set1( double v ) { return _mm_set1_pd( v ); }
+    static uint32_t eq( V l, V r ) { return _mm_movemask_pd( _mm_cmpeq_pd( l, r ) ); }
+    static uint32_t gt( V l, V r ) { return _mm_movemask_pd( _mm_cmpgt_pd( l, r ) ); }
+    static uint32_t lt( V l, V r ) { return _mm_movemask_pd( _mm_cmplt_pd( l, r ) ); }
+    static uint32_t ge( V l, V r ) { return _mm_movemask_pd( _mm_cmpge_pd( l, r ) ); }
+    static uint32_t le( V l, V r ) { return _mm_movemask_pd( _mm_cmple_pd( l, r ) ); }
+};
+
+template<typename T, ScanCompare C>
+inline bool Match( T cur, T prev, T a, T b )
+{
+    if constexpr (C == ScanCompare::Equal)
+        return cur == a;
+    else if constexpr (C == ScanCompare::Range)
+        return cur >= a && cur <= b;
+    else if constexpr (C == ScanCompare::Changed)
+        return !(cur == prev);
+    else if constexpr (C == ScanCompare::Unchanged)
+        return cur == prev;
+    else if constexpr (C == ScanCompare::Increased)
+        return cur > prev;
+    else if constexpr (C == ScanCompare::Decreased)
+        return cur < prev;
+    else
+        return true;
+}
+
+/// <summary>
+/// Narrow candidates of one page. Words without candidates are skipped
+/// </summary>
+/// <param name="cur">Current page contents</param>
+/// <param name="prev">Previous page contents, may be null if comparison doesn't use them</param>
+/// <param name="a">Value or lower range bound</param>
+/// <param name="b">Upper range bound</param>
+/// <param name="bitmap">Page candidate bits</param>
+template<typename T, ScanCompare C>
+void ComparePage( const T* cur, const T* prev, T a, T b, uint64_t* bitmap )
+{
+    constexpr size_t words = PageSize / sizeof( T ) / 64;
+
+    if constexpr (Sse<T>::lanes != 0)
+    {
+        if (HasSSE2())
+        {
+            using S = Sse<T>;
+            const auto va = S::set1( a );
+            const auto vb = S::set1( b );
+
+            for (size_t w = 0; w < words; w++)
+            {
+                if (bitmap[w] == 0)
+                    continue;
+
+                uint64_t bits = 0;
+                for (size_t i = 0; i < 64; i += S::lanes)
+                {
+                    const size_t slot = w * 64 + i;
+                    auto vc = S::load( cur + slot );
+                    uint32_t mask = 0;
+
+                    if constexpr (C == ScanCompare::Equal)
+                        mask = S::eq( vc, va );
+                    else if constexpr (C == ScanCompare::Range)
+                        mask = S::ge( vc, va ) & S::le( vc, vb );
+                    else if constexpr (C == ScanCompare::Changed)
+                        mask = ~S::eq( vc, S::load( prev + slot ) ) & S::full;
+                    else if constexpr (C == ScanCompare::Unchanged)
+                        mask = S::eq( vc, S::load( prev + slot ) );
+                    else if constexpr (C == ScanCompare::Increased)
+                        mask = S::gt( vc, S::load( prev + slot ) );
+                    else if constexpr (C == ScanCompare::Decreased)
+                        mask = S::lt( vc, S::load( prev + slot ) );
+                    else
+                        mask = S::full;
+
+                    bits |= static_cast<uint64_t>(mask) << i;
+                }
+
+                bitmap[w] &= bits;
+            }
+
+            return;
+        }
+    }
+
+    // Scalar path visits remaining candidates only
+    for (size_t w = 0; w < words; w++)
+    {
+        for (uint64_t mask = bitmap[w]; mask != 0; mask &= mask - 1)
+        {
+            const uint32_t bit = LowestBit64( mask );
+            const size_t slot = w * 64 + bit;
+            if (!Match<T, C>( cur[slot], prev ? prev[slot] : T(), a, b ))
+                bitmap[w] &= ~(1ull << bit);
+        }
+    }
+}
+
+template<typename T>
+void ComparePage( ScanCompare compare, const uint8_t* cur, const uint8_t* prev, const ScanValue& a, const ScanValue& b, uint64_t* bitmap )
+{
+    auto pCur = reinterpret_cast<const T*>(cur);
+    auto pPrev = reinterpret_cast<const T*>(prev);
+    const T va = Convert<T>( a ), vb = Convert<T>( b );
+
+    switch (compare)
+    {
+        case ScanCompare::Equal:
+            ComparePage<T, ScanCompare::Equal>( pCur, pPrev, va, vb, bitmap );
+            break;
+        case ScanCompare::Range:
+            ComparePage<T, ScanCompare::Range>( pCur, pPrev, va, vb, bitmap );
+            break;
+        case ScanCompare::Changed:
+            ComparePage<T, ScanCompare::Changed>( pCur, pPrev, va, vb, bitmap );
+            break;
+        case ScanCompare::Unchanged:
+            ComparePage<T, ScanCompare::Unchanged>( pCur, pPrev, va, vb, bitmap );
+            break;
+        case ScanCompare::Increased:
+            ComparePage<T, ScanCompare::Increased>( pCur, pPrev, va, vb, bitmap );
+            break;
+        case ScanCompare::Decreased:
+            ComparePage<T, ScanCompare::Decreased>( pCur, pPrev, va, vb, bitmap );
+            break;
+        default:
+            break;
+    }
+}
+
+void ComparePage( ScanValueType type, ScanCompare compare, const uint8_t* cur, const uint8_t* prev, const ScanValue& a, const ScanValue& b, uint64_t* bitmap )
+{
+    switch (type)
+    {
+        case ScanValueType::Int32:
+            ComparePage<int32_t>( compare, cur, prev, a, b, bitmap );
+            break;
+        case ScanValueType::Int64:
+            ComparePage<int64_t>( compare, cur, prev, a, b, bitmap );
+            break;
+        case ScanValueType::Float:
+            ComparePage<float>( compare, cur, prev, a, b, bitmap );
+            break;
+        case ScanValueType::Double:
+            ComparePage<double>( compare, cur, prev, a, b, bitmap );
+            break;
+    }
+}
+
+}
+
+ValueScanner::ValueScanner( Process& process, ScanValueType type )
+    : _process( process )
+    , _type( type )
+{
+}
+
+/// <summary>
+/// Scan all regions matching filter, previous results are dropped
+/// </summary>
+/// <param name="compare">Value comparison, Unknown, Equal or Range</param>
+/// <param name="a">Value or lower range bound</param>
+/// <param name="b">Upper range bound</param>
+/// <param name="filter">Scanned regions filter</param>
+/// <returns>Status code</returns>
+NTSTATUS ValueScanner::FirstScan(
+    ScanCompare compare,
+    ScanValue a /*= ScanValue()*/,
+    ScanValue b /*= ScanValue()*/,
+    const RegionFilter& filter /*= RegionFilter()*/
+    )
+{
+    if (compare != ScanCompare::Unknown && compare != ScanCompare::Equal && compare != ScanCompare::Range)
+        return STATUS_INVALID_PARAMETER;
+
+    Reset();
+
+    auto& regionMap = _process.memory().regionMap();
+    NTSTATUS status = regionMap.Refresh();
+    if (!NT_SUCCESS( status ))
+        return status;
+
+    const size_t words = PageSize / slotSize() / 64;
+
+    for (const auto& mbi : regionMap.regions())
+    {
+        if (mbi.Protect & PAGE_GUARD)
+            continue;
+
+        ptr_t start = mbi.BaseAddress, size = 0;
+        if (!filter.Match( mbi, start, size ))
+            continue;
+
+        ptr_t end = (start + size) & ~static_cast<ptr_t>(PageSize - 1);
+        start = (start + PageSize - 1) & ~static_cast<ptr_t>(PageSize - 1);
+        if (end <= start)
+            continue;
+
+        Region region;
+        region.base = start;
+        region.size = static_cast<size_t>(end - start);
+        region.bitmap.assign( region.size / PageSize * words, ~0ull );
+        region.pages.resize( region.size / PageSize );
+        for (size_t i = 0; i < region.pages.size(); i++)
+            region.pages[i] = static_cast<uint32_t>(i);
+
+        _regions.emplace_back( std::move( region ) );
+    }
+
+    std::vector<Region*> regions;
+    for (auto& region : _regions)
+        regions.emplace_back( &region );
+
+    ScanRegions( regions, compare, a, b, true );
+
+    _regions.erase(
+        std::remove_if( _regions.begin(), _regions.end(), []( const Region& region ) { return region.pages.empty(); } ),
+        _regions.end()
+        );
+
+    _scanned = true;
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Narrow candidates found by previous scans
+/// </summary>
+/// <param name="compare">Value comparison, anything except Unknown</param>
+/// <param name="a">Value or lower range bound</param>
+/// <param name="b">Upper range bound</param>
+/// <returns>Status code, STATUS_INVALID_DEVICE_STATE if there was no first scan</returns>
+NTSTATUS ValueScanner::NextScan( ScanCompare compare, ScanValue a /*= ScanValue()*/, ScanValue b /*= ScanValue()*/ )
+{
+    if (!_scanned)
+        return STATUS_INVALID_DEVICE_STATE;
+
+    if (compare == ScanCompare::Unknown)
+        return STATUS_INVALID_PARAMETER;
+
+    _bytesRead = 0;
+
+    std::vector<Region*> regions;
+    for (auto& region : _regions)
+        regions.emplace_back( &region );
+
+    ScanRegions( regions, compare, a, b, false );
+
+    _regions.erase(
+        std::remove_if( _regions.begin(), _regions.end(), []( const Region& region ) { return region.pages.empty(); } ),
+        _regions.end()
+        );
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Get number of candidates
+/// </summary>
+/// <returns>Candidate count</returns>
+size_t ValueScanner::count() const
+{
+    const size_t words = PageSize / slotSize() / 64;
+    size_t found = 0;
+
+    for (const auto& region : _regions)
+        for (auto page : region.pages)
+            for (size_t w = 0; w < words; w++)
+                found += BitCount64( region.bitmap[page * words + w] );
+
+    return found;
+}
+
+/// <summary>
+/// Get candidate addresses
+/// </summary>
+/// <param name="max">Max number of addresses, 0 - all</param>
+/// <returns>Addresses in ascending order</returns>
+std::vector<ptr_t> ValueScanner::results( size_t max /*= 0*/ ) const
+{
+    const size_t slot = slotSize();
+    const size_t words = PageSize / slot / 64;
+    std::vector<ptr_t> out;
+
+    for (const auto& region : _regions)
+    {
+        for (auto page : region.pages)
+        {
+            for (size_t w = page * words; w < (page + 1) * words; w++)
+            {
+                for (uint64_t mask = region.bitmap[w]; mask != 0; mask &= mask - 1)
+                {
+                    if (max != 0 && out.size() >= max)
+                        return out;
+
+                    out.emplace_back( region.base + (w * 64 + LowestBit64( mask )) * slot );
+                }
+            }
+        }
+    }
+
+    return out;
+}
+
+/// <summary>
+/// Drop all candidates
+/// </summary>
+void ValueScanner::Reset()
+{
+    _regions.clear();
+    _scanned = false;
+    _bytesRead = 0;
+}
+
+/// <summary>
+/// Read pages of listed regions and compare them
+/// </summary>
+/// <param name="regions">Regions to update, pages list of every region is scanned</param>
+/// <param name="compare">Value comparison</param>
+/// <param name="a">Value or lower range bound</param>
+/// <param name="b">Upper range bound</param>
+/// <param name="first">No previous values are available</param>
+void ValueScanner::ScanRegions(
+    const std::vector<Region*>& regions,
+    ScanCompare compare,
+    const ScanValue& a,
+    const ScanValue& b,
+    bool first
+    )
+{
+    // Part of region pages list placed in batch buffer
+    struct Chunk
+    {
+        size_t region;
+        size_t from;
+        size_t to;
+        size_t offset;
+    };
+
+    const size_t words = PageSize / slotSize() / 64;
+
+    std::vector<std::vector<uint32_t>> keptPages( regions.size() );
+    std::vector<std::vector<uint8_t>> keptValues( regions.size() );
+
+    size_t total = 0;
+    for (auto region : regions)
+        total += region->pages.size() * PageSize;
+
+    std::vector<uint8_t> buffer( std::min( total, BatchBytes ) );
+
+    for (size_t ri = 0, pi = 0; ri < regions.size() && !buffer.empty();)
+    {
+        // Pages of several regions go to one batch, contiguous pages form single range
+        std::vector<Chunk> chunks;
+        std::vector<ReadRequest> requests;
+        std::vector<size_t> owners;
+        size_t used = 0;
+
+        while (ri < regions.size() && used < buffer.size())
+        {
+            auto region = regions[ri];
+            const size_t take = std::min( region->pages.size() - pi, (buffer.size() - used) / PageSize );
+
+            chunks.push_back( { ri, pi, pi + take, used } );
+
+            for (size_t k = pi; k < pi + take;)
+            {
+                size_t run = 1;
+                while (k + run < pi + take && region->pages[k + run] == region->pages[k] + run)
+                    run++;
+
+                requests.push_back( { region->base + region->pages[k] * PageSize, run * PageSize, buffer.data() + used + (k - pi) * PageSize } );
+                owners.emplace_back( ri );
+                k += run;
+            }
+
+            used += take * PageSize;
+            pi += take;
+
+            if (pi == region->pages.size())
+            {
+                ri++;
+                pi = 0;
+            }
+        }
+
+        _process.memory().ReadBatch( requests );
+        _bytesRead += used;
+
+        // Values of unreadable pages are unknown, drop their candidates
+        for (size_t i = 0; i < requests.size(); i++)
+        {
+            if (NT_SUCCESS( requests[i].status ))
+                continue;
+
+            auto region = regions[owners[i]];
+            const size_t page = static_cast<size_t>(requests[i].address - region->base) / PageSize;
+            std::fill_n( region->bitmap.begin() + page * words, requests[i].size / PageSize * words, 0ull );
+        }
+
+        for (const auto& chunk : chunks)
+        {
+            auto region = regions[chunk.region];
+            auto& pages = keptPages[chunk.region];
+            auto& values = keptValues[chunk.region];
+
+            for (size_t k = chunk.from; k < chunk.to; k++)
+            {
+                const uint32_t page = region->pages[k];
+                const uint8_t* cur = buffer.data() + chunk.offset + (k - chunk.from) * PageSize;
+                const uint8_t* prev = first ? nullptr : region->values.data() + k * PageSize;
+                uint64_t* bitmap = region->bitmap.data() + page * words;
+
+                if (compare != ScanCompare::Unknown)
+                    ComparePage( _type, compare, cur, prev, a, b, bitmap );
+
+                if (std::any_of( bitmap, bitmap + words, []( uint64_t word ) { return word != 0; } ))
+                {
+                    pages.emplace_back( page );
+                    values.insert( values.end(), cur, cur + PageSize );
+                }
+            }
+        }
+    }
+
+    for (size_t i = 0; i < regions.size(); i++)
+    {
+        regions[i]->pages.swap( keptPages[i] );
+        regions[i]->values.swap( keptValues[i] );
+    }
+}
+
+size_t ValueScanner::slotSize() const
+{
+    return _type == ScanValueType::Int64 || _type == ScanValueType::Double ? sizeof( uint64_t ) : sizeof( uint32_t );
+}
+
+}
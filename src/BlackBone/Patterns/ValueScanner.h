@@ -0,0 +1,154 @@
+#pragma once
+
+#include "PatternSearch.h"
+
+#include <vector>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Scanned value type. Values are expected to be naturally aligned
+/// </summary>
+enum class ScanValueType
+{
+    Int32 = 0,
+    Int64,
+    Float,
+    Double,
+};
+
+/// <summary>
+/// Value comparison
+/// </summary>
+enum class ScanCompare
+{
+    Unknown = 0,    // Any value, first scan only. Every slot becomes a candidate
+    Equal,          // value == a
+    Range,          // a <= value <= b
+    Changed,        // value != previous, next scans only
+    Unchanged,      // value == previous, next scans only
+    Increased,      // value > previous, next scans only
+    Decreased,      // value < previous, next scans only
+};
+
+/// <summary>
+/// Compared value, converted to scanner type on use
+/// </summary>
+struct ScanValue
+{
+    int64_t integer = 0;    // Int32 and Int64 scans
+    double real = 0.0;      // Float and Double scans
+
+    ScanValue() = default;
+    ScanValue( int32_t value ) : integer( value ), real( value ) { }
+    ScanValue( int64_t value ) : integer( value ), real( static_cast<double>(value) ) { }
+    ScanValue( float value ) : integer( static_cast<int64_t>(value) ), real( value ) { }
+    ScanValue( double value ) : integer( static_cast<int64_t>(value) ), real( value ) { }
+};
+
+/// <summary>
+/// Typed value scanner with iterative narrowing.
+/// Candidates are kept as one bit per aligned slot of every scanned region, along with
+/// previous contents of pages that still hold candidates. Next scans re-read only those pages,
+/// all of them in a single batched read, and compare them with SSE2 if supported by CPU.
+/// Filter bounds are rounded inward to page boundaries.
+/// </summary>
+class ValueScanner
+{
+public:
+    BLACKBONE_API ValueScanner( class Process& process, ScanValueType type );
+    BLACKBONE_API ~ValueScanner() = default;
+
+    /// <summary>
+    /// Scan all regions matching filter, previous results are dropped
+    /// </summary>
+    /// <param name="compare">Value comparison, Unknown, Equal or Range</param>
+    /// <param name="a">Value or lower range bound</param>
+    /// <param name="b">Upper range bound</param>
+    /// <param name="filter">Scanned regions filter</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS FirstScan(
+        ScanCompare compare,
+        ScanValue a = ScanValue(),
+        ScanValue b = ScanValue(),
+        const RegionFilter& filter = RegionFilter()
+        );
+
+    /// <summary>
+    /// Narrow candidates found by previous scans
+    /// </summary>
+    /// <param name="compare">Value comparison, anything except Unknown</param>
+    /// <param name="a">Value or lower range bound</param>
+    /// <param name="b">Upper range bound</param>
+    /// <returns>Status code, STATUS_INVALID_DEVICE_STATE if there was no first scan</returns>
+    BLACKBONE_API NTSTATUS NextScan( ScanCompare compare, ScanValue a = ScanValue(), ScanValue b = ScanValue() );
+
+    /// <summary>
+    /// Get number of candidates
+    /// </summary>
+    /// <returns>Candidate count</returns>
+    BLACKBONE_API size_t count() const;
+
+    /// <summary>
+    /// Get candidate addresses
+    /// </summary>
+    /// <param name="max">Max number of addresses, 0 - all</param>
+    /// <returns>Addresses in ascending order</returns>
+    BLACKBONE_API std::vector<ptr_t> results( size_t max = 0 ) const;
+
+    /// <summary>
+    /// Drop all candidates
+    /// </summary>
+    BLACKBONE_API void Reset();
+
+    BLACKBONE_API inline ScanValueType type() const { return _type; }
+
+    /// <summary>
+    /// Bytes read from target by last scan
+    /// </summary>
+    BLACKBONE_API inline uint64_t bytesRead() const { return _bytesRead; }
+
+private:
+    /// <summary>
+    /// Scanned region
+    /// </summary>
+    struct Region
+    {
+        ptr_t base = 0;                 // Page aligned start
+        size_t size = 0;                // Page aligned size
+        std::vector<uint64_t> bitmap;   // One bit per slot
+        std::vector<uint32_t> pages;    // Indexes of pages that hold candidates, ascending
+        std::vector<uint8_t> values;    // Previous contents of these pages
+    };
+
+    /// <summary>
+    /// Read pages of listed regions and compare them
+    /// </summary>
+    /// <param name="regions">Regions to update, pages list of every region is scanned</param>
+    /// <param name="compare">Value comparison</param>
+    /// <param name="a">Value or lower range bound</param>
+    /// <param name="b">Upper range bound</param>
+    /// <param name="first">No previous values are available</param>
+    void ScanRegions(
+        const std::vector<Region*>& regions,
+        ScanCompare compare,
+        const ScanValue& a,
+        const ScanValue& b,
+        bool first
+        );
+
+    size_t slotSize() const;
+
+    ValueScanner( const ValueScanner& ) = delete;
+    ValueScanner& operator =( const ValueScanner& ) = delete;
+
+private:
+    class Process& _process;
+    ScanValueType _type;
+    std::vector<Region> _regions;   // Regions with candidates, ascending
+    bool _scanned = false;          // First scan was done
+    uint64_t _bytesRead = 0;        // Bytes read by last scan
+};
+
+}
@@ -0,0 +1,315 @@
+#include "AsyncMemory.h"
+#include "ProcessMemory.h"
+#include "../DriverControl/DriverControl.h"
+
+#include <algorithm>
+#include <thread>
+
+namespace blackbone
+{
+
+// Completion key used to stop worker
+constexpr ULONG_PTR StopKey = 1;
+
+/// <summary>
+/// Start worker pool
+/// </summary>
+/// <param name="threads">Number of worker threads, 0 - number of CPUs</param>
+AsyncMemory::AsyncMemory( uint32_t threads /*= 0*/ )
+{
+    if (threads == 0)
+        threads = std::max( std::thread::hardware_concurrency(), 1u );
+
+    _idle = CreateEventW( NULL, TRUE, TRUE, NULL );
+    _port = CreateIoCompletionPort( INVALID_HANDLE_VALUE, NULL, 0, threads );
+    if (!_port || !_idle)
+        return;
+
+    for (uint32_t i = 0; i < threads; i++)
+    {
+        Handle hThread( CreateThread( NULL, 0, &AsyncMemory::WorkerThreadWrap, this, 0, NULL ) );
+        if (hThread)
+            _threads.emplace_back( std::move( hThread ) );
+    }
+}
+
+/// <summary>
+/// Complete pending requests and stop worker pool
+/// </summary>
+AsyncMemory::~AsyncMemory()
+{
+    Wait();
+
+    for (size_t i = 0; i < _threads.size(); i++)
+        PostQueuedCompletionStatus( _port, 0, StopKey, nullptr );
+
+    for (auto& thread : _threads)
+        WaitForSingleObject( thread, INFINITE );
+}
+
+/// <summary>
+/// Queue read through ProcessMemory
+/// </summary>
+/// <param name="memory">Target process memory</param>
+/// <param name="address">Address to read from</param>
+/// <param name="size">Size of data to read</param>
+/// <param name="buffer">Output buffer</param>
+/// <returns>Future receiving operation status</returns>
+std::future<NTSTATUS> AsyncMemory::Read( ProcessMemory& memory, ptr_t address, size_t size, void* buffer )
+{
+    auto request = new Request();
+    request->memory = &memory;
+    request->address = address;
+    request->size = size;
+    request->buffer = buffer;
+
+    return QueueFuture( request );
+}
+
+/// <summary>
+/// Queue write through ProcessMemory
+/// </summary>
+/// <param name="memory">Target process memory</param>
+/// <param name="address">Address to write to</param>
+/// <param name="size">Size of data to write</param>
+/// <param name="buffer">Data to write</param>
+/// <returns>Future receiving operation status</returns>
+std::future<NTSTATUS> AsyncMemory::Write( ProcessMemory& memory, ptr_t address, size_t size, const void* buffer )
+{
+    auto request = new Request();
+    request->memory = &memory;
+    request->write = true;
+    request->address = address;
+    request->size = size;
+    request->buffer = const_cast<void*>(buffer);
+
+    return QueueFuture( request );
+}
+
+/// <summary>
+/// Queue read through ProcessMemory
+/// </summary>
+/// <param name="memory">Target process memory</param>
+/// <param name="address">Address to read from</param>
+/// <param name="size">Size of data to read</param>
+/// <param name="buffer">Output buffer</param>
+/// <param name="callback">Completion callback, invoked from worker thread</param>
+/// <param name="context">User context</param>
+/// <returns>Status code</returns>
+NTSTATUS AsyncMemory::Read( ProcessMemory& memory, ptr_t address, size_t size, void* buffer, fnCompletion callback, void* context /*= nullptr*/ )
+{
+    auto request = new Request();
+    request->memory = &memory;
+    request->address = address;
+    request->size = size;
+    request->buffer = buffer;
+    request->callback = callback;
+    request->context = context;
+
+    return Queue( request );
+}
+
+/// <summary>
+/// Queue write through ProcessMemory
+/// </summary>
+/// <param name="memory">Target process memory</param>
+/// <param name="address">Address to write to</param>
+/// <param name="size">Size of data to write</param>
+/// <param name="buffer">Data to write</param>
+/// <param name="callback">Completion callback, invoked from worker thread</param>
+/// <param name="context">User context</param>
+/// <returns>Status code</returns>
+NTSTATUS AsyncMemory::Write( ProcessMemory& memory, ptr_t address, size_t size, const void* buffer, fnCompletion callback, void* context /*= nullptr*/ )
+{
+    auto request = new Request();
+    request->memory = &memory;
+    request->write = true;
+    request->address = address;
+    request->size = size;
+    request->buffer = const_cast<void*>(buffer);
+    request->callback = callback;
+    request->context = context;
+
+    return Queue( request );
+}
+
+/// <summary>
+/// Queue read through BlackBone driver
+/// </summary>
+/// <param name="pid">Target PID</param>
+/// <param name="address">Address to read from</param>
+/// <param name="size">Size of data to read</param>
+/// <param name="buffer">Output buffer</param>
+/// <returns>Future receiving operation status</returns>
+std::future<NTSTATUS> AsyncMemory::Read( DWORD pid, ptr_t address, size_t size, void* buffer )
+{
+    auto request = new Request();
+    request->pid = pid;
+    request->address = address;
+    request->size = size;
+    request->buffer = buffer;
+
+    return QueueFuture( request );
+}
+
+/// <summary>
+/// Queue write through BlackBone driver
+/// </summary>
+/// <param name="pid">Target PID</param>
+/// <param name="address">Address to write to</param>
+/// <param name="size">Size of data to write</param>
+/// <param name="buffer">Data to write</param>
+/// <returns>Future receiving operation status</returns>
+std::future<NTSTATUS> AsyncMemory::Write( DWORD pid, ptr_t address, size_t size, const void* buffer )
+{
+    auto request = new Request();
+    request->pid = pid;
+    request->write = true;
+    request->address = address;
+    request->size = size;
+    request->buffer = const_cast<void*>(buffer);
+
+    return QueueFuture( request );
+}
+
+/// <summary>
+/// Wait until all queued requests are completed
+/// </summary>
+/// <param name="timeout">Wait timeout</param>
+/// <returns>true if queue is empty</returns>
+bool AsyncMemory::Wait( uint32_t timeout /*= INFINITE*/ )
+{
+    if (!_idle)
+        return true;
+
+    return WaitForSingleObject( _idle, timeout ) == WAIT_OBJECT_0;
+}
+
+/// <summary>
+/// Number of queued or running requests
+/// </summary>
+/// <returns>Request count</returns>
+size_t AsyncMemory::pending()
+{
+    CSLock lck( _lock );
+    return _pending;
+}
+
+/// <summary>
+/// Queue request
+/// </summary>
+/// <param name="request">Request, ownership is passed to worker</param>
+/// <returns>Status code</returns>
+NTSTATUS AsyncMemory::Queue( Request* request )
+{
+    if (!valid())
+    {
+        if (request->hasPromise)
+            request->promise.set_value( STATUS_INVALID_HANDLE );
+
+        delete request;
+        return STATUS_INVALID_HANDLE;
+    }
+
+    {
+        CSLock lck( _lock );
+        if (_pending++ == 0)
+            ResetEvent( _idle );
+    }
+
+    if (!PostQueuedCompletionStatus( _port, 0, 0, reinterpret_cast<LPOVERLAPPED>(request) ))
+    {
+        auto status = LastNtStatus();
+        if (request->hasPromise)
+            request->promise.set_value( status );
+
+        delete request;
+
+        CSLock lck( _lock );
+        if (--_pending == 0)
+            SetEvent( _idle );
+
+        return status;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Queue request reporting through future
+/// </summary>
+/// <param name="request">Request, ownership is passed to worker</param>
+/// <returns>Request future</returns>
+std::future<NTSTATUS> AsyncMemory::QueueFuture( Request* request )
+{
+    request->hasPromise = true;
+    auto future = request->promise.get_future();
+
+    // Queue failure is reported through promise as well
+    Queue( request );
+    return future;
+}
+
+/// <summary>
+/// Execute and complete request
+/// </summary>
+/// <param name="request">Request</param>
+void AsyncMemory::Execute( Request* request )
+{
+    NTSTATUS status = STATUS_SUCCESS;
+
+    if (request->memory)
+    {
+        status = request->write
+            ? request->memory->Write( request->address, request->size, request->buffer )
+            : request->memory->Read( request->address, request->size, request->buffer );
+    }
+    else
+    {
+        status = request->write
+            ? Driver().WriteMem( request->pid, request->address, request->size, request->buffer )
+            : Driver().ReadMem( request->pid, request->address, request->size, request->buffer );
+    }
+
+    if (request->callback)
+        request->callback( status, request->address, request->size, request->buffer, request->context );
+
+    if (request->hasPromise)
+        request->promise.set_value( status );
+
+    delete request;
+
+    CSLock lck( _lock );
+    if (--_pending == 0)
+        SetEvent( _idle );
+}
+
+DWORD CALLBACK AsyncMemory::WorkerThreadWrap( LPVOID lpParam )
+{
+    reinterpret_cast<AsyncMemory*>(lpParam)->WorkerThread();
+    return 0;
+}
+
+/// <summary>
+/// Worker thread, executes requests posted to completion port
+/// </summary>
+void AsyncMemory::WorkerThread()
+{
+    for (;;)
+    {
+        DWORD bytes = 0;
+        ULONG_PTR key = 0;
+        LPOVERLAPPED pOverlapped = nullptr;
+
+        if (!GetQueuedCompletionStatus( _port, &bytes, &key, &pOverlapped, INFINITE ) && pOverlapped == nullptr)
+            break;
+
+        if (key == StopKey)
+            break;
+
+        if (pOverlapped)
+            Execute( reinterpret_cast<Request*>(pOverlapped) );
+    }
+}
+
+}
@@ -0,0 +1,177 @@
+#pragma once
+
+#include "../Include/Winheaders.h"
+#include "../Include/Types.h"
+#include "../Include/HandleGuard.h"
+#include "../Misc/Utils.h"
+
+#include <vector>
+#include <future>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Asynchronous memory I/O.
+/// Requests are queued to IO completion port and executed by worker pool,
+/// so single controller thread can keep many reads in flight across processes.
+/// Buffers must stay valid until request is completed.
+/// </summary>
+class AsyncMemory
+{
+public:
+    /// <summary>
+    /// Request completion callback
+    /// </summary>
+    /// <param name="status">Operation status</param>
+    /// <param name="address">Target address</param>
+    /// <param name="size">Data size</param>
+    /// <param name="buffer">Local buffer</param>
+    /// <param name="context">User context</param>
+    using fnCompletion = void( *)(NTSTATUS status, ptr_t address, size_t size, void* buffer, void* context);
+
+public:
+    /// <summary>
+    /// Start worker pool
+    /// </summary>
+    /// <param name="threads">Number of worker threads, 0 - number of CPUs</param>
+    BLACKBONE_API AsyncMemory( uint32_t threads = 0 );
+
+    /// <summary>
+    /// Complete pending requests and stop worker pool
+    /// </summary>
+    BLACKBONE_API ~AsyncMemory();
+
+    AsyncMemory( const AsyncMemory& ) = delete;
+    AsyncMemory& operator =( const AsyncMemory& ) = delete;
+
+    /// <summary>
+    /// Queue read through ProcessMemory
+    /// </summary>
+    /// <param name="memory">Target process memory</param>
+    /// <param name="address">Address to read from</param>
+    /// <param name="size">Size of data to read</param>
+    /// <param name="buffer">Output buffer</param>
+    /// <returns>Future receiving operation status</returns>
+    BLACKBONE_API std::future<NTSTATUS> Read( class ProcessMemory& memory, ptr_t address, size_t size, void* buffer );
+
+    /// <summary>
+    /// Queue write through ProcessMemory
+    /// </summary>
+    /// <param name="memory">Target process memory</param>
+    /// <param name="address">Address to write to</param>
+    /// <param name="size">Size of data to write</param>
+    /// <param name="buffer">Data to write</param>
+    /// <returns>Future receiving operation status</returns>
+    BLACKBONE_API std::future<NTSTATUS> Write( class ProcessMemory& memory, ptr_t address, size_t size, const void* buffer );
+
+    /// <summary>
+    /// Queue read through ProcessMemory
+    /// </summary>
+    /// <param name="memory">Target process memory</param>
+    /// <param name="address">Address to read from</param>
+    /// <param name="size">Size of data to read</param>
+    /// <param name="buffer">Output buffer</param>
+    /// <param name="callback">Completion callback, invoked from worker thread</param>
+    /// <param name="context">User context</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS Read( class ProcessMemory& memory, ptr_t address, size_t size, void* buffer, fnCompletion callback, void* context = nullptr );
+
+    /// <summary>
+    /// Queue write through ProcessMemory
+    /// </summary>
+    /// <param name="memory">Target process memory</param>
+    /// <param name="address">Address to write to</param>
+    /// <param name="size">Size of data to write</param>
+    /// <param name="buffer">Data to write</param>
+    /// <param name="callback">Completion callback, invoked from worker thread</param>
+    /// <param name="context">User context</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS Write( class ProcessMemory& memory, ptr_t address, size_t size, const void* buffer, fnCompletion callback, void* context = nullptr );
+
+    /// <summary>
+    /// Queue read through BlackBone driver
+    /// </summary>
+    /// <param name="pid">Target PID</param>
+    /// <param name="address">Address to read from</param>
+    /// <param name="size">Size of data to read</param>
+    /// <param name="buffer">Output buffer</param>
+    /// <returns>Future receiving operation status</returns>
+    BLACKBONE_API std::future<NTSTATUS> Read( DWORD pid, ptr_t address, size_t size, void* buffer );
+
+    /// <summary>
+    /// Queue write through BlackBone driver
+    /// </summary>
+    /// <param name="pid">Target PID</param>
+    /// <param name="address">Address to write to</param>
+    /// <param name="size">Size of data to write</param>
+    /// <param name="buffer">Data to write</param>
+    /// <returns>Future receiving operation status</returns>
+    BLACKBONE_API std::future<NTSTATUS> Write( DWORD pid, ptr_t address, size_t size, const void* buffer );
+
+    /// <summary>
+    /// Wait until all queued requests are completed
+    /// </summary>
+    /// <param name="timeout">Wait timeout</param>
+    /// <returns>true if queue is empty</returns>
+    BLACKBONE_API bool Wait( uint32_t timeout = INFINITE );
+
+    /// <summary>
+    /// Number of queued or running requests
+    /// </summary>
+    /// <returns>Request count</returns>
+    BLACKBONE_API size_t pending();
+
+    /// <summary>
+    /// Worker pool is running
+    /// </summary>
+    /// <returns>true if requests can be queued</returns>
+    BLACKBONE_API inline bool valid() const { return _port.valid() && !_threads.empty(); }
+
+private:
+    struct Request
+    {
+        class ProcessMemory* memory = nullptr;  // Target memory, nullptr for driver requests
+        DWORD pid = 0;                          // Target PID for driver requests
+        bool write = false;                     // Write request
+        ptr_t address = 0;                      // Target address
+        size_t size = 0;                        // Data size
+        void* buffer = nullptr;                 // Local buffer
+        fnCompletion callback = nullptr;        // Completion callback
+        void* context = nullptr;                // Callback context
+        bool hasPromise = false;                // Result is reported through promise
+        std::promise<NTSTATUS> promise;         // Request result
+    };
+
+    /// <summary>
+    /// Queue request
+    /// </summary>
+    /// <param name="request">Request, ownership is passed to worker</param>
+    /// <returns>Status code</returns>
+    NTSTATUS Queue( Request* request );
+
+    /// <summary>
+    /// Queue request reporting through future
+    /// </summary>
+    /// <param name="request">Request, ownership is passed to worker</param>
+    /// <returns>Request future</returns>
+    std::future<NTSTATUS> QueueFuture( Request* request );
+
+    /// <summary>
+    /// Execute and complete request
+    /// </summary>
+    /// <param name="request">Request</param>
+    void Execute( Request* request );
+
+    static DWORD CALLBACK WorkerThreadWrap( LPVOID lpParam );
+    void WorkerThread();
+
+private:
+    Handle _port;                       // IO completion port
+    std::vector<Handle> _threads;       // Worker threads
+    Handle _idle;                       // Signaled when no requests are pending
+    size_t _pending = 0;                // Queued or running requests
+    CriticalSection _lock;              // Pending counter lock
+};
+
+}
@@ -0,0 +1,118 @@
+#pragma once
+#include "Process.h"
+
+#include <stdint.h>
+#include <type_traits>
+#include <vector>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Typed view over target process memory.
+/// If range is completely covered by single region mapped with RemoteMemory::Map,
+/// view points directly into the mapping. Otherwise data is copied with ProcessMemory::Read.
+/// </summary>
+template<typename T>
+class MappedView
+{
+    static_assert(std::is_trivially_copyable_v<T>, "MappedView requires trivially copyable type");
+
+public:
+    /// <summary>
+    /// Create view
+    /// </summary>
+    /// <param name="memory">Target process memory</param>
+    /// <param name="address">Target address</param>
+    /// <param name="count">Number of elements</param>
+    /// <param name="resolveFault">Map missing region through driver instead of falling back to copy</param>
+    MappedView( ProcessMemory& memory, ptr_t address, size_t count = 1, bool resolveFault = false )
+        : _memory( &memory )
+        , _address( address )
+        , _count( count )
+    {
+        const size_t bytes = count * sizeof( T );
+        if (bytes == 0)
+            return;
+
+        // Whole range must be inside one contiguous local mapping
+        ptr_t first = memory.TranslateAddress( address, resolveFault );
+        ptr_t last = first != 0 ? memory.TranslateAddress( address + bytes - 1, resolveFault ) : 0;
+
+        if (first != 0 && last == first + bytes - 1)
+        {
+            _data = reinterpret_cast<T*>(first);
+            return;
+        }
+
+        _copy.resize( count );
+        _status = memory.Read( address, bytes, _copy.data() );
+        _data = NT_SUCCESS( _status ) ? _copy.data() : nullptr;
+    }
+
+    MappedView( MappedView&& ) = default;
+    MappedView& operator =( MappedView&& ) = default;
+
+    /// <summary>
+    /// Write copied data back to target process. Direct views need no flush
+    /// </summary>
+    /// <returns>Status code</returns>
+    NTSTATUS Flush()
+    {
+        if (!_data)
+            return _status;
+
+        return direct() ? STATUS_SUCCESS : _memory->Write( _address, _count * sizeof( T ), _copy.data() );
+    }
+
+    /// <summary>
+    /// Element access
+    /// </summary>
+    inline T* data()                     { return _data; }
+    inline const T* data() const         { return _data; }
+    inline T& operator []( size_t i )    { return _data[i]; }
+    inline T* operator ->()              { return _data; }
+    inline T& operator *()               { return *_data; }
+    inline T* begin()                    { return _data; }
+    inline T* end()                      { return _data ? _data + _count : nullptr; }
+
+    /// <summary>
+    /// Number of elements
+    /// </summary>
+    inline size_t size() const { return _count; }
+
+    /// <summary>
+    /// Target address
+    /// </summary>
+    inline ptr_t address() const { return _address; }
+
+    /// <summary>
+    /// Data points directly into mapped target memory
+    /// </summary>
+    inline bool direct() const { return _data != nullptr && _copy.empty(); }
+
+    /// <summary>
+    /// View contains valid data
+    /// </summary>
+    inline bool valid() const { return _data != nullptr; }
+    inline explicit operator bool() const { return valid(); }
+
+    /// <summary>
+    /// Read status if data was copied
+    /// </summary>
+    inline NTSTATUS status() const { return _status; }
+
+private:
+    MappedView( const MappedView& ) = delete;
+    MappedView& operator =( const MappedView& ) = delete;
+
+private:
+    ProcessMemory* _memory = nullptr;   // Target process memory
+    ptr_t _address = 0;                 // Target address
+    size_t _count = 0;                  // Element count
+    T* _data = nullptr;                 // Mapped or copied data
+    std::vector<T> _copy;               // Copied data, empty for direct view
+    NTSTATUS _status = STATUS_SUCCESS;  // Copy status
+};
+
+}
@@ -1,6 +1,8 @@
 #include "MemBlock.h"
 #include "ProcessMemory.h"
 #include "ProcessCore.h"
+#include "RemoteCodeHeap.h"
+#include "RemoteHeap.h"
 #include "../Subsystem/NativeSubsystem.h"
 #include "../Misc/Trace.hpp"
 
@@ -79,36 +81,50 @@ MemBlock::MemBlock( ProcessMemory* mem, ptr_t ptr, bool own /*= true*/ )
 /// <param name="desired">Desired base address of new block</param>
 /// <param name="protection">Memory protection</param>
 /// <param name="own">false if caller will be responsible for block deallocation</param>
+/// <param name="writeWatch">Track written pages, see GetDirtyPages</param>
 /// <returns>Memory block. If failed - returned block will be invalid</returns>
 call_result_t<MemBlock> MemBlock::Allocate( 
     ProcessMemory& process, 
     size_t size, 
     ptr_t desired /*= 0*/, 
     DWORD protection /*= PAGE_EXECUTE_READWRITE */, 
-    bool own /*= true*/ 
+    bool own /*= true*/,
+    bool writeWatch /*= false*/
     )
 {
     ptr_t desired64 = desired;
     DWORD newProt = CastProtection( protection, process.core().DEP() );
+
+    // Write watch can be set only on new reservation
+    DWORD watchFlags = writeWatch ? MEM_RESERVE | MEM_WRITE_WATCH : 0;
     
-    NTSTATUS status = process.core().native()->VirtualAllocExT( desired64, size, MEM_RESERVE | MEM_COMMIT, newProt );
+    NTSTATUS status = process.core().native()->VirtualAllocExT( desired64, size, MEM_RESERVE | MEM_COMMIT | watchFlags, newProt );
     if (!NT_SUCCESS( status ))
     {
         desired64 = 0;
-        status = process.core().native()->VirtualAllocExT( desired64, size, MEM_COMMIT, newProt );
+        status = process.core().native()->VirtualAllocExT( desired64, size, MEM_COMMIT | watchFlags, newProt );
         if (NT_SUCCESS( status ))
-            return call_result_t<MemBlock>( MemBlock( &process, desired64, size, protection, own ), STATUS_IMAGE_NOT_AT_BASE );
+        {
+            process.regionMap().Invalidate( desired64, size );
+            MemBlock block( &process, desired64, size, protection, own );
+            block._pImpl->_writeWatch = writeWatch;
+            return call_result_t<MemBlock>( std::move( block ), STATUS_IMAGE_NOT_AT_BASE );
+        }
         else
             return status;
     }
 #ifdef _DEBUG
     BLACKBONE_TRACE(L"Allocate: Allocating at address 0x%p (0x%X bytes)", static_cast<uintptr_t>(desired64), size);
 #endif
-    return MemBlock( &process, desired64, size, protection, own );
+    process.regionMap().Invalidate( desired64, size );
+    MemBlock block( &process, desired64, size, protection, own );
+    block._pImpl->_writeWatch = writeWatch;
+    return std::move( block );
 }
 
 /// <summary>
-/// Reallocate existing block for new size
+/// Reallocate existing block for new size.
+/// Block grows in place if its reservation allows, otherwise it is moved and contents are copied
 /// </summary>
 /// <param name="size">New block size</param>
 /// <param name="desired">Desired base address of new block</param>
@@ -119,29 +135,67 @@ call_result_t<ptr_t> MemBlock::Realloc( size_t size, ptr_t desired /*= 0*/, DWOR
     if (!_pImpl)
         return STATUS_MEMORY_NOT_ALLOCATED;
 
+    // Heap blocks can't be resized in place
+    if (_pImpl->_heap || _pImpl->_dataHeap)
+        return STATUS_NOT_SUPPORTED;
+
+    auto& memory = *_pImpl->_memory;
+    auto native = memory.core().native();
+    DWORD newProt = CastProtection( protection, memory.core().DEP() );
+
+    // Commit more pages of current reservation
+    if (_pImpl->_ptr != 0 && !_pImpl->_physical && (desired == 0 || desired == _pImpl->_ptr))
+    {
+        ptr_t base = _pImpl->_ptr;
+        if (NT_SUCCESS( native->VirtualAllocExT( base, size, MEM_COMMIT, newProt ) ) && base == _pImpl->_ptr)
+        {
+            memory.regionMap().Invalidate( base, size );
+            _pImpl->_size = size;
+            _pImpl->_protection = protection;
+            return base;
+        }
+    }
+
+    // Reserve headroom, so next growth is done in place
+    size_t reserve = Align( size * 2, 0x10000 );
     ptr_t desired64 = desired;
-    auto status = _pImpl->_memory->core().native()->VirtualAllocExT( desired64, size, MEM_COMMIT, protection );
-    if (!desired64)
+    DWORD reserveType = _pImpl->_writeWatch ? MEM_RESERVE | MEM_WRITE_WATCH : MEM_RESERVE;
+    NTSTATUS status = native->VirtualAllocExT( desired64, reserve, reserveType, PAGE_NOACCESS );
+    if (!NT_SUCCESS( status ) && desired != 0)
     {
         desired64 = 0;
-        status = _pImpl->_memory->core().native()->VirtualAllocExT( desired64, size, MEM_COMMIT, protection );
-        if (!NT_SUCCESS( status ))
-            return status;
-
-        status = STATUS_IMAGE_NOT_AT_BASE;
+        status = native->VirtualAllocExT( desired64, reserve, reserveType, PAGE_NOACCESS );
     }
 
-    // Replace current instance
-    if (desired64)
+    if (!NT_SUCCESS( status ))
+        return status;
+
+    ptr_t reserved = desired64;
+    status = native->VirtualAllocExT( desired64, size, MEM_COMMIT, newProt );
+    if (!NT_SUCCESS( status ))
     {
-        Free();
+        native->VirtualFreeExT( reserved, 0, MEM_RELEASE );
+        return status;
+    }
 
-        _pImpl->_ptr = desired64;
-        _pImpl->_size = size;
-        _pImpl->_protection = protection;
+    memory.regionMap().Invalidate( desired64, reserve );
+
+    // Move contents
+    if (_pImpl->_ptr != 0 && _pImpl->_size != 0)
+    {
+        std::vector<uint8_t> buf( std::min( _pImpl->_size, size ) );
+        if (NT_SUCCESS( memory.Read( _pImpl->_ptr, buf.size(), buf.data(), true ) ))
+            memory.Write( desired64, buf.size(), buf.data() );
     }
 
-    return call_result_t<ptr_t>( desired64, status );
+    Free();
+
+    _pImpl->_ptr = desired64;
+    _pImpl->_size = size;
+    _pImpl->_protection = protection;
+    _pImpl->_physical = false;
+
+    return call_result_t<ptr_t>( desired64, desired != 0 && desired64 != desired ? STATUS_IMAGE_NOT_AT_BASE : STATUS_SUCCESS );
 }
 
 /// <summary>
@@ -162,6 +216,9 @@ NTSTATUS MemBlock::Protect( DWORD protection, uintptr_t offset /*= 0*/, size_t s
     if (size == 0)
         size = _pImpl->_size;
 
+    if (_pImpl->_physical)
+        _pImpl->_memory->regionMap().Invalidate( _pImpl->_ptr + offset, size );
+
     return _pImpl->_physical ? Driver().ProtectMem( _pImpl->_memory->core().pid(), _pImpl->_ptr + offset, size, prot ) :
         _pImpl->_memory->Protect( _pImpl->_ptr + offset, size, prot, pOld );
 }
@@ -187,8 +244,25 @@ NTSTATUS MemBlock::MemBlockImpl::Free( size_t size /*= 0 */ )
     if (_ptr == 0)
         return STATUS_MEMORY_NOT_ALLOCATED;
 
+    // Block is always returned whole
+    if (_heap || _dataHeap)
+    {
+        if (_heap)
+            _heap->Free( _ptr );
+        else
+            _dataHeap->Free( _ptr );
+
+        _ptr = 0;
+        _size = 0;
+        _protection = 0;
+        return STATUS_SUCCESS;
+    }
+
     size = Align( size, 0x1000 );
 
+    if (_physical)
+        _memory->regionMap().Invalidate( _ptr, size );
+
     NTSTATUS status = _physical ? Driver().FreeMem( _memory->core().pid(), _ptr, size, MEM_RELEASE ) :
         _memory->Free( _ptr, size, size == 0 ? MEM_RELEASE : MEM_DECOMMIT );
 
@@ -245,6 +319,85 @@ NTSTATUS MemBlock::Write( uintptr_t offset, size_t size, const void* pData )
     return _pImpl->_memory->Write( _pImpl->_ptr + offset, size, pData );
 }
 
+/// <summary>
+/// Get pages written by anyone since allocation or last reset.
+/// Block must be allocated with write watch
+/// </summary>
+/// <param name="pages">Addresses of written pages, ascending</param>
+/// <param name="reset">Reset tracking state of returned pages</param>
+/// <returns>Status</returns>
+NTSTATUS MemBlock::GetDirtyPages( std::vector<ptr_t>& pages, bool reset /*= false*/ )
+{
+    pages.clear();
+
+    if (!_pImpl || _pImpl->_ptr == 0)
+        return STATUS_MEMORY_NOT_ALLOCATED;
+
+    if (!_pImpl->_writeWatch)
+        return STATUS_INVALID_PARAMETER;
+
+    return _pImpl->_memory->core().native()->GetWriteWatchT( _pImpl->_ptr, _pImpl->_size, pages, reset );
+}
+
+/// <summary>
+/// Mark all block pages as not written
+/// </summary>
+/// <returns>Status</returns>
+NTSTATUS MemBlock::ResetWatch()
+{
+    if (!_pImpl || _pImpl->_ptr == 0)
+        return STATUS_MEMORY_NOT_ALLOCATED;
+
+    if (!_pImpl->_writeWatch)
+        return STATUS_INVALID_PARAMETER;
+
+    return _pImpl->_memory->core().native()->ResetWriteWatchT( _pImpl->_ptr, _pImpl->_size );
+}
+
+/// <summary>
+/// Update local copy of block with pages written since last update, tracking state is reset.
+/// Adjacent dirty pages are read at once, clean pages aren't read at all
+/// </summary>
+/// <param name="pMirror">Local copy, at least size() bytes</param>
+/// <param name="pPages">Optional list of updated pages</param>
+/// <returns>Status</returns>
+NTSTATUS MemBlock::ReadDirty( void* pMirror, std::vector<ptr_t>* pPages /*= nullptr*/ )
+{
+    std::vector<ptr_t> pages;
+
+    // Reset before read, so writes made during read are reported next time
+    NTSTATUS status = GetDirtyPages( pages, true );
+    if (!NT_SUCCESS( status ))
+        return status;
+
+    const ptr_t end = _pImpl->_ptr + _pImpl->_size;
+    std::vector<ReadRequest> requests;
+
+    for (auto page : pages)
+    {
+        if (page >= end)
+            continue;
+
+        const size_t size = static_cast<size_t>(std::min<ptr_t>( page + 0x1000, end ) - page);
+        if (!requests.empty() && requests.back().address + requests.back().size == page)
+        {
+            requests.back().size += size;
+            continue;
+        }
+
+        ReadRequest request;
+        request.address = page;
+        request.size = size;
+        request.buffer = reinterpret_cast<uint8_t*>(pMirror) + (page - _pImpl->_ptr);
+        requests.emplace_back( request );
+    }
+
+    if (pPages)
+        *pPages = std::move( pages );
+
+    return requests.empty() ? STATUS_SUCCESS : _pImpl->_memory->ReadBatch( requests );
+}
+
 /// <summary>
 /// Try to free memory and reset pointers
 /// </summary>
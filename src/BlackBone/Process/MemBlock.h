@@ -7,6 +7,7 @@
 
 #include <stdint.h>
 #include <memory>
+#include <vector>
 
 namespace blackbone
 {
@@ -42,6 +43,8 @@ public:
     class MemBlockImpl
     {
         friend class MemBlock;
+        friend class RemoteCodeHeap;
+        friend class RemoteHeap;
 
     public:
         MemBlockImpl() = default;
@@ -74,7 +77,10 @@ public:
         DWORD  _protection = 0;         // Region protection
         bool   _own = true;             // Memory will be freed in destructor
         bool   _physical = false;       // Memory allocated as direct physical
+        bool   _writeWatch = false;     // Memory allocated with MEM_WRITE_WATCH
         class ProcessMemory* _memory;   // Target process routines
+        class RemoteCodeHeap* _heap = nullptr;  // Owning code heap, block is returned there instead of being freed
+        class RemoteHeap* _dataHeap = nullptr;  // Owning data heap, block is returned there instead of being freed
     }; 
 
 public:
@@ -124,17 +130,20 @@ public:
     /// <param name="desired">Desired base address of new block</param>
     /// <param name="protection">Win32 Memory protection flags</param>
     /// <param name="own">false if caller will be responsible for block deallocation</param>
+    /// <param name="writeWatch">Track written pages, see GetDirtyPages</param>
     /// <returns>Memory block. If failed - returned block will be invalid</returns>
     BLACKBONE_API static call_result_t<MemBlock> Allocate(
         class ProcessMemory& process,
         size_t size,
         ptr_t desired = 0,
         DWORD protection = PAGE_EXECUTE_READWRITE,
-        bool own = true
+        bool own = true,
+        bool writeWatch = false
         );
 
     /// <summary>
-    /// Reallocate existing block for new size
+    /// Reallocate existing block for new size.
+    /// Block grows in place if its reservation allows, otherwise it is moved and contents are copied
     /// </summary>
     /// <param name="size">New block size</param>
     /// <param name="desired">Desired base address of new block</param>
@@ -180,6 +189,30 @@ public:
     /// <returns>Status</returns>
     BLACKBONE_API NTSTATUS Write( uintptr_t offset, size_t size, const void* pData );
 
+    /// <summary>
+    /// Get pages written by anyone since allocation or last reset.
+    /// Block must be allocated with write watch
+    /// </summary>
+    /// <param name="pages">Addresses of written pages, ascending</param>
+    /// <param name="reset">Reset tracking state of returned pages</param>
+    /// <returns>Status</returns>
+    BLACKBONE_API NTSTATUS GetDirtyPages( std::vector<ptr_t>& pages, bool reset = false );
+
+    /// <summary>
+    /// Mark all block pages as not written
+    /// </summary>
+    /// <returns>Status</returns>
+    BLACKBONE_API NTSTATUS ResetWatch();
+
+    /// <summary>
+    /// Update local copy of block with pages written since last update, tracking state is reset.
+    /// Adjacent dirty pages are read at once, clean pages aren't read at all
+    /// </summary>
+    /// <param name="pMirror">Local copy, at least size() bytes</param>
+    /// <param name="pPages">Optional list of updated pages</param>
+    /// <returns>Status</returns>
+    BLACKBONE_API NTSTATUS ReadDirty( void* pMirror, std::vector<ptr_t>* pPages = nullptr );
+
     /// <summary>
     /// Read data
     /// </summary>
@@ -247,6 +280,12 @@ public:
     /// <returns>Memory protection flags</returns>
     BLACKBONE_API inline DWORD  protection() const { return _pImpl ? _pImpl->_protection : 0; }
 
+    /// <summary>
+    /// Check if block tracks written pages
+    /// </summary>
+    /// <returns>true if block was allocated with write watch</returns>
+    BLACKBONE_API inline bool writeWatch() const { return _pImpl ? _pImpl->_writeWatch : false; }
+
     /// <summary>
     /// Validate memory block
     /// <returns>true if memory pointer isn't 0</returns>
@@ -259,6 +298,9 @@ public:
     BLACKBONE_API inline operator ptr_t() const  { return _pImpl ? _pImpl->_ptr : 0; }
 
 private:
+    friend class RemoteCodeHeap;
+    friend class RemoteHeap;
+
     std::shared_ptr<MemBlockImpl> _pImpl;
 };
 
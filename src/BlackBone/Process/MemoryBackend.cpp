@@ -0,0 +1,293 @@
+#include "MemoryBackend.h"
+#include "ProcessMemory.h"
+#include "ProcessCore.h"
+#include "../DriverControl/DriverControl.h"
+
+#include <algorithm>
+
+namespace blackbone
+{
+
+MemoryRouter::MemoryRouter( ProcessMemory& memory )
+{
+    _slots[static_cast<size_t>(MemoryBackendType::Syscall)].backend = std::make_shared<SyscallBackend>( memory );
+    _slots[static_cast<size_t>(MemoryBackendType::Driver)].backend = std::make_shared<DriverBackend>( memory );
+    _slots[static_cast<size_t>(MemoryBackendType::Mapped)].backend = std::make_shared<MappedBackend>( memory );
+
+    for (auto& selected : _selections)
+        selected = 0;
+}
+
+/// <summary>
+/// Pick backend for request
+/// </summary>
+/// <param name="count">Number of ranges</param>
+/// <param name="bytes">Total size of all ranges</param>
+/// <returns>Backend type</returns>
+MemoryBackendType MemoryRouter::Select( size_t count, size_t bytes )
+{
+    constexpr size_t backends = static_cast<size_t>(MemoryBackendType::Count);
+
+    bool usable[backends] = { };
+    for (size_t i = 0; i < backends; i++)
+        usable[i] = _slots[i].backend->available();
+
+    const size_t average = count != 0 ? bytes / count : 0;
+    auto preferred = Preferred( count, average, usable );
+    if (!_policy.adaptive)
+        return preferred;
+
+    const size_t cls = SizeClass( average );
+    const uint64_t index = _selections[cls]++;
+
+    // Let backends without enough samples get some traffic, otherwise rules would never be revised
+    if (_policy.exploreInterval != 0 && index % _policy.exploreInterval == _policy.exploreInterval - 1)
+    {
+        for (size_t i = 0; i < backends; i++)
+        {
+            if (usable[i] && i != static_cast<size_t>(preferred) && _slots[i].samples[cls].count < _policy.warmup)
+                return static_cast<MemoryBackendType>(i);
+        }
+    }
+
+    // Per-range cost, batched ranges share single request overhead
+    auto cost = [&]( size_t i )
+    {
+        const auto& sample = _slots[i].samples[cls];
+        uint64_t samples = sample.count;
+        return samples >= _policy.warmup && samples != 0 ? sample.ticks / samples : ~0ull;
+    };
+
+    size_t best = static_cast<size_t>(preferred);
+    uint64_t bestCost = cost( best );
+    if (bestCost == ~0ull)
+        return preferred;
+
+    for (size_t i = 0; i < backends; i++)
+    {
+        if (!usable[i] || i == best)
+            continue;
+
+        uint64_t value = cost( i );
+        if (value < bestCost)
+        {
+            best = i;
+            bestCost = value;
+        }
+    }
+
+    return static_cast<MemoryBackendType>(best);
+}
+
+/// <summary>
+/// Account finished request
+/// </summary>
+/// <param name="type">Backend that served request</param>
+/// <param name="count">Number of ranges</param>
+/// <param name="bytes">Total size of all ranges</param>
+/// <param name="ticks">Elapsed QPC ticks</param>
+/// <param name="failed">Request failed</param>
+void MemoryRouter::Record( MemoryBackendType type, size_t count, size_t bytes, uint64_t ticks, bool failed )
+{
+    auto& slot = _slots[static_cast<size_t>(type)];
+
+    slot.requests++;
+    slot.ranges += count;
+    slot.bytes += bytes;
+    slot.ticks += ticks;
+    if (failed)
+        slot.failures++;
+
+    auto& sample = slot.samples[SizeClass( count != 0 ? bytes / count : 0 )];
+    sample.count += count;
+    sample.ticks += ticks;
+}
+
+/// <summary>
+/// Replace backend, statistics of replaced backend are reset
+/// </summary>
+/// <param name="type">Backend type</param>
+/// <param name="backend">New backend</param>
+void MemoryRouter::Set( MemoryBackendType type, std::shared_ptr<MemoryBackend> backend )
+{
+    auto& slot = _slots[static_cast<size_t>(type)];
+
+    slot.backend = std::move( backend );
+    slot.requests = slot.ranges = slot.bytes = slot.failures = slot.ticks = 0;
+    for (auto& sample : slot.samples)
+        sample.count = sample.ticks = 0;
+}
+
+/// <summary>
+/// Get backend counters
+/// </summary>
+/// <param name="type">Backend type</param>
+/// <returns>Counters snapshot</returns>
+MemoryBackendStats MemoryRouter::stats( MemoryBackendType type ) const
+{
+    static const uint64_t freq = []()
+    {
+        LARGE_INTEGER value;
+        QueryPerformanceFrequency( &value );
+        return static_cast<uint64_t>(value.QuadPart);
+    }();
+
+    const auto& slot = _slots[static_cast<size_t>(type)];
+    const uint64_t ticks = slot.ticks;
+
+    MemoryBackendStats result;
+    result.requests = slot.requests;
+    result.ranges = slot.ranges;
+    result.bytes = slot.bytes;
+    result.failures = slot.failures;
+    result.time = (ticks / freq) * 1000000000ull + (ticks % freq) * 1000000000ull / freq;
+
+    return result;
+}
+
+/// <summary>
+/// Drop all collected statistics
+/// </summary>
+void MemoryRouter::ResetStats()
+{
+    for (auto& slot : _slots)
+    {
+        slot.requests = slot.ranges = slot.bytes = slot.failures = slot.ticks = 0;
+        for (auto& sample : slot.samples)
+            sample.count = sample.ticks = 0;
+    }
+
+    for (auto& selected : _selections)
+        selected = 0;
+}
+
+/// <summary>
+/// Current QPC value
+/// </summary>
+/// <returns>Ticks</returns>
+uint64_t MemoryRouter::Now()
+{
+    LARGE_INTEGER now;
+    QueryPerformanceCounter( &now );
+    return static_cast<uint64_t>(now.QuadPart);
+}
+
+size_t MemoryRouter::SizeClass( size_t size )
+{
+    if (size <= 0x100)
+        return 0;
+    if (size <= 0x1000)
+        return 1;
+    if (size <= 0x10000)
+        return 2;
+
+    return 3;
+}
+
+/// <summary>
+/// Backend picked by size thresholds alone
+/// </summary>
+/// <param name="count">Number of ranges</param>
+/// <param name="average">Average range size</param>
+/// <param name="usable">Backend availability</param>
+/// <returns>Backend type</returns>
+MemoryBackendType MemoryRouter::Preferred( size_t count, size_t average, const bool* usable ) const
+{
+    // Tiny scattered reads, one vectored IOCTL replaces many syscalls
+    if (count > 1 && average <= _policy.tinyRead && usable[static_cast<size_t>(MemoryBackendType::Driver)])
+        return MemoryBackendType::Driver;
+
+    // Big sequential reads, plain memcpy from mapped view
+    if (average >= _policy.largeRead && usable[static_cast<size_t>(MemoryBackendType::Mapped)])
+        return MemoryBackendType::Mapped;
+
+    return MemoryBackendType::Syscall;
+}
+
+
+SyscallBackend::SyscallBackend( ProcessMemory& memory )
+    : _memory( memory )
+{
+}
+
+NTSTATUS SyscallBackend::Read( ptr_t address, size_t size, void* buffer )
+{
+    _memory.Count( size );
+    return _memory.core().ReadMemory( address, buffer, size );
+}
+
+void SyscallBackend::ReadBatch( std::vector<NativeReadRange>& ranges )
+{
+    for (const auto& range : ranges)
+        _memory.Count( range.size );
+
+    // Subsystem may perform all reads at once
+    _memory.core().native()->ReadProcessMemoryBatchT( ranges );
+}
+
+
+DriverBackend::DriverBackend( ProcessMemory& memory )
+    : _memory( memory )
+{
+}
+
+bool DriverBackend::available()
+{
+    return Driver().loaded();
+}
+
+NTSTATUS DriverBackend::Read( ptr_t address, size_t size, void* buffer )
+{
+    return Driver().ReadMem( _memory.core().pid(), address, size, buffer );
+}
+
+void DriverBackend::ReadBatch( std::vector<NativeReadRange>& ranges )
+{
+    std::vector<CopyRange> copy;
+    copy.reserve( ranges.size() );
+
+    for (const auto& range : ranges)
+        copy.push_back( { range.address, range.buffer, range.size, false, STATUS_UNSUCCESSFUL } );
+
+    // All ranges go to driver in one request
+    NTSTATUS status = Driver().CopyMemBatch( _memory.core().pid(), copy );
+    for (size_t i = 0; i < ranges.size(); i++)
+    {
+        ranges[i].status = copy[i].status == STATUS_UNSUCCESSFUL && !NT_SUCCESS( status ) ? status : copy[i].status;
+        ranges[i].bytes = NT_SUCCESS( ranges[i].status ) ? ranges[i].size : 0;
+    }
+}
+
+
+MappedBackend::MappedBackend( ProcessMemory& memory, bool resolveFaults /*= false*/ )
+    : _memory( memory )
+    , _resolveFaults( resolveFaults )
+{
+}
+
+bool MappedBackend::available()
+{
+    return _memory.mapped();
+}
+
+NTSTATUS MappedBackend::Read( ptr_t address, size_t size, void* buffer )
+{
+    auto pDst = reinterpret_cast<uint8_t*>(buffer);
+
+    // Range may span several mapped regions, each one has its own view
+    for (size_t done = 0; done < size;)
+    {
+        size_t available = 0;
+        ptr_t local = _memory.TranslateAddress( address + done, available, _resolveFaults );
+        if (local == 0)
+            return STATUS_INVALID_ADDRESS;
+
+        size_t chunk = std::min( available, size - done );
+        memcpy( pDst + done, reinterpret_cast<const void*>(static_cast<uintptr_t>(local)), chunk );
+        done += chunk;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+}
@@ -0,0 +1,238 @@
+#pragma once
+
+#include "../Include/Winheaders.h"
+#include "../Include/Types.h"
+#include "../Subsystem/NativeSubsystem.h"
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Memory read path
+/// </summary>
+enum class MemoryBackendType
+{
+    Syscall = 0,    // NtReadVirtualMemory, native or Wow64 subsystem
+    Driver,         // BlackBone driver copy, batches go in single vectored request
+    Mapped,         // Target pages mapped into current process by RemoteMemory::Map
+
+    Count
+};
+
+/// <summary>
+/// Read path implementation. Built-in backends may be replaced with ProcessMemory::SetBackend
+/// </summary>
+class MemoryBackend
+{
+public:
+    virtual ~MemoryBackend() = default;
+
+    /// <summary>
+    /// Check if backend can serve requests right now
+    /// </summary>
+    /// <returns>true if available</returns>
+    virtual bool available() = 0;
+
+    /// <summary>
+    /// Read single range
+    /// </summary>
+    /// <param name="address">Memory address to read from</param>
+    /// <param name="size">Size of data to read</param>
+    /// <param name="buffer">Output buffer</param>
+    /// <returns>Status code</returns>
+    virtual NTSTATUS Read( ptr_t address, size_t size, void* buffer ) = 0;
+
+    /// <summary>
+    /// Read several ranges, range by range unless backend can do better
+    /// </summary>
+    /// <param name="ranges">Ranges to read, status of every range is updated</param>
+    virtual void ReadBatch( std::vector<NativeReadRange>& ranges )
+    {
+        for (auto& range : ranges)
+        {
+            range.status = Read( range.address, range.size, range.buffer );
+            range.bytes = NT_SUCCESS( range.status ) ? range.size : 0;
+        }
+    }
+};
+
+/// <summary>
+/// Routing rules. Size thresholds pick backend until enough timings are collected,
+/// after that the backend with lowest measured cost for request size class wins
+/// </summary>
+struct MemoryPolicy
+{
+    size_t tinyRead = 0x100;            // Batched ranges of this size or smaller go to driver
+    size_t largeRead = 0x10000;         // Reads of this size or larger go to mapped view
+    uint32_t warmup = 16;               // Samples of size class required before measured cost is trusted
+    uint32_t exploreInterval = 64;      // Every Nth request of size class goes to backend lacking samples, 0 - never
+    bool adaptive = true;               // Let measured cost override size thresholds
+};
+
+/// <summary>
+/// Per-backend counters
+/// </summary>
+struct MemoryBackendStats
+{
+    uint64_t requests = 0;              // Read or batch requests served
+    uint64_t ranges = 0;                // Ranges read
+    uint64_t bytes = 0;                 // Bytes requested
+    uint64_t failures = 0;              // Failed requests, non-syscall ones are retried through syscall backend
+    uint64_t time = 0;                  // Total time spent, ns
+};
+
+/// <summary>
+/// Backend set with cost model
+/// </summary>
+class MemoryRouter
+{
+public:
+    static constexpr size_t SizeClasses = 4;    // <= 256 B, <= 4 KB, <= 64 KB, larger
+
+    MemoryRouter( class ProcessMemory& memory );
+
+    /// <summary>
+    /// Pick backend for request
+    /// </summary>
+    /// <param name="count">Number of ranges</param>
+    /// <param name="bytes">Total size of all ranges</param>
+    /// <returns>Backend type</returns>
+    MemoryBackendType Select( size_t count, size_t bytes );
+
+    /// <summary>
+    /// Account finished request
+    /// </summary>
+    /// <param name="type">Backend that served request</param>
+    /// <param name="count">Number of ranges</param>
+    /// <param name="bytes">Total size of all ranges</param>
+    /// <param name="ticks">Elapsed QPC ticks</param>
+    /// <param name="failed">Request failed</param>
+    void Record( MemoryBackendType type, size_t count, size_t bytes, uint64_t ticks, bool failed );
+
+    /// <summary>
+    /// Get backend
+    /// </summary>
+    /// <param name="type">Backend type</param>
+    /// <returns>Backend, never null</returns>
+    inline MemoryBackend& backend( MemoryBackendType type ) { return *_slots[static_cast<size_t>(type)].backend; }
+
+    /// <summary>
+    /// Replace backend, statistics of replaced backend are reset
+    /// </summary>
+    /// <param name="type">Backend type</param>
+    /// <param name="backend">New backend</param>
+    void Set( MemoryBackendType type, std::shared_ptr<MemoryBackend> backend );
+
+    /// <summary>
+    /// Get backend counters
+    /// </summary>
+    /// <param name="type">Backend type</param>
+    /// <returns>Counters snapshot</returns>
+    MemoryBackendStats stats( MemoryBackendType type ) const;
+
+    /// <summary>
+    /// Drop all collected statistics
+    /// </summary>
+    void ResetStats();
+
+    inline MemoryPolicy& policy() { return _policy; }
+
+    /// <summary>
+    /// Current QPC value
+    /// </summary>
+    /// <returns>Ticks</returns>
+    static uint64_t Now();
+
+private:
+    /// <summary>
+    /// Accumulated timings of one size class
+    /// </summary>
+    struct Sample
+    {
+        std::atomic<uint64_t> count{ 0 };
+        std::atomic<uint64_t> ticks{ 0 };
+    };
+
+    struct Slot
+    {
+        std::shared_ptr<MemoryBackend> backend;
+        std::atomic<uint64_t> requests{ 0 };
+        std::atomic<uint64_t> ranges{ 0 };
+        std::atomic<uint64_t> bytes{ 0 };
+        std::atomic<uint64_t> failures{ 0 };
+        std::atomic<uint64_t> ticks{ 0 };
+        std::array<Sample, SizeClasses> samples;
+    };
+
+    static size_t SizeClass( size_t size );
+
+    /// <summary>
+    /// Backend picked by size thresholds alone
+    /// </summary>
+    MemoryBackendType Preferred( size_t count, size_t average, const bool* usable ) const;
+
+private:
+    std::array<Slot, static_cast<size_t>(MemoryBackendType::Count)> _slots;
+    std::array<std::atomic<uint64_t>, SizeClasses> _selections;     // Requests routed per size class
+    MemoryPolicy _policy;
+};
+
+/// <summary>
+/// NtReadVirtualMemory through process subsystem
+/// </summary>
+class SyscallBackend : public MemoryBackend
+{
+public:
+    SyscallBackend( class ProcessMemory& memory );
+
+    virtual bool available() override { return true; }
+    virtual NTSTATUS Read( ptr_t address, size_t size, void* buffer ) override;
+    virtual void ReadBatch( std::vector<NativeReadRange>& ranges ) override;
+
+private:
+    class ProcessMemory& _memory;
+};
+
+/// <summary>
+/// BlackBone driver copy
+/// </summary>
+class DriverBackend : public MemoryBackend
+{
+public:
+    DriverBackend( class ProcessMemory& memory );
+
+    virtual bool available() override;
+    virtual NTSTATUS Read( ptr_t address, size_t size, void* buffer ) override;
+    virtual void ReadBatch( std::vector<NativeReadRange>& ranges ) override;
+
+private:
+    class ProcessMemory& _memory;
+};
+
+/// <summary>
+/// Copy from address space mapped by RemoteMemory
+/// </summary>
+class MappedBackend : public MemoryBackend
+{
+public:
+    /// <summary>
+    /// Constructor
+    /// </summary>
+    /// <param name="memory">Process memory</param>
+    /// <param name="resolveFaults">Map missing pages instead of failing read</param>
+    MappedBackend( class ProcessMemory& memory, bool resolveFaults = false );
+
+    virtual bool available() override;
+    virtual NTSTATUS Read( ptr_t address, size_t size, void* buffer ) override;
+
+private:
+    class ProcessMemory& _memory;
+    bool _resolveFaults;
+};
+
+}
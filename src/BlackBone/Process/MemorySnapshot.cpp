@@ -0,0 +1,339 @@
+#include "MemorySnapshot.h"
+#include "Process.h"
+
+#include <algorithm>
+
+namespace blackbone
+{
+
+// Max pages processed at once
+constexpr size_t MaxScanPages = 256;
+
+// NtQueryVirtualMemory(MemoryWorkingSetExList) entry
+struct WorkingSetExInfo
+{
+    uintptr_t VirtualAddress;
+    uintptr_t Flags;
+};
+
+constexpr uintptr_t WsValid = 0x1;
+constexpr uintptr_t WsShared = 0x8000;
+
+MemorySnapshot::MemorySnapshot( ProcessMemory& memory )
+    : _memory( memory )
+    , _pageSize( memory.core().native()->pageSize() )
+{
+}
+
+/// <summary>
+/// Capture range. Range is expanded to page boundaries, already captured pages are replaced
+/// </summary>
+/// <param name="address">Range start</param>
+/// <param name="size">Range size</param>
+/// <returns>Status code</returns>
+NTSTATUS MemorySnapshot::Capture( ptr_t address, size_t size )
+{
+    if (address == 0 || size == 0)
+        return STATUS_INVALID_PARAMETER;
+
+    ptr_t start = address & ~static_cast<ptr_t>(_pageSize - 1);
+    ptr_t end = (address + size + _pageSize - 1) & ~static_cast<ptr_t>(_pageSize - 1);
+
+    for (ptr_t ptr = start; ptr < end; ptr += MaxScanPages * _pageSize)
+    {
+        size_t count = static_cast<size_t>(std::min<ptr_t>( MaxScanPages, (end - ptr) / _pageSize ));
+        Scan( ptr, count, nullptr, true );
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Capture committed regions
+/// </summary>
+/// <param name="regions">Regions to capture, e.g. result of ProcessMemory::EnumRegions</param>
+/// <returns>Status code</returns>
+NTSTATUS MemorySnapshot::Capture( const std::vector<MEMORY_BASIC_INFORMATION64>& regions )
+{
+    for (const auto& region : regions)
+    {
+        if (region.State != MEM_COMMIT || (region.Protect & (PAGE_NOACCESS | PAGE_GUARD)))
+            continue;
+
+        Capture( region.BaseAddress, static_cast<size_t>(region.RegionSize) );
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Compare captured pages with current memory
+/// </summary>
+/// <param name="changes">Changed pages in ascending address order</param>
+/// <param name="update">Replace captured data with current one</param>
+/// <returns>Status code</returns>
+NTSTATUS MemorySnapshot::Diff( std::vector<PageChange>& changes, bool update /*= false*/ )
+{
+    changes.clear();
+
+    // Process runs of consecutive captured pages
+    for (auto iter = _pages.begin(); iter != _pages.end();)
+    {
+        ptr_t start = iter->first;
+        size_t count = 0;
+
+        for (; iter != _pages.end() && iter->first == start + count * _pageSize && count < MaxScanPages; ++iter)
+            count++;
+
+        Scan( start, count, &changes, update );
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Get captured page data
+/// </summary>
+/// <param name="address">Address inside page</param>
+/// <returns>Page data, nullptr if page wasn't captured or was unreadable</returns>
+const uint8_t* MemorySnapshot::page( ptr_t address ) const
+{
+    auto iter = _pages.find( address & ~static_cast<ptr_t>(_pageSize - 1) );
+    if (iter == _pages.end() || iter->second.slot == InvalidSlot)
+        return nullptr;
+
+    return slotData( iter->second.slot );
+}
+
+/// <summary>
+/// Drop all data
+/// </summary>
+void MemorySnapshot::Clear()
+{
+    _pages.clear();
+    _pool.clear();
+    _refs.clear();
+    _hashes.clear();
+    _freeSlots.clear();
+    _index.clear();
+    _slotCount = 0;
+}
+
+/// <summary>
+/// Capture or compare range of pages
+/// </summary>
+/// <param name="start">First page address</param>
+/// <param name="count">Page count</param>
+/// <param name="changes">If not null, receives changed pages. Missing pages are not reported</param>
+/// <param name="update">Store current data</param>
+void MemorySnapshot::Scan( ptr_t start, size_t count, std::vector<PageChange>* changes, bool update )
+{
+    std::vector<bool> shared, readable( count, false );
+    std::vector<PageEntry*> entries( count, nullptr );
+    std::vector<uint8_t> buffer( count * _pageSize );
+
+    QueryShared( start, count, shared );
+
+    for (size_t i = 0; i < count; i++)
+    {
+        auto iter = _pages.find( start + i * _pageSize );
+        if (iter != _pages.end())
+            entries[i] = &iter->second;
+    }
+
+    // Read all pages except shared image pages that were shared at capture time
+    for (size_t i = 0; i < count;)
+    {
+        auto skip = [&]( size_t idx ) { return entries[idx] && entries[idx]->shared && shared[idx]; };
+        if (skip( i ))
+        {
+            i++;
+            continue;
+        }
+
+        size_t first = i;
+        while (i < count && !skip( i ))
+            i++;
+
+        std::vector<bool> pageMap;
+        _memory.ReadSparse( start + first * _pageSize, (i - first) * _pageSize, buffer.data() + first * _pageSize, &pageMap );
+
+        for (size_t j = 0; j < pageMap.size() && first + j < count; j++)
+            readable[first + j] = pageMap[j];
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        ptr_t address = start + i * _pageSize;
+        const uint8_t* data = buffer.data() + i * _pageSize;
+        auto entry = entries[i];
+
+        // Page is unchanged by definition
+        if (entry && entry->shared && shared[i])
+            continue;
+
+        if (changes)
+        {
+            if (!entry)
+                continue;
+
+            bool changed = entry->slot == InvalidSlot
+                ? readable[i]
+                : !readable[i] || memcmp( slotData( entry->slot ), data, _pageSize ) != 0;
+
+            if (changed)
+                changes->emplace_back( PageChange{ address, readable[i] } );
+
+            // Captured data matches current one, page can be skipped while it stays shared
+            if (!changed)
+            {
+                entry->shared = readable[i] && shared[i];
+                continue;
+            }
+
+            if (!update)
+                continue;
+        }
+
+        if (!entry)
+            entry = &_pages[address];
+
+        if (entry->slot != InvalidSlot)
+            Release( entry->slot );
+
+        entry->slot = readable[i] ? Store( data ) : InvalidSlot;
+        entry->shared = readable[i] && shared[i];
+    }
+}
+
+/// <summary>
+/// Get shared state for range of pages
+/// </summary>
+/// <param name="start">First page address</param>
+/// <param name="count">Page count</param>
+/// <param name="shared">Per-page shared image flag</param>
+void MemorySnapshot::QueryShared( ptr_t start, size_t count, std::vector<bool>& shared )
+{
+    constexpr DWORD writable = PAGE_READWRITE | PAGE_EXECUTE_READWRITE;
+
+    shared.assign( count, false );
+
+    // Working set entry layout doesn't match native one
+    if (_memory.process()->barrier().type == wow_32_64)
+        return;
+
+    auto native = _memory.core().native();
+    const ptr_t end = start + count * _pageSize;
+    MEMORY_BASIC_INFORMATION64 mbi = { 0 };
+    std::vector<WorkingSetExInfo> info;
+
+    for (ptr_t ptr = start; ptr < end; ptr = mbi.BaseAddress + mbi.RegionSize)
+    {
+        if (!NT_SUCCESS( native->VirtualQueryExT( ptr, &mbi ) ) || mbi.RegionSize == 0)
+            break;
+
+        // Shared image page content is defined by image file. Truly shared writable sections are excluded
+        if (mbi.State != MEM_COMMIT || mbi.Type != MEM_IMAGE || (mbi.Protect & writable))
+            continue;
+
+        ptr_t regionEnd = std::min( end, mbi.BaseAddress + mbi.RegionSize );
+        size_t first = static_cast<size_t>((ptr - start) / _pageSize);
+        size_t pages = static_cast<size_t>((regionEnd - ptr) / _pageSize);
+
+        info.resize( pages );
+        for (size_t i = 0; i < pages; i++)
+        {
+            info[i].VirtualAddress = static_cast<uintptr_t>(ptr + i * _pageSize);
+            info[i].Flags = 0;
+        }
+
+        if (!NT_SUCCESS( native->VirtualQueryExT( 0, MemoryWorkingSetExList, info.data(), info.size() * sizeof( info[0] ) ) ))
+            continue;
+
+        for (size_t i = 0; i < pages; i++)
+            shared[first + i] = (info[i].Flags & (WsValid | WsShared)) == (WsValid | WsShared);
+    }
+}
+
+/// <summary>
+/// Store page data, reusing identical page if present
+/// </summary>
+/// <param name="data">Page data</param>
+/// <returns>Page slot</returns>
+uint32_t MemorySnapshot::Store( const uint8_t* data )
+{
+    auto hash = Hash( data );
+    auto range = _index.equal_range( hash );
+    for (auto iter = range.first; iter != range.second; ++iter)
+    {
+        if (memcmp( slotData( iter->second ), data, _pageSize ) == 0)
+        {
+            _refs[iter->second]++;
+            return iter->second;
+        }
+    }
+
+    uint32_t slot = 0;
+    if (!_freeSlots.empty())
+    {
+        slot = _freeSlots.back();
+        _freeSlots.pop_back();
+    }
+    else
+    {
+        slot = _slotCount++;
+        _pool.resize( static_cast<size_t>(_slotCount) * _pageSize );
+        _refs.emplace_back( 0 );
+        _hashes.emplace_back( 0 );
+    }
+
+    memcpy( slotData( slot ), data, _pageSize );
+    _refs[slot] = 1;
+    _hashes[slot] = hash;
+    _index.emplace( hash, slot );
+
+    return slot;
+}
+
+/// <summary>
+/// Release page slot reference
+/// </summary>
+/// <param name="slot">Page slot</param>
+void MemorySnapshot::Release( uint32_t slot )
+{
+    if (--_refs[slot] != 0)
+        return;
+
+    auto range = _index.equal_range( _hashes[slot] );
+    for (auto iter = range.first; iter != range.second; ++iter)
+    {
+        if (iter->second == slot)
+        {
+            _index.erase( iter );
+            break;
+        }
+    }
+
+    _freeSlots.emplace_back( slot );
+}
+
+/// <summary>
+/// Page data hash
+/// </summary>
+/// <param name="data">Page data</param>
+/// <returns>Hash value</returns>
+uint64_t MemorySnapshot::Hash( const uint8_t* data ) const
+{
+    // FNV-1a over 64-bit words
+    uint64_t hash = 0xcbf29ce484222325ull;
+    auto words = reinterpret_cast<const uint64_t*>(data);
+    for (size_t i = 0; i < _pageSize / sizeof( uint64_t ); i++)
+    {
+        hash ^= words[i];
+        hash *= 0x100000001b3ull;
+    }
+
+    return hash;
+}
+
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include "../Include/Winheaders.h"
+#include "../Include/Types.h"
+
+#include <map>
+#include <vector>
+#include <unordered_map>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Page-granular snapshot of process memory.
+/// Identical pages are stored once, Diff re-reads captured pages and reports changed ones.
+/// Shared image pages that were not copied-on-write since capture are skipped without reading.
+/// </summary>
+class MemorySnapshot
+{
+public:
+    /// <summary>
+    /// Changed page
+    /// </summary>
+    struct PageChange
+    {
+        ptr_t address;      // Page address
+        bool readable;      // false if page can't be read anymore
+    };
+
+public:
+    BLACKBONE_API MemorySnapshot( class ProcessMemory& memory );
+    BLACKBONE_API ~MemorySnapshot() = default;
+
+    /// <summary>
+    /// Capture range. Range is expanded to page boundaries, already captured pages are replaced
+    /// </summary>
+    /// <param name="address">Range start</param>
+    /// <param name="size">Range size</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS Capture( ptr_t address, size_t size );
+
+    /// <summary>
+    /// Capture committed regions
+    /// </summary>
+    /// <param name="regions">Regions to capture, e.g. result of ProcessMemory::EnumRegions</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS Capture( const std::vector<MEMORY_BASIC_INFORMATION64>& regions );
+
+    /// <summary>
+    /// Compare captured pages with current memory
+    /// </summary>
+    /// <param name="changes">Changed pages in ascending address order</param>
+    /// <param name="update">Replace captured data with current one</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS Diff( std::vector<PageChange>& changes, bool update = false );
+
+    /// <summary>
+    /// Get captured page data
+    /// </summary>
+    /// <param name="address">Address inside page</param>
+    /// <returns>Page data, nullptr if page wasn't captured or was unreadable</returns>
+    BLACKBONE_API const uint8_t* page( ptr_t address ) const;
+
+    /// <summary>
+    /// Drop all data
+    /// </summary>
+    BLACKBONE_API void Clear();
+
+    /// <summary>
+    /// Number of captured pages
+    /// </summary>
+    /// <returns>Page count</returns>
+    BLACKBONE_API inline size_t pages() const { return _pages.size(); }
+
+    /// <summary>
+    /// Number of stored unique pages
+    /// </summary>
+    /// <returns>Page count</returns>
+    BLACKBONE_API inline size_t uniquePages() const { return _slotCount - _freeSlots.size(); }
+
+private:
+    static constexpr uint32_t InvalidSlot = 0xFFFFFFFF;
+
+    struct PageEntry
+    {
+        uint32_t slot = InvalidSlot;    // Data slot, InvalidSlot if page was unreadable
+        bool shared = false;            // Shared image page, unchanged while it stays shared
+    };
+
+    /// <summary>
+    /// Capture or compare range of pages
+    /// </summary>
+    /// <param name="start">First page address</param>
+    /// <param name="count">Page count</param>
+    /// <param name="changes">If not null, receives changed pages. Missing pages are not reported</param>
+    /// <param name="update">Store current data</param>
+    void Scan( ptr_t start, size_t count, std::vector<PageChange>* changes, bool update );
+
+    /// <summary>
+    /// Get shared state for range of pages
+    /// </summary>
+    /// <param name="start">First page address</param>
+    /// <param name="count">Page count</param>
+    /// <param name="shared">Per-page shared image flag</param>
+    void QueryShared( ptr_t start, size_t count, std::vector<bool>& shared );
+
+    /// <summary>
+    /// Store page data, reusing identical page if present
+    /// </summary>
+    /// <param name="data">Page data</param>
+    /// <returns>Page slot</returns>
+    uint32_t Store( const uint8_t* data );
+
+    /// <summary>
+    /// Release page slot reference
+    /// </summary>
+    /// <param name="slot">Page slot</param>
+    void Release( uint32_t slot );
+
+    /// <summary>
+    /// Page data hash
+    /// </summary>
+    /// <param name="data">Page data</param>
+    /// <returns>Hash value</returns>
+    uint64_t Hash( const uint8_t* data ) const;
+
+    inline uint8_t* slotData( uint32_t slot ) { return _pool.data() + static_cast<size_t>(slot) * _pageSize; }
+    inline const uint8_t* slotData( uint32_t slot ) const { return _pool.data() + static_cast<size_t>(slot) * _pageSize; }
+
+private:
+    class ProcessMemory& _memory;                           // Target memory
+    size_t _pageSize = 0x1000;                              // Target page size
+    std::map<ptr_t, PageEntry> _pages;                      // Captured pages
+    std::vector<uint8_t> _pool;                             // Unique page data
+    std::vector<uint32_t> _refs;                            // Slot reference counts
+    std::vector<uint64_t> _hashes;                          // Slot data hashes
+    std::vector<uint32_t> _freeSlots;                       // Unused slots
+    std::unordered_multimap<uint64_t, uint32_t> _index;     // Slots by data hash
+    uint32_t _slotCount = 0;                                // Allocated slots
+};
+
+}
@@ -96,10 +96,33 @@ public:
     /// <param name="proc">Target process</param>
     /// <param name="base">Base address</param>
     /// <param name="offsets">Offsets</param>
-    multi_ptr_ex( Process* proc, uintptr_t base = 0, const vecOffsets& offsets = vecOffsets() )
+    /// <param name="cache">
+    /// Cache resolved target pointer until next ProcessMemory::BeginEpoch call.
+    /// Only the object itself is read on every access while chain stays valid
+    /// </param>
+    multi_ptr_ex( Process* proc, uintptr_t base = 0, const vecOffsets& offsets = vecOffsets(), bool cache = false )
         : _proc( proc )
+        , _cache( cache )
         , multi_ptr( base, offsets ) { }
 
+    /// <summary>
+    /// Enable or disable target pointer cache
+    /// </summary>
+    /// <param name="enable">Cache state</param>
+    void enable_cache( bool enable )
+    {
+        _cache = enable;
+        invalidate();
+    }
+
+    /// <summary>
+    /// Drop cached target pointer. Chain will be resolved again on next access
+    /// </summary>
+    void invalidate()
+    {
+        _cachedPtr = 0;
+    }
+
     /// <summary>
     /// Commit changed object into process
     /// </summary>
@@ -124,7 +147,19 @@ private:
         if (ptr == 0)
             return nullptr;
 
-        return NT_SUCCESS( _proc->memory().Read( ptr, sizeof( _data ), &_data ) ) ? &_data : nullptr;
+        if (NT_SUCCESS( _proc->memory().Read( ptr, sizeof( _data ), &_data ) ))
+            return &_data;
+
+        // Cached chain may be stale, resolve it again
+        if (_cache)
+        {
+            invalidate();
+            ptr = get_ptr();
+            if (ptr != 0 && NT_SUCCESS( _proc->memory().Read( ptr, sizeof( _data ), &_data ) ))
+                return &_data;
+        }
+
+        return nullptr;
     }
     
     /// <summary>
@@ -132,6 +167,25 @@ private:
     /// </summary>
     /// <returns>Pointer value or 0 if chain is invalid</returns>
     uintptr_t get_ptr()
+    {
+        if (_cache && _cachedPtr != 0 && _cachedEpoch == _proc->memory().epoch())
+            return _cachedPtr;
+
+        uintptr_t ptr = resolve();
+        if (_cache && ptr != 0)
+        {
+            _cachedPtr = ptr;
+            _cachedEpoch = _proc->memory().epoch();
+        }
+
+        return ptr;
+    }
+
+    /// <summary>
+    /// Walk pointer chain
+    /// </summary>
+    /// <returns>Pointer value or 0 if chain is invalid</returns>
+    uintptr_t resolve()
     {
         uintptr_t ptr = _base;
         if (!NT_SUCCESS( _proc->memory().Read( ptr, ptr ) ))
@@ -156,5 +210,8 @@ private:
 private:
     Process* _proc = nullptr;       // Target process
     type _data;                     // Local object copy
+    bool _cache = false;            // Target pointer cache is enabled
+    uintptr_t _cachedPtr = 0;       // Cached target pointer
+    uint64_t _cachedEpoch = 0;      // Memory epoch of cached pointer
 };
 }
\ No newline at end of file
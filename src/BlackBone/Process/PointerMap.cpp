@@ -0,0 +1,334 @@
+#include "PointerMap.h"
+#include "Process.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <unordered_set>
+
+namespace blackbone
+{
+
+namespace
+{
+
+/// <summary>
+/// Committed address range
+/// </summary>
+struct ValidRange
+{
+    ptr_t start;
+    ptr_t end;
+};
+
+/// <summary>
+/// Found pointer
+/// </summary>
+struct PointerEntry
+{
+    ptr_t value;
+    ptr_t location;
+
+    bool operator <( const PointerEntry& other ) const
+    {
+        return value < other.value || (value == other.value && location < other.location);
+    }
+};
+
+/// <summary>
+/// Collect aligned values pointing into committed memory
+/// </summary>
+/// <param name="data">Chunk data</param>
+/// <param name="size">Chunk size</param>
+/// <param name="base">Chunk address</param>
+/// <param name="valid">Committed ranges, ascending</param>
+/// <param name="out">Found pointers</param>
+template<typename T>
+void CollectPointers( const uint8_t* data, size_t size, ptr_t base, const std::vector<ValidRange>& valid, std::vector<PointerEntry>& out )
+{
+    const ptr_t low = valid.front().start;
+    const ptr_t high = valid.back().end;
+    auto pValues = reinterpret_cast<const T*>(data);
+
+    // Pointers tend to cluster, last hit range is checked before binary search
+    size_t last = 0;
+
+    for (size_t i = 0; i < size / sizeof( T ); i++)
+    {
+        const ptr_t value = pValues[i];
+        if (value < low || value >= high)
+            continue;
+
+        if (value < valid[last].start || value >= valid[last].end)
+        {
+            auto iter = std::upper_bound( valid.begin(), valid.end(), value, []( ptr_t v, const ValidRange& r ) { return v < r.start; } );
+            if (iter == valid.begin() || value >= std::prev( iter )->end)
+                continue;
+
+            last = std::prev( iter ) - valid.begin();
+        }
+
+        out.push_back( { value, base + i * sizeof( T ) } );
+    }
+}
+
+}
+
+PointerMap::PointerMap( Process& process )
+    : _process( process )
+{
+}
+
+/// <summary>
+/// Scan target memory and build index, previous index is dropped
+/// </summary>
+/// <param name="threads">Number of scanning threads, 0 - use all CPU cores</param>
+/// <param name="filter">Regions to collect pointers from, pointed memory may be anywhere</param>
+/// <returns>Status code</returns>
+NTSTATUS PointerMap::Build( uint32_t threads /*= 0*/, const RegionFilter& filter /*= RegionFilter()*/ )
+{
+    constexpr size_t chunkSize = 4 * 1024 * 1024;  // 4 MB
+
+    struct WorkItem
+    {
+        ptr_t base;     // Chunk address
+        size_t size;    // Chunk size
+    };
+
+    Reset();
+
+    auto& regionMap = _process.memory().regionMap();
+    NTSTATUS status = regionMap.Refresh();
+    if (!NT_SUCCESS( status ))
+        return status;
+
+    const bool x86 = _process.barrier().targetWow64 || _process.barrier().x86OS;
+    const size_t ptrSize = x86 ? sizeof( uint32_t ) : sizeof( uint64_t );
+
+    std::vector<ValidRange> valid;
+    std::vector<WorkItem> items;
+
+    for (const auto& mbi : regionMap.regions())
+    {
+        if (mbi.State != MEM_COMMIT)
+            continue;
+
+        const ptr_t regionEnd = mbi.BaseAddress + mbi.RegionSize;
+        if (!valid.empty() && valid.back().end == mbi.BaseAddress)
+            valid.back().end = regionEnd;
+        else
+            valid.push_back( { mbi.BaseAddress, regionEnd } );
+
+        if (mbi.Protect & PAGE_GUARD)
+            continue;
+
+        ptr_t start = mbi.BaseAddress, size = 0;
+        if (!filter.Match( mbi, start, size ))
+            continue;
+
+        const ptr_t end = (start + size) & ~static_cast<ptr_t>(ptrSize - 1);
+        start = (start + ptrSize - 1) & ~static_cast<ptr_t>(ptrSize - 1);
+
+        for (ptr_t base = start; base < end; base += chunkSize)
+            items.push_back( { base, static_cast<size_t>(std::min<ptr_t>( chunkSize, end - base )) } );
+    }
+
+    if (items.empty() || valid.empty())
+        return STATUS_NOT_FOUND;
+
+    for (const auto& mod : _process.modules().GetAllModules())
+        _modules.emplace_back( mod.second );
+
+    std::sort( _modules.begin(), _modules.end(), []( const ModuleDataPtr& l, const ModuleDataPtr& r ) { return l->baseAddress < r->baseAddress; } );
+
+    if (threads == 0)
+        threads = std::max( std::thread::hardware_concurrency(), 1u );
+
+    threads = std::min( threads, static_cast<uint32_t>(items.size()) );
+
+    std::vector<std::vector<PointerEntry>> results( items.size() );
+    std::atomic<size_t> next( 0 );
+
+    auto worker = [&]()
+    {
+        std::vector<uint8_t> buf;
+
+        for (size_t idx = next++; idx < items.size(); idx = next++)
+        {
+            buf.resize( items[idx].size );
+            if (!NT_SUCCESS( _process.memory().Read( items[idx].base, items[idx].size, buf.data() ) ))
+                continue;
+
+            if (x86)
+                CollectPointers<uint32_t>( buf.data(), buf.size(), items[idx].base, valid, results[idx] );
+            else
+                CollectPointers<uint64_t>( buf.data(), buf.size(), items[idx].base, valid, results[idx] );
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (uint32_t i = 0; i < threads; i++)
+        pool.emplace_back( worker );
+
+    for (auto& thread : pool)
+        thread.join();
+
+    size_t total = 0;
+    for (const auto& found : results)
+        total += found.size();
+
+    std::vector<PointerEntry> entries;
+    entries.reserve( total );
+    for (auto& found : results)
+    {
+        entries.insert( entries.end(), found.begin(), found.end() );
+        std::vector<PointerEntry>().swap( found );
+    }
+
+    std::sort( entries.begin(), entries.end() );
+
+    // Value -> locations, locations of one value are stored contiguously
+    _locations.reserve( entries.size() );
+    for (const auto& entry : entries)
+    {
+        if (_values.empty() || _values.back() != entry.value)
+        {
+            _values.emplace_back( entry.value );
+            _starts.emplace_back( static_cast<uint32_t>(_locations.size()) );
+        }
+
+        _locations.emplace_back( entry.location );
+    }
+
+    _starts.emplace_back( static_cast<uint32_t>(_locations.size()) );
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Get locations holding pointer value
+/// </summary>
+/// <param name="value">Pointer value</param>
+/// <returns>Locations in ascending order</returns>
+std::vector<ptr_t> PointerMap::Find( ptr_t value ) const
+{
+    auto iter = std::lower_bound( _values.begin(), _values.end(), value );
+    if (iter == _values.end() || *iter != value)
+        return std::vector<ptr_t>();
+
+    const size_t idx = iter - _values.begin();
+    return std::vector<ptr_t>( _locations.begin() + _starts[idx], _locations.begin() + _starts[idx + 1] );
+}
+
+/// <summary>
+/// Find static chains leading to address.
+/// Breadth-first search backwards from target, chains are ordered by depth.
+/// Base pointer must reside inside a module loaded at the time of Build
+/// </summary>
+/// <param name="target">Target address</param>
+/// <param name="out">Found chains</param>
+/// <param name="options">Search bounds</param>
+/// <returns>Status code, STATUS_NOT_FOUND if no chains were found</returns>
+NTSTATUS PointerMap::FindChains(
+    ptr_t target,
+    std::vector<PointerChain>& out,
+    const PointerSearchOptions& options /*= PointerSearchOptions()*/
+    ) const
+{
+    // Location that must be reached. Value stored in it plus offset gives parent location
+    struct Node
+    {
+        ptr_t address;
+        size_t parent;
+        intptr_t offset;
+        bool base;      // Chain end, not expanded
+    };
+
+    constexpr size_t root = static_cast<size_t>(-1);
+
+    out.clear();
+    if (_values.empty())
+        return STATUS_NOT_FOUND;
+
+    std::vector<Node> nodes{ { target, root, 0, false } };
+    std::unordered_set<ptr_t> visited{ target };
+    size_t levelStart = 0, levelEnd = 1;
+
+    for (uint32_t depth = 1; depth <= options.maxDepth && levelStart < levelEnd; depth++)
+    {
+        size_t expanded = 0;
+
+        for (size_t n = levelStart; n < levelEnd && expanded < options.maxNodes; n++)
+        {
+            if (nodes[n].base)
+                continue;
+
+            const ptr_t address = nodes[n].address;
+            const ptr_t low = address > options.maxOffset ? address - options.maxOffset : 0;
+
+            // Every pointer whose value is within max offset below the address
+            for (auto iter = std::lower_bound( _values.begin(), _values.end(), low ); iter != _values.end() && *iter <= address; ++iter)
+            {
+                const size_t idx = iter - _values.begin();
+                for (size_t i = _starts[idx]; i < _starts[idx + 1] && expanded < options.maxNodes; i++)
+                {
+                    const ptr_t location = _locations[i];
+                    if (!visited.insert( location ).second)
+                        continue;
+
+                    auto mod = StaticModule( location );
+                    nodes.push_back( { location, n, static_cast<intptr_t>(address - *iter), mod != nullptr } );
+
+                    if (!mod)
+                    {
+                        expanded++;
+                        continue;
+                    }
+
+                    // Static base found, offsets go from base towards target
+                    PointerChain chain;
+                    chain.module = mod;
+                    chain.base = location;
+                    for (size_t k = nodes.size() - 1; k != 0; k = nodes[k].parent)
+                        chain.offsets.emplace_back( nodes[k].offset );
+
+                    out.emplace_back( std::move( chain ) );
+                    if (out.size() >= options.maxResults)
+                        return STATUS_SUCCESS;
+                }
+            }
+        }
+
+        levelStart = levelEnd;
+        levelEnd = nodes.size();
+    }
+
+    return out.empty() ? STATUS_NOT_FOUND : STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Drop index
+/// </summary>
+void PointerMap::Reset()
+{
+    _values.clear();
+    _starts.clear();
+    _locations.clear();
+    _modules.clear();
+}
+
+/// <summary>
+/// Find module containing address
+/// </summary>
+/// <param name="address">Address</param>
+/// <returns>Module or nullptr</returns>
+ModuleDataPtr PointerMap::StaticModule( ptr_t address ) const
+{
+    auto iter = std::upper_bound( _modules.begin(), _modules.end(), address, []( ptr_t v, const ModuleDataPtr& mod ) { return v < mod->baseAddress; } );
+    if (iter == _modules.begin())
+        return nullptr;
+
+    --iter;
+    return address < (*iter)->baseAddress + (*iter)->size ? *iter : nullptr;
+}
+
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "../Include/Winheaders.h"
+#include "../Include/Types.h"
+#include "../Patterns/PatternSearch.h"
+
+#include <vector>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Static pointer chain, base and offsets have multi_ptr layout:
+/// multi_ptr_ex<T>( &process, chain.base, chain.offsets )
+/// </summary>
+struct PointerChain
+{
+    ModuleDataPtr module;           // Module holding base pointer
+    ptr_t base = 0;                 // Base pointer address
+    std::vector<intptr_t> offsets;  // Offsets applied after every dereference
+
+    /// <summary>
+    /// Base pointer offset from module base
+    /// </summary>
+    inline ptr_t rva() const { return module ? base - module->baseAddress : base; }
+};
+
+/// <summary>
+/// Chain search bounds
+/// </summary>
+struct PointerSearchOptions
+{
+    uint32_t maxDepth = 4;          // Max number of dereferences
+    uint32_t maxOffset = 0x1000;    // Max offset added to pointer value at any level
+    size_t maxResults = 100;        // Search stops after this number of chains
+    size_t maxNodes = 100000;       // Max number of addresses expanded at one level
+};
+
+/// <summary>
+/// Index of target pointers.
+/// All aligned pointer-sized values that point into committed memory are collected by parallel scan
+/// and stored sorted by value, with locations of every value packed into one array.
+/// </summary>
+class PointerMap
+{
+public:
+    BLACKBONE_API PointerMap( class Process& process );
+    BLACKBONE_API ~PointerMap() = default;
+
+    /// <summary>
+    /// Scan target memory and build index, previous index is dropped
+    /// </summary>
+    /// <param name="threads">Number of scanning threads, 0 - use all CPU cores</param>
+    /// <param name="filter">Regions to collect pointers from, pointed memory may be anywhere</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS Build( uint32_t threads = 0, const RegionFilter& filter = RegionFilter() );
+
+    /// <summary>
+    /// Get locations holding pointer value
+    /// </summary>
+    /// <param name="value">Pointer value</param>
+    /// <returns>Locations in ascending order</returns>
+    BLACKBONE_API std::vector<ptr_t> Find( ptr_t value ) const;
+
+    /// <summary>
+    /// Find static chains leading to address.
+    /// Breadth-first search backwards from target, chains are ordered by depth.
+    /// Base pointer must reside inside a module loaded at the time of Build
+    /// </summary>
+    /// <param name="target">Target address</param>
+    /// <param name="out">Found chains</param>
+    /// <param name="options">Search bounds</param>
+    /// <returns>Status code, STATUS_NOT_FOUND if no chains were found</returns>
+    BLACKBONE_API NTSTATUS FindChains(
+        ptr_t target,
+        std::vector<PointerChain>& out,
+        const PointerSearchOptions& options = PointerSearchOptions()
+        ) const;
+
+    /// <summary>
+    /// Drop index
+    /// </summary>
+    BLACKBONE_API void Reset();
+
+    /// <summary>
+    /// Number of indexed pointers
+    /// </summary>
+    BLACKBONE_API inline size_t size() const { return _locations.size(); }
+
+    /// <summary>
+    /// Number of distinct pointer values
+    /// </summary>
+    BLACKBONE_API inline size_t values() const { return _values.size(); }
+
+private:
+    /// <summary>
+    /// Find module containing address
+    /// </summary>
+    /// <param name="address">Address</param>
+    /// <returns>Module or nullptr</returns>
+    ModuleDataPtr StaticModule( ptr_t address ) const;
+
+    PointerMap( const PointerMap& ) = delete;
+    PointerMap& operator =( const PointerMap& ) = delete;
+
+private:
+    class Process& _process;
+    std::vector<ptr_t> _values;         // Distinct pointer values, ascending
+    std::vector<uint32_t> _starts;      // Index of first location of every value, plus end marker
+    std::vector<ptr_t> _locations;      // Pointer locations grouped by value, ascending within group
+    std::vector<ModuleDataPtr> _modules;// Modules by base address
+};
+
+}
@@ -1,8 +1,12 @@
 #include "Process.h"
 #include "../Misc/NameResolve.h"
 #include "../Misc/DynImport.h"
+#include "../DriverControl/DriverControl.h"
+#include "../ManualMap/ImageBundle.h"
 
 #include <memory>
+#include <array>
+#include <mutex>
 
 namespace blackbone
 {
@@ -14,8 +18,9 @@ Process::Process()
     , _modules( *this )
     , _memory( this )
     , _threads( _core )
-    , _hooks( _memory )
+    , _breakpoints( _core, _threads )
     , _localHooks( *this )
+    , _hooks( _memory )
     , _remote( *this )
     , _mmap( *this )
     , _nativeLdr( *this )
@@ -33,22 +38,78 @@ Process::~Process(void)
 /// </summary>
 /// <param name="pid">Process ID</param>
 /// <param name="access">Access mask</param>
+/// <param name="directSyscalls">Issue memory and query syscalls directly instead of calling ntdll. Native x64 host only</param>
 /// <returns>Status code</returns>
-NTSTATUS Process::Attach( DWORD pid, DWORD access /*= DEFAULT_ACCESS_P*/ )
+NTSTATUS Process::Attach( DWORD pid, DWORD access /*= DEFAULT_ACCESS_P*/, bool directSyscalls /*= false*/ )
 {
     Detach();
-    return _core.Open( pid, access );
+    return _core.Open( pid, access, directSyscalls );
 }
 
 /// <summary>
 /// Attach to existing process
 /// </summary>
 /// <param name="pid">Process handle</param>
+/// <param name="directSyscalls">Issue memory and query syscalls directly instead of calling ntdll. Native x64 host only</param>
 /// <returns>Status code</returns>
-NTSTATUS Process::Attach( HANDLE hProc )
+NTSTATUS Process::Attach( HANDLE hProc, bool directSyscalls /*= false*/ )
 {
     Detach();
-    return _core.Open( hProc );
+    return _core.Open( hProc, directSyscalls );
+}
+
+/// <summary>
+/// Attach to copy-on-write clone of process address space
+/// </summary>
+/// <param name="pid">Process ID</param>
+/// <param name="directSyscalls">Issue memory and query syscalls directly instead of calling ntdll. Native x64 host only</param>
+/// <returns>Status code</returns>
+NTSTATUS Process::AttachSnapshot( DWORD pid, bool directSyscalls /*= false*/ )
+{
+    Detach();
+
+    auto pCapture = GET_IMPORT( PssCaptureSnapshot );
+    auto pQuery = GET_IMPORT( PssQuerySnapshot );
+    if (!pCapture || !pQuery)
+        return STATUS_NOT_SUPPORTED;
+
+    // Pss routines return Win32 error codes
+    auto toStatus = []( DWORD error )
+    {
+        return error == ERROR_SUCCESS ? STATUS_SUCCESS : static_cast<NTSTATUS>(0xC0070000 | (error & 0xFFFF));
+    };
+
+    auto hProcess = Handle( OpenProcess( PROCESS_CREATE_PROCESS | PROCESS_QUERY_INFORMATION | PROCESS_VM_READ | PROCESS_DUP_HANDLE, FALSE, pid ) );
+    if (!hProcess)
+        return LastNtStatus();
+
+    NTSTATUS status = toStatus( pCapture( hProcess, PSS_CAPTURE_VA_CLONE, 0, &_snapshot ) );
+    if (!NT_SUCCESS( status ))
+    {
+        _snapshot = nullptr;
+        return status;
+    }
+
+    // Clone handle is owned by snapshot, core gets its own read-only duplicate
+    PSS_VA_CLONE_INFORMATION info = { 0 };
+    HANDLE hClone = NULL;
+
+    status = toStatus( pQuery( _snapshot, PSS_QUERY_VA_CLONE_INFORMATION, &info, sizeof( info ) ) );
+    if (NT_SUCCESS( status ) && !DuplicateHandle(
+        GetCurrentProcess(), info.VaCloneHandle, GetCurrentProcess(), &hClone,
+        PROCESS_QUERY_INFORMATION | PROCESS_QUERY_LIMITED_INFORMATION | PROCESS_VM_READ, FALSE, 0
+        ))
+    {
+        status = LastNtStatus();
+    }
+
+    if (NT_SUCCESS( status ))
+        status = _core.Open( hClone, directSyscalls );
+
+    if (!NT_SUCCESS( status ))
+        Detach();
+
+    return status;
 }
 
 /// <summary>
@@ -56,11 +117,12 @@ NTSTATUS Process::Attach( HANDLE hProc )
 /// </summary>
 /// <param name="name">Process name</param>
 /// <param name="access">Access mask</param>
+/// <param name="directSyscalls">Issue memory and query syscalls directly instead of calling ntdll. Native x64 host only</param>
 /// <returns>Status code</returns>
-NTSTATUS Process::Attach( const wchar_t* name, DWORD access /*= DEFAULT_ACCESS_P*/ )
+NTSTATUS Process::Attach( const wchar_t* name, DWORD access /*= DEFAULT_ACCESS_P*/, bool directSyscalls /*= false*/ )
 {
     auto pids = EnumByName( name );
-    return pids.empty() ? STATUS_NOT_FOUND : Attach( pids.front(), access );
+    return pids.empty() ? STATUS_NOT_FOUND : Attach( pids.front(), access, directSyscalls );
 }
 
 /// <summary>
@@ -119,6 +181,85 @@ NTSTATUS Process::CreateAndAttach(
     return status;
 }
 
+/// <summary>
+/// Bundle prepared while target process is being created
+/// </summary>
+struct LaunchBundle
+{
+    std::wstring path;                      // Image path
+    eLoadFlags flags;                       // Mapping flags
+    ImageBundle bundle;                     // Prepared image
+    NTSTATUS status = STATUS_UNSUCCESSFUL;  // Build status
+};
+
+static DWORD CALLBACK BuildLaunchBundle( LPVOID lpParam )
+{
+    auto pJob = reinterpret_cast<LaunchBundle*>(lpParam);
+
+    // Payload doesn't depend on new process, resolve it against our own system images
+    Process self;
+    pJob->status = self.Attach( GetCurrentProcessId() );
+    if (NT_SUCCESS( pJob->status ))
+        pJob->status = self.mmap().BuildBundle( pJob->path, pJob->bundle, pJob->flags );
+
+    return 0;
+}
+
+/// <summary>
+/// Create new process, attach to it and manually map image into it.
+/// Image bundle is built on a worker thread while process is created and initialized,
+/// so only writing and initialization remain once process is ready.
+/// Bundle is resolved against current process modules, if it can't be built image is mapped from file
+/// </summary>
+/// <param name="path">Executable path</param>
+/// <param name="imagePath">Image to map</param>
+/// <param name="flags">Image mapping flags</param>
+/// <param name="cmdLine">Process command line</param>
+/// <param name="currentDir">Startup directory</param>
+/// <param name="pStartup">Additional startup params</param>
+/// <param name="resume">Resume main thread after successful mapping. Process stays suspended if mapping fails</param>
+/// <param name="pStats">Optional per phase mapping statistics</param>
+/// <returns>Mapped image info</returns>
+call_result_t<ModuleDataPtr> Process::CreateAndMap(
+    const std::wstring& path,
+    const std::wstring& imagePath,
+    eLoadFlags flags /*= ManualImports*/,
+    const std::wstring& cmdLine /*= L""*/,
+    const wchar_t* currentDir /*= nullptr*/,
+    STARTUPINFOW* pStartup /*= nullptr*/,
+    bool resume /*= true*/,
+    MapStats* pStats /*= nullptr*/
+    )
+{
+    LaunchBundle job;
+    job.path = imagePath;
+    job.flags = flags;
+
+    Handle hThread( CreateThread( NULL, 0, &BuildLaunchBundle, &job, 0, NULL ) );
+
+    // Suspended process is initialized by second thread, main thread stays untouched until image is mapped
+    auto status = CreateAndAttach( path, true, true, cmdLine, currentDir, pStartup );
+
+    if (hThread)
+        WaitForSingleObject( hThread, INFINITE );
+
+    if (!NT_SUCCESS( status ))
+        return status;
+
+    auto result = NT_SUCCESS( job.status ) && !job.bundle.empty()
+        ? _mmap.MapImage( job.bundle, flags, nullptr, nullptr, nullptr, pStats )
+        : _mmap.MapImage( imagePath, flags, nullptr, nullptr, nullptr, pStats );
+
+    if (result && resume)
+    {
+        auto mainThread = _threads.getMain();
+        if (mainThread)
+            mainThread->Resume();
+    }
+
+    return result;
+}
+
 /// <summary>
 /// Detach form current process, if any
 /// </summary>
@@ -126,13 +267,26 @@ NTSTATUS Process::CreateAndAttach(
 NTSTATUS Process::Detach()
 {
     // Reset data
+    _localHooks.reset();
     _memory.reset();
     _modules.reset();
     _remote.reset();
     _mmap.reset();
     _hooks.reset();
+    _breakpoints.reset();
+    _threads.reset();
+
+    // Code and data blocks are returned by components above
+    _memory.codeHeap().reset();
+    _memory.heap().reset();
     _core.Close();
 
+    if (_snapshot)
+    {
+        SAFE_CALL( PssFreeSnapshot, GetCurrentProcess(), _snapshot );
+        _snapshot = nullptr;
+    }
+
     return STATUS_SUCCESS;
 }
 
@@ -193,126 +347,204 @@ NTSTATUS Process::Terminate( uint32_t code /*= 0*/ )
 }
 
 /// <summary>
-/// Enumerate all open handles
+/// Snapshot of operation counters. Counters are updated atomically, snapshot may be taken from any thread
 /// </summary>
-/// <returns>Found handles or status code</returns>
-call_result_t<std::vector<HandleInfo>> Process::EnumHandles()
+/// <returns>Counters snapshot</returns>
+ProcessMetrics Process::metrics()
 {
-    ULONG bufSize = 0x10000;
-    uint8_t* buffer = (uint8_t*)VirtualAlloc( NULL, bufSize, MEM_COMMIT, PAGE_READWRITE );
-    ULONG returnLength = 0;
-    std::vector<HandleInfo> handles;
+    ProcessMetrics result;
+    if (_core.native() != nullptr)
+        result.native = _core.native()->counters();
 
-    // Query handle list
-    NTSTATUS status = SAFE_NATIVE_CALL( NtQuerySystemInformation, SystemHandleInformation, buffer, bufSize, &returnLength );
-    while (status == STATUS_INFO_LENGTH_MISMATCH)
+    result.memory = _memory.counters();
+    result.rpcCalls = _remote.calls();
+    result.debugEvents = _hooks.debugEvents();
+    result.driverRequests = Driver().ioctls();
+
+    return result;
+}
+
+/// <summary>
+/// Get handle copy inside current process
+/// </summary>
+/// <returns>Duplicated handle, nullptr on failure</returns>
+HANDLE HandleEntry::local()
+{
+    if (!_duplicated)
     {
-        bufSize *= 2;
-        VirtualFree( buffer, 0, MEM_RELEASE );
-        buffer = (uint8_t*)VirtualAlloc( NULL, bufSize, MEM_COMMIT, PAGE_READWRITE );
+        _duplicated = true;
+
+        HANDLE hLocal = nullptr;
+        NTSTATUS status = SAFE_NATIVE_CALL(
+            NtDuplicateObject, _hProcess, handle(), GetCurrentProcess(), &hLocal, 0, 0, DUPLICATE_SAME_ACCESS
+            );
 
-        status = SAFE_NATIVE_CALL( NtQuerySystemInformation, SystemHandleInformation, buffer, bufSize, &returnLength );
+        if (NT_SUCCESS( status ))
+            _local = hLocal;
     }
 
-    if (!NT_SUCCESS( status ))
+    return _local;
+}
+
+/// <summary>
+/// Get object name
+/// </summary>
+/// <returns>Object name, empty if object is unnamed or name can't be queried</returns>
+const std::wstring& HandleEntry::name()
+{
+    if (_nameQueried || !local())
+        return _name;
+
+    _nameQueried = true;
+
+    ULONG returnLength = 0;
+    std::vector<uint8_t> buf( 0x1000 );
+    NTSTATUS status = SAFE_NATIVE_CALL( NtQueryObject, _local, ObjectNameInformation, buf.data(), static_cast<ULONG>(buf.size()), &returnLength );
+    if (!NT_SUCCESS( status ) && returnLength > buf.size())
     {
-        VirtualFree( buffer, 0, MEM_RELEASE );
-        return status;
+        buf.resize( returnLength );
+        status = SAFE_NATIVE_CALL( NtQueryObject, _local, ObjectNameInformation, buf.data(), returnLength, nullptr );
     }
 
-    SYSTEM_HANDLE_INFORMATION_T* handleInfo = (SYSTEM_HANDLE_INFORMATION_T*)buffer;
-    for (ULONG i = 0; i < handleInfo->HandleCount; i++)
+    auto pName = reinterpret_cast<PUNICODE_STRING>(buf.data());
+    if (NT_SUCCESS( status ) && pName->Length)
+        _name.assign( pName->Buffer, pName->Length / sizeof( wchar_t ) );
+
+    return _name;
+}
+
+/// <summary>
+/// Get section object information
+/// </summary>
+/// <returns>Section info, nullptr if object isn't a section</returns>
+std::shared_ptr<SectionInfo> HandleEntry::section()
+{
+    if (_sectionQueried || _wcsicmp( _typeName.c_str(), L"Section" ) != 0 || !local())
+        return _section;
+
+    _sectionQueried = true;
+
+    SECTION_BASIC_INFORMATION_T secInfo = { 0 };
+    NTSTATUS status = SAFE_NATIVE_CALL( NtQuerySection, _local, SectionBasicInformation, &secInfo, (ULONG)sizeof( secInfo ), nullptr );
+    if (NT_SUCCESS( status ))
     {
-        HandleInfo info;
-        ProcessHandle hLocal;
-        OBJECT_TYPE_INFORMATION_T* pTypeInfo = nullptr;
-        PVOID pNameInfo = nullptr;
-        UNICODE_STRING objectName = { 0 };
-
-        // Filter process
-        if (handleInfo->Handles[i].ProcessId != _core._pid)
-            continue;
+        _section = std::make_shared<SectionInfo>();
+        _section->size = secInfo.Size.QuadPart;
+        _section->attrib = secInfo.Attributes;
+    }
 
-        // Get local handle copy
-        status = SAFE_NATIVE_CALL(
-            NtDuplicateObject,
-            _core._hProcess,
-            reinterpret_cast<HANDLE>(handleInfo->Handles[i].Handle),
-            GetCurrentProcess(),
-            &hLocal, 0, 0, DUPLICATE_SAME_ACCESS
-            );
+    return _section;
+}
 
-        if (!NT_SUCCESS( status ))
-            continue;
+/// <summary>
+/// Convert into handle information with all fields queried
+/// </summary>
+/// <returns>Handle information</returns>
+HandleInfo HandleEntry::info()
+{
+    HandleInfo info;
 
-        // 
-        // Get type information
-        //
-        pTypeInfo = (OBJECT_TYPE_INFORMATION_T*)malloc( 0x1000 );
-        status = SAFE_NATIVE_CALL( NtQueryObject, hLocal, ObjectTypeInformation, pTypeInfo, 0x1000, nullptr );
-        if (!NT_SUCCESS( status ))
-        {
-            continue;
-        }
+    info.handle   = handle();
+    info.access   = access();
+    info.flags    = flags();
+    info.pObject  = object();
+    info.typeName = _typeName;
+    info.name     = name();
+    info.section  = section();
 
-        //
-        // Obtain object name
-        //
-        pNameInfo = malloc( 0x1000 );
-        status = SAFE_NATIVE_CALL( NtQueryObject, hLocal, ObjectNameInformation, pNameInfo, 0x1000, &returnLength);
-        if (!NT_SUCCESS( status ))
-        {
-            pNameInfo = realloc( pNameInfo, returnLength );
-            status = SAFE_NATIVE_CALL( NtQueryObject, hLocal, ObjectNameInformation, pNameInfo, returnLength, nullptr );
-            if (!NT_SUCCESS( status ))
-            {
-                free( pTypeInfo );
-                free( pNameInfo );
-                continue;
-            }
-        }
+    return info;
+}
 
-        objectName = *(PUNICODE_STRING)pNameInfo;
+/// <summary>
+/// Enumerate all open handles
+/// </summary>
+/// <returns>Found handles or status code</returns>
+call_result_t<std::vector<HandleInfo>> Process::EnumHandles()
+{
+    std::vector<HandleInfo> handles;
 
-        //
-        // Fill handle info structure
-        //
-        info.handle   = reinterpret_cast<HANDLE>(handleInfo->Handles[i].Handle);
-        info.access   = handleInfo->Handles[i].GrantedAccess;
-        info.flags    = handleInfo->Handles[i].Flags;
-        info.pObject  = handleInfo->Handles[i].Object;
+    NTSTATUS status = EnumHandles( [&handles]( HandleEntry& entry )
+    {
+        handles.emplace_back( entry.info() );
+        return true;
+    } );
 
-        if (pTypeInfo->Name.Length)
-            info.typeName = (wchar_t*)pTypeInfo->Name.Buffer;
+    if (!NT_SUCCESS( status ))
+        return status;
 
-        if (objectName.Length)
-            info.name = objectName.Buffer;
+    return call_result_t<std::vector<HandleInfo>>( handles, status );
+}
 
-        //
-        // Type-specific info
-        //
-        if (_wcsicmp( info.typeName.c_str(), L"Section" ) == 0)
-        {
-            SECTION_BASIC_INFORMATION_T secInfo = { 0 };
+/// <summary>
+/// Enumerate open handles without materializing the list.
+/// Handles are filtered by type index before any object query, type names are resolved once per index
+/// </summary>
+/// <param name="callback">Called for every matching handle, return false to stop</param>
+/// <param name="typeName">Object type name, e.g. L"Section". Empty - all types</param>
+/// <returns>Status code</returns>
+NTSTATUS Process::EnumHandles( const fnHandleCallback& callback, const std::wstring& typeName /*= L""*/ )
+{
+    // Type indexes are system-wide and fixed until reboot
+    static std::array<std::wstring, 256> typeNames;
+    static std::array<bool, 256> typeKnown = { };
+    static std::mutex typeLock;
 
-            status = SAFE_NATIVE_CALL( NtQuerySection, hLocal, SectionBasicInformation, &secInfo, (ULONG)sizeof( secInfo ), nullptr );
-            if (NT_SUCCESS( status ))
-            {
-                info.section.reset( new SectionInfo() );
+    std::vector<uint8_t> buffer( 0x10000 );
+    ULONG returnLength = 0;
+
+    // Query handle list
+    NTSTATUS status = STATUS_INFO_LENGTH_MISMATCH;
+    while (status == STATUS_INFO_LENGTH_MISMATCH)
+    {
+        status = SAFE_NATIVE_CALL(
+            NtQuerySystemInformation, SystemHandleInformation,
+            buffer.data(), static_cast<ULONG>(buffer.size()), &returnLength
+            );
+
+        if (status == STATUS_INFO_LENGTH_MISMATCH)
+            buffer.resize( std::max<size_t>( buffer.size() * 2, returnLength + 0x10000 ) );
+    }
+
+    if (!NT_SUCCESS( status ))
+        return status;
+
+    auto handleInfo = reinterpret_cast<const SYSTEM_HANDLE_INFORMATION_T*>(buffer.data());
+    for (ULONG i = 0; i < handleInfo->HandleCount; i++)
+    {
+        auto& raw = handleInfo->Handles[i];
+        if (raw.ProcessId != _core._pid)
+            continue;
 
-                info.section->size = secInfo.Size.QuadPart;
-                info.section->attrib = secInfo.Attributes;
+        auto index = raw.ObjectTypeNumber;
+        {
+            std::lock_guard<std::mutex> lg( typeLock );
+            if (!typeKnown[index])
+            {
+                // Resolve type name from the first handle of this type
+                HandleEntry probe( _core._hProcess, raw, typeNames[index] );
+                if (!probe.local())
+                    continue;
+
+                uint8_t typeBuf[0x1000] = { };
+                auto pTypeInfo = reinterpret_cast<OBJECT_TYPE_INFORMATION_T*>(typeBuf);
+                status = SAFE_NATIVE_CALL( NtQueryObject, probe.local(), ObjectTypeInformation, pTypeInfo, (ULONG)sizeof( typeBuf ), nullptr );
+                if (!NT_SUCCESS( status ))
+                    continue;
+
+                typeNames[index].assign( reinterpret_cast<wchar_t*>(pTypeInfo->Name.Buffer), pTypeInfo->Name.Length / sizeof( wchar_t ) );
+                typeKnown[index] = true;
             }
         }
 
-        handles.emplace_back( info );
+        if (!typeName.empty() && _wcsicmp( typeNames[index].c_str(), typeName.c_str() ) != 0)
+            continue;
 
-        free( pTypeInfo );
-        free( pNameInfo );
+        HandleEntry entry( _core._hProcess, raw, typeNames[index] );
+        if (!callback( entry ))
+            break;
     }
 
-    VirtualFree( buffer, 0, MEM_RELEASE );
-    return call_result_t<std::vector<HandleInfo>>( handles, status );
+    return STATUS_SUCCESS;
 }
 
 /// <summary>
@@ -323,21 +555,9 @@ call_result_t<std::vector<HandleInfo>> Process::EnumHandles()
 std::vector<DWORD> Process::EnumByName( const std::wstring& name )
 {
     std::vector<DWORD> found;
-    auto hProcSnap = Handle( CreateToolhelp32Snapshot( TH32CS_SNAPPROCESS, 0 ) );
-    if (!hProcSnap)
-        return found;
-
-    PROCESSENTRY32W tEntry = { 0 };
-    tEntry.dwSize = sizeof( PROCESSENTRY32W );
-
-    // Iterate threads
-    for (BOOL success = Process32FirstW( hProcSnap, &tEntry );
-        success != FALSE;
-        success = Process32NextW( hProcSnap, &tEntry ))
-    {
-        if (name.empty() || _wcsicmp( tEntry.szExeFile, name.c_str() ) == 0)
-            found.emplace_back( tEntry.th32ProcessID );
-    }
+    ProcessList list;
+    if (NT_SUCCESS( list.Refresh() ))
+        list.FindByName( name, found );
 
     return found;
 }
@@ -356,78 +576,34 @@ call_result_t<std::vector<ProcessInfo>> Process::EnumByNameOrPID(
     bool includeThreads /*= false*/
     )
 {
-    ULONG bufSize = 0x100;
-    uint8_t tmpbuf[0x100];
-    uint8_t* buffer = tmpbuf;
-    ULONG returnLength = 0;
     std::vector<ProcessInfo> found;
+    ProcessList list;
 
-    // Query process info
-    NTSTATUS status = SAFE_NATIVE_CALL( NtQuerySystemInformation, (SYSTEM_INFORMATION_CLASS)57, buffer, bufSize, &returnLength );
+    NTSTATUS status = list.Refresh();
     if (!NT_SUCCESS( status ))
-    {
-        bufSize = returnLength;
-        buffer = (uint8_t*)VirtualAlloc( NULL, bufSize, MEM_COMMIT, PAGE_READWRITE );
-        status = SAFE_NATIVE_CALL( NtQuerySystemInformation, (SYSTEM_INFORMATION_CLASS)57, buffer, bufSize, &returnLength );
-        if (!NT_SUCCESS( status ))
-        {
-            VirtualFree( buffer, 0, MEM_RELEASE );
-            return status;
-        }
-    }
+        return status;
 
-    // Parse info
-    for (auto pInfo = reinterpret_cast<_SYSTEM_PROCESS_INFORMATION_T<DWORD_PTR>*>(buffer);;)
+    list.ForEach( [&]( const ProcessList::Entry& entry )
     {
-        //  Skip idle process, compare name or compare pid
-        if (pInfo->UniqueProcessId != 0 && ((name.empty() && pid == 0) || _wcsicmp( name.c_str(), (wchar_t*)pInfo->ImageName.Buffer ) == 0 ||  pid == pInfo->UniqueProcessId))
+        // Compare name or compare pid
+        if ((name.empty() && pid == 0) || entry.nameIs( name ) || pid == entry.pid())
         {
             ProcessInfo info;
+            info.pid = entry.pid();
+            info.imageName = entry.imageName();
 
-            info.pid = static_cast<uint32_t>(pInfo->UniqueProcessId);
-
-            if (pInfo->ImageName.Buffer)
-                info.imageName = reinterpret_cast<wchar_t*>(pInfo->ImageName.Buffer);
-
-            // Get threads info
             if (includeThreads)
-            {
-                int64_t minTime = 0xFFFFFFFFFFFFFFFF;
-                ULONG mainIdx = 0;
-
-                for (ULONG i = 0; i < pInfo->NumberOfThreads; i++)
-                {
-                    ThreadInfo tinfo;
-                    auto& thd = pInfo->Threads[i];
-
-                    tinfo.tid = static_cast<uint32_t>(thd.ThreadInfo.ClientId.UniqueThread);
-                    tinfo.startAddress = static_cast<uintptr_t>(thd.ThreadInfo.StartAddress);
-
-                    // Check for main thread
-                    if (thd.ThreadInfo.CreateTime.QuadPart < minTime)
-                    {
-                        minTime = thd.ThreadInfo.CreateTime.QuadPart;
-                        mainIdx = i;
-                    }
-
-                    info.threads.emplace_back( tinfo );
-                    info.threads[mainIdx].mainThread = true;
-                }
-            }
+                info.threads = entry.threads();
 
-            found.emplace_back( info );
+            found.emplace_back( std::move( info ) );
         }
 
-        if (pInfo->NextEntryOffset)
-            pInfo = reinterpret_cast<_SYSTEM_PROCESS_INFORMATION_T<DWORD_PTR>*>((uint8_t*)pInfo + pInfo->NextEntryOffset);
-        else
-            break;        
-    }
+        return true;
+    } );
 
     // Sort results
     std::sort( found.begin(), found.end() );
 
-    VirtualFree( buffer, 0, MEM_RELEASE );
     return call_result_t<std::vector<ProcessInfo>>( found, status );
 }
 
@@ -3,7 +3,9 @@
 #include "ProcessCore.h"
 #include "ProcessMemory.h"
 #include "ProcessModules.h"
+#include "ProcessList.h"
 #include "Threads/Threads.h"
+#include "Threads/Breakpoints.h"
 #include "RPC/RemoteExec.h"
 #include "RPC/RemoteHook.h"
 #include "RPC/RemoteLocalHook.h"
@@ -13,38 +15,15 @@
 #include "../Include/NativeStructures.h"
 #include "../Include/CallResult.h"
 #include "../Misc/InitOnce.h"
+#include "../Misc/LatencyHistogram.h"
 
 #include <string>
 #include <list>
+#include <functional>
 
 namespace blackbone
 {
 
-/// <summary>
-/// Process thread information
-/// </summary>
-struct ThreadInfo
-{
-    uint32_t tid = 0;
-    uintptr_t startAddress = 0;
-    bool mainThread = false;
-};
-
-/// <summary>
-/// Process information
-/// </summary>
-struct ProcessInfo
-{
-    uint32_t pid = 0;
-    std::wstring imageName;
-    std::vector<ThreadInfo> threads;
-
-    bool operator < (const ProcessInfo& other)
-    {
-        return this->pid < other.pid;
-    }
-};
-
 /// <summary>
 /// Section object information
 /// </summary>
@@ -71,6 +50,68 @@ struct HandleInfo
     std::shared_ptr<SectionInfo> section;
 };
 
+/// <summary>
+/// Handle entry passed to streaming enumeration.
+/// Object name and section info are queried on first access, handle is duplicated only when needed
+/// </summary>
+class HandleEntry
+{
+public:
+    HandleEntry( HANDLE hProcess, const _SYSTEM_HANDLE_T<uintptr_t>& raw, const std::wstring& typeName )
+        : _hProcess( hProcess )
+        , _raw( raw )
+        , _typeName( typeName ) { }
+
+    inline HANDLE handle() const            { return reinterpret_cast<HANDLE>(static_cast<uintptr_t>(_raw.Handle)); }
+    inline uint32_t access() const          { return _raw.GrantedAccess; }
+    inline uint32_t flags() const           { return _raw.Flags; }
+    inline ptr_t object() const             { return _raw.Object; }
+    inline uint8_t typeIndex() const        { return _raw.ObjectTypeNumber; }
+    inline const std::wstring& typeName() const { return _typeName; }
+
+    /// <summary>
+    /// Get object name
+    /// </summary>
+    /// <returns>Object name, empty if object is unnamed or name can't be queried</returns>
+    BLACKBONE_API const std::wstring& name();
+
+    /// <summary>
+    /// Get section object information
+    /// </summary>
+    /// <returns>Section info, nullptr if object isn't a section</returns>
+    BLACKBONE_API std::shared_ptr<SectionInfo> section();
+
+    /// <summary>
+    /// Get handle copy inside current process
+    /// </summary>
+    /// <returns>Duplicated handle, nullptr on failure</returns>
+    BLACKBONE_API HANDLE local();
+
+    /// <summary>
+    /// Convert into handle information with all fields queried
+    /// </summary>
+    /// <returns>Handle information</returns>
+    BLACKBONE_API HandleInfo info();
+
+private:
+    HANDLE _hProcess;
+    const _SYSTEM_HANDLE_T<uintptr_t>& _raw;
+    const std::wstring& _typeName;
+
+    ProcessHandle _local;
+    std::wstring _name;
+    std::shared_ptr<SectionInfo> _section;
+    bool _duplicated = false;
+    bool _nameQueried = false;
+    bool _sectionQueried = false;
+};
+
+/// <summary>
+/// Streaming handle enumeration callback
+/// </summary>
+/// <returns>false to stop enumeration</returns>
+using fnHandleCallback = std::function<bool( HandleEntry& )>;
+
 #define DEFAULT_ACCESS_P  PROCESS_QUERY_INFORMATION | \
                           PROCESS_VM_READ           | \
                           PROCESS_VM_WRITE          | \
@@ -80,6 +121,29 @@ struct HandleInfo
                           PROCESS_TERMINATE         | \
                           PROCESS_SUSPEND_RESUME    | \
                           PROCESS_DUP_HANDLE
+
+/// <summary>
+/// Work done on behalf of a Process object, see Process::metrics()
+/// </summary>
+struct ProcessMetrics
+{
+    NativeCounters native;          // Subsystem calls by type, since attach
+    MemoryCounters memory;          // ProcessMemory syscalls, bytes and page cache use
+    uint64_t rpcCalls = 0;          // Remote code executions
+    uint64_t debugEvents = 0;       // Debug events received by RemoteHook
+    uint64_t driverRequests = 0;    // Driver requests, shared by all processes
+};
+
+/// <summary>
+/// Target process.
+/// Concurrency: one Process may be used by several threads for independent work.
+///  - memory(): reads and writes are lock-free, page cache, region map and heaps have own locks
+///  - modules(), threads(), breakpoints(), hooks(), localHooks(): internally locked
+///  - remote(): executions are serialized, hold remote().guard() across multi-step sequences, use remote().pool() for parallel calls
+///  - nativeLdr(): loader structure updates are serialized
+///  - mmap(): not thread-safe, map and unmap images from one thread at a time
+///  - Attach, Detach and other lifetime routines must not race with any other call
+/// </summary>
 class Process
 {
 public:
@@ -91,23 +155,37 @@ public:
     /// </summary>
     /// <param name="pid">Process ID</param>
     /// <param name="access">Access mask</param>
+    /// <param name="directSyscalls">Issue memory and query syscalls directly instead of calling ntdll. Native x64 host only</param>
     /// <returns>Status code</returns>
-    BLACKBONE_API NTSTATUS Attach( DWORD pid, DWORD access = DEFAULT_ACCESS_P );
+    BLACKBONE_API NTSTATUS Attach( DWORD pid, DWORD access = DEFAULT_ACCESS_P, bool directSyscalls = false );
 
     /// <summary>
     /// Attach to existing process
     /// </summary>
     /// <param name="name">Process name</param>
     /// <param name="access">Access mask</param>
+    /// <param name="directSyscalls">Issue memory and query syscalls directly instead of calling ntdll. Native x64 host only</param>
     /// <returns>Status code</returns>
-    BLACKBONE_API NTSTATUS Attach( const wchar_t* name, DWORD access = DEFAULT_ACCESS_P );
+    BLACKBONE_API NTSTATUS Attach( const wchar_t* name, DWORD access = DEFAULT_ACCESS_P, bool directSyscalls = false );
 
     /// <summary>
     /// Attach to existing process
     /// </summary>
     /// <param name="pid">Process handle</param>
+    /// <param name="directSyscalls">Issue memory and query syscalls directly instead of calling ntdll. Native x64 host only</param>
     /// <returns>Status code</returns>
-    BLACKBONE_API NTSTATUS Attach( HANDLE hProc );
+    BLACKBONE_API NTSTATUS Attach( HANDLE hProc, bool directSyscalls = false );
+
+    /// <summary>
+    /// Attach to copy-on-write clone of process address space captured with PssCaptureSnapshot.
+    /// Target keeps running, reads return memory as it was at capture time.
+    /// Clone is opened with query and read access only, so writes, allocations and remote calls fail.
+    /// pid() returns clone ID. Requires Windows 8.1 or newer
+    /// </summary>
+    /// <param name="pid">Process ID</param>
+    /// <param name="directSyscalls">Issue memory and query syscalls directly instead of calling ntdll. Native x64 host only</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS AttachSnapshot( DWORD pid, bool directSyscalls = false );
 
     /// <summary>
     /// Create new process and attach to it
@@ -128,6 +206,32 @@ public:
         STARTUPINFOW* pStartup = nullptr
         );
 
+    /// <summary>
+    /// Create new process, attach to it and manually map image into it.
+    /// Image bundle is built on a worker thread while process is created and initialized,
+    /// so only writing and initialization remain once process is ready.
+    /// Bundle is resolved against current process modules, if it can't be built image is mapped from file
+    /// </summary>
+    /// <param name="path">Executable path</param>
+    /// <param name="imagePath">Image to map</param>
+    /// <param name="flags">Image mapping flags</param>
+    /// <param name="cmdLine">Process command line</param>
+    /// <param name="currentDir">Startup directory</param>
+    /// <param name="pStartup">Additional startup params</param>
+    /// <param name="resume">Resume main thread after successful mapping. Process stays suspended if mapping fails</param>
+    /// <param name="pStats">Optional per phase mapping statistics</param>
+    /// <returns>Mapped image info</returns>
+    BLACKBONE_API call_result_t<ModuleDataPtr> CreateAndMap(
+        const std::wstring& path,
+        const std::wstring& imagePath,
+        eLoadFlags flags = ManualImports,
+        const std::wstring& cmdLine = L"",
+        const wchar_t* currentDir = nullptr,
+        STARTUPINFOW* pStartup = nullptr,
+        bool resume = true,
+        MapStats* pStats = nullptr
+        );
+
     /// <summary>
     /// Detach form current process, if any
     /// </summary>
@@ -158,6 +262,12 @@ public:
     /// <returns>Process ID</returns>
     BLACKBONE_API inline DWORD pid() const { return _core.pid(); }
 
+    /// <summary>
+    /// Check if attached to address space snapshot
+    /// </summary>
+    /// <returns>true if attached with AttachSnapshot</returns>
+    BLACKBONE_API inline bool snapshot() const { return _snapshot != nullptr; }
+
     /// <summary>
     /// Checks if process still exists
     /// </summary>
@@ -171,12 +281,27 @@ public:
     /// <returns>Stratus code</returns>
     BLACKBONE_API NTSTATUS Terminate( uint32_t code = 0 );
 
+    /// <summary>
+    /// Snapshot of operation counters. Counters are updated atomically, snapshot may be taken from any thread
+    /// </summary>
+    /// <returns>Counters snapshot</returns>
+    BLACKBONE_API ProcessMetrics metrics();
+
     /// <summary>
     /// Enumerate all open handles
     /// </summary>
     /// <returns>Found handles or status code</returns>
     BLACKBONE_API call_result_t<std::vector<HandleInfo>> EnumHandles();
 
+    /// <summary>
+    /// Enumerate open handles without materializing the list.
+    /// Handles are filtered by type index before any object query, type names are resolved once per index
+    /// </summary>
+    /// <param name="callback">Called for every matching handle, return false to stop</param>
+    /// <param name="typeName">Object type name, e.g. L"Section". Empty - all types</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS EnumHandles( const fnHandleCallback& callback, const std::wstring& typeName = L"" );
+
     /// <summary>
     /// Search for process by executable name
     /// </summary>
@@ -205,11 +330,13 @@ public:
     BLACKBONE_API ProcessMemory&   memory()     { return _memory;     }  // Memory manipulations
     BLACKBONE_API ProcessModules&  modules()    { return _modules;    }  // Module management
     BLACKBONE_API ProcessThreads&  threads()    { return _threads;    }  // Threads
+    BLACKBONE_API HWBPManager&     breakpoints(){ return _breakpoints;}  // Process-wide hardware breakpoints
     BLACKBONE_API RemoteHook&      hooks()      { return _hooks;      }  // Hooking code remotely
     BLACKBONE_API RemoteLocalHook& localHooks() { return _localHooks; }  // Hooking code locally
     BLACKBONE_API RemoteExec&      remote()     { return _remote;     }  // Remote code execution
     BLACKBONE_API MMap&            mmap()       { return _mmap;       }  // Manual module mapping
     BLACKBONE_API NtLdr&           nativeLdr()  { return _nativeLdr;  }  // Native loader routines
+    BLACKBONE_API LatencyRecorder& latency()    { return _latency;    }  // Operation latency histograms
 
     // Sugar
     BLACKBONE_API const Wow64Barrier& barrier() const { return _core._native->GetWow64Barrier(); }
@@ -223,11 +350,14 @@ private:
     ProcessModules  _modules;       // Module management
     ProcessMemory   _memory;        // Memory manipulations
     ProcessThreads  _threads;       // Threads
+    HWBPManager     _breakpoints;   // Process-wide hardware breakpoints
+    RemoteLocalHook _localHooks;    // In-process remote hooks, outlive filtered RemoteHook hooks
     RemoteHook      _hooks;         // Hooking code remotely
-    RemoteLocalHook _localHooks;    // In-process remote hooks
     RemoteExec      _remote;        // Remote code execution
     MMap            _mmap;          // Manual module mapping
     NtLdr           _nativeLdr;     // Native loader routines
+    LatencyRecorder _latency;       // Operation latency histograms, disabled by default
+    HPSS            _snapshot = nullptr;    // Address space snapshot, if attached to its clone
 };
 
 }
@@ -26,8 +26,9 @@ ProcessCore::~ProcessCore()
 /// </summary>
 /// <param name="pid">Process ID</param>
 /// <param name="access">Access mask</param>
+/// <param name="directSyscalls">Use direct syscalls instead of ntdll exports, if possible</param>
 /// <returns>Status</returns>
-NTSTATUS ProcessCore::Open( DWORD pid, DWORD access )
+NTSTATUS ProcessCore::Open( DWORD pid, DWORD access, bool directSyscalls /*= false*/ )
 {
     // Handle current process differently
     _hProcess = (pid == GetCurrentProcessId()) ? GetCurrentProcess() : OpenProcess( access, false, pid );
@@ -39,7 +40,7 @@ NTSTATUS ProcessCore::Open( DWORD pid, DWORD access )
     if (_hProcess)
     {
         _pid = pid;
-        return Init();
+        return Init( directSyscalls );
     }
 
     return LastNtStatus();
@@ -49,22 +50,23 @@ NTSTATUS ProcessCore::Open( DWORD pid, DWORD access )
 /// Attach to existing process
 /// </summary>
 /// <param name="pid">Process ID</param>
-/// <param name="access">Access mask</param>
+/// <param name="directSyscalls">Use direct syscalls instead of ntdll exports, if possible</param>
 /// <returns>Status</returns>
-NTSTATUS ProcessCore::Open( HANDLE handle )
+NTSTATUS ProcessCore::Open( HANDLE handle, bool directSyscalls /*= false*/ )
 {
     _hProcess = handle;
     _pid = GetProcessId( _hProcess );
 
-    return Init();
+    return Init( directSyscalls );
 }
 
 
 /// <summary>
 /// Initialize some internal data
 /// </summary>
+/// <param name="directSyscalls">Use direct syscalls instead of ntdll exports, if possible</param>
 /// <returns>Status code</returns>
-NTSTATUS ProcessCore::Init()
+NTSTATUS ProcessCore::Init( bool directSyscalls )
 {
     // Detect x86 OS
     SYSTEM_INFO info = { { 0 } };
@@ -80,12 +82,18 @@ NTSTATUS ProcessCore::Init()
         BOOL wowSrc = FALSE;
         IsWow64Process( GetCurrentProcess(), &wowSrc );
 
+        // Direct syscalls are available only in native x64 code
         if (wowSrc == TRUE)
             _native = std::make_unique<NativeWow64>( _hProcess );
+        else if (directSyscalls && NativeSyscall::Supported())
+            _native = std::make_unique<NativeSyscall>( _hProcess );
         else
             _native = std::make_unique<Native>( _hProcess );
     }
 
+    // Subsystem is fixed until detach
+    _memory = _native->GetMemoryRoutines();
+
     // Get DEP info
     // For native x64 processes DEP is always enabled
     if (_native->GetWow64Barrier().targetWow64 == false)
@@ -111,6 +119,7 @@ void ProcessCore::Close()
 {
     _hProcess.reset();
     _native.reset();
+    _memory = MemoryRoutines();
     _pid = 0;
 }
 
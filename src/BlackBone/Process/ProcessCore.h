@@ -4,6 +4,7 @@
 #include "../Include/HandleGuard.h"
 #include "../Subsystem/Wow64Subsystem.h"
 #include "../Subsystem/x86Subsystem.h"
+#include "../Subsystem/SyscallSubsystem.h"
 
 #include <memory>
 #include <stdint.h>
@@ -45,6 +46,51 @@ public:
     /// <returns></returns>
     BLACKBONE_API inline Native* native() { return _native.get(); }
 
+    /// <summary>
+    /// Read memory through routines captured at attach, without subsystem virtual call
+    /// </summary>
+    /// <param name="address">Memory address</param>
+    /// <param name="buffer">Output buffer</param>
+    /// <param name="size">Number of bytes to read</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API inline NTSTATUS ReadMemory( ptr_t address, LPVOID buffer, size_t size )
+    {
+        if (_memory.read64)
+        {
+            _native->Count( NativeOp::Read );
+            DWORD64 bytes = 0;
+            return _memory.read64( _hProcess, address, buffer, size, &bytes );
+        }
+
+        if (_memory.read)
+        {
+            _native->Count( NativeOp::Read );
+            SIZE_T bytes = 0;
+            return _memory.read( _hProcess, reinterpret_cast<PVOID>(static_cast<uintptr_t>(address)), buffer, size, &bytes );
+        }
+
+        return _native->ReadProcessMemoryT( address, buffer, size );
+    }
+
+    /// <summary>
+    /// Write memory through routines captured at attach, without subsystem virtual call
+    /// </summary>
+    /// <param name="address">Memory address</param>
+    /// <param name="buffer">Data to write</param>
+    /// <param name="size">Number of bytes to write</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API inline NTSTATUS WriteMemory( ptr_t address, LPCVOID buffer, size_t size )
+    {
+        if (_memory.write64)
+        {
+            _native->Count( NativeOp::Write );
+            DWORD64 bytes = 0;
+            return _memory.write64( _hProcess, address, const_cast<LPVOID>(buffer), size, &bytes );
+        }
+
+        return _native->WriteProcessMemoryT( address, buffer, size );
+    }
+
     /// <summary>
     /// Get WOW64 PEB
     /// </summary>
@@ -87,21 +133,24 @@ private:
     /// </summary>
     /// <param name="pid">Process ID</param>
     /// <param name="access">Access mask</param>
+    /// <param name="directSyscalls">Use direct syscalls instead of ntdll exports, if possible</param>
     /// <returns>Status</returns>
-    NTSTATUS Open( DWORD pid, DWORD access );
+    NTSTATUS Open( DWORD pid, DWORD access, bool directSyscalls = false );
 
     /// <summary>
     /// Attach to existing process by handle
     /// </summary>
     /// <param name="pid">Process handle</param>
+    /// <param name="directSyscalls">Use direct syscalls instead of ntdll exports, if possible</param>
     /// <returns>Status</returns>
-    NTSTATUS Open( HANDLE handle );
+    NTSTATUS Open( HANDLE handle, bool directSyscalls = false );
 
     /// <summary>
     /// Initialize some internal data
     /// </summary>
+    /// <param name="directSyscalls">Use direct syscalls instead of ntdll exports, if possible</param>
     /// <returns>Status code</returns>
-    NTSTATUS Init();
+    NTSTATUS Init( bool directSyscalls );
 
     /// <summary>
     /// Close current process handle
@@ -112,6 +161,7 @@ private:
     ProcessHandle _hProcess;        // Process handle
     DWORD         _pid = 0;         // Process ID
     ptrNative     _native;          // Api wrapper
+    MemoryRoutines _memory;         // Memory routines of _native
     bool          _dep = true;      // DEP state for process
 };
 
@@ -0,0 +1,432 @@
+#include "ProcessDumper.h"
+#include "Process.h"
+#include "../Include/HandleGuard.h"
+#include "../Include/Macro.h"
+
+#include <3rd_party/VersionApi.h>
+
+#include <DbgHelp.h>
+
+#include <algorithm>
+#include <ctime>
+#include <future>
+#include <thread>
+
+namespace blackbone
+{
+
+namespace
+{
+
+/// <summary>
+/// Append plain structure to buffer
+/// </summary>
+/// <param name="out">Buffer</param>
+/// <param name="value">Structure to append</param>
+/// <returns>Offset of appended structure</returns>
+template<typename T>
+RVA Append( std::vector<uint8_t>& out, const T& value )
+{
+    auto offset = static_cast<RVA>(out.size());
+    auto ptr = reinterpret_cast<const uint8_t*>(&value);
+    out.insert( out.end(), ptr, ptr + sizeof( T ) );
+    return offset;
+}
+
+/// <summary>
+/// Append MINIDUMP_STRING
+/// </summary>
+/// <param name="out">Buffer</param>
+/// <param name="str">String to append</param>
+/// <returns>Offset of appended string</returns>
+RVA AppendString( std::vector<uint8_t>& out, const std::wstring& str )
+{
+    RVA offset = Append( out, static_cast<ULONG32>(str.size() * sizeof( wchar_t )) );
+
+    // Buffer is null-terminated, terminator isn't included into length
+    auto ptr = reinterpret_cast<const uint8_t*>(str.c_str());
+    out.insert( out.end(), ptr, ptr + (str.size() + 1) * sizeof( wchar_t ) );
+    return offset;
+}
+
+/// <summary>
+/// Get structure stored in buffer
+/// </summary>
+/// <param name="out">Buffer</param>
+/// <param name="offset">Structure offset</param>
+/// <returns>Structure reference</returns>
+template<typename T>
+T& At( std::vector<uint8_t>& out, RVA offset )
+{
+    return *reinterpret_cast<T*>(out.data() + offset);
+}
+
+}
+
+ProcessDumper::ProcessDumper( Process& process )
+    : _process( process )
+{
+}
+
+/// <summary>
+/// Write dump to file
+/// </summary>
+/// <param name="path">Output file path, overwritten if exists</param>
+/// <param name="options">Dump options</param>
+/// <returns>Status code</returns>
+NTSTATUS ProcessDumper::Dump( const std::wstring& path, const DumpOptions& options /*= DumpOptions()*/ )
+{
+    _stats = DumpStats();
+
+    if (options.chunkSize == 0 || options.maxBuffered < options.chunkSize)
+        return STATUS_INVALID_PARAMETER;
+
+    NTSTATUS status = CollectRanges( options );
+    if (!NT_SUCCESS( status ))
+        return status;
+
+    std::vector<uint8_t> header;
+    if (options.format == DumpFormat::Minidump)
+        BuildMinidump( header );
+    else
+        BuildRawSparse( header );
+
+    auto hFile = Handle( CreateFileW( path.c_str(), FILE_GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_FLAG_SEQUENTIAL_SCAN, NULL ) );
+    if (!hFile)
+        return LastNtStatus();
+
+    // Reserve whole file at once, so data is appended without growing allocation on every write
+    LARGE_INTEGER size = { { 0 } }, zero = { { 0 } };
+    size.QuadPart = static_cast<LONGLONG>(header.size() + _stats.bytes);
+    if (!SetFilePointerEx( hFile, size, NULL, FILE_BEGIN ) || !SetEndOfFile( hFile ) || !SetFilePointerEx( hFile, zero, NULL, FILE_BEGIN ))
+        status = LastNtStatus();
+
+    DWORD bytes = 0;
+    if (NT_SUCCESS( status ) && (!WriteFile( hFile, header.data(), static_cast<DWORD>(header.size()), &bytes, NULL ) || bytes != header.size()))
+        status = LastNtStatus();
+
+    if (NT_SUCCESS( status ))
+        status = WriteData( hFile, options );
+
+    if (!NT_SUCCESS( status ))
+    {
+        hFile.reset();
+        DeleteFileW( path.c_str() );
+        return status;
+    }
+
+    _stats.fileSize = static_cast<uint64_t>(size.QuadPart);
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Collect dumped ranges
+/// </summary>
+/// <param name="options">Dump options</param>
+/// <returns>Status code</returns>
+NTSTATUS ProcessDumper::CollectRanges( const DumpOptions& options )
+{
+    _ranges.clear();
+
+    auto& regionMap = _process.memory().regionMap();
+    NTSTATUS status = regionMap.Refresh();
+    if (!NT_SUCCESS( status ))
+        return status;
+
+    for (const auto& mbi : regionMap.regions())
+    {
+        if (mbi.Protect & PAGE_GUARD)
+            continue;
+
+        ptr_t start = mbi.BaseAddress, size = 0;
+        if (!options.filter.Match( mbi, start, size ))
+            continue;
+
+        auto range = mbi;
+        range.BaseAddress = start;
+        range.RegionSize = size;
+        _ranges.emplace_back( range );
+
+        _stats.bytes += size;
+    }
+
+    _stats.ranges = _ranges.size();
+    return _ranges.empty() ? STATUS_NOT_FOUND : STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Build minidump streams preceding memory data
+/// </summary>
+/// <param name="out">Serialized header, directory and streams</param>
+void ProcessDumper::BuildMinidump( std::vector<uint8_t>& out )
+{
+    enum { SystemInfo, Modules, MemoryInfo, Memory64, StreamCount };
+
+    out.clear();
+
+    MINIDUMP_HEADER header = { 0 };
+    header.Signature = MINIDUMP_SIGNATURE;
+    header.Version = MINIDUMP_VERSION;
+    header.NumberOfStreams = StreamCount;
+    header.StreamDirectoryRva = sizeof( header );
+    header.TimeDateStamp = static_cast<ULONG32>(time( nullptr ));
+    header.Flags = MiniDumpWithFullMemory | MiniDumpWithFullMemoryInfo;
+    Append( out, header );
+
+    RVA directory = static_cast<RVA>(out.size());
+    out.resize( out.size() + StreamCount * sizeof( MINIDUMP_DIRECTORY ) );
+
+    auto beginStream = [&]( int index, ULONG32 type )
+    {
+        auto& entry = At<MINIDUMP_DIRECTORY>( out, directory + index * sizeof( MINIDUMP_DIRECTORY ) );
+        entry.StreamType = type;
+        entry.Location.Rva = static_cast<RVA>(out.size());
+    };
+
+    auto endStream = [&]( int index )
+    {
+        auto& entry = At<MINIDUMP_DIRECTORY>( out, directory + index * sizeof( MINIDUMP_DIRECTORY ) );
+        entry.Location.DataSize = static_cast<ULONG32>(out.size() - entry.Location.Rva);
+    };
+
+    // System info, debuggers pick target architecture from it
+    {
+        SYSTEM_INFO sysinfo = { 0 };
+        GetNativeSystemInfo( &sysinfo );
+
+        const auto& ver = WinVer().native;
+
+        MINIDUMP_SYSTEM_INFO info = { 0 };
+        info.ProcessorArchitecture = _process.barrier().targetWow64 ? PROCESSOR_ARCHITECTURE_INTEL : sysinfo.wProcessorArchitecture;
+        info.ProcessorLevel = sysinfo.wProcessorLevel;
+        info.ProcessorRevision = sysinfo.wProcessorRevision;
+        info.NumberOfProcessors = static_cast<UCHAR>(std::min<DWORD>( sysinfo.dwNumberOfProcessors, 0xFF ));
+        info.ProductType = ver.wProductType;
+        info.MajorVersion = ver.dwMajorVersion;
+        info.MinorVersion = ver.dwMinorVersion;
+        info.BuildNumber = ver.dwBuildNumber;
+        info.PlatformId = ver.dwPlatformId;
+        info.SuiteMask = ver.wSuiteMask;
+
+        beginStream( SystemInfo, SystemInfoStream );
+        RVA offset = Append( out, info );
+        endStream( SystemInfo );
+
+        At<MINIDUMP_SYSTEM_INFO>( out, offset ).CSDVersionRva = AppendString( out, ver.szCSDVersion );
+    }
+
+    // Module list, names are stored after module array
+    {
+        std::vector<ModuleDataPtr> modules;
+        for (const auto& mod : _process.modules().GetAllModules())
+            modules.emplace_back( mod.second );
+
+        std::sort( modules.begin(), modules.end(), []( const auto& l, const auto& r ) { return l->baseAddress < r->baseAddress; } );
+
+        beginStream( Modules, ModuleListStream );
+        Append( out, static_cast<ULONG32>(modules.size()) );
+
+        RVA first = static_cast<RVA>(out.size());
+        for (const auto& mod : modules)
+        {
+            MINIDUMP_MODULE entry = { 0 };
+            entry.BaseOfImage = mod->baseAddress;
+            entry.SizeOfImage = mod->size;
+            Append( out, entry );
+        }
+
+        endStream( Modules );
+
+        for (size_t i = 0; i < modules.size(); i++)
+        {
+            RVA name = AppendString( out, modules[i]->fullPath );
+            At<MINIDUMP_MODULE>( out, static_cast<RVA>(first + i * sizeof( MINIDUMP_MODULE )) ).ModuleNameRva = name;
+        }
+    }
+
+    // Memory info of dumped ranges
+    {
+        MINIDUMP_MEMORY_INFO_LIST list = { 0 };
+        list.SizeOfHeader = sizeof( list );
+        list.SizeOfEntry = sizeof( MINIDUMP_MEMORY_INFO );
+        list.NumberOfEntries = _ranges.size();
+
+        beginStream( MemoryInfo, MemoryInfoListStream );
+        Append( out, list );
+
+        for (const auto& range : _ranges)
+        {
+            MINIDUMP_MEMORY_INFO info = { 0 };
+            info.BaseAddress = range.BaseAddress;
+            info.AllocationBase = range.AllocationBase;
+            info.AllocationProtect = range.AllocationProtect;
+            info.RegionSize = range.RegionSize;
+            info.State = range.State;
+            info.Protect = range.Protect;
+            info.Type = range.Type;
+            Append( out, info );
+        }
+
+        endStream( MemoryInfo );
+    }
+
+    // Memory64 list must be last, range data follows it back to back
+    {
+        MINIDUMP_MEMORY64_LIST list = { 0 };
+        list.NumberOfMemoryRanges = _ranges.size();
+
+        beginStream( Memory64, Memory64ListStream );
+        RVA offset = Append( out, list );
+
+        for (const auto& range : _ranges)
+        {
+            MINIDUMP_MEMORY_DESCRIPTOR64 desc = { 0 };
+            desc.StartOfMemoryRange = range.BaseAddress;
+            desc.DataSize = range.RegionSize;
+            Append( out, desc );
+        }
+
+        endStream( Memory64 );
+        At<MINIDUMP_MEMORY64_LIST>( out, offset ).BaseRva = out.size();
+    }
+}
+
+/// <summary>
+/// Build raw sparse header and range table
+/// </summary>
+/// <param name="out">Serialized header and range table</param>
+void ProcessDumper::BuildRawSparse( std::vector<uint8_t>& out )
+{
+    out.clear();
+
+    DumpHeader header = { 0 };
+    header.magic = DumpHeader::Magic;
+    header.version = DumpHeader::Version;
+    header.pageSize = _process.core().native()->pageSize();
+    header.rangeCount = static_cast<uint32_t>(_ranges.size());
+    header.dataOffset = sizeof( DumpHeader ) + _ranges.size() * sizeof( DumpRange );
+    Append( out, header );
+
+    uint64_t offset = header.dataOffset;
+    for (const auto& range : _ranges)
+    {
+        DumpRange entry = { 0 };
+        entry.address = range.BaseAddress;
+        entry.size = range.RegionSize;
+        entry.offset = offset;
+        entry.protect = range.Protect;
+        entry.type = range.Type;
+        Append( out, entry );
+
+        offset += range.RegionSize;
+    }
+}
+
+/// <summary>
+/// Read range data and append it to file
+/// </summary>
+/// <param name="hFile">Output file</param>
+/// <param name="options">Dump options</param>
+/// <returns>Status code</returns>
+NTSTATUS ProcessDumper::WriteData( HANDLE hFile, const DumpOptions& options )
+{
+    struct Chunk
+    {
+        ptr_t address;              // Chunk address
+        size_t size;                // Chunk size
+        const uint8_t* mapped;      // Local mapping of chunk, if any
+    };
+
+    struct ChunkData
+    {
+        NTSTATUS status;            // Read status
+        uint64_t holes;             // Zero-filled bytes
+    };
+
+    auto& memory = _process.memory();
+    const size_t pageSize = _process.core().native()->pageSize();
+    const size_t chunkSize = std::max( options.chunkSize & ~(pageSize - 1), pageSize );
+
+    // Mapping lookup isn't thread-safe, so it's resolved before readers start
+    std::vector<Chunk> chunks;
+    for (const auto& range : _ranges)
+    {
+        const ptr_t end = range.BaseAddress + range.RegionSize;
+        for (ptr_t ptr = range.BaseAddress; ptr < end; ptr += chunkSize)
+        {
+            Chunk chunk = { ptr, static_cast<size_t>(std::min<ptr_t>( chunkSize, end - ptr )), nullptr };
+
+            ptr_t first = memory.TranslateAddress( chunk.address, false );
+            ptr_t last = first != 0 ? memory.TranslateAddress( chunk.address + chunk.size - 1, false ) : 0;
+            if (first != 0 && last == first + chunk.size - 1)
+                chunk.mapped = reinterpret_cast<const uint8_t*>(first);
+
+            chunks.emplace_back( chunk );
+        }
+    }
+
+    // Chunk i is read into slot i % slots. Writer holds one slot, others are being filled by readers
+    uint32_t threads = options.threads != 0 ? options.threads : std::max( std::thread::hardware_concurrency(), 1u );
+    size_t slots = std::min<size_t>( threads + 1, options.maxBuffered / chunkSize );
+    slots = std::max<size_t>( std::min( slots, chunks.size() + 1 ), 2 );
+
+    std::vector<std::vector<uint8_t>> buffers( slots );
+    std::vector<std::future<ChunkData>> pending( chunks.size() );
+
+    auto read = [&]( size_t idx ) -> ChunkData
+    {
+        const auto& chunk = chunks[idx];
+        auto& buf = buffers[idx % slots];
+        buf.resize( chunkSize );
+
+        if (NT_SUCCESS( _process.core().ReadMemory( chunk.address, buf.data(), chunk.size ) ))
+            return { STATUS_SUCCESS, 0 };
+
+        // Region changed since it was listed. Keep file layout, zero-fill pages that can't be read anymore
+        std::vector<bool> pages;
+        NTSTATUS status = memory.ReadSparse( chunk.address, chunk.size, buf.data(), &pages );
+        uint64_t holes = static_cast<uint64_t>(std::count( pages.begin(), pages.end(), false )) * pageSize;
+
+        return { status, std::min<uint64_t>( holes, chunk.size ) };
+    };
+
+    NTSTATUS status = STATUS_SUCCESS;
+    size_t launched = 0;
+
+    for (size_t i = 0; i < chunks.size() && NT_SUCCESS( status ); i++)
+    {
+        for (; launched < chunks.size() && launched < i + slots; launched++)
+            if (chunks[launched].mapped == nullptr)
+                pending[launched] = std::async( std::launch::async, read, launched );
+
+        const auto& chunk = chunks[i];
+        const uint8_t* data = chunk.mapped;
+
+        if (data != nullptr)
+        {
+            _stats.mappedBytes += chunk.size;
+        }
+        else
+        {
+            auto result = pending[i].get();
+            if (!NT_SUCCESS( status = result.status ))
+                break;
+
+            _stats.holeBytes += result.holes;
+            data = buffers[i % slots].data();
+        }
+
+        DWORD bytes = 0;
+        if (!WriteFile( hFile, data, static_cast<DWORD>(chunk.size), &bytes, NULL ) || bytes != chunk.size)
+            status = LastNtStatus();
+    }
+
+    // Readers reference local state, wait for them before leaving
+    for (auto& item : pending)
+        if (item.valid())
+            item.wait();
+
+    return status;
+}
+
+}
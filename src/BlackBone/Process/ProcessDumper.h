@@ -0,0 +1,134 @@
+#pragma once
+
+#include "../Include/Winheaders.h"
+#include "../Include/Types.h"
+#include "../Patterns/PatternSearch.h"
+
+#include <string>
+#include <vector>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Dump file layout
+/// </summary>
+enum class DumpFormat
+{
+    Minidump,   // MiniDumpWithFullMemory compatible: system info, module list, memory info and Memory64 list streams
+    RawSparse,  // DumpHeader, DumpRange table, then data of every range back to back
+};
+
+/// <summary>
+/// Dump options
+/// </summary>
+struct DumpOptions
+{
+    DumpFormat format = DumpFormat::Minidump;
+    RegionFilter filter;                    // Dumped regions. Non-accessible and guard regions are always skipped
+    uint32_t threads = 0;                   // Number of reader threads, 0 - number of CPUs
+    size_t chunkSize = 4 * 1024 * 1024;     // Read and write unit
+    size_t maxBuffered = 64 * 1024 * 1024;  // Max data held in read buffers at once
+};
+
+/// <summary>
+/// Dump statistics
+/// </summary>
+struct DumpStats
+{
+    uint64_t ranges = 0;        // Dumped memory ranges
+    uint64_t bytes = 0;         // Dumped memory bytes
+    uint64_t holeBytes = 0;     // Bytes that became unreadable during dump, stored zero-filled
+    uint64_t mappedBytes = 0;   // Bytes written straight from RemoteMemory mapping without copy
+    uint64_t fileSize = 0;      // Resulting file size
+};
+
+/// <summary>
+/// Raw sparse dump header
+/// </summary>
+struct DumpHeader
+{
+    uint32_t magic;         // DumpHeader::Magic
+    uint32_t version;       // DumpHeader::Version
+    uint32_t pageSize;      // Target page size
+    uint32_t rangeCount;    // Number of DumpRange entries following header
+    uint64_t dataOffset;    // File offset of first range data
+
+    static constexpr uint32_t Magic = 0x50444242;   // 'BBDP'
+    static constexpr uint32_t Version = 1;
+};
+
+/// <summary>
+/// Raw sparse dump range
+/// </summary>
+struct DumpRange
+{
+    uint64_t address;       // Range address
+    uint64_t size;          // Range size
+    uint64_t offset;        // File offset of range data
+    uint32_t protect;       // Region protection
+    uint32_t type;          // MEM_IMAGE, MEM_MAPPED or MEM_PRIVATE
+};
+
+/// <summary>
+/// Streams committed memory of a process into a file.
+/// Range list and file layout are built from the region map before any data is read,
+/// so headers are written once and data is appended strictly sequentially.
+/// Chunks are read by a pool of threads into a bounded ring of buffers while calling thread writes completed ones in order.
+/// Ranges mapped through RemoteMemory::Map are written straight from the mapping.
+/// </summary>
+class ProcessDumper
+{
+public:
+    BLACKBONE_API ProcessDumper( class Process& process );
+    BLACKBONE_API ~ProcessDumper() = default;
+
+    /// <summary>
+    /// Write dump to file
+    /// </summary>
+    /// <param name="path">Output file path, overwritten if exists</param>
+    /// <param name="options">Dump options</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS Dump( const std::wstring& path, const DumpOptions& options = DumpOptions() );
+
+    /// <summary>
+    /// Statistics of last dump
+    /// </summary>
+    /// <returns>Statistics</returns>
+    BLACKBONE_API inline const DumpStats& stats() const { return _stats; }
+
+private:
+    /// <summary>
+    /// Collect dumped ranges
+    /// </summary>
+    /// <param name="options">Dump options</param>
+    /// <returns>Status code</returns>
+    NTSTATUS CollectRanges( const DumpOptions& options );
+
+    /// <summary>
+    /// Build minidump streams preceding memory data
+    /// </summary>
+    /// <param name="out">Serialized header, directory and streams</param>
+    void BuildMinidump( std::vector<uint8_t>& out );
+
+    /// <summary>
+    /// Build raw sparse header and range table
+    /// </summary>
+    /// <param name="out">Serialized header and range table</param>
+    void BuildRawSparse( std::vector<uint8_t>& out );
+
+    /// <summary>
+    /// Read range data and append it to file
+    /// </summary>
+    /// <param name="hFile">Output file</param>
+    /// <param name="options">Dump options</param>
+    /// <returns>Status code</returns>
+    NTSTATUS WriteData( HANDLE hFile, const DumpOptions& options );
+
+private:
+    class Process& _process;                            // Target process
+    std::vector<MEMORY_BASIC_INFORMATION64> _ranges;    // Dumped ranges, sorted by address
+    DumpStats _stats;                                   // Last dump statistics
+};
+
+}
@@ -0,0 +1,311 @@
+#include "ProcessHeaps.h"
+#include "Process.h"
+#include "../Include/NativeStructures.h"
+
+#include <algorithm>
+
+namespace blackbone
+{
+
+constexpr uint32_t NtHeapSignature = 0xFFEEFFEE;       // _HEAP_SEGMENT::SegmentSignature
+constexpr uint32_t SegmentHeapSignature = 0xDDEEDDEE;  // _SEGMENT_HEAP::Signature
+
+constexpr uint8_t HeapEntryBusy = 0x01;
+constexpr uint8_t HeapEntryLast = 0x10;
+
+// Segment list sanity limit
+constexpr size_t MaxSegments = 0x1000;
+
+/// <summary>
+/// _HEAP_SEGMENT, layout is stable since Vista
+/// </summary>
+template<typename T>
+struct _HEAP_SEGMENT_T
+{
+    _LIST_ENTRY_T<T> Entry;                 // Segment block _HEAP_ENTRY, same size as list entry
+    uint32_t SegmentSignature;
+    uint32_t SegmentFlags;
+    _LIST_ENTRY_T<T> SegmentListEntry;
+    T Heap;
+    T BaseAddress;
+    uint32_t NumberOfPages;
+    T FirstEntry;
+    T LastValidEntry;
+    uint32_t NumberOfUnCommittedPages;
+    uint32_t NumberOfUnCommittedRanges;
+    uint16_t SegmentAllocatorBackTraceIndex;
+    uint16_t Reserved;
+    _LIST_ENTRY_T<T> UCRSegmentList;
+};
+
+/// <summary>
+/// Leading part of _HEAP, up to entry encoding key
+/// </summary>
+template<typename T>
+struct _HEAP_T
+{
+    _HEAP_SEGMENT_T<T> Segment;
+    uint32_t Flags;
+    uint32_t ForceFlags;
+    uint32_t CompatibilityFlags;
+    uint32_t EncodeFlagMask;
+    uint8_t Encoding[2 * sizeof( T )];      // XOR key for _HEAP_ENTRY
+};
+
+/// <summary>
+/// Size, flags and checksum part of _HEAP_ENTRY.
+/// Occupies second half of 64 bit entry and whole 32 bit entry, this is the part covered by encoding
+/// </summary>
+struct HeapEntryCode
+{
+    uint16_t Size;          // Block size in granularity units
+    uint8_t Flags;
+    uint8_t SmallTagIndex;  // Checksum of first 3 bytes when heap is encoded
+    uint16_t PreviousSize;
+    uint8_t SegmentOffset;
+    uint8_t UnusedBytes;
+};
+
+static_assert(sizeof( _HEAP_SEGMENT_T<uint32_t> ) == 0x40, "Bad _HEAP_SEGMENT32 size");
+static_assert(sizeof( _HEAP_SEGMENT_T<uint64_t> ) == 0x70, "Bad _HEAP_SEGMENT64 size");
+static_assert(offsetof( _HEAP_T<uint32_t>, Encoding ) == 0x50, "Bad _HEAP32::Encoding offset");
+static_assert(offsetof( _HEAP_T<uint64_t>, Encoding ) == 0x80, "Bad _HEAP64::Encoding offset");
+
+ProcessHeaps::ProcessHeaps( Process& process )
+    : _process( process )
+{
+}
+
+/// <summary>
+/// Get heap list from PEB
+/// </summary>
+/// <returns>Heap addresses, process heap first</returns>
+call_result_t<std::vector<ptr_t>> ProcessHeaps::EnumHeaps()
+{
+    return is32bit() ? EnumHeapsT<uint32_t>() : EnumHeapsT<uint64_t>();
+}
+
+/// <summary>
+/// Walk single heap
+/// </summary>
+/// <param name="heap">Heap address</param>
+/// <param name="info">Heap info and blocks</param>
+/// <returns>
+/// Status code. STATUS_NOT_SUPPORTED for segment heaps,
+/// STATUS_HEAP_CORRUPTION if some block header failed validation, blocks found before it are kept
+/// </returns>
+NTSTATUS ProcessHeaps::Walk( ptr_t heap, HeapInfo& info )
+{
+    info = HeapInfo();
+    info.base = heap;
+    info.status = is32bit() ? WalkT<uint32_t>( heap, info ) : WalkT<uint64_t>( heap, info );
+
+    return info.status;
+}
+
+/// <summary>
+/// Walk all process heaps
+/// </summary>
+/// <param name="heaps">Walked heaps, status of every heap is set separately</param>
+/// <returns>Status code</returns>
+NTSTATUS ProcessHeaps::WalkAll( std::vector<HeapInfo>& heaps )
+{
+    heaps.clear();
+
+    auto list = EnumHeaps();
+    if (!list)
+        return list.status;
+
+    heaps.resize( list->size() );
+    for (size_t i = 0; i < heaps.size(); i++)
+        Walk( list.result()[i], heaps[i] );
+
+    return STATUS_SUCCESS;
+}
+
+template<typename T>
+call_result_t<std::vector<ptr_t>> ProcessHeaps::EnumHeapsT()
+{
+    _PEB_T<T> peb = { };
+    if (_process.core().peb( &peb ) == 0)
+        return STATUS_UNSUCCESSFUL;
+
+    if (peb.NumberOfHeaps == 0 || peb.ProcessHeaps == 0 || peb.NumberOfHeaps > peb.MaximumNumberOfHeaps)
+        return STATUS_NOT_FOUND;
+
+    std::vector<T> raw( peb.NumberOfHeaps );
+    NTSTATUS status = _process.memory().Read( peb.ProcessHeaps, raw.size() * sizeof( T ), raw.data() );
+    if (!NT_SUCCESS( status ))
+        return status;
+
+    return std::vector<ptr_t>( raw.begin(), raw.end() );
+}
+
+template<typename T>
+NTSTATUS ProcessHeaps::WalkT( ptr_t heap, HeapInfo& info )
+{
+    // Block granularity equals header size
+    constexpr size_t granularity = 2 * sizeof( T );
+    constexpr size_t codeOffset = sizeof( T ) == sizeof( uint64_t ) ? sizeof( uint64_t ) : 0;
+    constexpr size_t segmentLink = offsetof( _HEAP_SEGMENT_T<T>, SegmentListEntry );
+
+    auto& memory = _process.memory();
+    auto native = _process.core().native();
+
+    _HEAP_T<T> header = { };
+    NTSTATUS status = memory.Read( heap, sizeof( header ), &header );
+    if (!NT_SUCCESS( status ))
+        return status;
+
+    if (header.Segment.SegmentSignature != NtHeapSignature)
+    {
+        // _SEGMENT_HEAP starts with RTL_HP_ENV_HANDLE made of two pointers
+        uint32_t signature = *reinterpret_cast<const uint32_t*>(reinterpret_cast<const uint8_t*>(&header) + 2 * sizeof( T ));
+        if (signature == SegmentHeapSignature)
+        {
+            info.type = HeapType::SegmentHeap;
+            return STATUS_NOT_SUPPORTED;
+        }
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    info.type = HeapType::NtHeap;
+    info.flags = header.Flags;
+
+    // Segment list head lives inside _HEAP past the segment, so it's the only node without segment signature
+    std::vector<_HEAP_SEGMENT_T<T>> segments( 1, header.Segment );
+    for (T link = header.Segment.SegmentListEntry.Flink; link != heap + segmentLink && link != 0 && segments.size() < MaxSegments;)
+    {
+        _HEAP_SEGMENT_T<T> segment = { };
+        if (!NT_SUCCESS( memory.Read( link - segmentLink, sizeof( segment ), &segment ) ))
+            break;
+
+        if (segment.SegmentSignature == NtHeapSignature)
+            segments.emplace_back( segment );
+
+        link = segment.SegmentListEntry.Flink;
+    }
+
+    info.segments = segments.size();
+
+    // Committed parts of segments, uncommitted ranges are never touched by reads
+    struct Run
+    {
+        ptr_t start;
+        size_t size;
+        size_t offset;
+    };
+
+    std::vector<Run> runs;
+    size_t total = 0;
+
+    for (const auto& segment : segments)
+    {
+        MEMORY_BASIC_INFORMATION64 mbi = { };
+        for (ptr_t ptr = segment.FirstEntry; ptr < segment.LastValidEntry;)
+        {
+            if (!NT_SUCCESS( native->VirtualQueryExT( ptr, &mbi ) ) || mbi.BaseAddress + mbi.RegionSize <= ptr)
+                break;
+
+            ptr_t end = std::min<ptr_t>( mbi.BaseAddress + mbi.RegionSize, segment.LastValidEntry );
+            if (mbi.State == MEM_COMMIT && !(mbi.Protect & (PAGE_NOACCESS | PAGE_GUARD)))
+            {
+                // Adjacent committed regions with different protection form single run
+                if (!runs.empty() && runs.back().start + runs.back().size == ptr)
+                {
+                    runs.back().size += static_cast<size_t>(end - ptr);
+                }
+                else
+                {
+                    runs.push_back( { ptr, static_cast<size_t>(end - ptr), total } );
+                }
+
+                total += static_cast<size_t>(end - ptr);
+            }
+
+            ptr = end;
+        }
+    }
+
+    // All committed pages in one batch
+    std::vector<uint8_t> data( total );
+    std::vector<ReadRequest> requests;
+    requests.reserve( runs.size() );
+
+    for (const auto& run : runs)
+        requests.push_back( { run.start, run.size, data.data() + run.offset } );
+
+    memory.ReadBatch( requests );
+
+    HeapEntryCode key = { };
+    if (header.EncodeFlagMask != 0)
+        memcpy( &key, header.Encoding + codeOffset, sizeof( key ) );
+
+    status = STATUS_SUCCESS;
+    for (size_t i = 0; i < runs.size(); i++)
+    {
+        if (!NT_SUCCESS( requests[i].status ))
+            continue;
+
+        const auto& run = runs[i];
+        const uint8_t* pRun = data.data() + run.offset;
+
+        for (size_t pos = 0; pos + granularity <= run.size;)
+        {
+            HeapEntryCode code;
+            memcpy( &code, pRun + pos + codeOffset, sizeof( code ) );
+
+            if (header.EncodeFlagMask != 0)
+            {
+                auto pCode = reinterpret_cast<uint8_t*>(&code);
+                auto pKey = reinterpret_cast<const uint8_t*>(&key);
+                for (size_t j = 0; j < sizeof( code ); j++)
+                    pCode[j] ^= pKey[j];
+
+                if (code.SmallTagIndex != (pCode[0] ^ pCode[1] ^ pCode[2]))
+                {
+                    status = STATUS_HEAP_CORRUPTION;
+                    break;
+                }
+            }
+
+            const size_t blockSize = code.Size * granularity;
+            if (blockSize == 0 || pos + blockSize > run.size)
+            {
+                status = STATUS_HEAP_CORRUPTION;
+                break;
+            }
+
+            HeapBlock block;
+            block.entry = run.start + pos;
+            block.address = block.entry + granularity;
+            block.blockSize = blockSize;
+            block.flags = code.Flags;
+            block.busy = (code.Flags & HeapEntryBusy) != 0;
+            block.size = block.busy && code.UnusedBytes <= blockSize ? blockSize - code.UnusedBytes : 0;
+
+            info.blocks.emplace_back( block );
+
+            // Next committed run starts right after uncommitted range
+            if (code.Flags & HeapEntryLast)
+                break;
+
+            pos += blockSize;
+        }
+    }
+
+    std::sort( info.blocks.begin(), info.blocks.end(), []( const HeapBlock& l, const HeapBlock& r ) { return l.entry < r.entry; } );
+    return status;
+}
+
+/// <summary>
+/// Check if target heaps are 32 bit
+/// </summary>
+/// <returns>true if 32 bit</returns>
+bool ProcessHeaps::is32bit() const
+{
+    return _process.barrier().targetWow64 || _process.barrier().x86OS;
+}
+
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "../Include/Winheaders.h"
+#include "../Include/Types.h"
+#include "../Include/CallResult.h"
+
+#include <vector>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Heap implementation
+/// </summary>
+enum class HeapType
+{
+    Unknown = 0,    // Signature not recognized
+    NtHeap,         // Classic NT heap
+    SegmentHeap,    // Segment heap (Windows 10+)
+};
+
+/// <summary>
+/// Heap block
+/// </summary>
+struct HeapBlock
+{
+    ptr_t entry = 0;        // Block header address
+    ptr_t address = 0;      // User data address
+    size_t blockSize = 0;   // Whole block size, including header
+    size_t size = 0;        // User data size, 0 for free blocks
+    uint8_t flags = 0;      // HEAP_ENTRY_* flags
+    bool busy = false;      // Block is allocated
+};
+
+/// <summary>
+/// Walked heap
+/// </summary>
+struct HeapInfo
+{
+    ptr_t base = 0;                     // Heap address
+    HeapType type = HeapType::Unknown;  // Heap implementation
+    uint32_t flags = 0;                 // HEAP_* creation flags
+    size_t segments = 0;                // Number of walked segments
+    std::vector<HeapBlock> blocks;      // Blocks in ascending address order
+    NTSTATUS status = STATUS_SUCCESS;   // Walk status
+};
+
+/// <summary>
+/// Remote heap walker.
+/// Segment pages are read in bulk and block headers are decoded locally,
+/// so no code is executed in target and number of reads doesn't depend on number of blocks.
+/// LFH user blocks are reported as single busy backend block, large (virtually allocated) blocks are not reported
+/// </summary>
+class ProcessHeaps
+{
+public:
+    BLACKBONE_API ProcessHeaps( class Process& process );
+    BLACKBONE_API ~ProcessHeaps() = default;
+
+    /// <summary>
+    /// Get heap list from PEB
+    /// </summary>
+    /// <returns>Heap addresses, process heap first</returns>
+    BLACKBONE_API call_result_t<std::vector<ptr_t>> EnumHeaps();
+
+    /// <summary>
+    /// Walk single heap
+    /// </summary>
+    /// <param name="heap">Heap address</param>
+    /// <param name="info">Heap info and blocks</param>
+    /// <returns>
+    /// Status code. STATUS_NOT_SUPPORTED for segment heaps,
+    /// STATUS_HEAP_CORRUPTION if some block header failed validation, blocks found before it are kept
+    /// </returns>
+    BLACKBONE_API NTSTATUS Walk( ptr_t heap, HeapInfo& info );
+
+    /// <summary>
+    /// Walk all process heaps
+    /// </summary>
+    /// <param name="heaps">Walked heaps, status of every heap is set separately</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS WalkAll( std::vector<HeapInfo>& heaps );
+
+private:
+    template<typename T>
+    call_result_t<std::vector<ptr_t>> EnumHeapsT();
+
+    template<typename T>
+    NTSTATUS WalkT( ptr_t heap, HeapInfo& info );
+
+    /// <summary>
+    /// Check if target heaps are 32 bit
+    /// </summary>
+    /// <returns>true if 32 bit</returns>
+    bool is32bit() const;
+
+    ProcessHeaps( const ProcessHeaps& ) = delete;
+    ProcessHeaps& operator =( const ProcessHeaps& ) = delete;
+
+private:
+    class Process& _process;
+};
+
+}
@@ -0,0 +1,128 @@
+#include "ProcessList.h"
+#include "../Misc/DynImport.h"
+
+namespace blackbone
+{
+
+/// <summary>
+/// Case-insensitive image name comparison
+/// </summary>
+/// <param name="name">Executable name</param>
+/// <returns>true if name matches</returns>
+bool ProcessList::Entry::nameIs( std::wstring_view name ) const
+{
+    auto image = imageName();
+    return image.size() == name.size() && _wcsnicmp( image.data(), name.data(), name.size() ) == 0;
+}
+
+/// <summary>
+/// Build process thread list
+/// </summary>
+/// <returns>Thread information</returns>
+std::vector<ThreadInfo> ProcessList::Entry::threads() const
+{
+    std::vector<ThreadInfo> result;
+    result.reserve( _info->NumberOfThreads );
+
+    int64_t minTime = 0x7FFFFFFFFFFFFFFF;
+    size_t mainIdx = 0;
+
+    for (ULONG i = 0; i < _info->NumberOfThreads; i++)
+    {
+        auto& thd = _info->Threads[i].ThreadInfo;
+        ThreadInfo tinfo;
+
+        tinfo.tid = static_cast<uint32_t>(thd.ClientId.UniqueThread);
+        tinfo.startAddress = static_cast<uintptr_t>(thd.StartAddress);
+        tinfo.state = thd.ThreadState;
+        tinfo.waitReason = thd.WaitReason;
+        tinfo.execTime = thd.KernelTime.QuadPart + thd.UserTime.QuadPart;
+
+        // Earliest created thread is the main one
+        if (thd.CreateTime.QuadPart < minTime)
+        {
+            minTime = thd.CreateTime.QuadPart;
+            mainIdx = i;
+        }
+
+        result.emplace_back( tinfo );
+    }
+
+    if (!result.empty())
+        result[mainIdx].mainThread = true;
+
+    return result;
+}
+
+/// <summary>
+/// Query current process list into cached buffer
+/// </summary>
+/// <returns>Status code</returns>
+NTSTATUS ProcessList::Refresh()
+{
+    ULONG returnLength = 0;
+
+    if (_buffer.empty())
+        _buffer.resize( 0x40000 );
+
+    // Process list can grow between calls
+    NTSTATUS status = STATUS_INFO_LENGTH_MISMATCH;
+    while (status == STATUS_INFO_LENGTH_MISMATCH)
+    {
+        status = SAFE_NATIVE_CALL(
+            NtQuerySystemInformation, (SYSTEM_INFORMATION_CLASS)57,
+            _buffer.data(), static_cast<ULONG>(_buffer.size()), &returnLength
+            );
+
+        if (status == STATUS_INFO_LENGTH_MISMATCH)
+            _buffer.resize( returnLength + 0x4000 );
+    }
+
+    _valid = NT_SUCCESS( status );
+    return status;
+}
+
+/// <summary>
+/// Find processes by executable name
+/// </summary>
+/// <param name="name">Executable name. If empty - all processes are returned</param>
+/// <param name="pids">Found process IDs, appended</param>
+/// <returns>Number of found processes</returns>
+size_t ProcessList::FindByName( std::wstring_view name, std::vector<DWORD>& pids ) const
+{
+    size_t count = 0;
+    ForEach( [&]( const Entry& entry )
+    {
+        if (name.empty() || entry.nameIs( name ))
+        {
+            pids.emplace_back( entry.pid() );
+            count++;
+        }
+
+        return true;
+    } );
+
+    return count;
+}
+
+/// <summary>
+/// Find first process with given executable name
+/// </summary>
+/// <param name="name">Executable name</param>
+/// <returns>Process ID, 0 if not found</returns>
+uint32_t ProcessList::FindFirst( std::wstring_view name ) const
+{
+    uint32_t pid = 0;
+    ForEach( [&]( const Entry& entry )
+    {
+        if (!entry.nameIs( name ))
+            return true;
+
+        pid = entry.pid();
+        return false;
+    } );
+
+    return pid;
+}
+
+}
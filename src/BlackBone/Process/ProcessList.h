@@ -0,0 +1,149 @@
+#pragma once
+
+#include "../Include/Winheaders.h"
+#include "../Include/Types.h"
+#include "../Include/NativeStructures.h"
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Process thread information
+/// </summary>
+struct ThreadInfo
+{
+    uint32_t tid = 0;
+    uintptr_t startAddress = 0;
+    bool mainThread = false;
+    uint32_t state = 0;         // KTHREAD_STATE
+    uint32_t waitReason = 0;    // KWAIT_REASON, valid for waiting thread
+    uint64_t execTime = 0;      // Kernel and user time, 100ns units
+};
+
+/// <summary>
+/// Process information
+/// </summary>
+struct ProcessInfo
+{
+    uint32_t pid = 0;
+    std::wstring imageName;
+    std::vector<ThreadInfo> threads;
+
+    bool operator < (const ProcessInfo& other)
+    {
+        return this->pid < other.pid;
+    }
+};
+
+/// <summary>
+/// System process list.
+/// Query buffer is kept between Refresh calls, entries are read in place,
+/// so polling for a process allocates nothing once the buffer has grown to fit the list.
+/// </summary>
+class ProcessList
+{
+public:
+    using PROCESS_INFO = _SYSTEM_PROCESS_INFORMATION_T<DWORD_PTR>;
+
+    /// <summary>
+    /// Single process entry, valid until next Refresh
+    /// </summary>
+    class Entry
+    {
+    public:
+        Entry( const PROCESS_INFO* info )
+            : _info( info ) { }
+
+        inline uint32_t pid() const       { return static_cast<uint32_t>(_info->UniqueProcessId); }
+        inline uint32_t parentPid() const { return static_cast<uint32_t>(_info->InheritedFromUniqueProcessId); }
+        inline uint32_t sessionId() const { return _info->SessionId; }
+        inline uint32_t threadCount() const { return _info->NumberOfThreads; }
+        inline int64_t createTime() const { return _info->CreateTime.QuadPart; }
+
+        /// <summary>
+        /// Executable file name
+        /// </summary>
+        /// <returns>Image name, empty for system processes without one</returns>
+        inline std::wstring_view imageName() const
+        {
+            return std::wstring_view(
+                reinterpret_cast<const wchar_t*>(_info->ImageName.Buffer),
+                _info->ImageName.Length / sizeof( wchar_t )
+            );
+        }
+
+        /// <summary>
+        /// Case-insensitive image name comparison
+        /// </summary>
+        /// <param name="name">Executable name</param>
+        /// <returns>true if name matches</returns>
+        BLACKBONE_API bool nameIs( std::wstring_view name ) const;
+
+        /// <summary>
+        /// Build process thread list
+        /// </summary>
+        /// <returns>Thread information</returns>
+        BLACKBONE_API std::vector<ThreadInfo> threads() const;
+
+    private:
+        const PROCESS_INFO* _info;
+    };
+
+public:
+    BLACKBONE_API ProcessList() = default;
+    BLACKBONE_API ~ProcessList() = default;
+
+    /// <summary>
+    /// Query current process list into cached buffer
+    /// </summary>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS Refresh();
+
+    /// <summary>
+    /// Iterate processes from last Refresh. Idle process is skipped
+    /// </summary>
+    /// <param name="fn">Callback, return false to stop</param>
+    /// <returns>true if enumeration was stopped by callback</returns>
+    template<typename Fn>
+    bool ForEach( Fn&& fn ) const
+    {
+        if (!_valid)
+            return false;
+
+        for (auto pInfo = reinterpret_cast<const PROCESS_INFO*>(_buffer.data());;)
+        {
+            if (pInfo->UniqueProcessId != 0 && !fn( Entry( pInfo ) ))
+                return true;
+
+            if (pInfo->NextEntryOffset == 0)
+                return false;
+
+            pInfo = reinterpret_cast<const PROCESS_INFO*>(reinterpret_cast<const uint8_t*>(pInfo) + pInfo->NextEntryOffset);
+        }
+    }
+
+    /// <summary>
+    /// Find processes by executable name
+    /// </summary>
+    /// <param name="name">Executable name. If empty - all processes are returned</param>
+    /// <param name="pids">Found process IDs, appended</param>
+    /// <returns>Number of found processes</returns>
+    BLACKBONE_API size_t FindByName( std::wstring_view name, std::vector<DWORD>& pids ) const;
+
+    /// <summary>
+    /// Find first process with given executable name
+    /// </summary>
+    /// <param name="name">Executable name</param>
+    /// <returns>Process ID, 0 if not found</returns>
+    BLACKBONE_API uint32_t FindFirst( std::wstring_view name ) const;
+
+private:
+    std::vector<uint8_t> _buffer;   // Raw SystemExtendedProcessInformation data
+    bool _valid = false;            // Buffer holds result of successful query
+};
+
+}
@@ -2,6 +2,8 @@
 #include "Process.h"
 #include "../Misc/Trace.hpp"
 
+#include <algorithm>
+
 namespace blackbone
 {
 
@@ -9,6 +11,10 @@ ProcessMemory::ProcessMemory( Process* process )
     : RemoteMemory( process )
     , _process( process )
     , _core( process->core() )  
+    , _regionMap( process->core() )
+    , _codeHeap( *this )
+    , _heap( *this )
+    , _router( *this )
 {
 }
 
@@ -23,10 +29,18 @@ ProcessMemory::~ProcessMemory()
 /// <param name="protection">Memory protection</param>
 /// <param name="desired">Desired base address of new block</param>
 /// <param name="own">false if caller will be responsible for block deallocation</param>
+/// <param name="writeWatch">Track written pages, see MemBlock::GetDirtyPages</param>
 /// <returns>Memory block. If failed - returned block will be invalid</returns>
-call_result_t<MemBlock> ProcessMemory::Allocate( size_t size, DWORD protection /*= PAGE_EXECUTE_READWRITE*/, ptr_t desired /*= 0*/, bool own /*= true*/ )
+call_result_t<MemBlock> ProcessMemory::Allocate(
+    size_t size,
+    DWORD protection /*= PAGE_EXECUTE_READWRITE*/,
+    ptr_t desired /*= 0*/,
+    bool own /*= true*/,
+    bool writeWatch /*= false*/
+    )
 {
-    return MemBlock::Allocate( *this, size, desired, protection, own );
+    Count();
+    return MemBlock::Allocate( *this, size, desired, protection, own, writeWatch );
 }
 
 /// <summary>
@@ -46,6 +60,9 @@ NTSTATUS ProcessMemory::Free( ptr_t pAddr, size_t size /*= 0*/, DWORD freeType /
         BLACKBONE_TRACE( L"Free: Free at address 0x%p", static_cast<uintptr_t>(pAddr) );
     }
 #endif
+    InvalidateCache( pAddr, size );
+    _regionMap.Invalidate( pAddr, size );
+    Count();
     return _core.native()->VirtualFreeExT( pAddr, size, freeType );
 }
 
@@ -57,6 +74,7 @@ NTSTATUS ProcessMemory::Free( ptr_t pAddr, size_t size /*= 0*/, DWORD freeType /
 /// <returns>Status</returns>
 NTSTATUS ProcessMemory::Query( ptr_t pAddr, PMEMORY_BASIC_INFORMATION64 pInfo )
 {
+    Count();
     return _core.native()->VirtualQueryExT( pAddr, pInfo );
 }
 
@@ -74,6 +92,9 @@ NTSTATUS ProcessMemory::Protect( ptr_t pAddr, size_t size, DWORD flProtect, DWOR
     if (pOld == nullptr)
         pOld = &junk;
 
+    InvalidateCache( pAddr, size );
+    _regionMap.Invalidate( pAddr, size );
+    Count();
     return _core.native()->VirtualProtectExT( pAddr, size, CastProtection( flProtect, _core.DEP() ), pOld );
 }
 
@@ -84,50 +105,28 @@ NTSTATUS ProcessMemory::Protect( ptr_t pAddr, size_t size, DWORD flProtect, DWOR
 /// <param name="dwSize">Size of data to read</param>
 /// <param name="pResult">Output buffer</param>
 /// <param name="handleHoles">
-/// If true, function will try to read all committed pages in range ignoring uncommitted ones.
+/// If true, function will try to read all committed pages in range ignoring uncommitted ones, which are zero-filled.
 /// Otherwise function will fail if there is at least one non-committed page in region.
 /// </param>
 /// <returns>Status</returns>
 NTSTATUS ProcessMemory::Read( ptr_t dwAddress, size_t dwSize, PVOID pResult, bool handleHoles /*= false*/ )
 {
-    DWORD64 dwRead = 0;
     if (dwAddress == 0)
         return STATUS_INVALID_ADDRESS;
 
+    LatencyTimer timer( _process->latency().recording( LatencyOp::MemoryRead ) );
+
     // Simple read
     if (!handleHoles)
     {
-        return _core.native()->ReadProcessMemoryT( dwAddress, pResult, dwSize, &dwRead );
-    }
-    // Read all committed memory regions
-    else
-    {
-        MEMORY_BASIC_INFORMATION64 mbi = { 0 };
-
-        for (ptr_t memptr = dwAddress; memptr < dwAddress + dwSize; memptr = mbi.BaseAddress + mbi.RegionSize)
-        {
-            if (_core.native()->VirtualQueryExT( memptr, &mbi ) != STATUS_SUCCESS)
-                continue;
+        if (_cacheEnabled && dwSize <= 4 * CachePageSize)
+            return ReadCached( dwAddress, dwSize, pResult );
 
-            // Filter empty regions
-            if (mbi.State != MEM_COMMIT || mbi.Protect == PAGE_NOACCESS)
-                continue;
-
-            uint64_t region_ptr = memptr - dwAddress;
-
-            auto status = _core.native()->ReadProcessMemoryT(
-                mbi.BaseAddress,
-                reinterpret_cast<uint8_t*>(pResult) + region_ptr,
-                static_cast<size_t>(mbi.RegionSize),
-                &dwRead
-            );
-
-            if (!NT_SUCCESS( status ))
-                return status;
-        }
+        return ReadRange( dwAddress, dwSize, pResult );
     }
 
-    return STATUS_SUCCESS;
+    // Read all committed memory regions
+    return ReadSparse( dwAddress, dwSize, pResult );
 }
 
 /// <summary>
@@ -137,7 +136,7 @@ NTSTATUS ProcessMemory::Read( ptr_t dwAddress, size_t dwSize, PVOID pResult, boo
 /// <param name="dwSize">Size of data to read</param>
 /// <param name="pResult">Output buffer</param>
 /// <param name="handleHoles">
-/// If true, function will try to read all committed pages in range ignoring uncommitted ones.
+/// If true, function will try to read all committed pages in range ignoring uncommitted ones, which are zero-filled.
 /// Otherwise function will fail if there is at least one non-committed page in region.
 /// </param>
 /// <returns>Status</returns>
@@ -157,6 +156,342 @@ NTSTATUS ProcessMemory::Read( const std::vector<ptr_t>& adrList, size_t dwSize,
     return Read( ptr + adrList.back(), dwSize, pResult, handleHoles );
 }
 
+/// <summary>
+/// Read range that may contain non-committed or inaccessible pages.
+/// Adjacent readable regions are read at once, holes are zero-filled.
+/// </summary>
+/// <param name="address">Memory address to read from</param>
+/// <param name="size">Size of data to read</param>
+/// <param name="pResult">Output buffer, at least 'size' bytes</param>
+/// <param name="pageMap">If not null, receives one flag per page touched by range, true if page was read</param>
+/// <returns>Status</returns>
+NTSTATUS ProcessMemory::ReadSparse( ptr_t address, size_t size, PVOID pResult, std::vector<bool>* pageMap /*= nullptr*/ )
+{
+    if (address == 0)
+        return STATUS_INVALID_ADDRESS;
+
+    auto native = _core.native();
+    auto pBuf = reinterpret_cast<uint8_t*>(pResult);
+    const ptr_t pageSize = native->pageSize();
+    const ptr_t end = address + size;
+    const ptr_t firstPage = address & ~(pageSize - 1);
+
+    memset( pResult, 0, size );
+    if (pageMap)
+        pageMap->assign( static_cast<size_t>((end - firstPage + pageSize - 1) / pageSize), false );
+
+    auto markRead = [&]( ptr_t from, ptr_t to )
+    {
+        if (pageMap)
+        {
+            for (ptr_t page = (from - firstPage) / pageSize; page <= (to - 1 - firstPage) / pageSize; page++)
+                (*pageMap)[static_cast<size_t>(page)] = true;
+        }
+    };
+
+    // Read accumulated run of readable regions
+    ptr_t runStart = 0, runEnd = 0;
+    auto flush = [&]()
+    {
+        if (runStart == runEnd)
+            return;
+
+        if (NT_SUCCESS( _core.ReadMemory( runStart, pBuf + (runStart - address), static_cast<size_t>(runEnd - runStart) ) ))
+        {
+            markRead( runStart, runEnd );
+        }
+        else
+        {
+            // Region changed since query, retry page by page
+            for (ptr_t ptr = runStart, next = 0; ptr < runEnd; ptr = next)
+            {
+                next = std::min( (ptr & ~(pageSize - 1)) + pageSize, runEnd );
+                uint8_t* pDst = pBuf + (ptr - address);
+
+                if (NT_SUCCESS( _core.ReadMemory( ptr, pDst, static_cast<size_t>(next - ptr) ) ))
+                    markRead( ptr, next );
+                else
+                    memset( pDst, 0, static_cast<size_t>(next - ptr) );
+            }
+        }
+
+        runStart = runEnd = 0;
+    };
+
+    MEMORY_BASIC_INFORMATION64 mbi = { 0 };
+    for (ptr_t memptr = address, next = 0; memptr < end; memptr = next)
+    {
+        bool readable = false;
+
+        // Skip single page if query failed, so loop always advances
+        if (native->VirtualQueryExT( memptr, &mbi ) != STATUS_SUCCESS || mbi.BaseAddress + mbi.RegionSize <= memptr)
+        {
+            next = (memptr & ~(pageSize - 1)) + pageSize;
+        }
+        else
+        {
+            next = mbi.BaseAddress + mbi.RegionSize;
+            readable = mbi.State == MEM_COMMIT && mbi.Protect != PAGE_NOACCESS && !(mbi.Protect & PAGE_GUARD);
+        }
+
+        next = std::min( next, end );
+
+        if (readable)
+        {
+            if (runStart == runEnd)
+                runStart = memptr;
+
+            runEnd = next;
+        }
+        else
+            flush();
+    }
+
+    flush();
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Read multiple ranges at once.
+/// Requests are sorted by address and adjacent or overlapping ranges are merged into single read.
+/// Merged ranges go to backend selected by router, tiny ones to driver in a single request if it is loaded.
+/// </summary>
+/// <param name="requests">Ranges to read, status of every request is updated</param>
+/// <param name="maxGap">Max number of unused bytes between two ranges that still allows to merge them</param>
+/// <returns>STATUS_SUCCESS if all requests succeeded, otherwise status of first failed request</returns>
+NTSTATUS ProcessMemory::ReadBatch( std::vector<ReadRequest>& requests, size_t maxGap /*= 0*/ )
+{
+    // Don't let gaps blow up single read
+    constexpr size_t maxMerged = 1 * 1024 * 1024;
+
+    std::vector<size_t> order( requests.size() );
+    for (size_t i = 0; i < order.size(); i++)
+        order[i] = i;
+
+    std::sort( order.begin(), order.end(), [&requests]( size_t l, size_t r ) { return requests[l].address < requests[r].address; } );
+
+    // Merged range, reads into scratch buffer if it covers several requests
+    struct Group
+    {
+        ptr_t start;
+        size_t size;
+        size_t first, last;
+        size_t offset;
+    };
+
+    std::vector<Group> groups;
+    size_t scratchSize = 0;
+    NTSTATUS result = STATUS_SUCCESS;
+
+    for (size_t first = 0; first < order.size();)
+    {
+        auto& head = requests[order[first]];
+        ptr_t start = head.address;
+        ptr_t end = head.address + head.size;
+        size_t last = first + 1;
+
+        // Collect group of ranges that can be read at once
+        for (; last < order.size(); last++)
+        {
+            const auto& next = requests[order[last]];
+            ptr_t newEnd = std::max( end, next.address + next.size );
+            if (next.address > end + maxGap || newEnd - start > maxMerged)
+                break;
+
+            end = newEnd;
+        }
+
+        Group group = { start, static_cast<size_t>(end - start), first, last, scratchSize };
+        if (last - first > 1)
+            scratchSize += group.size;
+
+        groups.emplace_back( group );
+        first = last;
+    }
+
+    std::vector<uint8_t> scratch( scratchSize );
+    std::vector<NTSTATUS> statuses( groups.size(), STATUS_INVALID_ADDRESS );
+
+    auto target = [&]( const Group& group )
+    {
+        return group.last - group.first == 1 ? requests[order[group.first]].buffer : scratch.data() + group.offset;
+    };
+
+    std::vector<NativeReadRange> ranges;
+    std::vector<size_t> index;
+    size_t total = 0;
+    ranges.reserve( groups.size() );
+
+    for (size_t i = 0; i < groups.size(); i++)
+    {
+        if (groups[i].start == 0)
+            continue;
+
+        NativeReadRange range;
+        range.address = groups[i].start;
+        range.buffer = target( groups[i] );
+        range.size = groups[i].size;
+
+        ranges.emplace_back( range );
+        index.emplace_back( i );
+        total += groups[i].size;
+    }
+
+    if (!ranges.empty())
+    {
+        auto type = _router.Select( ranges.size(), total );
+        auto start = MemoryRouter::Now();
+
+        _router.backend( type ).ReadBatch( ranges );
+
+        bool failed = false;
+        for (size_t i = 0; i < ranges.size(); i++)
+        {
+            statuses[index[i]] = ranges[i].status;
+            failed |= !NT_SUCCESS( ranges[i].status );
+        }
+
+        // Failed groups are retried request by request below
+        _router.Record( type, ranges.size(), total, MemoryRouter::Now() - start, failed );
+    }
+
+    for (size_t i = 0; i < groups.size(); i++)
+    {
+        auto& group = groups[i];
+        if (group.last - group.first == 1)
+        {
+            requests[order[group.first]].status = statuses[i];
+            continue;
+        }
+
+        for (size_t j = group.first; j < group.last; j++)
+        {
+            auto& req = requests[order[j]];
+
+            // Merged range may span inaccessible pages, so each request gets separate try
+            if (NT_SUCCESS( statuses[i] ))
+            {
+                memcpy( req.buffer, scratch.data() + group.offset + (req.address - group.start), req.size );
+                req.status = STATUS_SUCCESS;
+            }
+            else
+                req.status = req.address != 0 ? ReadRange( req.address, req.size, req.buffer ) : STATUS_INVALID_ADDRESS;
+        }
+    }
+
+    for (const auto& req : requests)
+    {
+        if (!NT_SUCCESS( req.status ))
+        {
+            result = req.status;
+            break;
+        }
+    }
+
+    return result;
+}
+
+/// <summary>
+/// Read single contiguous range through backend selected by router.
+/// Failed non-syscall read is retried through syscall backend
+/// </summary>
+/// <param name="address">Memory address to read from</param>
+/// <param name="size">Size of data to read</param>
+/// <param name="buffer">Output buffer</param>
+/// <returns>Status</returns>
+NTSTATUS ProcessMemory::ReadRange( ptr_t address, size_t size, void* buffer )
+{
+    auto type = _router.Select( 1, size );
+    auto start = MemoryRouter::Now();
+
+    NTSTATUS status = _router.backend( type ).Read( address, size, buffer );
+    bool failed = !NT_SUCCESS( status );
+    if (failed && type != MemoryBackendType::Syscall)
+        status = _router.backend( MemoryBackendType::Syscall ).Read( address, size, buffer );
+
+    // Retry time is charged to failed backend, so cost model learns to avoid it
+    _router.Record( type, 1, size, MemoryRouter::Now() - start, failed );
+    return status;
+}
+
+/// <summary>
+/// Replace read backend, e.g. with custom driver interface.
+/// Not synchronized with reads in progress, set backends before issuing reads
+/// </summary>
+/// <param name="type">Backend to replace</param>
+/// <param name="backend">New backend</param>
+void ProcessMemory::SetBackend( MemoryBackendType type, std::shared_ptr<MemoryBackend> backend )
+{
+    if (backend && type < MemoryBackendType::Count)
+        _router.Set( type, std::move( backend ) );
+}
+
+/// <summary>
+/// Read null-terminated string page by page
+/// </summary>
+/// <param name="address">String address</param>
+/// <param name="maxLength">Max number of characters to read</param>
+/// <param name="result">Read string</param>
+/// <returns>Status</returns>
+template<typename Ch>
+NTSTATUS ProcessMemory::ReadTerminated( ptr_t address, size_t maxLength, std::basic_string<Ch>& result )
+{
+    Ch chunk[0x1000 / sizeof( Ch )];
+    result.clear();
+
+    while (result.size() < maxLength)
+    {
+        // Next page may be inaccessible, character crossing the boundary is read alone
+        size_t pageLeft = static_cast<size_t>(0x1000 - (address & 0xFFF)) / sizeof( Ch );
+        size_t count = std::min( std::max<size_t>( pageLeft, 1 ), maxLength - result.size() );
+
+        auto status = Read( address, count * sizeof( Ch ), chunk );
+        if (!NT_SUCCESS( status ))
+            return status;
+
+        auto end = std::find( chunk, chunk + count, Ch( 0 ) );
+        result.append( chunk, end );
+        if (end != chunk + count)
+            break;
+
+        address += count * sizeof( Ch );
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Read null-terminated string
+/// </summary>
+/// <param name="address">String address</param>
+/// <param name="maxLength">Max number of characters to read</param>
+/// <returns>String, truncated to maxLength</returns>
+call_result_t<std::string> ProcessMemory::ReadCString( ptr_t address, size_t maxLength /*= MAX_PATH*/ )
+{
+    std::string result;
+    auto status = ReadTerminated( address, maxLength, result );
+    if (!NT_SUCCESS( status ))
+        return status;
+
+    return result;
+}
+
+/// <summary>
+/// Read null-terminated wide string
+/// </summary>
+/// <param name="address">String address</param>
+/// <param name="maxLength">Max number of characters to read</param>
+/// <returns>String, truncated to maxLength</returns>
+call_result_t<std::wstring> ProcessMemory::ReadWString( ptr_t address, size_t maxLength /*= MAX_PATH*/ )
+{
+    std::wstring result;
+    auto status = ReadTerminated( address, maxLength, result );
+    if (!NT_SUCCESS( status ))
+        return status;
+
+    return result;
+}
+
 /// <summary>
 /// Write data
 /// </summary>
@@ -166,7 +501,9 @@ NTSTATUS ProcessMemory::Read( const std::vector<ptr_t>& adrList, size_t dwSize,
 /// <returns>Status</returns>
 NTSTATUS ProcessMemory::Write( ptr_t pAddress, size_t dwSize, const void* pData )
 {
-    return _core.native()->WriteProcessMemoryT( pAddress, pData, dwSize );
+    InvalidateCache( pAddress, dwSize );
+    Count( 0, dwSize );
+    return _core.WriteMemory( pAddress, pData, dwSize );
 }
 
 /// <summary>
@@ -192,6 +529,16 @@ NTSTATUS ProcessMemory::Write( const std::vector<ptr_t>& adrList, size_t dwSize,
     return Write( ptr + adrList.back(), dwSize, pData );
 }
 
+/// <summary>
+/// Start write-combining transaction.
+/// Writes are buffered until WriteTransaction::Commit
+/// </summary>
+/// <returns>New transaction</returns>
+WriteTransaction ProcessMemory::BeginWrite()
+{
+    return WriteTransaction( *this );
+}
+
 /// <summary>
 /// Enumerate valid memory regions
 /// </summary>
@@ -202,4 +549,157 @@ std::vector<MEMORY_BASIC_INFORMATION64> ProcessMemory::EnumRegions( bool include
     return _core.native()->EnumRegions( includeFree );
 }
 
+/// <summary>
+/// Unmap any mapped memory, restore hooks, drop cached pages and regions
+/// </summary>
+void ProcessMemory::reset()
+{
+    RemoteMemory::reset();
+    BeginEpoch();
+    _regionMap.Reset();
+}
+
+/// <summary>
+/// Enable page cache for small reads.
+/// Cache is invalidated by Write/Protect/Free calls made through this object, by BeginEpoch or by TTL.
+/// Memory modified by other means (target threads, driver) is not tracked, call BeginEpoch in that case.
+/// </summary>
+/// <param name="maxPages">Max number of cached pages, least recently used pages are evicted first</param>
+/// <param name="ttl">Page lifetime in milliseconds, 0 - pages never expire</param>
+void ProcessMemory::EnableCache( size_t maxPages /*= 256*/, uint32_t ttl /*= 0*/ )
+{
+    CSLock lck( _cacheGuard );
+
+    _cacheMaxPages = std::max<size_t>( maxPages, 1 );
+    _cacheTTL = ttl;
+    _cacheEnabled = true;
+
+    while (_cachePages.size() > _cacheMaxPages)
+    {
+        _cacheIndex.erase( _cachePages.back().base );
+        _cachePages.pop_back();
+    }
+}
+
+/// <summary>
+/// Disable page cache and drop all cached pages
+/// </summary>
+void ProcessMemory::DisableCache()
+{
+    CSLock lck( _cacheGuard );
+
+    _cacheEnabled = false;
+    _cachePages.clear();
+    _cacheIndex.clear();
+}
+
+/// <summary>
+/// Drop all cached pages and start new epoch.
+/// Pointer caches (multi_ptr_ex, PtrChainResolver) compare epoch to detect stale data
+/// </summary>
+void ProcessMemory::BeginEpoch()
+{
+    _epoch++;
+    InvalidateCache( 0, 0 );
+}
+
+/// <summary>
+/// Read data through page cache
+/// </summary>
+/// <param name="address">Memory address to read from</param>
+/// <param name="size">Size of data to read</param>
+/// <param name="buffer">Output buffer</param>
+/// <returns>Status</returns>
+NTSTATUS ProcessMemory::ReadCached( ptr_t address, size_t size, void* buffer )
+{
+    CSLock lck( _cacheGuard );
+
+    const uint64_t now = _cacheTTL != 0 ? GetTickCount64() : 0;
+    const ptr_t end = address + size;
+
+    for (ptr_t page = address & ~static_cast<ptr_t>(CachePageSize - 1); page < end; page += CachePageSize)
+    {
+        auto iter = _cacheIndex.find( page );
+        if (iter != _cacheIndex.end() && _cacheTTL != 0 && now - iter->second->time > _cacheTTL)
+        {
+            _cachePages.erase( iter->second );
+            _cacheIndex.erase( iter );
+            iter = _cacheIndex.end();
+        }
+
+        if (iter != _cacheIndex.end())
+        {
+            _cacheHits++;
+            _cachePages.splice( _cachePages.begin(), _cachePages, iter->second );
+        }
+        else
+        {
+            _cacheMisses++;
+            _cachePages.emplace_front();
+            auto& entry = _cachePages.front();
+            entry.base = page;
+            entry.time = now;
+
+            // Inaccessible page, let uncached read report proper status
+            Count( CachePageSize );
+            if (!NT_SUCCESS( _core.ReadMemory( page, entry.data.data(), CachePageSize ) ))
+            {
+                _cachePages.pop_front();
+                Count( size );
+                return _core.ReadMemory( address, buffer, size );
+            }
+
+            _cacheIndex.emplace( page, _cachePages.begin() );
+        }
+
+        // Copy overlapping part
+        const auto& entry = _cachePages.front();
+        ptr_t from = std::max( page, address );
+        ptr_t to = std::min( page + CachePageSize, end );
+        memcpy( reinterpret_cast<uint8_t*>(buffer) + (from - address), entry.data.data() + (from - page), static_cast<size_t>(to - from) );
+
+        if (_cachePages.size() > _cacheMaxPages)
+        {
+            _cacheIndex.erase( _cachePages.back().base );
+            _cachePages.pop_back();
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Drop cached pages in range
+/// </summary>
+/// <param name="address">Range start</param>
+/// <param name="size">Range size, 0 - drop all pages</param>
+void ProcessMemory::InvalidateCache( ptr_t address, size_t size )
+{
+    if (!_cacheEnabled)
+        return;
+
+    CSLock lck( _cacheGuard );
+
+    const ptr_t first = address & ~static_cast<ptr_t>(CachePageSize - 1);
+    const ptr_t end = address + size;
+
+    // Release or big range, cheaper to drop everything
+    if (size == 0 || (end - first) / CachePageSize >= _cachePages.size())
+    {
+        _cachePages.clear();
+        _cacheIndex.clear();
+        return;
+    }
+
+    for (ptr_t page = first; page < end; page += CachePageSize)
+    {
+        auto iter = _cacheIndex.find( page );
+        if (iter != _cacheIndex.end())
+        {
+            _cachePages.erase( iter->second );
+            _cacheIndex.erase( iter );
+        }
+    }
+}
+
 }
\ No newline at end of file
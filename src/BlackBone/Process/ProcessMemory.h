@@ -1,15 +1,51 @@
 #pragma once
 
 #include "../Include/Winheaders.h"
+#include "../Include/NativeStructures.h"
+#include "../Include/Macro.h"
 #include "RPC/RemoteMemory.h"
 #include "MemBlock.h"
+#include "RegionMap.h"
+#include "RemoteCodeHeap.h"
+#include "RemoteHeap.h"
+#include "WriteTransaction.h"
+#include "MemoryBackend.h"
+#include "../Misc/Utils.h"
 
+#include <string>
 #include <vector>
 #include <list>
+#include <array>
+#include <unordered_map>
+#include <atomic>
+#include <type_traits>
 
 namespace blackbone
 {
 
+/// <summary>
+/// Single entry of batched read
+/// </summary>
+struct ReadRequest
+{
+    ptr_t address = 0;                  // Address to read from
+    size_t size = 0;                    // Number of bytes to read
+    void* buffer = nullptr;             // Output buffer
+    NTSTATUS status = STATUS_SUCCESS;   // Read status, filled by ReadBatch
+};
+
+/// <summary>
+/// Cumulative memory operation counters
+/// </summary>
+struct MemoryCounters
+{
+    uint64_t calls = 0;                 // Memory syscalls issued
+    uint64_t bytesRead = 0;             // Bytes read from target
+    uint64_t bytesWritten = 0;          // Bytes written into target
+    uint64_t cacheHits = 0;             // Pages served from page cache
+    uint64_t cacheMisses = 0;           // Pages read into page cache
+};
+
 class ProcessMemory : public RemoteMemory
 {
 public:
@@ -23,8 +59,15 @@ public:
     /// <param name="protection">Memory protection</param>
     /// <param name="desired">Desired base address of new block</param>
     /// <param name="desired">false if caller will be responsible for block deallocation</param>
+    /// <param name="writeWatch">Track written pages, see MemBlock::GetDirtyPages</param>
     /// <returns>Memory block. If failed - returned block will be invalid</returns>
-    BLACKBONE_API call_result_t<MemBlock> Allocate( size_t size, DWORD protection = PAGE_EXECUTE_READWRITE, ptr_t desired = 0, bool own = true );
+    BLACKBONE_API call_result_t<MemBlock> Allocate(
+        size_t size,
+        DWORD protection = PAGE_EXECUTE_READWRITE,
+        ptr_t desired = 0,
+        bool own = true,
+        bool writeWatch = false
+        );
 
     /// <summary>
     /// Free memory
@@ -60,7 +103,7 @@ public:
     /// <param name="dwSize">Size of data to read</param>
     /// <param name="pResult">Output buffer</param>
     /// <param name="handleHoles">
-    /// If true, function will try to read all committed pages in range ignoring uncommitted ones.
+    /// If true, function will try to read all committed pages in range ignoring uncommitted ones, which are zero-filled.
     /// Otherwise function will fail if there is at least one non-committed page in region.
     /// </param>
     /// <returns>Status</returns>
@@ -73,12 +116,33 @@ public:
     /// <param name="dwSize">Size of data to read</param>
     /// <param name="pResult">Output buffer</param>
     /// <param name="handleHoles">
-    /// If true, function will try to read all committed pages in range ignoring uncommitted ones.
+    /// If true, function will try to read all committed pages in range ignoring uncommitted ones, which are zero-filled.
     /// Otherwise function will fail if there is at least one non-committed page in region.
     /// </param>
     /// <returns>Status</returns>
     BLACKBONE_API NTSTATUS Read( const std::vector<ptr_t>& adrList, size_t dwSize, PVOID pResult, bool handleHoles = false );
 
+    /// <summary>
+    /// Read range that may contain non-committed or inaccessible pages.
+    /// Adjacent readable regions are read at once, holes are zero-filled.
+    /// </summary>
+    /// <param name="address">Memory address to read from</param>
+    /// <param name="size">Size of data to read</param>
+    /// <param name="pResult">Output buffer, at least 'size' bytes</param>
+    /// <param name="pageMap">If not null, receives one flag per page touched by range, true if page was read</param>
+    /// <returns>Status</returns>
+    BLACKBONE_API NTSTATUS ReadSparse( ptr_t address, size_t size, PVOID pResult, std::vector<bool>* pageMap = nullptr );
+
+    /// <summary>
+    /// Read multiple ranges at once.
+    /// Requests are sorted by address and adjacent or overlapping ranges are merged into single read.
+    /// If BlackBone driver is loaded, all merged ranges are read through it in a single request.
+    /// </summary>
+    /// <param name="requests">Ranges to read, status of every request is updated</param>
+    /// <param name="maxGap">Max number of unused bytes between two ranges that still allows to merge them</param>
+    /// <returns>STATUS_SUCCESS if all requests succeeded, otherwise status of first failed request</returns>
+    BLACKBONE_API NTSTATUS ReadBatch( std::vector<ReadRequest>& requests, size_t maxGap = 0 );
+
     /// <summary>
     /// Write data
     /// </summary>
@@ -97,6 +161,13 @@ public:
     /// <returns>Status</returns>
     BLACKBONE_API NTSTATUS Write( const std::vector<ptr_t>& adrList, size_t dwSize, const void* pData );
 
+    /// <summary>
+    /// Start write-combining transaction.
+    /// Writes are buffered until WriteTransaction::Commit
+    /// </summary>
+    /// <returns>New transaction</returns>
+    BLACKBONE_API WriteTransaction BeginWrite();
+
     /// <summary>
     /// Read data
     /// </summary>
@@ -147,6 +218,140 @@ public:
         return Read( std::forward<std::vector<ptr_t>>( adrList ), sizeof( result ), &result );
     };
 
+    /// <summary>
+    /// Read array of values with single read
+    /// </summary>
+    /// <param name="address">Address of first element</param>
+    /// <param name="count">Number of elements</param>
+    /// <returns>Read elements</returns>
+    template<class T>
+    inline call_result_t<std::vector<T>> ReadArray( ptr_t address, size_t count )
+    {
+        std::vector<T> result( count );
+        auto status = count != 0 ? Read( address, count * sizeof( T ), result.data() ) : STATUS_SUCCESS;
+        if (!NT_SUCCESS( status ))
+            return status;
+
+        return result;
+    }
+
+    /// <summary>
+    /// Read only selected fields of remote structure, e.g. ReadFields<_PEB64, &_PEB64::Ldr, &_PEB64::ImageBaseAddress>( ptr ).
+    /// Fields close to each other are fetched by single read, distant ones by one batched read.
+    /// Fields that weren't selected are zero
+    /// </summary>
+    /// <param name="address">Structure address</param>
+    /// <returns>Partially filled structure</returns>
+    template<typename T, auto... Fields>
+    inline call_result_t<T> ReadFields( ptr_t address )
+    {
+        static_assert(sizeof...(Fields) > 0, "No fields selected");
+        static_assert(std::is_trivially_copyable_v<T>, "Structure must be trivially copyable");
+
+        T result;
+        memset( &result, 0, sizeof( result ) );
+
+        std::vector<ReadRequest> requests = { FieldRequest( address, result, Fields )... };
+        auto status = ReadBatch( requests, FieldGap );
+        if (!NT_SUCCESS( status ))
+            return status;
+
+        return result;
+    }
+
+    /// <summary>
+    /// Read contents of UNICODE_STRING already fetched from target, exactly 'Length' bytes
+    /// </summary>
+    /// <param name="str">String descriptor, T is pointer type of target string</param>
+    /// <returns>String</returns>
+    template<class T>
+    inline call_result_t<std::wstring> ReadUnicodeString( const _UNICODE_STRING_T<T>& str )
+    {
+        std::wstring result( str.Length / sizeof( wchar_t ), L'\0' );
+        if (result.empty())
+            return result;
+
+        auto status = Read( str.Buffer, result.size() * sizeof( wchar_t ), &result[0] );
+        if (!NT_SUCCESS( status ))
+            return status;
+
+        return result;
+    }
+
+    /// <summary>
+    /// Read UNICODE_STRING and its contents, two exact-size reads
+    /// </summary>
+    /// <param name="address">Address of UNICODE_STRING, T is pointer type of target string</param>
+    /// <returns>String</returns>
+    template<class T>
+    inline call_result_t<std::wstring> ReadUnicodeString( ptr_t address )
+    {
+        _UNICODE_STRING_T<T> str = { };
+        auto status = Read( address, sizeof( str ), &str );
+        if (!NT_SUCCESS( status ))
+            return status;
+
+        return ReadUnicodeString( str );
+    }
+
+    /// <summary>
+    /// Read many UNICODE_STRINGs, e.g. names of all loader entries.
+    /// All descriptors are fetched by one batched read and all contents by another
+    /// </summary>
+    /// <param name="addresses">Addresses of UNICODE_STRING, T is pointer type of target strings</param>
+    /// <param name="result">Strings in order of addresses, failed ones are empty</param>
+    /// <returns>STATUS_SUCCESS if all strings were read, otherwise status of first failed read</returns>
+    template<class T>
+    inline NTSTATUS ReadUnicodeStrings( const std::vector<ptr_t>& addresses, std::vector<std::wstring>& result )
+    {
+        std::vector<_UNICODE_STRING_T<T>> descriptors( addresses.size() );
+        std::vector<ReadRequest> requests( addresses.size() );
+        for (size_t i = 0; i < addresses.size(); i++)
+            requests[i] = { addresses[i], sizeof( descriptors[i] ), &descriptors[i] };
+
+        NTSTATUS status = ReadBatch( requests );
+
+        result.assign( addresses.size(), std::wstring() );
+        std::vector<ReadRequest> data;
+        std::vector<size_t> index;
+        for (size_t i = 0; i < addresses.size(); i++)
+        {
+            if (!NT_SUCCESS( requests[i].status ) || descriptors[i].Length < sizeof( wchar_t ))
+                continue;
+
+            result[i].resize( descriptors[i].Length / sizeof( wchar_t ) );
+            data.push_back( { static_cast<ptr_t>(descriptors[i].Buffer), result[i].size() * sizeof( wchar_t ), &result[i][0] } );
+            index.emplace_back( i );
+        }
+
+        NTSTATUS dataStatus = data.empty() ? STATUS_SUCCESS : ReadBatch( data );
+        for (size_t i = 0; i < data.size(); i++)
+        {
+            if (!NT_SUCCESS( data[i].status ))
+                result[index[i]].clear();
+        }
+
+        return NT_SUCCESS( status ) ? dataStatus : status;
+    }
+
+    /// <summary>
+    /// Read null-terminated string.
+    /// String is read in chunks that never cross page boundary, so readable string followed by inaccessible page is read successfully
+    /// </summary>
+    /// <param name="address">String address</param>
+    /// <param name="maxLength">Max number of characters to read</param>
+    /// <returns>String, truncated to maxLength</returns>
+    BLACKBONE_API call_result_t<std::string> ReadCString( ptr_t address, size_t maxLength = MAX_PATH );
+
+    /// <summary>
+    /// Read null-terminated wide string.
+    /// String is read in chunks that never cross page boundary, so readable string followed by inaccessible page is read successfully
+    /// </summary>
+    /// <param name="address">String address</param>
+    /// <param name="maxLength">Max number of characters to read</param>
+    /// <returns>String, truncated to maxLength</returns>
+    BLACKBONE_API call_result_t<std::wstring> ReadWString( ptr_t address, size_t maxLength = MAX_PATH );
+
     /// <summary>
     /// Write data
     /// </summary>
@@ -178,16 +383,208 @@ public:
     /// <returns>Found regions</returns>
     BLACKBONE_API std::vector<MEMORY_BASIC_INFORMATION64> EnumRegions( bool includeFree = false );
 
+    /// <summary>
+    /// Get cached region map.
+    /// Map is built by first Refresh call, Allocate/Free/Protect made through this object mark changed ranges.
+    /// </summary>
+    /// <returns>Region map</returns>
+    BLACKBONE_API inline RegionMap& regionMap() { return _regionMap; }
+
+    /// <summary>
+    /// Get executable memory heap shared by all injected code
+    /// </summary>
+    /// <returns>Code heap</returns>
+    BLACKBONE_API inline RemoteCodeHeap& codeHeap() { return _codeHeap; }
+
+    /// <summary>
+    /// Get heap for small data blocks: strings, argument blocks, etc.
+    /// </summary>
+    /// <returns>Data heap</returns>
+    BLACKBONE_API inline RemoteHeap& heap() { return _heap; }
+
+    /// <summary>
+    /// Unmap any mapped memory, restore hooks, drop cached pages and regions
+    /// </summary>
+    BLACKBONE_API void reset();
+
+    /// <summary>
+    /// Enable page cache for small reads.
+    /// Cache is invalidated by Write/Protect/Free calls made through this object, by BeginEpoch or by TTL.
+    /// Memory modified by other means (target threads, driver) is not tracked, call BeginEpoch in that case.
+    /// </summary>
+    /// <param name="maxPages">Max number of cached pages, least recently used pages are evicted first</param>
+    /// <param name="ttl">Page lifetime in milliseconds, 0 - pages never expire</param>
+    BLACKBONE_API void EnableCache( size_t maxPages = 256, uint32_t ttl = 0 );
+
+    /// <summary>
+    /// Disable page cache and drop all cached pages
+    /// </summary>
+    BLACKBONE_API void DisableCache();
+
+    /// <summary>
+    /// Drop all cached pages and start new epoch.
+    /// Pointer caches (multi_ptr_ex, PtrChainResolver) compare epoch to detect stale data
+    /// </summary>
+    BLACKBONE_API void BeginEpoch();
+
+    /// <summary>
+    /// Current cache epoch
+    /// </summary>
+    /// <returns>Epoch number</returns>
+    BLACKBONE_API inline uint64_t epoch() const { return _epoch; }
+
+    /// <summary>
+    /// Check if page cache is enabled
+    /// </summary>
+    /// <returns>true if enabled</returns>
+    BLACKBONE_API inline bool cacheEnabled() const { return _cacheEnabled; }
+
+    /// <summary>
+    /// Memory operations made through this object so far.
+    /// Driver requests and page cache hits are not counted as calls
+    /// </summary>
+    /// <returns>Counters snapshot</returns>
+    BLACKBONE_API inline MemoryCounters counters() const
+    {
+        MemoryCounters result;
+        result.calls = _calls;
+        result.bytesRead = _bytesRead;
+        result.bytesWritten = _bytesWritten;
+        result.cacheHits = _cacheHits;
+        result.cacheMisses = _cacheMisses;
+        return result;
+    }
+
+    /// <summary>
+    /// Replace read backend, e.g. with custom driver interface.
+    /// Not synchronized with reads in progress, set backends before issuing reads
+    /// </summary>
+    /// <param name="type">Backend to replace</param>
+    /// <param name="backend">New backend</param>
+    BLACKBONE_API void SetBackend( MemoryBackendType type, std::shared_ptr<MemoryBackend> backend );
+
+    /// <summary>
+    /// Read backend routing rules
+    /// </summary>
+    /// <returns>Policy, may be changed in place</returns>
+    BLACKBONE_API inline MemoryPolicy& backendPolicy() { return _router.policy(); }
+
+    /// <summary>
+    /// Requests served by read backend so far
+    /// </summary>
+    /// <param name="type">Backend type</param>
+    /// <returns>Counters snapshot</returns>
+    BLACKBONE_API inline MemoryBackendStats backendStats( MemoryBackendType type ) const { return _router.stats( type ); }
+
+    /// <summary>
+    /// Forget measured backend costs, routing falls back to policy thresholds until new samples are collected
+    /// </summary>
+    BLACKBONE_API inline void ResetBackendStats() { _router.ResetStats(); }
+
     BLACKBONE_API inline class ProcessCore& core() { return _core; }
     BLACKBONE_API inline class Process* process()  { return _process; }
 
 private:
+    /// <summary>
+    /// Read single contiguous range through backend selected by router.
+    /// Failed non-syscall read is retried through syscall backend
+    /// </summary>
+    /// <param name="address">Memory address to read from</param>
+    /// <param name="size">Size of data to read</param>
+    /// <param name="buffer">Output buffer</param>
+    /// <returns>Status</returns>
+    NTSTATUS ReadRange( ptr_t address, size_t size, void* buffer );
+
+    /// <summary>
+    /// Read data through page cache
+    /// </summary>
+    /// <param name="address">Memory address to read from</param>
+    /// <param name="size">Size of data to read</param>
+    /// <param name="buffer">Output buffer</param>
+    /// <returns>Status</returns>
+    NTSTATUS ReadCached( ptr_t address, size_t size, void* buffer );
+
+    /// <summary>
+    /// Read null-terminated string page by page
+    /// </summary>
+    /// <param name="address">String address</param>
+    /// <param name="maxLength">Max number of characters to read</param>
+    /// <param name="result">Read string</param>
+    /// <returns>Status</returns>
+    template<typename Ch>
+    NTSTATUS ReadTerminated( ptr_t address, size_t maxLength, std::basic_string<Ch>& result );
+
+    /// <summary>
+    /// Make read request for structure field
+    /// </summary>
+    /// <param name="address">Structure address</param>
+    /// <param name="result">Local structure</param>
+    /// <param name="member">Field</param>
+    /// <returns>Read request</returns>
+    template<typename T, typename U>
+    static inline ReadRequest FieldRequest( ptr_t address, T& result, U T::*member )
+    {
+        return { fieldPtr( address, member ), sizeof( U ), &(result.*member) };
+    }
+
+    static constexpr size_t FieldGap = 0x100;   // Largest gap between fields read at once
+
+    /// <summary>
+    /// Drop cached pages in range
+    /// </summary>
+    /// <param name="address">Range start</param>
+    /// <param name="size">Range size, 0 - drop all pages</param>
+    void InvalidateCache( ptr_t address, size_t size );
+
+    /// <summary>
+    /// Count memory syscall
+    /// </summary>
+    /// <param name="read">Bytes read</param>
+    /// <param name="written">Bytes written</param>
+    inline void Count( size_t read = 0, size_t written = 0 )
+    {
+        _calls++;
+        _bytesRead += read;
+        _bytesWritten += written;
+    }
+
+    friend class SyscallBackend;
+
     ProcessMemory( const ProcessMemory& ) = delete;
     ProcessMemory& operator =( const ProcessMemory& ) = delete;
 
 private:
+    static constexpr size_t CachePageSize = 0x1000;
+
+    struct CachedPage
+    {
+        ptr_t base;                                     // Page address
+        uint64_t time;                                  // Read time
+        std::array<uint8_t, CachePageSize> data;        // Page data
+    };
+
+    using PageList = std::list<CachedPage>;
+
     class Process* _process;    // Owning process object
     class ProcessCore& _core;   // Core routines
+    RegionMap _regionMap;       // Cached region map
+    RemoteCodeHeap _codeHeap;   // Injected code memory
+    RemoteHeap _heap;           // Small data blocks
+    MemoryRouter _router;       // Read backends
+
+    std::atomic<uint64_t> _epoch{ 0 };                          // Cache epoch
+    std::atomic<bool> _cacheEnabled{ false };                   // Page cache is enabled, checked without lock
+    size_t _cacheMaxPages = 0;                                  // Cache size cap
+    uint32_t _cacheTTL = 0;                                     // Page lifetime, ms
+    PageList _cachePages;                                       // Cached pages, most recently used first
+    std::unordered_map<ptr_t, PageList::iterator> _cacheIndex;  // Page address -> cached page
+    CriticalSection _cacheGuard;                                // Cache lock
+
+    std::atomic<uint64_t> _calls{ 0 };                          // Memory syscalls issued
+    std::atomic<uint64_t> _bytesRead{ 0 };                      // Bytes read from target
+    std::atomic<uint64_t> _bytesWritten{ 0 };                   // Bytes written into target
+    std::atomic<uint64_t> _cacheHits{ 0 };                      // Pages served from page cache
+    std::atomic<uint64_t> _cacheMisses{ 0 };                    // Pages read into page cache
 };
 
 }
\ No newline at end of file
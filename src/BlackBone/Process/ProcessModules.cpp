@@ -3,6 +3,7 @@
 #include "Process.h"
 #include "RPC/RemoteExec.h"
 #include "../Misc/NameResolve.h"
+#include "../DriverControl/DriverControl.h"
 #include "../Misc/Utils.h"
 #include "../Symbols/SymbolData.h"
 #include "../Asm/AsmFactory.h"
@@ -19,6 +20,13 @@
 
 namespace blackbone
 {
+// LDR_DLL_NOTIFICATION_REASON_*
+constexpr uint32_t NotifyLoaded = 1;
+constexpr uint32_t NotifyUnloaded = 2;
+
+std::map<ProcessModules::SharedIndexKey, ProcessModules::ExportIndexPtr> ProcessModules::_sharedExports;
+CriticalSection ProcessModules::_sharedGuard;
+
 ProcessModules::ProcessModules( class Process& proc )
     : _proc( proc )
     , _memory( _proc.memory() )
@@ -31,21 +39,46 @@ ProcessModules::~ProcessModules()
 {
 }
 
+/// <summary>
+/// File name part of path
+/// </summary>
+/// <param name="path">Path</param>
+/// <returns>File name</returns>
+static std::wstring_view StripPathView( std::wstring_view path )
+{
+    auto idx = path.find_last_of( L"\\/" );
+    return idx != path.npos ? path.substr( idx + 1 ) : path;
+}
+
 /// <summary>
 /// Get module by name
 /// </summary>
 /// <param name="name">Module name</param>
 /// <param name="type">Module type. 32 bit or 64 bit</param>
 /// <param name="search">Saerch type.</param>
+/// <param name="baseModule">Import module name. Used only to resolve ApiSchema during manual map</param>
 /// <returns>Module data. nullptr if not found</returns>
 ModuleDataPtr ProcessModules::GetModule(
-    const std::wstring& name,
+    std::wstring_view name,
     eModSeachType search /*= LdrList*/,
-    eModType type /*= mt_default*/
+    eModType type /*= mt_default*/,
+    const wchar_t* baseModule /*= L""*/
     )
 {
-    std::wstring namecopy( Utils::StripPath( name ) );
-    return GetModule( namecopy, search, type );
+    auto stripped = StripPathView( name );
+
+    // Only api set names have to be resolved into a new string
+    if (NameResolve::Instance().IsApiSet( stripped ))
+    {
+        std::wstring namecopy( stripped );
+        return GetModule( namecopy, search, type, baseModule );
+    }
+
+    // Detect module type
+    if (type == mt_default)
+        type = _proc.barrier().targetWow64 ? mt_mod32 : mt_mod64;
+
+    return FindModule( ModuleKey( stripped, type ), search );
 }
 
 /// <summary>
@@ -69,20 +102,51 @@ ModuleDataPtr ProcessModules::GetModule(
     if (type == mt_default)
         type = _proc.barrier().targetWow64 ? mt_mod32 : mt_mod64;
 
-    CSLock lck( _modGuard );
+    return FindModule( ModuleKey( name, type ), search );
+}
 
-    auto key = std::make_pair( name, type );
+/// <summary>
+/// Find module by cache key, rescan module list on miss
+/// </summary>
+/// <param name="key">Module name and type</param>
+/// <param name="search">Search type</param>
+/// <returns>Module data. nullptr if not found</returns>
+ModuleDataPtr ProcessModules::FindModule( const ModuleKey& key, eModSeachType search )
+{
+    // Cache is kept up to date by loader notifications
+    if (DrainNotifications( search, key.type ))
+    {
+        SharedLock lck( _modGuard );
+
+        auto iter = _modules.find( key );
+        return iter != _modules.end() ? iter->second : nullptr;
+    }
 
     // Fast lookup
-    if (_modules.count( key ) && (_modules[key]->manual || ValidateModule( _modules[key]->baseAddress )))
-        return _modules[key];
+    ModuleDataPtr cached;
+    {
+        SharedLock lck( _modGuard );
+
+        auto iter = _modules.find( key );
+        if (iter != _modules.end())
+            cached = iter->second;
+    }
 
-    UpdateModuleCache( search, type );
+    // Headers are validated without holding the lock
+    if (cached && (cached->manual || ValidateModule( cached->baseAddress )))
+        return cached;
 
-    if (_modules.count( key ))
-        return _modules[key];
+    ExclusiveLock lck( _modGuard );
 
-    return nullptr;
+    // Drop stale entry, otherwise it won't be replaced by rescan
+    auto iter = _modules.find( key );
+    if (cached && iter != _modules.end() && iter->second == cached)
+        EraseModule( iter );
+
+    UpdateModuleCache( search, key.type );
+
+    iter = _modules.find( key );
+    return iter != _modules.end() ? iter->second : nullptr;
 }
 
 /// <summary>
@@ -104,29 +168,23 @@ ModuleDataPtr ProcessModules::GetModule(
     if (type == mt_default)
         type = _proc.barrier().targetWow64 ? mt_mod32 : mt_mod64;
 
-    CSLock lck( _modGuard );
+    bool tracked = DrainNotifications( search, type );
+    {
+        SharedLock lck( _modGuard );
 
-    auto compFn = [modBase, strict]( const mapModules::value_type& val )
-    { 
-        if (strict)
-            return (val.second->baseAddress == modBase);
-        else
-            return (modBase >= val.second->baseAddress && modBase < val.second->baseAddress + val.second->size);
-    };
+        auto mod = FindByAddress( modBase, strict );
+        if (mod)
+            return mod;
+    }
 
-    auto iter = std::find_if( _modules.begin(), _modules.end(), compFn );
+    // Cache is kept up to date by loader notifications
+    if (tracked)
+        return nullptr;
 
-    if (iter != _modules.end())
-        return iter->second;
+    ExclusiveLock lck( _modGuard );
 
     UpdateModuleCache( search , type );
-
-    iter = std::find_if( _modules.begin(), _modules.end(), compFn );
-
-    if (iter != _modules.end())
-        return iter->second;
-    else
-        return nullptr;
+    return FindByAddress( modBase, strict );
 }
 
 /// <summary>
@@ -161,13 +219,13 @@ ModuleDataPtr ProcessModules::GetMainModule()
 const ProcessModules::mapModules& ProcessModules::GetAllModules( eModSeachType search /*= LdrList*/ )
 {
     eModType mt = _core.isWow64() ? mt_mod32 : mt_mod64;
-    CSLock lck( _modGuard );
+    ExclusiveLock lck( _modGuard );
 
     // Remove non-manual modules
     for (auto iter = _modules.begin(); iter != _modules.end();)
     {
         if (!iter->second->manual) 
-            _modules.erase( iter++ );
+            iter = EraseModule( iter );
         else 
             ++iter;
     }
@@ -188,6 +246,8 @@ const ProcessModules::mapModules& ProcessModules::GetAllModules( eModSeachType s
 /// <returns>List of modules</returns>
 ProcessModules::mapModules ProcessModules::GetManualModules()
 {
+    SharedLock lck( _modGuard );
+
     ProcessModules::mapModules mods;
     std::copy_if( 
         _modules.begin(), _modules.end(), 
@@ -219,11 +279,229 @@ call_result_t<exportData> ProcessModules::GetExport( const ModuleDataPtr& hMod,
 /// <returns>Export info. If failed procAddress field is 0</returns>
 call_result_t<exportData> ProcessModules::GetExport( const ModuleData& hMod, const char* name_ord, const wchar_t* baseModule /*= L"0"*/ )
 {
-    exportData data;
+    auto results = GetExports( hMod, std::vector<const char*>{ name_ord }, baseModule );
+    return std::move( results.front() );
+}
+
+/// <summary>
+/// Get multiple exports at once. Forwarded exports are resolved in one pass per forward module
+/// </summary>
+/// <param name="hMod">Module to search in</param>
+/// <param name="names">Function names or ordinals</param>
+/// <param name="baseModule">Import module name. Only used to resolve ApiSchema during manual map.</param>
+/// <returns>Export info for every name, in the same order</returns>
+std::vector<call_result_t<exportData>> ProcessModules::GetExports(
+    const ModuleDataPtr& hMod,
+    const std::vector<const char*>& names,
+    const wchar_t* baseModule /*= L""*/
+    )
+{
+    return GetExports( *hMod, names, baseModule );
+}
+
+/// <summary>
+/// Get multiple exports at once. Forwarded exports are resolved in one pass per forward module
+/// </summary>
+/// <param name="hMod">Module to search in</param>
+/// <param name="names">Function names or ordinals</param>
+/// <param name="baseModule">Import module name. Only used to resolve ApiSchema during manual map.</param>
+/// <returns>Export info for every name, in the same order</returns>
+std::vector<call_result_t<exportData>> ProcessModules::GetExports(
+    const ModuleData& hMod,
+    const std::vector<const char*>& names,
+    const wchar_t* baseModule /*= L""*/
+    )
+{
+    std::vector<call_result_t<exportData>> results( names.size() );
 
     // Invalid module
     if (hMod.baseAddress == 0)
-        return STATUS_INVALID_PARAMETER_1;
+    {
+        for (auto& result : results)
+            result = STATUS_INVALID_PARAMETER_1;
+
+        return results;
+    }
+
+    auto index = GetExportIndex( hMod );
+    if (!index)
+    {
+        for (auto& result : results)
+            result = index.status;
+
+        return results;
+    }
+
+    const auto& exports = *index.result();
+
+    // Forwarded entries grouped by forward module
+    std::map<std::wstring, std::vector<size_t>> forwarded;
+    std::vector<WORD> ordIndexes( names.size(), 0xFFFF );
+    std::wstring_view importModule = baseModule ? baseModule : L"";
+
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        auto name_ord = names[i];
+        WORD ordIndex = 0xFFFF;
+
+        // Find by ordinal
+        if (reinterpret_cast<uintptr_t>(name_ord) <= 0xFFFF)
+        {
+            auto ordinal = static_cast<WORD>(reinterpret_cast<uintptr_t>(name_ord));
+            if (ordinal >= exports.ordinalBase && ordinal - exports.ordinalBase < exports.functions.size())
+                ordIndex = static_cast<WORD>(ordinal - exports.ordinalBase);
+        }
+        // Find by name
+        else
+        {
+            auto iter = exports.names.find( name_ord );
+            if (iter != exports.names.end() && iter->second < exports.functions.size())
+                ordIndex = iter->second;
+        }
+
+        if (ordIndex == 0xFFFF)
+        {
+            results[i] = STATUS_NOT_FOUND;
+            continue;
+        }
+
+        ordIndexes[i] = ordIndex;
+
+        // Check forwarded export
+        exportData data;
+        auto fwd = exports.forwards.find( ordIndex );
+        if (fwd != exports.forwards.end())
+        {
+            // Chain was already resolved
+            {
+                CSLock lck( _exportGuard );
+                auto memo = _forwardMemo.find( std::make_tuple( hMod.baseAddress, ordIndex, importModule ) );
+                if (memo != _forwardMemo.end())
+                {
+                    results[i] = memo->second;
+                    continue;
+                }
+            }
+
+            data = fwd->second;
+            forwarded[data.forwardModule].emplace_back( i );
+        }
+
+        data.procAddress = exports.functions[ordIndex] + hMod.baseAddress;
+        results[i] = call_result_t<exportData>( data, data.isForwarded ? STATUS_SOME_NOT_MAPPED : STATUS_SUCCESS );
+    }
+
+    // Resolve forwards
+    for (auto& [fwdModule, ids] : forwarded)
+    {
+        // Check if forward mod is loaded
+        auto hChainMod = GetModule( fwdModule, LdrList, exports.type, baseModule );
+        if (hChainMod == nullptr)
+            continue;
+
+        std::vector<const char*> fwdNames;
+        fwdNames.reserve( ids.size() );
+        for (auto id : ids)
+        {
+            const auto& data = results[id].result();
+            if (data.forwardByOrd)
+                fwdNames.emplace_back( reinterpret_cast<const char*>(data.forwardOrdinal) );
+            else
+                fwdNames.emplace_back( data.forwardName.c_str() );
+        }
+
+        auto fwdResults = GetExports( hChainMod, fwdNames, hChainMod->name.c_str() );
+
+        CSLock lck( _exportGuard );
+        for (size_t i = 0; i < ids.size(); i++)
+        {
+            // Remember fully resolved chains only
+            if (fwdResults[i].status == STATUS_SUCCESS)
+                _forwardMemo[std::make_tuple( hMod.baseAddress, ordIndexes[ids[i]], std::wstring( importModule ) )] = fwdResults[i].result();
+
+            results[ids[i]] = std::move( fwdResults[i] );
+        }
+    }
+
+    return results;
+}
+
+/// <summary>
+/// Get cached export index, build it if module wasn't indexed yet
+/// </summary>
+/// <param name="hMod">Module</param>
+/// <returns>Export index</returns>
+call_result_t<ProcessModules::ExportIndexPtr> ProcessModules::GetExportIndex( const ModuleData& hMod )
+{
+    CSLock lck( _exportGuard );
+
+    // Index is valid only for the same module instance
+    auto iter = _exports.find( hMod.baseAddress );
+    if (iter != _exports.end())
+    {
+        const auto& index = iter->second;
+        if (index->size == hMod.size && (index->shared || index->ldrPtr == hMod.ldrPtr))
+            return index;
+
+        // Module was reloaded, any chain could pass through its old instance
+        _forwardMemo.clear();
+        _exports.erase( iter );
+    }
+
+    // System modules are mapped at the same base in every process of the same bitness, their index can be reused.
+    // If current process has the module at the same base, nothing is read from target at all
+    bool shared = IsSharedModule( hMod );
+    bool local = false;
+    SharedIndexKey key;
+    if (shared)
+    {
+        local = hMod.type == (sizeof( void* ) == sizeof( uint64_t ) ? mt_mod64 : mt_mod32)
+             && reinterpret_cast<module_t>(GetModuleHandleW( hMod.name.c_str() )) == hMod.baseAddress;
+
+        key = SharedIndexKey( Utils::ToLower( hMod.fullPath ), hMod.baseAddress, hMod.type, ReadTimeStamp( hMod, local ) );
+
+        CSLock sharedLck( _sharedGuard );
+        auto sharedIter = _sharedExports.find( key );
+        if (sharedIter != _sharedExports.end())
+        {
+            _exports.emplace( hMod.baseAddress, sharedIter->second );
+            return sharedIter->second;
+        }
+    }
+
+    auto index = std::make_shared<ExportIndex>();
+    if (auto status = BuildExportIndex( hMod, *index, local ); !NT_SUCCESS( status ))
+        return status;
+
+    if (shared && index->timeStamp == std::get<3>( key ))
+    {
+        index->shared = true;
+
+        CSLock sharedLck( _sharedGuard );
+        _sharedExports.emplace( key, index );
+    }
+
+    _exports.emplace( hMod.baseAddress, index );
+    return ExportIndexPtr( index );
+}
+
+/// <summary>
+/// Read and parse module export directory
+/// </summary>
+/// <param name="hMod">Module</param>
+/// <param name="index">Resulting index</param>
+/// <param name="local">Module is mapped at the same base in current process, read it from there</param>
+/// <returns>Status code</returns>
+NTSTATUS ProcessModules::BuildExportIndex( const ModuleData& hMod, ExportIndex& index, bool local /*= false*/ )
+{
+    auto read = [this, local]( ptr_t address, size_t size, void* buffer ) -> NTSTATUS
+    {
+        if (!local)
+            return _memory.Read( address, size, buffer );
+
+        memcpy( buffer, reinterpret_cast<const void*>(address), size );
+        return STATUS_SUCCESS;
+    };
 
     std::unique_ptr<IMAGE_EXPORT_DIRECTORY, decltype(&free)> expData( nullptr, &free );
 
@@ -234,127 +512,440 @@ call_result_t<exportData> ProcessModules::GetExport( const ModuleData& hMod, con
     DWORD expSize = 0;
     uintptr_t expBase = 0;
 
-    _memory.Read( hMod.baseAddress, sizeof( hdrDos ), &hdrDos );
+    index.base = hMod.baseAddress;
+    index.size = hMod.size;
+    index.ldrPtr = hMod.ldrPtr;
+
+    read( hMod.baseAddress, sizeof( hdrDos ), &hdrDos );
 
     if (hdrDos.e_magic != IMAGE_DOS_SIGNATURE)
         return STATUS_INVALID_IMAGE_NOT_MZ;
 
-    _memory.Read( hMod.baseAddress + hdrDos.e_lfanew, sizeof( IMAGE_NT_HEADERS64 ), &hdrNt32 );
+    read( hMod.baseAddress + hdrDos.e_lfanew, sizeof( IMAGE_NT_HEADERS64 ), &hdrNt32 );
 
     if (phdrNt32->Signature != IMAGE_NT_SIGNATURE)
         return STATUS_INVALID_IMAGE_FORMAT;
 
+    index.timeStamp = phdrNt32->FileHeader.TimeDateStamp;
+
     if (phdrNt32->OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR32_MAGIC)
+    {
+        index.type = mt_mod32;
         expBase = phdrNt32->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_EXPORT].VirtualAddress;
+        expSize = phdrNt32->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_EXPORT].Size;
+    }
     else
+    {
+        index.type = mt_mod64;
         expBase = phdrNt64->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_EXPORT].VirtualAddress;
+        expSize = phdrNt64->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_EXPORT].Size;
+    }
 
-    // Exports are present
-    if (expBase)
+    // No exports, index stays empty
+    if (expBase == 0 || expSize == 0)
+        return STATUS_SUCCESS;
+
+    expData.reset( reinterpret_cast<IMAGE_EXPORT_DIRECTORY*>(malloc( std::max<size_t>( expSize, sizeof( IMAGE_EXPORT_DIRECTORY ) ) )) );
+    IMAGE_EXPORT_DIRECTORY* pExpData = expData.get();
+
+    if (auto status = read( hMod.baseAddress + expBase, expSize, pExpData ); !NT_SUCCESS( status ))
+        return status;
+
+    // Fix invalid directory size
+    if (expSize <= sizeof( IMAGE_EXPORT_DIRECTORY ))
     {
-        if (phdrNt32->OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR32_MAGIC)
-            expSize = phdrNt32->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_EXPORT].Size;
-        else
-            expSize = phdrNt64->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_EXPORT].Size;
+        // New size should take care of max number of present names (max name length is assumed to be 255 chars)
+        expSize = static_cast<DWORD>(
+            pExpData->AddressOfNameOrdinals - expBase
+            + max( pExpData->NumberOfFunctions, pExpData->NumberOfNames ) * 255
+            );
 
         expData.reset( reinterpret_cast<IMAGE_EXPORT_DIRECTORY*>(malloc( expSize )) );
-        IMAGE_EXPORT_DIRECTORY* pExpData = expData.get();
-
-        if( auto status = _memory.Read( hMod.baseAddress + expBase, expSize, pExpData ); !NT_SUCCESS( status ) )
+        pExpData = expData.get();
+        if (auto status = read( hMod.baseAddress + expBase, expSize, pExpData ); !NT_SUCCESS( status ))
             return status;
+    }
 
-        // Fix invalid directory size
-        if (expSize <= sizeof( IMAGE_EXPORT_DIRECTORY ))
-        {
-            // New size should take care of max number of present names (max name length is assumed to be 255 chars)
-            expSize = static_cast<DWORD>(
-                pExpData->AddressOfNameOrdinals - expBase
-                + max( pExpData->NumberOfFunctions, pExpData->NumberOfNames ) * 255
-                );
-
-            expData.reset( reinterpret_cast<IMAGE_EXPORT_DIRECTORY*>(malloc( expSize )) );
-            pExpData = expData.get();
-            if (auto status = _memory.Read( hMod.baseAddress + expBase, expSize, pExpData ); !NT_SUCCESS( status ))
-                return status;
-        }
+    auto pBase = reinterpret_cast<const uint8_t*>(pExpData);
+    auto inDir = [expBase, expSize]( uintptr_t rva, size_t size )
+    {
+        return rva >= expBase && rva - expBase + size <= expSize;
+    };
 
-        WORD* pAddressOfOrds = reinterpret_cast<WORD*>(
-            pExpData->AddressOfNameOrdinals + reinterpret_cast<uintptr_t>(pExpData) - expBase);
+    if (!inDir( pExpData->AddressOfFunctions, pExpData->NumberOfFunctions * sizeof( DWORD ) ) ||
+        !inDir( pExpData->AddressOfNames, pExpData->NumberOfNames * sizeof( DWORD ) ) ||
+        !inDir( pExpData->AddressOfNameOrdinals, pExpData->NumberOfNames * sizeof( WORD ) ))
+    {
+        return STATUS_INVALID_IMAGE_FORMAT;
+    }
 
-        DWORD* pAddressOfNames = reinterpret_cast<DWORD*>(
-            pExpData->AddressOfNames + reinterpret_cast<uintptr_t>(pExpData) - expBase);
+    auto pAddressOfOrds = reinterpret_cast<const WORD*>(pBase + pExpData->AddressOfNameOrdinals - expBase);
+    auto pAddressOfNames = reinterpret_cast<const DWORD*>(pBase + pExpData->AddressOfNames - expBase);
+    auto pAddressOfFuncs = reinterpret_cast<const DWORD*>(pBase + pExpData->AddressOfFunctions - expBase);
 
-        DWORD* pAddressOfFuncs = reinterpret_cast<DWORD*>(
-            pExpData->AddressOfFunctions + reinterpret_cast<uintptr_t>(pExpData) - expBase);
+    index.ordinalBase = pExpData->Base;
+    index.functions.assign( pAddressOfFuncs, pAddressOfFuncs + pExpData->NumberOfFunctions );
 
-        for (DWORD i = 0; i < pExpData->NumberOfFunctions; ++i)
-        {
-            WORD OrdIndex = 0xFFFF;
-            char *pName = nullptr;
+    index.names.reserve( pExpData->NumberOfNames );
+    for (DWORD i = 0; i < pExpData->NumberOfNames; ++i)
+    {
+        if (!inDir( pAddressOfNames[i], 1 ))
+            continue;
 
-            // Find by index
-            if (reinterpret_cast<uintptr_t>(name_ord) <= 0xFFFF)
-            {
-                OrdIndex = static_cast<WORD>(i);
-            }
-            // Find by name
-            else if (reinterpret_cast<uintptr_t>(name_ord) > 0xFFFF && i < pExpData->NumberOfNames)
-            {
-                pName = (char*)(pAddressOfNames[i] + reinterpret_cast<uintptr_t>(pExpData) - expBase);
-                OrdIndex = static_cast<WORD>(pAddressOfOrds[i]);
-            }
+        auto pName = reinterpret_cast<const char*>(pBase + pAddressOfNames[i] - expBase);
+        index.names.emplace( std::string( pName, strnlen( pName, expBase + expSize - pAddressOfNames[i] ) ), pAddressOfOrds[i] );
+    }
+
+    // Forwarder strings reside inside export directory
+    for (DWORD i = 0; i < pExpData->NumberOfFunctions; ++i)
+    {
+        auto rva = index.functions[i];
+        if (!inDir( rva, 1 ))
+            continue;
+
+        auto pForward = reinterpret_cast<const char*>(pBase + rva - expBase);
+        std::string chainExp( pForward, strnlen( pForward, expBase + expSize - rva ) );
+
+        std::string strDll = chainExp.substr( 0, chainExp.find( "." ) ) + ".dll";
+        std::string strName = chainExp.substr( chainExp.find( "." ) + 1, strName.npos );
+
+        // Fill export data info
+        exportData data;
+        data.isForwarded = true;
+        data.forwardModule = Utils::AnsiToWstring( strDll );
+        data.forwardByOrd = (strName.find( "#" ) == 0);
+
+        if (data.forwardByOrd)
+            data.forwardOrdinal = static_cast<WORD>(atoi( strName.c_str() + 1 ));
+        else
+            data.forwardName = strName;
+
+        index.forwards.emplace( static_cast<WORD>(i), std::move( data ) );
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Read image header timestamp
+/// </summary>
+/// <param name="hMod">Module</param>
+/// <param name="local">Module is mapped at the same base in current process, read it from there</param>
+/// <returns>Timestamp, 0 if headers can't be read</returns>
+uint32_t ProcessModules::ReadTimeStamp( const ModuleData& hMod, bool local )
+{
+    if (local)
+    {
+        auto pHdr = reinterpret_cast<const IMAGE_DOS_HEADER*>(hMod.baseAddress);
+        auto pNtHdr = reinterpret_cast<const IMAGE_NT_HEADERS*>(reinterpret_cast<const uint8_t*>(pHdr) + pHdr->e_lfanew);
+        return pNtHdr->FileHeader.TimeDateStamp;
+    }
+
+    auto e_lfanew = _memory.Read<LONG>( hMod.baseAddress + FIELD_OFFSET( IMAGE_DOS_HEADER, e_lfanew ) );
+    if (!e_lfanew)
+        return 0;
+
+    ptr_t timeStampPtr = hMod.baseAddress + e_lfanew.result()
+        + FIELD_OFFSET( IMAGE_NT_HEADERS32, FileHeader )
+        + FIELD_OFFSET( IMAGE_FILE_HEADER, TimeDateStamp );
+
+    return _memory.Read<uint32_t>( timeStampPtr ).result( 0 );
+}
+
+/// <summary>
+/// Check if module is a system image mapped at the same base in every process of the same bitness
+/// </summary>
+/// <param name="hMod">Module</param>
+/// <returns>true if module export index can be shared</returns>
+bool ProcessModules::IsSharedModule( const ModuleData& hMod )
+{
+    static const wchar_t* sharedModules[] = { L"ntdll.dll", L"kernel32.dll", L"kernelbase.dll", L"user32.dll" };
+
+    if (hMod.manual)
+        return false;
+
+    for (auto name : sharedModules)
+    {
+        if (_wcsicmp( hMod.name.c_str(), name ) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+/// <summary>
+/// Drop cached export index and resolved forward chains
+/// </summary>
+/// <param name="base">Module base address, 0 - drop all</param>
+void ProcessModules::InvalidateExports( module_t base /*= 0*/ )
+{
+    CSLock lck( _exportGuard );
+
+    // Any chain could pass through this module
+    _forwardMemo.clear();
+
+    if (base == 0)
+        _exports.clear();
+    else
+        _exports.erase( base );
+}
+
+/// <summary>
+/// Track loader module loads and unloads through LdrRegisterDllNotification callback.
+/// While enabled, LdrList lookups are served from cache updated by notification events,
+/// without header revalidation and loader list walks on every miss
+/// </summary>
+/// <returns>Status code</returns>
+NTSTATUS ProcessModules::EnableLoadNotifications()
+{
+    CSLock lck( _notifyGuard );
+
+    if (_notifyMem.valid())
+        return STATUS_SUCCESS;
+
+    auto type = _proc.barrier().targetWow64 ? mt_mod32 : mt_mod64;
+
+    auto pRegister = GetNtdllExport( "LdrRegisterDllNotification", type );
+    if (!pRegister)
+        return pRegister.status;
+
+    // Notification ring followed by callback code
+    auto mem = _memory.Allocate( 0x2000, PAGE_EXECUTE_READWRITE );
+    if (!mem)
+        return mem.status;
+
+    auto& ring = mem.result();
+    ptr_t pCallback = ring.ptr() + sizeof( NotifyRing );
+
+    // VOID CALLBACK LdrDllNotification( ULONG reason, PCLDR_DLL_NOTIFICATION_DATA data, PVOID context )
+    // Context points to ring. Slot is claimed with interlocked increment and published by writing its sequence
+    auto a = AsmFactory::GetAssembler( type );
+    int32_t slotMask = NotifyRingSize - 1;
+    int32_t slotShift = 5;
+    static_assert(sizeof( NotifyEvent ) == 1 << 5, "Notification slot size mismatch");
+
+    if (type == mt_mod64)
+    {
+        (*a)->mov( asmjit::host::r9d, 1 );
+        (*a)->lock().xadd( asmjit::host::dword_ptr( asmjit::host::r8, FIELD_OFFSET( NotifyRing, writeIndex ) ), asmjit::host::r9d );
+        (*a)->mov( asmjit::host::eax, asmjit::host::r9d );
+        (*a)->and_( asmjit::host::eax, slotMask );
+        (*a)->shl( asmjit::host::eax, slotShift );
+        (*a)->add( asmjit::host::rax, asmjit::host::r8 );
+        (*a)->mov( asmjit::host::dword_ptr( asmjit::host::rax, FIELD_OFFSET( NotifyRing, events ) + FIELD_OFFSET( NotifyEvent, reason ) ), asmjit::host::ecx );
+        (*a)->mov( asmjit::host::r10, asmjit::host::qword_ptr( asmjit::host::rdx, 0x18 ) );     // DllBase
+        (*a)->mov( asmjit::host::qword_ptr( asmjit::host::rax, FIELD_OFFSET( NotifyRing, events ) + FIELD_OFFSET( NotifyEvent, base ) ), asmjit::host::r10 );
+        (*a)->mov( asmjit::host::r10d, asmjit::host::dword_ptr( asmjit::host::rdx, 0x20 ) );    // SizeOfImage
+        (*a)->mov( asmjit::host::dword_ptr( asmjit::host::rax, FIELD_OFFSET( NotifyRing, events ) + FIELD_OFFSET( NotifyEvent, size ) ), asmjit::host::r10d );
+        (*a)->inc( asmjit::host::r9d );
+        (*a)->mov( asmjit::host::dword_ptr( asmjit::host::rax, FIELD_OFFSET( NotifyRing, events ) + FIELD_OFFSET( NotifyEvent, sequence ) ), asmjit::host::r9d );
+        (*a)->ret();
+    }
+    else
+    {
+        (*a)->mov( asmjit::host::ecx, asmjit::host::dword_ptr( asmjit::host::esp, 0x4 ) );
+        (*a)->mov( asmjit::host::edx, asmjit::host::dword_ptr( asmjit::host::esp, 0x8 ) );
+        (*a)->mov( asmjit::host::eax, asmjit::host::dword_ptr( asmjit::host::esp, 0xC ) );
+        (*a)->push( asmjit::host::esi );
+        (*a)->push( asmjit::host::edi );
+        (*a)->mov( asmjit::host::esi, asmjit::host::eax );
+        (*a)->mov( asmjit::host::edi, 1 );
+        (*a)->lock().xadd( asmjit::host::dword_ptr( asmjit::host::esi, FIELD_OFFSET( NotifyRing, writeIndex ) ), asmjit::host::edi );
+        (*a)->mov( asmjit::host::eax, asmjit::host::edi );
+        (*a)->and_( asmjit::host::eax, slotMask );
+        (*a)->shl( asmjit::host::eax, slotShift );
+        (*a)->add( asmjit::host::eax, asmjit::host::esi );
+        (*a)->mov( asmjit::host::dword_ptr( asmjit::host::eax, FIELD_OFFSET( NotifyRing, events ) + FIELD_OFFSET( NotifyEvent, reason ) ), asmjit::host::ecx );
+        (*a)->mov( asmjit::host::ecx, asmjit::host::dword_ptr( asmjit::host::edx, 0xC ) );      // DllBase
+        (*a)->mov( asmjit::host::dword_ptr( asmjit::host::eax, FIELD_OFFSET( NotifyRing, events ) + FIELD_OFFSET( NotifyEvent, base ) ), asmjit::host::ecx );
+        (*a)->mov( asmjit::host::ecx, asmjit::host::dword_ptr( asmjit::host::edx, 0x10 ) );     // SizeOfImage
+        (*a)->mov( asmjit::host::dword_ptr( asmjit::host::eax, FIELD_OFFSET( NotifyRing, events ) + FIELD_OFFSET( NotifyEvent, size ) ), asmjit::host::ecx );
+        (*a)->inc( asmjit::host::edi );
+        (*a)->mov( asmjit::host::dword_ptr( asmjit::host::eax, FIELD_OFFSET( NotifyRing, events ) + FIELD_OFFSET( NotifyEvent, sequence ) ), asmjit::host::edi );
+        (*a)->pop( asmjit::host::edi );
+        (*a)->pop( asmjit::host::esi );
+        (*a)->ret( 0xC );
+    }
+
+    NTSTATUS status = ring.Write( sizeof( NotifyRing ), (*a)->getCodeSize(), (*a)->make() );
+    if (!NT_SUCCESS( status ))
+        return status;
+
+    // LdrRegisterDllNotification( 0, callback, ring, &cookie )
+    auto a2 = AsmFactory::GetAssembler( type );
+    uint64_t result = 0;
+
+    a2->GenPrologue();
+    a2->GenCall( pRegister->procAddress, { 0, pCallback, ring.ptr(), ring.ptr() + FIELD_OFFSET( NotifyRing, cookie ) } );
+    _proc.remote().AddReturnWithEvent( *a2, type );
+    a2->GenEpilogue();
+
+    status = _proc.remote().ExecInWorkerThread( (*a2)->make(), (*a2)->getCodeSize(), result );
+    if (!NT_SUCCESS( status ))
+    {
+        // Callback may have been registered, keep stub alive
+        ring.Release();
+        return status;
+    }
+
+    if (!NT_SUCCESS( static_cast<NTSTATUS>(result) ))
+        return static_cast<NTSTATUS>(result);
+
+    ExclusiveLock modLock( _modGuard );
+
+    _notifyMem = std::move( ring );
+    _notifyType = type;
+    _notifyRead = 0;
+
+    // Events are posted from now on, take single snapshot of loader list
+    for (auto iter = _modules.begin(); iter != _modules.end();)
+    {
+        if (!iter->second->manual && iter->second->type == type)
+            iter = EraseModule( iter );
+        else
+            ++iter;
+    }
+
+    UpdateModuleCache( LdrList, type );
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Unregister loader notification callback and return to polling lookups
+/// </summary>
+/// <returns>Status code</returns>
+NTSTATUS ProcessModules::DisableLoadNotifications()
+{
+    CSLock lck( _notifyGuard );
+
+    if (!_notifyMem.valid())
+        return STATUS_SUCCESS;
+
+    uint64_t cookie = 0;
+    uint64_t result = 0;
+    NTSTATUS status = _notifyMem.Read( FIELD_OFFSET( NotifyRing, cookie ), sizeof( cookie ), &cookie );
+
+    auto pUnregister = GetNtdllExport( "LdrUnregisterDllNotification", _notifyType );
+    if (NT_SUCCESS( status ) && !pUnregister)
+        status = pUnregister.status;
+
+    if (NT_SUCCESS( status ))
+    {
+        auto a = AsmFactory::GetAssembler( _notifyType );
+
+        a->GenPrologue();
+        a->GenCall( pUnregister->procAddress, { cookie } );
+        _proc.remote().AddReturnWithEvent( *a, _notifyType );
+        a->GenEpilogue();
+
+        status = _proc.remote().ExecInWorkerThread( (*a)->make(), (*a)->getCodeSize(), result );
+        if (NT_SUCCESS( status ))
+            status = static_cast<NTSTATUS>(result);
+    }
+
+    ExclusiveLock modLock( _modGuard );
+
+    // Callback may still be registered, stub memory can't be released
+    if (!NT_SUCCESS( status ))
+        _notifyMem.Release();
+
+    _notifyMem.Reset();
+    _notifyRead = 0;
+    return status;
+}
+
+/// <summary>
+/// Apply pending loader notifications to module cache
+/// </summary>
+/// <param name="search">Search type</param>
+/// <param name="type">Module type</param>
+/// <returns>true if cache is tracked by notifications for this search and module type</returns>
+bool ProcessModules::DrainNotifications( eModSeachType search, eModType type )
+{
+    auto readIndex = [this, search, type]( uint32_t& writeIndex )
+    {
+        if (!_notifyMem.valid() || search != LdrList || type != _notifyType)
+            return false;
+
+        return NT_SUCCESS( _notifyMem.Read( FIELD_OFFSET( NotifyRing, writeIndex ), sizeof( writeIndex ), &writeIndex ) );
+    };
+
+    uint32_t writeIndex = 0;
+
+    // No new events, concurrent lookups don't block each other
+    {
+        SharedLock lck( _modGuard );
+
+        if (!readIndex( writeIndex ))
+            return false;
+
+        if (writeIndex == _notifyRead)
+            return true;
+    }
+
+    ExclusiveLock lck( _modGuard );
+
+    if (!readIndex( writeIndex ))
+        return false;
+
+    if (writeIndex == _notifyRead)
+        return true;
+
+    auto dropModule = [this]( module_t base )
+    {
+        for (auto iter = _modules.begin(); iter != _modules.end();)
+        {
+            if (!iter->second->manual && iter->second->type == _notifyType && (base == 0 || iter->second->baseAddress == base))
+                iter = EraseModule( iter );
             else
-                return STATUS_NOT_FOUND;
+                ++iter;
+        }
 
-            if ((reinterpret_cast<uintptr_t>(name_ord) <= 0xFFFF && (WORD)((uintptr_t)name_ord) == (OrdIndex + pExpData->Base)) ||
-                (reinterpret_cast<uintptr_t>(name_ord) > 0xFFFF && strcmp( pName, name_ord ) == 0))
-            {
-                data.procAddress = pAddressOfFuncs[OrdIndex] + hMod.baseAddress;
+        InvalidateExports( base );
+    };
 
-                // Check forwarded export
-                if (data.procAddress >= hMod.baseAddress + expBase &&
-                    data.procAddress <= hMod.baseAddress + expBase + expSize)
-                {
-                    char forwardStr[255] = { 0 };
-
-                    _memory.Read( data.procAddress, sizeof( forwardStr ), forwardStr );
-
-                    std::string chainExp( forwardStr );
-
-                    std::string strDll = chainExp.substr( 0, chainExp.find( "." ) ) + ".dll";
-                    std::string strName = chainExp.substr( chainExp.find( "." ) + 1, strName.npos );
-                    std::wstring wDll( Utils::AnsiToWstring( strDll ) );
-
-                    // Fill export data info
-                    data.isForwarded = true;
-                    data.forwardModule = wDll;
-                    data.forwardByOrd = (strName.find( "#" ) == 0);
-
-                    if (data.forwardByOrd)
-                        data.forwardOrdinal = static_cast<WORD>(atoi( strName.c_str() + 1 ));
-                    else
-                        data.forwardName = strName;
-
-                    // Check if forward mod is loaded
-                    auto mt = (phdrNt32->OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR32_MAGIC) ? mt_mod32 : mt_mod64;
-                    auto hChainMod = GetModule( wDll, LdrList, mt, baseModule );
-                    if (hChainMod == nullptr)
-                        return call_result_t<exportData>( data, STATUS_SOME_NOT_MAPPED );
-
-                    // Import by ordinal
-                    if (data.forwardByOrd)
-                        return GetExport( hChainMod, reinterpret_cast<const char*>(data.forwardOrdinal), wDll.c_str() );
-                    // Import by name
-                    else
-                        return GetExport( hChainMod, strName.c_str(), wDll.c_str() );
-                }
+    bool loaded = false;
+    std::map<module_t, uint32_t> lastEvent;
 
-                return data;
-            }
+    // Ring overflow, some events were lost
+    if (writeIndex - _notifyRead > NotifyRingSize)
+    {
+        dropModule( 0 );
+        loaded = true;
+        _notifyRead = writeIndex;
+    }
+    else
+    {
+        std::vector<NotifyEvent> events( NotifyRingSize );
+        if (!NT_SUCCESS( _notifyMem.Read( FIELD_OFFSET( NotifyRing, events ), sizeof( NotifyEvent ) * NotifyRingSize, events.data() ) ))
+            return false;
+
+        for (; _notifyRead != writeIndex; _notifyRead++)
+        {
+            const auto& evt = events[_notifyRead & (NotifyRingSize - 1)];
+
+            // Slot is still being filled
+            if (evt.sequence != _notifyRead + 1)
+                break;
+
+            lastEvent[evt.base] = evt.reason;
+            loaded |= evt.reason == NotifyLoaded;
         }
+
+        // Loaded images are re-read from loader list, entries for reused bases are replaced
+        for (const auto& evt : lastEvent)
+            dropModule( evt.first );
     }
 
-    return STATUS_NOT_FOUND;
+    if (loaded)
+        UpdateModuleCache( LdrList, _notifyType );
+
+    // Image could be still linked while unload is in progress
+    for (const auto& evt : lastEvent)
+        if (evt.second == NotifyUnloaded)
+            dropModule( evt.first );
+
+    return true;
 }
 
 /// <summary>
@@ -402,7 +993,8 @@ call_result_t<ModuleDataPtr> ProcessModules::Inject( const std::wstring& path, T
     uint32_t ustrSize = 0;
     ptr_t res = 0;    
 
-    img.Load( path, true );
+    // Only image type is needed
+    img.Load( path, pe::HeadersOnly | pe::UseCache );
     img.Release();
 
     // Already loaded
@@ -410,7 +1002,7 @@ call_result_t<ModuleDataPtr> ProcessModules::Inject( const std::wstring& path, T
         return call_result_t<ModuleDataPtr>( mod, STATUS_IMAGE_ALREADY_LOADED );
 
     // Image path
-    auto modName = _memory.Allocate( 0x1000, PAGE_READWRITE );
+    auto modName = _memory.heap().Allocate( 0x1000 );
     if (!modName)
         return modName.status;
 
@@ -421,7 +1013,7 @@ call_result_t<ModuleDataPtr> ProcessModules::Inject( const std::wstring& path, T
         ustr.MaximumLength = ustr.Length = static_cast<USHORT>(path.size() * sizeof( wchar_t ));
 
         modName->Write( 0, ustr );
-        modName->Write( sizeof( ustr ), path.size() * sizeof( wchar_t ), path.c_str() );
+        modName->Write( sizeof( ustr ), (path.size() + 1) * sizeof( wchar_t ), path.c_str() );
 
         return static_cast<uint32_t>(sizeof( ustr ));
     };
@@ -459,7 +1051,7 @@ call_result_t<ModuleDataPtr> ProcessModules::Inject( const std::wstring& path, T
     if (switchMode == ForceSwitch && !_ldrPatched && IsWindows7OrGreater() && !IsWindows8OrGreater())
     {
         uint8_t patch[] = { 0x90, 0x90, 0x90, 0x90, 0x90, 0x90 };
-        auto patchBase = g_symbols.LdrKernel32PatchAddress;
+        auto patchBase = g_symbols->LdrKernel32PatchAddress;
 
         if (patchBase != 0)
         {
@@ -540,7 +1132,14 @@ NTSTATUS ProcessModules::Unload( const ModuleDataPtr& hMod )
     _proc.remote().ExecInNewThread( (*a)->make(), (*a)->getCodeSize(), res, threadSwitch );
 
     // Remove module from cache
-    _modules.erase( std::make_pair( hMod->name, hMod->type ) );
+    InvalidateExports( hMod->baseAddress );
+
+    ExclusiveLock lck( _modGuard );
+
+    auto iter = _modules.find( ModuleKey( hMod->name, hMod->type ) );
+    if (iter != _modules.end())
+        EraseModule( iter );
+
     return true;
 }
 
@@ -566,17 +1165,22 @@ bool ProcessModules::Unlink( const ModuleData& mod )
 /// <returns>true on success</returns>
 bool ProcessModules::ValidateModule( module_t base )
 {
-    IMAGE_DOS_HEADER idh = { 0 };
-    IMAGE_NT_HEADERS inth = { 0 };
+    // DOS header and NT signature are almost always within first 1KB of the header page, fetch them at once
+    uint8_t headers[0x400] = { 0 };
+    if (_memory.Read( base, sizeof( headers ), headers ) != STATUS_SUCCESS)
+        return false;
 
-    // Validate memory and headers
-    if (_memory.Read( base, sizeof(idh), &idh ) == STATUS_SUCCESS)
-        if (idh.e_magic == IMAGE_DOS_SIGNATURE)
-            if(_memory.Read( base + idh.e_lfanew, sizeof(inth), &inth ) == STATUS_SUCCESS)
-                if (inth.Signature == IMAGE_NT_SIGNATURE)
-                    return true;
+    auto pDos = reinterpret_cast<const IMAGE_DOS_HEADER*>(headers);
+    if (pDos->e_magic != IMAGE_DOS_SIGNATURE || pDos->e_lfanew < 0)
+        return false;
 
-    return false;
+    DWORD signature = 0;
+    if (static_cast<size_t>(pDos->e_lfanew) + sizeof( signature ) <= sizeof( headers ))
+        memcpy( &signature, headers + pDos->e_lfanew, sizeof( signature ) );
+    else if (_memory.Read( base + pDos->e_lfanew, signature ) != STATUS_SUCCESS)
+        return false;
+
+    return signature == IMAGE_NT_SIGNATURE;
 }
 
 /// <summary>
@@ -587,8 +1191,12 @@ bool ProcessModules::ValidateModule( module_t base )
 ModuleDataPtr ProcessModules::AddManualModule( const ModuleData& mod )
 {
     auto canonicalized = Canonicalize( mod, true );
-    auto key = std::make_pair( canonicalized.name, canonicalized.type );
-    return _modules.emplace( key, std::make_shared<const ModuleData>( canonicalized ) ).first->second;
+
+    // Image could be mapped over previously indexed one
+    InvalidateExports( canonicalized.baseAddress );
+
+    ExclusiveLock lck( _modGuard );
+    return InsertModule( std::make_shared<const ModuleData>( canonicalized ) );
 }
 
 /// <summary>
@@ -619,15 +1227,111 @@ ModuleData ProcessModules::Canonicalize( const ModuleData& mod, bool manual )
 /// <param name="mt">Module type. 32 bit or 64 bit</param>
 void ProcessModules::RemoveManualModule( const std::wstring& filename, eModType mt )
 {
-    auto key = std::make_pair( Utils::ToLower( Utils::StripPath( filename ) ), mt );
-    if (_modules.count( key ))
-        _modules.erase( key );
+    ModuleKey key( StripPathView( filename ), mt );
+
+    ExclusiveLock lck( _modGuard );
+    auto iter = _modules.find( key );
+    if (iter != _modules.end())
+    {
+        InvalidateExports( iter->second->baseAddress );
+        EraseModule( iter );
+    }
 }
 
 void ProcessModules::UpdateModuleCache( eModSeachType search, eModType type )
 {
+    // Section and header search walk shared region map.
+    // Target could have mapped images on its own, so map is fully rebuilt
+    if (search != LdrList)
+    {
+        auto& regionMap = _memory.regionMap();
+        if (NT_SUCCESS( regionMap.Refresh( true ) ))
+        {
+            for (const auto& mod : _core.native()->EnumModules( search, regionMap.regions() ))
+                InsertModule( mod );
+
+            return;
+        }
+    }
+
+    // Driver walks loader list with single attach instead of remote read per entry
+    if (search == LdrList && Driver().loaded())
+    {
+        if (type == mt_default)
+            type = _core.isWow64() ? mt_mod32 : mt_mod64;
+
+        std::vector<ModuleDataPtr> mods;
+        if (NT_SUCCESS( Driver().EnumModules( _core.pid(), type == mt_mod32, mods ) ))
+        {
+            for (const auto& mod : mods)
+                InsertModule( mod );
+
+            return;
+        }
+    }
+
     for (const auto& mod : _core.native()->EnumModules( search, type ))
-        _modules.emplace( std::make_pair( mod->name, mod->type ), mod );
+        InsertModule( mod );
+}
+
+/// <summary>
+/// Add module to name and address indexes. Existing module with the same name is kept
+/// </summary>
+/// <param name="mod">Module</param>
+/// <returns>Cached module</returns>
+ModuleDataPtr ProcessModules::InsertModule( const ModuleDataPtr& mod )
+{
+    // Key refers to name stored in module record, which lives as long as map entry
+    auto result = _modules.emplace( ModuleKey( mod->name, mod->type ), mod );
+    if (result.second)
+        _byBase[mod->baseAddress] = mod;
+
+    return result.first->second;
+}
+
+/// <summary>
+/// Remove module from name and address indexes
+/// </summary>
+/// <param name="iter">Module to remove</param>
+/// <returns>Iterator following removed module</returns>
+ProcessModules::mapModules::iterator ProcessModules::EraseModule( mapModules::iterator iter )
+{
+    auto base = _byBase.find( iter->second->baseAddress );
+    if (base != _byBase.end() && base->second == iter->second)
+        _byBase.erase( base );
+
+    return _modules.erase( iter );
+}
+
+/// <summary>
+/// Find cached module by address
+/// </summary>
+/// <param name="address">Address to look up</param>
+/// <param name="strict">If true address must exactly match module base address</param>
+/// <returns>Module data. nullptr if not found</returns>
+ModuleDataPtr ProcessModules::FindByAddress( ptr_t address, bool strict ) const
+{
+    auto iter = _byBase.upper_bound( address );
+    if (iter == _byBase.begin())
+        return nullptr;
+
+    --iter;
+    if (strict ? iter->first == address : address < iter->first + iter->second->size)
+        return iter->second;
+
+    return nullptr;
+}
+
+/// <summary>
+/// Get cached module containing address. Unlike GetModule, loader lists aren't rescanned on miss,
+/// so it can be used to symbolize addresses in tight loops
+/// </summary>
+/// <param name="address">Address to look up</param>
+/// <returns>Module data. nullptr if not found</returns>
+ModuleDataPtr ProcessModules::ModuleFromAddress( ptr_t address )
+{
+    SharedLock lck( _modGuard );
+    return FindByAddress( address, false );
 }
 
 
@@ -638,6 +1342,8 @@ using namespace asmjit::host;
 
 /// <summary>
 /// Inject pure IL image.
+/// Runtime host created by first call is kept in RPC data block,
+/// later calls for the same runtime version only run ExecuteInDefaultAppDomain in RPC worker thread
 /// </summary>
 /// <param name="netVersion">NET runtime version to use</param>
 /// <param name="netAssemblyPath">Path to image</param>
@@ -663,7 +1369,24 @@ bool ProcessModules::InjectPureIL(
     tmp.erase( idx );
     std::wstring ClassName = tmp;
 
-    auto mem = _memory.Allocate( 0x10000 );
+    // Runtime host is kept in RPC data block between calls, worker thread executes the stub
+    auto& remote = _proc.remote();
+    CSLock lck( remote.guard() );
+
+    NTSTATUS status = STATUS_SUCCESS;
+    if (!remote.getWorker() && !NT_SUCCESS( status = remote.CreateRPCEnvironment( Worker_CreateNew, true ) ))
+    {
+        returnCode = status;
+        return false;
+    }
+
+    // Slot is zeroed when RPC environment is recreated
+    const ptr_t hostSlot = remote.userData() + CLRHOST_OFFSET;
+    ptr_t cachedHost = 0;
+    _memory.Read( hostSlot, sizeof( uintptr_t ), &cachedHost );
+    const bool cached = cachedHost != 0 && _clrVersion == netVersion;
+
+    auto mem = _memory.codeHeap().Allocate( 0x10000 );
     if (!mem)
     {
         returnCode = 7;
@@ -718,26 +1441,35 @@ bool ProcessModules::InjectPureIL(
 
     offset += sizeof(GArray);
 
-    std::wstring libName = L"mscoree.dll";
+    // CLRCreateInstance address, only needed to create host
+    uintptr_t pfnCreateInstance = 0;
+    if (!cached)
+    {
+        std::wstring libName = L"mscoree.dll";
 
-    NameResolve::Instance().ResolvePath( libName, L"", L"", NameResolve::EnsureFullPath, _proc );
+        NameResolve::Instance().ResolvePath( libName, L"", L"", NameResolve::EnsureFullPath, _proc );
 
-    auto pMscoree = Inject( libName );
-    if(!pMscoree)
-    {
-        returnCode = pMscoree.status;
-        return false;
-    }
+        auto pMscoree = Inject( libName );
+        if (!pMscoree)
+        {
+            returnCode = pMscoree.status;
+            return false;
+        }
 
-    // CLRCreateInstance address
-    auto pfnCreateInstance = GetExport( pMscoree.result(), "CLRCreateInstance" );
-    if (!pfnCreateInstance)
-        return false;
+        auto pExport = GetExport( pMscoree.result(), "CLRCreateInstance" );
+        if (!pExport)
+            return false;
+
+        pfnCreateInstance = static_cast<uintptr_t>(pExport->procAddress);
+    }
 
     // Scary assembler code incoming!
     auto pAsm = AsmFactory::GetAssembler( _proc.core().isWow64() );
     auto& a = *pAsm;
-    AsmStackAllocator sa( a.assembler(), 0x30 );   // 0x30 - 6 arguments of ExecuteInDefaultAppDomain
+    AsmStackFrame<
+        sizeof( ICLRMetaHost* ), sizeof( ICLRRuntimeInfo* ), sizeof( ICLRRuntimeHost* ),
+        sizeof( BOOL ), sizeof( DWORD ), sizeof( HRESULT )
+        > frame( a.assembler(), 0x30 );   // 0x30 - 6 arguments of ExecuteInDefaultAppDomain
 
     // Stack will be reserved manually
     a.EnableX64CallStack( false );
@@ -750,32 +1482,47 @@ bool ProcessModules::InjectPureIL(
     Label L_Error5 = a->newLabel();
     Label L_Error6 = a->newLabel();
     Label L_SkipStart = a->newLabel();
+    Label L_NoPrevious = a->newLabel();
+    Label L_Execute = a->newLabel();
     Label L_ReleaseInterface = a->newLabel();
 
     // stack variables for the injected code
-    ALLOC_STACK_VAR( sa, stack_MetaHost,     ICLRMetaHost* );
-    ALLOC_STACK_VAR( sa, stack_RuntimeInfo,  ICLRRuntimeInfo* );
-    ALLOC_STACK_VAR( sa, stack_RuntimeHost,  ICLRRuntimeHost* );
-    ALLOC_STACK_VAR( sa, stack_IsStarted,    BOOL );
-    ALLOC_STACK_VAR( sa, stack_StartupFlags, DWORD );
-    ALLOC_STACK_VAR( sa, stack_returnCode,   HRESULT );
-
+    asmjit::Mem stack_MetaHost      = frame.Get<0>();
+    asmjit::Mem stack_RuntimeInfo   = frame.Get<1>();
+    asmjit::Mem stack_RuntimeHost   = frame.Get<2>();
+    asmjit::Mem stack_IsStarted     = frame.Get<3>();
+    asmjit::Mem stack_StartupFlags  = frame.Get<4>();
+    asmjit::Mem stack_returnCode    = frame.Get<5>();
+
+    // Stub runs in worker thread, so non-volatile registers must survive it
 #ifdef USE64
     GpReg callReg = r13;
 
+    a->push( a->zsi );
+    a->push( callReg );
 #else
     GpReg callReg = edx;
 
+    a->push( a->zsi );
     a->push( a->zbp );
     a->mov( a->zbp, a->zsp );
 #endif
 
     // function prologue  
-    a->sub( a->zsp, Align( sa.getTotalSize(), 0x10 ) + 8 );
+    a->sub( a->zsp, frame.getFrameSize() + 8 );
     a->xor_( a->zsi, a->zsi );
 
+    if (cached)
+    {
+        // Host created by previous call
+        a->mov( a->zax, static_cast<uintptr_t>(hostSlot) );
+        a->mov( a->zax, a->intptr_ptr( a->zax ) );
+        a->mov( stack_RuntimeHost, a->zax );
+        a->jmp( L_Execute );
+    }
+
     // CLRCreateInstance()
-    a.GenCall( (uintptr_t)pfnCreateInstance->procAddress, { address_CLSID_CLRMetaHost, address_IID_ICLRMetaHost, &stack_MetaHost } );
+    a.GenCall( pfnCreateInstance, { address_CLSID_CLRMetaHost, address_IID_ICLRMetaHost, &stack_MetaHost } );
     // success?
     a->test( a->zax, a->zax );
     a->jnz( L_Error1 );
@@ -820,9 +1567,30 @@ bool ProcessModules::InjectPureIL(
     a->test( a->zax, a->zax );
     a->jnz( L_Error5 );
 
-    // pRuntimeHost->ExecuteInDefaultAppDomain()
     a->bind( L_SkipStart );
 
+    // Replace host cached for another runtime version
+    a->mov( a->zax, static_cast<uintptr_t>(hostSlot) );
+    a->mov( a->zcx, a->intptr_ptr( a->zax ) );
+    a->test( a->zcx, a->zcx );
+    a->jz( L_NoPrevious );
+    a->call( L_ReleaseInterface );
+    a->bind( L_NoPrevious );
+
+    // Keep host reference for later calls
+    a->mov( a->zax, static_cast<uintptr_t>(hostSlot) );
+    a->mov( a->zcx, stack_RuntimeHost );
+    a->mov( a->intptr_ptr( a->zax ), a->zcx );
+
+    // Release unneeded interfaces
+    a->mov( a->zcx, stack_RuntimeInfo );
+    a->call( L_ReleaseInterface );
+    a->mov( a->zcx, stack_MetaHost );
+    a->call( L_ReleaseInterface );
+
+    // pRuntimeHost->ExecuteInDefaultAppDomain()
+    a->bind( L_Execute );
+
     a->mov( a->zcx, stack_RuntimeHost );
     a->mov( a->zax, a->intptr_ptr( a->zcx ) );
     a->mov( callReg, a->intptr_ptr( a->zax, 11 * sizeof( void* ) ) );
@@ -832,14 +1600,6 @@ bool ProcessModules::InjectPureIL(
     a->test( a->zax, a->zax );
     a->jnz( L_Error6 );
 
-    // Release unneeded interfaces
-    a->mov( a->zcx, stack_RuntimeHost );
-    a->call( L_ReleaseInterface );
-    a->mov( a->zcx, stack_RuntimeInfo );
-    a->call( L_ReleaseInterface );
-    a->mov( a->zcx, stack_MetaHost );
-    a->call( L_ReleaseInterface );
-
     // Write the managed code's return value to the first DWORD
     // in the allocated buffer
     a->mov( eax, stack_returnCode );
@@ -851,10 +1611,13 @@ bool ProcessModules::InjectPureIL(
     a->bind( L_Exit );
 
 #ifdef USE64
-    a->add( a->zsp, Align( sa.getTotalSize(), 0x10 ) + 8 );
+    a->add( a->zsp, frame.getFrameSize() + 8 );
+    a->pop( callReg );
+    a->pop( a->zsi );
 #else
     a->mov( a->zsp, a->zbp );
     a->pop( a->zbp );
+    a->pop( a->zsi );
 #endif
 
     a->ret();
@@ -900,17 +1663,8 @@ bool ProcessModules::InjectPureIL(
     a->mov( a->zax, 5 );
     a->jmp( L_Exit );
 
-    // pRuntimeHost->ExecuteInDefaultAppDomain() failed
+    // pRuntimeHost->ExecuteInDefaultAppDomain() failed, host stays cached
     a->bind( L_Error6 );
-    a->push( a->zax );
-    a->mov( a->zcx, stack_RuntimeHost );
-    a->call( L_ReleaseInterface );
-    a->mov( a->zcx, stack_RuntimeInfo );
-    a->call( L_ReleaseInterface );
-    a->mov( a->zcx, stack_MetaHost );
-    a->call( L_ReleaseInterface );
-    a->mov( a->zax, 6 );
-    a->pop( a->zax );
     a->jmp( L_Exit );
 
     // void __fastcall ReleaseInterface(IUnknown* pInterface)
@@ -936,8 +1690,30 @@ bool ProcessModules::InjectPureIL(
         return false;
     }
 
-    // run ze codez
-    _proc.remote().ExecDirect( (ptr_t)codeAddress, 0 );
+    // run ze codez through RPC worker
+    auto type = _proc.barrier().targetWow64 ? mt_mod32 : mt_mod64;
+    auto a2 = AsmFactory::GetAssembler( type );
+    uint64_t result = 0;
+
+    a2->GenPrologue();
+    a2->GenCall( codeAddress, { } );
+    remote.AddReturnWithEvent( *a2, type );
+    a2->GenEpilogue();
+
+    status = remote.ExecInWorkerThread( (*a2)->make(), (*a2)->getCodeSize(), result );
+    if (!NT_SUCCESS( status ))
+    {
+        returnCode = status;
+        return false;
+    }
+
+    // Host is cached only by successful creation path
+    if (!cached)
+    {
+        ptr_t host = 0;
+        _memory.Read( hostSlot, sizeof( uintptr_t ), &host );
+        _clrVersion = host != 0 ? netVersion : std::wstring();
+    }
 
     // Get the managed return value
     address.Read( 0, 4, &returnCode );
@@ -952,10 +1728,16 @@ bool ProcessModules::InjectPureIL(
 /// </summary>
 void ProcessModules::reset()
 {
-    CSLock lck( _modGuard );
+    DisableLoadNotifications();
+
+    ExclusiveLock lck( _modGuard );
 
     _modules.clear(); 
+    _byBase.clear();
     _ldrPatched = false;
+    _clrVersion.clear();
+
+    InvalidateExports();
 }
 
 }
\ No newline at end of file
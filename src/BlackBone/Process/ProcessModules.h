@@ -7,21 +7,68 @@
 #include "../PE/PEImage.h"
 #include "../Misc/Utils.h"
 #include "Threads/Thread.h"
+#include "MemBlock.h"
 
 #include <string>
+#include <string_view>
 #include <map>
 #include <unordered_map>
+#include <tuple>
 #include <algorithm>
 
+namespace blackbone
+{
+
+/// <summary>
+/// Module cache key. Name isn't copied: cached keys refer to name of module record they index,
+/// lookup keys refer to caller string, so lookups don't allocate.
+/// Name comparison is case-insensitive, hash is computed once
+/// </summary>
+struct ModuleKey
+{
+    std::wstring_view name;         // Module file name
+    eModType type = mt_default;     // Module architecture
+    size_t hash = 0;                // Case-insensitive hash of name and type
+
+    ModuleKey() = default;
+    ModuleKey( std::wstring_view name_, eModType type_ )
+        : name( name_ ), type( type_ ), hash( Hash( name_, type_ ) ) { }
+
+    bool operator ==( const ModuleKey& other ) const
+    {
+        return hash == other.hash && type == other.type && name.size() == other.name.size() &&
+            std::equal( name.begin(), name.end(), other.name.begin(), []( wchar_t l, wchar_t r ) { return Fold( l ) == Fold( r ); } );
+    }
+
+    static wchar_t Fold( wchar_t c )
+    {
+        if (c < 0x80)
+            return c >= L'A' && c <= L'Z' ? static_cast<wchar_t>(c + (L'a' - L'A')) : c;
+
+        return static_cast<wchar_t>(towlower( c ));
+    }
+
+    // FNV-1a of case-folded name
+    static size_t Hash( std::wstring_view name, eModType type )
+    {
+        uint64_t hash = 14695981039346656037ull ^ static_cast<uint64_t>(type);
+        for (auto c : name)
+            hash = (hash ^ Fold( c )) * 1099511628211ull;
+
+        return static_cast<size_t>(hash);
+    }
+};
+
+}
+
 namespace std
 {
     template <>
-    struct hash < struct pair<wstring, blackbone::eModType> >
+    struct hash<blackbone::ModuleKey>
     {
-        size_t operator()( const pair<wstring, blackbone::eModType>& value ) const
+        size_t operator()( const blackbone::ModuleKey& value ) const
         {
-            hash<wstring> sh;
-            return sh( value.first ) ^ value.second;
+            return value.hash;
         }
     };
 }
@@ -45,7 +92,7 @@ struct exportData
 class ProcessModules
 {
 public:
-    using mapModules = std::unordered_map<std::pair<std::wstring, eModType>, ModuleDataPtr> ;
+    using mapModules = std::unordered_map<ModuleKey, ModuleDataPtr>;
 
 public:
     BLACKBONE_API ProcessModules( class Process& proc );
@@ -57,11 +104,13 @@ public:
     /// <param name="name">Module name</param>
     /// <param name="type">Module type. 32 bit or 64 bit</param>
     /// <param name="search">Search type.</param>
+    /// <param name="baseModule">Import module name. Used only to resolve ApiSchema during manual map</param>
     /// <returns>Module data. nullptr if not found</returns>
     BLACKBONE_API ModuleDataPtr GetModule(
-        const std::wstring& name,
+        std::wstring_view name,
         eModSeachType search = LdrList,
-        eModType type = mt_default
+        eModType type = mt_default,
+        const wchar_t* baseModule = L""
         );
 
     /// <summary>
@@ -100,6 +149,14 @@ public:
     /// <returns>Module data. nullptr if not found</returns>
     BLACKBONE_API ModuleDataPtr GetMainModule();
 
+    /// <summary>
+    /// Get cached module containing address. Unlike GetModule, loader lists aren't rescanned on miss,
+    /// so it can be used to symbolize addresses in tight loops
+    /// </summary>
+    /// <param name="address">Address to look up</param>
+    /// <returns>Module data. nullptr if not found</returns>
+    BLACKBONE_API ModuleDataPtr ModuleFromAddress( ptr_t address );
+
     /// <summary>
     /// Enumerate all process modules
     /// </summary>
@@ -139,6 +196,32 @@ public:
         const wchar_t* baseModule = L""
     );
 
+    /// <summary>
+    /// Get multiple exports at once. Forwarded exports are resolved in one pass per forward module
+    /// </summary>
+    /// <param name="hMod">Module to search in</param>
+    /// <param name="names">Function names or ordinals</param>
+    /// <param name="baseModule">Import module name. Only used to resolve ApiSchema during manual map.</param>
+    /// <returns>Export info for every name, in the same order</returns>
+    BLACKBONE_API std::vector<call_result_t<exportData>> GetExports(
+        const ModuleDataPtr& hMod,
+        const std::vector<const char*>& names,
+        const wchar_t* baseModule = L""
+    );
+
+    /// <summary>
+    /// Get multiple exports at once. Forwarded exports are resolved in one pass per forward module
+    /// </summary>
+    /// <param name="hMod">Module to search in</param>
+    /// <param name="names">Function names or ordinals</param>
+    /// <param name="baseModule">Import module name. Only used to resolve ApiSchema during manual map.</param>
+    /// <returns>Export info for every name, in the same order</returns>
+    BLACKBONE_API std::vector<call_result_t<exportData>> GetExports(
+        const ModuleData& hMod,
+        const std::vector<const char*>& names,
+        const wchar_t* baseModule = L""
+    );
+
     /// <summary>
     /// Get export address. Forwarded exports will be automatically resolved if forward module is present
     /// </summary>
@@ -170,6 +253,8 @@ public:
 #ifdef COMPILER_MSVC
     /// <summary>
     /// Inject pure IL image.
+    /// Runtime host created by first call is kept in RPC data block,
+    /// later calls for the same runtime version only run ExecuteInDefaultAppDomain in RPC worker thread
     /// </summary>
     /// <param name="netVersion">NET runtime version to use</param>
     /// <param name="netAssemblyPath">Path to image</param>
@@ -230,25 +315,180 @@ public:
     /// <returns>true on success</returns>
     BLACKBONE_API bool ValidateModule( module_t base );
 
+    /// <summary>
+    /// Drop cached export index and resolved forward chains
+    /// </summary>
+    /// <param name="base">Module base address, 0 - drop all</param>
+    BLACKBONE_API void InvalidateExports( module_t base = 0 );
+
+    /// <summary>
+    /// Track loader module loads and unloads through LdrRegisterDllNotification callback.
+    /// While enabled, LdrList lookups are served from cache updated by notification events,
+    /// without header revalidation and loader list walks on every miss
+    /// </summary>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS EnableLoadNotifications();
+
+    /// <summary>
+    /// Unregister loader notification callback and return to polling lookups
+    /// </summary>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS DisableLoadNotifications();
+
+    /// <summary>
+    /// Check if loader notifications are active
+    /// </summary>
+    /// <returns>true if cache is updated by notification events</returns>
+    BLACKBONE_API inline bool notificationsEnabled() const { return _notifyMem.valid(); }
+
     /// <summary>
     /// Reset local data
     /// </summary>
     BLACKBONE_API void reset();
 
 private:
+    /// <summary>
+    /// Parsed module export directory
+    /// </summary>
+    struct ExportIndex
+    {
+        module_t base = 0;                                  // Module base
+        uint32_t size = 0;                                  // Module size
+        ptr_t ldrPtr = 0;                                   // Loader entry of indexed module
+        uint32_t timeStamp = 0;                             // Image header timestamp
+        bool shared = false;                                // Shared between processes, ldrPtr isn't checked
+        eModType type = mt_mod64;                           // Module type, used to resolve forwards
+        DWORD ordinalBase = 0;                              // Export ordinal base
+        std::vector<DWORD> functions;                       // Function RVAs by ordinal index
+        std::unordered_map<std::string, WORD> names;        // Ordinal indexes by name
+        std::unordered_map<WORD, exportData> forwards;      // Pre-split forwarders by ordinal index
+    };
+
+    using ExportIndexPtr = std::shared_ptr<const ExportIndex>;
+    using SharedIndexKey = std::tuple<std::wstring, module_t, eModType, uint32_t>;    // Module path, base, type and timestamp
+
+    // Loader notification ring capacity, must be power of 2
+    static constexpr uint32_t NotifyRingSize = 128;
+
+    /// <summary>
+    /// Single loader notification, filled by remote callback
+    /// </summary>
+    struct NotifyEvent
+    {
+        uint32_t sequence;                                  // Event index + 1, written last
+        uint32_t reason;                                    // LDR_DLL_NOTIFICATION_REASON_*
+        uint64_t base;                                      // Image base
+        uint32_t size;                                      // Image size
+        uint32_t reserved[3];
+    };
+
+    /// <summary>
+    /// Remote notification ring
+    /// </summary>
+    struct NotifyRing
+    {
+        uint32_t writeIndex;                                // Number of posted events
+        uint32_t reserved;
+        uint64_t cookie;                                    // LdrRegisterDllNotification cookie
+        uint8_t padding[0x30];
+        NotifyEvent events[NotifyRingSize];                 // Event slots
+    };
+
     ProcessModules( const ProcessModules& ) = delete;
     ProcessModules operator =(const ProcessModules&) = delete;
 
     void UpdateModuleCache( eModSeachType search, eModType type );
 
+    /// <summary>
+    /// Add module to name and address indexes. Existing module with the same name is kept
+    /// </summary>
+    /// <param name="mod">Module</param>
+    /// <returns>Cached module</returns>
+    ModuleDataPtr InsertModule( const ModuleDataPtr& mod );
+
+    /// <summary>
+    /// Find module by cache key, rescan module list on miss
+    /// </summary>
+    /// <param name="key">Module name and type</param>
+    /// <param name="search">Search type</param>
+    /// <returns>Module data. nullptr if not found</returns>
+    ModuleDataPtr FindModule( const ModuleKey& key, eModSeachType search );
+
+    /// <summary>
+    /// Remove module from name and address indexes
+    /// </summary>
+    /// <param name="iter">Module to remove</param>
+    /// <returns>Iterator following removed module</returns>
+    mapModules::iterator EraseModule( mapModules::iterator iter );
+
+    /// <summary>
+    /// Find cached module by address
+    /// </summary>
+    /// <param name="address">Address to look up</param>
+    /// <param name="strict">If true address must exactly match module base address</param>
+    /// <returns>Module data. nullptr if not found</returns>
+    ModuleDataPtr FindByAddress( ptr_t address, bool strict ) const;
+
+    /// <summary>
+    /// Get cached export index, build it if module wasn't indexed yet
+    /// </summary>
+    /// <param name="hMod">Module</param>
+    /// <returns>Export index</returns>
+    call_result_t<ExportIndexPtr> GetExportIndex( const ModuleData& hMod );
+
+    /// <summary>
+    /// Read and parse module export directory
+    /// </summary>
+    /// <param name="hMod">Module</param>
+    /// <param name="index">Resulting index</param>
+    /// <param name="local">Module is mapped at the same base in current process, read it from there</param>
+    /// <returns>Status code</returns>
+    NTSTATUS BuildExportIndex( const ModuleData& hMod, ExportIndex& index, bool local = false );
+
+    /// <summary>
+    /// Read image header timestamp
+    /// </summary>
+    /// <param name="hMod">Module</param>
+    /// <param name="local">Module is mapped at the same base in current process, read it from there</param>
+    /// <returns>Timestamp, 0 if headers can't be read</returns>
+    uint32_t ReadTimeStamp( const ModuleData& hMod, bool local );
+
+    /// <summary>
+    /// Check if module is a system image mapped at the same base in every process of the same bitness
+    /// </summary>
+    /// <param name="hMod">Module</param>
+    /// <returns>true if module export index can be shared</returns>
+    static bool IsSharedModule( const ModuleData& hMod );
+
+    /// <summary>
+    /// Apply pending loader notifications to module cache
+    /// </summary>
+    /// <param name="search">Search type</param>
+    /// <param name="type">Module type</param>
+    /// <returns>true if cache is tracked by notifications for this search and module type</returns>
+    bool DrainNotifications( eModSeachType search, eModType type );
+
 private:
     class Process&       _proc;
     class ProcessMemory& _memory;
     class ProcessCore&   _core;
 
     mapModules _modules;            // Fast lookup cache
-    CriticalSection _modGuard;      // Module guard        
+    std::map<module_t, ModuleDataPtr> _byBase;  // Same modules sorted by base address
+    ReadWriteLock _modGuard;        // Module guard, not recursive
+    std::unordered_map<module_t, ExportIndexPtr> _exports;   // Export index cache
+    std::map<std::tuple<module_t, WORD, std::wstring>, exportData, std::less<>> _forwardMemo;   // Resolved forward chains by module, ordinal index and import module
+    CriticalSection _exportGuard;   // Export index guard
+
+    static std::map<SharedIndexKey, ExportIndexPtr> _sharedExports;   // System module export indexes shared by all processes
+    static CriticalSection _sharedGuard;                                // Shared index guard
     bool _ldrPatched;               // Win7 loader patch flag
+
+    MemBlock _notifyMem;            // Notification ring and callback stub
+    CriticalSection _notifyGuard;   // Serializes notification setup and teardown
+    uint32_t _notifyRead = 0;       // Number of consumed notification events
+    eModType _notifyType = mt_mod64;// Module type tracked by notification callback
+    std::wstring _clrVersion;       // Runtime version of CLR host cached in RPC data block
 };
 
 };
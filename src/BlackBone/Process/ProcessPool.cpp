@@ -0,0 +1,302 @@
+#include "ProcessPool.h"
+#include "../Misc/Trace.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Create pool
+/// </summary>
+/// <param name="access">Access mask used to attach to processes, SYNCHRONIZE is added to track exit</param>
+/// <param name="directSyscalls">Attach with direct syscall subsystem</param>
+ProcessPool::ProcessPool( DWORD access /*= DEFAULT_ACCESS_P*/, bool directSyscalls /*= false*/ )
+    : _access( access | SYNCHRONIZE )
+    , _directSyscalls( directSyscalls )
+{
+}
+
+ProcessPool::~ProcessPool()
+{
+    clear();
+}
+
+/// <summary>
+/// Get pooled process, attach to it if it isn't in pool yet
+/// </summary>
+/// <param name="pid">Process ID</param>
+/// <param name="createTime">Expected process creation time, 0 to accept any</param>
+/// <returns>Attached process, STATUS_NOT_FOUND if process with this PID has another creation time</returns>
+call_result_t<ProcessPool::ProcessPtr> ProcessPool::Acquire( DWORD pid, int64_t createTime /*= 0*/ )
+{
+    Entry stale;
+
+    {
+        CSLock lck( _lock );
+
+        auto iter = _pool.find( pid );
+        if (iter != _pool.end())
+        {
+            // Pooled handle keeps PID from being reused, so live entry is the only process with this PID
+            if (WaitForSingleObject( iter->second.process->core().handle(), 0 ) == WAIT_TIMEOUT)
+            {
+                if (createTime != 0 && createTime != iter->second.createTime)
+                    return STATUS_NOT_FOUND;
+
+                return iter->second.process;
+            }
+
+            // Exited, but exit callback didn't run yet
+            stale = std::move( iter->second );
+            _pool.erase( iter );
+        }
+    }
+
+    Unregister( stale );
+
+    auto process = std::make_shared<Process>();
+    auto status = process->Attach( pid, _access, _directSyscalls );
+    if (!NT_SUCCESS( status ))
+        return status;
+
+    FILETIME times[4] = { };
+    if (!GetProcessTimes( process->core().handle(), &times[0], &times[1], &times[2], &times[3] ))
+        return LastNtStatus();
+
+    Entry entry;
+    entry.process = process;
+    entry.createTime = static_cast<int64_t>((static_cast<uint64_t>(times[0].dwHighDateTime) << 32) | times[0].dwLowDateTime);
+
+    if (createTime != 0 && createTime != entry.createTime)
+        return STATUS_NOT_FOUND;
+
+    entry.context = std::make_unique<WaitContext>();
+    entry.context->pool = this;
+    entry.context->pid = pid;
+    entry.context->createTime = entry.createTime;
+
+    CSLock lck( _lock );
+
+    // Attached concurrently
+    auto iter = _pool.find( pid );
+    if (iter != _pool.end())
+        return iter->second.process;
+
+    if (!RegisterWaitForSingleObject(
+        &entry.wait, process->core().handle(), &ProcessPool::OnExit,
+        entry.context.get(), INFINITE, WT_EXECUTEONLYONCE
+        ))
+        return LastNtStatus();
+
+    _pool.emplace( pid, std::move( entry ) );
+    return process;
+}
+
+/// <summary>
+/// Current time, microseconds
+/// </summary>
+/// <returns>Timestamp</returns>
+inline uint64_t NowUs()
+{
+    using namespace std::chrono;
+    return static_cast<uint64_t>(duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count());
+}
+
+/// <summary>
+/// Number of failed targets
+/// </summary>
+/// <returns>Failed target count</returns>
+size_t ForEachResult::failed() const
+{
+    return std::count_if( targets.begin(), targets.end(), []( const auto& target ) { return !NT_SUCCESS( target.status ); } );
+}
+
+/// <summary>
+/// Run operation on every process, driving up to 'parallelism' processes concurrently.
+/// Each process is used by one worker only, duplicate PIDs are processed once.
+/// Pooled processes shouldn't be used by other threads until call returns
+/// </summary>
+/// <param name="pids">Target process IDs</param>
+/// <param name="fn">Operation</param>
+/// <param name="parallelism">Number of worker threads, 0 - one per CPU</param>
+/// <returns>Per-process statuses and timings</returns>
+ForEachResult ProcessPool::ForEach( const std::vector<DWORD>& pids, const fnProcessOp& fn, uint32_t parallelism /*= 0*/ )
+{
+    ForEachResult result;
+    uint64_t start = NowUs();
+
+    // Same Process object must not be driven by two workers
+    for (auto pid : pids)
+    {
+        auto dup = std::find_if( result.targets.begin(), result.targets.end(), [pid]( const auto& target ) { return target.pid == pid; } );
+        if (dup == result.targets.end())
+            result.targets.emplace_back().pid = pid;
+    }
+
+    if (parallelism == 0)
+        parallelism = std::max( std::thread::hardware_concurrency(), 1u );
+
+    parallelism = static_cast<uint32_t>(std::min<size_t>( parallelism, result.targets.size() ));
+
+    std::atomic<size_t> next( 0 );
+    auto worker = [&]()
+    {
+        for (size_t idx = next++; idx < result.targets.size(); idx = next++)
+        {
+            auto& target = result.targets[idx];
+            uint64_t begin = NowUs();
+
+            auto process = Acquire( target.pid );
+            if (process)
+            {
+                try
+                {
+                    target.status = fn( *process.result() );
+                }
+                catch (...)
+                {
+                    target.status = STATUS_UNHANDLED_EXCEPTION;
+                }
+            }
+            else
+                target.status = process.status;
+
+            target.time = NowUs() - begin;
+        }
+    };
+
+    if (parallelism <= 1)
+    {
+        worker();
+    }
+    else
+    {
+        std::vector<std::thread> workers;
+        for (uint32_t i = 0; i < parallelism; i++)
+            workers.emplace_back( worker );
+
+        for (auto& thread : workers)
+            thread.join();
+    }
+
+    result.time = NowUs() - start;
+    return result;
+}
+
+/// <summary>
+/// Remove process from pool. Process is detached once last reference is released
+/// </summary>
+/// <param name="pid">Process ID</param>
+/// <returns>true if process was pooled</returns>
+bool ProcessPool::Release( DWORD pid )
+{
+    Entry entry;
+
+    {
+        CSLock lck( _lock );
+
+        auto iter = _pool.find( pid );
+        if (iter == _pool.end())
+            return false;
+
+        entry = std::move( iter->second );
+        _pool.erase( iter );
+    }
+
+    Unregister( entry );
+    return true;
+}
+
+/// <summary>
+/// Remove all processes from pool
+/// </summary>
+void ProcessPool::clear()
+{
+    std::map<DWORD, Entry> entries;
+
+    {
+        CSLock lck( _lock );
+        entries.swap( _pool );
+    }
+
+    // Exit callbacks lock pool, so waits are cancelled outside of it
+    for (auto& entry : entries)
+        Unregister( entry.second );
+}
+
+/// <summary>
+/// Number of pooled processes
+/// </summary>
+/// <returns>Process count</returns>
+size_t ProcessPool::size()
+{
+    CSLock lck( _lock );
+    return _pool.size();
+}
+
+/// <summary>
+/// Process exit callback, evicts process entry
+/// </summary>
+/// <param name="context">WaitContext</param>
+/// <param name="timedOut">Unused</param>
+VOID CALLBACK ProcessPool::OnExit( PVOID context, BOOLEAN /*timedOut*/ )
+{
+    // Context is owned by entry, copy it before entry is gone
+    auto ctx = *reinterpret_cast<WaitContext*>(context);
+    Entry entry;
+
+    {
+        CSLock lck( ctx.pool->_lock );
+
+        auto iter = ctx.pool->_pool.find( ctx.pid );
+        if (iter == ctx.pool->_pool.end() || iter->second.createTime != ctx.createTime)
+            return;
+
+        entry = std::move( iter->second );
+        ctx.pool->_pool.erase( iter );
+    }
+
+    BLACKBONE_TRACE( L"ProcessPool: Process %d exited, evicted", ctx.pid );
+
+    // Can't wait for own callback to complete
+    UnregisterWait( entry.wait );
+}
+
+/// <summary>
+/// Cancel exit wait of removed entry. Waits for running callback to finish
+/// </summary>
+/// <param name="entry">Removed entry</param>
+void ProcessPool::Unregister( Entry& entry )
+{
+    if (entry.wait != nullptr)
+    {
+        UnregisterWaitEx( entry.wait, INVALID_HANDLE_VALUE );
+        entry.wait = nullptr;
+    }
+}
+
+/// <summary>
+/// Run operation on every process, driving up to 'parallelism' processes concurrently.
+/// Processes are attached for the duration of call only
+/// </summary>
+/// <param name="pids">Target process IDs</param>
+/// <param name="fn">Operation</param>
+/// <param name="parallelism">Number of worker threads, 0 - one per CPU</param>
+/// <param name="access">Access mask used to attach to processes</param>
+/// <returns>Per-process statuses and timings</returns>
+ForEachResult ForEachProcess(
+    const std::vector<DWORD>& pids,
+    const fnProcessOp& fn,
+    uint32_t parallelism /*= 0*/,
+    DWORD access /*= DEFAULT_ACCESS_P*/
+    )
+{
+    ProcessPool pool( access );
+    return pool.ForEach( pids, fn, parallelism );
+}
+
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include "Process.h"
+#include "../Include/CallResult.h"
+#include "../Misc/Utils.h"
+
+#include <map>
+#include <memory>
+#include <vector>
+#include <functional>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Outcome of operation on single process
+/// </summary>
+struct ProcessOpResult
+{
+    DWORD pid = 0;
+    NTSTATUS status = STATUS_SUCCESS;   // Attach status or operation result
+    uint64_t time = 0;                  // Attach and operation time, microseconds
+};
+
+/// <summary>
+/// Outcome of operation on a set of processes
+/// </summary>
+struct ForEachResult
+{
+    std::vector<ProcessOpResult> targets;   // Per-process results, in order of first occurrence of PID
+    uint64_t time = 0;                      // Total time, microseconds
+
+    /// <summary>
+    /// Number of failed targets
+    /// </summary>
+    /// <returns>Failed target count</returns>
+    BLACKBONE_API size_t failed() const;
+};
+
+/// <summary>
+/// Operation on single process
+/// </summary>
+/// <returns>Operation status</returns>
+using fnProcessOp = std::function<NTSTATUS( Process& )>;
+
+/// <summary>
+/// Pool of attached processes, for controllers that work with many targets and re-attach often.
+/// Entries are keyed by PID and creation time, so reused PID never resolves to an object of exited process.
+/// Entry is evicted as soon as its process exits.
+/// Symbols, image metadata, ntdll exports and loader variables are cached globally and shared by all pooled processes
+/// </summary>
+class ProcessPool
+{
+public:
+    using ProcessPtr = std::shared_ptr<Process>;
+
+public:
+    /// <summary>
+    /// Create pool
+    /// </summary>
+    /// <param name="access">Access mask used to attach to processes, SYNCHRONIZE is added to track exit</param>
+    /// <param name="directSyscalls">Attach with direct syscall subsystem</param>
+    BLACKBONE_API ProcessPool( DWORD access = DEFAULT_ACCESS_P, bool directSyscalls = false );
+    BLACKBONE_API ~ProcessPool();
+
+    /// <summary>
+    /// Get pooled process, attach to it if it isn't in pool yet
+    /// </summary>
+    /// <param name="pid">Process ID</param>
+    /// <param name="createTime">Expected process creation time, 0 to accept any</param>
+    /// <returns>Attached process, STATUS_NOT_FOUND if process with this PID has another creation time</returns>
+    BLACKBONE_API call_result_t<ProcessPtr> Acquire( DWORD pid, int64_t createTime = 0 );
+
+    /// <summary>
+    /// Run operation on every process, driving up to 'parallelism' processes concurrently.
+    /// Each process is used by one worker only, duplicate PIDs are processed once.
+    /// Pooled processes shouldn't be used by other threads until call returns
+    /// </summary>
+    /// <param name="pids">Target process IDs</param>
+    /// <param name="fn">Operation</param>
+    /// <param name="parallelism">Number of worker threads, 0 - one per CPU</param>
+    /// <returns>Per-process statuses and timings</returns>
+    BLACKBONE_API ForEachResult ForEach( const std::vector<DWORD>& pids, const fnProcessOp& fn, uint32_t parallelism = 0 );
+
+    /// <summary>
+    /// Remove process from pool. Process is detached once last reference is released
+    /// </summary>
+    /// <param name="pid">Process ID</param>
+    /// <returns>true if process was pooled</returns>
+    BLACKBONE_API bool Release( DWORD pid );
+
+    /// <summary>
+    /// Remove all processes from pool
+    /// </summary>
+    BLACKBONE_API void clear();
+
+    /// <summary>
+    /// Number of pooled processes
+    /// </summary>
+    /// <returns>Process count</returns>
+    BLACKBONE_API size_t size();
+
+private:
+    ProcessPool( const ProcessPool& ) = delete;
+    ProcessPool& operator =( const ProcessPool& ) = delete;
+
+    /// <summary>
+    /// Exit wait callback context
+    /// </summary>
+    struct WaitContext
+    {
+        ProcessPool* pool = nullptr;
+        DWORD pid = 0;
+        int64_t createTime = 0;
+    };
+
+    /// <summary>
+    /// Pooled process
+    /// </summary>
+    struct Entry
+    {
+        ProcessPtr process;
+        int64_t createTime = 0;                 // Process creation time
+        HANDLE wait = nullptr;                  // Exit wait registration
+        std::unique_ptr<WaitContext> context;   // Exit wait context
+    };
+
+    /// <summary>
+    /// Process exit callback, evicts process entry
+    /// </summary>
+    /// <param name="context">WaitContext</param>
+    /// <param name="timedOut">Unused</param>
+    static VOID CALLBACK OnExit( PVOID context, BOOLEAN timedOut );
+
+    /// <summary>
+    /// Cancel exit wait of removed entry. Waits for running callback to finish
+    /// </summary>
+    /// <param name="entry">Removed entry</param>
+    static void Unregister( Entry& entry );
+
+private:
+    DWORD _access;                  // Attach access mask
+    bool _directSyscalls;           // Attach with syscall subsystem
+    std::map<DWORD, Entry> _pool;   // Pooled processes by PID
+    CriticalSection _lock;
+};
+
+/// <summary>
+/// Run operation on every process, driving up to 'parallelism' processes concurrently.
+/// Processes are attached for the duration of call only
+/// </summary>
+/// <param name="pids">Target process IDs</param>
+/// <param name="fn">Operation</param>
+/// <param name="parallelism">Number of worker threads, 0 - one per CPU</param>
+/// <param name="access">Access mask used to attach to processes</param>
+/// <returns>Per-process statuses and timings</returns>
+BLACKBONE_API ForEachResult ForEachProcess(
+    const std::vector<DWORD>& pids,
+    const fnProcessOp& fn,
+    uint32_t parallelism = 0,
+    DWORD access = DEFAULT_ACCESS_P
+    );
+
+}
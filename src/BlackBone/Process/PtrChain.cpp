@@ -0,0 +1,176 @@
+#include "PtrChain.h"
+#include "Process.h"
+
+#include <algorithm>
+
+namespace blackbone
+{
+
+PtrChainResolver::PtrChainResolver( ProcessMemory& memory )
+    : _memory( memory )
+    , _epoch( memory.epoch() )
+{
+}
+
+/// <summary>
+/// Add chain
+/// </summary>
+/// <param name="chain">Base address + list of offsets, same layout as in ProcessMemory::Read</param>
+/// <returns>Chain ID</returns>
+size_t PtrChainResolver::Add( const std::vector<ptr_t>& chain )
+{
+    Chain entry;
+    entry.levels = chain;
+    if (chain.empty())
+        entry.status = STATUS_INVALID_PARAMETER;
+
+    _chains.emplace_back( std::move( entry ) );
+    return _chains.size() - 1;
+}
+
+/// <summary>
+/// Resolve all added chains
+/// </summary>
+/// <returns>STATUS_SUCCESS if all chains were resolved, otherwise status of first failed chain</returns>
+NTSTATUS PtrChainResolver::Resolve()
+{
+    if (_epoch != _memory.epoch())
+    {
+        _values.clear();
+        _epoch = _memory.epoch();
+    }
+
+    const bool wow64 = _memory.process()->barrier().targetWow64;
+    const size_t ptrSize = wow64 ? sizeof( uint32_t ) : sizeof( ptr_t );
+
+    // Current address for every chain
+    std::vector<ptr_t> current( _chains.size(), 0 );
+    size_t maxLevels = 0;
+
+    for (size_t i = 0; i < _chains.size(); i++)
+    {
+        auto& chain = _chains[i];
+        if (chain.levels.empty())
+            continue;
+
+        chain.result = 0;
+        chain.status = STATUS_SUCCESS;
+        current[i] = chain.levels[0];
+        maxLevels = std::max( maxLevels, chain.levels.size() );
+    }
+
+    std::vector<ReadRequest> requests;
+    std::vector<ptr_t> values;
+
+    // Level 'level' dereferences current address and adds next offset
+    for (size_t level = 0; level + 1 < maxLevels; level++)
+    {
+        requests.clear();
+
+        // Collect unique addresses missing in cache
+        for (size_t i = 0; i < _chains.size(); i++)
+        {
+            const auto& chain = _chains[i];
+            if (chain.status != STATUS_SUCCESS || level + 1 >= chain.levels.size())
+                continue;
+
+            if (current[i] == 0)
+            {
+                _chains[i].status = STATUS_INVALID_ADDRESS;
+                continue;
+            }
+
+            if (_values.count( current[i] ) == 0)
+            {
+                _values.emplace( current[i], 0 );
+                requests.push_back( { current[i], ptrSize } );
+            }
+        }
+
+        if (!requests.empty())
+        {
+            values.assign( requests.size(), 0 );
+            for (size_t i = 0; i < requests.size(); i++)
+                requests[i].buffer = &values[i];
+
+            _memory.ReadBatch( requests );
+
+            for (size_t i = 0; i < requests.size(); i++)
+            {
+                // Keep failed reads out of cache
+                if (NT_SUCCESS( requests[i].status ))
+                    _values[requests[i].address] = values[i];
+                else
+                    _values.erase( requests[i].address );
+            }
+        }
+
+        // Advance chains
+        for (size_t i = 0; i < _chains.size(); i++)
+        {
+            auto& chain = _chains[i];
+            if (chain.status != STATUS_SUCCESS || level + 1 >= chain.levels.size())
+                continue;
+
+            auto iter = _values.find( current[i] );
+            if (iter == _values.end())
+            {
+                chain.status = STATUS_PARTIAL_COPY;
+                continue;
+            }
+
+            current[i] = iter->second + chain.levels[level + 1];
+        }
+    }
+
+    NTSTATUS result = STATUS_SUCCESS;
+    for (size_t i = 0; i < _chains.size(); i++)
+    {
+        auto& chain = _chains[i];
+        if (chain.status == STATUS_SUCCESS)
+            chain.result = current[i];
+        else if (NT_SUCCESS( result ))
+            result = chain.status;
+    }
+
+    return result;
+}
+
+/// <summary>
+/// Get resolved address
+/// </summary>
+/// <param name="id">Chain ID</param>
+/// <returns>Final address of the chain, 0 if chain is invalid or wasn't resolved</returns>
+ptr_t PtrChainResolver::result( size_t id ) const
+{
+    return id < _chains.size() && _chains[id].status == STATUS_SUCCESS ? _chains[id].result : 0;
+}
+
+/// <summary>
+/// Get chain resolve status
+/// </summary>
+/// <param name="id">Chain ID</param>
+/// <returns>Status code</returns>
+NTSTATUS PtrChainResolver::status( size_t id ) const
+{
+    return id < _chains.size() ? _chains[id].status : STATUS_INVALID_PARAMETER;
+}
+
+/// <summary>
+/// Drop cached pointer values
+/// </summary>
+void PtrChainResolver::Invalidate()
+{
+    _values.clear();
+}
+
+/// <summary>
+/// Remove all chains
+/// </summary>
+void PtrChainResolver::Clear()
+{
+    _chains.clear();
+    _values.clear();
+}
+
+}
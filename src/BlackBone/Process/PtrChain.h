@@ -0,0 +1,81 @@
+#pragma once
+
+#include "../Include/Winheaders.h"
+#include "../Include/Types.h"
+
+#include <vector>
+#include <unordered_map>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Batched resolver for multi-level pointer chains.
+/// Chains with common prefixes share reads, every level is fetched by single ReadBatch.
+/// Dereferenced values are cached until ProcessMemory::BeginEpoch is called.
+/// </summary>
+class PtrChainResolver
+{
+public:
+    BLACKBONE_API PtrChainResolver( class ProcessMemory& memory );
+    BLACKBONE_API ~PtrChainResolver() = default;
+
+    /// <summary>
+    /// Add chain
+    /// </summary>
+    /// <param name="chain">Base address + list of offsets, same layout as in ProcessMemory::Read</param>
+    /// <returns>Chain ID</returns>
+    BLACKBONE_API size_t Add( const std::vector<ptr_t>& chain );
+
+    /// <summary>
+    /// Resolve all added chains
+    /// </summary>
+    /// <returns>STATUS_SUCCESS if all chains were resolved, otherwise status of first failed chain</returns>
+    BLACKBONE_API NTSTATUS Resolve();
+
+    /// <summary>
+    /// Get resolved address
+    /// </summary>
+    /// <param name="id">Chain ID</param>
+    /// <returns>Final address of the chain, 0 if chain is invalid or wasn't resolved</returns>
+    BLACKBONE_API ptr_t result( size_t id ) const;
+
+    /// <summary>
+    /// Get chain resolve status
+    /// </summary>
+    /// <param name="id">Chain ID</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS status( size_t id ) const;
+
+    /// <summary>
+    /// Drop cached pointer values
+    /// </summary>
+    BLACKBONE_API void Invalidate();
+
+    /// <summary>
+    /// Remove all chains
+    /// </summary>
+    BLACKBONE_API void Clear();
+
+    /// <summary>
+    /// Chain count
+    /// </summary>
+    /// <returns>Number of added chains</returns>
+    BLACKBONE_API inline size_t size() const { return _chains.size(); }
+
+private:
+    struct Chain
+    {
+        std::vector<ptr_t> levels;              // Base + offsets
+        ptr_t result = 0;                       // Resolved address
+        NTSTATUS status = STATUS_NOT_FOUND;     // Resolve status
+    };
+
+private:
+    class ProcessMemory& _memory;               // Target memory
+    std::vector<Chain> _chains;                 // Added chains
+    std::unordered_map<ptr_t, ptr_t> _values;   // Pointer values by address
+    uint64_t _epoch = 0;                        // Memory epoch of cached values
+};
+
+}
@@ -0,0 +1,286 @@
+#include "RemoteBatch.h"
+#include "../Process.h"
+#include "../../Include/Macro.h"
+
+namespace blackbone
+{
+
+RemoteBatch::RemoteBatch( Process& proc )
+    : _process( proc )
+{
+}
+
+/// <summary>
+/// Append call to the batch
+/// </summary>
+/// <param name="pfn">Remote function address</param>
+/// <param name="args">Function arguments</param>
+/// <param name="cc">Calling convention</param>
+/// <param name="retType">Return type, struct return values aren't supported</param>
+/// <returns>Call index</returns>
+size_t RemoteBatch::Add(
+    ptr_t pfn,
+    AsmArgs args,
+    eCalligConvention cc /*= cc_stdcall*/,
+    eReturnType retType /*= rt_int32*/
+    )
+{
+    BatchCall call;
+    call.pfn = pfn;
+    call.args.assign( args.begin(), args.end() );
+    call.cc = cc;
+    call.retType = retType;
+
+    _calls.emplace_back( std::move( call ) );
+    return _calls.size() - 1;
+}
+
+/// <summary>
+/// Append x64 call to the batch. In WOW64 process consecutive x64 calls run under single mode switch
+/// </summary>
+/// <param name="pfn">Remote x64 function address</param>
+/// <param name="args">Function arguments</param>
+/// <param name="retType">Return type, struct return values aren't supported</param>
+/// <returns>Call index</returns>
+size_t RemoteBatch::AddX64(
+    ptr_t pfn,
+    AsmArgs args,
+    eReturnType retType /*= rt_int64*/
+    )
+{
+    auto index = Add( pfn, args, cc_stdcall, retType );
+    _calls[index].x64 = true;
+
+    return index;
+}
+
+/// <summary>
+/// Execute all calls in sequence. Output arguments are updated like single remote call does
+/// </summary>
+/// <param name="contextThread">Execution thread, new thread is created if nullptr</param>
+/// <returns>Status code</returns>
+NTSTATUS RemoteBatch::Execute( ThreadPtr contextThread /*= nullptr*/ )
+{
+    _results.clear();
+    if (_calls.empty())
+        return STATUS_SUCCESS;
+
+    auto a = AsmFactory::GetAssembler( _process.core().isWow64() );
+    bool x86 = (*a)->getArch() == asmjit::kArchX86;
+
+    // Results go first, argument data follows
+    size_t resultSize = _calls.size() * sizeof( BatchResult );
+    size_t dataSize = resultSize;
+
+    for (auto& call : _calls)
+    {
+        if (call.retType == rt_struct || call.cc < cc_cdecl || call.cc > cc_fastcall)
+            return STATUS_NOT_SUPPORTED;
+
+        for (auto& arg : call.args)
+        {
+            // Transform 64 bit imm values
+            if (arg.type == AsmVariant::imm && arg.size > sizeof( uint32_t ) && x86 && !call.x64)
+            {
+                uint64_t value = arg.imm_val64;
+                arg.setData( &value, arg.size );
+            }
+
+            if (arg.type == AsmVariant::dataStruct || arg.type == AsmVariant::dataPtr)
+                dataSize = Align( dataSize + arg.size, 0x10 );
+        }
+    }
+
+    // Reuse block from previous execution if it fits
+    if (!_data.valid() || _data.size() < dataSize)
+    {
+        auto mem = _process.memory().Allocate( Align( dataSize, 0x1000 ), PAGE_READWRITE );
+        if (!mem)
+            return mem.status;
+
+        _data = std::move( mem.result() );
+    }
+
+    std::vector<uint8_t> local( dataSize );
+    size_t offset = resultSize;
+
+    for (auto& call : _calls)
+    {
+        for (auto& arg : call.args)
+        {
+            if (arg.type == AsmVariant::dataStruct || arg.type == AsmVariant::dataPtr)
+            {
+                memcpy( local.data() + offset, reinterpret_cast<const void*>(arg.imm_val), arg.size );
+                arg.new_imm_val = _data.ptr() + offset;
+                offset = Align( offset + arg.size, 0x10 );
+            }
+        }
+    }
+
+    NTSTATUS status = _data.Write( 0, local.size(), local.data() );
+    if (!NT_SUCCESS( status ))
+        return status;
+
+    // Ensure RPC environment exists
+    status = _process.remote().CreateRPCEnvironment( Worker_None, contextThread != nullptr );
+    if (!NT_SUCCESS( status ))
+        return status;
+
+    // Consecutive x64 calls of WOW64 process are grouped into long mode regions
+    std::vector<std::pair<size_t, size_t>> regions;     // First call, end call
+    std::vector<size_t> regionOffsets;
+
+    for (size_t i = 0; x86 && i < _calls.size(); i++)
+    {
+        if (!_calls[i].x64)
+            continue;
+
+        size_t end = i + 1;
+        while (end < _calls.size() && _calls[end].x64)
+            end++;
+
+        regions.emplace_back( i, end );
+        i = end;
+    }
+
+    if (!regions.empty())
+    {
+        auto a64 = AsmFactory::GetAssembler( AsmFactory::asm64 );
+        for (auto& [first, end] : regions)
+        {
+            regionOffsets.emplace_back( (*a64)->getOffset() );
+
+            a64->GenX64RegionPrologue();
+            for (size_t i = first; i < end; i++)
+                GenCall( *a64, _calls[i], _data.ptr() + i * sizeof( BatchResult ) );
+
+            a64->GenX64RegionEpilogue();
+        }
+
+        // Far call takes 32 bit address, WOW64 process allocations are below 4GB
+        if (!_regions.valid() || _regions.size() < (*a64)->getCodeSize())
+        {
+            auto mem = _process.memory().codeHeap().Allocate( (*a64)->getCodeSize() );
+            if (!mem)
+                return mem.status;
+
+            _regions = std::move( mem.result() );
+        }
+
+        std::vector<uint8_t> code( (*a64)->getCodeSize() );
+        (*a64)->setBaseAddress( static_cast<asmjit::Ptr>(_regions.ptr()) );
+        (*a64)->relocCode( code.data() );
+
+        if (!NT_SUCCESS( status = _regions.Write( 0, code.size(), code.data() ) ))
+            return status;
+    }
+
+    a->GenPrologue();
+
+    for (size_t i = 0, region = 0; i < _calls.size();)
+    {
+        if (region < regions.size() && regions[region].first == i)
+        {
+            a->GenX64RegionCall( static_cast<uint32_t>(_regions.ptr() + regionOffsets[region]) );
+            i = regions[region++].second;
+        }
+        else
+        {
+            GenCall( *a, _calls[i], _data.ptr() + i * sizeof( BatchResult ) );
+            i++;
+        }
+    }
+
+    _process.remote().AddReturnWithEvent( *a );
+    a->GenEpilogue();
+
+    // Choose execution thread
+    uint64_t tmpResult = 0;
+    if (!contextThread)
+        status = _process.remote().ExecInNewThread( (*a)->make(), (*a)->getCodeSize(), tmpResult );
+    else if (contextThread == _process.remote().getWorker())
+        status = _process.remote().ExecInWorkerThread( (*a)->make(), (*a)->getCodeSize(), tmpResult );
+    else
+        status = _process.remote().ExecInAnyThread( (*a)->make(), (*a)->getCodeSize(), tmpResult, contextThread );
+
+    if (!NT_SUCCESS( status ))
+        return status;
+
+    // Collect results and output arguments at once
+    if (!NT_SUCCESS( status = _data.Read( 0, local.size(), local.data() ) ))
+        return status;
+
+    _results.resize( _calls.size() );
+    memcpy( _results.data(), local.data(), resultSize );
+
+    for (auto& call : _calls)
+        for (auto& arg : call.args)
+            if (arg.type == AsmVariant::dataPtr && arg.output)
+                memcpy( reinterpret_cast<void*>(arg.imm_val), local.data() + (arg.new_imm_val - _data.ptr()), arg.size );
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Remove all calls and results
+/// </summary>
+void RemoteBatch::clear()
+{
+    _calls.clear();
+    _results.clear();
+}
+
+/// <summary>
+/// Generate call and result saving code
+/// </summary>
+/// <param name="a">Target assembler</param>
+/// <param name="call">Call</param>
+/// <param name="resultPtr">Result slot address</param>
+void RemoteBatch::GenCall( IAsmHelper& a, const BatchCall& call, ptr_t resultPtr )
+{
+    bool x86 = a->getArch() == asmjit::kArchX86;
+    auto args = call.args;
+
+    a.GenCall( call.pfn, args, call.cc );
+    a->mov( a->zcx, resultPtr );
+
+    // Retrieve result from XMM0, ST0 or general registers
+    if (call.retType == rt_float || call.retType == rt_double)
+    {
+        if (!x86)
+        {
+            if (call.retType == rt_double)
+                a->movsd( asmjit::host::qword_ptr( a->zcx, FIELD_OFFSET( BatchResult, value ) ), asmjit::host::xmm0 );
+            else
+                a->movss( asmjit::host::dword_ptr( a->zcx, FIELD_OFFSET( BatchResult, value ) ), asmjit::host::xmm0 );
+        }
+        else
+            a->fstp( asmjit::Mem( a->zcx, FIELD_OFFSET( BatchResult, value ), call.retType * sizeof( float ) ) );
+    }
+    else if (call.retType == rt_int32)
+    {
+        a->mov( asmjit::host::dword_ptr( a->zcx, FIELD_OFFSET( BatchResult, value ) ), asmjit::host::eax );
+    }
+    else
+    {
+        a->mov( a->intptr_ptr( a->zcx, FIELD_OFFSET( BatchResult, value ) ), a->zax );
+        if (x86)
+            a->mov( asmjit::host::dword_ptr( a->zcx, FIELD_OFFSET( BatchResult, value ) + sizeof( uint32_t ) ), asmjit::host::edx );
+    }
+
+    // TEB LastErrorValue and LastStatusValue
+    if (x86)
+        a->mov( a->zdx, asmjit::host::dword_ptr_abs( 0x18 ).setSegment( asmjit::host::fs ) );
+    else
+        a->mov( a->zdx, asmjit::host::dword_ptr_abs( 0x30 ).setSegment( asmjit::host::gs ) );
+
+    const int32_t lastErrorOffset = x86 ? 0x34 : 0x68;
+    const int32_t lastStatusOffset = 0x598 + 0x197 * (x86 ? sizeof( uint32_t ) : sizeof( uint64_t ));
+
+    a->mov( asmjit::host::eax, asmjit::host::dword_ptr( a->zdx, lastErrorOffset ) );
+    a->mov( asmjit::host::dword_ptr( a->zcx, FIELD_OFFSET( BatchResult, lastError ) ), asmjit::host::eax );
+    a->mov( asmjit::host::eax, asmjit::host::dword_ptr( a->zdx, lastStatusOffset ) );
+    a->mov( asmjit::host::dword_ptr( a->zcx, FIELD_OFFSET( BatchResult, lastStatus ) ), asmjit::host::eax );
+}
+
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include "../../Include/Winheaders.h"
+#include "../../Asm/AsmFactory.h"
+#include "../Threads/Threads.h"
+#include "../MemBlock.h"
+
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Result of a single batched call
+/// </summary>
+struct BatchResult
+{
+    uint64_t value = 0;                 // Return value, floating point values are stored as is
+    uint32_t lastError = 0;             // Thread last error after the call
+    NTSTATUS lastStatus = 0;            // Thread last NT status after the call
+};
+
+/// <summary>
+/// Sequence of remote calls assembled into single code blob.
+/// Arguments of all calls and results are transferred at once, so whole batch costs one round trip
+/// </summary>
+class RemoteBatch
+{
+public:
+    BLACKBONE_API RemoteBatch( class Process& proc );
+
+    /// <summary>
+    /// Append call to the batch
+    /// </summary>
+    /// <param name="pfn">Remote function address</param>
+    /// <param name="args">Function arguments</param>
+    /// <param name="cc">Calling convention</param>
+    /// <param name="retType">Return type, struct return values aren't supported</param>
+    /// <returns>Call index</returns>
+    BLACKBONE_API size_t Add(
+        ptr_t pfn,
+        AsmArgs args,
+        eCalligConvention cc = cc_stdcall,
+        eReturnType retType = rt_int32
+        );
+
+    /// <summary>
+    /// Append x64 call to the batch. In WOW64 process consecutive x64 calls run under single mode switch
+    /// </summary>
+    /// <param name="pfn">Remote x64 function address</param>
+    /// <param name="args">Function arguments</param>
+    /// <param name="retType">Return type, struct return values aren't supported</param>
+    /// <returns>Call index</returns>
+    BLACKBONE_API size_t AddX64(
+        ptr_t pfn,
+        AsmArgs args,
+        eReturnType retType = rt_int64
+        );
+
+    /// <summary>
+    /// Execute all calls in sequence. Output arguments are updated like single remote call does
+    /// </summary>
+    /// <param name="contextThread">Execution thread, new thread is created if nullptr</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS Execute( ThreadPtr contextThread = nullptr );
+
+    /// <summary>
+    /// Remove all calls and results
+    /// </summary>
+    BLACKBONE_API void clear();
+
+    /// <summary>
+    /// Number of calls
+    /// </summary>
+    BLACKBONE_API inline size_t size() const { return _calls.size(); }
+
+    /// <summary>
+    /// Results of last execution, in call order
+    /// </summary>
+    BLACKBONE_API inline const std::vector<BatchResult>& results() const { return _results; }
+
+    /// <summary>
+    /// Typed return value of a call
+    /// </summary>
+    /// <param name="index">Call index</param>
+    /// <returns>Return value</returns>
+    template<typename T>
+    T value( size_t index ) const
+    {
+        T val = {};
+        if (index < _results.size())
+            memcpy( &val, &_results[index].value, std::min( sizeof( T ), sizeof( uint64_t ) ) );
+
+        return val;
+    }
+
+private:
+    /// <summary>
+    /// Queued call
+    /// </summary>
+    struct BatchCall
+    {
+        ptr_t pfn = 0;
+        std::vector<AsmVariant> args;
+        eCalligConvention cc = cc_stdcall;
+        eReturnType retType = rt_int32;
+        bool x64 = false;               // Call is made in long mode
+    };
+
+    /// <summary>
+    /// Generate call and result saving code
+    /// </summary>
+    /// <param name="a">Target assembler</param>
+    /// <param name="call">Call</param>
+    /// <param name="resultPtr">Result slot address</param>
+    void GenCall( IAsmHelper& a, const BatchCall& call, ptr_t resultPtr );
+
+private:
+    class Process& _process;
+    std::vector<BatchCall> _calls;      // Queued calls
+    std::vector<BatchResult> _results;  // Results of last execution
+    MemBlock _data;                     // Results and arguments in target process
+    MemBlock _regions;                  // Long mode regions of WOW64 batch
+};
+
+}
@@ -2,14 +2,20 @@
 
 #include "../ProcessCore.h"
 #include "../ProcessMemory.h"
+#include "../WriteTransaction.h"
 #include "../Threads/Thread.h"
 #include "../../Include/Macro.h"
 
+#include <array>
+
 namespace blackbone
 {
 
 /// <summary>
 /// Remote function context during hook breakpoint.
+/// Top of the stack is read once on construction, argument and return address accesses inside it are served locally.
+/// TEB fields are read once on first access. Stack and TEB writes are buffered and flushed together
+/// by Flush or on destruction, before thread is resumed.
 /// </summary>
 class RemoteContext
 {
@@ -28,11 +34,34 @@ public:
         , _x64Target( x64 )
         , _wordSize( wordSize )
         , _frame_ptr( frame_ptr != 0 ? frame_ptr : ctx.Rsp )
-    {     
+        , _writes( memory )
+    {
+        // Extend window to return address slot if it is close enough
+        size_t size = StackWindow;
+        if (_frame_ptr >= ctx.Rsp && _frame_ptr + _wordSize - ctx.Rsp <= MaxStackWindow)
+            size = std::max<size_t>( size, static_cast<size_t>(_frame_ptr + _wordSize - ctx.Rsp) );
+
+        // Stack top may be closer than window size, retry up to the end of page
+        _stackBase = ctx.Rsp;
+        if (NT_SUCCESS( _memory.Read( _stackBase, size, _stack.data() ) ))
+            _stackSize = size;
+        else if (size_t tail = static_cast<size_t>(0x1000 - (_stackBase & 0xFFF)); tail < size && NT_SUCCESS( _memory.Read( _stackBase, tail, _stack.data() ) ))
+            _stackSize = tail;
     }
 
     BLACKBONE_API ~RemoteContext()
     {
+        Flush();
+    }
+
+    /// <summary>
+    /// Write buffered stack and TEB changes into target.
+    /// Called automatically on destruction
+    /// </summary>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS Flush()
+    {
+        return _writes.Commit();
     }
 
     // Native context
@@ -57,7 +86,7 @@ public:
     BLACKBONE_API inline const ptr_t returnAddress() const
     { 
         ptr_t val = 0;
-        _memory.Read( _frame_ptr, _wordSize, &val );
+        readStack( _frame_ptr, _wordSize, &val );
 
         return val;
     }
@@ -67,9 +96,9 @@ public:
     /// </summary>
     /// <param name="val">New return address</param>
     /// <returns>true on success</returns>
-    BLACKBONE_API inline bool returnAddress( ptr_t val ) const
+    BLACKBONE_API inline bool returnAddress( ptr_t val )
     { 
-        return (_memory.Write( _frame_ptr, _wordSize, &val ) == STATUS_SUCCESS);
+        return writeStack( _frame_ptr, _wordSize, &val );
     }
  
     /// <summary>
@@ -134,13 +163,17 @@ public:
                 return _ctx.R9;
 
             default:
-                return _memory.Read<DWORD64>( _ctx.Rsp + 0x28 + (index - 4) * _wordSize ).result( 0 );
+            {
+                DWORD64 val = 0;
+                readStack( _ctx.Rsp + 0x28 + (index - 4) * _wordSize, sizeof( val ), &val );
+                return val;
+            }
             }
         }
         else
         {
             DWORD64 val = 0;
-            _memory.Read( _ctx.Rsp + 4 + index * _wordSize, _wordSize, &val );
+            readStack( _ctx.Rsp + 4 + index * _wordSize, _wordSize, &val );
             return val;
         }
     }
@@ -173,14 +206,14 @@ public:
                 break;
 
             default:
-                return (_memory.Write( _ctx.Rsp + 0x28 + (index - 4) * _wordSize, val ) == STATUS_SUCCESS);
+                return writeStack( _ctx.Rsp + 0x28 + (index - 4) * _wordSize, sizeof( val ), &val );
             }
 
             return true;
         }
         else
         {
-            return  (_memory.Write( _ctx.Rsp + 4 + index * _wordSize, _wordSize, &val ) == STATUS_SUCCESS);
+            return writeStack( _ctx.Rsp + 4 + index * _wordSize, _wordSize, &val );
         }
     }
 
@@ -191,50 +224,20 @@ public:
     /// <returns>Last error code, -1 if function failed</returns>
     BLACKBONE_API DWORD lastError()
     {
-        ptr_t pteb = 0;
-        LONG offset = 0;
-
-        if( _x64Target )
-        {
-            pteb = _thd.teb( (_TEB64*)nullptr );
-            offset = FIELD_OFFSET( _TEB64, LastErrorValue );
-        }
-        else
-        {
-            pteb = _thd.teb( (_TEB32*)nullptr );
-            offset = FIELD_OFFSET( _TEB32, LastErrorValue );
-        }
-
-        if (pteb)
-            return _memory.Read<DWORD>( pteb + offset ).result( 0xFFFFFFFF );
-
-        return 0xFFFFFFFF;
+        return loadTeb() ? _teb.lastError : 0xFFFFFFFF;
     }
 
     /// <summary>
     /// Set last thread error code
     /// </summary>
-    /// <returns>Last error code, -1 if function failed</returns>
+    /// <returns>Status code, -1 if function failed</returns>
     BLACKBONE_API DWORD lastError( DWORD newError )
     {
-        ptr_t pteb = 0;
-        LONG offset = 0;
-
-        if (_x64Target)
-        {
-            pteb = _thd.teb( (_TEB64*)nullptr );
-            offset = FIELD_OFFSET( _TEB64, LastErrorValue );
-        }
-        else
-        {
-            pteb = _thd.teb( (_TEB32*)nullptr );
-            offset = FIELD_OFFSET( _TEB32, LastErrorValue );
-        }
-
-        if (!pteb)
+        if (!loadTeb())
             return 0xFFFFFFFF;
 
-        return _memory.Write( pteb + offset, newError );
+        _teb.lastError = newError;
+        return _writes.Write( _teb.errorPtr, newError );
     }
 
 
@@ -244,11 +247,7 @@ public:
     /// <returns>Data value</returns>
     BLACKBONE_API ptr_t getUserContext()
     {
-        auto pteb = _thd.teb( (_TEB64*)nullptr );
-        if (!pteb)
-            return 0;
-            
-        return _memory.Read<ptr_t>( pteb + FIELD_OFFSET( _NT_TIB_T<DWORD64>, ArbitraryUserPointer ) ).result( 0 );
+        return loadTeb() ? _teb.userContext : 0;
     }
 
     /// <summary>
@@ -257,16 +256,85 @@ public:
     /// <returns>true on success</returns>
     BLACKBONE_API bool setUserContext( ptr_t context )
     {
-        auto pteb = _thd.teb( (_TEB64*)nullptr );
-        if(pteb)
+        if (!loadTeb())
+            return false;
+
+        _teb.userContext = context;
+        return _writes.Write( _teb.userContextPtr, context ) == STATUS_SUCCESS;
+    }
+
+
+private:
+    /// <summary>
+    /// Read stack data, from window if possible
+    /// </summary>
+    /// <param name="address">Data address</param>
+    /// <param name="size">Data size</param>
+    /// <param name="data">Output buffer</param>
+    /// <returns>true on success</returns>
+    bool readStack( ptr_t address, size_t size, void* data ) const
+    {
+        if (address >= _stackBase && address + size <= _stackBase + _stackSize)
         {
-            if (_memory.Write( pteb + FIELD_OFFSET( _NT_TIB_T<DWORD64>, ArbitraryUserPointer ), context ) == STATUS_SUCCESS)
-                return true;
+            memcpy( data, _stack.data() + (address - _stackBase), size );
+            return true;
         }
 
-        return false;
+        return _memory.Read( address, size, data ) == STATUS_SUCCESS;
     }
 
+    /// <summary>
+    /// Write stack data. Writes inside window are buffered until Flush
+    /// </summary>
+    /// <param name="address">Data address</param>
+    /// <param name="size">Data size</param>
+    /// <param name="data">Data to write</param>
+    /// <returns>true on success</returns>
+    bool writeStack( ptr_t address, size_t size, const void* data )
+    {
+        if (address >= _stackBase && address + size <= _stackBase + _stackSize)
+        {
+            memcpy( _stack.data() + (address - _stackBase), data, size );
+            return _writes.Write( address, size, data ) == STATUS_SUCCESS;
+        }
+
+        return _memory.Write( address, size, data ) == STATUS_SUCCESS;
+    }
+
+    /// <summary>
+    /// Read last error and arbitrary user pointer TEB fields, once
+    /// </summary>
+    /// <returns>true if fields are available</returns>
+    bool loadTeb()
+    {
+        if (_teb.loaded)
+            return _teb.errorPtr != 0;
+
+        _teb.loaded = true;
+
+        // User pointer is always taken from native TEB
+        ptr_t teb64 = _thd.teb( (_TEB64*)nullptr );
+        ptr_t teb = _x64Target ? teb64 : _thd.teb( (_TEB32*)nullptr );
+        if (!teb || !teb64)
+            return false;
+
+        _teb.errorPtr = teb + (_x64Target ? FIELD_OFFSET( _TEB64, LastErrorValue ) : FIELD_OFFSET( _TEB32, LastErrorValue ));
+        _teb.userContextPtr = teb64 + FIELD_OFFSET( _NT_TIB_T<DWORD64>, ArbitraryUserPointer );
+
+        std::vector<ReadRequest> requests =
+        {
+            { _teb.errorPtr, sizeof( _teb.lastError ), &_teb.lastError },
+            { _teb.userContextPtr, sizeof( _teb.userContext ), &_teb.userContext },
+        };
+
+        if (!NT_SUCCESS( _memory.ReadBatch( requests, 0x100 ) ))
+        {
+            _teb.errorPtr = 0;
+            return false;
+        }
+
+        return true;
+    }
 
 private:
     RemoteContext( const RemoteContext& ) = delete;
@@ -280,6 +348,24 @@ private:
     BOOL  _x64Target = FALSE;   // Target process is 64 bit
     int   _wordSize = 4;        // 4 for x86, 8 for x64
     ptr_t _frame_ptr = 0;       // Top stack frame pointer
+
+    static constexpr size_t StackWindow = 0x100;        // Stack bytes read on construction
+    static constexpr size_t MaxStackWindow = 0x400;     // Window is extended up to this size to cover return address
+
+    std::array<uint8_t, MaxStackWindow> _stack;         // Stack window data
+    ptr_t _stackBase = 0;                               // Stack window address
+    size_t _stackSize = 0;                              // Stack window size, 0 if it couldn't be read
+
+    struct
+    {
+        bool loaded = false;        // Fields were read
+        ptr_t errorPtr = 0;         // LastErrorValue address, 0 if not available
+        ptr_t userContextPtr = 0;   // ArbitraryUserPointer address
+        DWORD lastError = 0;        // LastErrorValue
+        ptr_t userContext = 0;      // ArbitraryUserPointer
+    } _teb;
+
+    WriteTransaction _writes;   // Buffered stack and TEB writes
 };
 
 }
\ No newline at end of file
@@ -2,22 +2,35 @@
 #include "../Process.h"
 #include "../../Misc/DynImport.h"
 #include "../../Symbols/SymbolData.h"
+#include "../../Asm/StubTemplate.h"
 
 #include <3rd_party/VersionApi.h>
 #include <sddl.h>
 #include <AccCtrl.h>
 #include <Aclapi.h>
+#include <algorithm>
+#include <limits>
 
 namespace blackbone
 {
 
+// Template stub kinds
+enum eStubKind
+{
+    Stub_Call,          // Call function with arguments in slots, save result and signal event
+    Stub_CallSave,      // Call code without arguments and save result
+};
+
 RemoteExec::RemoteExec( Process& proc )
     : _process( proc )
     , _mods( _process.modules() )
     , _memory( _process.memory() )
     , _threads( _process.threads() )
     , _hWaitEvent( NULL )
+    , _hDoneEvent( NULL )
     , _apcPatched( false )
+    , _ring( proc )
+    , _pool( proc )
 {
 }
 
@@ -40,7 +53,10 @@ NTSTATUS RemoteExec::ExecInNewThread(
     eThreadModeSwitch modeSwitch /*= AutoSwitch*/
     )
 {
+    CSLock lck( _execLock );
+
     NTSTATUS status = STATUS_SUCCESS;
+    _calls++;
 
     // Write code
     if (!NT_SUCCESS( status = CopyCode( pCode, size ) ))
@@ -58,6 +74,32 @@ NTSTATUS RemoteExec::ExecInNewThread(
         break;
     }
 
+    // Regular wrapper differs only in addresses
+    if (!switchMode)
+    {
+        auto generate = []( IAsmHelper& a, const StubValues& v )
+        {
+            a.GenPrologue();
+            a.GenCall( v( 0 ), { } );
+            a->mov( a->zdx, v( 1 ) );
+            a->mov( asmjit::host::dword_ptr( a->zdx ), a->zax );
+            a.GenEpilogue( false, 4 );
+        };
+
+        uint64_t values[] = { _userCode.ptr(), _userData.ptr() + INTRET_OFFSET };
+        auto tmpl = StubTemplate::Get( StubTemplate::Key( Stub_CallSave, cc_stdcall, rt_int32, 0 ), _process.core().isWow64(), generate );
+
+        uint8_t code[0x100] = { 0 };
+        if (tmpl && tmpl->size() <= sizeof( code ))
+        {
+            tmpl->Emit( code, values, _countof( values ) );
+            if (!NT_SUCCESS( status = _userCode.Write( size, tmpl->size(), code ) ))
+                return status;
+
+            return RunNewThread( size, callResult );
+        }
+    }
+
     auto a = switchMode ? AsmFactory::GetAssembler( AsmFactory::asm64 ) 
                         : AsmFactory::GetAssembler( _process.core().isWow64() );
 
@@ -85,11 +127,38 @@ NTSTATUS RemoteExec::ExecInNewThread(
     (*a)->mov( asmjit::host::dword_ptr( (*a)->zdx ), (*a)->zax );
     a->GenEpilogue( switchMode, 4 );
     
-    // Execute code in newly created thread
     if (!NT_SUCCESS( status = _userCode.Write( size, (*a)->getCodeSize(), (*a)->make() ) ))
         return status;
 
-    auto thread = _threads.CreateNew( _userCode.ptr() + size, _userData.ptr()/*, HideFromDebug*/ );
+    return RunNewThread( size, callResult, switchMode );
+}
+
+/// <summary>
+/// Run wrapper written after user code in new or parked thread
+/// </summary>
+/// <param name="wrapperOffset">Wrapper offset in code block</param>
+/// <param name="callResult">Code return value</param>
+/// <param name="switchMode">Wrapper switches thread to long mode, parked thread can't be used</param>
+/// <returns>Status</returns>
+NTSTATUS RemoteExec::RunNewThread( size_t wrapperOffset, uint64_t& callResult, bool switchMode /*= false*/ )
+{
+    // Execute code in parked thread
+    if (_threadCache && !switchMode && NT_SUCCESS( GetParkedThread() ))
+    {
+        if (!NT_SUCCESS( _process.core().native()->QueueApcT( _parkedThread->handle(), _userCode.ptr() + wrapperOffset, 0 ) ))
+            return LastNtStatus();
+
+        // Code may terminate thread itself, new one is created next time
+        HANDLE handles[] = { _hParkedDone, _parkedThread->handle() };
+        if (WaitForMultipleObjects( ARRAYSIZE( handles ), handles, FALSE, INFINITE ) == WAIT_FAILED)
+            return LastNtStatus();
+
+        callResult = _userData.Read<uint64_t>( INTRET_OFFSET, 0 );
+        return STATUS_SUCCESS;
+    }
+
+    // Execute code in newly created thread
+    auto thread = _threads.CreateNew( _userCode.ptr() + wrapperOffset, _userData.ptr(), _threadOptions );
     if (!thread)
         return thread.status;
     if (!(*thread)->Join())
@@ -99,6 +168,147 @@ NTSTATUS RemoteExec::ExecInNewThread(
     return STATUS_SUCCESS;
 }
 
+/// <summary>
+/// Reuse thread for ExecInNewThread calls that don't switch thread mode.
+/// Finished thread is parked in alertable wait and receives next call as APC,
+/// so thread creation and DLL_THREAD_ATTACH notifications are paid only once
+/// </summary>
+/// <param name="enable">Enable thread cache</param>
+void RemoteExec::EnableThreadCache( bool enable )
+{
+    CSLock lck( _execLock );
+
+    _threadCache = enable;
+    if (!enable)
+        ReleaseParkedThread();
+}
+
+/// <summary>
+/// Set flags and stack sizes of worker, parked and direct execution threads created afterwards.
+/// ThreadCreateOptions::Lightweight() reduces committed target memory and skips DLL_THREAD_ATTACH,
+/// but executed code must not rely on per-thread initialization of loaded modules
+/// </summary>
+/// <param name="options">Thread creation options</param>
+void RemoteExec::SetThreadOptions( const ThreadCreateOptions& options )
+{
+    CSLock lck( _execLock );
+    _threadOptions = options;
+}
+
+/// <summary>
+/// Get parked thread, create if necessary
+/// </summary>
+/// <returns>Status code</returns>
+NTSTATUS RemoteExec::GetParkedThread()
+{
+    if (_parkedThread && _parkedThread->valid())
+        return STATUS_SUCCESS;
+
+    ReleaseParkedThread();
+
+    auto ntdll = _mods.GetModule( L"ntdll.dll", Sections );
+    auto pDelay = _mods.GetExport( ntdll, "NtDelayExecution" );
+    auto pSetEvent = _mods.GetExport( ntdll, "NtSetEvent" );
+    if (!pDelay)
+        return pDelay.status;
+    if (!pSetEvent)
+        return pSetEvent.status;
+
+    _hParkedDone = CreateEventW( NULL, FALSE, FALSE, NULL );
+    if (!_hParkedDone)
+        return LastNtStatus();
+
+    HANDLE hRemoteHandle = nullptr;
+    if (!DuplicateHandle( GetCurrentProcess(), _hParkedDone, _process.core().handle(), &hRemoteHandle, 0, FALSE, DUPLICATE_SAME_ACCESS ))
+        return LastNtStatus();
+
+    _hRemoteParkedDone = reinterpret_cast<ptr_t>(hRemoteHandle);
+
+    if (!_parkedCode.valid())
+    {
+        auto mem = _memory.codeHeap().Allocate( 0x1000 );
+        if (!mem)
+            return mem.status;
+
+        _parkedCode = std::move( mem.result() );
+    }
+
+    /*
+        for(;;)
+        {
+            SleepEx(INFINITE, TRUE);
+            SetEvent(hParkedDone);
+        }
+    */
+    auto a = AsmFactory::GetAssembler( _process.core().isWow64() );
+    a->EnableCompactCode( _parkedCode.ptr() + sizeof( LARGE_INTEGER ) );
+    auto l_loop = (*a)->newLabel();
+
+    (*a)->bind( l_loop );
+    a->GenCall( pDelay->procAddress, { TRUE, _parkedCode.ptr() } );
+    a->GenCall( pSetEvent->procAddress, { _hRemoteParkedDone, 0 } );
+    (*a)->jmp( l_loop );
+
+    // Most negative interval is an infinite timeout
+    LARGE_INTEGER liDelay = { { 0 } };
+    liDelay.QuadPart = static_cast<LONGLONG>(0x8000000000000000ull);
+
+    std::vector<uint8_t> code( (*a)->getCodeSize() );
+    (*a)->relocCode( code.data() );
+
+    _parkedCode.Write( 0, liDelay );
+    _parkedCode.Write( sizeof( LARGE_INTEGER ), code.size(), code.data() );
+
+    auto thd = _threads.CreateNew( _parkedCode.ptr() + sizeof( LARGE_INTEGER ), 0, _threadOptions );
+    if (!thd)
+        return thd.status;
+
+    _parkedThread = std::move( thd.result() );
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Terminate parked thread
+/// </summary>
+void RemoteExec::ReleaseParkedThread()
+{
+    if (_parkedThread)
+    {
+        if (_parkedThread->valid())
+        {
+            _parkedThread->Terminate();
+            _parkedThread->Join();
+        }
+
+        _parkedThread->Close();
+        _parkedThread.reset();
+    }
+
+    if (_hRemoteParkedDone)
+    {
+        HANDLE hLocal = nullptr;
+        DuplicateHandle(
+            _process.core().handle(),
+            reinterpret_cast<HANDLE>(_hRemoteParkedDone),
+            GetCurrentProcess(),
+            &hLocal,
+            0, false,
+            DUPLICATE_CLOSE_SOURCE | DUPLICATE_SAME_ACCESS
+        );
+
+        if (hLocal)
+            CloseHandle( hLocal );
+
+        _hRemoteParkedDone = 0;
+    }
+
+    if (_hParkedDone)
+    {
+        CloseHandle( _hParkedDone );
+        _hParkedDone = NULL;
+    }
+}
+
 /// <summary>
 /// Execute code in context of our worker thread
 /// </summary>
@@ -108,6 +318,8 @@ NTSTATUS RemoteExec::ExecInNewThread(
 /// <returns>Status</returns>
 NTSTATUS RemoteExec::ExecInWorkerThread( PVOID pCode, size_t size, uint64_t& callResult )
 {
+    CSLock lck( _execLock );
+
     NTSTATUS status = STATUS_SUCCESS;
 
     // Delegate to another thread
@@ -115,16 +327,33 @@ NTSTATUS RemoteExec::ExecInWorkerThread( PVOID pCode, size_t size, uint64_t& cal
         return ExecInAnyThread( pCode, size, callResult, _hijackThread );
 
     assert( _workerThread );
-    assert( _hWaitEvent != NULL );
-    if (!_workerThread || !_hWaitEvent)
+    assert( _hWaitEvent != NULL || _hDoneEvent != NULL );
+    if (!_workerThread || (!_hWaitEvent && !_hDoneEvent))
         return STATUS_INVALID_PARAMETER;
 
     // Write code
     if (!NT_SUCCESS( status = CopyCode( pCode, size ) ))
         return status;
 
+    return RunInWorkerThread( _userCode.ptr(), callResult );
+}
+
+/// <summary>
+/// Execute code already present in target process in context of our worker thread
+/// </summary>
+/// <param name="pRemoteCode">Code address</param>
+/// <param name="callResult">Execution result</param>
+/// <returns>Status</returns>
+NTSTATUS RemoteExec::RunInWorkerThread( ptr_t pRemoteCode, uint64_t& callResult )
+{
+    NTSTATUS status = STATUS_SUCCESS;
+
+    _calls++;
+
     if (_hWaitEvent)
         ResetEvent( _hWaitEvent );
+    if (_hDoneEvent)
+        ResetEvent( _hDoneEvent );
 
     // Patch KiUserApcDispatcher 
     /*if (!_apcPatched && IsWindows7OrGreater() && !IsWindows8OrGreater())
@@ -148,24 +377,171 @@ NTSTATUS RemoteExec::ExecInWorkerThread( PVOID pCode, size_t size, uint64_t& cal
             _apcPatched = true;
     }*/
 
-    auto pRemoteCode = _userCode.ptr();
-
     // Execute code in thread context
     // TODO: Find out why am I passing pRemoteCode as an argument???
     if (NT_SUCCESS( _process.core().native()->QueueApcT( _workerThread->handle(), pRemoteCode, pRemoteCode ) ))
     {
-        status = WaitForSingleObject( _hWaitEvent, 30 * 1000 /*wait 30s*/ );
+        // Event driven worker signals only after APC has returned
+        status = WaitForSingleObject( _hDoneEvent ? _hDoneEvent : _hWaitEvent, 30 * 1000 /*wait 30s*/ );
         callResult = _userData.Read<uint64_t>( RET_OFFSET, 0 );
     }
     else
         return LastNtStatus();
 
     // Ensure APC function fully returns
-    Sleep( 1 );
+    if (!_hDoneEvent)
+        Sleep( 1 );
 
     return status;
 }
 
+/// <summary>
+/// Execute code in context of our worker thread without waiting for completion.
+/// Completion is reported from thread pool thread; call result can be read inside callback.
+/// Other executions are held back until callback returns, so callback must not issue remote calls
+/// </summary>
+/// <param name="pCode">Code to execute</param>
+/// <param name="size">Code size</param>
+/// <param name="callback">Completion callback, receives execution status</param>
+/// <param name="timeout">Completion timeout in ms</param>
+/// <returns>Status code</returns>
+NTSTATUS RemoteExec::ExecInWorkerThreadAsync( PVOID pCode, size_t size, AsyncCallback callback, uint32_t timeout /*= 30 * 1000*/ )
+{
+    CSLock lck( _execLock );
+
+    NTSTATUS status = STATUS_SUCCESS;
+
+    // Hijacked thread signals no event to wait for
+    if (_hijackThread)
+        return STATUS_NOT_SUPPORTED;
+
+    if (!_workerThread || (!_hWaitEvent && !_hDoneEvent) || !callback)
+        return STATUS_INVALID_PARAMETER;
+
+    if (!_hAsyncIdle)
+    {
+        _hAsyncIdle = CreateEventW( NULL, TRUE, TRUE, NULL );
+        if (!_hAsyncIdle)
+            return LastNtStatus();
+    }
+
+    _calls++;
+
+    // Write code, waits for previous asynchronous execution
+    if (!NT_SUCCESS( status = CopyCode( pCode, size ) ))
+        return status;
+
+    if (_hWaitEvent)
+        ResetEvent( _hWaitEvent );
+    if (_hDoneEvent)
+        ResetEvent( _hDoneEvent );
+
+    ResetEvent( _hAsyncIdle );
+
+    {
+        CSLock lck( _asyncLock );
+        _asyncCallback = std::move( callback );
+
+        if (!RegisterWaitForSingleObject( &_hAsyncWait, _hDoneEvent ? _hDoneEvent : _hWaitEvent, &RemoteExec::AsyncComplete, this, timeout, WT_EXECUTEONLYONCE ))
+        {
+            status = LastNtStatus();
+            _hAsyncWait = NULL;
+            _asyncCallback = nullptr;
+            SetEvent( _hAsyncIdle );
+            return status;
+        }
+    }
+
+    auto pRemoteCode = _userCode.ptr();
+    if (!NT_SUCCESS( _process.core().native()->QueueApcT( _workerThread->handle(), pRemoteCode, pRemoteCode ) ))
+    {
+        status = LastNtStatus();
+
+        // Callback isn't invoked on failure
+        HANDLE hWait = NULL;
+        {
+            CSLock lck( _asyncLock );
+            std::swap( hWait, _hAsyncWait );
+            _asyncCallback = nullptr;
+        }
+
+        if (hWait)
+            UnregisterWaitEx( hWait, INVALID_HANDLE_VALUE );
+
+        SetEvent( _hAsyncIdle );
+        return status;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Asynchronous execution completion routine
+/// </summary>
+/// <param name="context">RemoteExec instance</param>
+/// <param name="timedOut">Wait has timed out</param>
+void CALLBACK RemoteExec::AsyncComplete( PVOID context, BOOLEAN timedOut )
+{
+    auto pThis = reinterpret_cast<RemoteExec*>(context);
+    HANDLE hWait = NULL;
+    AsyncCallback callback;
+
+    {
+        CSLock lck( pThis->_asyncLock );
+        std::swap( hWait, pThis->_hAsyncWait );
+        std::swap( callback, pThis->_asyncCallback );
+    }
+
+    // Wait can't be unregistered synchronously from its own callback
+    if (hWait)
+        UnregisterWait( hWait );
+
+    // Ensure APC function fully returns
+    if (!timedOut && !pThis->_hDoneEvent)
+        Sleep( 1 );
+
+    if (callback)
+        callback( timedOut ? STATUS_IO_TIMEOUT : STATUS_SUCCESS );
+
+    SetEvent( pThis->_hAsyncIdle );
+}
+
+/// <summary>
+/// Cancel pending asynchronous execution
+/// </summary>
+void RemoteExec::CancelAsync()
+{
+    if (!_hAsyncIdle)
+        return;
+
+    HANDLE hWait = NULL;
+    AsyncCallback callback;
+
+    {
+        CSLock lck( _asyncLock );
+        std::swap( hWait, _hAsyncWait );
+    }
+
+    // Blocks until running callback returns
+    if (hWait)
+        UnregisterWaitEx( hWait, INVALID_HANDLE_VALUE );
+
+    {
+        CSLock lck( _asyncLock );
+        std::swap( callback, _asyncCallback );
+    }
+
+    // Callback was never invoked
+    if (callback)
+    {
+        callback( STATUS_CANCELLED );
+        SetEvent( _hAsyncIdle );
+    }
+
+    // Callback which had already taken the wait handle
+    WaitForSingleObject( _hAsyncIdle, INFINITE );
+}
+
 /// <summary>
 /// Execute code in context of any existing thread
 /// </summary>
@@ -176,9 +552,12 @@ NTSTATUS RemoteExec::ExecInWorkerThread( PVOID pCode, size_t size, uint64_t& cal
 /// <returns>Status</returns>
 NTSTATUS RemoteExec::ExecInAnyThread( PVOID pCode, size_t size, uint64_t& callResult, ThreadPtr& thd )
 {
+    CSLock lck( _execLock );
+
     NTSTATUS status = STATUS_SUCCESS;
     _CONTEXT32 ctx32 = { 0 };
     _CONTEXT64 ctx64 = { 0 };
+    _calls++;
 
     assert( _hWaitEvent != NULL );
     if (_hWaitEvent == NULL)
@@ -188,13 +567,75 @@ NTSTATUS RemoteExec::ExecInAnyThread( PVOID pCode, size_t size, uint64_t& callRe
     if (!NT_SUCCESS( status = CopyCode( pCode, size ) ))
         return status;
 
+    // Trampoline is built once per thread
+    auto stub = GetHijackStub( thd->id() );
+    if (!stub)
+        return stub.status;
+
     if (_hWaitEvent)
         ResetEvent( _hWaitEvent );
 
     if (!thd->Suspend())
         return LastNtStatus();
 
+    // Only instruction and stack pointers are needed, trampoline preserves everything else itself
+    if (_process.core().isWow64())
+    {
+        if (NT_SUCCESS( status = thd->GetContext( ctx32, CONTEXT_CONTROL, true ) ) &&
+            NT_SUCCESS( status = _hijackCode.Write( stub->retSlot - _hijackCode.ptr(), ctx32.Eip ) ))
+        {
+            ctx32.Eip = static_cast<uint32_t>(stub->code);
+            status = thd->SetContext( ctx32, true );
+        }
+    }
+    else
+    {
+        if (NT_SUCCESS( status = thd->GetContext( ctx64, CONTEXT64_CONTROL, true ) ) &&
+            NT_SUCCESS( status = _hijackCode.Write( stub->retSlot - _hijackCode.ptr(), ctx64.Rip ) ))
+        {
+            ctx64.Rip = stub->code;
+            status = thd->SetContext( ctx64, true );
+        }
+    }
+
+    thd->Resume();
+    if (NT_SUCCESS( status ))
+    {
+        WaitForSingleObject( _hWaitEvent, 20 * 1000/*INFINITE*/ );
+        status = _userData.Read( RET_OFFSET, callResult );
+    }
+
+    return status;
+}
+
+/// <summary>
+/// Find or build hijack trampoline for a thread
+/// </summary>
+/// <param name="tid">Thread ID</param>
+/// <returns>Trampoline</returns>
+call_result_t<RemoteExec::HijackStub> RemoteExec::GetHijackStub( DWORD tid )
+{
+    auto iter = _hijackStubs.find( tid );
+    if (iter != _hijackStubs.end())
+        return iter->second;
+
+    if (!_hijackCode.valid())
+    {
+        auto mem = _memory.codeHeap().Allocate( 0x4000 );
+        if (!mem)
+            return mem.status;
+
+        _hijackCode = std::move( mem.result() );
+        _hijackUsed = 0;
+    }
+
     auto a = AsmFactory::GetAssembler( _process.core().isWow64() );
+    HijackStub stub;
+    stub.code = _hijackCode.ptr() + _hijackUsed;
+
+    // Stub address is known before generation
+    a->EnableCompactCode( stub.code );
+
     if (!_process.core().isWow64())
     {
         const int count = 15;
@@ -205,12 +646,6 @@ NTSTATUS RemoteExec::ExecInAnyThread( PVOID pCode, size_t size, uint64_t& callRe
             asmjit::host::r12, asmjit::host::r13, asmjit::host::r14, asmjit::host::r15, asmjit::host::rbp
         };
 
-        if (!NT_SUCCESS( status = thd->GetContext( ctx64, CONTEXT64_CONTROL, true ) ))
-        {
-            thd->Resume();
-            return status;
-        }
-
         //
         // Preserve thread context
         // I don't care about FPU, XMM and anything else
@@ -233,19 +668,15 @@ NTSTATUS RemoteExec::ExecInAnyThread( PVOID pCode, size_t size, uint64_t& callRe
         (*a)->popf();
         (*a)->add( asmjit::host::rsp, count * sizeof( uint64_t ) );
 
-        // jmp [rip]
+        // jmp [rip], return address is written before each hijack
         (*a)->dw( '\xFF\x25' );
         (*a)->dd( 0 );
-        (*a)->dq( ctx64.Rip );
+        (*a)->dq( 0 );
+
+        stub.retSlot = stub.code + (*a)->getCodeSize() - sizeof( uint64_t );
     }
     else
     {
-        if (!NT_SUCCESS( status = thd->GetContext( ctx32, CONTEXT_CONTROL, true ) ))
-        {
-            thd->Resume();
-            return status;
-        }
-
         (*a)->pusha();
         (*a)->pushf();
 
@@ -256,32 +687,73 @@ NTSTATUS RemoteExec::ExecInAnyThread( PVOID pCode, size_t size, uint64_t& callRe
         (*a)->popf();
         (*a)->popa();
 
-        (*a)->push( static_cast<int>(ctx32.Eip) );
+        // Return address is written before each hijack
+        auto l_ret = (*a)->newLabel();
+        (*a)->push( (*a)->intptr_ptr( l_ret ) );
         (*a)->ret();
-    }
+        (*a)->bind( l_ret );
+        (*a)->dd( 0 );
 
-    if (NT_SUCCESS( status = _userCode.Write( size, (*a)->getCodeSize(), (*a)->make() ) ))
-    {
-        if (_process.core().isWow64())
-        {
-            ctx32.Eip = static_cast<uint32_t>(_userCode.ptr() + size);
-            status = thd->SetContext( ctx32, true );
-        }     
-        else
-        {
-            ctx64.Rip = _userCode.ptr() + size;
-            status = thd->SetContext( ctx64, true );
-        }
+        stub.retSlot = stub.code + (*a)->getCodeSize() - sizeof( uint32_t );
     }
 
-    thd->Resume();
-    if (NT_SUCCESS( status ))
+    size_t codeSize = (*a)->getCodeSize();
+    if (_hijackUsed + codeSize > _hijackCode.size())
+        return STATUS_NO_MEMORY;
+
+    // Code is relocated to its final address before writing
+    std::vector<uint8_t> code( codeSize );
+    (*a)->relocCode( code.data() );
+
+    NTSTATUS status = _hijackCode.Write( _hijackUsed, code.size(), code.data() );
+    if (!NT_SUCCESS( status ))
+        return status;
+
+    _hijackUsed = Align( _hijackUsed + codeSize, 0x10 );
+    _hijackStubs.emplace( tid, stub );
+
+    return stub;
+}
+
+/// <summary>
+/// Evaluate threads suitable for hijacking, see ProcessThreads::getHijackCandidates.
+/// Worker thread is excluded
+/// </summary>
+/// <returns>Status code</returns>
+NTSTATUS RemoteExec::RefreshHijackCandidates()
+{
+    CSLock lck( _execLock );
+
+    _hijackCandidates.clear();
+    for (auto& thd : _threads.getHijackCandidates())
     {
-        WaitForSingleObject( _hWaitEvent, 20 * 1000/*INFINITE*/ );
-        status = _userData.Read( RET_OFFSET, callResult );
+        if (_workerThread && thd->id() == _workerThread->id())
+            continue;
+
+        _hijackCandidates.emplace_back( thd );
     }
 
-    return status;
+    return _hijackCandidates.empty() ? STATUS_NOT_FOUND : STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Get best thread for hijacking, evaluated once by RefreshHijackCandidates
+/// </summary>
+/// <returns>Thread, nullptr if none found</returns>
+ThreadPtr RemoteExec::GetHijackCandidate()
+{
+    if (_hijackCandidates.empty())
+        RefreshHijackCandidates();
+
+    for (auto& thd : _hijackCandidates)
+        if (thd->valid())
+            return thd;
+
+    // Candidates are outdated
+    if (NT_SUCCESS( RefreshHijackCandidates() ))
+        return _hijackCandidates.front();
+
+    return nullptr;
 }
 
 
@@ -293,7 +765,8 @@ NTSTATUS RemoteExec::ExecInAnyThread( PVOID pCode, size_t size, uint64_t& callRe
 /// <returns>Thread exit code</returns>
 DWORD RemoteExec::ExecDirect( ptr_t pCode, ptr_t arg )
 {
-    auto thread = _threads.CreateNew( pCode, arg/*, HideFromDebug*/ );
+    _calls++;
+    auto thread = _threads.CreateNew( pCode, arg, _threadOptions );
     if (!thread)
         return thread.status;
 
@@ -316,6 +789,8 @@ DWORD RemoteExec::ExecDirect( ptr_t pCode, ptr_t arg )
 /// <returns>Status</returns>
 NTSTATUS RemoteExec::CreateRPCEnvironment( WorkerThreadMode mode /*= Worker_None*/, bool bEvent /*= false*/ )
 {
+    CSLock lck( _execLock );
+
     DWORD thdID = GetTickCount();       // randomize thread id
     NTSTATUS status = STATUS_SUCCESS;
 
@@ -323,7 +798,8 @@ NTSTATUS RemoteExec::CreateRPCEnvironment( WorkerThreadMode mode /*= Worker_None
     {
         if (!result.valid())
         {
-            auto mem = _memory.Allocate( size, prot );
+            // Code caves share executable slabs, data gets own pages
+            auto mem = prot == PAGE_EXECUTE_READWRITE ? _memory.codeHeap().Allocate( size ) : _memory.Allocate( size, prot );
             if (!mem)
                 return mem.status;
                 
@@ -344,9 +820,9 @@ NTSTATUS RemoteExec::CreateRPCEnvironment( WorkerThreadMode mode /*= Worker_None
         return status;
 
     // Create RPC thread
-    if (mode == Worker_CreateNew)
+    if (mode == Worker_CreateNew || mode == Worker_CreateNewEvent)
     {
-        auto thd = CreateWorkerThread();
+        auto thd = CreateWorkerThread( mode == Worker_CreateNewEvent );
         if (!thd)
             return thd.status;
 
@@ -355,7 +831,10 @@ NTSTATUS RemoteExec::CreateRPCEnvironment( WorkerThreadMode mode /*= Worker_None
     // Get thread to hijack
     else if (mode == Worker_UseExisting)
     {
-        _hijackThread = _process.threads().getMostExecuted();
+        _hijackThread = GetHijackCandidate();
+        if (!_hijackThread)
+            _hijackThread = _process.threads().getMostExecuted();
+
         if (!_hijackThread)
             return STATUS_INVALID_THREAD;
 
@@ -372,8 +851,9 @@ NTSTATUS RemoteExec::CreateRPCEnvironment( WorkerThreadMode mode /*= Worker_None
 /// <summary>
 /// Create worker RPC thread
 /// </summary>
+/// <param name="eventDriven">Wait for APC without timeout and signal completion event once APC has returned</param>
 /// <returns>Thread ID</returns>
-call_result_t<DWORD> RemoteExec::CreateWorkerThread()
+call_result_t<DWORD> RemoteExec::CreateWorkerThread( bool eventDriven /*= false*/ )
 {
     auto a = AsmFactory::GetAssembler( _process.core().isWow64() );
     asmjit::Label l_loop = (*a)->newLabel();
@@ -409,26 +889,62 @@ call_result_t<DWORD> RemoteExec::CreateWorkerThread()
         if (!proc || !pExitThread)
             return proc.status ? proc.status : pExitThread.status;
 
+        auto pSetEvent = _mods.GetExport( ntdll, "NtSetEvent" );
+        if (eventDriven)
+        {
+            if (!pSetEvent)
+                return pSetEvent.status;
+
+            // Completion event, signaled by worker itself
+            if (!_hDoneEvent)
+            {
+                _hDoneEvent = CreateEventW( NULL, FALSE, FALSE, NULL );
+                if (!_hDoneEvent)
+                    return LastNtStatus();
+            }
+
+            HANDLE hRemoteHandle = nullptr;
+            if (!DuplicateHandle( GetCurrentProcess(), _hDoneEvent, _process.core().handle(), &hRemoteHandle, 0, FALSE, DUPLICATE_SAME_ACCESS ))
+                return LastNtStatus();
+
+            _hRemoteDone = reinterpret_cast<ptr_t>(hRemoteHandle);
+        }
+
         /*
             for(;;)
-                SleepEx(5, TRUE);
+            {
+                SleepEx(eventDriven ? INFINITE : 5, TRUE);
+                if(eventDriven)
+                    SetEvent(m_hDoneEvent);
+            }
 
             ExitThread(SetEvent(m_hWaitEvent));
         */
+        a->EnableCompactCode( _workerCode.ptr() + sizeof( LARGE_INTEGER ) );
+
         (*a)->bind( l_loop );
         a->GenCall( proc->procAddress, { TRUE, _workerCode.ptr() } );
+
+        // Alertable wait returns only after APC routine did
+        if (eventDriven)
+            a->GenCall( pSetEvent->procAddress, { _hRemoteDone, 0 } );
+
         (*a)->jmp( l_loop );
 
         a->ExitThreadWithStatus( pExitThread->procAddress, _userData.ptr() );
 
         // Write code into process
+        // Most negative interval is an infinite timeout
         LARGE_INTEGER liDelay = { { 0 } };
-        liDelay.QuadPart = -10 * 1000 * 5;
+        liDelay.QuadPart = eventDriven ? static_cast<LONGLONG>(0x8000000000000000ull) : -10 * 1000 * 5;
+
+        std::vector<uint8_t> code( (*a)->getCodeSize() );
+        (*a)->relocCode( code.data() );
 
         _workerCode.Write( 0, liDelay );
-        _workerCode.Write( sizeof(LARGE_INTEGER), (*a)->getCodeSize(), (*a)->make() );
+        _workerCode.Write( sizeof(LARGE_INTEGER), code.size(), code.data() );
 
-        auto thd = _threads.CreateNew( _workerCode.ptr() + sizeof( LARGE_INTEGER ), _userData.ptr()/*, HideFromDebug*/ );
+        auto thd = _threads.CreateNew( _workerCode.ptr() + sizeof( LARGE_INTEGER ), _userData.ptr(), _threadOptions );
         if (!thd)
             return thd.status;
 
@@ -500,27 +1016,31 @@ NTSTATUS RemoteExec::CreateAPCEvent( DWORD threadID )
 NTSTATUS RemoteExec::PrepareCallAssembly( 
     IAsmHelper& a, 
     ptr_t pfn,
-    std::vector<AsmVariant>& args,
+    AsmArgsInOut args,
     eCalligConvention cc,
     eReturnType retType
     )
 {
+    CSLock lck( _execLock );
+
     uintptr_t data_offset = ARGS_OFFSET;
 
     // Invalid calling convention
     if (cc < cc_cdecl || cc > cc_fastcall)
         return STATUS_INVALID_PARAMETER_3;
 
+    // Arguments of pending asynchronous call live in _userData
+    if (_hAsyncIdle)
+        WaitForSingleObject( _hAsyncIdle, INFINITE );
+
     // Copy structures and strings
     for (auto& arg : args)
     {
         // Transform 64 bit imm values
         if (arg.type == AsmVariant::imm && arg.size > sizeof( uint32_t ) && a.assembler()->getArch() == asmjit::kArchX86)
         {
-            arg.type = AsmVariant::dataStruct;
-            arg.buf.resize( arg.size );
-            memcpy( arg.buf.data(), &arg.imm_val64, arg.size );
-            arg.imm_val64 = reinterpret_cast<uint64_t>(arg.buf.data());
+            uint64_t value = arg.imm_val64;
+            arg.setData( &value, arg.size );
         }
 
         if (arg.type == AsmVariant::dataStruct || arg.type == AsmVariant::dataPtr)
@@ -533,17 +1053,37 @@ NTSTATUS RemoteExec::PrepareCallAssembly(
         }
     }
 
+    a.GenPrologue();
+
     // Insert hidden variable if return type is struct.
-    // This variable contains address of buffer in which return value is copied
+    // This variable contains address of buffer in which return value is copied.
+    // Extended list is kept on stack unless there are too many arguments
     if (retType == rt_struct)
     {
-        args.emplace( args.begin(), AsmVariant( _userData.ptr<uintptr_t>() + ARGS_OFFSET ) );
-        args.front().new_imm_val = args.front().imm_val;
-        args.front().type = AsmVariant::structRet;
+        constexpr size_t inlineArgs = 16;
+        AsmVariant local[inlineArgs];
+        std::vector<AsmVariant> spill;
+
+        AsmVariant* fullArgs = local;
+        if (args.size() >= inlineArgs)
+        {
+            spill.resize( args.size() + 1 );
+            fullArgs = spill.data();
+        }
+
+        fullArgs[0] = AsmVariant( _userData.ptr<uintptr_t>() + ARGS_OFFSET );
+        fullArgs[0].new_imm_val = fullArgs[0].imm_val;
+        fullArgs[0].type = AsmVariant::structRet;
+
+        for (size_t i = 0; i < args.size(); i++)
+            fullArgs[i + 1] = args[i];
+
+        a.GenCall( pfn, AsmArgs( fullArgs, args.size() + 1 ), cc );
+    }
+    else
+    {
+        a.GenCall( pfn, args, cc );
     }
-        
-    a.GenPrologue();
-    a.GenCall( pfn, args, cc );
 
     // Retrieve result from XMM0 or ST0
     if (retType == rt_float || retType == rt_double)
@@ -566,6 +1106,277 @@ NTSTATUS RemoteExec::PrepareCallAssembly(
     return STATUS_SUCCESS;
 }
 
+/// <summary>
+/// Call function in context of our worker thread.
+/// Call code is generated once per function, calling convention, return type and argument count
+/// and kept in target process, so repeated calls only write argument data.
+/// Arguments which can't be loaded from memory slot fall back to regular call assembly
+/// </summary>
+/// <param name="pfn">Remote function pointer</param>
+/// <param name="args">Function arguments</param>
+/// <param name="cc">Calling convention</param>
+/// <param name="retType">Return type</param>
+/// <param name="callResult">Execution result</param>
+/// <returns>Status code</returns>
+NTSTATUS RemoteExec::CallInWorkerThread(
+    ptr_t pfn,
+    AsmArgsInOut args,
+    eCalligConvention cc,
+    eReturnType retType,
+    uint64_t& callResult
+    )
+{
+    CSLock lck( _execLock );
+
+    // Invalid calling convention
+    if (cc < cc_cdecl || cc > cc_fastcall)
+        return STATUS_INVALID_PARAMETER_3;
+
+    auto stub = call_result_t<ptr_t>( STATUS_NOT_SUPPORTED );
+    if (!_hijackThread && StubCompatible( args, retType ))
+        stub = GetCallStub( pfn, args.size(), cc, retType );
+
+    if (!stub)
+    {
+        auto a = AsmFactory::GetAssembler( _process.core().isWow64() );
+
+        NTSTATUS status = PrepareCallAssembly( *a, pfn, args, cc, retType );
+        if (!NT_SUCCESS( status ))
+            return status;
+
+        return ExecInWorkerThread( (*a)->make(), (*a)->getCodeSize(), callResult );
+    }
+
+    // Argument slots come first, copied structures and strings follow
+    size_t slotsSize = args.size() * sizeof( uint64_t );
+    std::vector<uint8_t> block( slotsSize );
+
+    for (size_t i = 0; i < args.size(); i++)
+    {
+        auto& arg = args[i];
+        uint64_t value = arg.imm_val64;
+
+        if (arg.type == AsmVariant::dataStruct || arg.type == AsmVariant::dataPtr)
+        {
+            size_t offset = block.size();
+            block.resize( offset + arg.size + 0x10 );
+            memcpy( block.data() + offset, reinterpret_cast<const void*>(arg.imm_val), arg.size );
+
+            arg.new_imm_val = _userData.ptr() + ARGS_OFFSET + offset;
+            value = arg.new_imm_val;
+        }
+
+        memcpy( block.data() + i * sizeof( uint64_t ), &value, sizeof( value ) );
+    }
+
+    // Keep persistent slots at the end of block intact
+    if (ARGS_OFFSET + block.size() > std::min<size_t>( _userData.size(), CLRHOST_OFFSET ))
+        return STATUS_BUFFER_OVERFLOW;
+
+    // _userData is busy until asynchronous execution completes
+    if (_hAsyncIdle)
+        WaitForSingleObject( _hAsyncIdle, INFINITE );
+
+    NTSTATUS status = _userData.Write( ARGS_OFFSET, block.size(), block.data() );
+    if (!NT_SUCCESS( status ))
+        return status;
+
+    return RunInWorkerThread( stub.result(), callResult );
+}
+
+/// <summary>
+/// Read back output buffer arguments of completed call with a single read
+/// </summary>
+/// <param name="args">Call arguments</param>
+/// <returns>Status code</returns>
+NTSTATUS RemoteExec::ReadOutputArgs( AsmArgs args )
+{
+    ptr_t low = std::numeric_limits<ptr_t>::max(), high = 0;
+
+    for (auto& arg : args)
+    {
+        if (arg.type == AsmVariant::dataPtr && arg.output && arg.new_imm_val != 0 && arg.size != 0)
+        {
+            low = std::min( low, arg.new_imm_val );
+            high = std::max( high, arg.new_imm_val + arg.size );
+        }
+    }
+
+    if (high == 0)
+        return STATUS_SUCCESS;
+
+    // Copied arguments are packed together, so range is small
+    std::vector<uint8_t> buf( static_cast<size_t>(high - low) );
+    NTSTATUS status = _memory.Read( low, buf.size(), buf.data() );
+    if (!NT_SUCCESS( status ))
+        return status;
+
+    for (auto& arg : args)
+    {
+        if (arg.type == AsmVariant::dataPtr && arg.output && arg.new_imm_val != 0 && arg.size != 0)
+            memcpy( reinterpret_cast<void*>(arg.imm_val), buf.data() + (arg.new_imm_val - low), arg.size );
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Check if call stub can load all arguments from memory slots
+/// </summary>
+/// <param name="args">Function arguments</param>
+/// <param name="retType">Return type</param>
+/// <returns>true if stub can be cached</returns>
+bool RemoteExec::StubCompatible( AsmArgs args, eReturnType retType ) const
+{
+    bool x86 = _process.core().isWow64();
+    size_t ptrSize = x86 ? sizeof( uint32_t ) : sizeof( uint64_t );
+
+    // Hidden return buffer pointer isn't a slot
+    if (retType == rt_struct)
+        return false;
+
+    for (auto& arg : args)
+    {
+        switch (arg.type)
+        {
+        case AsmVariant::imm:
+            if (arg.size > ptrSize)
+                return false;
+            break;
+
+        case AsmVariant::dataPtr:
+            break;
+
+        // x86 copies structures onto stack
+        case AsmVariant::dataStruct:
+            if (x86)
+                return false;
+            break;
+
+        default:
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/// <summary>
+/// Find or generate call stub
+/// </summary>
+/// <param name="pfn">Remote function pointer</param>
+/// <param name="argCount">Argument count</param>
+/// <param name="cc">Calling convention</param>
+/// <param name="retType">Return type</param>
+/// <returns>Stub address</returns>
+call_result_t<ptr_t> RemoteExec::GetCallStub( ptr_t pfn, size_t argCount, eCalligConvention cc, eReturnType retType )
+{
+    auto key = std::make_tuple( pfn, cc, retType, argCount );
+    auto iter = _stubs.find( key );
+    if (iter != _stubs.end())
+        return iter->second;
+
+    if (!_stubCode.valid())
+    {
+        auto mem = _memory.codeHeap().Allocate( 0x10000 );
+        if (!mem)
+            return mem.status;
+
+        _stubCode = std::move( mem.result() );
+        _stubUsed = 0;
+    }
+
+    bool x86 = _process.core().isWow64();
+    ptr_t slots = _userData.ptr() + ARGS_OFFSET;
+
+    auto pSetEvent = _mods.GetNtdllExport( "NtSetEvent" );
+    if (!pSetEvent)
+        return pSetEvent.status;
+
+    // Every argument is loaded from its slot
+    auto generate = [x86, argCount, cc, retType]( IAsmHelper& a, const StubValues& v )
+    {
+        std::vector<AsmVariant> args;
+        for (size_t i = 0; i < argCount; i++)
+        {
+            if (x86)
+                args.emplace_back( asmjit::host::dword_ptr_abs( static_cast<asmjit::Ptr>(v( 1, static_cast<uint32_t>(i * sizeof( uint64_t )) )) ) );
+            else
+                args.emplace_back( asmjit::host::qword_ptr( asmjit::host::r11, static_cast<int32_t>(i * sizeof( uint64_t )) ) );
+
+            args.back().size = x86 ? sizeof( uint32_t ) : sizeof( uint64_t );
+        }
+
+        a.GenPrologue();
+
+        if (!x86)
+            a->mov( asmjit::host::r11, v( 1 ) );
+
+        a.GenCall( v( 0 ), args, cc );
+
+        // Retrieve result from XMM0 or ST0
+        if (retType == rt_float || retType == rt_double)
+        {
+            a->mov( a->zdx, v( 2 ) );
+
+            if (!x86)
+            {
+                if (retType == rt_double)
+                    a->movsd( asmjit::Mem( a->zdx, 0 ), asmjit::host::xmm0 );
+                else
+                    a->movss( asmjit::Mem( a->zdx, 0 ), asmjit::host::xmm0 );
+            }
+            else
+                a->fstp( asmjit::Mem( a->zdx, 0, retType * sizeof( float ) ) );
+        }
+
+        a.SaveRetValAndSignalEvent( v( 3 ), v( 2 ), v( 4 ), v( 5 ), retType );
+        a.GenEpilogue();
+    };
+
+    uint64_t values[] = 
+    {
+        pfn,
+        slots,
+        _userData.ptr() + RET_OFFSET,
+        pSetEvent->procAddress,
+        _userData.ptr() + EVENT_OFFSET,
+        _userData.ptr() + ERR_OFFSET
+    };
+
+    // Only immediates differ between functions, so code is patched from template
+    std::vector<uint8_t> code;
+    auto tmpl = StubTemplate::Get( StubTemplate::Key( Stub_Call, cc, retType, argCount ), x86, generate );
+    if (tmpl)
+    {
+        code.resize( tmpl->size() );
+        tmpl->Emit( code.data(), values, _countof( values ) );
+    }
+    else
+    {
+        auto a = AsmFactory::GetAssembler( x86 );
+        generate( *a, StubValues( values, _countof( values ) ) );
+
+        code.resize( (*a)->getCodeSize() );
+        (*a)->relocCode( code.data() );
+    }
+
+    // Arena is full, caller falls back to regular call assembly
+    size_t size = code.size();
+    if (_stubUsed + size > _stubCode.size())
+        return STATUS_NO_MEMORY;
+
+    ptr_t stub = _stubCode.ptr() + _stubUsed;
+    NTSTATUS status = _stubCode.Write( _stubUsed, size, code.data() );
+    if (!NT_SUCCESS( status ))
+        return status;
+
+    _stubUsed = Align( _stubUsed + size, 0x10 );
+    _stubs.emplace( key, stub );
+
+    return stub;
+}
+
 /// <summary>
 /// Copy executable code into remote codecave for future execution
 /// </summary>
@@ -574,23 +1385,20 @@ NTSTATUS RemoteExec::PrepareCallAssembly(
 /// <returns>Status</returns>
 NTSTATUS RemoteExec::CopyCode( PVOID pCode, size_t size )
 {
-    if (!_userCode.valid())
+    // _userCode and _userData are busy until asynchronous execution completes
+    if (_hAsyncIdle)
+        WaitForSingleObject( _hAsyncIdle, INFINITE );
+
+    // Heap block can't grow, larger one is taken instead
+    if (!_userCode.valid() || size > _userCode.size())
     {
-        auto mem = _memory.Allocate( size );
+        auto mem = _memory.codeHeap().Allocate( std::max<size_t>( size, 0x1000 ) );
         if (!mem)
             return mem.status;
 
         _userCode = std::move( mem.result() );
     }
 
-    // Reallocate for larger code
-    if (size > _userCode.size())
-    {
-        auto res = _userCode.Realloc( size );
-        if (!res)
-            return res.status;
-    }
-
     return _userCode.Write( 0, size, pCode );
 }
 
@@ -629,6 +1437,15 @@ void RemoteExec::AddReturnWithEvent(
 /// </summary>
 void RemoteExec::TerminateWorker()
 {
+    CSLock lck( _execLock );
+
+    CancelAsync();
+    if (_hAsyncIdle)
+    {
+        CloseHandle( _hAsyncIdle );
+        _hAsyncIdle = NULL;
+    }
+
     // Close remote event handle
     ptr_t hRemoteEvent = 0;
     _userData.Read( EVENT_OFFSET, hRemoteEvent );
@@ -657,6 +1474,8 @@ void RemoteExec::TerminateWorker()
         _hWaitEvent = NULL;
     }
 
+    ReleaseParkedThread();
+
     // Stop thread
     if(_workerThread && _workerThread->valid())
     {
@@ -666,6 +1485,31 @@ void RemoteExec::TerminateWorker()
         _workerThread.reset();
         _workerCode.Free();
     }
+
+    // Close completion event
+    if (_hRemoteDone)
+    {
+        HANDLE hLocal = nullptr;
+        DuplicateHandle(
+            _process.core().handle(),
+            reinterpret_cast<HANDLE>(_hRemoteDone),
+            GetCurrentProcess(),
+            &hLocal,
+            0, false,
+            DUPLICATE_CLOSE_SOURCE | DUPLICATE_SAME_ACCESS
+        );
+
+        if (hLocal)
+            CloseHandle( hLocal );
+
+        _hRemoteDone = 0;
+    }
+
+    if (_hDoneEvent)
+    {
+        CloseHandle( _hDoneEvent );
+        _hDoneEvent = NULL;
+    }
 }
 
 /// <summary>
@@ -673,11 +1517,23 @@ void RemoteExec::TerminateWorker()
 /// </summary>
 void RemoteExec::reset()
 {
+    CSLock lck( _execLock );
+
     TerminateWorker();
+    _ring.Close();
+    _pool.Stop();
 
     _userCode.Reset();
     _userData.Reset();
     _workerCode.Reset();
+    _stubCode.Reset();
+    _parkedCode.Reset();
+    _hijackCode.Reset();
+    _hijackUsed = 0;
+    _hijackStubs.clear();
+    _hijackCandidates.clear();
+    _stubUsed = 0;
+    _stubs.clear();
 
     _apcPatched = false;
 }
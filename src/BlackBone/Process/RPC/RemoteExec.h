@@ -4,6 +4,15 @@
 #include "../../Asm/AsmFactory.h"
 #include "../Threads/Threads.h"
 #include "../MemBlock.h"
+#include "../../Misc/Utils.h"
+#include "RemoteRing.h"
+#include "RemoteBatch.h"
+#include "RemoteWorkerPool.h"
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <tuple>
 
 // User data offsets
 #define INTRET_OFFSET   0x00
@@ -11,6 +20,7 @@
 #define ERR_OFFSET      0x10
 #define EVENT_OFFSET    0x18
 #define ARGS_OFFSET     0x20
+#define CLRHOST_OFFSET  0x3F00  // ICLRRuntimeHost kept alive by InjectPureIL
 
 
 namespace blackbone
@@ -21,12 +31,26 @@ enum WorkerThreadMode
     Worker_None,            // No worker thread
     Worker_CreateNew,       // Create dedicated worker thread
     Worker_UseExisting,     // Hijack existing thread
+    Worker_CreateNewEvent,  // Create dedicated worker thread that sleeps until APC arrives and signals after it returns
 };
 
+/// <summary>
+/// Remote code execution.
+/// Public execution routines are serialized by internal recursive lock, since they share one code cave,
+/// data region and worker thread. Hold guard() to keep multi-step sequence (prepare call, execute,
+/// read results) from interleaving with other threads. For truly concurrent calls use pool()
+/// </summary>
 class RemoteExec
 {
     using vecArgs = std::vector<AsmVariant>;
 
+public:
+    /// <summary>
+    /// Asynchronous execution completion callback
+    /// </summary>
+    /// <param name="status">Execution status</param>
+    using AsyncCallback = std::function<void( NTSTATUS status )>;
+
 public:
     BLACKBONE_API RemoteExec( class Process& proc );
     BLACKBONE_API ~RemoteExec();
@@ -60,6 +84,28 @@ public:
         eThreadModeSwitch modeSwitch = AutoSwitch 
         );
 
+    /// <summary>
+    /// Reuse thread for ExecInNewThread calls that don't switch thread mode.
+    /// Finished thread is parked in alertable wait and receives next call as APC,
+    /// so thread creation and DLL_THREAD_ATTACH notifications are paid only once
+    /// </summary>
+    /// <param name="enable">Enable thread cache</param>
+    BLACKBONE_API void EnableThreadCache( bool enable );
+
+    /// <summary>
+    /// Set flags and stack sizes of worker, parked and direct execution threads created afterwards.
+    /// ThreadCreateOptions::Lightweight() reduces committed target memory and skips DLL_THREAD_ATTACH,
+    /// but executed code must not rely on per-thread initialization of loaded modules
+    /// </summary>
+    /// <param name="options">Thread creation options</param>
+    BLACKBONE_API void SetThreadOptions( const ThreadCreateOptions& options );
+
+    /// <summary>
+    /// Thread creation options
+    /// </summary>
+    /// <returns>Options</returns>
+    BLACKBONE_API inline const ThreadCreateOptions& threadOptions() const { return _threadOptions; }
+
     /// <summary>
     /// Execute code in context of our worker thread
     /// </summary>
@@ -69,6 +115,18 @@ public:
     /// <returns>Status</returns>
     BLACKBONE_API NTSTATUS ExecInWorkerThread( PVOID pCode, size_t size, uint64_t& callResult );
 
+    /// <summary>
+    /// Execute code in context of our worker thread without waiting for completion.
+    /// Completion is reported from thread pool thread; call result can be read inside callback.
+    /// Other executions are held back until callback returns, so callback must not issue remote calls
+    /// </summary>
+    /// <param name="pCode">Code to execute</param>
+    /// <param name="size">Code size</param>
+    /// <param name="callback">Completion callback, receives execution status</param>
+    /// <param name="timeout">Completion timeout in ms</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS ExecInWorkerThreadAsync( PVOID pCode, size_t size, AsyncCallback callback, uint32_t timeout = 30 * 1000 );
+
     /// <summary>
     /// Execute code in context of any existing thread
     /// </summary>
@@ -79,6 +137,13 @@ public:
     /// <returns>Status</returns>
     BLACKBONE_API NTSTATUS ExecInAnyThread( PVOID pCode, size_t size, uint64_t& callResult, ThreadPtr& thread );
 
+    /// <summary>
+    /// Evaluate threads suitable for hijacking, see ProcessThreads::getHijackCandidates.
+    /// Worker thread is excluded
+    /// </summary>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS RefreshHijackCandidates();
+
     /// <summary>
     /// Create new thread with specified entry point and argument
     /// </summary>
@@ -99,11 +164,44 @@ public:
     BLACKBONE_API NTSTATUS PrepareCallAssembly(
         IAsmHelper& a,
         ptr_t pfn,
-        std::vector<blackbone::AsmVariant>& args,
+        AsmArgsInOut args,
         eCalligConvention cc,
         eReturnType retType
     );
 
+    /// <summary>
+    /// Call function in context of our worker thread.
+    /// Call code is generated once per function, calling convention, return type and argument count
+    /// and kept in target process, so repeated calls only write argument data.
+    /// Arguments which can't be loaded from memory slot fall back to regular call assembly
+    /// </summary>
+    /// <param name="pfn">Remote function pointer</param>
+    /// <param name="args">Function arguments</param>
+    /// <param name="cc">Calling convention</param>
+    /// <param name="retType">Return type</param>
+    /// <param name="callResult">Execution result</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS CallInWorkerThread(
+        ptr_t pfn,
+        AsmArgsInOut args,
+        eCalligConvention cc,
+        eReturnType retType,
+        uint64_t& callResult
+        );
+
+    /// <summary>
+    /// Read back output buffer arguments of completed call with a single read
+    /// </summary>
+    /// <param name="args">Call arguments</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS ReadOutputArgs( AsmArgs args );
+
+    /// <summary>
+    /// Number of cached call stubs
+    /// </summary>
+    /// <returns>Stub count</returns>
+    BLACKBONE_API size_t cachedStubs() const { return _stubs.size(); }
+
     /// <summary>
     /// Generate return from function with event synchronization
     /// </summary>
@@ -173,24 +271,82 @@ public:
     /// <returns></returns>
     BLACKBONE_API ThreadPtr getExecThread() { return _hijackThread ? _hijackThread : _workerThread; }
 
+    /// <summary>
+    /// Get RPC data block address
+    /// </summary>
+    /// <returns>Block address, 0 if RPC environment wasn't created</returns>
+    BLACKBONE_API ptr_t userData() const { return _userData.ptr(); }
+
     /// <summary>
     /// Ge memory routines
     /// </summary>
     /// <returns></returns>
     BLACKBONE_API class ProcessMemory& memory() { return _memory; }
 
+    /// <summary>
+    /// Shared memory call transport. Must be opened before use
+    /// </summary>
+    /// <returns>Call ring</returns>
+    BLACKBONE_API RemoteRing& ring() { return _ring; }
+
+    /// <summary>
+    /// Create empty call batch. Queued calls are executed with a single round trip
+    /// </summary>
+    /// <returns>Call batch</returns>
+    BLACKBONE_API RemoteBatch Batch() { return RemoteBatch( _process ); }
+
+    /// <summary>
+    /// Worker thread pool for concurrent calls. Must be started before use
+    /// </summary>
+    /// <returns>Worker pool</returns>
+    BLACKBONE_API RemoteWorkerPool& pool() { return _pool; }
+
+    /// <summary>
+    /// Execution lock, recursive. Must not be taken inside asynchronous completion callback
+    /// </summary>
+    /// <returns>Execution lock</returns>
+    BLACKBONE_API CriticalSection& guard() { return _execLock; }
+
+    /// <summary>
+    /// Number of remote code executions so far
+    /// </summary>
+    /// <returns>Call count</returns>
+    BLACKBONE_API uint64_t calls() const { return _calls; }
+
     /// <summary>
     /// Reset instance
     /// </summary>
     BLACKBONE_API void reset();
 
 private:
+    /// <summary>
+    /// Prebuilt hijack trampoline
+    /// </summary>
+    struct HijackStub
+    {
+        ptr_t code = 0;         // Trampoline address
+        ptr_t retSlot = 0;      // Address of original instruction pointer slot
+    };
+
+    /// <summary>
+    /// Find or build hijack trampoline for a thread
+    /// </summary>
+    /// <param name="tid">Thread ID</param>
+    /// <returns>Trampoline</returns>
+    call_result_t<HijackStub> GetHijackStub( DWORD tid );
+
+    /// <summary>
+    /// Get best thread for hijacking, evaluated once by RefreshHijackCandidates
+    /// </summary>
+    /// <returns>Thread, nullptr if none found</returns>
+    ThreadPtr GetHijackCandidate();
 
     /// <summary>
     /// Create worker RPC thread
     /// </summary>
+    /// <param name="eventDriven">Wait for APC without timeout and signal completion event once APC has returned</param>
     /// <returns>Thread ID</returns>
-    call_result_t<DWORD> CreateWorkerThread();
+    call_result_t<DWORD> CreateWorkerThread( bool eventDriven = false );
 
     /// <summary>
     /// Create event to synchronize APC procedures
@@ -207,6 +363,64 @@ private:
     /// <returns>Status</returns>
     NTSTATUS CopyCode( PVOID pCode, size_t size );
 
+    /// <summary>
+    /// Asynchronous execution completion routine
+    /// </summary>
+    /// <param name="context">RemoteExec instance</param>
+    /// <param name="timedOut">Wait has timed out</param>
+    static void CALLBACK AsyncComplete( PVOID context, BOOLEAN timedOut );
+
+    /// <summary>
+    /// Cancel pending asynchronous execution
+    /// </summary>
+    void CancelAsync();
+
+    /// <summary>
+    /// Get parked thread, create if necessary
+    /// </summary>
+    /// <returns>Status code</returns>
+    NTSTATUS GetParkedThread();
+
+    /// <summary>
+    /// Terminate parked thread
+    /// </summary>
+    void ReleaseParkedThread();
+
+    /// <summary>
+    /// Execute code already present in target process in context of our worker thread
+    /// </summary>
+    /// <param name="pRemoteCode">Code address</param>
+    /// <param name="callResult">Execution result</param>
+    /// <returns>Status</returns>
+    NTSTATUS RunInWorkerThread( ptr_t pRemoteCode, uint64_t& callResult );
+
+    /// <summary>
+    /// Run wrapper written after user code in new or parked thread
+    /// </summary>
+    /// <param name="wrapperOffset">Wrapper offset in code block</param>
+    /// <param name="callResult">Code return value</param>
+    /// <param name="switchMode">Wrapper switches thread to long mode, parked thread can't be used</param>
+    /// <returns>Status</returns>
+    NTSTATUS RunNewThread( size_t wrapperOffset, uint64_t& callResult, bool switchMode = false );
+
+    /// <summary>
+    /// Check if call stub can load all arguments from memory slots
+    /// </summary>
+    /// <param name="args">Function arguments</param>
+    /// <param name="retType">Return type</param>
+    /// <returns>true if stub can be cached</returns>
+    bool StubCompatible( AsmArgs args, eReturnType retType ) const;
+
+    /// <summary>
+    /// Find or generate call stub
+    /// </summary>
+    /// <param name="pfn">Remote function pointer</param>
+    /// <param name="argCount">Argument count</param>
+    /// <param name="cc">Calling convention</param>
+    /// <param name="retType">Return type</param>
+    /// <returns>Stub address</returns>
+    call_result_t<ptr_t> GetCallStub( ptr_t pfn, size_t argCount, eCalligConvention cc, eReturnType retType );
+
     RemoteExec( const RemoteExec& ) = delete;
     RemoteExec& operator =(const RemoteExec&) = delete;
 
@@ -220,10 +434,33 @@ private:
     ThreadPtr _workerThread;    // Worker thread handle
     ThreadPtr _hijackThread;    // Thread to use for hijacking  
     HANDLE    _hWaitEvent;      // APC sync event handle
+    HANDLE    _hDoneEvent;      // Event driven worker completion event
+    ptr_t     _hRemoteDone = 0; // _hDoneEvent handle in target process
     MemBlock  _workerCode;      // Worker thread address space
     MemBlock  _userCode;        // Codecave for code execution
     MemBlock  _userData;        // Region to store copied structures and strings
     bool      _apcPatched;      // KiUserApcDispatcher was patched
+    std::atomic<uint64_t> _calls{ 0 };  // Remote code executions
+    RemoteRing _ring;           // Shared memory call transport
+    RemoteWorkerPool _pool;     // Workers for concurrent calls
+    bool      _threadCache = false;     // Reuse thread for ExecInNewThread
+    ThreadCreateOptions _threadOptions; // Flags and stack sizes of created threads
+    ThreadPtr _parkedThread;            // Thread waiting for next ExecInNewThread call
+    HANDLE    _hParkedDone = NULL;      // Signaled by parked thread after each call
+    ptr_t     _hRemoteParkedDone = 0;   // _hParkedDone in target process
+    MemBlock  _parkedCode;              // Parked thread loop
+    MemBlock  _stubCode;        // Cached call stubs
+    size_t    _stubUsed = 0;    // Used stub code bytes
+    std::map<std::tuple<ptr_t, eCalligConvention, eReturnType, size_t>, ptr_t> _stubs;  // Stub addresses
+    MemBlock  _hijackCode;      // Hijack trampolines
+    size_t    _hijackUsed = 0;  // Used trampoline bytes
+    std::map<DWORD, HijackStub> _hijackStubs;   // Trampolines by thread ID
+    std::vector<ThreadPtr> _hijackCandidates;   // Threads ordered by hijack suitability
+    HANDLE    _hAsyncWait = NULL;   // Thread pool wait for pending asynchronous execution
+    HANDLE    _hAsyncIdle = NULL;   // Signaled while no asynchronous execution is pending
+    AsyncCallback _asyncCallback;   // Pending asynchronous execution callback
+    CriticalSection _asyncLock;     // Asynchronous execution state lock
+    CriticalSection _execLock;      // Serializes use of code cave, data region and worker thread
 };
 
 
@@ -3,8 +3,12 @@
 #include "../../Include/CallResult.h"
 #include "../../Asm/IAsmHelper.h"
 #include "../Process.h"
+#include "../../Misc/Task.h"
 
 #include <type_traits>
+#include <future>
+#include <functional>
+#include <memory>
 
 // TODO: Find more elegant way to deduce calling convention
 //       than defining each one manually
@@ -33,12 +37,6 @@ public:
         CallArguments( const std::initializer_list<AsmVariant>& args )
             : arguments{ args }
         {
-            // Since initializer_list can't be moved from, dataStruct types must be fixed
-            for (auto& arg : arguments)
-            {
-                if (!arg.buf.empty())
-                    arg.imm_val = reinterpret_cast<uintptr_t>(arg.buf.data());
-            }
         }
 
         // Manually set argument to custom value
@@ -63,59 +61,136 @@ public:
     }
 
     call_result_t<ReturnType> Call( CallArguments& args, ThreadPtr contextThread = nullptr )
+    {
+        return Call( args, _process.remote(), contextThread );
+    }
+
+    call_result_t<ReturnType> Call( CallArguments& args, RemoteWorkerPool& pool )
+    {
+        auto lease = pool.Acquire();
+        if (!lease)
+            return call_result_t<ReturnType>( ReturnType(), lease.status );
+
+        return Call( args, *lease.result(), lease.result()->getWorker() );
+    }
+
+    call_result_t<ReturnType> Call( CallArguments& args, RemoteExec& remote, ThreadPtr contextThread )
     {
         ReturnType result = {};
         uint64_t tmpResult = 0;
         NTSTATUS status = STATUS_SUCCESS;
         auto a = AsmFactory::GetAssembler( _process.core().isWow64() );
+        LatencyTimer timer( _process.latency().recording( LatencyOp::RemoteCall ) );
+
+        // Arguments and results share data region with other callers
+        CSLock lck( remote.guard() );
 
         // Ensure RPC environment exists
-        status = _process.remote().CreateRPCEnvironment( Worker_None, contextThread != nullptr );
+        status = remote.CreateRPCEnvironment( Worker_None, contextThread != nullptr );
         if (!NT_SUCCESS( status ))
             return call_result_t<ReturnType>( result, status );
 
-        // FPU check
-        constexpr bool isFloat = std::is_same_v<ReturnType, float>;
-        constexpr bool isDouble = std::is_same_v<ReturnType, double> || std::is_same_v<ReturnType, long double>;
-
-        // Deduce return type
-        eReturnType retType = rt_int32;
-
-        if constexpr (isFloat)
-            retType = rt_float;
-        else if constexpr (isDouble)
-            retType = rt_double;
-        else if constexpr (sizeof( ReturnType ) == sizeof( uint64_t ))
-            retType = rt_int64;
-        else if constexpr (!std::is_reference_v<ReturnType> && sizeof( ReturnType ) > sizeof( uint64_t ))
-            retType = rt_struct;
-
-        _process.remote().PrepareCallAssembly( *a, _ptr, args.arguments, Conv, retType );
+        constexpr eReturnType retType = ReturnKind();
 
         // Choose execution thread
-        if (!contextThread)
+        if (contextThread && contextThread == remote.getWorker())
         {
-            status = _process.remote().ExecInNewThread( (*a)->make(), (*a)->getCodeSize(), tmpResult );
-        }
-        else if (contextThread == _process.remote().getWorker())
-        {
-            status = _process.remote().ExecInWorkerThread( (*a)->make(), (*a)->getCodeSize(), tmpResult );
+            // Cached call stub
+            status = remote.CallInWorkerThread( _ptr, args.arguments, Conv, retType, tmpResult );
         }
         else
         {
-            status = _process.remote().ExecInAnyThread( (*a)->make(), (*a)->getCodeSize(), tmpResult, contextThread );
+            remote.PrepareCallAssembly( *a, _ptr, args.arguments, Conv, retType );
+
+            if (!contextThread)
+                status = remote.ExecInNewThread( (*a)->make(), (*a)->getCodeSize(), tmpResult );
+            else
+                status = remote.ExecInAnyThread( (*a)->make(), (*a)->getCodeSize(), tmpResult, contextThread );
         }
 
         // Get function return value
-        if (!NT_SUCCESS( status ) || !NT_SUCCESS( status = _process.remote().GetCallResult( result ) ))
+        if (!NT_SUCCESS( status ) || !NT_SUCCESS( status = remote.GetCallResult( result ) ))
             return call_result_t<ReturnType>( result, status );
 
-        // Update arguments
-        for (auto& arg : args.arguments)
-            if (arg.type == AsmVariant::dataPtr)
-                _process.memory().Read( arg.new_imm_val, arg.size, reinterpret_cast<void*>(arg.imm_val) );
+        // Update output arguments
+        status = remote.ReadOutputArgs( args.arguments );
+        return call_result_t<ReturnType>( result, status );
+    }
+
+    std::future<call_result_t<ReturnType>> CallAsync( CallArguments& args, uint32_t timeout = 30 * 1000 )
+    {
+        auto promise = std::make_shared<std::promise<call_result_t<ReturnType>>>();
+        auto future = promise->get_future();
 
-        return call_result_t<ReturnType>( result, STATUS_SUCCESS );
+        CallAsync( args, [promise]( call_result_t<ReturnType> result )
+        {
+            promise->set_value( std::move( result ) );
+        }, timeout );
+
+        return future;
+    }
+
+    std::future<call_result_t<ReturnType>> CallAsync( const Args&... args )
+    {
+        CallArguments a( args... );
+        return CallAsync( a );
+    }
+
+#ifdef BLACKBONE_COROUTINES
+    /// <summary>
+    /// Call function in worker thread, awaiting coroutine is resumed on scheduler thread.
+    /// Output buffers in arguments must stay valid until call is completed
+    /// </summary>
+    AsyncResult<call_result_t<ReturnType>> CallAsync( TaskScheduler& scheduler, const CallArguments& args, uint32_t timeout = 30 * 1000 )
+    {
+        return AsyncResult<call_result_t<ReturnType>>( scheduler, [this, args, timeout]( auto complete )
+        {
+            auto a = args;
+            CallAsync( a, std::move( complete ), timeout );
+        } );
+    }
+
+    AsyncResult<call_result_t<ReturnType>> CallAsync( TaskScheduler& scheduler, const Args&... args )
+    {
+        return CallAsync( scheduler, CallArguments( args... ) );
+    }
+#endif
+
+    /// <summary>
+    /// Call function in worker thread, completion is always reported through callback
+    /// </summary>
+    void CallAsync( CallArguments& args, std::function<void( call_result_t<ReturnType> )> complete, uint32_t timeout )
+    {
+        auto a = AsmFactory::GetAssembler( _process.core().isWow64() );
+
+        // Completion is awaited on worker thread event
+        CSLock lck( _process.remote().guard() );
+        NTSTATUS status = STATUS_SUCCESS;
+        if (!_process.remote().getWorker())
+            status = _process.remote().CreateRPCEnvironment( Worker_CreateNew, true );
+
+        if (!NT_SUCCESS( status ))
+            return complete( call_result_t<ReturnType>( ReturnType(), status ) );
+
+        constexpr eReturnType retType = ReturnKind();
+        _process.remote().PrepareCallAssembly( *a, _ptr, args.arguments, Conv, retType );
+
+        // Arguments are updated upon completion, output buffers must stay valid
+        auto& process = _process;
+        auto arguments = args.arguments;
+
+        status = _process.remote().ExecInWorkerThreadAsync( (*a)->make(), (*a)->getCodeSize(),
+            [&process, complete, arguments]( NTSTATUS status )
+            {
+                ReturnType result = {};
+                if (NT_SUCCESS( status ) && NT_SUCCESS( status = process.remote().GetCallResult( result ) ))
+                    status = process.remote().ReadOutputArgs( arguments );
+
+                complete( call_result_t<ReturnType>( result, status ) );
+            }, timeout );
+
+        if (!NT_SUCCESS( status ))
+            complete( call_result_t<ReturnType>( ReturnType(), status ) );
     }
 
     call_result_t<ReturnType> Call( const Args&... args )
@@ -135,6 +210,12 @@ public:
         CallArguments a( args ); 
         return Call( a, contextThread ); 
     } 
+
+    call_result_t<ReturnType> Call( const std::initializer_list<AsmVariant>& args, RemoteWorkerPool& pool )
+    {
+        CallArguments a( args );
+        return Call( a, pool );
+    }
         
     call_result_t<ReturnType> operator()( const Args&... args ) 
     { 
@@ -157,10 +238,46 @@ public:
         return CallArguments( args, std::index_sequence_for<Args...>() ); 
     }      
 
+    size_t Enqueue( RemoteBatch& batch, CallArguments& args )
+    {
+        return batch.Add( _ptr, args.arguments, Conv, ReturnKind() );
+    }
+
+    size_t Enqueue( RemoteBatch& batch, const Args&... args )
+    {
+        CallArguments a( args... );
+        return Enqueue( batch, a );
+    }
+
+    size_t Enqueue( RemoteBatch& batch, const std::initializer_list<AsmVariant>& args )
+    {
+        CallArguments a( args );
+        return Enqueue( batch, a );
+    }
+
     bool valid() const { return _ptr != 0; }
     explicit operator bool() const { return valid(); }
 
 private:
+    static constexpr eReturnType ReturnKind()
+    {
+        // FPU check
+        constexpr bool isFloat = std::is_same_v<ReturnType, float>;
+        constexpr bool isDouble = std::is_same_v<ReturnType, double> || std::is_same_v<ReturnType, long double>;
+
+        // Deduce return type
+        if constexpr (isFloat)
+            return rt_float;
+        else if constexpr (isDouble)
+            return rt_double;
+        else if constexpr (sizeof( ReturnType ) == sizeof( uint64_t ))
+            return rt_int64;
+        else if constexpr (!std::is_reference_v<ReturnType> && sizeof( ReturnType ) > sizeof( uint64_t ))
+            return rt_struct;
+        else
+            return rt_int32;
+    }
+
     Process& _process;
     ptr_t _ptr = 0;
 };
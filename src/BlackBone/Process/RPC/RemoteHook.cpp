@@ -87,19 +87,10 @@ void RemoteHook::EndDebug()
 /// <returns>Status code</returns>
 NTSTATUS RemoteHook::ApplyP( eHookType type, uint64_t ptr, fnCallback newFn, const void* pClass /*= nullptr*/, ThreadPtr pThread /*= nullptr*/ )
 {
-    NTSTATUS status = EnsureDebug();
+    NTSTATUS status = EnsureDebugActive();
     if (!NT_SUCCESS( status ))
         return status;
 
-    // Wait for debug event thread
-    DWORD exitCode = 0;
-    GetExitCodeThread( _hEventThd, &exitCode );
-    while (!_active && exitCode == STILL_ACTIVE)
-    {
-        Sleep( 10 );
-        GetExitCodeThread( _hEventThd, &exitCode );
-    }
-
     HookData data = { { 0 } };
 
     // Store old byte
@@ -123,8 +114,9 @@ NTSTATUS RemoteHook::ApplyP( eHookType type, uint64_t ptr, fnCallback newFn, con
         // Set for all threads
         else
         {
-            for (auto& thread : _memory.process()->threads().getAll())
-                thread->AddHWBP( ptr, hwbp_execute, hwbp_1 );
+            data.hwbp_idx = _memory.process()->breakpoints().Add( ptr, hwbp_execute, hwbp_1 ).result( -1 );
+            if (data.hwbp_idx == -1)
+                return STATUS_NO_MORE_ENTRIES;
         }
     }
     // Write int3
@@ -140,11 +132,125 @@ NTSTATUS RemoteHook::ApplyP( eHookType type, uint64_t ptr, fnCallback newFn, con
     }
 
     // Store hooked address
-    _hooks.emplace( ptr, data );
+    if (!_hooks.contains( ptr ))
+        _hooks.insert( ptr, data );
 
     return STATUS_SUCCESS;
 }
 
+/// <summary>
+/// Install several hooks at once.
+/// int3 hooks are written with one protection change per page,
+/// global HWBP hooks are set in all threads within single suspension
+/// </summary>
+/// <param name="hooks">Hooks to install</param>
+/// <returns>Status code, last failure if some hooks weren't installed</returns>
+NTSTATUS RemoteHook::ApplyMany( const std::vector<HookSpec>& hooks )
+{
+    NTSTATUS status = EnsureDebugActive();
+    if (!NT_SUCCESS( status ))
+        return status;
+
+    CSLock lck( _lock );
+
+    auto makeHook = []( const HookSpec& spec )
+    {
+        HookData data = { { 0 } };
+        data.type = spec.type;
+        data.onExecute.freeFn = spec.callback;
+        data.onExecute.classFn.classPtr = spec.classPtr;
+        data.threadID = (spec.thread != nullptr) ? spec.thread->id() : 0;
+        return data;
+    };
+
+    // int3 hooks grouped by page, global HWBP hooks collected for single pass
+    std::map<ptr_t, std::vector<const HookSpec*>> pages;
+    std::vector<const HookSpec*> global;
+    std::vector<ptr_t> globalAddresses;
+
+    for (auto& spec : hooks)
+    {
+        if (_hooks.contains( spec.address ))
+            continue;
+
+        if (spec.type == int3)
+        {
+            pages[spec.address & ~static_cast<ptr_t>(0xFFF)].emplace_back( &spec );
+        }
+        else if (spec.thread == nullptr)
+        {
+            global.emplace_back( &spec );
+            globalAddresses.emplace_back( spec.address );
+        }
+        else
+        {
+            // Thread debug registers are written without suspension anyway
+            auto data = makeHook( spec );
+            data.hwbp_idx = spec.thread->AddHWBP( spec.address, hwbp_execute, hwbp_1 ).result( -1 );
+            if (data.hwbp_idx == -1)
+                status = STATUS_NO_MORE_ENTRIES;
+            else
+                _hooks.insert( spec.address, data );
+        }
+    }
+
+    if (!global.empty())
+    {
+        std::vector<int> indices;
+        NTSTATUS hwbpStatus = _memory.process()->breakpoints().Add( globalAddresses, hwbp_execute, hwbp_1, indices );
+        if (!NT_SUCCESS( hwbpStatus ))
+            status = hwbpStatus;
+
+        for (size_t i = 0; i < global.size(); i++)
+        {
+            if (indices[i] == -1)
+                continue;
+
+            auto data = makeHook( *global[i] );
+            data.hwbp_idx = indices[i];
+            _hooks.insert( global[i]->address, data );
+        }
+    }
+
+    uint8_t page[0x1000] = { 0 };
+    for (auto& item : pages)
+    {
+        ptr_t base = item.first;
+        NTSTATUS pageStatus = _memory.Read( base, sizeof( page ), page );
+        if (!NT_SUCCESS( pageStatus ))
+        {
+            status = pageStatus;
+            continue;
+        }
+
+        DWORD flOld = 0;
+        if (!NT_SUCCESS( pageStatus = _memory.Protect( base, sizeof( page ), PAGE_EXECUTE_READWRITE, &flOld ) ))
+        {
+            status = pageStatus;
+            continue;
+        }
+
+        for (auto spec : item.second)
+        {
+            // Same address may be listed twice
+            if (_hooks.contains( spec->address ))
+                continue;
+
+            auto data = makeHook( *spec );
+            data.oldByte = page[spec->address - base];
+
+            if (NT_SUCCESS( pageStatus = _memory.Write<uint8_t>( spec->address, 0xCC ) ))
+                _hooks.insert( spec->address, data );
+            else
+                status = pageStatus;
+        }
+
+        _memory.Protect( base, sizeof( page ), flOld, nullptr );
+    }
+
+    return status;
+}
+
 /// <summary>
 /// Hook function return
 /// This hook will only work if function is hooked normally
@@ -156,14 +262,12 @@ NTSTATUS RemoteHook::ApplyP( eHookType type, uint64_t ptr, fnCallback newFn, con
 NTSTATUS RemoteHook::AddReturnHookP( uint64_t ptr, fnCallback newFn, const void* pClass /*= nullptr */ )
 {
     CSLock lck( _lock );
-    if(_hooks.count(ptr))
+    if (auto hook = _hooks.find( ptr ))
     {
-        auto& hook = _hooks[ptr];
-
         // Add return callback
-        hook.onReturn.freeFn = newFn;
-        hook.onReturn.classFn.classPtr = pClass;
-        hook.flags |= returnHook;
+        hook->onReturn.freeFn = newFn;
+        hook->onReturn.classFn.classPtr = pClass;
+        hook->flags |= returnHook;
 
         return STATUS_SUCCESS;
     }
@@ -171,6 +275,188 @@ NTSTATUS RemoteHook::AddReturnHookP( uint64_t ptr, fnCallback newFn, const void*
     return STATUS_NOT_FOUND;
 }
 
+/// <summary>
+/// Hook function entry, raising debug event only when all conditions are met.
+/// Conditions are checked by RemoteLocalHook detour, matching calls hit int 3 inside detour code
+/// with registers and stack of function entry, so no byte has to be restored and stepped over
+/// </summary>
+/// <param name="ptr">Function address</param>
+/// <param name="conditions">Conditions, all must be met</param>
+/// <param name="newFn">Callback</param>
+/// <param name="pClass">Class reference.</param>
+/// <returns>Status code</returns>
+NTSTATUS RemoteHook::ApplyFilteredP( uint64_t ptr, const std::vector<Condition>& conditions, fnCallback newFn, const void* pClass /*= nullptr*/ )
+{
+    for (auto& cond : conditions)
+        if (cond.source == Condition::Arg && cond.index >= LocalHookRecord::MaxArgs)
+            return STATUS_INVALID_PARAMETER;
+
+    NTSTATUS status = EnsureDebugActive();
+    if (!NT_SUCCESS( status ))
+        return status;
+
+    CSLock lck( _lock );
+    if (_hooks.contains( ptr ))
+        return STATUS_ALREADY_REGISTERED;
+
+    auto a = AsmFactory::GetAssembler( _memory.core().isWow64() );
+    auto trap = GenFilter( *a, conditions );
+
+    auto& localHooks = _memory.process()->localHooks();
+    auto id = localHooks.SetHook( ptr, *a->assembler() );
+    if (!id)
+        return id.status;
+
+    HookData data = { { 0 } };
+    data.type = int3;
+    data.onExecute.freeFn = newFn;
+    data.onExecute.classFn.classPtr = pClass;
+    data.detourId = id.result();
+
+    auto trapPtr = localHooks.hookCode( data.detourId ).result() + (*a)->getLabelOffset( trap );
+    _filterTraps.emplace( trapPtr, ptr );
+    _hooks.insert( ptr, data );
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Generate condition check. Registers, flags and stack are preserved, int 3 is hit when all conditions are met
+/// </summary>
+/// <param name="a">Target assembler</param>
+/// <param name="conditions">Conditions</param>
+/// <returns>int 3 label</returns>
+asmjit::Label RemoteHook::GenFilter( IAsmHelper& a, const std::vector<Condition>& conditions )
+{
+    using namespace asmjit::host;
+
+    auto trap = a->newLabel();
+    auto skip = a->newLabel();
+    auto done = a->newLabel();
+
+    // Leave when condition isn't met
+    auto jumpUnless = [&]( Condition::eCompare op )
+    {
+        switch (op)
+        {
+            case Condition::Equal:          a->jne( skip ); break;
+            case Condition::NotEqual:       a->je( skip );  break;
+            case Condition::Below:          a->jae( skip ); break;
+            case Condition::AboveOrEqual:   a->jb( skip );  break;
+            case Condition::AnyBits:        a->jz( skip );  break;
+        }
+    };
+
+    if (!_memory.core().isWow64())
+    {
+        // [rsp] flags, [rsp + 0x8] r11, [rsp + 0x10] rax, [rsp + 0x18] return address
+        const int32_t retOffset = 0x18;
+
+        a->push( rax );
+        a->push( r11 );
+        a->pushf();
+
+        for (auto& cond : conditions)
+        {
+            switch (cond.source)
+            {
+                case Condition::ThreadId:
+                    a->mov( eax, dword_ptr_abs( 0x48 ).setSegment( gs ) );     // TEB ClientId.UniqueThread
+                    break;
+
+                case Condition::ReturnAddress:
+                    a->mov( rax, qword_ptr( rsp, retOffset ) );
+                    break;
+
+                case Condition::Arg:
+                    switch (cond.index)
+                    {
+                        case 0: a->mov( rax, rcx ); break;
+                        case 1: a->mov( rax, rdx ); break;
+                        case 2: a->mov( rax, r8 );  break;
+                        case 3: a->mov( rax, r9 );  break;
+
+                        // Stack arguments follow return address and home area
+                        default:
+                            a->mov( rax, qword_ptr( rsp, static_cast<int32_t>(retOffset + 8 + cond.index * sizeof( uint64_t )) ) );
+                            break;
+                    }
+                    break;
+            }
+
+            a->mov( r11, cond.value );
+            if (cond.op == Condition::AnyBits)
+                a->test( rax, r11 );
+            else
+                a->cmp( rax, r11 );
+
+            jumpUnless( cond.op );
+        }
+
+        a->popf();
+        a->pop( r11 );
+        a->pop( rax );
+        a->bind( trap );
+        a->int_( 3 );
+        a->jmp( done );
+
+        a->bind( skip );
+        a->popf();
+        a->pop( r11 );
+        a->pop( rax );
+    }
+    else
+    {
+        // [esp] flags, [esp + 0x4] ecx, [esp + 0x8] eax, [esp + 0xC] return address
+        const int32_t retOffset = 0xC;
+
+        a->push( eax );
+        a->push( ecx );
+        a->pushf();
+
+        for (auto& cond : conditions)
+        {
+            switch (cond.source)
+            {
+                case Condition::ThreadId:
+                    a->mov( eax, dword_ptr_abs( 0x24 ).setSegment( fs ) );     // TEB ClientId.UniqueThread
+                    break;
+
+                case Condition::ReturnAddress:
+                    a->mov( eax, dword_ptr( esp, retOffset ) );
+                    break;
+
+                case Condition::Arg:
+                    a->mov( eax, dword_ptr( esp, static_cast<int32_t>(retOffset + (cond.index + 1) * sizeof( uint32_t )) ) );
+                    break;
+            }
+
+            a->mov( ecx, static_cast<uint32_t>(cond.value) );
+            if (cond.op == Condition::AnyBits)
+                a->test( eax, ecx );
+            else
+                a->cmp( eax, ecx );
+
+            jumpUnless( cond.op );
+        }
+
+        a->popf();
+        a->pop( ecx );
+        a->pop( eax );
+        a->bind( trap );
+        a->int_( 3 );
+        a->jmp( done );
+
+        a->bind( skip );
+        a->popf();
+        a->pop( ecx );
+        a->pop( eax );
+    }
+
+    a->bind( done );
+    return trap;
+}
+
 /// <summary>
 /// Remove existing hook
 /// </summary>
@@ -179,11 +465,9 @@ void RemoteHook::Remove( uint64_t ptr )
 {
     // Restore hooked function
     CSLock lck( _lock );
-    if (_hooks.count( ptr ))
+    if (auto hook = _hooks.find( ptr ))
     {
-        auto& hook = _hooks[ptr];
-
-        Restore( hook, ptr );
+        Restore( *hook, ptr );
         _hooks.erase( ptr );
     }    
 }
@@ -195,18 +479,23 @@ void RemoteHook::Remove( uint64_t ptr )
 /// <param name="ptr">Hooked address</param>
 void RemoteHook::Restore( const HookData &hook, uint64_t ptr )
 {
+    // Remove condition check detour
+    if (hook.detourId != 0)
+    {
+        _memory.process()->localHooks().Remove( hook.detourId );
+        for (auto iter = _filterTraps.begin(); iter != _filterTraps.end();)
+            iter = (iter->second == ptr) ? _filterTraps.erase( iter ) : std::next( iter );
+    }
     // Remove HWBP
-    if (hook.type == hwbp)
+    else if (hook.type == hwbp)
     {       
         if (hook.threadID != 0)
         {
-            Thread( hook.threadID, &_core ).RemoveHWBP( hook.hwbp_idx );
+            _memory.process()->threads().open( hook.threadID )->RemoveHWBP( hook.hwbp_idx );
         }   
         else
         {
-            auto threads = _memory.process()->threads().getAll();
-            for (auto& thread : threads)
-                thread->RemoveHWBP( ptr );
+            _memory.process()->breakpoints().Remove( ptr );
         }
     }
     // Restore original byte
@@ -268,6 +557,7 @@ DWORD RemoteHook::EventThread()
         if (!WaitForDebugEvent( &DebugEv, 100 ))
             continue;
 
+        _debugEvents++;
         _lock.lock();
         switch (DebugEv.dwDebugEventCode)
         {
@@ -277,12 +567,17 @@ DWORD RemoteHook::EventThread()
 
                 // Add HWBP to created thread
             case CREATE_THREAD_DEBUG_EVENT:
-                for(auto& hook : _hooks)
-                    if (hook.second.type == hwbp && hook.second.threadID == 0)
-                    {
-                        Thread th( DebugEv.u.CreateThread.hThread, &_core );
-                        th.AddHWBP( hook.first, hwbp_execute, hwbp_1 );
-                    }
+                if (_memory.process()->breakpoints().count() != 0)
+                {
+                    Thread th( DebugEv.u.CreateThread.hThread, &_core );
+                    _memory.process()->breakpoints().ArmThread( th );
+                }
+                break;
+
+                // Code regions changed
+            case LOAD_DLL_DEBUG_EVENT:
+            case UNLOAD_DLL_DEBUG_EVENT:
+                _execRanges.clear();
                 break;
 
             default:
@@ -339,47 +634,60 @@ DWORD RemoteHook::OnBreakpoint( const DEBUG_EVENT& DebugEv )
     // Prevent highest bit extension.
     ptr_t addr = (uintptr_t)DebugEv.u.Exception.ExceptionRecord.ExceptionAddress;
     ptr_t ip = 0, sp = 0;
-    Thread thd( DebugEv.dwThreadId, &_core );
+    auto pThread = _memory.process()->threads().open( DebugEv.dwThreadId );
+    Thread& thd = *pThread;
 
-    if (_hooks.count( addr ))
+    // Filtered hook conditions are met
+    auto trap = _filterTraps.find( addr );
+    if (trap != _filterTraps.end())
     {
+        auto pHook = _hooks.find( trap->second );
+        if (!pHook)
+            return (DWORD)DBG_EXCEPTION_NOT_HANDLED;
+
         _CONTEXT64 ctx64;
         _CONTEXT32 ctx32;
         thd.GetContext( ctx64, CONTEXT64_FULL, true );
 
+        // Registers and stack are the same as on function entry
         if (_memory.core().isWow64())
         {
             thd.GetContext( ctx32, WOW64_CONTEXT_FULL, true );
-            ip = ctx32.Eip;
             sp = ctx32.Esp;
         }
         else
         {
-            ip = ctx64.Rip;
             sp = ctx64.Rsp;
         }
-        
-        // Get stack frame pointer
-        std::vector<std::pair<ptr_t, ptr_t>> results;
-        StackBacktrace( ip, sp, thd, results, 1 );
 
-        RemoteContext context( _memory, thd, ctx64, !results.empty() ? results.back().first : 0, _x64Target, _wordSize );
+        // Execution continues after int 3, detour code jumps to relocated prologue
+        Dispatch( trap->second, *pHook, pThread, ctx64, trap->second, sp );
+        thd.SetContext( ctx64, true );
 
-        // Execute user callback
-        auto& hook = _hooks[addr];
+        return DBG_CONTINUE;
+    }
 
-        if (hook.onExecute.classFn.classPtr && hook.onExecute.classFn.ptr != nullptr)
-            hook.onExecute.classFn.ptr( hook.onExecute.classFn.classPtr, context );
-        else if (hook.onExecute.freeFn != nullptr)
-            hook.onExecute.freeFn( context );
+    if (auto pHook = _hooks.find( addr ))
+    {
+        _CONTEXT64 ctx64;
+        _CONTEXT32 ctx32;
+        thd.GetContext( ctx64, CONTEXT64_FULL, true );
 
-        // Raise exceptions upon return
-        if (hook.flags & returnHook)
+        if (_memory.core().isWow64())
+        {
+            thd.GetContext( ctx32, WOW64_CONTEXT_FULL, true );
+            ip = ctx32.Eip;
+            sp = ctx32.Esp;
+        }
+        else
         {
-            hook.entryCtx = ctx64;
-            auto newReturn = context.hookReturn();
-            _retHooks.emplace( newReturn, addr );
+            ip = ctx64.Rip;
+            sp = ctx64.Rsp;
         }
+        
+        // Execute user callback
+        auto& hook = *pHook;
+        Dispatch( addr, hook, pThread, ctx64, ip, sp );
 
         // Resume execution
         DWORD flOld = 0;
@@ -387,7 +695,7 @@ DWORD RemoteHook::OnBreakpoint( const DEBUG_EVENT& DebugEv )
         _memory.Write( addr, hook.oldByte );
         _memory.Protect( addr, sizeof( hook.oldByte ), flOld, nullptr );
 
-        _repatch[addr] = true;
+        _threadState[thd.id()].repatch.emplace_back( addr );
         
         // Single-step failed instruction
         ctx64.Rip -= sizeof( uint8_t );
@@ -414,7 +722,8 @@ DWORD RemoteHook::OnSinglestep( const DEBUG_EVENT& DebugEv )
     _CONTEXT32 ctx32 = { 0 };
     _CONTEXT64 ctx64 = { 0 };
 
-    Thread thd( DebugEv.dwThreadId, &_core );
+    auto pThread = _memory.process()->threads().open( DebugEv.dwThreadId );
+    Thread& thd = *pThread;
 
     thd.GetContext( ctx64, CONTEXT64_ALL, true );
     ip = ctx64.Rip;
@@ -444,32 +753,14 @@ DWORD RemoteHook::OnSinglestep( const DEBUG_EVENT& DebugEv )
 
     if (index < 4)
     {
-        // Get stack frame pointer
-        std::vector<std::pair<ptr_t, ptr_t>> results;
-        StackBacktrace( ip, sp, thd, results, 1 );
-
-        RemoteContext context( _memory, thd, ctx64, !results.empty() ? results.back().first : 0, _x64Target, _wordSize );
-
         // Execute user callback
-        if(_hooks.count( addr ))
+        if (auto hook = _hooks.find( addr ))
         {
-            auto& hook = _hooks[addr];
-            if (hook.onExecute.classFn.classPtr && hook.onExecute.classFn.ptr != nullptr)
-                hook.onExecute.classFn.ptr( hook.onExecute.classFn.classPtr, context );
-            else if (hook.onExecute.freeFn != nullptr)
-                hook.onExecute.freeFn( context );
-
-            // Raise exception upon return
-            if (hook.flags & returnHook)
-            {
-                hook.entryCtx = ctx64;
-                auto newReturn = context.hookReturn();
-                _retHooks.emplace( newReturn, addr );
-            }
+            Dispatch( addr, *hook, pThread, ctx64, ip, sp );
 
             ctx64.ContextFlags = use64 ? CONTEXT64_ALL : WOW64_CONTEXT_ALL;
             use64 ? ctx64.EFlags |= 0x100 : ctx32.EFlags |= 0x100;      // Single step
-            _repatch[addr] = true;
+            _threadState[thd.id()].repatch.emplace_back( addr );
         }
 
         auto andVal = ~(1ll << (2 * index));
@@ -493,29 +784,34 @@ DWORD RemoteHook::OnSinglestep( const DEBUG_EVENT& DebugEv )
         return DBG_CONTINUE;
     }
 
-    // Restore pending hooks
-    for(auto place : _repatch)
-    {
-        if (place.second == true && _hooks.count( place.first ))
-        {
-            auto& hook = _hooks[place.first];
+    // Restore hooks stepped over by this thread
+    auto state = _threadState.find( thd.id() );
+    if (state == _threadState.end())
+        return DBG_CONTINUE;
 
-            if (hook.type == hwbp)
-            {
-                thd.AddHWBP( place.first, hwbp_execute, hwbp_1 );
-            }
-            else if (hook.type == int3)
-            {
-                DWORD flOld = 0;
-                _memory.Protect( addr, sizeof( hook.oldByte ), PAGE_EXECUTE_READWRITE, &flOld );
-                _memory.Write( place.first, uint8_t( 0xCC ) );
-                _memory.Protect( addr, sizeof( hook.oldByte ), flOld, nullptr );
-            }
+    for (auto place : state->second.repatch)
+    {
+        auto hook = _hooks.find( place );
+        if (!hook)
+            continue;
 
-            place.second = false;
+        if (hook->type == hwbp)
+        {
+            thd.AddHWBP( place, hwbp_execute, hwbp_1 );
+        }
+        else if (hook->type == int3)
+        {
+            DWORD flOld = 0;
+            _memory.Protect( place, sizeof( hook->oldByte ), PAGE_EXECUTE_READWRITE, &flOld );
+            _memory.Write( place, uint8_t( 0xCC ) );
+            _memory.Protect( place, sizeof( hook->oldByte ), flOld, nullptr );
         }
     }
 
+    state->second.repatch.clear();
+    if (state->second.returns.empty())
+        _threadState.erase( state );
+
     return DBG_CONTINUE;
 }
 
@@ -533,7 +829,8 @@ DWORD RemoteHook::OnAccessViolation( const DEBUG_EVENT& DebugEv )
     _CONTEXT32 ctx32;
     _CONTEXT64 ctx64;
 
-    Thread thd( DebugEv.dwThreadId, &_core );
+    auto pThread = _memory.process()->threads().open( DebugEv.dwThreadId );
+    Thread& thd = *pThread;
 
     thd.GetContext( ctx64, CONTEXT64_ALL, true );
     ip = ctx64.Rip;
@@ -551,38 +848,40 @@ DWORD RemoteHook::OnAccessViolation( const DEBUG_EVENT& DebugEv )
     std::vector<std::pair<ptr_t, ptr_t>> results;
     StackBacktrace( ip, sp, thd, results, 1 );
 
-    RemoteContext context( _memory, thd, ctx64, !results.empty() ? results.back().first : 0, _x64Target, _wordSize );
-
     // Under AMD64 exception is thrown before 'ret' gets executed
     // Return must be detected manually
     if (_x64Target && results.size() > 0)
         addr = results.back().second;
             
-    // Test if this is a return hook
-    if (_retHooks.count( addr ))
+    // Test if this is a return hook. Innermost frame is the most likely one
+    auto state = _threadState.find( thd.id() );
+    if (state != _threadState.end())
     {
-        // Execute user callback
-        auto& hook = _hooks[_retHooks[addr]];
-
-        if (hook.flags & returnHook)
+        auto& returns = state->second.returns;
+        auto frame = std::find_if( returns.rbegin(), returns.rend(), [addr]( const ReturnFrame& item ) { return item.returnAddress == addr; } );
+        if (frame != returns.rend())
         {
-            RemoteContext fixedContext( _memory, thd, hook.entryCtx, !results.empty() ? results.back().first : 0, _x64Target, _wordSize );
-
-            if (hook.onReturn.classFn.classPtr && hook.onReturn.classFn.ptr != nullptr)
-                hook.onReturn.classFn.ptr( hook.onExecute.classFn.classPtr, fixedContext );
-            else if (hook.onReturn.freeFn != nullptr)
-                hook.onReturn.freeFn( fixedContext );
+            // Execute user callback
+            auto hook = _hooks.find( frame->hookAddress );
+            if (hook && (hook->flags & returnHook))
+            {
+                RemoteContext fixedContext( _memory, thd, frame->entryCtx, !results.empty() ? results.back().first : 0, _x64Target, _wordSize );
+                Invoke( hook->onReturn, fixedContext );
+            }
 
-            hook.entryCtx = { 0 };
+            // Frames above were unwound without returning
+            returns.erase( std::prev( frame.base() ), returns.end() );
+            if (returns.empty() && state->second.repatch.empty())
+                _threadState.erase( state );
         }
-
-        _retHooks.erase( addr );
     }
 
     // Under AMD64there is no need to update IP, because exception is thrown before actual return.
     // Return address still must be fixed though.
+    // Context is created after return callback, so its stack window includes changes made by callback
     if(_x64Target)
     {
+        RemoteContext context( _memory, thd, ctx64, !results.empty() ? results.back().first : 0, _x64Target, _wordSize );
         auto retAddr = context.returnAddress();
         if (retAddr & 0x8000000000000000)
         {
@@ -605,6 +904,200 @@ DWORD RemoteHook::OnAccessViolation( const DEBUG_EVENT& DebugEv )
     return (DWORD)DBG_EXCEPTION_NOT_HANDLED;
 }
 
+/// <summary>
+/// Attach debugger and wait until debug event thread is running
+/// </summary>
+/// <returns>Status code</returns>
+NTSTATUS RemoteHook::EnsureDebugActive()
+{
+    NTSTATUS status = EnsureDebug();
+    if (!NT_SUCCESS( status ))
+        return status;
+
+    // Wait for debug event thread
+    DWORD exitCode = 0;
+    GetExitCodeThread( _hEventThd, &exitCode );
+    while (!_active && exitCode == STILL_ACTIVE)
+    {
+        Sleep( 10 );
+        GetExitCodeThread( _hEventThd, &exitCode );
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Invoke hook callback
+/// </summary>
+/// <param name="callback">Callback</param>
+/// <param name="context">Hook context</param>
+void RemoteHook::Invoke( const HookData::callback& callback, RemoteContext& context )
+{
+    LatencyTimer timer( _memory.process()->latency().recording( LatencyOp::HookDispatch ) );
+
+    if (callback.classFn.classPtr && callback.classFn.ptr != nullptr)
+        callback.classFn.ptr( callback.classFn.classPtr, context );
+    else if (callback.freeFn != nullptr)
+        callback.freeFn( context );
+}
+
+/// <summary>
+/// Queue callback to worker pool, or run it in place if async dispatch isn't enabled
+/// </summary>
+/// <param name="addr">Hooked address</param>
+/// <param name="hook">Hit hook</param>
+/// <param name="thd">Thread that hit the hook</param>
+/// <param name="ctx">Thread context</param>
+/// <param name="ip">Instruction pointer</param>
+/// <param name="sp">Stack pointer</param>
+/// <returns>true if callback was queued</returns>
+bool RemoteHook::Dispatch( ptr_t addr, HookData& hook, const ThreadPtr& thd, _CONTEXT64& ctx, ptr_t ip, ptr_t sp )
+{
+    // Return hook must be set while thread is stopped
+    if (_dispatchPort && !(hook.flags & returnHook))
+    {
+        auto item = new DispatchItem();
+        item->callback = hook.onExecute;
+        item->thread = thd;
+        item->ctx = ctx;
+        item->ip = ip;
+        item->sp = sp;
+
+        if (PostQueuedCompletionStatus( _dispatchPort, 0, 0, reinterpret_cast<LPOVERLAPPED>(item) ))
+            return true;
+
+        delete item;
+    }
+
+    // Get stack frame pointer
+    std::vector<std::pair<ptr_t, ptr_t>> results;
+    StackBacktrace( ip, sp, *thd, results, 1 );
+
+    RemoteContext context( _memory, *thd, ctx, !results.empty() ? results.back().first : 0, _x64Target, _wordSize );
+    Invoke( hook.onExecute, context );
+
+    // Raise exceptions upon return
+    if (hook.flags & returnHook)
+    {
+        auto newReturn = context.hookReturn();
+        _threadState[thd->id()].returns.emplace_back( ReturnFrame{ newReturn, addr, ctx } );
+    }
+
+    return false;
+}
+
+/// <summary>
+/// Run hook callbacks on worker threads.
+/// Debug event thread only captures thread context, restores hooked code and continues,
+/// so busy hooks don't stall the target. Callbacks receive context snapshot:
+/// context changes have no effect and stack may change before callback runs.
+/// Return hooks are always dispatched synchronously
+/// </summary>
+/// <param name="workers">Number of worker threads</param>
+/// <returns>Status code</returns>
+NTSTATUS RemoteHook::EnableAsyncDispatch( uint32_t workers /*= 2*/ )
+{
+    CSLock lck( _lock );
+    if (_dispatchPort)
+        return STATUS_SUCCESS;
+
+    if (workers == 0)
+        return STATUS_INVALID_PARAMETER;
+
+    _dispatchPort = CreateIoCompletionPort( INVALID_HANDLE_VALUE, NULL, 0, workers );
+    if (!_dispatchPort)
+        return LastNtStatus();
+
+    for (uint32_t i = 0; i < workers; i++)
+    {
+        Handle hThread( CreateThread( NULL, 0, &RemoteHook::DispatchThreadWrap, this, 0, NULL ) );
+        if (hThread)
+            _dispatchThreads.emplace_back( std::move( hThread ) );
+    }
+
+    if (_dispatchThreads.empty())
+    {
+        _dispatchPort.reset();
+        return STATUS_TOO_MANY_THREADS;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Complete queued callbacks and return to synchronous dispatch
+/// </summary>
+void RemoteHook::DisableAsyncDispatch()
+{
+    Handle port;
+    std::vector<Handle> threads;
+
+    // New events are dispatched synchronously from now on
+    {
+        CSLock lck( _lock );
+        port = std::move( _dispatchPort );
+        threads = std::move( _dispatchThreads );
+        _dispatchThreads.clear();
+    }
+
+    if (!port)
+        return;
+
+    // Queued items are processed before stop requests
+    for (size_t i = 0; i < threads.size(); i++)
+        PostQueuedCompletionStatus( port, 0, 1, nullptr );
+
+    for (auto& thread : threads)
+        WaitForSingleObject( thread, INFINITE );
+}
+
+/// <summary>
+/// Wrapper for callback worker thread
+/// </summary>
+/// <param name="lpParam">RemoteHook pointer</param>
+/// <returns>Error code</returns>
+DWORD RemoteHook::DispatchThreadWrap( LPVOID lpParam )
+{
+    if (lpParam)
+        return reinterpret_cast<RemoteHook*>(lpParam)->DispatchThread();
+
+    return ERROR_INVALID_PARAMETER;
+}
+
+/// <summary>
+/// Callback worker thread
+/// </summary>
+/// <returns>Error code</returns>
+DWORD RemoteHook::DispatchThread()
+{
+    // Port is owned by this object until all workers exit
+    HANDLE port = _dispatchPort;
+
+    for (;;)
+    {
+        DWORD bytes = 0;
+        ULONG_PTR key = 0;
+        LPOVERLAPPED pOverlapped = nullptr;
+
+        if (!GetQueuedCompletionStatus( port, &bytes, &key, &pOverlapped, INFINITE ) && pOverlapped == nullptr)
+            break;
+
+        // Stop request
+        if (key == 1)
+            break;
+
+        std::unique_ptr<DispatchItem> item( reinterpret_cast<DispatchItem*>(pOverlapped) );
+
+        std::vector<std::pair<ptr_t, ptr_t>> results;
+        StackBacktrace( item->ip, item->sp, *item->thread, results, 1 );
+
+        RemoteContext context( _memory, *item->thread, item->ctx, !results.empty() ? results.back().first : 0, _x64Target, _wordSize );
+        Invoke( item->callback, context );
+    }
+
+    return ERROR_SUCCESS;
+}
+
 /// <summary>
 /// Walk stack frames
 /// </summary>
@@ -616,67 +1109,64 @@ DWORD RemoteHook::OnAccessViolation( const DEBUG_EVENT& DebugEv )
 /// <returns>Frame count</returns>
 DWORD RemoteHook::StackBacktrace( ptr_t ip, ptr_t sp, Thread& thd, std::vector<std::pair<ptr_t, ptr_t>>& results, int depth /*= 100 */ )
 {
-    int i = 0;
     uint64_t stack_base = 0;
 
     // Get stack base
     if(_core.isWow64())
     {
-        _TEB32 teb32 = { { 0 } };
-        if (thd.teb( &teb32 ) == 0)
+        auto teb32 = _memory.ReadFields<_TEB32, &_TEB32::NtTib>( thd.teb( static_cast<_TEB32*>(nullptr) ) );
+        if (!teb32)
             return 0;
 
-        stack_base = teb32.NtTib.StackBase;
+        stack_base = teb32->NtTib.StackBase;
     }
     else
     {
-        _TEB64 teb64 = { { 0 } };
-        if (thd.teb( &teb64 ) == 0)
+        auto teb64 = _memory.ReadFields<_TEB64, &_TEB64::NtTib>( thd.teb( static_cast<_TEB64*>(nullptr) ) );
+        if (!teb64)
             return 0;
 
-        stack_base = teb64.NtTib.StackBase;
+        stack_base = teb64->NtTib.StackBase;
     }
 
-    // Store exception address
-    results.emplace_back( 0, ip );
+    auto read = [this]( ptr_t address, void* buffer, size_t size )
+    {
+        return NT_SUCCESS( _memory.Read( address, size, buffer ) );
+    };
 
-    // Walk stack
-    for (ptr_t stackPtr = sp; stackPtr < stack_base && i < depth; stackPtr += _wordSize)
+    // Image allocations are always executable, so whole allocation protection is checked
+    auto query = [this]( ptr_t address, ptr_t& base, ptr_t& size, bool& executable )
     {
-        ptr_t stack_val = 0;
-        _memory.Read( stackPtr, _wordSize, &stack_val );
         MEMORY_BASIC_INFORMATION64 meminfo = { 0 };
+        if (_core.native()->VirtualQueryExT( address, &meminfo ) != STATUS_SUCCESS)
+            return false;
 
-        ptr_t original = stack_val & 0x7FFFFFFFFFFFFFFF;
+        base = meminfo.BaseAddress;
+        size = meminfo.RegionSize;
+        executable = (meminfo.AllocationProtect == PAGE_EXECUTE_READ ||
+                      meminfo.AllocationProtect == PAGE_EXECUTE_WRITECOPY ||
+                      meminfo.AllocationProtect == PAGE_EXECUTE_READWRITE);
 
-        // Invalid value
-        if (stack_val < _core.native()->minAddr() || original > _core.native()->maxAddr())
-            continue;
+        return true;
+    };
 
-        // Check if memory is executable
-        if (_core.native()->VirtualQueryExT( original, &meminfo ) != STATUS_SUCCESS)
-            continue;
-
-        if ( meminfo.AllocationProtect != PAGE_EXECUTE_READ &&
-             meminfo.AllocationProtect != PAGE_EXECUTE_WRITECOPY &&
-             meminfo.AllocationProtect != PAGE_EXECUTE_READWRITE)
-        {
-            continue;
-        }
-
-        uint8_t codeChunk[6] = {0};
-        _memory.Read( original - 6, sizeof(codeChunk), codeChunk );
+    auto isCall = [this]( ptr_t original )
+    {
+        uint8_t codeChunk[6] = { 0 };
+        _memory.Read( original - 6, sizeof( codeChunk ), codeChunk );
 
         // Detect 'call' instruction
         // TODO: Implement more reliable way to detect 'call'
-        if (codeChunk[0] == 0xFF || codeChunk[1] == 0xE8 || codeChunk[4] == 0xFF)
-        {
-            results.emplace_back( stackPtr, stack_val );
-            i++;
-        }
-    }
+        return (codeChunk[0] == 0xFF || codeChunk[1] == 0xE8 || codeChunk[4] == 0xFF);
+    };
 
-    return i;
+    StackWalker walker(
+        _execRanges, _wordSize, 0x8000000000000000ull,
+        _core.native()->minAddr(), _core.native()->maxAddr(),
+        read, query, isCall
+        );
+
+    return static_cast<DWORD>(walker.Scan( ip, sp, stack_base, results, depth ));
 }
 
 /// <summary>
@@ -684,14 +1174,17 @@ DWORD RemoteHook::StackBacktrace( ptr_t ip, ptr_t sp, Thread& thd, std::vector<s
 /// </summary>
 void RemoteHook::reset()
 {
+    DisableAsyncDispatch();
+
     if (!_hooks.empty())
     {
         _lock.lock();
-        for (auto& hook : _hooks)
-            Restore( hook.second, hook.first );
+        _hooks.for_each( [this]( ptr_t ptr, HookData& hook ) { Restore( hook, ptr ); } );
 
         _hooks.clear();
-        _repatch.clear();
+        _filterTraps.clear();
+        _threadState.clear();
+        _execRanges.clear();
 
         _lock.unlock();
 
@@ -2,14 +2,20 @@
 
 #include "../../Config.h"
 #include "RemoteContext.hpp"
+#include "../../Asm/AsmFactory.h"
 
 #include "../../Include/Winheaders.h"
 #include "../../Include/Macro.h"
 #include "../../Misc/Utils.h"
+#include "../../Include/HandleGuard.h"
+#include "../../Misc/AddressMap.hpp"
+#include "../../Misc/StackWalker.h"
 #include "../Threads/Threads.h"
 
 #include <map>
 #include <set>
+#include <unordered_map>
+#include <atomic>
 #include <stdint.h>
 
 namespace blackbone
@@ -36,6 +42,50 @@ public:
     using fnCallback = void( *)(RemoteContext& context);
     using fnClassCallback = void( __thiscall* )(const void* __this, RemoteContext& context);
 
+    /// <summary>
+    /// Hook request for batch installation
+    /// </summary>
+    struct HookSpec
+    {
+        eHookType type = int3;              // int 3 or HWBP
+        ptr_t address = 0;                  // Hooked address
+        fnCallback callback = nullptr;      // Callback, member function pointer casted with brutal_cast
+        const void* classPtr = nullptr;     // Class instance for member callback
+        ThreadPtr thread = nullptr;         // Thread to hook. Valid only for HWBP
+    };
+
+    /// <summary>
+    /// Filtered hook condition, evaluated inside the target on function entry.
+    /// Values are compared as unsigned, 32 bit for x86 target
+    /// </summary>
+    struct Condition
+    {
+        enum eSource
+        {
+            Arg,                // Function argument, stdcall for x86 target
+            ThreadId,           // Calling thread ID
+            ReturnAddress,      // Caller return address
+        };
+
+        enum eCompare
+        {
+            Equal,
+            NotEqual,
+            Below,
+            AboveOrEqual,
+            AnyBits,            // value & mask != 0
+        };
+
+        eSource  source = Arg;
+        uint32_t index = 0;     // Argument index
+        eCompare op = Equal;
+        uint64_t value = 0;     // Compared value or bit mask
+
+        static Condition arg( uint32_t index, eCompare op, uint64_t value ) { return { Arg, index, op, value }; }
+        static Condition thread( DWORD tid ) { return { ThreadId, 0, Equal, tid }; }
+        static Condition returnAddress( eCompare op, uint64_t value ) { return { ReturnAddress, 0, op, value }; }
+    };
+
     /// <summary>
     /// Hook descriptor
     /// </summary>
@@ -61,12 +111,30 @@ public:
         uint8_t    oldByte;             // Original byte in case of int 3 hook
         DWORD      threadID;            // Thread id for HWBP (0 means global hook for all threads)
         int        hwbp_idx;            // Index of HWBP if applied to one thread only
-        _CONTEXT64 entryCtx;            // Thread context on function entry (used in function return hook)
+        uint32_t   detourId;            // RemoteLocalHook detour of filtered hook, 0 if none
+    };
+
+    /// <summary>
+    /// Pending function return
+    /// </summary>
+    struct ReturnFrame
+    {
+        ptr_t      returnAddress;       // Faulting return address
+        ptr_t      hookAddress;         // Hooked function
+        _CONTEXT64 entryCtx;            // Thread context on function entry
+    };
+
+    /// <summary>
+    /// Hook state of a single thread
+    /// </summary>
+    struct ThreadHookState
+    {
+        std::vector<ptr_t> repatch;         // Hooks to restore after single step
+        std::vector<ReturnFrame> returns;   // Hooked returns, innermost last
     };
 
-    using mapHook = std::map<ptr_t, HookData>;
-    using mapAddress = std::map<ptr_t, ptr_t>;
-    using setAddresses = std::map<ptr_t, bool>;
+    using mapHook = AddressMap<HookData>;
+    using mapThreadState = std::unordered_map<DWORD, ThreadHookState>;
 
 public:
     BLACKBONE_API RemoteHook( class ProcessMemory& memory );
@@ -97,6 +165,19 @@ public:
         return AddReturnHookP( ptr, newFn, nullptr );
     }
 
+    /// <summary>
+    /// Hook function entry, raising debug event only when all conditions are met.
+    /// Conditions are checked by code detoured into the target, other calls don't stop the thread
+    /// </summary>
+    /// <param name="ptr">Function address</param>
+    /// <param name="conditions">Conditions, all must be met</param>
+    /// <param name="newFn">Callback</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API inline NTSTATUS ApplyFiltered( uint64_t ptr, const std::vector<Condition>& conditions, fnCallback newFn )
+    {
+        return ApplyFilteredP( ptr, conditions, newFn, nullptr );
+    }
+
     // FIXME: Alternative for MinGW
 #ifdef COMPILER_MSVC
     /// <summary>
@@ -128,20 +209,114 @@ public:
     {
         return AddReturnHookP( ptr, brutal_cast<fnCallback>(newFn), &classRef );
     }
+
+    /// <summary>
+    /// Hook function entry, raising debug event only when all conditions are met
+    /// </summary>
+    /// <param name="ptr">Function address</param>
+    /// <param name="conditions">Conditions, all must be met</param>
+    /// <param name="newFn">Callback</param>
+    /// <param name="classRef">Class reference.</param>
+    /// <returns>Status code</returns>
+    template<typename C>
+    inline NTSTATUS ApplyFiltered( uint64_t ptr, const std::vector<Condition>& conditions, void(C::* newFn)(RemoteContext& ctx), const C& classRef )
+    {
+        return ApplyFilteredP( ptr, conditions, brutal_cast<fnCallback>(newFn), &classRef );
+    }
 #endif // COMPILER_MSVC
 
+    /// <summary>
+    /// Install several hooks at once.
+    /// int3 hooks are written with one protection change per page,
+    /// global HWBP hooks are set in all threads within single suspension
+    /// </summary>
+    /// <param name="hooks">Hooks to install</param>
+    /// <returns>Status code, last failure if some hooks weren't installed</returns>
+    BLACKBONE_API NTSTATUS ApplyMany( const std::vector<HookSpec>& hooks );
+
     /// <summary>
     /// Remove existing hook
     /// </summary>
     /// <param name="ptr">Hooked address</param>
     BLACKBONE_API void Remove( uint64_t ptr );
 
+    /// <summary>
+    /// Run hook callbacks on worker threads.
+    /// Debug event thread only captures thread context, restores hooked code and continues,
+    /// so busy hooks don't stall the target. Callbacks receive context snapshot:
+    /// context changes have no effect and stack may change before callback runs.
+    /// Return hooks are always dispatched synchronously
+    /// </summary>
+    /// <param name="workers">Number of worker threads</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS EnableAsyncDispatch( uint32_t workers = 2 );
+
+    /// <summary>
+    /// Complete queued callbacks and return to synchronous dispatch
+    /// </summary>
+    BLACKBONE_API void DisableAsyncDispatch();
+
     /// <summary>
     /// Stop debug and remove all hooks
     /// </summary>
     BLACKBONE_API void reset();
 
+    /// <summary>
+    /// Number of debug events received so far
+    /// </summary>
+    /// <returns>Debug event count</returns>
+    BLACKBONE_API inline uint64_t debugEvents() const { return _debugEvents; }
+
 private:
+    /// <summary>
+    /// Queued hook callback
+    /// </summary>
+    struct DispatchItem
+    {
+        HookData::callback callback;    // Callback to invoke
+        ThreadPtr thread;               // Thread that hit the hook
+        _CONTEXT64 ctx;                 // Context at hook
+        ptr_t ip = 0;                   // Instruction pointer, 32 bit for wow64 target
+        ptr_t sp = 0;                   // Stack pointer, 32 bit for wow64 target
+    };
+
+    /// <summary>
+    /// Attach debugger and wait until debug event thread is running
+    /// </summary>
+    /// <returns>Status code</returns>
+    NTSTATUS EnsureDebugActive();
+
+    /// <summary>
+    /// Invoke hook callback
+    /// </summary>
+    /// <param name="callback">Callback</param>
+    /// <param name="context">Hook context</param>
+    void Invoke( const HookData::callback& callback, RemoteContext& context );
+
+    /// <summary>
+    /// Queue callback to worker pool, or run it in place if async dispatch isn't enabled
+    /// </summary>
+    /// <param name="addr">Hooked address</param>
+    /// <param name="hook">Hit hook</param>
+    /// <param name="thd">Thread that hit the hook</param>
+    /// <param name="ctx">Thread context</param>
+    /// <param name="ip">Instruction pointer</param>
+    /// <param name="sp">Stack pointer</param>
+    /// <returns>true if callback was queued</returns>
+    bool Dispatch( ptr_t addr, HookData& hook, const ThreadPtr& thd, _CONTEXT64& ctx, ptr_t ip, ptr_t sp );
+
+    /// <summary>
+    /// Wrapper for callback worker thread
+    /// </summary>
+    /// <param name="lpParam">RemoteHook pointer</param>
+    /// <returns>Error code</returns>
+    static DWORD __stdcall DispatchThreadWrap( LPVOID lpParam );
+
+    /// <summary>
+    /// Callback worker thread
+    /// </summary>
+    /// <returns>Error code</returns>
+    DWORD DispatchThread();
 
     /// <summary>
     /// Hook specified address
@@ -164,6 +339,24 @@ private:
     /// <returns>true on success</returns>
     BLACKBONE_API NTSTATUS AddReturnHookP( uint64_t ptr, fnCallback newFn, const void* pClass = nullptr );
 
+    /// <summary>
+    /// Hook function entry, raising debug event only when all conditions are met
+    /// </summary>
+    /// <param name="ptr">Function address</param>
+    /// <param name="conditions">Conditions, all must be met</param>
+    /// <param name="newFn">Callback</param>
+    /// <param name="pClass">Class reference.</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS ApplyFilteredP( uint64_t ptr, const std::vector<Condition>& conditions, fnCallback newFn, const void* pClass = nullptr );
+
+    /// <summary>
+    /// Generate condition check. Registers, flags and stack are preserved, int 3 is hit when all conditions are met
+    /// </summary>
+    /// <param name="a">Target assembler</param>
+    /// <param name="conditions">Conditions</param>
+    /// <returns>int 3 label</returns>
+    asmjit::Label GenFilter( IAsmHelper& a, const std::vector<Condition>& conditions );
+
     /// <summary>
     /// Restore hooked function
     /// </summary>
@@ -249,8 +442,12 @@ private:
     int          _wordSize = 4;         // 4 or 8 bytes
     bool         _active = false;       // Event thread activity flag
     mapHook      _hooks;                // Hooked callbacks
-    setAddresses _repatch;              // Pending repatch addresses
-    mapAddress   _retHooks;             // Hooked return addresses
+    std::map<ptr_t, ptr_t> _filterTraps;    // Filtered hook int 3 address -> hooked function
+    mapThreadState _threadState;        // Pending repatches and hooked returns per thread
+    Handle       _dispatchPort;         // Queued callbacks completion port
+    std::vector<Handle> _dispatchThreads;   // Callback workers
+    ExecRangeCache _execRanges;         // Regions checked during stack walks
+    std::atomic<uint64_t> _debugEvents{ 0 };    // Debug events received
 };
 
 ENUM_OPS( RemoteHook::eHookFlags )
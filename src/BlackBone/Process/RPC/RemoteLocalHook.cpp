@@ -1,173 +1,585 @@
 #include "RemoteLocalHook.h"
 
 #include "../Process.h"
-#include "../../Asm/LDasm.h"
+#include "../../Asm/CodeRelocator.h"
+#include "../../Misc/DynImport.h"
 
 namespace blackbone
 {
 
+// Size of rel32 jump written over function prologue
+constexpr size_t DetourSize = 5;
+
 RemoteLocalHook::RemoteLocalHook( class Process& process )
     : _process( process )
 {
+    static_assert(sizeof( TraceSlot ) == 0x80, "Trace slot size mismatch");
+    static_assert(sizeof( TraceLane ) == 0x40, "Trace lane header must take one cache line");
 }
 
 RemoteLocalHook::~RemoteLocalHook()
 {
-    Restore();
+    reset();
 }
 
-NTSTATUS RemoteLocalHook::AllocateMem( ptr_t /*address*/, size_t codeSize )
+/// <summary>
+/// Execute custom code on function entry.
+/// Code must preserve registers, flags and stack, and fall through at the end,
+/// relocated function prologue is executed after it
+/// </summary>
+/// <param name="address">Hooked function</param>
+/// <param name="hook">Hook code</param>
+/// <returns>Hook ID</returns>
+call_result_t<uint32_t> RemoteLocalHook::SetHook( ptr_t address, asmjit::Assembler& hook )
 {
-    auto pagesize = _process.core().native()->pageSize();
-    auto size = Align( codeSize, pagesize ) + Align( sizeof( _ctx ), pagesize );
+    CSLock lck( _lock );
+
+    auto id = _nextId++;
+    NTSTATUS status = Install( address, hook, id );
+    if (!NT_SUCCESS( status ))
+        return status;
 
-    auto allocation = _process.memory().Allocate( size, PAGE_EXECUTE_READWRITE );
-    if (!allocation)
-        return allocation.status;
+    return id;
+}
+
+/// <summary>
+/// Get address hook code was placed at
+/// </summary>
+/// <param name="id">Hook ID</param>
+/// <returns>Hook code address</returns>
+call_result_t<ptr_t> RemoteLocalHook::hookCode( uint32_t id )
+{
+    CSLock lck( _lock );
 
-    _hookData   = std::move( allocation.result() );
-    _pHookCode  = _hookData.ptr();
-    _pThunkCode = _pHookCode + _hookData.size() - pagesize;
+    auto iter = _detours.find( id );
+    if (iter == _detours.end())
+        return STATUS_NOT_FOUND;
 
-    return allocation.status;
+    return iter->second.stub;
 }
 
-NTSTATUS RemoteLocalHook::SetHook( ptr_t address, asmjit::Assembler& hook )
+/// <summary>
+/// Map trace ring into target process
+/// </summary>
+/// <param name="records">Ring capacity, must be power of 2</param>
+/// <param name="lanes">Number of per-thread sub-buffers, must be power of 2</param>
+/// <returns>Status code</returns>
+NTSTATUS RemoteLocalHook::OpenTrace( uint32_t records /*= 0x10000*/, uint32_t lanes /*= 16*/ )
 {
-    _address = address;
-    NTSTATUS status = AllocateMem( address, hook.getCodeSize() );
+    CSLock lck( _lock );
+
+    if (_pLanes != nullptr)
+        return STATUS_SUCCESS;
+
+    auto isPow2 = []( uint32_t value ) { return value != 0 && (value & (value - 1)) == 0; };
+    if (!isPow2( records ) || !isPow2( lanes ) || lanes > records)
+        return STATUS_INVALID_PARAMETER;
+
+    // Can't map view into x64 process from WOW64 one
+    if (_process.barrier().type == wow_32_64)
+        return STATUS_NOT_SUPPORTED;
+
+    auto size = lanes * sizeof( TraceLane ) + records * sizeof( TraceSlot );
+
+    _hSection = Handle( CreateFileMappingW( INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, static_cast<DWORD>(size), NULL ) );
+    if (!_hSection)
+        return LastNtStatus();
+
+    auto pLocal = MapViewOfFile( _hSection, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, size );
+    if (!pLocal)
+    {
+        NTSTATUS status = LastNtStatus();
+        _hSection.reset();
+        return status;
+    }
+
+    // WOW64 target needs view below 2GB
+    PVOID remoteBase = nullptr;
+    SIZE_T viewSize = 0;
+    ULONG_PTR zeroBits = _process.barrier().type == wow_64_32 ? 0x7FFFFFFF : 0;
+
+    NTSTATUS status = SAFE_NATIVE_CALL(
+        NtMapViewOfSection, _hSection.get(), _process.core().handle(), &remoteBase,
+        zeroBits, 0, nullptr, &viewSize, 2 /*ViewUnmap*/, 0, PAGE_READWRITE
+        );
+
     if (!NT_SUCCESS( status ))
+    {
+        UnmapViewOfFile( pLocal );
+        _hSection.reset();
         return status;
+    }
 
-    return _process.core().isWow64() ? SetHook32( address, hook ) : SetHook64( address, hook );
+    _pLanes = reinterpret_cast<TraceLane*>(pLocal);
+    _pSlots = reinterpret_cast<TraceSlot*>(_pLanes + lanes);
+    _remoteTrace = reinterpret_cast<ptr_t>(remoteBase);
+    _laneCount = lanes;
+    _laneSlots = records / lanes;
+    _tails.assign( lanes, 0 );
+    _dropped = 0;
+
+    return STATUS_SUCCESS;
 }
 
-NTSTATUS RemoteLocalHook::SetHook32( ptr_t address, asmjit::Assembler& hook )
+/// <summary>
+/// Record every function call into trace ring. Calls made while ring is full are dropped
+/// </summary>
+/// <param name="address">Hooked function</param>
+/// <param name="argCount">Number of arguments to record</param>
+/// <returns>Hook ID</returns>
+call_result_t<uint32_t> RemoteLocalHook::AddTrace( ptr_t address, uint32_t argCount /*= 4*/ )
 {
-    NTSTATUS status = STATUS_SUCCESS;
-    auto& mem = _process.memory();
+    CSLock lck( _lock );
 
-    if (!CopyOldCode( address, false ))
-        return STATUS_PARTIAL_COPY;
+    if (_pLanes == nullptr)
+        return STATUS_INVALID_HANDLE;
 
-    _ctx.hook32.codeSize = 5;
-    _ctx.hook32.jmp.opcode = 0xE9;
-    _ctx.hook32.jmp.ptr = static_cast<int32_t>(_pThunkCode - address - 5);
+    if (argCount > LocalHookRecord::MaxArgs)
+        return STATUS_INVALID_PARAMETER;
 
-    uint8_t buf[0x1000] = { 0 };
-    hook.setBaseAddress( _hookData.ptr<int32_t>() );
-    hook.relocCode( buf );
+    auto id = _nextId++;
+    auto a = AsmFactory::GetAssembler( _process.barrier().targetWow64 );
+    GenTrace( *a, id, argCount );
 
-    mem.Write( _pHookCode, buf );
-    mem.Write( _pThunkCode, _ctx.hook32.codeSize + _ctx.hook32.jmp_size, _ctx.hook32.original_code );
+    NTSTATUS status = Install( address, *a->assembler(), id );
+    if (!NT_SUCCESS( status ))
+        return status;
 
-    DWORD flOld = 0;
-    mem.Protect( address, sizeof( _ctx.hook32.jmp_code ), PAGE_EXECUTE_READWRITE, &flOld );
-    status = mem.Write( address, _ctx.hook32.jmp_code );
-    mem.Protect( address, sizeof( _ctx.hook32.jmp_code ), flOld );
+    return id;
+}
 
-    if (NT_SUCCESS( status ))
-        _hooked = true;
+/// <summary>
+/// Move recorded hits from trace ring.
+/// Records of one thread are in hit order, lanes are drained one after another.
+/// Record claimed by a thread that was stopped before completing it holds back its lane
+/// </summary>
+/// <param name="records">Receives records</param>
+/// <param name="maxRecords">Max number of records, 0 - all available</param>
+/// <returns>Number of records consumed</returns>
+size_t RemoteLocalHook::Consume( std::vector<LocalHookRecord>& records, size_t maxRecords /*= 0*/ )
+{
+    CSLock lck( _lock );
 
-    return status;
+    if (_pLanes == nullptr)
+        return 0;
+
+    bool x86 = _process.barrier().targetWow64;
+    uint64_t mask = x86 ? 0xFFFFFFFF : ~0ull;
+    size_t count = 0;
+
+    for (uint32_t lane = 0; lane < _laneCount && (maxRecords == 0 || count < maxRecords); lane++)
+    {
+        auto& tail = _tails[lane];
+        auto pSlots = _pSlots + lane * _laneSlots;
+
+        while (maxRecords == 0 || count < maxRecords)
+        {
+            auto& slot = pSlots[tail & (_laneSlots - 1)];
+            uint32_t stamp = slot.stamp;
+
+            if (stamp != tail + 1)
+            {
+                // Slot already holds record from one of the next laps, skip to oldest record still present
+                uint32_t oldest = _pLanes[lane].head - _laneSlots;
+                if (stamp != 0 && static_cast<int32_t>(stamp - (tail + 1)) > 0 && static_cast<int32_t>(oldest - tail) > 0)
+                {
+                    _dropped += oldest - tail;
+                    tail = oldest;
+                    continue;
+                }
+
+                break;
+            }
+
+            _ReadWriteBarrier();
+
+            LocalHookRecord record = { 0 };
+            record.sequence = tail;
+            record.hookId = slot.hookId;
+            record.threadId = slot.threadId;
+            record.returnAddress = slot.returnAddress & mask;
+            record.stackPointer = slot.stackPointer & mask;
+            record.timestamp = slot.timestamp;
+            for (uint32_t i = 0; i < LocalHookRecord::MaxArgs; i++)
+                record.args[i] = slot.args[i] & mask;
+
+            // Record was overwritten while being copied
+            _ReadWriteBarrier();
+            if (slot.stamp != stamp)
+                continue;
+
+            records.emplace_back( record );
+            tail++;
+            count++;
+        }
+    }
+
+    return count;
 }
 
-NTSTATUS RemoteLocalHook::SetHook64( ptr_t /*address*/, asmjit::Assembler& /*hook*/ )
+/// <summary>
+/// Remove hook
+/// </summary>
+/// <param name="id">Hook ID</param>
+/// <returns>Status code</returns>
+NTSTATUS RemoteLocalHook::Remove( uint32_t id )
 {
-    _hook64 = true;
-    return STATUS_NOT_IMPLEMENTED;
+    CSLock lck( _lock );
+
+    auto iter = _detours.find( id );
+    if (iter == _detours.end())
+        return STATUS_NOT_FOUND;
+
+    NTSTATUS status = Unhook( iter->second );
+    if (NT_SUCCESS( status ))
+        _detours.erase( iter );
+
+    return status;
 }
 
+/// <summary>
+/// Remove all hooks
+/// </summary>
+/// <returns>Status code</returns>
 NTSTATUS RemoteLocalHook::Restore()
 {
-    if (!_hooked)
-        return STATUS_SUCCESS;
+    CSLock lck( _lock );
 
-    DWORD flOld = 0;
-    _process.memory().Protect( _address, sizeof( _ctx.hook32.jmp_code ), PAGE_EXECUTE_READWRITE, &flOld );
-    NTSTATUS status = _process.memory().Write( _address, _ctx.hook32.codeSize, _ctx.hook32.original_code );
-    _process.memory().Protect( _address, sizeof( _ctx.hook32.jmp_code ), flOld );
-    
-    if (NT_SUCCESS( status ))
+    NTSTATUS status = STATUS_SUCCESS;
+    for (auto iter = _detours.begin(); iter != _detours.end();)
     {
-        _hookData.Free();
-        _pHookCode = _pThunkCode = 0;
-        _address = 0;
-        _hooked = false;
+        NTSTATUS unhookStatus = Unhook( iter->second );
+        if (NT_SUCCESS( unhookStatus ))
+        {
+            iter = _detours.erase( iter );
+        }
+        else
+        {
+            status = unhookStatus;
+            ++iter;
+        }
     }
 
     return status;
 }
 
-bool RemoteLocalHook::CopyOldCode( ptr_t address, bool x64 )
+/// <summary>
+/// Remove all hooks and unmap trace ring
+/// </summary>
+void RemoteLocalHook::reset()
 {
-    _process.memory().Read( address, sizeof( _ctx.hook32.original_code ), _ctx.hook32.original_code );
+    CSLock lck( _lock );
 
-    // Store original bytes
-    uint8_t* src = _ctx.hook32.original_code;
-    uint8_t* old = (uint8_t*)(_hookData.ptr() + _hookData.size() - _process.core().native()->pageSize());
-    uint32_t all_len = 0;
-    ldasm_data ld = { 0 };
+    // Hook code is released only here, some thread could still be executing it after Restore
+    if (_process.valid())
+        Restore();
 
-    do
+    _detours.clear();
+    _code.clear();
+
+    if (_remoteTrace != 0)
     {
-        uint32_t len = ldasm( src, &ld, x64 );
+        SAFE_NATIVE_CALL( NtUnmapViewOfSection, _process.core().handle(), reinterpret_cast<PVOID>(_remoteTrace) );
+        _remoteTrace = 0;
+    }
 
-        // Determine code end
-        if (ld.flags & F_INVALID
-            || (len == 1 && (src[ld.opcd_offset] == 0xCC || src[ld.opcd_offset] == 0xC3))
-            || (len == 3 && src[ld.opcd_offset] == 0xC2)
-            || len + all_len > 128)
-        {
-            break;
-        }
+    if (_pLanes != nullptr)
+    {
+        UnmapViewOfFile( _pLanes );
+        _pLanes = nullptr;
+        _pSlots = nullptr;
+    }
 
-        // if instruction has relative offset, calculate new offset 
-        if (ld.flags & F_RELATIVE)
-        {
-            int32_t diff = 0;
-            const uintptr_t ofst = (ld.disp_offset != 0 ? ld.disp_offset : ld.imm_offset);
-            const uintptr_t sz = ld.disp_size != 0 ? ld.disp_size : ld.imm_size;
+    _laneCount = _laneSlots = 0;
+    _tails.clear();
 
-            memcpy( &diff, src + ofst, sz );
+    _hSection.reset();
+}
 
-            if(x64)
+/// <summary>
+/// Generate trace code
+/// </summary>
+/// <param name="a">Target assembler</param>
+/// <param name="id">Hook ID</param>
+/// <param name="argCount">Number of arguments to record</param>
+void RemoteLocalHook::GenTrace( IAsmHelper& a, uint32_t id, uint32_t argCount )
+{
+    using namespace asmjit::host;
+
+    int32_t laneMask = static_cast<int32_t>(_laneCount - 1);
+    int32_t slotMask = static_cast<int32_t>(_laneSlots - 1);
+    int32_t laneShift = 6;
+    int32_t slotShift = 7;
+    int32_t slotsOffset = static_cast<int32_t>(_laneCount * sizeof( TraceLane ));
+
+    int32_t laneSlotsShift = 0;
+    while ((1u << laneSlotsShift) < _laneSlots)
+        laneSlotsShift++;
+
+    /*
+        lane = (tid >> 2) & laneMask;
+        seq = InterlockedExchangeAdd( &lanes[lane].head, 1 );
+
+        slot = &slots[lane * laneSlots + (seq & slotMask)];
+        slot->stamp = 0;
+        slot->... = ...;
+        slot->stamp = seq + 1;
+    */
+    if (!_process.barrier().targetWow64)
+    {
+        // [rsp] r10, [rsp + 0x8] rdx, [rsp + 0x10] rcx, [rsp + 0x18] rax, [rsp + 0x20] flags, [rsp + 0x28] return address
+        const int32_t retOffset = 0x28;
+
+        a->pushf();
+        a->push( rax );
+        a->push( rcx );
+        a->push( rdx );
+        a->push( r10 );
+        a->mov( r10, _remoteTrace );
+
+        // Thread IDs are multiple of 4
+        a->mov( edx, dword_ptr_abs( 0x48 ).setSegment( gs ) );     // TEB ClientId.UniqueThread
+        a->shr( edx, 2 );
+        a->and_( edx, laneMask );
+        a->mov( eax, edx );
+        a->shl( eax, laneShift );
+        a->mov( ecx, 1 );
+        a->lock().xadd( dword_ptr( r10, rax, 0, FIELD_OFFSET( TraceLane, head ) ), ecx );
+
+        // rdx - slot, ecx - stamp
+        a->shl( edx, laneSlotsShift );
+        a->mov( eax, ecx );
+        a->and_( eax, slotMask );
+        a->add( edx, eax );
+        a->shl( rdx, slotShift );
+        a->add( rdx, r10 );
+        a->add( rdx, slotsOffset );
+        a->inc( ecx );
+        a->mov( dword_ptr( rdx, FIELD_OFFSET( TraceSlot, stamp ) ), 0 );
+
+        a->mov( dword_ptr( rdx, FIELD_OFFSET( TraceSlot, hookId ) ), id );
+        a->mov( eax, dword_ptr_abs( 0x48 ).setSegment( gs ) );
+        a->mov( dword_ptr( rdx, FIELD_OFFSET( TraceSlot, threadId ) ), eax );
+        a->mov( rax, qword_ptr( rsp, retOffset ) );
+        a->mov( qword_ptr( rdx, FIELD_OFFSET( TraceSlot, returnAddress ) ), rax );
+        a->lea( rax, qword_ptr( rsp, retOffset ) );
+        a->mov( qword_ptr( rdx, FIELD_OFFSET( TraceSlot, stackPointer ) ), rax );
+
+        for (uint32_t i = 0; i < argCount; i++)
+        {
+            auto dst = qword_ptr( rdx, static_cast<int32_t>(FIELD_OFFSET( TraceSlot, args ) + i * sizeof( uint64_t )) );
+            switch (i)
             {
-                // exit if jump is greater then 2GB
-                /*if (_abs64( src + len + diff - old ) > INT_MAX)
-                {
+                case 0: a->mov( rax, qword_ptr( rsp, 0x10 ) ); a->mov( dst, rax ); break;
+                case 1: a->mov( rax, qword_ptr( rsp, 0x8 ) );  a->mov( dst, rax ); break;
+                case 2: a->mov( dst, r8 ); break;
+                case 3: a->mov( dst, r9 ); break;
+
+                // Stack arguments follow return address and home area
+                default:
+                    a->mov( rax, qword_ptr( rsp, static_cast<int32_t>(retOffset + 8 + i * sizeof( uint64_t )) ) );
+                    a->mov( dst, rax );
                     break;
-                }
-                else
-                {
-                    diff += static_cast<int32_t>(src - old);
-                    memcpy( old + ofst, &diff, sz );
-                }*/
-            }
-            else
-            {
-                //diff += src - old;
-                memcpy( src + ofst, &diff, sz );
             }
         }
 
-        src += len;
-        old += len;
-        all_len += len;
+        a->mov( r10, rdx );
+        a->rdtsc();
+        a->shl( rdx, 32 );
+        a->or_( rax, rdx );
+        a->mov( qword_ptr( r10, FIELD_OFFSET( TraceSlot, timestamp ) ), rax );
+        a->mov( dword_ptr( r10, FIELD_OFFSET( TraceSlot, stamp ) ), ecx );
+
+        a->pop( r10 );
+        a->pop( rdx );
+        a->pop( rcx );
+        a->pop( rax );
+        a->popf();
+    }
+    else
+    {
+        // pushad frame at [esp], [esp + 0x20] flags, [esp + 0x24] return address
+        const int32_t retOffset = 0x24;
+
+        a->pushf();
+        a->pusha();
+        a->mov( esi, static_cast<uint32_t>(_remoteTrace) );
+
+        // Thread IDs are multiple of 4
+        a->mov( edi, dword_ptr_abs( 0x24 ).setSegment( fs ) );     // TEB ClientId.UniqueThread
+        a->shr( edi, 2 );
+        a->and_( edi, laneMask );
+        a->mov( eax, edi );
+        a->shl( eax, laneShift );
+        a->mov( ecx, 1 );
+        a->lock().xadd( dword_ptr( esi, eax, 0, FIELD_OFFSET( TraceLane, head ) ), ecx );
+
+        // edi - slot, ecx - stamp
+        a->shl( edi, laneSlotsShift );
+        a->mov( eax, ecx );
+        a->and_( eax, slotMask );
+        a->add( edi, eax );
+        a->shl( edi, slotShift );
+        a->add( edi, esi );
+        a->add( edi, slotsOffset );
+        a->inc( ecx );
+        a->mov( dword_ptr( edi, FIELD_OFFSET( TraceSlot, stamp ) ), 0 );
+
+        a->mov( dword_ptr( edi, FIELD_OFFSET( TraceSlot, hookId ) ), id );
+        a->mov( eax, dword_ptr_abs( 0x24 ).setSegment( fs ) );
+        a->mov( dword_ptr( edi, FIELD_OFFSET( TraceSlot, threadId ) ), eax );
+        a->mov( eax, dword_ptr( esp, retOffset ) );
+        a->mov( dword_ptr( edi, FIELD_OFFSET( TraceSlot, returnAddress ) ), eax );
+        a->lea( eax, dword_ptr( esp, retOffset ) );
+        a->mov( dword_ptr( edi, FIELD_OFFSET( TraceSlot, stackPointer ) ), eax );
+
+        for (uint32_t i = 0; i < argCount; i++)
+        {
+            a->mov( eax, dword_ptr( esp, static_cast<int32_t>(retOffset + (i + 1) * sizeof( uint32_t )) ) );
+            a->mov( dword_ptr( edi, static_cast<int32_t>(FIELD_OFFSET( TraceSlot, args ) + i * sizeof( uint64_t )) ), eax );
+        }
+
+        a->rdtsc();
+        a->mov( dword_ptr( edi, FIELD_OFFSET( TraceSlot, timestamp ) ), eax );
+        a->mov( dword_ptr( edi, FIELD_OFFSET( TraceSlot, timestamp ) + sizeof( uint32_t ) ), edx );
+        a->mov( dword_ptr( edi, FIELD_OFFSET( TraceSlot, stamp ) ), ecx );
 
-    } while (all_len < sizeof( _ctx.hook32.jmp_code ));
+        a->popa();
+        a->popf();
+    }
+}
 
-    // Failed to copy old code, use backup plan
-    if (all_len >= sizeof( _ctx.hook32.jmp_code ))
+/// <summary>
+/// Detour function into hook code followed by relocated prologue
+/// </summary>
+/// <param name="address">Hooked function</param>
+/// <param name="code">Hook code</param>
+/// <param name="id">Hook ID</param>
+/// <returns>Status code</returns>
+NTSTATUS RemoteLocalHook::Install( ptr_t address, asmjit::Assembler& code, uint32_t id )
+{
+    // Overlapping detours can't be restored in arbitrary order
+    for (auto& item : _detours)
     {
-        _ctx.hook32.jmp_size = 5;
-        _ctx.hook32.codeSize = all_len;
-        *src = 0xE9;
-        //*(int32_t*)(src + 1) = (int32_t)address + all_len - (int32_t)old - 5;
-        return true;
+        auto& detour = item.second;
+        if (address < detour.address + detour.original.size() && detour.address < address + DetourSize)
+            return STATUS_ALREADY_REGISTERED;
     }
 
-    return false;
+    // Hook code, relocated prologue and jump back. Short branches in prologue can grow when rewritten
+    auto codeSize = code.getCodeSize();
+    auto stub = AllocateCode( address, Align( codeSize + CodeRelocator::MaxSize( static_cast<uint32_t>(DetourSize) ) + DetourSize, 0x10 ) );
+    if (!stub)
+        return stub.status;
+
+    Detour detour;
+    detour.address = address;
+    detour.stub = stub.result();
+
+    std::vector<uint8_t> relocated;
+    NTSTATUS status = RelocatePrologue( address, detour.stub + codeSize, detour.original, relocated );
+    if (!NT_SUCCESS( status ))
+        return status;
+
+    std::vector<uint8_t> buf( codeSize + relocated.size() + DetourSize );
+    code.setBaseAddress( static_cast<asmjit::Ptr>(detour.stub) );
+    code.relocCode( buf.data() );
+    memcpy( buf.data() + codeSize, relocated.data(), relocated.size() );
+
+    // Continue after overwritten instructions
+    auto pJmpBack = buf.data() + codeSize + relocated.size();
+    pJmpBack[0] = 0xE9;
+    *reinterpret_cast<int32_t*>(pJmpBack + 1) = static_cast<int32_t>(
+        address + detour.original.size() - (detour.stub + buf.size())
+        );
+
+    auto& mem = _process.memory();
+    if (!NT_SUCCESS( status = mem.Write( detour.stub, buf.size(), buf.data() ) ))
+        return status;
+
+    uint8_t jmp[DetourSize] = { 0xE9 };
+    *reinterpret_cast<int32_t*>(jmp + 1) = static_cast<int32_t>(detour.stub - address - DetourSize);
+
+    DWORD flOld = 0;
+    if (!NT_SUCCESS( status = mem.Protect( address, sizeof( jmp ), PAGE_EXECUTE_READWRITE, &flOld ) ))
+        return status;
+
+    status = mem.Write( address, sizeof( jmp ), jmp );
+    mem.Protect( address, sizeof( jmp ), flOld );
+    FlushInstructionCache( _process.core().handle(), reinterpret_cast<LPCVOID>(address), sizeof( jmp ) );
+
+    if (NT_SUCCESS( status ))
+        _detours.emplace( id, std::move( detour ) );
+
+    return status;
+}
+
+/// <summary>
+/// Copy whole instructions covering detour jump and fix relative offsets
+/// </summary>
+/// <param name="address">Hooked function</param>
+/// <param name="dest">Address of relocated code</param>
+/// <param name="original">Receives overwritten bytes</param>
+/// <param name="relocated">Receives relocated instructions</param>
+/// <returns>Status code</returns>
+NTSTATUS RemoteLocalHook::RelocatePrologue( ptr_t address, ptr_t dest, std::vector<uint8_t>& original, std::vector<uint8_t>& relocated )
+{
+    uint8_t code[0x40] = { 0 };
+    NTSTATUS status = _process.memory().Read( address, sizeof( code ), code, true );
+    if (!NT_SUCCESS( status ))
+        return status;
+
+    RelocatedCode result;
+    status = CodeRelocator::Relocate(
+        code, sizeof( code ), address, dest,
+        static_cast<uint32_t>(DetourSize), !_process.barrier().targetWow64, result
+        );
+
+    if (!NT_SUCCESS( status ))
+        return status;
+
+    original.assign( code, code + result.consumed );
+    relocated = std::move( result.code );
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Reserve code memory within rel32 jump distance from address
+/// </summary>
+/// <param name="address">Hooked function</param>
+/// <param name="size">Code size</param>
+/// <returns>Code address</returns>
+call_result_t<ptr_t> RemoteLocalHook::AllocateCode( ptr_t address, size_t size )
+{
+    // Any address is reachable in x86 target
+    bool x64 = !_process.barrier().targetWow64;
+    auto mem = _process.memory().codeHeap().Allocate( size, x64 ? address : 0 );
+    if (!mem)
+        return mem.status;
+
+    _code.emplace_back( std::move( mem.result() ) );
+    return _code.back().ptr();
+}
+
+/// <summary>
+/// Restore original function code
+/// </summary>
+/// <param name="detour">Detour</param>
+/// <returns>Status code</returns>
+NTSTATUS RemoteLocalHook::Unhook( const Detour& detour )
+{
+    auto& mem = _process.memory();
+
+    DWORD flOld = 0;
+    NTSTATUS status = mem.Protect( detour.address, detour.original.size(), PAGE_EXECUTE_READWRITE, &flOld );
+    if (!NT_SUCCESS( status ))
+        return status;
+
+    status = mem.Write( detour.address, detour.original.size(), detour.original.data() );
+    mem.Protect( detour.address, detour.original.size(), flOld );
+    FlushInstructionCache( _process.core().handle(), reinterpret_cast<LPCVOID>(detour.address), detour.original.size() );
+
+    return status;
 }
 
 }
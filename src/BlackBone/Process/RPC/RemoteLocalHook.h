@@ -3,83 +3,209 @@
 #include "../../Config.h"
 #include "../../Asm/AsmFactory.h"
 #include "../../Include/Types.h"
+#include "../../Include/CallResult.h"
+#include "../../Include/HandleGuard.h"
+#include "../../Misc/Utils.h"
 #include "../MemBlock.h"
 
+#include <map>
+#include <vector>
 
 namespace blackbone
 {
 
 /// <summary>
-/// Hook data, sizeof = 0x50 bytes
+/// Function hit recorded by trace hook
 /// </summary>
-#pragma pack(push, 1)
-struct HookCtx32
+struct LocalHookRecord
 {
-    uint32_t codeSize;          // Size of saved code
-    uint32_t jmp_size;          // Size of jump from thunk to original
-    uint8_t original_code[29];  // Original function code
-
-    union
-    {
-        uint8_t jmp_code[5];    // Jump instruction
-        struct  
-        {
-            uint8_t opcode; 
-            int32_t ptr;
-        } jmp;
-    };
-};
-
-struct HookCtx64
-{
-    uint64_t dst_ptr;           // Target address
-    uint32_t codeSize;          // Size of saved code
-    uint8_t original_code[32];  // Original function code
-    uint8_t far_jmp[6];         // Far jump code
-};
-#pragma pack(pop)
-
-union HookCtx
-{
-    HookCtx32 hook32;
-    HookCtx64 hook64;
+    static constexpr uint32_t MaxArgs = 8;
+
+    uint32_t sequence;          // Hit sequence number within trace lane
+    uint32_t hookId;            // Hook that was hit
+    uint32_t threadId;          // Calling thread
+    uint64_t returnAddress;     // Caller return address
+    uint64_t stackPointer;      // Stack pointer on function entry
+    uint64_t timestamp;         // Time stamp counter on function entry
+    uint64_t args[MaxArgs];     // Function arguments, stdcall for x86 target
 };
 
-
 /// <summary>
-/// In-process remote hook
+/// In-process remote hook.
+/// Hooked function is detoured into code executed inside the target, without debugger attachment.
+/// Trace hooks record arguments into a ring shared with this process, records are consumed asynchronously.
+/// Ring is split into lanes selected by thread ID, so threads rarely contend for the same head index
 /// </summary>
 class RemoteLocalHook
 {
 public:
-    RemoteLocalHook( class Process& process );
-    ~RemoteLocalHook();
-
-    NTSTATUS SetHook( ptr_t address, asmjit::Assembler& hook );
-    NTSTATUS Restore();
+    BLACKBONE_API RemoteLocalHook( class Process& process );
+    BLACKBONE_API ~RemoteLocalHook();
+
+    /// <summary>
+    /// Execute custom code on function entry.
+    /// Code must preserve registers, flags and stack, and fall through at the end,
+    /// relocated function prologue is executed after it
+    /// </summary>
+    /// <param name="address">Hooked function</param>
+    /// <param name="hook">Hook code</param>
+    /// <returns>Hook ID</returns>
+    BLACKBONE_API call_result_t<uint32_t> SetHook( ptr_t address, asmjit::Assembler& hook );
+
+    /// <summary>
+    /// Get address hook code was placed at
+    /// </summary>
+    /// <param name="id">Hook ID</param>
+    /// <returns>Hook code address</returns>
+    BLACKBONE_API call_result_t<ptr_t> hookCode( uint32_t id );
+
+    /// <summary>
+    /// Map trace ring into target process
+    /// </summary>
+    /// <param name="records">Ring capacity, must be power of 2</param>
+    /// <param name="lanes">Number of per-thread sub-buffers, must be power of 2</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS OpenTrace( uint32_t records = 0x10000, uint32_t lanes = 16 );
+
+    /// <summary>
+    /// Record every function call into trace ring.
+    /// Producers never wait: once lane is full, its oldest unread records are overwritten
+    /// </summary>
+    /// <param name="address">Hooked function</param>
+    /// <param name="argCount">Number of arguments to record</param>
+    /// <returns>Hook ID</returns>
+    BLACKBONE_API call_result_t<uint32_t> AddTrace( ptr_t address, uint32_t argCount = 4 );
+
+    /// <summary>
+    /// Move recorded hits from trace ring.
+    /// Records of one thread are in hit order, lanes are drained one after another.
+    /// Record claimed by a thread that was stopped before completing it holds back its lane
+    /// </summary>
+    /// <param name="records">Receives records</param>
+    /// <param name="maxRecords">Max number of records, 0 - all available</param>
+    /// <returns>Number of records consumed</returns>
+    BLACKBONE_API size_t Consume( std::vector<LocalHookRecord>& records, size_t maxRecords = 0 );
+
+    /// <summary>
+    /// Number of records overwritten before they were consumed
+    /// </summary>
+    BLACKBONE_API uint64_t dropped() const { return _dropped; }
+
+    /// <summary>
+    /// Remove hook
+    /// </summary>
+    /// <param name="id">Hook ID</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS Remove( uint32_t id );
+
+    /// <summary>
+    /// Remove all hooks
+    /// </summary>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS Restore();
+
+    /// <summary>
+    /// Remove all hooks and unmap trace ring
+    /// </summary>
+    BLACKBONE_API void reset();
 
 private:
     RemoteLocalHook( const RemoteLocalHook& ) = delete;
     RemoteLocalHook& operator = (const RemoteLocalHook&) = delete;
 
-    NTSTATUS AllocateMem( ptr_t address, size_t codeSize );
+    /// <summary>
+    /// Installed detour
+    /// </summary>
+    struct Detour
+    {
+        ptr_t address = 0;                  // Hooked function
+        ptr_t stub = 0;                     // Hook code
+        std::vector<uint8_t> original;      // Overwritten prologue
+    };
 
-    NTSTATUS SetHook32( ptr_t address, asmjit::Assembler& hook );
+    /// <summary>
+    /// Shared trace lane header. Ring starts with one header per lane, record slots of all lanes follow.
+    /// Each head index lives in own cache line
+    /// </summary>
+    struct TraceLane
+    {
+        volatile uint32_t head;             // Records claimed by target threads
+        uint8_t padding[0x3C];
+    };
 
-    NTSTATUS SetHook64( ptr_t address, asmjit::Assembler& hook );
+    /// <summary>
+    /// Trace ring slot. Values are 32 bit for x86 target
+    /// </summary>
+    struct TraceSlot
+    {
+        volatile uint32_t stamp;            // Sequence number + 1 when complete, 0 while being written
+        uint32_t hookId;
+        uint32_t threadId;
+        uint32_t reserved;
+        uint64_t returnAddress;
+        uint64_t stackPointer;
+        uint64_t timestamp;
+        uint64_t args[LocalHookRecord::MaxArgs];
+        uint8_t padding[0x18];
+    };
 
-    bool CopyOldCode( ptr_t address, bool x64 );
+    /// <summary>
+    /// Generate trace code
+    /// </summary>
+    /// <param name="a">Target assembler</param>
+    /// <param name="id">Hook ID</param>
+    /// <param name="argCount">Number of arguments to record</param>
+    void GenTrace( IAsmHelper& a, uint32_t id, uint32_t argCount );
+
+    /// <summary>
+    /// Detour function into hook code followed by relocated prologue
+    /// </summary>
+    /// <param name="address">Hooked function</param>
+    /// <param name="code">Hook code</param>
+    /// <param name="id">Hook ID</param>
+    /// <returns>Status code</returns>
+    NTSTATUS Install( ptr_t address, asmjit::Assembler& code, uint32_t id );
+
+    /// <summary>
+    /// Copy whole instructions covering detour jump and fix relative offsets
+    /// </summary>
+    /// <param name="address">Hooked function</param>
+    /// <param name="dest">Address of relocated code</param>
+    /// <param name="original">Receives overwritten bytes</param>
+    /// <param name="relocated">Receives relocated instructions</param>
+    /// <returns>Status code</returns>
+    NTSTATUS RelocatePrologue( ptr_t address, ptr_t dest, std::vector<uint8_t>& original, std::vector<uint8_t>& relocated );
+
+    /// <summary>
+    /// Reserve code memory within rel32 jump distance from address
+    /// </summary>
+    /// <param name="address">Hooked function</param>
+    /// <param name="size">Code size</param>
+    /// <returns>Code address</returns>
+    call_result_t<ptr_t> AllocateCode( ptr_t address, size_t size );
+
+    /// <summary>
+    /// Restore original function code
+    /// </summary>
+    /// <param name="detour">Detour</param>
+    /// <returns>Status code</returns>
+    NTSTATUS Unhook( const Detour& detour );
 
 private:
     class Process& _process;
-    HookCtx _ctx;
-    MemBlock _hookData;
-    ptr_t _pHookCode = 0;
-    ptr_t _pThunkCode = 0;
-    ptr_t _address = 0;
-
-    bool _hooked = false;
-    bool _hook64 = false;
+    std::map<uint32_t, Detour> _detours;    // Installed hooks
+    std::vector<MemBlock> _code;            // Hook code, taken from process code heap
+    uint32_t _nextId = 1;                   // Next hook ID
+    CriticalSection _lock;
+
+    Handle      _hSection;                  // Trace ring section
+    TraceLane*  _pLanes = nullptr;          // Local view of trace ring
+    TraceSlot*  _pSlots = nullptr;          // Local view of trace slots
+    ptr_t       _remoteTrace = 0;           // Trace ring view in target process
+    uint32_t    _laneCount = 0;             // Number of lanes
+    uint32_t    _laneSlots = 0;             // Slots per lane
+    std::vector<uint32_t> _tails;           // Records consumed from each lane
+    uint64_t    _dropped = 0;               // Records overwritten before consumed
 };
 
-}
\ No newline at end of file
+}
@@ -5,10 +5,13 @@
 namespace blackbone
 {
 
+// Hook data and event ring live in single page shared by driver
+static_assert(sizeof( RemoteMemory::PageContext ) <= 0x1000, "Hook context doesn't fit shared page");
+static_assert(sizeof( RemoteMemory::EventSlot ) == 1 << 5, "Event slot size mismatch");
+
 RemoteMemory::RemoteMemory( Process* process )
     : _process( process )
 {
-    _pipeName = Utils::RandomANString() + L"_" + std::to_wstring( _process->pid() ) + L"_" + std::to_wstring( GetCurrentProcessId() );
 }
 
 RemoteMemory::~RemoteMemory()
@@ -20,25 +23,23 @@ RemoteMemory::~RemoteMemory()
 /// Map entire process address space
 /// </summary>
 /// <param name="mapSections">Set to true to map section objects. They are converted to private pages before locking</param>
+/// <param name="lazy">Set to true to lock and map regions only when they are first translated</param>
 /// <returns>Status code</returns>
-NTSTATUS RemoteMemory::Map( bool mapSections )
+NTSTATUS RemoteMemory::Map( bool mapSections, bool lazy /*= false*/ )
 {
     MapMemoryResult result = { 0 };
 
-    // IPC
-    if (!_hPipe)
-        _hPipe = CreateNamedPipeW( (L"\\\\.\\pipe\\" + _pipeName).c_str(), PIPE_ACCESS_DUPLEX, PIPE_TYPE_MESSAGE, 1, 0, 0, 0, NULL );
-
+    // Hook events are passed through shared page, no pipe is needed
     Driver().EnsureLoaded();
-    NTSTATUS status = Driver().MapMemory( _process->pid(), _pipeName, mapSections, result );
+    NTSTATUS status = Driver().MapMemory( _process->pid(), std::wstring(), mapSections, result, lazy );
 
     if (NT_SUCCESS( status ))
     {
         std::swap( _mapDatabase, result.regions );
+        _hitSize = 0;
 
         _pSharedData = (PageContext*)result.hostSharedPage;
         _targetShare = result.targetSharedPage;
-        _targetPipe = result.targetPipe;
     }
 
     return status;
@@ -54,22 +55,66 @@ NTSTATUS RemoteMemory::Map( ptr_t base, uint32_t size )
 {
     MapMemoryRegionResult memRes =  { 0 };
 
-    // IPC
-    if (!_hPipe)
-        _hPipe = CreateNamedPipeW( (L"\\\\.\\pipe\\" + _pipeName).c_str(), PIPE_ACCESS_DUPLEX, PIPE_TYPE_MESSAGE, 1, 0, 0, 0, NULL );
-
     Driver().EnsureLoaded();
     NTSTATUS status = Driver().MapMemoryRegion( _process->pid(), base, size, memRes );
 
     // Update regions
     if (NT_SUCCESS( status ))
+        ReloadRegions();
+
+    return status;
+}
+
+/// <summary>
+/// Reload region list from driver
+/// </summary>
+/// <returns>Status code</returns>
+NTSTATUS RemoteMemory::ReloadRegions()
+{
+    MapMemoryResult rgnRes = { };
+
+    NTSTATUS status = Driver().MapMemory( _process->pid(), std::wstring(), false, rgnRes );
+    if (NT_SUCCESS( status ))
+    {
+        std::swap( _mapDatabase, rgnRes.regions );
+        _hitSize = 0;
+    }
+
+    return status;
+}
+
+/// <summary>
+/// Sync address space mapped with Map( bool ) with current target memory.
+/// Unchanged regions stay mapped, only released and new regions are processed
+/// </summary>
+/// <param name="mapSections">Set to true to map new section objects</param>
+/// <returns>Status code</returns>
+NTSTATUS RemoteMemory::Refresh( bool mapSections )
+{
+    RemapRefreshResult delta;
+
+    NTSTATUS status = Driver().RefreshMemoryMap( _process->pid(), mapSections, delta );
+    if (!NT_SUCCESS( status ))
+        return status;
+
+    // Too many changes to report, fetch complete region list
+    if (!delta.complete)
+    {
+        MapMemoryResult result = { };
+
+        status = Driver().MapMemory( _process->pid(), std::wstring(), mapSections, result );
+        if (NT_SUCCESS( status ))
+            std::swap( _mapDatabase, result.regions );
+    }
+    else
     {
-        MapMemoryResult rgnRes = { };
+        for (auto& region : delta.removed)
+            _mapDatabase.erase( region.first );
 
-        if (NT_SUCCESS( Driver().MapMemory( _process->pid(), _pipeName, false, rgnRes ) ))
-            std::swap( _mapDatabase, rgnRes.regions );
+        _mapDatabase.insert( delta.added.begin(), delta.added.end() );
     }
 
+    _hitSize = 0;
     return status;
 }
 
@@ -84,10 +129,10 @@ NTSTATUS RemoteMemory::Unmap( )
     if (NT_SUCCESS( status ))
     {
         _mapDatabase.clear();
+        _hitSize = 0;
 
         _pSharedData = nullptr;
         _targetShare = 0;
-        _targetPipe = NULL;
     }
 
     return status;
@@ -101,19 +146,16 @@ NTSTATUS RemoteMemory::Unmap( )
 /// <returns>Status code</returns>
 NTSTATUS RemoteMemory::Unmap( ptr_t base, uint32_t size )
 {
-    auto searchFn = [&base]( const decltype(_mapDatabase)::value_type& val )
-    {
-        return base >= val.first.first && base < val.first.first + val.first.second;
-    };
-
     NTSTATUS status = Driver().UnmapMemoryRegion( _process->pid(), base, size );
 
     if (NT_SUCCESS( status ))
     {
         // Remove region
-        auto iter = std::find_if( _mapDatabase.begin(), _mapDatabase.end(), searchFn );
+        auto iter = FindRegion( base );
         if (iter != _mapDatabase.end())
             _mapDatabase.erase( iter );
+
+        _hitSize = 0;
     }
 
     return status;
@@ -128,24 +170,90 @@ NTSTATUS RemoteMemory::Unmap( ptr_t base, uint32_t size )
 /// <returns>Translated address</returns>
 blackbone::ptr_t RemoteMemory::TranslateAddress( ptr_t address, bool resolveFault /*= true */ )
 {
-    auto searchFn = [&address]( const decltype(_mapDatabase)::value_type& val )
-    {
-        return address >= val.first.first && address < val.first.first + val.first.second;
-    };
+    // Pages mapped ahead of faulting address
+    constexpr ptr_t faultAhead = 0x10000;
+
+    // Same region as last time
+    if (address - _hitBase < _hitSize)
+        return _hitMapped + (address - _hitBase);
 
-    auto iter = std::find_if( _mapDatabase.begin(), _mapDatabase.end(), searchFn );
+    auto iter = FindRegion( address );
+
+    // Region of lazy mapping that wasn't touched yet
+    bool reserved = iter != _mapDatabase.end() && iter->second == 0;
                               
     // Primitive Page fault. Try to resolve missing page
-    if (iter == _mapDatabase.end() && resolveFault && NT_SUCCESS( Map( address, 1 ) ))
-        // Second chance
-        iter = std::find_if( _mapDatabase.begin(), _mapDatabase.end(), searchFn );           
+    if ((iter == _mapDatabase.end() || reserved) && resolveFault)
+    {
+        // Map neighbouring pages too, but stop before next mapped region,
+        // otherwise driver would treat it as conflicting and remap it
+        ptr_t page = address & ~static_cast<ptr_t>(0xFFF);
+        ptr_t limit = page + faultAhead;
+
+        auto next = _mapDatabase.upper_bound( std::make_pair( address, ~0u ) );
+        if (next != _mapDatabase.end())
+            limit = std::min( limit, next->first.first );
+
+        // Driver maps only part of reserved region
+        if (reserved)
+            limit = std::min( limit, iter->first.first + iter->first.second );
+
+        auto size = static_cast<uint32_t>(std::max( limit, page + 0x1000 ) - page);
+        if (NT_SUCCESS( Map( page, size ) ) || (size > 0x1000 && NT_SUCCESS( Map( address, 1 ) )))
+            // Second chance
+            iter = FindRegion( address );
+    }
 
-    if (iter != _mapDatabase.end())
-        return iter->second + (address - iter->first.first);    
+    if (iter != _mapDatabase.end() && iter->second != 0)
+    {
+        _hitBase = iter->first.first;
+        _hitSize = iter->first.second;
+        _hitMapped = iter->second;
+
+        return iter->second + (address - iter->first.first);
+    }
 
     return 0;
 }
 
+/// <summary>
+/// Translate target address and get size of contiguous mapped block starting at it
+/// </summary>
+/// <param name="address">Address to translate</param>
+/// <param name="available">Number of bytes mapped contiguously from address</param>
+/// <param name="resolveFault">If set to true, routine will try to map non-existing region upon translation failure</param>
+/// <returns>Translated address</returns>
+blackbone::ptr_t RemoteMemory::TranslateAddress( ptr_t address, size_t& available, bool resolveFault /*= true */ )
+{
+    available = 0;
+
+    // Successful translation always updates last hit region
+    auto translated = TranslateAddress( address, resolveFault );
+    if (translated != 0)
+        available = static_cast<size_t>(_hitBase + _hitSize - address);
+
+    return translated;
+}
+
+/// <summary>
+/// Find mapped region containing address
+/// </summary>
+/// <param name="address">Target process address</param>
+/// <returns>Region iterator, _mapDatabase.end() if not found</returns>
+mapMemoryMap::const_iterator RemoteMemory::FindRegion( ptr_t address ) const
+{
+    // Regions don't overlap, so only the last region starting at or before address can contain it
+    auto iter = _mapDatabase.upper_bound( std::make_pair( address, ~0u ) );
+    if (iter == _mapDatabase.begin())
+        return _mapDatabase.end();
+
+    --iter;
+    if (address - iter->first.first < iter->first.second)
+        return iter;
+
+    return _mapDatabase.end();
+}
+
 /// <summary>
 /// Setup one of the 4 possible memory hooks:
 /// </summary>
@@ -164,8 +272,8 @@ NTSTATUS RemoteMemory::SetupHook( OperationType hkType )
     uint8_t* pTranslated = nullptr;
     ptr_t pProc = 0;
 
-    // Can't setup hook without target pipe and shared data
-    if (_targetPipe == NULL || !_pSharedData || !_targetShare)
+    // Can't setup hook without shared data
+    if (!_pSharedData || !_targetShare)
         return STATUS_NONE_MAPPED;
 
     // Cross-architecture code generation isn't supported yet
@@ -185,15 +293,33 @@ NTSTATUS RemoteMemory::SetupHook( OperationType hkType )
     if (!pTranslated)
         return STATUS_INVALID_ADDRESS;
 
-    // IPC
-    if (!_hPipe)
-        _hPipe = CreateNamedPipeW( (L"\\\\.\\pipe\\" + _pipeName).c_str(), PIPE_ACCESS_DUPLEX, PIPE_TYPE_MESSAGE, 1, 0, 0, 0, NULL );
+    // Wake event, signaled by hook functions when consumer sleeps
+    if (!_hEvent)
+    {
+        _hEvent = CreateEventW( NULL, FALSE, FALSE, NULL );
+        if (!_hEvent)
+            return LastNtStatus();
+
+        if (!DuplicateHandle( GetCurrentProcess(), _hEvent, _process->core().handle(), &_targetEvent, 0, FALSE, DUPLICATE_SAME_ACCESS ))
+        {
+            _hEvent.reset();
+            return LastNtStatus();
+        }
+    }
 
     // Listening thread
     if (_hThread == NULL)
     {
+        memset( &_pSharedData->ring, 0, sizeof( _pSharedData->ring ) );
+        _readIndex = 0;
+        _active = true;
+
         _hThread = CreateThread( NULL, 0, &RemoteMemory::HookThreadWrap, this, 0, NULL );
-        InitializeCriticalSection( &_pSharedData->csLock );
+        if (_hThread == NULL)
+        {
+            _active = false;
+            return LastNtStatus();
+        }
     }
     
     // Setup hook data
@@ -247,26 +373,47 @@ bool RemoteMemory::RestoreHook( OperationType hkType )
 /// </summary>
 void RemoteMemory::reset()
 {
+    for (int i = 0; i < 4; i++)
+        RestoreHook( (OperationType)i );
+
+    // Listener never blocks for longer than wake event timeout
     _active = false;
 
     if (_hThread != NULL)
     {
-        TerminateThread( _hThread, 0 );
+        SetEvent( _hEvent );
+        WaitForSingleObject( _hThread, INFINITE );
+        CloseHandle( _hThread );
         _hThread = NULL;
     }
 
-    _hPipe.reset();
+    if (_targetEvent != NULL)
+    {
+        HANDLE hLocal = nullptr;
+        DuplicateHandle(
+            _process->core().handle(),
+            _targetEvent,
+            GetCurrentProcess(),
+            &hLocal,
+            0, false,
+            DUPLICATE_CLOSE_SOURCE | DUPLICATE_SAME_ACCESS
+        );
+
+        if (hLocal)
+            CloseHandle( hLocal );
+
+        _targetEvent = NULL;
+    }
 
-    for (int i = 0; i < 4; i++)
-        RestoreHook( (OperationType)i );
+    _hEvent.reset();
 
     if (!_mapDatabase.empty() && !NT_SUCCESS( Unmap() ))
     {
         _mapDatabase.clear();
+        _hitSize = 0;
 
         _pSharedData = nullptr;
         _targetShare = 0;
-        _targetPipe = NULL;
     }
 }
 
@@ -286,29 +433,87 @@ DWORD CALLBACK RemoteMemory::HookThreadWrap( LPVOID lpParam )
 /// </summary>
 void RemoteMemory::HookThread()
 {
-    DWORD bytes = 0;
-
-    // Wait for target process to connect
-    ConnectNamedPipe( _hPipe, NULL );
-    _active = true;
+    auto& ring = _pSharedData->ring;
+    auto writeIndexPtr = reinterpret_cast<volatile LONG*>(&ring.writeIndex);
+    std::vector<OperationData> ops;
+    ops.reserve( EventRingSize );
 
     while (_active)
     {
-        OperationData opData = { 0 };
+        uint32_t writeIndex = static_cast<uint32_t>(*writeIndexPtr);
 
-        // Target endpoint closed
-        if (!ReadFile( _hPipe, &opData, sizeof( opData ), &bytes, NULL ))
+        // Hook functions signal event only if this flag is set, so burst of events results in single wakeup
+        if (writeIndex == _readIndex)
         {
-            _active = false;
-            _hThread = NULL;
-            return;
+            InterlockedExchange( reinterpret_cast<volatile LONG*>(&ring.waiting), 1 );
+            if (static_cast<uint32_t>(*writeIndexPtr) == _readIndex)
+                WaitForSingleObject( _hEvent, 100 );
+
+            InterlockedExchange( reinterpret_cast<volatile LONG*>(&ring.waiting), 0 );
+            continue;
+        }
+
+        // Ring overflow, some events were lost. Resync whole address space
+        if (writeIndex - _readIndex > EventRingSize)
+        {
+            BLACKBONE_TRACE( L"Hook event ring overflow, %d events lost", writeIndex - _readIndex - EventRingSize );
+            Refresh( false );
+            _readIndex = writeIndex;
+            continue;
         }
 
+        ops.clear();
+        bool lost = false;
+
+        for (; _readIndex != writeIndex; _readIndex++)
+        {
+            auto& slot = ring.events[_readIndex & (EventRingSize - 1)];
+            auto sequence = reinterpret_cast<volatile LONG*>(&slot.sequence);
+
+            // Slot is still being filled
+            if (static_cast<uint32_t>(*sequence) != _readIndex + 1)
+                break;
+
+            ops.emplace_back( slot.data );
+            _ReadWriteBarrier();
+
+            // Slot was reused while being read
+            if (static_cast<uint32_t>(*sequence) != _readIndex + 1)
+            {
+                lost = true;
+                break;
+            }
+        }
+
+        if (lost)
+        {
+            Refresh( false );
+            _readIndex = static_cast<uint32_t>(*writeIndexPtr);
+        }
+        else if (!ops.empty())
+            ApplyEvents( ops );
+        else
+            SwitchToThread();
+    }
+}
+
+/// <summary>
+/// Apply batch of hooked operations to mapped regions
+/// </summary>
+/// <param name="ops">Operations in posting order</param>
+void RemoteMemory::ApplyEvents( const std::vector<OperationData>& ops )
+{
+    bool mapped = false;
+
+    for (const auto& opData : ops)
+    {
         // Update mapping
         if (opData.allocType == MemVirtualAlloc || opData.allocType == MemMapSection)
         {
             BLACKBONE_TRACE( L"Allocated 0x%x bytes at %p", opData.allocSize, opData.allocAddress );
-            Map( opData.allocAddress, opData.allocSize );
+
+            MapMemoryRegionResult memRes = { 0 };
+            mapped |= NT_SUCCESS( Driver().MapMemoryRegion( _process->pid(), opData.allocAddress, opData.allocSize, memRes ) );
         }
         else
         {
@@ -316,6 +521,10 @@ void RemoteMemory::HookThread()
             Unmap( opData.allocAddress, opData.allocSize );
         }
     }
+
+    // Region list is reloaded once per batch
+    if (mapped)
+        ReloadRegions();
 }
 
 #ifdef USE64
@@ -335,17 +544,15 @@ void RemoteMemory::BuildGenericHookFn( OperationType opType )
 
     auto pAsm = AsmFactory::GetAssembler( _process->core().isWow64() );
     auto& a = *pAsm;
-    AsmStackAllocator sa( a.assembler(), 0x60 );
+    AsmStackFrame<sizeof( OperationData )> frame( a.assembler(), 0x60 );
     asmjit::Label skip1 = a->newLabel();
-    ALLOC_STACK_VAR( sa, data, OperationData );
-    ALLOC_STACK_VAR( sa, junk, SIZE_T );
-    size_t stack_size = Align( sa.getTotalSize(), 0x10 );
+    asmjit::Label skipWake = a->newLabel();
+    asmjit::Mem data = frame.Get<0>();
+    size_t stack_size = frame.getFrameSize();
 
     auto& modules = _process->modules();
 
-    auto pEnterCS = modules.GetExport( modules.GetModule( L"ntdll.dll" ), "RtlEnterCriticalSection" ).result( exportData() );
-    auto pLeaveCS = modules.GetExport( modules.GetModule( L"ntdll.dll" ), "RtlLeaveCriticalSection" ).result( exportData() );
-    auto pWrite = modules.GetExport( modules.GetModule( L"kernel32.dll" ), "WriteFile" ).result( exportData() );
+    auto pSetEvent = modules.GetExport( modules.GetModule( L"ntdll.dll" ), "NtSetEvent" ).result( exportData() );
 
     a.GenPrologue();
     a.EnableX64CallStack( false );
@@ -373,9 +580,6 @@ void RemoteMemory::BuildGenericHookFn( OperationType opType )
         a->jne( skip1 );
     }
 
-    // RtlEnterCriticalSection
-    a.GenCall( (uintptr_t)pEnterCS.procAddress, { _targetShare + FIELD_OFFSET( PageContext, csLock ) } );
-
     // Storage pointer
     a->lea( asmjit::host::rdx, data );
 
@@ -407,10 +611,28 @@ void RemoteMemory::BuildGenericHookFn( OperationType opType )
     // Operation type
     a->mov( asmjit::host::dword_ptr( asmjit::host::rdx, FIELD_OFFSET( OperationData, allocType ) ), opType );
 
-    a.GenCall( (uintptr_t)pWrite.procAddress, { (uint64_t)_targetPipe, &data, sizeof( OperationData ), &junk, 0 } );
-
-    // RtlEnterCriticalSection
-    a.GenCall( (uintptr_t)pLeaveCS.procAddress, { _targetShare + FIELD_OFFSET( PageContext, csLock ) } );
+    // Claim ring slot, it is published by writing its sequence
+    a->mov( asmjit::host::rcx, _targetShare + FIELD_OFFSET( PageContext, ring ) );
+    a->mov( asmjit::host::r9d, 1 );
+    a->lock().xadd( asmjit::host::dword_ptr( asmjit::host::rcx, FIELD_OFFSET( EventRing, writeIndex ) ), asmjit::host::r9d );
+    a->mov( asmjit::host::eax, asmjit::host::r9d );
+    a->and_( asmjit::host::eax, EventRingSize - 1 );
+    a->shl( asmjit::host::eax, 5 );
+    a->add( asmjit::host::rax, asmjit::host::rcx );
+    a->mov( asmjit::host::r10, asmjit::host::qword_ptr( asmjit::host::rdx ) );
+    a->mov( asmjit::host::qword_ptr( asmjit::host::rax, FIELD_OFFSET( EventRing, events ) + FIELD_OFFSET( EventSlot, data ) ), asmjit::host::r10 );
+    a->mov( asmjit::host::r10, asmjit::host::qword_ptr( asmjit::host::rdx, 8 ) );
+    a->mov( asmjit::host::qword_ptr( asmjit::host::rax, FIELD_OFFSET( EventRing, events ) + FIELD_OFFSET( EventSlot, data ) + 8 ), asmjit::host::r10 );
+    a->inc( asmjit::host::r9d );
+    a->mov( asmjit::host::dword_ptr( asmjit::host::rax, FIELD_OFFSET( EventRing, events ) + FIELD_OFFSET( EventSlot, sequence ) ), asmjit::host::r9d );
+
+    // Wake consumer if it sleeps, only first event of a batch does so
+    a->xor_( asmjit::host::eax, asmjit::host::eax );
+    a->xchg( asmjit::host::dword_ptr( asmjit::host::rcx, FIELD_OFFSET( EventRing, waiting ) ), asmjit::host::eax );
+    a->test( asmjit::host::eax, asmjit::host::eax );
+    a->jz( skipWake );
+    a.GenCall( (uintptr_t)pSetEvent.procAddress, { (uint64_t)_targetEvent, 0 } );
+    a->bind( skipWake );
 
     // Ignore return value
     a->xor_( asmjit::host::rax, asmjit::host::rax );
@@ -461,19 +683,17 @@ void RemoteMemory::BuildGenericHookFn( OperationType opType )
 
     auto pAsm = AsmFactory::GetAssembler( _process->core().isWow64() );
     auto& a = *pAsm;
-    AsmStackAllocator sa( a.assembler() );
+    AsmStackFrame<sizeof( OperationData )> frame( a.assembler() );
     asmjit::Label skip1 = a->newLabel();
-    ALLOC_STACK_VAR( sa, data, OperationData );
-    ALLOC_STACK_VAR( sa, junk, DWORD );
+    asmjit::Label skipWake = a->newLabel();
+    asmjit::Mem data = frame.Get<0>();
 
     auto& modules = _process->modules();
 
-    auto pEnterCS = modules.GetExport( modules.GetModule( L"ntdll.dll" ), "RtlEnterCriticalSection" ).result( exportData() ).procAddress;
-    auto pLeaveCS = modules.GetExport( modules.GetModule( L"ntdll.dll" ), "RtlLeaveCriticalSection" ).result( exportData() ).procAddress;
-    auto pWrite = modules.GetExport( modules.GetModule( L"kernel32.dll" ), "WriteFile" ).result( exportData() ).procAddress;
+    auto pSetEvent = modules.GetExport( modules.GetModule( L"ntdll.dll" ), "NtSetEvent" ).result( exportData() ).procAddress;
 
     a.GenPrologue();
-    a->sub( asmjit::host::esp, sa.getTotalSize() );
+    a->sub( asmjit::host::esp, frame.getTotalSize() );
 
     // Call original
     for (int i = 0; i < argc[opType]; i++)
@@ -493,9 +713,6 @@ void RemoteMemory::BuildGenericHookFn( OperationType opType )
         a->jne( skip1 );
     }
 
-    // RtlEnterCriticalSection
-    a.GenCall( (uintptr_t)pEnterCS, { (uintptr_t)_targetShare + FIELD_OFFSET( PageContext, csLock ) } );
-
     // Storage pointer
     a->lea( asmjit::host::edx, data );
     
@@ -524,8 +741,35 @@ void RemoteMemory::BuildGenericHookFn( OperationType opType )
     // Operation type
     a->mov( asmjit::host::dword_ptr( asmjit::host::edx, FIELD_OFFSET( OperationData, allocType ) ), opType );
 
-    a.GenCall( (uintptr_t)pWrite, { (uintptr_t)_targetPipe, asmjit::host::edx, sizeof( OperationData ), &junk, 0 } );
-    a.GenCall( (uintptr_t)pLeaveCS, { (uintptr_t)_targetShare + FIELD_OFFSET( PageContext, csLock ) } );
+    // Claim ring slot, it is published by writing its sequence
+    a->push( asmjit::host::esi );
+    a->push( asmjit::host::edi );
+    a->mov( asmjit::host::ecx, (uintptr_t)_targetShare + FIELD_OFFSET( PageContext, ring ) );
+    a->mov( asmjit::host::esi, 1 );
+    a->lock().xadd( asmjit::host::dword_ptr( asmjit::host::ecx, FIELD_OFFSET( EventRing, writeIndex ) ), asmjit::host::esi );
+    a->mov( asmjit::host::eax, asmjit::host::esi );
+    a->and_( asmjit::host::eax, EventRingSize - 1 );
+    a->shl( asmjit::host::eax, 5 );
+    a->add( asmjit::host::eax, asmjit::host::ecx );
+
+    for (int32_t i = 0; i < sizeof( OperationData ); i += 4)
+    {
+        a->mov( asmjit::host::edi, asmjit::host::dword_ptr( asmjit::host::edx, i ) );
+        a->mov( asmjit::host::dword_ptr( asmjit::host::eax, FIELD_OFFSET( EventRing, events ) + FIELD_OFFSET( EventSlot, data ) + i ), asmjit::host::edi );
+    }
+
+    a->inc( asmjit::host::esi );
+    a->mov( asmjit::host::dword_ptr( asmjit::host::eax, FIELD_OFFSET( EventRing, events ) + FIELD_OFFSET( EventSlot, sequence ) ), asmjit::host::esi );
+
+    // Wake consumer if it sleeps, only first event of a batch does so
+    a->xor_( asmjit::host::eax, asmjit::host::eax );
+    a->xchg( asmjit::host::dword_ptr( asmjit::host::ecx, FIELD_OFFSET( EventRing, waiting ) ), asmjit::host::eax );
+    a->pop( asmjit::host::edi );
+    a->pop( asmjit::host::esi );
+    a->test( asmjit::host::eax, asmjit::host::eax );
+    a->jz( skipWake );
+    a.GenCall( (uintptr_t)pSetEvent, { (uintptr_t)_targetEvent, 0 } );
+    a->bind( skipWake );
 
     // Ignore return value
     a->xor_( asmjit::host::eax, asmjit::host::eax );
@@ -5,6 +5,8 @@
 
 #include <string>
 #include <map>
+#include <atomic>
+#include <vector>
 
 namespace blackbone
 {
@@ -44,13 +46,37 @@ public:
         OperationType allocType;    // Operation type
     };
 
+    // Hook event ring capacity, must be power of 2
+    static constexpr uint32_t EventRingSize = 64;
+
+    /// <summary>
+    /// Single hooked operation, filled by hook function
+    /// </summary>
+    struct EventSlot
+    {
+        uint32_t sequence;          // Event index + 1, written last
+        uint32_t reserved[3];
+        OperationData data;         // Operation
+    };
+
+    /// <summary>
+    /// Hook event ring. Hook functions claim slots with interlocked increment and never block,
+    /// consumer detects lost events by distance between write and read indexes
+    /// </summary>
+    struct EventRing
+    {
+        uint32_t writeIndex;        // Number of posted events
+        uint32_t waiting;           // Consumer sleeps and has to be woken by first event posted
+        EventSlot events[EventRingSize];
+    };
+
     struct PageContext
     {
         HookData hkVirtualAlloc;    // NtAllocateVirtualMemory context
         HookData hkVirtualFree;     // NtFreeVirtualMemory context
         HookData hkMapSection;      // NtMapViewOfSection context
         HookData hkUnmapSection;    // NtUnmapViewOfSection context
-        CRITICAL_SECTION csLock;    // Lock to sync multi-threaded mappings
+        EventRing ring;             // Hooked operations
     };
 
 public:
@@ -61,8 +87,9 @@ public:
     /// Map entire process address space
     /// </summary>
     /// <param name="mapSections">Set to true to map section objects. They are converted to private pages before locking</param>
+    /// <param name="lazy">Set to true to lock and map regions only when they are first translated</param>
     /// <returns>Status code</returns>
-    BLACKBONE_API NTSTATUS Map( bool mapSections );
+    BLACKBONE_API NTSTATUS Map( bool mapSections, bool lazy = false );
 
     /// <summary>
     /// Map specific memory region
@@ -72,6 +99,14 @@ public:
     /// <returns>Status code</returns>
     BLACKBONE_API NTSTATUS Map( ptr_t base, uint32_t size );
 
+    /// <summary>
+    /// Sync address space mapped with Map( bool ) with current target memory.
+    /// Unchanged regions stay mapped, only released and new regions are processed
+    /// </summary>
+    /// <param name="mapSections">Set to true to map new section objects</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS Refresh( bool mapSections );
+
     /// <summary>
     /// Unmap process address space from current process
     /// </summary>
@@ -94,6 +129,21 @@ public:
     /// <returns>Translated address</returns>
     BLACKBONE_API ptr_t TranslateAddress( ptr_t address, bool resolveFault = true );
 
+    /// <summary>
+    /// Translate target address and get size of contiguous mapped block starting at it
+    /// </summary>
+    /// <param name="address">Address to translate</param>
+    /// <param name="available">Number of bytes mapped contiguously from address</param>
+    /// <param name="resolveFault">If set to true, routine will try to map non-existing region upon translation failure</param>
+    /// <returns>Translated address</returns>
+    BLACKBONE_API ptr_t TranslateAddress( ptr_t address, size_t& available, bool resolveFault = true );
+
+    /// <summary>
+    /// Check if any target memory is mapped
+    /// </summary>
+    /// <returns>true if mapped</returns>
+    BLACKBONE_API inline bool mapped() const { return !_mapDatabase.empty(); }
+
     /// <summary>
     /// Setup one of the 4 possible memory hooks:
     /// </summary>
@@ -120,6 +170,13 @@ public:
     BLACKBONE_API void reset();
 
 private:
+    /// <summary>
+    /// Find mapped region containing address
+    /// </summary>
+    /// <param name="address">Target process address</param>
+    /// <returns>Region iterator, _mapDatabase.end() if not found</returns>
+    mapMemoryMap::const_iterator FindRegion( ptr_t address ) const;
+
     /// <summary>
     /// Hook thread wrapper
     /// </summary>
@@ -132,6 +189,18 @@ private:
     /// </summary>
     void HookThread();
 
+    /// <summary>
+    /// Apply batch of hooked operations to mapped regions
+    /// </summary>
+    /// <param name="ops">Operations in posting order</param>
+    void ApplyEvents( const std::vector<OperationData>& ops );
+
+    /// <summary>
+    /// Reload region list from driver
+    /// </summary>
+    /// <returns>Status code</returns>
+    NTSTATUS ReloadRegions();
+
     /// <summary>
     /// Build remote hook function
     /// </summary>
@@ -149,13 +218,16 @@ private:
 private:
     class Process* _process = nullptr;      // Target process
     mapMemoryMap _mapDatabase;              // Region map
-    std::wstring _pipeName;                 // Pipe name used to gather hook data
-    Handle _hPipe;                          // Hook pipe handle
-    HANDLE _targetPipe = NULL;              // Hook pipe handle in target process
+    ptr_t _hitBase = 0;                     // Last translated region base
+    ptr_t _hitSize = 0;                     // Last translated region size
+    ptr_t _hitMapped = 0;                   // Last translated region address in current process
+    Handle _hEvent;                         // Hook event ring wake event
+    HANDLE _targetEvent = NULL;             // Wake event handle in target process
     HANDLE _hThread = NULL;                 // Hook thread listener
+    uint32_t _readIndex = 0;                // Number of consumed hook events
     PageContext* _pSharedData = nullptr;    // Hook related data, shared between processes
     ptr_t _targetShare = 0;                 // Address of shared in data in target process
-    bool _active = false;                   // Hook thread activity flag
+    std::atomic<bool> _active = false;      // Hook thread activity flag
     bool _hooked[4] = { 0 };                // Hook state
 };
 
@@ -0,0 +1,506 @@
+#include "RemoteRing.h"
+#include "../Process.h"
+#include "../../Misc/DynImport.h"
+
+namespace blackbone
+{
+
+// Spin iterations before host falls back to waiting on event
+constexpr uint32_t RingSpinCount = 4000;
+
+// Worker loop code size
+constexpr size_t RingWorkerSize = 0x200;
+
+RemoteRing::RemoteRing( Process& proc )
+    : _process( proc )
+{
+    static_assert(sizeof( RingSlot ) == 0x40, "Ring slot size mismatch");
+    static_assert(sizeof( RingHeader ) % 0x40 == 0, "Ring header must be cache line aligned");
+}
+
+RemoteRing::~RemoteRing()
+{
+    Close();
+}
+
+/// <summary>
+/// Map shared ring into target process and start worker thread serving it
+/// </summary>
+/// <param name="slots">Ring capacity, must be power of 2</param>
+/// <returns>Status code</returns>
+NTSTATUS RemoteRing::Open( uint32_t slots /*= 64*/ )
+{
+    if (valid())
+        return STATUS_SUCCESS;
+
+    if (slots == 0 || (slots & (slots - 1)) != 0)
+        return STATUS_INVALID_PARAMETER;
+
+    // Can't map view into x64 process from WOW64 one
+    if (_process.barrier().type == wow_32_64)
+        return STATUS_NOT_SUPPORTED;
+
+    NTSTATUS status = STATUS_SUCCESS;
+    auto size = sizeof( RingHeader ) + slots * sizeof( RingSlot );
+
+    _hSection = Handle( CreateFileMappingW( INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, static_cast<DWORD>(size), NULL ) );
+    if (!_hSection)
+        return LastNtStatus();
+
+    auto pLocal = MapViewOfFile( _hSection, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, size );
+    if (!pLocal)
+    {
+        status = LastNtStatus();
+        Close();
+        return status;
+    }
+
+    _pHeader = reinterpret_cast<RingHeader*>(pLocal);
+    _pSlots = reinterpret_cast<RingSlot*>(_pHeader + 1);
+    _pHeader->slotMask = slots - 1;
+
+    // WOW64 target needs view below 2GB
+    PVOID remoteBase = nullptr;
+    SIZE_T viewSize = 0;
+    ULONG_PTR zeroBits = _process.barrier().type == wow_64_32 ? 0x7FFFFFFF : 0;
+
+    status = SAFE_NATIVE_CALL(
+        NtMapViewOfSection, _hSection.get(), _process.core().handle(), &remoteBase,
+        zeroBits, 0, nullptr, &viewSize, 2 /*ViewUnmap*/, 0, PAGE_READWRITE
+        );
+
+    if (!NT_SUCCESS( status ))
+    {
+        Close();
+        return status;
+    }
+
+    _remoteBase = reinterpret_cast<ptr_t>(remoteBase);
+
+    // Both events are auto-reset, extra signal only causes spurious wake up
+    _hRequest = Handle( CreateEventW( NULL, FALSE, FALSE, NULL ) );
+    _hDone = Handle( CreateEventW( NULL, FALSE, FALSE, NULL ) );
+    if (!_hRequest || !_hDone)
+    {
+        status = LastNtStatus();
+        Close();
+        return status;
+    }
+
+    if (!NT_SUCCESS( status = DuplicateToTarget( _hRequest, _hRemoteRequest ) ) ||
+        !NT_SUCCESS( status = DuplicateToTarget( _hDone, _hRemoteDone ) ))
+    {
+        Close();
+        return status;
+    }
+
+    // Worker loop followed by stub thunks
+    auto mem = _process.memory().codeHeap().Allocate( 0x1000 );
+    if (!mem)
+    {
+        Close();
+        return mem.status;
+    }
+
+    _code = std::move( mem.result() );
+
+    auto a = AsmFactory::GetAssembler( _process.barrier().targetWow64 );
+    if (!NT_SUCCESS( status = GenWorker( *a ) ) ||
+        !NT_SUCCESS( status = _code.Write( 0, (*a)->getCodeSize(), (*a)->make() ) ))
+    {
+        Close();
+        return status;
+    }
+
+    _codeUsed = RingWorkerSize;
+
+    auto thd = _process.threads().CreateNew( _code.ptr(), 0, _process.remote().threadOptions() );
+    if (!thd)
+    {
+        Close();
+        return thd.status;
+    }
+
+    _worker = std::move( thd.result() );
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Stop worker thread and unmap shared ring
+/// </summary>
+void RemoteRing::Close()
+{
+    // Let worker exit on its own, it never holds any locks while sleeping
+    if (_worker && _worker->valid())
+    {
+        InterlockedExchange( reinterpret_cast<volatile LONG*>(&_pHeader->stop), 1 );
+        SetEvent( _hRequest );
+
+        if (!_worker->Join( 1000 ))
+        {
+            _worker->Terminate();
+            _worker->Join();
+        }
+
+        _worker->Close();
+    }
+
+    _worker.reset();
+
+    // Close target handles
+    for (auto hRemote : { &_hRemoteRequest, &_hRemoteDone })
+    {
+        if (*hRemote == 0)
+            continue;
+
+        HANDLE hLocal = nullptr;
+        DuplicateHandle(
+            _process.core().handle(),
+            reinterpret_cast<HANDLE>(*hRemote),
+            GetCurrentProcess(),
+            &hLocal,
+            0, false,
+            DUPLICATE_CLOSE_SOURCE | DUPLICATE_SAME_ACCESS
+        );
+
+        if (hLocal)
+            CloseHandle( hLocal );
+
+        *hRemote = 0;
+    }
+
+    if (_remoteBase != 0)
+    {
+        SAFE_NATIVE_CALL( NtUnmapViewOfSection, _process.core().handle(), reinterpret_cast<PVOID>(_remoteBase) );
+        _remoteBase = 0;
+    }
+
+    if (_pHeader != nullptr)
+    {
+        UnmapViewOfFile( _pHeader );
+        _pHeader = nullptr;
+        _pSlots = nullptr;
+    }
+
+    _code.Reset();
+    _codeUsed = 0;
+    _stubCount = 0;
+
+    _hRequest.reset();
+    _hDone.reset();
+    _hSection.reset();
+}
+
+/// <summary>
+/// Register remote function callable through the ring
+/// </summary>
+/// <param name="pfn">Remote function address</param>
+/// <param name="argCount">Number of function arguments</param>
+/// <param name="cc">Calling convention, ignored for x64 target</param>
+/// <returns>Stub index</returns>
+call_result_t<uint32_t> RemoteRing::RegisterStub( ptr_t pfn, uint32_t argCount, eCalligConvention cc /*= cc_stdcall*/ )
+{
+    if (!valid())
+        return STATUS_INVALID_HANDLE;
+
+    if (argCount > MaxArgs || cc < cc_cdecl || cc > cc_fastcall)
+        return STATUS_INVALID_PARAMETER;
+
+    if (_stubCount >= MaxStubs)
+        return STATUS_TOO_MANY_NAMES;
+
+    // Worker passes current slot in zsi, it is preserved by callee in both x86 and x64 conventions
+    auto a = AsmFactory::GetAssembler( _process.barrier().targetWow64 );
+    std::vector<AsmVariant> args;
+    for (uint32_t i = 0; i < argCount; i++)
+        args.emplace_back( (*a)->intptr_ptr( (*a)->zsi, static_cast<int32_t>(FIELD_OFFSET( RingSlot, args ) + i * sizeof( uint64_t )) ) );
+
+    if (_process.barrier().targetWow64)
+    {
+        // Restore stack by hand, so cdecl and stdcall functions are handled the same way
+        (*a)->mov( (*a)->zdi, (*a)->zsp );
+        a->GenCall( pfn, args, cc == cc_cdecl ? cc_stdcall : cc );
+        (*a)->mov( (*a)->zsp, (*a)->zdi );
+    }
+    else
+        a->GenCall( pfn, args );
+
+    (*a)->ret();
+
+    auto codeSize = Align( (*a)->getCodeSize(), 0x10 );
+    if (_codeUsed + codeSize > _code.size())
+        return STATUS_NO_MEMORY;
+
+    NTSTATUS status = _code.Write( _codeUsed, (*a)->getCodeSize(), (*a)->make() );
+    if (!NT_SUCCESS( status ))
+        return status;
+
+    // Stub becomes callable once its address is published
+    auto index = _stubCount++;
+    _pHeader->stubs[index] = _code.ptr() + _codeUsed;
+    _codeUsed += codeSize;
+
+    return index;
+}
+
+/// <summary>
+/// Post call request without waiting for its completion. Blocks while ring is full
+/// </summary>
+/// <param name="stub">Stub index</param>
+/// <param name="args">Call arguments</param>
+/// <param name="timeout">Wait timeout in ms for a free slot</param>
+/// <returns>Request sequence number</returns>
+call_result_t<uint32_t> RemoteRing::Post( uint32_t stub, const std::vector<uint64_t>& args, uint32_t timeout /*= 30 * 1000*/ )
+{
+    if (!valid())
+        return STATUS_INVALID_HANDLE;
+
+    if (stub >= _stubCount || args.size() > MaxArgs)
+        return STATUS_INVALID_PARAMETER;
+
+    // Ring is full, wait for the oldest request
+    uint32_t sequence = _pHeader->head;
+    uint32_t slots = _pHeader->slotMask + 1;
+    if (sequence - _pHeader->done >= slots)
+    {
+        NTSTATUS status = WaitDone( sequence - slots + 1, timeout );
+        if (!NT_SUCCESS( status ))
+            return status;
+    }
+
+    auto& slot = _pSlots[sequence & _pHeader->slotMask];
+    slot.stub = stub;
+    slot.result = 0;
+    for (size_t i = 0; i < MaxArgs; i++)
+        slot.args[i] = i < args.size() ? args[i] : 0;
+
+    // Full barrier publishes slot before head and orders head store before sleep flag load
+    InterlockedExchange( reinterpret_cast<volatile LONG*>(&_pHeader->head), sequence + 1 );
+    if (_pHeader->workerSleeping)
+        SetEvent( _hRequest );
+
+    return sequence;
+}
+
+/// <summary>
+/// Wait for request completion. Result stays available until ring wraps around, 'slots' requests later
+/// </summary>
+/// <param name="sequence">Request sequence number</param>
+/// <param name="timeout">Wait timeout in ms</param>
+/// <returns>Pointer-sized function return value</returns>
+call_result_t<uint64_t> RemoteRing::Wait( uint32_t sequence, uint32_t timeout /*= 30 * 1000*/ )
+{
+    if (!valid())
+        return STATUS_INVALID_HANDLE;
+
+    // Slot was already reused
+    if (_pHeader->head - sequence > _pHeader->slotMask + 1 || _pHeader->head == sequence)
+        return STATUS_INVALID_PARAMETER;
+
+    NTSTATUS status = WaitDone( sequence + 1, timeout );
+    if (!NT_SUCCESS( status ))
+        return status;
+
+    return _pSlots[sequence & _pHeader->slotMask].result;
+}
+
+/// <summary>
+/// Execute call and wait for its result
+/// </summary>
+/// <param name="stub">Stub index</param>
+/// <param name="args">Call arguments</param>
+/// <param name="timeout">Wait timeout in ms</param>
+/// <returns>Pointer-sized function return value</returns>
+call_result_t<uint64_t> RemoteRing::Call( uint32_t stub, const std::vector<uint64_t>& args, uint32_t timeout /*= 30 * 1000*/ )
+{
+    auto sequence = Post( stub, args, timeout );
+    if (!sequence)
+        return sequence.status;
+
+    return Wait( sequence.result(), timeout );
+}
+
+/// <summary>
+/// Wait until 'count' requests are completed
+/// </summary>
+/// <param name="count">Required completed request counter value</param>
+/// <param name="timeout">Wait timeout in ms</param>
+/// <returns>Status code</returns>
+NTSTATUS RemoteRing::WaitDone( uint32_t count, uint32_t timeout )
+{
+    auto completed = [this, count]() { return static_cast<int32_t>(_pHeader->done - count) >= 0; };
+
+    // Short calls finish before it's worth to sleep
+    for (uint32_t i = 0; i < RingSpinCount; i++)
+    {
+        if (completed())
+            return STATUS_SUCCESS;
+
+        YieldProcessor();
+    }
+
+    NTSTATUS status = STATUS_SUCCESS;
+    auto start = GetTickCount64();
+
+    for (;;)
+    {
+        // Announce wait, then check again so completion posted meanwhile isn't missed
+        InterlockedExchange( reinterpret_cast<volatile LONG*>(&_pHeader->hostWaiting), 1 );
+        if (completed())
+            break;
+
+        auto elapsed = GetTickCount64() - start;
+        if (elapsed >= timeout)
+        {
+            status = STATUS_TIMEOUT;
+            break;
+        }
+
+        // Request will never complete if worker is gone
+        HANDLE handles[] = { _hDone, _worker->handle() };
+        if (WaitForMultipleObjects( 2, handles, FALSE, static_cast<DWORD>(timeout - elapsed) ) == WAIT_OBJECT_0 + 1 && !completed())
+        {
+            status = STATUS_THREAD_IS_TERMINATING;
+            break;
+        }
+    }
+
+    InterlockedExchange( reinterpret_cast<volatile LONG*>(&_pHeader->hostWaiting), 0 );
+    return status;
+}
+
+/// <summary>
+/// Generate worker thread code
+/// </summary>
+/// <param name="a">Target assembler</param>
+/// <returns>Status code</returns>
+NTSTATUS RemoteRing::GenWorker( IAsmHelper& a )
+{
+    auto type = _process.barrier().targetWow64 ? mt_mod32 : mt_mod64;
+    auto pWait = _process.modules().GetNtdllExport( "NtWaitForSingleObject", type );
+    auto pSetEvent = _process.modules().GetNtdllExport( "NtSetEvent", type );
+    auto pExitThread = _process.modules().GetNtdllExport( "NtTerminateThread", type );
+    if (!pWait)
+        return pWait.status;
+    if (!pSetEvent)
+        return pSetEvent.status;
+    if (!pExitThread)
+        return pExitThread.status;
+
+    auto l_loop = a->newLabel();
+    auto l_awake = a->newLabel();
+    auto l_work = a->newLabel();
+    auto l_bad = a->newLabel();
+    auto l_publish = a->newLabel();
+    auto l_exit = a->newLabel();
+
+    auto head = asmjit::host::dword_ptr( a->zbx, FIELD_OFFSET( RingHeader, head ) );
+    auto done = asmjit::host::dword_ptr( a->zbx, FIELD_OFFSET( RingHeader, done ) );
+    auto sleeping = asmjit::host::dword_ptr( a->zbx, FIELD_OFFSET( RingHeader, workerSleeping ) );
+    auto waiting = asmjit::host::dword_ptr( a->zbx, FIELD_OFFSET( RingHeader, hostWaiting ) );
+    auto stop = asmjit::host::dword_ptr( a->zbx, FIELD_OFFSET( RingHeader, stop ) );
+    auto mask = asmjit::host::dword_ptr( a->zbx, FIELD_OFFSET( RingHeader, slotMask ) );
+
+    /*
+        for (;;)
+        {
+            while (done == head)
+            {
+                workerSleeping = 1;
+                if (done == head && stop)
+                    ExitThread( 0 );
+                if (done == head)
+                    NtWaitForSingleObject( hRequest, FALSE, NULL );
+                workerSleeping = 0;
+            }
+
+            slot = &slots[done & slotMask];
+            slot->result = stubs[slot->stub]( slot->args );
+            done++;
+
+            if (hostWaiting)
+                NtSetEvent( hDone, NULL );
+        }
+    */
+    a->mov( a->zbx, _remoteBase );
+    a->bind( l_loop );
+    a->mov( asmjit::host::eax, done );
+    a->cmp( asmjit::host::eax, head );
+    a->jne( l_work );
+
+    // Ring is empty. Announce sleep, then check again so request posted meanwhile isn't missed
+    a->mov( asmjit::host::eax, 1 );
+    a->xchg( sleeping, asmjit::host::eax );
+    a->mov( asmjit::host::eax, done );
+    a->cmp( asmjit::host::eax, head );
+    a->jne( l_awake );
+    a->cmp( stop, 0 );
+    a->jne( l_exit );
+    a.GenCall( pWait->procAddress, { _hRemoteRequest, FALSE, 0 } );
+    a->bind( l_awake );
+    a->mov( sleeping, 0 );
+    a->jmp( l_loop );
+
+    // Current slot
+    a->bind( l_work );
+    a->and_( asmjit::host::eax, mask );
+    a->shl( asmjit::host::eax, 6 );
+    a->mov( a->zsi, a->zbx );
+    a->add( a->zsi, a->zax );
+    a->add( a->zsi, static_cast<int32_t>(sizeof( RingHeader )) );
+
+    // Stub address
+    a->mov( asmjit::host::eax, asmjit::host::dword_ptr( a->zsi, FIELD_OFFSET( RingSlot, stub ) ) );
+    a->cmp( asmjit::host::eax, MaxStubs );
+    a->jae( l_bad );
+    a->shl( asmjit::host::eax, 3 );
+    a->add( a->zax, a->zbx );
+    a->mov( a->zax, a->intptr_ptr( a->zax, FIELD_OFFSET( RingHeader, stubs ) ) );
+    a->test( a->zax, a->zax );
+    a->jz( l_bad );
+
+    a.GenCall( a->zax, {} );
+    a->mov( a->intptr_ptr( a->zsi, FIELD_OFFSET( RingSlot, result ) ), a->zax );
+    a->jmp( l_publish );
+
+    a->bind( l_bad );
+    a->mov( asmjit::host::eax, STATUS_INVALID_PARAMETER );
+    a->mov( a->intptr_ptr( a->zsi, FIELD_OFFSET( RingSlot, result ) ), a->zax );
+
+    // Publish completion, wake host if it sleeps
+    a->bind( l_publish );
+    a->mov( asmjit::host::eax, done );
+    a->inc( asmjit::host::eax );
+    a->xchg( done, asmjit::host::eax );
+    a->cmp( waiting, 0 );
+    a->je( l_loop );
+    a.GenCall( pSetEvent->procAddress, { _hRemoteDone, 0 } );
+    a->jmp( l_loop );
+
+    a->bind( l_exit );
+    a->xor_( asmjit::host::eax, asmjit::host::eax );
+    a.ExitThreadWithStatus( pExitThread->procAddress, 0 );
+
+    if (a->getCodeSize() > RingWorkerSize)
+        return STATUS_BUFFER_OVERFLOW;
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Duplicate local handle into target process
+/// </summary>
+/// <param name="hLocal">Local handle</param>
+/// <param name="hRemote">Target handle</param>
+/// <returns>Status code</returns>
+NTSTATUS RemoteRing::DuplicateToTarget( HANDLE hLocal, ptr_t& hRemote )
+{
+    HANDLE hDup = nullptr;
+    if (!DuplicateHandle( GetCurrentProcess(), hLocal, _process.core().handle(), &hDup, 0, FALSE, DUPLICATE_SAME_ACCESS ))
+        return LastNtStatus();
+
+    hRemote = reinterpret_cast<ptr_t>(hDup);
+    return STATUS_SUCCESS;
+}
+
+}
@@ -0,0 +1,163 @@
+#pragma once
+
+#include "../../Include/Winheaders.h"
+#include "../../Include/HandleGuard.h"
+#include "../../Include/CallResult.h"
+#include "../../Asm/AsmFactory.h"
+#include "../Threads/Threads.h"
+#include "../MemBlock.h"
+
+#include <vector>
+#include <stdint.h>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Remote call transport over a section shared with the target process.
+/// Host posts requests into a single producer/single consumer ring, dedicated target thread
+/// executes them by calling pre-registered stubs and writes results back into the same ring.
+/// Posting and collecting a call touches only local memory, events are signaled only if other side sleeps.
+/// Not thread safe, ring must be used from one host thread at a time
+/// </summary>
+class RemoteRing
+{
+public:
+    static constexpr uint32_t MaxStubs = 64;    // Registered stub limit
+    static constexpr uint32_t MaxArgs  = 6;     // Arguments per call
+
+public:
+    BLACKBONE_API RemoteRing( class Process& proc );
+    BLACKBONE_API ~RemoteRing();
+
+    /// <summary>
+    /// Map shared ring into target process and start worker thread serving it
+    /// </summary>
+    /// <param name="slots">Ring capacity, must be power of 2</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS Open( uint32_t slots = 64 );
+
+    /// <summary>
+    /// Stop worker thread and unmap shared ring
+    /// </summary>
+    BLACKBONE_API void Close();
+
+    /// <summary>
+    /// Register remote function callable through the ring
+    /// </summary>
+    /// <param name="pfn">Remote function address</param>
+    /// <param name="argCount">Number of function arguments</param>
+    /// <param name="cc">Calling convention, ignored for x64 target</param>
+    /// <returns>Stub index</returns>
+    BLACKBONE_API call_result_t<uint32_t> RegisterStub( ptr_t pfn, uint32_t argCount, eCalligConvention cc = cc_stdcall );
+
+    /// <summary>
+    /// Post call request without waiting for its completion. Blocks while ring is full
+    /// </summary>
+    /// <param name="stub">Stub index</param>
+    /// <param name="args">Call arguments</param>
+    /// <param name="timeout">Wait timeout in ms for a free slot</param>
+    /// <returns>Request sequence number</returns>
+    BLACKBONE_API call_result_t<uint32_t> Post( uint32_t stub, const std::vector<uint64_t>& args, uint32_t timeout = 30 * 1000 );
+
+    /// <summary>
+    /// Wait for request completion. Result stays available until ring wraps around, 'slots' requests later
+    /// </summary>
+    /// <param name="sequence">Request sequence number</param>
+    /// <param name="timeout">Wait timeout in ms</param>
+    /// <returns>Pointer-sized function return value</returns>
+    BLACKBONE_API call_result_t<uint64_t> Wait( uint32_t sequence, uint32_t timeout = 30 * 1000 );
+
+    /// <summary>
+    /// Execute call and wait for its result
+    /// </summary>
+    /// <param name="stub">Stub index</param>
+    /// <param name="args">Call arguments</param>
+    /// <param name="timeout">Wait timeout in ms</param>
+    /// <returns>Pointer-sized function return value</returns>
+    BLACKBONE_API call_result_t<uint64_t> Call( uint32_t stub, const std::vector<uint64_t>& args, uint32_t timeout = 30 * 1000 );
+
+    /// <summary>
+    /// Ring is mapped and worker is running
+    /// </summary>
+    BLACKBONE_API inline bool valid() const { return _pHeader != nullptr; }
+
+    /// <summary>
+    /// Worker thread
+    /// </summary>
+    BLACKBONE_API inline ThreadPtr worker() const { return _worker; }
+
+private:
+    /// <summary>
+    /// Single call request and its result
+    /// </summary>
+    struct RingSlot
+    {
+        uint32_t stub;                          // Stub index
+        uint32_t reserved;
+        uint64_t args[MaxArgs];                 // Call arguments
+        uint64_t result;                        // Return value, written by worker
+    };
+
+    /// <summary>
+    /// Shared ring header, slots follow it.
+    /// Producer and consumer indexes live in separate cache lines
+    /// </summary>
+    struct RingHeader
+    {
+        volatile uint32_t head;                 // Requests posted by host
+        uint8_t padding0[0x3C];
+        volatile uint32_t done;                 // Requests completed by worker
+        uint8_t padding1[0x3C];
+        volatile uint32_t workerSleeping;       // Worker waits for request event
+        volatile uint32_t hostWaiting;          // Host waits for completion event
+        volatile uint32_t stop;                 // Worker must exit once ring is empty
+        uint32_t slotMask;                      // Slot count - 1
+        uint8_t padding2[0x30];
+        uint64_t stubs[MaxStubs];               // Registered stub addresses
+    };
+
+    /// <summary>
+    /// Wait until 'count' requests are completed
+    /// </summary>
+    /// <param name="count">Required completed request counter value</param>
+    /// <param name="timeout">Wait timeout in ms</param>
+    /// <returns>Status code</returns>
+    NTSTATUS WaitDone( uint32_t count, uint32_t timeout );
+
+    /// <summary>
+    /// Generate worker thread code
+    /// </summary>
+    /// <param name="a">Target assembler</param>
+    /// <returns>Status code</returns>
+    NTSTATUS GenWorker( IAsmHelper& a );
+
+    /// <summary>
+    /// Duplicate local handle into target process
+    /// </summary>
+    /// <param name="hLocal">Local handle</param>
+    /// <param name="hRemote">Target handle</param>
+    /// <returns>Status code</returns>
+    NTSTATUS DuplicateToTarget( HANDLE hLocal, ptr_t& hRemote );
+
+    RemoteRing( const RemoteRing& ) = delete;
+    RemoteRing& operator =( const RemoteRing& ) = delete;
+
+private:
+    class Process& _process;                    // Target process
+
+    Handle      _hSection;                      // Shared ring section
+    RingHeader* _pHeader = nullptr;             // Local view of ring
+    RingSlot*   _pSlots = nullptr;              // Local view of ring slots
+    ptr_t       _remoteBase = 0;                // Ring view in target process
+    Handle      _hRequest;                      // Signaled when worker sleeps and request is posted
+    Handle      _hDone;                         // Signaled when host waits and request is completed
+    ptr_t       _hRemoteRequest = 0;            // _hRequest in target process
+    ptr_t       _hRemoteDone = 0;               // _hDone in target process
+    MemBlock    _code;                          // Worker loop and stub thunks
+    size_t      _codeUsed = 0;                  // Used code bytes
+    ThreadPtr   _worker;                        // Worker thread
+    uint32_t    _stubCount = 0;                 // Registered stubs
+};
+
+}
@@ -0,0 +1,150 @@
+#include "RemoteWorkerPool.h"
+#include "RemoteExec.h"
+#include "../Process.h"
+
+namespace blackbone
+{
+
+RemoteWorkerPool::Lease::Lease( Lease&& other )
+    : _pool( other._pool )
+    , _exec( other._exec )
+{
+    other._pool = nullptr;
+    other._exec = nullptr;
+}
+
+RemoteWorkerPool::Lease& RemoteWorkerPool::Lease::operator =( Lease&& other )
+{
+    if (this != &other)
+    {
+        release();
+        std::swap( _pool, other._pool );
+        std::swap( _exec, other._exec );
+    }
+
+    return *this;
+}
+
+RemoteWorkerPool::Lease::~Lease()
+{
+    release();
+}
+
+/// <summary>
+/// Return worker back to the pool
+/// </summary>
+void RemoteWorkerPool::Lease::release()
+{
+    if (_pool && _exec)
+        _pool->Release( _exec );
+
+    _pool = nullptr;
+    _exec = nullptr;
+}
+
+RemoteWorkerPool::RemoteWorkerPool( Process& proc )
+    : _process( proc )
+{
+}
+
+RemoteWorkerPool::~RemoteWorkerPool()
+{
+    Stop();
+}
+
+/// <summary>
+/// Create worker threads
+/// </summary>
+/// <param name="workers">Number of workers</param>
+/// <returns>Status code</returns>
+NTSTATUS RemoteWorkerPool::Start( uint32_t workers /*= 4*/ )
+{
+    if (valid())
+        return STATUS_SUCCESS;
+
+    if (workers == 0)
+        return STATUS_INVALID_PARAMETER;
+
+    _hIdle = CreateSemaphoreW( NULL, 0, workers, NULL );
+    if (!_hIdle)
+        return LastNtStatus();
+
+    for (uint32_t i = 0; i < workers; i++)
+    {
+        auto exec = std::make_unique<RemoteExec>( _process );
+        NTSTATUS status = exec->CreateRPCEnvironment( Worker_CreateNewEvent, true );
+        if (!NT_SUCCESS( status ))
+        {
+            Stop();
+            return status;
+        }
+
+        _workers.emplace_back( std::move( exec ) );
+    }
+
+    {
+        CSLock lck( _lock );
+        for (auto& exec : _workers)
+            _idle.emplace_back( exec.get() );
+    }
+
+    ReleaseSemaphore( _hIdle, workers, nullptr );
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Terminate all workers. All leases must be released
+/// </summary>
+void RemoteWorkerPool::Stop()
+{
+    CSLock lck( _lock );
+
+    _idle.clear();
+    _workers.clear();
+    _hIdle.reset();
+}
+
+/// <summary>
+/// Wait for idle worker and take exclusive access to it
+/// </summary>
+/// <param name="timeout">Wait timeout in ms</param>
+/// <returns>Worker lease</returns>
+call_result_t<RemoteWorkerPool::Lease> RemoteWorkerPool::Acquire( uint32_t timeout /*= 30 * 1000*/ )
+{
+    if (!valid())
+        return STATUS_INVALID_DEVICE_STATE;
+
+    DWORD result = WaitForSingleObject( _hIdle, timeout );
+    if (result == WAIT_TIMEOUT)
+        return STATUS_IO_TIMEOUT;
+    if (result != WAIT_OBJECT_0)
+        return LastNtStatus();
+
+    CSLock lck( _lock );
+
+    // Semaphore count always matches idle list
+    assert( !_idle.empty() );
+    if (_idle.empty())
+        return STATUS_INVALID_DEVICE_STATE;
+
+    auto exec = _idle.back();
+    _idle.pop_back();
+
+    return Lease( this, exec );
+}
+
+/// <summary>
+/// Return worker back to the pool
+/// </summary>
+/// <param name="exec">Worker</param>
+void RemoteWorkerPool::Release( RemoteExec* exec )
+{
+    {
+        CSLock lck( _lock );
+        _idle.emplace_back( exec );
+    }
+
+    ReleaseSemaphore( _hIdle, 1, nullptr );
+}
+
+}
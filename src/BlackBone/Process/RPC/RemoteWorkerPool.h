@@ -0,0 +1,110 @@
+#pragma once
+
+#include "../../Include/Winheaders.h"
+#include "../../Include/HandleGuard.h"
+#include "../../Include/CallResult.h"
+#include "../../Misc/Utils.h"
+
+#include <vector>
+#include <memory>
+#include <stdint.h>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Pool of RPC worker threads in target process.
+/// Every worker owns separate code, data and event slots, so independent calls
+/// issued from different host threads run in parallel. Thread safe
+/// </summary>
+class RemoteWorkerPool
+{
+public:
+    /// <summary>
+    /// Exclusive access to a pool worker, returned back to the pool on destruction
+    /// </summary>
+    class Lease
+    {
+    public:
+        Lease() = default;
+
+        BLACKBONE_API Lease( Lease&& other );
+        BLACKBONE_API Lease& operator =( Lease&& other );
+        BLACKBONE_API ~Lease();
+
+        /// <summary>
+        /// Return worker back to the pool
+        /// </summary>
+        BLACKBONE_API void release();
+
+        BLACKBONE_API inline class RemoteExec& operator *() const { return *_exec; }
+        BLACKBONE_API inline class RemoteExec* operator ->() const { return _exec; }
+        BLACKBONE_API inline explicit operator bool() const { return _exec != nullptr; }
+
+    private:
+        friend class RemoteWorkerPool;
+
+        Lease( RemoteWorkerPool* pool, class RemoteExec* exec )
+            : _pool( pool )
+            , _exec( exec ) { }
+
+        Lease( const Lease& ) = delete;
+        Lease& operator =( const Lease& ) = delete;
+
+    private:
+        RemoteWorkerPool* _pool = nullptr;
+        class RemoteExec* _exec = nullptr;
+    };
+
+public:
+    BLACKBONE_API RemoteWorkerPool( class Process& proc );
+    BLACKBONE_API ~RemoteWorkerPool();
+
+    /// <summary>
+    /// Create worker threads
+    /// </summary>
+    /// <param name="workers">Number of workers</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS Start( uint32_t workers = 4 );
+
+    /// <summary>
+    /// Terminate all workers. All leases must be released
+    /// </summary>
+    BLACKBONE_API void Stop();
+
+    /// <summary>
+    /// Wait for idle worker and take exclusive access to it
+    /// </summary>
+    /// <param name="timeout">Wait timeout in ms</param>
+    /// <returns>Worker lease</returns>
+    BLACKBONE_API call_result_t<Lease> Acquire( uint32_t timeout = 30 * 1000 );
+
+    /// <summary>
+    /// Number of workers
+    /// </summary>
+    BLACKBONE_API inline size_t size() const { return _workers.size(); }
+
+    /// <summary>
+    /// Pool was started
+    /// </summary>
+    BLACKBONE_API inline bool valid() const { return !_workers.empty(); }
+
+private:
+    /// <summary>
+    /// Return worker back to the pool
+    /// </summary>
+    /// <param name="exec">Worker</param>
+    void Release( class RemoteExec* exec );
+
+    RemoteWorkerPool( const RemoteWorkerPool& ) = delete;
+    RemoteWorkerPool& operator =( const RemoteWorkerPool& ) = delete;
+
+private:
+    class Process& _process;                                // Target process
+    std::vector<std::unique_ptr<class RemoteExec>> _workers;// Workers with own RPC environment
+    std::vector<class RemoteExec*> _idle;                   // Workers available for calls
+    Handle _hIdle;                                          // Semaphore counting idle workers
+    CriticalSection _lock;                                  // Idle list lock
+};
+
+}
@@ -0,0 +1,224 @@
+#include "RegionMap.h"
+#include "ProcessCore.h"
+
+#include <algorithm>
+
+namespace blackbone
+{
+
+RegionMap::RegionMap( ProcessCore& core )
+    : _core( core )
+{
+}
+
+/// <summary>
+/// Update map
+/// </summary>
+/// <param name="full">Re-walk whole address space instead of invalidated ranges only</param>
+/// <returns>Status code</returns>
+NTSTATUS RegionMap::Refresh( bool full /*= false*/ )
+{
+    CSLock lck( _lock );
+
+    if (full || !_valid)
+    {
+        _regions.clear();
+        _dirty.clear();
+        _valid = false;
+
+        auto status = Update( _core.native()->minAddr(), _core.native()->maxAddr() );
+        if (NT_SUCCESS( status ))
+            _valid = true;
+
+        return status;
+    }
+
+    auto dirty = std::move( _dirty );
+    _dirty.clear();
+
+    for (const auto& range : dirty)
+    {
+        auto status = Update( range.first, range.second );
+        if (!NT_SUCCESS( status ))
+        {
+            _valid = false;
+            return status;
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Mark range as changed. Range is re-queried on next Refresh
+/// </summary>
+/// <param name="address">Range start</param>
+/// <param name="size">Range size, 0 - whole allocation</param>
+void RegionMap::Invalidate( ptr_t address, ptr_t size )
+{
+    CSLock lck( _lock );
+
+    if (!_valid)
+        return;
+
+    ptr_t start = address & ~static_cast<ptr_t>(_core.native()->pageSize() - 1);
+    ptr_t end = address + std::max<ptr_t>( size, 1 );
+
+    // Released allocation, cover all its regions
+    if (size == 0)
+    {
+        auto iter = _regions.upper_bound( address );
+        if (iter != _regions.begin())
+        {
+            --iter;
+            const ptr_t allocBase = iter->second.AllocationBase;
+            for (; iter != _regions.end() && iter->second.State != MEM_FREE && iter->second.AllocationBase == allocBase; ++iter)
+                end = std::max( end, iter->second.BaseAddress + iter->second.RegionSize );
+        }
+    }
+
+    // Merge with overlapping or adjacent ranges
+    auto iter = _dirty.upper_bound( start );
+    if (iter != _dirty.begin() && std::prev( iter )->second >= start)
+        --iter;
+
+    while (iter != _dirty.end() && iter->first <= end)
+    {
+        start = std::min( start, iter->first );
+        end = std::max( end, iter->second );
+        iter = _dirty.erase( iter );
+    }
+
+    _dirty.emplace( start, end );
+}
+
+/// <summary>
+/// Drop map. Next Refresh will perform full walk
+/// </summary>
+void RegionMap::Reset()
+{
+    CSLock lck( _lock );
+
+    _regions.clear();
+    _dirty.clear();
+    _valid = false;
+}
+
+/// <summary>
+/// Find region containing address
+/// </summary>
+/// <param name="address">Address to look up</param>
+/// <param name="mbi">Found region</param>
+/// <returns>true if region was found</returns>
+bool RegionMap::Find( ptr_t address, MEMORY_BASIC_INFORMATION64& mbi )
+{
+    CSLock lck( _lock );
+
+    auto iter = _regions.upper_bound( address );
+    if (iter == _regions.begin())
+        return false;
+
+    --iter;
+    if (address >= iter->second.BaseAddress + iter->second.RegionSize)
+        return false;
+
+    mbi = iter->second;
+    return true;
+}
+
+/// <summary>
+/// Get all regions sorted by address
+/// </summary>
+/// <param name="includeFree">If true - non-allocated regions will be included in list</param>
+/// <returns>Region list</returns>
+std::vector<MEMORY_BASIC_INFORMATION64> RegionMap::regions( bool includeFree /*= false*/ )
+{
+    CSLock lck( _lock );
+
+    std::vector<MEMORY_BASIC_INFORMATION64> result;
+    result.reserve( _regions.size() );
+
+    for (const auto& entry : _regions)
+    {
+        if (includeFree || entry.second.State != MEM_FREE)
+            result.emplace_back( entry.second );
+    }
+
+    return result;
+}
+
+/// <summary>
+/// Re-query regions overlapping range
+/// </summary>
+/// <param name="start">Range start</param>
+/// <param name="end">Range end</param>
+/// <returns>Status code</returns>
+NTSTATUS RegionMap::Update( ptr_t start, ptr_t end )
+{
+    // Queries must start at region base, otherwise region would be split at query address
+    auto iter = _regions.upper_bound( start );
+    if (iter != _regions.begin())
+    {
+        --iter;
+        if (start < iter->second.BaseAddress + iter->second.RegionSize)
+            start = iter->first;
+    }
+
+    MEMORY_BASIC_INFORMATION64 mbi = { 0 };
+    for (ptr_t memptr = start; memptr < _core.native()->maxAddr(); memptr = mbi.BaseAddress + mbi.RegionSize)
+    {
+        // Stop at first known region boundary past the range
+        if (memptr >= end && _regions.count( memptr ) != 0)
+            break;
+
+        auto status = _core.native()->VirtualQueryExT( memptr, &mbi );
+        if (status == STATUS_INVALID_PARAMETER || status == STATUS_ACCESS_DENIED)
+            break;
+        else if (status != STATUS_SUCCESS)
+            return status;
+
+        // Drop stale regions covered by new one
+        auto first = _regions.lower_bound( memptr );
+        auto last = _regions.lower_bound( mbi.BaseAddress + mbi.RegionSize );
+        _regions.erase( first, last );
+
+        // Region is cut by previous stale region
+        auto prev = _regions.lower_bound( memptr );
+        if (prev != _regions.begin())
+        {
+            --prev;
+            auto& prevInfo = prev->second;
+            if (prevInfo.BaseAddress + prevInfo.RegionSize > memptr)
+                prevInfo.RegionSize = memptr - prevInfo.BaseAddress;
+        }
+
+        Insert( mbi );
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Insert region, merging it with identical preceding one
+/// </summary>
+/// <param name="mbi">Region info</param>
+void RegionMap::Insert( const MEMORY_BASIC_INFORMATION64& mbi )
+{
+    auto iter = _regions.lower_bound( mbi.BaseAddress );
+    if (iter != _regions.begin())
+    {
+        auto& prev = std::prev( iter )->second;
+        bool same = prev.State == mbi.State && prev.Protect == mbi.Protect && prev.Type == mbi.Type
+            && prev.AllocationBase == mbi.AllocationBase && prev.AllocationProtect == mbi.AllocationProtect;
+
+        if (same && prev.BaseAddress + prev.RegionSize == mbi.BaseAddress)
+        {
+            prev.RegionSize += mbi.RegionSize;
+            return;
+        }
+    }
+
+    _regions.emplace( mbi.BaseAddress, mbi );
+}
+
+}
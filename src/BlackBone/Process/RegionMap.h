@@ -0,0 +1,86 @@
+#pragma once
+
+#include "../Include/Winheaders.h"
+#include "../Include/Types.h"
+#include "../Misc/Utils.h"
+
+#include <map>
+#include <vector>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Cached map of process memory regions.
+/// Built once by full address space walk, later refreshes re-query only invalidated ranges.
+/// </summary>
+class RegionMap
+{
+public:
+    BLACKBONE_API RegionMap( class ProcessCore& core );
+    BLACKBONE_API ~RegionMap() = default;
+
+    /// <summary>
+    /// Update map
+    /// </summary>
+    /// <param name="full">Re-walk whole address space instead of invalidated ranges only</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS Refresh( bool full = false );
+
+    /// <summary>
+    /// Mark range as changed. Range is re-queried on next Refresh
+    /// </summary>
+    /// <param name="address">Range start</param>
+    /// <param name="size">Range size, 0 - whole allocation</param>
+    BLACKBONE_API void Invalidate( ptr_t address, ptr_t size );
+
+    /// <summary>
+    /// Drop map. Next Refresh will perform full walk
+    /// </summary>
+    BLACKBONE_API void Reset();
+
+    /// <summary>
+    /// Find region containing address
+    /// </summary>
+    /// <param name="address">Address to look up</param>
+    /// <param name="mbi">Found region</param>
+    /// <returns>true if region was found</returns>
+    BLACKBONE_API bool Find( ptr_t address, MEMORY_BASIC_INFORMATION64& mbi );
+
+    /// <summary>
+    /// Get all regions sorted by address
+    /// </summary>
+    /// <param name="includeFree">If true - non-allocated regions will be included in list</param>
+    /// <returns>Region list</returns>
+    BLACKBONE_API std::vector<MEMORY_BASIC_INFORMATION64> regions( bool includeFree = false );
+
+    /// <summary>
+    /// Check if map was built
+    /// </summary>
+    /// <returns>true if built</returns>
+    BLACKBONE_API inline bool valid() const { return _valid; }
+
+private:
+    /// <summary>
+    /// Re-query regions overlapping range
+    /// </summary>
+    /// <param name="start">Range start</param>
+    /// <param name="end">Range end</param>
+    /// <returns>Status code</returns>
+    NTSTATUS Update( ptr_t start, ptr_t end );
+
+    /// <summary>
+    /// Insert region, merging it with identical preceding one
+    /// </summary>
+    /// <param name="mbi">Region info</param>
+    void Insert( const MEMORY_BASIC_INFORMATION64& mbi );
+
+private:
+    class ProcessCore& _core;                               // Core routines
+    std::map<ptr_t, MEMORY_BASIC_INFORMATION64> _regions;   // Regions by base address
+    std::map<ptr_t, ptr_t> _dirty;                          // Invalidated ranges, start -> end
+    bool _valid = false;                                    // Map was built
+    CriticalSection _lock;                                  // Map lock
+};
+
+}
@@ -0,0 +1,253 @@
+#include "RemoteCodeHeap.h"
+#include "ProcessMemory.h"
+#include "../Misc/Trace.hpp"
+
+namespace blackbone
+{
+
+// Max distance of rel32 branch target, with margin for branch instruction itself
+constexpr int64_t MaxRel32Distance = 0x7FFF0000;
+
+RemoteCodeHeap::RemoteCodeHeap( ProcessMemory& memory )
+    : _memory( memory )
+{
+}
+
+RemoteCodeHeap::~RemoteCodeHeap()
+{
+    reset();
+}
+
+/// <summary>
+/// Allocate executable block. Block returns to heap when released
+/// </summary>
+/// <param name="size">Block size</param>
+/// <param name="nearest">Block must be within rel32 reach of this address, 0 if location doesn't matter</param>
+/// <returns>Memory block</returns>
+call_result_t<MemBlock> RemoteCodeHeap::Allocate( size_t size, ptr_t nearest /*= 0*/ )
+{
+    if (size == 0)
+        return STATUS_INVALID_PARAMETER;
+
+    size = Align( size, Granularity );
+
+    CSLock lck( _lock );
+
+    for (auto& slab : _slabs)
+    {
+        if (!Reachable( slab.base, slab.size, nearest ))
+            continue;
+
+        if (auto ptr = Take( slab, size ))
+            return Wrap( ptr, size );
+    }
+
+    // Large blocks get own slab, it is reused like any other
+    size_t slabSize = Align( size, SlabSize );
+    auto base = AllocateSlab( slabSize, nearest );
+    if (base == 0)
+        return STATUS_NO_MEMORY;
+
+    BLACKBONE_TRACE( L"RemoteCodeHeap: New slab of 0x%llx bytes at 0x%016llx", static_cast<uint64_t>(slabSize), base );
+
+    Slab slab;
+    slab.base = base;
+    slab.size = slabSize;
+    _slabs.emplace_back( std::move( slab ) );
+
+    return Wrap( Take( _slabs.back(), size ), size );
+}
+
+/// <summary>
+/// Release all slabs. Slabs with live blocks are left to the target process
+/// </summary>
+void RemoteCodeHeap::reset()
+{
+    CSLock lck( _lock );
+
+    for (auto& slab : _slabs)
+    {
+        // Code of released blocks, e.g. exception handlers, must stay
+        if (slab.live.empty())
+            _memory.Free( slab.base );
+    }
+
+    _slabs.clear();
+}
+
+/// <summary>
+/// Number of slabs allocated in target process
+/// </summary>
+/// <returns>Slab count</returns>
+size_t RemoteCodeHeap::slabCount()
+{
+    CSLock lck( _lock );
+    return _slabs.size();
+}
+
+/// <summary>
+/// Return block to heap
+/// </summary>
+/// <param name="ptr">Block address</param>
+void RemoteCodeHeap::Free( ptr_t ptr )
+{
+    CSLock lck( _lock );
+
+    for (auto& slab : _slabs)
+    {
+        if (ptr < slab.base || ptr >= slab.base + slab.size)
+            continue;
+
+        auto iter = slab.live.find( ptr );
+        if (iter == slab.live.end())
+            return;
+
+        size_t size = iter->second;
+        slab.live.erase( iter );
+
+        // Empty slab is rewound, its pages stay committed for next blocks
+        if (slab.live.empty())
+        {
+            slab.top = 0;
+            slab.free.clear();
+            return;
+        }
+
+        // Merge with following free block
+        auto next = slab.free.find( ptr + size );
+        if (next != slab.free.end())
+        {
+            size += next->second;
+            slab.free.erase( next );
+        }
+
+        // Merge with preceding free block
+        auto iterFree = slab.free.emplace( ptr, size ).first;
+        if (iterFree != slab.free.begin())
+        {
+            auto prev = std::prev( iterFree );
+            if (prev->first + prev->second == ptr)
+            {
+                prev->second += size;
+                slab.free.erase( iterFree );
+                iterFree = prev;
+            }
+        }
+
+        // Free block at the top lowers bump pointer
+        if (iterFree->first + iterFree->second == slab.base + slab.top)
+        {
+            slab.top = static_cast<size_t>(iterFree->first - slab.base);
+            slab.free.erase( iterFree );
+        }
+
+        return;
+    }
+}
+
+/// <summary>
+/// Make block returned to heap on release
+/// </summary>
+/// <param name="ptr">Block address</param>
+/// <param name="size">Block size</param>
+/// <returns>Memory block</returns>
+MemBlock RemoteCodeHeap::Wrap( ptr_t ptr, size_t size )
+{
+    MemBlock block( &_memory, ptr, size, PAGE_EXECUTE_READWRITE );
+    block._pImpl->_heap = this;
+    return block;
+}
+
+/// <summary>
+/// Take block from slab
+/// </summary>
+/// <param name="slab">Slab</param>
+/// <param name="size">Aligned block size</param>
+/// <returns>Block address, 0 if slab has no room</returns>
+ptr_t RemoteCodeHeap::Take( Slab& slab, size_t size )
+{
+    ptr_t ptr = 0;
+
+    // Released blocks first
+    for (auto iter = slab.free.begin(); iter != slab.free.end(); ++iter)
+    {
+        if (iter->second < size)
+            continue;
+
+        ptr = iter->first;
+        if (iter->second > size)
+            slab.free.emplace( ptr + size, iter->second - size );
+
+        slab.free.erase( iter );
+        break;
+    }
+
+    if (ptr == 0)
+    {
+        if (slab.top + size > slab.size)
+            return 0;
+
+        ptr = slab.base + slab.top;
+        slab.top += size;
+    }
+
+    slab.live.emplace( ptr, size );
+    return ptr;
+}
+
+/// <summary>
+/// Allocate new slab
+/// </summary>
+/// <param name="size">Slab size</param>
+/// <param name="nearest">Slab must be within rel32 reach of this address, 0 if location doesn't matter</param>
+/// <returns>Slab base, 0 on failure</returns>
+ptr_t RemoteCodeHeap::AllocateSlab( size_t size, ptr_t nearest )
+{
+    if (nearest == 0)
+    {
+        auto mem = _memory.Allocate( size, PAGE_EXECUTE_READWRITE, 0, false );
+        return mem ? mem->ptr() : 0;
+    }
+
+    // Walk regions around address for free range
+    ptr_t start = nearest > static_cast<ptr_t>(MaxRel32Distance) ? nearest - MaxRel32Distance : 0x10000;
+    ptr_t end = nearest + MaxRel32Distance;
+
+    for (ptr_t cursor = start; cursor < end;)
+    {
+        MEMORY_BASIC_INFORMATION64 mbi = { 0 };
+        if (!NT_SUCCESS( _memory.Query( cursor, &mbi ) ) || mbi.RegionSize == 0)
+            break;
+
+        ptr_t candidate = (mbi.BaseAddress + SlabSize - 1) & ~static_cast<ptr_t>(SlabSize - 1);
+        if (mbi.State == MEM_FREE && candidate + size <= mbi.BaseAddress + mbi.RegionSize && Reachable( candidate, size, nearest ))
+        {
+            // Range could've been taken meanwhile
+            auto mem = _memory.Allocate( size, PAGE_EXECUTE_READWRITE, candidate, false );
+            if (mem && mem.status == STATUS_SUCCESS)
+                return mem->ptr();
+
+            if (mem)
+                mem->Free();
+        }
+
+        cursor = mbi.BaseAddress + mbi.RegionSize;
+    }
+
+    return 0;
+}
+
+/// <summary>
+/// Check if whole slab is within rel32 reach of address
+/// </summary>
+bool RemoteCodeHeap::Reachable( ptr_t base, size_t size, ptr_t nearest )
+{
+    if (nearest == 0)
+        return true;
+
+    auto low = static_cast<int64_t>(base - nearest);
+    auto high = static_cast<int64_t>(base + size - nearest);
+    return low > -MaxRel32Distance && high < MaxRel32Distance;
+}
+
+}
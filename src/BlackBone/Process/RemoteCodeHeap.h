@@ -0,0 +1,107 @@
+#pragma once
+
+#include "../Include/Winheaders.h"
+#include "../Include/Types.h"
+#include "../Include/CallResult.h"
+#include "../Misc/Utils.h"
+#include "MemBlock.h"
+
+#include <map>
+#include <list>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Executable memory heap of target process.
+/// Code blocks are carved from 64KB RWX slabs by bump pointer, released blocks are reused
+/// and slab is rewound once it has no live blocks, so slab pages are never reprotected or freed while attached
+/// </summary>
+class RemoteCodeHeap
+{
+public:
+    static constexpr size_t Granularity = 0x10;     // Block alignment
+    static constexpr size_t SlabSize = 0x10000;     // Default slab size, equals system allocation granularity
+
+    BLACKBONE_API RemoteCodeHeap( class ProcessMemory& memory );
+    BLACKBONE_API ~RemoteCodeHeap();
+
+    /// <summary>
+    /// Allocate executable block. Block returns to heap when released
+    /// </summary>
+    /// <param name="size">Block size</param>
+    /// <param name="nearest">Block must be within rel32 reach of this address, 0 if location doesn't matter</param>
+    /// <returns>Memory block</returns>
+    BLACKBONE_API call_result_t<MemBlock> Allocate( size_t size, ptr_t nearest = 0 );
+
+    /// <summary>
+    /// Release all slabs. Slabs with live blocks are left to the target process
+    /// </summary>
+    BLACKBONE_API void reset();
+
+    /// <summary>
+    /// Number of slabs allocated in target process
+    /// </summary>
+    /// <returns>Slab count</returns>
+    BLACKBONE_API size_t slabCount();
+
+private:
+    friend class MemBlock::MemBlockImpl;
+
+    RemoteCodeHeap( const RemoteCodeHeap& ) = delete;
+    RemoteCodeHeap& operator =( const RemoteCodeHeap& ) = delete;
+
+    /// <summary>
+    /// Slab of executable memory
+    /// </summary>
+    struct Slab
+    {
+        ptr_t base = 0;
+        size_t size = 0;
+        size_t top = 0;                     // Bump pointer offset
+        std::map<ptr_t, size_t> live;       // Allocated blocks
+        std::map<ptr_t, size_t> free;       // Released blocks below top, coalesced
+    };
+
+    /// <summary>
+    /// Return block to heap
+    /// </summary>
+    /// <param name="ptr">Block address</param>
+    void Free( ptr_t ptr );
+
+    /// <summary>
+    /// Make block returned to heap on release
+    /// </summary>
+    /// <param name="ptr">Block address</param>
+    /// <param name="size">Block size</param>
+    /// <returns>Memory block</returns>
+    MemBlock Wrap( ptr_t ptr, size_t size );
+
+    /// <summary>
+    /// Take block from slab
+    /// </summary>
+    /// <param name="slab">Slab</param>
+    /// <param name="size">Aligned block size</param>
+    /// <returns>Block address, 0 if slab has no room</returns>
+    ptr_t Take( Slab& slab, size_t size );
+
+    /// <summary>
+    /// Allocate new slab
+    /// </summary>
+    /// <param name="size">Slab size</param>
+    /// <param name="nearest">Slab must be within rel32 reach of this address, 0 if location doesn't matter</param>
+    /// <returns>Slab base, 0 on failure</returns>
+    ptr_t AllocateSlab( size_t size, ptr_t nearest );
+
+    /// <summary>
+    /// Check if whole slab is within rel32 reach of address
+    /// </summary>
+    static bool Reachable( ptr_t base, size_t size, ptr_t nearest );
+
+private:
+    class ProcessMemory& _memory;       // Target process memory routines
+    std::list<Slab> _slabs;             // Allocated slabs
+    CriticalSection _lock;
+};
+
+}
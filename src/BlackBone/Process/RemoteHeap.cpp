@@ -0,0 +1,151 @@
+#include "RemoteHeap.h"
+#include "ProcessMemory.h"
+#include "../Misc/Trace.hpp"
+
+namespace blackbone
+{
+
+RemoteHeap::RemoteHeap( ProcessMemory& memory )
+    : _memory( memory )
+{
+}
+
+RemoteHeap::~RemoteHeap()
+{
+    reset();
+}
+
+/// <summary>
+/// Allocate read-write block. Block returns to heap when released
+/// </summary>
+/// <param name="size">Block size</param>
+/// <returns>Memory block</returns>
+call_result_t<MemBlock> RemoteHeap::Allocate( size_t size )
+{
+    if (size == 0)
+        return STATUS_INVALID_PARAMETER;
+
+    // Not worth a slab
+    if (size > MaxBlock)
+        return _memory.Allocate( size, PAGE_READWRITE );
+
+    size_t sizeClass = SizeClass( size );
+    size_t blockSize = ClassSize( sizeClass );
+
+    CSLock lck( _lock );
+
+    auto& freeList = _free[sizeClass];
+    if (!freeList.empty())
+    {
+        ptr_t ptr = freeList.back();
+        freeList.pop_back();
+
+        auto iter = std::prev( _slabs.upper_bound( ptr ) );
+        iter->second.live++;
+        return Wrap( ptr, blockSize );
+    }
+
+    ptr_t base = _current[sizeClass];
+    if (base == 0 || _slabs[base].top + blockSize > SlabSize)
+    {
+        auto mem = _memory.Allocate( SlabSize, PAGE_READWRITE, 0, false );
+        if (!mem)
+            return mem.status;
+
+        base = mem->ptr();
+        BLACKBONE_TRACE( L"RemoteHeap: New slab for 0x%llx byte blocks at 0x%016llx", static_cast<uint64_t>(blockSize), base );
+
+        Slab slab;
+        slab.sizeClass = sizeClass;
+        _slabs.emplace( base, slab );
+        _current[sizeClass] = base;
+    }
+
+    auto& slab = _slabs[base];
+    ptr_t ptr = base + slab.top;
+    slab.top += blockSize;
+    slab.live++;
+
+    return Wrap( ptr, blockSize );
+}
+
+/// <summary>
+/// Release all slabs. Slabs with live blocks are left to the target process
+/// </summary>
+void RemoteHeap::reset()
+{
+    CSLock lck( _lock );
+
+    for (auto& slab : _slabs)
+    {
+        if (slab.second.live == 0)
+            _memory.Free( slab.first );
+    }
+
+    _slabs.clear();
+    for (size_t i = 0; i < ClassCount; i++)
+    {
+        _free[i].clear();
+        _current[i] = 0;
+    }
+}
+
+/// <summary>
+/// Number of slabs allocated in target process
+/// </summary>
+/// <returns>Slab count</returns>
+size_t RemoteHeap::slabCount()
+{
+    CSLock lck( _lock );
+    return _slabs.size();
+}
+
+/// <summary>
+/// Return block to heap
+/// </summary>
+/// <param name="ptr">Block address</param>
+void RemoteHeap::Free( ptr_t ptr )
+{
+    CSLock lck( _lock );
+
+    // Slab could've been dropped by reset
+    auto iter = _slabs.upper_bound( ptr );
+    if (iter == _slabs.begin())
+        return;
+
+    --iter;
+    if (ptr >= iter->first + SlabSize || iter->second.live == 0)
+        return;
+
+    iter->second.live--;
+    _free[iter->second.sizeClass].emplace_back( ptr );
+}
+
+/// <summary>
+/// Make block returned to heap on release
+/// </summary>
+/// <param name="ptr">Block address</param>
+/// <param name="size">Block size</param>
+/// <returns>Memory block</returns>
+MemBlock RemoteHeap::Wrap( ptr_t ptr, size_t size )
+{
+    MemBlock block( &_memory, ptr, size, PAGE_READWRITE );
+    block._pImpl->_dataHeap = this;
+    return block;
+}
+
+/// <summary>
+/// Get size class of block
+/// </summary>
+/// <param name="size">Block size, must not exceed MaxBlock</param>
+/// <returns>Size class index</returns>
+size_t RemoteHeap::SizeClass( size_t size )
+{
+    size_t sizeClass = 0;
+    while (ClassSize( sizeClass ) < size)
+        sizeClass++;
+
+    return sizeClass;
+}
+
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include "../Include/Winheaders.h"
+#include "../Include/Types.h"
+#include "../Include/CallResult.h"
+#include "../Misc/Utils.h"
+#include "MemBlock.h"
+
+#include <map>
+#include <vector>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Read-write data heap of target process.
+/// Small blocks are carved from 64KB slabs, one slab serves single power-of-two size class.
+/// Released blocks go to free list of their class, slab pages are never freed while attached.
+/// Contents of reused blocks are not cleared
+/// </summary>
+class RemoteHeap
+{
+public:
+    static constexpr size_t MinBlock = 0x10;        // Smallest size class
+    static constexpr size_t MaxBlock = 0x1000;      // Largest size class, bigger blocks are allocated directly
+    static constexpr size_t SlabSize = 0x10000;     // Slab size, equals system allocation granularity
+    static constexpr size_t ClassCount = 9;         // Number of size classes, MinBlock..MaxBlock
+
+    BLACKBONE_API RemoteHeap( class ProcessMemory& memory );
+    BLACKBONE_API ~RemoteHeap();
+
+    /// <summary>
+    /// Allocate read-write block. Block returns to heap when released
+    /// </summary>
+    /// <param name="size">Block size</param>
+    /// <returns>Memory block</returns>
+    BLACKBONE_API call_result_t<MemBlock> Allocate( size_t size );
+
+    /// <summary>
+    /// Release all slabs. Slabs with live blocks are left to the target process
+    /// </summary>
+    BLACKBONE_API void reset();
+
+    /// <summary>
+    /// Number of slabs allocated in target process
+    /// </summary>
+    /// <returns>Slab count</returns>
+    BLACKBONE_API size_t slabCount();
+
+private:
+    friend class MemBlock::MemBlockImpl;
+
+    RemoteHeap( const RemoteHeap& ) = delete;
+    RemoteHeap& operator =( const RemoteHeap& ) = delete;
+
+    /// <summary>
+    /// Slab of single size class
+    /// </summary>
+    struct Slab
+    {
+        size_t sizeClass = 0;       // Size class index
+        size_t top = 0;             // Bump pointer offset
+        size_t live = 0;            // Number of allocated blocks
+    };
+
+    /// <summary>
+    /// Return block to heap
+    /// </summary>
+    /// <param name="ptr">Block address</param>
+    void Free( ptr_t ptr );
+
+    /// <summary>
+    /// Make block returned to heap on release
+    /// </summary>
+    /// <param name="ptr">Block address</param>
+    /// <param name="size">Block size</param>
+    /// <returns>Memory block</returns>
+    MemBlock Wrap( ptr_t ptr, size_t size );
+
+    /// <summary>
+    /// Get size class of block
+    /// </summary>
+    /// <param name="size">Block size, must not exceed MaxBlock</param>
+    /// <returns>Size class index</returns>
+    static size_t SizeClass( size_t size );
+
+    /// <summary>
+    /// Get block size of size class
+    /// </summary>
+    /// <param name="sizeClass">Size class index</param>
+    /// <returns>Block size</returns>
+    static constexpr size_t ClassSize( size_t sizeClass ) { return MinBlock << sizeClass; }
+
+private:
+    class ProcessMemory& _memory;               // Target process memory routines
+    std::map<ptr_t, Slab> _slabs;               // Allocated slabs by base
+    std::vector<ptr_t> _free[ClassCount];       // Released blocks of each size class
+    ptr_t _current[ClassCount] = { 0 };         // Slab with free space above top of each size class
+    CriticalSection _lock;
+};
+
+}
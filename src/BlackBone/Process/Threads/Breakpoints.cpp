@@ -0,0 +1,257 @@
+#include "Breakpoints.h"
+#include "Threads.h"
+#include "../ProcessCore.h"
+
+#include <algorithm>
+
+namespace blackbone
+{
+
+HWBPManager::HWBPManager( ProcessCore& core, ProcessThreads& threads )
+    : _core( core )
+    , _threads( threads )
+{
+}
+
+/// <summary>
+/// Set breakpoint in all process threads
+/// </summary>
+/// <param name="addr">Breakpoint address</param>
+/// <param name="type">Breakpoint type(read/write/execute)</param>
+/// <param name="length">Number of bytes to include into breakpoint</param>
+/// <returns>Debug register index</returns>
+call_result_t<int> HWBPManager::Add( ptr_t addr, HWBPType type, HWBPLength length )
+{
+    CSLock lck( _lock );
+
+    // Already present
+    auto iter = std::find_if( _slots.begin(), _slots.end(), [addr]( const Slot& slot ) { return slot.used && slot.address == addr; } );
+    if (iter != _slots.end())
+        return static_cast<int>(iter - _slots.begin());
+
+    auto free = std::find_if( _slots.begin(), _slots.end(), []( const Slot& slot ) { return !slot.used; } );
+    if (free == _slots.end())
+        return STATUS_NO_MORE_ENTRIES;
+
+    free->address = addr;
+    free->type = type;
+    free->length = length;
+    free->used = true;
+    _generation++;
+
+    return call_result_t<int>( static_cast<int>(free - _slots.begin()), Apply() );
+}
+
+/// <summary>
+/// Set several breakpoints in all process threads within single suspension
+/// </summary>
+/// <param name="addresses">Breakpoint addresses</param>
+/// <param name="type">Breakpoint type(read/write/execute)</param>
+/// <param name="length">Number of bytes to include into breakpoint</param>
+/// <param name="indices">Debug register index of each address, -1 if registers are exhausted</param>
+/// <returns>Status code</returns>
+NTSTATUS HWBPManager::Add( const std::vector<ptr_t>& addresses, HWBPType type, HWBPLength length, std::vector<int>& indices )
+{
+    CSLock lck( _lock );
+
+    NTSTATUS status = STATUS_SUCCESS;
+    bool changed = false;
+    indices.assign( addresses.size(), -1 );
+
+    for (size_t i = 0; i < addresses.size(); i++)
+    {
+        ptr_t addr = addresses[i];
+        auto iter = std::find_if( _slots.begin(), _slots.end(), [addr]( const Slot& slot ) { return slot.used && slot.address == addr; } );
+        if (iter == _slots.end())
+        {
+            iter = std::find_if( _slots.begin(), _slots.end(), []( const Slot& slot ) { return !slot.used; } );
+            if (iter == _slots.end())
+            {
+                status = STATUS_NO_MORE_ENTRIES;
+                continue;
+            }
+
+            iter->address = addr;
+            iter->type = type;
+            iter->length = length;
+            iter->used = true;
+            changed = true;
+        }
+
+        indices[i] = static_cast<int>(iter - _slots.begin());
+    }
+
+    if (!changed)
+        return status;
+
+    _generation++;
+
+    NTSTATUS applyStatus = Apply();
+    return NT_SUCCESS( applyStatus ) ? status : applyStatus;
+}
+
+/// <summary>
+/// Remove breakpoint from all process threads
+/// </summary>
+/// <param name="addr">Breakpoint address</param>
+/// <returns>Status code</returns>
+NTSTATUS HWBPManager::Remove( ptr_t addr )
+{
+    CSLock lck( _lock );
+
+    auto iter = std::find_if( _slots.begin(), _slots.end(), [addr]( const Slot& slot ) { return slot.used && slot.address == addr; } );
+    if (iter == _slots.end())
+        return STATUS_NOT_FOUND;
+
+    *iter = Slot();
+    _generation++;
+
+    return Apply();
+}
+
+/// <summary>
+/// Arm threads created since last update
+/// </summary>
+/// <returns>Status code</returns>
+NTSTATUS HWBPManager::Sync()
+{
+    CSLock lck( _lock );
+
+    for (auto& thread : _threads.getAll())
+    {
+        auto iter = _armed.find( thread->id() );
+        if (iter != _armed.end() && iter->second == _generation)
+            continue;
+
+        if (thread->id() == GetCurrentThreadId() || !thread->Suspend())
+            continue;
+
+        if (NT_SUCCESS( Write( *thread ) ))
+            _armed[thread->id()] = _generation;
+
+        thread->Resume();
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Arm single thread, e.g. from thread creation notification. Thread must be suspended
+/// </summary>
+/// <param name="thread">Target thread</param>
+/// <returns>Status code</returns>
+NTSTATUS HWBPManager::ArmThread( Thread& thread )
+{
+    CSLock lck( _lock );
+
+    NTSTATUS status = Write( thread );
+    if (NT_SUCCESS( status ))
+        _armed[thread.id()] = _generation;
+
+    return status;
+}
+
+/// <summary>
+/// Forget all breakpoints, thread registers are left intact
+/// </summary>
+void HWBPManager::reset()
+{
+    CSLock lck( _lock );
+
+    _slots.fill( Slot() );
+    _armed.clear();
+    _generation = 0;
+}
+
+/// <summary>
+/// Number of active breakpoints
+/// </summary>
+size_t HWBPManager::count() const
+{
+    CSLock lck( _lock );
+    return std::count_if( _slots.begin(), _slots.end(), []( const Slot& slot ) { return slot.used; } );
+}
+
+/// <summary>
+/// Write all debug registers to every thread within single suspension
+/// </summary>
+/// <returns>Status code</returns>
+NTSTATUS HWBPManager::Apply()
+{
+    // Map can't be updated while threads of current process are suspended
+    std::vector<std::pair<DWORD, NTSTATUS>> written;
+    written.reserve( _threads.getAll().size() + 0x10 );
+
+    NTSTATUS status = _threads.ForEachSuspended( [&]( const ThreadPtr& thread )
+    {
+        if (written.size() < written.capacity())
+            written.emplace_back( thread->id(), Write( *thread ) );
+    } );
+
+    // Exited threads are dropped
+    _armed.clear();
+    for (auto& item : written)
+    {
+        if (NT_SUCCESS( item.second ))
+            _armed.emplace( item.first, _generation );
+        else
+            status = item.second;
+    }
+
+    return status;
+}
+
+/// <summary>
+/// Write debug registers of a thread
+/// </summary>
+/// <param name="thread">Target thread</param>
+/// <returns>Status code</returns>
+NTSTATUS HWBPManager::Write( Thread& thread ) const
+{
+    uint64_t dr[4] = { 0 };
+    uint32_t dr7 = 0;
+    auto pDR7 = reinterpret_cast<regDR7*>(&dr7);
+
+    for (int i = 0; i < 4; i++)
+    {
+        if (!_slots[i].used)
+            continue;
+
+        dr[i] = _slots[i].address;
+        pDR7->setLocal( i, 1 );
+        pDR7->setRW( i, static_cast<char>(_slots[i].type) );
+        pDR7->setLen( i, static_cast<char>(_slots[i].length) );
+    }
+
+    pDR7->l_enable = pDR7->empty() ? 0 : 1;
+
+    NTSTATUS status = STATUS_SUCCESS;
+    if (!_core.native()->GetWow64Barrier().x86OS)
+    {
+        _CONTEXT64 context64 = { 0 };
+        context64.ContextFlags = CONTEXT64_DEBUG_REGISTERS;
+        context64.Dr0 = dr[0];
+        context64.Dr1 = dr[1];
+        context64.Dr2 = dr[2];
+        context64.Dr3 = dr[3];
+        context64.Dr7 = dr7;
+
+        status = thread.SetContext( context64, true );
+    }
+    else
+    {
+        _CONTEXT32 context32 = { 0 };
+        context32.ContextFlags = CONTEXT_DEBUG_REGISTERS;
+        context32.Dr0 = static_cast<uint32_t>(dr[0]);
+        context32.Dr1 = static_cast<uint32_t>(dr[1]);
+        context32.Dr2 = static_cast<uint32_t>(dr[2]);
+        context32.Dr3 = static_cast<uint32_t>(dr[3]);
+        context32.Dr7 = dr7;
+
+        status = thread.SetContext( context32, true );
+    }
+
+    return status;
+}
+
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "../../Include/Winheaders.h"
+#include "../../Include/CallResult.h"
+#include "../../Misc/Utils.h"
+#include "Thread.h"
+
+#include <array>
+#include <map>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Process-wide hardware breakpoints.
+/// DR0-DR3 assignment is kept locally and written to every thread as a whole,
+/// so threads are never queried for free debug registers
+/// </summary>
+class HWBPManager
+{
+public:
+    BLACKBONE_API HWBPManager( class ProcessCore& core, class ProcessThreads& threads );
+
+    HWBPManager( const HWBPManager& ) = delete;
+    HWBPManager& operator =( const HWBPManager& ) = delete;
+
+    /// <summary>
+    /// Set breakpoint in all process threads
+    /// </summary>
+    /// <param name="addr">Breakpoint address</param>
+    /// <param name="type">Breakpoint type(read/write/execute)</param>
+    /// <param name="length">Number of bytes to include into breakpoint</param>
+    /// <returns>Debug register index</returns>
+    BLACKBONE_API call_result_t<int> Add( ptr_t addr, HWBPType type, HWBPLength length );
+
+    /// <summary>
+    /// Set several breakpoints in all process threads within single suspension
+    /// </summary>
+    /// <param name="addresses">Breakpoint addresses</param>
+    /// <param name="type">Breakpoint type(read/write/execute)</param>
+    /// <param name="length">Number of bytes to include into breakpoint</param>
+    /// <param name="indices">Debug register index of each address, -1 if registers are exhausted</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS Add( const std::vector<ptr_t>& addresses, HWBPType type, HWBPLength length, std::vector<int>& indices );
+
+    /// <summary>
+    /// Remove breakpoint from all process threads
+    /// </summary>
+    /// <param name="addr">Breakpoint address</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS Remove( ptr_t addr );
+
+    /// <summary>
+    /// Arm threads created since last update
+    /// </summary>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS Sync();
+
+    /// <summary>
+    /// Arm single thread, e.g. from thread creation notification. Thread must be suspended
+    /// </summary>
+    /// <param name="thread">Target thread</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS ArmThread( Thread& thread );
+
+    /// <summary>
+    /// Forget all breakpoints, thread registers are left intact
+    /// </summary>
+    BLACKBONE_API void reset();
+
+    /// <summary>
+    /// Number of active breakpoints
+    /// </summary>
+    BLACKBONE_API size_t count() const;
+
+private:
+    /// <summary>
+    /// Debug register assignment
+    /// </summary>
+    struct Slot
+    {
+        ptr_t address = 0;
+        HWBPType type = hwbp_execute;
+        HWBPLength length = hwbp_1;
+        bool used = false;
+    };
+
+    /// <summary>
+    /// Write all debug registers to every thread within single suspension
+    /// </summary>
+    /// <returns>Status code</returns>
+    NTSTATUS Apply();
+
+    /// <summary>
+    /// Write debug registers of a thread
+    /// </summary>
+    /// <param name="thread">Target thread</param>
+    /// <returns>Status code</returns>
+    NTSTATUS Write( Thread& thread ) const;
+
+private:
+    class ProcessCore& _core;
+    class ProcessThreads& _threads;
+
+    std::array<Slot, 4> _slots;         // DR0-DR3
+    std::map<DWORD, uint32_t> _armed;   // Register generation written to each thread
+    uint32_t _generation = 0;           // Incremented on every assignment change
+    mutable CriticalSection _lock;
+};
+
+}
@@ -1,6 +1,7 @@
 #include "Threads.h"
 #include "../ProcessCore.h"
 #include "../../DriverControl/DriverControl.h"
+#include "../../Misc/DynImport.h"
 
 #include <memory>
 #include <random>
@@ -26,13 +27,25 @@ ProcessThreads::~ProcessThreads()
 /// <param name="flags">Thread creation flags</param>
 /// <returns>New thread object</returns>
 call_result_t<ThreadPtr> ProcessThreads::CreateNew( ptr_t threadProc, ptr_t arg, enum CreateThreadFlags flags /*= NoThreadFlags*/ )
+{
+    return CreateNew( threadProc, arg, ThreadCreateOptions( flags ) );
+}
+
+/// <summary>
+/// Create the thread with custom stack sizes
+/// </summary>
+/// <param name="threadProc">Thread enty point</param>
+/// <param name="arg">Thread argument.</param>
+/// <param name="options">Thread creation flags and stack sizes</param>
+/// <returns>New thread object</returns>
+call_result_t<ThreadPtr> ProcessThreads::CreateNew( ptr_t threadProc, ptr_t arg, const ThreadCreateOptions& options )
 {
     HANDLE hThd = NULL;
-    auto status = _core.native()->CreateRemoteThreadT( hThd, threadProc, arg, flags, THREAD_ALL_ACCESS );
+    auto status = _core.native()->CreateRemoteThreadT( hThd, threadProc, arg, options, THREAD_ALL_ACCESS );
     if (!NT_SUCCESS( status ))
     {
         // Ensure full thread access
-        status = _core.native()->CreateRemoteThreadT( hThd, threadProc, arg, flags, THREAD_QUERY_LIMITED_INFORMATION );
+        status = _core.native()->CreateRemoteThreadT( hThd, threadProc, arg, options, THREAD_QUERY_LIMITED_INFORMATION );
         if (NT_SUCCESS( status ))
         {
             if (Driver().loaded())
@@ -43,58 +56,124 @@ call_result_t<ThreadPtr> ProcessThreads::CreateNew( ptr_t threadProc, ptr_t arg,
     if (!NT_SUCCESS( status ))
         return status;
 
-    return std::make_shared<Thread>( hThd, &_core );
+    auto thread = std::make_shared<Thread>( hThd, &_core );
+
+    // Later queries reuse this handle
+    ThreadStats entry;
+    entry.thread = thread;
+    entry.createTime = static_cast<int64_t>(thread->startTime());
+
+    std::lock_guard<std::mutex> lg( _lock );
+    _cache[thread->id()] = entry;
+
+    return thread;
 }
 
 /// <summary>
-/// Gets all process threads
+/// Query times, state and priority of all process threads in one system call.
+/// Thread objects are reused between calls, so handles are opened once per thread
 /// </summary>
-/// <returns>Threads collection</returns>
-std::vector<ThreadPtr> ProcessThreads::getAll() const
+/// <returns>Thread statistics</returns>
+std::vector<ThreadStats> ProcessThreads::stats() const
 {
-    std::vector<ThreadPtr> result;
-    auto hThreadSnapshot = Handle( CreateToolhelp32Snapshot( TH32CS_SNAPTHREAD, 0 ) );
-    if (!hThreadSnapshot)
+    std::vector<ThreadStats> result;
+    std::vector<uint8_t> buffer( 0x40000 );
+    ULONG returnLength = 0;
+
+    // Extended process information, thread list grows between calls
+    NTSTATUS status = STATUS_INFO_LENGTH_MISMATCH;
+    while (status == STATUS_INFO_LENGTH_MISMATCH)
+    {
+        status = SAFE_NATIVE_CALL(
+            NtQuerySystemInformation, (SYSTEM_INFORMATION_CLASS)57,
+            buffer.data(), static_cast<ULONG>(buffer.size()), &returnLength
+            );
+
+        if (status == STATUS_INFO_LENGTH_MISMATCH)
+            buffer.resize( returnLength + 0x1000 );
+    }
+
+    if (!NT_SUCCESS( status ))
         return result;
-   
-    THREADENTRY32 tEntry = { 0 };
-    tEntry.dwSize = sizeof( THREADENTRY32 );
-
-    // Iterate threads
-    for (BOOL success = Thread32First( hThreadSnapshot, &tEntry );
-        success != FALSE;
-        success = Thread32Next( hThreadSnapshot, &tEntry ))
+
+    using PROCESS_INFO = _SYSTEM_PROCESS_INFORMATION_T<DWORD_PTR>;
+    for (auto pInfo = reinterpret_cast<PROCESS_INFO*>(buffer.data());;)
     {
-        if (tEntry.th32OwnerProcessID != _core.pid())
-            continue;
+        if (pInfo->UniqueProcessId == _core.pid())
+        {
+            std::lock_guard<std::mutex> lg( _lock );
+            std::map<DWORD, ThreadStats> alive;
 
-        result.emplace_back( std::make_shared<Thread>( tEntry.th32ThreadID, &_core ) );
+            for (ULONG i = 0; i < pInfo->NumberOfThreads; i++)
+            {
+                auto& ext = pInfo->Threads[i];
+                auto& thd = ext.ThreadInfo;
+                auto tid = static_cast<DWORD>(thd.ClientId.UniqueThread);
+
+                // Reuse opened thread unless ID belongs to new thread now
+                ThreadStats entry;
+                auto iter = _cache.find( tid );
+                if (iter != _cache.end() && iter->second.createTime == thd.CreateTime.QuadPart)
+                    entry.thread = iter->second.thread;
+                else
+                    entry.thread = std::make_shared<Thread>( tid, &_core );
+
+                entry.createTime = thd.CreateTime.QuadPart;
+                entry.kernelTime = thd.KernelTime.QuadPart;
+                entry.userTime = thd.UserTime.QuadPart;
+                entry.startAddress = ext.Win32StartAddress ? ext.Win32StartAddress : thd.StartAddress;
+                entry.teb = ext.TebBase;
+                entry.waitTime = thd.WaitTime;
+                entry.contextSwitches = thd.ContextSwitches;
+                entry.state = thd.ThreadState;
+                entry.waitReason = thd.WaitReason;
+                entry.priority = thd.Priority;
+                entry.basePriority = thd.BasePriority;
+
+                alive.emplace( tid, entry );
+                result.emplace_back( entry );
+            }
+
+            // Exited threads are dropped
+            _cache.swap( alive );
+            break;
+        }
+
+        if (pInfo->NextEntryOffset)
+            pInfo = reinterpret_cast<PROCESS_INFO*>(reinterpret_cast<uint8_t*>(pInfo) + pInfo->NextEntryOffset);
+        else
+            break;
     }
 
     return result;
 }
 
+/// <summary>
+/// Gets all process threads
+/// </summary>
+/// <returns>Threads collection</returns>
+std::vector<ThreadPtr> ProcessThreads::getAll() const
+{
+    std::vector<ThreadPtr> result;
+    for (auto& entry : stats())
+        result.emplace_back( entry.thread );
+
+    return result;
+}
+
 /// <summary>
 /// Get main process thread
 /// </summary>
 /// <returns>Pointer to thread object, nullptr if failed</returns>
 ThreadPtr ProcessThreads::getMain() const
 {
-    uint64_t mintime = MAXULONG64_2;
-    auto threads = getAll();
-    ThreadPtr result = !threads.empty() ? threads.front() : threads.front();
-
-    for (const auto& thread : threads)
+    auto threads = stats();
+    auto iter = std::min_element( threads.begin(), threads.end(), []( const auto& l, const auto& r )
     {
-        uint64_t time = thread->startTime();
-        if (time < mintime)
-        {
-            mintime = time;
-            result = thread;
-        }
-    }
+        return l.createTime < r.createTime;
+    } );
 
-    return result;
+    return iter != threads.end() ? iter->thread : nullptr;
 }
 
 /// <summary>
@@ -103,21 +182,13 @@ ThreadPtr ProcessThreads::getMain() const
 /// <returns>Pointer to thread object, nullptr if failed</returns>
 ThreadPtr ProcessThreads::getLeastExecuted() const
 {
-    uint64_t mintime = MAXULONG64_2;
-    auto threads = getAll();
-    ThreadPtr result = !threads.empty() ? threads.front() : threads.front();
-
-    for (const auto& thread : threads)
+    auto threads = stats();
+    auto iter = std::min_element( threads.begin(), threads.end(), []( const auto& l, const auto& r )
     {
-        uint64_t time = thread->execTime();
-        if (time < mintime)
-        {
-            mintime = time;
-            result = thread;
-        }
-    }
+        return l.execTime() < r.execTime();
+    } );
 
-    return result;
+    return iter != threads.end() ? iter->thread : nullptr;
 }
 
 /// <summary>
@@ -127,19 +198,17 @@ ThreadPtr ProcessThreads::getLeastExecuted() const
 ThreadPtr ProcessThreads::getMostExecuted() const
 {
     uint64_t maxtime = 0;
-    auto threads = getAll();
-    ThreadPtr result = !threads.empty() ? threads.front() : threads.front();
+    ThreadPtr result;
 
-    for (const auto& thread : threads)
+    for (const auto& entry : stats())
     {
-        if (thread->id() == GetCurrentThreadId())
+        if (entry.thread->id() == GetCurrentThreadId())
             continue;
 
-        uint64_t time = thread->execTime();
-        if (thread->id() != GetCurrentThreadId() && time >= maxtime)
+        if (!result || entry.execTime() >= maxtime)
         {
-            maxtime = time;
-            result = thread;
+            maxtime = entry.execTime();
+            result = entry.thread;
         }
     }
 
@@ -152,14 +221,14 @@ ThreadPtr ProcessThreads::getMostExecuted() const
 /// <returns>Pointer to thread object, nullptr if failed</returns>
 ThreadPtr ProcessThreads::getRandom() const
 {
-    auto threads = getAll();
+    auto threads = stats();
     if (threads.empty())
         return nullptr;
 
     static std::random_device rd;
     std::uniform_int_distribution<size_t> dist( 0, threads.size() - 1 );
 
-    return threads[dist(rd)];
+    return threads[dist(rd)].thread;
 }
 
 /// <summary>
@@ -168,11 +237,191 @@ ThreadPtr ProcessThreads::getRandom() const
 /// <param name="id">Thread ID</param>
 /// <returns>Pointer to thread object, nullptr if failed</returns>
 ThreadPtr ProcessThreads::get( DWORD id ) const
+{
+    // Live thread from handle table
+    {
+        std::lock_guard<std::mutex> lg( _lock );
+        auto iter = _cache.find( id );
+        if (iter != _cache.end())
+        {
+            if (iter->second.thread->valid())
+                return iter->second.thread;
+
+            // Purge exited thread, ID may belong to a new thread now
+            _cache.erase( iter );
+        }
+    }
+
+    auto threads = stats();
+    auto iter = std::find_if( threads.begin(), threads.end(), [id]( const auto& entry ) { return entry.thread->id() == id; } );
+
+    return iter != threads.end() ? iter->thread : nullptr;
+}
+
+/// <summary>
+/// Get threads ordered by hijack suitability: waiting on user requests first,
+/// then ready or running threads, most executed first. Calling thread is excluded
+/// </summary>
+/// <returns>Threads, best candidate first</returns>
+std::vector<ThreadPtr> ProcessThreads::getHijackCandidates() const
+{
+    auto rank = []( const ThreadStats& thd ) -> int
+    {
+        // KTHREAD_STATE Waiting, KWAIT_REASON: DelayExecution, UserRequest, WrUserRequest.
+        // Such waits are usually alertable and return to user mode right away
+        if (thd.state == 5 && (thd.waitReason == 4 || thd.waitReason == 6 || thd.waitReason == 13))
+            return 0;
+
+        // KTHREAD_STATE: Ready, Running, Standby
+        if (thd.state == 1 || thd.state == 2 || thd.state == 3)
+            return 1;
+
+        return 2;
+    };
+
+    auto threads = stats();
+    std::stable_sort( threads.begin(), threads.end(), [&rank]( const ThreadStats& l, const ThreadStats& r )
+    {
+        int rl = rank( l ), rr = rank( r );
+        return rl != rr ? rl < rr : l.execTime() > r.execTime();
+    } );
+
+    std::vector<ThreadPtr> result;
+    for (auto& thd : threads)
+        if (thd.thread->id() != GetCurrentThreadId())
+            result.emplace_back( thd.thread );
+
+    return result;
+}
+
+/// <summary>
+/// Suspend all threads at once, run callback for every thread and resume them.
+/// Whole process is suspended with single call if possible, calling thread is never suspended.
+/// For current process callback must not allocate memory or take locks other threads may hold
+/// </summary>
+/// <param name="fn">Callback invoked for every suspended thread</param>
+/// <returns>Status code</returns>
+NTSTATUS ProcessThreads::ForEachSuspended( const std::function<void( const ThreadPtr& )>& fn ) const
 {
     auto threads = getAll();
-    auto iter = std::find_if( threads.begin(), threads.end(), [id]( const auto& thread ) { return thread->id() == id; } );
+    if (threads.empty())
+        return STATUS_NOT_FOUND;
+
+    // Own process can't be suspended as whole
+    bool wholeProcess = _core.pid() != GetCurrentProcessId() &&
+        NT_SUCCESS( SAFE_NATIVE_CALL( NtSuspendProcess, _core.handle() ) );
+
+    std::vector<ThreadPtr> suspended;
+    if (!wholeProcess)
+    {
+        for (auto& thread : threads)
+            if (thread->id() != GetCurrentThreadId() && thread->Suspend())
+                suspended.emplace_back( thread );
+    }
+
+    for (auto& thread : (wholeProcess ? threads : suspended))
+        if (thread->id() != GetCurrentThreadId())
+            fn( thread );
+
+    if (wholeProcess)
+        SAFE_NATIVE_CALL( NtResumeProcess, _core.handle() );
+    else
+        for (auto& thread : suspended)
+            thread->Resume();
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Get contexts of all threads within single suspension
+/// </summary>
+/// <param name="contexts">Captured contexts</param>
+/// <param name="flags64">Native context flags, 0 to skip</param>
+/// <param name="flags32">WOW64 context flags, 0 to skip</param>
+/// <returns>Status code</returns>
+NTSTATUS ProcessThreads::CaptureContexts( std::vector<ThreadContext>& contexts, DWORD flags64, DWORD flags32 /*= 0*/ ) const
+{
+    contexts.clear();
 
-    return iter != threads.end() ? *iter : nullptr;
+    return ForEachSuspended( [&]( const ThreadPtr& thread )
+    {
+        ThreadContext context;
+        context.thread = thread;
+
+        if (flags64 != 0)
+            context.status = thread->GetContext( context.ctx64, flags64, true );
+        if (flags32 != 0 && NT_SUCCESS( context.status ))
+            context.status = thread->GetContext( context.ctx32, flags32, true );
+
+        contexts.emplace_back( context );
+    } );
+}
+
+/// <summary>
+/// Set contexts of multiple threads within single suspension
+/// </summary>
+/// <param name="contexts">Contexts to apply, status field is updated</param>
+/// <returns>Status code</returns>
+NTSTATUS ProcessThreads::ApplyContexts( std::vector<ThreadContext>& contexts ) const
+{
+    std::map<DWORD, ThreadContext*> byId;
+    for (auto& context : contexts)
+        if (context.thread)
+            byId.emplace( context.thread->id(), &context );
+
+    return ForEachSuspended( [&]( const ThreadPtr& thread )
+    {
+        auto iter = byId.find( thread->id() );
+        if (iter == byId.end())
+            return;
+
+        auto& context = *iter->second;
+        context.status = STATUS_SUCCESS;
+
+        if (context.ctx64.ContextFlags != 0)
+            context.status = thread->SetContext( context.ctx64, true );
+        if (context.ctx32.ContextFlags != 0 && NT_SUCCESS( context.status ))
+            context.status = thread->SetContext( context.ctx32, true );
+    } );
 }
 
-}
\ No newline at end of file
+/// <summary>
+/// Get thread from handle table without querying thread list.
+/// Handle is opened once and shared until thread exits
+/// </summary>
+/// <param name="id">Thread ID</param>
+/// <returns>Pointer to thread object, handle is invalid if thread can't be opened</returns>
+ThreadPtr ProcessThreads::open( DWORD id ) const
+{
+    std::lock_guard<std::mutex> lg( _lock );
+
+    auto iter = _cache.find( id );
+    if (iter != _cache.end())
+    {
+        if (iter->second.thread->valid())
+            return iter->second.thread;
+
+        _cache.erase( iter );
+    }
+
+    ThreadStats entry;
+    entry.thread = std::make_shared<Thread>( id, &_core );
+    entry.createTime = static_cast<int64_t>(entry.thread->startTime());
+
+    // Don't keep threads that can't be opened
+    if (entry.thread->handle())
+        _cache.emplace( id, entry );
+
+    return entry.thread;
+}
+
+/// <summary>
+/// Drop cached thread objects
+/// </summary>
+void ProcessThreads::reset()
+{
+    std::lock_guard<std::mutex> lg( _lock );
+    _cache.clear();
+}
+
+}
@@ -4,11 +4,45 @@
 #include "Thread.h"
 
 #include <vector>
+#include <map>
 #include <mutex>
+#include <functional>
 
 namespace blackbone
 {
 
+/// <summary>
+/// Thread state captured by system process information query
+/// </summary>
+struct ThreadStats
+{
+    ThreadPtr thread;
+    int64_t  createTime = 0;        // Creation time, 100ns units
+    uint64_t kernelTime = 0;        // Time spent in kernel mode, 100ns units
+    uint64_t userTime = 0;          // Time spent in user mode, 100ns units
+    uint64_t startAddress = 0;      // Start address
+    uint64_t teb = 0;               // TEB address
+    uint32_t waitTime = 0;          // Time spent in current wait, ticks
+    uint32_t contextSwitches = 0;   // Number of context switches
+    uint32_t state = 0;             // KTHREAD_STATE
+    uint32_t waitReason = 0;        // KWAIT_REASON, valid for waiting thread
+    int32_t  priority = 0;          // Dynamic priority
+    int32_t  basePriority = 0;      // Base priority
+
+    inline uint64_t execTime() const { return kernelTime + userTime; }
+};
+
+/// <summary>
+/// Thread context captured or applied in bulk
+/// </summary>
+struct ThreadContext
+{
+    ThreadPtr thread;
+    _CONTEXT64 ctx64 = { 0 };           // Native context, used if ctx64.ContextFlags isn't 0
+    _CONTEXT32 ctx32 = { 0 };           // WOW64 context, used if ctx32.ContextFlags isn't 0
+    NTSTATUS status = STATUS_SUCCESS;   // Last operation status
+};
+
 class ProcessThreads
 {
 public:
@@ -31,6 +65,19 @@ public:
         enum CreateThreadFlags flags = static_cast<CreateThreadFlags>(0)
     );
 
+    /// <summary>
+    /// Create the thread with custom stack sizes
+    /// </summary>
+    /// <param name="threadProc">Thread enty point</param>
+    /// <param name="arg">Thread argument.</param>
+    /// <param name="options">Thread creation flags and stack sizes</param>
+    /// <returns>New thread object</returns>
+    BLACKBONE_API call_result_t<ThreadPtr> CreateNew(
+        ptr_t threadProc,
+        ptr_t arg,
+        const ThreadCreateOptions& options
+    );
+
     /// <summary>
     /// Gets all process threads
     /// </summary>
@@ -68,8 +115,63 @@ public:
     /// <returns>Pointer to thread object, nullptr if failed</returns>
     BLACKBONE_API ThreadPtr get( DWORD id ) const;
 
+    /// <summary>
+    /// Get thread from handle table without querying thread list.
+    /// Handle is opened once and shared until thread exits
+    /// </summary>
+    /// <param name="id">Thread ID</param>
+    /// <returns>Pointer to thread object, handle is invalid if thread can't be opened</returns>
+    BLACKBONE_API ThreadPtr open( DWORD id ) const;
+
+    /// <summary>
+    /// Suspend all threads at once, run callback for every thread and resume them.
+    /// Whole process is suspended with single call if possible, calling thread is never suspended.
+    /// For current process callback must not allocate memory or take locks other threads may hold
+    /// </summary>
+    /// <param name="fn">Callback invoked for every suspended thread</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS ForEachSuspended( const std::function<void( const ThreadPtr& )>& fn ) const;
+
+    /// <summary>
+    /// Get contexts of all threads within single suspension
+    /// </summary>
+    /// <param name="contexts">Captured contexts</param>
+    /// <param name="flags64">Native context flags, 0 to skip</param>
+    /// <param name="flags32">WOW64 context flags, 0 to skip</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS CaptureContexts( std::vector<ThreadContext>& contexts, DWORD flags64, DWORD flags32 = 0 ) const;
+
+    /// <summary>
+    /// Set contexts of multiple threads within single suspension
+    /// </summary>
+    /// <param name="contexts">Contexts to apply, status field is updated</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS ApplyContexts( std::vector<ThreadContext>& contexts ) const;
+
+    /// <summary>
+    /// Drop cached thread objects
+    /// </summary>
+    BLACKBONE_API void reset();
+
+    /// <summary>
+    /// Query times, state and priority of all process threads in one system call.
+    /// Thread objects are reused between calls, so handles are opened once per thread
+    /// </summary>
+    /// <returns>Thread statistics</returns>
+    BLACKBONE_API std::vector<ThreadStats> stats() const;
+
+    /// <summary>
+    /// Get threads ordered by hijack suitability: waiting on user requests first,
+    /// then ready or running threads, most executed first. Calling thread is excluded
+    /// </summary>
+    /// <returns>Threads, best candidate first</returns>
+    BLACKBONE_API std::vector<ThreadPtr> getHijackCandidates() const;
+
 private:
     class ProcessCore& _core;   // Core process functions
+
+    mutable std::map<DWORD, ThreadStats> _cache;    // Handle table, opened threads by ID
+    mutable std::mutex _lock;                       // Cache lock
 };
 
 }
\ No newline at end of file
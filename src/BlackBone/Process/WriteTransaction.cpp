@@ -0,0 +1,164 @@
+#include "WriteTransaction.h"
+#include "ProcessMemory.h"
+#include "ProcessCore.h"
+
+#include <algorithm>
+
+namespace blackbone
+{
+
+WriteTransaction::WriteTransaction( ProcessMemory& memory )
+    : _memory( &memory )
+{
+}
+
+/// <summary>
+/// Buffer write. Later writes overwrite earlier ones
+/// </summary>
+/// <param name="address">Memory address to write to</param>
+/// <param name="size">Size of data to write</param>
+/// <param name="data">Buffer to write</param>
+/// <returns>Status code</returns>
+NTSTATUS WriteTransaction::Write( ptr_t address, size_t size, const void* data )
+{
+    if (address == 0 || data == nullptr)
+        return STATUS_INVALID_PARAMETER;
+    if (size == 0)
+        return STATUS_SUCCESS;
+
+    ptr_t start = address;
+    ptr_t end = address + size;
+
+    // Find first range that overlaps or touches new one
+    auto first = _ranges.upper_bound( address );
+    if (first != _ranges.begin())
+    {
+        auto prev = std::prev( first );
+        if (prev->first + prev->second.size() >= address)
+            first = prev;
+    }
+
+    // Extend new range over all touched ones
+    auto last = first;
+    for (; last != _ranges.end() && last->first <= end; ++last)
+    {
+        start = std::min( start, last->first );
+        end = std::max( end, last->first + last->second.size() );
+    }
+
+    // Fast path - new data fits into existing range
+    if (first != last && std::next( first ) == last && first->first == start && first->first + first->second.size() == end)
+    {
+        memcpy( first->second.data() + (address - start), data, size );
+        return STATUS_SUCCESS;
+    }
+
+    std::vector<uint8_t> merged( static_cast<size_t>(end - start) );
+    for (auto iter = first; iter != last; ++iter)
+        memcpy( merged.data() + (iter->first - start), iter->second.data(), iter->second.size() );
+
+    memcpy( merged.data() + (address - start), data, size );
+
+    _ranges.erase( first, last );
+    _ranges.emplace( start, std::move( merged ) );
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Flush buffered ranges into target process
+/// </summary>
+/// <param name="forceWritable">
+/// Temporarily make non-writable pages writable.
+/// Protection is changed once per range region, not once per write
+/// </param>
+/// <returns>STATUS_SUCCESS if all ranges were written, otherwise status of first failed range</returns>
+NTSTATUS WriteTransaction::Commit( bool forceWritable /*= false*/ )
+{
+    NTSTATUS result = STATUS_SUCCESS;
+
+    for (const auto& range : _ranges)
+    {
+        auto status = forceWritable
+            ? WriteWritable( range.first, range.second )
+            : _memory->Write( range.first, range.second.size(), range.second.data() );
+
+        if (!NT_SUCCESS( status ) && NT_SUCCESS( result ))
+            result = status;
+    }
+
+    _ranges.clear();
+    return result;
+}
+
+/// <summary>
+/// Drop buffered writes
+/// </summary>
+void WriteTransaction::Discard()
+{
+    _ranges.clear();
+}
+
+/// <summary>
+/// Number of buffered bytes
+/// </summary>
+/// <returns>Buffered size</returns>
+size_t WriteTransaction::size() const
+{
+    size_t total = 0;
+    for (const auto& range : _ranges)
+        total += range.second.size();
+
+    return total;
+}
+
+/// <summary>
+/// Write single range, changing page protection if required
+/// </summary>
+/// <param name="address">Range start</param>
+/// <param name="data">Range data</param>
+/// <returns>Status code</returns>
+NTSTATUS WriteTransaction::WriteWritable( ptr_t address, const std::vector<uint8_t>& data )
+{
+    constexpr DWORD writable = PAGE_READWRITE | PAGE_WRITECOPY | PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY;
+    constexpr DWORD executable = PAGE_EXECUTE | PAGE_EXECUTE_READ | PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY;
+
+    struct Restore
+    {
+        ptr_t address;
+        size_t size;
+        DWORD protection;
+    };
+
+    std::vector<Restore> restore;
+    const ptr_t end = address + data.size();
+    MEMORY_BASIC_INFORMATION64 mbi = { 0 };
+
+    // Unlock every region covered by range
+    for (ptr_t ptr = address; ptr < end; ptr = mbi.BaseAddress + mbi.RegionSize)
+    {
+        auto status = _memory->core().native()->VirtualQueryExT( ptr, &mbi );
+        if (!NT_SUCCESS( status ))
+            break;
+
+        if (mbi.State != MEM_COMMIT || (mbi.Protect & writable))
+            continue;
+
+        ptr_t regionEnd = std::min( end, mbi.BaseAddress + mbi.RegionSize );
+        size_t regionSize = static_cast<size_t>(regionEnd - ptr);
+        DWORD newProt = (mbi.Protect & executable) ? PAGE_EXECUTE_READWRITE : PAGE_READWRITE;
+        DWORD oldProt = 0;
+
+        if (NT_SUCCESS( _memory->Protect( ptr, regionSize, newProt, &oldProt ) ))
+            restore.push_back( { ptr, regionSize, oldProt } );
+    }
+
+    auto status = _memory->Write( address, data.size(), data.data() );
+
+    for (const auto& region : restore)
+        _memory->Protect( region.address, region.size, region.protection );
+
+    return status;
+}
+
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "../Include/Winheaders.h"
+#include "../Include/Types.h"
+
+#include <map>
+#include <vector>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Write-combining transaction.
+/// Writes are buffered locally and merged into contiguous ranges,
+/// every range is flushed by single write on Commit.
+/// Uncommitted writes are discarded on destruction.
+/// </summary>
+class WriteTransaction
+{
+public:
+    BLACKBONE_API WriteTransaction( class ProcessMemory& memory );
+    BLACKBONE_API ~WriteTransaction() = default;
+
+    BLACKBONE_API WriteTransaction( WriteTransaction&& ) = default;
+    WriteTransaction( const WriteTransaction& ) = delete;
+    WriteTransaction& operator =( const WriteTransaction& ) = delete;
+
+    /// <summary>
+    /// Buffer write. Later writes overwrite earlier ones
+    /// </summary>
+    /// <param name="address">Memory address to write to</param>
+    /// <param name="size">Size of data to write</param>
+    /// <param name="data">Buffer to write</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS Write( ptr_t address, size_t size, const void* data );
+
+    /// <summary>
+    /// Buffer write
+    /// </summary>
+    /// <param name="address">Memory address to write to</param>
+    /// <param name="data">Data to write</param>
+    /// <returns>Status code</returns>
+    template<class T>
+    inline NTSTATUS Write( ptr_t address, const T& data )
+    {
+        return Write( address, sizeof( T ), &data );
+    }
+
+    /// <summary>
+    /// Flush buffered ranges into target process
+    /// </summary>
+    /// <param name="forceWritable">
+    /// Temporarily make non-writable pages writable.
+    /// Protection is changed once per range region, not once per write
+    /// </param>
+    /// <returns>STATUS_SUCCESS if all ranges were written, otherwise status of first failed range</returns>
+    BLACKBONE_API NTSTATUS Commit( bool forceWritable = false );
+
+    /// <summary>
+    /// Drop buffered writes
+    /// </summary>
+    BLACKBONE_API void Discard();
+
+    /// <summary>
+    /// Number of merged ranges
+    /// </summary>
+    /// <returns>Range count</returns>
+    BLACKBONE_API inline size_t ranges() const { return _ranges.size(); }
+
+    /// <summary>
+    /// Number of buffered bytes
+    /// </summary>
+    /// <returns>Buffered size</returns>
+    BLACKBONE_API size_t size() const;
+
+private:
+    /// <summary>
+    /// Write single range, changing page protection if required
+    /// </summary>
+    /// <param name="address">Range start</param>
+    /// <param name="data">Range data</param>
+    /// <returns>Status code</returns>
+    NTSTATUS WriteWritable( ptr_t address, const std::vector<uint8_t>& data );
+
+private:
+    class ProcessMemory* _memory;                       // Target memory
+    std::map<ptr_t, std::vector<uint8_t>> _ranges;      // Dirty ranges by start address
+};
+
+}
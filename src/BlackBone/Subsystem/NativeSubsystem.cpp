@@ -5,6 +5,7 @@
 #include "../Include/Macro.h"
 
 #include <type_traits>
+#include <algorithm>
 #include <Psapi.h>
 
 namespace blackbone
@@ -57,6 +58,19 @@ Native::~Native()
 {
 }
 
+/// <summary>
+/// Calls made through this subsystem so far, including direct MemoryRoutines calls
+/// </summary>
+/// <returns>Counters snapshot</returns>
+NativeCounters Native::counters() const
+{
+    NativeCounters result;
+    for (size_t i = 0; i < result.calls.size(); i++)
+        result.calls[i] = _counters[i].load( std::memory_order_relaxed );
+
+    return result;
+}
+
 /// <summary>
 /// Allocate virtual memory
 /// </summary>
@@ -67,6 +81,8 @@ Native::~Native()
 /// <returns>Status code</returns>
 NTSTATUS Native::VirtualAllocExT( ptr_t& lpAddress, size_t dwSize, DWORD flAllocationType, DWORD flProtect )
 {
+    Count( NativeOp::Alloc );
+
     SetLastNtStatus( STATUS_SUCCESS );
     lpAddress = reinterpret_cast<ptr_t>(VirtualAllocEx( _hProcess, reinterpret_cast<LPVOID>(lpAddress), dwSize, flAllocationType, flProtect ));
     return LastNtStatus();
@@ -82,6 +98,8 @@ NTSTATUS Native::VirtualAllocExT( ptr_t& lpAddress, size_t dwSize, DWORD flAlloc
 /// <returns>Status code</returns>
 NTSTATUS Native::VirtualFreeExT( ptr_t lpAddress, size_t dwSize, DWORD dwFreeType )
 {
+    Count( NativeOp::Free );
+
     SetLastNtStatus( STATUS_SUCCESS );
     VirtualFreeEx( _hProcess, reinterpret_cast<LPVOID>(lpAddress), dwSize, dwFreeType );
     return LastNtStatus();
@@ -95,6 +113,8 @@ NTSTATUS Native::VirtualFreeExT( ptr_t lpAddress, size_t dwSize, DWORD dwFreeTyp
 /// <returns>Status code</returns>
 NTSTATUS Native::VirtualQueryExT( ptr_t lpAddress, PMEMORY_BASIC_INFORMATION64 lpBuffer )
 {
+    Count( NativeOp::Query );
+
     SetLastNtStatus( STATUS_SUCCESS );
     VirtualQueryEx(
         _hProcess, reinterpret_cast<LPCVOID>(lpAddress),
@@ -113,6 +133,8 @@ NTSTATUS Native::VirtualQueryExT( ptr_t lpAddress, PMEMORY_BASIC_INFORMATION64 l
 /// <returns>Status code</returns>
 NTSTATUS Native::VirtualQueryExT( ptr_t lpAddress, MEMORY_INFORMATION_CLASS infoClass, LPVOID lpBuffer, size_t bufSize )
 {
+    Count( NativeOp::Query );
+
     SIZE_T retLen = 0;
 
     SetLastNtStatus( STATUS_SUCCESS );   
@@ -122,6 +144,48 @@ NTSTATUS Native::VirtualQueryExT( ptr_t lpAddress, MEMORY_INFORMATION_CLASS info
         );
 }
 
+/// <summary>
+/// Get pages written since last reset. Region must be allocated with MEM_WRITE_WATCH
+/// </summary>
+/// <param name="lpAddress">Region address</param>
+/// <param name="dwSize">Region size</param>
+/// <param name="pages">Addresses of written pages</param>
+/// <param name="reset">Reset write tracking state of returned pages</param>
+/// <returns>Status code</returns>
+NTSTATUS Native::GetWriteWatchT( ptr_t lpAddress, size_t dwSize, std::vector<ptr_t>& pages, bool reset )
+{
+    Count( NativeOp::Query );
+
+    std::vector<PVOID> addresses( (dwSize + (lpAddress & 0xFFF) + 0xFFF) / 0x1000 + 1 );
+    ULONG_PTR count = addresses.size();
+    ULONG granularity = 0;
+
+    pages.clear();
+
+    NTSTATUS status = SAFE_NATIVE_CALL(
+        NtGetWriteWatch, _hProcess, reset ? WRITE_WATCH_FLAG_RESET : 0, reinterpret_cast<LPVOID>(lpAddress),
+        dwSize, addresses.data(), &count, &granularity
+        );
+
+    if (NT_SUCCESS( status ))
+        for (ULONG_PTR i = 0; i < count; i++)
+            pages.emplace_back( reinterpret_cast<ptr_t>(addresses[i]) );
+
+    return status;
+}
+
+/// <summary>
+/// Reset write tracking state of region allocated with MEM_WRITE_WATCH
+/// </summary>
+/// <param name="lpAddress">Region address</param>
+/// <param name="dwSize">Region size</param>
+/// <returns>Status code</returns>
+NTSTATUS Native::ResetWriteWatchT( ptr_t lpAddress, size_t dwSize )
+{
+    Count( NativeOp::Query );
+    return SAFE_NATIVE_CALL( NtResetWriteWatch, _hProcess, reinterpret_cast<LPVOID>(lpAddress), dwSize );
+}
+
 /// <summary>
 /// Change memory protection
 /// </summary>
@@ -132,6 +196,8 @@ NTSTATUS Native::VirtualQueryExT( ptr_t lpAddress, MEMORY_INFORMATION_CLASS info
 /// <returns>Status code</returns>
 NTSTATUS Native::VirtualProtectExT( ptr_t lpAddress, DWORD64 dwSize, DWORD flProtect, DWORD* flOld )
 {
+    Count( NativeOp::Protect );
+
     DWORD junk = 0;
     if (!flOld)
         flOld = &junk;
@@ -152,11 +218,43 @@ NTSTATUS Native::VirtualProtectExT( ptr_t lpAddress, DWORD64 dwSize, DWORD flPro
 /// <returns>Status code</returns>
 NTSTATUS Native::ReadProcessMemoryT( ptr_t lpBaseAddress, LPVOID lpBuffer, size_t nSize, DWORD64 *lpBytes /*= nullptr */ )
 {
+    Count( NativeOp::Read );
+
     SetLastNtStatus( STATUS_SUCCESS );
     ReadProcessMemory( _hProcess, reinterpret_cast<LPVOID>(lpBaseAddress), lpBuffer, nSize, reinterpret_cast<SIZE_T*>(lpBytes) );
     return LastNtStatus();
 }
 
+/// <summary>
+/// Get memory routines equivalent to ReadProcessMemoryT/WriteProcessMemoryT
+/// </summary>
+/// <returns>Routines that can be called directly</returns>
+MemoryRoutines Native::GetMemoryRoutines() const
+{
+    // kernel32 write handles read-only pages, so only read is bypassed
+    MemoryRoutines routines;
+    routines.read = GET_IMPORT( NtReadVirtualMemory );
+    return routines;
+}
+
+/// <summary>
+/// Read several memory ranges
+/// </summary>
+/// <param name="ranges">Ranges to read, each receives its own status</param>
+/// <returns>Status code of first failed read</returns>
+NTSTATUS Native::ReadProcessMemoryBatchT( std::vector<NativeReadRange>& ranges )
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    for (auto& range : ranges)
+    {
+        range.status = ReadProcessMemoryT( range.address, range.buffer, range.size, &range.bytes );
+        if (!NT_SUCCESS( range.status ) && NT_SUCCESS( status ))
+            status = range.status;
+    }
+
+    return status;
+}
+
 /// <summary>
 /// Write virtual memory
 /// </summary>
@@ -167,6 +265,8 @@ NTSTATUS Native::ReadProcessMemoryT( ptr_t lpBaseAddress, LPVOID lpBuffer, size_
 /// <returns>Status code</returns>
 NTSTATUS Native::WriteProcessMemoryT( ptr_t lpBaseAddress, LPCVOID lpBuffer, size_t nSize, DWORD64 *lpBytes /*= nullptr */ )
 {
+    Count( NativeOp::Write );
+
     SetLastNtStatus( STATUS_SUCCESS );
     WriteProcessMemory( _hProcess, reinterpret_cast<LPVOID>(lpBaseAddress), lpBuffer, nSize, reinterpret_cast<SIZE_T*>(lpBytes) );
     return LastNtStatus();
@@ -181,6 +281,8 @@ NTSTATUS Native::WriteProcessMemoryT( ptr_t lpBaseAddress, LPCVOID lpBuffer, siz
 /// <returns>Status code</returns>
 NTSTATUS Native::QueryProcessInfoT( PROCESSINFOCLASS infoClass, LPVOID lpBuffer, uint32_t bufSize )
 {
+    Count( NativeOp::QueryInfo );
+
     ULONG length = 0;
     return SAFE_NATIVE_CALL( NtQueryInformationProcess, _hProcess, infoClass, lpBuffer, bufSize, &length );
 }
@@ -194,6 +296,8 @@ NTSTATUS Native::QueryProcessInfoT( PROCESSINFOCLASS infoClass, LPVOID lpBuffer,
 /// <returns>Status code</returns>
 NTSTATUS Native::SetProcessInfoT( PROCESSINFOCLASS infoClass, LPVOID lpBuffer, uint32_t bufSize )
 {
+    Count( NativeOp::SetInfo );
+
     return SAFE_NATIVE_CALL( NtSetInformationProcess, _hProcess, infoClass, lpBuffer, bufSize );
 }
 
@@ -203,11 +307,13 @@ NTSTATUS Native::SetProcessInfoT( PROCESSINFOCLASS infoClass, LPVOID lpBuffer, u
 /// <param name="hThread">Created thread handle</param>
 /// <param name="entry">Thread entry point</param>
 /// <param name="arg">Thread argument</param>
-/// <param name="flags">Creation flags</param>
+/// <param name="options">Creation flags and stack sizes</param>
 /// <param name="access">Access override</param>
 /// <returns>Status code</returns>
-NTSTATUS Native::CreateRemoteThreadT( HANDLE& hThread, ptr_t entry, ptr_t arg, CreateThreadFlags flags, DWORD access /*= THREAD_ALL_ACCESS*/ )
+NTSTATUS Native::CreateRemoteThreadT( HANDLE& hThread, ptr_t entry, ptr_t arg, const ThreadCreateOptions& options, DWORD access /*= THREAD_ALL_ACCESS*/ )
 {
+    Count( NativeOp::CreateThread );
+
     SetLastNtStatus( STATUS_SUCCESS );
     NTSTATUS status = 0; 
     auto pCreateThread = GET_IMPORT( NtCreateThreadEx );
@@ -217,8 +323,8 @@ NTSTATUS Native::CreateRemoteThreadT( HANDLE& hThread, ptr_t entry, ptr_t arg, C
         status = pCreateThread(
             &hThread, access, NULL,
             _hProcess, reinterpret_cast<PTHREAD_START_ROUTINE>(entry),
-            reinterpret_cast<LPVOID>(arg), static_cast<DWORD>(flags),
-            0, 0x1000, 0x100000, NULL
+            reinterpret_cast<LPVOID>(arg), static_cast<DWORD>(options.flags),
+            0, options.stackCommit, options.stackReserve, NULL
             );
 
         if (!NT_SUCCESS( status ))
@@ -226,13 +332,13 @@ NTSTATUS Native::CreateRemoteThreadT( HANDLE& hThread, ptr_t entry, ptr_t arg, C
     }
     else
     {
-        DWORD win32Flags = 0;
+        DWORD win32Flags = options.stackReserve != 0 ? STACK_SIZE_PARAM_IS_A_RESERVATION : 0;
 
-        if (flags & CreateSuspended)
-            win32Flags = CREATE_SUSPENDED;
+        if (options.flags & CreateSuspended)
+            win32Flags |= CREATE_SUSPENDED;
 
         hThread = CreateRemoteThread( 
-            _hProcess, NULL, 0, reinterpret_cast<PTHREAD_START_ROUTINE>(entry),
+            _hProcess, NULL, options.stackReserve, reinterpret_cast<PTHREAD_START_ROUTINE>(entry),
             reinterpret_cast<LPVOID>(arg), win32Flags, NULL
             );
 
@@ -250,6 +356,8 @@ NTSTATUS Native::CreateRemoteThreadT( HANDLE& hThread, ptr_t entry, ptr_t arg, C
 /// <returns>Status code</returns>
 NTSTATUS Native::GetThreadContextT( HANDLE hThread, _CONTEXT64& ctx )
 {
+    Count( NativeOp::GetContext );
+
     SetLastNtStatus( STATUS_SUCCESS );
     GetThreadContext( hThread, reinterpret_cast<PCONTEXT>(&ctx) );
     return LastNtStatus();
@@ -263,6 +371,8 @@ NTSTATUS Native::GetThreadContextT( HANDLE hThread, _CONTEXT64& ctx )
 /// <returns>Status code</returns>
 NTSTATUS Native::GetThreadContextT( HANDLE hThread, _CONTEXT32& ctx )
 {
+    Count( NativeOp::GetContext );
+
     // Target process is x64. WOW64 CONTEXT is not available.
     if (_wowBarrier.targetWow64 == false)
     {
@@ -284,6 +394,8 @@ NTSTATUS Native::GetThreadContextT( HANDLE hThread, _CONTEXT32& ctx )
 /// <returns>Status code</returns>
 NTSTATUS Native::SetThreadContextT( HANDLE hThread, _CONTEXT64& ctx )
 {
+    Count( NativeOp::SetContext );
+
     SetLastNtStatus( STATUS_SUCCESS );
     SetThreadContext( hThread, reinterpret_cast<PCONTEXT>(&ctx) );
     return LastNtStatus();
@@ -297,6 +409,8 @@ NTSTATUS Native::SetThreadContextT( HANDLE hThread, _CONTEXT64& ctx )
 /// <returns>Status code</returns>
 NTSTATUS Native::SetThreadContextT( HANDLE hThread, _CONTEXT32& ctx )
 {
+    Count( NativeOp::SetContext );
+
     // Target process is x64. 32bit CONTEXT is not available.
     if (_wowBarrier.targetWow64 == false)
     {
@@ -319,6 +433,8 @@ NTSTATUS Native::SetThreadContextT( HANDLE hThread, _CONTEXT32& ctx )
 /// <returns>Status code</returns>
 NTSTATUS Native::QueueApcT( HANDLE hThread, ptr_t func, ptr_t arg )
 {
+    Count( NativeOp::QueueApc );
+
     if (_wowBarrier.type == wow_64_32)
     {
         return SAFE_NATIVE_CALL( RtlQueueApcWow64Thread, hThread, reinterpret_cast<PVOID>(func), reinterpret_cast<PVOID>(arg), nullptr, nullptr );
@@ -361,7 +477,7 @@ ptr_t Native::getPEB( _PEB64* ppeb )
     ULONG bytes = 0;
 
     if (NT_SUCCESS( SAFE_NATIVE_CALL( NtQueryInformationProcess, _hProcess, ProcessBasicInformation, &pbi, (ULONG)sizeof( pbi ), &bytes ) ) && ppeb)
-        ReadProcessMemory( _hProcess, pbi.PebBaseAddress, ppeb, sizeof(_PEB32), NULL );
+        ReadProcessMemory( _hProcess, pbi.PebBaseAddress, ppeb, sizeof(_PEB64), NULL );
 
     return reinterpret_cast<ptr_t>(pbi.PebBaseAddress);
 }
@@ -435,6 +551,69 @@ std::vector<MEMORY_BASIC_INFORMATION64> Native::EnumRegions( bool includeFree /*
     return results;
 }
 
+/// <summary>
+/// Read memory through local page cache, missing pages are fetched in chunks.
+/// Used to parse scattered loader structures with few reads
+/// </summary>
+/// <param name="pages">Page cache</param>
+/// <param name="address">Memory address</param>
+/// <param name="buffer">Output buffer</param>
+/// <param name="size">Number of bytes to read</param>
+/// <returns>Status code</returns>
+NTSTATUS Native::ReadPaged( PageCache& pages, ptr_t address, void* buffer, size_t size )
+{
+    // Loader heap is mostly contiguous, neighbour pages are likely to contain other entries
+    constexpr size_t chunkPages = 4;
+
+    auto pDst = reinterpret_cast<uint8_t*>(buffer);
+    const ptr_t pageMask = static_cast<ptr_t>(_pageSize) - 1;
+
+    while (size > 0)
+    {
+        ptr_t page = address & ~pageMask;
+        auto iter = pages.find( page );
+
+        if (iter == pages.end())
+        {
+            ptr_t chunk = address & ~(static_cast<ptr_t>(_pageSize) * chunkPages - 1);
+            std::vector<uint8_t> data( _pageSize * chunkPages );
+
+            if (NT_SUCCESS( ReadProcessMemoryT( chunk, data.data(), data.size() ) ))
+            {
+                for (size_t i = 0; i < chunkPages; i++)
+                {
+                    auto start = data.begin() + i * _pageSize;
+                    pages.emplace( chunk + i * _pageSize, std::vector<uint8_t>( start, start + _pageSize ) );
+                }
+            }
+            else
+            {
+                // Part of chunk is not accessible, fall back to single page
+                data.resize( _pageSize );
+
+                NTSTATUS status = ReadProcessMemoryT( page, data.data(), data.size() );
+                if (!NT_SUCCESS( status ))
+                    return status;
+
+                pages.emplace( page, std::move( data ) );
+            }
+
+            iter = pages.find( page );
+        }
+
+        size_t offset = static_cast<size_t>(address - page);
+        size_t part = std::min<size_t>( size, _pageSize - offset );
+
+        memcpy( pDst, iter->second.data() + offset, part );
+
+        pDst += part;
+        address += part;
+        size -= part;
+    }
+
+    return STATUS_SUCCESS;
+}
+
 /// <summary>
 /// Enumerate process modules
 /// </summary>
@@ -443,23 +622,27 @@ std::vector<MEMORY_BASIC_INFORMATION64> Native::EnumRegions( bool includeFree /*
 template<typename T>
 std::vector<ModuleDataPtr> Native::EnumModulesT()
 {
-    NTSTATUS status = STATUS_SUCCESS;
     _PEB_T<T> peb = { };
     _PEB_LDR_DATA2_T<T> ldr = { };
     std::vector<ModuleDataPtr> result;
 
     if (getPEB( &peb ) != 0 && ReadProcessMemoryT( peb.Ldr, &ldr, sizeof( ldr ), 0 ) == STATUS_SUCCESS)
     {
-        for (T head = ldr.InLoadOrderModuleList.Flink;
-            NT_SUCCESS( status ) && head != (peb.Ldr + FIELD_OFFSET( _PEB_LDR_DATA2_T<T>, InLoadOrderModuleList ));
-            status = ReadProcessMemoryT( static_cast<ptr_t>(head), &head, sizeof( head ) ))
+        // Entries and names are parsed from locally cached loader heap pages
+        PageCache pages;
+        const T listHead = static_cast<T>(peb.Ldr + FIELD_OFFSET( _PEB_LDR_DATA2_T<T>, InLoadOrderModuleList ));
+
+        for (T head = ldr.InLoadOrderModuleList.Flink; head != listHead;)
         {
             ModuleData data;
             wchar_t localPath[512] = { 0 };
             _LDR_DATA_TABLE_ENTRY_BASE_T<T> localdata = { { 0 } };
 
-            ReadProcessMemoryT( head, &localdata, sizeof( localdata ), 0 );
-            ReadProcessMemoryT( localdata.FullDllName.Buffer, localPath, localdata.FullDllName.Length );
+            if (!NT_SUCCESS( ReadPaged( pages, head, &localdata, sizeof( localdata ) ) ))
+                break;
+
+            size_t nameLength = std::min<size_t>( localdata.FullDllName.Length, sizeof( localPath ) - sizeof( wchar_t ) );
+            ReadPaged( pages, localdata.FullDllName.Buffer, localPath, nameLength );
 
             data.baseAddress = localdata.DllBase;
             data.size = localdata.SizeOfImage;
@@ -470,6 +653,7 @@ std::vector<ModuleDataPtr> Native::EnumModulesT()
             data.manual = false;
 
             result.emplace_back( std::make_shared<const ModuleData>( data ) );
+            head = localdata.InLoadOrderLinks.Flink;
         }
     }
     else
@@ -483,189 +667,222 @@ std::vector<ModuleDataPtr> Native::EnumModulesT()
 /// <summary>
 /// Enum process section objects
 /// </summary>
-/// <param name="result">Found modules</param>
-/// <returns>Sections count</returns>
-std::vector<ModuleDataPtr> Native::EnumSections()
+/// <param name="regions">Process memory regions</param>
+/// <returns>Found modules</returns>
+std::vector<ModuleDataPtr> Native::EnumSections( const std::vector<MEMORY_BASIC_INFORMATION64>& regions )
 {
-    MEMORY_BASIC_INFORMATION64 mbi = { 0 };
-    ptr_t lastBase = 0;
-    std::vector<ModuleDataPtr> result;
+    std::vector<ModuleProbe> probes;
 
-    for (ptr_t memptr = minAddr(); memptr < maxAddr(); memptr = mbi.BaseAddress + mbi.RegionSize)
+    for (const auto& mbi : regions)
     {
-        auto status = VirtualQueryExT( memptr, &mbi );
+        // Extend contiguous image regions of current allocation
+        if (!probes.empty() && probes.back().base == mbi.AllocationBase)
+        {
+            if (mbi.Type == SEC_IMAGE && probes.back().imageEnd == mbi.BaseAddress)
+                probes.back().imageEnd = mbi.BaseAddress + mbi.RegionSize;
 
-        if (status == STATUS_INVALID_PARAMETER || status == STATUS_ACCESS_DENIED || status == STATUS_PROCESS_IS_TERMINATING)
-            break;
-        else if (status != STATUS_SUCCESS)
             continue;
+        }
 
         // Filter non-section regions
-        if (mbi.State != MEM_COMMIT || mbi.Type != SEC_IMAGE || lastBase == mbi.AllocationBase)
+        if (mbi.State != MEM_COMMIT || mbi.Type != SEC_IMAGE)
             continue;
 
-        uint8_t buf[0x1000] = { 0 };
-        _UNICODE_STRING_T<uint64_t>* ustr = (decltype(ustr))(buf + 0x800);
+        ModuleProbe probe;
+        probe.base = mbi.AllocationBase;
+        probe.imageEnd = mbi.BaseAddress + mbi.RegionSize;
+        probe.image = true;
+
+        probes.emplace_back( probe );
+    }
 
-        status = VirtualQueryExT( mbi.AllocationBase, MemorySectionName, ustr, sizeof(buf) / 2 );
+    return ProbeModules( probes, true );
+}
 
-        // Get additional 
-        if (NT_SUCCESS( status ))
+/// <summary>
+/// Enum pages containing valid PE headers
+/// </summary>
+/// <param name="regions">Process memory regions</param>
+/// <returns>Found modules</returns>
+std::vector<ModuleDataPtr> Native::EnumPEHeaders( const std::vector<MEMORY_BASIC_INFORMATION64>& regions )
+{
+    std::vector<ModuleProbe> probes;
+
+    for (const auto& mbi : regions)
+    {
+        // Filter regions
+        if (mbi.State != MEM_COMMIT ||
+            mbi.AllocationProtect == PAGE_NOACCESS ||
+            mbi.AllocationProtect & PAGE_GUARD ||
+            (!probes.empty() && probes.back().base == mbi.AllocationBase))
         {
-            ModuleData data;
+            continue;
+        }
 
-            IMAGE_DOS_HEADER* phdrDos = reinterpret_cast<PIMAGE_DOS_HEADER>(buf);
-            IMAGE_NT_HEADERS32 *phdrNt32 = nullptr;
-            IMAGE_NT_HEADERS64 *phdrNt64 = nullptr;
+        ModuleProbe probe;
+        probe.base = mbi.AllocationBase;
+        probe.imageEnd = mbi.BaseAddress + mbi.RegionSize;
+        probe.image = mbi.Type == SEC_IMAGE;
 
-            if (ReadProcessMemoryT( mbi.AllocationBase, buf, 0x800 ) != STATUS_SUCCESS)
-                continue;
+        probes.emplace_back( probe );
+    }
 
-            phdrNt32 = reinterpret_cast<PIMAGE_NT_HEADERS32>(buf + phdrDos->e_lfanew);
-            phdrNt64 = reinterpret_cast<PIMAGE_NT_HEADERS64>(phdrNt32);
+    return ProbeModules( probes, false );
+}
 
-            // If no PE header present
-            if (phdrDos->e_magic != IMAGE_DOS_SIGNATURE || phdrNt32->Signature != IMAGE_NT_SIGNATURE)
-            {
-                // Iterate until region end
-                MEMORY_BASIC_INFORMATION64 mbi2 = { 0 };
-                for (ptr_t memptr2 = mbi.AllocationBase; memptr2 < maxAddr(); memptr2 = mbi2.BaseAddress + mbi2.RegionSize)
-                    if (!NT_SUCCESS( VirtualQueryExT( memptr2, &mbi2 ) ) || mbi2.Type != SEC_IMAGE)
-                    {
-                        data.size = static_cast<uint32_t>(mbi2.BaseAddress - mbi.AllocationBase);
-                        break;
-                    }
-
-                data.type = mt_unknown;
-            }
-            else if( phdrNt32->OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR32_MAGIC )
-            {
-                data.size = phdrNt32->OptionalHeader.SizeOfImage;
-                data.type = mt_mod32;
-            }
-            else if (phdrNt32->OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR64_MAGIC)
-            {
-                data.size = phdrNt64->OptionalHeader.SizeOfImage;
-                data.type = mt_mod64;
-            }
-            else 
-                continue;
+/// <summary>
+/// Probe allocations for module headers, large lists are split between several threads
+/// </summary>
+/// <param name="probes">Allocations to probe</param>
+/// <param name="sections">Section search: keep images without valid headers, skip unnamed images</param>
+/// <returns>Found modules</returns>
+std::vector<ModuleDataPtr> Native::ProbeModules( std::vector<ModuleProbe>& probes, bool sections )
+{
+    // Single header read and optional name query per probe, not worth a thread for small lists
+    constexpr size_t probesPerThread = 32;
+    constexpr size_t maxThreads = 8;
 
-            // Hack for x86 OS
-            if (_wowBarrier.x86OS == true)
-            {
-                _UNICODE_STRING_T<DWORD>* ustr32 = reinterpret_cast<_UNICODE_STRING_T<DWORD>*>(ustr);
-                data.fullPath = Utils::ToLower( reinterpret_cast<wchar_t*>((uintptr_t)ustr32->Buffer) );
-            }
-            else
-                data.fullPath = Utils::ToLower( reinterpret_cast<wchar_t*>((uintptr_t)ustr->Buffer) );
+    SYSTEM_INFO info = { { 0 } };
+    GetNativeSystemInfo( &info );
 
-            data.name = Utils::StripPath( data.fullPath );
-            data.baseAddress = mbi.AllocationBase;
-            data.ldrPtr = 0;
-            data.manual = false;
+    ProbeContext context( *this, probes, sections );
+    size_t threads = std::min<size_t>( { probes.size() / probesPerThread, info.dwNumberOfProcessors, maxThreads } );
 
-            result.emplace_back( std::make_shared<const ModuleData>( data ) );
-        }
+    std::vector<HANDLE> workers;
+    for (size_t i = 1; i < threads; i++)
+    {
+        HANDLE hThread = CreateThread( NULL, 0, &Native::ProbeWorkerWrap, &context, 0, NULL );
+        if (hThread != NULL)
+            workers.emplace_back( hThread );
+    }
+
+    // Calling thread takes part as well
+    ProbeWorker( context );
 
-        lastBase = mbi.AllocationBase;
+    for (auto hThread : workers)
+    {
+        WaitForSingleObject( hThread, INFINITE );
+        CloseHandle( hThread );
     }
 
+    std::vector<ModuleDataPtr> result;
+    for (const auto& probe : probes)
+        if (probe.result)
+            result.emplace_back( probe.result );
+
     return result;
 }
 
 /// <summary>
-/// Enum pages containing valid PE headers
+/// Header probe worker
 /// </summary>
-/// <param name="result">Found modules</param>
-/// <returns>Sections count</returns>
-std::vector<ModuleDataPtr> Native::EnumPEHeaders()
+/// <param name="context">Shared probe list</param>
+void Native::ProbeWorker( ProbeContext& context )
 {
-    MEMORY_BASIC_INFORMATION64 mbi = { 0 };
-    uint8_t buf[0x1000];
-    ptr_t lastBase = 0;
-    std::vector<ModuleDataPtr> result;
-
-    for (ptr_t memptr = minAddr(); memptr < maxAddr(); memptr = mbi.BaseAddress + mbi.RegionSize)
-    {
-        auto status = VirtualQueryExT( memptr, &mbi );
+    for (size_t idx = context.next++; idx < context.probes.size(); idx = context.next++)
+        ProbeModule( context.probes[idx], context.sections );
+}
 
-        if (status == STATUS_INVALID_PARAMETER || status == STATUS_ACCESS_DENIED || status == STATUS_PROCESS_IS_TERMINATING)
-            break;
-        else if (status != STATUS_SUCCESS)
-            continue;
+/// <summary>
+/// Header probe thread entry point
+/// </summary>
+/// <param name="lpParam">Probe context</param>
+/// <returns>0</returns>
+DWORD CALLBACK Native::ProbeWorkerWrap( LPVOID lpParam )
+{
+    auto& context = *reinterpret_cast<ProbeContext*>(lpParam);
+    context.self.ProbeWorker( context );
+    return 0;
+}
 
-        // Filter regions
-        if (mbi.State != MEM_COMMIT ||
-            mbi.AllocationProtect == PAGE_NOACCESS ||
-            mbi.AllocationProtect & PAGE_GUARD ||
-            lastBase == mbi.AllocationBase)
-        {
-            continue;
-        }
+/// <summary>
+/// Read allocation headers and section name
+/// </summary>
+/// <param name="probe">Probed allocation</param>
+/// <param name="sections">Section search: keep images without valid headers, skip unnamed images</param>
+void Native::ProbeModule( ModuleProbe& probe, bool sections )
+{
+    uint8_t buf[0x1000] = { 0 };
+    ModuleData data;
 
-        ModuleData data;
+    if (ReadProcessMemoryT( probe.base, buf, sizeof( buf ) ) != STATUS_SUCCESS)
+        return;
 
-        IMAGE_DOS_HEADER* phdrDos = reinterpret_cast<PIMAGE_DOS_HEADER>(buf);
-        IMAGE_NT_HEADERS32 *phdrNt32 = nullptr;
-        IMAGE_NT_HEADERS64 *phdrNt64 = nullptr;
+    IMAGE_DOS_HEADER* phdrDos = reinterpret_cast<PIMAGE_DOS_HEADER>(buf);
+    IMAGE_NT_HEADERS32 *phdrNt32 = nullptr;
+    IMAGE_NT_HEADERS64 *phdrNt64 = nullptr;
 
-        if (ReadProcessMemoryT( mbi.AllocationBase, buf, 0x1000 ) != STATUS_SUCCESS)
-            continue;
+    bool validHeaders = phdrDos->e_magic == IMAGE_DOS_SIGNATURE &&
+                        phdrDos->e_lfanew > 0 &&
+                        static_cast<size_t>(phdrDos->e_lfanew) <= sizeof( buf ) - sizeof( IMAGE_NT_HEADERS64 );
 
+    if (validHeaders)
+    {
         phdrNt32 = reinterpret_cast<PIMAGE_NT_HEADERS32>(buf + phdrDos->e_lfanew);
         phdrNt64 = reinterpret_cast<PIMAGE_NT_HEADERS64>(phdrNt32);
+        validHeaders = phdrNt32->Signature == IMAGE_NT_SIGNATURE;
+    }
 
-        if (phdrDos->e_magic != IMAGE_DOS_SIGNATURE || phdrNt32->Signature != IMAGE_NT_SIGNATURE)
-            continue;
+    // If no PE header present
+    if (!validHeaders)
+    {
+        if (!sections)
+            return;
 
-        if (phdrNt32->OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR32_MAGIC)
-        {
-            data.size = phdrNt32->OptionalHeader.SizeOfImage;
-            data.type = mt_mod32;
-        }
-        else if (phdrNt32->OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR64_MAGIC)
-        {
-            data.size = phdrNt64->OptionalHeader.SizeOfImage;
-            data.type = mt_mod64;
-        }
+        data.size = static_cast<uint32_t>(probe.imageEnd - probe.base);
+        data.type = mt_unknown;
+    }
+    else if (phdrNt32->OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR32_MAGIC)
+    {
+        data.size = phdrNt32->OptionalHeader.SizeOfImage;
+        data.type = mt_mod32;
+    }
+    else if (phdrNt32->OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR64_MAGIC)
+    {
+        data.size = phdrNt64->OptionalHeader.SizeOfImage;
+        data.type = mt_mod64;
+    }
+    else
+        return;
 
-        data.baseAddress = mbi.AllocationBase;
-        data.ldrPtr = 0;
-        data.manual = false;
+    data.baseAddress = probe.base;
+    data.ldrPtr = 0;
+    data.manual = false;
 
-        // Try to get section name
-        _UNICODE_STRING_T<DWORD64>* ustr = (decltype(ustr))buf;
-        status = VirtualQueryExT( mbi.AllocationBase, MemorySectionName, ustr, sizeof(buf) );
+    // Only image sections have backing file name
+    NTSTATUS status = STATUS_NOT_FOUND;
+    _UNICODE_STRING_T<DWORD64>* ustr = reinterpret_cast<decltype(ustr)>(buf);
 
-        if (status == STATUS_SUCCESS)
-        {
-            // Hack for x86 OS
-            if (_wowBarrier.x86OS == true)
-            {
-                _UNICODE_STRING_T<DWORD>* ustr32 = reinterpret_cast<_UNICODE_STRING_T<DWORD>*>(ustr);
-                data.fullPath = Utils::ToLower( reinterpret_cast<wchar_t*>((uintptr_t)ustr32->Buffer) );
-            }
-            else
-                data.fullPath = Utils::ToLower( reinterpret_cast<wchar_t*>((uintptr_t)ustr->Buffer) );
+    if (probe.image)
+        status = VirtualQueryExT( probe.base, MemorySectionName, ustr, sizeof( buf ) );
 
-            data.name = Utils::StripPath( data.fullPath );
-        }
-        else
+    if (NT_SUCCESS( status ))
+    {
+        // Hack for x86 OS
+        if (_wowBarrier.x86OS == true)
         {
-            wchar_t name[64] = { 0 };
-            wsprintfW( name, L"Unknown_0x%I64x", data.baseAddress );
-
-            data.fullPath = name;
-            data.name = data.fullPath;
+            _UNICODE_STRING_T<DWORD>* ustr32 = reinterpret_cast<_UNICODE_STRING_T<DWORD>*>(ustr);
+            data.fullPath = Utils::ToLower( reinterpret_cast<wchar_t*>((uintptr_t)ustr32->Buffer) );
         }
+        else
+            data.fullPath = Utils::ToLower( reinterpret_cast<wchar_t*>((uintptr_t)ustr->Buffer) );
 
-        result.emplace_back( std::make_shared<const ModuleData>( data ) );
+        data.name = Utils::StripPath( data.fullPath );
+    }
+    else if (sections)
+    {
+        return;
+    }
+    else
+    {
+        wchar_t name[64] = { 0 };
+        wsprintfW( name, L"Unknown_0x%I64x", data.baseAddress );
 
-        lastBase = mbi.AllocationBase;
+        data.fullPath = name;
+        data.name = data.fullPath;
     }
 
-    return result;
+    probe.result = std::make_shared<const ModuleData>( data );
 }
 
 /// <summary>
@@ -684,14 +901,23 @@ std::vector<ModuleDataPtr> Native::EnumModules( eModSeachType search/*= LdrList*
 
         return CALL_64_86( mtype == mt_mod64, EnumModulesT );
     }
-    else if(search == Sections)
-    {
-        return EnumSections();
-    }
-    else if(search == PEHeaders)
-    {
-        return EnumPEHeaders();
-    }
+
+    return EnumModules( search, EnumRegions() );
+}
+
+/// <summary>
+/// Enumerate process modules using known memory regions.
+/// Only Sections and PEHeaders search types are supported
+/// </summary>
+/// <param name="search">Search type</param>
+/// <param name="regions">Process memory regions sorted by address</param>
+/// <returns>Found modules</returns>
+std::vector<ModuleDataPtr> Native::EnumModules( eModSeachType search, const std::vector<MEMORY_BASIC_INFORMATION64>& regions )
+{
+    if (search == Sections)
+        return EnumSections( regions );
+    else if (search == PEHeaders)
+        return EnumPEHeaders( regions );
 
     return std::vector<ModuleDataPtr>();
 }
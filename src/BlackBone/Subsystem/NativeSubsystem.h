@@ -8,6 +8,9 @@
 #include <list>
 #include <vector>
 #include <unordered_set>
+#include <unordered_map>
+#include <array>
+#include <atomic>
 #include <cassert>
 
 
@@ -18,12 +21,92 @@ enum CreateThreadFlags
 {
     NoThreadFlags   = 0x0000,
     CreateSuspended = 0x0001,
-    NoDllCallbacks  = 0x0002,
+    NoDllCallbacks  = 0x0002,   // THREAD_CREATE_FLAGS_SKIP_THREAD_ATTACH, no DLL_THREAD_ATTACH/DETACH and TLS callbacks
     HideFromDebug   = 0x0004,
 };
 
 ENUM_OPS(CreateThreadFlags)
 
+/// <summary>
+/// Remote thread creation options
+/// </summary>
+struct ThreadCreateOptions
+{
+    CreateThreadFlags flags = NoThreadFlags;
+    size_t stackCommit = 0x1000;        // Initially committed stack size, 0 - image default
+    size_t stackReserve = 0x100000;     // Reserved stack size, 0 - image default
+
+    ThreadCreateOptions() = default;
+    ThreadCreateOptions( CreateThreadFlags flags_ )
+        : flags( flags_ ) { }
+
+    /// <summary>
+    /// Small stack without thread attach notifications.
+    /// Suitable for threads that run only generated code or a few API calls
+    /// </summary>
+    /// <returns>Options</returns>
+    static ThreadCreateOptions Lightweight()
+    {
+        ThreadCreateOptions options( NoDllCallbacks );
+        options.stackReserve = 0x10000;
+        return options;
+    }
+};
+
+/// <summary>
+/// Memory routines captured at attach, so hot paths can skip virtual dispatch
+/// At most one routine of each pair is set, none means subsystem methods must be used
+/// </summary>
+struct MemoryRoutines
+{
+    fnNtReadVirtualMemory read = nullptr;                   // Same-width read
+    fnNtWow64ReadVirtualMemory64 read64 = nullptr;          // x64 read from WOW64 host
+    fnNtWow64WriteVirtualMemory64 write64 = nullptr;        // x64 write from WOW64 host
+};
+
+/// <summary>
+/// Subsystem call kinds
+/// </summary>
+enum class NativeOp
+{
+    Alloc,
+    Free,
+    Query,
+    Protect,
+    Read,
+    Write,
+    QueryInfo,
+    SetInfo,
+    CreateThread,
+    GetContext,
+    SetContext,
+    QueueApc,
+
+    Count
+};
+
+/// <summary>
+/// Subsystem call counters, indexed by NativeOp
+/// </summary>
+struct NativeCounters
+{
+    std::array<uint64_t, static_cast<size_t>(NativeOp::Count)> calls = { };
+
+    inline uint64_t operator []( NativeOp op ) const { return calls[static_cast<size_t>(op)]; }
+};
+
+/// <summary>
+/// Single range of Native::ReadProcessMemoryBatchT
+/// </summary>
+struct NativeReadRange
+{
+    ptr_t address = 0;                  // Address to read from
+    LPVOID buffer = nullptr;            // Output buffer
+    size_t size = 0;                    // Number of bytes to read
+    DWORD64 bytes = 0;                  // Number of bytes read
+    NTSTATUS status = STATUS_SUCCESS;   // Read status
+};
+
 class Native
 {
 public:
@@ -71,6 +154,19 @@ public:
     /// <returns>Status code</returns>
     virtual NTSTATUS ReadProcessMemoryT( ptr_t lpBaseAddress, LPVOID lpBuffer, size_t nSize, DWORD64 *lpBytes = nullptr );
 
+    /// <summary>
+    /// Read several memory ranges
+    /// </summary>
+    /// <param name="ranges">Ranges to read, each receives its own status</param>
+    /// <returns>Status code of first failed read</returns>
+    virtual NTSTATUS ReadProcessMemoryBatchT( std::vector<NativeReadRange>& ranges );
+
+    /// <summary>
+    /// Get memory routines equivalent to ReadProcessMemoryT/WriteProcessMemoryT
+    /// </summary>
+    /// <returns>Routines that can be called directly</returns>
+    virtual MemoryRoutines GetMemoryRoutines() const;
+
     /// <summary>
     /// Write virtual memory
     /// </summary>
@@ -97,6 +193,24 @@ public:
     /// <returns>Status code</returns>
     virtual NTSTATUS VirtualQueryExT( ptr_t lpAddress, MEMORY_INFORMATION_CLASS infoClass, LPVOID lpBuffer, size_t bufSize );
 
+    /// <summary>
+    /// Get pages written since last reset. Region must be allocated with MEM_WRITE_WATCH
+    /// </summary>
+    /// <param name="lpAddress">Region address</param>
+    /// <param name="dwSize">Region size</param>
+    /// <param name="pages">Addresses of written pages</param>
+    /// <param name="reset">Reset write tracking state of returned pages</param>
+    /// <returns>Status code</returns>
+    virtual NTSTATUS GetWriteWatchT( ptr_t lpAddress, size_t dwSize, std::vector<ptr_t>& pages, bool reset );
+
+    /// <summary>
+    /// Reset write tracking state of region allocated with MEM_WRITE_WATCH
+    /// </summary>
+    /// <param name="lpAddress">Region address</param>
+    /// <param name="dwSize">Region size</param>
+    /// <returns>Status code</returns>
+    virtual NTSTATUS ResetWriteWatchT( ptr_t lpAddress, size_t dwSize );
+
     /// <summary>
     /// Call NtQueryInformationProcess for underlying process
     /// </summary>
@@ -121,10 +235,10 @@ public:
     /// <param name="hThread">Created thread handle</param>
     /// <param name="entry">Thread entry point</param>
     /// <param name="arg">Thread argument</param>
-    /// <param name="flags">Creation flags</param>
+    /// <param name="options">Creation flags and stack sizes</param>
     /// <param name="access">Access override</param>
     /// <returns>Status code</returns>
-    virtual NTSTATUS CreateRemoteThreadT( HANDLE& hThread, ptr_t entry, ptr_t arg, CreateThreadFlags flags, DWORD access = THREAD_ALL_ACCESS );
+    virtual NTSTATUS CreateRemoteThreadT( HANDLE& hThread, ptr_t entry, ptr_t arg, const ThreadCreateOptions& options, DWORD access = THREAD_ALL_ACCESS );
 
     /// <summary>
     /// Get native thread context
@@ -210,6 +324,15 @@ public:
     /// <returns>Module count</returns>
     BLACKBONE_API std::vector<ModuleDataPtr> EnumModules( eModSeachType search = LdrList, eModType mtype = mt_default );
 
+    /// <summary>
+    /// Enumerate process modules using known memory regions.
+    /// Only Sections and PEHeaders search types are supported
+    /// </summary>
+    /// <param name="search">Search type</param>
+    /// <param name="regions">Process memory regions sorted by address</param>
+    /// <returns>Found modules</returns>
+    BLACKBONE_API std::vector<ModuleDataPtr> EnumModules( eModSeachType search, const std::vector<MEMORY_BASIC_INFORMATION64>& regions );
+
     /// <summary>
     /// Get lowest possible valid address value
     /// </summary>
@@ -227,7 +350,61 @@ public:
     /// </summary>
     /// <returns>Address value</returns>
     BLACKBONE_API inline uint32_t pageSize() const { return _pageSize; }
+
+    /// <summary>
+    /// Calls made through this subsystem so far, including direct MemoryRoutines calls
+    /// </summary>
+    /// <returns>Counters snapshot</returns>
+    BLACKBONE_API NativeCounters counters() const;
+
+    /// <summary>
+    /// Count subsystem call
+    /// </summary>
+    /// <param name="op">Call kind</param>
+    /// <param name="count">Number of calls</param>
+    BLACKBONE_API inline void Count( NativeOp op, uint64_t count = 1 )
+    {
+        _counters[static_cast<size_t>(op)].fetch_add( count, std::memory_order_relaxed );
+    }
+
 private:
+    using PageCache = std::unordered_map<ptr_t, std::vector<uint8_t>>;
+
+    /// <summary>
+    /// Allocation probed for module headers
+    /// </summary>
+    struct ModuleProbe
+    {
+        ptr_t base = 0;             // Allocation base
+        ptr_t imageEnd = 0;         // End of contiguous image regions
+        bool image = false;         // Image section
+        ModuleDataPtr result;       // Found module
+    };
+
+    /// <summary>
+    /// Probe list shared between worker threads
+    /// </summary>
+    struct ProbeContext
+    {
+        ProbeContext( Native& self_, std::vector<ModuleProbe>& probes_, bool sections_ )
+            : self( self_ ), probes( probes_ ), sections( sections_ ) { }
+
+        Native& self;                       // Owner
+        std::vector<ModuleProbe>& probes;   // Allocations to probe
+        bool sections;                      // Section search mode
+        std::atomic<size_t> next{ 0 };      // Next unclaimed probe
+    };
+
+    /// <summary>
+    /// Read memory through local page cache, missing pages are fetched in chunks.
+    /// Used to parse scattered loader structures with few reads
+    /// </summary>
+    /// <param name="pages">Page cache</param>
+    /// <param name="address">Memory address</param>
+    /// <param name="buffer">Output buffer</param>
+    /// <param name="size">Number of bytes to read</param>
+    /// <returns>Status code</returns>
+    NTSTATUS ReadPaged( PageCache& pages, ptr_t address, void* buffer, size_t size );
 
     /// <summary>
     /// Enumerate process modules
@@ -240,21 +417,51 @@ private:
     /// <summary>
     /// Enum process section objects
     /// </summary>
-    /// <param name="result">Found modules</param>
-    /// <returns>Sections count</returns>
-    std::vector<ModuleDataPtr> EnumSections();
+    /// <param name="regions">Process memory regions</param>
+    /// <returns>Found modules</returns>
+    std::vector<ModuleDataPtr> EnumSections( const std::vector<MEMORY_BASIC_INFORMATION64>& regions );
 
     /// <summary>
     /// Enum pages containing valid PE headers
     /// </summary>
-    /// <param name="result">Found modules</param>
-    /// <returns>Sections count</returns>
-    std::vector<ModuleDataPtr> EnumPEHeaders();
+    /// <param name="regions">Process memory regions</param>
+    /// <returns>Found modules</returns>
+    std::vector<ModuleDataPtr> EnumPEHeaders( const std::vector<MEMORY_BASIC_INFORMATION64>& regions );
+
+    /// <summary>
+    /// Probe allocations for module headers, large lists are split between several threads
+    /// </summary>
+    /// <param name="probes">Allocations to probe</param>
+    /// <param name="sections">Section search: keep images without valid headers, skip unnamed images</param>
+    /// <returns>Found modules</returns>
+    std::vector<ModuleDataPtr> ProbeModules( std::vector<ModuleProbe>& probes, bool sections );
+
+    /// <summary>
+    /// Read allocation headers and section name
+    /// </summary>
+    /// <param name="probe">Probed allocation</param>
+    /// <param name="sections">Section search: keep images without valid headers, skip unnamed images</param>
+    void ProbeModule( ModuleProbe& probe, bool sections );
+
+    /// <summary>
+    /// Header probe worker
+    /// </summary>
+    /// <param name="context">Shared probe list</param>
+    void ProbeWorker( ProbeContext& context );
+
+    /// <summary>
+    /// Header probe thread entry point
+    /// </summary>
+    /// <param name="lpParam">Probe context</param>
+    /// <returns>0</returns>
+    static DWORD CALLBACK ProbeWorkerWrap( LPVOID lpParam );
 
 protected:
     HANDLE _hProcess;           // Process handle
     Wow64Barrier _wowBarrier;   // WOW64 barrier info
     uint32_t _pageSize;
+
+    std::array<std::atomic<uint64_t>, static_cast<size_t>(NativeOp::Count)> _counters = { };    // Calls by NativeOp
 };
 
 }
\ No newline at end of file
@@ -0,0 +1,252 @@
+#include "SyscallSubsystem.h"
+#include "../Syscalls/Syscall.h"
+#include "../PE/PEImage.h"
+
+#include <string_view>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Syscall numbers used by NativeSyscall, -1 if not resolved
+/// </summary>
+struct SyscallTable
+{
+    int NtAllocateVirtualMemory = -1;
+    int NtFreeVirtualMemory = -1;
+    int NtProtectVirtualMemory = -1;
+    int NtReadVirtualMemory = -1;
+    int NtQueryVirtualMemory = -1;
+    int NtQueryInformationProcess = -1;
+};
+
+/// <summary>
+/// Read syscall numbers from ntdll file. 
+/// File mapping isn't affected by hooks placed into loaded ntdll
+/// </summary>
+/// <returns>Syscall numbers</returns>
+static SyscallTable LoadSyscallTable()
+{
+    SyscallTable table;
+
+#ifdef USE64
+    wchar_t sysDir[MAX_PATH] = { };
+    if (GetSystemDirectoryW( sysDir, _countof( sysDir ) ) == 0)
+        return table;
+
+    pe::PEImage ntdll;
+    if (!NT_SUCCESS( ntdll.Load( std::wstring( sysDir ) + L"\\ntdll.dll", pe::SkipActx ) ))
+        return table;
+
+    const std::pair<std::string_view, int*> routines[] =
+    {
+        { "NtAllocateVirtualMemory",   &table.NtAllocateVirtualMemory },
+        { "NtFreeVirtualMemory",       &table.NtFreeVirtualMemory },
+        { "NtProtectVirtualMemory",    &table.NtProtectVirtualMemory },
+        { "NtReadVirtualMemory",       &table.NtReadVirtualMemory },
+        { "NtQueryVirtualMemory",      &table.NtQueryVirtualMemory },
+        { "NtQueryInformationProcess", &table.NtQueryInformationProcess },
+    };
+
+    for (const auto& exp : ntdll.ExportsView())
+    {
+        for (const auto& [name, pIndex] : routines)
+        {
+            if (exp.name != name)
+                continue;
+
+            // mov r10, rcx
+            // mov eax, index
+            auto pStub = reinterpret_cast<const uint8_t*>(ntdll.ResolveRVAToVA( exp.RVA ));
+            if (pStub && pStub[0] == 0x4C && pStub[1] == 0x8B && pStub[2] == 0xD1 && pStub[3] == 0xB8)
+                *pIndex = *reinterpret_cast<const int*>(pStub + 4);
+        }
+    }
+#endif
+
+    return table;
+}
+
+/// <summary>
+/// Get syscall numbers, resolved on first use
+/// </summary>
+/// <returns>Syscall numbers</returns>
+static const SyscallTable& Syscalls()
+{
+    static const SyscallTable table = LoadSyscallTable();
+    return table;
+}
+
+NativeSyscall::NativeSyscall( HANDLE hProcess )
+    : Native( hProcess )
+{
+}
+
+NativeSyscall::~NativeSyscall()
+{
+}
+
+/// <summary>
+/// Check if syscall numbers could be resolved
+/// </summary>
+/// <returns>true if direct syscalls can be used</returns>
+bool NativeSyscall::Supported()
+{
+    return Syscalls().NtReadVirtualMemory != -1;
+}
+
+/// <summary>
+/// Allocate virtual memory
+/// </summary>
+/// <param name="lpAddress">Allocation address</param>
+/// <param name="dwSize">Region size</param>
+/// <param name="flAllocationType">Allocation type</param>
+/// <param name="flProtect">Memory protection</param>
+/// <returns>Status code</returns>
+NTSTATUS NativeSyscall::VirtualAllocExT( ptr_t& lpAddress, size_t dwSize, DWORD flAllocationType, DWORD flProtect )
+{
+    if (Syscalls().NtAllocateVirtualMemory == -1)
+        return Native::VirtualAllocExT( lpAddress, dwSize, flAllocationType, flProtect );
+
+    Count( NativeOp::Alloc );
+
+    PVOID base = reinterpret_cast<PVOID>(lpAddress);
+    SIZE_T size = dwSize;
+
+    NTSTATUS status = syscall::nt_syscall(
+        Syscalls().NtAllocateVirtualMemory,
+        _hProcess, &base, ULONG_PTR( 0 ), &size, flAllocationType, flProtect
+        );
+
+    lpAddress = NT_SUCCESS( status ) ? reinterpret_cast<ptr_t>(base) : 0;
+    return status;
+}
+
+/// <summary>
+/// Free virtual memory
+/// </summary>
+/// <param name="lpAddress">Memory address</param>
+/// <param name="dwSize">Region size</param>
+/// <param name="dwFreeType">Memory release type.</param>
+/// <returns>Status code</returns>
+NTSTATUS NativeSyscall::VirtualFreeExT( ptr_t lpAddress, size_t dwSize, DWORD dwFreeType )
+{
+    if (Syscalls().NtFreeVirtualMemory == -1)
+        return Native::VirtualFreeExT( lpAddress, dwSize, dwFreeType );
+
+    Count( NativeOp::Free );
+
+    PVOID base = reinterpret_cast<PVOID>(lpAddress);
+    SIZE_T size = dwSize;
+
+    return syscall::nt_syscall( Syscalls().NtFreeVirtualMemory, _hProcess, &base, &size, dwFreeType );
+}
+
+/// <summary>
+/// Change memory protection
+/// </summary>
+/// <param name="lpAddress">Memory address.</param>
+/// <param name="dwSize">Region size</param>
+/// <param name="flProtect">New protection.</param>
+/// <param name="flOld">Old protection</param>
+/// <returns>Status code</returns>
+NTSTATUS NativeSyscall::VirtualProtectExT( ptr_t lpAddress, DWORD64 dwSize, DWORD flProtect, DWORD* flOld )
+{
+    if (Syscalls().NtProtectVirtualMemory == -1)
+        return Native::VirtualProtectExT( lpAddress, dwSize, flProtect, flOld );
+
+    Count( NativeOp::Protect );
+
+    DWORD junk = 0;
+    if (!flOld)
+        flOld = &junk;
+
+    PVOID base = reinterpret_cast<PVOID>(lpAddress);
+    SIZE_T size = static_cast<SIZE_T>(dwSize);
+
+    return syscall::nt_syscall( Syscalls().NtProtectVirtualMemory, _hProcess, &base, &size, flProtect, flOld );
+}
+
+/// <summary>
+/// Read virtual memory
+/// </summary>
+/// <param name="lpBaseAddress">Memory address</param>
+/// <param name="lpBuffer">Output buffer</param>
+/// <param name="nSize">Number of bytes to read</param>
+/// <param name="lpBytes">Mumber of bytes read</param>
+/// <returns>Status code</returns>
+NTSTATUS NativeSyscall::ReadProcessMemoryT( ptr_t lpBaseAddress, LPVOID lpBuffer, size_t nSize, DWORD64 *lpBytes /*= nullptr */ )
+{
+    if (Syscalls().NtReadVirtualMemory == -1)
+        return Native::ReadProcessMemoryT( lpBaseAddress, lpBuffer, nSize, lpBytes );
+
+    Count( NativeOp::Read );
+
+    return syscall::nt_syscall(
+        Syscalls().NtReadVirtualMemory,
+        _hProcess, reinterpret_cast<PVOID>(lpBaseAddress), lpBuffer, nSize, reinterpret_cast<PSIZE_T>(lpBytes)
+        );
+}
+
+/// <summary>
+/// Get memory routines equivalent to ReadProcessMemoryT/WriteProcessMemoryT
+/// </summary>
+/// <returns>Empty set, reads must stay on direct syscalls</returns>
+MemoryRoutines NativeSyscall::GetMemoryRoutines() const
+{
+    return MemoryRoutines();
+}
+
+/// <summary>
+/// Query virtual memory
+/// </summary>
+/// <param name="lpAddress">Address to query</param>
+/// <param name="lpBuffer">Retrieved memory info</param>
+/// <returns>Status code</returns>
+NTSTATUS NativeSyscall::VirtualQueryExT( ptr_t lpAddress, PMEMORY_BASIC_INFORMATION64 lpBuffer )
+{
+    return VirtualQueryExT( lpAddress, MemoryBasicInformation, lpBuffer, sizeof( MEMORY_BASIC_INFORMATION64 ) );
+}
+
+/// <summary>
+/// Query virtual memory
+/// </summary>
+/// <param name="lpAddress">Address to query</param>
+/// <param name="lpBuffer">Retrieved memory info</param>
+/// <returns>Status code</returns>
+NTSTATUS NativeSyscall::VirtualQueryExT( ptr_t lpAddress, MEMORY_INFORMATION_CLASS infoClass, LPVOID lpBuffer, size_t bufSize )
+{
+    if (Syscalls().NtQueryVirtualMemory == -1)
+        return Native::VirtualQueryExT( lpAddress, infoClass, lpBuffer, bufSize );
+
+    Count( NativeOp::Query );
+
+    SIZE_T retLen = 0;
+    return syscall::nt_syscall(
+        Syscalls().NtQueryVirtualMemory,
+        _hProcess, reinterpret_cast<PVOID>(lpAddress), infoClass, lpBuffer, bufSize, &retLen
+        );
+}
+
+/// <summary>
+/// Call NtQueryInformationProcess for underlying process
+/// </summary>
+/// <param name="infoClass">Information class</param>
+/// <param name="lpBuffer">Output buffer</param>
+/// <param name="bufSize">Buffer size</param>
+/// <returns>Status code</returns>
+NTSTATUS NativeSyscall::QueryProcessInfoT( PROCESSINFOCLASS infoClass, LPVOID lpBuffer, uint32_t bufSize )
+{
+    if (Syscalls().NtQueryInformationProcess == -1)
+        return Native::QueryProcessInfoT( infoClass, lpBuffer, bufSize );
+
+    Count( NativeOp::QueryInfo );
+
+    ULONG length = 0;
+    return syscall::nt_syscall(
+        Syscalls().NtQueryInformationProcess,
+        _hProcess, infoClass, lpBuffer, bufSize, &length
+        );
+}
+
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "NativeSubsystem.h"
+
+namespace blackbone
+{
+
+/// <summary>
+/// Native x64 subsystem that issues syscalls directly instead of calling ntdll exports.
+/// Syscall numbers are read once from ntdll image on disk, so hooks in loaded ntdll are bypassed.
+/// Routines without resolved number fall back to Native implementation
+/// </summary>
+class NativeSyscall : public Native
+{
+public:
+    BLACKBONE_API NativeSyscall( HANDLE hProcess );
+    BLACKBONE_API ~NativeSyscall();
+
+    /// <summary>
+    /// Check if syscall numbers could be resolved
+    /// </summary>
+    /// <returns>true if direct syscalls can be used</returns>
+    BLACKBONE_API static bool Supported();
+
+    /// <summary>
+    /// Allocate virtual memory
+    /// </summary>
+    /// <param name="lpAddress">Allocation address</param>
+    /// <param name="dwSize">Region size</param>
+    /// <param name="flAllocationType">Allocation type</param>
+    /// <param name="flProtect">Memory protection</param>
+    /// <returns>Status code</returns>
+    virtual NTSTATUS VirtualAllocExT( ptr_t& lpAddress, size_t dwSize, DWORD flAllocationType, DWORD flProtect );
+
+    /// <summary>
+    /// Free virtual memory
+    /// </summary>
+    /// <param name="lpAddress">Memory address</param>
+    /// <param name="dwSize">Region size</param>
+    /// <param name="dwFreeType">Memory release type.</param>
+    /// <returns>Status code</returns>
+    virtual NTSTATUS VirtualFreeExT( ptr_t lpAddress, size_t dwSize, DWORD dwFreeType );
+
+    /// <summary>
+    /// Change memory protection
+    /// </summary>
+    /// <param name="lpAddress">Memory address.</param>
+    /// <param name="dwSize">Region size</param>
+    /// <param name="flProtect">New protection.</param>
+    /// <param name="flOld">Old protection</param>
+    /// <returns>Status code</returns>
+    virtual NTSTATUS VirtualProtectExT( ptr_t lpAddress, DWORD64 dwSize, DWORD flProtect, DWORD* flOld );
+
+    /// <summary>
+    /// Read virtual memory
+    /// </summary>
+    /// <param name="lpBaseAddress">Memory address</param>
+    /// <param name="lpBuffer">Output buffer</param>
+    /// <param name="nSize">Number of bytes to read</param>
+    /// <param name="lpBytes">Mumber of bytes read</param>
+    /// <returns>Status code</returns>
+    virtual NTSTATUS ReadProcessMemoryT( ptr_t lpBaseAddress, LPVOID lpBuffer, size_t nSize, DWORD64 *lpBytes = nullptr );
+
+    /// <summary>
+    /// Get memory routines equivalent to ReadProcessMemoryT/WriteProcessMemoryT
+    /// </summary>
+    /// <returns>Empty set, reads must stay on direct syscalls</returns>
+    virtual MemoryRoutines GetMemoryRoutines() const;
+
+    /// <summary>
+    /// Query virtual memory
+    /// </summary>
+    /// <param name="lpAddress">Address to query</param>
+    /// <param name="lpBuffer">Retrieved memory info</param>
+    /// <returns>Status code</returns>
+    virtual NTSTATUS VirtualQueryExT( ptr_t lpAddress, PMEMORY_BASIC_INFORMATION64 lpBuffer );
+
+    /// <summary>
+    /// Query virtual memory
+    /// </summary>
+    /// <param name="lpAddress">Address to query</param>
+    /// <param name="lpBuffer">Retrieved memory info</param>
+    /// <returns>Status code</returns>
+    virtual NTSTATUS VirtualQueryExT( ptr_t lpAddress, MEMORY_INFORMATION_CLASS infoClass, LPVOID lpBuffer, size_t bufSize );
+
+    /// <summary>
+    /// Call NtQueryInformationProcess for underlying process
+    /// </summary>
+    /// <param name="infoClass">Information class</param>
+    /// <param name="lpBuffer">Output buffer</param>
+    /// <param name="bufSize">Buffer size</param>
+    /// <returns>Status code</returns>
+    virtual NTSTATUS QueryProcessInfoT( PROCESSINFOCLASS infoClass, LPVOID lpBuffer, uint32_t bufSize );
+};
+
+}
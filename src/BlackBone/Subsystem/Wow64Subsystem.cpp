@@ -6,6 +6,45 @@
 namespace blackbone
 {
 
+/*
+    ; rcx - Call64 array, rdx - number of calls
+    push    rsi
+    push    rdi
+    sub     rsp, 38h
+    mov     rsi, rcx
+    mov     rdi, rdx
+    test    rdi, rdi
+    jz      done
+next:
+    mov     rax, [rsi+30h]
+    mov     [rsp+28h], rax
+    mov     rax, [rsi+28h]
+    mov     [rsp+20h], rax
+    mov     rcx, [rsi+08h]
+    mov     rdx, [rsi+10h]
+    mov     r8,  [rsi+18h]
+    mov     r9,  [rsi+20h]
+    call    qword ptr [rsi]
+    mov     [rsi+38h], rax
+    add     rsi, 40h
+    dec     rdi
+    jnz     next
+done:
+    xor     eax, eax
+    add     rsp, 38h
+    pop     rdi
+    pop     rsi
+    ret
+*/
+uint8_t NativeWow64::_batchThunk[] =
+{
+    0x56, 0x57, 0x48, 0x83, 0xEC, 0x38, 0x48, 0x89, 0xCE, 0x48, 0x89, 0xD7, 0x48, 0x85, 0xFF, 0x74,
+    0x31, 0x48, 0x8B, 0x46, 0x30, 0x48, 0x89, 0x44, 0x24, 0x28, 0x48, 0x8B, 0x46, 0x28, 0x48, 0x89,
+    0x44, 0x24, 0x20, 0x48, 0x8B, 0x4E, 0x08, 0x48, 0x8B, 0x56, 0x10, 0x4C, 0x8B, 0x46, 0x18, 0x4C,
+    0x8B, 0x4E, 0x20, 0xFF, 0x16, 0x48, 0x89, 0x46, 0x38, 0x48, 0x83, 0xC6, 0x40, 0x48, 0xFF, 0xCF,
+    0x75, 0xCF, 0x31, 0xC0, 0x48, 0x83, 0xC4, 0x38, 0x5F, 0x5E, 0xC3
+};
+
 NativeWow64::NativeWow64( HANDLE hProcess )
     : Native( hProcess )
 {
@@ -25,6 +64,8 @@ NativeWow64::~NativeWow64()
 /// <returns>Status code</returns>
 NTSTATUS NativeWow64::VirtualAllocExT( ptr_t& lpAddress, size_t dwSize, DWORD flAllocationType, DWORD flProtect )
 {
+    Count( NativeOp::Alloc );
+
     DWORD64 size64 = dwSize;
     static ptr_t ntavm = GetProcAddress64( getNTDLL64(), "NtAllocateVirtualMemory" );
     if (ntavm == 0)
@@ -42,6 +83,8 @@ NTSTATUS NativeWow64::VirtualAllocExT( ptr_t& lpAddress, size_t dwSize, DWORD fl
 /// <returns>Status code</returns>
 NTSTATUS NativeWow64::VirtualFreeExT( ptr_t lpAddress, size_t dwSize, DWORD dwFreeType )
 {
+    Count( NativeOp::Free );
+
     static ptr_t ntfvm = GetProcAddress64( getNTDLL64(), "NtFreeVirtualMemory" );
     if (ntfvm == 0)
         return STATUS_ORDINAL_NOT_FOUND;
@@ -60,6 +103,8 @@ NTSTATUS NativeWow64::VirtualFreeExT( ptr_t lpAddress, size_t dwSize, DWORD dwFr
 /// <returns>Status code</returns>
 NTSTATUS NativeWow64::VirtualQueryExT( ptr_t lpAddress, PMEMORY_BASIC_INFORMATION64 lpBuffer )
 {
+    Count( NativeOp::Query );
+
     static ptr_t ntqvm = GetProcAddress64( getNTDLL64(), "NtQueryVirtualMemory" );
     if (ntqvm == 0)
         return STATUS_ORDINAL_NOT_FOUND;
@@ -75,6 +120,8 @@ NTSTATUS NativeWow64::VirtualQueryExT( ptr_t lpAddress, PMEMORY_BASIC_INFORMATIO
 /// <returns>Status code</returns>
 NTSTATUS NativeWow64::VirtualQueryExT( ptr_t lpAddress, MEMORY_INFORMATION_CLASS infoClass, LPVOID lpBuffer, size_t bufSize )
 {
+    Count( NativeOp::Query );
+
     static ptr_t ntqvm = GetProcAddress64( getNTDLL64(), "NtQueryVirtualMemory" );
     if (ntqvm == 0)
         return STATUS_ORDINAL_NOT_FOUND;
@@ -82,6 +129,57 @@ NTSTATUS NativeWow64::VirtualQueryExT( ptr_t lpAddress, MEMORY_INFORMATION_CLASS
     return static_cast<NTSTATUS>(X64Call( ntqvm, 6, (DWORD64)_hProcess, lpAddress, (DWORD64)infoClass, (DWORD64)lpBuffer, (DWORD64)bufSize, 0ull ));
 }
 
+/// <summary>
+/// Get pages written since last reset. Region must be allocated with MEM_WRITE_WATCH
+/// </summary>
+/// <param name="lpAddress">Region address</param>
+/// <param name="dwSize">Region size</param>
+/// <param name="pages">Addresses of written pages</param>
+/// <param name="reset">Reset write tracking state of returned pages</param>
+/// <returns>Status code</returns>
+NTSTATUS NativeWow64::GetWriteWatchT( ptr_t lpAddress, size_t dwSize, std::vector<ptr_t>& pages, bool reset )
+{
+    Count( NativeOp::Query );
+
+    static ptr_t ntgww = GetProcAddress64( getNTDLL64(), "NtGetWriteWatch" );
+    if (ntgww == 0)
+        return STATUS_ORDINAL_NOT_FOUND;
+
+    // x64 function fills array of 64 bit addresses
+    std::vector<DWORD64> addresses( (dwSize + (lpAddress & 0xFFF) + 0xFFF) / 0x1000 + 1 );
+    DWORD64 count = addresses.size();
+    ULONG granularity = 0;
+
+    pages.clear();
+
+    NTSTATUS status = static_cast<NTSTATUS>(X64Call(
+        ntgww, 7, (DWORD64)_hProcess, (DWORD64)(reset ? WRITE_WATCH_FLAG_RESET : 0), lpAddress,
+        (DWORD64)dwSize, (DWORD64)addresses.data(), (DWORD64)&count, (DWORD64)&granularity
+        ));
+
+    if (NT_SUCCESS( status ))
+        pages.assign( addresses.begin(), addresses.begin() + static_cast<size_t>(count) );
+
+    return status;
+}
+
+/// <summary>
+/// Reset write tracking state of region allocated with MEM_WRITE_WATCH
+/// </summary>
+/// <param name="lpAddress">Region address</param>
+/// <param name="dwSize">Region size</param>
+/// <returns>Status code</returns>
+NTSTATUS NativeWow64::ResetWriteWatchT( ptr_t lpAddress, size_t dwSize )
+{
+    Count( NativeOp::Query );
+
+    static ptr_t ntrww = GetProcAddress64( getNTDLL64(), "NtResetWriteWatch" );
+    if (ntrww == 0)
+        return STATUS_ORDINAL_NOT_FOUND;
+
+    return static_cast<NTSTATUS>(X64Call( ntrww, 3, (DWORD64)_hProcess, lpAddress, (DWORD64)dwSize ));
+}
+
 /// <summary>
 /// Change memory protection
 /// </summary>
@@ -92,6 +190,8 @@ NTSTATUS NativeWow64::VirtualQueryExT( ptr_t lpAddress, MEMORY_INFORMATION_CLASS
 /// <returns>Status code</returns>
 NTSTATUS NativeWow64::VirtualProtectExT( ptr_t lpAddress, DWORD64 dwSize, DWORD flProtect, DWORD* flOld )
 {
+    Count( NativeOp::Protect );
+
     static ptr_t ntpvm = GetProcAddress64( getNTDLL64(), "NtProtectVirtualMemory" );
     if (ntpvm == 0)
         return STATUS_ORDINAL_NOT_FOUND;
@@ -109,6 +209,8 @@ NTSTATUS NativeWow64::VirtualProtectExT( ptr_t lpAddress, DWORD64 dwSize, DWORD
 /// <returns>Status code</returns>
 NTSTATUS NativeWow64::ReadProcessMemoryT( ptr_t lpBaseAddress, LPVOID lpBuffer, size_t nSize, DWORD64 *lpBytes /*= nullptr */ )
 {
+    Count( NativeOp::Read );
+
     DWORD64 junk = 0;
     if (lpBytes == nullptr)
         lpBytes = &junk;
@@ -116,6 +218,57 @@ NTSTATUS NativeWow64::ReadProcessMemoryT( ptr_t lpBaseAddress, LPVOID lpBuffer,
     return SAFE_NATIVE_CALL( NtWow64ReadVirtualMemory64, _hProcess, lpBaseAddress, lpBuffer, nSize, lpBytes );
 }
 
+/// <summary>
+/// Get memory routines equivalent to ReadProcessMemoryT/WriteProcessMemoryT
+/// </summary>
+/// <returns>Routines that can be called directly</returns>
+MemoryRoutines NativeWow64::GetMemoryRoutines() const
+{
+    MemoryRoutines routines;
+    routines.read64 = GET_IMPORT( NtWow64ReadVirtualMemory64 );
+    routines.write64 = GET_IMPORT( NtWow64WriteVirtualMemory64 );
+    return routines;
+}
+
+/// <summary>
+/// Read several memory ranges using single x64 transition
+/// </summary>
+/// <param name="ranges">Ranges to read, each receives its own status</param>
+/// <returns>Status code of first failed read</returns>
+NTSTATUS NativeWow64::ReadProcessMemoryBatchT( std::vector<NativeReadRange>& ranges )
+{
+    static ptr_t ntrvm = GetProcAddress64( getNTDLL64(), "NtReadVirtualMemory" );
+    if (ntrvm == 0)
+        return Native::ReadProcessMemoryBatchT( ranges );
+
+    std::vector<Call64> calls( ranges.size() );
+    for (size_t i = 0; i < ranges.size(); i++)
+    {
+        calls[i].function = ntrvm;
+        calls[i].args[0] = (DWORD64)_hProcess;
+        calls[i].args[1] = ranges[i].address;
+        calls[i].args[2] = (DWORD64)ranges[i].buffer;
+        calls[i].args[3] = (DWORD64)ranges[i].size;
+        calls[i].args[4] = (DWORD64)&ranges[i].bytes;
+    }
+
+    // Thunk is unavailable, transition per read
+    if (!NT_SUCCESS( CallBatch64( calls ) ))
+        return Native::ReadProcessMemoryBatchT( ranges );
+
+    Count( NativeOp::Read, ranges.size() );
+
+    NTSTATUS status = STATUS_SUCCESS;
+    for (size_t i = 0; i < ranges.size(); i++)
+    {
+        ranges[i].status = static_cast<NTSTATUS>(calls[i].result);
+        if (!NT_SUCCESS( ranges[i].status ) && NT_SUCCESS( status ))
+            status = ranges[i].status;
+    }
+
+    return status;
+}
+
 /// <summary>
 /// Write virtual memory
 /// </summary>
@@ -126,6 +279,8 @@ NTSTATUS NativeWow64::ReadProcessMemoryT( ptr_t lpBaseAddress, LPVOID lpBuffer,
 /// <returns>Status code</returns>
 NTSTATUS NativeWow64::WriteProcessMemoryT( ptr_t lpBaseAddress, LPCVOID lpBuffer, size_t nSize, DWORD64 *lpBytes /*= nullptr */ )
 {
+    Count( NativeOp::Write );
+
     DWORD64 junk = 0;
     if (lpBytes == nullptr)
         lpBytes = &junk;
@@ -142,6 +297,8 @@ NTSTATUS NativeWow64::WriteProcessMemoryT( ptr_t lpBaseAddress, LPCVOID lpBuffer
 /// <returns>Status code</returns>
 NTSTATUS NativeWow64::QueryProcessInfoT( PROCESSINFOCLASS infoClass, LPVOID lpBuffer, uint32_t bufSize )
 {
+    Count( NativeOp::QueryInfo );
+
     ULONG length = 0;
     return SAFE_NATIVE_CALL( NtWow64QueryInformationProcess64, _hProcess, infoClass, lpBuffer, bufSize, &length );
 }
@@ -156,6 +313,8 @@ NTSTATUS NativeWow64::QueryProcessInfoT( PROCESSINFOCLASS infoClass, LPVOID lpBu
 /// <returns>Status code</returns>
 NTSTATUS NativeWow64::SetProcessInfoT( PROCESSINFOCLASS infoClass, LPVOID lpBuffer, uint32_t bufSize )
 {
+    Count( NativeOp::SetInfo );
+
     static ptr_t ntspi = GetProcAddress64( getNTDLL64(), "NtSetInformationProcess" );
     if (ntspi == 0)
         return STATUS_ORDINAL_NOT_FOUND;
@@ -169,14 +328,16 @@ NTSTATUS NativeWow64::SetProcessInfoT( PROCESSINFOCLASS infoClass, LPVOID lpBuff
 /// <param name="hThread">Created thread handle</param>
 /// <param name="entry">Thread entry point</param>
 /// <param name="arg">Thread argument</param>
-/// <param name="flags">Creation flags</param>
+/// <param name="options">Creation flags and stack sizes</param>
 /// <returns>Status code</returns>*/
-NTSTATUS NativeWow64::CreateRemoteThreadT( HANDLE& hThread, ptr_t entry, ptr_t arg, CreateThreadFlags flags, DWORD access )
+NTSTATUS NativeWow64::CreateRemoteThreadT( HANDLE& hThread, ptr_t entry, ptr_t arg, const ThreadCreateOptions& options, DWORD access )
 {
+    Count( NativeOp::CreateThread );
+
     // Try to use default routine if possible
     /*if(_wowBarrier.targetWow64 == true)
     {
-        return Native::CreateRemoteThreadT( hThread, entry, arg, flags, access );
+        return Native::CreateRemoteThreadT( hThread, entry, arg, options, access );
     }
     else*/
     {
@@ -189,8 +350,8 @@ NTSTATUS NativeWow64::CreateRemoteThreadT( HANDLE& hThread, ptr_t entry, ptr_t a
 
         NTSTATUS status = static_cast<NTSTATUS>(X64Call(
             NtCreateThreadEx, 11, (DWORD64)&hThd2, (DWORD64)access, 0ull,
-            (DWORD64)_hProcess, (DWORD64)entry, (DWORD64)arg, (DWORD64)flags,
-            0ull, 0x1000ull, 0x100000ull, 0ull
+            (DWORD64)_hProcess, (DWORD64)entry, (DWORD64)arg, (DWORD64)options.flags,
+            0ull, (DWORD64)options.stackCommit, (DWORD64)options.stackReserve, 0ull
             ));
 
         hThread = reinterpret_cast<HANDLE>(hThd2);
@@ -207,6 +368,8 @@ NTSTATUS NativeWow64::CreateRemoteThreadT( HANDLE& hThread, ptr_t entry, ptr_t a
 /// <returns>Status code</returns>
 NTSTATUS NativeWow64::GetThreadContextT( HANDLE hThread, _CONTEXT32& ctx )
 {
+    Count( NativeOp::GetContext );
+
     // Target process is x64. 32bit CONTEXT is not available.
     if (_wowBarrier.targetWow64 == false)
     {
@@ -229,6 +392,8 @@ NTSTATUS NativeWow64::GetThreadContextT( HANDLE hThread, _CONTEXT32& ctx )
 /// <returns>Status code</returns>
 NTSTATUS NativeWow64::GetThreadContextT( HANDLE hThread, _CONTEXT64& ctx )
 {
+    Count( NativeOp::GetContext );
+
     static ptr_t gtc = GetProcAddress64( getNTDLL64(), "NtGetContextThread" );
     if (gtc == 0)
         return STATUS_ORDINAL_NOT_FOUND;
@@ -244,6 +409,8 @@ NTSTATUS NativeWow64::GetThreadContextT( HANDLE hThread, _CONTEXT64& ctx )
 /// <returns>Status code</returns>
 NTSTATUS NativeWow64::SetThreadContextT( HANDLE hThread, _CONTEXT32& ctx )
 {
+    Count( NativeOp::SetContext );
+
     // Target process is x64. 32bit CONTEXT is not available.
     if (_wowBarrier.targetWow64 == false)
     {
@@ -265,6 +432,8 @@ NTSTATUS NativeWow64::SetThreadContextT( HANDLE hThread, _CONTEXT32& ctx )
 /// <returns>Status code</returns>
 NTSTATUS NativeWow64::SetThreadContextT( HANDLE hThread, _CONTEXT64& ctx )
 {
+    Count( NativeOp::SetContext );
+
     static ptr_t stc = GetProcAddress64( getNTDLL64(), "NtSetContextThread" );
     if (stc == 0)
         return STATUS_ORDINAL_NOT_FOUND;
@@ -284,6 +453,8 @@ NTSTATUS NativeWow64::QueueApcT( HANDLE hThread, ptr_t func, ptr_t arg )
     if (_wowBarrier.targetWow64)
         return Native::QueueApcT( hThread, func, arg );
 
+    Count( NativeOp::QueueApc );
+
     static ptr_t qat = GetProcAddress64( getNTDLL64(), "NtQueueApcThread" );
     if (qat == 0)
         return STATUS_ORDINAL_NOT_FOUND;
@@ -382,4 +553,40 @@ ptr_t NativeWow64::getTEB( HANDLE hThread, _TEB64* pteb )
     return 0;
 }
 
-}
\ No newline at end of file
+/// <summary>
+/// Execute several x64 routines using single x64 transition
+/// </summary>
+/// <param name="calls">Calls to perform, executed in order</param>
+/// <returns>Status code</returns>
+NTSTATUS NativeWow64::CallBatch64( std::vector<Call64>& calls )
+{
+    // Thunk is copied into executable memory once
+    static void* pThunk = []() -> void*
+    {
+        DWORD flOld = 0;
+        void* ptr = VirtualAlloc( nullptr, sizeof( _batchThunk ), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE );
+        if (ptr == nullptr)
+            return nullptr;
+
+        memcpy( ptr, _batchThunk, sizeof( _batchThunk ) );
+        if (!VirtualProtect( ptr, sizeof( _batchThunk ), PAGE_EXECUTE_READ, &flOld ))
+        {
+            VirtualFree( ptr, 0, MEM_RELEASE );
+            return nullptr;
+        }
+
+        FlushInstructionCache( GetCurrentProcess(), ptr, sizeof( _batchThunk ) );
+        return ptr;
+    }();
+
+    if (pThunk == nullptr)
+        return STATUS_NO_MEMORY;
+
+    if (calls.empty())
+        return STATUS_SUCCESS;
+
+    X64Call( (DWORD64)pThunk, 2, (DWORD64)calls.data(), (DWORD64)calls.size() );
+    return STATUS_SUCCESS;
+}
+
+}
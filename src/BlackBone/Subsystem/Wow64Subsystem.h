@@ -5,6 +5,16 @@
 namespace blackbone
 {
 
+/// <summary>
+/// Single native x64 call of NativeWow64::CallBatch64
+/// </summary>
+struct Call64
+{
+    DWORD64 function = 0;       // x64 routine address
+    DWORD64 args[6] = { 0 };    // Arguments, unused ones are ignored by callee
+    DWORD64 result = 0;         // Returned value
+};
+
 class NativeWow64 : public Native
 {
 public:
@@ -50,6 +60,19 @@ public:
     /// <returns>Status code</returns>
     virtual NTSTATUS ReadProcessMemoryT( ptr_t lpBaseAddress, LPVOID lpBuffer, size_t nSize, DWORD64 *lpBytes = nullptr );
 
+    /// <summary>
+    /// Read several memory ranges using single x64 transition
+    /// </summary>
+    /// <param name="ranges">Ranges to read, each receives its own status</param>
+    /// <returns>Status code of first failed read</returns>
+    virtual NTSTATUS ReadProcessMemoryBatchT( std::vector<NativeReadRange>& ranges );
+
+    /// <summary>
+    /// Get memory routines equivalent to ReadProcessMemoryT/WriteProcessMemoryT
+    /// </summary>
+    /// <returns>Routines that can be called directly</returns>
+    virtual MemoryRoutines GetMemoryRoutines() const;
+
     /// <summary>
     /// Write virtual memory
     /// </summary>
@@ -76,6 +99,24 @@ public:
     /// <returns>Status code</returns>
     virtual NTSTATUS VirtualQueryExT( ptr_t lpAddress, MEMORY_INFORMATION_CLASS infoClass, LPVOID lpBuffer, size_t bufSize );
 
+    /// <summary>
+    /// Get pages written since last reset. Region must be allocated with MEM_WRITE_WATCH
+    /// </summary>
+    /// <param name="lpAddress">Region address</param>
+    /// <param name="dwSize">Region size</param>
+    /// <param name="pages">Addresses of written pages</param>
+    /// <param name="reset">Reset write tracking state of returned pages</param>
+    /// <returns>Status code</returns>
+    virtual NTSTATUS GetWriteWatchT( ptr_t lpAddress, size_t dwSize, std::vector<ptr_t>& pages, bool reset );
+
+    /// <summary>
+    /// Reset write tracking state of region allocated with MEM_WRITE_WATCH
+    /// </summary>
+    /// <param name="lpAddress">Region address</param>
+    /// <param name="dwSize">Region size</param>
+    /// <returns>Status code</returns>
+    virtual NTSTATUS ResetWriteWatchT( ptr_t lpAddress, size_t dwSize );
+
     /// <summary>
     /// Call NtQueryInformationProcess for underlying process
     /// </summary>
@@ -102,7 +143,7 @@ public:
     /// <param name="arg">Thread argument</param>
     /// <param name="flags">Creation flags</param>
     /// <returns>Status code</returns>
-    virtual NTSTATUS CreateRemoteThreadT( HANDLE& hThread, ptr_t entry, ptr_t arg, CreateThreadFlags flags, DWORD access = THREAD_ALL_ACCESS );
+    virtual NTSTATUS CreateRemoteThreadT( HANDLE& hThread, ptr_t entry, ptr_t arg, const ThreadCreateOptions& options, DWORD access = THREAD_ALL_ACCESS );
 
     /// <summary>
     /// Get native thread context
@@ -172,6 +213,16 @@ public:
     /// <param name="ppeb">Retrieved TEB</param>
     /// <returns>TEB pointer</returns>
     virtual ptr_t getTEB( HANDLE hThread, _TEB64* pteb );
+
+    /// <summary>
+    /// Execute several x64 routines using single x64 transition
+    /// </summary>
+    /// <param name="calls">Calls to perform, executed in order</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API static NTSTATUS CallBatch64( std::vector<Call64>& calls );
+
+private:
+    static uint8_t _batchThunk[];
 };
 
 }
\ No newline at end of file
@@ -22,6 +22,8 @@ x86Native::~x86Native()
 /// <returns>Status code</returns>
 NTSTATUS x86Native::VirtualQueryExT( ptr_t lpAddress, PMEMORY_BASIC_INFORMATION64 lpBuffer )
 {
+    Count( NativeOp::Query );
+
     MEMORY_BASIC_INFORMATION tmp = { 0 };
 
     NTSTATUS status = SAFE_NATIVE_CALL(
@@ -52,6 +54,8 @@ NTSTATUS x86Native::VirtualQueryExT( ptr_t lpAddress, PMEMORY_BASIC_INFORMATION6
 /// <returns>Status code</returns>
 NTSTATUS x86Native::GetThreadContextT( HANDLE hThread, _CONTEXT32& ctx )
 {
+    Count( NativeOp::GetContext );
+
     SetLastNtStatus( STATUS_SUCCESS );
     GetThreadContext( hThread, reinterpret_cast<PCONTEXT>(&ctx) );
     return LastNtStatus();
@@ -65,6 +69,8 @@ NTSTATUS x86Native::GetThreadContextT( HANDLE hThread, _CONTEXT32& ctx )
 /// <returns>Status code</returns>
 NTSTATUS x86Native::GetThreadContextT( HANDLE /*hThread*/, _CONTEXT64& /*ctx*/ )
 {
+    Count( NativeOp::GetContext );
+
     // There is no x64 context under x86 OS
     return STATUS_NOT_SUPPORTED;
 }
@@ -77,6 +83,8 @@ NTSTATUS x86Native::GetThreadContextT( HANDLE /*hThread*/, _CONTEXT64& /*ctx*/ )
 /// <returns>Status code</returns>
 NTSTATUS x86Native::SetThreadContextT( HANDLE hThread, _CONTEXT32& ctx )
 {
+    Count( NativeOp::SetContext );
+
     SetLastNtStatus( STATUS_SUCCESS );
     SetThreadContext( hThread, reinterpret_cast<const CONTEXT*>(&ctx) );
     return LastNtStatus();
@@ -90,6 +98,8 @@ NTSTATUS x86Native::SetThreadContextT( HANDLE hThread, _CONTEXT32& ctx )
 /// <returns>Status code</returns>
 NTSTATUS x86Native::SetThreadContextT( HANDLE /*hThread*/, _CONTEXT64& /*ctx*/ )
 {
+    Count( NativeOp::SetContext );
+
     // There is no x64 context under x86 OS
     return STATUS_NOT_SUPPORTED;
 }
@@ -31,6 +31,12 @@ public:
     /// <returns>Status code</returns>
     HRESULT GetSymAddress( const std::wstring& symName, ptr_t& result );
 
+    /// <summary>
+    /// Get all module symbols
+    /// </summary>
+    /// <returns>Symbol name <--> RVA map</returns>
+    const std::unordered_map<std::wstring, uint32_t>& symbols() const { return _cache; }
+
 private:
     /// <summary>
     /// Initialize DIA
@@ -1,6 +1,7 @@
 #include "PatternLoader.h"
 #include "../Include/Winheaders.h"
 #include "../Patterns/PatternSearch.h"
+#include "../Patterns/PatternSet.h"
 #include "../Misc/Trace.hpp"
 #include <3rd_party/VersionApi.h>
 
@@ -27,6 +28,37 @@ struct ScanParams
     ptr_t diff = 0;
 };
 
+/// <summary>
+/// Translate pattern match into resulting address
+/// </summary>
+/// <param name="rule">Pattern rule</param>
+/// <param name="scan">Scanned image</param>
+/// <param name="found">Address of pattern inside local image</param>
+/// <returns>Resulting address, 0 if rule has no result</returns>
+ptr_t ApplyRule( const OffsetData& rule, const ScanParams& scan, ptr_t found )
+{
+    // Plain pointer sum
+    if (rule.functionOffset != -1)
+    {
+        return found - rule.functionOffset + scan.diff;
+    }
+    // Pointer dereference inside instruction
+    else if (rule.dataStartOffset != 0)
+    {
+        if (rule.bit64)
+        {
+            return *reinterpret_cast<int32_t*>(found + (rule.dataStartOffset + rule.dataOperandOffset)) +
+                (found + rule.dataStartOffset + rule.dataInstructionSize) + scan.diff;
+        }
+        else
+        {
+            return *reinterpret_cast<int32_t*>(found + rule.dataStartOffset);
+        }
+    }
+
+    return 0;
+}
+
 void FindPattern( const ScanParams& scan32, const ScanParams& scan64, const OffsetData& rule, ptr_t& result )
 {
     // Skip if already found
@@ -37,30 +69,39 @@ void FindPattern( const ScanParams& scan32, const ScanParams& scan64, const Offs
 
     const ScanParams& scan = rule.bit64 ? scan64 : scan32;
 
-    std::vector<ptr_t> found;
-    rule.pattern.Search( reinterpret_cast<void*>(scan.start), static_cast<size_t>(scan.size), found );
-    if (!found.empty())
+    ptr_t found = rule.pattern.SearchFirst( reinterpret_cast<void*>(scan.start), static_cast<size_t>(scan.size) );
+    if (found != 0)
+        result = ApplyRule( rule, scan, found );
+};
+
+/// <summary>
+/// Find all rules in one pass over image code section
+/// </summary>
+/// <param name="scan">Scanned image</param>
+/// <param name="rules">Rules to search</param>
+void FindPatterns( const ScanParams& scan, const std::vector<std::pair<ptr_t*, const OffsetData*>>& rules )
+{
+    if (rules.empty() || scan.start == 0)
+        return;
+
+    PatternSet set;
+    for (const auto& rule : rules)
+        set.Add( rule.second->pattern );
+
+    std::vector<PatternSet::Match> found;
+    set.Search( reinterpret_cast<void*>(scan.start), static_cast<size_t>(scan.size), found );
+
+    // Only first match of every rule is used
+    std::vector<bool> done( rules.size(), false );
+    for (const auto& match : found)
     {
-        // Plain pointer sum
-        if (rule.functionOffset != -1)
-        {
-            result = found.front() - rule.functionOffset + scan.diff;
-        }
-        // Pointer dereference inside instruction
-        else if (rule.dataStartOffset != 0)
-        {
-            if (rule.bit64)
-            {
-                result = *reinterpret_cast<int32_t*>(found.front() + (rule.dataStartOffset + rule.dataOperandOffset)) +
-                    (found.front() + rule.dataStartOffset + rule.dataInstructionSize) + scan.diff;
-            }
-            else
-            {
-                result = *reinterpret_cast<int32_t*>(found.front() + rule.dataStartOffset);
-            }
-        }
+        if (done[match.id])
+            continue;
+
+        done[match.id] = true;
+        *rules[match.id].first = ApplyRule( *rules[match.id].second, scan, match.address );
     }
-};
+}
 
 /// <summary>
 /// Fill OS-dependent patterns
@@ -201,82 +242,86 @@ void OSFillPatterns( std::unordered_map<ptr_t*, OffsetData>& patterns, SymbolDat
 }
 
 /// <summary>
-/// Scan ntdll for internal loader data
+/// Scan ntdll for internal loader data.
+/// Only rules matching image architecture are searched, so x86 and x64 images can be scanned concurrently
+/// into separate results
 /// </summary>
-/// <param name="ntdll32">Mapped x86 ntdll</param>
-/// <param name="ntdll64">Mapped x64 ntdll</param>
+/// <param name="ntdll">Mapped x86 or x64 ntdll</param>
+/// <param name="bit64">Image is x64 ntdll</param>
 /// <param name="result">Result</param>
 /// <returns>Status code</returns>
-NTSTATUS ScanSymbolPatterns( const pe::PEImage& ntdll32, const pe::PEImage& ntdll64, SymbolData& result )
+NTSTATUS ScanSymbolPatterns( const pe::PEImage& ntdll, bool bit64, SymbolData& result )
 {
-    ScanParams scan32, scan64;
+    ScanParams scan, none;
+    scan.diff = static_cast<int64_t>(ntdll.imageBase()) - reinterpret_cast<int64_t>(ntdll.base());
 
-    scan32.diff = static_cast<int64_t>(ntdll32.imageBase()) - reinterpret_cast<int64_t>(ntdll32.base());
-    scan64.diff = static_cast<int64_t>(ntdll64.imageBase()) - reinterpret_cast<int64_t>(ntdll64.base());
-
-    auto fillRanges = []( const pe::PEImage& file, ScanParams& params )
+    // Get code section bounds
+    if (ntdll.base())
     {
-        for (const auto& sec : file.sections())
+        for (const auto& sec : ntdll.sections())
         {
             if (_stricmp( reinterpret_cast<const char*>(sec.Name), ".text" ) == 0)
             {
-                params.start = reinterpret_cast<ptr_t>(file.base()) + sec.VirtualAddress;
-                params.size = sec.Misc.VirtualSize;
+                scan.start = reinterpret_cast<ptr_t>(ntdll.base()) + sec.VirtualAddress;
+                scan.size = sec.Misc.VirtualSize;
                 break;
             }
         }
-    };
-
-    // Get code section bounds
-    fillRanges( ntdll32, scan32 );
-    if (ntdll64.base())
-    {
-        fillRanges( ntdll64, scan64 );
-    }  
+    }
 
     std::unordered_map<ptr_t*, OffsetData> patterns;
     OSFillPatterns( patterns, result );
 
-    // Final search
+    // Final search, image is scanned once for all rules
+    std::vector<std::pair<ptr_t*, const OffsetData*>> rules;
     for (const auto& e : patterns)
     {
-        FindPattern( scan32, scan64, e.second, *e.first );
+        if (*e.first == 0 && e.second.bit64 == bit64)
+            rules.emplace_back( e.first, &e.second );
     }
 
+    FindPatterns( scan, rules );
+
     // Retry with old patterns
-    if (result.RtlInsertInvertedFunctionTable32 == 0 && IsWindows8Point1OrGreater() && !IsWindows10RS2OrGreater())
+    if (!bit64 && result.RtlInsertInvertedFunctionTable32 == 0 && IsWindows8Point1OrGreater() && !IsWindows10RS2OrGreater())
     {
         // RtlInsertInvertedFunctionTable
         // 8D 45 F4 89 55 F8 50 8D 55 FC
         OffsetData rule1{ "\x8d\x45\xf4\x89\x55\xf8\x50\x8d\x55\xfc", false, 0xB };
         OffsetData rule2{ "\x8d\x45\xf4\x89\x55\xf8\x50\x8d\x55\xfc", false, -1, 0x1D };
 
-        FindPattern( scan32, scan64, rule1, result.RtlInsertInvertedFunctionTable32 );
-        FindPattern( scan32, scan64, rule2, result.LdrpInvertedFunctionTable32 );
+        FindPattern( scan, none, rule1, result.RtlInsertInvertedFunctionTable32 );
+        FindPattern( scan, none, rule2, result.LdrpInvertedFunctionTable32 );
     }
 
     // Report errors
 #ifndef BLACKBONE_NO_TRACE
-    if (result.LdrpHandleTlsData64 == 0)
-        BLACKBONE_TRACE( "PatternData: LdrpHandleTlsData64 not found" );
-    if (result.LdrpHandleTlsData32 == 0)
-        BLACKBONE_TRACE( "PatternData: LdrpHandleTlsData32 not found" );
-    if (IsWindows8Point1OrGreater() && result.LdrpInvertedFunctionTable64 == 0)
-        BLACKBONE_TRACE( "PatternData: LdrpInvertedFunctionTable64 not found" );
-    if (result.LdrpInvertedFunctionTable32 == 0)
-        BLACKBONE_TRACE( "PatternData: LdrpInvertedFunctionTable32 not found" );
-    if (IsWindows8Point1OrGreater() && result.RtlInsertInvertedFunctionTable64 == 0)
-        BLACKBONE_TRACE( "PatternData: RtlInsertInvertedFunctionTable64 not found" );
-    if (result.RtlInsertInvertedFunctionTable32 == 0)
-        BLACKBONE_TRACE( "PatternData: RtlInsertInvertedFunctionTable32 not found" );
-    if (IsWindows8Point1OrGreater() && result.LdrProtectMrdata == 0)
-        BLACKBONE_TRACE( "PatternData: LdrProtectMrdata not found" );
-    if (IsWindows7OrGreater() && !IsWindows8OrGreater())
+    if (bit64)
+    {
+        if (result.LdrpHandleTlsData64 == 0)
+            BLACKBONE_TRACE( "PatternData: LdrpHandleTlsData64 not found" );
+        if (IsWindows8Point1OrGreater() && result.LdrpInvertedFunctionTable64 == 0)
+            BLACKBONE_TRACE( "PatternData: LdrpInvertedFunctionTable64 not found" );
+        if (IsWindows8Point1OrGreater() && result.RtlInsertInvertedFunctionTable64 == 0)
+            BLACKBONE_TRACE( "PatternData: RtlInsertInvertedFunctionTable64 not found" );
+        if (IsWindows7OrGreater() && !IsWindows8OrGreater())
+        {
+            if (result.LdrKernel32PatchAddress == 0)
+                BLACKBONE_TRACE( "PatternData: LdrKernel32PatchAddress not found" );
+            if (result.APC64PatchAddress == 0)
+                BLACKBONE_TRACE( "PatternData: APC64PatchAddress not found" );
+        }
+    }
+    else
     {
-        if (result.LdrKernel32PatchAddress == 0)
-            BLACKBONE_TRACE( "PatternData: LdrKernel32PatchAddress not found" );
-        if (result.APC64PatchAddress == 0)
-            BLACKBONE_TRACE( "PatternData: APC64PatchAddress not found" );
+        if (result.LdrpHandleTlsData32 == 0)
+            BLACKBONE_TRACE( "PatternData: LdrpHandleTlsData32 not found" );
+        if (result.LdrpInvertedFunctionTable32 == 0)
+            BLACKBONE_TRACE( "PatternData: LdrpInvertedFunctionTable32 not found" );
+        if (result.RtlInsertInvertedFunctionTable32 == 0)
+            BLACKBONE_TRACE( "PatternData: RtlInsertInvertedFunctionTable32 not found" );
+        if (IsWindows8Point1OrGreater() && result.LdrProtectMrdata == 0)
+            BLACKBONE_TRACE( "PatternData: LdrProtectMrdata not found" );
     }
 #endif
 
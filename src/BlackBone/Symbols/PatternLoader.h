@@ -6,12 +6,14 @@ namespace blackbone
 {
 
 /// <summary>
-/// Scan ntdll for internal loader data
+/// Scan ntdll for internal loader data.
+/// Only rules matching image architecture are searched, so x86 and x64 images can be scanned concurrently
+/// into separate results
 /// </summary>
-/// <param name="ntdll32">Mapped x86 ntdll</param>
-/// <param name="ntdll64">Mapped x64 ntdll</param>
+/// <param name="ntdll">Mapped x86 or x64 ntdll</param>
+/// <param name="bit64">Image is x64 ntdll</param>
 /// <param name="result">Result</param>
 /// <returns>Status code</returns>
-NTSTATUS ScanSymbolPatterns( const pe::PEImage& ntdll32, const pe::PEImage& ntdll64, SymbolData& result );
+NTSTATUS ScanSymbolPatterns( const pe::PEImage& ntdll, bool bit64, SymbolData& result );
 
 }
\ No newline at end of file
@@ -0,0 +1,192 @@
+#include "SymbolCache.h"
+#include "../Include/HandleGuard.h"
+#include "../Misc/BinaryStream.h"
+
+namespace blackbone
+{
+
+// 'BBSC'
+constexpr uint32_t CacheMagic = 0x43534242;
+constexpr uint32_t CacheVersion = 1;
+
+// 'RSDS'
+constexpr uint32_t CodeViewSignature = 0x53445352;
+
+/// <summary>
+/// CodeView PDB 7.0 record
+/// </summary>
+struct CodeViewRecord
+{
+    uint32_t signature;
+    GUID guid;
+    uint32_t age;
+};
+
+/// <summary>
+/// Override cache file location. Empty path disables cache.
+/// Must be called before first Process object is created
+/// </summary>
+/// <param name="newPath">Cache file path</param>
+void SymbolCache::SetPath( const std::wstring& newPath )
+{
+    path() = newPath;
+}
+
+/// <summary>
+/// Get cache file path
+/// </summary>
+/// <returns>Cache file path, empty if cache is disabled</returns>
+const std::wstring& SymbolCache::GetPath()
+{
+    return path();
+}
+
+/// <summary>
+/// Cache file path storage
+/// </summary>
+/// <returns>Cache file path</returns>
+std::wstring& SymbolCache::path()
+{
+    static std::wstring cachePath = []
+    {
+        wchar_t tempDir[MAX_PATH] = { };
+        if (GetTempPathW( _countof( tempDir ), tempDir ) == 0)
+            return std::wstring();
+
+        return std::wstring( tempDir ) + L"BlackBoneSymbols.bin";
+    }();
+
+    return cachePath;
+}
+
+/// <summary>
+/// Get image identity from PE header and debug directory. No PDB or DIA access involved
+/// </summary>
+/// <param name="image">Loaded image, empty key if image isn't loaded</param>
+/// <returns>Image key</returns>
+SymbolCache::ImageKey SymbolCache::GetImageKey( const pe::PEImage& image )
+{
+    ImageKey key;
+
+    auto pDosHdr = reinterpret_cast<const IMAGE_DOS_HEADER*>(image.base());
+    if (pDosHdr == nullptr)
+        return key;
+
+    // FileHeader is at the same offset for PE32 and PE32+
+    auto pNtHdr = reinterpret_cast<const IMAGE_NT_HEADERS32*>(reinterpret_cast<const uint8_t*>(pDosHdr) + pDosHdr->e_lfanew);
+    key.timestamp = pNtHdr->FileHeader.TimeDateStamp;
+    key.imageSize = image.imageSize();
+
+    auto pDebug = reinterpret_cast<const IMAGE_DEBUG_DIRECTORY*>(image.DirectoryAddress( IMAGE_DIRECTORY_ENTRY_DEBUG ));
+    if (pDebug == nullptr)
+        return key;
+
+    size_t count = image.DirectorySize( IMAGE_DIRECTORY_ENTRY_DEBUG ) / sizeof( IMAGE_DEBUG_DIRECTORY );
+    for (size_t i = 0; i < count; i++)
+    {
+        if (pDebug[i].Type != IMAGE_DEBUG_TYPE_CODEVIEW || pDebug[i].SizeOfData < sizeof( CodeViewRecord ))
+            continue;
+
+        auto pRecord = reinterpret_cast<const CodeViewRecord*>(image.ResolveRVAToVA( pDebug[i].AddressOfRawData ));
+        if (pRecord != nullptr && pRecord->signature == CodeViewSignature)
+        {
+            key.pdbGuid = pRecord->guid;
+            key.pdbAge = pRecord->age;
+            break;
+        }
+    }
+
+    return key;
+}
+
+/// <summary>
+/// Load symbols stored for given ntdll builds
+/// </summary>
+/// <param name="key32">x86 ntdll key</param>
+/// <param name="key64">x64 ntdll key</param>
+/// <param name="result">Stored symbols</param>
+/// <returns>true if cache exists and matches both images</returns>
+bool SymbolCache::Load( const ImageKey& key32, const ImageKey& key64, SymbolData& result )
+{
+    if (path().empty())
+        return false;
+
+    auto hFile = Handle( CreateFileW( path().c_str(), FILE_GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL ) );
+    if (!hFile)
+        return false;
+
+    uint8_t buf[sizeof( uint32_t ) * 3 + sizeof( ImageKey ) * 2 + sizeof( SymbolData )] = { };
+    DWORD bytes = 0;
+    if (!ReadFile( hFile, buf, sizeof( buf ), &bytes, NULL ) || bytes != sizeof( buf ))
+        return false;
+
+    BinaryReader reader( buf, sizeof( buf ) );
+    uint32_t magic = 0, version = 0, dataSize = 0;
+    ImageKey stored32, stored64;
+    SymbolData data;
+
+    if (!reader.get( magic ) || !reader.get( version ) || !reader.get( dataSize ) ||
+        !reader.get( stored32 ) || !reader.get( stored64 ) || !reader.get( data ))
+    {
+        return false;
+    }
+
+    // Stale file or different ntdll build
+    if (magic != CacheMagic || version != CacheVersion || dataSize != sizeof( SymbolData ) ||
+        memcmp( &stored32, &key32, sizeof( key32 ) ) != 0 || memcmp( &stored64, &key64, sizeof( key64 ) ) != 0)
+    {
+        return false;
+    }
+
+    result = data;
+    return true;
+}
+
+/// <summary>
+/// Replace cache contents
+/// </summary>
+/// <param name="key32">x86 ntdll key</param>
+/// <param name="key64">x64 ntdll key</param>
+/// <param name="data">Symbols to store</param>
+/// <returns>Status code</returns>
+NTSTATUS SymbolCache::Store( const ImageKey& key32, const ImageKey& key64, const SymbolData& data )
+{
+    if (path().empty())
+        return STATUS_SUCCESS;
+
+    BinaryWriter writer;
+    writer.put( CacheMagic );
+    writer.put( CacheVersion );
+    writer.put( static_cast<uint32_t>(sizeof( SymbolData )) );
+    writer.put( key32 );
+    writer.put( key64 );
+    writer.put( data );
+
+    // Write to temporary file first, so concurrently starting processes never see partial cache
+    auto tmpPath = path() + L"." + std::to_wstring( GetCurrentProcessId() ) + L".tmp";
+    auto hFile = Handle( CreateFileW( tmpPath.c_str(), FILE_GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, 0, NULL ) );
+    if (!hFile)
+        return LastNtStatus();
+
+    DWORD bytes = 0;
+    auto& buf = writer.data();
+    if (!WriteFile( hFile, buf.data(), static_cast<DWORD>(buf.size()), &bytes, NULL ) || bytes != buf.size())
+    {
+        auto status = LastNtStatus();
+        hFile.reset();
+        DeleteFileW( tmpPath.c_str() );
+        return status;
+    }
+
+    hFile.reset();
+    if (!MoveFileExW( tmpPath.c_str(), path().c_str(), MOVEFILE_REPLACE_EXISTING ))
+    {
+        auto status = LastNtStatus();
+        DeleteFileW( tmpPath.c_str() );
+        return status;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+}
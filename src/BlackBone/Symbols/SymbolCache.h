@@ -0,0 +1,76 @@
+#pragma once
+#include "SymbolData.h"
+#include "../PE/PEImage.h"
+
+#include <string>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Persistent on-disk copy of loaded SymbolData.
+/// Entry is keyed by CodeView PDB GUID and age of both ntdll images, with timestamp and image size
+/// as a fallback, so it is only matched by exactly the same ntdll builds.
+/// Cache file is %TEMP%\BlackBoneSymbols.bin by default.
+/// </summary>
+class SymbolCache
+{
+public:
+    /// <summary>
+    /// Image build identity
+    /// </summary>
+    struct ImageKey
+    {
+        GUID pdbGuid = { };         // CodeView PDB GUID
+        uint32_t pdbAge = 0;        // CodeView PDB age
+        uint32_t timestamp = 0;     // File header timestamp
+        uint32_t imageSize = 0;     // Image size
+    };
+
+    /// <summary>
+    /// Override cache file location. Empty path disables cache.
+    /// Must be called before first Process object is created
+    /// </summary>
+    /// <param name="path">Cache file path</param>
+    BLACKBONE_API static void SetPath( const std::wstring& path );
+
+    /// <summary>
+    /// Get cache file path
+    /// </summary>
+    /// <returns>Cache file path, empty if cache is disabled</returns>
+    BLACKBONE_API static const std::wstring& GetPath();
+
+    /// <summary>
+    /// Get image identity from PE header and debug directory. No PDB or DIA access involved
+    /// </summary>
+    /// <param name="image">Loaded image, empty key if image isn't loaded</param>
+    /// <returns>Image key</returns>
+    BLACKBONE_API static ImageKey GetImageKey( const pe::PEImage& image );
+
+    /// <summary>
+    /// Load symbols stored for given ntdll builds
+    /// </summary>
+    /// <param name="key32">x86 ntdll key</param>
+    /// <param name="key64">x64 ntdll key</param>
+    /// <param name="result">Stored symbols</param>
+    /// <returns>true if cache exists and matches both images</returns>
+    BLACKBONE_API static bool Load( const ImageKey& key32, const ImageKey& key64, SymbolData& result );
+
+    /// <summary>
+    /// Replace cache contents
+    /// </summary>
+    /// <param name="key32">x86 ntdll key</param>
+    /// <param name="key64">x64 ntdll key</param>
+    /// <param name="data">Symbols to store</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API static NTSTATUS Store( const ImageKey& key32, const ImageKey& key64, const SymbolData& data );
+
+private:
+    /// <summary>
+    /// Cache file path storage
+    /// </summary>
+    /// <returns>Cache file path</returns>
+    static std::wstring& path();
+};
+
+}
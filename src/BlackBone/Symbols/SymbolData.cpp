@@ -1,7 +1,75 @@
 #pragma once
 #include "SymbolData.h"
+#include "SymbolLoader.h"
+
+#include <thread>
 
 namespace blackbone
 {
-	SymbolData g_symbols;
-}
\ No newline at end of file
+	LazySymbolData g_symbols;
+
+	/// <summary>
+	/// Answer first access from pattern scan and load PDBs in background.
+	/// Must be set before symbols are first used
+	/// </summary>
+	/// <param name="state">Enable async mode</param>
+	void LazySymbolData::EnableAsyncPdb( bool state )
+	{
+		_asyncPdb = state;
+	}
+
+	/// <summary>
+	/// Get symbols, resolving them on first call
+	/// </summary>
+	/// <returns>Found symbols</returns>
+	SymbolData LazySymbolData::get()
+	{
+		std::call_once( _once, [this]
+		{
+			SymbolLoader sl;
+			SymbolData data;
+			bool complete = true;
+
+			if (_asyncPdb)
+				sl.LoadFast( data, complete );
+			else
+				sl.Load( data );
+
+			{
+				std::lock_guard<std::mutex> lck( _shared->lock );
+				_shared->data = data;
+				_shared->state = complete ? sym_complete : sym_pending;
+			}
+
+			// Upgrade to PDB addresses once they arrive
+			if (!complete)
+			{
+				std::thread( [shared = _shared]
+				{
+					SymbolLoader loader;
+					SymbolData full;
+					bool found = NT_SUCCESS( loader.Load( full ) );
+
+					std::lock_guard<std::mutex> lck( shared->lock );
+					if (found)
+						shared->data = full;
+
+					shared->state = sym_complete;
+				} ).detach();
+			}
+		} );
+
+		std::lock_guard<std::mutex> lck( _shared->lock );
+		return _shared->data;
+	}
+
+	/// <summary>
+	/// Get resolution state
+	/// </summary>
+	/// <returns>Symbol state</returns>
+	eSymbolState LazySymbolData::state() const
+	{
+		std::lock_guard<std::mutex> lck( _shared->lock );
+		return _shared->state;
+	}
+}
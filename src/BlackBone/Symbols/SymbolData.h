@@ -1,6 +1,10 @@
 #pragma once
+#include "../Config.h"
 #include "../include/Types.h"
 
+#include <memory>
+#include <mutex>
+
 namespace blackbone
 {
 
@@ -22,6 +26,68 @@ struct SymbolData
     ptr_t LdrProtectMrdata = 0;                     // LdrProtectMrdata address
 };
 
-extern SymbolData g_symbols;
+/// <summary>
+/// Symbol resolution state
+/// </summary>
+enum eSymbolState
+{
+    sym_none,           // Symbols weren't requested yet
+    sym_pending,        // Pattern scan results are available, PDB lookup is running in background
+    sym_complete,       // Final addresses from cache, PDB or pattern scan if PDB is unavailable
+};
+
+/// <summary>
+/// Ntdll internal pointers, resolved on first access.
+/// Only manual mapping and kernel32 patching need them, so other consumers never load PDBs or scan ntdll.
+/// In async PDB mode first access returns pattern scan results right away and PDB addresses replace them once downloaded
+/// </summary>
+class LazySymbolData
+{
+public:
+    /// <summary>
+    /// Consistent copy of symbols, so background update never tears a field being read
+    /// </summary>
+    struct Snapshot
+    {
+        SymbolData data;
+        const SymbolData* operator ->() const { return &data; }
+    };
+
+    /// <summary>
+    /// Answer first access from pattern scan and load PDBs in background.
+    /// Must be set before symbols are first used
+    /// </summary>
+    /// <param name="state">Enable async mode</param>
+    BLACKBONE_API void EnableAsyncPdb( bool state );
+
+    /// <summary>
+    /// Get symbols, resolving them on first call
+    /// </summary>
+    /// <returns>Found symbols</returns>
+    BLACKBONE_API SymbolData get();
+
+    /// <summary>
+    /// Get resolution state
+    /// </summary>
+    /// <returns>Symbol state</returns>
+    BLACKBONE_API eSymbolState state() const;
+
+    Snapshot operator ->() { return { get() }; }
+
+private:
+    struct Shared
+    {
+        SymbolData data;
+        eSymbolState state = sym_none;
+        mutable std::mutex lock;
+    };
+
+    // Background loader keeps shared state alive even if it outlives this object
+    std::shared_ptr<Shared> _shared = std::make_shared<Shared>();
+    std::once_flag _once;
+    bool _asyncPdb = false;
+};
+
+extern LazySymbolData g_symbols;
 
 }
\ No newline at end of file
@@ -1,8 +1,11 @@
 #include "SymbolLoader.h"
 #include "PDBHelper.h"
+#include "SymbolCache.h"
 #include "../Symbols/PatternLoader.h"
 #include "../PE/PEImage.h"
 
+#include <future>
+
 namespace blackbone
 {
 
@@ -26,15 +29,80 @@ SymbolLoader::SymbolLoader()
 }
 
 /// <summary>
-/// Load symbol addresses from PDB or and pattern scans
+/// Load symbol addresses from cache, PDB or pattern scans
 /// </summary>
 /// <param name="result">Found symbols</param>
 /// <returns>Status code</returns>
 NTSTATUS SymbolLoader::Load( SymbolData& result )
 {
     pe::PEImage ntdll32, ntdll64;
-    PDBHelper sym32, sym64;
+    LoadImages( ntdll32, ntdll64 );
+
+    // Same ntdll builds were already resolved
+    auto key32 = SymbolCache::GetImageKey( ntdll32 );
+    auto key64 = SymbolCache::GetImageKey( ntdll64 );
+    if (SymbolCache::Load( key32, key64, result ))
+        return STATUS_SUCCESS;
+
+    // x86 and x64 ntdll are resolved concurrently into separate results
+    SymbolData result64 = result;
+    std::future<NTSTATUS> pending64;
+    if (!_x86OS)
+        pending64 = std::async( std::launch::async, &SymbolLoader::Resolve, this, std::cref( ntdll64 ), true, std::ref( result64 ) );
+
+    NTSTATUS status = Resolve( ntdll32, false, result );
+    if (pending64.valid())
+    {
+        NTSTATUS status64 = pending64.get();
+        if (NT_SUCCESS( status ))
+            status = status64;
+
+        // Fields filled by x64 pipeline
+        for (auto field : {
+            &SymbolData::LdrKernel32PatchAddress, &SymbolData::APC64PatchAddress, &SymbolData::LdrpHandleTlsData64,
+            &SymbolData::LdrpInvertedFunctionTable64, &SymbolData::RtlInsertInvertedFunctionTable64, &SymbolData::LdrpReleaseTlsEntry64
+            })
+        {
+            result.*field = result64.*field;
+        }
+    }
+
+    if (NT_SUCCESS( status ))
+        SymbolCache::Store( key32, key64, result );
+
+    return status;
+}
+
+/// <summary>
+/// Load symbol addresses from cache or pattern scans only, without touching DIA or symbol server
+/// </summary>
+/// <param name="result">Found symbols</param>
+/// <param name="complete">Set to true if symbols came from cache and no PDB lookup is required</param>
+/// <returns>Status code</returns>
+NTSTATUS SymbolLoader::LoadFast( SymbolData& result, bool& complete )
+{
+    pe::PEImage ntdll32, ntdll64;
+    LoadImages( ntdll32, ntdll64 );
+
+    complete = SymbolCache::Load( SymbolCache::GetImageKey( ntdll32 ), SymbolCache::GetImageKey( ntdll64 ), result );
+    if (complete)
+        return STATUS_SUCCESS;
+
+    // Pattern-only results are never cached, so PDB lookup still happens later
+    NTSTATUS status = ScanSymbolPatterns( ntdll32, false, result );
+    if (NT_SUCCESS( status ) && !_x86OS)
+        status = ScanSymbolPatterns( ntdll64, true, result );
 
+    return status;
+}
+
+/// <summary>
+/// Map x86 and, on x64 OS, x64 ntdll
+/// </summary>
+/// <param name="ntdll32">x86 ntdll</param>
+/// <param name="ntdll64">x64 ntdll</param>
+void SymbolLoader::LoadImages( pe::PEImage& ntdll32, pe::PEImage& ntdll64 )
+{
     wchar_t buf[MAX_PATH] = { 0 };
     GetWindowsDirectoryW( buf, MAX_PATH );
 
@@ -49,36 +117,47 @@ NTSTATUS SymbolLoader::Load( SymbolData& result )
         FsRedirector fsr( _wow64Process );
 
         ntdll64.Load( std::wstring( windir + L"\\System32\\ntdll.dll" ), true );
-        ntdll32.Load( std::wstring( windir + L"\\SysWOW64\\ntdll.dll" ), true );       
+        ntdll32.Load( std::wstring( windir + L"\\SysWOW64\\ntdll.dll" ), true );
     }
+}
 
-    HRESULT hr = sym32.Init( ntdll32.path(), ntdll32.imageBase() );
-    if (!_x86OS && SUCCEEDED( hr ))
+/// <summary>
+/// Resolve symbols of single ntdll image, PDB first and patterns for whatever is missing
+/// </summary>
+/// <param name="ntdll">Mapped x86 or x64 ntdll</param>
+/// <param name="bit64">Image is x64 ntdll</param>
+/// <param name="result">Found symbols</param>
+/// <returns>Status code</returns>
+NTSTATUS SymbolLoader::Resolve( const pe::PEImage& ntdll, bool bit64, SymbolData& result )
+{
+    // DIA is initialized per thread
+    PDBHelper sym;
+    HRESULT hr = E_FAIL;
     {
-        FsRedirector fsr( _wow64Process );
-        hr = sym64.Init( ntdll64.path(), ntdll64.imageBase() );
+        // Redirection is per thread as well
+        FsRedirector fsr( bit64 && _wow64Process );
+        hr = sym.Init( ntdll.path(), ntdll.imageBase() );
     }
 
     // Get addresses from pdb
-    if (SUCCEEDED( hr ))
+    if (SUCCEEDED( hr ) && bit64)
     {
-        sym32.GetSymAddress( L"LdrpHandleTlsData", result.LdrpHandleTlsData32 );
-        sym64.GetSymAddress( L"LdrpHandleTlsData", result.LdrpHandleTlsData64 );
-
-        sym32.GetSymAddress( L"LdrpInvertedFunctionTable", result.LdrpInvertedFunctionTable32 );
-        sym64.GetSymAddress( L"LdrpInvertedFunctionTable", result.LdrpInvertedFunctionTable64 );
-
-        sym32.GetSymAddress( L"RtlInsertInvertedFunctionTable", result.RtlInsertInvertedFunctionTable32 );
-        sym64.GetSymAddress( L"RtlInsertInvertedFunctionTable", result.RtlInsertInvertedFunctionTable64 );
-
-        sym32.GetSymAddress( L"LdrpReleaseTlsEntry", result.LdrpReleaseTlsEntry32 );
-        sym64.GetSymAddress( L"LdrpReleaseTlsEntry", result.LdrpReleaseTlsEntry64 );
-
-        sym32.GetSymAddress( L"LdrProtectMrdata", result.LdrProtectMrdata );
+        sym.GetSymAddress( L"LdrpHandleTlsData", result.LdrpHandleTlsData64 );
+        sym.GetSymAddress( L"LdrpInvertedFunctionTable", result.LdrpInvertedFunctionTable64 );
+        sym.GetSymAddress( L"RtlInsertInvertedFunctionTable", result.RtlInsertInvertedFunctionTable64 );
+        sym.GetSymAddress( L"LdrpReleaseTlsEntry", result.LdrpReleaseTlsEntry64 );
+    }
+    else if (SUCCEEDED( hr ))
+    {
+        sym.GetSymAddress( L"LdrpHandleTlsData", result.LdrpHandleTlsData32 );
+        sym.GetSymAddress( L"LdrpInvertedFunctionTable", result.LdrpInvertedFunctionTable32 );
+        sym.GetSymAddress( L"RtlInsertInvertedFunctionTable", result.RtlInsertInvertedFunctionTable32 );
+        sym.GetSymAddress( L"LdrpReleaseTlsEntry", result.LdrpReleaseTlsEntry32 );
+        sym.GetSymAddress( L"LdrProtectMrdata", result.LdrProtectMrdata );
     }
-   
+
     // Fill missing symbols from patterns
-    return ScanSymbolPatterns( ntdll32, ntdll64, result );
+    return ScanSymbolPatterns( ntdll, bit64, result );
 }
 
 }
\ No newline at end of file
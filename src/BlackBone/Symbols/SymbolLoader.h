@@ -1,5 +1,6 @@
 #pragma once
 #include "SymbolData.h"
+#include "../PE/PEImage.h"
 
 namespace blackbone
 {
@@ -10,12 +11,37 @@ public:
     SymbolLoader();
 
     /// <summary>
-    /// Load symbol addresses from PDB or and pattern scans
+    /// Load symbol addresses from cache, PDB or pattern scans
     /// </summary>
     /// <param name="result">Found symbols</param>
     /// <returns>Status code</returns>
     NTSTATUS Load( SymbolData& result );
 
+    /// <summary>
+    /// Load symbol addresses from cache or pattern scans only, without touching DIA or symbol server
+    /// </summary>
+    /// <param name="result">Found symbols</param>
+    /// <param name="complete">Set to true if symbols came from cache and no PDB lookup is required</param>
+    /// <returns>Status code</returns>
+    NTSTATUS LoadFast( SymbolData& result, bool& complete );
+
+private:
+    /// <summary>
+    /// Map x86 and, on x64 OS, x64 ntdll
+    /// </summary>
+    /// <param name="ntdll32">x86 ntdll</param>
+    /// <param name="ntdll64">x64 ntdll</param>
+    void LoadImages( pe::PEImage& ntdll32, pe::PEImage& ntdll64 );
+
+    /// <summary>
+    /// Resolve symbols of single ntdll image, PDB first and patterns for whatever is missing
+    /// </summary>
+    /// <param name="ntdll">Mapped x86 or x64 ntdll</param>
+    /// <param name="bit64">Image is x64 ntdll</param>
+    /// <param name="result">Found symbols</param>
+    /// <returns>Status code</returns>
+    NTSTATUS Resolve( const pe::PEImage& ntdll, bool bit64, SymbolData& result );
+
 private:
     bool _x86OS;            // x86 OS
     bool _wow64Process;     // Current process is wow64 process
@@ -0,0 +1,162 @@
+#include "SymbolResolver.h"
+#include "PDBHelper.h"
+
+#include <algorithm>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Resolve a list of symbols. Requests are grouped by module, so every module is loaded at most once
+/// </summary>
+/// <param name="requests">Module and symbol names</param>
+/// <param name="rvas">Symbol RVAs in request order, 0 if symbol wasn't found</param>
+/// <returns>Status code, STATUS_NOT_FOUND if any symbol wasn't found</returns>
+NTSTATUS SymbolResolver::Resolve( const std::vector<SymbolRequest>& requests, std::vector<uint32_t>& rvas )
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    std::unordered_map<std::wstring, ModuleSymbolsPtr> modules;
+
+    rvas.assign( requests.size(), 0 );
+
+    for (size_t i = 0; i < requests.size(); i++)
+    {
+        auto iter = modules.find( requests[i].module );
+        if (iter == modules.end())
+        {
+            auto table = GetModule( requests[i].module );
+            iter = modules.emplace( requests[i].module, table ? table.result() : nullptr ).first;
+        }
+
+        if (iter->second)
+        {
+            auto found = iter->second->byName.find( requests[i].name );
+            if (found != iter->second->byName.end())
+            {
+                rvas[i] = found->second;
+                continue;
+            }
+        }
+
+        status = STATUS_NOT_FOUND;
+    }
+
+    return status;
+}
+
+/// <summary>
+/// Resolve single symbol
+/// </summary>
+/// <param name="module">Module path or system file name</param>
+/// <param name="name">Undecorated symbol name</param>
+/// <returns>Symbol RVA</returns>
+call_result_t<uint32_t> SymbolResolver::Resolve( const std::wstring& module, const std::wstring& name )
+{
+    auto table = GetModule( module );
+    if (!table)
+        return table.status;
+
+    auto found = table.result()->byName.find( name );
+    if (found == table.result()->byName.end())
+        return STATUS_NOT_FOUND;
+
+    return found->second;
+}
+
+/// <summary>
+/// Find closest symbol at or below given RVA
+/// </summary>
+/// <param name="module">Module path or system file name</param>
+/// <param name="rva">Address relative to module base</param>
+/// <param name="name">Symbol name</param>
+/// <param name="displacement">Distance from symbol start</param>
+/// <returns>Status code</returns>
+NTSTATUS SymbolResolver::FindSymbol( const std::wstring& module, uint32_t rva, std::wstring& name, uint32_t& displacement )
+{
+    auto table = GetModule( module );
+    if (!table)
+        return table.status;
+
+    auto& byRva = table.result()->byRva;
+    auto iter = std::upper_bound(
+        byRva.begin(), byRva.end(), rva,
+        []( uint32_t value, const auto& entry ) { return value < entry.first; }
+    );
+
+    if (iter == byRva.begin())
+        return STATUS_NOT_FOUND;
+
+    --iter;
+    name = *iter->second;
+    displacement = rva - iter->first;
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Drop all loaded symbol tables
+/// </summary>
+void SymbolResolver::Clear()
+{
+    CSLock lck( _lock );
+
+    _modules.clear();
+    _paths.clear();
+}
+
+/// <summary>
+/// Get symbol table of a module, loading it on first use
+/// </summary>
+/// <param name="module">Module path or system file name</param>
+/// <returns>Symbol table</returns>
+call_result_t<SymbolResolver::ModuleSymbolsPtr> SymbolResolver::GetModule( const std::wstring& module )
+{
+    CSLock lck( _lock );
+
+    auto cached = _paths.find( module );
+    if (cached != _paths.end())
+        return cached->second;
+
+    auto path = module;
+    if (path.find( L'\\' ) == path.npos)
+    {
+        wchar_t sysDir[MAX_PATH] = { };
+        GetSystemDirectoryW( sysDir, _countof( sysDir ) );
+        path = std::wstring( sysDir ) + L"\\" + module;
+    }
+
+    pe::PEImage image;
+    NTSTATUS status = image.Load( path, pe::SkipActx | pe::HeadersOnly );
+    if (!NT_SUCCESS( status ))
+        return status;
+
+    // Same build loaded from another path
+    auto key = SymbolCache::GetImageKey( image );
+    auto known = _modules.find( key );
+    if (known != _modules.end())
+    {
+        _paths.emplace( module, known->second );
+        return known->second;
+    }
+
+    PDBHelper pdb;
+    HRESULT hr = pdb.Init( path );
+    if (FAILED( hr ))
+        return STATUS_NOT_FOUND;
+
+    auto table = std::make_shared<ModuleSymbols>();
+    table->byName = pdb.symbols();
+    table->byRva.reserve( table->byName.size() );
+
+    for (const auto& sym : table->byName)
+        table->byRva.emplace_back( sym.second, &sym.first );
+
+    std::sort( table->byRva.begin(), table->byRva.end(), []( const auto& l, const auto& r ) { return l.first < r.first; } );
+
+    _modules.emplace( key, table );
+    _paths.emplace( module, table );
+
+    return ModuleSymbolsPtr( table );
+}
+
+}
@@ -0,0 +1,105 @@
+#pragma once
+#include "SymbolCache.h"
+#include "../Include/CallResult.h"
+#include "../Misc/Utils.h"
+
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Symbol name lookup request
+/// </summary>
+struct SymbolRequest
+{
+    std::wstring module;    // Full module path or file name inside system directory, e.g. L"win32k.sys"
+    std::wstring name;      // Undecorated symbol name
+};
+
+/// <summary>
+/// Resolves arbitrary module symbols from PDB.
+/// Every module is loaded in a single DIA session and its whole symbol table is kept,
+/// keyed by PDB identity, so later lookups and reverse queries never touch DIA again
+/// </summary>
+class SymbolResolver
+{
+public:
+    BLACKBONE_API static SymbolResolver& Instance()
+    {
+        static SymbolResolver instance;
+        return instance;
+    }
+
+    SymbolResolver() = default;
+    SymbolResolver( const SymbolResolver& ) = delete;
+
+    /// <summary>
+    /// Resolve a list of symbols. Requests are grouped by module, so every module is loaded at most once
+    /// </summary>
+    /// <param name="requests">Module and symbol names</param>
+    /// <param name="rvas">Symbol RVAs in request order, 0 if symbol wasn't found</param>
+    /// <returns>Status code, STATUS_NOT_FOUND if any symbol wasn't found</returns>
+    BLACKBONE_API NTSTATUS Resolve( const std::vector<SymbolRequest>& requests, std::vector<uint32_t>& rvas );
+
+    /// <summary>
+    /// Resolve single symbol
+    /// </summary>
+    /// <param name="module">Module path or system file name</param>
+    /// <param name="name">Undecorated symbol name</param>
+    /// <returns>Symbol RVA</returns>
+    BLACKBONE_API call_result_t<uint32_t> Resolve( const std::wstring& module, const std::wstring& name );
+
+    /// <summary>
+    /// Find closest symbol at or below given RVA
+    /// </summary>
+    /// <param name="module">Module path or system file name</param>
+    /// <param name="rva">Address relative to module base</param>
+    /// <param name="name">Symbol name</param>
+    /// <param name="displacement">Distance from symbol start</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS FindSymbol( const std::wstring& module, uint32_t rva, std::wstring& name, uint32_t& displacement );
+
+    /// <summary>
+    /// Drop all loaded symbol tables
+    /// </summary>
+    BLACKBONE_API void Clear();
+
+private:
+    /// <summary>
+    /// Symbol table of single module
+    /// </summary>
+    struct ModuleSymbols
+    {
+        std::unordered_map<std::wstring, uint32_t> byName;      // Name -> RVA
+        std::vector<std::pair<uint32_t, const std::wstring*>> byRva;   // Sorted by RVA, names point into byName
+    };
+
+    using ModuleSymbolsPtr = std::shared_ptr<const ModuleSymbols>;
+
+    struct KeyLess
+    {
+        bool operator()( const SymbolCache::ImageKey& l, const SymbolCache::ImageKey& r ) const
+        {
+            return memcmp( &l, &r, sizeof( l ) ) < 0;
+        }
+    };
+
+    /// <summary>
+    /// Get symbol table of a module, loading it on first use
+    /// </summary>
+    /// <param name="module">Module path or system file name</param>
+    /// <returns>Symbol table</returns>
+    call_result_t<ModuleSymbolsPtr> GetModule( const std::wstring& module );
+
+private:
+    std::map<SymbolCache::ImageKey, ModuleSymbolsPtr, KeyLess> _modules;     // Tables by PDB identity
+    std::unordered_map<std::wstring, ModuleSymbolsPtr> _paths;              // Tables by module path
+    CriticalSection _lock;                                                  // Table guard
+};
+
+}
@@ -0,0 +1,113 @@
+#include "Common.h"
+#include <BlackBone/Process/RPC/RemoteFunction.hpp>
+
+#include <atomic>
+
+namespace
+{
+
+std::atomic<uint64_t> g_hits{ 0 };    // Hook callback invocations
+
+void OnHit( RemoteContext& )
+{
+    g_hits++;
+}
+
+/// <summary>
+/// Measure hook installation and hit cost against helper process
+/// </summary>
+void BenchTarget( const BenchOptions& options, const std::wstring& helper, const char* target )
+{
+    Process process;
+    if (!StartHelper( options, process, helper ))
+        return;
+
+    // Trivial function, so hit cost isn't hidden by function body
+    auto pfn = process.modules().GetExport( L"kernel32.dll", "TlsGetValue" );
+    if (!pfn)
+    {
+        fprintf( stderr, "Failed to resolve TlsGetValue in %ls\n", helper.c_str() );
+        process.Terminate();
+        return;
+    }
+
+    ptr_t address = pfn->procAddress;
+    auto& hooks = process.hooks();
+
+    for (auto type : { RemoteHook::int3, RemoteHook::hwbp })
+    {
+        NTSTATUS status = STATUS_SUCCESS;
+
+        BenchResult result;
+        result.suite = "hook";
+        result.name = type == RemoteHook::int3 ? "install_int3" : "install_hwbp";
+        result.target = target;
+        result.ns = Measure( options.iterations, [&]
+        {
+            if (NT_SUCCESS( status ))
+                status = hooks.Apply( type, address, &OnHit );
+        }, [&]
+        {
+            hooks.Remove( address );
+        } );
+
+        if (NT_SUCCESS( status ))
+            Report( result );
+        else
+            fprintf( stderr, "%s/%s failed with status 0x%08X\n", target, result.name.c_str(), status );
+    }
+
+    // Same remote call with and without hook, difference is debug event round trip
+    auto TlsGetValue = MakeRemoteFunction<DWORD( __stdcall* )(DWORD)>( process, address );
+    NTSTATUS status = STATUS_SUCCESS;
+
+    BenchResult result;
+    result.suite = "hook";
+    result.name = "call_unhooked";
+    result.target = target;
+    result.ns = Measure( options.iterations, [&]
+    {
+        if (NT_SUCCESS( status ))
+            status = TlsGetValue.Call( { 0 } ).status;
+    } );
+
+    if (NT_SUCCESS( status ))
+        Report( result );
+
+    if (NT_SUCCESS( status ) && NT_SUCCESS( status = hooks.Apply( RemoteHook::int3, address, &OnHit ) ))
+    {
+        g_hits = 0;
+
+        result.name = "hit_int3";
+        result.ns = Measure( options.iterations, [&]
+        {
+            if (NT_SUCCESS( status ))
+                status = TlsGetValue.Call( { 0 } ).status;
+        } );
+
+        hooks.Remove( address );
+
+        if (NT_SUCCESS( status ) && g_hits.load() != 0)
+            Report( result );
+        else
+            fprintf( stderr, "%s/hit_int3: hook wasn't hit, status 0x%08X\n", target, status );
+    }
+    else
+        fprintf( stderr, "%s: remote call failed with status 0x%08X\n", target, status );
+
+    process.Terminate();
+}
+
+}
+
+/// <summary>
+/// Remote hook cost: int3 and hardware breakpoint installation, int3 hit round trip
+/// </summary>
+/// <param name="options">Run options</param>
+void BenchHook( const BenchOptions& options )
+{
+    BenchTarget( options, L"TestHelper32.exe", "x86" );
+#ifdef USE64
+    BenchTarget( options, L"TestHelper64.exe", "x64" );
+#endif
+}
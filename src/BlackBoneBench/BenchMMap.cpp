@@ -0,0 +1,164 @@
+#include "Common.h"
+#include <BlackBone/ManualMap/MMap.h>
+
+namespace
+{
+
+/// <summary>
+/// Report case or its failure
+/// </summary>
+void ReportStatus( const BenchResult& result, NTSTATUS status )
+{
+    if (NT_SUCCESS( status ))
+        Report( result );
+    else
+        fprintf( stderr, "%s/%s failed with status 0x%08X\n", result.target.c_str(), result.name.c_str(), status );
+}
+
+/// <summary>
+/// Map TestDll with common flag sets, then compare with native loader injection
+/// </summary>
+void BenchTarget( const BenchOptions& options, const std::wstring& helper, const std::wstring& dll, const char* target )
+{
+    Process process;
+    if (!StartHelper( options, process, helper ))
+        return;
+
+    std::wstring path = options.helperDir + L"\\" + dll;
+
+    struct
+    {
+        const char* name;
+        eLoadFlags flags;
+    } flagSets[] =
+    {
+        { "mmap_default",        NoFlags },
+        { "mmap_imports",        ManualImports },
+        { "mmap_parallel_deps",  ManualImports | ParallelDeps },
+        { "mmap_shared_arena",   ManualImports | SharedArena },
+        { "mmap_lazy_bind",      ManualImports | LazyBind },
+        { "mmap_no_threads",     NoThreads },
+        { "mmap_minimal",        WipeHeader | NoExceptions | NoDelayLoad | NoSxS | NoTLS },
+    };
+
+    for (const auto& set : flagSets)
+    {
+        NTSTATUS status = STATUS_SUCCESS;
+        CountingResource counter;
+
+        BenchResult result;
+        result.suite = "mmap";
+        result.name = set.name;
+        result.target = target;
+        result.ns = Measure( options.iterations, [&]
+        {
+            TransientScope scope( &counter );
+            if (NT_SUCCESS( status ))
+                status = process.mmap().MapImage( path, set.flags ).status;
+        }, [&]
+        {
+            process.mmap().UnmapAllModules();
+        } );
+
+        // Warm-up run is counted as well
+        result.allocs = counter.stats().allocations / (options.iterations + 1);
+        ReportStatus( result, status );
+    }
+
+    // Staging buffers of every call come from single arena released at once
+    {
+        NTSTATUS status = STATUS_SUCCESS;
+
+        BenchResult result;
+        result.suite = "mmap";
+        result.name = "mmap_imports_arena";
+        result.target = target;
+        result.ns = Measure( options.iterations, [&]
+        {
+            std::pmr::monotonic_buffer_resource arena;
+            TransientScope scope( &arena );
+            if (NT_SUCCESS( status ))
+                status = process.mmap().MapImage( path, ManualImports ).status;
+        }, [&]
+        {
+            process.mmap().UnmapAllModules();
+        } );
+
+        ReportStatus( result, status );
+    }
+
+    // Native loader
+    {
+        call_result_t<ModuleDataPtr> mod( STATUS_SUCCESS );
+
+        BenchResult result;
+        result.suite = "mmap";
+        result.name = "inject";
+        result.target = target;
+        result.ns = Measure( options.iterations, [&]
+        {
+            if (mod.success())
+                mod = process.modules().Inject( path );
+        }, [&]
+        {
+            if (mod)
+                process.modules().Unload( mod.result() );
+        } );
+
+        ReportStatus( result, mod.status );
+    }
+
+    if (UseDriver( options ))
+    {
+        NTSTATUS status = STATUS_SUCCESS;
+
+        BenchResult result;
+        result.suite = "mmap";
+        result.name = "inject";
+        result.target = std::string( target ) + "_driver";
+        result.ns = Measure( options.iterations, [&]
+        {
+            if (NT_SUCCESS( status ))
+                status = Driver().InjectDll( process.pid(), path, IT_Thread );
+        }, [&]
+        {
+            process.modules().reset();
+            if (auto mod = process.modules().GetModule( dll ))
+                process.modules().Unload( mod );
+        } );
+
+        ReportStatus( result, status );
+
+        // Kernel mapped image can't be unloaded, every run gets fresh process
+        result.name = "mmap_default";
+        result.ns = Measure( options.iterations, [&]
+        {
+            if (NT_SUCCESS( status ))
+                status = Driver().MmapDll( process.pid(), path, KNoFlags );
+        }, [&]
+        {
+            process.Terminate();
+            if (!StartHelper( options, process, helper ))
+                status = STATUS_UNSUCCESSFUL;
+        } );
+
+        ReportStatus( result, status );
+    }
+
+    process.Terminate();
+}
+
+}
+
+/// <summary>
+/// Image mapping cost: MMap::MapImage of TestDll with common flag sets,
+/// native loader injection and driver-side injection and mapping
+/// </summary>
+/// <param name="options">Run options</param>
+void BenchMMap( const BenchOptions& options )
+{
+    BenchTarget( options, L"TestHelper32.exe", L"TestDll32.dll", "x86" );
+#ifdef USE64
+    BenchTarget( options, L"TestHelper64.exe", L"TestDll64.dll", "x64" );
+#endif
+}
@@ -0,0 +1,205 @@
+#include "Common.h"
+#include <BlackBone/Patterns/PatternSearch.h>
+
+#include <random>
+
+namespace
+{
+
+constexpr size_t LocalBufferSize = 64 * 1024 * 1024;   // 64 MB
+constexpr uint8_t Wildcard = 0xCC;
+constexpr size_t PatternLengths[] = { 4, 8, 16, 32, 64 };
+
+/// <summary>
+/// Build pattern from buffer tail, so every scan has to walk whole buffer.
+/// Every 4th byte is replaced by wildcard for wildcard patterns.
+/// </summary>
+/// <param name="buffer">Scanned data</param>
+/// <param name="length">Pattern length</param>
+/// <param name="useWildcard">Insert wildcards</param>
+/// <returns>Pattern bytes</returns>
+std::vector<uint8_t> MakePattern( const std::vector<uint8_t>& buffer, size_t length, bool useWildcard )
+{
+    std::vector<uint8_t> pattern( buffer.end() - length, buffer.end() );
+    for (size_t i = 0; i < length; i++)
+    {
+        if (useWildcard && i % 4 == 1)
+            pattern[i] = Wildcard;
+        else if (pattern[i] == Wildcard)
+            pattern[i]++;
+    }
+
+    return pattern;
+}
+
+/// <summary>
+/// Random scan data without wildcard bytes
+/// </summary>
+/// <param name="size">Data size</param>
+/// <returns>Data</returns>
+std::vector<uint8_t> MakeBuffer( size_t size )
+{
+    std::vector<uint8_t> buffer( size );
+    std::mt19937 rng( 0x1234 );
+    std::uniform_int_distribution<int> dist( 0, 0xFF );
+
+    for (auto& b : buffer)
+    {
+        b = static_cast<uint8_t>(dist( rng ));
+        if (b == Wildcard)
+            b++;
+    }
+
+    return buffer;
+}
+
+/// <summary>
+/// Case name, e.g. "local_wildcard_16"
+/// </summary>
+std::string CaseName( const char* kind, bool useWildcard, size_t length )
+{
+    return std::string( kind ) + (useWildcard ? "_wildcard_" : "_exact_") + std::to_string( length );
+}
+
+/// <summary>
+/// Scan local buffer
+/// </summary>
+void BenchLocal( const BenchOptions& options, std::vector<uint8_t>& buffer )
+{
+    for (bool useWildcard : { false, true })
+    {
+        for (size_t length : PatternLengths)
+        {
+            auto pattern = MakePattern( buffer, length, useWildcard );
+            PatternSearch ps = useWildcard ? PatternSearch( pattern, Wildcard ) : PatternSearch( pattern );
+            std::vector<ptr_t> out;
+
+            BenchResult result;
+            result.suite = "pattern";
+            result.name = CaseName( "local", useWildcard, length );
+            result.target = "local";
+            result.bytes = buffer.size();
+            result.ns = Measure( options.iterations, [&]
+            {
+                out.clear();
+                if (useWildcard)
+                    ps.Search( Wildcard, buffer.data(), buffer.size(), out );
+                else
+                    ps.Search( buffer.data(), buffer.size(), out );
+            } );
+
+            Report( result );
+        }
+    }
+}
+
+/// <summary>
+/// Scan helper process memory
+/// </summary>
+void BenchRemote( const BenchOptions& options, const std::vector<uint8_t>& buffer, const std::wstring& helper, const char* target )
+{
+    Process process;
+    if (!NT_SUCCESS( process.CreateAndAttach( options.helperDir + L"\\" + helper ) ))
+    {
+        fprintf( stderr, "Failed to start %ls\n", helper.c_str() );
+        return;
+    }
+
+    auto block = process.memory().Allocate( buffer.size(), PAGE_READWRITE );
+    if (!block || !NT_SUCCESS( block->Write( 0, buffer.size(), buffer.data() ) ))
+    {
+        fprintf( stderr, "Failed to prepare %ls memory\n", helper.c_str() );
+        process.Terminate();
+        return;
+    }
+
+    // Amount of memory whole-process scan has to read
+    uint64_t committed = 0;
+    for (const auto& mbi : process.core().native()->EnumRegions())
+    {
+        if (mbi.State == MEM_COMMIT && mbi.Protect != PAGE_NOACCESS)
+            committed += mbi.RegionSize;
+    }
+
+    for (bool useWildcard : { false, true })
+    {
+        for (size_t length : PatternLengths)
+        {
+            auto pattern = MakePattern( buffer, length, useWildcard );
+            PatternSearch ps = useWildcard ? PatternSearch( pattern, Wildcard ) : PatternSearch( pattern );
+            std::vector<ptr_t> out;
+
+            BenchResult result;
+            result.suite = "pattern";
+            result.name = CaseName( "remote", useWildcard, length );
+            result.target = target;
+            result.bytes = buffer.size();
+            result.ns = Measure( options.iterations, [&]
+            {
+                out.clear();
+                if (useWildcard)
+                    ps.SearchRemote( process, Wildcard, block->ptr(), buffer.size(), out );
+                else
+                    ps.SearchRemote( process, block->ptr(), buffer.size(), out );
+            } );
+
+            Report( result );
+
+            for (uint32_t threads : { 1u, 0u })
+            {
+                result.name = CaseName( threads == 1 ? "whole" : "whole_parallel", useWildcard, length );
+                result.bytes = committed;
+                result.ns = Measure( options.iterations, [&]
+                {
+                    ps.SearchRemoteWhole( process, useWildcard, Wildcard, out, threads );
+                } );
+
+                Report( result );
+            }
+
+            // Scan is done inside target address space, only matches are transferred
+            if (UseDriver( options ))
+            {
+                std::vector<uint8_t> mask( length, 0xFF );
+                for (size_t i = 0; useWildcard && i < length; i++)
+                    mask[i] = pattern[i] == Wildcard ? 0x00 : 0xFF;
+
+                NTSTATUS status = STATUS_SUCCESS;
+                result.name = CaseName( "whole", useWildcard, length );
+                result.target = std::string( target ) + "_driver";
+                result.ns = Measure( options.iterations, [&]
+                {
+                    out.clear();
+                    if (NT_SUCCESS( status ))
+                        status = Driver().ScanMemory( process.pid(), pattern.data(), useWildcard ? mask.data() : nullptr, length, out );
+                } );
+
+                if (NT_SUCCESS( status ))
+                    Report( result );
+                else
+                    fprintf( stderr, "%s/%s failed with status 0x%08X\n", result.target.c_str(), result.name.c_str(), status );
+            }
+        }
+    }
+
+    block->Free();
+    process.Terminate();
+}
+
+}
+
+/// <summary>
+/// Pattern search throughput: local buffer, SearchRemote and SearchRemoteWhole
+/// for exact and wildcard patterns of different length
+/// </summary>
+/// <param name="options">Run options</param>
+void BenchPatternScan( const BenchOptions& options )
+{
+    auto buffer = MakeBuffer( LocalBufferSize );
+
+    BenchLocal( options, buffer );
+    BenchRemote( options, buffer, L"TestHelper32.exe", "x86" );
+#ifdef USE64
+    BenchRemote( options, buffer, L"TestHelper64.exe", "x64" );
+#endif
+}
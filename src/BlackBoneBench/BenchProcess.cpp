@@ -0,0 +1,195 @@
+#include "Common.h"
+
+namespace
+{
+
+// Commonly imported kernel32 functions, resolved in one export lookup iteration
+const char* ExportNames[] =
+{
+    "CreateFileW", "ReadFile", "WriteFile", "CloseHandle", "GetLastError", "SetLastError",
+    "VirtualAlloc", "VirtualFree", "VirtualProtect", "GetProcAddress", "LoadLibraryW", "GetModuleHandleW",
+    "CreateThread", "ExitThread", "Sleep", "WaitForSingleObject", "TlsAlloc", "TlsGetValue",
+    "HeapAlloc", "HeapFree", "GetProcessHeap", "InitializeCriticalSection", "EnterCriticalSection", "LeaveCriticalSection",
+};
+
+/// <summary>
+/// Fill common result fields
+/// </summary>
+BenchResult MakeResult( const char* name, const std::string& target, uint64_t ops = 1 )
+{
+    BenchResult result;
+    result.suite = "process";
+    result.name = name;
+    result.target = target;
+    result.ops = ops;
+
+    return result;
+}
+
+/// <summary>
+/// Attach and detach cost
+/// </summary>
+void BenchAttach( const BenchOptions& options, Process& process, const std::string& target )
+{
+    for (bool syscalls : { false, true })
+    {
+        Process attached;
+        NTSTATUS status = STATUS_SUCCESS;
+
+        auto result = MakeResult( syscalls ? "attach_syscalls" : "attach", target );
+        result.ns = Measure( options.iterations, [&]
+        {
+            if (NT_SUCCESS( status ))
+                status = attached.Attach( process.pid(), DEFAULT_ACCESS_P, syscalls );
+            if (NT_SUCCESS( status ))
+                status = attached.EnsureInit();
+        }, [&]
+        {
+            attached.Detach();
+        } );
+
+        if (NT_SUCCESS( status ))
+            Report( result );
+        else
+            fprintf( stderr, "%s/%s failed with status 0x%08X\n", target.c_str(), result.name.c_str(), status );
+    }
+
+    if (UseDriver( options ))
+    {
+        call_result_t<DWORD> handle( STATUS_UNSUCCESSFUL );
+
+        auto result = MakeResult( "attach", target + "_driver" );
+        result.ns = Measure( options.iterations, [&]
+        {
+            handle = Driver().OpenTarget( process.pid() );
+        }, [&]
+        {
+            if (handle)
+                Driver().CloseTarget( handle.result() );
+        } );
+
+        if (handle)
+            Report( result );
+    }
+}
+
+/// <summary>
+/// Module enumeration for every search type
+/// </summary>
+void BenchModules( const BenchOptions& options, Process& process, const std::string& target )
+{
+    struct
+    {
+        const char* name;
+        eModSeachType search;
+    } searches[] =
+    {
+        { "modules_ldr",      LdrList },
+        { "modules_sections", Sections },
+        { "modules_headers",  PEHeaders },
+    };
+
+    for (const auto& search : searches)
+    {
+        size_t count = 0;
+        auto result = MakeResult( search.name, target );
+        result.ns = Measure( options.iterations, [&]
+        {
+            process.modules().reset();
+            count = process.modules().GetAllModules( search.search ).size();
+        } );
+
+        result.ops = count;
+        Report( result );
+    }
+
+    if (UseDriver( options ))
+    {
+        std::vector<ModuleDataPtr> modules;
+        NTSTATUS status = STATUS_SUCCESS;
+
+        auto result = MakeResult( "modules_ldr", target + "_driver" );
+        result.ns = Measure( options.iterations, [&]
+        {
+            modules.clear();
+            if (NT_SUCCESS( status ))
+                status = Driver().EnumModules( process.pid(), process.barrier().targetWow64, modules );
+        } );
+
+        result.ops = modules.size();
+        if (NT_SUCCESS( status ))
+            Report( result );
+    }
+}
+
+/// <summary>
+/// Export lookup with cold and warm export cache, one by one and batched
+/// </summary>
+void BenchExports( const BenchOptions& options, Process& process, const std::string& target )
+{
+    auto kernel32 = process.modules().GetModule( L"kernel32.dll" );
+    if (!kernel32)
+    {
+        fprintf( stderr, "%s: kernel32.dll not found\n", target.c_str() );
+        return;
+    }
+
+    std::vector<const char*> names( std::begin( ExportNames ), std::end( ExportNames ) );
+
+    for (bool cold : { true, false })
+    {
+        auto result = MakeResult( cold ? "export_cold" : "export_warm", target, names.size() );
+        result.ns = Measure( options.iterations, [&]
+        {
+            if (cold)
+                process.modules().InvalidateExports( kernel32->baseAddress );
+
+            for (auto name : names)
+                process.modules().GetExport( kernel32, name );
+        } );
+
+        Report( result );
+
+        result.name = cold ? "export_batch_cold" : "export_batch_warm";
+        result.ns = Measure( options.iterations, [&]
+        {
+            if (cold)
+                process.modules().InvalidateExports( kernel32->baseAddress );
+
+            process.modules().GetExports( kernel32, names );
+        } );
+
+        Report( result );
+    }
+}
+
+/// <summary>
+/// Run all cases against helper process
+/// </summary>
+void BenchTarget( const BenchOptions& options, const std::wstring& helper, const char* target )
+{
+    Process process;
+    if (!StartHelper( options, process, helper ))
+        return;
+
+    BenchAttach( options, process, target );
+    BenchModules( options, process, target );
+    BenchExports( options, process, target );
+
+    process.Terminate();
+}
+
+}
+
+/// <summary>
+/// Process access basics: attach, module enumeration for every eModSeachType and export lookup.
+/// Attach and module enumeration are also measured through driver when enabled
+/// </summary>
+/// <param name="options">Run options</param>
+void BenchProcess( const BenchOptions& options )
+{
+    BenchTarget( options, L"TestHelper32.exe", "x86" );
+#ifdef USE64
+    BenchTarget( options, L"TestHelper64.exe", "x64" );
+#endif
+}
@@ -0,0 +1,155 @@
+#include "Common.h"
+
+namespace
+{
+
+constexpr uint32_t CallsPerIteration = 100;    // Latency samples per measured iteration
+
+/// <summary>
+/// Measure single round trip latency of every call
+/// </summary>
+/// <param name="options">Run options</param>
+/// <param name="name">Case name</param>
+/// <param name="target">Target process name</param>
+/// <param name="func">Single remote call, returns status code</param>
+template<typename Fn>
+void BenchMode( const BenchOptions& options, const char* name, const char* target, Fn&& func )
+{
+    NTSTATUS status = STATUS_SUCCESS;
+
+    BenchResult result;
+    result.suite = "rpc";
+    result.name = name;
+    result.target = target;
+    result.ns = Measure( options.iterations * CallsPerIteration, [&]
+    {
+        if (NT_SUCCESS( status ))
+            status = func();
+    } );
+
+    if (!NT_SUCCESS( status ))
+    {
+        fprintf( stderr, "%s/%s failed with status 0x%08X\n", target, name, status );
+        return;
+    }
+
+    Report( result );
+}
+
+/// <summary>
+/// Measure every execution mode against helper process
+/// </summary>
+void BenchTarget( const BenchOptions& options, const std::wstring& helper, const char* target )
+{
+    Process process;
+    if (!NT_SUCCESS( process.CreateAndAttach( options.helperDir + L"\\" + helper ) ))
+    {
+        fprintf( stderr, "Failed to start %ls\n", helper.c_str() );
+        return;
+    }
+
+    // Let loader finish process initialization
+    Sleep( 100 );
+
+    // Trivial function, so measured time is transport overhead only
+    auto kernel32 = process.modules().GetModule( L"kernel32.dll" );
+    auto pfn = kernel32 ? process.modules().GetExport( kernel32, "TlsGetValue" ) : call_result_t<exportData>( STATUS_NOT_FOUND );
+    if (!pfn)
+    {
+        fprintf( stderr, "Failed to resolve TlsGetValue in %ls\n", helper.c_str() );
+        process.Terminate();
+        return;
+    }
+
+    auto& remote = process.remote();
+    ptr_t address = pfn->procAddress;
+
+    // Call code is generated once, every mode executes the same blob
+    std::vector<AsmVariant> args = { 0 };
+    auto a = AsmFactory::GetAssembler( process.core().isWow64() );
+    remote.CreateRPCEnvironment( Worker_None, false );
+    remote.PrepareCallAssembly( *a, address, args, cc_stdcall, rt_int32 );
+
+    std::vector<uint8_t> code( (*a)->getCodeSize() );
+    (*a)->relocCode( code.data() );
+
+    uint64_t callResult = 0;
+
+    BenchMode( options, "exec_direct", target, [&]
+    {
+        remote.ExecDirect( address, 0 );
+        return STATUS_SUCCESS;
+    } );
+
+    BenchMode( options, "exec_new_thread", target, [&]
+    {
+        return remote.ExecInNewThread( code.data(), code.size(), callResult );
+    } );
+
+    remote.EnableThreadCache( true );
+    BenchMode( options, "exec_new_thread_cached", target, [&]
+    {
+        return remote.ExecInNewThread( code.data(), code.size(), callResult );
+    } );
+
+    remote.EnableThreadCache( false );
+
+    if (NT_SUCCESS( remote.CreateRPCEnvironment( Worker_CreateNew, true ) ))
+    {
+        BenchMode( options, "exec_worker_apc", target, [&]
+        {
+            return remote.ExecInWorkerThread( code.data(), code.size(), callResult );
+        } );
+
+        BenchMode( options, "exec_worker_stub", target, [&]
+        {
+            auto stubArgs = args;
+            return remote.CallInWorkerThread( address, stubArgs, cc_stdcall, rt_int32, callResult );
+        } );
+    }
+    else
+        fprintf( stderr, "%s: failed to create worker thread\n", target );
+
+    auto& ring = remote.ring();
+    auto stub = NT_SUCCESS( ring.Open() ) ? ring.RegisterStub( address, 1 ) : call_result_t<uint32_t>( STATUS_UNSUCCESSFUL );
+    if (stub)
+    {
+        BenchMode( options, "exec_ring", target, [&]
+        {
+            return ring.Call( stub.result(), { 0 } ).status;
+        } );
+
+        ring.Close();
+    }
+    else
+        fprintf( stderr, "%s: failed to open shared memory ring\n", target );
+
+    if (NT_SUCCESS( remote.CreateRPCEnvironment( Worker_UseExisting, true ) ))
+    {
+        auto thread = remote.getExecThread();
+        BenchMode( options, "exec_hijack", target, [&]
+        {
+            return remote.ExecInAnyThread( code.data(), code.size(), callResult, thread );
+        } );
+    }
+    else
+        fprintf( stderr, "%s: no thread to hijack\n", target );
+
+    process.Terminate();
+}
+
+}
+
+/// <summary>
+/// Remote call round trip latency and throughput for every execution mode:
+/// ExecDirect, ExecInNewThread (plain and cached thread), worker APC, worker call stub,
+/// shared memory ring and thread hijack
+/// </summary>
+/// <param name="options">Run options</param>
+void BenchRpc( const BenchOptions& options )
+{
+    BenchTarget( options, L"TestHelper32.exe", "x86" );
+#ifdef USE64
+    BenchTarget( options, L"TestHelper64.exe", "x64" );
+#endif
+}
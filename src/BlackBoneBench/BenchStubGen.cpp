@@ -0,0 +1,194 @@
+#include "Common.h"
+#include <BlackBone/Asm/AsmFactory.h>
+
+namespace
+{
+
+constexpr uint32_t StubsPerIteration = 256;         // Stubs generated per measured iteration
+constexpr uint64_t FakeFunction = 0x7FFE1000;       // Called function, code is never executed
+constexpr uint64_t FakeData = 0x7FFE2000;           // Remote address of marshaled data
+constexpr uint64_t FakeCodeBase = 0x7FFE0000;       // Stub location for compact code
+
+/// <summary>
+/// Structure passed by value, larger than register
+/// </summary>
+struct Payload
+{
+    uint64_t a, b, c;
+};
+
+/// <summary>
+/// Representative call signature
+/// </summary>
+struct Signature
+{
+    const char* name;
+    std::vector<AsmVariant> args;
+    eCalligConvention cc;
+    eReturnType retType;
+};
+
+wchar_t g_wideString[] = L"kernel32.dll";
+char g_ansiString[] = "LoadLibraryA";
+uint8_t g_outBuffer[0x100] = { };
+
+/// <summary>
+/// Signatures from 0 to 12 integer arguments, floating point, structure by value and string pointers
+/// </summary>
+std::vector<Signature> MakeSignatures()
+{
+    Payload payload = { 1, 2, 3 };
+
+    return
+    {
+        { "args_0",  { },                                                       cc_stdcall, rt_int32 },
+        { "args_4",  { 1, 2, 3, 4 },                                            cc_stdcall, rt_int32 },
+        { "args_12", { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12 },                 cc_stdcall, rt_int32 },
+        { "float",   { 1.0f, 2.0, 3.0f, 4.0 },                                  cc_stdcall, rt_double },
+        { "struct",  { payload, 1, payload },                                   cc_stdcall, rt_int32 },
+        { "strings", { g_wideString, g_ansiString, AsmVariant::out( g_outBuffer, sizeof( g_outBuffer ) ) }, cc_stdcall, rt_int32 },
+    };
+}
+
+/// <summary>
+/// Measure stub generation and report time and code size per stub
+/// </summary>
+/// <param name="options">Run options</param>
+/// <param name="name">Case name</param>
+/// <param name="target">Target architecture or process</param>
+/// <param name="func">Generates single stub, returns its size or 0 on failure</param>
+template<typename Fn>
+void BenchStubs( const BenchOptions& options, const std::string& name, const char* target, Fn&& func )
+{
+    size_t codeSize = 0;
+
+    BenchResult result;
+    result.suite = "stubgen";
+    result.name = name;
+    result.target = target;
+    result.ops = StubsPerIteration;
+    result.ns = Measure( options.iterations, [&]
+    {
+        for (uint32_t i = 0; i < StubsPerIteration && (i == 0 || codeSize != 0); i++)
+            codeSize = func();
+    } );
+
+    if (codeSize == 0)
+    {
+        fprintf( stderr, "%s/%s failed to generate stub\n", target, name.c_str() );
+        return;
+    }
+
+    result.bytes = codeSize * StubsPerIteration;
+    Report( result );
+}
+
+/// <summary>
+/// Assembler only: arguments are already marshaled, so data pointers are replaced by fake remote address
+/// </summary>
+/// <param name="options">Run options</param>
+/// <param name="arch">Assembler architecture</param>
+/// <param name="target">Target name</param>
+/// <param name="compact">Enable compact code emission</param>
+void BenchAssembler( const BenchOptions& options, AsmFactory::eAsmArch arch, const char* target, bool compact )
+{
+    std::vector<uint8_t> code( 0x1000 );
+
+    for (auto& sig : MakeSignatures())
+    {
+        for (auto& arg : sig.args)
+        {
+            if (arg.type == AsmVariant::dataPtr || arg.type == AsmVariant::dataStruct)
+                arg.new_imm_val = FakeData;
+        }
+
+        BenchStubs( options, std::string( compact ? "asm_compact_" : "asm_" ) + sig.name, target, [&]() -> size_t
+        {
+            auto a = AsmFactory::GetAssembler( arch );
+            if (compact)
+                a->EnableCompactCode( FakeCodeBase );
+
+            a->GenPrologue();
+            a->GenCall( FakeFunction, sig.args, sig.cc );
+            a->GenEpilogue();
+
+            size_t size = (*a)->getCodeSize();
+            if (size > code.size())
+                code.resize( size );
+
+            (*a)->relocCode( code.data(), FakeCodeBase );
+            return size;
+        } );
+    }
+}
+
+/// <summary>
+/// Full remote call assembly: strings and structures are written into target process
+/// </summary>
+/// <param name="options">Run options</param>
+/// <param name="helper">Helper executable</param>
+/// <param name="target">Target name</param>
+void BenchPrepare( const BenchOptions& options, const std::wstring& helper, const char* target )
+{
+    Process process;
+    if (!NT_SUCCESS( process.CreateAndAttach( options.helperDir + L"\\" + helper ) ))
+    {
+        fprintf( stderr, "Failed to start %ls\n", helper.c_str() );
+        return;
+    }
+
+    // Let loader finish process initialization
+    Sleep( 100 );
+
+    auto& remote = process.remote();
+    if (!NT_SUCCESS( remote.CreateRPCEnvironment( Worker_None, false ) ))
+    {
+        fprintf( stderr, "%s: failed to create RPC environment\n", target );
+        process.Terminate();
+        return;
+    }
+
+    bool wow64 = process.core().isWow64();
+    std::vector<uint8_t> code( 0x1000 );
+
+    for (auto& sig : MakeSignatures())
+    {
+        BenchStubs( options, std::string( "prepare_" ) + sig.name, target, [&]() -> size_t
+        {
+            // Marshaling modifies arguments
+            auto args = sig.args;
+            auto a = AsmFactory::GetAssembler( wow64 );
+            if (!NT_SUCCESS( remote.PrepareCallAssembly( *a, FakeFunction, args, sig.cc, sig.retType ) ))
+                return 0;
+
+            size_t size = (*a)->getCodeSize();
+            if (size > code.size())
+                code.resize( size );
+
+            (*a)->relocCode( code.data() );
+            return size;
+        } );
+    }
+
+    process.Terminate();
+}
+
+}
+
+/// <summary>
+/// Call stub generation throughput and size for representative signatures:
+/// AsmHelper32/AsmHelper64 alone, with compact code, and RemoteExec::PrepareCallAssembly with argument marshaling
+/// </summary>
+/// <param name="options">Run options</param>
+void BenchStubGen( const BenchOptions& options )
+{
+    BenchAssembler( options, AsmFactory::asm32, "x86", false );
+    BenchAssembler( options, AsmFactory::asm32, "x86", true );
+    BenchAssembler( options, AsmFactory::asm64, "x64", false );
+    BenchAssembler( options, AsmFactory::asm64, "x64", true );
+
+    BenchPrepare( options, L"TestHelper32.exe", "x86" );
+#ifdef USE64
+    BenchPrepare( options, L"TestHelper64.exe", "x64" );
+#endif
+}
@@ -0,0 +1,221 @@
+#pragma once
+#include <BlackBone/Config.h>
+#include <BlackBone/Process/Process.h>
+#include <BlackBone/DriverControl/DriverControl.h>
+#include <BlackBone/Misc/Utils.h>
+#include <BlackBone/Misc/MemoryResource.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace blackbone;
+
+/// <summary>
+/// Benchmark run options
+/// </summary>
+struct BenchOptions
+{
+    std::wstring helperDir;     // Directory with TestHelper32/64.exe and TestDll32/64.dll
+    std::string filter;         // Run only suites with this name, empty - all suites
+    uint32_t iterations = 10;   // Number of measured iterations per case
+    bool driver = false;        // Add driver-backed cases, requires loaded BlackBone driver
+};
+
+/// <summary>
+/// Single benchmark case result
+/// </summary>
+struct BenchResult
+{
+    std::string suite;          // Suite name
+    std::string name;           // Case name
+    std::string target;         // Target process: local, x86, x64
+    uint64_t bytes = 0;         // Bytes processed per iteration, 0 if not applicable
+    uint64_t ops = 1;           // Operations per iteration
+    uint64_t allocs = 0;        // Library transient allocations per iteration, 0 if not measured
+    std::vector<double> ns;     // Per-iteration time in nanoseconds
+};
+
+/// <summary>
+/// Run 'func' 'iterations' times and record time of every run
+/// </summary>
+/// <param name="iterations">Number of measured runs</param>
+/// <param name="func">Measured code</param>
+/// <returns>Per-iteration time in nanoseconds</returns>
+template<typename Fn>
+inline std::vector<double> Measure( uint32_t iterations, Fn&& func )
+{
+    std::vector<double> result;
+    result.reserve( iterations );
+
+    // Warm-up run, not recorded
+    func();
+
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        func();
+        auto end = std::chrono::steady_clock::now();
+
+        result.emplace_back( std::chrono::duration<double, std::nano>( end - start ).count() );
+    }
+
+    return result;
+}
+
+/// <summary>
+/// Run 'func' 'iterations' times, calling 'reset' after every run.
+/// Only 'func' is timed, 'reset' undoes its effect, e.g. unloads mapped image
+/// </summary>
+/// <param name="iterations">Number of measured runs</param>
+/// <param name="func">Measured code</param>
+/// <param name="reset">Untimed cleanup</param>
+/// <returns>Per-iteration time in nanoseconds</returns>
+template<typename Fn, typename Reset>
+inline std::vector<double> Measure( uint32_t iterations, Fn&& func, Reset&& reset )
+{
+    std::vector<double> result;
+    result.reserve( iterations );
+
+    func();
+    reset();
+
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        func();
+        auto end = std::chrono::steady_clock::now();
+        reset();
+
+        result.emplace_back( std::chrono::duration<double, std::nano>( end - start ).count() );
+    }
+
+    return result;
+}
+
+/// <summary>
+/// Median times of previous run, by "suite/case/target"
+/// </summary>
+/// <returns>Baseline values</returns>
+inline std::map<std::string, double>& Baseline()
+{
+    static std::map<std::string, double> values;
+    return values;
+}
+
+/// <summary>
+/// Get percentile of measured values
+/// </summary>
+/// <param name="values">Measured values</param>
+/// <param name="p">Percentile, 0.0 - 1.0</param>
+/// <returns>Percentile value</returns>
+inline double Percentile( std::vector<double> values, double p )
+{
+    if (values.empty())
+        return 0.0;
+
+    std::sort( values.begin(), values.end() );
+    return values[static_cast<size_t>(p * (values.size() - 1) + 0.5)];
+}
+
+/// <summary>
+/// Print result as single JSON line, so output can be collected and compared between releases
+/// </summary>
+/// <param name="result">Case result</param>
+inline void Report( const BenchResult& result )
+{
+    double median = Percentile( result.ns, 0.5 );
+    double gbps = median > 0.0 ? static_cast<double>(result.bytes) / median : 0.0;
+    double opsps = median > 0.0 ? static_cast<double>(result.ops) * 1e9 / median : 0.0;
+    double bytesPerOp = result.ops ? static_cast<double>(result.bytes) / result.ops : 0.0;
+
+    // Relative change against baseline, positive is slower
+    char extra[96] = { 0 };
+    auto base = Baseline().find( result.suite + "/" + result.name + "/" + result.target );
+    if (base != Baseline().end() && base->second > 0.0)
+        sprintf_s( extra, ",\"base_p50_ns\":%.0f,\"delta_pct\":%.1f", base->second, (median - base->second) * 100.0 / base->second );
+
+    if (result.allocs != 0)
+        sprintf_s( extra + strlen( extra ), sizeof( extra ) - strlen( extra ), ",\"allocs\":%llu", static_cast<unsigned long long>(result.allocs) );
+
+    printf(
+        "{\"suite\":\"%s\",\"case\":\"%s\",\"target\":\"%s\",\"iterations\":%zu,\"bytes\":%llu,"
+        "\"min_ns\":%.0f,\"p50_ns\":%.0f,\"p99_ns\":%.0f,\"gbps\":%.3f,\"ops_per_sec\":%.1f,"
+        "\"ns_per_op\":%.1f,\"bytes_per_op\":%.1f%s}\n",
+        result.suite.c_str(), result.name.c_str(), result.target.c_str(), result.ns.size(),
+        static_cast<unsigned long long>(result.bytes),
+        Percentile( result.ns, 0.0 ), median, Percentile( result.ns, 0.99 ), gbps, opsps,
+        result.ops ? median / result.ops : 0.0, bytesPerOp, extra
+        );
+
+    fflush( stdout );
+}
+
+/// <summary>
+/// Get default helper directory, "Testing" folder in repository root
+/// </summary>
+/// <returns>Directory path</returns>
+inline std::wstring GetDefaultHelperDir()
+{
+    std::wstring path = Utils::GetExeDirectory();
+    if (path.empty())
+        return path;
+
+    // build/<platform>/<config>/BlackBoneBench.exe
+    for (int i = 0; i < 3; i++)
+        path = Utils::GetParent( path );
+
+    return path + L"\\Testing";
+}
+
+/// <summary>
+/// Start helper process from helper directory and wait for loader to finish initialization
+/// </summary>
+/// <param name="options">Run options</param>
+/// <param name="process">Process to attach</param>
+/// <param name="helper">Helper file name</param>
+/// <returns>true on success</returns>
+inline bool StartHelper( const BenchOptions& options, Process& process, const std::wstring& helper )
+{
+    if (!NT_SUCCESS( process.CreateAndAttach( options.helperDir + L"\\" + helper ) ))
+    {
+        fprintf( stderr, "Failed to start %ls\n", helper.c_str() );
+        return false;
+    }
+
+    Sleep( 100 );
+    return true;
+}
+
+/// <summary>
+/// Load driver for driver-backed cases
+/// </summary>
+/// <param name="options">Run options</param>
+/// <returns>true if driver cases should run</returns>
+inline bool UseDriver( const BenchOptions& options )
+{
+    if (!options.driver)
+        return false;
+
+    static NTSTATUS status = Driver().EnsureLoaded();
+    if (!NT_SUCCESS( status ))
+    {
+        fprintf( stderr, "Driver is not available, status 0x%08X\n", status );
+        return false;
+    }
+
+    return true;
+}
+
+/// <summary>
+/// Available benchmark suites
+/// </summary>
+void BenchPatternScan( const BenchOptions& options );
+void BenchRpc( const BenchOptions& options );
+void BenchStubGen( const BenchOptions& options );
+void BenchProcess( const BenchOptions& options );
+void BenchMMap( const BenchOptions& options );
+void BenchHook( const BenchOptions& options );
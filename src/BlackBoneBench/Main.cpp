@@ -0,0 +1,91 @@
+#include "Common.h"
+
+#include <cwchar>
+#include <fstream>
+
+/// <summary>
+/// Get string or number value of JSON field in single line object
+/// </summary>
+/// <param name="line">JSON line</param>
+/// <param name="field">Field name</param>
+/// <returns>Raw value, empty if field is missing</returns>
+static std::string JsonField( const std::string& line, const std::string& field )
+{
+    auto pos = line.find( "\"" + field + "\":" );
+    if (pos == std::string::npos)
+        return std::string();
+
+    pos += field.length() + 3;
+    if (pos < line.length() && line[pos] == '"')
+        return line.substr( pos + 1, line.find( '"', pos + 1 ) - pos - 1 );
+
+    return line.substr( pos, line.find_first_of( ",}", pos ) - pos );
+}
+
+/// <summary>
+/// Load median times from output of previous run
+/// </summary>
+/// <param name="path">Saved output</param>
+/// <returns>true on success</returns>
+static bool LoadBaseline( const std::wstring& path )
+{
+    std::ifstream file( path );
+    if (!file)
+        return false;
+
+    for (std::string line; std::getline( file, line );)
+    {
+        auto median = JsonField( line, "p50_ns" );
+        if (!median.empty())
+            Baseline()[JsonField( line, "suite" ) + "/" + JsonField( line, "case" ) + "/" + JsonField( line, "target" )] = atof( median.c_str() );
+    }
+
+    return true;
+}
+
+/// <summary>
+/// Usage: BlackBoneBench [--helpers <dir>] [--suite <name>] [--iterations <count>] [--driver 1] [--baseline <file>]
+/// Every case result is printed to stdout as single JSON line.
+/// With baseline, saved output of previous run, every line also gets baseline median and relative change.
+/// </summary>
+int wmain( int argc, wchar_t* argv[] )
+{
+    BenchOptions options;
+    options.helperDir = GetDefaultHelperDir();
+
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        if (wcscmp( argv[i], L"--helpers" ) == 0)
+            options.helperDir = argv[i + 1];
+        else if (wcscmp( argv[i], L"--suite" ) == 0)
+            options.filter = Utils::WstringToAnsi( argv[i + 1] );
+        else if (wcscmp( argv[i], L"--iterations" ) == 0)
+            options.iterations = std::max( static_cast<uint32_t>(wcstoul( argv[i + 1], nullptr, 10 )), 1u );
+        else if (wcscmp( argv[i], L"--driver" ) == 0)
+            options.driver = wcstoul( argv[i + 1], nullptr, 10 ) != 0;
+        else if (wcscmp( argv[i], L"--baseline" ) == 0 && !LoadBaseline( argv[i + 1] ))
+            fprintf( stderr, "Failed to read baseline %ls\n", argv[i + 1] );
+    }
+
+    struct
+    {
+        const char* name;
+        void( *run )(const BenchOptions&);
+    } suites[] =
+    {
+        { "pattern", &BenchPatternScan },
+        { "rpc",     &BenchRpc },
+        { "stubgen", &BenchStubGen },
+        { "process", &BenchProcess },
+        { "mmap",    &BenchMMap },
+        { "hook",    &BenchHook },
+    };
+
+    for (const auto& suite : suites)
+    {
+        if (options.filter.empty() || options.filter == suite.name)
+            suite.run( options );
+    }
+
+    return 0;
+}
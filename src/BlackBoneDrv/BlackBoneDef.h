@@ -270,6 +270,297 @@ Map entire address space of target process into calling process
 */
 #define IOCTL_BLACKBONE_ENUM_REGIONS  (ULONG)CTL_CODE(FILE_DEVICE_BLACKBONE, 0x80E, METHOD_BUFFERED, FILE_READ_ACCESS | FILE_WRITE_ACCESS)
 
+/*
+    Scan committed memory of target process for byte pattern
+
+    Input:
+       SCAN_MEMORY
+
+    Input size: 
+        sizeof(SCAN_MEMORY)
+
+    Output:
+        SCAN_MEMORY_RESULT - found addresses. 
+        If total > count, output buffer was too small to hold all matches
+
+    Output size:
+        >= sizeof(SCAN_MEMORY_RESULT)
+*/
+#define IOCTL_BLACKBONE_SCAN_MEMORY  (ULONG)CTL_CODE(FILE_DEVICE_BLACKBONE, 0x80F, METHOD_BUFFERED, FILE_READ_ACCESS | FILE_WRITE_ACCESS)
+
+/*
+    Change protection of several memory regions of one process
+
+    Input:
+       PROTECT_MEMORY_BATCH
+
+    Input size: 
+        FIELD_OFFSET(PROTECT_MEMORY_BATCH, entries) + count * sizeof(PROTECT_MEMORY_ENTRY)
+
+    Output:
+        void
+
+    Output size:
+        0
+*/
+#define IOCTL_BLACKBONE_PROTECT_MEMORY_BATCH  (ULONG)CTL_CODE(FILE_DEVICE_BLACKBONE, 0x810, METHOD_BUFFERED, FILE_READ_ACCESS | FILE_WRITE_ACCESS)
+
+/*
+    Read or write several ranges of one process
+
+    Input:
+       COPY_MEMORY_VECTOR
+
+    Input size: 
+        FIELD_OFFSET(COPY_MEMORY_VECTOR, entries) + count * sizeof(COPY_MEMORY_ENTRY)
+
+    Output:
+        COPY_MEMORY_VECTOR with status of every entry
+
+    Output size:
+        Same as input size
+*/
+#define IOCTL_BLACKBONE_COPY_MEMORY_VECTOR  (ULONG)CTL_CODE(FILE_DEVICE_BLACKBONE, 0x811, METHOD_BUFFERED, FILE_READ_ACCESS | FILE_WRITE_ACCESS)
+
+/*
+    Reference target process once and get driver-side handle for it.
+    Handle can be passed instead of PID to memory IOCTLs (copy, allocate/free, protect, enum regions, scan).
+    Handle is closed automatically when either target or calling process exits
+
+    Input:
+       OPEN_TARGET
+
+    Input size: 
+        sizeof(OPEN_TARGET)
+
+    Output:
+        OPEN_TARGET_RESULT
+
+    Output size:
+        sizeof(OPEN_TARGET_RESULT)
+*/
+#define IOCTL_BLACKBONE_OPEN_TARGET  (ULONG)CTL_CODE(FILE_DEVICE_BLACKBONE, 0x812, METHOD_BUFFERED, FILE_READ_ACCESS | FILE_WRITE_ACCESS)
+
+/*
+    Close target handle returned by IOCTL_BLACKBONE_OPEN_TARGET
+
+    Input:
+       CLOSE_TARGET
+
+    Input size: 
+        sizeof(CLOSE_TARGET)
+
+    Output:
+        void
+
+    Output size:
+        0
+*/
+#define IOCTL_BLACKBONE_CLOSE_TARGET  (ULONG)CTL_CODE(FILE_DEVICE_BLACKBONE, 0x813, METHOD_BUFFERED, FILE_READ_ACCESS | FILE_WRITE_ACCESS)
+
+/*
+    Enumerate committed, accessible, non-guarded memory regions starting from given address.
+    Fills as many regions as fit into output buffer and returns address to continue from
+
+    Input:
+       ENUM_REGIONS_NEXT
+
+    Input size: 
+        sizeof(ENUM_REGIONS_NEXT)
+
+    Output:
+        ENUM_REGIONS_NEXT_RESULT
+
+    Output size:
+        >= sizeof(ENUM_REGIONS_NEXT_RESULT)
+*/
+#define IOCTL_BLACKBONE_ENUM_REGIONS_NEXT  (ULONG)CTL_CODE(FILE_DEVICE_BLACKBONE, 0x814, METHOD_BUFFERED, FILE_READ_ACCESS | FILE_WRITE_ACCESS)
+
+/*
+    Create shared command ring for calling process.
+    One page is mapped into the caller, driver worker thread executes copy commands
+    published there every time request event is signaled. No IRP per command.
+
+    Input:
+       CREATE_RING
+
+    Input size: 
+        sizeof(CREATE_RING)
+
+    Output:
+        CREATE_RING_RESULT
+
+    Output size:
+        sizeof(CREATE_RING_RESULT)
+*/
+#define IOCTL_BLACKBONE_CREATE_RING  (ULONG)CTL_CODE(FILE_DEVICE_BLACKBONE, 0x815, METHOD_BUFFERED, FILE_READ_ACCESS | FILE_WRITE_ACCESS)
+
+/*
+    Stop worker and unmap command ring of calling process
+
+    Input:
+       void
+
+    Input size: 
+        0
+
+    Output:
+        void
+
+    Output size:
+        0
+*/
+#define IOCTL_BLACKBONE_DESTROY_RING  (ULONG)CTL_CODE(FILE_DEVICE_BLACKBONE, 0x816, METHOD_BUFFERED, FILE_READ_ACCESS | FILE_WRITE_ACCESS)
+
+/*
+    Read several ranges of one process through its page tables and physical memory.
+    No process attach and no VAD lock, so paged out or not yet touched pages fail with STATUS_INVALID_ADDRESS.
+    Write entries fail with STATUS_NOT_SUPPORTED. Requires Windows 8.1 or newer
+
+    Input:
+       COPY_MEMORY_VECTOR
+
+    Input size: 
+        FIELD_OFFSET(COPY_MEMORY_VECTOR, entries) + count * sizeof(COPY_MEMORY_ENTRY)
+
+    Output:
+        COPY_MEMORY_VECTOR with status of every entry
+
+    Output size:
+        Same as input size
+*/
+#define IOCTL_BLACKBONE_READ_PHYSICAL_VECTOR  (ULONG)CTL_CODE(FILE_DEVICE_BLACKBONE, 0x817, METHOD_BUFFERED, FILE_READ_ACCESS | FILE_WRITE_ACCESS)
+
+/*
+    Enumerate all modules from process loader list in one request
+
+    Input:
+       ENUM_MODULES
+
+    Input size: 
+        sizeof(ENUM_MODULES)
+
+    Output:
+        ENUM_MODULES_RESULT - packed MODULE_RECORD entries. 
+        If required > output size, buffer was too small to hold all records
+
+    Output size:
+        >= sizeof(ENUM_MODULES_RESULT)
+*/
+#define IOCTL_BLACKBONE_ENUM_MODULES  (ULONG)CTL_CODE(FILE_DEVICE_BLACKBONE, 0x818, METHOD_BUFFERED, FILE_READ_ACCESS | FILE_WRITE_ACCESS)
+
+/*
+    Subscribe calling process to process, thread and image load events.
+    Existing subscription of calling process is replaced
+
+    Input:
+       SUBSCRIBE_EVENTS
+
+    Input size: 
+        sizeof(SUBSCRIBE_EVENTS)
+
+    Output:
+        void
+
+    Output size:
+        0
+*/
+#define IOCTL_BLACKBONE_SUBSCRIBE_EVENTS  (ULONG)CTL_CODE(FILE_DEVICE_BLACKBONE, 0x819, METHOD_BUFFERED, FILE_READ_ACCESS | FILE_WRITE_ACCESS)
+
+/*
+    Remove event subscription of calling process. Pending IOCTL_BLACKBONE_WAIT_EVENTS is cancelled
+
+    Input:
+       void
+
+    Input size: 
+        0
+
+    Output:
+        void
+
+    Output size:
+        0
+*/
+#define IOCTL_BLACKBONE_UNSUBSCRIBE_EVENTS  (ULONG)CTL_CODE(FILE_DEVICE_BLACKBONE, 0x81A, METHOD_BUFFERED, FILE_READ_ACCESS | FILE_WRITE_ACCESS)
+
+/*
+    Dequeue subscribed events. Request is pended until at least one event is queued, 
+    so it should be sent through overlapped handle. Only one request per subscriber can be pending
+
+    Input:
+       void
+
+    Input size: 
+        0
+
+    Output:
+        WAIT_EVENTS_RESULT
+
+    Output size:
+        FIELD_OFFSET(WAIT_EVENTS_RESULT, events) + count * sizeof(NOTIFY_EVENT)
+*/
+#define IOCTL_BLACKBONE_WAIT_EVENTS  (ULONG)CTL_CODE(FILE_DEVICE_BLACKBONE, 0x81B, METHOD_BUFFERED, FILE_READ_ACCESS | FILE_WRITE_ACCESS)
+
+/*
+    Allocate several memory regions of one process
+
+    Input:
+       ALLOCATE_MEMORY_BATCH
+
+    Input size: 
+        FIELD_OFFSET(ALLOCATE_MEMORY_BATCH, entries) + count * sizeof(ALLOCATE_MEMORY_ENTRY)
+
+    Output:
+        ALLOCATE_MEMORY_BATCH with address, size and status of every entry
+
+    Output size:
+        Same as input size
+*/
+#define IOCTL_BLACKBONE_ALLOCATE_MEMORY_BATCH  (ULONG)CTL_CODE(FILE_DEVICE_BLACKBONE, 0x81C, METHOD_BUFFERED, FILE_READ_ACCESS | FILE_WRITE_ACCESS)
+
+/*
+    Bring existing memory map of target process in sync with its current address space.
+    Only regions that appeared or disappeared since last call are mapped or unmapped
+
+    Input:
+       REMAP_REFRESH
+
+    Input size: 
+        sizeof(REMAP_REFRESH)
+
+    Output:
+        REMAP_REFRESH_RESULT, removed regions go first, followed by added ones
+
+    Output size:
+        FIELD_OFFSET(REMAP_REFRESH_RESULT, entries) + count * sizeof(MAP_MEMORY_RESULT_ENTRY)
+*/
+#define IOCTL_BLACKBONE_REMAP_REFRESH  (ULONG)CTL_CODE(FILE_DEVICE_BLACKBONE, 0x81D, METHOD_BUFFERED, FILE_READ_ACCESS | FILE_WRITE_ACCESS)
+
+/*
+    Inject same dll into several processes with LdrLoadDll. 
+    Manual mapping is not supported, use IOCTL_BLACKBONE_INJECT_DLL
+
+    Input:
+       INJECT_DLL_BATCH
+
+    Input size: 
+        FIELD_OFFSET(INJECT_DLL_BATCH, entries) + count * sizeof(INJECT_DLL_BATCH_ENTRY)
+
+    Output:
+        INJECT_DLL_BATCH with status of every entry
+
+    Output size:
+        Same as input size
+*/
+#define IOCTL_BLACKBONE_INJECT_DLL_BATCH  (ULONG)CTL_CODE(FILE_DEVICE_BLACKBONE, 0x81E, METHOD_BUFFERED, FILE_READ_ACCESS | FILE_WRITE_ACCESS)
+
+// Target handles are tagged, so they never collide with process IDs
+#define BLACKBONE_TARGET_HANDLE_FLAG 0x80000000
+
+#define BLACKBONE_MAX_PATTERN   256     // Max pattern length for IOCTL_BLACKBONE_SCAN_MEMORY
+#define BLACKBONE_RING_ENTRIES  64      // Command ring capacity, power of 2
+
 
 /// <summary>
 /// Input for IOCTL_BLACKBONE_DISABLE_DEP
@@ -331,7 +622,7 @@ typedef struct _ALLOCATE_FREE_MEMORY
     ULONGLONG size;             // Region size
     ULONG     pid;              // Target process id
     ULONG     protection;       // Memory protection for allocation
-    ULONG     type;             // MEM_RESERVE/MEM_COMMIT/MEM_DECOMMIT/MEM_RELEASE
+    ULONG     type;             // MEM_RESERVE/MEM_COMMIT/MEM_DECOMMIT/MEM_RELEASE. MEM_LARGE_PAGES is tried first if set
     BOOLEAN   allocate;         // TRUE if allocation, FALSE is freeing
     BOOLEAN   physical;         // If set to TRUE, physical pages will be directly mapped into UM space
 } ALLOCATE_FREE_MEMORY, *PALLOCATE_FREE_MEMORY;
@@ -345,6 +636,29 @@ typedef struct _ALLOCATE_FREE_MEMORY_RESULT
     ULONGLONG size;             // Allocated size
 } ALLOCATE_FREE_MEMORY_RESULT, *PALLOCATE_FREE_MEMORY_RESULT;
 
+/// <summary>
+/// Single region of IOCTL_BLACKBONE_ALLOCATE_MEMORY_BATCH
+/// </summary>
+typedef struct _ALLOCATE_MEMORY_ENTRY
+{
+    ULONGLONG base;             // Desired base, 0 for any. Allocated base on output
+    ULONGLONG size;             // Region size. Allocated size on output
+    ULONG     protection;       // Memory protection
+    ULONG     type;             // MEM_RESERVE/MEM_COMMIT. MEM_LARGE_PAGES is tried first if set
+    BOOLEAN   physical;         // Directly map physical pages, large pages are not used
+    NTSTATUS  status;           // Allocation status, filled by driver
+} ALLOCATE_MEMORY_ENTRY, *PALLOCATE_MEMORY_ENTRY;
+
+/// <summary>
+/// Input for IOCTL_BLACKBONE_ALLOCATE_MEMORY_BATCH
+/// </summary>
+typedef struct _ALLOCATE_MEMORY_BATCH
+{
+    ULONG pid;                          // Target process id or target handle
+    ULONG count;                        // Number of regions
+    ALLOCATE_MEMORY_ENTRY entries[1];   // Regions, variable-sized
+} ALLOCATE_MEMORY_BATCH, *PALLOCATE_MEMORY_BATCH;
+
 /// <summary>
 /// Input for IOCTL_BLACKBONE_PROTECT_MEMORY
 /// </summary>
@@ -356,6 +670,72 @@ typedef struct _PROTECT_MEMORY
     ULONG     newProtection;    // New protection value
 } PROTECT_MEMORY, *PPROTECT_MEMORY;
 
+/// <summary>
+/// Single region of IOCTL_BLACKBONE_PROTECT_MEMORY_BATCH
+/// </summary>
+typedef struct _PROTECT_MEMORY_ENTRY
+{
+    ULONGLONG base;             // Region base address
+    ULONGLONG size;             // Region size
+    ULONG     newProtection;    // New protection value
+} PROTECT_MEMORY_ENTRY, *PPROTECT_MEMORY_ENTRY;
+
+/// <summary>
+/// Input for IOCTL_BLACKBONE_PROTECT_MEMORY_BATCH
+/// </summary>
+typedef struct _PROTECT_MEMORY_BATCH
+{
+    ULONG pid;                          // Target process id
+    ULONG count;                        // Number of regions
+    PROTECT_MEMORY_ENTRY entries[1];    // Regions, variable-sized
+} PROTECT_MEMORY_BATCH, *PPROTECT_MEMORY_BATCH;
+
+/// <summary>
+/// Single range of IOCTL_BLACKBONE_COPY_MEMORY_VECTOR
+/// </summary>
+typedef struct _COPY_MEMORY_ENTRY
+{
+    ULONGLONG localbuf;         // Buffer address
+    ULONGLONG targetPtr;        // Target address
+    ULONGLONG size;             // Buffer size
+    BOOLEAN   write;            // TRUE if write operation, FALSE if read
+    NTSTATUS  status;           // Copy status, filled by driver
+} COPY_MEMORY_ENTRY, *PCOPY_MEMORY_ENTRY;
+
+/// <summary>
+/// Input and output for IOCTL_BLACKBONE_COPY_MEMORY_VECTOR
+/// </summary>
+typedef struct _COPY_MEMORY_VECTOR
+{
+    ULONG pid;                          // Target process id
+    ULONG count;                        // Number of ranges
+    COPY_MEMORY_ENTRY entries[1];       // Ranges, variable-sized
+} COPY_MEMORY_VECTOR, *PCOPY_MEMORY_VECTOR;
+
+/// <summary>
+/// Input for IOCTL_BLACKBONE_OPEN_TARGET
+/// </summary>
+typedef struct _OPEN_TARGET
+{
+    ULONG pid;                  // Target process id
+} OPEN_TARGET, *POPEN_TARGET;
+
+/// <summary>
+/// Output for IOCTL_BLACKBONE_OPEN_TARGET
+/// </summary>
+typedef struct _OPEN_TARGET_RESULT
+{
+    ULONG handle;               // Target handle, use in place of pid
+} OPEN_TARGET_RESULT, *POPEN_TARGET_RESULT;
+
+/// <summary>
+/// Input for IOCTL_BLACKBONE_CLOSE_TARGET
+/// </summary>
+typedef struct _CLOSE_TARGET
+{
+    ULONG handle;               // Target handle
+} CLOSE_TARGET, *PCLOSE_TARGET;
+
 /// <summary>
 /// Input for IOCTL_BLACKBONE_REMAP_MEMORY
 /// </summary>
@@ -364,6 +744,7 @@ typedef struct _MAP_MEMORY
     ULONG   pid;                // Target process id
     wchar_t pipeName[32];       // Hook pipe name
     BOOLEAN mapSections;        // Set to TRUE to map sections
+    BOOLEAN lazy;               // Set to TRUE to only record regions, they are mapped by IOCTL_BLACKBONE_MAP_REGION on demand
 } MAP_MEMORY, *PMAP_MEMORY;
 
 /// <summary>
@@ -524,4 +905,219 @@ typedef struct _ENUM_REGIONS_RESULT
 {
     ULONGLONG  count;                   // Number of records
     MEM_REGION regions[1];              // Found regions, variable-sized
-} ENUM_REGIONS_RESULT, *PENUM_REGIONS_RESULT;
\ No newline at end of file
+} ENUM_REGIONS_RESULT, *PENUM_REGIONS_RESULT;
+
+/// <summary>
+/// Input for IOCTL_BLACKBONE_ENUM_REGIONS_NEXT
+/// </summary>
+typedef struct _ENUM_REGIONS_NEXT
+{
+    ULONGLONG  start;       // Address to start from, 0 - lowest user address
+    ULONG      pid;         // Process ID
+    BOOLEAN    fromVad;     // Walk VAD tree directly: one record per allocation with its initial protection, State is 0
+} ENUM_REGIONS_NEXT, *PENUM_REGIONS_NEXT;
+
+/// <summary>
+/// Output for IOCTL_BLACKBONE_ENUM_REGIONS_NEXT
+/// </summary>
+typedef struct _ENUM_REGIONS_NEXT_RESULT
+{
+    ULONGLONG  next;                    // Address to continue from, 0 if enumeration is complete
+    ULONGLONG  count;                   // Number of records
+    MEM_REGION regions[1];              // Found regions, variable-sized
+} ENUM_REGIONS_NEXT_RESULT, *PENUM_REGIONS_NEXT_RESULT;
+
+/// <summary>
+/// Input for IOCTL_BLACKBONE_SCAN_MEMORY
+/// </summary>
+typedef struct _SCAN_MEMORY
+{
+    ULONGLONG  minAddress;                      // Lowest scanned address, 0 - lowest user address
+    ULONGLONG  maxAddress;                      // Highest scanned address (exclusive), 0 - highest user address
+    ULONG      pid;                             // Process ID
+    ULONG      protection;                      // Any of these protection flags must be set, 0 - any protection
+    ULONG      type;                            // Any of MEM_IMAGE | MEM_PRIVATE | MEM_MAPPED, 0 - any type
+    ULONG      length;                          // Pattern length
+    BOOLEAN    useMask;                         // Apply mask. Matches don't overlap, like user-mode wildcard search
+    UCHAR      pattern[BLACKBONE_MAX_PATTERN];  // Pattern bytes
+    UCHAR      mask[BLACKBONE_MAX_PATTERN];     // 0xFF - significant byte, 0x00 - wildcard
+} SCAN_MEMORY, *PSCAN_MEMORY;
+
+/// <summary>
+/// Output for IOCTL_BLACKBONE_SCAN_MEMORY
+/// </summary>
+typedef struct _SCAN_MEMORY_RESULT
+{
+    ULONGLONG  total;                   // Total number of matches
+    ULONGLONG  count;                   // Number of stored addresses
+    ULONGLONG  addresses[1];            // Found addresses, variable-sized
+} SCAN_MEMORY_RESULT, *PSCAN_MEMORY_RESULT;
+
+/// <summary>
+/// Input for IOCTL_BLACKBONE_CREATE_RING
+/// </summary>
+typedef struct _CREATE_RING
+{
+    ULONGLONG  requestEvent;    // Auto-reset event, signaled by caller after publishing commands
+    ULONGLONG  completeEvent;   // Auto-reset event, signaled by driver after ring is drained
+} CREATE_RING, *PCREATE_RING;
+
+/// <summary>
+/// Output for IOCTL_BLACKBONE_CREATE_RING
+/// </summary>
+typedef struct _CREATE_RING_RESULT
+{
+    ULONGLONG  address;         // COMMAND_RING address in calling process
+} CREATE_RING_RESULT, *PCREATE_RING_RESULT;
+
+/// <summary>
+/// Command ring entry, same meaning as COPY_MEMORY
+/// </summary>
+typedef struct _RING_ENTRY
+{
+    ULONGLONG  localbuf;        // Buffer address in ring owner process
+    ULONGLONG  targetPtr;       // Target address
+    ULONGLONG  size;            // Range size
+    ULONG      pid;             // Target process ID or target handle
+    BOOLEAN    write;           // TRUE if write operation, FALSE if read
+    NTSTATUS   status;          // Copy status, written by driver
+} RING_ENTRY, *PRING_ENTRY;
+
+/// <summary>
+/// Shared command ring layout.
+/// Caller fills entries[head % BLACKBONE_RING_ENTRIES] and increments head,
+/// driver increments tail after entry status is written
+/// </summary>
+typedef struct _COMMAND_RING
+{
+    volatile LONG head;         // Number of published commands, written by caller
+    volatile LONG tail;         // Number of completed commands, written by driver
+    RING_ENTRY entries[BLACKBONE_RING_ENTRIES];
+} COMMAND_RING, *PCOMMAND_RING;
+
+/// <summary>
+/// Input for IOCTL_BLACKBONE_ENUM_MODULES
+/// </summary>
+typedef struct _ENUM_MODULES
+{
+    ULONG      pid;             // Process ID or target handle
+    BOOLEAN    x86;             // Walk 32-bit loader list of Wow64 process
+} ENUM_MODULES, *PENUM_MODULES;
+
+/// <summary>
+/// Single module record, variable-sized
+/// </summary>
+typedef struct _MODULE_RECORD
+{
+    ULONGLONG  base;            // Image base
+    ULONGLONG  ldrEntry;        // Loader entry address
+    ULONG      size;            // Image size
+    USHORT     recordSize;      // Record size including name, 8-byte aligned
+    USHORT     nameLength;      // Full path length in characters, without terminator
+    WCHAR      name[1];         // Full image path
+} MODULE_RECORD, *PMODULE_RECORD;
+
+/// <summary>
+/// Output for IOCTL_BLACKBONE_ENUM_MODULES
+/// </summary>
+typedef struct _ENUM_MODULES_RESULT
+{
+    ULONG      count;           // Number of stored records
+    ULONG      required;        // Output size required to hold all records
+    MODULE_RECORD records[1];   // Packed records, each one starts recordSize bytes after previous
+} ENUM_MODULES_RESULT, *PENUM_MODULES_RESULT;
+
+// Max number of queued events per subscriber, older events are dropped on overflow
+#define BLACKBONE_EVENT_QUEUE_SIZE 128
+
+typedef enum _NotifyEventType
+{
+    NE_ProcessCreate,
+    NE_ProcessExit,
+    NE_ThreadCreate,
+    NE_ThreadExit,
+    NE_ImageLoad,
+} NotifyEventType;
+
+// Subscription mask bit of event type
+#define BLACKBONE_EVENT_MASK(type) (1u << (type))
+
+/// <summary>
+/// Input for IOCTL_BLACKBONE_SUBSCRIBE_EVENTS
+/// </summary>
+typedef struct _SUBSCRIBE_EVENTS
+{
+    ULONG      pid;             // Process ID to watch, 0 to watch all processes
+    ULONG      mask;            // Combination of BLACKBONE_EVENT_MASK values
+} SUBSCRIBE_EVENTS, *PSUBSCRIBE_EVENTS;
+
+/// <summary>
+/// Single process, thread or image event
+/// </summary>
+typedef struct _NOTIFY_EVENT
+{
+    ULONG      type;            // NotifyEventType
+    ULONG      pid;             // Process ID
+    ULONG      tid;             // Thread ID, thread events only
+    ULONG      parentPid;       // Parent process ID, NE_ProcessCreate only
+    ULONGLONG  imageBase;       // Image base, NE_ImageLoad only
+    ULONGLONG  imageSize;       // Image size, NE_ImageLoad only
+    WCHAR      imagePath[260];  // Null-terminated full image path, NE_ImageLoad only
+} NOTIFY_EVENT, *PNOTIFY_EVENT;
+
+/// <summary>
+/// Output for IOCTL_BLACKBONE_WAIT_EVENTS
+/// </summary>
+typedef struct _WAIT_EVENTS_RESULT
+{
+    ULONG      count;           // Number of returned events
+    ULONG      lost;            // Number of events dropped due to queue overflow since last request
+    NOTIFY_EVENT events[1];     // Events in order of arrival
+} WAIT_EVENTS_RESULT, *PWAIT_EVENTS_RESULT;
+
+/// <summary>
+/// Input for IOCTL_BLACKBONE_REMAP_REFRESH
+/// </summary>
+typedef struct _REMAP_REFRESH
+{
+    ULONG      pid;             // Target process id
+    BOOLEAN    mapSections;     // Set to TRUE to map new sections
+} REMAP_REFRESH, *PREMAP_REFRESH;
+
+/// <summary>
+/// Output for IOCTL_BLACKBONE_REMAP_REFRESH
+/// If count is less than removed + added, output was truncated and 
+/// complete map must be fetched with IOCTL_BLACKBONE_MAP_MEMORY
+/// </summary>
+typedef struct _REMAP_REFRESH_RESULT
+{
+    ULONG      removed;         // Number of unmapped regions, newPtr holds former host address
+    ULONG      added;           // Number of mapped regions, newPtr is 0 if region could not be mapped
+    ULONG      count;           // Number of returned entries
+    MAP_MEMORY_RESULT_ENTRY entries[1];
+} REMAP_REFRESH_RESULT, *PREMAP_REFRESH_RESULT;
+
+/// <summary>
+/// Single target of IOCTL_BLACKBONE_INJECT_DLL_BATCH
+/// </summary>
+typedef struct _INJECT_DLL_BATCH_ENTRY
+{
+    ULONG      pid;             // Target process ID
+    NTSTATUS   status;          // Injection status, filled by driver
+} INJECT_DLL_BATCH_ENTRY, *PINJECT_DLL_BATCH_ENTRY;
+
+/// <summary>
+/// Input for IOCTL_BLACKBONE_INJECT_DLL_BATCH
+/// </summary>
+typedef struct _INJECT_DLL_BATCH
+{
+    InjectType type;                // Type of injection, IT_Thread or IT_Apc
+    wchar_t    FullDllPath[512];    // Fully-qualified path to the target dll
+    wchar_t    initArg[512];        // Init routine argument
+    ULONG      initRVA;             // Init routine RVA, if 0 - no init routine
+    BOOLEAN    wait;                // Wait on injection thread
+    BOOLEAN    unlink;              // Unlink module after injection
+    BOOLEAN    erasePE;             // Erase PE headers after injection
+    ULONG      count;               // Number of targets
+    INJECT_DLL_BATCH_ENTRY entries[1];  // Targets, variable-sized
+} INJECT_DLL_BATCH, *PINJECT_DLL_BATCH;
@@ -1,6 +1,8 @@
 #include "BlackBoneDrv.h"
 #include "Remap.h"
 #include "Loader.h"
+#include "Ring.h"
+#include "Events.h"
 #include "Utils.h"
 #include <Ntstrsafe.h>
 
@@ -49,6 +51,12 @@ NTSTATUS DriverEntry( IN PDRIVER_OBJECT DriverObject, IN PUNICODE_STRING Registr
     // Globals init
     //
     InitializeListHead( &g_PhysProcesses );
+    InitializeListHead( &g_Targets );
+    KeInitializeGuardedMutex( &g_targetLock );
+    InitializeListHead( &g_Rings );
+    KeInitializeGuardedMutex( &g_ringLock );
+    InitializeListHead( &g_Subscribers );
+    KeInitializeSpinLock( &g_eventLock );
     RtlInitializeGenericTableAvl( &g_ProcessPageTables, &AvlCompare, &AvlAllocate, &AvlFree, NULL );
     KeInitializeGuardedMutex( &g_globalLock );
 
@@ -66,6 +74,7 @@ NTSTATUS DriverEntry( IN PDRIVER_OBJECT DriverObject, IN PUNICODE_STRING Registr
     if (!NT_SUCCESS( status ))
     {
         DPRINT( "BlackBone: %s: IoCreateDevice failed with status 0x%X\n", __FUNCTION__, status );
+        PsSetCreateProcessNotifyRoutine( BBProcessNotify, TRUE );
         return status;
     }
 
@@ -82,6 +91,31 @@ NTSTATUS DriverEntry( IN PDRIVER_OBJECT DriverObject, IN PUNICODE_STRING Registr
     {
         DPRINT( "BlackBone: %s: IoCreateSymbolicLink failed with status 0x%X\n", __FUNCTION__, status );
         IoDeleteDevice (deviceObject);
+        PsSetCreateProcessNotifyRoutine( BBProcessNotify, TRUE );
+        return status;
+    }
+
+    // Setup event sources for IOCTL_BLACKBONE_SUBSCRIBE_EVENTS.
+    // Registered last, so no failure path leaves callbacks pointing into unloaded image
+    status = PsSetCreateThreadNotifyRoutine( BBThreadNotify );
+    if (!NT_SUCCESS( status ))
+    {
+        DPRINT( "BlackBone: %s: Failed to setup thread notify routine with status 0x%X\n", __FUNCTION__, status );
+        IoDeleteSymbolicLink( &deviceLink );
+        IoDeleteDevice( deviceObject );
+        PsSetCreateProcessNotifyRoutine( BBProcessNotify, TRUE );
+        return status;
+    }
+
+    status = PsSetLoadImageNotifyRoutine( BBImageNotify );
+    if (!NT_SUCCESS( status ))
+    {
+        DPRINT( "BlackBone: %s: Failed to setup image notify routine with status 0x%X\n", __FUNCTION__, status );
+        PsRemoveCreateThreadNotifyRoutine( BBThreadNotify );
+        IoDeleteSymbolicLink( &deviceLink );
+        IoDeleteDevice( deviceObject );
+        PsSetCreateProcessNotifyRoutine( BBProcessNotify, TRUE );
+        return status;
     }
 
     return status;
@@ -96,6 +130,17 @@ VOID BBUnload( IN PDRIVER_OBJECT DriverObject )
 
     // Unregister notification
     PsSetCreateProcessNotifyRoutine( BBProcessNotify, TRUE );
+    PsRemoveCreateThreadNotifyRoutine( BBThreadNotify );
+    PsRemoveLoadImageNotifyRoutine( BBImageNotify );
+
+    // Cancel pending event requests
+    BBCleanupSubscribers( NULL );
+
+    // Stop ring workers before targets they may use are released
+    BBCleanupRings( NULL );
+
+    // Release referenced targets
+    BBCleanupTargets( NULL );
 
     // Cleanup physical regions
     BBCleanupProcessPhysList();
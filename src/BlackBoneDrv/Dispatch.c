@@ -1,6 +1,8 @@
 #include "BlackBoneDrv.h"
 #include "Remap.h"
 #include "Loader.h"
+#include "Ring.h"
+#include "Events.h"
 
 #include <ntstrsafe.h>
 
@@ -75,6 +77,115 @@ NTSTATUS BBDispatch( IN PDEVICE_OBJECT DeviceObject, IN PIRP Irp )
                     }
                     break;
 
+                case IOCTL_BLACKBONE_COPY_MEMORY_VECTOR:
+                    {
+                        PCOPY_MEMORY_VECTOR pData = (PCOPY_MEMORY_VECTOR)ioBuffer;
+
+                        if (inputBufferLength >= FIELD_OFFSET( COPY_MEMORY_VECTOR, entries ) && ioBuffer &&
+                            pData->count <= (inputBufferLength - FIELD_OFFSET( COPY_MEMORY_VECTOR, entries )) / sizeof( COPY_MEMORY_ENTRY ) &&
+                            outputBufferLength >= inputBufferLength)
+                        {
+                            Irp->IoStatus.Status = BBCopyMemoryVector( pData );
+                            if (NT_SUCCESS( Irp->IoStatus.Status ))
+                                Irp->IoStatus.Information = inputBufferLength;
+                        }
+                        else
+                            Irp->IoStatus.Status = STATUS_INFO_LENGTH_MISMATCH;
+                    }
+                    break;
+
+                case IOCTL_BLACKBONE_READ_PHYSICAL_VECTOR:
+                    {
+                        PCOPY_MEMORY_VECTOR pData = (PCOPY_MEMORY_VECTOR)ioBuffer;
+
+                        if (inputBufferLength >= FIELD_OFFSET( COPY_MEMORY_VECTOR, entries ) && ioBuffer &&
+                            pData->count <= (inputBufferLength - FIELD_OFFSET( COPY_MEMORY_VECTOR, entries )) / sizeof( COPY_MEMORY_ENTRY ) &&
+                            outputBufferLength >= inputBufferLength)
+                        {
+                            Irp->IoStatus.Status = BBReadPhysicalVector( pData );
+                            if (NT_SUCCESS( Irp->IoStatus.Status ))
+                                Irp->IoStatus.Information = inputBufferLength;
+                        }
+                        else
+                            Irp->IoStatus.Status = STATUS_INFO_LENGTH_MISMATCH;
+                    }
+                    break;
+
+                case IOCTL_BLACKBONE_OPEN_TARGET:
+                    {
+                        if (inputBufferLength >= sizeof( OPEN_TARGET ) && outputBufferLength >= sizeof( OPEN_TARGET_RESULT ) && ioBuffer)
+                        {
+                            OPEN_TARGET_RESULT result = { 0 };
+                            Irp->IoStatus.Status = BBOpenTarget( (POPEN_TARGET)ioBuffer, &result );
+
+                            if (NT_SUCCESS( Irp->IoStatus.Status ))
+                            {
+                                RtlCopyMemory( ioBuffer, &result, sizeof( result ) );
+                                Irp->IoStatus.Information = sizeof( result );
+                            }
+                        }
+                        else
+                            Irp->IoStatus.Status = STATUS_INFO_LENGTH_MISMATCH;
+                    }
+                    break;
+
+                case IOCTL_BLACKBONE_CLOSE_TARGET:
+                    {
+                        if (inputBufferLength >= sizeof( CLOSE_TARGET ) && ioBuffer)
+                            Irp->IoStatus.Status = BBCloseTarget( (PCLOSE_TARGET)ioBuffer );
+                        else
+                            Irp->IoStatus.Status = STATUS_INFO_LENGTH_MISMATCH;
+                    }
+                    break;
+
+                case IOCTL_BLACKBONE_CREATE_RING:
+                    {
+                        if (inputBufferLength >= sizeof( CREATE_RING ) && outputBufferLength >= sizeof( CREATE_RING_RESULT ) && ioBuffer)
+                        {
+                            CREATE_RING_RESULT result = { 0 };
+                            Irp->IoStatus.Status = BBCreateRing( (PCREATE_RING)ioBuffer, &result );
+
+                            if (NT_SUCCESS( Irp->IoStatus.Status ))
+                            {
+                                RtlCopyMemory( ioBuffer, &result, sizeof( result ) );
+                                Irp->IoStatus.Information = sizeof( result );
+                            }
+                        }
+                        else
+                            Irp->IoStatus.Status = STATUS_INFO_LENGTH_MISMATCH;
+                    }
+                    break;
+
+                case IOCTL_BLACKBONE_DESTROY_RING:
+                    Irp->IoStatus.Status = BBDestroyRing();
+                    break;
+
+                case IOCTL_BLACKBONE_SUBSCRIBE_EVENTS:
+                    {
+                        if (inputBufferLength >= sizeof( SUBSCRIBE_EVENTS ) && ioBuffer)
+                            Irp->IoStatus.Status = BBSubscribeEvents( (PSUBSCRIBE_EVENTS)ioBuffer );
+                        else
+                            Irp->IoStatus.Status = STATUS_INFO_LENGTH_MISMATCH;
+                    }
+                    break;
+
+                case IOCTL_BLACKBONE_UNSUBSCRIBE_EVENTS:
+                    Irp->IoStatus.Status = BBUnsubscribeEvents();
+                    break;
+
+                case IOCTL_BLACKBONE_WAIT_EVENTS:
+                    {
+                        if (outputBufferLength >= sizeof( WAIT_EVENTS_RESULT ) && ioBuffer)
+                        {
+                            // Pended request is owned and completed by event queue
+                            if (BBWaitEvents( Irp ) == STATUS_PENDING)
+                                return STATUS_PENDING;
+                        }
+                        else
+                            Irp->IoStatus.Status = STATUS_INFO_LENGTH_MISMATCH;
+                    }
+                    break;
+
                 case IOCTL_BLACKBONE_ALLOCATE_FREE_MEMORY:
                     {
                         if (inputBufferLength >= sizeof( ALLOCATE_FREE_MEMORY ) &&
@@ -95,6 +206,23 @@ NTSTATUS BBDispatch( IN PDEVICE_OBJECT DeviceObject, IN PIRP Irp )
                     }
                     break;
 
+                case IOCTL_BLACKBONE_ALLOCATE_MEMORY_BATCH:
+                    {
+                        PALLOCATE_MEMORY_BATCH pData = (PALLOCATE_MEMORY_BATCH)ioBuffer;
+
+                        if (inputBufferLength >= FIELD_OFFSET( ALLOCATE_MEMORY_BATCH, entries ) && ioBuffer &&
+                            pData->count <= (inputBufferLength - FIELD_OFFSET( ALLOCATE_MEMORY_BATCH, entries )) / sizeof( ALLOCATE_MEMORY_ENTRY ) &&
+                            outputBufferLength >= inputBufferLength)
+                        {
+                            Irp->IoStatus.Status = BBAllocateMemoryBatch( pData );
+                            if (NT_SUCCESS( Irp->IoStatus.Status ))
+                                Irp->IoStatus.Information = inputBufferLength;
+                        }
+                        else
+                            Irp->IoStatus.Status = STATUS_INFO_LENGTH_MISMATCH;
+                    }
+                    break;
+
                 case IOCTL_BLACKBONE_PROTECT_MEMORY:
                     {
                         if (inputBufferLength >= sizeof( PROTECT_MEMORY ) && ioBuffer)
@@ -104,6 +232,18 @@ NTSTATUS BBDispatch( IN PDEVICE_OBJECT DeviceObject, IN PIRP Irp )
                     }
                     break;
 
+                case IOCTL_BLACKBONE_PROTECT_MEMORY_BATCH:
+                    {
+                        PPROTECT_MEMORY_BATCH pData = (PPROTECT_MEMORY_BATCH)ioBuffer;
+
+                        if (inputBufferLength >= FIELD_OFFSET( PROTECT_MEMORY_BATCH, entries ) && ioBuffer &&
+                            pData->count <= (inputBufferLength - FIELD_OFFSET( PROTECT_MEMORY_BATCH, entries )) / sizeof( PROTECT_MEMORY_ENTRY ))
+                            Irp->IoStatus.Status = BBProtectMemoryBatch( pData );
+                        else
+                            Irp->IoStatus.Status = STATUS_INFO_LENGTH_MISMATCH;
+                    }
+                    break;
+
                 case IOCTL_BLACKBONE_MAP_MEMORY:
                     {
                         if (inputBufferLength >= sizeof( MAP_MEMORY ) && ioBuffer && outputBufferLength >= sizeof( ULONG ))
@@ -150,6 +290,8 @@ NTSTATUS BBDispatch( IN PDEVICE_OBJECT DeviceObject, IN PIRP Irp )
                                     *(ULONG*)ioBuffer = (ULONG)sizeRequired;
                                     Irp->IoStatus.Information = sizeof( ULONG );
                                 }
+
+                                BBReleaseProcessEntry( pProcessEntry );
                             }
                         }
                         else
@@ -194,6 +336,24 @@ NTSTATUS BBDispatch( IN PDEVICE_OBJECT DeviceObject, IN PIRP Irp )
                     }
                     break;
 
+                case IOCTL_BLACKBONE_REMAP_REFRESH:
+                    {
+                        if (inputBufferLength >= sizeof( REMAP_REFRESH ) && outputBufferLength >= sizeof( REMAP_REFRESH_RESULT ) && ioBuffer)
+                        {
+                            // Input and output share system buffer, output is written directly
+                            REMAP_REFRESH data = *(PREMAP_REFRESH)ioBuffer;
+                            PREMAP_REFRESH_RESULT pResult = (PREMAP_REFRESH_RESULT)ioBuffer;
+
+                            Irp->IoStatus.Status = BBRefreshMemoryMap( &data, pResult, outputBufferLength );
+
+                            if (NT_SUCCESS( Irp->IoStatus.Status ))
+                                Irp->IoStatus.Information = FIELD_OFFSET( REMAP_REFRESH_RESULT, entries ) + pResult->count * sizeof( MAP_MEMORY_RESULT_ENTRY );
+                        }
+                        else
+                            Irp->IoStatus.Status = STATUS_INFO_LENGTH_MISMATCH;
+                    }
+                    break;
+
                 case IOCTL_BLACKBONE_HIDE_VAD:
                     {
                         if (inputBufferLength >= sizeof( HIDE_VAD ) && ioBuffer)
@@ -212,6 +372,23 @@ NTSTATUS BBDispatch( IN PDEVICE_OBJECT DeviceObject, IN PIRP Irp )
                     }
                     break;
 
+                case IOCTL_BLACKBONE_INJECT_DLL_BATCH:
+                    {
+                        PINJECT_DLL_BATCH pData = (PINJECT_DLL_BATCH)ioBuffer;
+
+                        if (inputBufferLength >= FIELD_OFFSET( INJECT_DLL_BATCH, entries ) && ioBuffer &&
+                            pData->count <= (inputBufferLength - FIELD_OFFSET( INJECT_DLL_BATCH, entries )) / sizeof( INJECT_DLL_BATCH_ENTRY ) &&
+                            outputBufferLength >= inputBufferLength)
+                        {
+                            Irp->IoStatus.Status = BBInjectDllBatch( pData );
+                            if (NT_SUCCESS( Irp->IoStatus.Status ))
+                                Irp->IoStatus.Information = inputBufferLength;
+                        }
+                        else
+                            Irp->IoStatus.Status = STATUS_INFO_LENGTH_MISMATCH;
+                    }
+                    break;
+
                 case IOCTL_BLACKBONE_MAP_DRIVER:
                     {
                         if (inputBufferLength >= sizeof( MMAP_DRIVER ) && ioBuffer)
@@ -268,6 +445,76 @@ NTSTATUS BBDispatch( IN PDEVICE_OBJECT DeviceObject, IN PIRP Irp )
                     }
                     break; 
 
+                case IOCTL_BLACKBONE_ENUM_REGIONS_NEXT:
+                    {
+                        if (inputBufferLength >= sizeof( ENUM_REGIONS_NEXT ) && outputBufferLength >= sizeof( ENUM_REGIONS_NEXT_RESULT ) && ioBuffer)
+                        {
+                            // Input and output share system buffer, output is written directly
+                            ENUM_REGIONS_NEXT data = *(PENUM_REGIONS_NEXT)ioBuffer;
+                            PENUM_REGIONS_NEXT_RESULT pResult = (PENUM_REGIONS_NEXT_RESULT)ioBuffer;
+
+                            pResult->count = (outputBufferLength - FIELD_OFFSET( ENUM_REGIONS_NEXT_RESULT, regions )) / sizeof( MEM_REGION );
+                            Irp->IoStatus.Status = BBEnumMemRegionsNext( &data, pResult );
+
+                            if (NT_SUCCESS( Irp->IoStatus.Status ))
+                                Irp->IoStatus.Information = FIELD_OFFSET( ENUM_REGIONS_NEXT_RESULT, regions ) + (ULONG_PTR)pResult->count * sizeof( MEM_REGION );
+                        }
+                        else
+                            Irp->IoStatus.Status = STATUS_INFO_LENGTH_MISMATCH;
+                    }
+                    break;
+
+                case IOCTL_BLACKBONE_ENUM_MODULES:
+                    {
+                        if (inputBufferLength >= sizeof( ENUM_MODULES ) && outputBufferLength >= sizeof( ENUM_MODULES_RESULT ) && ioBuffer)
+                        {
+                            // Input and output share system buffer, output is written directly
+                            ENUM_MODULES data = *(PENUM_MODULES)ioBuffer;
+                            PENUM_MODULES_RESULT pResult = (PENUM_MODULES_RESULT)ioBuffer;
+
+                            Irp->IoStatus.Status = BBEnumModules( &data, pResult, outputBufferLength );
+
+                            if (NT_SUCCESS( Irp->IoStatus.Status ))
+                                Irp->IoStatus.Information = min( pResult->required, outputBufferLength );
+                        }
+                        else
+                            Irp->IoStatus.Status = STATUS_INFO_LENGTH_MISMATCH;
+                    }
+                    break;
+
+                case IOCTL_BLACKBONE_SCAN_MEMORY:
+                    {
+                        if (inputBufferLength >= sizeof( SCAN_MEMORY ) && outputBufferLength >= sizeof( SCAN_MEMORY_RESULT ) && ioBuffer)
+                        {
+                            // Input and output share system buffer
+                            PSCAN_MEMORY pData = ExAllocatePoolWithTag( PagedPool, sizeof( SCAN_MEMORY ), BB_POOL_TAG );
+                            PSCAN_MEMORY_RESULT pResult = ExAllocatePoolWithTag( PagedPool, outputBufferLength, BB_POOL_TAG );
+
+                            if (pData && pResult)
+                            {
+                                RtlCopyMemory( pData, ioBuffer, sizeof( SCAN_MEMORY ) );
+                                pResult->count = (outputBufferLength - FIELD_OFFSET( SCAN_MEMORY_RESULT, addresses )) / sizeof( ULONGLONG );
+
+                                Irp->IoStatus.Status = BBScanMemory( pData, pResult );
+                                if (NT_SUCCESS( Irp->IoStatus.Status ))
+                                {
+                                    Irp->IoStatus.Information = FIELD_OFFSET( SCAN_MEMORY_RESULT, addresses ) + (ULONG_PTR)pResult->count * sizeof( ULONGLONG );
+                                    RtlCopyMemory( ioBuffer, pResult, Irp->IoStatus.Information );
+                                }
+                            }
+                            else
+                                Irp->IoStatus.Status = STATUS_NO_MEMORY;
+
+                            if (pData)
+                                ExFreePoolWithTag( pData, BB_POOL_TAG );
+                            if (pResult)
+                                ExFreePoolWithTag( pResult, BB_POOL_TAG );
+                        }
+                        else
+                            Irp->IoStatus.Status = STATUS_INFO_LENGTH_MISMATCH;
+                    }
+                    break;
+
                 default:
                     DPRINT( "BlackBone: %s: Unknown IRP_MJ_DEVICE_CONTROL 0x%X\n", __FUNCTION__, ioControlCode );
                     Irp->IoStatus.Status = STATUS_INVALID_PARAMETER;
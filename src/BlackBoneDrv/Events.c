@@ -0,0 +1,313 @@
+#include "Events.h"
+#include "Utils.h"
+
+LIST_ENTRY g_Subscribers;
+KSPIN_LOCK g_eventLock;
+volatile LONG g_subscriberCount = 0;
+
+DRIVER_CANCEL BBCancelEventWait;
+VOID BBDrainEvents( IN PEVENT_SUBSCRIBER pSub, IN PIRP Irp );
+ULONG BBRemoveSubscribers( IN HANDLE pid );
+
+//
+// Queue is accessed from notify routines and cancel routine under spinlock,
+// so none of these routines can be paged
+//
+
+/// <summary>
+/// Find subscription of process. g_eventLock must be held
+/// </summary>
+/// <param name="owner">Client process ID</param>
+/// <returns>Found subscription, NULL if not found</returns>
+PEVENT_SUBSCRIBER BBFindSubscriber( IN HANDLE owner )
+{
+    for (PLIST_ENTRY pListEntry = g_Subscribers.Flink; pListEntry != &g_Subscribers; pListEntry = pListEntry->Flink)
+    {
+        PEVENT_SUBSCRIBER pSub = CONTAINING_RECORD( pListEntry, EVENT_SUBSCRIBER, link );
+        if (pSub->owner == owner)
+            return pSub;
+    }
+
+    return NULL;
+}
+
+/// <summary>
+/// Subscribe calling process to events. Existing subscription is updated
+/// </summary>
+/// <param name="pData">Request params</param>
+/// <returns>Status code</returns>
+NTSTATUS BBSubscribeEvents( IN PSUBSCRIBE_EVENTS pData )
+{
+    KIRQL irql = 0;
+    PEVENT_SUBSCRIBER pFound = NULL;
+    PEVENT_SUBSCRIBER pSub = NULL;
+
+    ASSERT( pData != NULL );
+    if (pData == NULL)
+        return STATUS_INVALID_PARAMETER;
+
+    pSub = ExAllocatePoolWithTag( NonPagedPool, sizeof( EVENT_SUBSCRIBER ), BB_POOL_TAG );
+    if (pSub == NULL)
+        return STATUS_NO_MEMORY;
+
+    RtlZeroMemory( pSub, sizeof( EVENT_SUBSCRIBER ) );
+    pSub->owner = PsGetCurrentProcessId();
+    pSub->pid = pData->pid;
+    pSub->mask = pData->mask;
+
+    KeAcquireSpinLock( &g_eventLock, &irql );
+
+    // Queued events and pending request are kept
+    pFound = BBFindSubscriber( pSub->owner );
+    if (pFound != NULL)
+    {
+        pFound->pid = pData->pid;
+        pFound->mask = pData->mask;
+    }
+    else
+    {
+        InsertTailList( &g_Subscribers, &pSub->link );
+        InterlockedIncrement( &g_subscriberCount );
+    }
+
+    KeReleaseSpinLock( &g_eventLock, irql );
+
+    if (pFound != NULL)
+        ExFreePoolWithTag( pSub, BB_POOL_TAG );
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Remove subscription of calling process
+/// </summary>
+/// <returns>Status code</returns>
+NTSTATUS BBUnsubscribeEvents()
+{
+    return BBRemoveSubscribers( PsGetCurrentProcessId() ) != 0 ? STATUS_SUCCESS : STATUS_NOT_FOUND;
+}
+
+/// <summary>
+/// Remove subscriptions owned by process. Pending requests are cancelled
+/// </summary>
+/// <param name="pid">Exited process ID. NULL to remove all subscriptions</param>
+VOID BBCleanupSubscribers( IN HANDLE pid )
+{
+    BBRemoveSubscribers( pid );
+}
+
+/// <summary>
+/// Unlink subscriptions owned by process, cancel their pending requests and free them
+/// </summary>
+/// <param name="pid">Owner process ID. NULL to remove all subscriptions</param>
+/// <returns>Number of removed subscriptions</returns>
+ULONG BBRemoveSubscribers( IN HANDLE pid )
+{
+    KIRQL irql = 0;
+    ULONG removedCount = 0;
+    LIST_ENTRY removed;
+    InitializeListHead( &removed );
+
+    KeAcquireSpinLock( &g_eventLock, &irql );
+
+    for (PLIST_ENTRY pListEntry = g_Subscribers.Flink; pListEntry != &g_Subscribers;)
+    {
+        PEVENT_SUBSCRIBER pSub = CONTAINING_RECORD( pListEntry, EVENT_SUBSCRIBER, link );
+        pListEntry = pListEntry->Flink;
+
+        if (pid == NULL || pSub->owner == pid)
+        {
+            // Request that is being cancelled is completed by cancel routine
+            if (pSub->pIrp != NULL && IoSetCancelRoutine( pSub->pIrp, NULL ) == NULL)
+                pSub->pIrp = NULL;
+
+            RemoveEntryList( &pSub->link );
+            InsertTailList( &removed, &pSub->link );
+            InterlockedDecrement( &g_subscriberCount );
+            removedCount++;
+        }
+    }
+
+    KeReleaseSpinLock( &g_eventLock, irql );
+
+    while (!IsListEmpty( &removed ))
+    {
+        PEVENT_SUBSCRIBER pSub = CONTAINING_RECORD( RemoveHeadList( &removed ), EVENT_SUBSCRIBER, link );
+        if (pSub->pIrp != NULL)
+        {
+            pSub->pIrp->IoStatus.Status = STATUS_CANCELLED;
+            pSub->pIrp->IoStatus.Information = 0;
+            IoCompleteRequest( pSub->pIrp, IO_NO_INCREMENT );
+        }
+
+        ExFreePoolWithTag( pSub, BB_POOL_TAG );
+    }
+
+    return removedCount;
+}
+
+/// <summary>
+/// Complete request with queued events or pend it until next event arrives
+/// </summary>
+/// <param name="Irp">IOCTL_BLACKBONE_WAIT_EVENTS request</param>
+/// <returns>STATUS_PENDING if IRP was pended or completed by this call, otherwise request status</returns>
+NTSTATUS BBWaitEvents( IN PIRP Irp )
+{
+    KIRQL irql = 0;
+    NTSTATUS status = STATUS_PENDING;
+    BOOLEAN cancelled = FALSE;
+    PEVENT_SUBSCRIBER pSub = NULL;
+
+    KeAcquireSpinLock( &g_eventLock, &irql );
+
+    pSub = BBFindSubscriber( PsGetCurrentProcessId() );
+    if (pSub == NULL)
+    {
+        status = STATUS_NOT_FOUND;
+    }
+    else if (pSub->count != 0)
+    {
+        BBDrainEvents( pSub, Irp );
+        status = STATUS_SUCCESS;
+    }
+    else if (pSub->pIrp != NULL)
+    {
+        status = STATUS_DEVICE_BUSY;
+    }
+    else
+    {
+        IoMarkIrpPending( Irp );
+        IoSetCancelRoutine( Irp, BBCancelEventWait );
+
+        // Cancelled before cancel routine was set
+        if (Irp->Cancel && IoSetCancelRoutine( Irp, NULL ) != NULL)
+            cancelled = TRUE;
+        else
+            pSub->pIrp = Irp;
+    }
+
+    KeReleaseSpinLock( &g_eventLock, irql );
+
+    if (cancelled)
+    {
+        Irp->IoStatus.Status = STATUS_CANCELLED;
+        Irp->IoStatus.Information = 0;
+        IoCompleteRequest( Irp, IO_NO_INCREMENT );
+    }
+    else if (status != STATUS_PENDING && status != STATUS_SUCCESS)
+    {
+        Irp->IoStatus.Status = status;
+    }
+
+    return status;
+}
+
+/// <summary>
+/// Deliver event to matching subscribers
+/// </summary>
+/// <param name="pEvent">Event</param>
+/// <param name="relatedPid">Additional process ID matched against subscriber filter, e.g. parent process</param>
+VOID BBQueueEvent( IN PNOTIFY_EVENT pEvent, IN ULONG relatedPid )
+{
+    KIRQL irql = 0;
+    LIST_ENTRY completed;
+
+    if (g_subscriberCount == 0)
+        return;
+
+    InitializeListHead( &completed );
+    KeAcquireSpinLock( &g_eventLock, &irql );
+
+    for (PLIST_ENTRY pListEntry = g_Subscribers.Flink; pListEntry != &g_Subscribers; pListEntry = pListEntry->Flink)
+    {
+        PEVENT_SUBSCRIBER pSub = CONTAINING_RECORD( pListEntry, EVENT_SUBSCRIBER, link );
+
+        if ((pSub->mask & BLACKBONE_EVENT_MASK( pEvent->type )) == 0)
+            continue;
+
+        if (pSub->pid != 0 && pSub->pid != pEvent->pid && (relatedPid == 0 || pSub->pid != relatedPid))
+            continue;
+
+        // Drop oldest event
+        if (pSub->count == BLACKBONE_EVENT_QUEUE_SIZE)
+        {
+            pSub->head = (pSub->head + 1) % BLACKBONE_EVENT_QUEUE_SIZE;
+            pSub->count--;
+            pSub->lost++;
+        }
+
+        pSub->events[(pSub->head + pSub->count) % BLACKBONE_EVENT_QUEUE_SIZE] = *pEvent;
+        pSub->count++;
+
+        // Request that is being cancelled is completed by cancel routine
+        if (pSub->pIrp != NULL && IoSetCancelRoutine( pSub->pIrp, NULL ) != NULL)
+        {
+            BBDrainEvents( pSub, pSub->pIrp );
+            InsertTailList( &completed, &pSub->pIrp->Tail.Overlay.ListEntry );
+            pSub->pIrp = NULL;
+        }
+    }
+
+    KeReleaseSpinLock( &g_eventLock, irql );
+
+    while (!IsListEmpty( &completed ))
+        IoCompleteRequest( CONTAINING_RECORD( RemoveHeadList( &completed ), IRP, Tail.Overlay.ListEntry ), IO_NO_INCREMENT );
+}
+
+/// <summary>
+/// Move queued events into request output. g_eventLock must be held
+/// </summary>
+/// <param name="pSub">Subscription</param>
+/// <param name="Irp">IOCTL_BLACKBONE_WAIT_EVENTS request</param>
+VOID BBDrainEvents( IN PEVENT_SUBSCRIBER pSub, IN PIRP Irp )
+{
+    PIO_STACK_LOCATION irpStack = IoGetCurrentIrpStackLocation( Irp );
+    PWAIT_EVENTS_RESULT pResult = (PWAIT_EVENTS_RESULT)Irp->AssociatedIrp.SystemBuffer;
+    ULONG capacity = (irpStack->Parameters.DeviceIoControl.OutputBufferLength - FIELD_OFFSET( WAIT_EVENTS_RESULT, events )) / sizeof( NOTIFY_EVENT );
+
+    pResult->count = min( capacity, pSub->count );
+    pResult->lost = pSub->lost;
+
+    for (ULONG i = 0; i < pResult->count; i++)
+    {
+        pResult->events[i] = pSub->events[pSub->head];
+        pSub->head = (pSub->head + 1) % BLACKBONE_EVENT_QUEUE_SIZE;
+    }
+
+    pSub->count -= pResult->count;
+    pSub->lost = 0;
+
+    Irp->IoStatus.Status = STATUS_SUCCESS;
+    Irp->IoStatus.Information = FIELD_OFFSET( WAIT_EVENTS_RESULT, events ) + (ULONG_PTR)pResult->count * sizeof( NOTIFY_EVENT );
+}
+
+/// <summary>
+/// Cancel routine of pending IOCTL_BLACKBONE_WAIT_EVENTS request
+/// </summary>
+/// <param name="DeviceObject">Device object</param>
+/// <param name="Irp">Cancelled request</param>
+VOID BBCancelEventWait( IN PDEVICE_OBJECT DeviceObject, IN PIRP Irp )
+{
+    KIRQL irql = 0;
+    UNREFERENCED_PARAMETER( DeviceObject );
+
+    IoReleaseCancelSpinLock( Irp->CancelIrql );
+
+    KeAcquireSpinLock( &g_eventLock, &irql );
+
+    for (PLIST_ENTRY pListEntry = g_Subscribers.Flink; pListEntry != &g_Subscribers; pListEntry = pListEntry->Flink)
+    {
+        PEVENT_SUBSCRIBER pSub = CONTAINING_RECORD( pListEntry, EVENT_SUBSCRIBER, link );
+        if (pSub->pIrp == Irp)
+        {
+            pSub->pIrp = NULL;
+            break;
+        }
+    }
+
+    KeReleaseSpinLock( &g_eventLock, irql );
+
+    Irp->IoStatus.Status = STATUS_CANCELLED;
+    Irp->IoStatus.Information = 0;
+    IoCompleteRequest( Irp, IO_NO_INCREMENT );
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "Private.h"
+#include "BlackBoneDef.h"
+
+/// <summary>
+/// Event subscription of a single client process, see IOCTL_BLACKBONE_SUBSCRIBE_EVENTS
+/// </summary>
+typedef struct _EVENT_SUBSCRIBER
+{
+    LIST_ENTRY link;
+    HANDLE owner;               // Client process ID
+    ULONG pid;                  // Watched process ID, 0 for all processes
+    ULONG mask;                 // Subscribed event types
+    PIRP pIrp;                  // Pending IOCTL_BLACKBONE_WAIT_EVENTS request
+    ULONG head;                 // Index of oldest queued event
+    ULONG count;                // Number of queued events
+    ULONG lost;                 // Number of dropped events
+    NOTIFY_EVENT events[BLACKBONE_EVENT_QUEUE_SIZE];
+} EVENT_SUBSCRIBER, *PEVENT_SUBSCRIBER;
+
+extern LIST_ENTRY g_Subscribers;
+extern KSPIN_LOCK g_eventLock;
+extern volatile LONG g_subscriberCount;
+
+/// <summary>
+/// Subscribe calling process to events. Existing subscription is updated
+/// </summary>
+/// <param name="pData">Request params</param>
+/// <returns>Status code</returns>
+NTSTATUS BBSubscribeEvents( IN PSUBSCRIBE_EVENTS pData );
+
+/// <summary>
+/// Remove subscription of calling process
+/// </summary>
+/// <returns>Status code</returns>
+NTSTATUS BBUnsubscribeEvents();
+
+/// <summary>
+/// Complete request with queued events or pend it until next event arrives
+/// </summary>
+/// <param name="Irp">IOCTL_BLACKBONE_WAIT_EVENTS request</param>
+/// <returns>STATUS_PENDING if IRP was pended or completed by this call, otherwise request status</returns>
+NTSTATUS BBWaitEvents( IN PIRP Irp );
+
+/// <summary>
+/// Deliver event to matching subscribers
+/// </summary>
+/// <param name="pEvent">Event</param>
+/// <param name="relatedPid">Additional process ID matched against subscriber filter, e.g. parent process</param>
+VOID BBQueueEvent( IN PNOTIFY_EVENT pEvent, IN ULONG relatedPid );
+
+/// <summary>
+/// Remove subscriptions owned by process. Pending requests are cancelled
+/// </summary>
+/// <param name="pid">Exited process ID. NULL to remove all subscriptions</param>
+VOID BBCleanupSubscribers( IN HANDLE pid );
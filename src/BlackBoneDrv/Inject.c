@@ -23,14 +23,65 @@ typedef struct _INJECT_BUFFER
 
 extern DYNAMIC_DATA dynData;
 
+// LdrLoadDll call for wow64 process
+static const UCHAR g_InjectCode32[] =
+{
+    0x68, 0, 0, 0, 0,                       // push ModuleHandle            offset +1 
+    0x68, 0, 0, 0, 0,                       // push ModuleFileName          offset +6
+    0x6A, 0,                                // push Flags  
+    0x6A, 0,                                // push PathToFile
+    0xE8, 0, 0, 0, 0,                       // call LdrLoadDll              offset +15
+    0xBA, 0, 0, 0, 0,                       // mov edx, COMPLETE_OFFSET     offset +20
+    0xC7, 0x02, 0x7E, 0x1E, 0x37, 0xC0,     // mov [edx], CALL_COMPLETE     
+    0xBA, 0, 0, 0, 0,                       // mov edx, STATUS_OFFSET       offset +31
+    0x89, 0x02,                             // mov [edx], eax
+    0xC2, 0x04, 0x00                        // ret 4
+};
+
+// LdrLoadDll call for native x64 process
+static const UCHAR g_InjectCode64[] =
+{
+    0x48, 0x83, 0xEC, 0x28,                 // sub rsp, 0x28
+    0x48, 0x31, 0xC9,                       // xor rcx, rcx
+    0x48, 0x31, 0xD2,                       // xor rdx, rdx
+    0x49, 0xB8, 0, 0, 0, 0, 0, 0, 0, 0,     // mov r8, ModuleFileName   offset +12
+    0x49, 0xB9, 0, 0, 0, 0, 0, 0, 0, 0,     // mov r9, ModuleHandle     offset +28
+    0x48, 0xB8, 0, 0, 0, 0, 0, 0, 0, 0,     // mov rax, LdrLoadDll      offset +32
+    0xFF, 0xD0,                             // call rax
+    0x48, 0xBA, 0, 0, 0, 0, 0, 0, 0, 0,     // mov rdx, COMPLETE_OFFSET offset +44
+    0xC7, 0x02, 0x7E, 0x1E, 0x37, 0xC0,     // mov [rdx], CALL_COMPLETE 
+    0x48, 0xBA, 0, 0, 0, 0, 0, 0, 0, 0,     // mov rdx, STATUS_OFFSET   offset +60
+    0x89, 0x02,                             // mov [rdx], eax
+    0x48, 0x83, 0xC4, 0x28,                 // add rsp, 0x28
+    0xC3                                    // ret
+};
+
 PINJECT_BUFFER BBGetWow64Code( IN PVOID LdrLoadDll, IN PUNICODE_STRING pPath );
 PINJECT_BUFFER BBGetNativeCode( IN PVOID LdrLoadDll, IN PUNICODE_STRING pPath );
+PINJECT_BUFFER BBPrepareInjectTemplate( IN BOOLEAN wow64, IN PUNICODE_STRING pPath );
+PINJECT_BUFFER BBCloneInjectBuffer( IN PINJECT_BUFFER pTemplate, IN BOOLEAN wow64, IN PVOID LdrLoadDll );
+VOID BBFillInjectStubs( IN PINJECT_BUFFER pBuffer, IN BOOLEAN wow64, IN PVOID LdrLoadDll );
 
 NTSTATUS BBApcInject( IN PINJECT_BUFFER pUserBuf, IN PEPROCESS pProcess, IN ULONG initRVA, IN PCWCHAR InitArg );
+NTSTATUS BBInjectAttached(
+    IN PEPROCESS pProcess,
+    IN PINJECT_BUFFER pUserBuf,
+    IN InjectType type,
+    IN ULONG initRVA,
+    IN PCWCHAR initArg,
+    IN BOOLEAN wait,
+    IN BOOLEAN unlink,
+    IN BOOLEAN erasePE
+    );
 
 #pragma alloc_text(PAGE, BBInjectDll)
+#pragma alloc_text(PAGE, BBInjectDllBatch)
+#pragma alloc_text(PAGE, BBInjectAttached)
 #pragma alloc_text(PAGE, BBGetWow64Code)
 #pragma alloc_text(PAGE, BBGetNativeCode)
+#pragma alloc_text(PAGE, BBPrepareInjectTemplate)
+#pragma alloc_text(PAGE, BBCloneInjectBuffer)
+#pragma alloc_text(PAGE, BBFillInjectStubs)
 #pragma alloc_text(PAGE, BBExecuteInNewThread)
 #pragma alloc_text(PAGE, BBApcInject)
 #pragma alloc_text(PAGE, BBQueueUserApc)
@@ -45,7 +96,6 @@ NTSTATUS BBApcInject( IN PINJECT_BUFFER pUserBuf, IN PEPROCESS pProcess, IN ULON
 NTSTATUS BBInjectDll( IN PINJECT_DLL pData )
 {
     NTSTATUS status = STATUS_SUCCESS;
-    NTSTATUS threadStatus = STATUS_SUCCESS;
     PEPROCESS pProcess = NULL;
 
     status = PsLookupProcessByProcessId( (HANDLE)pData->pid, &pProcess );
@@ -53,7 +103,6 @@ NTSTATUS BBInjectDll( IN PINJECT_DLL pData )
     {
         KAPC_STATE apc;
         UNICODE_STRING ustrPath, ustrNtdll;
-        SET_PROC_PROTECTION prot = { 0 };
         PVOID pNtdll = NULL;
         PVOID LdrLoadDll = NULL;
         PVOID systemBuffer = NULL;
@@ -140,117 +189,248 @@ NTSTATUS BBInjectDll( IN PINJECT_DLL pData )
             }
         }
 
-        // If process is protected - temporarily disable protection
-        if (PsIsProtectedProcess( pProcess ))
-        {
-            prot.pid         = pData->pid;
-            prot.protection  = Policy_Disable;
-            prot.dynamicCode = Policy_Disable;
-            prot.signature   = Policy_Disable;
-            BBSetProtection( &prot );
-        }
-
         // Call LdrLoadDll
         if (NT_SUCCESS( status ))
         {
-            SIZE_T size = 0;
             PINJECT_BUFFER pUserBuf = isWow64 ? BBGetWow64Code( LdrLoadDll, &ustrPath ) : BBGetNativeCode( LdrLoadDll, &ustrPath );
+            status = BBInjectAttached( 
+                pProcess, pUserBuf, pData->type, pData->initRVA, pData->initArg, 
+                pData->wait, pData->unlink, pData->erasePE 
+                );
+        }
 
-            if (pData->type == IT_Thread)
-            {
-                status = BBExecuteInNewThread( pUserBuf, NULL, THREAD_CREATE_FLAGS_HIDE_FROM_DEBUGGER, pData->wait, &threadStatus );
+        KeUnstackDetachProcess( &apc );
+    }
+    else
+        DPRINT( "BlackBone: %s: PsLookupProcessByProcessId failed with status 0x%X\n", __FUNCTION__, status );
 
-                // Injection failed
-                if (!NT_SUCCESS( threadStatus ))
-                {
-                    status = threadStatus;
-                    DPRINT( "BlackBone: %s: User thread failed with status - 0x%X\n", __FUNCTION__, status );
-                }
-                // Call Init routine
-                else
-                {
-                    if (pUserBuf->module != 0 && pData->initRVA != 0)
-                    {
-                        RtlCopyMemory( pUserBuf->buffer, pData->initArg, sizeof( pUserBuf->buffer ) );
-                        BBExecuteInNewThread(
-                            (PUCHAR)pUserBuf->module + pData->initRVA, 
-                            pUserBuf->buffer,
-                            THREAD_CREATE_FLAGS_HIDE_FROM_DEBUGGER, 
-                            TRUE, 
-                            &threadStatus
-                            );
-                    }
-                    else if (pUserBuf->module == 0)
-                        DPRINT( "BlackBone: %s: Module base = 0. Aborting\n", __FUNCTION__ );
-                }
-            }
-            else if (pData->type == IT_Apc)
-            {
-                status = BBApcInject( pUserBuf, pProcess, pData->initRVA, pData->initArg );
-            }
-            else
+    if (pProcess)
+        ObDereferenceObject( pProcess );
+
+    return status;
+}
+
+/// <summary>
+/// Inject same dll into several processes.
+/// LdrLoadDll is resolved once per ntdll flavor and injection buffer is built once per flavor
+/// </summary>
+/// <param name="pData">Request params, status of every entry is updated</param>
+/// <returns>Status code</returns>
+NTSTATUS BBInjectDllBatch( IN OUT PINJECT_DLL_BATCH pData )
+{
+    UNICODE_STRING ustrPath, ustrNtdll;
+    PINJECT_BUFFER pTemplate[2] = { 0 };    // Native, wow64
+    PVOID pNtdll[2] = { 0 };
+    PVOID LdrLoadDll[2] = { 0 };
+
+    // Manual map needs image buffer per target, use IOCTL_BLACKBONE_INJECT_DLL
+    if (pData->type != IT_Thread && pData->type != IT_Apc)
+        return STATUS_INVALID_PARAMETER;
+
+    pData->FullDllPath[ARRAYSIZE( pData->FullDllPath ) - 1] = L'\0';
+    RtlInitUnicodeString( &ustrPath, pData->FullDllPath );
+    RtlInitUnicodeString( &ustrNtdll, L"Ntdll.dll" );
+
+    for (ULONG i = 0; i < pData->count; i++)
+    {
+        PINJECT_DLL_BATCH_ENTRY pEntry = &pData->entries[i];
+        PEPROCESS pProcess = NULL;
+        KAPC_STATE apc;
+
+        pEntry->status = PsLookupProcessByProcessId( (HANDLE)pEntry->pid, &pProcess );
+        if (!NT_SUCCESS( pEntry->status ))
+        {
+            DPRINT( "BlackBone: %s: PsLookupProcessByProcessId(%u) failed with status 0x%X\n", __FUNCTION__, pEntry->pid, pEntry->status );
+            continue;
+        }
+
+        if (BBCheckProcessTermination( pProcess ))
+        {
+            pEntry->status = STATUS_PROCESS_IS_TERMINATING;
+            ObDereferenceObject( pProcess );
+            continue;
+        }
+
+        BOOLEAN isWow64 = (PsGetProcessWow64Process( pProcess ) != NULL) ? TRUE : FALSE;
+
+        if (pTemplate[isWow64] == NULL)
+            pTemplate[isWow64] = BBPrepareInjectTemplate( isWow64, &ustrPath );
+
+        if (pTemplate[isWow64] == NULL)
+        {
+            pEntry->status = STATUS_NO_MEMORY;
+            ObDereferenceObject( pProcess );
+            continue;
+        }
+
+        KeStackAttachProcess( pProcess, &apc );
+
+        // ntdll base is shared by all processes of the same flavor in most cases, 
+        // export lookup is repeated only if it differs
+        PVOID pBase = BBGetUserModule( pProcess, &ustrNtdll, isWow64 );
+        if (pBase != NULL && pBase != pNtdll[isWow64])
+        {
+            pNtdll[isWow64] = pBase;
+            LdrLoadDll[isWow64] = BBGetModuleExport( pBase, "LdrLoadDll", pProcess, NULL );
+        }
+
+        if (pBase == NULL || LdrLoadDll[isWow64] == NULL)
+        {
+            DPRINT( "BlackBone: %s: Failed to get LdrLoadDll address in process %u\n", __FUNCTION__, pEntry->pid );
+            pEntry->status = STATUS_NOT_FOUND;
+        }
+        else
+        {
+            pEntry->status = BBInjectAttached(
+                pProcess, BBCloneInjectBuffer( pTemplate[isWow64], isWow64, LdrLoadDll[isWow64] ),
+                pData->type, pData->initRVA, pData->initArg,
+                pData->wait, pData->unlink, pData->erasePE
+                );
+        }
+
+        KeUnstackDetachProcess( &apc );
+        ObDereferenceObject( pProcess );
+    }
+
+    for (ULONG i = 0; i < ARRAYSIZE( pTemplate ); i++)
+        if (pTemplate[i])
+            ExFreePoolWithTag( pTemplate[i], BB_POOL_TAG );
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Load dll with prepared injection buffer. Buffer is released afterwards
+/// Must be running in target process context
+/// </summary>
+/// <param name="pProcess">Target process</param>
+/// <param name="pUserBuf">Injection code, can be NULL if it could not be allocated</param>
+/// <param name="type">Injection type, IT_Thread or IT_Apc</param>
+/// <param name="initRVA">Init routine RVA, if 0 - no init routine</param>
+/// <param name="initArg">Init routine argument</param>
+/// <param name="wait">Wait on injection thread</param>
+/// <param name="unlink">Unlink module after injection</param>
+/// <param name="erasePE">Erase PE headers after injection</param>
+/// <returns>Status code</returns>
+NTSTATUS BBInjectAttached(
+    IN PEPROCESS pProcess,
+    IN PINJECT_BUFFER pUserBuf,
+    IN InjectType type,
+    IN ULONG initRVA,
+    IN PCWCHAR initArg,
+    IN BOOLEAN wait,
+    IN BOOLEAN unlink,
+    IN BOOLEAN erasePE
+    )
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    NTSTATUS threadStatus = STATUS_SUCCESS;
+    SET_PROC_PROTECTION prot = { 0 };
+    SIZE_T size = 0;
+
+    if (pUserBuf == NULL)
+    {
+        DPRINT( "BlackBone: %s: Failed to allocate injection buffer\n", __FUNCTION__ );
+        return STATUS_NO_MEMORY;
+    }
+
+    // If process is protected - temporarily disable protection
+    if (PsIsProtectedProcess( pProcess ))
+    {
+        prot.pid         = HandleToUlong( PsGetProcessId( pProcess ) );
+        prot.protection  = Policy_Disable;
+        prot.dynamicCode = Policy_Disable;
+        prot.signature   = Policy_Disable;
+        BBSetProtection( &prot );
+    }
+
+    // Call LdrLoadDll
+    if (type == IT_Thread)
+    {
+        status = BBExecuteInNewThread( pUserBuf, NULL, THREAD_CREATE_FLAGS_HIDE_FROM_DEBUGGER, wait, &threadStatus );
+
+        // Injection failed
+        if (!NT_SUCCESS( threadStatus ))
+        {
+            status = threadStatus;
+            DPRINT( "BlackBone: %s: User thread failed with status - 0x%X\n", __FUNCTION__, status );
+        }
+        // Call Init routine
+        else
+        {
+            if (pUserBuf->module != 0 && initRVA != 0)
             {
-                DPRINT( "BlackBone: %s: Invalid injection type specified - %d\n", __FUNCTION__, pData->type );
-                status = STATUS_INVALID_PARAMETER;
+                RtlCopyMemory( pUserBuf->buffer, initArg, sizeof( pUserBuf->buffer ) );
+                BBExecuteInNewThread(
+                    (PUCHAR)pUserBuf->module + initRVA, 
+                    pUserBuf->buffer,
+                    THREAD_CREATE_FLAGS_HIDE_FROM_DEBUGGER, 
+                    TRUE, 
+                    &threadStatus
+                    );
             }
+            else if (pUserBuf->module == 0)
+                DPRINT( "BlackBone: %s: Module base = 0. Aborting\n", __FUNCTION__ );
+        }
+    }
+    else if (type == IT_Apc)
+    {
+        status = BBApcInject( pUserBuf, pProcess, initRVA, initArg );
+    }
+    else
+    {
+        DPRINT( "BlackBone: %s: Invalid injection type specified - %d\n", __FUNCTION__, type );
+        status = STATUS_INVALID_PARAMETER;
+    }
 
-            // Post-inject stuff
-            if (NT_SUCCESS( status ))
-            {
-                // Unlink module
-                if (pData->unlink)
-                    BBUnlinkFromLoader( pProcess, pUserBuf->module, isWow64 );
+    // Post-inject stuff
+    if (NT_SUCCESS( status ))
+    {
+        // Unlink module
+        if (unlink)
+            BBUnlinkFromLoader( pProcess, pUserBuf->module, PsGetProcessWow64Process( pProcess ) != NULL );
 
-                // Erase header
-                if (pData->erasePE)
+        // Erase header
+        if (erasePE)
+        {
+            __try
+            {
+                PIMAGE_NT_HEADERS64 pHdr = RtlImageNtHeader( pUserBuf->module );
+                if (pHdr)
                 {
-                    __try
-                    {
-                        PIMAGE_NT_HEADERS64 pHdr = RtlImageNtHeader( pUserBuf->module );
-                        if (pHdr)
-                        {
-                            ULONG oldProt = 0;
-                            size = (pHdr->OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR32_MAGIC) ?
-                                ((PIMAGE_NT_HEADERS32)pHdr)->OptionalHeader.SizeOfHeaders :
-                                pHdr->OptionalHeader.SizeOfHeaders;
-
-                            if (NT_SUCCESS( ZwProtectVirtualMemory( ZwCurrentProcess(), &pUserBuf->module, &size, PAGE_EXECUTE_READWRITE, &oldProt ) ))
-                            {
-                                RtlZeroMemory( pUserBuf->module, size );
-                                ZwProtectVirtualMemory( ZwCurrentProcess(), &pUserBuf->module, &size, oldProt, &oldProt );
-
-                                DPRINT( "BlackBone: %s: PE headers erased. \n", __FUNCTION__ );
-                            }
-                        }
-                        else
-                            DPRINT( "BlackBone: %s: Failed to retrieve PE headers for image\n", __FUNCTION__ );
-                    }
-                    __except (EXCEPTION_EXECUTE_HANDLER)
+                    ULONG oldProt = 0;
+                    size = (pHdr->OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR32_MAGIC) ?
+                        ((PIMAGE_NT_HEADERS32)pHdr)->OptionalHeader.SizeOfHeaders :
+                        pHdr->OptionalHeader.SizeOfHeaders;
+
+                    if (NT_SUCCESS( ZwProtectVirtualMemory( ZwCurrentProcess(), &pUserBuf->module, &size, PAGE_EXECUTE_READWRITE, &oldProt ) ))
                     {
-                        DPRINT( "BlackBone: %s: Exception during PE header erease: 0x%X\n", __FUNCTION__, GetExceptionCode() );
+                        RtlZeroMemory( pUserBuf->module, size );
+                        ZwProtectVirtualMemory( ZwCurrentProcess(), &pUserBuf->module, &size, oldProt, &oldProt );
+
+                        DPRINT( "BlackBone: %s: PE headers erased. \n", __FUNCTION__ );
                     }
                 }
+                else
+                    DPRINT( "BlackBone: %s: Failed to retrieve PE headers for image\n", __FUNCTION__ );
+            }
+            __except (EXCEPTION_EXECUTE_HANDLER)
+            {
+                DPRINT( "BlackBone: %s: Exception during PE header erease: 0x%X\n", __FUNCTION__, GetExceptionCode() );
             }
-
-            ZwFreeVirtualMemory( ZwCurrentProcess(), &pUserBuf, &size, MEM_RELEASE );
         }
+    }
 
-        // Restore protection
-        if (prot.pid != 0)
-        {
-            prot.protection  = Policy_Enable;
-            prot.dynamicCode = Policy_Enable;
-            prot.signature   = Policy_Enable;
-            BBSetProtection( &prot );
-        }
+    ZwFreeVirtualMemory( ZwCurrentProcess(), &pUserBuf, &size, MEM_RELEASE );
 
-        KeUnstackDetachProcess( &apc );
+    // Restore protection
+    if (prot.pid != 0)
+    {
+        prot.protection  = Policy_Enable;
+        prot.dynamicCode = Policy_Enable;
+        prot.signature   = Policy_Enable;
+        BBSetProtection( &prot );
     }
-    else
-        DPRINT( "BlackBone: %s: PsLookupProcessByProcessId failed with status 0x%X\n", __FUNCTION__, status );
-
-    if (pProcess)
-        ObDereferenceObject( pProcess );
 
     return status;
 }
@@ -268,21 +448,6 @@ PINJECT_BUFFER BBGetWow64Code( IN PVOID LdrLoadDll, IN PUNICODE_STRING pPath )
     PINJECT_BUFFER pBuffer = NULL;
     SIZE_T size = PAGE_SIZE;
 
-    // Code
-    UCHAR code[] = 
-    { 
-        0x68, 0, 0, 0, 0,                       // push ModuleHandle            offset +1 
-        0x68, 0, 0, 0, 0,                       // push ModuleFileName          offset +6
-        0x6A, 0,                                // push Flags  
-        0x6A, 0,                                // push PathToFile
-        0xE8, 0, 0, 0, 0,                       // call LdrLoadDll              offset +15
-        0xBA, 0, 0, 0, 0,                       // mov edx, COMPLETE_OFFSET     offset +20
-        0xC7, 0x02, 0x7E, 0x1E, 0x37, 0xC0,     // mov [edx], CALL_COMPLETE     
-        0xBA, 0, 0, 0, 0,                       // mov edx, STATUS_OFFSET       offset +31
-        0x89, 0x02,                             // mov [edx], eax
-        0xC2, 0x04, 0x00                        // ret 4
-    };
-
     status = ZwAllocateVirtualMemory( ZwCurrentProcess(), &pBuffer, 0, &size, MEM_COMMIT, PAGE_EXECUTE_READWRITE );
     if (NT_SUCCESS( status ))
     { 
@@ -296,14 +461,8 @@ PINJECT_BUFFER BBGetWow64Code( IN PVOID LdrLoadDll, IN PUNICODE_STRING pPath )
         memcpy( (PVOID)pUserPath->Buffer, pPath->Buffer, pPath->Length );
 
         // Copy code
-        memcpy( pBuffer, code, sizeof( code ) );
-
-        // Fill stubs
-        *(ULONG*)((PUCHAR)pBuffer + 1)  = (ULONG)(ULONG_PTR)&pBuffer->module;
-        *(ULONG*)((PUCHAR)pBuffer + 6)  = (ULONG)(ULONG_PTR)pUserPath;
-        *(ULONG*)((PUCHAR)pBuffer + 15) = (ULONG)((ULONG_PTR)LdrLoadDll - ((ULONG_PTR)pBuffer + 15) - 5 + 1);
-        *(ULONG*)((PUCHAR)pBuffer + 20) = (ULONG)(ULONG_PTR)&pBuffer->complete;
-        *(ULONG*)((PUCHAR)pBuffer + 31) = (ULONG)(ULONG_PTR)&pBuffer->status;
+        memcpy( pBuffer, g_InjectCode32, sizeof( g_InjectCode32 ) );
+        BBFillInjectStubs( pBuffer, TRUE, LdrLoadDll );
 
         return pBuffer;
     }
@@ -325,24 +484,6 @@ PINJECT_BUFFER BBGetNativeCode( IN PVOID LdrLoadDll, IN PUNICODE_STRING pPath )
     PINJECT_BUFFER pBuffer = NULL;
     SIZE_T size = PAGE_SIZE;
 
-    // Code
-    UCHAR code[] =
-    {
-        0x48, 0x83, 0xEC, 0x28,                 // sub rsp, 0x28
-        0x48, 0x31, 0xC9,                       // xor rcx, rcx
-        0x48, 0x31, 0xD2,                       // xor rdx, rdx
-        0x49, 0xB8, 0, 0, 0, 0, 0, 0, 0, 0,     // mov r8, ModuleFileName   offset +12
-        0x49, 0xB9, 0, 0, 0, 0, 0, 0, 0, 0,     // mov r9, ModuleHandle     offset +28
-        0x48, 0xB8, 0, 0, 0, 0, 0, 0, 0, 0,     // mov rax, LdrLoadDll      offset +32
-        0xFF, 0xD0,                             // call rax
-        0x48, 0xBA, 0, 0, 0, 0, 0, 0, 0, 0,     // mov rdx, COMPLETE_OFFSET offset +44
-        0xC7, 0x02, 0x7E, 0x1E, 0x37, 0xC0,     // mov [rdx], CALL_COMPLETE 
-        0x48, 0xBA, 0, 0, 0, 0, 0, 0, 0, 0,     // mov rdx, STATUS_OFFSET   offset +60
-        0x89, 0x02,                             // mov [rdx], eax
-        0x48, 0x83, 0xC4, 0x28,                 // add rsp, 0x28
-        0xC3                                    // ret
-    };
-
     status = ZwAllocateVirtualMemory( ZwCurrentProcess(), &pBuffer, 0, &size, MEM_COMMIT, PAGE_EXECUTE_READWRITE );
     if (NT_SUCCESS( status ))
     {
@@ -355,14 +496,8 @@ PINJECT_BUFFER BBGetNativeCode( IN PVOID LdrLoadDll, IN PUNICODE_STRING pPath )
         RtlUnicodeStringCopy( pUserPath, pPath );
 
         // Copy code
-        memcpy( pBuffer, code, sizeof( code ) );
-
-        // Fill stubs
-        *(ULONGLONG*)((PUCHAR)pBuffer + 12) = (ULONGLONG)pUserPath;
-        *(ULONGLONG*)((PUCHAR)pBuffer + 22) = (ULONGLONG)&pBuffer->module;
-        *(ULONGLONG*)((PUCHAR)pBuffer + 32) = (ULONGLONG)LdrLoadDll;
-        *(ULONGLONG*)((PUCHAR)pBuffer + 44) = (ULONGLONG)&pBuffer->complete;
-        *(ULONGLONG*)((PUCHAR)pBuffer + 60) = (ULONGLONG)&pBuffer->status;
+        memcpy( pBuffer, g_InjectCode64, sizeof( g_InjectCode64 ) );
+        BBFillInjectStubs( pBuffer, FALSE, LdrLoadDll );
 
         return pBuffer;
     }
@@ -371,6 +506,91 @@ PINJECT_BUFFER BBGetNativeCode( IN PVOID LdrLoadDll, IN PUNICODE_STRING pPath )
     return NULL;
 }
 
+/// <summary>
+/// Build process-independent part of injection buffer: code and dll path.
+/// Used by BBCloneInjectBuffer to avoid rebuilding buffer for every target
+/// </summary>
+/// <param name="wow64">Build code for wow64 process</param>
+/// <param name="pPath">Path to the dll</param>
+/// <returns>Template in system memory. When not needed, it should be freed with ExFreePoolWithTag</returns>
+PINJECT_BUFFER BBPrepareInjectTemplate( IN BOOLEAN wow64, IN PUNICODE_STRING pPath )
+{
+    PINJECT_BUFFER pTemplate = ExAllocatePoolWithTag( PagedPool, sizeof( INJECT_BUFFER ), BB_POOL_TAG );
+    if (pTemplate == NULL)
+        return NULL;
+
+    RtlZeroMemory( pTemplate, sizeof( INJECT_BUFFER ) );
+
+    if (wow64)
+    {
+        pTemplate->path32.Length = (USHORT)min( pPath->Length, sizeof( pTemplate->buffer ) - sizeof( WCHAR ) );
+        pTemplate->path32.MaximumLength = sizeof( pTemplate->buffer );
+        memcpy( pTemplate->code, g_InjectCode32, sizeof( g_InjectCode32 ) );
+        memcpy( pTemplate->buffer, pPath->Buffer, pTemplate->path32.Length );
+    }
+    else
+    {
+        pTemplate->path.Length = (USHORT)min( pPath->Length, sizeof( pTemplate->buffer ) - sizeof( WCHAR ) );
+        pTemplate->path.MaximumLength = sizeof( pTemplate->buffer );
+        memcpy( pTemplate->code, g_InjectCode64, sizeof( g_InjectCode64 ) );
+        memcpy( pTemplate->buffer, pPath->Buffer, pTemplate->path.Length );
+    }
+
+    return pTemplate;
+}
+
+/// <summary>
+/// Allocate injection buffer in current process and fill it from template
+/// Must be running in target process context
+/// </summary>
+/// <param name="pTemplate">Template built by BBPrepareInjectTemplate</param>
+/// <param name="wow64">Template is built for wow64 process</param>
+/// <param name="LdrLoadDll">LdrLoadDll address</param>
+/// <returns>Code pointer. When not needed, it should be freed with ZwFreeVirtualMemory</returns>
+PINJECT_BUFFER BBCloneInjectBuffer( IN PINJECT_BUFFER pTemplate, IN BOOLEAN wow64, IN PVOID LdrLoadDll )
+{
+    PINJECT_BUFFER pBuffer = NULL;
+    SIZE_T size = PAGE_SIZE;
+
+    if (!NT_SUCCESS( ZwAllocateVirtualMemory( ZwCurrentProcess(), &pBuffer, 0, &size, MEM_COMMIT, PAGE_EXECUTE_READWRITE ) ))
+        return NULL;
+
+    memcpy( pBuffer, pTemplate, sizeof( INJECT_BUFFER ) );
+    BBFillInjectStubs( pBuffer, wow64, LdrLoadDll );
+
+    return pBuffer;
+}
+
+/// <summary>
+/// Fill address-dependent parts of injection buffer
+/// </summary>
+/// <param name="pBuffer">Injection buffer in target process with code and path already copied</param>
+/// <param name="wow64">Buffer holds code for wow64 process</param>
+/// <param name="LdrLoadDll">LdrLoadDll address</param>
+VOID BBFillInjectStubs( IN PINJECT_BUFFER pBuffer, IN BOOLEAN wow64, IN PVOID LdrLoadDll )
+{
+    if (wow64)
+    {
+        pBuffer->path32.Buffer = (ULONG)(ULONG_PTR)pBuffer->buffer;
+
+        *(ULONG*)((PUCHAR)pBuffer + 1)  = (ULONG)(ULONG_PTR)&pBuffer->module;
+        *(ULONG*)((PUCHAR)pBuffer + 6)  = (ULONG)(ULONG_PTR)&pBuffer->path32;
+        *(ULONG*)((PUCHAR)pBuffer + 15) = (ULONG)((ULONG_PTR)LdrLoadDll - ((ULONG_PTR)pBuffer + 15) - 5 + 1);
+        *(ULONG*)((PUCHAR)pBuffer + 20) = (ULONG)(ULONG_PTR)&pBuffer->complete;
+        *(ULONG*)((PUCHAR)pBuffer + 31) = (ULONG)(ULONG_PTR)&pBuffer->status;
+    }
+    else
+    {
+        pBuffer->path.Buffer = pBuffer->buffer;
+
+        *(ULONGLONG*)((PUCHAR)pBuffer + 12) = (ULONGLONG)&pBuffer->path;
+        *(ULONGLONG*)((PUCHAR)pBuffer + 22) = (ULONGLONG)&pBuffer->module;
+        *(ULONGLONG*)((PUCHAR)pBuffer + 32) = (ULONGLONG)LdrLoadDll;
+        *(ULONGLONG*)((PUCHAR)pBuffer + 44) = (ULONGLONG)&pBuffer->complete;
+        *(ULONGLONG*)((PUCHAR)pBuffer + 60) = (ULONGLONG)&pBuffer->status;
+    }
+}
+
 /// <summary>
 /// Inject dll using APC
 /// Must be running in target process context
@@ -8,6 +8,7 @@ NTSTATUS BBMapWorker             ( IN PVOID pArg );
 VOID     KernelApcPrepareCallback( PKAPC, PKNORMAL_ROUTINE*, PVOID*, PVOID*, PVOID* );
 VOID     KernelApcInjectCallback ( PKAPC, PKNORMAL_ROUTINE*, PVOID*, PVOID*, PVOID* );
 BOOLEAN  BBSkipThread            ( IN PETHREAD pThread, IN BOOLEAN isWow64 );
+USHORT   BBFindExportByName      ( IN PVOID pBase, IN PIMAGE_EXPORT_DIRECTORY pExport, IN PCCHAR name );
 
 
 extern DYNAMIC_DATA dynData;
@@ -17,6 +18,7 @@ extern DYNAMIC_DATA dynData;
 #pragma alloc_text(PAGE, BBGetUserModule)
 #pragma alloc_text(PAGE, BBUnlinkFromLoader)
 #pragma alloc_text(PAGE, BBGetModuleExport)
+#pragma alloc_text(PAGE, BBFindExportByName)
 #pragma alloc_text(PAGE, BBLookupProcessThread)
 #pragma alloc_text(PAGE, BBQueueUserApc)
 #pragma alloc_text(PAGE, KernelApcPrepareCallback)
@@ -337,90 +339,115 @@ PVOID BBGetModuleExport( IN PVOID pBase, IN PCCHAR name_ord, IN PEPROCESS pProce
         expSize = pNtHdr32->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_EXPORT].Size;
     }
 
-    PUSHORT pAddressOfOrds = (PUSHORT)(pExport->AddressOfNameOrdinals + (ULONG_PTR)pBase);
-    PULONG  pAddressOfNames = (PULONG)(pExport->AddressOfNames + (ULONG_PTR)pBase);
     PULONG  pAddressOfFuncs = (PULONG)(pExport->AddressOfFunctions + (ULONG_PTR)pBase);
+    USHORT  OrdIndex = 0xFFFF;
 
-    for (ULONG i = 0; i < pExport->NumberOfFunctions; ++i)
+    // Find by ordinal
+    if ((ULONG_PTR)name_ord <= 0xFFFF)
+    {
+        ULONG ordinal = (USHORT)((ULONG_PTR)name_ord);
+        if (ordinal >= pExport->Base && ordinal - pExport->Base < pExport->NumberOfFunctions)
+            OrdIndex = (USHORT)(ordinal - pExport->Base);
+    }
+    // Find by name
+    else
     {
-        USHORT OrdIndex = 0xFFFF;
-        PCHAR  pName = NULL;
+        OrdIndex = BBFindExportByName( pBase, pExport, name_ord );
+    }
 
-        // Find by index
-        if ((ULONG_PTR)name_ord <= 0xFFFF)
-        {
-            OrdIndex = (USHORT)i;
-        }
-        // Find by name
-        else if ((ULONG_PTR)name_ord > 0xFFFF && i < pExport->NumberOfNames)
-        {
-            pName = (PCHAR)(pAddressOfNames[i] + (ULONG_PTR)pBase);
-            OrdIndex = pAddressOfOrds[i];
-        }
-        // Weird params
-        else
+    if (OrdIndex == 0xFFFF || OrdIndex >= pExport->NumberOfFunctions)
+        return NULL;
+
+    pAddress = pAddressOfFuncs[OrdIndex] + (ULONG_PTR)pBase;
+
+    // Check forwarded export
+    if (pAddress >= (ULONG_PTR)pExport && pAddress <= (ULONG_PTR)pExport + expSize)
+    {
+        WCHAR strbuf[256] = { 0 };
+        ANSI_STRING forwarder = { 0 };
+        ANSI_STRING import = { 0 };
+
+        UNICODE_STRING uForwarder = { 0 };
+        ULONG delimIdx = 0;
+        PVOID forwardBase = NULL;
+        PVOID result = NULL;
+
+        // System image, not supported
+        if (pProcess == NULL)
             return NULL;
 
-        if (((ULONG_PTR)name_ord <= 0xFFFF && (USHORT)((ULONG_PTR)name_ord) == OrdIndex + pExport->Base) ||
-            ((ULONG_PTR)name_ord > 0xFFFF && strcmp( pName, name_ord ) == 0))
-        {
-            pAddress = pAddressOfFuncs[OrdIndex] + (ULONG_PTR)pBase;
+        RtlInitAnsiString( &forwarder, (PCSZ)pAddress );
+        RtlInitEmptyUnicodeString( &uForwarder, strbuf, sizeof( strbuf ) );
 
-            // Check forwarded export
-            if (pAddress >= (ULONG_PTR)pExport && pAddress <= (ULONG_PTR)pExport + expSize)
+        RtlAnsiStringToUnicodeString( &uForwarder, &forwarder, FALSE );
+        for (ULONG j = 0; j < uForwarder.Length / sizeof( WCHAR ); j++)
+        {
+            if (uForwarder.Buffer[j] == L'.')
             {
-                WCHAR strbuf[256] = { 0 };
-                ANSI_STRING forwarder = { 0 };
-                ANSI_STRING import = { 0 };
+                uForwarder.Length = (USHORT)(j * sizeof( WCHAR ));
+                uForwarder.Buffer[j] = L'\0';
+                delimIdx = j;
+                break;
+            }
+        }
 
-                UNICODE_STRING uForwarder = { 0 };
-                ULONG delimIdx = 0;
-                PVOID forwardBase = NULL;
-                PVOID result = NULL;
+        // Get forward function name/ordinal
+        RtlInitAnsiString( &import, forwarder.Buffer + delimIdx + 1 );
+        RtlAppendUnicodeToString( &uForwarder, L".dll" );
 
-                // System image, not supported
-                if (pProcess == NULL)
-                    return NULL;
+        //
+        // Check forwarded module
+        //
+        UNICODE_STRING resolved = { 0 };
+        UNICODE_STRING resolvedName = { 0 };
+        BBResolveImagePath( NULL, pProcess, KApiShemaOnly, &uForwarder, baseName, &resolved );
+        BBStripPath( &resolved, &resolvedName );
 
-                RtlInitAnsiString( &forwarder, (PCSZ)pAddress );
-                RtlInitEmptyUnicodeString( &uForwarder, strbuf, sizeof( strbuf ) );
+        forwardBase = BBGetUserModule( pProcess, &resolvedName, PsGetProcessWow64Process( pProcess ) != NULL );
+        result = BBGetModuleExport( forwardBase, import.Buffer, pProcess, &resolvedName );
+        RtlFreeUnicodeString( &resolved );
 
-                RtlAnsiStringToUnicodeString( &uForwarder, &forwarder, FALSE );
-                for (ULONG j = 0; j < uForwarder.Length / sizeof( WCHAR ); j++)
-                {
-                    if (uForwarder.Buffer[j] == L'.')
-                    {
-                        uForwarder.Length = (USHORT)(j * sizeof( WCHAR ));
-                        uForwarder.Buffer[j] = L'\0';
-                        delimIdx = j;
-                        break;
-                    }
-                }
+        return result;
+    }
 
-                // Get forward function name/ordinal
-                RtlInitAnsiString( &import, forwarder.Buffer + delimIdx + 1 );
-                RtlAppendUnicodeToString( &uForwarder, L".dll" );
+    return (PVOID)pAddress;
+}
 
-                //
-                // Check forwarded module
-                //
-                UNICODE_STRING resolved = { 0 };
-                UNICODE_STRING resolvedName = { 0 };
-                BBResolveImagePath( NULL, pProcess, KApiShemaOnly, &uForwarder, baseName, &resolved );
-                BBStripPath( &resolved, &resolvedName );
+/// <summary>
+/// Find export ordinal index by name.
+/// Names are sorted lexically, so binary search is used. Linear scan is a fallback for malformed images
+/// </summary>
+/// <param name="pBase">Module base</param>
+/// <param name="pExport">Module export directory</param>
+/// <param name="name">Function name</param>
+/// <returns>Ordinal index, 0xFFFF if not found</returns>
+USHORT BBFindExportByName( IN PVOID pBase, IN PIMAGE_EXPORT_DIRECTORY pExport, IN PCCHAR name )
+{
+    PUSHORT pAddressOfOrds = (PUSHORT)(pExport->AddressOfNameOrdinals + (ULONG_PTR)pBase);
+    PULONG  pAddressOfNames = (PULONG)(pExport->AddressOfNames + (ULONG_PTR)pBase);
+    LONG low = 0, high = (LONG)pExport->NumberOfNames - 1;
 
-                forwardBase = BBGetUserModule( pProcess, &resolvedName, PsGetProcessWow64Process( pProcess ) != NULL );
-                result = BBGetModuleExport( forwardBase, import.Buffer, pProcess, &resolvedName );
-                RtlFreeUnicodeString( &resolved );
+    while (low <= high)
+    {
+        LONG mid = low + (high - low) / 2;
+        int cmp = strcmp( name, (PCHAR)(pAddressOfNames[mid] + (ULONG_PTR)pBase) );
 
-                return result;
-            }
+        if (cmp == 0)
+            return pAddressOfOrds[mid];
+        else if (cmp < 0)
+            high = mid - 1;
+        else
+            low = mid + 1;
+    }
 
-            break;
-        }
+    // Names may be unsorted
+    for (ULONG i = 0; i < pExport->NumberOfNames; ++i)
+    {
+        if (strcmp( name, (PCHAR)(pAddressOfNames[i] + (ULONG_PTR)pBase) ) == 0)
+            return pAddressOfOrds[i];
     }
 
-    return (PVOID)pAddress;
+    return 0xFFFF;
 }
 
 /// <summary>
@@ -72,6 +72,42 @@ typedef struct _USER_CONTEXT
     //UCHAR tlsBuf[0x100];
 } USER_CONTEXT, *PUSER_CONTEXT;
 
+/// <summary>
+/// Cached import name resolution
+/// </summary>
+typedef struct _RESOLVE_CACHE_ENTRY
+{
+    LIST_ENTRY link;            // List link
+    UNICODE_STRING name;        // Import name as written in import table
+    UNICODE_STRING resolved;    // Resolved image path
+} RESOLVE_CACHE_ENTRY, *PRESOLVE_CACHE_ENTRY;
+
+/// <summary>
+/// Dependency image read from disk by system worker thread
+/// </summary>
+typedef struct _PREFETCH_ENTRY
+{
+    LIST_ENTRY link;            // List link
+    WORK_QUEUE_ITEM workItem;   // Worker item
+    KEVENT done;                // Signaled when image is read
+    UNICODE_STRING path;        // Resolved image path
+    PVOID localBase;            // Image file contents in system memory
+    NTSTATUS status;            // Read status
+} PREFETCH_ENTRY, *PPREFETCH_ENTRY;
+
+/// <summary>
+/// Export name hash index of user module
+/// </summary>
+typedef struct _EXPORT_INDEX
+{
+    LIST_ENTRY link;            // List link
+    PVOID base;                 // Module base
+    ULONG ordinalBase;          // Export directory ordinal base
+    ULONG bucketMask;           // Number of buckets - 1
+    PULONG buckets;             // First name index in bucket, MAXULONG if empty
+    PULONG next;                // Next name index in chain, MAXULONG if last
+} EXPORT_INDEX, *PEXPORT_INDEX;
+
 /// <summary>
 /// Manual map context
 /// </summary>
@@ -82,6 +118,9 @@ typedef struct _MMAP_CONTEXT
     HANDLE hWorker;         // Worker thread handle
     PETHREAD pWorker;       // Worker thread object
     LIST_ENTRY modules;     // Manual module list
+    LIST_ENTRY resolveCache;// Resolved import names, RESOLVE_CACHE_ENTRY
+    LIST_ENTRY prefetched;  // Dependencies being read from disk, PREFETCH_ENTRY
+    LIST_ENTRY exportIndex; // Export indices of import modules, EXPORT_INDEX
     PUSER_CONTEXT userMem;  // Tmp buffer in user space
     HANDLE hSync;           // APC sync handle
     PKEVENT pSync;          // APC sync object
@@ -89,6 +128,8 @@ typedef struct _MMAP_CONTEXT
     PVOID pLoadImage;       // LdrLoadDll address
     BOOLEAN tlsInitialized; // Static TLS was initialized
     BOOLEAN noThreads;      // No threads should be created
+    ULONG batchOfst;        // End of batched calls in userMem->code, 0 if no batch is open
+    ULONG batchCalls;       // Number of batched calls not yet executed
 } MMAP_CONTEXT, *PMMAP_CONTEXT;
 
 /// <summary>
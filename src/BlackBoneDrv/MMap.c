@@ -14,6 +14,23 @@
 #define TLS_VAL_T(hdr, ptr, val) (IMAGE64(hdr) ? ((PIMAGE_TLS_DIRECTORY64)ptr)->val : ((PIMAGE_TLS_DIRECTORY32)ptr)->val)
 #define CFG_DIR_VAL_T(hdr, dir, val) (IMAGE64(hdr) ? ((PIMAGE_LOAD_CONFIG_DIRECTORY64)dir)->val : ((PIMAGE_LOAD_CONFIG_DIRECTORY32)dir)->val)
 
+// Code space kept free in batch buffer: one call with up to 4 arguments plus sync and epilogue
+#define BB_CALL_BATCH_RESERVE 0x80
+
+/// <summary>
+/// FNV-1a hash of export name
+/// </summary>
+/// <param name="name">Export name</param>
+/// <returns>Hash value</returns>
+static __inline ULONG BBHashExportName( IN PCCHAR name )
+{
+    ULONG hash = 2166136261u;
+    for (; *name; name++)
+        hash = (hash ^ (UCHAR)*name) * 16777619u;
+
+    return hash;
+}
+
 #if defined (_WIN10_)
 typedef PAPI_SET_VALUE_ENTRY_10     PAPISET_VALUE_ENTRY;
 typedef PAPI_SET_VALUE_ARRAY_10     PAPISET_VALUE_ARRAY;
@@ -84,7 +101,7 @@ NTSTATUS BBResolveSxS( IN PMMAP_CONTEXT pContext, IN PUNICODE_STRING name, OUT P
 NTSTATUS BBCallInitializers( IN PMMAP_CONTEXT pContext, IN BOOLEAN noTLS );
 
 /// <summary>
-/// Call TLS callbacks
+/// Add TLS callbacks to pending call batch
 /// </summary>
 /// <param name="pContext">Loader context</param>
 /// <param name="imageBase">Target image base</param>
@@ -148,6 +165,37 @@ NTSTATUS BBFindWokerThread( IN PMMAP_CONTEXT pContext );
 /// <returns>Status code</returns>
 NTSTATUS BBCallRoutine( IN BOOLEAN newThread, IN PMMAP_CONTEXT pContext, IN PVOID pRoutine, IN INT argc, ... );
 
+/// <summary>
+/// Start collecting calls that will be executed by worker thread in single APC
+/// </summary>
+/// <param name="pContext">Loader context</param>
+VOID BBBeginCallBatch( IN PMMAP_CONTEXT pContext );
+
+/// <summary>
+/// Append call to pending batch. Batch is executed first if there is no room left
+/// </summary>
+/// <param name="pContext">Loader context</param>
+/// <param name="pRoutine">Routine to call</param>
+/// <param name="argc">Number of arguments, no more than 4</param>
+/// <param name="...">Arguments</param>
+/// <returns>Status code</returns>
+NTSTATUS BBAddBatchCall( IN PMMAP_CONTEXT pContext, IN PVOID pRoutine, IN INT argc, ... );
+
+/// <summary>
+/// Execute pending batch in worker thread and wait for completion
+/// </summary>
+/// <param name="pContext">Loader context</param>
+/// <returns>Status code</returns>
+NTSTATUS BBFlushCallBatch( IN PMMAP_CONTEXT pContext );
+
+/// <summary>
+/// Run code prepared in userMem->code in worker thread and wait for its sync event
+/// </summary>
+/// <param name="pContext">Loader context</param>
+/// <param name="calls">Number of calls in code, used to scale wait timeout</param>
+/// <returns>Status code</returns>
+NTSTATUS BBRunWorkerCode( IN PMMAP_CONTEXT pContext, IN ULONG calls );
+
 /// <summary>
 /// Find existing module in the list
 /// </summary>
@@ -157,6 +205,63 @@ NTSTATUS BBCallRoutine( IN BOOLEAN newThread, IN PMMAP_CONTEXT pContext, IN PVOI
 /// <returns>Module info address; NULL if not found</returns>
 PMODULE_DATA BBLookupMappedModule( IN PLIST_ENTRY pList, IN PUNICODE_STRING pName, IN ModType type );
 
+/// <summary>
+/// Resolve import name, resolution is cached in map context
+/// </summary>
+/// <param name="pContext">Map context</param>
+/// <param name="pProcess">Target process</param>
+/// <param name="name">Import name</param>
+/// <param name="resolved">Resolved image path</param>
+/// <returns>Status code</returns>
+NTSTATUS BBResolveImagePathCached( IN PMMAP_CONTEXT pContext, IN PEPROCESS pProcess, IN PUNICODE_STRING name, OUT PUNICODE_STRING resolved );
+
+/// <summary>
+/// Start reading missing dependencies of image in system worker threads
+/// </summary>
+/// <param name="pImageBase">Image base</param>
+/// <param name="pProcess">Target process</param>
+/// <param name="wow64Image">Image is 32bit image</param>
+/// <param name="pContext">Map context</param>
+VOID BBPrefetchImageRefs( IN PVOID pImageBase, IN PEPROCESS pProcess, IN BOOLEAN wow64Image, IN PMMAP_CONTEXT pContext );
+
+/// <summary>
+/// Get image read by BBPrefetchImageRefs. Waits until read is complete
+/// </summary>
+/// <param name="pContext">Map context</param>
+/// <param name="path">Image path</param>
+/// <param name="pBase">Image file contents. Caller must free it</param>
+/// <returns>Read status, STATUS_NOT_FOUND if image wasn't prefetched</returns>
+NTSTATUS BBTakePrefetchedImage( IN PMMAP_CONTEXT pContext, IN PUNICODE_STRING path, OUT PVOID* pBase );
+
+/// <summary>
+/// Worker routine of BBPrefetchImageRefs
+/// </summary>
+/// <param name="context">PREFETCH_ENTRY</param>
+VOID BBPrefetchWorker( IN PVOID context );
+
+/// <summary>
+/// Get exported function address. Names are looked up in per-context hash index of module exports
+/// </summary>
+/// <param name="pContext">Map context</param>
+/// <param name="pBase">Module base</param>
+/// <param name="name_ord">Function name or ordinal</param>
+/// <param name="baseName">Module name, used to resolve forwarded exports</param>
+/// <returns>Found address, NULL if not found</returns>
+PVOID BBGetModuleExportIndexed( IN PMMAP_CONTEXT pContext, IN PVOID pBase, IN PCCHAR name_ord, IN PUNICODE_STRING baseName );
+
+/// <summary>
+/// Build hash index of module export names
+/// </summary>
+/// <param name="pBase">Module base</param>
+/// <returns>Index, NULL if module has no named exports or allocation failed</returns>
+PEXPORT_INDEX BBBuildExportIndex( IN PVOID pBase );
+
+/// <summary>
+/// Free resolve cache, export indices and prefetched images that were not used
+/// </summary>
+/// <param name="pContext">Map context</param>
+VOID BBCleanupResolveData( IN PMMAP_CONTEXT pContext );
+
 /// <summary>
 /// Get memory protection form section characteristics
 /// </summary>
@@ -189,6 +294,13 @@ PVOID BBRvaToVa( IN ULONG rva, IN BOOLEAN MappedAsImage, IN IN PVOID imageBase )
 #pragma alloc_text(PAGE, BBResolveApiSet)
 #pragma alloc_text(PAGE, BBResolveSxS)
 #pragma alloc_text(PAGE, BBResolveImagePath)
+#pragma alloc_text(PAGE, BBResolveImagePathCached)
+#pragma alloc_text(PAGE, BBPrefetchImageRefs)
+#pragma alloc_text(PAGE, BBTakePrefetchedImage)
+#pragma alloc_text(PAGE, BBPrefetchWorker)
+#pragma alloc_text(PAGE, BBGetModuleExportIndexed)
+#pragma alloc_text(PAGE, BBBuildExportIndex)
+#pragma alloc_text(PAGE, BBCleanupResolveData)
 #pragma alloc_text(PAGE, BBCallInitializers)
 #pragma alloc_text(PAGE, BBPrepareACTX)
 #pragma alloc_text(PAGE, BBCreateExceptionTable64)
@@ -196,6 +308,10 @@ PVOID BBRvaToVa( IN ULONG rva, IN BOOLEAN MappedAsImage, IN IN PVOID imageBase )
 #pragma alloc_text(PAGE, BBLoadLocalImage)
 #pragma alloc_text(PAGE, BBCreateWorkerThread)
 #pragma alloc_text(PAGE, BBCallRoutine)
+#pragma alloc_text(PAGE, BBBeginCallBatch)
+#pragma alloc_text(PAGE, BBAddBatchCall)
+#pragma alloc_text(PAGE, BBFlushCallBatch)
+#pragma alloc_text(PAGE, BBRunWorkerCode)
 #pragma alloc_text(PAGE, BBLookupMappedModule)
 #pragma alloc_text(PAGE, BBCastSectionProtection)
 #pragma alloc_text(PAGE, BBImageManifest)
@@ -237,6 +353,9 @@ NTSTATUS BBMapUserImage(
 
     context.pProcess = pProcess;
     InitializeListHead( &context.modules );
+    InitializeListHead( &context.resolveCache );
+    InitializeListHead( &context.prefetched );
+    InitializeListHead( &context.exportIndex );
 
     DPRINT( "BlackBone: %s: Mapping image '%wZ' with flags 0x%X\n", __FUNCTION__, path, flags );
 
@@ -274,6 +393,9 @@ NTSTATUS BBMapUserImage(
     if (NT_SUCCESS( status ))
         status = BBFindOrMapModule( pProcess, path, buffer, size, asImage, flags, &context, pImage );
 
+    // All dependencies are mapped, initializers are run sequentially below
+    BBCleanupResolveData( &context );
+
     // Enable exceptions for WOW64 process
     if (NT_SUCCESS( status ) && !(flags & KNoExceptions))
     {
@@ -427,7 +549,10 @@ NTSTATUS BBFindOrMapModule(
     // Load image info 
     if (buffer == NULL)
     {
-        status = BBLoadLocalImage( path, &pLocalImage->localBase );
+        status = BBTakePrefetchedImage( pContext, path, &pLocalImage->localBase );
+        if (status == STATUS_NOT_FOUND)
+            status = BBLoadLocalImage( path, &pLocalImage->localBase );
+
         asImage = FALSE;
     }
     else
@@ -702,6 +827,10 @@ NTSTATUS BBResolveImageRefs(
     if (pImportTbl == NULL)
         return STATUS_SUCCESS;
 
+    // Read missing dependencies from disk in parallel, they are mapped one by one below
+    if (!systemImage && (flags & KManualImports))
+        BBPrefetchImageRefs( pImageBase, pProcess, wow64Image, pContext );
+
     for (; pImportTbl->Name && NT_SUCCESS( status ); ++pImportTbl)
     {
         PVOID pThunk = ((PUCHAR)pImageBase + (pImportTbl->OriginalFirstThunk ? pImportTbl->OriginalFirstThunk : pImportTbl->FirstThunk));
@@ -723,7 +852,7 @@ NTSTATUS BBResolveImageRefs(
         // Resolve image name
         if(!systemImage)
         {
-            status = BBResolveImagePath( pContext, pProcess, 0, &ustrImpDll, NULL, &resolved );
+            status = BBResolveImagePathCached( pContext, pProcess, &ustrImpDll, &resolved );
             BBStripPath( &resolved, &resolvedName );
 
             // Something went terribly wrong
@@ -811,12 +940,9 @@ NTSTATUS BBResolveImageRefs(
                 impFunc = (PCCHAR)(THUNK_VAL_T( pHeader, pThunk, u1.AddressOfData ) & 0xFFFF);
             }
 
-            pFunc = BBGetModuleExport(
-                systemImage ? pModule.ldrEntry->DllBase : pModule.address,
-                impFunc,
-                systemImage ?  NULL : pContext->pProcess,
-                &resolved 
-                );
+            pFunc = systemImage ?
+                BBGetModuleExport( pModule.ldrEntry->DllBase, impFunc, NULL, &resolved ) :
+                BBGetModuleExportIndexed( pContext, pModule.address, impFunc, &resolved );
 
             // No export found
             if (!pFunc)
@@ -1214,6 +1340,301 @@ skip:
     return status;
 }
 
+/// <summary>
+/// Resolve import name, resolution is cached in map context
+/// </summary>
+/// <param name="pContext">Map context</param>
+/// <param name="pProcess">Target process</param>
+/// <param name="name">Import name</param>
+/// <param name="resolved">Resolved image path</param>
+/// <returns>Status code</returns>
+NTSTATUS BBResolveImagePathCached( IN PMMAP_CONTEXT pContext, IN PEPROCESS pProcess, IN PUNICODE_STRING name, OUT PUNICODE_STRING resolved )
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    PRESOLVE_CACHE_ENTRY pEntry = NULL;
+
+    // Same import is usually referenced by many images, every SxS lookup is a call into target process
+    for (PLIST_ENTRY pListEntry = pContext->resolveCache.Flink; pListEntry != &pContext->resolveCache; pListEntry = pListEntry->Flink)
+    {
+        pEntry = CONTAINING_RECORD( pListEntry, RESOLVE_CACHE_ENTRY, link );
+        if (RtlCompareUnicodeString( &pEntry->name, name, TRUE ) == 0)
+            return BBSafeInitString( resolved, &pEntry->resolved );
+    }
+
+    status = BBResolveImagePath( pContext, pProcess, 0, name, NULL, resolved );
+    if (!NT_SUCCESS( status ))
+        return status;
+
+    pEntry = ExAllocatePoolWithTag( PagedPool, sizeof( RESOLVE_CACHE_ENTRY ), BB_POOL_TAG );
+    if (pEntry != NULL)
+    {
+        RtlZeroMemory( pEntry, sizeof( RESOLVE_CACHE_ENTRY ) );
+
+        if (NT_SUCCESS( BBSafeInitString( &pEntry->name, name ) ) && NT_SUCCESS( BBSafeInitString( &pEntry->resolved, resolved ) ))
+        {
+            InsertTailList( &pContext->resolveCache, &pEntry->link );
+        }
+        else
+        {
+            RtlFreeUnicodeString( &pEntry->name );
+            RtlFreeUnicodeString( &pEntry->resolved );
+            ExFreePoolWithTag( pEntry, BB_POOL_TAG );
+        }
+    }
+
+    return status;
+}
+
+/// <summary>
+/// Start reading missing dependencies of image in system worker threads
+/// </summary>
+/// <param name="pImageBase">Image base</param>
+/// <param name="pProcess">Target process</param>
+/// <param name="wow64Image">Image is 32bit image</param>
+/// <param name="pContext">Map context</param>
+VOID BBPrefetchImageRefs( IN PVOID pImageBase, IN PEPROCESS pProcess, IN BOOLEAN wow64Image, IN PMMAP_CONTEXT pContext )
+{
+    ULONG impSize = 0;
+    PIMAGE_IMPORT_DESCRIPTOR pImportTbl = RtlImageDirectoryEntryToData( pImageBase, TRUE, IMAGE_DIRECTORY_ENTRY_IMPORT, &impSize );
+    ModType type = wow64Image ? mt_mod32 : mt_mod64;
+
+    if (pImportTbl == NULL)
+        return;
+
+    for (; pImportTbl->Name; ++pImportTbl)
+    {
+        UNICODE_STRING ustrImpDll = { 0 };
+        UNICODE_STRING resolved = { 0 };
+        UNICODE_STRING resolvedName = { 0 };
+        ANSI_STRING strImpDll = { 0 };
+        BOOLEAN queued = FALSE;
+
+        RtlInitAnsiString( &strImpDll, (PCHAR)pImageBase + pImportTbl->Name );
+        if (!NT_SUCCESS( RtlAnsiStringToUnicodeString( &ustrImpDll, &strImpDll, TRUE ) ))
+            continue;
+
+        if (!NT_SUCCESS( BBResolveImagePathCached( pContext, pProcess, &ustrImpDll, &resolved ) ))
+        {
+            RtlFreeUnicodeString( &ustrImpDll );
+            RtlFreeUnicodeString( &resolved );
+            continue;
+        }
+
+        BBStripPath( &resolved, &resolvedName );
+
+        // Already being read
+        for (PLIST_ENTRY pListEntry = pContext->prefetched.Flink; pListEntry != &pContext->prefetched; pListEntry = pListEntry->Flink)
+        {
+            if (RtlCompareUnicodeString( &CONTAINING_RECORD( pListEntry, PREFETCH_ENTRY, link )->path, &resolved, TRUE ) == 0)
+            {
+                queued = TRUE;
+                break;
+            }
+        }
+
+        // Only images that will be manually mapped
+        if (!queued &&
+             BBLookupMappedModule( &pContext->modules, &resolvedName, type ) == NULL &&
+             BBGetUserModule( pProcess, &resolvedName, wow64Image ) == NULL)
+        {
+            // Event and work item must be resident
+            PPREFETCH_ENTRY pEntry = ExAllocatePoolWithTag( NonPagedPool, sizeof( PREFETCH_ENTRY ), BB_POOL_TAG );
+            if (pEntry != NULL)
+            {
+                RtlZeroMemory( pEntry, sizeof( PREFETCH_ENTRY ) );
+                pEntry->path = resolved;
+                pEntry->status = STATUS_PENDING;
+                RtlZeroMemory( &resolved, sizeof( resolved ) );
+
+                KeInitializeEvent( &pEntry->done, NotificationEvent, FALSE );
+                ExInitializeWorkItem( &pEntry->workItem, BBPrefetchWorker, pEntry );
+                InsertTailList( &pContext->prefetched, &pEntry->link );
+
+                ExQueueWorkItem( &pEntry->workItem, DelayedWorkQueue );
+            }
+        }
+
+        RtlFreeUnicodeString( &ustrImpDll );
+        RtlFreeUnicodeString( &resolved );
+    }
+}
+
+/// <summary>
+/// Worker routine of BBPrefetchImageRefs
+/// </summary>
+/// <param name="context">PREFETCH_ENTRY</param>
+VOID BBPrefetchWorker( IN PVOID context )
+{
+    PPREFETCH_ENTRY pEntry = (PPREFETCH_ENTRY)context;
+
+    pEntry->status = BBLoadLocalImage( &pEntry->path, &pEntry->localBase );
+    KeSetEvent( &pEntry->done, IO_NO_INCREMENT, FALSE );
+}
+
+/// <summary>
+/// Get image read by BBPrefetchImageRefs. Waits until read is complete
+/// </summary>
+/// <param name="pContext">Map context</param>
+/// <param name="path">Image path</param>
+/// <param name="pBase">Image file contents. Caller must free it</param>
+/// <returns>Read status, STATUS_NOT_FOUND if image wasn't prefetched</returns>
+NTSTATUS BBTakePrefetchedImage( IN PMMAP_CONTEXT pContext, IN PUNICODE_STRING path, OUT PVOID* pBase )
+{
+    NTSTATUS status = STATUS_NOT_FOUND;
+
+    for (PLIST_ENTRY pListEntry = pContext->prefetched.Flink; pListEntry != &pContext->prefetched; pListEntry = pListEntry->Flink)
+    {
+        PPREFETCH_ENTRY pEntry = CONTAINING_RECORD( pListEntry, PREFETCH_ENTRY, link );
+        if (RtlCompareUnicodeString( &pEntry->path, path, TRUE ) == 0)
+        {
+            KeWaitForSingleObject( &pEntry->done, Executive, KernelMode, FALSE, NULL );
+
+            // Failed read releases buffer
+            status = pEntry->status;
+            *pBase = NT_SUCCESS( status ) ? pEntry->localBase : NULL;
+
+            RemoveEntryList( &pEntry->link );
+            RtlFreeUnicodeString( &pEntry->path );
+            ExFreePoolWithTag( pEntry, BB_POOL_TAG );
+            break;
+        }
+    }
+
+    return status;
+}
+
+/// <summary>
+/// Get exported function address. Names are looked up in per-context hash index of module exports
+/// </summary>
+/// <param name="pContext">Map context</param>
+/// <param name="pBase">Module base</param>
+/// <param name="name_ord">Function name or ordinal</param>
+/// <param name="baseName">Module name, used to resolve forwarded exports</param>
+/// <returns>Found address, NULL if not found</returns>
+PVOID BBGetModuleExportIndexed( IN PMMAP_CONTEXT pContext, IN PVOID pBase, IN PCCHAR name_ord, IN PUNICODE_STRING baseName )
+{
+    PEXPORT_INDEX pIndex = NULL;
+    PIMAGE_EXPORT_DIRECTORY pExport = NULL;
+    PULONG pAddressOfNames = NULL;
+    PUSHORT pAddressOfOrds = NULL;
+    ULONG expSize = 0;
+
+    // Ordinal lookup is direct anyway
+    if (pBase == NULL || (ULONG_PTR)name_ord <= 0xFFFF)
+        return BBGetModuleExport( pBase, name_ord, pContext->pProcess, baseName );
+
+    for (PLIST_ENTRY pListEntry = pContext->exportIndex.Flink; pListEntry != &pContext->exportIndex; pListEntry = pListEntry->Flink)
+    {
+        PEXPORT_INDEX pEntry = CONTAINING_RECORD( pListEntry, EXPORT_INDEX, link );
+        if (pEntry->base == pBase)
+        {
+            pIndex = pEntry;
+            break;
+        }
+    }
+
+    if (pIndex == NULL)
+    {
+        pIndex = BBBuildExportIndex( pBase );
+        if (pIndex == NULL)
+            return BBGetModuleExport( pBase, name_ord, pContext->pProcess, baseName );
+
+        InsertTailList( &pContext->exportIndex, &pIndex->link );
+    }
+
+    pExport = RtlImageDirectoryEntryToData( pBase, TRUE, IMAGE_DIRECTORY_ENTRY_EXPORT, &expSize );
+    pAddressOfNames = (PULONG)(pExport->AddressOfNames + (ULONG_PTR)pBase);
+    pAddressOfOrds = (PUSHORT)(pExport->AddressOfNameOrdinals + (ULONG_PTR)pBase);
+
+    for (ULONG i = pIndex->buckets[BBHashExportName( name_ord ) & pIndex->bucketMask]; i != MAXULONG; i = pIndex->next[i])
+    {
+        // Found ordinal is resolved by regular lookup, it handles forwarded exports
+        if (strcmp( name_ord, (PCHAR)(pAddressOfNames[i] + (ULONG_PTR)pBase) ) == 0)
+            return BBGetModuleExport( pBase, (PCCHAR)(ULONG_PTR)(pAddressOfOrds[i] + pIndex->ordinalBase), pContext->pProcess, baseName );
+    }
+
+    return NULL;
+}
+
+/// <summary>
+/// Build hash index of module export names
+/// </summary>
+/// <param name="pBase">Module base</param>
+/// <returns>Index, NULL if module has no named exports or allocation failed</returns>
+PEXPORT_INDEX BBBuildExportIndex( IN PVOID pBase )
+{
+    PEXPORT_INDEX pIndex = NULL;
+    ULONG expSize = 0;
+    ULONG bucketCount = 16;
+    PIMAGE_EXPORT_DIRECTORY pExport = RtlImageDirectoryEntryToData( pBase, TRUE, IMAGE_DIRECTORY_ENTRY_EXPORT, &expSize );
+
+    if (pExport == NULL || pExport->NumberOfNames == 0)
+        return NULL;
+
+    // Keep load factor at or below 1
+    while (bucketCount < pExport->NumberOfNames)
+        bucketCount <<= 1;
+
+    pIndex = ExAllocatePoolWithTag(
+        PagedPool, sizeof( EXPORT_INDEX ) + (bucketCount + pExport->NumberOfNames) * sizeof( ULONG ), BB_POOL_TAG
+        );
+
+    if (pIndex == NULL)
+        return NULL;
+
+    pIndex->base = pBase;
+    pIndex->ordinalBase = pExport->Base;
+    pIndex->bucketMask = bucketCount - 1;
+    pIndex->buckets = (PULONG)(pIndex + 1);
+    pIndex->next = pIndex->buckets + bucketCount;
+
+    RtlFillMemory( pIndex->buckets, bucketCount * sizeof( ULONG ), 0xFF );
+
+    PULONG pAddressOfNames = (PULONG)(pExport->AddressOfNames + (ULONG_PTR)pBase);
+    for (ULONG i = 0; i < pExport->NumberOfNames; i++)
+    {
+        ULONG bucket = BBHashExportName( (PCCHAR)(pAddressOfNames[i] + (ULONG_PTR)pBase) ) & pIndex->bucketMask;
+
+        pIndex->next[i] = pIndex->buckets[bucket];
+        pIndex->buckets[bucket] = i;
+    }
+
+    return pIndex;
+}
+
+/// <summary>
+/// Free resolve cache, export indices and prefetched images that were not used
+/// </summary>
+/// <param name="pContext">Map context</param>
+VOID BBCleanupResolveData( IN PMMAP_CONTEXT pContext )
+{
+    while (!IsListEmpty( &pContext->exportIndex ))
+        ExFreePoolWithTag( CONTAINING_RECORD( RemoveHeadList( &pContext->exportIndex ), EXPORT_INDEX, link ), BB_POOL_TAG );
+
+    while (!IsListEmpty( &pContext->prefetched ))
+    {
+        PPREFETCH_ENTRY pEntry = CONTAINING_RECORD( RemoveHeadList( &pContext->prefetched ), PREFETCH_ENTRY, link );
+
+        // Worker still references entry
+        KeWaitForSingleObject( &pEntry->done, Executive, KernelMode, FALSE, NULL );
+
+        if (NT_SUCCESS( pEntry->status ) && pEntry->localBase)
+            ExFreePoolWithTag( pEntry->localBase, BB_POOL_TAG );
+
+        RtlFreeUnicodeString( &pEntry->path );
+        ExFreePoolWithTag( pEntry, BB_POOL_TAG );
+    }
+
+    while (!IsListEmpty( &pContext->resolveCache ))
+    {
+        PRESOLVE_CACHE_ENTRY pEntry = CONTAINING_RECORD( RemoveHeadList( &pContext->resolveCache ), RESOLVE_CACHE_ENTRY, link );
+
+        RtlFreeUnicodeString( &pEntry->name );
+        RtlFreeUnicodeString( &pEntry->resolved );
+        ExFreePoolWithTag( pEntry, BB_POOL_TAG );
+    }
+}
+
 /// <summary>
 /// Call module initialization routines
 /// </summary>
@@ -1222,6 +1643,12 @@ skip:
 /// <returns>Status code</returns>
 NTSTATUS BBCallInitializers( IN PMMAP_CONTEXT pContext, IN BOOLEAN noTLS )
 {
+    NTSTATUS status = STATUS_SUCCESS;
+
+    // TLS callbacks and entry points of all new modules are run by worker in one APC.
+    // Module list order is preserved, so call order is the same as with separate calls
+    BBBeginCallBatch( pContext );
+
     for (PLIST_ENTRY pListEntry = pContext->modules.Flink; pListEntry != &pContext->modules; pListEntry = pListEntry->Flink)
     {
         PMODULE_DATA pEntry = (PMODULE_DATA)CONTAINING_RECORD( pListEntry, MODULE_DATA, link );
@@ -1235,11 +1662,10 @@ NTSTATUS BBCallInitializers( IN PMMAP_CONTEXT pContext, IN BOOLEAN noTLS )
         if (noTLS == FALSE)
             BBCallTlsInitializers( pContext, pEntry->baseAddress );
 
-        NTSTATUS status = STATUS_SUCCESS;
         if (HEADER_VAL_T( pHeaders, AddressOfEntryPoint ))
         {
             PUCHAR entrypoint = pEntry->baseAddress + HEADER_VAL_T( pHeaders, AddressOfEntryPoint );
-            status = BBCallRoutine( FALSE, pContext, entrypoint, 3, pEntry->baseAddress, (PVOID)1, NULL );
+            status = BBAddBatchCall( pContext, entrypoint, 3, pEntry->baseAddress, (PVOID)1, NULL );
         }
 
         // Check if process is terminating
@@ -1248,6 +1674,22 @@ NTSTATUS BBCallInitializers( IN PMMAP_CONTEXT pContext, IN BOOLEAN noTLS )
             DPRINT( "BlackBone: %s: Process is terminating, map aborted\n", __FUNCTION__ );
             return STATUS_PROCESS_IS_TERMINATING;
         }
+    }
+
+    status = BBFlushCallBatch( pContext );
+    if (status != STATUS_SUCCESS && BBCheckProcessTermination( PsGetCurrentProcess() ))
+    {
+        DPRINT( "BlackBone: %s: Process is terminating, map aborted\n", __FUNCTION__ );
+        return STATUS_PROCESS_IS_TERMINATING;
+    }
+
+    for (PLIST_ENTRY pListEntry = pContext->modules.Flink; pListEntry != &pContext->modules; pListEntry = pListEntry->Flink)
+    {
+        PMODULE_DATA pEntry = (PMODULE_DATA)CONTAINING_RECORD( pListEntry, MODULE_DATA, link );
+        if (pEntry->initialized)
+            continue;
+
+        PIMAGE_NT_HEADERS pHeaders = RtlImageNtHeader( pEntry->baseAddress );
 
         //
         // Wipe discardable sections
@@ -1309,7 +1751,7 @@ NTSTATUS BBCallInitializers( IN PMMAP_CONTEXT pContext, IN BOOLEAN noTLS )
 }
 
 /// <summary>
-/// Call TLS callbacks
+/// Add TLS callbacks to pending call batch
 /// </summary>
 /// <param name="pContext">Loader context</param>
 /// <param name="imageBase">Target image base</param>
@@ -1360,7 +1802,7 @@ void BBCallTlsInitializers( IN PMMAP_CONTEXT pContext, IN PVOID imageBase )
           pCallback += IMAGE64( pHeaders ) ? sizeof( ULONGLONG ) : sizeof( ULONG ))
     {
         ULONG_PTR callback = IMAGE64( pHeaders ) ? *(PULONGLONG)pCallback : *(PULONG)pCallback;
-        BBCallRoutine( FALSE, pContext, (PVOID)callback, 3, imageBase, (PVOID)1, NULL );
+        BBAddBatchCall( pContext, (PVOID)callback, 3, imageBase, (PVOID)1, NULL );
     }
 }
 
@@ -1742,25 +2184,110 @@ NTSTATUS BBCallRoutine( IN BOOLEAN newThread, IN PMMAP_CONTEXT pContext, IN PVOI
     }
     else
     {
-        KeResetEvent( pContext->pSync );
-        status = BBQueueUserApc( pContext->pWorker, pContext->userMem->code, NULL, NULL, NULL, pContext->noThreads );
-        if (NT_SUCCESS( status ))
-        {
-            LARGE_INTEGER timeout = { 0 };
-            timeout.QuadPart = -(10ll * 10 * 1000 * 1000);  // 10s
+        status = BBRunWorkerCode( pContext, 1 );
+    }
 
-            status = KeWaitForSingleObject( pContext->pSync, Executive, UserMode, TRUE, &timeout );
+    va_end( vl );
 
-            timeout.QuadPart = -(1ll * 10 * 1000);          // 1ms
-            KeDelayExecutionThread( KernelMode, TRUE, &timeout );
-        }
+    return status;
+}
+
+/// <summary>
+/// Start collecting calls that will be executed by worker thread in single APC
+/// </summary>
+/// <param name="pContext">Loader context</param>
+VOID BBBeginCallBatch( IN PMMAP_CONTEXT pContext )
+{
+    BOOLEAN wow64 = PsGetProcessWow64Process( pContext->pProcess ) != NULL;
+
+    pContext->batchOfst = GenPrologueT( wow64, pContext->userMem->code );
+    pContext->batchCalls = 0;
+}
+
+/// <summary>
+/// Append call to pending batch. Batch is executed first if there is no room left
+/// </summary>
+/// <param name="pContext">Loader context</param>
+/// <param name="pRoutine">Routine to call</param>
+/// <param name="argc">Number of arguments, no more than 4</param>
+/// <param name="...">Arguments</param>
+/// <returns>Status code</returns>
+NTSTATUS BBAddBatchCall( IN PMMAP_CONTEXT pContext, IN PVOID pRoutine, IN INT argc, ... )
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    va_list vl;
+    BOOLEAN wow64 = PsGetProcessWow64Process( pContext->pProcess ) != NULL;
+
+    ASSERT( argc <= 4 && pContext->batchOfst != 0 );
+    if (argc > 4 || pContext->batchOfst == 0)
+        return STATUS_INVALID_PARAMETER;
+
+    if (pContext->batchOfst + BB_CALL_BATCH_RESERVE > sizeof( pContext->userMem->code ))
+    {
+        status = BBFlushCallBatch( pContext );
+        BBBeginCallBatch( pContext );
     }
 
+    va_start( vl, argc );
+    pContext->batchOfst += GenCallTV( wow64, pContext->userMem->code + pContext->batchOfst, pRoutine, argc, vl );
+    pContext->batchCalls++;
     va_end( vl );
 
     return status;
 }
 
+/// <summary>
+/// Execute pending batch in worker thread and wait for completion
+/// </summary>
+/// <param name="pContext">Loader context</param>
+/// <returns>Status code</returns>
+NTSTATUS BBFlushCallBatch( IN PMMAP_CONTEXT pContext )
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    BOOLEAN wow64 = PsGetProcessWow64Process( pContext->pProcess ) != NULL;
+    ULONG ofst = pContext->batchOfst;
+
+    if (ofst != 0 && pContext->batchCalls != 0)
+    {
+        // Routines take 3 arguments, same epilogue as single BBCallRoutine
+        ofst += GenSyncT( wow64, pContext->userMem->code + ofst, &pContext->userMem->status, pContext->pSetEvent, pContext->hSync );
+        ofst += GenEpilogueT( wow64, pContext->userMem->code + ofst, 3 * sizeof( ULONG ) );
+
+        status = BBRunWorkerCode( pContext, pContext->batchCalls );
+    }
+
+    pContext->batchOfst = 0;
+    pContext->batchCalls = 0;
+
+    return status;
+}
+
+/// <summary>
+/// Run code prepared in userMem->code in worker thread and wait for its sync event
+/// </summary>
+/// <param name="pContext">Loader context</param>
+/// <param name="calls">Number of calls in code, used to scale wait timeout</param>
+/// <returns>Status code</returns>
+NTSTATUS BBRunWorkerCode( IN PMMAP_CONTEXT pContext, IN ULONG calls )
+{
+    NTSTATUS status = STATUS_SUCCESS;
+
+    KeResetEvent( pContext->pSync );
+    status = BBQueueUserApc( pContext->pWorker, pContext->userMem->code, NULL, NULL, NULL, pContext->noThreads );
+    if (NT_SUCCESS( status ))
+    {
+        LARGE_INTEGER timeout = { 0 };
+        timeout.QuadPart = -(10ll * 10 * 1000 * 1000) * calls;  // 10s per call
+
+        status = KeWaitForSingleObject( pContext->pSync, Executive, UserMode, TRUE, &timeout );
+
+        timeout.QuadPart = -(1ll * 10 * 1000);                  // 1ms
+        KeDelayExecutionThread( KernelMode, TRUE, &timeout );
+    }
+
+    return status;
+}
+
 /// <summary>
 /// Find existing module in the list
 /// </summary>
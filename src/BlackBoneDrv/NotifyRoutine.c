@@ -1,6 +1,8 @@
 #include "Remap.h"
 #include "BlackBoneDrv.h"
 #include "Routines.h"
+#include "Ring.h"
+#include "Events.h"
 
 #pragma alloc_text(PAGE, BBProcessNotify)
 
@@ -13,12 +15,31 @@
 /// <param name="Create">TRUE if process was created</param>
 VOID BBProcessNotify( IN HANDLE ParentId, IN HANDLE ProcessId, IN BOOLEAN Create )
 {
-    UNREFERENCED_PARAMETER( ParentId );
     PPROCESS_MAP_ENTRY pProcessEntry = NULL;
     PMEM_PHYS_PROCESS_ENTRY pPhysProcessEntry = NULL;
 
+    if (g_subscriberCount != 0)
+    {
+        NOTIFY_EVENT event = { 0 };
+        event.type = Create ? NE_ProcessCreate : NE_ProcessExit;
+        event.pid = HandleToUlong( ProcessId );
+        event.parentPid = HandleToUlong( ParentId );
+
+        // Child creation is reported to parent watchers
+        BBQueueEvent( &event, Create ? event.parentPid : 0 );
+    }
+
     if (Create == FALSE)
     {
+        // Drop subscription of exited client
+        BBCleanupSubscribers( ProcessId );
+
+        // Stop command ring of exited client
+        BBCleanupRings( ProcessId );
+
+        // Drop cached references of exited target or client
+        BBCleanupTargets( ProcessId );
+
         pPhysProcessEntry = BBLookupPhysProcessEntry( ProcessId );
         if (pPhysProcessEntry != NULL)
         {
@@ -26,25 +47,70 @@ VOID BBProcessNotify( IN HANDLE ParentId, IN HANDLE ProcessId, IN BOOLEAN Create
             BBCleanupProcessPhysEntry( pPhysProcessEntry, TRUE );
         }
 
-        KeAcquireGuardedMutex( &g_globalLock );
-
-        pProcessEntry = BBLookupProcessEntry( ProcessId, FALSE );
+        pProcessEntry = BBAcquireProcessEntry( ProcessId, FALSE );
 
         // Target process shutdown
         if (pProcessEntry != NULL)
         {
             DPRINT( "BlackBone: %s: Target process %u shutdown. Cleanup\n", __FUNCTION__, pProcessEntry->target.pid );
             BBCleanupProcessEntry( pProcessEntry );
+            BBReleaseProcessEntry( pProcessEntry );
         }
         else
         {
-            pProcessEntry = BBLookupProcessEntry( ProcessId, TRUE );
+            pProcessEntry = BBAcquireProcessEntry( ProcessId, TRUE );
 
             // Host process shutdown
             if (pProcessEntry != NULL)
+            {
                 BBCleanupHostProcess( pProcessEntry );
+                BBReleaseProcessEntry( pProcessEntry );
+            }
         }
-
-        KeReleaseGuardedMutex( &g_globalLock );
     }
-}
\ No newline at end of file
+}
+
+/// <summary>
+/// Thread creation and termination handler
+/// </summary>
+/// <param name="ProcessId">PID</param>
+/// <param name="ThreadId">TID</param>
+/// <param name="Create">TRUE if thread was created</param>
+VOID BBThreadNotify( IN HANDLE ProcessId, IN HANDLE ThreadId, IN BOOLEAN Create )
+{
+    NOTIFY_EVENT event = { 0 };
+
+    if (g_subscriberCount == 0)
+        return;
+
+    event.type = Create ? NE_ThreadCreate : NE_ThreadExit;
+    event.pid = HandleToUlong( ProcessId );
+    event.tid = HandleToUlong( ThreadId );
+
+    BBQueueEvent( &event, 0 );
+}
+
+/// <summary>
+/// Image load handler
+/// </summary>
+/// <param name="FullImageName">Image path, can be NULL</param>
+/// <param name="ProcessId">PID, 0 for driver images</param>
+/// <param name="ImageInfo">Image info</param>
+VOID BBImageNotify( IN PUNICODE_STRING FullImageName, IN HANDLE ProcessId, IN PIMAGE_INFO ImageInfo )
+{
+    NOTIFY_EVENT event = { 0 };
+
+    if (g_subscriberCount == 0)
+        return;
+
+    event.type = NE_ImageLoad;
+    event.pid = HandleToUlong( ProcessId );
+    event.imageBase = (ULONGLONG)ImageInfo->ImageBase;
+    event.imageSize = ImageInfo->ImageSize;
+
+    // Path is truncated, zeroed event keeps it terminated
+    if (FullImageName != NULL && FullImageName->Buffer != NULL)
+        RtlCopyMemory( event.imagePath, FullImageName->Buffer, min( FullImageName->Length, sizeof( event.imagePath ) - sizeof( WCHAR ) ) );
+
+    BBQueueEvent( &event, 0 );
+}
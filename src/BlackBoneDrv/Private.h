@@ -38,6 +38,10 @@
 #define MM_PTE_PROTOTYPE_MASK     0x400
 #define MM_PTE_TRANSITION_MASK    0x800
 
+#ifndef LARGE_PAGE_SIZE
+#define LARGE_PAGE_SIZE 0x200000
+#endif
+
 #define VIRTUAL_ADDRESS_BITS 48
 #define VIRTUAL_ADDRESS_MASK ((((ULONG_PTR)1) << VIRTUAL_ADDRESS_BITS) - 1)
 
@@ -3,7 +3,7 @@
 #include <Ntstrsafe.h>
 
 RTL_AVL_TABLE g_ProcessPageTables;      // Mapping table
-KGUARDED_MUTEX g_globalLock;            // ProcessPageTables mutex
+KGUARDED_MUTEX g_globalLock;            // ProcessPageTables structure mutex, entries have own locks
 
 /// <summary>
 /// Walk region list and create MDL for each region
@@ -38,14 +38,6 @@ NTSTATUS BBMapRegionListIntoCurrentProcess( IN PLIST_ENTRY pList, IN BOOLEAN noW
 NTSTATUS BBMapRegionIntoCurrentProcess( IN PMAP_ENTRY pEntry, IN PMAP_ENTRY pPrevEntry );
 
 
-/// <summary>
-/// Allocate kernel page from NonPaged pool and build MDL for it
-/// </summary>
-/// <param name="pPage">Resulting address</param>
-/// <param name="pResultMDL">Resulting MDL</param>
-/// <returns>Status code</returns>
-NTSTATUS BBAllocateSharedPage( OUT PVOID* pPage, OUT PMDL* pResultMDL );
-
 /// <summary>
 /// Map kernel page into current process address space
 /// </summary>
@@ -92,6 +84,22 @@ NTSTATUS BBUnmapRegionEntry( IN PMAP_ENTRY pPageEntry, IN PPROCESS_MAP_ENTRY pFo
 /// <returns>Status code</returns>
 PMAP_ENTRY BBFindPageEntry( IN PLIST_ENTRY pList, IN ULONG_PTR baseAddress, IN ULONG_PTR size );
 
+/// <summary>
+/// Insert region into list ordered by address
+/// </summary>
+/// <param name="pList">Region list</param>
+/// <param name="pEntry">Region to insert</param>
+VOID BBInsertPageEntry( IN PLIST_ENTRY pList, IN PMAP_ENTRY pEntry );
+
+/// <summary>
+/// Cut range out of not yet mapped region of lazy mapping. Parts outside range stay in list
+/// </summary>
+/// <param name="pEntry">Region to split</param>
+/// <param name="base">Range base</param>
+/// <param name="size">Range size</param>
+/// <returns>Status code</returns>
+NTSTATUS BBSplitPlaceholderEntry( IN PMAP_ENTRY pEntry, IN ULONG_PTR base, IN ULONG_PTR size );
+
 //
 // Cleanup routines
 //
@@ -129,11 +137,17 @@ NTSTATUS BBSafeHandleClose( IN PEPROCESS pProcess, IN HANDLE handle, IN KPROCESS
 #pragma alloc_text(PAGE, BBMapMemoryRegion)
 #pragma alloc_text(PAGE, BBUnmapMemory)
 #pragma alloc_text(PAGE, BBUnmapMemoryRegion)
+#pragma alloc_text(PAGE, BBRefreshMemoryMap)
 
 #pragma alloc_text(PAGE, BBGetRequiredRemapOutputSize)
 
 #pragma alloc_text(PAGE, BBLookupProcessEntry)
+#pragma alloc_text(PAGE, BBAcquireProcessEntry)
+#pragma alloc_text(PAGE, BBAcquireOrCreateProcessEntry)
+#pragma alloc_text(PAGE, BBReleaseProcessEntry)
 #pragma alloc_text(PAGE, BBFindPageEntry)
+#pragma alloc_text(PAGE, BBInsertPageEntry)
+#pragma alloc_text(PAGE, BBSplitPlaceholderEntry)
 
 #pragma alloc_text(PAGE, BBCleanupProcessTable)
 #pragma alloc_text(PAGE, BBCleanupProcessEntry)
@@ -184,7 +198,9 @@ RTL_GENERIC_COMPARE_RESULTS AvlCompare( IN RTL_AVL_TABLE *Table, IN PVOID FirstS
 PVOID AvlAllocate( IN RTL_AVL_TABLE *Table, IN CLONG ByteSize )
 {
     UNREFERENCED_PARAMETER( Table );
-    return ExAllocatePoolWithTag( PagedPool, ByteSize, BB_POOL_TAG );
+
+    // PROCESS_MAP_ENTRY embeds a guarded mutex, which must be resident
+    return ExAllocatePoolWithTag( NonPagedPool, ByteSize, BB_POOL_TAG );
 }
 
 /*
@@ -196,7 +212,8 @@ VOID AvlFree( IN RTL_AVL_TABLE *Table, IN PVOID Buffer )
 }
 
 /// <summary>
-/// Enumerate committed, accessible, non-guarded memory regions
+/// Enumerate committed, accessible, non-guarded memory regions.
+/// Regions are clipped to range end and split into BB_MAX_MDL_SPAN spans
 /// </summary>
 /// <param name="pList">Region list</param>
 /// <param name="start">Region start</param>
@@ -225,25 +242,33 @@ NTSTATUS BBBuildProcessRegionListForRange( IN PLIST_ENTRY pList, IN ULONG_PTR st
         // Skip non-committed, no-access and guard pages
         else if (mbi.State == MEM_COMMIT &&  mbi.Protect != PAGE_NOACCESS && !(mbi.Protect & PAGE_GUARD))
         {
+            ULONG_PTR regionEnd = min( (ULONG_PTR)mbi.BaseAddress + mbi.RegionSize, end );
+
             // Ignore shared memory if required
             if (mbi.Type != MEM_PRIVATE && !mapSections)
                 continue;
 
-            pEntry = ExAllocatePoolWithTag( PagedPool, sizeof( MAP_ENTRY ), BB_POOL_TAG );
-            if (pEntry == NULL)
+            // Single MDL can't describe arbitrary large region
+            for (ULONG_PTR spanStart = (ULONG_PTR)mbi.BaseAddress; spanStart < regionEnd; spanStart += BB_MAX_MDL_SPAN)
             {
-                DPRINT( "BlackBone: %s: Failed to allocate memory for Remap descriptor\n", __FUNCTION__ );
-                BBCleanupPageList( FALSE, pList );
-                return STATUS_NO_MEMORY;
-            }
+                pEntry = ExAllocatePoolWithTag( PagedPool, sizeof( MAP_ENTRY ), BB_POOL_TAG );
+                if (pEntry == NULL)
+                {
+                    DPRINT( "BlackBone: %s: Failed to allocate memory for Remap descriptor\n", __FUNCTION__ );
+                    BBCleanupPageList( FALSE, pList );
+                    return STATUS_NO_MEMORY;
+                }
 
-            pEntry->mem = mbi;
-            pEntry->newPtr = 0;
-            pEntry->pMdl = NULL;
-            pEntry->locked = FALSE;
-            pEntry->shared = mbi.Type != MEM_PRIVATE;
+                pEntry->mem = mbi;
+                pEntry->mem.BaseAddress = (PVOID)spanStart;
+                pEntry->mem.RegionSize = min( regionEnd - spanStart, BB_MAX_MDL_SPAN );
+                pEntry->newPtr = 0;
+                pEntry->pMdl = NULL;
+                pEntry->locked = FALSE;
+                pEntry->shared = mbi.Type != MEM_PRIVATE;
 
-            InsertTailList( pList, &pEntry->link );
+                InsertTailList( pList, &pEntry->link );
+            }
         }
     }
 
@@ -601,6 +626,10 @@ NTSTATUS BBMapRegionListIntoCurrentProcess( IN PLIST_ENTRY pList, IN BOOLEAN noW
             continue;
         }
 
+        // Region of lazy mapping, mapped on first access
+        if (pEntry->pMdl == NULL)
+            continue;
+
         // Non-locked pages can't be mapped
         if (pEntry->pMdl && pEntry->locked)
             status |= BBMapRegionIntoCurrentProcess( pEntry, pPrevEntry );
@@ -713,14 +742,10 @@ NTSTATUS BBMapMemory( IN PMAP_MEMORY pRemap, OUT PPROCESS_MAP_ENTRY* ppEntry )
 
     processEntry.target.pid = (HANDLE)pRemap->pid;
 
-    KeAcquireGuardedMutex( &g_globalLock );
-
     status = PsLookupProcessByProcessId( processEntry.target.pid, &pProcess );
     if (!NT_SUCCESS( status ))
     {
         DPRINT( "BlackBone: %s: Failed to find process with PID %u\n", __FUNCTION__, processEntry.target.pid );
-
-        KeReleaseGuardedMutex( &g_globalLock );
         return status;
     }
 
@@ -730,14 +755,20 @@ NTSTATUS BBMapMemory( IN PMAP_MEMORY pRemap, OUT PPROCESS_MAP_ENTRY* ppEntry )
         DPRINT( "BlackBone: %s: Process %u is terminating. Abort\n", __FUNCTION__, processEntry.target.pid );
 
         ObDereferenceObject( pProcess );
-        KeReleaseGuardedMutex( &g_globalLock );
         return STATUS_PROCESS_IS_TERMINATING;
     }
 
-    pFoundEntry = (PPROCESS_MAP_ENTRY)RtlInsertElementGenericTableAvl( &g_ProcessPageTables, &processEntry, sizeof( processEntry ), &newEntry );
+    // Only this target is serialized from here
+    status = BBAcquireOrCreateProcessEntry( &processEntry, &pFoundEntry, &newEntry );
+    if (!NT_SUCCESS( status ))
+    {
+        ObDereferenceObject( pProcess );
+        return status;
+    }
+
     if (newEntry != FALSE)
     {
-        InitializeListHead( &pFoundEntry->pageList );
+        pFoundEntry->lazy = pRemap->lazy;
 
         // Allocate shared Page
         status = BBAllocateSharedPage( &pFoundEntry->pSharedPage, &pFoundEntry->pMDLShared );
@@ -753,7 +784,8 @@ NTSTATUS BBMapMemory( IN PMAP_MEMORY pRemap, OUT PPROCESS_MAP_ENTRY* ppEntry )
                 (ULONG_PTR)MM_HIGHEST_USER_ADDRESS, pRemap->mapSections 
                 );
 
-            if (NT_SUCCESS( status ))
+            // Lazy mapping only reserves regions, pages are locked when host touches them
+            if (NT_SUCCESS( status ) && !pFoundEntry->lazy)
                 status = BBPrepareMDLList( pProcess, &pFoundEntry->pageList );
 
             // Map shared page into target process
@@ -808,9 +840,6 @@ NTSTATUS BBMapMemory( IN PMAP_MEMORY pRemap, OUT PPROCESS_MAP_ENTRY* ppEntry )
         pFoundEntry->host.pid = PsGetCurrentProcessId();
     }
 
-    if (ppEntry)
-        *ppEntry = pFoundEntry;
-
     if (pProcess)
         ObDereferenceObject( pProcess );
 
@@ -818,7 +847,11 @@ NTSTATUS BBMapMemory( IN PMAP_MEMORY pRemap, OUT PPROCESS_MAP_ENTRY* ppEntry )
     if (!NT_SUCCESS( status ) && status != STATUS_ADDRESS_ALREADY_EXISTS)
         BBCleanupProcessEntry(pFoundEntry);
 
-    KeReleaseGuardedMutex( &g_globalLock );
+    // Caller reads mapping results from locked entry
+    if (NT_SUCCESS( status ) && ppEntry)
+        *ppEntry = pFoundEntry;
+    else
+        BBReleaseProcessEntry( pFoundEntry );
 
     return status;
 }
@@ -848,8 +881,6 @@ NTSTATUS BBMapMemoryRegion( IN PMAP_MEMORY_REGION pRegion, OUT PMAP_MEMORY_REGIO
         return STATUS_INVALID_ADDRESS;
     }
 
-    KeAcquireGuardedMutex( &g_globalLock );
-
     // Align on page boundaries
     pRegion->base = (ULONGLONG)PAGE_ALIGN( pRegion->base );
     pRegion->size = pageCount << PAGE_SHIFT;
@@ -861,7 +892,6 @@ NTSTATUS BBMapMemoryRegion( IN PMAP_MEMORY_REGION pRegion, OUT PMAP_MEMORY_REGIO
     if (!NT_SUCCESS( status ))
     {
         DPRINT( "BlackBone: %s: Failed to find process 0x%u\n", __FUNCTION__, processEntry.target.pid );
-        KeReleaseGuardedMutex( &g_globalLock );
         return status;
     }
 
@@ -871,16 +901,20 @@ NTSTATUS BBMapMemoryRegion( IN PMAP_MEMORY_REGION pRegion, OUT PMAP_MEMORY_REGIO
         DPRINT( "BlackBone: %s: Process %u is terminating. Abort\n", __FUNCTION__, processEntry.target.pid );
 
         ObDereferenceObject( pProcess );
-        KeReleaseGuardedMutex( &g_globalLock );
         return STATUS_PROCESS_IS_TERMINATING;
     }
 
     // Store or retrieve context
-    pFoundEntry = (PPROCESS_MAP_ENTRY)RtlInsertElementGenericTableAvl( &g_ProcessPageTables, &processEntry, sizeof( processEntry ), &newEntry );
+    status = BBAcquireOrCreateProcessEntry( &processEntry, &pFoundEntry, &newEntry );
+    if (!NT_SUCCESS( status ))
+    {
+        ObDereferenceObject( pProcess );
+        return status;
+    }
+
     if (newEntry != FALSE)
     {
         DPRINT( "BlackBone: %s: Process entry 0x%u was not found, creating new\n", __FUNCTION__, processEntry.target.pid );
-        InitializeListHead( &pFoundEntry->pageList );
 
         // Allocate shared Page
         status = BBAllocateSharedPage( &pFoundEntry->pSharedPage, &pFoundEntry->pMDLShared );
@@ -917,6 +951,9 @@ NTSTATUS BBMapMemoryRegion( IN PMAP_MEMORY_REGION pRegion, OUT PMAP_MEMORY_REGIO
 
                 status = BBUnmapRegionEntry( pPageEntry, pFoundEntry );
             }
+            // Region of lazy mapping, map only requested part
+            else if (pPageEntry->pMdl == NULL)
+                status = BBSplitPlaceholderEntry( pPageEntry, (ULONG_PTR)pRegion->base, pRegion->size );
             else
                 alreadyExists = TRUE;
         }
@@ -926,13 +963,15 @@ NTSTATUS BBMapMemoryRegion( IN PMAP_MEMORY_REGION pRegion, OUT PMAP_MEMORY_REGIO
     if (alreadyExists == FALSE && NT_SUCCESS( status ))
     {
         KAPC_STATE apc;
+        LIST_ENTRY newList;
+        InitializeListHead( &newList );
 
         // Allocate MDLs and lock pages
         KeStackAttachProcess( pProcess, &apc );
-        status = BBBuildProcessRegionListForRange( &pFoundEntry->pageList, pRegion->base, pRegion->base + pRegion->size, TRUE );
+        status = BBBuildProcessRegionListForRange( &newList, pRegion->base, pRegion->base + pRegion->size, TRUE );
 
         if (NT_SUCCESS( status ))
-            status = BBPrepareMDLList( pProcess, &pFoundEntry->pageList );
+            status = BBPrepareMDLList( pProcess, &newList );
 
         // Map shared page into target process
         if (NT_SUCCESS( status ) && newEntry)
@@ -945,7 +984,11 @@ NTSTATUS BBMapMemoryRegion( IN PMAP_MEMORY_REGION pRegion, OUT PMAP_MEMORY_REGIO
             status = BBMapSharedPage( pFoundEntry->pMDLShared, &pFoundEntry->host.sharedPage );
 
         if (NT_SUCCESS( status ))
-            status = BBMapRegionListIntoCurrentProcess( &pFoundEntry->pageList, TRUE );
+            status = BBMapRegionListIntoCurrentProcess( &newList, TRUE );
+
+        // On failure whole entry is cleaned up below
+        while (!IsListEmpty( &newList ))
+            BBInsertPageEntry( &pFoundEntry->pageList, CONTAINING_RECORD( RemoveHeadList( &newList ), MAP_ENTRY, link ) );
     }
 
     if (pProcess)
@@ -974,7 +1017,7 @@ NTSTATUS BBMapMemoryRegion( IN PMAP_MEMORY_REGION pRegion, OUT PMAP_MEMORY_REGIO
     if (!NT_SUCCESS( status ))
         BBCleanupProcessEntry( pFoundEntry );
 
-    KeReleaseGuardedMutex( &g_globalLock );
+    BBReleaseProcessEntry( pFoundEntry );
 
     return status;
 }
@@ -989,9 +1032,7 @@ NTSTATUS BBUnmapMemory( IN PUNMAP_MEMORY pUnmap )
     NTSTATUS status = STATUS_SUCCESS;
     PPROCESS_MAP_ENTRY pFoundEntry = NULL;
 
-    KeAcquireGuardedMutex( &g_globalLock );
-
-    pFoundEntry = BBLookupProcessEntry( (HANDLE)pUnmap->pid, FALSE );
+    pFoundEntry = BBAcquireProcessEntry( (HANDLE)pUnmap->pid, FALSE );
     if (pFoundEntry == NULL)
     {
         DPRINT( "BlackBone: %s: Process entry with PID %u was not found\n", __FUNCTION__, pUnmap->pid );
@@ -1001,10 +1042,9 @@ NTSTATUS BBUnmapMemory( IN PUNMAP_MEMORY pUnmap )
     {
         DPRINT( "BlackBone: %s: BBUnmapMemory cleanup for PID %u\n", __FUNCTION__, pUnmap->pid );
         BBCleanupProcessEntry( pFoundEntry );
+        BBReleaseProcessEntry( pFoundEntry );
     }
 
-    KeReleaseGuardedMutex( &g_globalLock );
-
     return status;
 }
 
@@ -1025,13 +1065,10 @@ NTSTATUS BBUnmapMemoryRegion( IN PUNMAP_MEMORY_REGION pRegion )
     if (pRegion->base >= (ULONGLONG)MM_HIGHEST_USER_ADDRESS || pRegion->base + pRegion->size > (ULONGLONG)MM_HIGHEST_USER_ADDRESS)
         return STATUS_INVALID_ADDRESS;
 
-    KeAcquireGuardedMutex( &g_globalLock );
-
     status = PsLookupProcessByProcessId( (HANDLE)pRegion->pid, &pProcess );
     if (!NT_SUCCESS( status ))
     {
         DPRINT( "BlackBone: %s: Failed to find process 0x%u\n", __FUNCTION__, pRegion->pid );
-        KeReleaseGuardedMutex( &g_globalLock );
         return status;
     }
 
@@ -1041,11 +1078,10 @@ NTSTATUS BBUnmapMemoryRegion( IN PUNMAP_MEMORY_REGION pRegion )
         DPRINT( "BlackBone: %s: Process %u is terminating. Abort\n", __FUNCTION__, pRegion->pid );
 
         ObDereferenceObject( pProcess );
-        KeReleaseGuardedMutex( &g_globalLock );
         return STATUS_PROCESS_IS_TERMINATING;
     }
 
-    pFoundEntry = BBLookupProcessEntry( (HANDLE)pRegion->pid, FALSE );
+    pFoundEntry = BBAcquireProcessEntry( (HANDLE)pRegion->pid, FALSE );
     if (pFoundEntry == NULL)
     {
         DPRINT( "BlackBone: %s: Process entry for process %u was not found\n", __FUNCTION__, pRegion->pid );
@@ -1076,12 +1112,192 @@ NTSTATUS BBUnmapMemoryRegion( IN PUNMAP_MEMORY_REGION pRegion )
                 status = STATUS_INVALID_ADDRESS;
             }
         }
+
+        BBReleaseProcessEntry( pFoundEntry );
     }
 
     if (pProcess)
         ObDereferenceObject( pProcess );
 
-    KeReleaseGuardedMutex( &g_globalLock );
+    return status;
+}
+
+/// <summary>
+/// Bring existing memory map in sync with current target address space.
+/// Regions that are unchanged stay mapped, only stale regions are unmapped and new ones mapped
+/// </summary>
+/// <param name="pData">Request params</param>
+/// <param name="pResult">Removed and added regions</param>
+/// <param name="resultSize">Output buffer size</param>
+/// <returns>Status code</returns>
+NTSTATUS BBRefreshMemoryMap( IN PREMAP_REFRESH pData, OUT PREMAP_REFRESH_RESULT pResult, IN ULONG resultSize )
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    PPROCESS_MAP_ENTRY pFoundEntry = NULL;
+    PEPROCESS pProcess = NULL;
+    LIST_ENTRY current, stale;
+    ULONG capacity = (resultSize - FIELD_OFFSET( REMAP_REFRESH_RESULT, entries )) / sizeof( MAP_MEMORY_RESULT_ENTRY );
+
+    InitializeListHead( &current );
+    InitializeListHead( &stale );
+
+    pResult->removed = pResult->added = pResult->count = 0;
+
+    status = PsLookupProcessByProcessId( (HANDLE)pData->pid, &pProcess );
+    if (!NT_SUCCESS( status ))
+    {
+        DPRINT( "BlackBone: %s: Failed to find process %u\n", __FUNCTION__, pData->pid );
+        return status;
+    }
+
+    // Process in signaled state, abort any operations
+    if (BBCheckProcessTermination( pProcess ))
+    {
+        DPRINT( "BlackBone: %s: Process %u is terminating. Abort\n", __FUNCTION__, pData->pid );
+
+        ObDereferenceObject( pProcess );
+        return STATUS_PROCESS_IS_TERMINATING;
+    }
+
+    pFoundEntry = BBAcquireProcessEntry( (HANDLE)pData->pid, FALSE );
+    if (pFoundEntry == NULL)
+    {
+        DPRINT( "BlackBone: %s: Process entry for process %u was not found\n", __FUNCTION__, pData->pid );
+        ObDereferenceObject( pProcess );
+        return STATUS_NOT_FOUND;
+    }
+
+    // Regions can be mapped and unmapped only in host context
+    if (pFoundEntry->host.pid != PsGetCurrentProcessId())
+    {
+        DPRINT( "BlackBone: %s: Call from non-original process not supported\n", __FUNCTION__ );
+        status = STATUS_INVALID_PARAMETER;
+    }
+    else
+    {
+        KAPC_STATE apc;
+        PLIST_ENTRY pCursor = NULL;
+
+        KeStackAttachProcess( pProcess, &apc );
+
+        status = BBBuildProcessRegionListForRange(
+            &current, (ULONG_PTR)MM_LOWEST_USER_ADDRESS,
+            (ULONG_PTR)MM_HIGHEST_USER_ADDRESS, pData->mapSections
+            );
+
+        if (NT_SUCCESS( status ))
+        {
+            // Both lists are ordered by address. Fresh region is unchanged if recorded regions inside it
+            // cover it completely, recorded regions can be smaller if lazy mapping was mapped in parts
+            pCursor = pFoundEntry->pageList.Flink;
+
+            for (PLIST_ENTRY pListEntry = current.Flink; pListEntry != &current;)
+            {
+                PMAP_ENTRY pFresh = CONTAINING_RECORD( pListEntry, MAP_ENTRY, link );
+                ULONG_PTR freshEnd = (ULONG_PTR)pFresh->mem.BaseAddress + pFresh->mem.RegionSize;
+                ULONG_PTR covered = 0;
+                pListEntry = pListEntry->Flink;
+
+                // Recorded regions below fresh one were released or changed
+                while (pCursor != &pFoundEntry->pageList &&
+                        CONTAINING_RECORD( pCursor, MAP_ENTRY, link )->mem.BaseAddress < pFresh->mem.BaseAddress)
+                {
+                    PLIST_ENTRY pStale = pCursor;
+                    pCursor = pCursor->Flink;
+
+                    RemoveEntryList( pStale );
+                    InsertTailList( &stale, pStale );
+                }
+
+                for (PLIST_ENTRY pInner = pCursor; pInner != &pFoundEntry->pageList; pInner = pInner->Flink)
+                {
+                    PMAP_ENTRY pEntry = CONTAINING_RECORD( pInner, MAP_ENTRY, link );
+                    if ((ULONG_PTR)pEntry->mem.BaseAddress + pEntry->mem.RegionSize > freshEnd || pEntry->mem.Type != pFresh->mem.Type)
+                        break;
+
+                    covered += pEntry->mem.RegionSize;
+                }
+
+                // Region is unchanged, keep existing mapping. Otherwise overlapping recorded regions become stale on next pass
+                if (covered == pFresh->mem.RegionSize)
+                {
+                    while (pCursor != &pFoundEntry->pageList && (ULONG_PTR)CONTAINING_RECORD( pCursor, MAP_ENTRY, link )->mem.BaseAddress < freshEnd)
+                        pCursor = pCursor->Flink;
+
+                    RemoveEntryList( &pFresh->link );
+                    ExFreePoolWithTag( pFresh, BB_POOL_TAG );
+                }
+            }
+
+            // Recorded regions above last fresh one
+            while (pCursor != &pFoundEntry->pageList)
+            {
+                PLIST_ENTRY pStale = pCursor;
+                pCursor = pCursor->Flink;
+
+                RemoveEntryList( pStale );
+                InsertTailList( &stale, pStale );
+            }
+
+            // Lock pages of new regions
+            if (!pFoundEntry->lazy)
+                status = BBPrepareMDLList( pProcess, &current );
+        }
+
+        KeUnstackDetachProcess( &apc );
+
+        if (NT_SUCCESS( status ))
+        {
+            while (!IsListEmpty( &stale ))
+            {
+                PMAP_ENTRY pEntry = CONTAINING_RECORD( stale.Flink, MAP_ENTRY, link );
+
+                if (pResult->count < capacity)
+                {
+                    pResult->entries[pResult->count].originalPtr = (ULONGLONG)pEntry->mem.BaseAddress;
+                    pResult->entries[pResult->count].newPtr = pEntry->newPtr;
+                    pResult->entries[pResult->count].size = (ULONG)pEntry->mem.RegionSize;
+                    pResult->count++;
+                }
+
+                pResult->removed++;
+                BBUnmapRegionEntry( pEntry, pFoundEntry );
+            }
+
+            // Failed and lazy regions are reported with zero address, same as for full map
+            if (!pFoundEntry->lazy)
+                BBMapRegionListIntoCurrentProcess( &current, TRUE );
+
+            while (!IsListEmpty( &current ))
+            {
+                PMAP_ENTRY pEntry = CONTAINING_RECORD( RemoveHeadList( &current ), MAP_ENTRY, link );
+
+                if (pResult->count < capacity)
+                {
+                    pResult->entries[pResult->count].originalPtr = (ULONGLONG)pEntry->mem.BaseAddress;
+                    pResult->entries[pResult->count].newPtr = pEntry->newPtr;
+                    pResult->entries[pResult->count].size = (ULONG)pEntry->mem.RegionSize;
+                    pResult->count++;
+                }
+
+                pResult->added++;
+                BBInsertPageEntry( &pFoundEntry->pageList, pEntry );
+            }
+
+            DPRINT( "BlackBone: %s: Process %u map refreshed, %u regions removed, %u added\n", __FUNCTION__, pData->pid, pResult->removed, pResult->added );
+        }
+        else
+        {
+            // Leave map as it was
+            while (!IsListEmpty( &stale ))
+                BBInsertPageEntry( &pFoundEntry->pageList, CONTAINING_RECORD( RemoveHeadList( &stale ), MAP_ENTRY, link ) );
+
+            BBCleanupPageList( FALSE, &current );
+        }
+    }
+
+    BBReleaseProcessEntry( pFoundEntry );
+    ObDereferenceObject( pProcess );
 
     return status;
 }
@@ -1146,7 +1362,8 @@ NTSTATUS BBSafeHandleClose( IN PEPROCESS pProcess, IN HANDLE handle, IN KPROCESS
 
 
 /// <summary>
-/// Unmap all regions, delete MDLs, close handles, remove entry from table
+/// Unmap all regions, delete MDLs, close handles, mark entry as removed.
+/// Entry lock must be held
 /// </summary>
 /// <param name="pProcessEntry">Process entry</param>
 VOID BBCleanupProcessEntry( IN PPROCESS_MAP_ENTRY pProcessEntry )
@@ -1215,12 +1432,14 @@ VOID BBCleanupProcessEntry( IN PPROCESS_MAP_ENTRY pProcessEntry )
 
     // Make sure page list is cleaned up even if there is no Host process
     BBCleanupPageList( FALSE, &pProcessEntry->pageList );
-    RtlDeleteElementGenericTableAvl( &g_ProcessPageTables, pProcessEntry );
+
+    // Entry can't be freed while other threads wait for its lock
+    pProcessEntry->removed = TRUE;
 }
 
 
 /// <summary>
-/// Unmap any mapped pages from host process
+/// Unmap any mapped pages from host process. Entry lock must be held
 /// </summary>
 /// <param name="pProcessEntry">Process entry</param>
 VOID BBCleanupHostProcess( IN PPROCESS_MAP_ENTRY pProcessEntry )
@@ -1264,8 +1483,15 @@ VOID BBCleanupProcessTable()
 {
     KeAcquireGuardedMutex( &g_globalLock );
 
+    // No requests are running during unload, so entry locks aren't needed
     while (!RtlIsGenericTableEmptyAvl( &g_ProcessPageTables ))
-        BBCleanupProcessEntry( (PPROCESS_MAP_ENTRY)RtlEnumerateGenericTableAvl( &g_ProcessPageTables, TRUE ) );
+    {
+        PPROCESS_MAP_ENTRY pEntry = (PPROCESS_MAP_ENTRY)RtlEnumerateGenericTableAvl( &g_ProcessPageTables, TRUE );
+        if (!pEntry->removed)
+            BBCleanupProcessEntry( pEntry );
+
+        RtlDeleteElementGenericTableAvl( &g_ProcessPageTables, pEntry );
+    }
 
     KeReleaseGuardedMutex( &g_globalLock );
 }
@@ -1289,6 +1515,103 @@ PPROCESS_MAP_ENTRY BBLookupProcessEntry( IN HANDLE pid, IN BOOLEAN asHost )
     return RtlLookupElementGenericTableAvl( &g_ProcessPageTables, &entry );
 }
 
+/// <summary>
+/// Find process entry, reference and lock it
+/// </summary>
+/// <param name="pid">PID</param>
+/// <param name="asHost">If set to TRUE, pid is treated as host PID</param>
+/// <returns>Locked entry, NULL if not found. Release with BBReleaseProcessEntry</returns>
+PPROCESS_MAP_ENTRY BBAcquireProcessEntry( IN HANDLE pid, IN BOOLEAN asHost )
+{
+    PPROCESS_MAP_ENTRY pEntry = NULL;
+
+    KeAcquireGuardedMutex( &g_globalLock );
+
+    pEntry = BBLookupProcessEntry( pid, asHost );
+    if (pEntry != NULL)
+        pEntry->refCount++;
+
+    KeReleaseGuardedMutex( &g_globalLock );
+
+    if (pEntry == NULL)
+        return NULL;
+
+    KeAcquireGuardedMutex( &pEntry->lock );
+
+    // Cleaned up while waiting for lock
+    if (pEntry->removed)
+    {
+        BBReleaseProcessEntry( pEntry );
+        return NULL;
+    }
+
+    return pEntry;
+}
+
+/// <summary>
+/// Find or create process entry for target, reference and lock it
+/// </summary>
+/// <param name="pTemplate">Initial entry values, target.pid is used as key</param>
+/// <param name="ppEntry">Locked entry. Release with BBReleaseProcessEntry</param>
+/// <param name="pNewEntry">Set to TRUE if entry was created</param>
+/// <returns>Status code, STATUS_DELETE_PENDING if entry is being removed</returns>
+NTSTATUS BBAcquireOrCreateProcessEntry( IN PPROCESS_MAP_ENTRY pTemplate, OUT PPROCESS_MAP_ENTRY* ppEntry, OUT PBOOLEAN pNewEntry )
+{
+    PPROCESS_MAP_ENTRY pEntry = NULL;
+    BOOLEAN newEntry = FALSE;
+
+    KeAcquireGuardedMutex( &g_globalLock );
+
+    pEntry = (PPROCESS_MAP_ENTRY)RtlInsertElementGenericTableAvl( &g_ProcessPageTables, pTemplate, sizeof( *pTemplate ), &newEntry );
+    if (pEntry == NULL)
+    {
+        KeReleaseGuardedMutex( &g_globalLock );
+        return STATUS_NO_MEMORY;
+    }
+
+    // Nobody can see new entry before table lock is released
+    if (newEntry != FALSE)
+    {
+        InitializeListHead( &pEntry->pageList );
+        KeInitializeGuardedMutex( &pEntry->lock );
+        pEntry->refCount = 0;
+        pEntry->removed = FALSE;
+    }
+
+    pEntry->refCount++;
+
+    KeReleaseGuardedMutex( &g_globalLock );
+
+    KeAcquireGuardedMutex( &pEntry->lock );
+
+    // Previous mapping of this target is still being torn down
+    if (pEntry->removed)
+    {
+        BBReleaseProcessEntry( pEntry );
+        return STATUS_DELETE_PENDING;
+    }
+
+    *ppEntry = pEntry;
+    *pNewEntry = newEntry;
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Unlock and dereference process entry. Removed entry is deleted from table by its last user
+/// </summary>
+/// <param name="pProcessEntry">Process entry</param>
+VOID BBReleaseProcessEntry( IN PPROCESS_MAP_ENTRY pProcessEntry )
+{
+    KeReleaseGuardedMutex( &pProcessEntry->lock );
+
+    KeAcquireGuardedMutex( &g_globalLock );
+
+    if (--pProcessEntry->refCount == 0 && pProcessEntry->removed)
+        RtlDeleteElementGenericTableAvl( &g_ProcessPageTables, pProcessEntry );
+
+    KeReleaseGuardedMutex( &g_globalLock );
+}
+
 
 /// <summary>
 /// Find memory region containing at least one byte from specific region
@@ -1320,6 +1643,66 @@ PMAP_ENTRY BBFindPageEntry( IN PLIST_ENTRY pList, IN ULONG_PTR baseAddress, IN U
     return NULL;
 }
 
+/// <summary>
+/// Insert region into list ordered by address
+/// </summary>
+/// <param name="pList">Region list</param>
+/// <param name="pEntry">Region to insert</param>
+VOID BBInsertPageEntry( IN PLIST_ENTRY pList, IN PMAP_ENTRY pEntry )
+{
+    PLIST_ENTRY pListEntry = pList->Blink;
+
+    // New regions are usually placed at the end
+    while (pListEntry != pList && CONTAINING_RECORD( pListEntry, MAP_ENTRY, link )->mem.BaseAddress > pEntry->mem.BaseAddress)
+        pListEntry = pListEntry->Blink;
+
+    InsertHeadList( pListEntry, &pEntry->link );
+}
+
+/// <summary>
+/// Cut range out of not yet mapped region of lazy mapping. Parts outside range stay in list
+/// </summary>
+/// <param name="pEntry">Region to split</param>
+/// <param name="base">Range base</param>
+/// <param name="size">Range size</param>
+/// <returns>Status code</returns>
+NTSTATUS BBSplitPlaceholderEntry( IN PMAP_ENTRY pEntry, IN ULONG_PTR base, IN ULONG_PTR size )
+{
+    ULONG_PTR start = (ULONG_PTR)pEntry->mem.BaseAddress;
+    ULONG_PTR end = start + pEntry->mem.RegionSize;
+
+    ASSERT( pEntry->pMdl == NULL && base >= start && base + size <= end );
+
+    // Part after range
+    if (base + size < end)
+    {
+        PMAP_ENTRY pTail = ExAllocatePoolWithTag( PagedPool, sizeof( MAP_ENTRY ), BB_POOL_TAG );
+        if (pTail == NULL)
+        {
+            DPRINT( "BlackBone: %s: Failed to allocate memory for Remap descriptor\n", __FUNCTION__ );
+            return STATUS_NO_MEMORY;
+        }
+
+        *pTail = *pEntry;
+        pTail->mem.BaseAddress = (PVOID)(base + size);
+        pTail->mem.RegionSize = end - (base + size);
+        InsertHeadList( &pEntry->link, &pTail->link );
+    }
+
+    // Part before range
+    if (base > start)
+    {
+        pEntry->mem.RegionSize = base - start;
+    }
+    else
+    {
+        RemoveEntryList( &pEntry->link );
+        ExFreePoolWithTag( pEntry, BB_POOL_TAG );
+    }
+
+    return STATUS_SUCCESS;
+}
+
 /// <summary>
 /// Calculate size required to store mapping info
 /// </summary>
@@ -4,6 +4,9 @@
 #include "VadRoutines.h"
 #include "BlackBoneDef.h"
 
+// Largest region described by single MDL, bigger regions are split into spans of this size
+#define BB_MAX_MDL_SPAN ((ULONG_PTR)MAXLONG & ~((ULONG_PTR)PAGE_SIZE - 1))
+
 typedef enum _ATTACHED_CONTEXT
 {
     ContextNone,    // Running in system context
@@ -22,19 +25,26 @@ typedef struct _PROCESS_CONTEXT
 
 
 /// <summary>
-/// Target - host correspondence
+/// Target - host correspondence.
+/// Table structure and refCount are guarded by g_globalLock, everything else by entry lock
 /// </summary>
 typedef struct _PROCESS_MAP_ENTRY
 {
     PROCESS_CONTEXT host;   // Hosting process context
-    PROCESS_CONTEXT target; // Target process context
+    PROCESS_CONTEXT target; // Target process context, target.pid is immutable table key
+
+    KGUARDED_MUTEX lock;    // Entry lock, taken without holding g_globalLock
+    LONG refCount;          // Number of threads using entry
+    BOOLEAN removed;        // Entry was cleaned up, last user removes it from table
 
     PVOID pSharedPage;      // Address of kernel-shared page allocated from non-paged pool
     PMDL  pMDLShared;       // MDL of kernel-shared page
 
     HANDLE targetPipe;      // Hook pipe handle in target process
+    BOOLEAN lazy;           // Regions are locked and mapped on first access
+
 
-    LIST_ENTRY pageList;    // List of REMAP_ENTRY structures
+    LIST_ENTRY pageList;    // List of REMAP_ENTRY structures, ordered by address
 } PROCESS_MAP_ENTRY, *PPROCESS_MAP_ENTRY;
 
 
@@ -47,7 +57,7 @@ typedef struct _MAP_ENTRY
     MEMORY_BASIC_INFORMATION mem;   // Original memory info
 
     ULONG_PTR newPtr;               // Mapped memory address in host process
-    PMDL    pMdl;                   // Region MDL entry
+    PMDL    pMdl;                   // Region MDL entry, NULL for not yet mapped region of lazy mapping
     BOOLEAN locked;                 // MDL is locked
     BOOLEAN shared;                 // Regions has shared pages
     BOOLEAN readonly;               // Region must be mapped as readonly
@@ -61,10 +71,18 @@ extern KGUARDED_MUTEX g_globalLock;
 /// Map entire address space of target process into current
 /// </summary>
 /// <param name="pRemap">Mapping params</param>
-/// <param name="ppEntry">Mapped context</param>
+/// <param name="ppEntry">Mapped context. On success entry is locked, release it with BBReleaseProcessEntry</param>
 /// <returns>Status code</returns>
 NTSTATUS BBMapMemory( IN PMAP_MEMORY pRemap, OUT PPROCESS_MAP_ENTRY* ppEntry );
 
+/// <summary>
+/// Allocate kernel page from NonPaged pool and build MDL for it
+/// </summary>
+/// <param name="pPage">Resulting address</param>
+/// <param name="pResultMDL">Resulting MDL</param>
+/// <returns>Status code</returns>
+NTSTATUS BBAllocateSharedPage( OUT PVOID* pPage, OUT PMDL* pResultMDL );
+
 /// <summary>
 /// Map specific memory region
 /// </summary>
@@ -87,6 +105,16 @@ NTSTATUS BBUnmapMemory( IN PUNMAP_MEMORY pUnmap );
 /// <returns>Status ode</returns>
 NTSTATUS BBUnmapMemoryRegion( IN PUNMAP_MEMORY_REGION pRegion );
 
+/// <summary>
+/// Bring existing memory map in sync with current target address space.
+/// Regions that are unchanged stay mapped, only stale regions are unmapped and new ones mapped
+/// </summary>
+/// <param name="pData">Request params</param>
+/// <param name="pResult">Removed and added regions</param>
+/// <param name="resultSize">Output buffer size</param>
+/// <returns>Status code</returns>
+NTSTATUS BBRefreshMemoryMap( IN PREMAP_REFRESH pData, OUT PREMAP_REFRESH_RESULT pResult, IN ULONG resultSize );
+
 /// <summary>
 /// Calculate size required to store mapping info
 /// </summary>
@@ -96,7 +124,8 @@ NTSTATUS BBUnmapMemoryRegion( IN PUNMAP_MEMORY_REGION pRegion );
 NTSTATUS BBGetRequiredRemapOutputSize( IN PLIST_ENTRY pList, OUT PULONG_PTR pSize );
 
 /// <summary>
-/// Enumerate committed, accessible, non-guarded memory regions
+/// Enumerate committed, accessible, non-guarded memory regions.
+/// Regions are clipped to range end and split into BB_MAX_MDL_SPAN spans
 /// </summary>
 /// <param name="pList">Region list</param>
 /// <param name="start">Region start</param>
@@ -106,7 +135,7 @@ NTSTATUS BBGetRequiredRemapOutputSize( IN PLIST_ENTRY pList, OUT PULONG_PTR pSiz
 NTSTATUS BBBuildProcessRegionListForRange( IN PLIST_ENTRY pList, IN ULONG_PTR start, IN ULONG_PTR end, IN BOOLEAN mapSections );
 
 /// <summary>
-/// Search process entry in list by PID
+/// Search process entry in list by PID. g_globalLock must be held
 /// </summary>
 /// <param name="pid">PID.</param>
 /// <param name="asHost">If set to TRUE, pid is treated as host PID</param>
@@ -114,7 +143,31 @@ NTSTATUS BBBuildProcessRegionListForRange( IN PLIST_ENTRY pList, IN ULONG_PTR st
 PPROCESS_MAP_ENTRY BBLookupProcessEntry( IN HANDLE pid, IN BOOLEAN asHost );
 
 /// <summary>
-/// Unmap all regions, delete MDLs, close handles, remove entry from table
+/// Find process entry, reference and lock it
+/// </summary>
+/// <param name="pid">PID</param>
+/// <param name="asHost">If set to TRUE, pid is treated as host PID</param>
+/// <returns>Locked entry, NULL if not found. Release with BBReleaseProcessEntry</returns>
+PPROCESS_MAP_ENTRY BBAcquireProcessEntry( IN HANDLE pid, IN BOOLEAN asHost );
+
+/// <summary>
+/// Find or create process entry for target, reference and lock it
+/// </summary>
+/// <param name="pTemplate">Initial entry values, target.pid is used as key</param>
+/// <param name="ppEntry">Locked entry. Release with BBReleaseProcessEntry</param>
+/// <param name="pNewEntry">Set to TRUE if entry was created</param>
+/// <returns>Status code, STATUS_DELETE_PENDING if entry is being removed</returns>
+NTSTATUS BBAcquireOrCreateProcessEntry( IN PPROCESS_MAP_ENTRY pTemplate, OUT PPROCESS_MAP_ENTRY* ppEntry, OUT PBOOLEAN pNewEntry );
+
+/// <summary>
+/// Unlock and dereference process entry. Removed entry is deleted from table by its last user
+/// </summary>
+/// <param name="pProcessEntry">Process entry</param>
+VOID BBReleaseProcessEntry( IN PPROCESS_MAP_ENTRY pProcessEntry );
+
+/// <summary>
+/// Unmap all regions, delete MDLs, close handles, mark entry as removed.
+/// Entry lock must be held
 /// </summary>
 /// <param name="pProcessEntry">Process entry</param>
 VOID BBCleanupProcessEntry( IN PPROCESS_MAP_ENTRY pProcessEntry );
@@ -125,7 +178,7 @@ VOID BBCleanupProcessEntry( IN PPROCESS_MAP_ENTRY pProcessEntry );
 VOID BBCleanupProcessTable();
 
 /// <summary>
-/// Unmap any mapped pages from host process
+/// Unmap any mapped pages from host process. Entry lock must be held
 /// </summary>
 /// <param name="pProcessEntry">Process entry</param>
 VOID BBCleanupHostProcess( IN PPROCESS_MAP_ENTRY pProcessEntry );
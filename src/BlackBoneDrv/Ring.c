@@ -0,0 +1,305 @@
+#include "Ring.h"
+#include "Remap.h"
+#include "Routines.h"
+#include "Utils.h"
+
+LIST_ENTRY g_Rings;
+KGUARDED_MUTEX g_ringLock;
+
+C_ASSERT( sizeof( COMMAND_RING ) <= PAGE_SIZE );
+C_ASSERT( (BLACKBONE_RING_ENTRIES & (BLACKBONE_RING_ENTRIES - 1)) == 0 );
+
+VOID BBRingWorker( IN PVOID context );
+VOID BBFreeRing( IN PRING_CONTEXT pRing );
+
+#pragma alloc_text(PAGE, BBCreateRing)
+#pragma alloc_text(PAGE, BBDestroyRing)
+#pragma alloc_text(PAGE, BBCleanupRings)
+#pragma alloc_text(PAGE, BBRingWorker)
+#pragma alloc_text(PAGE, BBFreeRing)
+
+/// <summary>
+/// Create command ring for calling process
+/// </summary>
+/// <param name="pData">Request params</param>
+/// <param name="pResult">Ring address in calling process</param>
+/// <returns>Status code</returns>
+NTSTATUS BBCreateRing( IN PCREATE_RING pData, OUT PCREATE_RING_RESULT pResult )
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    PRING_CONTEXT pRing = NULL;
+    OBJECT_ATTRIBUTES oa = { 0 };
+    HANDLE hThread = NULL;
+
+    ASSERT( pData != NULL && pResult != NULL );
+    if (pData == NULL || pResult == NULL)
+        return STATUS_INVALID_PARAMETER;
+
+    // Worker waits on events inside context, so it can't be paged
+    pRing = ExAllocatePoolWithTag( NonPagedPool, sizeof( RING_CONTEXT ), BB_POOL_TAG );
+    if (pRing == NULL)
+        return STATUS_NO_MEMORY;
+
+    RtlZeroMemory( pRing, sizeof( RING_CONTEXT ) );
+    KeInitializeEvent( &pRing->stopEvent, NotificationEvent, FALSE );
+    pRing->owner = PsGetCurrentProcessId();
+    pRing->pOwner = PsGetCurrentProcess();
+    ObReferenceObject( pRing->pOwner );
+
+    status = ObReferenceObjectByHandle( (HANDLE)pData->requestEvent, EVENT_MODIFY_STATE | SYNCHRONIZE, *ExEventObjectType, UserMode, &pRing->pRequestEvent, NULL );
+    if (NT_SUCCESS( status ))
+        status = ObReferenceObjectByHandle( (HANDLE)pData->completeEvent, EVENT_MODIFY_STATE, *ExEventObjectType, UserMode, &pRing->pCompleteEvent, NULL );
+
+    if (!NT_SUCCESS( status ))
+    {
+        DPRINT( "BlackBone: %s: Failed to reference ring events, status 0x%X\n", __FUNCTION__, status );
+        BBFreeRing( pRing );
+        return status;
+    }
+
+    status = BBAllocateSharedPage( &pRing->pPage, &pRing->pMDL );
+    if (NT_SUCCESS( status ) && pRing->pMDL == NULL)
+        status = STATUS_INSUFFICIENT_RESOURCES;
+
+    if (!NT_SUCCESS( status ))
+    {
+        BBFreeRing( pRing );
+        return status;
+    }
+
+    // Ring holds data only, so unlike BBMapSharedPage page is left non-executable
+    __try
+    {
+        pRing->pMapped = MmMapLockedPagesSpecifyCache( pRing->pMDL, UserMode, MmCached, NULL, FALSE, NormalPagePriority );
+    }
+    __except (EXCEPTION_EXECUTE_HANDLER)
+    {
+        pRing->pMapped = NULL;
+    }
+
+    if (pRing->pMapped == NULL)
+    {
+        DPRINT( "BlackBone: %s: Failed to map ring page\n", __FUNCTION__ );
+        BBFreeRing( pRing );
+        return STATUS_NOT_MAPPED_DATA;
+    }
+
+    // Kernel handle, current process is the client
+    InitializeObjectAttributes( &oa, NULL, OBJ_KERNEL_HANDLE, NULL, NULL );
+    status = PsCreateSystemThread( &hThread, THREAD_ALL_ACCESS, &oa, NULL, NULL, &BBRingWorker, pRing );
+    if (NT_SUCCESS( status ))
+    {
+        status = ObReferenceObjectByHandle( hThread, SYNCHRONIZE, *PsThreadType, KernelMode, &pRing->pWorker, NULL );
+
+        // Thread can't be found otherwise
+        if (!NT_SUCCESS( status ))
+        {
+            KeSetEvent( &pRing->stopEvent, IO_NO_INCREMENT, FALSE );
+            ZwWaitForSingleObject( hThread, FALSE, NULL );
+        }
+
+        ZwClose( hThread );
+    }
+
+    if (!NT_SUCCESS( status ))
+    {
+        DPRINT( "BlackBone: %s: Failed to start ring worker, status 0x%X\n", __FUNCTION__, status );
+        BBFreeRing( pRing );
+        return status;
+    }
+
+    // One ring per process
+    KeAcquireGuardedMutex( &g_ringLock );
+
+    for (PLIST_ENTRY pListEntry = g_Rings.Flink; pListEntry != &g_Rings; pListEntry = pListEntry->Flink)
+    {
+        if (CONTAINING_RECORD( pListEntry, RING_CONTEXT, link )->owner == pRing->owner)
+        {
+            status = STATUS_OBJECT_NAME_COLLISION;
+            break;
+        }
+    }
+
+    if (NT_SUCCESS( status ))
+        InsertTailList( &g_Rings, &pRing->link );
+
+    KeReleaseGuardedMutex( &g_ringLock );
+
+    if (!NT_SUCCESS( status ))
+    {
+        BBFreeRing( pRing );
+        return status;
+    }
+
+    pResult->address = (ULONGLONG)pRing->pMapped;
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Destroy command ring of calling process
+/// </summary>
+/// <returns>Status code</returns>
+NTSTATUS BBDestroyRing()
+{
+    PRING_CONTEXT pFound = NULL;
+
+    KeAcquireGuardedMutex( &g_ringLock );
+
+    for (PLIST_ENTRY pListEntry = g_Rings.Flink; pListEntry != &g_Rings; pListEntry = pListEntry->Flink)
+    {
+        PRING_CONTEXT pRing = CONTAINING_RECORD( pListEntry, RING_CONTEXT, link );
+        if (pRing->owner == PsGetCurrentProcessId())
+        {
+            RemoveEntryList( &pRing->link );
+            pFound = pRing;
+            break;
+        }
+    }
+
+    KeReleaseGuardedMutex( &g_ringLock );
+
+    if (pFound == NULL)
+        return STATUS_NOT_FOUND;
+
+    BBFreeRing( pFound );
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Destroy command rings owned by process
+/// </summary>
+/// <param name="pid">Exited process ID. NULL to destroy all rings</param>
+VOID BBCleanupRings( IN HANDLE pid )
+{
+    LIST_ENTRY removed;
+    InitializeListHead( &removed );
+
+    KeAcquireGuardedMutex( &g_ringLock );
+
+    for (PLIST_ENTRY pListEntry = g_Rings.Flink; pListEntry != &g_Rings;)
+    {
+        PRING_CONTEXT pRing = CONTAINING_RECORD( pListEntry, RING_CONTEXT, link );
+        pListEntry = pListEntry->Flink;
+
+        if (pid == NULL || pRing->owner == pid)
+        {
+            RemoveEntryList( &pRing->link );
+            InsertTailList( &removed, &pRing->link );
+        }
+    }
+
+    KeReleaseGuardedMutex( &g_ringLock );
+
+    // Worker shutdown waits, so don't hold the lock
+    while (!IsListEmpty( &removed ))
+        BBFreeRing( CONTAINING_RECORD( RemoveHeadList( &removed ), RING_CONTEXT, link ) );
+}
+
+/// <summary>
+/// Stop worker, unmap shared page and release all ring resources.
+/// Handles partially initialized context
+/// </summary>
+/// <param name="pRing">Ring context</param>
+VOID BBFreeRing( IN PRING_CONTEXT pRing )
+{
+    if (pRing->pWorker)
+    {
+        KeSetEvent( &pRing->stopEvent, IO_NO_INCREMENT, FALSE );
+        KeWaitForSingleObject( pRing->pWorker, Executive, KernelMode, FALSE, NULL );
+        ObDereferenceObject( pRing->pWorker );
+    }
+
+    if (pRing->pMapped)
+    {
+        KAPC_STATE apc;
+        BOOLEAN attach = PsGetCurrentProcessId() != pRing->owner;
+
+        if (attach)
+            KeStackAttachProcess( pRing->pOwner, &apc );
+
+        MmUnmapLockedPages( pRing->pMapped, pRing->pMDL );
+
+        if (attach)
+            KeUnstackDetachProcess( &apc );
+    }
+
+    if (pRing->pMDL)
+        IoFreeMdl( pRing->pMDL );
+
+    if (pRing->pPage)
+        ExFreePoolWithTag( pRing->pPage, BB_POOL_TAG );
+
+    if (pRing->pRequestEvent)
+        ObDereferenceObject( pRing->pRequestEvent );
+
+    if (pRing->pCompleteEvent)
+        ObDereferenceObject( pRing->pCompleteEvent );
+
+    ObDereferenceObject( pRing->pOwner );
+    ExFreePoolWithTag( pRing, BB_POOL_TAG );
+}
+
+/// <summary>
+/// Ring worker. Executes published commands every time request event is signaled
+/// </summary>
+/// <param name="context">Ring context</param>
+VOID BBRingWorker( IN PVOID context )
+{
+    PRING_CONTEXT pRing = (PRING_CONTEXT)context;
+    PCOMMAND_RING pShared = (PCOMMAND_RING)pRing->pPage;
+    PVOID objects[2] = { &pRing->stopEvent, pRing->pRequestEvent };
+
+    for (;;)
+    {
+        PEPROCESS pTarget = NULL;
+        ULONG targetPid = 0;
+        LONG head = 0;
+
+        NTSTATUS status = KeWaitForMultipleObjects( 2, objects, WaitAny, Executive, KernelMode, FALSE, NULL, NULL );
+        if (status != STATUS_WAIT_1)
+            break;
+
+        head = InterlockedCompareExchange( &pShared->head, 0, 0 );
+
+        // Producer index is out of range, drop everything published so far
+        if ((ULONG)(head - pRing->completed) > BLACKBONE_RING_ENTRIES)
+            pRing->completed = head;
+
+        for (; pRing->completed != head; pRing->completed++)
+        {
+            PRING_ENTRY pSharedEntry = &pShared->entries[pRing->completed & (BLACKBONE_RING_ENTRIES - 1)];
+            RING_ENTRY entry = *pSharedEntry;
+            SIZE_T bytes = 0;
+
+            // Consecutive commands usually target the same process
+            if (pTarget == NULL || entry.pid != targetPid)
+            {
+                if (pTarget)
+                    ObDereferenceObject( pTarget );
+
+                pTarget = NULL;
+                targetPid = entry.pid;
+                status = BBLookupTargetForOwner( entry.pid, pRing->owner, &pTarget );
+            }
+
+            // Both addresses come from shared memory, so they are probed as user-mode pointers
+            if (pTarget == NULL)
+                entry.status = status;
+            else if (entry.write != FALSE)
+                entry.status = MmCopyVirtualMemory( pRing->pOwner, (PVOID)entry.localbuf, pTarget, (PVOID)entry.targetPtr, entry.size, UserMode, &bytes );
+            else
+                entry.status = MmCopyVirtualMemory( pTarget, (PVOID)entry.targetPtr, pRing->pOwner, (PVOID)entry.localbuf, entry.size, UserMode, &bytes );
+
+            pSharedEntry->status = entry.status;
+            InterlockedExchange( &pShared->tail, pRing->completed + 1 );
+        }
+
+        if (pTarget)
+            ObDereferenceObject( pTarget );
+
+        pShared->tail = pRing->completed;
+        KeSetEvent( pRing->pCompleteEvent, IO_NO_INCREMENT, FALSE );
+    }
+
+    PsTerminateSystemThread( STATUS_SUCCESS );
+}
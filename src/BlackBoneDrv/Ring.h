@@ -0,0 +1,45 @@
+#pragma once
+
+#include "Private.h"
+#include "BlackBoneDef.h"
+
+/// <summary>
+/// Command ring of a single client process, see IOCTL_BLACKBONE_CREATE_RING
+/// </summary>
+typedef struct _RING_CONTEXT
+{
+    LIST_ENTRY link;
+    HANDLE owner;               // Client process ID
+    PEPROCESS pOwner;           // Referenced client process
+    PVOID pPage;                // Shared page, kernel address
+    PMDL pMDL;                  // Shared page MDL
+    PVOID pMapped;              // Shared page address in client process
+    PKEVENT pRequestEvent;      // Client request event
+    PKEVENT pCompleteEvent;     // Client completion event
+    KEVENT stopEvent;           // Worker stop event
+    PETHREAD pWorker;           // Worker thread
+    LONG completed;             // Number of completed commands. Shared tail is only a copy
+} RING_CONTEXT, *PRING_CONTEXT;
+
+extern LIST_ENTRY g_Rings;
+extern KGUARDED_MUTEX g_ringLock;
+
+/// <summary>
+/// Create command ring for calling process
+/// </summary>
+/// <param name="pData">Request params</param>
+/// <param name="pResult">Ring address in calling process</param>
+/// <returns>Status code</returns>
+NTSTATUS BBCreateRing( IN PCREATE_RING pData, OUT PCREATE_RING_RESULT pResult );
+
+/// <summary>
+/// Destroy command ring of calling process
+/// </summary>
+/// <returns>Status code</returns>
+NTSTATUS BBDestroyRing();
+
+/// <summary>
+/// Destroy command rings owned by process
+/// </summary>
+/// <param name="pid">Exited process ID. NULL to destroy all rings</param>
+VOID BBCleanupRings( IN HANDLE pid );
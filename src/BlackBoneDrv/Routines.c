@@ -4,17 +4,24 @@
 #include <Ntstrsafe.h>
 
 LIST_ENTRY g_PhysProcesses;
+LIST_ENTRY g_Targets;
+KGUARDED_MUTEX g_targetLock;
+LONG g_lastTarget = 0;
 PVOID g_kernelPage = NULL;  // Trampoline buffer page
 LONG g_trIndex = 0;         // Trampoline global index
 
 /// <summary>
 /// Find allocated memory region entry
 /// </summary>
-/// <param name="pList">Region list</param>
-/// <param name="pBase">Region base</param>
+/// <param name="pTable">Region table</param>
+/// <param name="pBase">Any address inside region</param>
 /// <returns>Found entry, NULL if not found</returns>
-PMEM_PHYS_ENTRY BBLookupPhysMemEntry( IN PLIST_ENTRY pList, IN PVOID pBase );
+PMEM_PHYS_ENTRY BBLookupPhysMemEntry( IN PRTL_AVL_TABLE pTable, IN PVOID pBase );
+RTL_GENERIC_COMPARE_RESULTS BBPhysEntryCompare( IN RTL_AVL_TABLE *Table, IN PVOID FirstStruct, IN PVOID SecondStruct );
+NTSTATUS BBAllocateVirtual( IN OUT PVOID* pBase, IN OUT PULONG_PTR pSize, IN ULONG type, IN ULONG protection );
 VOID BBWriteTrampoline( IN PUCHAR place, IN PVOID pfn );
+NTSTATUS BBProtectRegion( IN PEPROCESS pProcess, IN ULONGLONG base, IN ULONGLONG size, IN ULONG newProtection );
+VOID BBScanRegion( IN PSCAN_MEMORY pData, IN PUCHAR pStart, IN SIZE_T size, IN OUT PSCAN_MEMORY_RESULT pResult, IN ULONGLONG capacity );
 BOOLEAN BBHandleCallback(
 #if !defined(_WIN7_)
     IN PHANDLE_TABLE HandleTable,
@@ -29,14 +36,30 @@ BOOLEAN BBHandleCallback(
 #pragma alloc_text(PAGE, BBHandleCallback)
 #pragma alloc_text(PAGE, BBGrantAccess)
 #pragma alloc_text(PAGE, BBCopyMemory)
+#pragma alloc_text(PAGE, BBCopyMemoryVector)
+#pragma alloc_text(PAGE, BBReadPhysicalVector)
 #pragma alloc_text(PAGE, BBAllocateFreeMemory)
 #pragma alloc_text(PAGE, BBAllocateFreePhysical)
+#pragma alloc_text(PAGE, BBAllocateMemoryBatch)
+#pragma alloc_text(PAGE, BBAllocateVirtual)
 #pragma alloc_text(PAGE, BBProtectMemory)
+#pragma alloc_text(PAGE, BBProtectMemoryBatch)
+#pragma alloc_text(PAGE, BBProtectRegion)
+#pragma alloc_text(PAGE, BBEnumMemRegionsNext)
+#pragma alloc_text(PAGE, BBScanMemory)
+#pragma alloc_text(PAGE, BBScanRegion)
 #pragma alloc_text(PAGE, BBWriteTrampoline)
 #pragma alloc_text(PAGE, BBHookSSDT)
 
+#pragma alloc_text(PAGE, BBOpenTarget)
+#pragma alloc_text(PAGE, BBCloseTarget)
+#pragma alloc_text(PAGE, BBLookupTarget)
+#pragma alloc_text(PAGE, BBLookupTargetForOwner)
+#pragma alloc_text(PAGE, BBCleanupTargets)
+#pragma alloc_text(PAGE, BBEnumModules)
 #pragma alloc_text(PAGE, BBLookupPhysProcessEntry)
 #pragma alloc_text(PAGE, BBLookupPhysMemEntry)
+#pragma alloc_text(PAGE, BBPhysEntryCompare)
 
 #pragma alloc_text(PAGE, BBCleanupPhysMemEntry)
 #pragma alloc_text(PAGE, BBCleanupProcessPhysEntry)
@@ -318,7 +341,7 @@ NTSTATUS BBCopyMemory( IN PCOPY_MEMORY pCopy )
     PEPROCESS pProcess = NULL, pSourceProc = NULL, pTargetProc = NULL;
     PVOID pSource = NULL, pTarget = NULL;
 
-    status = PsLookupProcessByProcessId( (HANDLE)pCopy->pid, &pProcess );
+    status = BBLookupTarget( pCopy->pid, &pProcess );
 
     if (NT_SUCCESS( status ))
     {
@@ -344,7 +367,46 @@ NTSTATUS BBCopyMemory( IN PCOPY_MEMORY pCopy )
         status = MmCopyVirtualMemory( pSourceProc, pSource, pTargetProc, pTarget, pCopy->size, KernelMode, &bytes );
     }
     else
-        DPRINT( "BlackBone: %s: PsLookupProcessByProcessId failed with status 0x%X\n", __FUNCTION__, status );
+        DPRINT( "BlackBone: %s: BBLookupTarget failed with status 0x%X\n", __FUNCTION__, status );
+
+    if (pProcess)
+        ObDereferenceObject( pProcess );
+
+    return status;
+}
+
+/// <summary>
+/// Read/write several ranges of one process. Process is looked up once
+/// </summary>
+/// <param name="pData">Request params, status of every entry is updated</param>
+/// <returns>Status code</returns>
+NTSTATUS BBCopyMemoryVector( IN OUT PCOPY_MEMORY_VECTOR pData )
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    PEPROCESS pProcess = NULL;
+
+    status = BBLookupTarget( pData->pid, &pProcess );
+    if (NT_SUCCESS( status ))
+    {
+        PEPROCESS pCurrent = PsGetCurrentProcess();
+
+        for (ULONG i = 0; i < pData->count; i++)
+        {
+            PCOPY_MEMORY_ENTRY pEntry = &pData->entries[i];
+            SIZE_T bytes = 0;
+
+            if (pEntry->write != FALSE)
+                pEntry->status = MmCopyVirtualMemory(
+                    pCurrent, (PVOID)pEntry->localbuf, pProcess, (PVOID)pEntry->targetPtr, pEntry->size, KernelMode, &bytes
+                    );
+            else
+                pEntry->status = MmCopyVirtualMemory(
+                    pProcess, (PVOID)pEntry->targetPtr, pCurrent, (PVOID)pEntry->localbuf, pEntry->size, KernelMode, &bytes
+                    );
+        }
+    }
+    else
+        DPRINT( "BlackBone: %s: BBLookupTarget failed with status 0x%X\n", __FUNCTION__, status );
 
     if (pProcess)
         ObDereferenceObject( pProcess );
@@ -352,6 +414,222 @@ NTSTATUS BBCopyMemory( IN PCOPY_MEMORY pCopy )
     return status;
 }
 
+#if defined(_WIN81_) || defined(_WIN10_)
+
+// KPROCESS::DirectoryTableBase, same on every supported x64 build
+#define KPROCESS_DIRECTORY_TABLE_BASE   0x28
+
+#define PHYS_PFN_MASK       0x000FFFFFFFFFF000ull
+#define PHYS_LARGE_1G_MASK  0x000FFFFFC0000000ull
+#define PHYS_LARGE_2M_MASK  0x000FFFFFFFE00000ull
+#define PHYS_PRESENT        0x1ull
+#define PHYS_LARGE          0x80ull
+
+/// <summary>
+/// Last used page table walk. Keys hold virtual address bits above the level
+/// </summary>
+typedef struct _PHYS_WALK_CACHE
+{
+    ULONGLONG dirBase;      // Process PML4 physical address
+    ULONGLONG pdKey;        // VA >> 30 of cached page directory
+    ULONGLONG pdBase;       // Page directory physical address
+    ULONGLONG ptKey;        // VA >> 21 of cached page table
+    ULONGLONG ptBase;       // Page table physical address, or 2MB page base if ptLarge
+    BOOLEAN ptLarge;        // PDE maps large page
+} PHYS_WALK_CACHE, *PPHYS_WALK_CACHE;
+
+/// <summary>
+/// Read single paging structure entry
+/// </summary>
+/// <param name="address">Entry physical address</param>
+/// <param name="pEntry">Entry value</param>
+/// <returns>Status code, STATUS_INVALID_ADDRESS if entry isn't present</returns>
+static NTSTATUS BBReadTableEntry( IN ULONGLONG address, OUT PULONGLONG pEntry )
+{
+    MM_COPY_ADDRESS source = { 0 };
+    SIZE_T bytes = 0;
+
+    source.PhysicalAddress.QuadPart = (LONGLONG)address;
+    NTSTATUS status = MmCopyMemory( pEntry, source, sizeof( *pEntry ), MM_COPY_MEMORY_PHYSICAL, &bytes );
+    if (NT_SUCCESS( status ) && (*pEntry & PHYS_PRESENT) == 0)
+        status = STATUS_INVALID_ADDRESS;
+
+    return status;
+}
+
+/// <summary>
+/// Translate virtual address of process described by cache
+/// </summary>
+/// <param name="pCache">Walk cache</param>
+/// <param name="va">Virtual address</param>
+/// <param name="pPhys">Physical address</param>
+/// <returns>Status code</returns>
+static NTSTATUS BBTranslateAddress( IN OUT PPHYS_WALK_CACHE pCache, IN ULONGLONG va, OUT PULONGLONG pPhys )
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    ULONGLONG entry = 0;
+
+    if ((va >> 21) != pCache->ptKey)
+    {
+        if ((va >> 30) != pCache->pdKey)
+        {
+            status = BBReadTableEntry( (pCache->dirBase & PHYS_PFN_MASK) + ((va >> 39) & 0x1FF) * sizeof( entry ), &entry );
+            if (NT_SUCCESS( status ))
+                status = BBReadTableEntry( (entry & PHYS_PFN_MASK) + ((va >> 30) & 0x1FF) * sizeof( entry ), &entry );
+
+            if (!NT_SUCCESS( status ))
+                return status;
+
+            // 1GB page
+            if (entry & PHYS_LARGE)
+            {
+                *pPhys = (entry & PHYS_LARGE_1G_MASK) + (va & 0x3FFFFFFF);
+                return STATUS_SUCCESS;
+            }
+
+            pCache->pdKey = va >> 30;
+            pCache->pdBase = entry & PHYS_PFN_MASK;
+        }
+
+        status = BBReadTableEntry( pCache->pdBase + ((va >> 21) & 0x1FF) * sizeof( entry ), &entry );
+        if (!NT_SUCCESS( status ))
+            return status;
+
+        pCache->ptKey = va >> 21;
+        pCache->ptLarge = (entry & PHYS_LARGE) != 0;
+        pCache->ptBase = pCache->ptLarge ? (entry & PHYS_LARGE_2M_MASK) : (entry & PHYS_PFN_MASK);
+    }
+
+    // 2MB page
+    if (pCache->ptLarge)
+    {
+        *pPhys = pCache->ptBase + (va & 0x1FFFFF);
+        return STATUS_SUCCESS;
+    }
+
+    status = BBReadTableEntry( pCache->ptBase + ((va >> 12) & 0x1FF) * sizeof( entry ), &entry );
+    if (NT_SUCCESS( status ))
+        *pPhys = (entry & PHYS_PFN_MASK) + (va & (PAGE_SIZE - 1));
+
+    return status;
+}
+
+/// <summary>
+/// Read single range through physical memory into caller buffer
+/// </summary>
+/// <param name="pCache">Walk cache</param>
+/// <param name="pEntry">Range</param>
+/// <param name="pPage">Page-sized bounce buffer</param>
+/// <returns>Status code</returns>
+static NTSTATUS BBReadPhysicalRange( IN OUT PPHYS_WALK_CACHE pCache, IN PCOPY_MEMORY_ENTRY pEntry, IN PUCHAR pPage )
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    ULONGLONG done = 0;
+
+    if (pEntry->write != FALSE)
+        return STATUS_NOT_SUPPORTED;
+
+    if (pEntry->targetPtr + pEntry->size < pEntry->targetPtr || pEntry->targetPtr + pEntry->size > (ULONGLONG)MM_HIGHEST_USER_ADDRESS)
+        return STATUS_INVALID_ADDRESS;
+
+    __try
+    {
+        ProbeForWrite( (PVOID)pEntry->localbuf, (SIZE_T)pEntry->size, 1 );
+    }
+    __except (EXCEPTION_EXECUTE_HANDLER)
+    {
+        return STATUS_ACCESS_VIOLATION;
+    }
+
+    // Chunks never cross page boundary, so every chunk is physically contiguous
+    while (done < pEntry->size && NT_SUCCESS( status ))
+    {
+        ULONGLONG va = pEntry->targetPtr + done;
+        ULONGLONG phys = 0;
+        SIZE_T chunk = (SIZE_T)min( pEntry->size - done, PAGE_SIZE - (va & (PAGE_SIZE - 1)) );
+        SIZE_T bytes = 0;
+        MM_COPY_ADDRESS source = { 0 };
+
+        status = BBTranslateAddress( pCache, va, &phys );
+        if (!NT_SUCCESS( status ))
+            break;
+
+        source.PhysicalAddress.QuadPart = (LONGLONG)phys;
+        status = MmCopyMemory( pPage, source, chunk, MM_COPY_MEMORY_PHYSICAL, &bytes );
+        if (!NT_SUCCESS( status ))
+            break;
+
+        __try
+        {
+            RtlCopyMemory( (PUCHAR)pEntry->localbuf + done, pPage, chunk );
+        }
+        __except (EXCEPTION_EXECUTE_HANDLER)
+        {
+            status = STATUS_ACCESS_VIOLATION;
+        }
+
+        done += chunk;
+    }
+
+    return status;
+}
+
+/// <summary>
+/// Read several ranges of one process through its page tables, without attach.
+/// Consecutive pages reuse cached upper level table entries
+/// </summary>
+/// <param name="pData">Request params, status of every entry is updated</param>
+/// <returns>Status code</returns>
+NTSTATUS BBReadPhysicalVector( IN OUT PCOPY_MEMORY_VECTOR pData )
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    PEPROCESS pProcess = NULL;
+    PUCHAR pPage = NULL;
+    PHYS_WALK_CACHE cache = { 0 };
+
+    status = BBLookupTarget( pData->pid, &pProcess );
+    if (!NT_SUCCESS( status ))
+    {
+        DPRINT( "BlackBone: %s: BBLookupTarget failed with status 0x%X\n", __FUNCTION__, status );
+        return status;
+    }
+
+    pPage = ExAllocatePoolWithTag( NonPagedPool, PAGE_SIZE, BB_POOL_TAG );
+    if (pPage == NULL)
+    {
+        ObDereferenceObject( pProcess );
+        return STATUS_NO_MEMORY;
+    }
+
+    // Tables are read while process is referenced, so they can't be freed
+    cache.dirBase = *(PULONGLONG)((PUCHAR)pProcess + KPROCESS_DIRECTORY_TABLE_BASE);
+    cache.pdKey = cache.ptKey = ~0ull;
+
+    for (ULONG i = 0; i < pData->count; i++)
+        pData->entries[i].status = BBReadPhysicalRange( &cache, &pData->entries[i], pPage );
+
+    ExFreePoolWithTag( pPage, BB_POOL_TAG );
+    ObDereferenceObject( pProcess );
+
+    return status;
+}
+
+#else
+
+/// <summary>
+/// Read several ranges of one process through its page tables, without attach.
+/// MmCopyMemory is unavailable before Windows 8.1
+/// </summary>
+/// <param name="pData">Request params</param>
+/// <returns>STATUS_NOT_SUPPORTED</returns>
+NTSTATUS BBReadPhysicalVector( IN OUT PCOPY_MEMORY_VECTOR pData )
+{
+    UNREFERENCED_PARAMETER( pData );
+    return STATUS_NOT_SUPPORTED;
+}
+
+#endif
+
 /// <summary>
 /// Allocate/Free process memory
 /// </summary>
@@ -367,7 +645,7 @@ NTSTATUS BBAllocateFreeMemory( IN PALLOCATE_FREE_MEMORY pAllocFree, OUT PALLOCAT
     if (pResult == NULL)
         return STATUS_INVALID_PARAMETER;
 
-    status = PsLookupProcessByProcessId( (HANDLE)pAllocFree->pid, &pProcess );
+    status = BBLookupTarget( pAllocFree->pid, &pProcess );
     if (NT_SUCCESS( status ))
     {
         KAPC_STATE apc;
@@ -384,7 +662,7 @@ NTSTATUS BBAllocateFreeMemory( IN PALLOCATE_FREE_MEMORY pAllocFree, OUT PALLOCAT
             }
             else
             {
-                status = ZwAllocateVirtualMemory( ZwCurrentProcess(), &base, 0, &size, pAllocFree->type, pAllocFree->protection );
+                status = BBAllocateVirtual( &base, &size, pAllocFree->type, pAllocFree->protection );
                 pResult->address = (ULONGLONG)base;
                 pResult->size = size;
             }
@@ -403,7 +681,7 @@ NTSTATUS BBAllocateFreeMemory( IN PALLOCATE_FREE_MEMORY pAllocFree, OUT PALLOCAT
         KeUnstackDetachProcess( &apc );        
     }
     else
-        DPRINT( "BlackBone: %s: PsLookupProcessByProcessId failed with status 0x%X\n", __FUNCTION__, status );
+        DPRINT( "BlackBone: %s: BBLookupTarget failed with status 0x%X\n", __FUNCTION__, status );
 
     if (pProcess)
         ObDereferenceObject( pProcess );
@@ -411,6 +689,101 @@ NTSTATUS BBAllocateFreeMemory( IN PALLOCATE_FREE_MEMORY pAllocFree, OUT PALLOCAT
     return status;
 }
 
+/// <summary>
+/// Allocate several regions of one process. Process is looked up and attached once
+/// </summary>
+/// <param name="pData">Request params, address, size and status of every entry are updated</param>
+/// <returns>Status code</returns>
+NTSTATUS BBAllocateMemoryBatch( IN OUT PALLOCATE_MEMORY_BATCH pData )
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    PEPROCESS pProcess = NULL;
+
+    status = BBLookupTarget( pData->pid, &pProcess );
+    if (NT_SUCCESS( status ))
+    {
+        KAPC_STATE apc;
+        KeStackAttachProcess( pProcess, &apc );
+
+        for (ULONG i = 0; i < pData->count; i++)
+        {
+            PALLOCATE_MEMORY_ENTRY pEntry = &pData->entries[i];
+
+            if (pEntry->physical != FALSE)
+            {
+                ALLOCATE_FREE_MEMORY request = { 0 };
+                ALLOCATE_FREE_MEMORY_RESULT result = { 0 };
+
+                request.pid = pData->pid;
+                request.base = pEntry->base;
+                request.size = pEntry->size;
+                request.protection = pEntry->protection;
+                request.type = pEntry->type;
+                request.allocate = TRUE;
+                request.physical = TRUE;
+
+                pEntry->status = BBAllocateFreePhysical( pProcess, &request, &result );
+                pEntry->base = result.address;
+                pEntry->size = result.size;
+            }
+            else
+            {
+                PVOID base = (PVOID)pEntry->base;
+                ULONG_PTR size = (ULONG_PTR)pEntry->size;
+
+                pEntry->status = BBAllocateVirtual( &base, &size, pEntry->type, pEntry->protection );
+                pEntry->base = NT_SUCCESS( pEntry->status ) ? (ULONGLONG)base : 0;
+                pEntry->size = NT_SUCCESS( pEntry->status ) ? size : 0;
+            }
+        }
+
+        KeUnstackDetachProcess( &apc );
+    }
+    else
+        DPRINT( "BlackBone: %s: BBLookupTarget failed with status 0x%X\n", __FUNCTION__, status );
+
+    if (pProcess)
+        ObDereferenceObject( pProcess );
+
+    return status;
+}
+
+/// <summary>
+/// Allocate virtual memory in current process.
+/// With MEM_LARGE_PAGES region is rounded up to large page size and committed at once.
+/// If large pages can't be used, regular pages are allocated instead
+/// </summary>
+/// <param name="pBase">Desired base, allocated base on success</param>
+/// <param name="pSize">Region size, allocated size on success</param>
+/// <param name="type">Allocation type</param>
+/// <param name="protection">Memory protection</param>
+/// <returns>Status code</returns>
+NTSTATUS BBAllocateVirtual( IN OUT PVOID* pBase, IN OUT PULONG_PTR pSize, IN ULONG type, IN ULONG protection )
+{
+    NTSTATUS status = STATUS_SUCCESS;
+
+    if (type & MEM_LARGE_PAGES)
+    {
+        PVOID base = *pBase;
+        ULONG_PTR size = ALIGN_UP_BY( *pSize, LARGE_PAGE_SIZE );
+
+        // Kernel caller skips SeLockMemoryPrivilege check, base must be large page aligned
+        status = ZwAllocateVirtualMemory( ZwCurrentProcess(), &base, 0, &size, type | MEM_RESERVE | MEM_COMMIT, protection );
+        if (NT_SUCCESS( status ))
+        {
+            *pBase = base;
+            *pSize = size;
+            return status;
+        }
+
+        // Not enough contiguous physical memory
+        DPRINT( "BlackBone: %s: Large page allocation failed with status 0x%X, using regular pages\n", __FUNCTION__, status );
+        type &= ~MEM_LARGE_PAGES;
+    }
+
+    return ZwAllocateVirtualMemory( ZwCurrentProcess(), pBase, 0, pSize, type, protection );
+}
+
 /// <summary>
 /// Allocate kernel memory and map into User space. Or free previously allocated memory
 /// </summary>
@@ -484,7 +857,7 @@ NTSTATUS BBAllocateFreePhysical( IN PEPROCESS pProcess, IN PALLOCATE_FREE_MEMORY
         if (pResult->address)
         {
             PMEM_PHYS_PROCESS_ENTRY pEntry = NULL;
-            PMEM_PHYS_ENTRY pMemEntry = NULL;
+            MEM_PHYS_ENTRY memEntry = { 0 };
 
             pResult->size = pAllocFree->size;
 
@@ -498,25 +871,23 @@ NTSTATUS BBAllocateFreePhysical( IN PEPROCESS pProcess, IN PALLOCATE_FREE_MEMORY
                     GetPTEForVA( (PVOID)pAdress )->u.Hard.NoExecute = 0;
             }
 
-            // Add to list
-            pEntry = BBLookupPhysProcessEntry( (HANDLE)pAllocFree->pid );
+            // Add to table
+            pEntry = BBLookupPhysProcessEntry( PsGetProcessId( pProcess ) );
             if (pEntry == NULL)
             {
                 pEntry = ExAllocatePoolWithTag( PagedPool, sizeof( MEM_PHYS_PROCESS_ENTRY ), BB_POOL_TAG );
-                pEntry->pid = (HANDLE)pAllocFree->pid;
+                pEntry->pid = PsGetProcessId( pProcess );
 
-                InitializeListHead( &pEntry->pVadList );
+                RtlInitializeGenericTableAvl( &pEntry->regions, &BBPhysEntryCompare, &AvlAllocate, &AvlFree, NULL );
                 InsertTailList( &g_PhysProcesses, &pEntry->link );
             }
 
-            pMemEntry = ExAllocatePoolWithTag( PagedPool, sizeof( MEM_PHYS_ENTRY ), BB_POOL_TAG );
-            
-            pMemEntry->pMapped = (PVOID)pResult->address;
-            pMemEntry->pMDL = pMDL;
-            pMemEntry->ptr = pRegionBase;
-            pMemEntry->size = pAllocFree->size;
+            memEntry.pMapped = (PVOID)pResult->address;
+            memEntry.pMDL = pMDL;
+            memEntry.ptr = pRegionBase;
+            memEntry.size = pAllocFree->size;
 
-            InsertTailList( &pEntry->pVadList, &pMemEntry->link );
+            RtlInsertElementGenericTableAvl( &pEntry->regions, &memEntry, sizeof( memEntry ), NULL );
         }
         else
         {
@@ -530,14 +901,14 @@ NTSTATUS BBAllocateFreePhysical( IN PEPROCESS pProcess, IN PALLOCATE_FREE_MEMORY
     // Free
     else
     {
-        PMEM_PHYS_PROCESS_ENTRY pEntry = BBLookupPhysProcessEntry( (HANDLE)pAllocFree->pid );
+        PMEM_PHYS_PROCESS_ENTRY pEntry = BBLookupPhysProcessEntry( PsGetProcessId( pProcess ) );
 
         if (pEntry != NULL)
         {
-            PMEM_PHYS_ENTRY pMemEntry = BBLookupPhysMemEntry( &pEntry->pVadList, (PVOID)pAllocFree->base );
+            PMEM_PHYS_ENTRY pMemEntry = BBLookupPhysMemEntry( &pEntry->regions, (PVOID)pAllocFree->base );
 
             if (pMemEntry != NULL)
-                BBCleanupPhysMemEntry( pMemEntry, TRUE );
+                BBCleanupPhysMemEntry( pEntry, pMemEntry, TRUE );
             else
                 status = STATUS_NOT_FOUND;
         }
@@ -548,6 +919,57 @@ NTSTATUS BBAllocateFreePhysical( IN PEPROCESS pProcess, IN PALLOCATE_FREE_MEMORY
     return status;
 }
 
+/// <summary>
+/// Change memory protection of a region. Must be called in context of target process
+/// </summary>
+/// <param name="pProcess">Target process</param>
+/// <param name="base">Region base address</param>
+/// <param name="size">Region size</param>
+/// <param name="newProtection">New protection value</param>
+/// <returns>Status code</returns>
+NTSTATUS BBProtectRegion( IN PEPROCESS pProcess, IN ULONGLONG base, IN ULONGLONG size, IN ULONG newProtection )
+{
+    MI_VAD_TYPE vadType = VadNone;
+
+    // Handle physical allocations
+    NTSTATUS status = BBGetVadType( pProcess, base, &vadType );
+    if (NT_SUCCESS( status ))
+    {
+        if (vadType == VadDevicePhysicalMemory)
+        {
+            // Align on page boundaries   
+            size = ADDRESS_AND_SIZE_TO_SPAN_PAGES( base, size ) << PAGE_SHIFT;
+            base = (ULONGLONG)PAGE_ALIGN( base );
+
+            status = BBProtectVAD( pProcess, base, BBConvertProtection( newProtection, FALSE ) );
+
+            // Update PTE
+            for (ULONG_PTR pAdress = base; pAdress < base + size; pAdress += PAGE_SIZE)
+            {
+                PMMPTE pPTE = GetPTEForVA( (PVOID)pAdress );
+
+                // Executable
+                if (newProtection & (PAGE_EXECUTE | PAGE_EXECUTE_READ | PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY))
+                    pPTE->u.Hard.NoExecute = 0;
+
+                // Read-only
+                if (newProtection & (PAGE_READONLY | PAGE_EXECUTE | PAGE_EXECUTE_READ))
+                    pPTE->u.Hard.Dirty1 = pPTE->u.Hard.Write = 0;
+            }
+        }
+        else
+        {
+            PVOID pBase = (PVOID)base;
+            SIZE_T regionSize = (SIZE_T)size;
+            ULONG oldProt = 0;
+
+            status = ZwProtectVirtualMemory( ZwCurrentProcess(), &pBase, &regionSize, newProtection, &oldProt );
+        }
+    }
+
+    return status;
+}
+
 /// <summary>
 /// Change process memory protection
 /// </summary>
@@ -558,51 +980,49 @@ NTSTATUS BBProtectMemory( IN PPROTECT_MEMORY pProtect )
     NTSTATUS status = STATUS_SUCCESS;
     PEPROCESS pProcess = NULL;
 
-    status = PsLookupProcessByProcessId( (HANDLE)pProtect->pid, &pProcess );
+    status = BBLookupTarget( pProtect->pid, &pProcess );
     if (NT_SUCCESS( status ))
     {
         KAPC_STATE apc;
-        MI_VAD_TYPE vadType = VadNone;
-        PVOID base = (PVOID)pProtect->base;
-        SIZE_T size = (SIZE_T)pProtect->size;
-        ULONG oldProt = 0;
 
         KeStackAttachProcess( pProcess, &apc );
+        status = BBProtectRegion( pProcess, pProtect->base, pProtect->size, pProtect->newProtection );
+        KeUnstackDetachProcess( &apc );
+    }
+    else
+        DPRINT( "BlackBone: %s: BBLookupTarget failed with status 0x%X\n", __FUNCTION__, status );
 
-        // Handle physical allocations
-        status = BBGetVadType( pProcess, pProtect->base, &vadType );
-        if (NT_SUCCESS( status ))
-        {
-            if (vadType == VadDevicePhysicalMemory)
-            {
-                // Align on page boundaries   
-                pProtect->base = (ULONGLONG)PAGE_ALIGN( pProtect->base );
-                pProtect->size = ADDRESS_AND_SIZE_TO_SPAN_PAGES( pProtect->base, pProtect->size ) << PAGE_SHIFT;
+    if (pProcess)
+        ObDereferenceObject( pProcess );
 
-                status = BBProtectVAD( pProcess, pProtect->base, BBConvertProtection( pProtect->newProtection, FALSE ) );
+    return status;
+}
 
-                // Update PTE
-                for (ULONG_PTR pAdress = pProtect->base; pAdress < pProtect->base + pProtect->size; pAdress += PAGE_SIZE)
-                {
-                    PMMPTE pPTE = GetPTEForVA( (PVOID)pAdress );
+/// <summary>
+/// Change protection of several memory regions under single process attach.
+/// Stops at first failed region
+/// </summary>
+/// <param name="pData">Request params</param>
+/// <returns>Status code</returns>
+NTSTATUS BBProtectMemoryBatch( IN PPROTECT_MEMORY_BATCH pData )
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    PEPROCESS pProcess = NULL;
 
-                    // Executable
-                    if (pProtect->newProtection & (PAGE_EXECUTE | PAGE_EXECUTE_READ | PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY))
-                        pPTE->u.Hard.NoExecute = 0;
+    status = BBLookupTarget( pData->pid, &pProcess );
+    if (NT_SUCCESS( status ))
+    {
+        KAPC_STATE apc;
 
-                    // Read-only
-                    if (pProtect->newProtection & (PAGE_READONLY | PAGE_EXECUTE | PAGE_EXECUTE_READ))
-                        pPTE->u.Hard.Dirty1 = pPTE->u.Hard.Write = 0;
-                }
-            }
-            else
-                status = ZwProtectVirtualMemory( ZwCurrentProcess(), &base, &size, pProtect->newProtection, &oldProt );
-        }
+        KeStackAttachProcess( pProcess, &apc );
+
+        for (ULONG i = 0; i < pData->count && NT_SUCCESS( status ); i++)
+            status = BBProtectRegion( pProcess, pData->entries[i].base, pData->entries[i].size, pData->entries[i].newProtection );
 
         KeUnstackDetachProcess( &apc );
     }
     else
-        DPRINT( "BlackBone: %s: PsLookupProcessByProcessId failed with status 0x%X\n", __FUNCTION__, status );
+        DPRINT( "BlackBone: %s: BBLookupTarget failed with status 0x%X\n", __FUNCTION__, status );
 
     if (pProcess)
         ObDereferenceObject( pProcess );
@@ -642,60 +1062,269 @@ NTSTATUS BBEnumMemRegions( IN PENUM_REGIONS pData, OUT PENUM_REGIONS_RESULT pRes
 {
     NTSTATUS status = STATUS_SUCCESS;
     PEPROCESS pProcess = NULL;
-    LIST_ENTRY memList;
+    ULONGLONG capacity = 0;
     ULONG totalCount = 0;
 
     ASSERT( pResult != NULL && pData != NULL && pData->pid != 0 );
     if (pResult == NULL || pData == NULL || pData->pid == 0)
         return STATUS_INVALID_PARAMETER;
 
-    InitializeListHead( &memList );
+    capacity = pResult->count;
 
-    status = PsLookupProcessByProcessId( (HANDLE)pData->pid, &pProcess );
+    status = BBLookupTarget( pData->pid, &pProcess );
     if (NT_SUCCESS( status ))
     {
         KAPC_STATE apc;
+        MEMORY_BASIC_INFORMATION mbi = { 0 };
+        SIZE_T length = 0;
+
         KeStackAttachProcess( pProcess, &apc );
-        status = BBBuildProcessRegionListForRange( &memList, (ULONG_PTR)MM_LOWEST_USER_ADDRESS, (ULONG_PTR)MM_HIGHEST_USER_ADDRESS, TRUE );
+
+        // Single pass: regions are copied while they fit, the rest is only counted
+        for (ULONG_PTR memptr = (ULONG_PTR)MM_LOWEST_USER_ADDRESS; memptr < (ULONG_PTR)MM_HIGHEST_USER_ADDRESS; memptr = (ULONG_PTR)mbi.BaseAddress + mbi.RegionSize)
+        {
+            // STATUS_INVALID_PARAMETER is a normal status for last secured VAD under Win7
+            if (!NT_SUCCESS( ZwQueryVirtualMemory( ZwCurrentProcess(), (PVOID)memptr, MemoryBasicInformation, &mbi, sizeof( mbi ), &length ) ))
+                break;
+
+            // Skip non-committed, no-access and guard pages
+            if (mbi.State != MEM_COMMIT || mbi.Protect == PAGE_NOACCESS || (mbi.Protect & PAGE_GUARD))
+                continue;
+
+            if (totalCount < capacity)
+            {
+                PMEM_REGION pRegion = &pResult->regions[totalCount];
+                pRegion->AllocationBase = (ULONGLONG)mbi.AllocationBase;
+                pRegion->AllocationProtect = mbi.AllocationProtect;
+                pRegion->BaseAddress = (ULONGLONG)mbi.BaseAddress;
+                pRegion->Protect = mbi.Protect;
+                pRegion->RegionSize = mbi.RegionSize;
+                pRegion->State = mbi.State;
+                pRegion->Type = mbi.Type;
+            }
+
+            totalCount++;
+        }
+
         KeUnstackDetachProcess( &apc );
+
+        // Not enough memory
+        pResult->count = totalCount;
+        if (capacity < totalCount)
+            status = STATUS_BUFFER_TOO_SMALL;
     }
+    else
+        DPRINT( "BlackBone: %s: BBLookupTarget failed with status 0x%X\n", __FUNCTION__, status );
+
+    if (pProcess)
+        ObDereferenceObject( pProcess );
+
+    return status;
+}
+
+/// <summary>
+/// Enumerate committed, accessible, non-guarded memory regions in single pass.
+/// Regions are written straight into output until it is full, no intermediate list is built
+/// </summary>
+/// <param name="pData">Target process ID and start address</param>
+/// <param name="pResult">Result, count holds capacity on input</param>
+/// <returns>Status code</returns>
+NTSTATUS BBEnumMemRegionsNext( IN PENUM_REGIONS_NEXT pData, IN OUT PENUM_REGIONS_NEXT_RESULT pResult )
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    PEPROCESS pProcess = NULL;
+    ULONGLONG capacity = 0;
+
+    ASSERT( pResult != NULL && pData != NULL && pData->pid != 0 );
+    if (pResult == NULL || pData == NULL || pData->pid == 0 || pResult->count == 0)
+        return STATUS_INVALID_PARAMETER;
 
+    capacity = pResult->count;
+    pResult->count = 0;
+    pResult->next = 0;
+
+    status = BBLookupTarget( pData->pid, &pProcess );
     if (NT_SUCCESS( status ))
     {
-        for (PLIST_ENTRY pListEntry = memList.Flink; pListEntry != &memList; pListEntry = pListEntry->Flink, totalCount++);
+        KAPC_STATE apc;
+        MEMORY_BASIC_INFORMATION mbi = { 0 };
+        SIZE_T length = 0;
+        ULONG_PTR start = (ULONG_PTR)MM_LOWEST_USER_ADDRESS;
 
-        // Not enough memory
-        if (pResult->count < totalCount)
+        if (pData->start > start)
+            start = (ULONG_PTR)pData->start;
+
+        // No attach required, tree is read through process object
+        if (pData->fromVad != FALSE)
         {
-            pResult->count = totalCount;
-            status = STATUS_BUFFER_TOO_SMALL;
+            status = BBEnumVAD( pProcess, start, pResult, capacity );
+            ObDereferenceObject( pProcess );
+            return status;
         }
-        // Copy from list to array
-        else
+
+        KeStackAttachProcess( pProcess, &apc );
+
+        for (ULONG_PTR memptr = start; memptr < (ULONG_PTR)MM_HIGHEST_USER_ADDRESS; memptr = (ULONG_PTR)mbi.BaseAddress + mbi.RegionSize)
         {
-            ULONG i = 0;
-            pResult->count = totalCount;
-            for (PLIST_ENTRY pListEntry = memList.Flink; pListEntry != &memList; pListEntry = pListEntry->Flink, i++)
+            PMEM_REGION pRegion = NULL;
+
+            // STATUS_INVALID_PARAMETER is a normal status for last secured VAD under Win7
+            if (!NT_SUCCESS( ZwQueryVirtualMemory( ZwCurrentProcess(), (PVOID)memptr, MemoryBasicInformation, &mbi, sizeof( mbi ), &length ) ))
+                break;
+
+            // Skip non-committed, no-access and guard pages
+            if (mbi.State != MEM_COMMIT || mbi.Protect == PAGE_NOACCESS || (mbi.Protect & PAGE_GUARD))
+                continue;
+
+            // Output is full, resume from this region
+            if (pResult->count == capacity)
             {
-                PMEMORY_BASIC_INFORMATION pMem = &CONTAINING_RECORD( pListEntry, MAP_ENTRY, link )->mem;
-                pResult->regions[i].AllocationBase = (ULONGLONG)pMem->AllocationBase;
-                pResult->regions[i].AllocationProtect = pMem->AllocationProtect;
-                pResult->regions[i].BaseAddress = (ULONGLONG)pMem->BaseAddress;
-                pResult->regions[i].Protect = pMem->Protect;
-                pResult->regions[i].RegionSize = pMem->RegionSize;
-                pResult->regions[i].State = pMem->State;
-                pResult->regions[i].Type = pMem->Type;
+                pResult->next = memptr;
+                break;
             }
+
+            pRegion = &pResult->regions[pResult->count++];
+            pRegion->AllocationBase = (ULONGLONG)mbi.AllocationBase;
+            pRegion->AllocationProtect = mbi.AllocationProtect;
+            pRegion->BaseAddress = (ULONGLONG)mbi.BaseAddress;
+            pRegion->Protect = mbi.Protect;
+            pRegion->RegionSize = mbi.RegionSize;
+            pRegion->State = mbi.State;
+            pRegion->Type = mbi.Type;
         }
+
+        KeUnstackDetachProcess( &apc );
     }
+    else
+        DPRINT( "BlackBone: %s: BBLookupTarget failed with status 0x%X\n", __FUNCTION__, status );
+
+    if (pProcess)
+        ObDereferenceObject( pProcess );
+
+    return status;
+}
+
+/// <summary>
+/// Scan single memory region of current process
+/// </summary>
+/// <param name="pData">Request params</param>
+/// <param name="pStart">Region start</param>
+/// <param name="size">Region size</param>
+/// <param name="pResult">Found addresses</param>
+/// <param name="capacity">Result buffer capacity</param>
+VOID BBScanRegion( IN PSCAN_MEMORY pData, IN PUCHAR pStart, IN SIZE_T size, IN OUT PSCAN_MEMORY_RESULT pResult, IN ULONGLONG capacity )
+{
+    const ULONG length = pData->length;
+    ULONG first = 0;
+
+    if (size < length)
+        return;
+
+    // First significant byte is used as anchor
+    while (first < length && pData->mask[first] == 0)
+        first++;
+
+    if (first == length)
+        return;
+
+    __try
+    {
+        ProbeForRead( pStart, size, 1 );
+
+        for (SIZE_T i = 0; i + length <= size;)
+        {
+            ULONG k = first;
+            if (pStart[i + first] == pData->pattern[first])
+            {
+                for (k = 0; k < length; k++)
+                    if ((pStart[i + k] ^ pData->pattern[k]) & pData->mask[k])
+                        break;
+            }
+
+            if (k == length)
+            {
+                if (pResult->count < capacity)
+                    pResult->addresses[pResult->count++] = (ULONGLONG)(pStart + i);
+
+                pResult->total++;
+                i += pData->useMask ? length : 1;
+            }
+            else
+                i++;
+        }
+    }
+    __except (EXCEPTION_EXECUTE_HANDLER)
+    {
+        DPRINT( "BlackBone: %s: Exception while scanning region 0x%p\n", __FUNCTION__, pStart );
+    }
+}
+
+/// <summary>
+/// Scan committed, accessible, non-guarded memory regions for pattern
+/// </summary>
+/// <param name="pData">Request params</param>
+/// <param name="pResult">Found addresses. On input count holds result buffer capacity</param>
+/// <returns>Status code</returns>
+NTSTATUS BBScanMemory( IN PSCAN_MEMORY pData, IN OUT PSCAN_MEMORY_RESULT pResult )
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    PEPROCESS pProcess = NULL;
+    ULONGLONG capacity = 0;
+
+    ASSERT( pResult != NULL && pData != NULL && pData->pid != 0 );
+    if (pResult == NULL || pData == NULL || pData->pid == 0 || pData->length == 0 || pData->length > BLACKBONE_MAX_PATTERN)
+        return STATUS_INVALID_PARAMETER;
+
+    capacity = pResult->count;
+    pResult->count = 0;
+    pResult->total = 0;
+
+    // Exact match
+    if (pData->useMask == FALSE)
+        RtlFillMemory( pData->mask, sizeof( pData->mask ), 0xFF );
 
-    // Cleanup list
-    while (!IsListEmpty( &memList ))
+    status = BBLookupTarget( pData->pid, &pProcess );
+    if (NT_SUCCESS( status ))
     {
-        PMAP_ENTRY ptr = CONTAINING_RECORD( memList.Flink, MAP_ENTRY, link );
-        RemoveEntryList( &ptr->link );
-        ExFreePoolWithTag( ptr, BB_POOL_TAG );
+        KAPC_STATE apc;
+        MEMORY_BASIC_INFORMATION mbi = { 0 };
+        SIZE_T length = 0;
+        ULONG_PTR start = (ULONG_PTR)MM_LOWEST_USER_ADDRESS;
+        ULONG_PTR end = (ULONG_PTR)MM_HIGHEST_USER_ADDRESS;
+
+        if (pData->minAddress > start)
+            start = (ULONG_PTR)pData->minAddress;
+        if (pData->maxAddress != 0 && pData->maxAddress < end)
+            end = (ULONG_PTR)pData->maxAddress;
+
+        KeStackAttachProcess( pProcess, &apc );
+
+        for (ULONG_PTR memptr = start; memptr < end; memptr = (ULONG_PTR)mbi.BaseAddress + mbi.RegionSize)
+        {
+            ULONG_PTR regionStart = 0, regionEnd = 0;
+
+            // STATUS_INVALID_PARAMETER is a normal status for last secured VAD under Win7
+            if (!NT_SUCCESS( ZwQueryVirtualMemory( ZwCurrentProcess(), (PVOID)memptr, MemoryBasicInformation, &mbi, sizeof( mbi ), &length ) ))
+                break;
+
+            // Skip non-committed, no-access and guard pages
+            if (mbi.State != MEM_COMMIT || mbi.Protect == PAGE_NOACCESS || (mbi.Protect & PAGE_GUARD))
+                continue;
+
+            if ((pData->protection != 0 && !(mbi.Protect & pData->protection)) || (pData->type != 0 && !(mbi.Type & pData->type)))
+                continue;
+
+            regionStart = max( memptr, (ULONG_PTR)mbi.BaseAddress );
+            regionEnd = min( end, (ULONG_PTR)mbi.BaseAddress + mbi.RegionSize );
+
+            if (regionStart < regionEnd)
+                BBScanRegion( pData, (PUCHAR)regionStart, regionEnd - regionStart, pResult, capacity );
+        }
+
+        KeUnstackDetachProcess( &apc );
     }
+    else
+        DPRINT( "BlackBone: %s: BBLookupTarget failed with status 0x%X\n", __FUNCTION__, status );
 
     if (pProcess)
         ObDereferenceObject( pProcess );
@@ -856,6 +1485,315 @@ NTSTATUS BBHookInline( IN PVOID origAddr, IN PVOID newAddr )
     return STATUS_SUCCESS;
 }
 
+/// <summary>
+/// Reference target process and create driver-side handle for it
+/// </summary>
+/// <param name="pData">Request params</param>
+/// <param name="pResult">Target handle</param>
+/// <returns>Status code</returns>
+NTSTATUS BBOpenTarget( IN POPEN_TARGET pData, OUT POPEN_TARGET_RESULT pResult )
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    PEPROCESS pProcess = NULL;
+    PTARGET_ENTRY pEntry = NULL;
+
+    status = PsLookupProcessByProcessId( (HANDLE)pData->pid, &pProcess );
+    if (!NT_SUCCESS( status ))
+    {
+        DPRINT( "BlackBone: %s: PsLookupProcessByProcessId failed with status 0x%X\n", __FUNCTION__, status );
+        return status;
+    }
+
+    // Exiting process won't trigger notify routine again
+    if (BBCheckProcessTermination( pProcess ))
+    {
+        ObDereferenceObject( pProcess );
+        return STATUS_PROCESS_IS_TERMINATING;
+    }
+
+    pEntry = ExAllocatePoolWithTag( PagedPool, sizeof( TARGET_ENTRY ), BB_POOL_TAG );
+    if (pEntry == NULL)
+    {
+        ObDereferenceObject( pProcess );
+        return STATUS_NO_MEMORY;
+    }
+
+    // Reference is kept until handle is closed
+    pEntry->handle = BLACKBONE_TARGET_HANDLE_FLAG | ((ULONG)InterlockedIncrement( &g_lastTarget ) & ~BLACKBONE_TARGET_HANDLE_FLAG);
+    pEntry->owner = PsGetCurrentProcessId();
+    pEntry->pid = (HANDLE)pData->pid;
+    pEntry->pProcess = pProcess;
+
+    KeAcquireGuardedMutex( &g_targetLock );
+    InsertTailList( &g_Targets, &pEntry->link );
+    KeReleaseGuardedMutex( &g_targetLock );
+
+    pResult->handle = pEntry->handle;
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Close target handle
+/// </summary>
+/// <param name="pData">Request params</param>
+/// <returns>Status code</returns>
+NTSTATUS BBCloseTarget( IN PCLOSE_TARGET pData )
+{
+    PTARGET_ENTRY pFound = NULL;
+
+    KeAcquireGuardedMutex( &g_targetLock );
+
+    for (PLIST_ENTRY pListEntry = g_Targets.Flink; pListEntry != &g_Targets; pListEntry = pListEntry->Flink)
+    {
+        PTARGET_ENTRY pEntry = CONTAINING_RECORD( pListEntry, TARGET_ENTRY, link );
+        if (pEntry->handle == pData->handle && pEntry->owner == PsGetCurrentProcessId())
+        {
+            RemoveEntryList( &pEntry->link );
+            pFound = pEntry;
+            break;
+        }
+    }
+
+    KeReleaseGuardedMutex( &g_targetLock );
+
+    if (pFound == NULL)
+        return STATUS_INVALID_HANDLE;
+
+    ObDereferenceObject( pFound->pProcess );
+    ExFreePoolWithTag( pFound, BB_POOL_TAG );
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Get referenced process object by PID or by target handle.
+/// Caller must dereference returned object
+/// </summary>
+/// <param name="pid">Process ID or handle returned by BBOpenTarget</param>
+/// <param name="ppProcess">Process object</param>
+/// <returns>Status code</returns>
+NTSTATUS BBLookupTarget( IN ULONG pid, OUT PEPROCESS* ppProcess )
+{
+    return BBLookupTargetForOwner( pid, PsGetCurrentProcessId(), ppProcess );
+}
+
+/// <summary>
+/// Get referenced process object by PID or by target handle opened by specific process.
+/// Caller must dereference returned object
+/// </summary>
+/// <param name="pid">Process ID or handle returned by BBOpenTarget</param>
+/// <param name="owner">Process that opened target handle</param>
+/// <param name="ppProcess">Process object</param>
+/// <returns>Status code</returns>
+NTSTATUS BBLookupTargetForOwner( IN ULONG pid, IN HANDLE owner, OUT PEPROCESS* ppProcess )
+{
+    NTSTATUS status = STATUS_INVALID_HANDLE;
+
+    if ((pid & BLACKBONE_TARGET_HANDLE_FLAG) == 0)
+        return PsLookupProcessByProcessId( (HANDLE)pid, ppProcess );
+
+    *ppProcess = NULL;
+
+    KeAcquireGuardedMutex( &g_targetLock );
+
+    for (PLIST_ENTRY pListEntry = g_Targets.Flink; pListEntry != &g_Targets; pListEntry = pListEntry->Flink)
+    {
+        PTARGET_ENTRY pEntry = CONTAINING_RECORD( pListEntry, TARGET_ENTRY, link );
+        if (pEntry->handle == pid && pEntry->owner == owner)
+        {
+            // Plain reference instead of CID table lookup
+            ObReferenceObject( pEntry->pProcess );
+            *ppProcess = pEntry->pProcess;
+            status = STATUS_SUCCESS;
+            break;
+        }
+    }
+
+    KeReleaseGuardedMutex( &g_targetLock );
+    return status;
+}
+
+/// <summary>
+/// Append module record if it fits into output
+/// </summary>
+/// <param name="pResult">Result</param>
+/// <param name="resultSize">Output buffer size</param>
+/// <param name="pOffset">Offset of next record, advanced even if record doesn't fit</param>
+/// <param name="base">Image base</param>
+/// <param name="ldrEntry">Loader entry address</param>
+/// <param name="size">Image size</param>
+/// <param name="name">Full image path</param>
+/// <param name="nameBytes">Path length in bytes</param>
+static VOID BBAppendModuleRecord(
+    IN OUT PENUM_MODULES_RESULT pResult, 
+    IN ULONG resultSize, 
+    IN OUT PULONG pOffset,
+    IN ULONGLONG base,
+    IN ULONGLONG ldrEntry,
+    IN ULONG size,
+    IN PWCH name,
+    IN USHORT nameBytes
+    )
+{
+    // Keep record size within USHORT
+    nameBytes = min( nameBytes, 0xFF00 ) & ~1;
+
+    ULONG recordSize = (ULONG)ALIGN_UP_BY( FIELD_OFFSET( MODULE_RECORD, name ) + nameBytes + sizeof( WCHAR ), 8 );
+    if (*pOffset + recordSize <= resultSize)
+    {
+        PMODULE_RECORD pRecord = (PMODULE_RECORD)((PUCHAR)pResult + *pOffset);
+
+        pRecord->base = base;
+        pRecord->ldrEntry = ldrEntry;
+        pRecord->size = size;
+        pRecord->recordSize = (USHORT)recordSize;
+        pRecord->nameLength = nameBytes / sizeof( WCHAR );
+
+        if (name != NULL)
+            RtlCopyMemory( pRecord->name, name, nameBytes );
+        else
+            pRecord->nameLength = 0;
+
+        pRecord->name[pRecord->nameLength] = L'\0';
+        pResult->count++;
+    }
+
+    *pOffset += recordSize;
+}
+
+/// <summary>
+/// Enumerate modules from process loader list in single attach.
+/// Records are packed into output while they fit, required size is always reported
+/// </summary>
+/// <param name="pData">Request params</param>
+/// <param name="pResult">Result</param>
+/// <param name="resultSize">Output buffer size</param>
+/// <returns>Status code</returns>
+NTSTATUS BBEnumModules( IN PENUM_MODULES pData, OUT PENUM_MODULES_RESULT pResult, IN ULONG resultSize )
+{
+    // Guard against looped lists
+    const ULONG maxModules = 0x10000;
+
+    NTSTATUS status = STATUS_SUCCESS;
+    PEPROCESS pProcess = NULL;
+    KAPC_STATE apc;
+    ULONG offset = FIELD_OFFSET( ENUM_MODULES_RESULT, records );
+    ULONG i = 0;
+
+    ASSERT( pData != NULL && pResult != NULL );
+    if (pData == NULL || pResult == NULL)
+        return STATUS_INVALID_PARAMETER;
+
+    pResult->count = 0;
+    pResult->required = offset;
+
+    status = BBLookupTarget( pData->pid, &pProcess );
+    if (!NT_SUCCESS( status ))
+    {
+        DPRINT( "BlackBone: %s: BBLookupTarget failed with status 0x%X\n", __FUNCTION__, status );
+        return status;
+    }
+
+    if (BBCheckProcessTermination( pProcess ))
+    {
+        ObDereferenceObject( pProcess );
+        return STATUS_PROCESS_IS_TERMINATING;
+    }
+
+    KeStackAttachProcess( pProcess, &apc );
+
+    // Protect from UserMode AV
+    __try
+    {
+        if (pData->x86 != FALSE)
+        {
+            PPEB32 pPeb32 = (PPEB32)PsGetProcessWow64Process( pProcess );
+            if (pPeb32 == NULL || pPeb32->Ldr == 0)
+            {
+                status = STATUS_NOT_FOUND;
+            }
+            else
+            {
+                PLIST_ENTRY32 pHead = &((PPEB_LDR_DATA32)pPeb32->Ldr)->InLoadOrderModuleList;
+                for (PLIST_ENTRY32 pListEntry = (PLIST_ENTRY32)pHead->Flink; pListEntry != pHead && i < maxModules; pListEntry = (PLIST_ENTRY32)pListEntry->Flink, i++)
+                {
+                    PLDR_DATA_TABLE_ENTRY32 pEntry = CONTAINING_RECORD( pListEntry, LDR_DATA_TABLE_ENTRY32, InLoadOrderLinks );
+                    BBAppendModuleRecord(
+                        pResult, resultSize, &offset, pEntry->DllBase, (ULONGLONG)pEntry, pEntry->SizeOfImage,
+                        (PWCH)(ULONG_PTR)pEntry->FullDllName.Buffer, pEntry->FullDllName.Length
+                        );
+                }
+            }
+        }
+        else
+        {
+            PPEB pPeb = PsGetProcessPeb( pProcess );
+            if (pPeb == NULL || pPeb->Ldr == NULL)
+            {
+                status = STATUS_NOT_FOUND;
+            }
+            else
+            {
+                PLIST_ENTRY pHead = &pPeb->Ldr->InLoadOrderModuleList;
+                for (PLIST_ENTRY pListEntry = pHead->Flink; pListEntry != pHead && i < maxModules; pListEntry = pListEntry->Flink, i++)
+                {
+                    PLDR_DATA_TABLE_ENTRY pEntry = CONTAINING_RECORD( pListEntry, LDR_DATA_TABLE_ENTRY, InLoadOrderLinks );
+                    BBAppendModuleRecord(
+                        pResult, resultSize, &offset, (ULONGLONG)pEntry->DllBase, (ULONGLONG)pEntry, pEntry->SizeOfImage,
+                        pEntry->FullDllName.Buffer, pEntry->FullDllName.Length
+                        );
+                }
+            }
+        }
+    }
+    __except (EXCEPTION_EXECUTE_HANDLER)
+    {
+        DPRINT( "BlackBone: %s: Exception, Code: 0x%X\n", __FUNCTION__, GetExceptionCode() );
+        status = STATUS_ACCESS_VIOLATION;
+    }
+
+    KeUnstackDetachProcess( &apc );
+    ObDereferenceObject( pProcess );
+
+    pResult->required = offset;
+    return status;
+}
+
+/// <summary>
+/// Close target handles that refer to or were opened by process
+/// </summary>
+/// <param name="pid">Exited process ID. NULL to close all handles</param>
+VOID BBCleanupTargets( IN HANDLE pid )
+{
+    LIST_ENTRY removed;
+    InitializeListHead( &removed );
+
+    KeAcquireGuardedMutex( &g_targetLock );
+
+    for (PLIST_ENTRY pListEntry = g_Targets.Flink; pListEntry != &g_Targets;)
+    {
+        PTARGET_ENTRY pEntry = CONTAINING_RECORD( pListEntry, TARGET_ENTRY, link );
+        pListEntry = pListEntry->Flink;
+
+        if (pid == NULL || pEntry->pid == pid || pEntry->owner == pid)
+        {
+            RemoveEntryList( &pEntry->link );
+            InsertTailList( &removed, &pEntry->link );
+        }
+    }
+
+    KeReleaseGuardedMutex( &g_targetLock );
+
+    // Last reference may free process object, so don't hold the lock
+    while (!IsListEmpty( &removed ))
+    {
+        PTARGET_ENTRY pEntry = CONTAINING_RECORD( RemoveHeadList( &removed ), TARGET_ENTRY, link );
+
+        ObDereferenceObject( pEntry->pProcess );
+        ExFreePoolWithTag( pEntry, BB_POOL_TAG );
+    }
+}
+
 /// <summary>
 /// Find memory allocation process entry
 /// </summary>
@@ -877,33 +1815,54 @@ PMEM_PHYS_PROCESS_ENTRY BBLookupPhysProcessEntry( IN HANDLE pid )
 /// <summary>
 /// Find allocated memory region entry
 /// </summary>
-/// <param name="pList">Region list</param>
-/// <param name="pBase">Region base</param>
+/// <param name="pTable">Region table</param>
+/// <param name="pBase">Any address inside region</param>
 /// <returns>Found entry, NULL if not found</returns>
-PMEM_PHYS_ENTRY BBLookupPhysMemEntry( IN PLIST_ENTRY pList, IN PVOID pBase )
+PMEM_PHYS_ENTRY BBLookupPhysMemEntry( IN PRTL_AVL_TABLE pTable, IN PVOID pBase )
 {
-    ASSERT( pList != NULL );
-    if (pList == NULL)
+    MEM_PHYS_ENTRY key = { 0 };
+
+    ASSERT( pTable != NULL );
+    if (pTable == NULL)
         return NULL;
 
-    for (PLIST_ENTRY pListEntry = pList->Flink; pListEntry != pList; pListEntry = pListEntry->Flink)
-    {
-        PMEM_PHYS_ENTRY pEntry = CONTAINING_RECORD( pListEntry, MEM_PHYS_ENTRY, link );
-        if (pBase >= pEntry->pMapped && pBase < (PVOID)((ULONG_PTR)pEntry->pMapped + pEntry->size))
-            return pEntry;
-    }
+    // Single byte range matches region that contains it
+    key.pMapped = pBase;
+    key.size = 1;
 
-    return NULL;
+    return (PMEM_PHYS_ENTRY)RtlLookupElementGenericTableAvl( pTable, &key );
+}
+
+/// <summary>
+/// Order physical regions by address. Overlapping ranges are equal
+/// </summary>
+/// <param name="Table">Region table</param>
+/// <param name="FirstStruct">First region</param>
+/// <param name="SecondStruct">Second region</param>
+/// <returns>Compare result</returns>
+RTL_GENERIC_COMPARE_RESULTS BBPhysEntryCompare( IN RTL_AVL_TABLE *Table, IN PVOID FirstStruct, IN PVOID SecondStruct )
+{
+    UNREFERENCED_PARAMETER( Table );
+    PMEM_PHYS_ENTRY pFirst = (PMEM_PHYS_ENTRY)FirstStruct;
+    PMEM_PHYS_ENTRY pSecond = (PMEM_PHYS_ENTRY)SecondStruct;
+
+    if ((ULONG_PTR)pFirst->pMapped + pFirst->size <= (ULONG_PTR)pSecond->pMapped)
+        return GenericLessThan;
+
+    if ((ULONG_PTR)pSecond->pMapped + pSecond->size <= (ULONG_PTR)pFirst->pMapped)
+        return GenericGreaterThan;
+
+    return GenericEqual;
 }
 
 //
 // Cleanup routines
 //
 
-void BBCleanupPhysMemEntry( IN PMEM_PHYS_ENTRY pEntry, BOOLEAN attached )
+void BBCleanupPhysMemEntry( IN PMEM_PHYS_PROCESS_ENTRY pProcessEntry, IN PMEM_PHYS_ENTRY pEntry, BOOLEAN attached )
 {
-    ASSERT( pEntry != NULL );
-    if (pEntry == NULL)
+    ASSERT( pProcessEntry != NULL && pEntry != NULL );
+    if (pProcessEntry == NULL || pEntry == NULL)
         return;
 
     if (attached)
@@ -912,8 +1871,8 @@ void BBCleanupPhysMemEntry( IN PMEM_PHYS_ENTRY pEntry, BOOLEAN attached )
     IoFreeMdl( pEntry->pMDL );
     ExFreePoolWithTag( pEntry->ptr, BB_POOL_TAG );
 
-    RemoveEntryList( &pEntry->link );
-    ExFreePoolWithTag( pEntry, BB_POOL_TAG );
+    // Entry memory is owned by table
+    RtlDeleteElementGenericTableAvl( &pProcessEntry->regions, pEntry );
 }
 
 void BBCleanupProcessPhysEntry( IN PMEM_PHYS_PROCESS_ENTRY pEntry, BOOLEAN attached )
@@ -922,8 +1881,12 @@ void BBCleanupProcessPhysEntry( IN PMEM_PHYS_PROCESS_ENTRY pEntry, BOOLEAN attac
     if (pEntry == NULL)
         return;
 
-    while (!IsListEmpty( &pEntry->pVadList ))
-        BBCleanupPhysMemEntry( (PMEM_PHYS_ENTRY)pEntry->pVadList.Flink, attached );
+    for (PMEM_PHYS_ENTRY pMemEntry = RtlGetElementGenericTableAvl( &pEntry->regions, 0 );
+         pMemEntry != NULL;
+         pMemEntry = RtlGetElementGenericTableAvl( &pEntry->regions, 0 ))
+    {
+        BBCleanupPhysMemEntry( pEntry, pMemEntry, attached );
+    }
 
     RemoveEntryList( &pEntry->link );
     ExFreePoolWithTag( pEntry, BB_POOL_TAG );
@@ -9,7 +9,6 @@
 /// </summary>
 typedef struct _MEM_PHYS_ENTRY
 {
-    LIST_ENTRY link;
     ULONG_PTR size;     // Region size
     PVOID pMapped;      // Mapped address
     PMDL pMDL;          // Related MDL
@@ -23,11 +22,26 @@ typedef struct _MEM_PHYS_PROCESS_ENTRY
 {
     LIST_ENTRY link;
     HANDLE pid;             // Process ID
-    LIST_ENTRY pVadList;    // List of mapped regions
+    RTL_AVL_TABLE regions;  // Mapped regions, ordered by address
 } MEM_PHYS_PROCESS_ENTRY, *PMEM_PHYS_PROCESS_ENTRY;
 
 extern LIST_ENTRY g_PhysProcesses;
 
+/// <summary>
+/// Referenced target process, see IOCTL_BLACKBONE_OPEN_TARGET
+/// </summary>
+typedef struct _TARGET_ENTRY
+{
+    LIST_ENTRY link;
+    ULONG handle;           // Driver-side handle
+    HANDLE owner;           // Process that opened the target
+    HANDLE pid;             // Target process ID
+    PEPROCESS pProcess;     // Referenced target process object
+} TARGET_ENTRY, *PTARGET_ENTRY;
+
+extern LIST_ENTRY g_Targets;
+extern KGUARDED_MUTEX g_targetLock;
+
 
 /// <summary>
 /// Disable process DEP
@@ -59,6 +73,13 @@ NTSTATUS BBGrantAccess( IN PHANDLE_GRANT_ACCESS pAccess );
 /// <returns>Status code</returns>
 NTSTATUS BBAllocateFreeMemory( IN PALLOCATE_FREE_MEMORY pAllocFree, OUT PALLOCATE_FREE_MEMORY_RESULT pResult );
 
+/// <summary>
+/// Allocate several regions of one process. Process is looked up and attached once
+/// </summary>
+/// <param name="pData">Request params, address, size and status of every entry are updated</param>
+/// <returns>Status code</returns>
+NTSTATUS BBAllocateMemoryBatch( IN OUT PALLOCATE_MEMORY_BATCH pData );
+
 /// <summary>
 /// Read/write process memory
 /// </summary>
@@ -66,6 +87,21 @@ NTSTATUS BBAllocateFreeMemory( IN PALLOCATE_FREE_MEMORY pAllocFree, OUT PALLOCAT
 /// <returns>Status code</returns>
 NTSTATUS BBCopyMemory( IN PCOPY_MEMORY pCopy );
 
+/// <summary>
+/// Read/write several ranges of one process. Process is looked up once
+/// </summary>
+/// <param name="pData">Request params, status of every entry is updated</param>
+/// <returns>Status code</returns>
+NTSTATUS BBCopyMemoryVector( IN OUT PCOPY_MEMORY_VECTOR pData );
+
+/// <summary>
+/// Read several ranges of one process through its page tables, without attach.
+/// Consecutive pages reuse cached upper level table entries
+/// </summary>
+/// <param name="pData">Request params, status of every entry is updated</param>
+/// <returns>Status code</returns>
+NTSTATUS BBReadPhysicalVector( IN OUT PCOPY_MEMORY_VECTOR pData );
+
 /// <summary>
 /// Change process memory protection
 /// </summary>
@@ -73,6 +109,14 @@ NTSTATUS BBCopyMemory( IN PCOPY_MEMORY pCopy );
 /// <returns>Status code</returns>
 NTSTATUS BBProtectMemory( IN PPROTECT_MEMORY pProtect );
 
+/// <summary>
+/// Change protection of several memory regions under single process attach.
+/// Stops at first failed region
+/// </summary>
+/// <param name="pData">Request params</param>
+/// <returns>Status code</returns>
+NTSTATUS BBProtectMemoryBatch( IN PPROTECT_MEMORY_BATCH pData );
+
 /// <summary>
 /// Hide VAD containing target address
 /// </summary>
@@ -88,6 +132,23 @@ NTSTATUS BBHideVAD( IN PHIDE_VAD pData );
 /// <returns>Status code</returns>
 NTSTATUS BBEnumMemRegions( IN PENUM_REGIONS pData, OUT PENUM_REGIONS_RESULT pResult );
 
+/// <summary>
+/// Enumerate committed, accessible, non-guarded memory regions in single pass.
+/// Regions are written straight into output until it is full, no intermediate list is built
+/// </summary>
+/// <param name="pData">Target process ID and start address</param>
+/// <param name="pResult">Result, count holds capacity on input</param>
+/// <returns>Status code</returns>
+NTSTATUS BBEnumMemRegionsNext( IN PENUM_REGIONS_NEXT pData, IN OUT PENUM_REGIONS_NEXT_RESULT pResult );
+
+/// <summary>
+/// Scan committed, accessible, non-guarded memory regions for pattern
+/// </summary>
+/// <param name="pData">Request params</param>
+/// <param name="pResult">Found addresses. On input count holds result buffer capacity</param>
+/// <returns>Status code</returns>
+NTSTATUS BBScanMemory( IN PSCAN_MEMORY pData, IN OUT PSCAN_MEMORY_RESULT pResult );
+
 /// <summary>
 /// Inject dll into process
 /// </summary>
@@ -96,6 +157,14 @@ NTSTATUS BBEnumMemRegions( IN PENUM_REGIONS pData, OUT PENUM_REGIONS_RESULT pRes
 /// <returns>Status code</returns>
 NTSTATUS BBInjectDll( IN PINJECT_DLL pData );
 
+/// <summary>
+/// Inject same dll into several processes.
+/// LdrLoadDll is resolved once per ntdll flavor and injection buffer is built once per flavor
+/// </summary>
+/// <param name="pData">Request params, status of every entry is updated</param>
+/// <returns>Status code</returns>
+NTSTATUS BBInjectDllBatch( IN OUT PINJECT_DLL_BATCH pData );
+
 /// <summary>
 /// Change handle granted access
 /// </summary>
@@ -130,6 +199,72 @@ NTSTATUS BBHookInline( IN PVOID origAddr, IN PVOID newAddr );
 /// <param name="Create">TRUE if process was created</param>
 VOID BBProcessNotify( IN HANDLE ParentId, IN HANDLE ProcessId, IN BOOLEAN Create );
 
+/// <summary>
+/// Thread creation and termination handler
+/// </summary>
+/// <param name="ProcessId">PID</param>
+/// <param name="ThreadId">TID</param>
+/// <param name="Create">TRUE if thread was created</param>
+VOID BBThreadNotify( IN HANDLE ProcessId, IN HANDLE ThreadId, IN BOOLEAN Create );
+
+/// <summary>
+/// Image load handler
+/// </summary>
+/// <param name="FullImageName">Image path, can be NULL</param>
+/// <param name="ProcessId">PID, 0 for driver images</param>
+/// <param name="ImageInfo">Image info</param>
+VOID BBImageNotify( IN PUNICODE_STRING FullImageName, IN HANDLE ProcessId, IN PIMAGE_INFO ImageInfo );
+
+/// <summary>
+/// Reference target process and create driver-side handle for it
+/// </summary>
+/// <param name="pData">Request params</param>
+/// <param name="pResult">Target handle</param>
+/// <returns>Status code</returns>
+NTSTATUS BBOpenTarget( IN POPEN_TARGET pData, OUT POPEN_TARGET_RESULT pResult );
+
+/// <summary>
+/// Close target handle
+/// </summary>
+/// <param name="pData">Request params</param>
+/// <returns>Status code</returns>
+NTSTATUS BBCloseTarget( IN PCLOSE_TARGET pData );
+
+/// <summary>
+/// Get referenced process object by PID or by target handle.
+/// Caller must dereference returned object
+/// </summary>
+/// <param name="pid">Process ID or handle returned by BBOpenTarget</param>
+/// <param name="ppProcess">Process object</param>
+/// <returns>Status code</returns>
+NTSTATUS BBLookupTarget( IN ULONG pid, OUT PEPROCESS* ppProcess );
+
+/// <summary>
+/// Get referenced process object by PID or by target handle opened by specific process.
+/// Caller must dereference returned object
+/// </summary>
+/// <param name="pid">Process ID or handle returned by BBOpenTarget</param>
+/// <param name="owner">Process that opened target handle</param>
+/// <param name="ppProcess">Process object</param>
+/// <returns>Status code</returns>
+NTSTATUS BBLookupTargetForOwner( IN ULONG pid, IN HANDLE owner, OUT PEPROCESS* ppProcess );
+
+/// <summary>
+/// Enumerate modules from process loader list in single attach.
+/// Records are packed into output while they fit, required size is always reported
+/// </summary>
+/// <param name="pData">Request params</param>
+/// <param name="pResult">Result</param>
+/// <param name="resultSize">Output buffer size</param>
+/// <returns>Status code</returns>
+NTSTATUS BBEnumModules( IN PENUM_MODULES pData, OUT PENUM_MODULES_RESULT pResult, IN ULONG resultSize );
+
+/// <summary>
+/// Close target handles that refer to or were opened by process
+/// </summary>
+/// <param name="pid">Exited process ID. NULL to close all handles</param>
+VOID BBCleanupTargets( IN HANDLE pid );
+
 /// <summary>
 /// Find memory allocation process entry
 /// </summary>
@@ -150,6 +285,6 @@ NTSTATUS BBAllocateFreePhysical( IN PEPROCESS pProcess, IN PALLOCATE_FREE_MEMORY
 //
 // Memory allocation cleanup routines
 //
-void BBCleanupPhysMemEntry( IN PMEM_PHYS_ENTRY pEntry, BOOLEAN attached );
+void BBCleanupPhysMemEntry( IN PMEM_PHYS_PROCESS_ENTRY pProcessEntry, IN PMEM_PHYS_ENTRY pEntry, BOOLEAN attached );
 void BBCleanupProcessPhysEntry( IN PMEM_PHYS_PROCESS_ENTRY pEntry, BOOLEAN attached );
 void BBCleanupProcessPhysList();
@@ -5,6 +5,7 @@
 #pragma alloc_text(PAGE, BBUnlinkVAD)
 #pragma alloc_text(PAGE, BBGetVadType)
 #pragma alloc_text(PAGE, BBFindVAD)
+#pragma alloc_text(PAGE, BBEnumVAD)
 
 extern DYNAMIC_DATA dynData;
 
@@ -168,6 +169,120 @@ NTSTATUS BBFindVAD( IN PEPROCESS pProcess, IN ULONG_PTR address, OUT PMMVAD_SHOR
     return status;
 }
 
+/// <summary>
+/// Get VAD page range
+/// </summary>
+/// <param name="pVad">VAD</param>
+/// <param name="pStart">First page number</param>
+/// <param name="pEnd">Last page number, inclusive</param>
+static VOID BBGetVadRange( IN PMMVAD_SHORT pVad, OUT PULONG_PTR pStart, OUT PULONG_PTR pEnd )
+{
+    *pStart = pVad->StartingVpn;
+    *pEnd = pVad->EndingVpn;
+
+#if defined( _WIN81_ ) || defined( _WIN10_ )
+    *pStart |= (ULONG_PTR)pVad->StartingVpnHigh << 32;
+    *pEnd |= (ULONG_PTR)pVad->EndingVpnHigh << 32;
+#endif
+}
+
+/// <summary>
+/// Enumerate process allocations straight from VAD tree, one record per VAD.
+/// Records are written into output in address order, no pool memory is used
+/// </summary>
+/// <param name="pProcess">Target process object</param>
+/// <param name="start">Address to start from</param>
+/// <param name="pResult">Result, 'next' is set if output was filled before tree end</param>
+/// <param name="capacity">Output capacity in records</param>
+/// <returns>Status code</returns>
+NTSTATUS BBEnumVAD( IN PEPROCESS pProcess, IN ULONG_PTR start, IN OUT PENUM_REGIONS_NEXT_RESULT pResult, IN ULONGLONG capacity )
+{
+    // AVL tree depth never exceeds 1.44 * log2(N)
+    PMMADDRESS_NODE stack[64] = { 0 };
+    ULONG depth = 0;
+    ULONG_PTR vpnStart = start >> PAGE_SHIFT;
+    ULONG_PTR vadStart = 0, vadEnd = 0;
+
+    ASSERT( pProcess != NULL && pResult != NULL );
+    if (pProcess == NULL || pResult == NULL)
+        return STATUS_INVALID_PARAMETER;
+
+    if (dynData.VadRoot == 0)
+    {
+        DPRINT( "BlackBone: %s: Invalid VadRoot offset\n", __FUNCTION__ );
+        return STATUS_INVALID_ADDRESS;
+    }
+
+    PMM_AVL_TABLE pTable = (PMM_AVL_TABLE)((PUCHAR)pProcess + dynData.VadRoot);
+    if (pTable->NumberGenericTableElements == 0)
+        return STATUS_SUCCESS;
+
+    PMMADDRESS_NODE pRoot = (PMMADDRESS_NODE)GET_VAD_ROOT( pTable );
+
+#if defined( _WIN7_ )
+    // Table root is a sentinel, real tree hangs on its right
+    pRoot = pRoot->RightChild;
+#endif
+
+    // Descend to first VAD that ends at or above start, keeping the path of pending nodes
+    for (PMMADDRESS_NODE pNode = pRoot; pNode != NULL;)
+    {
+        BBGetVadRange( (PMMVAD_SHORT)pNode, &vadStart, &vadEnd );
+        if (vadEnd >= vpnStart)
+        {
+            if (depth == ARRAYSIZE( stack ))
+                return STATUS_INTERNAL_ERROR;
+
+            stack[depth++] = pNode;
+            pNode = pNode->LeftChild;
+        }
+        else
+            pNode = pNode->RightChild;
+    }
+
+    // In-order walk
+    while (depth > 0)
+    {
+        PMMVAD_SHORT pVad = (PMMVAD_SHORT)stack[--depth];
+        PMEM_REGION pRegion = NULL;
+
+        BBGetVadRange( pVad, &vadStart, &vadEnd );
+
+        // Output is full, resume from this VAD
+        if (pResult->count == capacity)
+        {
+            pResult->next = vadStart << PAGE_SHIFT;
+            break;
+        }
+
+        pRegion = &pResult->regions[pResult->count++];
+        pRegion->BaseAddress = vadStart << PAGE_SHIFT;
+        pRegion->AllocationBase = pRegion->BaseAddress;
+        pRegion->RegionSize = (vadEnd - vadStart + 1) << PAGE_SHIFT;
+        pRegion->AllocationProtect = BBConvertProtection( pVad->u.VadFlags.Protection, TRUE );
+        pRegion->Protect = pRegion->AllocationProtect;
+        pRegion->State = 0;
+
+        if (pVad->u.VadFlags.VadType == VadImageMap)
+            pRegion->Type = MEM_IMAGE;
+        else if (pVad->u.VadFlags.PrivateMemory)
+            pRegion->Type = MEM_PRIVATE;
+        else
+            pRegion->Type = MEM_MAPPED;
+
+        // Right subtree follows current node
+        for (PMMADDRESS_NODE pNode = ((PMMADDRESS_NODE)pVad)->RightChild; pNode != NULL; pNode = pNode->LeftChild)
+        {
+            if (depth == ARRAYSIZE( stack ))
+                return STATUS_INTERNAL_ERROR;
+
+            stack[depth++] = pNode;
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
 /// <summary>
 /// Convert protection flags
 /// </summary>
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Private.h"
+#include "BlackBoneDef.h"
 
 /// <summary>
 /// Change VAD protection flags
@@ -43,4 +44,15 @@ NTSTATUS BBFindVAD( IN PEPROCESS pProcess, IN ULONG_PTR address, OUT PMMVAD_SHOR
 /// <param name="prot">Protection flags.</param>
 /// <param name="fromPTE">If TRUE - convert to PTE protection, if FALSE - convert to Win32 protection</param>
 /// <returns>Resulting protection flags</returns>
-ULONG BBConvertProtection( IN ULONG prot, IN BOOLEAN fromPTE );
\ No newline at end of file
+ULONG BBConvertProtection( IN ULONG prot, IN BOOLEAN fromPTE );
+
+/// <summary>
+/// Enumerate process allocations straight from VAD tree, one record per VAD.
+/// Records are written into output in address order, no pool memory is used
+/// </summary>
+/// <param name="pProcess">Target process object</param>
+/// <param name="start">Address to start from</param>
+/// <param name="pResult">Result, 'next' is set if output was filled before tree end</param>
+/// <param name="capacity">Output capacity in records</param>
+/// <returns>Status code</returns>
+NTSTATUS BBEnumVAD( IN PEPROCESS pProcess, IN ULONG_PTR start, IN OUT PENUM_REGIONS_NEXT_RESULT pResult, IN ULONGLONG capacity );
@@ -1,17 +1,48 @@
 #pragma once
 #include <BlackBone/Config.h>
 #include <BlackBone/Process/Process.h>
+#include <BlackBone/Process/ProcessPool.h>
 #include <BlackBone/Process/MultPtr.hpp>
+#include <BlackBone/Process/PtrChain.h>
+#include <BlackBone/Process/PointerMap.h>
+#include <BlackBone/Process/AsyncMemory.h>
+#include <BlackBone/Process/MemorySnapshot.h>
+#include <BlackBone/Process/MappedView.hpp>
+#include <BlackBone/Process/ProcessDumper.h>
+#include <BlackBone/Process/ProcessHeaps.h>
 #include <BlackBone/Process/RPC/RemoteFunction.hpp>
 #include <BlackBone/PE/PEImage.h>
+#include <BlackBone/PE/PECollection.h>
+#include <BlackBone/PE/ImageCache.h>
+#include <BlackBone/Symbols/SymbolCache.h>
+#include <BlackBone/Symbols/SymbolResolver.h>
+#include <BlackBone/PE/RelocTable.h>
+#include <BlackBone/PE/NetMetadata.h>
+#include <BlackBone/ManualMap/ImageBundle.h>
 #include <BlackBone/Misc/Utils.h>
+#include <BlackBone/Misc/Trace.hpp>
+#include <BlackBone/Misc/MemoryResource.h>
+#include <BlackBone/Misc/Task.h>
+#include <BlackBone/Misc/AddressMap.hpp>
+#include <BlackBone/Misc/StackWalker.h>
 #include <BlackBone/Misc/DynImport.h>
 #include <BlackBone/Syscalls/Syscall.h>
+#include <BlackBone/Subsystem/Wow64Subsystem.h>
 #include <BlackBone/Patterns/PatternSearch.h>
+#include <BlackBone/Patterns/FileScanner.h>
+#include <BlackBone/Patterns/Signature.hpp>
+#include <BlackBone/Patterns/ValueScanner.h>
+#include <BlackBone/Patterns/StringExtractor.h>
 #include <BlackBone/Asm/LDasm.h>
+#include <BlackBone/Asm/LDasmCache.h>
+#include <BlackBone/Asm/CodeRelocator.h>
+#include <BlackBone/Asm/StubTemplate.h>
 #include <BlackBone/localHook/VTableHook.hpp>
+#include <BlackBone/LocalHook/StaticHook.hpp>
 
 #include <iostream>
+#include <thread>
+#include <atomic>
 #include <CppUnitTest.h>
 
 using namespace Microsoft::VisualStudio::CppUnitTestFramework;
@@ -88,5 +88,158 @@ namespace Testing
             AssertEx::AreEqual( static_cast<DWORD>(sizeof( readBuf )), bytes );
             AssertEx::IsZero( memcmp( writeBuf, readBuf, sizeof( readBuf ) ) );
         }
+
+        TEST_METHOD( Reuse )
+        {
+            IAsmHelper* first = nullptr;
+            {
+                auto asmPtr = AsmFactory::GetAssembler();
+                first = asmPtr.get();
+
+                (*asmPtr)->nop();
+                asmPtr->EnableX64CallStack( false );
+            }
+
+            // Released generator is reset and handed out again
+            auto asmPtr = AsmFactory::GetAssembler();
+            auto& a = *asmPtr;
+
+            AssertEx::AreEqual( reinterpret_cast<uintptr_t>(first), reinterpret_cast<uintptr_t>(asmPtr.get()) );
+            AssertEx::AreEqual( size_t( 0 ), a->getCodeSize() );
+
+            a.GenPrologue();
+            a->mov( a->zax, a->zcx );
+            a.GenEpilogue();
+
+            auto func = reinterpret_cast<intptr_t( __fastcall* )(intptr_t)>(a->make());
+            AssertEx::AreEqual( intptr_t( 7 ), func( 7 ) );
+        }
+
+        TEST_METHOD( Template )
+        {
+            auto generate = []( IAsmHelper& a, const StubValues& v )
+            {
+                a.GenPrologue();
+                a.GenCall( v( 0 ), { a->zcx } );
+                a->mov( a->zdx, v( 1, 8 ) );
+                a->mov( a->intptr_ptr( a->zdx ), a->zax );
+                a.GenEpilogue();
+            };
+
+            uintptr_t result[2] = { };
+            uint64_t values[] = { reinterpret_cast<uintptr_t>(&GetModuleHandleW), reinterpret_cast<uintptr_t>(result) };
+
+            auto tmpl = StubTemplate::Get( StubTemplate::Key( 0, cc_stdcall, rt_int32, 1 ), sizeof( void* ) == sizeof( uint32_t ), generate );
+            AssertEx::IsNotNull( tmpl );
+
+            // Patched template must work the same as directly generated code
+            auto code = reinterpret_cast<uint8_t*>(VirtualAlloc( nullptr, tmpl->size(), MEM_COMMIT, PAGE_EXECUTE_READWRITE ));
+            AssertEx::IsNotNull( code );
+
+            tmpl->Emit( code, values, _countof( values ) );
+            reinterpret_cast<void( __fastcall* )(LPCWSTR)>(code)( nullptr );
+            VirtualFree( code, 0, MEM_RELEASE );
+
+            AssertEx::AreEqual( reinterpret_cast<uintptr_t>(GetModuleHandleW( nullptr )), result[1] );
+            AssertEx::AreEqual( uintptr_t( 0 ), result[0] );
+        }
+
+        TEST_METHOD( Compact )
+        {
+            auto generate = []( IAsmHelper& a )
+            {
+                a.GenPrologue();
+                a.GenCall( reinterpret_cast<uintptr_t>(&GetModuleHandleW), { 0 } );
+                a.GenEpilogue();
+            };
+
+            auto code = reinterpret_cast<uint8_t*>(VirtualAlloc( nullptr, 0x1000, MEM_COMMIT, PAGE_EXECUTE_READWRITE ));
+            AssertEx::IsNotNull( code );
+
+            auto normal = AsmFactory::GetAssembler();
+            generate( *normal );
+
+            // Code address is known up front
+            auto compact = AsmFactory::GetAssembler();
+            compact->EnableCompactCode( reinterpret_cast<uintptr_t>(code) );
+            generate( *compact );
+            AssertEx::IsTrue( (*compact)->getCodeSize() < (*normal)->getCodeSize() );
+
+            (*compact)->relocCode( code );
+            auto result = reinterpret_cast<HMODULE( __fastcall* )()>(code)();
+            VirtualFree( code, 0, MEM_RELEASE );
+
+            AssertEx::AreEqual( reinterpret_cast<uintptr_t>(GetModuleHandleW( nullptr )), reinterpret_cast<uintptr_t>(result) );
+        }
+
+        TEST_METHOD( LdasmBlock )
+        {
+            // mov [rsp+8], rbx; push rdi; sub rsp, 20h; call rel32; ret
+            uint8_t code[0x20] = { 0x48, 0x89, 0x5C, 0x24, 0x08, 0x57, 0x48, 0x83, 0xEC, 0x20, 0xE8, 0x01, 0x02, 0x03, 0x04, 0xC3 };
+            blackbone::LdasmBlock first, second;
+
+            auto count = LdasmCache::Instance().Decode( reinterpret_cast<ptr_t>(code), code, sizeof( code ), 12, true, first );
+            AssertEx::AreEqual( 4u, count );
+            AssertEx::AreEqual( uint8_t( 5 ), first.lengths[3] );
+            AssertEx::IsTrue( (first.data[3].flags & F_RELATIVE) != 0 );
+
+            // Cached result
+            AssertEx::AreEqual( count, LdasmCache::Instance().Decode( reinterpret_cast<ptr_t>(code), code, sizeof( code ), 12, true, second ) );
+            AssertEx::AreEqual( 0, memcmp( first.lengths, second.lengths, count ) );
+
+            // Patched code is decoded again
+            code[0] = 0x90;
+            AssertEx::AreEqual( 5u, LdasmCache::Instance().Decode( reinterpret_cast<ptr_t>(code), code, sizeof( code ), 12, true, second ) );
+            AssertEx::AreEqual( uint8_t( 1 ), second.lengths[0] );
+        }
+
+        TEST_METHOD( Relocate )
+        {
+            // jz short +2; push rbp; nop; mov rbp, rsp
+            const uint8_t code[0x20] = { 0x74, 0x02, 0x55, 0x90, 0x48, 0x89, 0xE5 };
+            const ptr_t from = 0x140001000, nearby = 0x140100000, distant = 0x7FF000000000;
+            RelocatedCode result;
+
+            // Internal short branch becomes rel32 to relocated instruction
+            AssertEx::NtSuccess( CodeRelocator::Relocate( code, sizeof( code ), from, nearby, 5, true, result ) );
+            AssertEx::AreEqual( 7u, result.consumed );
+            AssertEx::AreEqual( 8, result.Translate( 4 ) );
+            AssertEx::AreEqual( -1, result.Translate( 1 ) );
+
+            const uint8_t expected[] = { 0x0F, 0x84, 0x02, 0x00, 0x00, 0x00, 0x55, 0x90, 0x48, 0x89, 0xE5 };
+            AssertEx::AreEqual( sizeof( expected ), result.code.size() );
+            AssertEx::AreEqual( 0, memcmp( expected, result.code.data(), sizeof( expected ) ) );
+
+            // jmp short +10h, target is out of rel32 range
+            const uint8_t jmp[0x20] = { 0xEB, 0x10, 0x90, 0x90, 0x90 };
+            AssertEx::NtSuccess( CodeRelocator::Relocate( jmp, sizeof( jmp ), from, distant, 5, true, result ) );
+            AssertEx::AreEqual( uint8_t( 0xFF ), result.code[0] );
+            AssertEx::AreEqual( uint8_t( 0x25 ), result.code[1] );
+            AssertEx::AreEqual( from + 0x12, *reinterpret_cast<const ptr_t*>(result.code.data() + 6) );
+
+            // mov rax, [rip+100h]
+            const uint8_t rip[0x20] = { 0x48, 0x8B, 0x05, 0x00, 0x01, 0x00, 0x00 };
+            AssertEx::NtSuccess( CodeRelocator::Relocate( rip, sizeof( rip ), from, nearby, 5, true, result ) );
+            AssertEx::AreEqual( from + 7 + 0x100, nearby + 7 + *reinterpret_cast<const int32_t*>(result.code.data() + 3) );
+            AssertEx::AreEqual( STATUS_NOT_SUPPORTED, CodeRelocator::Relocate( rip, sizeof( rip ), from, distant, 5, true, result ) );
+        }
+
+        TEST_METHOD( StackFrame )
+        {
+            using Frame = AsmStackFrame<sizeof( uint64_t ), sizeof( uint32_t ), 0x18>;
+            static_assert(Frame::TotalSize( true, 0x30 ) == 0x58, "Unexpected x64 frame size");
+            static_assert(Frame::TotalSize( false ) == 0x2C, "Unexpected x86 frame size");
+
+            // Same layout as runtime allocator
+            auto a = AsmFactory::GetAssembler();
+            AsmStackAllocator sa( a->assembler(), 0x30 );
+            Frame frame( a->assembler(), 0x30 );
+
+            AssertEx::AreEqual( sa.AllocVar( sizeof( uint64_t ) ).getDisplacement(), frame.Get<0>().getDisplacement() );
+            AssertEx::AreEqual( sa.AllocVar( sizeof( uint32_t ) ).getDisplacement(), frame.Get<1>().getDisplacement() );
+            AssertEx::AreEqual( sa.AllocVar( 0x18 ).getDisplacement(), frame.Get<2>().getDisplacement() );
+            AssertEx::AreEqual( sa.getTotalSize(), frame.getTotalSize() );
+            AssertEx::AreEqual( int32_t( Align( sa.getTotalSize(), 0x10 ) ), frame.getFrameSize() );
+        }
     };
 }
\ No newline at end of file
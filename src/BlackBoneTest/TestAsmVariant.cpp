@@ -218,7 +218,30 @@ namespace Testing
 
             AssertEx::AreEqual( AsmVariant::dataStruct, a.type );
             AssertEx::AreEqual( sizeof( big ), a.size );
-            AssertEx::AreEqual( 0, memcmp( &big, a.buf.data(), sizeof( big ) ) );
+            AssertEx::AreEqual( reinterpret_cast<uint64_t>(a.inline_buf), a.imm_val64 );
+            AssertEx::AreEqual( 0, memcmp( &big, a.inline_buf, sizeof( big ) ) );
+        }
+
+        TEST_METHOD( StructCopy )
+        {
+            struct HugeStruct
+            {
+                uint8_t data[AsmVariant::InlineSize + 1] = { 1 };
+            } huge;
+
+            PairStruct big;
+            std::vector<AsmVariant> args = { big, huge };
+
+            // Copies must point to own storage
+            AssertEx::AreEqual( reinterpret_cast<uint64_t>(args[0].inline_buf), args[0].imm_val64 );
+            AssertEx::AreEqual( 0, memcmp( &big, reinterpret_cast<const void*>(args[0].imm_val), sizeof( big ) ) );
+
+            AssertEx::AreEqual( reinterpret_cast<uint64_t>(args[1].buf.data()), args[1].imm_val64 );
+            AssertEx::AreEqual( 0, memcmp( &huge, reinterpret_cast<const void*>(args[1].imm_val), sizeof( huge ) ) );
+
+            AsmArgs span = args;
+            AssertEx::AreEqual( size_t( 2 ), span.size() );
+            AssertEx::AreEqual( args[1].imm_val64, span[1].imm_val64 );
         }
 
         TEST_METHOD( FunctionPtr )
@@ -76,6 +76,1493 @@ namespace Testing
             AssertEx::AreEqual( STATUS_ACCESS_DENIED, LastNtStatus() );
         }
 
+        TEST_METHOD( ReadBatch )
+        {
+            uint8_t data[256] = { };
+            for (size_t i = 0; i < sizeof( data ); i++)
+                data[i] = static_cast<uint8_t>(i);
+
+            uint32_t adjacent[2] = { }, overlapping = 0, invalid = 0;
+            uint8_t distant = 0;
+            auto base = reinterpret_cast<ptr_t>(data);
+
+            std::vector<ReadRequest> requests =
+            {
+                { base + 0x84, sizeof( adjacent[1] ), &adjacent[1] },
+                { base + 0x80, sizeof( adjacent[0] ), &adjacent[0] },
+                { base + 0x82, sizeof( overlapping ), &overlapping },
+                { base + 0xF0, sizeof( distant ), &distant },
+                { 0, sizeof( invalid ), &invalid },
+            };
+
+            AssertEx::AreEqual( STATUS_INVALID_ADDRESS, _proc.memory().ReadBatch( requests ) );
+
+            for (size_t i = 0; i < requests.size() - 1; i++)
+                AssertEx::NtSuccess( requests[i].status );
+
+            AssertEx::AreEqual( STATUS_INVALID_ADDRESS, requests.back().status );
+            AssertEx::AreEqual( *reinterpret_cast<uint32_t*>(data + 0x80), adjacent[0] );
+            AssertEx::AreEqual( *reinterpret_cast<uint32_t*>(data + 0x84), adjacent[1] );
+            AssertEx::AreEqual( *reinterpret_cast<uint32_t*>(data + 0x82), overlapping );
+            AssertEx::AreEqual( data[0xF0], distant );
+        }
+
+        TEST_METHOD( MemoryBackends )
+        {
+            // Reads current process directly, counts routed ranges
+            class LocalBackend : public MemoryBackend
+            {
+            public:
+                virtual bool available() override { return true; }
+                virtual NTSTATUS Read( ptr_t address, size_t size, void* buffer ) override
+                {
+                    ranges++;
+                    memcpy( buffer, reinterpret_cast<const void*>(static_cast<uintptr_t>(address)), size );
+                    return STATUS_SUCCESS;
+                }
+
+                size_t ranges = 0;
+            };
+
+            uint32_t data[64] = { }, scattered[3] = { }, single = 0;
+            for (uint32_t i = 0; i < _countof( data ); i++)
+                data[i] = i * 3;
+
+            auto& memory = _proc.memory();
+            auto local = std::make_shared<LocalBackend>();
+            memory.SetBackend( MemoryBackendType::Driver, local );
+            memory.backendPolicy().adaptive = false;
+
+            std::vector<ReadRequest> requests =
+            {
+                { reinterpret_cast<ptr_t>(&data[0]), sizeof( uint32_t ), &scattered[0] },
+                { reinterpret_cast<ptr_t>(&data[20]), sizeof( uint32_t ), &scattered[1] },
+                { reinterpret_cast<ptr_t>(&data[40]), sizeof( uint32_t ), &scattered[2] },
+            };
+
+            // Tiny scattered ranges go to driver slot, single read goes to syscall
+            AssertEx::NtSuccess( memory.ReadBatch( requests ) );
+            AssertEx::NtSuccess( memory.Read( reinterpret_cast<ptr_t>(&data[10]), sizeof( single ), &single ) );
+
+            AssertEx::AreEqual( size_t( 3 ), local->ranges );
+            AssertEx::AreEqual( data[20], scattered[1] );
+            AssertEx::AreEqual( data[40], scattered[2] );
+            AssertEx::AreEqual( data[10], single );
+
+            auto driverStats = memory.backendStats( MemoryBackendType::Driver );
+            AssertEx::AreEqual( uint64_t( 1 ), driverStats.requests );
+            AssertEx::AreEqual( uint64_t( 3 ), driverStats.ranges );
+            AssertEx::IsTrue( memory.backendStats( MemoryBackendType::Syscall ).requests >= 1 );
+
+            memory.SetBackend( MemoryBackendType::Driver, std::make_shared<DriverBackend>( memory ) );
+            memory.backendPolicy().adaptive = true;
+            memory.ResetBackendStats();
+        }
+
+        TEST_METHOD( Wow64BatchRead )
+        {
+            // Only WOW64 host can enter x64 mode
+            if (!_proc.barrier().sourceWow64)
+                return;
+
+            uint32_t data[8] = { }, result[8] = { };
+            for (uint32_t i = 0; i < _countof( data ); i++)
+                data[i] = i * 7;
+
+            NativeWow64 native( _proc.core().handle() );
+            std::vector<NativeReadRange> ranges( _countof( data ) + 1 );
+            for (size_t i = 0; i < _countof( data ); i++)
+            {
+                ranges[i].address = reinterpret_cast<ptr_t>(&data[i]);
+                ranges[i].buffer = &result[i];
+                ranges[i].size = sizeof( data[i] );
+            }
+
+            // Last range is unreadable
+            ranges.back().address = 0;
+            ranges.back().buffer = &result[0];
+            ranges.back().size = sizeof( result[0] );
+
+            AssertEx::IsFalse( NT_SUCCESS( native.ReadProcessMemoryBatchT( ranges ) ) );
+            AssertEx::IsFalse( NT_SUCCESS( ranges.back().status ) );
+
+            for (size_t i = 0; i < _countof( data ); i++)
+            {
+                AssertEx::NtSuccess( ranges[i].status );
+                AssertEx::AreEqual( sizeof( data[i] ), static_cast<size_t>(ranges[i].bytes) );
+            }
+
+            AssertEx::AreEqual( 0, memcmp( data, result, sizeof( data ) ) );
+        }
+
+        TEST_METHOD( AsyncIO )
+        {
+            uint32_t data[64] = { };
+            uint32_t result[64] = { };
+            for (uint32_t i = 0; i < _countof( data ); i++)
+                data[i] = i * 3;
+
+            AsyncMemory async( 4 );
+            AssertEx::IsTrue( async.valid() );
+
+            std::vector<std::future<NTSTATUS>> futures;
+            for (size_t i = 0; i < _countof( data ); i++)
+                futures.emplace_back( async.Read( _proc.memory(), reinterpret_cast<ptr_t>(&data[i]), sizeof( data[i] ), &result[i] ) );
+
+            for (auto& future : futures)
+                AssertEx::NtSuccess( future.get() );
+
+            AssertEx::AreEqual( 0, memcmp( data, result, sizeof( data ) ) );
+
+            // Completion callbacks
+            struct Counter
+            {
+                volatile long completed = 0;
+                volatile long failed = 0;
+            } counter;
+
+            auto callback = []( NTSTATUS status, ptr_t, size_t, void*, void* context )
+            {
+                auto pCounter = reinterpret_cast<Counter*>(context);
+                InterlockedIncrement( NT_SUCCESS( status ) ? &pCounter->completed : &pCounter->failed );
+            };
+
+            uint32_t value = 0xDEADBEEF;
+            AssertEx::NtSuccess( async.Write( _proc.memory(), reinterpret_cast<ptr_t>(&data[0]), sizeof( value ), &value, callback, &counter ) );
+            AssertEx::NtSuccess( async.Read( _proc.memory(), 0, sizeof( value ), &value, callback, &counter ) );
+            AssertEx::IsTrue( async.Wait() );
+
+            AssertEx::AreEqual( 1l, counter.completed );
+            AssertEx::AreEqual( 1l, counter.failed );
+            AssertEx::AreEqual( 0xDEADBEEF, data[0] );
+            AssertEx::AreEqual( size_t( 0 ), async.pending() );
+        }
+
+        TEST_METHOD( WriteCoalescing )
+        {
+            auto base = reinterpret_cast<uint8_t*>(VirtualAlloc( nullptr, 0x2000, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE ));
+            AssertEx::IsNotNull( base );
+
+            auto ptr = reinterpret_cast<ptr_t>(base);
+            auto tx = _proc.memory().BeginWrite();
+
+            // Overlapping and adjacent writes are merged, distant one stays separate
+            AssertEx::NtSuccess( tx.Write<uint32_t>( ptr + 0x10, 0x11111111 ) );
+            AssertEx::NtSuccess( tx.Write<uint32_t>( ptr + 0x14, 0x22222222 ) );
+            AssertEx::NtSuccess( tx.Write<uint16_t>( ptr + 0x12, 0x3333 ) );
+            AssertEx::NtSuccess( tx.Write<uint32_t>( ptr + 0x1800, 0x44444444 ) );
+
+            AssertEx::AreEqual( size_t( 2 ), tx.ranges() );
+            AssertEx::AreEqual( size_t( 12 ), tx.size() );
+            AssertEx::AreEqual( 0u, *reinterpret_cast<uint32_t*>(base + 0x10) );
+
+            // Second page is read-only
+            DWORD old = 0;
+            AssertEx::IsTrue( VirtualProtect( base + 0x1000, 0x1000, PAGE_READONLY, &old ) != FALSE );
+
+            AssertEx::NtSuccess( tx.Commit( true ) );
+            AssertEx::AreEqual( size_t( 0 ), tx.ranges() );
+            AssertEx::AreEqual( 0x33331111u, *reinterpret_cast<uint32_t*>(base + 0x10) );
+            AssertEx::AreEqual( 0x22222222u, *reinterpret_cast<uint32_t*>(base + 0x14) );
+            AssertEx::AreEqual( 0x44444444u, *reinterpret_cast<uint32_t*>(base + 0x1800) );
+
+            // Protection is restored
+            MEMORY_BASIC_INFORMATION mbi = { 0 };
+            VirtualQuery( base + 0x1000, &mbi, sizeof( mbi ) );
+            AssertEx::AreEqual( static_cast<DWORD>(PAGE_READONLY), mbi.Protect );
+
+            VirtualFree( base, 0, MEM_RELEASE );
+        }
+
+        TEST_METHOD( Snapshot )
+        {
+            auto base = reinterpret_cast<uint8_t*>(VirtualAlloc( nullptr, 0x4000, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE ));
+            AssertEx::IsNotNull( base );
+
+            // Pages 0 and 2 are identical
+            memset( base, 0x11, 0x1000 );
+            memset( base + 0x1000, 0x22, 0x1000 );
+            memset( base + 0x2000, 0x11, 0x1000 );
+            memset( base + 0x3000, 0x33, 0x1000 );
+
+            MemorySnapshot snapshot( _proc.memory() );
+            AssertEx::NtSuccess( snapshot.Capture( reinterpret_cast<ptr_t>(base), 0x4000 ) );
+            AssertEx::AreEqual( size_t( 4 ), snapshot.pages() );
+            AssertEx::AreEqual( size_t( 3 ), snapshot.uniquePages() );
+
+            std::vector<MemorySnapshot::PageChange> changes;
+            AssertEx::NtSuccess( snapshot.Diff( changes ) );
+            AssertEx::IsTrue( changes.empty() );
+
+            base[0x2010] = 0x55;
+            DWORD old = 0;
+            AssertEx::IsTrue( VirtualProtect( base + 0x3000, 0x1000, PAGE_NOACCESS, &old ) != FALSE );
+
+            AssertEx::NtSuccess( snapshot.Diff( changes, true ) );
+            AssertEx::AreEqual( size_t( 2 ), changes.size() );
+            AssertEx::AreEqual( reinterpret_cast<ptr_t>(base + 0x2000), changes[0].address );
+            AssertEx::IsTrue( changes[0].readable );
+            AssertEx::AreEqual( reinterpret_cast<ptr_t>(base + 0x3000), changes[1].address );
+            AssertEx::IsFalse( changes[1].readable );
+
+            // Snapshot was updated
+            AssertEx::AreEqual( static_cast<uint8_t>(0x55), snapshot.page( reinterpret_cast<ptr_t>(base + 0x2000) )[0x10] );
+            AssertEx::IsNull( snapshot.page( reinterpret_cast<ptr_t>(base + 0x3000) ) );
+            AssertEx::NtSuccess( snapshot.Diff( changes ) );
+            AssertEx::IsTrue( changes.empty() );
+
+            VirtualFree( base, 0, MEM_RELEASE );
+        }
+
+        TEST_METHOD( ExportIndex )
+        {
+            auto ntdll = _proc.modules().GetModule( L"ntdll.dll" );
+            AssertEx::IsNotNull( ntdll.get() );
+
+            auto hNtdll = GetModuleHandleW( L"ntdll.dll" );
+            auto byName = _proc.modules().GetExport( ntdll, "NtQueryVirtualMemory" );
+            AssertEx::IsTrue( byName.success() );
+            AssertEx::AreEqual( reinterpret_cast<ptr_t>(GetProcAddress( hNtdll, "NtQueryVirtualMemory" )), byName->procAddress );
+
+            // Served from cached index
+            AssertEx::AreEqual( byName->procAddress, _proc.modules().GetExport( ntdll, "NtQueryVirtualMemory" )->procAddress );
+            AssertEx::IsFalse( _proc.modules().GetExport( ntdll, "NonExistentExport" ).success() );
+
+            // By ordinal
+            auto pFirst = GetProcAddress( hNtdll, reinterpret_cast<LPCSTR>(8) );
+            if (pFirst)
+            {
+                auto byOrd = _proc.modules().GetExport( ntdll, reinterpret_cast<const char*>(8) );
+                AssertEx::IsTrue( byOrd.success() );
+                AssertEx::AreEqual( reinterpret_cast<ptr_t>(pFirst), byOrd->procAddress );
+            }
+
+            // Forwarded export
+            auto forwarded = _proc.modules().GetExport( L"kernel32.dll", "HeapAlloc" );
+            AssertEx::IsTrue( forwarded.success() );
+            AssertEx::AreEqual( reinterpret_cast<ptr_t>(GetProcAddress( hNtdll, "RtlAllocateHeap" )), forwarded->procAddress );
+
+            // Memoized forward chain
+            AssertEx::AreEqual( forwarded->procAddress, _proc.modules().GetExport( L"kernel32.dll", "HeapAlloc" )->procAddress );
+
+            _proc.modules().InvalidateExports( ntdll->baseAddress );
+            AssertEx::AreEqual( byName->procAddress, _proc.modules().GetExport( ntdll, "NtQueryVirtualMemory" )->procAddress );
+            AssertEx::AreEqual( forwarded->procAddress, _proc.modules().GetExport( L"kernel32.dll", "HeapAlloc" )->procAddress );
+
+            // System module index is shared with other Process instances
+            Process other;
+            AssertEx::NtSuccess( other.Attach( GetCurrentProcessId() ) );
+
+            auto shared = other.modules().GetExport( L"kernel32.dll", "LoadLibraryW" );
+            AssertEx::IsTrue( shared.success() );
+            AssertEx::AreEqual( reinterpret_cast<ptr_t>(GetProcAddress( GetModuleHandleW( L"kernel32.dll" ), "LoadLibraryW" )), shared->procAddress );
+            AssertEx::AreEqual( byName->procAddress, other.modules().GetNtdllExport( "NtQueryVirtualMemory" )->procAddress );
+        }
+
+        TEST_METHOD( BulkExports )
+        {
+            auto kernel32 = _proc.modules().GetModule( L"kernel32.dll" );
+            AssertEx::IsNotNull( kernel32.get() );
+
+            auto hKernel32 = GetModuleHandleW( L"kernel32.dll" );
+            std::vector<const char*> names = { "CreateFileW", "HeapAlloc", "NonExistentExport", "CloseHandle", "HeapFree" };
+            auto results = _proc.modules().GetExports( kernel32, names );
+            AssertEx::AreEqual( names.size(), results.size() );
+
+            for (size_t i = 0; i < names.size(); i++)
+            {
+                auto expected = reinterpret_cast<ptr_t>(GetProcAddress( hKernel32, names[i] ));
+                if (expected == 0)
+                {
+                    AssertEx::IsFalse( results[i].success() );
+                    continue;
+                }
+
+                AssertEx::IsTrue( results[i].success() );
+                AssertEx::AreEqual( expected, results[i]->procAddress );
+            }
+        }
+
+        TEST_METHOD( LoadNotifications )
+        {
+            AssertEx::NtSuccess( _proc.modules().EnableLoadNotifications() );
+            AssertEx::IsTrue( _proc.modules().notificationsEnabled() );
+            AssertEx::IsNotNull( _proc.modules().GetModule( L"ntdll.dll" ).get() );
+
+            bool preloaded = GetModuleHandleW( L"msimg32.dll" ) != nullptr;
+            HMODULE hMod = LoadLibraryW( L"msimg32.dll" );
+            AssertEx::IsNotNull( hMod );
+
+            // Picked up from load event
+            auto mod = _proc.modules().GetModule( L"msimg32.dll" );
+            AssertEx::IsNotNull( mod.get() );
+            AssertEx::AreEqual( reinterpret_cast<module_t>(hMod), mod->baseAddress );
+
+            // Dropped by unload event
+            FreeLibrary( hMod );
+            if (!preloaded)
+                AssertEx::IsNull( _proc.modules().GetModule( L"msimg32.dll" ).get() );
+
+            AssertEx::NtSuccess( _proc.modules().DisableLoadNotifications() );
+            AssertEx::IsFalse( _proc.modules().notificationsEnabled() );
+            AssertEx::IsNotNull( _proc.modules().GetModule( L"ntdll.dll" ).get() );
+        }
+
+        TEST_METHOD( EnumLdrModules )
+        {
+            auto modules = _proc.core().native()->EnumModules( LdrList );
+            AssertEx::IsFalse( modules.empty() );
+
+            for (auto name : { L"ntdll.dll", L"kernel32.dll" })
+            {
+                auto hMod = GetModuleHandleW( name );
+                auto iter = std::find_if( modules.begin(), modules.end(), [hMod]( const auto& mod ) 
+                {
+                    return mod->baseAddress == reinterpret_cast<module_t>(hMod); 
+                } );
+
+                AssertEx::IsTrue( iter != modules.end() );
+
+                wchar_t path[MAX_PATH] = { 0 };
+                GetModuleFileNameW( hMod, path, MAX_PATH );
+
+                AssertEx::AreEqual( Utils::ToLower( path ), (*iter)->fullPath );
+                AssertEx::AreEqual( std::wstring( name ), (*iter)->name );
+                AssertEx::IsNotZero( (*iter)->ldrPtr );
+            }
+        }
+
+        TEST_METHOD( EnumSectionModules )
+        {
+            auto hNtdll = reinterpret_cast<module_t>(GetModuleHandleW( L"ntdll.dll" ));
+
+            for (auto search : { Sections, PEHeaders })
+            {
+                auto modules = _proc.core().native()->EnumModules( search );
+                auto iter = std::find_if( modules.begin(), modules.end(), [hNtdll]( const auto& mod ) { return mod->baseAddress == hNtdll; } );
+
+                AssertEx::IsTrue( iter != modules.end() );
+                AssertEx::AreEqual( std::wstring( L"ntdll.dll" ), (*iter)->name );
+                AssertEx::IsNotZero( (*iter)->size );
+            }
+
+            // Served through shared region map
+            _proc.modules().reset();
+            auto ntdll = _proc.modules().GetModule( L"ntdll.dll", Sections );
+            AssertEx::IsNotNull( ntdll.get() );
+            AssertEx::AreEqual( hNtdll, ntdll->baseAddress );
+            AssertEx::IsTrue( _proc.memory().regionMap().valid() );
+            _proc.modules().reset();
+        }
+
+        TEST_METHOD( ConcurrentLookup )
+        {
+            auto expected = reinterpret_cast<module_t>(GetModuleHandleW( L"kernel32.dll" ));
+            std::atomic<int> failures{ 0 };
+            std::vector<std::thread> threads;
+
+            for (int i = 0; i < 4; i++)
+            {
+                threads.emplace_back( [&]()
+                {
+                    for (int j = 0; j < 100; j++)
+                    {
+                        auto mod = _proc.modules().GetModule( L"kernel32.dll" );
+                        if (!mod || mod->baseAddress != expected)
+                            failures++;
+
+                        if (!_proc.modules().GetModule( expected ))
+                            failures++;
+                    }
+                } );
+            }
+
+            for (auto& thread : threads)
+                thread.join();
+
+            AssertEx::AreEqual( 0, failures.load() );
+        }
+
+        TEST_METHOD( AddressLookup )
+        {
+            auto hKernel32 = reinterpret_cast<module_t>(GetModuleHandleW( L"kernel32.dll" ));
+            auto pFunc = reinterpret_cast<ptr_t>(GetProcAddress( GetModuleHandleW( L"kernel32.dll" ), "CreateFileW" ));
+
+            auto kernel32 = _proc.modules().GetModule( hKernel32 );
+            AssertEx::IsNotNull( kernel32.get() );
+            AssertEx::AreEqual( std::wstring( L"kernel32.dll" ), kernel32->name );
+
+            // Inner address
+            AssertEx::IsNull( _proc.modules().GetModule( pFunc, true ).get() );
+            AssertEx::AreEqual( hKernel32, _proc.modules().GetModule( pFunc, false )->baseAddress );
+
+            auto cached = _proc.modules().ModuleFromAddress( pFunc );
+            AssertEx::IsNotNull( cached.get() );
+            AssertEx::AreEqual( hKernel32, cached->baseAddress );
+
+            auto past = _proc.modules().ModuleFromAddress( kernel32->baseAddress + kernel32->size );
+            AssertEx::IsTrue( !past || past->baseAddress != hKernel32 );
+
+            AssertEx::IsNull( _proc.modules().ModuleFromAddress( 0x10 ).get() );
+        }
+
+        TEST_METHOD( NameLookup )
+        {
+            auto kernel32 = _proc.modules().GetModule( L"kernel32.dll" );
+            AssertEx::IsNotNull( kernel32.get() );
+
+            // Names are matched regardless of case and path
+            AssertEx::IsTrue( _proc.modules().GetModule( L"KERNEL32.DLL" ) == kernel32 );
+            AssertEx::IsTrue( _proc.modules().GetModule( L"C:\\Windows\\System32\\Kernel32.dll" ) == kernel32 );
+
+            std::wstring_view view( L"kernel32.dll.extra", 12 );
+            AssertEx::IsTrue( _proc.modules().GetModule( view ) == kernel32 );
+        }
+
+        TEST_METHOD( HeadersOnlyImage )
+        {
+            wchar_t sysDir[MAX_PATH] = { 0 };
+            GetSystemDirectoryW( sysDir, ARRAYSIZE( sysDir ) );
+
+            pe::PEImage image;
+            AssertEx::NtSuccess( image.Load( std::wstring( sysDir ) + L"\\kernel32.dll", pe::HeadersOnly ) );
+            AssertEx::IsTrue( image.pureIL() == false );
+            AssertEx::IsNull( image.actx() );
+
+            // Import directory is parsed once
+            auto count = image.GetImports().size();
+            AssertEx::IsTrue( count > 0 );
+            AssertEx::IsTrue( count == image.GetImports().size() );
+
+            pe::vecExports exports;
+            image.GetExports( exports );
+            AssertEx::IsFalse( exports.empty() );
+        }
+
+        TEST_METHOD( ImageViews )
+        {
+            wchar_t sysDir[MAX_PATH] = { 0 };
+            GetSystemDirectoryW( sysDir, ARRAYSIZE( sysDir ) );
+
+            pe::PEImage image;
+            AssertEx::NtSuccess( image.Load( std::wstring( sysDir ) + L"\\kernel32.dll", pe::HeadersOnly ) );
+
+            size_t importCount = 0, exportCount = 0;
+            for (const auto& item : image.ImportsView())
+            {
+                AssertEx::IsFalse( item.dllName.empty() );
+                AssertEx::IsTrue( item.importByOrd || !item.importName.empty() );
+                importCount++;
+            }
+
+            size_t total = 0;
+            for (const auto& mod : image.GetImports())
+                total += mod.second.size();
+
+            AssertEx::IsTrue( importCount > 0 );
+            AssertEx::IsTrue( importCount == total );
+
+            bool found = false;
+            for (const auto& item : image.ExportsView())
+            {
+                found |= item.name == "GetProcAddress";
+                exportCount++;
+            }
+
+            pe::vecExports exports;
+            image.GetExports( exports );
+
+            AssertEx::IsTrue( found );
+            AssertEx::IsTrue( exportCount == exports.size() );
+        }
+
+        TEST_METHOD( ImageCollection )
+        {
+            wchar_t sysDir[MAX_PATH] = { 0 };
+            GetSystemDirectoryW( sysDir, ARRAYSIZE( sysDir ) );
+
+            std::wstring dir( sysDir );
+            std::vector<std::wstring> paths = { dir + L"\\ntdll.dll", dir + L"\\kernel32.dll", dir + L"\\user32.dll", dir + L"\\NonExisting.dll" };
+
+            pe::PECollection collection;
+            AssertEx::NtSuccess( collection.LoadMany( paths, 2 ) );
+
+            const auto& images = collection.images();
+            AssertEx::IsTrue( images.size() == paths.size() );
+            AssertEx::IsFalse( NT_SUCCESS( images.back().status ) );
+
+            // Names are interned once
+            auto ntdllName = collection.strings().Find( "ntdll.dll" );
+            AssertEx::IsTrue( ntdllName == images[0].name );
+
+            // kernel32 imports ntdll directly
+            bool found = false;
+            for (const auto& link : collection.links())
+            {
+                if (link.importer == 1 && link.exporter == 0)
+                {
+                    auto& imp = images[1].imports[link.import];
+                    AssertEx::IsTrue( imp.dll == ntdllName );
+                    found = true;
+                }
+            }
+
+            AssertEx::IsTrue( found );
+        }
+
+        TEST_METHOD( ImageMetadataCache )
+        {
+            wchar_t sysDir[MAX_PATH] = { 0 }, tmpDir[MAX_PATH] = { 0 };
+            GetSystemDirectoryW( sysDir, ARRAYSIZE( sysDir ) );
+            GetTempPathW( ARRAYSIZE( tmpDir ), tmpDir );
+
+            auto cachePath = std::wstring( tmpDir ) + L"BlackBoneImageCache.bin";
+            auto imagePath = std::wstring( sysDir ) + L"\\kernel32.dll";
+            auto& cache = pe::ImageCache::Instance();
+
+            DeleteFileW( cachePath.c_str() );
+            AssertEx::NtSuccess( cache.Open( cachePath ) );
+
+            // Cold load populates cache
+            pe::PEImage cold;
+            pe::vecExports coldExports;
+            AssertEx::NtSuccess( cold.Load( imagePath, pe::HeadersOnly | pe::UseCache ) );
+            AssertEx::IsNotNull( cold.base() );
+            cold.GetExports( coldExports );
+
+            AssertEx::NtSuccess( cache.Flush() );
+            cache.Close();
+            AssertEx::NtSuccess( cache.Open( cachePath ) );
+
+            // Warm load doesn't map the file
+            pe::PEImage warm;
+            pe::vecExports warmExports;
+            AssertEx::NtSuccess( warm.Load( imagePath, pe::HeadersOnly | pe::UseCache ) );
+            AssertEx::IsNull( warm.base() );
+            warm.GetExports( warmExports );
+
+            AssertEx::IsTrue( warm.mType() == cold.mType() );
+            AssertEx::IsTrue( warm.imageSize() == cold.imageSize() );
+            AssertEx::IsTrue( warm.sections().size() == cold.sections().size() );
+            AssertEx::IsTrue( warm.GetImports().size() == cold.GetImports().size() );
+            AssertEx::IsTrue( warmExports.size() == coldExports.size() );
+
+            // Directories and views are served from cache
+            AssertEx::AreEqual( cold.DirectoryAddress( IMAGE_DIRECTORY_ENTRY_EXPORT, pe::RVA ), warm.DirectoryAddress( IMAGE_DIRECTORY_ENTRY_EXPORT, pe::RVA ) );
+            AssertEx::AreEqual( cold.DirectorySize( IMAGE_DIRECTORY_ENTRY_EXPORT ), warm.DirectorySize( IMAGE_DIRECTORY_ENTRY_EXPORT ) );
+            AssertEx::AreEqual( uintptr_t( 0 ), warm.DirectoryAddress( IMAGE_DIRECTORY_ENTRY_EXPORT ) );
+
+            size_t coldImports = 0, warmImports = 0, warmViews = 0;
+            for (const auto& item : cold.ImportsView())
+                coldImports += item.dllName.empty() ? 0 : 1;
+            for (const auto& item : warm.ImportsView())
+                warmImports += item.dllName.empty() ? 0 : 1;
+
+            AssertEx::AreEqual( coldImports, warmImports );
+
+            for (const auto& item : warm.ExportsView())
+            {
+                AssertEx::AreEqual( coldExports[warmViews].RVA, item.RVA );
+                AssertEx::AreEqual( coldExports[warmViews].ordinal, item.ordinal );
+                warmViews++;
+            }
+
+            AssertEx::AreEqual( coldExports.size(), warmViews );
+
+            pe::RelocTable coldRelocs, warmRelocs;
+            AssertEx::NtSuccess( coldRelocs.Parse( cold ) );
+            AssertEx::NtSuccess( warmRelocs.Parse( warm ) );
+            AssertEx::AreEqual( coldRelocs.dir64().size(), warmRelocs.dir64().size() );
+            AssertEx::AreEqual( coldRelocs.highLow().size(), warmRelocs.highLow().size() );
+
+            cache.Close();
+            DeleteFileW( cachePath.c_str() );
+        }
+
+        TEST_METHOD( SymbolDataCache )
+        {
+            wchar_t sysDir[MAX_PATH] = { 0 }, tmpDir[MAX_PATH] = { 0 };
+            GetSystemDirectoryW( sysDir, ARRAYSIZE( sysDir ) );
+            GetTempPathW( ARRAYSIZE( tmpDir ), tmpDir );
+
+            auto cachePath = std::wstring( tmpDir ) + L"BlackBoneSymbolTest.bin";
+            auto oldPath = SymbolCache::GetPath();
+
+            pe::PEImage ntdll, kernel32;
+            AssertEx::NtSuccess( ntdll.Load( std::wstring( sysDir ) + L"\\ntdll.dll", true ) );
+            AssertEx::NtSuccess( kernel32.Load( std::wstring( sysDir ) + L"\\kernel32.dll", true ) );
+
+            // ntdll always carries CodeView record
+            auto key = SymbolCache::GetImageKey( ntdll );
+            auto otherKey = SymbolCache::GetImageKey( kernel32 );
+            AssertEx::AreNotEqual( 0u, key.pdbAge );
+            AssertEx::AreNotEqual( 0u, key.timestamp );
+
+            SymbolCache::SetPath( cachePath );
+            DeleteFileW( cachePath.c_str() );
+
+            SymbolData data, loaded;
+            data.LdrpHandleTlsData64 = 0x180001000;
+            data.LdrProtectMrdata = 0x4B301000;
+
+            AssertEx::IsFalse( SymbolCache::Load( key, key, loaded ) );
+            AssertEx::NtSuccess( SymbolCache::Store( key, key, data ) );
+
+            AssertEx::IsTrue( SymbolCache::Load( key, key, loaded ) );
+            AssertEx::AreEqual( data.LdrpHandleTlsData64, loaded.LdrpHandleTlsData64 );
+            AssertEx::AreEqual( data.LdrProtectMrdata, loaded.LdrProtectMrdata );
+
+            // Different build doesn't match
+            AssertEx::IsFalse( SymbolCache::Load( key, otherKey, loaded ) );
+
+            SymbolCache::SetPath( oldPath );
+            DeleteFileW( cachePath.c_str() );
+        }
+
+        TEST_METHOD( SymbolLookup )
+        {
+            auto& resolver = SymbolResolver::Instance();
+
+            std::vector<uint32_t> rvas;
+            AssertEx::NtSuccess( resolver.Resolve( {
+                { L"ntdll.dll", L"LdrpHandleTlsData" },
+                { L"ntdll.dll", L"RtlInsertInvertedFunctionTable" },
+                { L"kernel32.dll", L"LoadLibraryW" }
+                }, rvas ) );
+
+            AssertEx::AreEqual( size_t( 3 ), rvas.size() );
+            for (auto rva : rvas)
+                AssertEx::AreNotEqual( 0u, rva );
+
+            // Reverse lookup from inside the function
+            std::wstring name;
+            uint32_t displacement = 0;
+            AssertEx::NtSuccess( resolver.FindSymbol( L"ntdll.dll", rvas[0] + 1, name, displacement ) );
+            AssertEx::AreEqual( std::wstring( L"LdrpHandleTlsData" ), name );
+            AssertEx::AreEqual( 1u, displacement );
+
+            AssertEx::AreEqual( STATUS_NOT_FOUND, resolver.Resolve( L"ntdll.dll", L"NonExistentSymbol" ).status );
+        }
+
+        TEST_METHOD( ImageRebase )
+        {
+            wchar_t sysDir[MAX_PATH] = { 0 };
+            GetSystemDirectoryW( sysDir, ARRAYSIZE( sysDir ) );
+
+            pe::PEImage file;
+            AssertEx::NtSuccess( file.Load( std::wstring( sysDir ) + L"\\kernel32.dll", true ) );
+            AssertEx::IsFalse( file.isPlainData() );
+            AssertEx::AreEqual( STATUS_NOT_SUPPORTED, file.Rebase( file.imageBase() + 0x10000 ) );
+
+            pe::RelocTable relocs;
+            AssertEx::NtSuccess( relocs.Parse( file ) );
+            AssertEx::IsFalse( relocs.empty() );
+            AssertEx::IsTrue( relocs.limit() <= file.imageSize() );
+
+            // Rebase local copy of image layout
+            std::vector<uint8_t> copy( reinterpret_cast<uint8_t*>(file.base()), reinterpret_cast<uint8_t*>(file.base()) + file.imageSize() );
+            auto oldBase = file.imageBase();
+            auto fixup = file.mType() == mt_mod64 ? relocs.dir64().front() : relocs.highLow().front();
+
+            pe::PEImage image;
+            AssertEx::NtSuccess( image.Load( copy.data(), copy.size(), false ) );
+            AssertEx::NtSuccess( image.Rebase( oldBase + 0x10000 ) );
+            AssertEx::IsTrue( image.imageBase() == oldBase + 0x10000 );
+
+            if (file.mType() == mt_mod64)
+                AssertEx::IsTrue( *reinterpret_cast<uint64_t*>(copy.data() + fixup) == *reinterpret_cast<uint64_t*>(reinterpret_cast<uint8_t*>(file.base()) + fixup) + 0x10000 );
+            else
+                AssertEx::IsTrue( *reinterpret_cast<uint32_t*>(copy.data() + fixup) == *reinterpret_cast<uint32_t*>(reinterpret_cast<uint8_t*>(file.base()) + fixup) + 0x10000 );
+        }
+
+        TEST_METHOD( MalformedRelocs )
+        {
+            // Single block whose fixup end wraps around 32 bits
+            uint8_t block[12] = { };
+            *reinterpret_cast<uint32_t*>(block) = 0xFFFFF000;
+            *reinterpret_cast<uint32_t*>(block + 4) = sizeof( block );
+            *reinterpret_cast<uint16_t*>(block + 8) = (IMAGE_REL_BASED_DIR64 << 12) | 0xFFC;
+
+            pe::RelocTable relocs;
+            AssertEx::AreEqual( STATUS_INVALID_IMAGE_FORMAT, relocs.Parse( block, sizeof( block ) ) );
+            AssertEx::IsTrue( relocs.empty() );
+            AssertEx::AreEqual( 0u, relocs.limit() );
+
+            // Block size past directory end is ignored
+            *reinterpret_cast<uint32_t*>(block) = 0x1000;
+            *reinterpret_cast<uint32_t*>(block + 4) = 0xFFFFFFF8;
+            AssertEx::NtSuccess( relocs.Parse( block, sizeof( block ) ) );
+            AssertEx::IsTrue( relocs.empty() );
+        }
+
+        TEST_METHOD( NetMetadataTables )
+        {
+            wchar_t winDir[MAX_PATH] = { 0 };
+            GetWindowsDirectoryW( winDir, ARRAYSIZE( winDir ) );
+
+            std::wstring path = std::wstring( winDir ) + L"\\Microsoft.NET\\Framework\\v4.0.30319\\mscorlib.dll";
+            if (!Utils::FileExists( path ))
+                return;
+
+            pe::PEImage image;
+            AssertEx::NtSuccess( image.Load( path, pe::HeadersOnly ) );
+            AssertEx::IsTrue( image.pureIL() );
+
+            pe::NetMetadata metadata;
+            AssertEx::NtSuccess( metadata.Parse( image ) );
+            AssertEx::IsFalse( metadata.methods().empty() );
+            AssertEx::AreEqual( std::string( "v4.0.30319" ), metadata.version() );
+
+            auto rvas = metadata.methodRVAs();
+            auto iter = rvas.find( std::make_pair( std::wstring( L"System.Object" ), std::wstring( L"ToString" ) ) );
+            AssertEx::IsTrue( iter != rvas.end() );
+            AssertEx::IsTrue( iter->second != 0 );
+
+            // Same RVAs as metadata dispenser
+            ImageNET net;
+            ImageNET::mapMethodRVA comRvas;
+            AssertEx::IsTrue( net.Init( path ) );
+            AssertEx::IsTrue( net.Parse( &comRvas ) );
+
+            for (auto& method : comRvas)
+            {
+                auto found = rvas.find( method.first );
+                AssertEx::IsTrue( found != rvas.end() );
+                AssertEx::IsTrue( found->second == method.second );
+            }
+
+            // Not a .NET image
+            wchar_t sysDir[MAX_PATH] = { 0 };
+            GetSystemDirectoryW( sysDir, ARRAYSIZE( sysDir ) );
+
+            pe::PEImage native;
+            AssertEx::NtSuccess( native.Load( std::wstring( sysDir ) + L"\\kernel32.dll", pe::HeadersOnly ) );
+            AssertEx::AreEqual( STATUS_INVALID_IMAGE_FORMAT, metadata.Parse( native ) );
+            AssertEx::IsTrue( metadata.methods().empty() );
+        }
+
+        TEST_METHOD( ReadSparse )
+        {
+            auto base = reinterpret_cast<uint8_t*>(VirtualAlloc( nullptr, 0x3000, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE ));
+            AssertEx::IsNotNull( base );
+
+            memset( base, 0xAB, 0x3000 );
+            DWORD old = 0;
+            AssertEx::IsTrue( VirtualProtect( base + 0x1000, 0x1000, PAGE_NOACCESS, &old ) != FALSE );
+
+            // Unaligned range touching all 3 pages
+            std::vector<uint8_t> buf( 0x2000, 0xEE );
+            std::vector<bool> pages;
+            AssertEx::NtSuccess( _proc.memory().ReadSparse( reinterpret_cast<ptr_t>(base + 0x800), buf.size(), buf.data(), &pages ) );
+
+            AssertEx::AreEqual( size_t( 3 ), pages.size() );
+            AssertEx::IsTrue( pages[0] && !pages[1] && pages[2] );
+            AssertEx::AreEqual( uint8_t( 0xAB ), buf[0] );
+            AssertEx::AreEqual( uint8_t( 0 ), buf[0x800] );
+            AssertEx::AreEqual( uint8_t( 0xAB ), buf[0x1FFF] );
+
+            VirtualFree( base, 0, MEM_RELEASE );
+        }
+
+        TEST_METHOD( RegionMap )
+        {
+            auto& map = _proc.memory().regionMap();
+            AssertEx::NtSuccess( map.Refresh( true ) );
+
+            auto block = _proc.memory().Allocate( 0x3000, PAGE_READWRITE );
+            AssertEx::IsTrue( block.success() );
+            AssertEx::NtSuccess( block->Protect( PAGE_READONLY, 0x1000, 0x1000 ) );
+            AssertEx::NtSuccess( map.Refresh() );
+
+            MEMORY_BASIC_INFORMATION64 mbi = { };
+            AssertEx::IsTrue( map.Find( block->ptr() + 0x1800, mbi ) );
+            AssertEx::AreEqual( block->ptr() + 0x1000, mbi.BaseAddress );
+            AssertEx::AreEqual( static_cast<DWORD>(PAGE_READONLY), mbi.Protect );
+
+            ptr_t address = block->ptr();
+            block->Free();
+            AssertEx::NtSuccess( map.Refresh() );
+            AssertEx::IsTrue( map.Find( address + 0x1800, mbi ) );
+            AssertEx::AreEqual( static_cast<DWORD>(MEM_FREE), mbi.State );
+        }
+
+        TEST_METHOD( CodeHeap )
+        {
+            auto& heap = _proc.memory().codeHeap();
+
+            auto first = heap.Allocate( 0x100 );
+            auto second = heap.Allocate( 0x30 );
+            AssertEx::IsTrue( first.success() && second.success() );
+            AssertEx::AreEqual( first->ptr() + 0x100, second->ptr() );
+            AssertEx::AreEqual( size_t( 1 ), heap.slabCount() );
+
+            // Released block is reused, slab isn't freed
+            ptr_t address = first->ptr();
+            first->Free();
+
+            auto third = heap.Allocate( 0x80 );
+            AssertEx::IsTrue( third.success() );
+            AssertEx::AreEqual( address, third->ptr() );
+            AssertEx::NtSuccess( third->Write( 0, 0xC3C3C3C3u ) );
+            AssertEx::AreEqual( 0xC3C3C3C3u, third->Read<uint32_t>( 0, 0 ) );
+
+            // Heap block can't be resized
+            AssertEx::AreEqual( STATUS_NOT_SUPPORTED, third->Realloc( 0x2000 ).status );
+
+            // Block larger than slab gets own slab
+            auto large = heap.Allocate( RemoteCodeHeap::SlabSize + 1 );
+            AssertEx::IsTrue( large.success() );
+            AssertEx::AreEqual( size_t( 2 ), heap.slabCount() );
+        }
+
+        TEST_METHOD( ReallocGrowth )
+        {
+            auto mem = _proc.memory().Allocate( 0x1000, PAGE_READWRITE );
+            AssertEx::IsTrue( mem.success() );
+            AssertEx::NtSuccess( mem->Write( 0x10, 0xDEADBEEFu ) );
+
+            // Exact reservation can't grow, block is moved with contents
+            auto moved = mem->Realloc( 0x3000, 0, PAGE_READWRITE );
+            AssertEx::NtSuccess( moved.status );
+            AssertEx::AreEqual( moved.result(), mem->ptr() );
+            AssertEx::AreEqual( 0xDEADBEEFu, mem->Read<uint32_t>( 0x10, 0 ) );
+
+            // Moved block has headroom
+            auto grown = mem->Realloc( 0x5000, 0, PAGE_READWRITE );
+            AssertEx::NtSuccess( grown.status );
+            AssertEx::AreEqual( moved.result(), grown.result() );
+            AssertEx::AreEqual( size_t( 0x5000 ), mem->size() );
+            AssertEx::NtSuccess( mem->Write( 0x4FF0, 0xC0FFEEu ) );
+            AssertEx::AreEqual( 0xDEADBEEFu, mem->Read<uint32_t>( 0x10, 0 ) );
+        }
+
+        TEST_METHOD( WriteWatch )
+        {
+            auto mem = _proc.memory().Allocate( 0x4000, PAGE_READWRITE, 0, true, true );
+            AssertEx::IsTrue( mem.success() );
+            AssertEx::IsTrue( mem->writeWatch() );
+            AssertEx::NtSuccess( mem->ResetWatch() );
+
+            // Same process, block is written directly
+            auto pData = mem->ptr<uint8_t*>();
+            pData[0x1010] = 0x11;
+            pData[0x3FFF] = 0x22;
+
+            std::vector<ptr_t> pages;
+            AssertEx::NtSuccess( mem->GetDirtyPages( pages ) );
+            AssertEx::AreEqual( size_t( 2 ), pages.size() );
+            AssertEx::AreEqual( mem->ptr() + 0x1000, pages[0] );
+            AssertEx::AreEqual( mem->ptr() + 0x3000, pages[1] );
+
+            // Only dirty pages are copied into mirror
+            std::vector<uint8_t> mirror( mem->size(), 0xCC );
+            AssertEx::NtSuccess( mem->ReadDirty( mirror.data() ) );
+            AssertEx::AreEqual( uint8_t( 0x11 ), mirror[0x1010] );
+            AssertEx::AreEqual( uint8_t( 0x22 ), mirror[0x3FFF] );
+            AssertEx::AreEqual( uint8_t( 0xCC ), mirror[0x10] );
+            AssertEx::AreEqual( uint8_t( 0xCC ), mirror[0x2010] );
+
+            // Tracking was reset by ReadDirty
+            AssertEx::NtSuccess( mem->GetDirtyPages( pages ) );
+            AssertEx::IsTrue( pages.empty() );
+
+            auto plain = _proc.memory().Allocate( 0x1000, PAGE_READWRITE );
+            AssertEx::IsTrue( plain.success() );
+            AssertEx::IsFalse( plain->writeWatch() );
+            AssertEx::AreEqual( STATUS_INVALID_PARAMETER, plain->GetDirtyPages( pages ) );
+        }
+
+        TEST_METHOD( DataHeap )
+        {
+            auto& heap = _proc.memory().heap();
+
+            // Same size class shares slab
+            auto first = heap.Allocate( 0x18 );
+            auto second = heap.Allocate( 0x20 );
+            AssertEx::IsTrue( first.success() && second.success() );
+            AssertEx::AreEqual( first->ptr() + 0x20, second->ptr() );
+            AssertEx::AreEqual( size_t( 1 ), heap.slabCount() );
+
+            // Other size class gets own slab
+            auto string = heap.Allocate( 0x200 );
+            AssertEx::IsTrue( string.success() );
+            AssertEx::AreEqual( size_t( 2 ), heap.slabCount() );
+
+            // Released block is reused
+            ptr_t address = first->ptr();
+            first->Free();
+
+            auto third = heap.Allocate( 0x10 );
+            AssertEx::IsTrue( third.success() );
+            AssertEx::AreEqual( address, third->ptr() );
+            AssertEx::NtSuccess( third->Write( 0, 0xDEADBEEFu ) );
+            AssertEx::AreEqual( 0xDEADBEEFu, third->Read<uint32_t>( 0, 0 ) );
+            AssertEx::AreEqual( STATUS_NOT_SUPPORTED, third->Realloc( 0x2000 ).status );
+
+            // Large block is allocated directly
+            auto large = heap.Allocate( RemoteHeap::MaxBlock + 1 );
+            AssertEx::IsTrue( large.success() );
+            AssertEx::AreEqual( size_t( 2 ), heap.slabCount() );
+        }
+
+        TEST_METHOD( PageCache )
+        {
+            volatile uint32_t value = 1;
+            auto address = reinterpret_cast<ptr_t>(&value);
+            auto& memory = _proc.memory();
+
+            memory.EnableCache( 16 );
+            AssertEx::AreEqual( 1u, memory.Read<uint32_t>( address ).result( 0 ) );
+
+            // Local change isn't visible until new epoch
+            value = 2;
+            AssertEx::AreEqual( 1u, memory.Read<uint32_t>( address ).result( 0 ) );
+
+            memory.BeginEpoch();
+            AssertEx::AreEqual( 2u, memory.Read<uint32_t>( address ).result( 0 ) );
+
+            // Write through same object invalidates page
+            AssertEx::NtSuccess( memory.Write( address, 3u ) );
+            AssertEx::AreEqual( 3u, memory.Read<uint32_t>( address ).result( 0 ) );
+
+            memory.DisableCache();
+            value = 4;
+            AssertEx::AreEqual( 4u, memory.Read<uint32_t>( address ).result( 0 ) );
+        }
+
+        TEST_METHOD( ThreadCache )
+        {
+            // Thread objects are reused between queries
+            auto main = _proc.threads().getMain();
+            AssertEx::IsNotNull( main.get() );
+            AssertEx::IsTrue( main == _proc.threads().getMain() );
+
+            std::thread worker( []() { Sleep( 200 ); } );
+            DWORD tid = GetThreadId( worker.native_handle() );
+
+            auto thread = _proc.threads().get( tid );
+            AssertEx::IsNotNull( thread.get() );
+            AssertEx::AreEqual( tid, thread->id() );
+            AssertEx::IsTrue( thread == _proc.threads().get( tid ) );
+
+            // Handle table hands out the same object
+            AssertEx::IsTrue( thread == _proc.threads().open( tid ) );
+
+            // Statistics share the same thread objects
+            auto stats = _proc.threads().stats();
+            auto iter = std::find_if( stats.begin(), stats.end(), [tid]( const ThreadStats& st ) { return st.thread->id() == tid; } );
+            AssertEx::IsTrue( iter != stats.end() );
+            AssertEx::IsTrue( iter->thread == thread );
+            AssertEx::IsNotZero( iter->teb );
+
+            worker.join();
+        }
+
+        TEST_METHOD( CaptureContexts )
+        {
+            auto path = GetTestHelperHost();
+            AssertEx::IsTrue( Utils::FileExists( path ) );
+
+            Process process;
+            AssertEx::NtSuccess( process.CreateAndAttach( path ) );
+            Sleep( 100 );
+
+            std::vector<ThreadContext> contexts;
+            AssertEx::NtSuccess( process.threads().CaptureContexts( contexts, CONTEXT64_CONTROL ) );
+            AssertEx::AreEqual( process.threads().getAll().size(), contexts.size() );
+
+            for (auto& context : contexts)
+            {
+                AssertEx::NtSuccess( context.status );
+                AssertEx::IsNotZero( context.ctx64.Rip );
+            }
+
+            // Write back unchanged contexts
+            AssertEx::NtSuccess( process.threads().ApplyContexts( contexts ) );
+            for (auto& context : contexts)
+                AssertEx::NtSuccess( context.status );
+
+            process.Terminate();
+        }
+
+        TEST_METHOD( ProcessBreakpoints )
+        {
+            auto path = GetTestHelperHost();
+            AssertEx::IsTrue( Utils::FileExists( path ) );
+
+            Process process;
+            AssertEx::NtSuccess( process.CreateAndAttach( path ) );
+            Sleep( 100 );
+
+            auto block = process.memory().Allocate( 0x1000, PAGE_EXECUTE_READWRITE );
+            AssertEx::IsTrue( block.success() );
+
+            // Same register in every thread
+            auto idx = process.breakpoints().Add( block->ptr(), hwbp_execute, hwbp_1 );
+            AssertEx::NtSuccess( idx.status );
+            AssertEx::AreEqual( 0, idx.result() );
+            AssertEx::AreEqual( 0, process.breakpoints().Add( block->ptr(), hwbp_execute, hwbp_1 ).result( -1 ) );
+
+            std::vector<ThreadContext> contexts;
+            AssertEx::NtSuccess( process.threads().CaptureContexts( contexts, CONTEXT64_DEBUG_REGISTERS ) );
+            for (auto& context : contexts)
+            {
+                AssertEx::AreEqual( block->ptr(), context.ctx64.Dr0 );
+                AssertEx::IsNotZero( context.ctx64.Dr7 & 1 );
+            }
+
+            AssertEx::NtSuccess( process.breakpoints().Remove( block->ptr() ) );
+            AssertEx::AreEqual( size_t( 0 ), process.breakpoints().count() );
+
+            AssertEx::NtSuccess( process.threads().CaptureContexts( contexts, CONTEXT64_DEBUG_REGISTERS ) );
+            for (auto& context : contexts)
+                AssertEx::IsZero( context.ctx64.Dr7 & 1 );
+
+            process.Terminate();
+        }
+
+        TEST_METHOD( AddressIndex )
+        {
+            AddressMap<int> index;
+            for (int i = 1; i <= 1000; i++)
+                index.insert( 0x10000 + i * 0x10, i );
+
+            AssertEx::AreEqual( size_t( 1000 ), index.size() );
+            AssertEx::IsNull( index.find( 0x10008 ) );
+
+            // Removed entries don't break probe sequence
+            for (int i = 1; i <= 1000; i += 2)
+                AssertEx::IsTrue( index.erase( 0x10000 + i * 0x10 ) );
+
+            for (int i = 2; i <= 1000; i += 2)
+            {
+                auto value = index.find( 0x10000 + i * 0x10 );
+                AssertEx::IsNotNull( value );
+                AssertEx::AreEqual( i, *value );
+            }
+
+            AssertEx::AreEqual( size_t( 500 ), index.size() );
+            AssertEx::IsFalse( index.erase( 0x10010 ) );
+        }
+
+        TEST_METHOD( ExecRanges )
+        {
+            ExecRangeCache cache;
+            bool executable = false;
+
+            cache.Add( 0x10000, 0x1000, true );
+            cache.Add( 0x12000, 0x1000, false );
+
+            AssertEx::IsTrue( cache.Find( 0x10800, executable ) );
+            AssertEx::IsTrue( executable );
+            AssertEx::IsTrue( cache.Find( 0x12FFF, executable ) );
+            AssertEx::IsFalse( executable );
+            AssertEx::IsFalse( cache.Find( 0x11000, executable ) );
+
+            // Re-queried region replaces overlapping ones
+            cache.Add( 0x10800, 0x2000, false );
+            AssertEx::IsTrue( cache.Find( 0x10800, executable ) );
+            AssertEx::IsFalse( executable );
+            AssertEx::IsFalse( cache.Find( 0x10000, executable ) );
+        }
+
+        TEST_METHOD( ProcessLookup )
+        {
+            wchar_t path[MAX_PATH] = { };
+            GetModuleFileNameW( NULL, path, _countof( path ) );
+            auto name = Utils::StripPath( path );
+
+            ProcessList list;
+            AssertEx::NtSuccess( list.Refresh() );
+
+            std::vector<DWORD> pids;
+            AssertEx::IsTrue( list.FindByName( Utils::ToLower( name ), pids ) > 0 );
+            AssertEx::IsTrue( std::find( pids.begin(), pids.end(), GetCurrentProcessId() ) != pids.end() );
+            AssertEx::AreEqual( size_t( 0 ), list.FindByName( L"nonexistent.exe", pids ) );
+
+            // Buffer is reused
+            AssertEx::NtSuccess( list.Refresh() );
+            AssertEx::AreNotEqual( 0u, list.FindFirst( name ) );
+
+            auto found = Process::EnumByNameOrPID( GetCurrentProcessId(), L"", true );
+            AssertEx::IsTrue( found.success() );
+            AssertEx::IsFalse( found.result().empty() );
+            AssertEx::IsFalse( found.result().front().threads.empty() );
+        }
+
+        TEST_METHOD( ProcessPooling )
+        {
+            auto path = GetTestHelperHost();
+            AssertEx::IsTrue( Utils::FileExists( path ) );
+
+            Process host;
+            AssertEx::NtSuccess( host.CreateAndAttach( path ) );
+
+            ProcessPool pool;
+            auto first = pool.Acquire( host.pid() );
+            AssertEx::NtSuccess( first.status );
+
+            // Same object is returned while process is alive
+            auto second = pool.Acquire( host.pid() );
+            AssertEx::NtSuccess( second.status );
+            AssertEx::IsTrue( first.result() == second.result() );
+            AssertEx::AreEqual( size_t( 1 ), pool.size() );
+
+            // Shared ntdll export index
+            AssertEx::IsTrue( first->modules().GetNtdllExport( "NtClose" ).success() );
+
+            ProcessList list;
+            AssertEx::NtSuccess( list.Refresh() );
+
+            int64_t createTime = 0;
+            list.ForEach( [&]( const ProcessList::Entry& entry )
+            {
+                if (entry.pid() != host.pid())
+                    return true;
+
+                createTime = entry.createTime();
+                return false;
+            } );
+
+            AssertEx::IsTrue( pool.Acquire( host.pid(), createTime ).success() );
+            AssertEx::AreEqual( STATUS_NOT_FOUND, pool.Acquire( host.pid(), createTime + 1 ).status );
+
+            // Evicted on exit
+            host.Terminate();
+            WaitForSingleObject( host.core().handle(), 5000 );
+
+            for (int i = 0; i < 50 && pool.size() != 0; i++)
+                Sleep( 100 );
+
+            AssertEx::AreEqual( size_t( 0 ), pool.size() );
+            AssertEx::IsFalse( pool.Release( host.pid() ) );
+        }
+
+        TEST_METHOD( ProcessFanOut )
+        {
+            std::atomic<int> calls( 0 );
+            std::vector<DWORD> pids = { GetCurrentProcessId(), 0xFFFFFFF0, GetCurrentProcessId() };
+
+            auto result = ForEachProcess( pids, [&calls]( Process& process )
+            {
+                calls++;
+                return process.core().peb64() != 0 ? STATUS_SUCCESS : STATUS_UNSUCCESSFUL;
+            }, 4 );
+
+            // Duplicate PID is processed once
+            AssertEx::AreEqual( size_t( 2 ), result.targets.size() );
+            AssertEx::AreEqual( 1, calls.load() );
+            AssertEx::AreEqual( size_t( 1 ), result.failed() );
+
+            AssertEx::AreEqual( static_cast<DWORD>(GetCurrentProcessId()), result.targets[0].pid );
+            AssertEx::NtSuccess( result.targets[0].status );
+            AssertEx::IsFalse( NT_SUCCESS( result.targets[1].status ) );
+            AssertEx::IsTrue( result.time >= result.targets[0].time );
+        }
+
+        TEST_METHOD( TraceBuffering )
+        {
+            static std::vector<std::wstring> messages;
+            static uint32_t tid = 0;
+
+            messages.clear();
+            SetTraceSink( []( const TraceEvent& event )
+            {
+                messages.emplace_back( event.message );
+                tid = event.tid;
+            } );
+
+            // Strings are copied, source can go away before flush
+            {
+                std::wstring name( L"module.dll" );
+                BLACKBONE_TRACE( L"Trace test '%ls' 0x%X %d", name.c_str(), 0xC0000005, 7 );
+                BLACKBONE_TRACE( "Trace test %s 0x%p", std::string( "narrow" ).c_str(), reinterpret_cast<void*>(0x1000) );
+            }
+
+            FlushTrace();
+            SetTraceSink( nullptr );
+
+            AssertEx::AreEqual( size_t( 2 ), messages.size() );
+            AssertEx::AreEqual( L"Trace test 'module.dll' 0xC0000005 7", messages[0].c_str() );
+            AssertEx::IsTrue( messages[1].find( L"Trace test narrow" ) == 0 );
+            AssertEx::AreEqual( static_cast<uint32_t>(GetCurrentThreadId()), tid );
+        }
+
+        TEST_METHOD( Metrics )
+        {
+            auto before = _proc.metrics();
+
+            uint64_t value = 0x1234, read = 0;
+            MEMORY_BASIC_INFORMATION64 mbi = { };
+            AssertEx::NtSuccess( _proc.memory().Read( reinterpret_cast<ptr_t>(&value), read ) );
+            AssertEx::NtSuccess( _proc.memory().Query( reinterpret_cast<ptr_t>(&value), &mbi ) );
+            AssertEx::AreEqual( value, read );
+
+            auto after = _proc.metrics();
+            AssertEx::IsTrue( after.native[NativeOp::Read] > before.native[NativeOp::Read] );
+            AssertEx::IsTrue( after.native[NativeOp::Query] > before.native[NativeOp::Query] );
+            AssertEx::IsTrue( after.memory.bytesRead >= before.memory.bytesRead + sizeof( read ) );
+            AssertEx::AreEqual( before.rpcCalls, after.rpcCalls );
+        }
+
+        TEST_METHOD( RemoteStrings )
+        {
+            // String ends right before inaccessible page
+            auto pages = static_cast<uint8_t*>(VirtualAlloc( nullptr, 0x2000, MEM_COMMIT, PAGE_READWRITE ));
+            AssertEx::IsNotNull( pages );
+
+            DWORD old = 0;
+            AssertEx::IsTrue( VirtualProtect( pages + 0x1000, 0x1000, PAGE_NOACCESS, &old ) != FALSE );
+
+            auto str = reinterpret_cast<char*>(pages + 0x1000 - 6);
+            strcpy_s( str, 6, "hello" );
+
+            auto cstr = _proc.memory().ReadCString( reinterpret_cast<ptr_t>(str) );
+            AssertEx::IsTrue( cstr.success() );
+            AssertEx::AreEqual( std::string( "hello" ), cstr.result() );
+
+            // Truncated by length and unterminated at page end
+            AssertEx::AreEqual( std::string( "hel" ), _proc.memory().ReadCString( reinterpret_cast<ptr_t>(str), 3 ).result() );
+            str[5] = 'x';
+            AssertEx::IsFalse( _proc.memory().ReadCString( reinterpret_cast<ptr_t>(str) ).success() );
+
+            VirtualFree( pages, 0, MEM_RELEASE );
+
+            // UNICODE_STRING, one by one and batched
+            wchar_t first[] = L"first", second[] = L"second string";
+            _UNICODE_STRING_T<DWORD_PTR> strings[2] =
+            {
+                { static_cast<uint16_t>(wcslen( first ) * sizeof( wchar_t )), sizeof( first ), reinterpret_cast<DWORD_PTR>(first) },
+                { static_cast<uint16_t>(wcslen( second ) * sizeof( wchar_t )), sizeof( second ), reinterpret_cast<DWORD_PTR>(second) },
+            };
+
+            auto ustr = _proc.memory().ReadUnicodeString<DWORD_PTR>( reinterpret_cast<ptr_t>(&strings[1]) );
+            AssertEx::IsTrue( ustr.success() );
+            AssertEx::AreEqual( std::wstring( second ), ustr.result() );
+
+            std::vector<std::wstring> names;
+            AssertEx::NtSuccess( _proc.memory().ReadUnicodeStrings<DWORD_PTR>( { reinterpret_cast<ptr_t>(&strings[0]), reinterpret_cast<ptr_t>(&strings[1]) }, names ) );
+            AssertEx::AreEqual( size_t( 2 ), names.size() );
+            AssertEx::AreEqual( std::wstring( first ), names[0] );
+            AssertEx::AreEqual( std::wstring( second ), names[1] );
+
+            int values[] = { 1, 2, 3, 4 };
+            auto array = _proc.memory().ReadArray<int>( reinterpret_cast<ptr_t>(values), _countof( values ) );
+            AssertEx::IsTrue( array.success() );
+            AssertEx::AreEqual( size_t( 4 ), array->size() );
+            AssertEx::AreEqual( 4, array.result()[3] );
+        }
+
+        TEST_METHOD( ReadFields )
+        {
+            using PEB_T = _PEB_T<DWORD_PTR>;
+
+            PEB_T full = { };
+            auto pebPtr = _proc.core().peb<DWORD_PTR>( &full );
+            AssertEx::IsNotZero( pebPtr );
+
+            auto peb = _proc.memory().ReadFields<PEB_T, &PEB_T::ImageBaseAddress, &PEB_T::Ldr, &PEB_T::NtGlobalFlag>( pebPtr );
+            AssertEx::IsTrue( peb.success() );
+            AssertEx::AreEqual( full.ImageBaseAddress, peb->ImageBaseAddress );
+            AssertEx::AreEqual( full.Ldr, peb->Ldr );
+            AssertEx::AreEqual( full.NtGlobalFlag, peb->NtGlobalFlag );
+
+            // Fields that weren't selected stay zero
+            AssertEx::AreEqual( DWORD_PTR( 0 ), peb->ProcessParameters );
+            AssertEx::IsFalse( _proc.memory().ReadFields<PEB_T, &PEB_T::Ldr>( 0 ).success() );
+        }
+
+        TEST_METHOD( LatencyHistograms )
+        {
+            LatencyHistogram histogram;
+            for (uint64_t i = 1; i <= 1000; i++)
+                histogram.Record( i * 1000 );
+
+            // Buckets are at most 12.5% wide
+            auto summary = histogram.snapshot();
+            AssertEx::AreEqual( uint64_t( 1000 ), summary.count );
+            AssertEx::AreEqual( uint64_t( 1000000 ), summary.max );
+            AssertEx::IsTrue( summary.p50 >= 500000 && summary.p50 <= 500000 * 9 / 8 );
+            AssertEx::IsTrue( summary.p99 >= 990000 && summary.p99 <= 1000000 );
+
+            // Recording is off by default
+            uint64_t value = 0;
+            AssertEx::IsNull( _proc.latency().recording( LatencyOp::MemoryRead ) );
+            AssertEx::NtSuccess( _proc.memory().Read( reinterpret_cast<ptr_t>(&summary), value ) );
+            AssertEx::AreEqual( uint64_t( 0 ), _proc.latency().snapshot( LatencyOp::MemoryRead ).count );
+
+            _proc.latency().Enable();
+            for (int i = 0; i < 10; i++)
+                AssertEx::NtSuccess( _proc.memory().Read( reinterpret_cast<ptr_t>(&summary), value ) );
+
+            _proc.latency().Enable( false );
+            auto reads = _proc.latency().snapshot( LatencyOp::MemoryRead );
+            AssertEx::AreEqual( uint64_t( 10 ), reads.count );
+            AssertEx::IsTrue( reads.p50 <= reads.max );
+        }
+
+        TEST_METHOD( HandleStream )
+        {
+            auto hSection = Handle( CreateFileMappingW( INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, 0x2000, NULL ) );
+            AssertEx::IsTrue( hSection.valid() );
+
+            bool found = false;
+            AssertEx::NtSuccess( _proc.EnumHandles( [&]( HandleEntry& entry )
+            {
+                AssertEx::AreEqual( L"Section", entry.typeName().c_str() );
+                if (entry.handle() != hSection.get())
+                    return true;
+
+                auto section = entry.section();
+                AssertEx::IsNotNull( section.get() );
+                AssertEx::AreEqual( ptr_t( 0x2000 ), section->size );
+
+                found = true;
+                return false;
+            }, L"Section" ) );
+
+            AssertEx::IsTrue( found );
+        }
+
+        TEST_METHOD( MemoryDump )
+        {
+            wchar_t tmpDir[MAX_PATH] = { 0 };
+            GetTempPathW( ARRAYSIZE( tmpDir ), tmpDir );
+            auto dumpPath = std::wstring( tmpDir ) + L"BlackBoneDump.bin";
+
+            // Marker pages around reserved hole
+            auto base = static_cast<uint8_t*>(VirtualAlloc( nullptr, 0x5000, MEM_RESERVE, PAGE_READWRITE ));
+            AssertEx::IsNotNull( base );
+            AssertEx::IsNotNull( VirtualAlloc( base, 0x2000, MEM_COMMIT, PAGE_READWRITE ) );
+            AssertEx::IsNotNull( VirtualAlloc( base + 0x3000, 0x2000, MEM_COMMIT, PAGE_READWRITE ) );
+            memset( base, 0xAB, 0x2000 );
+            memset( base + 0x3000, 0xCD, 0x2000 );
+
+            DumpOptions options;
+            options.format = DumpFormat::RawSparse;
+            options.filter.minAddress = reinterpret_cast<ptr_t>(base);
+            options.filter.maxAddress = reinterpret_cast<ptr_t>(base) + 0x5000;
+            options.chunkSize = 0x1000;
+            options.maxBuffered = 0x3000;
+
+            ProcessDumper dumper( _proc );
+            AssertEx::NtSuccess( dumper.Dump( dumpPath, options ) );
+            AssertEx::AreEqual( uint64_t( 2 ), dumper.stats().ranges );
+            AssertEx::AreEqual( uint64_t( 0x4000 ), dumper.stats().bytes );
+
+            auto hFile = Handle( CreateFileW( dumpPath.c_str(), FILE_GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL ) );
+            AssertEx::IsTrue( hFile.valid() );
+
+            std::vector<uint8_t> data( static_cast<size_t>(dumper.stats().fileSize) );
+            DWORD bytes = 0;
+            AssertEx::IsTrue( ReadFile( hFile, data.data(), static_cast<DWORD>(data.size()), &bytes, NULL ) != FALSE );
+            AssertEx::AreEqual( static_cast<DWORD>(data.size()), bytes );
+
+            auto header = reinterpret_cast<const DumpHeader*>(data.data());
+            auto ranges = reinterpret_cast<const DumpRange*>(header + 1);
+            AssertEx::AreEqual( DumpHeader::Magic, header->magic );
+            AssertEx::AreEqual( 2u, header->rangeCount );
+            AssertEx::AreEqual( reinterpret_cast<ptr_t>(base + 0x3000), ranges[1].address );
+            AssertEx::AreEqual( uint8_t( 0xAB ), data[static_cast<size_t>(ranges[0].offset + 0x1FFF)] );
+            AssertEx::AreEqual( uint8_t( 0xCD ), data[static_cast<size_t>(ranges[1].offset)] );
+
+            hFile.reset();
+            VirtualFree( base, 0, MEM_RELEASE );
+
+            // Minidump of loaded images
+            options = DumpOptions();
+            options.filter.type = MEM_IMAGE;
+            AssertEx::NtSuccess( dumper.Dump( dumpPath, options ) );
+            AssertEx::IsNotZero( dumper.stats().bytes );
+
+            hFile = Handle( CreateFileW( dumpPath.c_str(), FILE_GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL ) );
+            uint32_t signature = 0;
+            AssertEx::IsTrue( ReadFile( hFile, &signature, sizeof( signature ), &bytes, NULL ) != FALSE );
+            AssertEx::AreEqual( 0x504D444Du, signature );
+
+            hFile.reset();
+            DeleteFileW( dumpPath.c_str() );
+        }
+
+        TEST_METHOD( AddressSpaceSnapshot )
+        {
+            volatile uint32_t value = 0x1234;
+            auto address = reinterpret_cast<ptr_t>(&value);
+
+            Process snapshot;
+            AssertEx::NtSuccess( snapshot.AttachSnapshot( GetCurrentProcessId() ) );
+            AssertEx::IsTrue( snapshot.snapshot() );
+            AssertEx::AreNotEqual( GetCurrentProcessId(), snapshot.pid() );
+
+            // Clone keeps value from capture time and can't be modified
+            value = 0x5678;
+            AssertEx::AreEqual( 0x1234u, snapshot.memory().Read<uint32_t>( address ).result() );
+            AssertEx::IsFalse( NT_SUCCESS( snapshot.memory().Write( address, 0u ) ) );
+            AssertEx::IsNotNull( snapshot.modules().GetModule( ModuleName ).get() );
+
+            snapshot.Detach();
+            AssertEx::IsFalse( snapshot.snapshot() );
+        }
+
+        TEST_METHOD( HeapWalk )
+        {
+            // Private heap, few distinct sizes keep blocks out of LFH
+            HANDLE hHeap = HeapCreate( 0, 0, 0 );
+            AssertEx::IsNotNull( hHeap );
+
+            const size_t sizes[] = { 0x18, 0x120, 0x2000 };
+            void* blocks[_countof( sizes )] = { };
+            for (size_t i = 0; i < _countof( sizes ); i++)
+                blocks[i] = HeapAlloc( hHeap, 0, sizes[i] );
+
+            ProcessHeaps heaps( _proc );
+            auto list = heaps.EnumHeaps();
+            AssertEx::IsTrue( list.success() );
+            AssertEx::IsTrue( std::find( list->begin(), list->end(), reinterpret_cast<ptr_t>(hHeap) ) != list->end() );
+
+            HeapInfo info;
+            auto status = heaps.Walk( reinterpret_cast<ptr_t>(hHeap), info );
+            if (info.type == HeapType::SegmentHeap)
+            {
+                AssertEx::AreEqual( STATUS_NOT_SUPPORTED, status );
+            }
+            else
+            {
+                AssertEx::NtSuccess( status );
+                AssertEx::IsTrue( info.type == HeapType::NtHeap );
+
+                for (size_t i = 0; i < _countof( sizes ); i++)
+                {
+                    auto iter = std::find_if( info.blocks.begin(), info.blocks.end(), [&]( const HeapBlock& block )
+                    {
+                        return block.address == reinterpret_cast<ptr_t>(blocks[i]);
+                    } );
+
+                    AssertEx::IsTrue( iter != info.blocks.end() );
+                    AssertEx::IsTrue( iter->busy );
+                    AssertEx::AreEqual( sizes[i], iter->size );
+                }
+            }
+
+            for (auto block : blocks)
+                HeapFree( hHeap, 0, block );
+
+            HeapDestroy( hHeap );
+        }
+
+        TEST_METHOD( DynamicImports )
+        {
+            static_assert(DynImport::Hash( "NtQueryVirtualMemory" ) != DynImport::Hash( "NtReadVirtualMemory" ), "Slot key collision");
+
+            auto expected = GetProcAddress( GetModuleHandleW( L"ntdll.dll" ), "NtQueryVirtualMemory" );
+            AssertEx::AreEqual( reinterpret_cast<void*>(expected), reinterpret_cast<void*>(GET_IMPORT( NtQueryVirtualMemory )) );
+            AssertEx::AreEqual( reinterpret_cast<void*>(expected), reinterpret_cast<void*>(GET_IMPORT( NtQueryVirtualMemory )) );
+
+            // Missing import isn't cached and doesn't get called
+            AssertEx::IsNull( DynImport::cached<fnNtSuspendProcess, DynImport::Hash( "NtMissingExport" )>( "NtMissingExport" ) );
+            AssertEx::AreEqual( NTSTATUS( STATUS_ORDINAL_NOT_FOUND ), DynImport::nativeCall( fnNtSuspendProcess( nullptr ), GetCurrentProcess() ) );
+        }
+
     private:
         Process _proc;
     };
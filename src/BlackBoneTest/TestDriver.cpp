@@ -1,4 +1,5 @@
 #include "Common.h"
+#include <3rd_party/VersionApi.h>
 
 namespace Testing
 {
@@ -86,6 +87,89 @@ namespace Testing
             AssertEx::AreEqual( static_cast<short>(IMAGE_DOS_SIGNATURE), *reinterpret_cast<short*>(buf) );
         }
 
+        TEST_METHOD( ReadMemoryAsync )
+        {
+            CHECK_AND_SKIP;
+
+            uint8_t buf[0x1000] = { };
+            NTSTATUS readStatus = STATUS_PENDING;
+            auto address = _explorer.modules().GetMainModule()->baseAddress;
+
+            AssertEx::NtSuccess( Driver().ReadMemAsync( _explorer.pid(), address, sizeof( buf ), buf, [&]( NTSTATUS status ) { readStatus = status; } ) );
+            AssertEx::AreEqual( size_t( 1 ), Driver().PollCompletions( 5000 ) );
+
+            AssertEx::NtSuccess( readStatus );
+            AssertEx::AreEqual( static_cast<short>(IMAGE_DOS_SIGNATURE), *reinterpret_cast<short*>(buf) );
+        }
+
+        TEST_METHOD( ThreadEvents )
+        {
+            CHECK_AND_SKIP;
+
+            NTSTATUS waitStatus = STATUS_PENDING;
+            std::vector<NOTIFY_EVENT> received;
+
+            AssertEx::NtSuccess( Driver().SubscribeEvents( GetCurrentProcessId(), BLACKBONE_EVENT_MASK( NE_ThreadCreate ) ) );
+            AssertEx::NtSuccess( Driver().WaitEventsAsync( [&]( NTSTATUS status, std::vector<NOTIFY_EVENT>& events, uint32_t )
+            {
+                waitStatus = status;
+                received = events;
+            } ) );
+
+            DWORD tid = 0;
+            HANDLE hThread = CreateThread( nullptr, 0, []( LPVOID ) -> DWORD { return 0; }, nullptr, 0, &tid );
+            AssertEx::IsNotNull( hThread );
+
+            AssertEx::AreEqual( size_t( 1 ), Driver().PollCompletions( 5000 ) );
+            WaitForSingleObject( hThread, INFINITE );
+            CloseHandle( hThread );
+            Driver().UnsubscribeEvents();
+
+            AssertEx::NtSuccess( waitStatus );
+            AssertEx::IsNotZero( received.size() );
+            AssertEx::AreEqual( static_cast<ULONG>(NE_ThreadCreate), received.front().type );
+
+            // Process can start other threads meanwhile
+            AssertEx::IsTrue( std::any_of( received.begin(), received.end(), [tid]( const NOTIFY_EVENT& e ) { return e.tid == tid; } ) );
+        }
+
+        TEST_METHOD( ReadMemoryRing )
+        {
+            CHECK_AND_SKIP;
+
+            CommandRing ring;
+            uint8_t buf[4][0x100] = { };
+            NTSTATUS statuses[4] = { };
+            auto address = _explorer.modules().GetMainModule()->baseAddress;
+
+            AssertEx::NtSuccess( Driver().CreateRing( ring ) );
+
+            for (size_t i = 0; i < _countof( buf ); i++)
+                AssertEx::NtSuccess( ring.Push( _explorer.pid(), address + i * sizeof( buf[i] ), buf[i], sizeof( buf[i] ), false, &statuses[i] ) );
+
+            AssertEx::NtSuccess( ring.Flush( 5000 ) );
+            AssertEx::NtSuccess( statuses[3] );
+            AssertEx::AreEqual( static_cast<short>(IMAGE_DOS_SIGNATURE), *reinterpret_cast<short*>(buf[0]) );
+
+            AssertEx::NtSuccess( Driver().DestroyRing( ring ) );
+        }
+
+        TEST_METHOD( ReadMemoryPhysical )
+        {
+            CHECK_AND_SKIP;
+
+            if (!IsWindows8Point1OrGreater())
+                return;
+
+            uint8_t buf[0x1000] = { };
+            auto address = _explorer.modules().GetMainModule()->baseAddress;
+
+            // PE header is resident after image load
+            std::vector<CopyRange> ranges = { { address, buf, sizeof( buf ), false, STATUS_PENDING } };
+            AssertEx::NtSuccess( Driver().ReadMemPhysical( _explorer.pid(), ranges ) );
+            AssertEx::AreEqual( static_cast<short>(IMAGE_DOS_SIGNATURE), *reinterpret_cast<short*>(buf) );
+        }
+
         TEST_METHOD( AllocateMemory )
         {
             CHECK_AND_SKIP;
@@ -100,6 +184,29 @@ namespace Testing
             Driver().FreeMem( _explorer.pid(), address2, size, MEM_RELEASE );
         }
 
+        TEST_METHOD( AllocateMemoryBatch )
+        {
+            CHECK_AND_SKIP;
+
+            std::vector<AllocRange> ranges =
+            {
+                { 0, 0x1000, MEM_COMMIT, PAGE_READWRITE, false, STATUS_PENDING },
+                { 0, 0x300000, MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE, false, STATUS_PENDING },
+            };
+
+            AssertEx::NtSuccess( Driver().AllocateMemBatch( _explorer.pid(), ranges ) );
+
+            for (auto& range : ranges)
+            {
+                AssertEx::NtSuccess( range.status );
+                AssertEx::IsNotZero( range.base );
+                Driver().FreeMem( _explorer.pid(), range.base, 0, MEM_RELEASE );
+            }
+
+            // Large page region is rounded up, regular pages keep requested size
+            AssertEx::IsTrue( ranges[1].size >= 0x300000 );
+        }
+
         TEST_METHOD( ProtectMemory )
         {
             CHECK_AND_SKIP;
@@ -136,6 +243,19 @@ namespace Testing
             AssertEx::IsNotZero( info.size() );
         }
 
+        TEST_METHOD( EnumModules )
+        {
+            CHECK_AND_SKIP;
+
+            std::vector<ModuleDataPtr> modules;
+            auto mainMod = _explorer.modules().GetMainModule();
+
+            AssertEx::NtSuccess( Driver().EnumModules( _explorer.pid(), false, modules ) );
+            AssertEx::IsNotZero( modules.size() );
+            AssertEx::AreEqual( mainMod->baseAddress, modules.front()->baseAddress );
+            AssertEx::AreEqual( mainMod->name, modules.front()->name );
+        }
+
     private:
         Process _explorer;
         bool _mustSkip = false;
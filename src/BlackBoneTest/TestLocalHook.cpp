@@ -74,6 +74,20 @@ namespace Testing
         a1 /= 2;
     }
 
+    int __declspec(noinline) TestStatic( int a, int b )
+    {
+        volatile int result = a;
+        for (int i = 0; i < b; i++)
+            result = result * 3 + i;
+
+        return result;
+    }
+
+    int hkTestStatic( int a, int b )
+    {
+        return a + b;
+    }
+
     int __stdcall hkTest( void*& _this, int& a1, int&, int& )
     {
         reinterpret_cast<TestClassBase*>(_this)->junk = 72;
@@ -152,6 +166,92 @@ namespace Testing
             AssertEx::AreEqual( 2 * (args[0] + args[1]) - testClass.junk, val );
         }
 
+        TEST_METHOD( HookStatic )
+        {
+            StaticDetour<decltype(&TestStatic), CallOrder::NoOriginal, ReturnMethod::UseNew> hook;
+
+            AssertEx::IsTrue( hook.Hook( &TestStatic, &hkTestStatic ) );
+            AssertEx::AreEqual( args[0] + args[1], TestStatic( args[0], args[1] ) );
+
+            AssertEx::IsTrue( hook.Restore() );
+            AssertEx::AreNotEqual( args[0] + args[1], TestStatic( args[0], args[1] ) );
+        }
+
+        TEST_METHOD( HookBatch )
+        {
+            HookTransaction txn;
+            Detour<decltype(&TestFastcall)> hook;
+            StaticDetour<decltype(&TestStatic), CallOrder::NoOriginal, ReturnMethod::UseNew> hookStatic;
+
+            AssertEx::IsTrue( txn.Add( hook, &TestFastcall, &hkTestFastcall, HookType::Inline ) );
+            AssertEx::IsTrue( txn.Add( hookStatic, &TestStatic, &hkTestStatic ) );
+            AssertEx::AreEqual( size_t( 2 ), txn.size() );
+
+            // Nothing is written before commit
+            AssertEx::AreNotEqual( args[0] + args[1], TestStatic( args[0], args[1] ) );
+
+            AssertEx::IsTrue( txn.Commit() );
+            AssertEx::AreEqual( size_t( 0 ), txn.size() );
+
+            int a = args[0];
+            TestFastcall( a, 5.5f );
+
+            AssertEx::AreEqual( (args[0] / 2) * 3, a );
+            AssertEx::AreEqual( args[0] + args[1], TestStatic( args[0], args[1] ) );
+        }
+
+        TEST_METHOD( TrampolineReach )
+        {
+            auto& pool = TrampolinePool::Instance();
+            auto target = reinterpret_cast<uint8_t*>(&GetTickCount);
+
+            auto first = pool.Allocate( target );
+            auto second = pool.Allocate( target );
+            AssertEx::IsNotNull( first );
+            AssertEx::IsNotNull( second );
+            AssertEx::AreNotEqual( reinterpret_cast<uintptr_t>(first), reinterpret_cast<uintptr_t>(second) );
+
+#ifdef USE64
+            auto distance = reinterpret_cast<intptr_t>(first) - reinterpret_cast<intptr_t>(target);
+            AssertEx::IsTrue( distance < 0x7FFF0000 && distance > -0x7FFF0000 );
+#endif
+
+            // Released slot is reused
+            pool.Free( first );
+            auto third = pool.Allocate( target );
+            AssertEx::AreEqual( reinterpret_cast<uintptr_t>(first), reinterpret_cast<uintptr_t>(third) );
+
+            pool.Free( second );
+            pool.Free( third );
+        }
+
+        TEST_METHOD( HookVtableShared )
+        {
+            MyMook target;
+            TestClassChild second;
+            TestClassBase* pSecond = &second;
+            VTableDetour<int( __thiscall* )(void*, int, int), MyMook> hook;
+
+            AssertEx::IsTrue( hook.HookShared( reinterpret_cast<void**>(&testClass), 0, &MyMook::hkVFunc, &target ) );
+            AssertEx::IsTrue( VTableDetour<int( __thiscall* )(void*, int, int), MyMook>::AttachShared( reinterpret_cast<void**>(&second) ) );
+            AssertEx::AreEqual( *reinterpret_cast<void**>(&testClass), *reinterpret_cast<void**>(&second) );
+
+            pTCBase->Vfunc( args[0], args[1] );
+            pSecond->Vfunc( args[0], args[1] );
+
+            AssertEx::AreEqual( 48, testClass.junk );
+            AssertEx::AreEqual( 48, second.junk );
+
+            // Restored function is called through shadow
+            second.junk = 64;
+            AssertEx::IsTrue( hook.Restore() );
+            pSecond->Vfunc( args[0], args[1] );
+            AssertEx::AreEqual( 64, second.junk );
+
+            ShadowVTables::Instance().Detach( reinterpret_cast<void**>(&testClass) );
+            ShadowVTables::Instance().Detach( reinterpret_cast<void**>(&second) );
+        }
+
     private:
         TestClassChild testClass;
         TestClassBase* pTCBase = &testClass;
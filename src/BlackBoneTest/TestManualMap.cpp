@@ -55,6 +55,36 @@ namespace Testing
             MapFromFile( GetTestHelperHost64(), GetTestHelperDll64() );
         }
  
+        TEST_METHOD( FromFileParallel32 )
+        {
+            MapFromFile( GetTestHelperHost32(), GetTestHelperDll32(), ManualImports | ParallelDeps );
+        }
+
+        TEST_METHOD( FromFileParallel64 )
+        {
+            MapFromFile( GetTestHelperHost64(), GetTestHelperDll64(), ManualImports | ParallelDeps );
+        }
+
+        TEST_METHOD( FromFileArena32 )
+        {
+            MapFromFile( GetTestHelperHost32(), GetTestHelperDll32(), ManualImports | SharedArena );
+        }
+
+        TEST_METHOD( FromFileArena64 )
+        {
+            MapFromFile( GetTestHelperHost64(), GetTestHelperDll64(), ManualImports | SharedArena );
+        }
+
+        TEST_METHOD( FromFileLazy32 )
+        {
+            MapFromFile( GetTestHelperHost32(), GetTestHelperDll32(), ManualImports | LazyBind );
+        }
+
+        TEST_METHOD( FromFileLazy64 )
+        {
+            MapFromFile( GetTestHelperHost64(), GetTestHelperDll64(), ManualImports | LazyBind );
+        }
+
         TEST_METHOD( FromMemory32 )
         {
             MapFromMemory( GetTestHelperHost32(), GetTestHelperDll32() );
@@ -65,15 +95,104 @@ namespace Testing
             MapFromMemory( GetTestHelperHost64(), GetTestHelperDll64() );
         }
 
+        TEST_METHOD( Stats )
+        {
+            Process proc;
+            NTSTATUS status = proc.CreateAndAttach( GetTestHelperHost64() );
+            AssertEx::NtSuccess( status );
+            proc.EnsureInit();
+
+            MapStats stats;
+            auto image = proc.mmap().MapImage( GetTestHelperDll64(), ManualImports, &MapCallback, nullptr, nullptr, &stats );
+            proc.Terminate();
+
+            AssertEx::IsTrue( image.success() );
+            AssertEx::IsNotZero( stats.total.bytesWritten );
+            AssertEx::IsNotZero( stats.phases[MP_Copy].bytesWritten );
+            AssertEx::IsNotZero( stats.phases[MP_Imports].count );
+            AssertEx::IsNotZero( stats.phases[MP_EntryPoint].rpcCalls );
+
+            uint64_t phaseTime = 0;
+            for (auto& phase : stats.phases)
+                phaseTime += phase.time;
+
+            AssertEx::IsTrue( phaseTime <= stats.total.time );
+        }
+
+        TEST_METHOD( CreateAndMap )
+        {
+            Process proc;
+            MapStats stats;
+            auto image = proc.CreateAndMap( GetTestHelperHost64(), GetTestHelperDll64(), ManualImports, L"", nullptr, nullptr, true, &stats );
+            bool running = proc.valid();
+            proc.Terminate();
+
+            AssertEx::IsTrue( image.success() );
+            AssertEx::IsTrue( running );
+            AssertEx::IsNotZero( stats.total.bytesWritten );
+        }
+
+        TEST_METHOD( TransientAllocations )
+        {
+            Process proc;
+            NTSTATUS status = proc.CreateAndAttach( GetTestHelperHost64() );
+            AssertEx::NtSuccess( status );
+            proc.EnsureInit();
+
+            CountingResource counter;
+            {
+                TransientScope scope( &counter );
+                auto image = proc.mmap().MapImage( GetTestHelperDll64(), ManualImports, &MapCallback );
+                AssertEx::IsTrue( image.success() );
+            }
+
+            proc.Terminate();
+
+            // Staging copies are released by the time MapImage returns
+            auto stats = counter.stats();
+            AssertEx::IsNotZero( stats.allocations );
+            AssertEx::IsTrue( stats.peak >= 0x1000 );
+            AssertEx::AreEqual( uint64_t( 0 ), stats.live );
+        }
+
+        TEST_METHOD( UpdateImage )
+        {
+            Process proc;
+            NTSTATUS status = proc.CreateAndAttach( GetTestHelperHost64() );
+            AssertEx::NtSuccess( status );
+            proc.EnsureInit();
+
+            auto image = proc.mmap().MapImage( GetTestHelperDll64(), ManualImports, &MapCallback );
+            AssertEx::IsTrue( image.success() );
+
+            // Same build has no changed pages
+            MapStats stats;
+            status = proc.mmap().UpdateImage( image.result(), GetTestHelperDll64(), &stats );
+            proc.Terminate();
+
+            AssertEx::NtSuccess( status );
+            AssertEx::AreEqual( uint64_t( 0 ), stats.phases[MP_Copy].bytesWritten );
+        }
+
+        TEST_METHOD( FromBundle32 )
+        {
+            MapFromBundle( GetTestHelperHost32(), GetTestHelperDll32() );
+        }
+
+        TEST_METHOD( FromBundle64 )
+        {
+            MapFromBundle( GetTestHelperHost64(), GetTestHelperDll64() );
+        }
+
     private:
-        void MapFromFile( const std::wstring& hostPath, const std::wstring& dllPath )
+        void MapFromFile( const std::wstring& hostPath, const std::wstring& dllPath, eLoadFlags flags = ManualImports )
         {
             Process proc;
             NTSTATUS status = proc.CreateAndAttach( hostPath );
             AssertEx::NtSuccess( status );
             proc.EnsureInit();
 
-            auto image = proc.mmap().MapImage( dllPath, ManualImports, &MapCallback );
+            auto image = proc.mmap().MapImage( dllPath, flags, &MapCallback );
             AssertEx::IsTrue( image.success() );
             AssertEx::IsNotNull( image.result().get() );
 
@@ -115,6 +234,53 @@ namespace Testing
             ValidateDllLoad( g_loadData.result() );
         }
 
+        void MapFromBundle( const std::wstring& hostPath, const std::wstring& dllPath )
+        {
+            wchar_t tmpDir[MAX_PATH] = { 0 };
+            GetTempPathW( MAX_PATH, tmpDir );
+            std::wstring bundlePath = std::wstring( tmpDir ) + L"BlackBoneTest.bundle";
+
+            // Build in one process, map into another one
+            {
+                Process proc;
+                NTSTATUS status = proc.CreateAndAttach( hostPath );
+                AssertEx::NtSuccess( status );
+                proc.EnsureInit();
+
+                ImageBundle bundle;
+                AssertEx::NtSuccess( proc.mmap().BuildBundle( dllPath, bundle ) );
+                AssertEx::IsFalse( bundle.empty() );
+                AssertEx::IsFalse( bundle.root().thunks.empty() );
+                AssertEx::NtSuccess( bundle.Save( bundlePath ) );
+
+                proc.Terminate();
+            }
+
+            ImageBundle bundle;
+            AssertEx::NtSuccess( bundle.Load( bundlePath ) );
+            DeleteFileW( bundlePath.c_str() );
+
+            Process proc;
+            NTSTATUS status = proc.CreateAndAttach( hostPath );
+            AssertEx::NtSuccess( status );
+            proc.EnsureInit();
+
+            auto image = proc.mmap().MapImage( bundle, ManualImports, &MapCallback );
+            AssertEx::IsTrue( image.success() );
+            AssertEx::IsNotNull( image.result().get() );
+
+            auto g_loadDataPtr = proc.modules().GetExport( image.result(), "g_LoadData" );
+            AssertEx::IsTrue( g_loadDataPtr.success() );
+            AssertEx::IsNotZero( g_loadDataPtr->procAddress );
+
+            auto g_loadData = proc.memory().Read<DllLoadData>( g_loadDataPtr->procAddress );
+            AssertEx::IsTrue( g_loadData.success() );
+
+            proc.Terminate();
+
+            ValidateDllLoad( g_loadData.result() );
+        }
+
         void ValidateDllLoad( const DllLoadData& data )
         {
             AssertEx::IsTrue( data.initialized );
@@ -32,6 +32,9 @@ namespace Testing
         s2* pS2 = new s2();
     };
 
+    // Static base for pointer chain search
+    static s3* g_object = nullptr;
+
     // stupid C3865 : "'__thiscall' : can only be used on native member functions", even for a type declaration
     typedef int( __fastcall* pfnClass )(s_end* _this, void* zdx);
 
@@ -105,6 +108,98 @@ namespace Testing
             AssertEx::AreEqual( newVal, pVal_ex->fval, 0.001f );
         }
 
+        TEST_METHOD( RemoteCached )
+        {
+            Process proc;
+            AssertEx::NtSuccess( proc.Attach( GetCurrentProcessId() ) );
+
+            multi_ptr_ex<s_end*> ptr_ex( &proc, _objectPtr, { off[0], off[1], off[2] }, true );
+            auto pVal_ex = ptr_ex.get();
+            AssertEx::IsNotNull( pVal_ex );
+            AssertEx::AreEqual( _guard->pS2->pS1->pEnd->ival, pVal_ex->ival );
+
+            // Cached target is used until epoch changes
+            auto oldEnd = _guard->pS2->pS1->pEnd;
+            std::unique_ptr<s_end> newEnd( new s_end() );
+            newEnd->ival = 100;
+            _guard->pS2->pS1->pEnd = newEnd.get();
+
+            pVal_ex = ptr_ex.get();
+            AssertEx::IsNotNull( pVal_ex );
+            AssertEx::AreEqual( 74, pVal_ex->ival );
+
+            proc.memory().BeginEpoch();
+            pVal_ex = ptr_ex.get();
+            AssertEx::IsNotNull( pVal_ex );
+            AssertEx::AreEqual( 100, pVal_ex->ival );
+
+            _guard->pS2->pS1->pEnd = oldEnd;
+        }
+
+        TEST_METHOD( ChainResolver )
+        {
+            Process proc;
+            AssertEx::NtSuccess( proc.Attach( GetCurrentProcessId() ) );
+
+            PtrChainResolver resolver( proc.memory() );
+            auto idEnd = resolver.Add( { _objectPtr, off[0], off[1], off[2], 0 } );
+            auto idFloat = resolver.Add( { _objectPtr, off[0], off[1], off[2], offsetOf( &s_end::fval ) } );
+            auto idS1 = resolver.Add( { _objectPtr, off[0], off[1], 0 } );
+            auto idBad = resolver.Add( { 0, off[0] } );
+
+            AssertEx::AreEqual( STATUS_INVALID_ADDRESS, resolver.Resolve() );
+            AssertEx::AreEqual( reinterpret_cast<ptr_t>(_guard->pS2->pS1->pEnd), resolver.result( idEnd ) );
+            AssertEx::AreEqual( reinterpret_cast<ptr_t>(&_guard->pS2->pS1->pEnd->fval), resolver.result( idFloat ) );
+            AssertEx::AreEqual( reinterpret_cast<ptr_t>(_guard->pS2->pS1), resolver.result( idS1 ) );
+            AssertEx::AreEqual( ptr_t( 0 ), resolver.result( idBad ) );
+
+            // Cached values survive until epoch changes
+            auto oldEnd = _guard->pS2->pS1->pEnd;
+            std::unique_ptr<s_end> newEnd( new s_end() );
+            _guard->pS2->pS1->pEnd = newEnd.get();
+
+            resolver.Resolve();
+            AssertEx::AreEqual( reinterpret_cast<ptr_t>(oldEnd), resolver.result( idEnd ) );
+
+            proc.memory().BeginEpoch();
+            resolver.Resolve();
+            AssertEx::AreEqual( reinterpret_cast<ptr_t>(newEnd.get()), resolver.result( idEnd ) );
+
+            _guard->pS2->pS1->pEnd = oldEnd;
+        }
+
+        TEST_METHOD( PointerMapChains )
+        {
+            Process proc;
+            AssertEx::NtSuccess( proc.Attach( GetCurrentProcessId() ) );
+
+            g_object = _object;
+
+            PointerMap map( proc );
+            AssertEx::NtSuccess( map.Build() );
+            AssertEx::IsTrue( map.size() > 0 );
+            AssertEx::IsFalse( map.Find( reinterpret_cast<ptr_t>(_object) ).empty() );
+
+            PointerSearchOptions options;
+            options.maxOffset = 0x40;
+            options.maxResults = 1000;
+
+            std::vector<PointerChain> chains;
+            auto target = reinterpret_cast<ptr_t>(&_guard->pS2->pS1->pEnd->fval);
+            AssertEx::NtSuccess( map.FindChains( target, chains, options ) );
+
+            auto iter = std::find_if( chains.begin(), chains.end(), []( const PointerChain& chain ) { return chain.base == reinterpret_cast<ptr_t>(&g_object); } );
+            AssertEx::IsTrue( iter != chains.end() );
+            AssertEx::AreEqual( size_t( 4 ), iter->offsets.size() );
+
+            multi_ptr_ex<float> ptr_ex( &proc, static_cast<uintptr_t>(iter->base), iter->offsets );
+            auto pVal_ex = ptr_ex.get();
+            AssertEx::IsNotNull( pVal_ex );
+            AssertEx::AreEqual( _guard->pS2->pS1->pEnd->fval, *pVal_ex, 0.001f );
+
+            g_object = nullptr;
+        }
+
     private:
         s3 * _object;
         std::unique_ptr<s3> _guard;
@@ -20,6 +20,17 @@ namespace Testing
             AssertEx::IsTrue( results.size() > 0 );
         }
 
+        // Scan all allocated process memory using all CPU cores
+        TEST_METHOD( Parallel )
+        {
+            PatternSearch ps1( "\x48\x89\xD0" );
+
+            std::vector<ptr_t> results;
+            ps1.SearchRemoteWhole( _proc, false, 0, results, 0 );
+            AssertEx::IsTrue( results.size() > 0 );
+            AssertEx::IsTrue( std::is_sorted( results.begin(), results.end() ) );
+        }
+
         // Scan only inside 'explorer.exe' module
         TEST_METHOD( WithWildcard )
         {
@@ -33,6 +44,144 @@ namespace Testing
             AssertEx::IsTrue( results.size() > 0 );
         }
 
+        // Scan only executable sections of 'explorer.exe' module
+        TEST_METHOD( ModuleCode )
+        {
+            PatternSearch ps2{ 0x56, 0x57, 0xCC, 0x55 };
+
+            auto pMainMod = _proc.modules().GetMainModule();
+            AssertEx::IsNotNull( pMainMod.get() );
+
+            std::vector<ptr_t> results;
+            ps2.SearchModule( _proc, pMainMod, true, 0xCC, results );
+            AssertEx::IsTrue( results.size() > 0 );
+
+            for (auto address : results)
+                AssertEx::IsTrue( address >= pMainMod->baseAddress && address < pMainMod->baseAddress + pMainMod->size );
+        }
+
+        // IDA-style pattern inside 'explorer.exe' module
+        TEST_METHOD( FromString )
+        {
+            auto ps3 = PatternSearch::FromString( "56 57 ?? 55" );
+            AssertEx::IsTrue( ps3.success() );
+
+            auto pMainMod = _proc.modules().GetMainModule();
+            AssertEx::IsNotNull( pMainMod.get() );
+
+            std::vector<ptr_t> results;
+            ps3->SearchRemote( _proc, ps3->wildcard(), pMainMod->baseAddress, pMainMod->size, results );
+            AssertEx::IsTrue( results.size() > 0 );
+
+            AssertEx::IsFalse( PatternSearch::FromString( "56 5Z" ).success() );
+        }
+
+#ifdef BLACKBONE_SIGNATURE_LITERALS
+        // Compile-time signature gives the same results as run-time pattern
+        TEST_METHOD( SignatureLiteral )
+        {
+            constexpr auto sig = "56 57 ?? 55"_sig;
+            static_assert(sig.size() == 4 && sig.mask[2] == 0);
+
+            auto pMainMod = _proc.modules().GetMainModule();
+            AssertEx::IsNotNull( pMainMod.get() );
+
+            std::vector<uint8_t> buf( pMainMod->size );
+            AssertEx::NtSuccess( _proc.memory().Read( pMainMod->baseAddress, buf.size(), buf.data(), true ) );
+
+            std::vector<ptr_t> expected, results;
+            PatternSearch{ 0x56, 0x57, 0xCC, 0x55 }.Search( 0xCC, buf.data(), buf.size(), expected, pMainMod->baseAddress );
+            sig.Search( buf.data(), buf.size(), results, pMainMod->baseAddress );
+
+            AssertEx::IsTrue( results.size() > 0 );
+            AssertEx::IsTrue( results == expected );
+            AssertEx::AreEqual( expected.front(), sig.SearchFirst( buf.data(), buf.size(), pMainMod->baseAddress ) );
+        }
+#endif
+
+        // Scan ntdll file on disk, result must match RVA in loaded module
+        TEST_METHOD( OfflineFile )
+        {
+            auto hNtdll = GetModuleHandleW( L"ntdll.dll" );
+            auto pClose = reinterpret_cast<const uint8_t*>(GetProcAddress( hNtdll, "NtClose" ));
+            AssertEx::IsNotNull( pClose );
+
+            wchar_t sysDir[MAX_PATH] = { 0 };
+            GetSystemDirectoryW( sysDir, MAX_PATH );
+            std::wstring ntdllPath = std::wstring( sysDir ) + L"\\ntdll.dll";
+
+            PatternSearch ps( pClose, 16 );
+            FileScanner scanner( ps, false, 0 );
+
+            std::vector<FileScanResult> results;
+            AssertEx::NtSuccess( scanner.ScanMany( { ntdllPath, ntdllPath + L".missing" }, results ) );
+            AssertEx::AreEqual( size_t( 2 ), results.size() );
+            AssertEx::NtSuccess( results[0].status );
+            AssertEx::IsFalse( NT_SUCCESS( results[1].status ) );
+
+            auto rva = static_cast<ptr_t>(pClose - reinterpret_cast<const uint8_t*>(hNtdll));
+            auto iter = std::find_if( results[0].matches.begin(), results[0].matches.end(), [rva]( const auto& m ) { return m.address == rva; } );
+            AssertEx::IsTrue( iter != results[0].matches.end() );
+        }
+
+        // Find heap value in own process, then narrow by change
+        TEST_METHOD( ValueScan )
+        {
+            Process self;
+            AssertEx::NtSuccess( self.Attach( GetCurrentProcessId() ) );
+
+            auto pValue = std::make_unique<int32_t>( 0x13572468 );
+            auto address = reinterpret_cast<ptr_t>(pValue.get());
+
+            RegionFilter filter;
+            filter.protection = PAGE_READWRITE;
+            filter.type = MEM_PRIVATE;
+
+            ValueScanner scanner( self, ScanValueType::Int32 );
+            AssertEx::NtSuccess( scanner.FirstScan( ScanCompare::Equal, *pValue, ScanValue(), filter ) );
+            AssertEx::IsTrue( scanner.count() > 0 );
+            auto firstRead = scanner.bytesRead();
+
+            *pValue += 5;
+            AssertEx::NtSuccess( scanner.NextScan( ScanCompare::Increased ) );
+            AssertEx::NtSuccess( scanner.NextScan( ScanCompare::Range, 0x13572468, 0x1357246F ) );
+
+            auto found = scanner.results();
+            AssertEx::IsTrue( std::find( found.begin(), found.end(), address ) != found.end() );
+            AssertEx::IsTrue( scanner.bytesRead() < firstRead );
+        }
+
+        // Extract ASCII and UTF-16 strings from own heap buffer
+        TEST_METHOD( Strings )
+        {
+            Process self;
+            AssertEx::NtSuccess( self.Attach( GetCurrentProcessId() ) );
+
+            const char ascii[] = "BlackBoneAsciiMarker";
+            const wchar_t wide[] = L"BlackBoneWideMarker";
+
+            std::vector<uint8_t> buf( 0x4000, 0xFF );
+            memcpy( buf.data() + 0x100, ascii, sizeof( ascii ) );
+            memcpy( buf.data() + 0x3000, wide, sizeof( wide ) );
+
+            StringScanOptions options;
+            options.minLength = 8;
+            options.filter.minAddress = reinterpret_cast<ptr_t>(buf.data());
+            options.filter.maxAddress = options.filter.minAddress + buf.size();
+
+            std::vector<FoundString> found;
+            StringExtractor extractor( options );
+            extractor.Extract( self, found );
+
+            auto iterAscii = std::find_if( found.begin(), found.end(), []( const FoundString& s ) { return s.encoding == StringAscii && s.text == "BlackBoneAsciiMarker"; } );
+            auto iterWide = std::find_if( found.begin(), found.end(), []( const FoundString& s ) { return s.encoding == StringUtf16 && s.text == "BlackBoneWideMarker"; } );
+
+            AssertEx::IsTrue( iterAscii != found.end() );
+            AssertEx::IsTrue( iterWide != found.end() );
+            AssertEx::AreEqual( reinterpret_cast<ptr_t>(buf.data() + 0x100), iterAscii->address );
+            AssertEx::AreEqual( reinterpret_cast<ptr_t>(buf.data() + 0x3000), iterWide->address );
+        }
+
     private:
         Process _proc;
     };
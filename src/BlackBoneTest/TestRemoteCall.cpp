@@ -154,6 +154,423 @@ namespace Testing
             AssertEx::AreNotEqual( name.npos, name.rfind( Utils::StripPath( path ) ) );
         }
 
+        TEST_METHOD( RingCall )
+        {
+            auto path = GetTestHelperHost();
+            AssertEx::IsTrue( Utils::FileExists( path ) );
+
+            Process process;
+            AssertEx::NtSuccess( process.CreateAndAttach( path ) );
+            Sleep( 100 );
+
+            auto& ring = process.remote().ring();
+            AssertEx::NtSuccess( ring.Open() );
+
+            auto pGetPid = process.modules().GetExport( L"kernel32.dll", "GetCurrentProcessId" );
+            auto pToDosError = process.modules().GetExport( L"ntdll.dll", "RtlNtStatusToDosError" );
+            AssertEx::IsTrue( pGetPid.success() && pToDosError.success() );
+
+            auto getPid = ring.RegisterStub( pGetPid->procAddress, 0 );
+            auto toDosError = ring.RegisterStub( pToDosError->procAddress, 1 );
+            AssertEx::NtSuccess( getPid.status );
+            AssertEx::NtSuccess( toDosError.status );
+
+            auto pid = ring.Call( getPid.result(), {} );
+            AssertEx::NtSuccess( pid.status );
+            AssertEx::AreEqual( static_cast<uint64_t>(process.pid()), pid.result() );
+
+            // Results of posted requests are kept until ring wraps around
+            std::vector<uint32_t> sequences;
+            for (int i = 0; i < 32; i++)
+            {
+                auto seq = ring.Post( toDosError.result(), { static_cast<uint64_t>(STATUS_ACCESS_DENIED) } );
+                AssertEx::NtSuccess( seq.status );
+                sequences.emplace_back( seq.result() );
+            }
+
+            for (auto seq : sequences)
+            {
+                auto result = ring.Wait( seq );
+                AssertEx::NtSuccess( result.status );
+                AssertEx::AreEqual( static_cast<uint64_t>(ERROR_ACCESS_DENIED), result.result() );
+            }
+
+            ring.Close();
+            process.Terminate();
+        }
+
+        TEST_METHOD( BatchCall )
+        {
+            auto path = GetTestHelperHost();
+            AssertEx::IsTrue( Utils::FileExists( path ) );
+
+            Process process;
+            AssertEx::NtSuccess( process.CreateAndAttach( path ) );
+            Sleep( 100 );
+
+            AssertEx::NtSuccess( process.remote().CreateRPCEnvironment( Worker_CreateNew, true ) );
+
+            auto setLastError = MakeRemoteFunction<decltype(&SetLastError)>( process, L"kernel32.dll", "SetLastError" );
+            auto getPid = MakeRemoteFunction<decltype(&GetCurrentProcessId)>( process, L"kernel32.dll", "GetCurrentProcessId" );
+            auto strLen = MakeRemoteFunction<decltype(&lstrlenW)>( process, L"kernel32.dll", "lstrlenW" );
+            AssertEx::IsTrue( setLastError.valid() && getPid.valid() && strLen.valid() );
+
+            auto batch = process.remote().Batch();
+            for (int i = 0; i < 16; i++)
+            {
+                setLastError.Enqueue( batch, static_cast<DWORD>(ERROR_ACCESS_DENIED) );
+                getPid.Enqueue( batch );
+                strLen.Enqueue( batch, L"BatchCall" );
+            }
+
+            AssertEx::AreEqual( size_t( 48 ), batch.size() );
+            AssertEx::NtSuccess( batch.Execute( process.remote().getWorker() ) );
+            AssertEx::AreEqual( size_t( 48 ), batch.results().size() );
+
+            for (size_t i = 0; i < batch.size(); i += 3)
+            {
+                AssertEx::AreEqual( static_cast<uint32_t>(ERROR_ACCESS_DENIED), batch.results()[i].lastError );
+                AssertEx::AreEqual( process.pid(), batch.value<DWORD>( i + 1 ) );
+                AssertEx::AreEqual( 9, batch.value<int>( i + 2 ) );
+            }
+
+            process.Terminate();
+        }
+
+        TEST_METHOD( AsyncCall )
+        {
+            auto path = GetTestHelperHost();
+            AssertEx::IsTrue( Utils::FileExists( path ) );
+
+            // Calls into several processes are kept in flight at once
+            Process processes[2];
+            for (auto& process : processes)
+                AssertEx::NtSuccess( process.CreateAndAttach( path ) );
+
+            Sleep( 100 );
+
+            std::vector<std::future<call_result_t<DWORD>>> futures;
+            for (auto& process : processes)
+            {
+                auto getPid = MakeRemoteFunction<decltype(&GetCurrentProcessId)>( process, L"kernel32.dll", "GetCurrentProcessId" );
+                AssertEx::IsTrue( getPid.valid() );
+
+                futures.emplace_back( getPid.CallAsync() );
+            }
+
+            for (size_t i = 0; i < futures.size(); i++)
+            {
+                auto pid = futures[i].get();
+                AssertEx::NtSuccess( pid.status );
+                AssertEx::AreEqual( processes[i].pid(), pid.result() );
+            }
+
+            // Next call waits for previous completion
+            auto toDosError = MakeRemoteFunction<ULONG( NTAPI* )(NTSTATUS)>( processes[0], L"ntdll.dll", "RtlNtStatusToDosError" );
+            auto first = toDosError.CallAsync( STATUS_ACCESS_DENIED );
+            auto second = toDosError.Call( { STATUS_OBJECT_NAME_NOT_FOUND }, processes[0].remote().getWorker() );
+
+            auto firstResult = first.get();
+            AssertEx::NtSuccess( firstResult.status );
+            AssertEx::NtSuccess( second.status );
+            AssertEx::AreEqual( static_cast<ULONG>(ERROR_ACCESS_DENIED), firstResult.result() );
+            AssertEx::AreEqual( static_cast<ULONG>(ERROR_FILE_NOT_FOUND), second.result() );
+
+            // Pointer arguments are copied into shared data block, pending call keeps its copy
+            auto strLen = MakeRemoteFunction<decltype(&lstrlenW)>( processes[0], L"kernel32.dll", "lstrlenW" );
+            AssertEx::IsTrue( strLen.valid() );
+
+            auto longer = strLen.CallAsync( L"asynchronous argument" );
+            auto shorter = strLen.CallAsync( L"abc" );
+            auto sync = strLen.Call( { L"abcdef" }, processes[0].remote().getWorker() );
+
+            auto longerResult = longer.get();
+            auto shorterResult = shorter.get();
+            AssertEx::NtSuccess( longerResult.status );
+            AssertEx::NtSuccess( shorterResult.status );
+            AssertEx::NtSuccess( sync.status );
+            AssertEx::AreEqual( 21, longerResult.result() );
+            AssertEx::AreEqual( 3, shorterResult.result() );
+            AssertEx::AreEqual( 6, sync.result() );
+
+            for (auto& process : processes)
+                process.Terminate();
+        }
+
+#ifdef BLACKBONE_COROUTINES
+        TEST_METHOD( CoroutineCall )
+        {
+            auto path = GetTestHelperHost();
+            AssertEx::IsTrue( Utils::FileExists( path ) );
+
+            Process processes[2];
+            for (auto& process : processes)
+                AssertEx::NtSuccess( process.CreateAndAttach( path ) );
+
+            Sleep( 100 );
+
+            // Two scheduler threads drive both targets, no thread is blocked while calls are in flight
+            TaskScheduler scheduler( 2 );
+            AsyncMemory async( 1 );
+            std::atomic<int> passed = 0;
+
+            auto work = [&scheduler, &async, &passed]( Process& process ) -> Task<void>
+            {
+                auto getPid = MakeRemoteFunction<decltype(&GetCurrentProcessId)>( process, L"kernel32.dll", "GetCurrentProcessId" );
+                auto pid = co_await getPid.CallAsync( scheduler );
+                if (!NT_SUCCESS( pid.status ) || pid.result() != process.pid())
+                    co_return;
+
+                IMAGE_DOS_HEADER hdr = { 0 };
+                auto status = co_await ReadAsync( scheduler, async, process.memory(), process.modules().GetMainModule()->baseAddress, sizeof( hdr ), &hdr );
+                if (NT_SUCCESS( status ) && hdr.e_magic == IMAGE_DOS_SIGNATURE)
+                    passed++;
+            };
+
+            for (auto& process : processes)
+                scheduler.Spawn( work( process ) );
+
+            AssertEx::IsTrue( scheduler.Wait( 10 * 1000 ) );
+            AssertEx::AreEqual( 2, passed.load() );
+
+            for (auto& process : processes)
+                process.Terminate();
+        }
+#endif
+
+        TEST_METHOD( PoolCall )
+        {
+            auto path = GetTestHelperHost();
+            AssertEx::IsTrue( Utils::FileExists( path ) );
+
+            Process process;
+            AssertEx::NtSuccess( process.CreateAndAttach( path ) );
+            Sleep( 100 );
+
+            auto& pool = process.remote().pool();
+            AssertEx::NtSuccess( pool.Start( 4 ) );
+            AssertEx::AreEqual( size_t( 4 ), pool.size() );
+
+            auto sleep = MakeRemoteFunction<decltype(&Sleep)>( process, L"kernel32.dll", "Sleep" );
+            auto getPid = MakeRemoteFunction<decltype(&GetCurrentProcessId)>( process, L"kernel32.dll", "GetCurrentProcessId" );
+            AssertEx::IsTrue( sleep.valid() && getPid.valid() );
+
+            // Independent long calls run in parallel
+            std::vector<std::thread> threads;
+            std::atomic<int> failed( 0 );
+            auto start = GetTickCount64();
+
+            for (int i = 0; i < 4; i++)
+            {
+                threads.emplace_back( [&]()
+                {
+                    if (!sleep.Call( { 500 }, pool ))
+                        failed++;
+                } );
+            }
+
+            for (auto& thread : threads)
+                thread.join();
+
+            AssertEx::AreEqual( 0, failed.load() );
+            AssertEx::IsTrue( GetTickCount64() - start < 4 * 500 );
+
+            auto pid = getPid.Call( {}, pool );
+            AssertEx::NtSuccess( pid.status );
+            AssertEx::AreEqual( process.pid(), pid.result() );
+
+            pool.Stop();
+            process.Terminate();
+        }
+
+        TEST_METHOD( ConcurrentCall )
+        {
+            auto path = GetTestHelperHost();
+            AssertEx::IsTrue( Utils::FileExists( path ) );
+
+            Process process;
+            AssertEx::NtSuccess( process.CreateAndAttach( path ) );
+            Sleep( 100 );
+
+            auto getPid = MakeRemoteFunction<decltype(&GetCurrentProcessId)>( process, L"kernel32.dll", "GetCurrentProcessId" );
+            AssertEx::IsTrue( getPid.valid() );
+
+            // Calls through shared worker thread are serialized by RemoteExec
+            std::vector<std::thread> threads;
+            std::atomic<int> failed( 0 );
+
+            for (int i = 0; i < 8; i++)
+            {
+                threads.emplace_back( [&]()
+                {
+                    for (int j = 0; j < 20; j++)
+                    {
+                        auto pid = getPid.Call();
+                        if (!pid || pid.result() != process.pid())
+                            failed++;
+                    }
+                } );
+            }
+
+            for (auto& thread : threads)
+                thread.join();
+
+            AssertEx::AreEqual( 0, failed.load() );
+            process.Terminate();
+        }
+
+        TEST_METHOD( CachedStubCall )
+        {
+            auto path = GetTestHelperHost();
+            AssertEx::IsTrue( Utils::FileExists( path ) );
+
+            Process process;
+            AssertEx::NtSuccess( process.CreateAndAttach( path ) );
+            Sleep( 100 );
+
+            auto& remote = process.remote();
+            AssertEx::NtSuccess( remote.CreateRPCEnvironment( Worker_CreateNew, true ) );
+
+            auto toDosError = MakeRemoteFunction<ULONG( NTAPI* )(NTSTATUS)>( process, L"ntdll.dll", "RtlNtStatusToDosError" );
+            auto strLen = MakeRemoteFunction<decltype(&lstrlenW)>( process, L"kernel32.dll", "lstrlenW" );
+            AssertEx::IsTrue( toDosError.valid() && strLen.valid() );
+
+            // Stub is generated once, only arguments differ
+            for (int i = 0; i < 16; i++)
+            {
+                auto status = (i % 2) ? STATUS_ACCESS_DENIED : STATUS_OBJECT_NAME_NOT_FOUND;
+                auto expected = (i % 2) ? ERROR_ACCESS_DENIED : ERROR_FILE_NOT_FOUND;
+
+                auto result = toDosError.Call( { status }, remote.getWorker() );
+                AssertEx::NtSuccess( result.status );
+                AssertEx::AreEqual( static_cast<ULONG>(expected), result.result() );
+            }
+
+            AssertEx::AreEqual( size_t( 1 ), remote.cachedStubs() );
+
+            auto len = strLen.Call( { L"CachedStubCall" }, remote.getWorker() );
+            AssertEx::NtSuccess( len.status );
+            AssertEx::AreEqual( 14, len.result() );
+            AssertEx::AreEqual( size_t( 2 ), remote.cachedStubs() );
+
+            process.Terminate();
+        }
+
+        TEST_METHOD( RemoteBufferArgs )
+        {
+            auto path = GetTestHelperHost();
+            AssertEx::IsTrue( Utils::FileExists( path ) );
+
+            Process process;
+            AssertEx::NtSuccess( process.CreateAndAttach( path ) );
+            Sleep( 100 );
+
+            auto& remote = process.remote();
+            AssertEx::NtSuccess( remote.CreateRPCEnvironment( Worker_CreateNew, true ) );
+
+            // Remote block is passed by address without copying
+            const wchar_t text[] = L"RemoteBufferArgs";
+            auto block = process.memory().Allocate( 0x1000, PAGE_READWRITE );
+            AssertEx::NtSuccess( block.status );
+            AssertEx::NtSuccess( block->Write( 0, sizeof( text ), text ) );
+
+            auto strLen = MakeRemoteFunction<decltype(&lstrlenW)>( process, L"kernel32.dll", "lstrlenW" );
+            auto len = strLen.Call( { block.result() }, remote.getWorker() );
+            AssertEx::NtSuccess( len.status );
+            AssertEx::AreEqual( 16, len.result() );
+
+            // Only declared output buffer is read back
+            wchar_t input[32] = L"source";
+            wchar_t output[32] = { 0 };
+
+            auto strCpy = MakeRemoteFunction<decltype(&lstrcpyW)>( process, L"kernel32.dll", "lstrcpyW" );
+            AssertEx::IsTrue( strCpy.valid() );
+
+            auto copy = strCpy.Call( { AsmVariant::out( output, sizeof( output ) ), AsmVariant::in( input, sizeof( input ) ) }, remote.getWorker() );
+            AssertEx::NtSuccess( copy.status );
+            AssertEx::AreEqual( std::wstring( L"source" ), std::wstring( output ) );
+
+            auto swapped = strCpy.Call( { AsmVariant::in( output, sizeof( output ) ), L"changed" }, remote.getWorker() );
+            AssertEx::NtSuccess( swapped.status );
+            AssertEx::AreEqual( std::wstring( L"source" ), std::wstring( output ) );
+
+            process.Terminate();
+        }
+
+        TEST_METHOD( ThreadCache )
+        {
+            auto path = GetTestHelperHost();
+            AssertEx::IsTrue( Utils::FileExists( path ) );
+
+            Process process;
+            AssertEx::NtSuccess( process.CreateAndAttach( path ) );
+            Sleep( 100 );
+
+            auto getTid = MakeRemoteFunction<decltype(&GetCurrentThreadId)>( process, L"kernel32.dll", "GetCurrentThreadId" );
+            AssertEx::IsTrue( getTid.valid() );
+
+            // Same thread serves every call
+            process.remote().EnableThreadCache( true );
+
+            auto first = getTid.Call();
+            auto second = getTid.Call();
+            AssertEx::NtSuccess( first.status );
+            AssertEx::NtSuccess( second.status );
+            AssertEx::AreEqual( first.result(), second.result() );
+
+            // Parked thread is terminated, calls create fresh threads again
+            process.remote().EnableThreadCache( false );
+
+            auto third = getTid.Call();
+            AssertEx::NtSuccess( third.status );
+
+            process.Terminate();
+        }
+
+        TEST_METHOD( LightweightThreads )
+        {
+            auto path = GetTestHelperHost();
+            AssertEx::IsTrue( Utils::FileExists( path ) );
+
+            Process process;
+            AssertEx::NtSuccess( process.CreateAndAttach( path ) );
+            Sleep( 100 );
+
+            auto getTid = MakeRemoteFunction<decltype(&GetCurrentThreadId)>( process, L"kernel32.dll", "GetCurrentThreadId" );
+            AssertEx::IsTrue( getTid.valid() );
+
+            // Small stack, no DLL_THREAD_ATTACH
+            process.remote().SetThreadOptions( ThreadCreateOptions::Lightweight() );
+
+            auto result = getTid.Call();
+            AssertEx::NtSuccess( result.status );
+            AssertEx::IsNotZero( result.result() );
+
+            auto thread = process.threads().CreateNew( process.modules().GetExport( L"kernel32.dll", "Sleep" )->procAddress, 0, ThreadCreateOptions::Lightweight() );
+            AssertEx::IsTrue( thread.success() );
+            AssertEx::IsTrue( (*thread)->Join( 1000 ) );
+
+            process.Terminate();
+        }
+
+        TEST_METHOD( HijackCandidates )
+        {
+            auto path = GetTestHelperHost();
+            AssertEx::IsTrue( Utils::FileExists( path ) );
+
+            Process process;
+            AssertEx::NtSuccess( process.CreateAndAttach( path ) );
+            Sleep( 100 );
+
+            AssertEx::NtSuccess( process.remote().RefreshHijackCandidates() );
+
+            // Hijack target is taken from candidate list
+            AssertEx::NtSuccess( process.remote().CreateRPCEnvironment( Worker_UseExisting, true ) );
+            AssertEx::IsNotNull( process.remote().getExecThread().get() );
+
+            process.Terminate();
+        }
+
         TEST_METHOD( FileOP )
         {
             auto path = GetTestHelperHost();
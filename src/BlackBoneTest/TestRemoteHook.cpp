@@ -38,8 +38,14 @@ namespace Testing
             calls++;
         }
 
+        void HookCount( RemoteContext& )
+        {
+            asyncCalls++;
+        }
+
         Process process;
         int calls = 0;
+        std::atomic<int> asyncCalls{ 0 };
     };
 
     TEST_CLASS( RemoteHooking )
@@ -105,5 +111,163 @@ namespace Testing
 
             AssertEx::AreEqual( 1, hooker.calls );
         }
+
+        TEST_METHOD( FilteredHook )
+        {
+            HookClass hooker;
+
+            auto path = GetTestHelperHost();
+            AssertEx::IsFalse( path.empty() );
+
+            // Give process some time to initialize
+            AssertEx::NtSuccess( hooker.process.CreateAndAttach( path ) );
+            Sleep( 100 );
+
+            auto pHookFn = hooker.process.modules().GetNtdllExport( "NtAllocateVirtualMemory" );
+            AssertEx::IsTrue( pHookFn.success() );
+
+            PVOID base = nullptr;
+            SIZE_T size = 0xDEAD;
+            auto NtAllocateVirtualMemory = MakeRemoteFunction<NTSTATUS( __stdcall * )(HANDLE, PVOID*, ULONG_PTR, PSIZE_T, ULONG, ULONG)>( hooker.process, pHookFn->procAddress );
+
+            // Only executable allocations stop the target
+            std::vector<RemoteHook::Condition> conditions = { RemoteHook::Condition::arg( 5, RemoteHook::Condition::Equal, PAGE_EXECUTE_READWRITE ) };
+            AssertEx::NtSuccess( hooker.process.hooks().ApplyFiltered( pHookFn->procAddress, conditions, &HookClass::HookNtAllocateVirtualMemory, hooker ) );
+
+            auto result = NtAllocateVirtualMemory.Call( { GetCurrentProcess(), &base, 0, &size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE } );
+            AssertEx::NtSuccess( result.status );
+            AssertEx::AreEqual( 0, hooker.calls );
+
+            base = nullptr;
+            size = 0xDEAD;
+            result = NtAllocateVirtualMemory.Call( { GetCurrentProcess(), &base, 0, &size, MEM_RESERVE | MEM_COMMIT, PAGE_EXECUTE_READWRITE } );
+            AssertEx::NtSuccess( result.status );
+
+            hooker.process.hooks().Remove( pHookFn->procAddress );
+            hooker.process.Terminate();
+
+            AssertEx::AreEqual( 1, hooker.calls );
+        }
+
+        TEST_METHOD( AsyncDispatch )
+        {
+            HookClass hooker;
+
+            auto path = GetTestHelperHost();
+            AssertEx::IsFalse( path.empty() );
+
+            // Give process some time to initialize
+            AssertEx::NtSuccess( hooker.process.CreateAndAttach( path ) );
+            Sleep( 100 );
+
+            auto pHookFn = hooker.process.modules().GetNtdllExport( "NtAllocateVirtualMemory" );
+            AssertEx::IsTrue( pHookFn.success() );
+
+            PVOID base = nullptr;
+            SIZE_T size = 0xDEAD;
+            auto NtAllocateVirtualMemory = MakeRemoteFunction<NTSTATUS( __stdcall * )(HANDLE, PVOID*, ULONG_PTR, PSIZE_T, ULONG, ULONG)>( hooker.process, pHookFn->procAddress );
+
+            // Callback runs on worker thread, call isn't held back by it
+            AssertEx::NtSuccess( hooker.process.hooks().EnableAsyncDispatch() );
+            AssertEx::NtSuccess( hooker.process.hooks().Apply( RemoteHook::hwbp, pHookFn->procAddress, &HookClass::HookCount, hooker ) );
+            auto result = NtAllocateVirtualMemory.Call( { GetCurrentProcess(), &base, 0, &size, MEM_RESERVE | MEM_COMMIT, PAGE_EXECUTE_READWRITE } );
+            AssertEx::NtSuccess( result.status );
+
+            // Queued callbacks are completed
+            hooker.process.hooks().DisableAsyncDispatch();
+            hooker.process.Terminate();
+
+            AssertEx::AreEqual( 1, hooker.asyncCalls.load() );
+        }
+
+        TEST_METHOD( ApplyMany )
+        {
+            HookClass hooker;
+
+            auto path = GetTestHelperHost();
+            AssertEx::IsFalse( path.empty() );
+
+            // Give process some time to initialize
+            AssertEx::NtSuccess( hooker.process.CreateAndAttach( path ) );
+            Sleep( 100 );
+
+            std::vector<RemoteHook::HookSpec> specs;
+            std::vector<uint8_t> original;
+            for (auto name : { "NtAllocateVirtualMemory", "NtQueryVirtualMemory", "NtProtectVirtualMemory" })
+            {
+                auto pHookFn = hooker.process.modules().GetNtdllExport( name );
+                AssertEx::IsTrue( pHookFn.success() );
+
+                RemoteHook::HookSpec spec;
+                spec.type = RemoteHook::int3;
+                spec.address = pHookFn->procAddress;
+                spec.callback = brutal_cast<RemoteHook::fnCallback>(&HookClass::HookCount);
+                spec.classPtr = &hooker;
+                specs.emplace_back( spec );
+
+                original.emplace_back( hooker.process.memory().Read<uint8_t>( spec.address ).result() );
+            }
+
+            AssertEx::NtSuccess( hooker.process.hooks().ApplyMany( specs ) );
+            for (auto& spec : specs)
+                AssertEx::AreEqual( uint8_t( 0xCC ), hooker.process.memory().Read<uint8_t>( spec.address ).result() );
+
+            PVOID base = nullptr;
+            SIZE_T size = 0xDEAD;
+            auto NtAllocateVirtualMemory = MakeRemoteFunction<NTSTATUS( __stdcall * )(HANDLE, PVOID*, ULONG_PTR, PSIZE_T, ULONG, ULONG)>( hooker.process, specs[0].address );
+            AssertEx::NtSuccess( NtAllocateVirtualMemory.Call( { GetCurrentProcess(), &base, 0, &size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE } ).status );
+            AssertEx::IsTrue( hooker.asyncCalls.load() >= 1 );
+
+            for (size_t i = 0; i < specs.size(); i++)
+            {
+                hooker.process.hooks().Remove( specs[i].address );
+                AssertEx::AreEqual( original[i], hooker.process.memory().Read<uint8_t>( specs[i].address ).result() );
+            }
+
+            hooker.process.Terminate();
+        }
+
+        TEST_METHOD( LocalTrace )
+        {
+            Process process;
+
+            auto path = GetTestHelperHost();
+            AssertEx::IsFalse( path.empty() );
+
+            // Give process some time to initialize
+            AssertEx::NtSuccess( process.CreateAndAttach( path ) );
+            Sleep( 100 );
+
+            auto pHookFn = process.modules().GetNtdllExport( "NtAllocateVirtualMemory" );
+            AssertEx::IsTrue( pHookFn.success() );
+
+            // No debugger is attached, calls are recorded by target threads
+            auto& hooks = process.localHooks();
+            AssertEx::NtSuccess( hooks.OpenTrace( 0x100 ) );
+
+            auto id = hooks.AddTrace( pHookFn->procAddress, 6 );
+            AssertEx::NtSuccess( id.status );
+
+            PVOID base = nullptr;
+            SIZE_T size = 0xDEAD;
+            auto NtAllocateVirtualMemory = MakeRemoteFunction<NTSTATUS( __stdcall * )(HANDLE, PVOID*, ULONG_PTR, PSIZE_T, ULONG, ULONG)>( process, pHookFn->procAddress );
+            AssertEx::NtSuccess( NtAllocateVirtualMemory.Call( { GetCurrentProcess(), &base, 0, &size, MEM_RESERVE | MEM_COMMIT, PAGE_EXECUTE_READWRITE } ).status );
+
+            std::vector<LocalHookRecord> records;
+            hooks.Consume( records );
+
+            bool found = false;
+            for (auto& record : records)
+            {
+                AssertEx::AreEqual( id.result(), record.hookId );
+                if (record.args[4] == (MEM_RESERVE | MEM_COMMIT) && record.args[5] == PAGE_EXECUTE_READWRITE)
+                    found = true;
+            }
+
+            AssertEx::IsTrue( found );
+            AssertEx::NtSuccess( hooks.Remove( id.result() ) );
+
+            process.Terminate();
+        }
     };
 }
\ No newline at end of file
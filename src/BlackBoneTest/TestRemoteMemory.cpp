@@ -34,5 +34,90 @@ namespace Testing
             AssertEx::NtSuccess( proc.memory().SetupHook( RemoteMemory::MemMapSection ) );
             AssertEx::NtSuccess( proc.memory().SetupHook( RemoteMemory::MemUnmapSection ) );
         }
+
+        TEST_METHOD( Refresh )
+        {
+            Process proc;
+
+            NTSTATUS status = Driver().EnsureLoaded();
+            if (!NT_SUCCESS( status ))
+            {
+                AssertEx::AreEqual( STATUS_OBJECT_NAME_NOT_FOUND, status );
+                return;
+            }
+
+            AssertEx::NtSuccess( proc.Attach( L"explorer.exe" ) );
+            AssertEx::NtSuccess( proc.memory().Map( false ) );
+
+            auto mem = proc.memory().Allocate( 0x1000, PAGE_READWRITE );
+            AssertEx::NtSuccess( mem.status );
+            AssertEx::IsZero( proc.memory().TranslateAddress( mem->ptr(), false ) );
+
+            // New region is picked up without remapping everything
+            AssertEx::NtSuccess( proc.memory().Refresh( false ) );
+            AssertEx::IsNotZero( proc.memory().TranslateAddress( mem->ptr(), false ) );
+
+            // Released region is dropped
+            auto ptr = mem->ptr();
+            AssertEx::NtSuccess( mem->Free() );
+            AssertEx::NtSuccess( proc.memory().Refresh( false ) );
+            AssertEx::IsZero( proc.memory().TranslateAddress( ptr, false ) );
+
+            AssertEx::NtSuccess( proc.memory().Unmap() );
+        }
+
+        TEST_METHOD( Lazy )
+        {
+            Process proc;
+
+            NTSTATUS status = Driver().EnsureLoaded();
+            if (!NT_SUCCESS( status ))
+            {
+                AssertEx::AreEqual( STATUS_OBJECT_NAME_NOT_FOUND, status );
+                return;
+            }
+
+            AssertEx::NtSuccess( proc.Attach( L"explorer.exe" ) );
+            AssertEx::NtSuccess( proc.memory().Map( false, true ) );
+
+            // Nothing is mapped until first translation
+            auto addr = proc.modules().GetMainModule()->baseAddress;
+            AssertEx::IsZero( proc.memory().TranslateAddress( addr, false ) );
+
+            auto translated = proc.memory().TranslateAddress( addr );
+            AssertEx::IsNotZero( translated );
+            AssertEx::AreEqual( static_cast<WORD>(IMAGE_DOS_SIGNATURE), reinterpret_cast<PIMAGE_DOS_HEADER>(translated)->e_magic );
+
+            AssertEx::NtSuccess( proc.memory().Unmap() );
+        }
+
+        TEST_METHOD( View )
+        {
+            Process proc;
+            AssertEx::NtSuccess( proc.Attach( L"explorer.exe" ) );
+
+            auto base = proc.modules().GetMainModule()->baseAddress;
+            auto dosHdr = proc.memory().Read<IMAGE_DOS_HEADER>( base );
+            AssertEx::IsTrue( dosHdr.success() );
+
+            // Not mapped, data is copied
+            MappedView<IMAGE_DOS_HEADER> copied( proc.memory(), base );
+            AssertEx::IsTrue( copied.valid() );
+            AssertEx::IsFalse( copied.direct() );
+            AssertEx::AreEqual( dosHdr->e_lfanew, copied->e_lfanew );
+
+            NTSTATUS status = Driver().EnsureLoaded();
+            if (!NT_SUCCESS( status ))
+            {
+                AssertEx::AreEqual( STATUS_OBJECT_NAME_NOT_FOUND, status );
+                return;
+            }
+
+            AssertEx::NtSuccess( proc.memory().Map( false ) );
+
+            MappedView<IMAGE_DOS_HEADER> mapped( proc.memory(), base );
+            AssertEx::IsTrue( mapped.direct() );
+            AssertEx::AreEqual( dosHdr->e_lfanew, mapped->e_lfanew );
+        }
     };
 }
\ No newline at end of file
@@ -68,5 +68,28 @@ namespace Testing
             AssertEx::AreEqual( name, title );
 #endif
         }
+
+        TEST_METHOD( DirectSyscallProcess )
+        {
+            Process proc;
+            AssertEx::NtSuccess( proc.Attach( GetCurrentProcessId(), DEFAULT_ACCESS_P, true ) );
+
+#ifdef USE64
+            AssertEx::IsTrue( dynamic_cast<NativeSyscall*>(proc.core().native()) != nullptr );
+#endif
+
+            volatile uint64_t value = 0x1122334455667788;
+            uint64_t result = 0;
+            AssertEx::NtSuccess( proc.memory().Read( reinterpret_cast<ptr_t>(&value), result ) );
+            AssertEx::AreEqual( static_cast<uint64_t>(value), result );
+
+            MEMORY_BASIC_INFORMATION64 mbi = { };
+            AssertEx::NtSuccess( proc.core().native()->VirtualQueryExT( reinterpret_cast<ptr_t>(&value), &mbi ) );
+            AssertEx::AreEqual( static_cast<DWORD>(MEM_COMMIT), mbi.State );
+
+            auto mem = proc.memory().Allocate( 0x1000, PAGE_READWRITE );
+            AssertEx::IsTrue( mem.success() );
+            AssertEx::NtSuccess( mem->Protect( PAGE_READONLY ) );
+        }
     };
 }
\ No newline at end of file